@@ -57,6 +57,8 @@ BASE_SCRIPTS= [
     'wallet_listreceived.py',
     'mempool_tx_expiry.py',
     'finalsaplingroot.py',
+    'feature_pipelineblockconnect.py',
+    'mempool_proofbatch.py',
     'wallet_orchard.py',
     'wallet_overwintertx.py',
     'wallet_persistence.py',
@@ -87,6 +89,7 @@ BASE_SCRIPTS= [
     'wallet_unified_change.py',
     'listtransactions.py',
     'mempool_resurrect_test.py',
+    'mempool_resurrect_remined.py',
     'txn_doublespend.py',
     'txn_doublespend.py --mineblock',
     'getchaintips.py',
@@ -111,6 +114,7 @@ BASE_SCRIPTS= [
     'timestampindex.py',
     'decodescript.py',
     'blockchain.py',
+    'getstartupinfo.py',
     'disablewallet.py',
     'keypool.py',
     'getblocktemplate.py',
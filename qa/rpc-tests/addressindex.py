@@ -128,6 +128,22 @@ class AddressIndexTest(BitcoinTestFramework):
         assert_equal(len(self.nodes[3].getaddresstxids(addr_p2pkh)), 105)
         assert_equal(len(self.nodes[3].getaddresstxids(addr_p2sh)), 105)
 
+        # paging through the txids returns each of them once, in pages
+        paged_txids = []
+        cursor = None
+        while True:
+            params = {'addresses': [addr_p2pkh], 'limit': 40}
+            if cursor is not None:
+                params['cursor'] = cursor
+            page = self.nodes[1].getaddresstxids(params)
+            assert(len(page['txids']) <= 40)
+            paged_txids += page['txids']
+            if 'cursor' not in page:
+                break
+            cursor = page['cursor']
+        assert_equal(sorted(paged_txids), sorted(self.nodes[1].getaddresstxids(addr_p2pkh)))
+        assert_equal(self.nodes[1].getaddressbalance(addr_p2pkh)['txcount'], 105)
+
         # only the oldest 5 transactions are in the unspent list,
         # dup addresses are ignored
         height_txids = getaddresstxids(1, [addr_p2pkh, addr_p2pkh], 1, 5)
@@ -216,6 +232,13 @@ class AddressIndexTest(BitcoinTestFramework):
         for key in addr1_mempool[0].keys():
             assert_equal(mempool[1][key], addr1_mempool[0][key])
 
+        # the balances can include the change by the mempool
+        bal = self.nodes[0].getaddressbalance({'addresses': [addr1], 'mempool': True})
+        assert_equal(bal['mempoolBalance'], (-4) * COIN)
+        bal = self.nodes[0].getaddressbalance({'addresses': [addr1, addr2], 'mempool': True})
+        assert_equal(bal['mempoolBalance'], (-1) * COIN)
+        assert 'mempoolBalance' not in self.nodes[0].getaddressbalance(addr1)
+
         tx = self.nodes[0].getrawtransaction(txid, 1)
         assert_equal(tx['vin'][0]['address'], addr1)
         assert_equal(tx['vin'][0]['value'], 4)
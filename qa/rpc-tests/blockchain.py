@@ -23,6 +23,8 @@ class BlockchainTest(BitcoinTestFramework):
     Test blockchain-related RPC calls:
 
         - gettxoutsetinfo
+        - waitfornewblock, waitforblock, waitforblockheight
+        - waitformempoolsequence
 
     """
 
@@ -49,6 +51,32 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(len(res['bestblock']), 64)
         assert_equal(len(res['hash_serialized']), 64)
 
+        self._test_wait_methods()
+
+    def _test_wait_methods(self):
+        node = self.nodes[0]
+        tip = {'hash': node.getbestblockhash(), 'height': node.getblockcount()}
+
+        # Conditions that already hold return at once, and timeouts return
+        # the tip as it is.
+        assert_equal(node.waitforblockheight(tip['height']), tip)
+        assert_equal(node.waitforblock(tip['hash']), tip)
+        assert_equal(node.waitfornewblock(100), tip)
+        assert_equal(node.waitfornewblock(0, "00" * 32), tip)
+
+        # A block mined by the other node is seen by the waiting one.
+        self.nodes[1].generate(1)
+        new_tip = node.waitforblockheight(tip['height'] + 1, 60000)
+        assert_equal(new_tip['height'], tip['height'] + 1)
+        assert_equal(new_tip['hash'], self.nodes[1].getbestblockhash())
+        assert_equal(node.waitfornewblock(60000, tip['hash']), new_tip)
+
+        # Each transaction added to the mempool moves the sequence on.
+        sequence = node.waitformempoolsequence(0, 100)['sequence']
+        assert_equal(node.waitformempoolsequence(sequence, 100)['sequence'], sequence)
+        node.sendtoaddress(node.getnewaddress(), 1)
+        assert_equal(node.waitformempoolsequence(sequence, 60000)['sequence'], sequence + 1)
+
 
 if __name__ == '__main__':
     BlockchainTest().main()
@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+# Copyright (c) 2023 The Zcash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#
+# Test that blocks connected through the block connection pipeline
+# (-pipelineblockconnect) are checked as they are without it: the blocks
+# before an invalid block are connected, and the invalid block is rejected.
+# With -proofbatchblocks, the invalid block shares a batch of Sapling proofs
+# with the valid blocks before it. With -blockprefetch, the blocks are read
+# from disk ahead of the block being connected.
+#
+
+from io import BytesIO
+from decimal import Decimal
+import time
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    assert_false,
+    bytes_to_hex_str,
+    connect_nodes_bi,
+    get_coinbase_address,
+    hex_str_to_bytes,
+    start_nodes,
+    sync_blocks,
+    wait_and_assert_operationid_status,
+)
+from test_framework.mininode import CTransaction
+from test_framework.blocktools import create_block
+
+# The nodes that connect blocks through the pipeline, after the miner (node 0).
+PIPELINE_ARGS = [
+    ['-pipelineblockconnect'],
+    ['-proofbatchblocks=4'],
+    ['-blockprefetch=4'],
+]
+
+class PipelineBlockConnectTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.num_nodes = 1 + len(PIPELINE_ARGS)
+        self.setup_clean_chain = True
+
+    def setup_network(self, split=False):
+        # The pipeline only runs during initial block download, so the clocks
+        # of the other nodes are two days ahead of the blocks.
+        mocktime = int(time.time()) + 2 * 24 * 60 * 60
+        args = [[]] + [a + ['-mocktime=%d' % mocktime] for a in PIPELINE_ARGS]
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, args)
+        for i in range(1, self.num_nodes):
+            connect_nodes_bi(self.nodes, 0, i)
+        self.is_network_split = False
+
+    def send_sapling(self, from_addr, to_addr):
+        opid = self.nodes[0].z_sendmany(from_addr, [{'address': to_addr, 'amount': Decimal('1')}], 1, 0)
+        wait_and_assert_operationid_status(self.nodes[0], opid)
+
+    def invalid_proof_block(self):
+        '''
+        A block on node 0's tip with its mempool transactions, in which the
+        proofs of the first Sapling transaction's two outputs are swapped. They
+        are well-formed, but neither is valid for the other output.
+        '''
+        gbt = self.nodes[0].getblocktemplate()
+        coinbase = CTransaction()
+        coinbase.deserialize(BytesIO(hex_str_to_bytes(gbt['coinbasetxn']['data'])))
+        coinbase.calc_sha256()
+        block = create_block(
+            int(gbt['previousblockhash'], 16), coinbase, gbt['curtime'],
+            int(gbt['bits'], 16), int(gbt['finalsaplingroothash'], 16))
+        swapped = False
+        for gbt_tx in gbt['transactions']:
+            tx = CTransaction()
+            tx.deserialize(BytesIO(hex_str_to_bytes(gbt_tx['data'])))
+            if not swapped and len(tx.shieldedOutputs) >= 2:
+                outputs = tx.shieldedOutputs
+                outputs[0].zkproof, outputs[1].zkproof = outputs[1].zkproof, outputs[0].zkproof
+                swapped = True
+            tx.calc_sha256()
+            block.vtx.append(tx)
+        assert(swapped)
+        block.hashMerkleRoot = block.calc_merkle_root()
+        block.solve()
+        block.calc_sha256()
+        return block
+
+    def run_test(self):
+        node0 = self.nodes[0]
+        for node in self.nodes[1:]:
+            assert_false(node.getblockchaininfo()['initial_block_download_complete'])
+
+        # Shield two coinbase outputs, then make a Sapling transaction in
+        # each of the last few blocks.
+        node0.generate(101)
+        sapling_addr0 = node0.z_getnewaddress('sapling')
+        sapling_addr1 = node0.z_getnewaddress('sapling')
+        for i in range(2):
+            opid = node0.z_sendmany(
+                get_coinbase_address(node0), [{'address': sapling_addr0, 'amount': Decimal('10')}], 1, 0)
+            wait_and_assert_operationid_status(node0, opid)
+        node0.generate(1)
+        for i in range(4):
+            self.send_sapling(sapling_addr0, sapling_addr1)
+            node0.generate(1)
+        sync_blocks(self.nodes)
+        tip_height = node0.getblockcount()
+        tip_hash = node0.getbestblockhash()
+
+        # A block spending Sapling notes with an invalid proof, that node 0
+        # does not mine.
+        self.send_sapling(sapling_addr0, sapling_addr1)
+        block = self.invalid_proof_block()
+        block_hex = bytes_to_hex_str(block.serialize())
+
+        for node in self.nodes[1:]:
+            assert_equal(
+                'bad-sapling-bundle-authorization',
+                node.submitblock(block_hex))
+            assert_equal(tip_hash, node.getbestblockhash())
+
+            # Connect the last blocks again, now through the pipeline, which
+            # checks each block ahead of connecting it. With -proofbatchblocks=4
+            # the three blocks before the invalid block are checked in one
+            # batch with it. The invalid block is still rejected, and the
+            # blocks before it stay connected.
+            fork_hash = node.getblockhash(tip_height - 3)
+            node.invalidateblock(fork_hash)
+            assert_equal(tip_height - 4, node.getblockcount())
+            node.reconsiderblock(fork_hash)
+            assert_equal(tip_hash, node.getbestblockhash())
+            tips = {tip['hash']: tip['status'] for tip in node.getchaintips()}
+            assert_equal('invalid', tips[block.hash])
+            assert_false(node.getblockchaininfo()['initial_block_download_complete'])
+
+        # The nodes still follow the chain.
+        node0.generate(1)
+        sync_blocks(self.nodes)
+
+if __name__ == '__main__':
+    PipelineBlockConnectTest().main()
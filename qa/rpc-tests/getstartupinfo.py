@@ -0,0 +1,38 @@
+#!/usr/bin/env python3
+# Copyright (c) 2023 The Zcash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#
+# Test the startup profile reported by getstartupinfo.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, assert_greater_than
+
+class GetStartupInfoTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.num_nodes = 1
+
+    def run_test(self):
+        info = self.nodes[0].getstartupinfo()
+        names = [phase['name'] for phase in info['phases']]
+        for name in ['setup', 'network', 'addresses', 'loadblockindex', 'verifydb', 'feeestimates', 'wallet']:
+            assert name in names, name
+
+        for phase in info['phases']:
+            assert phase['duration_ms'] >= 0
+            assert phase['start_ms'] + phase['duration_ms'] <= info['total_ms']
+            for key in ['cpu_user_ms', 'cpu_system_ms', 'blocks_read', 'blocks_written']:
+                assert phase[key] >= 0
+        assert_greater_than(info['total_ms'], 0)
+
+        # The addresses are loaded while the block chain is.
+        phases = {phase['name']: phase for phase in info['phases']}
+        assert_equal(names.count('addresses'), 1)
+        assert phases['addresses']['start_ms'] <= phases['loadblockindex']['start_ms']
+
+if __name__ == '__main__':
+    GetStartupInfoTest().main()
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+# Copyright (c) 2023 The Zcash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#
+# Test that transactions relayed by peers whose proofs are checked as a batch
+# (-mempoolproofbatch) are accepted or rejected as they are without it: a
+# transaction with an invalid Sapling proof is rejected, and a valid
+# transaction checked in the same batch is accepted.
+#
+
+from io import BytesIO
+from decimal import Decimal
+import time
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    assert_equal,
+    fail,
+    get_coinbase_address,
+    hex_str_to_bytes,
+    p2p_port,
+    start_nodes,
+    wait_and_assert_operationid_status,
+)
+from test_framework.mininode import (
+    CTransaction,
+    NetworkThread,
+    NodeConn,
+    SAPLING_PROTO_VERSION,
+    mininode_lock,
+    msg_tx,
+)
+from tx_expiry_helper import TestNode
+
+class MempoolProofBatchTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.num_nodes = 2
+        self.setup_clean_chain = True
+
+    def setup_network(self, split=False):
+        # Node 1 is the wallet that makes the transactions. The nodes are not
+        # connected, so that node 0 only gets them from the test's peer.
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [['-mempoolproofbatch=4'], []])
+        self.is_network_split = True
+
+    def sync_node0_blocks(self):
+        node0, node1 = self.nodes
+        for height in range(node0.getblockcount() + 1, node1.getblockcount() + 1):
+            node0.submitblock(node1.getblock(node1.getblockhash(height), 0))
+        assert_equal(node1.getbestblockhash(), node0.getbestblockhash())
+
+    def send_sapling(self, from_addr, to_addr):
+        node1 = self.nodes[1]
+        # With the default fee, as relayed transactions must pay the relay fee.
+        opid = node1.z_sendmany(from_addr, [{'address': to_addr, 'amount': Decimal('1')}], 1)
+        txid = wait_and_assert_operationid_status(node1, opid)
+        tx = CTransaction()
+        tx.deserialize(BytesIO(hex_str_to_bytes(node1.getrawtransaction(txid))))
+        tx.calc_sha256()
+        return tx
+
+    def run_test(self):
+        node0, node1 = self.nodes
+
+        # Shield two coinbase outputs to separate notes, so that the two
+        # transactions below spend different notes.
+        node1.generate(101)
+        sapling_addr0 = node1.z_getnewaddress('sapling')
+        sapling_addr1 = node1.z_getnewaddress('sapling')
+        for i in range(2):
+            opid = node1.z_sendmany(
+                get_coinbase_address(node1), [{'address': sapling_addr0, 'amount': Decimal('10')}], 1, 0)
+            wait_and_assert_operationid_status(node1, opid)
+        node1.generate(1)
+        self.sync_node0_blocks()
+
+        valid_tx = self.send_sapling(sapling_addr0, sapling_addr1)
+        invalid_tx = self.send_sapling(sapling_addr0, sapling_addr1)
+        # Swap the proofs of the two outputs. They are well-formed, but
+        # neither is valid for the other output.
+        outputs = invalid_tx.shieldedOutputs
+        assert(len(outputs) >= 2)
+        outputs[0].zkproof, outputs[1].zkproof = outputs[1].zkproof, outputs[0].zkproof
+        invalid_tx.calc_sha256()
+
+        test_node = TestNode()
+        connection = NodeConn('127.0.0.1', p2p_port(0), node0, test_node, "regtest", SAPLING_PROTO_VERSION)
+        test_node.add_connection(connection)
+        NetworkThread().start()
+        test_node.wait_for_verack()
+
+        # Send both transactions at once, so that their proofs are checked in
+        # the same batch.
+        test_node.send_message(msg_tx(valid_tx))
+        test_node.send_message(msg_tx(invalid_tx))
+
+        # The peer is disconnected for sending the invalid transaction.
+        timeout = 30
+        while len(node0.getpeerinfo()) > 0:
+            if timeout <= 0:
+                fail("Peer was not disconnected")
+            time.sleep(0.5)
+            timeout -= 0.5
+
+        assert_equal([valid_tx.hash], node0.getrawmempool())
+        with mininode_lock:
+            reject = getattr(connection, 'rejectMessage', None)
+        assert(reject is not None)
+        assert_equal(b'tx', reject.message)
+        assert_equal(b'bad-sapling-bundle-authorization', reject.reason)
+        assert_equal(invalid_tx.sha256, reject.data)
+
+        # The valid transaction is mined.
+        node0.generate(1)
+        assert_equal([], node0.getrawmempool())
+
+if __name__ == '__main__':
+    MempoolProofBatchTest().main()
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+# Copyright (c) 2023 The Zcash developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#
+# Test that a reorg to a chain that mines a transaction again leaves the
+# mempool transactions spending it in the mempool.
+#
+
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import (
+    DEFAULT_FEE,
+    assert_equal,
+    connect_nodes_bi,
+    start_nodes,
+    sync_blocks,
+)
+
+from decimal import Decimal
+
+
+class MempoolResurrectReminedTest(BitcoinTestFramework):
+
+    def __init__(self):
+        super().__init__()
+        self.num_nodes = 2
+        self.setup_clean_chain = False
+
+    def setup_network(self):
+        # The nodes are connected once each has mined its own chain.
+        args = ["-checkmempool", "-debug=mempool"]
+        self.nodes = start_nodes(self.num_nodes, self.options.tmpdir, [args] * self.num_nodes)
+        self.is_network_split = True
+
+    def create_tx(self, from_txid, to_address, amount):
+        inputs = [{ "txid" : from_txid, "vout" : 0}]
+        outputs = { to_address : amount }
+        rawtx = self.nodes[0].createrawtransaction(inputs, outputs)
+        signresult = self.nodes[0].signrawtransaction(rawtx)
+        assert_equal(signresult["complete"], True)
+        return signresult["hex"]
+
+    def run_test(self):
+        node0, node1 = self.nodes
+        node0_address = node0.getnewaddress()
+
+        # Mine a parent transaction on node 0, and put a child spending it
+        # in node 0's mempool.
+        coinbase_txid = node0.getblock(node0.getblockhash(1))['tx'][0]
+        parent_raw = self.create_tx(coinbase_txid, node0_address, 10)
+        parent_id = node0.sendrawtransaction(parent_raw)
+        node0.generate(1)
+        child_raw = self.create_tx(parent_id, node0_address, Decimal('10.0') - DEFAULT_FEE)
+        child_id = node0.sendrawtransaction(child_raw)
+        assert_equal([child_id], node0.getrawmempool())
+
+        # Mine the parent again in a longer chain on node 1.
+        node1.sendrawtransaction(parent_raw)
+        reminedblock = node1.generate(2)[0]
+        assert(parent_id in node1.getblock(reminedblock)['tx'])
+
+        # Node 0 reorgs to node 1's chain. The parent is confirmed in it, and
+        # the child stays in the mempool.
+        connect_nodes_bi(self.nodes, 0, 1)
+        sync_blocks(self.nodes)
+        assert_equal(node1.getbestblockhash(), node0.getbestblockhash())
+        assert_equal([child_id], node0.getrawmempool())
+        assert(node0.gettransaction(parent_id)['confirmations'] > 0)
+
+        # The child is then mined.
+        node0.generate(1)
+        sync_blocks(self.nodes)
+        assert_equal([], node0.getrawmempool())
+        assert(node0.gettransaction(child_id)['confirmations'] > 0)
+
+
+if __name__ == '__main__':
+    MempoolResurrectReminedTest().main()
@@ -28,8 +28,16 @@ class ZMQTest(BitcoinTestFramework):
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashblock")
         self.zmqSubSocket.setsockopt(zmq.SUBSCRIBE, b"hashtx")
         self.zmqSubSocket.connect("tcp://127.0.0.1:%i" % self.port)
+        self.zmqSeqSocket = self.zmqContext.socket(zmq.SUB)
+        self.zmqSeqSocket.setsockopt(zmq.SUBSCRIBE, b"sequence")
+        self.zmqSeqSocket.connect("tcp://127.0.0.1:%i" % (self.port + 1))
+        self.zmqMempoolSocket = self.zmqContext.socket(zmq.SUB)
+        self.zmqMempoolSocket.setsockopt(zmq.SUBSCRIBE, b"compactmempooltx")
+        self.zmqMempoolSocket.connect("tcp://127.0.0.1:%i" % (self.port + 1))
         return start_nodes(self.num_nodes, self.options.tmpdir, extra_args=[
-            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port)],
+            ['-zmqpubhashtx=tcp://127.0.0.1:'+str(self.port), '-zmqpubhashblock=tcp://127.0.0.1:'+str(self.port),
+             '-zmqpubsequence=tcp://127.0.0.1:'+str(self.port + 1),
+             '-zmqpubcompactmempooltx=tcp://127.0.0.1:'+str(self.port + 1)],
             [],
             [],
             []
@@ -60,6 +68,7 @@ class ZMQTest(BitcoinTestFramework):
         msgSequence = struct.unpack('<I', msg[-1])[-1]
         assert_equal(msgSequence, 0) # must be sequence 0 on hashtx
 
+        genhashes_first = genhashes[0]
         n = 10
         genhashes = self.nodes[1].generate(n)
         self.sync_all()
@@ -95,6 +104,30 @@ class ZMQTest(BitcoinTestFramework):
 
         assert_equal(hashRPC, hashZMQ) #blockhash from generate must be equal to the hash received over zmq
 
+        # the sequence topic has each connected block, then the transaction
+        # entering the mempool
+        for blkhash in [genhashes_first] + genhashes:
+            msg = self.zmqSeqSocket.recv_multipart()
+            assert_equal(msg[0], b"sequence")
+            assert_equal(bytes_to_hex_str(msg[1][:32]), blkhash)
+            assert_equal(msg[1][32:], b"C")
+        msg = self.zmqSeqSocket.recv_multipart()
+        assert_equal(bytes_to_hex_str(msg[1][:32]), hashRPC)
+        assert_equal(msg[1][32:33], b"A")
+        assert_equal(len(msg[1]), 41)
+        mempoolSequence = msg[1][33:]
+
+        # the compactmempooltx topic has the same change, with the compact
+        # form of the transparent transaction: index 0, the txid and no
+        # shielded components
+        msg = self.zmqMempoolSocket.recv_multipart()
+        assert_equal(msg[0], b"compactmempooltx")
+        assert_equal(msg[1][:8], mempoolSequence)
+        assert_equal(msg[1][8:9], b"A")
+        assert_equal(msg[1][9:10], b"\x00")
+        assert_equal(bytes_to_hex_str(msg[1][10:42][::-1]), hashRPC)
+        assert_equal(msg[1][42:], b"\x00\x00\x00")
+
 
 if __name__ == '__main__':
     ZMQTest ().main ()
@@ -197,7 +197,7 @@ case "$1" in
                 zcash_rpc zcbenchmark parameterloading 10
                 ;;
             createsaplingspend)
-                zcash_rpc zcbenchmark createsaplingspend 10
+                zcash_rpc zcbenchmark createsaplingspend 10 "${@:3}"
                 ;;
             verifysaplingspend)
                 zcash_rpc zcbenchmark verifysaplingspend 1000
@@ -250,6 +250,9 @@ case "$1" in
             listunspent)
                 zcash_rpc zcbenchmark listunspent 10
                 ;;
+            selectcoins)
+                zcash_rpc zcbenchmark selectcoins 10 "${@:3}"
+                ;;
             *)
                 zcashd_stop
                 echo "Bad arguments to time."
@@ -11,6 +11,8 @@
 #include "amount.h"
 #include "script/script.h"
 
+#include <map>
+
 struct CAddressUnspentKey {
     unsigned int type;
     uint160 hashBytes;
@@ -223,6 +225,40 @@ struct CAddressIndexIteratorHeightKey {
     }
 };
 
+/**
+ * The totals of the address index entries of an address: its balance, the
+ * amount it received (including change) and the number of transactions
+ * that paid to or spent from it.
+ */
+struct CAddressBalanceValue {
+    CAmount balance;
+    CAmount received;
+    int64_t txCount;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(balance);
+        READWRITE(received);
+        READWRITE(txCount);
+    }
+
+    CAddressBalanceValue() {
+        SetNull();
+    }
+
+    void SetNull() {
+        balance = 0;
+        received = 0;
+        txCount = 0;
+    }
+
+    bool IsNull() const {
+        return txCount == 0;
+    }
+};
+
 struct CMempoolAddressDelta
 {
     int64_t time;
@@ -285,4 +321,11 @@ struct CMempoolAddressDeltaKeyCompare
     }
 };
 
+/** The mempool deltas of one address, and their sum. */
+struct CMempoolAddressDeltas
+{
+    std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> deltas;
+    CAmount balanceDelta = 0;
+};
+
 #endif // BITCOIN_ADDRESSINDEX_H
@@ -5,6 +5,7 @@
 #ifndef BITCOIN_ADDRMAN_H
 #define BITCOIN_ADDRMAN_H
 
+#include "memusage.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
@@ -15,6 +16,7 @@
 #include <map>
 #include <set>
 #include <stdint.h>
+#include <unordered_map>
 #include <vector>
 
 /**
@@ -204,6 +206,14 @@ private:
     //! list of "new" buckets
     int vvNew[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
 
+    //! occupied positions (bucket * ADDRMAN_BUCKET_SIZE + position) of vvTried and vvNew, in no particular order
+    std::vector<int> vTriedSlots;
+    std::vector<int> vNewSlots;
+
+    //! index in vTriedSlots and vNewSlots of each position, or -1 if it is empty
+    int vvTriedSlotIndex[ADDRMAN_TRIED_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
+    int vvNewSlotIndex[ADDRMAN_NEW_BUCKET_COUNT][ADDRMAN_BUCKET_SIZE];
+
 protected:
     //! secret key to randomize bucket select with
     uint256 nKey;
@@ -227,6 +237,10 @@ protected:
     //! Delete an entry. It must not be in tried, and have refcount 0.
     void Delete(int nId);
 
+    //! Set a position in the "new" or "tried" table to an nId, or to -1 to empty it.
+    void SetNew(int nUBucket, int nUBucketPos, int nId);
+    void SetTried(int nKBucket, int nKBucketPos, int nId);
+
     //! Clear a position in a "new" table. This is the only place where entries are actually deleted.
     void ClearNew(int nUBucket, int nUBucketPos);
 
@@ -259,7 +273,7 @@ protected:
 public:
     /**
      * serialized format:
-     * * version byte (currently 1)
+     * * version byte (currently 2)
      * * 0x20 + nKey (serialized as if it were a vector, for backward compatibility)
      * * nNew
      * * nTried
@@ -269,6 +283,14 @@ public:
      * * for each bucket:
      *   * number of elements
      *   * for each element: index
+     * * (version 2) where each address is in the tables, so that loading does not have to hash
+     *   every address again:
+     *   * number of "tried" buckets, and bucket size
+     *   * for each of the nTried addrinfos: its bucket and position
+     *   * for each element of each "new" bucket above: its position
+     *
+     * Version 1 deserializers ignore the trailing placement, and only lose the "new" table
+     * buckets, as for any version other than their own.
      *
      * 2**30 is xorred with the number of buckets to make addrman deserializer v0 detect it
      * as incompatible. This is necessary because it did not check the version number on
@@ -289,51 +311,92 @@ public:
     template<typename Stream>
     void Serialize(Stream &s) const
     {
-        LOCK(cs);
+        // Copy what is written out of the tables under the lock, and
+        // serialize the copy after releasing it, so that writing peers.dat
+        // holds up the connection threads and addr handling only for as long
+        // as it takes to copy the entries.
+        uint256 nKeyCopy;
+        int nNewCopy, nTriedCopy;
+        std::vector<CAddrInfo> vNewInfo, vTriedInfo;
+        std::vector<int> vTriedSlotOfInfo;
+        std::vector<int> vNewBucketSize(ADDRMAN_NEW_BUCKET_COUNT, 0);
+        //! for each element of each "new" bucket, in order: its index in vNewInfo and its position
+        std::vector<std::pair<int, uint16_t>> vNewEntries;
+        {
+            LOCK(cs);
+            nKeyCopy = nKey;
+            nNewCopy = nNew;
+            nTriedCopy = nTried;
+
+            vNewInfo.reserve(nNew);
+            vTriedInfo.reserve(nTried);
+            vTriedSlotOfInfo.reserve(nTried);
+            std::unordered_map<int, int> mapUnkIds;
+            mapUnkIds.reserve(nNew);
+            std::unordered_map<int, int> mapTriedSlots;
+            mapTriedSlots.reserve(vTriedSlots.size());
+            for (int nSlot : vTriedSlots) {
+                mapTriedSlots[vvTried[nSlot / ADDRMAN_BUCKET_SIZE][nSlot % ADDRMAN_BUCKET_SIZE]] = nSlot;
+            }
+            for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
+                const CAddrInfo &info = (*it).second;
+                if (info.nRefCount) {
+                    assert((int)vNewInfo.size() != nNew); // this means nNew was wrong, oh ow
+                    mapUnkIds[(*it).first] = vNewInfo.size();
+                    vNewInfo.push_back(info);
+                }
+                if (info.fInTried) {
+                    assert((int)vTriedInfo.size() != nTried); // this means nTried was wrong, oh ow
+                    vTriedInfo.push_back(info);
+                    vTriedSlotOfInfo.push_back(mapTriedSlots[(*it).first]);
+                }
+            }
+
+            vNewEntries.reserve(vNewSlots.size());
+            for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
+                for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
+                    if (vvNew[bucket][i] != -1) {
+                        vNewBucketSize[bucket]++;
+                        vNewEntries.emplace_back(mapUnkIds[vvNew[bucket][i]], i);
+                    }
+                }
+            }
+        }
 
-        unsigned char nVersion = 1;
+        unsigned char nVersion = 2;
         s << nVersion;
         s << ((unsigned char)32);
-        s << nKey;
-        s << nNew;
-        s << nTried;
+        s << nKeyCopy;
+        s << nNewCopy;
+        s << nTriedCopy;
 
         int nUBuckets = ADDRMAN_NEW_BUCKET_COUNT ^ (1 << 30);
         s << nUBuckets;
-        std::map<int, int> mapUnkIds;
-        int nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            mapUnkIds[(*it).first] = nIds;
-            const CAddrInfo &info = (*it).second;
-            if (info.nRefCount) {
-                assert(nIds != nNew); // this means nNew was wrong, oh ow
-                s << info;
-                nIds++;
-            }
+        for (const CAddrInfo &info : vNewInfo) {
+            s << info;
         }
-        nIds = 0;
-        for (std::map<int, CAddrInfo>::const_iterator it = mapInfo.begin(); it != mapInfo.end(); it++) {
-            const CAddrInfo &info = (*it).second;
-            if (info.fInTried) {
-                assert(nIds != nTried); // this means nTried was wrong, oh ow
-                s << info;
-                nIds++;
-            }
+        for (const CAddrInfo &info : vTriedInfo) {
+            s << info;
         }
+        size_t nEntry = 0;
         for (int bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
-            int nSize = 0;
-            for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
-                if (vvNew[bucket][i] != -1)
-                    nSize++;
-            }
-            s << nSize;
-            for (int i = 0; i < ADDRMAN_BUCKET_SIZE; i++) {
-                if (vvNew[bucket][i] != -1) {
-                    int nIndex = mapUnkIds[vvNew[bucket][i]];
-                    s << nIndex;
-                }
+            s << vNewBucketSize[bucket];
+            for (int i = 0; i < vNewBucketSize[bucket]; i++) {
+                s << vNewEntries[nEntry++].first;
             }
         }
+
+        int nKBuckets = ADDRMAN_TRIED_BUCKET_COUNT;
+        int nBucketSize = ADDRMAN_BUCKET_SIZE;
+        s << nKBuckets;
+        s << nBucketSize;
+        for (int nSlot : vTriedSlotOfInfo) {
+            s << (uint16_t)(nSlot / ADDRMAN_BUCKET_SIZE);
+            s << (uint16_t)(nSlot % ADDRMAN_BUCKET_SIZE);
+        }
+        for (const std::pair<int, uint16_t> &entry : vNewEntries) {
+            s << entry.second;
+        }
     }
 
     template<typename Stream>
@@ -365,6 +428,9 @@ public:
             throw std::ios_base::failure("Corrupt CAddrMan serialization, nTried exceeds limit.");
         }
 
+        // The new table data can only be used for a version we know, and the same bucket count.
+        bool fNewTableUsable = (nVersion == 1 || nVersion == 2) && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT;
+
         // Deserialize entries from the new table.
         for (int n = 0; n < nNew; n++) {
             CAddrInfo &info = mapInfo[n];
@@ -372,33 +438,82 @@ public:
             mapAddr[info] = n;
             info.nRandomPos = vRandom.size();
             vRandom.push_back(n);
-            if (nVersion != 1 || nUBuckets != ADDRMAN_NEW_BUCKET_COUNT) {
-                // In case the new table data cannot be used (nVersion unknown, or bucket count wrong),
-                // immediately try to give them a reference based on their primary source address.
+        }
+        nIdCount = nNew;
+
+        // Deserialize entries from the tried table; they are placed below.
+        std::vector<CAddrInfo> vTriedInfo(nTried);
+        for (int n = 0; n < nTried; n++) {
+            s >> vTriedInfo[n];
+        }
+
+        // Deserialize positions in the new table.
+        std::vector<std::pair<int, int>> vNewEntries;
+        for (int bucket = 0; bucket < nUBuckets; bucket++) {
+            int nSize = 0;
+            s >> nSize;
+            for (int n = 0; n < nSize; n++) {
+                int nIndex = 0;
+                s >> nIndex;
+                vNewEntries.emplace_back(bucket, nIndex);
+            }
+        }
+
+        // Deserialize where each address was in the tables, which is only
+        // used for the same table dimensions.
+        std::vector<std::pair<uint16_t, uint16_t>> vTriedPlacement;
+        std::vector<uint16_t> vNewPlacement;
+        bool fPlacement = false;
+        if (nVersion == 2) {
+            int nKBuckets = 0;
+            int nBucketSize = 0;
+            s >> nKBuckets;
+            s >> nBucketSize;
+            vTriedPlacement.resize(nTried);
+            for (int n = 0; n < nTried; n++) {
+                s >> vTriedPlacement[n].first;
+                s >> vTriedPlacement[n].second;
+            }
+            vNewPlacement.resize(vNewEntries.size());
+            for (size_t n = 0; n < vNewEntries.size(); n++) {
+                s >> vNewPlacement[n];
+            }
+            fPlacement = nKBuckets == ADDRMAN_TRIED_BUCKET_COUNT && nBucketSize == ADDRMAN_BUCKET_SIZE;
+        }
+
+        if (!fNewTableUsable) {
+            // In case the new table data cannot be used (nVersion unknown, or bucket count wrong),
+            // immediately try to give them a reference based on their primary source address.
+            for (int n = 0; n < nNew; n++) {
+                CAddrInfo &info = mapInfo[n];
                 int nUBucket = info.GetNewBucket(nKey);
                 int nUBucketPos = info.GetBucketPosition(nKey, true, nUBucket);
                 if (vvNew[nUBucket][nUBucketPos] == -1) {
-                    vvNew[nUBucket][nUBucketPos] = n;
+                    SetNew(nUBucket, nUBucketPos, n);
                     info.nRefCount++;
                 }
             }
         }
-        nIdCount = nNew;
 
-        // Deserialize entries from the tried table.
+        // Place the entries of the tried table.
         int nLost = 0;
         for (int n = 0; n < nTried; n++) {
-            CAddrInfo info;
-            s >> info;
-            int nKBucket = info.GetTriedBucket(nKey);
-            int nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
+            CAddrInfo &info = vTriedInfo[n];
+            int nKBucket, nKBucketPos;
+            if (fPlacement && vTriedPlacement[n].first < ADDRMAN_TRIED_BUCKET_COUNT && vTriedPlacement[n].second < ADDRMAN_BUCKET_SIZE) {
+                nKBucket = vTriedPlacement[n].first;
+                nKBucketPos = vTriedPlacement[n].second;
+            } else {
+                nKBucket = info.GetTriedBucket(nKey);
+                nKBucketPos = info.GetBucketPosition(nKey, false, nKBucket);
+            }
             if (vvTried[nKBucket][nKBucketPos] == -1) {
                 info.nRandomPos = vRandom.size();
                 info.fInTried = true;
                 vRandom.push_back(nIdCount);
                 mapInfo[nIdCount] = info;
                 mapAddr[info] = nIdCount;
-                vvTried[nKBucket][nKBucketPos] = nIdCount;
+                SetTried(nKBucket, nKBucketPos, nIdCount);
                 nIdCount++;
             } else {
                 nLost++;
@@ -406,19 +521,22 @@ public:
         }
         nTried -= nLost;
 
-        // Deserialize positions in the new table (if possible).
-        for (int bucket = 0; bucket < nUBuckets; bucket++) {
-            int nSize = 0;
-            s >> nSize;
-            for (int n = 0; n < nSize; n++) {
-                int nIndex = 0;
-                s >> nIndex;
+        // Place the entries of the new table (if possible).
+        if (fNewTableUsable) {
+            for (size_t n = 0; n < vNewEntries.size(); n++) {
+                int bucket = vNewEntries[n].first;
+                int nIndex = vNewEntries[n].second;
                 if (nIndex >= 0 && nIndex < nNew) {
                     CAddrInfo &info = mapInfo[nIndex];
-                    int nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
-                    if (nVersion == 1 && nUBuckets == ADDRMAN_NEW_BUCKET_COUNT && vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
+                    int nUBucketPos;
+                    if (fPlacement && vNewPlacement[n] < ADDRMAN_BUCKET_SIZE) {
+                        nUBucketPos = vNewPlacement[n];
+                    } else {
+                        nUBucketPos = info.GetBucketPosition(nKey, true, bucket);
+                    }
+                    if (vvNew[bucket][nUBucketPos] == -1 && info.nRefCount < ADDRMAN_NEW_BUCKETS_PER_ADDRESS) {
                         info.nRefCount++;
-                        vvNew[bucket][nUBucketPos] = nIndex;
+                        SetNew(bucket, nUBucketPos, nIndex);
                     }
                 }
             }
@@ -446,15 +564,19 @@ public:
     {
         LOCK(cs);
         std::vector<int>().swap(vRandom);
+        std::vector<int>().swap(vTriedSlots);
+        std::vector<int>().swap(vNewSlots);
         nKey = GetRandHash();
         for (size_t bucket = 0; bucket < ADDRMAN_NEW_BUCKET_COUNT; bucket++) {
             for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
                 vvNew[bucket][entry] = -1;
+                vvNewSlotIndex[bucket][entry] = -1;
             }
         }
         for (size_t bucket = 0; bucket < ADDRMAN_TRIED_BUCKET_COUNT; bucket++) {
             for (size_t entry = 0; entry < ADDRMAN_BUCKET_SIZE; entry++) {
                 vvTried[bucket][entry] = -1;
+                vvTriedSlotIndex[bucket][entry] = -1;
             }
         }
 
@@ -480,6 +602,14 @@ public:
         return vRandom.size();
     }
 
+    //! Return the memory used by the addresses and the tables of them.
+    size_t DynamicMemoryUsage() const
+    {
+        LOCK(cs);
+        return sizeof(vvTried) + sizeof(vvNew) + memusage::DynamicUsage(mapInfo) +
+            memusage::DynamicUsage(mapAddr) + memusage::DynamicUsage(vRandom);
+    }
+
     //! Consistency check
     void Check()
     {
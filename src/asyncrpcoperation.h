@@ -29,6 +29,16 @@ using namespace std;
 
 typedef std::string AsyncRPCOperationId;
 
+/**
+ * Operations of BACKGROUND priority are only started when no operation of
+ * NORMAL priority is waiting, so that long-running jobs do not hold up
+ * short ones queued behind them.
+ */
+enum class AsyncRPCPriority {
+    NORMAL = 0,
+    BACKGROUND,
+};
+
 typedef enum class operationStateEnum {
     READY = 0,
     EXECUTING,
@@ -65,6 +75,17 @@ public:
     // Override this method to add data to the default status object.
     virtual UniValue getStatus() const;
 
+    // Override this method to run the operation behind those of normal priority.
+    virtual AsyncRPCPriority getPriority() const {
+        return AsyncRPCPriority::NORMAL;
+    }
+
+    // Override this method to name the RPC method that created the operation,
+    // which the queue can limit the concurrency of.
+    virtual std::string getMethod() const {
+        return "";
+    }
+
     UniValue getError() const;
     
     UniValue getResult() const;
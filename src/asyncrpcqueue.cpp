@@ -5,6 +5,10 @@
 #include "asyncrpcqueue.h"
 #include "util/system.h"
 
+#include <algorithm>
+
+#include <rust/metrics.h>
+
 static std::atomic<size_t> workerCounter(0);
 
 /**
@@ -31,46 +35,109 @@ void AsyncRPCQueue::run(size_t workerId) {
     RenameThread(s.c_str());
 
     while (true) {
-        AsyncRPCOperationId key;
         std::shared_ptr<AsyncRPCOperation> operation;
         {
             std::unique_lock<std::mutex> guard(lock_);
-            while (operation_id_queue_.empty() && !isClosed() && !isFinishing()) {
-                this->condition_.wait(guard);
-            }
+            while (true) {
+                // Exit if the queue is closing.
+                if (isClosed()) {
+                    for (auto& queue : operation_id_queue_) {
+                        queue.clear();
+                    }
+                    return;
+                }
 
-            // Exit if the queue is empty and we are finishing up
-            if (isFinishing() && operation_id_queue_.empty()) {
-                break;
-            }
+                operation = take_next_operation();
+                if (operation) {
+                    break;
+                }
 
-            // Exit if the queue is closing.
-            if (isClosed()) {
-                while (!operation_id_queue_.empty()) {
-                    operation_id_queue_.pop();
+                // Exit if the queue is empty and we are finishing up
+                if (isFinishing() && queued_count() == 0) {
+                    return;
                 }
-                break;
+
+                this->condition_.wait(guard);
             }
+        }
 
-            // Get operation id
-            key = operation_id_queue_.front();
-            operation_id_queue_.pop();
+        operation->main();
 
-            // Search operation map
-            AsyncRPCOperationMap::const_iterator iter = operation_map_.find(key);
-            if (iter != operation_map_.end()) {
-                operation = iter->second;
-            }
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            executing_[operation->getMethod()]--;
+            num_executing_--;
+            add_finished(operation->getId());
+            // An operation held back by a concurrency limit may start now.
+            this->condition_.notify_all();
         }
+    }
+}
+
+/**
+ * Take the first operation that may start from the queue of the highest
+ * priority, skipping those of methods at their concurrency limit.
+ * Operations that were removed or cancelled while waiting are dropped.
+ */
+std::shared_ptr<AsyncRPCOperation> AsyncRPCQueue::take_next_operation() {
+    auto now = std::chrono::steady_clock::now();
+    for (auto& queue : operation_id_queue_) {
+        for (auto it = queue.begin(); it != queue.end(); ) {
+            AsyncRPCOperationMap::const_iterator iter = operation_map_.find(it->id);
+            if (iter == operation_map_.end()) {
+                // cannot find operation in map, may have been removed
+                it = queue.erase(it);
+                continue;
+            }
+            std::shared_ptr<AsyncRPCOperation> operation = iter->second;
+            if (operation->isCancelled()) {
+                // skip cancelled operation
+                add_finished(it->id);
+                it = queue.erase(it);
+                continue;
+            }
 
-        if (!operation) {
-            // cannot find operation in map, may have been removed
-        } else if (operation->isCancelled()) {
-            // skip cancelled operation
-        } else {
-            operation->main();
+            std::string method = operation->getMethod();
+            auto limit = concurrency_limits_.find(method);
+            if (limit != concurrency_limits_.end() && executing_[method] >= limit->second) {
+                ++it;
+                continue;
+            }
+
+            auto waited = now - it->queued;
+            total_wait_ += waited;
+            num_started_++;
+            MetricsHistogram("zcash.asyncrpc.wait.seconds",
+                std::chrono::duration_cast<std::chrono::duration<double>>(waited).count());
+            queue.erase(it);
+            MetricsGauge("zcash.asyncrpc.queued", queued_count());
+            executing_[method]++;
+            num_executing_++;
+            return operation;
         }
     }
+    return nullptr;
+}
+
+void AsyncRPCQueue::add_finished(const AsyncRPCOperationId& id) {
+    finished_ids_.push_back(id);
+    trim_finished();
+}
+
+void AsyncRPCQueue::trim_finished() {
+    while (finished_ids_.size() > retention_) {
+        operation_map_.erase(finished_ids_.front());
+        finished_ids_.pop_front();
+        num_evicted_++;
+    }
+}
+
+size_t AsyncRPCQueue::queued_count() const {
+    size_t count = 0;
+    for (const auto& queue : operation_id_queue_) {
+        count += queue.size();
+    }
+    return count;
 }
 
 
@@ -94,8 +161,10 @@ void AsyncRPCQueue::addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOp
 
     AsyncRPCOperationId id = ptrOperation->getId();
     operation_map_.emplace(id, ptrOperation);
-    operation_id_queue_.push(id);
-    this->condition_.notify_one();
+    operation_id_queue_[static_cast<size_t>(ptrOperation->getPriority())].push_back({id, std::chrono::steady_clock::now()});
+    MetricsGauge("zcash.asyncrpc.queued", queued_count());
+    // Notify all workers, as the first one woken may be at this operation's concurrency limit.
+    this->condition_.notify_all();
 }
 
 /**
@@ -122,6 +191,10 @@ std::shared_ptr<AsyncRPCOperation> AsyncRPCQueue::popOperationForId(AsyncRPCOper
         // Note: if the id still exists in the operationIdQueue, when it gets processed by a worker
         // there will no operation in the map to execute, so nothing will happen.
         operation_map_.erase(id);
+        auto it = std::find(finished_ids_.begin(), finished_ids_.end(), id);
+        if (it != finished_ids_.end()) {
+            finished_ids_.erase(it);
+        }
     }
     return ptr;
 }
@@ -171,7 +244,48 @@ void AsyncRPCQueue::cancelAllOperations() {
  */
 size_t AsyncRPCQueue::getOperationCount() const {
     std::lock_guard<std::mutex> guard(lock_);
-    return operation_id_queue_.size();
+    return queued_count();
+}
+
+/**
+ * Limit the number of operations of a method that execute at the same time.
+ */
+void AsyncRPCQueue::setConcurrencyLimit(const std::string& method, size_t nLimit) {
+    std::lock_guard<std::mutex> guard(lock_);
+    concurrency_limits_[method] = nLimit;
+    this->condition_.notify_all();
+}
+
+/**
+ * Set how many finished operations are kept until their results are
+ * fetched; the oldest are forgotten first.
+ */
+void AsyncRPCQueue::setRetention(size_t nRetention) {
+    std::lock_guard<std::mutex> guard(lock_);
+    retention_ = nRetention;
+    trim_finished();
+}
+
+AsyncRPCQueueStats AsyncRPCQueue::getStats() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    AsyncRPCQueueStats stats;
+    stats.nQueued = queued_count();
+    stats.nQueuedBackground = operation_id_queue_[static_cast<size_t>(AsyncRPCPriority::BACKGROUND)].size();
+    stats.nExecuting = num_executing_;
+    stats.nFinished = finished_ids_.size();
+    stats.nEvicted = num_evicted_;
+
+    auto now = std::chrono::steady_clock::now();
+    for (const auto& queue : operation_id_queue_) {
+        if (!queue.empty()) {
+            stats.nOldestQueuedMillis = std::max<int64_t>(stats.nOldestQueuedMillis,
+                std::chrono::duration_cast<std::chrono::milliseconds>(now - queue.front().queued).count());
+        }
+    }
+    if (num_started_ > 0) {
+        stats.nAverageWaitMillis = std::chrono::duration_cast<std::chrono::milliseconds>(total_wait_).count() / num_started_;
+    }
+    return stats;
 }
 
 /**
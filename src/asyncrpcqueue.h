@@ -10,7 +10,8 @@
 #include <iostream>
 #include <string>
 #include <chrono>
-#include <queue>
+#include <deque>
+#include <map>
 #include <unordered_map>
 #include <vector>
 #include <future>
@@ -21,6 +22,21 @@
 
 typedef std::unordered_map<AsyncRPCOperationId, std::shared_ptr<AsyncRPCOperation> > AsyncRPCOperationMap; 
 
+/** Default for -rpcasyncretention, the number of finished operations kept for their results. */
+static const size_t DEFAULT_ASYNC_RPC_RETENTION = 1000;
+
+struct AsyncRPCQueueStats {
+    size_t nQueued = 0;
+    size_t nQueuedBackground = 0;
+    size_t nExecuting = 0;
+    size_t nFinished = 0;
+    uint64_t nEvicted = 0;
+    //! How long the operation at the front of the queue has been waiting.
+    int64_t nOldestQueuedMillis = 0;
+    //! The average time operations waited in the queue before they started.
+    int64_t nAverageWaitMillis = 0;
+};
+
 
 class AsyncRPCQueue {
 public:
@@ -49,11 +65,28 @@ public:
     std::shared_ptr<AsyncRPCOperation> popOperationForId(AsyncRPCOperationId);
     void addOperation(const std::shared_ptr<AsyncRPCOperation> &ptrOperation);
     std::vector<AsyncRPCOperationId> getAllOperationIds() const;
+    // at most nLimit operations of the method will execute at the same time
+    void setConcurrencyLimit(const std::string& method, size_t nLimit);
+    // finished operations beyond the newest nRetention are forgotten
+    void setRetention(size_t nRetention);
+    AsyncRPCQueueStats getStats() const;
 
 private:
+    struct QueuedOperation {
+        AsyncRPCOperationId id;
+        std::chrono::steady_clock::time_point queued;
+    };
+
     // addWorker() will spawn a new thread on run())
     void run(size_t workerId);
     void wait_for_worker_threads();
+    // take the next operation that may start; requires lock_
+    std::shared_ptr<AsyncRPCOperation> take_next_operation();
+    // remember a finished operation, forgetting the oldest beyond the retention; requires lock_
+    void add_finished(const AsyncRPCOperationId& id);
+    // forget the oldest finished operations beyond the retention; requires lock_
+    void trim_finished();
+    size_t queued_count() const;
 
     // Why this is not a recursive lock: http://www.zaval.org/resources/library/butenhof1.html
     mutable std::mutex lock_;
@@ -61,7 +94,16 @@ private:
     std::atomic<bool> closed_;
     std::atomic<bool> finish_;
     AsyncRPCOperationMap operation_map_;
-    std::queue <AsyncRPCOperationId> operation_id_queue_;
+    // one queue for each AsyncRPCPriority
+    std::deque<QueuedOperation> operation_id_queue_[2];
+    std::map<std::string, size_t> concurrency_limits_;
+    std::map<std::string, size_t> executing_;
+    size_t num_executing_ = 0;
+    std::deque<AsyncRPCOperationId> finished_ids_;
+    size_t retention_ = DEFAULT_ASYNC_RPC_RETENTION;
+    uint64_t num_evicted_ = 0;
+    uint64_t num_started_ = 0;
+    std::chrono::steady_clock::duration total_wait_ = std::chrono::steady_clock::duration::zero();
     std::vector<std::thread> workers_;
 };
 
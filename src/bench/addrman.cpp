@@ -0,0 +1,103 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+#include "addrman.h"
+#include "clientversion.h"
+#include "random.h"
+#include "streams.h"
+
+#include <memory>
+#include <vector>
+
+/* A "big" number of addresses, about what a long-running node has in peers.dat. */
+static const int NUM_ADDRESSES = 60000;
+/* Addresses come from a few hundred sources. */
+static const int NUM_SOURCES = 256;
+
+static std::vector<CAddress> vAddresses;
+static std::vector<CNetAddr> vSources;
+
+static void CreateAddresses()
+{
+    if (!vAddresses.empty())
+        return;
+
+    FastRandomContext rng(true);
+    for (int i = 0; i < NUM_SOURCES; i++) {
+        struct in_addr ip;
+        ip.s_addr = rng.rand32();
+        vSources.push_back(CNetAddr(ip));
+    }
+    for (int i = 0; i < NUM_ADDRESSES; i++) {
+        struct in_addr ip;
+        ip.s_addr = rng.rand32();
+        CAddress addr(CService(CNetAddr(ip), 8233));
+        addr.nTime = GetTime() - rng.randrange(60 * 60 * 24 * 7);
+        vAddresses.push_back(addr);
+    }
+}
+
+static void FillAddrMan(CAddrMan& addrman)
+{
+    CreateAddresses();
+    for (int i = 0; i < NUM_ADDRESSES; i++) {
+        addrman.Add(vAddresses[i], vSources[i % NUM_SOURCES]);
+    }
+    // Some of the addresses have been connected to.
+    for (int i = 0; i < NUM_ADDRESSES; i += 10) {
+        addrman.Good(vAddresses[i]);
+    }
+}
+
+static void AddrManAdd(benchmark::State& state)
+{
+    CreateAddresses();
+    while (state.KeepRunning()) {
+        std::unique_ptr<CAddrMan> addrman(new CAddrMan());
+        FillAddrMan(*addrman);
+    }
+}
+
+static void AddrManSelect(benchmark::State& state)
+{
+    std::unique_ptr<CAddrMan> addrman(new CAddrMan());
+    FillAddrMan(*addrman);
+    while (state.KeepRunning()) {
+        CAddrInfo addr = addrman->Select();
+        assert(addr.GetPort() > 0);
+    }
+}
+
+static void AddrManSelectSparse(benchmark::State& state)
+{
+    // A handful of addresses in the tables, as on a new node.
+    CreateAddresses();
+    std::unique_ptr<CAddrMan> addrman(new CAddrMan());
+    for (int i = 0; i < 16; i++) {
+        addrman->Add(vAddresses[i], vSources[i % NUM_SOURCES]);
+    }
+    while (state.KeepRunning()) {
+        CAddrInfo addr = addrman->Select();
+        assert(addr.GetPort() > 0);
+    }
+}
+
+static void AddrManLoad(benchmark::State& state)
+{
+    std::unique_ptr<CAddrMan> addrman(new CAddrMan());
+    FillAddrMan(*addrman);
+    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+    ssPeers << *addrman;
+    std::unique_ptr<CAddrMan> addrman2(new CAddrMan());
+    while (state.KeepRunning()) {
+        CDataStream ssCopy(ssPeers);
+        ssCopy >> *addrman2;
+    }
+}
+
+BENCHMARK(AddrManAdd);
+BENCHMARK(AddrManSelect);
+BENCHMARK(AddrManSelectSparse);
+BENCHMARK(AddrManLoad);
@@ -10,6 +10,12 @@
 #include <assert.h>
 #include <iostream>
 #include <iomanip>
+#include <vector>
+
+#include <univalue.h>
+
+static benchmark::OutputFormat outputFormat = benchmark::OutputFormat::CSV;
+static std::vector<benchmark::Result> vResults;
 
 benchmark::BenchRunner::BenchmarkMap &benchmark::BenchRunner::benchmarks() {
     static std::map<std::string, benchmark::BenchFunction> benchmarks_map;
@@ -22,20 +28,52 @@ benchmark::BenchRunner::BenchRunner(std::string name, benchmark::BenchFunction f
 }
 
 void
-benchmark::BenchRunner::RunAll(benchmark::duration elapsedTimeForOne)
+benchmark::BenchRunner::RunAll(benchmark::duration elapsedTimeForOne, benchmark::OutputFormat format)
 {
     perf_init();
     if (std::ratio_less_equal<benchmark::clock::period, std::micro>::value) {
         std::cerr << "WARNING: Clock precision is worse than microsecond - benchmarks may be less accurate!\n";
     }
-    std::cout << "#Benchmark" << "," << "count" << "," << "min(ns)" << "," << "max(ns)" << "," << "average(ns)" << ","
-              << "min_cycles" << "," << "max_cycles" << "," << "average_cycles" << "\n";
+    outputFormat = format;
+    if (outputFormat == OutputFormat::CSV) {
+        std::cout << "#Benchmark" << "," << "count" << "," << "min(ns)" << "," << "max(ns)" << "," << "average(ns)" << ","
+                  << "min_cycles" << "," << "max_cycles" << "," << "average_cycles" << "\n";
+    }
 
     for (const auto &p: benchmarks()) {
         State state(p.first, elapsedTimeForOne);
         p.second(state);
     }
     perf_fini();
+
+    if (outputFormat == OutputFormat::JSON) {
+        UniValue results(UniValue::VARR);
+        for (const Result& result : vResults) {
+            UniValue obj(UniValue::VOBJ);
+            obj.pushKV("name", result.name);
+            obj.pushKV("count", result.count);
+            obj.pushKV("min_ns", result.minElapsed);
+            obj.pushKV("max_ns", result.maxElapsed);
+            obj.pushKV("average_ns", result.avgElapsed);
+            obj.pushKV("min_cycles", result.minCycles);
+            obj.pushKV("max_cycles", result.maxCycles);
+            obj.pushKV("average_cycles", result.avgCycles);
+            results.push_back(obj);
+        }
+        std::cout << results.write(2) << "\n";
+    }
+}
+
+void benchmark::BenchRunner::Report(const benchmark::Result& result)
+{
+    if (outputFormat == OutputFormat::JSON) {
+        vResults.push_back(result);
+        return;
+    }
+    std::cout << std::fixed << std::setprecision(15) << result.name << "," << result.count << ","
+              << result.minElapsed << "," << result.maxElapsed << "," << result.avgElapsed << ","
+              << result.minCycles << "," << result.maxCycles << "," << result.avgCycles << "\n";
+    std::cout.copyfmt(std::ios(nullptr));
 }
 
 bool benchmark::State::KeepRunning()
@@ -99,9 +137,8 @@ bool benchmark::State::KeepRunning()
     int64_t max_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(maxTime).count();
     int64_t avg_elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>((now-beginTime)/count).count();
     int64_t averageCycles = (nowCycles-beginCycles)/count;
-    std::cout << std::fixed << std::setprecision(15) << name << "," << count << "," << min_elapsed << "," << max_elapsed << "," << avg_elapsed << ","
-              << minCycles << "," << maxCycles << "," << averageCycles << "\n";
-    std::cout.copyfmt(std::ios(nullptr));
+    BenchRunner::Report({name, count, min_elapsed, max_elapsed, avg_elapsed,
+                         minCycles, maxCycles, (uint64_t)averageCycles});
 
     return false;
 }
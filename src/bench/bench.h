@@ -77,6 +77,22 @@ namespace benchmark {
 
     typedef std::function<void(State&)> BenchFunction;
 
+    /** How RunAll() prints the results. */
+    enum class OutputFormat {
+        //! One comma-separated line per benchmark, as each finishes.
+        CSV,
+        //! A JSON array of the results, once all the benchmarks have run.
+        JSON,
+    };
+
+    /** The result of one benchmark, in nanoseconds and CPU cycles per iteration. */
+    struct Result {
+        std::string name;
+        uint64_t count;
+        int64_t minElapsed, maxElapsed, avgElapsed;
+        uint64_t minCycles, maxCycles, avgCycles;
+    };
+
     class BenchRunner
     {
         typedef std::map<std::string, BenchFunction> BenchmarkMap;
@@ -85,7 +101,9 @@ namespace benchmark {
     public:
         BenchRunner(std::string name, BenchFunction func);
 
-        static void RunAll(duration elapsedTimeForOne = std::chrono::seconds(1));
+        static void RunAll(duration elapsedTimeForOne = std::chrono::seconds(1), OutputFormat format = OutputFormat::CSV);
+        /** Report the result of the benchmark that is running. */
+        static void Report(const Result& result);
     };
 }
 
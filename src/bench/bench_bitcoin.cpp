@@ -5,6 +5,7 @@
 
 #include "bench.h"
 
+#include "crypto/sha256.h"
 #include "fs.h"
 #include "key.h"
 #include "main.h"
@@ -17,6 +18,14 @@ const std::function<std::string(const char*)> G_TRANSLATION_FUN = nullptr;
 int
 main(int argc, char** argv)
 {
+    ParseParameters(argc, argv);
+    std::string strFormat = GetArg("-format", "csv");
+    if (strFormat != "csv" && strFormat != "json") {
+        fprintf(stderr, "Error: -format must be csv or json\n");
+        return 1;
+    }
+
+    SHA256AutoDetect();
     ECC_Start();
     auto globalVerifyHandle = new ECCVerifyHandle();
     SetupEnvironment();
@@ -43,7 +52,8 @@ main(int argc, char** argv)
         true
     );
 
-    benchmark::BenchRunner::RunAll();
+    benchmark::BenchRunner::RunAll(std::chrono::seconds(1),
+        strFormat == "json" ? benchmark::OutputFormat::JSON : benchmark::OutputFormat::CSV);
 
     ECC_Stop();
 }
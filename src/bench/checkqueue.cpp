@@ -21,6 +21,7 @@ static const size_t BATCHES = 101;
 static const size_t BATCH_SIZE = 30;
 static const int PREVECTOR_SIZE = 28;
 static const unsigned int QUEUE_BATCH_SIZE = 128;
+template <template <typename> class Queue>
 static void CCheckQueueSpeed(benchmark::State& state)
 {
     struct FakeJobNoWork {
@@ -30,13 +31,13 @@ static void CCheckQueueSpeed(benchmark::State& state)
         }
         void swap(FakeJobNoWork& x){};
     };
-    CCheckQueue<FakeJobNoWork> queue {QUEUE_BATCH_SIZE};
+    Queue<FakeJobNoWork> queue {QUEUE_BATCH_SIZE};
     boost::thread_group tg;
     for (auto x = 0; x < std::max(MIN_CORES, GetNumCores()); ++x) {
        tg.create_thread([&]{queue.Thread();});
     }
     while (state.KeepRunning()) {
-        CCheckQueueControl<FakeJobNoWork> control(&queue);
+        CCheckQueueControl<FakeJobNoWork, Queue<FakeJobNoWork>> control(&queue);
 
         // We call Add a number of times to simulate the behavior of adding
         // a block of transactions at once.
@@ -62,6 +63,7 @@ static void CCheckQueueSpeed(benchmark::State& state)
 // This Benchmark tests the CheckQueue with a slightly realistic workload,
 // where checks all contain a prevector that is indirect 50% of the time
 // and there is a little bit of work done between calls to Add.
+template <template <typename> class Queue>
 static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
 {
     struct PrevectorJob {
@@ -77,7 +79,7 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
         }
         void swap(PrevectorJob& x){p.swap(x.p);};
     };
-    CCheckQueue<PrevectorJob> queue {QUEUE_BATCH_SIZE};
+    Queue<PrevectorJob> queue {QUEUE_BATCH_SIZE};
     boost::thread_group tg;
     for (auto x = 0; x < std::max(MIN_CORES, GetNumCores()); ++x) {
        tg.create_thread([&]{queue.Thread();});
@@ -85,7 +87,7 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     while (state.KeepRunning()) {
         // Make insecure_rand here so that each iteration is identical.
         FastRandomContext insecure_rand(true);
-        CCheckQueueControl<PrevectorJob> control(&queue);
+        CCheckQueueControl<PrevectorJob, Queue<PrevectorJob>> control(&queue);
         std::vector<std::vector<PrevectorJob>> vBatches(BATCHES);
         for (auto& vChecks : vBatches) {
             vChecks.reserve(BATCH_SIZE);
@@ -100,5 +102,28 @@ static void CCheckQueueSpeedPrevectorJob(benchmark::State& state)
     tg.interrupt_all();
     tg.join_all();
 }
-BENCHMARK(CCheckQueueSpeed);
-BENCHMARK(CCheckQueueSpeedPrevectorJob);
+
+static void CCheckQueueSpeedLocked(benchmark::State& state)
+{
+    CCheckQueueSpeed<CCheckQueue>(state);
+}
+
+static void CCheckQueueSpeedWorkStealing(benchmark::State& state)
+{
+    CCheckQueueSpeed<CWorkStealingCheckQueue>(state);
+}
+
+static void CCheckQueueSpeedPrevectorJobLocked(benchmark::State& state)
+{
+    CCheckQueueSpeedPrevectorJob<CCheckQueue>(state);
+}
+
+static void CCheckQueueSpeedPrevectorJobWorkStealing(benchmark::State& state)
+{
+    CCheckQueueSpeedPrevectorJob<CWorkStealingCheckQueue>(state);
+}
+
+BENCHMARK(CCheckQueueSpeedLocked);
+BENCHMARK(CCheckQueueSpeedWorkStealing);
+BENCHMARK(CCheckQueueSpeedPrevectorJobLocked);
+BENCHMARK(CCheckQueueSpeedPrevectorJobWorkStealing);
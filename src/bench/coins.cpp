@@ -0,0 +1,44 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+#include "coins.h"
+#include "random.h"
+#include "script/script.h"
+
+#include <assert.h>
+
+/** The transparent outputs created and spent by a transparent-heavy block. */
+static const uint32_t BLOCK_OUTPUTS = 4000;
+
+/**
+ * Adds a block's worth of outputs to a cache over another cache, as
+ * ConnectBlock does, spends half of the outputs the parent already has, and
+ * flushes the child into the parent, as ConnectTip does.
+ */
+static void CoinsViewCacheFlush(benchmark::State& state)
+{
+    CCoinsView base;
+    CCoinsViewCache parent(&base);
+    std::vector<COutPoint> vParentOutPoints;
+    for (uint32_t i = 0; i < BLOCK_OUTPUTS; i++) {
+        vParentOutPoints.emplace_back(GetRandHash(), i % 4);
+        parent.AddCoin(vParentOutPoints.back(), Coin(CTxOut(1000, CScript() << OP_1), 1, false), false);
+    }
+
+    size_t nNextSpend = 0;
+    while (state.KeepRunning()) {
+        CCoinsViewCache child(&parent);
+        for (uint32_t i = 0; i < BLOCK_OUTPUTS; i++) {
+            child.AddCoin(COutPoint(GetRandHash(), i % 4), Coin(CTxOut(1000, CScript() << OP_1), 2, false), false);
+        }
+        for (uint32_t i = 0; i < BLOCK_OUTPUTS / 2 && nNextSpend < vParentOutPoints.size(); i++) {
+            child.SpendCoin(vParentOutPoints[nNextSpend++]);
+        }
+        bool fFlushed = child.Flush();
+        assert(fFlushed);
+    }
+}
+
+BENCHMARK(CoinsViewCacheFlush);
@@ -41,6 +41,41 @@ static void SHA256(benchmark::State& state)
         CSHA256().Write(begin_ptr(in), in.size()).Finalize(hash);
 }
 
+static void SHA256_32b(benchmark::State& state)
+{
+    std::vector<uint8_t> in(32,0);
+    while (state.KeepRunning()) {
+        for (int i = 0; i < 1000000; i++) {
+            CSHA256().Write(begin_ptr(in), in.size()).Finalize(&in[0]);
+        }
+    }
+}
+
+static void SHA256D64_1024(benchmark::State& state)
+{
+    std::vector<uint8_t> in(64 * 1024, 0);
+    while (state.KeepRunning())
+        SHA256D64(in.data(), in.data(), 1024);
+}
+
+/** Run a benchmark with only the given SHA-256 implementations allowed. */
+static void WithSHA256Implementation(benchmark::State& state,
+                                     sha256_implementation::UseImplementation use_implementation,
+                                     void (*bench)(benchmark::State&))
+{
+    SHA256AutoDetect(use_implementation);
+    bench(state);
+    SHA256AutoDetect();
+}
+
+static void SHA256_STANDARD(benchmark::State& state) { WithSHA256Implementation(state, sha256_implementation::STANDARD, SHA256); }
+static void SHA256_SHANI(benchmark::State& state) { WithSHA256Implementation(state, sha256_implementation::USE_SHANI, SHA256); }
+
+static void SHA256D64_1024_STANDARD(benchmark::State& state) { WithSHA256Implementation(state, sha256_implementation::STANDARD, SHA256D64_1024); }
+static void SHA256D64_1024_SSE41(benchmark::State& state) { WithSHA256Implementation(state, sha256_implementation::USE_SSE41, SHA256D64_1024); }
+static void SHA256D64_1024_AVX2(benchmark::State& state) { WithSHA256Implementation(state, sha256_implementation::USE_SSE41_AND_AVX2, SHA256D64_1024); }
+static void SHA256D64_1024_SHANI(benchmark::State& state) { WithSHA256Implementation(state, sha256_implementation::USE_SHANI, SHA256D64_1024); }
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -76,5 +111,14 @@ BENCHMARK(SHA1);
 BENCHMARK(SHA256);
 BENCHMARK(SHA512);
 
+BENCHMARK(SHA256_32b);
+BENCHMARK(SHA256D64_1024);
+BENCHMARK(SHA256_STANDARD);
+BENCHMARK(SHA256_SHANI);
+BENCHMARK(SHA256D64_1024_STANDARD);
+BENCHMARK(SHA256D64_1024_SSE41);
+BENCHMARK(SHA256D64_1024_AVX2);
+BENCHMARK(SHA256D64_1024_SHANI);
+
 BENCHMARK(FastRandom_32bit);
 BENCHMARK(FastRandom_1bit);
@@ -8,11 +8,13 @@
 #include "support/lockedpool.h"
 
 #include <iostream>
+#include <thread>
 #include <vector>
 
 #define ASIZE 2048
 #define BITER 5000
 #define MSIZE 2048
+#define BTHREADS 4
 
 static void LockedPool(benchmark::State& state)
 {
@@ -44,4 +46,39 @@ static void LockedPool(benchmark::State& state)
     addr.clear();
 }
 
+// Allocations and frees of small chunks of locked memory from several threads
+// at once, as when signing or proving in parallel.
+static void LockedPoolThreads(benchmark::State& state)
+{
+    LockedPoolManager &pool = LockedPoolManager::Instance();
+
+    while (state.KeepRunning()) {
+        std::vector<std::thread> threads;
+        for (int t=0; t<BTHREADS; ++t) {
+            threads.emplace_back([&pool, t]() {
+                std::vector<void*> addr(64, nullptr);
+                uint32_t s = 0x12345678 + t;
+                for (int x=0; x<BITER; ++x) {
+                    int idx = s & (addr.size()-1);
+                    if (addr[idx]) {
+                        pool.free(addr[idx]);
+                        addr[idx] = nullptr;
+                    } else {
+                        addr[idx] = pool.alloc(((s >> 16) & 255) + 1);
+                    }
+                    bool lsb = s & 1;
+                    s >>= 1;
+                    if (lsb)
+                        s ^= 0xf00f00f0; // LFSR period 0xf7ffffe1
+                }
+                for (void *ptr: addr)
+                    pool.free(ptr);
+            });
+        }
+        for (auto& thread: threads)
+            thread.join();
+    }
+}
+
 BENCHMARK(LockedPool);
+BENCHMARK(LockedPoolThreads);
@@ -0,0 +1,160 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "consensus/validation.h"
+#include "keystore.h"
+#include "main.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/standard.h"
+#include "transaction_builder.h"
+#include "txmempool.h"
+
+#include <assert.h>
+#include <deque>
+#include <list>
+
+/** The height of the chain the transactions are accepted on top of. */
+static const int MEMPOOL_ACCEPT_CHAIN_HEIGHT = 200;
+
+/** The transactions accepted into an empty mempool by each iteration. */
+static const size_t MEMPOOL_ACCEPT_TXS = 100;
+
+/** The value of the coins the transactions spend, and the fee they pay. */
+static const CAmount MEMPOOL_ACCEPT_COIN_VALUE = 100000;
+static const CAmount MEMPOOL_ACCEPT_FEE = 10000;
+
+/**
+ * A regtest chain tip with all the network upgrades up to NU5 active, and a
+ * coins view of P2PKH coins, in place of the node's chain state, for as long
+ * as it is in scope.
+ */
+class MempoolAcceptSetup {
+    std::deque<CBlockIndex> vIndex;
+    std::deque<uint256> vHashes;
+    CCoinsView base;
+    CCoinsViewCache* pcoinsTipPrev;
+
+public:
+    CBasicKeyStore keystore;
+    CScript scriptPubKey;
+    CTxDestination destination;
+    CCoinsViewCache coins;
+
+    MempoolAcceptSetup() : coins(&base)
+    {
+        SelectParams(CBaseChainParams::REGTEST);
+        for (int idx = Consensus::UPGRADE_OVERWINTER; idx <= Consensus::UPGRADE_NU5; idx++) {
+            UpdateNetworkUpgradeParameters(Consensus::UpgradeIndex(idx), 1);
+        }
+
+        CKey key = CKey::TestOnlyRandomKey(true);
+        keystore.AddKey(key);
+        destination = key.GetPubKey().GetID();
+        scriptPubKey = GetScriptForDestination(destination);
+
+        int64_t nTime = GetTime() - MEMPOOL_ACCEPT_CHAIN_HEIGHT * 150;
+        for (int nHeight = 0; nHeight <= MEMPOOL_ACCEPT_CHAIN_HEIGHT; nHeight++) {
+            vHashes.push_back(GetRandHash());
+            vIndex.emplace_back();
+            CBlockIndex& index = vIndex.back();
+            index.nHeight = nHeight;
+            index.nTime = nTime + nHeight * 150;
+            index.phashBlock = &vHashes.back();
+            index.pprev = nHeight > 0 ? &vIndex[nHeight - 1] : nullptr;
+        }
+
+        LOCK(cs_main);
+        chainActive.SetTip(&vIndex.back());
+        pcoinsTipPrev = pcoinsTip;
+        pcoinsTip = &coins;
+    }
+
+    ~MempoolAcceptSetup()
+    {
+        LOCK(cs_main);
+        pcoinsTip = pcoinsTipPrev;
+        chainActive.SetTip(nullptr);
+        for (int idx = Consensus::UPGRADE_OVERWINTER; idx <= Consensus::UPGRADE_NU5; idx++) {
+            UpdateNetworkUpgradeParameters(Consensus::UpgradeIndex(idx), Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+        }
+    }
+
+    /** Adds a coin to the chain state and builds a transaction that spends it to nOutputs outputs. */
+    CTransaction SpendNewCoin(size_t nOutputs)
+    {
+        COutPoint outpoint(GetRandHash(), 0);
+        coins.AddCoin(outpoint, Coin(CTxOut(MEMPOOL_ACCEPT_COIN_VALUE, scriptPubKey), 1, false), false);
+
+        auto builder = TransactionBuilder(Params().GetConsensus(), MEMPOOL_ACCEPT_CHAIN_HEIGHT + 1, std::nullopt, &keystore);
+        builder.SetFee(MEMPOOL_ACCEPT_FEE);
+        builder.AddTransparentInput(outpoint, scriptPubKey, MEMPOOL_ACCEPT_COIN_VALUE);
+        for (size_t i = 0; i < nOutputs; i++) {
+            builder.AddTransparentOutput(destination, (MEMPOOL_ACCEPT_COIN_VALUE - MEMPOOL_ACCEPT_FEE) / nOutputs);
+        }
+        return builder.Build().GetTxOrThrow();
+    }
+};
+
+/**
+ * Accepts MEMPOOL_ACCEPT_TXS transparent transactions, each spending a coin
+ * of the chain state to nOutputs P2PKH outputs, into an empty mempool with
+ * AcceptToMemoryPool, as a burst of relayed transactions is, including the
+ * script and signature checks, and removes them again.
+ */
+static void MempoolAcceptTransparent(benchmark::State& state, size_t nOutputs)
+{
+    MempoolAcceptSetup setup;
+    std::vector<CTransaction> vTxs;
+    for (size_t i = 0; i < MEMPOOL_ACCEPT_TXS; i++) {
+        vTxs.push_back(setup.SpendNewCoin(nOutputs));
+    }
+
+    CTxMemPool pool(::minRelayTxFee);
+    while (state.KeepRunning()) {
+        LOCK(cs_main);
+        for (const CTransaction& tx : vTxs) {
+            CValidationState valstate;
+            bool fMissingInputs;
+            bool fAccepted = AcceptToMemoryPool(Params(), pool, valstate, tx, false, &fMissingInputs);
+            assert(fAccepted);
+        }
+        // Unlike clear(), this also takes them out of the pool's eviction tree.
+        std::list<CTransaction> removed;
+        for (const CTransaction& tx : vTxs) {
+            pool.remove(tx, removed, false);
+        }
+    }
+}
+
+/**
+ * Computes the serialized size of a block of MEMPOOL_ACCEPT_TXS transactions
+ * with 20 outputs each, as CheckBlock and block template creation do, which
+ * uses the sizes the transactions cached when they were constructed.
+ */
+static void BlockSerializeSize(benchmark::State& state)
+{
+    MempoolAcceptSetup setup;
+    CBlock block;
+    for (size_t i = 0; i < MEMPOOL_ACCEPT_TXS; i++) {
+        block.vtx.push_back(setup.SpendNewCoin(20));
+    }
+
+    size_t nSize = 0;
+    while (state.KeepRunning()) {
+        nSize += ::GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION);
+    }
+    assert(nSize > 0);
+}
+
+static void MempoolAcceptTransparent1Out(benchmark::State& state) { MempoolAcceptTransparent(state, 1); }
+static void MempoolAcceptTransparent20Out(benchmark::State& state) { MempoolAcceptTransparent(state, 20); }
+
+BENCHMARK(MempoolAcceptTransparent1Out);
+BENCHMARK(MempoolAcceptTransparent20Out);
+BENCHMARK(BlockSerializeSize);
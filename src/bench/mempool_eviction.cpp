@@ -0,0 +1,64 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+#include "arith_uint256.h"
+#include "mempool_limit.h"
+
+static WeightedTxInfo BenchTxInfo(uint64_t n)
+{
+    int64_t cost = MIN_TX_COST + (n % 4096);
+    return WeightedTxInfo(ArithToUint256(arith_uint256(n + 1)), TxWeight(cost, cost + (n % 5 == 0 ? LOW_FEE_PENALTY : 0)));
+}
+
+// Build a tree of nTxs transactions that is just over its cost limit, so
+// that each added transaction evicts one.
+static WeightedTxTree BenchTree(uint64_t nTxs)
+{
+    std::vector<WeightedTxInfo> infos;
+    for (uint64_t n = 0; n < nTxs; n++) {
+        infos.push_back(BenchTxInfo(n));
+    }
+    int64_t totalCost = 0;
+    for (const WeightedTxInfo& info : infos) {
+        totalCost += info.txWeight.cost;
+    }
+    WeightedTxTree tree(totalCost - 1);
+    tree.add(infos);
+    return tree;
+}
+
+static void MempoolEviction(benchmark::State& state, uint64_t nTxs)
+{
+    WeightedTxTree tree = BenchTree(nTxs);
+    uint64_t n = nTxs;
+    while (state.KeepRunning()) {
+        tree.add(BenchTxInfo(n++));
+        tree.maybeDropRandom();
+    }
+}
+
+// Remove a block's worth of transactions and add them back.
+static void MempoolBlockRemoval(benchmark::State& state, uint64_t nTxs)
+{
+    WeightedTxTree tree = BenchTree(nTxs);
+    std::vector<uint256> txIds;
+    std::vector<WeightedTxInfo> infos;
+    for (uint64_t n = 0; n < nTxs; n += nTxs / 1000) {
+        txIds.push_back(BenchTxInfo(n).txId);
+        infos.push_back(BenchTxInfo(n));
+    }
+    while (state.KeepRunning()) {
+        tree.remove(txIds);
+        tree.add(infos);
+    }
+}
+
+static void MempoolEviction80k(benchmark::State& state) { MempoolEviction(state, 80000); }
+static void MempoolEviction320k(benchmark::State& state) { MempoolEviction(state, 320000); }
+static void MempoolBlockRemoval80k(benchmark::State& state) { MempoolBlockRemoval(state, 80000); }
+
+BENCHMARK(MempoolEviction80k);
+BENCHMARK(MempoolEviction320k);
+BENCHMARK(MempoolBlockRemoval80k);
@@ -0,0 +1,95 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "bench.h"
+#include "chainparams.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+#include "zcash/Note.hpp"
+#include "zcash/address/sapling.hpp"
+
+#include <assert.h>
+
+using namespace libzcash;
+
+/** The Sapling outputs of a Sapling-heavy block. */
+static const size_t BLOCK_SAPLING_OUTPUTS = 100;
+
+/** The witnesses of a wallet with many unspent Sapling notes. */
+static const size_t WALLET_SAPLING_WITNESSES = 1000;
+
+/** An encrypted Sapling note, as it is in an output. */
+struct EncryptedSaplingNote {
+    SaplingEncCiphertext ciphertext;
+    uint256 epk;
+    uint256 cmu;
+};
+
+static EncryptedSaplingNote EncryptSaplingNote(const SaplingPaymentAddress& addr, uint64_t value)
+{
+    SaplingNote note(addr, value, Zip212Enabled::AfterZip212);
+    std::array<unsigned char, ZC_MEMO_SIZE> memo = {{0xF6}};
+    auto encrypted = SaplingNotePlaintext(note, memo).encrypt(addr.pk_d);
+    assert(encrypted.has_value());
+    return {encrypted.value().first, encrypted.value().second.get_epk(), note.cmu().value()};
+}
+
+/**
+ * Trial-decrypts the outputs of a Sapling-heavy block with an incoming
+ * viewing key they are not for, as the wallet does for nearly all the
+ * outputs it scans.
+ */
+static void SaplingTrialDecryption(benchmark::State& state)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& consensus = Params().GetConsensus();
+    int nHeight = consensus.vUpgrades[Consensus::UPGRADE_CANOPY].nActivationHeight;
+
+    auto addr = SaplingSpendingKey::random().default_address();
+    std::vector<EncryptedSaplingNote> vNotes;
+    for (size_t i = 0; i < BLOCK_SAPLING_OUTPUTS; i++) {
+        vNotes.push_back(EncryptSaplingNote(addr, 1000 + i));
+    }
+    uint256 ivk = SaplingSpendingKey::random().full_viewing_key().in_viewing_key();
+
+    while (state.KeepRunning()) {
+        for (const EncryptedSaplingNote& note : vNotes) {
+            auto pt = SaplingNotePlaintext::decrypt(consensus, nHeight, note.ciphertext, ivk, note.epk, note.cmu);
+            assert(!pt.has_value());
+        }
+    }
+}
+
+/**
+ * Appends the note commitments of a Sapling-heavy block to the witnesses of
+ * a wallet's unspent notes, as IncrementNoteWitnesses does for each block.
+ */
+static void SaplingWitnessUpdate(benchmark::State& state)
+{
+    auto addr = SaplingSpendingKey::random().default_address();
+    std::vector<uint256> vCommitments;
+    for (size_t i = 0; i < BLOCK_SAPLING_OUTPUTS; i++) {
+        vCommitments.push_back(EncryptSaplingNote(addr, 1000 + i).cmu);
+    }
+
+    // A note of the wallet after each of the first commitments of the tree.
+    SaplingMerkleTree tree;
+    std::vector<SaplingWitness> vWitnesses;
+    vWitnesses.reserve(WALLET_SAPLING_WITNESSES);
+    std::vector<SaplingWitness*> vPtrs;
+    for (size_t i = 0; i < WALLET_SAPLING_WITNESSES; i++) {
+        PedersenHash cm = vCommitments[i % vCommitments.size()];
+        SaplingWitness::append_all(vPtrs, {cm});
+        tree.append(cm);
+        vWitnesses.push_back(tree.witness());
+        vPtrs.push_back(&vWitnesses.back());
+    }
+    std::vector<PedersenHash> vHashes(vCommitments.begin(), vCommitments.end());
+
+    while (state.KeepRunning()) {
+        SaplingWitness::append_all(vPtrs, vHashes);
+    }
+}
+
+BENCHMARK(SaplingTrialDecryption);
+BENCHMARK(SaplingWitnessUpdate);
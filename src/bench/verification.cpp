@@ -3,24 +3,36 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "bench.h"
+#include "checkqueue.h"
 #include "coins.h"
 #include "consensus/upgrades.h"
 #include "keystore.h"
+#include "main.h"
 #include "primitives/transaction.h"
 #include "script/interpreter.h"
 #include "script/sign.h"
 #include "streams.h"
 #include "uint256.h"
 #include "util/strencodings.h"
+#include "util/system.h"
 #include "version.h"
 
 #include "librustzcash.h"
 #include <rust/ed25519.h>
 #include <rust/sapling.h>
 
-static void ECDSA(benchmark::State& state)
+#include <boost/thread/thread.hpp>
+
+/**
+ * Creates a transaction with `nInputs` P2PKH inputs all signed by the same
+ * key, as in a consolidation transaction.
+ */
+static CTransaction MakeSignedP2PKHTransaction(
+    uint32_t nInputs,
+    uint32_t consensusBranchId,
+    CScript& scriptPubKey,
+    std::vector<CTxOut>& allPrevOutputs)
 {
-    uint32_t consensusBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_OVERWINTER].nBranchId;
     CMutableTransaction mtx;
     mtx.fOverwintered = true;
     mtx.nVersion = SAPLING_TX_VERSION;
@@ -30,10 +42,8 @@ static void ECDSA(benchmark::State& state)
     CBasicKeyStore keystore;
     keystore.AddKeyPubKey(key, key.GetPubKey());
     CKeyID hash = key.GetPubKey().GetID();
-    CScript scriptPubKey = GetScriptForDestination(hash);
+    scriptPubKey = GetScriptForDestination(hash);
 
-    // Benchmark a transaction containing a single input and output.
-    auto nInputs = 1;
     for(uint32_t ij = 0; ij < nInputs; ij++) {
         uint32_t i = mtx.vin.size();
         uint256 prevId;
@@ -49,7 +59,6 @@ static void ECDSA(benchmark::State& state)
         mtx.vout[i].scriptPubKey = CScript() << OP_1;
     }
 
-    std::vector<CTxOut> allPrevOutputs;
     // for benchmarking we simply use dummy inputs
     allPrevOutputs.resize(mtx.vin.size());
     const PrecomputedTransactionData txdata(mtx, allPrevOutputs);
@@ -64,6 +73,18 @@ static void ECDSA(benchmark::State& state)
     CDataStream ssout(SER_NETWORK, PROTOCOL_VERSION);
     ssout << mtx;
     ssout >> tx;
+    return tx;
+}
+
+static void ECDSA(benchmark::State& state)
+{
+    uint32_t consensusBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_OVERWINTER].nBranchId;
+    CScript scriptPubKey;
+    std::vector<CTxOut> allPrevOutputs;
+
+    // Benchmark a transaction containing a single input and output.
+    CTransaction tx = MakeSignedP2PKHTransaction(1, consensusBranchId, scriptPubKey, allPrevOutputs);
+    const PrecomputedTransactionData txdata(tx, allPrevOutputs);
 
     ScriptError error;
 
@@ -78,6 +99,121 @@ static void ECDSA(benchmark::State& state)
     }
 }
 
+static const uint32_t CONSOLIDATION_INPUTS = 500;
+
+/** Verifies the inputs of a consolidation transaction one at a time. */
+static void ECDSAConsolidation(benchmark::State& state)
+{
+    uint32_t consensusBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_OVERWINTER].nBranchId;
+    CScript scriptPubKey;
+    std::vector<CTxOut> allPrevOutputs;
+    CTransaction tx = MakeSignedP2PKHTransaction(CONSOLIDATION_INPUTS, consensusBranchId, scriptPubKey, allPrevOutputs);
+    const PrecomputedTransactionData txdata(tx, allPrevOutputs);
+
+    ScriptError error;
+
+    while (state.KeepRunning()) {
+        for (uint32_t i = 0; i < tx.vin.size(); i++) {
+            bool fValid = VerifyScript(
+                tx.vin[i].scriptSig,
+                scriptPubKey,
+                SCRIPT_VERIFY_P2SH,
+                TransactionSignatureChecker(&tx, txdata, i, 1000),
+                consensusBranchId,
+                &error);
+            assert(fValid);
+        }
+    }
+}
+
+/**
+ * Verifies the inputs of a consolidation transaction through a CCheckQueue,
+ * as ConnectBlock() does.
+ */
+static void ECDSAConsolidationCheckQueue(benchmark::State& state)
+{
+    uint32_t consensusBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_OVERWINTER].nBranchId;
+    CScript scriptPubKey;
+    std::vector<CTxOut> allPrevOutputs;
+    CTransaction tx = MakeSignedP2PKHTransaction(CONSOLIDATION_INPUTS, consensusBranchId, scriptPubKey, allPrevOutputs);
+    const PrecomputedTransactionData txdata(tx, allPrevOutputs);
+
+    struct InputCheck {
+        const CTransaction* ptx = nullptr;
+        const PrecomputedTransactionData* txdata = nullptr;
+        const CScript* scriptPubKey = nullptr;
+        uint32_t nIn = 0;
+        uint32_t consensusBranchId = 0;
+
+        bool operator()()
+        {
+            ScriptError error;
+            return VerifyScript(
+                ptx->vin[nIn].scriptSig,
+                *scriptPubKey,
+                SCRIPT_VERIFY_P2SH,
+                TransactionSignatureChecker(ptx, *txdata, nIn, 1000),
+                consensusBranchId,
+                &error);
+        }
+        void swap(InputCheck& x) { std::swap(*this, x); }
+    };
+    CCheckQueue<InputCheck> queue {128};
+    boost::thread_group tg;
+    for (auto x = 0; x < std::max(2, GetNumCores()) - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<InputCheck> control(&queue);
+        std::vector<InputCheck> vChecks(tx.vin.size());
+        for (uint32_t i = 0; i < tx.vin.size(); i++) {
+            vChecks[i] = {&tx, &txdata, &scriptPubKey, i, consensusBranchId};
+        }
+        control.Add(vChecks);
+        bool fValid = control.Wait();
+        assert(fValid);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+/**
+ * Verifies the inputs of a consolidation transaction with the CScriptCheck
+ * closures ConnectBlock() queues, including their signature cache lookups.
+ * The time spent in secp256k1 depends on the window size it is configured
+ * with (--with-secp256k1-ecmult-window).
+ */
+static void ECDSAConsolidationScriptCheck(benchmark::State& state)
+{
+    uint32_t consensusBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_OVERWINTER].nBranchId;
+    CScript scriptPubKey;
+    std::vector<CTxOut> allPrevOutputs;
+    CTransaction tx = MakeSignedP2PKHTransaction(CONSOLIDATION_INPUTS, consensusBranchId, scriptPubKey, allPrevOutputs);
+    const PrecomputedTransactionData txdata(tx, allPrevOutputs);
+    const CTxOut prevOut(1000, scriptPubKey);
+
+    CCheckQueue<CScriptCheck> queue {128};
+    boost::thread_group tg;
+    for (auto x = 0; x < std::max(2, GetNumCores()) - 1; ++x) {
+       tg.create_thread([&]{queue.Thread();});
+    }
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CScriptCheck> control(&queue);
+        std::vector<CScriptCheck> vChecks;
+        vChecks.reserve(tx.vin.size());
+        for (uint32_t i = 0; i < tx.vin.size(); i++) {
+            vChecks.emplace_back(prevOut, tx, i, SCRIPT_VERIFY_P2SH, false, consensusBranchId, &txdata);
+        }
+        control.Add(vChecks);
+        bool fValid = control.Wait();
+        assert(fValid);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
 static void JoinSplitSig(benchmark::State& state)
 {
     Ed25519VerificationKey joinSplitPubKey;
@@ -144,6 +280,9 @@ static void SaplingOutput(benchmark::State& state)
 }
 
 BENCHMARK(ECDSA);
+BENCHMARK(ECDSAConsolidation);
+BENCHMARK(ECDSAConsolidationCheckQueue);
+BENCHMARK(ECDSAConsolidationScriptCheck);
 BENCHMARK(JoinSplitSig);
 BENCHMARK(SaplingSpend);
 BENCHMARK(SaplingOutput);
@@ -12,6 +12,7 @@
 #include "util/system.h"
 #include "util/strencodings.h"
 
+#include <memory>
 #include <stdio.h>
 
 #include <event2/buffer.h>
@@ -33,6 +34,7 @@ const std::function<std::string(const char*)> G_TRANSLATION_FUN = nullptr;
 static const char DEFAULT_RPCCONNECT[] = "127.0.0.1";
 static const int DEFAULT_HTTP_CLIENT_TIMEOUT=900;
 static const int CONTINUE_EXECUTION=-1;
+static const int DEFAULT_STDIN_BATCH_SIZE=100;
 
 std::string HelpMessageCli()
 {
@@ -42,6 +44,8 @@ std::string HelpMessageCli()
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory (this path cannot use '~')"));
     strUsage += HelpMessageOpt("-stdin", _("Read extra arguments from standard input, one per line until EOF/Ctrl-D (recommended for sensitive information such as passphrases). If first extra argument is `walletpassphrase` then the first line(password) will not be echoed."));
+    strUsage += HelpMessageOpt("-stdin-batch", _("Read commands from standard input, one per line until EOF/Ctrl-D, with their arguments separated by spaces (quote an argument with \" or ' to include spaces). The commands are sent over one connection as JSON-RPC batches, and the result of each is printed on one line, in order."));
+    strUsage += HelpMessageOpt("-stdin-batchsize=<n>", strprintf(_("Number of commands sent in each batch with -stdin-batch (default: %d)"), DEFAULT_STDIN_BATCH_SIZE));
     AppendParamsHelpMessages(strUsage);
     strUsage += HelpMessageOpt("-rpcconnect=<ip>", strprintf(_("Send commands to node running on <ip> (default: %s)"), DEFAULT_RPCCONNECT));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Connect to JSON-RPC on <port> (default: %u or testnet: %u)"), 8232, 18232));
@@ -197,79 +201,230 @@ static void http_error_cb(enum evhttp_request_error err, void *ctx)
 }
 #endif
 
-UniValue CallRPC(const std::string& strMethod, const UniValue& params)
+/**
+ * A connection to the RPC server. Unless it is kept alive, the server closes
+ * it after one request.
+ */
+class CRPCConnection
 {
-    std::string host = GetArg("-rpcconnect", DEFAULT_RPCCONNECT);
-    int port = GetArg("-rpcport", BaseParams().RPCPort());
+    std::string host;
+    raii_event_base base;
+    raii_evhttp_connection evcon;
+    std::string strRPCUserColonPass;
+    bool fKeepAlive;
+
+public:
+    explicit CRPCConnection(bool fKeepAliveIn) : fKeepAlive(fKeepAliveIn)
+    {
+        host = GetArg("-rpcconnect", DEFAULT_RPCCONNECT);
+        int port = GetArg("-rpcport", BaseParams().RPCPort());
+
+        // Obtain event base
+        base = obtain_event_base();
+
+        // Synchronously look up hostname
+        evcon = obtain_evhttp_connection_base(base.get(), host, port);
+        evhttp_connection_set_timeout(evcon.get(), GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
 
-    // Obtain event base
-    raii_event_base base = obtain_event_base();
+        // Get credentials
+        if (mapArgs["-rpcpassword"] == "") {
+            // Try fall back to cookie-based authentication if no password is provided
+            if (!GetAuthCookie(&strRPCUserColonPass)) {
+                throw std::runtime_error(strprintf(
+                    _("Could not locate RPC credentials. No authentication cookie could be found,\n"
+                      "and no rpcpassword is set in the configuration file (%s)."),
+                        GetConfigFile(GetArg("-conf", BITCOIN_CONF_FILENAME)).string().c_str()));
 
-    // Synchronously look up hostname
-    raii_evhttp_connection evcon = obtain_evhttp_connection_base(base.get(), host, port);
-    evhttp_connection_set_timeout(evcon.get(), GetArg("-rpcclienttimeout", DEFAULT_HTTP_CLIENT_TIMEOUT));
+            }
+        } else {
+            strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
+        }
+    }
 
-    HTTPReply response;
-    raii_evhttp_request req = obtain_evhttp_request(http_request_done, (void*)&response);
-    if (req == NULL)
-        throw std::runtime_error("create http request failed");
+    /** Send a JSON-RPC request (or batch of requests) and return the parsed reply. */
+    UniValue Send(const std::string& strRequest)
+    {
+        HTTPReply response;
+        raii_evhttp_request req = obtain_evhttp_request(http_request_done, (void*)&response);
+        if (req == NULL)
+            throw std::runtime_error("create http request failed");
 #if LIBEVENT_VERSION_NUMBER >= 0x02010300
-    evhttp_request_set_error_cb(req.get(), http_error_cb);
+        evhttp_request_set_error_cb(req.get(), http_error_cb);
 #endif
 
-    // Get credentials
-    std::string strRPCUserColonPass;
-    if (mapArgs["-rpcpassword"] == "") {
-        // Try fall back to cookie-based authentication if no password is provided
-        if (!GetAuthCookie(&strRPCUserColonPass)) {
-            throw std::runtime_error(strprintf(
-                _("Could not locate RPC credentials. No authentication cookie could be found,\n"
-                  "and no rpcpassword is set in the configuration file (%s)."),
-                    GetConfigFile(GetArg("-conf", BITCOIN_CONF_FILENAME)).string().c_str()));
-
+        struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
+        assert(output_headers);
+        evhttp_add_header(output_headers, "Host", host.c_str());
+        evhttp_add_header(output_headers, "Connection", fKeepAlive ? "keep-alive" : "close");
+        evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
+
+        // Attach request data
+        struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
+        assert(output_buffer);
+        evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
+
+        int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, "/");
+        req.release(); // ownership moved to evcon in above call
+        if (r != 0) {
+            throw CConnectionFailed("send http request failed");
         }
-    } else {
-        strRPCUserColonPass = mapArgs["-rpcuser"] + ":" + mapArgs["-rpcpassword"];
+
+        event_base_dispatch(base.get());
+
+        if (response.status == 0)
+            throw CConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring(response.error), response.error));
+        else if (response.status == HTTP_UNAUTHORIZED)
+            throw std::runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
+        else if (response.status >= 400 && response.status != HTTP_BAD_REQUEST && response.status != HTTP_NOT_FOUND && response.status != HTTP_INTERNAL_SERVER_ERROR)
+            throw std::runtime_error(strprintf("server returned HTTP error %d", response.status));
+        else if (response.body.empty())
+            throw std::runtime_error("no response from server");
+
+        // Parse reply
+        UniValue valReply(UniValue::VSTR);
+        if (!valReply.read(response.body))
+            throw std::runtime_error("couldn't parse reply from server");
+        if (valReply.empty())
+            throw std::runtime_error("expected reply to have result, error and id properties");
+
+        return valReply;
     }
+};
 
-    struct evkeyvalq* output_headers = evhttp_request_get_output_headers(req.get());
-    assert(output_headers);
-    evhttp_add_header(output_headers, "Host", host.c_str());
-    evhttp_add_header(output_headers, "Connection", "close");
-    evhttp_add_header(output_headers, "Authorization", (std::string("Basic ") + EncodeBase64(strRPCUserColonPass)).c_str());
-
-    // Attach request data
-    std::string strRequest = JSONRPCRequest(strMethod, params, 1);
-    struct evbuffer* output_buffer = evhttp_request_get_output_buffer(req.get());
-    assert(output_buffer);
-    evbuffer_add(output_buffer, strRequest.data(), strRequest.size());
-
-    int r = evhttp_make_request(evcon.get(), req.get(), EVHTTP_REQ_POST, "/");
-    req.release(); // ownership moved to evcon in above call
-    if (r != 0) {
-        throw CConnectionFailed("send http request failed");
+UniValue CallRPC(const std::string& strMethod, const UniValue& params)
+{
+    CRPCConnection connection(false);
+    const UniValue reply = connection.Send(JSONRPCRequest(strMethod, params, 1));
+    return reply.get_obj();
+}
+
+/**
+ * Split a -stdin-batch line into arguments separated by spaces. An argument
+ * may be quoted with " or ' to include spaces, and \ escapes the next
+ * character inside double quotes and outside quotes.
+ */
+static std::vector<std::string> SplitBatchLine(const std::string& line)
+{
+    std::vector<std::string> args;
+    std::string arg;
+    bool fInArg = false;
+    char quote = 0;
+    for (size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quote == '\'') {
+            if (c == '\'') {
+                quote = 0;
+            } else {
+                arg += c;
+            }
+        } else if (c == '\\' && i + 1 < line.size()) {
+            arg += line[++i];
+            fInArg = true;
+        } else if (quote == '"') {
+            if (c == '"') {
+                quote = 0;
+            } else {
+                arg += c;
+            }
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+            fInArg = true;
+        } else if (c == ' ' || c == '\t' || c == '\r') {
+            if (fInArg) {
+                args.push_back(arg);
+                arg.clear();
+                fInArg = false;
+            }
+        } else {
+            arg += c;
+            fInArg = true;
+        }
     }
+    if (quote != 0)
+        throw std::runtime_error(strprintf("unterminated quote in command: %s", line));
+    if (fInArg)
+        args.push_back(arg);
+    return args;
+}
 
-    event_base_dispatch(base.get());
-
-    if (response.status == 0)
-        throw CConnectionFailed(strprintf("couldn't connect to server: %s (code %d)\n(make sure server is running and you are connecting to the correct RPC port)", http_errorstring(response.error), response.error));
-    else if (response.status == HTTP_UNAUTHORIZED)
-        throw std::runtime_error("incorrect rpcuser or rpcpassword (authorization failed)");
-    else if (response.status >= 400 && response.status != HTTP_BAD_REQUEST && response.status != HTTP_NOT_FOUND && response.status != HTTP_INTERNAL_SERVER_ERROR)
-        throw std::runtime_error(strprintf("server returned HTTP error %d", response.status));
-    else if (response.body.empty())
-        throw std::runtime_error("no response from server");
-
-    // Parse reply
-    UniValue valReply(UniValue::VSTR);
-    if (!valReply.read(response.body))
-        throw std::runtime_error("couldn't parse reply from server");
-    const UniValue& reply = valReply.get_obj();
-    if (reply.empty())
-        throw std::runtime_error("expected reply to have result, error and id properties");
-
-    return reply;
+/**
+ * Run the commands read from stdin in batches over one connection, printing
+ * the result of each on one line. Returns the exit code of the first command
+ * that failed, or 0.
+ */
+static int StdinBatchRPC()
+{
+    const int nBatchSize = GetArg("-stdin-batchsize", DEFAULT_STDIN_BATCH_SIZE);
+    if (nBatchSize < 1)
+        throw std::runtime_error("-stdin-batchsize must be at least 1");
+    const bool fWait = GetBoolArg("-rpcwait", false);
+
+    int nRet = 0;
+    std::unique_ptr<CRPCConnection> connection;
+    std::string line;
+    bool fEOF = false;
+    while (!fEOF) {
+        // Read the next batch of commands; blank lines and comments are skipped.
+        UniValue batch(UniValue::VARR);
+        while (batch.size() < (size_t)nBatchSize) {
+            if (!std::getline(std::cin, line)) {
+                fEOF = true;
+                break;
+            }
+            std::vector<std::string> args = SplitBatchLine(line);
+            if (args.empty() || args[0][0] == '#')
+                continue;
+            UniValue params = RPCConvertValues(args[0], std::vector<std::string>(args.begin()+1, args.end()));
+            batch.push_back(JSONRPCRequestObj(args[0], params, (int)batch.size()));
+        }
+        if (batch.empty())
+            break;
+
+        UniValue replies;
+        do {
+            try {
+                if (!connection)
+                    connection.reset(new CRPCConnection(true));
+                replies = connection->Send(batch.write());
+                break;
+            }
+            catch (const CConnectionFailed&) {
+                // The server may have closed the connection; reconnect.
+                connection.reset();
+                if (fWait)
+                    MilliSleep(1000);
+                else
+                    throw;
+            }
+        } while (fWait);
+
+        if (!replies.isArray())
+            throw std::runtime_error("expected a batch reply from server");
+        std::vector<UniValue> vReplies(batch.size());
+        for (const UniValue& reply : replies.getValues()) {
+            const UniValue& id = find_value(reply, "id");
+            if (!id.isNum() || id.get_int() < 0 || (size_t)id.get_int() >= vReplies.size())
+                throw std::runtime_error("unexpected id in batch reply from server");
+            vReplies[id.get_int()] = reply;
+        }
+        for (const UniValue& reply : vReplies) {
+            const UniValue& result = find_value(reply, "result");
+            const UniValue& error  = find_value(reply, "error");
+            if (!error.isNull()) {
+                fprintf(stdout, "error: %s\n", error.write().c_str());
+                if (nRet == 0) {
+                    const UniValue& errCode = find_value(error, "code");
+                    nRet = errCode.isNum() ? abs(errCode.get_int()) : EXIT_FAILURE;
+                }
+            } else if (result.isStr()) {
+                fprintf(stdout, "%s\n", result.get_str().c_str());
+            } else {
+                fprintf(stdout, "%s\n", result.write().c_str());
+            }
+        }
+        fflush(stdout);
+    }
+    return nRet;
 }
 
 bool SetStdinEcho(bool enable = true)
@@ -318,6 +473,11 @@ int CommandLineRPC(int argc, char *argv[])
             argv++;
         }
         std::vector<std::string> args = std::vector<std::string>(&argv[1], &argv[argc]);
+        if (GetBoolArg("-stdin-batch", false)) {
+            if (!args.empty())
+                throw std::runtime_error("-stdin-batch reads its commands from standard input, and takes no command arguments");
+            return StdinBatchRPC();
+        }
         if (GetBoolArg("-stdin", false)) {
             bool hide = false;
             if (args.size() > 0 && args[0] == "walletpassphrase") {
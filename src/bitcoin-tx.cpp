@@ -19,7 +19,12 @@
 #include "util/moneystr.h"
 #include "util/strencodings.h"
 
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
 #include <stdio.h>
+#include <thread>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/assign/list_of.hpp>
@@ -27,6 +32,10 @@
 static bool fCreateBlank;
 static std::map<std::string,UniValue> registers;
 static const int CONTINUE_EXECUTION=-1;
+//! Number of -stream lines that are processed (in parallel) before their output is written.
+static const size_t STREAM_CHUNK_SIZE=1024;
+//! Set once ECC has been started for the whole process, by -stream.
+static bool fECCStarted = false;
 
 const std::function<std::string(const char*)> G_TRANSLATION_FUN = nullptr;
 
@@ -58,6 +67,7 @@ static int AppInitRawTx(int argc, char* argv[])
             _("Usage:") + "\n" +
               "  zcash-tx [options] <hex-tx> [commands]  " + _("Update hex-encoded zcash transaction") + "\n" +
               "  zcash-tx [options] -create [commands]   " + _("Create hex-encoded zcash transaction") + "\n" +
+              "  zcash-tx [options] -stream [register commands]  " + _("Create or update a transaction for each line of standard input") + "\n" +
               "\n";
 
         fprintf(stdout, "%s", strUsage.c_str());
@@ -66,6 +76,10 @@ static int AppInitRawTx(int argc, char* argv[])
         strUsage += HelpMessageOpt("-?", _("This help message"));
         strUsage += HelpMessageOpt("-create", _("Create new, empty TX."));
         strUsage += HelpMessageOpt("-json", _("Select JSON output"));
+        strUsage += HelpMessageOpt("-stream", _("Read one JSON object per line from standard input, {\"hex\":\"hex-tx\",\"commands\":[\"command\",...]}, "
+            "and write the resulting transaction (or \"error: \" and a message) on one line for each, in order. \"hex\" may be left out to create "
+            "a transaction. The registers set by register commands on the command line are shared by all the transactions, so that "
+            "keys and previous outputs are parsed once, and the transactions are created and signed on all cores."));
         strUsage += HelpMessageOpt("-txid", _("Output only the hex-encoded transaction id of the resultant transaction."));
         AppendParamsHelpMessages(strUsage);
 
@@ -100,6 +114,20 @@ static int AppInitRawTx(int argc, char* argv[])
     return CONTINUE_EXECUTION;
 }
 
+/** The keys and previous outputs given in the privatekeys and prevtxs registers. */
+struct TxSignContext {
+    CBasicKeyStore keystore;
+    std::map<COutPoint, CTxOut> prevouts;
+};
+
+//! Parsed from the registers when first needed, and reset when they change.
+static std::shared_ptr<const TxSignContext> signContext;
+
+static void ResetSignContext()
+{
+    signContext.reset();
+}
+
 static void RegisterSetJson(const std::string& key, const std::string& rawJson)
 {
     UniValue val;
@@ -109,6 +137,7 @@ static void RegisterSetJson(const std::string& key, const std::string& rawJson)
     }
 
     registers[key] = val;
+    ResetSignContext();
 }
 
 static void RegisterSet(const std::string& strInput)
@@ -346,47 +375,16 @@ static CAmount AmountFromValue(const UniValue& value)
     return amount;
 }
 
-static void MutateTxSign(CMutableTransaction& tx, const std::string& strInput)
+static std::shared_ptr<const TxSignContext> GetSignContext()
 {
-    // separate HEIGHT:SIGHASH-FLAGS in string
-    size_t pos = strInput.find(':');
-    if ((pos == 0) ||
-        (pos == (strInput.size() - 1)))
-        throw std::runtime_error("Invalid sighash flag separator");
-
-    // extract and validate HEIGHT
-    std::string strHeight = strInput.substr(0, pos);
-    int nHeight = atoi(strHeight);
-    if (nHeight <= 0) {
-        throw std::runtime_error("invalid height");
-    }
-
-    // extract and validate SIGHASH-FLAGS
-    int nHashType = SIGHASH_ALL;
-    std::string flagStr;
-    if (pos != std::string::npos) {
-        flagStr = strInput.substr(pos + 1, std::string::npos);
-    }
-    if (flagStr.size() > 0)
-        if (!findSighashFlags(nHashType, flagStr))
-            throw std::runtime_error("unknown sighash flag/sign option");
+    if (signContext)
+        return signContext;
 
-    std::vector<CTransaction> txVariants;
-    txVariants.push_back(tx);
-
-    // mergedTx will end up with all the signatures; it
-    // starts as a clone of the raw tx:
-    CMutableTransaction mergedTx(txVariants[0]);
-    bool fComplete = true;
-    CCoinsView viewDummy;
-    CCoinsViewCache view(&viewDummy);
+    auto context = std::make_shared<TxSignContext>();
 
     if (!registers.count("privatekeys"))
         throw std::runtime_error("privatekeys register variable must be set.");
-    bool fGivenKeys = false;
-    CBasicKeyStore tempKeystore;
     UniValue keysObj = registers["privatekeys"];
-    fGivenKeys = true;
 
     KeyIO keyIO(Params());
 
@@ -397,7 +395,7 @@ static void MutateTxSign(CMutableTransaction& tx, const std::string& strInput)
         if (!key.IsValid()) {
             throw std::runtime_error("privatekey not valid");
         }
-        tempKeystore.AddKey(key);
+        context->keystore.AddKey(key);
     }
 
     // Add previous txouts given in the RPC call:
@@ -424,35 +422,74 @@ static void MutateTxSign(CMutableTransaction& tx, const std::string& strInput)
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                COutPoint out(txid, nOut);
+                auto it = context->prevouts.find(out);
+                if (it != context->prevouts.end() && it->second.scriptPubKey != scriptPubKey) {
                     std::string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + ScriptToAsmStr(coins->vout[nOut].scriptPubKey) + "\nvs:\n"+
+                    err = err + ScriptToAsmStr(it->second.scriptPubKey) + "\nvs:\n"+
                         ScriptToAsmStr(scriptPubKey);
                     throw std::runtime_error(err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
+                CTxOut txout;
+                txout.scriptPubKey = scriptPubKey;
+                txout.nValue = 0;
                 if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(prevOut["amount"]);
+                    txout.nValue = AmountFromValue(prevOut["amount"]);
                 }
+                context->prevouts[out] = txout;
             }
 
             // if redeemScript given and private keys given,
-            // add redeemScript to the tempKeystore so it can be signed:
-            if (fGivenKeys && scriptPubKey.IsPayToScriptHash() &&
+            // add redeemScript to the keystore so it can be signed:
+            if (scriptPubKey.IsPayToScriptHash() &&
                 prevOut.exists("redeemScript")) {
                 UniValue v = prevOut["redeemScript"];
                 std::vector<unsigned char> rsData(ParseHexUV(v, "redeemScript"));
                 CScript redeemScript(rsData.begin(), rsData.end());
-                tempKeystore.AddCScript(redeemScript);
+                context->keystore.AddCScript(redeemScript);
             }
         }
     }
 
-    const CKeyStore& keystore = tempKeystore;
+    signContext = context;
+    return signContext;
+}
+
+static void MutateTxSign(CMutableTransaction& tx, const std::string& strInput)
+{
+    // separate HEIGHT:SIGHASH-FLAGS in string
+    size_t pos = strInput.find(':');
+    if ((pos == 0) ||
+        (pos == (strInput.size() - 1)))
+        throw std::runtime_error("Invalid sighash flag separator");
+
+    // extract and validate HEIGHT
+    std::string strHeight = strInput.substr(0, pos);
+    int nHeight = atoi(strHeight);
+    if (nHeight <= 0) {
+        throw std::runtime_error("invalid height");
+    }
+
+    // extract and validate SIGHASH-FLAGS
+    int nHashType = SIGHASH_ALL;
+    std::string flagStr;
+    if (pos != std::string::npos) {
+        flagStr = strInput.substr(pos + 1, std::string::npos);
+    }
+    if (flagStr.size() > 0)
+        if (!findSighashFlags(nHashType, flagStr))
+            throw std::runtime_error("unknown sighash flag/sign option");
+
+    std::vector<CTransaction> txVariants;
+    txVariants.push_back(tx);
+
+    // mergedTx will end up with all the signatures; it
+    // starts as a clone of the raw tx:
+    CMutableTransaction mergedTx(txVariants[0]);
+    bool fComplete = true;
+
+    std::shared_ptr<const TxSignContext> context = GetSignContext();
+    const CKeyStore& keystore = context->keystore;
     // We don't support v5 transactions via this API yet.
     if (mergedTx.nVersion >= ZIP225_TX_VERSION) {
         throw std::runtime_error("v5+ transactions not supported yet");
@@ -467,13 +504,13 @@ static void MutateTxSign(CMutableTransaction& tx, const std::string& strInput)
     // Sign what we can:
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (!coins || !coins->IsAvailable(txin.prevout.n)) {
+        auto it = context->prevouts.find(txin.prevout);
+        if (it == context->prevouts.end()) {
             fComplete = false;
             continue;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
+        const CScript& prevPubKey = it->second.scriptPubKey;
+        const CAmount& amount = it->second.nValue;
 
         SignatureData sigdata;
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
@@ -535,7 +572,7 @@ static void MutateTx(CMutableTransaction& tx, const std::string& command,
         MutateTxAddOutScript(tx, commandVal);
 
     else if (command == "sign") {
-        if (!ecc) { ecc.reset(new Secp256k1Init()); }
+        if (!ecc && !fECCStarted) { ecc.reset(new Secp256k1Init()); }
         MutateTxSign(tx, commandVal);
     }
 
@@ -582,6 +619,122 @@ static void OutputTx(const CTransaction& tx)
         OutputTxHex(tx);
 }
 
+/** Split a command line argument into its command and value. */
+static void SplitCommand(const std::string& arg, std::string& key, std::string& value)
+{
+    size_t eqpos = arg.find('=');
+    if (eqpos == std::string::npos)
+        key = arg;
+    else {
+        key = arg.substr(0, eqpos);
+        value = arg.substr(eqpos + 1);
+    }
+}
+
+/** Create or update the transaction described by one line of -stream input. */
+static std::string StreamTx(const std::string& line, bool fJson, bool fTxid)
+{
+    UniValue obj;
+    if (!obj.read(line) || !obj.isObject())
+        throw std::runtime_error("expected a JSON object");
+
+    CTransaction txDecodeTmp;
+    const UniValue& hex = find_value(obj, "hex");
+    if (!hex.isNull()) {
+        if (!hex.isStr() || !DecodeHexTx(txDecodeTmp, hex.get_str()))
+            throw std::runtime_error("invalid transaction encoding");
+    }
+    CMutableTransaction tx(txDecodeTmp);
+
+    const UniValue& commands = find_value(obj, "commands");
+    if (!commands.isNull() && !commands.isArray())
+        throw std::runtime_error("commands must be an array");
+    for (const UniValue& command : commands.getValues()) {
+        if (!command.isStr())
+            throw std::runtime_error("command not a string");
+        std::string key, value;
+        SplitCommand(command.get_str(), key, value);
+        // The registers are shared by all the transactions of the stream.
+        if (key == "load" || key == "set")
+            throw std::runtime_error("register commands must be given on the command line with -stream");
+        MutateTx(tx, key, value);
+    }
+
+    if (fJson) {
+        UniValue entry(UniValue::VOBJ);
+        TxToUniv(tx, uint256(), entry);
+        return entry.write();
+    } else if (fTxid) {
+        return tx.GetHash().GetHex();
+    }
+    return EncodeHexTx(tx);
+}
+
+/**
+ * Run -stream: process the lines of standard input in chunks, each chunk on
+ * all cores, writing the output of each chunk in order once it is done.
+ */
+static int StreamRawTx()
+{
+    const bool fJson = GetBoolArg("-json", false);
+    const bool fTxid = GetBoolArg("-txid", false);
+
+    Secp256k1Init ecc;
+    fECCStarted = true;
+    // Parse the keys and previous outputs once, before the threads share them.
+    if (registers.count("privatekeys") && registers.count("prevtxs"))
+        GetSignContext();
+
+    int nRet = 0;
+    std::vector<std::string> vLines;
+    std::vector<std::string> vOutput;
+    std::string line;
+    bool fEOF = false;
+    while (!fEOF) {
+        vLines.clear();
+        while (vLines.size() < STREAM_CHUNK_SIZE) {
+            if (!std::getline(std::cin, line)) {
+                fEOF = true;
+                break;
+            }
+            boost::algorithm::trim_right(line);
+            if (!line.empty())
+                vLines.push_back(line);
+        }
+
+        vOutput.assign(vLines.size(), std::string());
+        std::atomic<size_t> nNext{0};
+        auto process = [&]() {
+            for (size_t i = nNext++; i < vLines.size(); i = nNext++) {
+                try {
+                    vOutput[i] = StreamTx(vLines[i], fJson, fTxid);
+                } catch (const std::exception& e) {
+                    vOutput[i] = std::string("error: ") + e.what();
+                }
+            }
+        };
+        size_t nThreads = std::min(vLines.size(), (size_t)std::max(1, GetNumCores()));
+        std::vector<std::thread> vThreads;
+        for (size_t i = 1; i < nThreads; i++) {
+            vThreads.emplace_back(process);
+        }
+        process();
+        for (std::thread& thread : vThreads) {
+            thread.join();
+        }
+
+        for (const std::string& output : vOutput) {
+            if (output.compare(0, 7, "error: ") == 0)
+                nRet = EXIT_FAILURE;
+            fprintf(stdout, "%s\n", output.c_str());
+        }
+        fflush(stdout);
+    }
+
+    fECCStarted = false;
+    return nRet;
+}
+
 static std::string readStdin()
 {
     char buf[4096];
@@ -614,6 +767,21 @@ static int CommandLineRawTx(int argc, char* argv[])
             argv++;
         }
 
+        if (GetBoolArg("-stream", false)) {
+            // The commands on the command line set the shared registers.
+            for (int i = 1; i < argc; i++) {
+                std::string key, value;
+                SplitCommand(argv[i], key, value);
+                if (key == "load")
+                    RegisterLoad(value);
+                else if (key == "set")
+                    RegisterSet(value);
+                else
+                    throw std::runtime_error("only register commands can be given on the command line with -stream");
+            }
+            return StreamRawTx();
+        }
+
         CTransaction txDecodeTmp;
         int startArg;
 
@@ -637,15 +805,8 @@ static int CommandLineRawTx(int argc, char* argv[])
         CMutableTransaction tx(txDecodeTmp);
 
         for (int i = startArg; i < argc; i++) {
-            std::string arg = argv[i];
             std::string key, value;
-            size_t eqpos = arg.find('=');
-            if (eqpos == std::string::npos)
-                key = arg;
-            else {
-                key = arg.substr(0, eqpos);
-                value = arg.substr(eqpos + 1);
-            }
+            SplitCommand(argv[i], key, value);
 
             MutateTx(tx, key, value);
         }
@@ -0,0 +1,330 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockfilter.h"
+
+#include "crypto/common.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "script/script.h"
+#include "streams.h"
+#include "undo.h"
+#include "version.h"
+
+#include <algorithm>
+#include <ios>
+#include <limits>
+#include <map>
+#include <stdexcept>
+
+/** The parameters of the basic filter type of BIP 158. */
+static const uint8_t BASIC_FILTER_P = 19;
+static const uint32_t BASIC_FILTER_M = 784931;
+
+namespace {
+
+/** Appends bits to a byte vector, most significant bit first. */
+class BitWriter
+{
+    std::vector<unsigned char>& vch;
+    uint8_t nBuffer;
+    int nBits;
+
+public:
+    explicit BitWriter(std::vector<unsigned char>& vchIn) : vch(vchIn), nBuffer(0), nBits(0) {}
+
+    //! Write the low nCount bits of data.
+    void Write(uint64_t data, int nCount)
+    {
+        while (nCount > 0) {
+            int nTake = std::min(8 - nBits, nCount);
+            uint8_t chunk = (data >> (nCount - nTake)) & ((1 << nTake) - 1);
+            nBuffer |= chunk << (8 - nBits - nTake);
+            nBits += nTake;
+            nCount -= nTake;
+            if (nBits == 8) {
+                Flush();
+            }
+        }
+    }
+
+    //! Write out the last partial byte, padded with zero bits.
+    void Flush()
+    {
+        if (nBits > 0) {
+            vch.push_back(nBuffer);
+            nBuffer = 0;
+            nBits = 0;
+        }
+    }
+};
+
+/** Reads bits from a byte vector, most significant bit first. */
+class BitReader
+{
+    const std::vector<unsigned char>& vch;
+    size_t nPos;
+    uint8_t nBuffer;
+    int nBits;
+
+public:
+    BitReader(const std::vector<unsigned char>& vchIn, size_t nPosIn) : vch(vchIn), nPos(nPosIn), nBuffer(0), nBits(0) {}
+
+    //! Read nCount bits. Throws std::ios_base::failure past the end.
+    uint64_t Read(int nCount)
+    {
+        uint64_t data = 0;
+        while (nCount > 0) {
+            if (nBits == 0) {
+                if (nPos >= vch.size()) {
+                    throw std::ios_base::failure("BitReader::Read(): end of data");
+                }
+                nBuffer = vch[nPos++];
+                nBits = 8;
+            }
+            int nTake = std::min(nBits, nCount);
+            data = (data << nTake) | ((nBuffer >> (nBits - nTake)) & ((1 << nTake) - 1));
+            nBits -= nTake;
+            nCount -= nTake;
+        }
+        return data;
+    }
+
+    //! The number of bytes read from, including a partially read one.
+    size_t GetPos() const { return nPos; }
+};
+
+void GolombRiceEncode(BitWriter& writer, uint8_t P, uint64_t x)
+{
+    // The quotient in unary, as ones terminated by a zero, then the
+    // remainder in P bits.
+    uint64_t q = x >> P;
+    while (q > 0) {
+        int nCount = std::min<uint64_t>(q, 64);
+        writer.Write(~0ULL, nCount);
+        q -= nCount;
+    }
+    writer.Write(0, 1);
+    writer.Write(x, P);
+}
+
+uint64_t GolombRiceDecode(BitReader& reader, uint8_t P)
+{
+    uint64_t q = 0;
+    while (reader.Read(1) == 1) {
+        q++;
+    }
+    uint64_t r = reader.Read(P);
+    return (q << P) + r;
+}
+
+/** Map x uniformly into [0, n), as (x * n) >> 64. */
+uint64_t MapIntoRange(uint64_t x, uint64_t n)
+{
+#ifdef __SIZEOF_INT128__
+    return (uint64_t)(((unsigned __int128)x * (unsigned __int128)n) >> 64);
+#else
+    uint64_t x_hi = x >> 32, x_lo = x & 0xFFFFFFFF;
+    uint64_t n_hi = n >> 32, n_lo = n & 0xFFFFFFFF;
+    uint64_t ac = x_hi * n_hi;
+    uint64_t ad = x_hi * n_lo;
+    uint64_t bc = x_lo * n_hi;
+    uint64_t bd = x_lo * n_lo;
+    uint64_t mid34 = (bd >> 32) + (bc & 0xFFFFFFFF) + (ad & 0xFFFFFFFF);
+    return ac + (bc >> 32) + (ad >> 32) + (mid34 >> 32);
+#endif
+}
+
+} // namespace
+
+GCSFilter::GCSFilter(const Params& paramsIn) : params(paramsIn), N(0), F(0)
+{
+    CVectorWriter writer(SER_NETWORK, PROTOCOL_VERSION, encoded);
+    WriteCompactSize(writer, N);
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn, std::vector<unsigned char> encodedIn)
+    : params(paramsIn), encoded(std::move(encodedIn))
+{
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream.write((const char*)encoded.data(), encoded.size());
+    uint64_t nElements = ReadCompactSize(stream);
+    N = nElements;
+    F = uint64_t(N) * params.M;
+
+    // Decode the filter once to check that it holds exactly N elements.
+    BitReader reader(encoded, encoded.size() - stream.size());
+    for (uint64_t i = 0; i < nElements; i++) {
+        GolombRiceDecode(reader, params.P);
+    }
+    if (reader.GetPos() != encoded.size()) {
+        throw std::ios_base::failure("GCSFilter: encoded filter contains excess data");
+    }
+}
+
+GCSFilter::GCSFilter(const Params& paramsIn, const ElementSet& elements) : params(paramsIn)
+{
+    if (elements.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::invalid_argument("GCSFilter: too many elements");
+    }
+    N = elements.size();
+    F = uint64_t(N) * params.M;
+
+    CVectorWriter writer(SER_NETWORK, PROTOCOL_VERSION, encoded);
+    WriteCompactSize(writer, N);
+
+    std::vector<uint64_t> vHashes;
+    vHashes.reserve(elements.size());
+    for (const Element& element : elements) {
+        vHashes.push_back(HashToRange(element));
+    }
+    std::sort(vHashes.begin(), vHashes.end());
+
+    BitWriter bitWriter(encoded);
+    uint64_t nLast = 0;
+    for (uint64_t hash : vHashes) {
+        GolombRiceEncode(bitWriter, params.P, hash - nLast);
+        nLast = hash;
+    }
+    bitWriter.Flush();
+}
+
+uint64_t GCSFilter::HashToRange(const Element& element) const
+{
+    uint64_t hash = CSipHasher(params.k0, params.k1).Write(element.data(), element.size()).Finalize();
+    return MapIntoRange(hash, F);
+}
+
+bool GCSFilter::MatchInternal(const std::vector<uint64_t>& vHashes) const
+{
+    // The element count was checked to be canonically encoded.
+    BitReader reader(encoded, GetSizeOfCompactSize(N));
+
+    // Both lists are sorted, so they are merged in one pass.
+    uint64_t value = 0;
+    size_t i = 0;
+    for (uint32_t nRead = 0; nRead < N && i < vHashes.size(); nRead++) {
+        value += GolombRiceDecode(reader, params.P);
+        while (i < vHashes.size() && vHashes[i] < value) {
+            i++;
+        }
+        if (i < vHashes.size() && vHashes[i] == value) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool GCSFilter::Match(const Element& element) const
+{
+    if (N == 0) {
+        return false;
+    }
+    return MatchInternal({HashToRange(element)});
+}
+
+bool GCSFilter::MatchAny(const ElementSet& elements) const
+{
+    if (N == 0) {
+        return false;
+    }
+    std::vector<uint64_t> vHashes;
+    vHashes.reserve(elements.size());
+    for (const Element& element : elements) {
+        vHashes.push_back(HashToRange(element));
+    }
+    std::sort(vHashes.begin(), vHashes.end());
+    return MatchInternal(vHashes);
+}
+
+static const std::map<BlockFilterType, std::string> g_filter_types = {
+    {BlockFilterType::BASIC, "basic"},
+};
+
+const std::string& BlockFilterTypeName(BlockFilterType filter_type)
+{
+    static const std::string unknown;
+    auto it = g_filter_types.find(filter_type);
+    return it != g_filter_types.end() ? it->second : unknown;
+}
+
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& filter_type)
+{
+    for (const auto& entry : g_filter_types) {
+        if (entry.second == name) {
+            filter_type = entry.first;
+            return true;
+        }
+    }
+    return false;
+}
+
+static GCSFilter::ElementSet BasicFilterElements(const CBlock& block, const CBlockUndo& block_undo)
+{
+    GCSFilter::ElementSet elements;
+    for (const CTransaction& tx : block.vtx) {
+        for (const CTxOut& txout : tx.vout) {
+            const CScript& script = txout.scriptPubKey;
+            if (script.empty() || script[0] == OP_RETURN) continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+    for (const CTxUndo& tx_undo : block_undo.vtxundo) {
+        for (const Coin& prevout : tx_undo.vprevout) {
+            const CScript& script = prevout.out.scriptPubKey;
+            if (script.empty()) continue;
+            elements.emplace(script.begin(), script.end());
+        }
+    }
+    return elements;
+}
+
+bool BlockFilter::BuildParams(GCSFilter::Params& params) const
+{
+    switch (filter_type) {
+        case BlockFilterType::BASIC:
+            // Keyed by the first 16 bytes of the block hash, so that the
+            // false positives differ from block to block.
+            params.k0 = ReadLE64(block_hash.begin());
+            params.k1 = ReadLE64(block_hash.begin() + 8);
+            params.P = BASIC_FILTER_P;
+            params.M = BASIC_FILTER_M;
+            return true;
+        case BlockFilterType::INVALID:
+            return false;
+    }
+    return false;
+}
+
+BlockFilter::BlockFilter(BlockFilterType filter_typeIn, const uint256& block_hashIn, std::vector<unsigned char> filterIn)
+    : filter_type(filter_typeIn), block_hash(block_hashIn)
+{
+    GCSFilter::Params params;
+    if (!BuildParams(params)) {
+        throw std::invalid_argument("unknown filter_type");
+    }
+    filter = GCSFilter(params, std::move(filterIn));
+}
+
+BlockFilter::BlockFilter(BlockFilterType filter_typeIn, const CBlock& block, const CBlockUndo& block_undo)
+    : filter_type(filter_typeIn), block_hash(block.GetHash())
+{
+    GCSFilter::Params params;
+    if (!BuildParams(params)) {
+        throw std::invalid_argument("unknown filter_type");
+    }
+    filter = GCSFilter(params, BasicFilterElements(block, block_undo));
+}
+
+uint256 BlockFilter::GetHash() const
+{
+    const std::vector<unsigned char>& data = GetEncodedFilter();
+    return Hash(data.begin(), data.end());
+}
+
+uint256 BlockFilter::ComputeHeader(const uint256& prev_header) const
+{
+    const uint256& filter_hash = GetHash();
+    return Hash(filter_hash.begin(), filter_hash.end(), prev_header.begin(), prev_header.end());
+}
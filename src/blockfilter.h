@@ -0,0 +1,158 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKFILTER_H
+#define ZCASH_BLOCKFILTER_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class CBlock;
+class CBlockUndo;
+
+/**
+ * A Golomb-coded set, as in BIP 158: a compact probabilistic filter over a
+ * set of byte strings. Each element is hashed to a number below N * M, and
+ * the sorted hashes are stored as Golomb-Rice coded differences with
+ * parameter P, so that querying an element that is not in the set matches
+ * with probability 1/M.
+ */
+class GCSFilter
+{
+public:
+    typedef std::vector<unsigned char> Element;
+    typedef std::set<Element> ElementSet;
+
+    struct Params {
+        //! The SipHash key the elements are hashed with.
+        uint64_t k0;
+        uint64_t k1;
+        //! The Golomb-Rice coding parameter.
+        uint8_t P;
+        //! The inverse false positive rate.
+        uint32_t M;
+
+        Params(uint64_t k0In = 0, uint64_t k1In = 0, uint8_t PIn = 0, uint32_t MIn = 1) :
+            k0(k0In), k1(k1In), P(PIn), M(MIn) {}
+    };
+
+private:
+    Params params;
+    uint32_t N;
+    //! N * M, the range the elements are hashed to.
+    uint64_t F;
+    std::vector<unsigned char> encoded;
+
+    uint64_t HashToRange(const Element& element) const;
+    //! Whether any of the sorted hashes is in the filter.
+    bool MatchInternal(const std::vector<uint64_t>& vHashes) const;
+
+public:
+    explicit GCSFilter(const Params& paramsIn = Params());
+
+    //! Decode a filter. Throws std::ios_base::failure if the encoding is
+    //! malformed.
+    GCSFilter(const Params& paramsIn, std::vector<unsigned char> encodedIn);
+
+    //! Build the filter of a set of elements.
+    GCSFilter(const Params& paramsIn, const ElementSet& elements);
+
+    uint32_t GetN() const { return N; }
+    const Params& GetParams() const { return params; }
+    //! The number of elements followed by the Golomb-Rice coded hashes.
+    const std::vector<unsigned char>& GetEncoded() const { return encoded; }
+
+    //! Whether the element may be in the set.
+    bool Match(const Element& element) const;
+    //! Whether any of the elements may be in the set, in one pass over the
+    //! filter.
+    bool MatchAny(const ElementSet& elements) const;
+};
+
+/** The filter types of BIP 157; only the basic filter is defined. */
+enum class BlockFilterType : uint8_t
+{
+    BASIC = 0,
+    INVALID = 255,
+};
+
+/** The name of a filter type, or the empty string if it is not known. */
+const std::string& BlockFilterTypeName(BlockFilterType filter_type);
+
+/** Sets filter_type and returns true if name is a known filter type. */
+bool BlockFilterTypeByName(const std::string& name, BlockFilterType& filter_type);
+
+/**
+ * The compact filter of a block, which a light client can test its scripts
+ * against without asking for the block.
+ *
+ * The basic filter holds the transparent scriptPubKeys of a block: those of
+ * its outputs, other than empty and OP_RETURN scripts, and those of the
+ * outputs its transactions spend, taken from the undo data of the block.
+ * Shielded outputs are not covered.
+ */
+class BlockFilter
+{
+private:
+    BlockFilterType filter_type;
+    uint256 block_hash;
+    GCSFilter filter;
+
+    bool BuildParams(GCSFilter::Params& params) const;
+
+public:
+    BlockFilter() : filter_type(BlockFilterType::INVALID) {}
+
+    //! Reconstruct a filter from its encoding. Throws std::invalid_argument
+    //! if the filter type is unknown, and std::ios_base::failure if the
+    //! encoding is malformed.
+    BlockFilter(BlockFilterType filter_type, const uint256& block_hash, std::vector<unsigned char> filter);
+
+    //! Compute the filter of a block. The undo data of the genesis block is
+    //! empty.
+    BlockFilter(BlockFilterType filter_type, const CBlock& block, const CBlockUndo& block_undo);
+
+    BlockFilterType GetFilterType() const { return filter_type; }
+    const uint256& GetBlockHash() const { return block_hash; }
+    const GCSFilter& GetFilter() const { return filter; }
+    const std::vector<unsigned char>& GetEncodedFilter() const { return filter.GetEncoded(); }
+
+    //! The hash of the encoded filter.
+    uint256 GetHash() const;
+
+    //! The header of the filter, committing to it and to the header of the
+    //! filter of the previous block (null for the genesis block).
+    uint256 ComputeHeader(const uint256& prev_header) const;
+};
+
+/**
+ * The filter of a block, as kept by the block filter index, with its hash
+ * and header so that getcfheaders and getcfcheckpt do not have to hash the
+ * filters.
+ */
+struct CBlockFilterIndexValue {
+    std::vector<unsigned char> filter;
+    uint256 hash;
+    uint256 header;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(filter);
+        READWRITE(hash);
+        READWRITE(header);
+    }
+
+    CBlockFilterIndexValue(const BlockFilter& blockFilter, const uint256& prevHeader) :
+        filter(blockFilter.GetEncodedFilter()), hash(blockFilter.GetHash()), header(blockFilter.ComputeHeader(prevHeader)) {}
+    CBlockFilterIndexValue() {}
+};
+
+#endif // ZCASH_BLOCKFILTER_H
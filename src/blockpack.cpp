@@ -0,0 +1,134 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockpack.h"
+
+#include "clientversion.h"
+#include "consensus/consensus.h"
+#include "diskrecord.h"
+#include "streams.h"
+#include "util/system.h"
+
+#include <algorithm>
+
+#include <rust/compression.h>
+
+static const char PACKED_BLOCK_FILE_MAGIC[4] = {'Z', 'P', 'A', 'K'};
+/** The size of the magic bytes and the version at the start of a packed file. */
+static const uint64_t PACKED_BLOCK_FILE_HEADER_SIZE = sizeof(PACKED_BLOCK_FILE_MAGIC) + sizeof(uint32_t);
+
+std::unique_ptr<CPackedBlockFile> CPackedBlockFile::Open(const fs::path& path)
+{
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return nullptr;
+
+    try {
+        char magic[sizeof(PACKED_BLOCK_FILE_MAGIC)];
+        uint32_t nVersion;
+        file >> FLATDATA(magic) >> nVersion;
+        if (memcmp(magic, PACKED_BLOCK_FILE_MAGIC, sizeof(magic)) || nVersion != PACKED_BLOCK_FILE_VERSION) {
+            error("%s: %s is not a packed block file of version %u", __func__, path.string(), PACKED_BLOCK_FILE_VERSION);
+            return nullptr;
+        }
+
+        uint64_t nIndexOffset;
+        if (fseek(file.Get(), -(long)sizeof(nIndexOffset), SEEK_END))
+            throw std::ios_base::failure("cannot seek to the index offset");
+        file >> nIndexOffset;
+        if (fseek(file.Get(), nIndexOffset, SEEK_SET))
+            throw std::ios_base::failure("cannot seek to the index");
+        std::vector<CPackedBlock> vBlocks;
+        file >> vBlocks;
+        return std::unique_ptr<CPackedBlockFile>(new CPackedBlockFile(path, std::move(vBlocks)));
+    } catch (const std::exception& e) {
+        error("%s: cannot read %s: %s", __func__, path.string(), e.what());
+        return nullptr;
+    }
+}
+
+bool CPackedBlockFile::Pack(const fs::path& pathBlocks, std::vector<unsigned int> vPositions,
+                            const CMessageHeader::MessageStartChars& messageStart, const fs::path& path)
+{
+    static const unsigned int nHeaderSize = CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+    std::sort(vPositions.begin(), vPositions.end());
+    vPositions.erase(std::unique(vPositions.begin(), vPositions.end()), vPositions.end());
+
+    fs::path pathTmp = path;
+    pathTmp += ".tmp";
+    try {
+        CAutoFile fileBlocks(fsbridge::fopen(pathBlocks, "rb"), SER_DISK, CLIENT_VERSION);
+        if (fileBlocks.IsNull())
+            return error("%s: cannot open %s", __func__, pathBlocks.string());
+        CAutoFile fileOut(fsbridge::fopen(pathTmp, "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileOut.IsNull())
+            return error("%s: cannot create %s", __func__, pathTmp.string());
+
+        fileOut << FLATDATA(PACKED_BLOCK_FILE_MAGIC) << PACKED_BLOCK_FILE_VERSION;
+        uint64_t nOffset = PACKED_BLOCK_FILE_HEADER_SIZE;
+        std::vector<CPackedBlock> vBlocks;
+        std::vector<unsigned char> data;
+        for (unsigned int nPos : vPositions) {
+            CMessageHeader::MessageStartChars blkStart;
+            unsigned int nSize;
+            if (nPos < nHeaderSize || fseek(fileBlocks.Get(), nPos - nHeaderSize, SEEK_SET))
+                throw std::ios_base::failure(strprintf("cannot seek to the block at %u", nPos));
+            fileBlocks >> FLATDATA(blkStart) >> nSize;
+            if (memcmp(blkStart, messageStart, CMessageHeader::MESSAGE_START_SIZE) || !IsValidDiskRecordSize(nSize))
+                throw std::ios_base::failure(strprintf("no block at %u", nPos));
+            data.resize(nSize & ~DISK_RECORD_COMPRESSED);
+            fileBlocks.read((char*)data.data(), data.size());
+            if (nSize & DISK_RECORD_COMPRESSED) {
+                // Blocks stored compressed are packed at the level of the others.
+                std::vector<unsigned char> compressed;
+                compressed.swap(data);
+                if (!DecompressDiskRecord(compressed, data))
+                    throw std::ios_base::failure(strprintf("the compressed block at %u is corrupt", nPos));
+            }
+
+            rust::Vec<uint8_t> compressed = compression::compress({data.data(), data.size()}, PACKED_BLOCK_COMPRESSION_LEVEL);
+            fileOut.write((const char*)compressed.data(), compressed.size());
+            vBlocks.emplace_back(nPos, nOffset, compressed.size(), data.size());
+            nOffset += compressed.size();
+        }
+        fileOut << vBlocks << nOffset;
+        FileCommit(fileOut.Get());
+    } catch (const std::exception& e) {
+        fs::remove(pathTmp);
+        return error("%s: cannot pack %s: %s", __func__, pathBlocks.string(), e.what());
+    }
+
+    if (!RenameOver(pathTmp, path)) {
+        fs::remove(pathTmp);
+        return error("%s: cannot rename %s", __func__, pathTmp.string());
+    }
+    return true;
+}
+
+bool CPackedBlockFile::Read(unsigned int nPos, std::vector<unsigned char>& data) const
+{
+    auto it = std::lower_bound(vBlocks.begin(), vBlocks.end(), nPos,
+        [](const CPackedBlock& block, unsigned int n) { return block.nPos < n; });
+    if (it == vBlocks.end() || it->nPos != nPos)
+        return error("%s: no block at position %u of %s", __func__, nPos, path.string());
+
+    std::vector<unsigned char> compressed(it->nCompressedSize);
+    try {
+        CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return error("%s: cannot open %s", __func__, path.string());
+        if (fseek(file.Get(), it->nOffset, SEEK_SET))
+            return error("%s: cannot seek to the block at position %u of %s", __func__, nPos, path.string());
+        file.read((char*)compressed.data(), compressed.size());
+    } catch (const std::exception& e) {
+        return error("%s: cannot read the block at position %u of %s: %s", __func__, nPos, path.string(), e.what());
+    }
+
+    rust::Vec<uint8_t> decompressed;
+    if (!compression::decompress({compressed.data(), compressed.size()}, it->nSize, decompressed) ||
+        decompressed.size() != it->nSize)
+        return error("%s: the block at position %u of %s is corrupt", __func__, nPos, path.string());
+    data.assign(decompressed.begin(), decompressed.end());
+    return true;
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_BLOCKPACK_H
+#define ZCASH_BLOCKPACK_H
+
+#include "fs.h"
+#include "protocol.h"
+#include "serialize.h"
+
+#include <memory>
+#include <vector>
+
+/** The format version of packed block files. */
+static const uint32_t PACKED_BLOCK_FILE_VERSION = 1;
+/** The DEFLATE level the blocks of packed block files are compressed at. */
+static const uint8_t PACKED_BLOCK_COMPRESSION_LEVEL = 6;
+
+/** Where a block of a packed block file is. */
+struct CPackedBlock {
+    //! The position of the block in its block file, after its header.
+    uint32_t nPos;
+    //! The position of the compressed block in the packed file.
+    uint64_t nOffset;
+    uint32_t nCompressedSize;
+    uint32_t nSize;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nPos);
+        READWRITE(nOffset);
+        READWRITE(nCompressedSize);
+        READWRITE(nSize);
+    }
+
+    CPackedBlock(uint32_t nPosIn, uint64_t nOffsetIn, uint32_t nCompressedSizeIn, uint32_t nSizeIn) :
+        nPos(nPosIn), nOffset(nOffsetIn), nCompressedSize(nCompressedSizeIn), nSize(nSizeIn) {}
+    CPackedBlock() : nPos(0), nOffset(0), nCompressedSize(0), nSize(0) {}
+};
+
+/**
+ * A packed block file (pak?????.dat) holds the blocks of the block file with
+ * the same number, each compressed on its own, with an index of them by their
+ * positions in the block file. The positions recorded in the block index and
+ * the transaction index thus stay valid once the block file is replaced by
+ * its packed file.
+ *
+ * The file holds the magic bytes "ZPAK" and the format version; then the
+ * compressed blocks; then the index, in order of position; and last, the
+ * offset of the index as a uint64_t.
+ */
+class CPackedBlockFile
+{
+private:
+    const fs::path path;
+    const std::vector<CPackedBlock> vBlocks;
+
+    CPackedBlockFile(const fs::path& pathIn, std::vector<CPackedBlock>&& vBlocksIn) :
+        path(pathIn), vBlocks(std::move(vBlocksIn)) {}
+
+public:
+    /**
+     * Read the index of the packed file at the given path. Returns nullptr if
+     * there is no such file, or it cannot be read.
+     */
+    static std::unique_ptr<CPackedBlockFile> Open(const fs::path& path);
+
+    /**
+     * Write the packed file at the given path for the blocks at the given
+     * positions (after their headers) of the block file at pathBlocks. The
+     * file only replaces an existing one once it has been written in full.
+     */
+    static bool Pack(const fs::path& pathBlocks, std::vector<unsigned int> vPositions,
+                     const CMessageHeader::MessageStartChars& messageStart, const fs::path& path);
+
+    /** Read the serialized block at the given position of the block file. */
+    bool Read(unsigned int nPos, std::vector<unsigned char>& data) const;
+
+    const std::vector<CPackedBlock>& GetBlocks() const { return vBlocks; }
+};
+
+#endif // ZCASH_BLOCKPACK_H
@@ -131,6 +131,8 @@ public:
 
     void reset();
 
+    size_t DynamicMemoryUsage() const;
+
 private:
     int nEntriesPerGeneration;
     int nEntriesThisGeneration;
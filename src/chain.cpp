@@ -6,10 +6,129 @@
 
 #include "chain.h"
 
+#include "main.h"
+#include "memusage.h"
+#include "support/hugepages.h"
+#include "sync.h"
+#include "txdb.h"
+
+#include <list>
+#include <map>
+#include <new>
+#include <stdexcept>
+
+/** Number of trimmed solutions kept in memory after being read back, about a megabyte per 750. */
+static const size_t SOLUTION_CACHE_SIZE = 2000;
+
+/**
+ * The trimmed solutions read back last, most recently used first. Peers
+ * mostly ask for the headers of the last blocks, and keep asking for them.
+ */
+static Mutex cs_solutionCache;
+static std::list<std::pair<uint256, std::vector<unsigned char>>> lruSolutions GUARDED_BY(cs_solutionCache);
+static std::map<uint256, std::list<std::pair<uint256, std::vector<unsigned char>>>::iterator> mapSolutions GUARDED_BY(cs_solutionCache);
+
+std::vector<unsigned char> CBlockIndex::GetSolution() const
+{
+    if (!fSolutionTrimmed)
+        return nSolution;
+
+    uint256 hash = GetBlockHash();
+    {
+        LOCK(cs_solutionCache);
+        auto it = mapSolutions.find(hash);
+        if (it != mapSolutions.end()) {
+            lruSolutions.splice(lruSolutions.begin(), lruSolutions, it->second);
+            return it->second->second;
+        }
+    }
+
+    CDiskBlockIndex diskindex;
+    if (!pblocktree->ReadDiskBlockIndex(hash, diskindex))
+        throw std::runtime_error(strprintf("%s: failed to read the block index entry of %s", __func__, hash.ToString()));
+
+    LOCK(cs_solutionCache);
+    if (!mapSolutions.count(hash)) {
+        lruSolutions.emplace_front(hash, diskindex.nSolution);
+        mapSolutions.emplace(hash, lruSolutions.begin());
+        if (lruSolutions.size() > SOLUTION_CACHE_SIZE) {
+            mapSolutions.erase(lruSolutions.back().first);
+            lruSolutions.pop_back();
+        }
+    }
+    return diskindex.nSolution;
+}
+
+void CBlockIndex::TrimSolution()
+{
+    AssertLockHeld(cs_main);
+    if (fSolutionTrimmed)
+        return;
+    std::vector<unsigned char>().swap(nSolution);
+    fSolutionTrimmed = true;
+}
+
+CBlockHeader CBlockIndex::GetBlockHeader() const
+{
+    CBlockHeader block;
+    block.nVersion       = nVersion;
+    if (pprev)
+        block.hashPrevBlock = pprev->GetBlockHash();
+    block.hashMerkleRoot = hashMerkleRoot;
+    block.hashBlockCommitments = hashBlockCommitments;
+    block.nTime          = nTime;
+    block.nBits          = nBits;
+    block.nNonce         = nNonce;
+    block.nSolution      = GetSolution();
+    return block;
+}
+
+/**
+ * CBlockIndexArena implementation
+ */
+CBlockIndex* CBlockIndexArena::Allocate() {
+    if (vChunks.empty() || nUsed == CHUNK_SIZE) {
+        vChunks.reserve(vChunks.size() + 1);
+        vChunks.push_back(static_cast<CBlockIndex*>(HugePageAllocate(CHUNK_SIZE * sizeof(CBlockIndex))));
+        nUsed = 0;
+    }
+    CBlockIndex* pindex = new (&vChunks.back()[nUsed]) CBlockIndex();
+    nUsed++;
+    return pindex;
+}
+
+void CBlockIndexArena::Clear() {
+    for (size_t i = 0; i < vChunks.size(); i++) {
+        size_t nEntries = i + 1 == vChunks.size() ? nUsed : CHUNK_SIZE;
+        for (size_t j = 0; j < nEntries; j++) {
+            vChunks[i][j].~CBlockIndex();
+        }
+        HugePageDeallocate(vChunks[i], CHUNK_SIZE * sizeof(CBlockIndex));
+    }
+    vChunks.clear();
+    nUsed = 0;
+}
+
+CBlockIndexArena& CBlockIndexArena::operator=(CBlockIndexArena&& other) {
+    if (this != &other) {
+        Clear();
+        vChunks = std::move(other.vChunks);
+        nUsed = other.nUsed;
+        other.vChunks.clear();
+        other.nUsed = 0;
+    }
+    return *this;
+}
+
+size_t CBlockIndexArena::DynamicMemoryUsage() const {
+    return memusage::DynamicUsage(vChunks) + vChunks.size() * memusage::MallocUsage(CHUNK_SIZE * sizeof(CBlockIndex));
+}
+
 /**
  * CChain implementation
  */
 void CChain::SetTip(CBlockIndex *pindex) {
+    pindexPublishedTip.store(pindex, std::memory_order_release);
     if (pindex == NULL) {
         vChain.clear();
         return;
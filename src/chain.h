@@ -13,6 +13,8 @@
 #include "tinyformat.h"
 #include "uint256.h"
 
+#include <atomic>
+#include <memory>
 #include <optional>
 #include <vector>
 
@@ -308,11 +310,16 @@ public:
     unsigned int nTime;
     unsigned int nBits;
     uint256 nNonce;
+    //! Use GetSolution(): this is emptied by TrimSolution() once the entry
+    //! has been written to the block index database.
     std::vector<unsigned char> nSolution;
 
     //! (memory only) Sequential id assigned to distinguish order in which blocks are received.
     uint32_t nSequenceId;
 
+    //! (memory only) Whether nSolution has been trimmed.
+    bool fSolutionTrimmed;
+
     void SetNull()
     {
         phashBlock = NULL;
@@ -348,6 +355,7 @@ public:
         nBits          = 0;
         nNonce         = uint256();
         nSolution.clear();
+        fSolutionTrimmed = false;
     }
 
     CBlockIndex()
@@ -386,20 +394,19 @@ public:
         return ret;
     }
 
-    CBlockHeader GetBlockHeader() const
-    {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        if (pprev)
-            block.hashPrevBlock = pprev->GetBlockHash();
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.hashBlockCommitments = hashBlockCommitments;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        block.nSolution      = nSolution;
-        return block;
-    }
+    /**
+     * The Equihash solution is most of the size of an entry (1344 bytes on
+     * mainnet), and is only needed to serve headers, so it is dropped from
+     * memory once the entry is on disk. GetSolution() then reads it back
+     * from the block index database, through a cache of the ones read last,
+     * and throws if it cannot.
+     */
+    std::vector<unsigned char> GetSolution() const;
+    //! Drop the solution from memory. The entry must have been written to
+    //! the block index database. Requires cs_main.
+    void TrimSolution();
+
+    CBlockHeader GetBlockHeader() const;
 
     uint256 GetBlockHash() const
     {
@@ -484,6 +491,12 @@ public:
 
     explicit CDiskBlockIndex(const CBlockIndex* pindex) : CBlockIndex(*pindex) {
         hashPrev = (pprev ? pprev->GetBlockHash() : uint256());
+        // Entries are rewritten as their status changes after their solution
+        // has been trimmed.
+        if (fSolutionTrimmed) {
+            nSolution = pindex->GetSolution();
+            fSolutionTrimmed = false;
+        }
     }
 
     ADD_SERIALIZE_METHODS;
@@ -590,10 +603,48 @@ public:
     }
 };
 
+/**
+ * Storage for the entries of the block index, in chunks of contiguous entries
+ * that are never moved or freed before Clear(). Entries allocated one after
+ * the other, such as the blocks of a chain as they are connected, or the
+ * whole index once LoadBlockIndexDB has reallocated it in height order, are
+ * next to each other in memory, which GetAncestor and the walks along pprev
+ * benefit from. The chunks are backed by huge pages when -hugepages is set.
+ */
+class CBlockIndexArena
+{
+public:
+    static const size_t CHUNK_SIZE = 1024;
+
+    CBlockIndexArena() {}
+    ~CBlockIndexArena() { Clear(); }
+
+    CBlockIndexArena(const CBlockIndexArena&) = delete;
+    CBlockIndexArena& operator=(const CBlockIndexArena&) = delete;
+    /** Take over the entries of another arena, freeing those of this one. */
+    CBlockIndexArena& operator=(CBlockIndexArena&& other);
+
+    /** A new entry, as constructed by CBlockIndex(). */
+    CBlockIndex* Allocate();
+    /** Free all the entries. */
+    void Clear();
+    size_t size() const { return vChunks.empty() ? 0 : (vChunks.size() - 1) * CHUNK_SIZE + nUsed; }
+    /** The memory used by the chunks, including the entries not yet allocated. */
+    size_t DynamicMemoryUsage() const;
+
+private:
+    //! Storage for CHUNK_SIZE entries each, constructed as they are allocated.
+    std::vector<CBlockIndex*> vChunks;
+    //! The entries allocated in the last chunk.
+    size_t nUsed = 0;
+};
+
 /** An in-memory indexed chain of blocks. */
 class CChain {
 private:
     std::vector<CBlockIndex*> vChain;
+    //! The tip as of the last SetTip.
+    std::atomic<const CBlockIndex*> pindexPublishedTip{nullptr};
 
 public:
     /** Returns the index entry for the genesis block of this chain, or NULL if none. */
@@ -640,6 +691,17 @@ public:
     /** Set/initialize a chain with a given tip. */
     void SetTip(CBlockIndex *pindex);
 
+    /**
+     * The tip of this chain, for readers that do not hold the lock guarding
+     * it (cs_main for chainActive). The height and hash of an index entry do
+     * not change, and neither do its ancestors, which GetAncestor() finds in
+     * as many steps as it takes to go back up to 2^18 blocks in about 110;
+     * the tip may be behind a SetTip that is in progress.
+     */
+    const CBlockIndex *PublishedTip() const {
+        return pindexPublishedTip.load(std::memory_order_acquire);
+    }
+
     /** Return a CBlockLocator that refers to a block in this chain (by default the tip). */
     CBlockLocator GetLocator(const CBlockIndex *pindex = NULL) const;
 
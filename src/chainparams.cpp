@@ -242,6 +242,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("000000000000000000000000000000000000000000000000098e5c63248dcb28");
 
+        // By default assume that the signatures in ancestors of this block are valid.
+        consensus.defaultAssumeValid = uint256S("0000000000d723156d9b65ffcf4984da7a19675ed7e2f06d9e5d5188af087bf8"); // 1687104
+
         /**
          * The message start string should be awesome! ⓩ❤
          */
@@ -359,6 +362,7 @@ public:
         };
 
         assert(vFoundersRewardAddress.size() <= consensus.GetLastFoundersRewardBlockHeight(0));
+        DecodeFoundersRewardScripts();
     }
 };
 static CMainParams mainParams;
@@ -547,6 +551,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("000000000000000000000000000000000000000000000000000000263c0984a2");
 
+        // By default assume that the signatures in ancestors of this block are valid.
+        consensus.defaultAssumeValid = uint256S("0006d75c60b3093d1b671ff7da11c99ea535df9927c02e6ed9eb898605eb7381"); // 1842420
+
         pchMessageStart[0] = 0xfa;
         pchMessageStart[1] = 0x1a;
         pchMessageStart[2] = 0xf9;
@@ -612,6 +619,7 @@ public:
             "t29pHDBWq7qN4EjwSEHg8wEqYe9pkmVrtRP", "t2Ez9KM8VJLuArcxuEkNRAkhNvidKkzXcjJ", "t2D5y7J5fpXajLbGrMBQkFg2mFN8fo3n8cX", "t2UV2wr1PTaUiybpkV3FdSdGxUJeZdZztyt",
             };
         assert(vFoundersRewardAddress.size() <= consensus.GetLastFoundersRewardBlockHeight(0));
+        DecodeFoundersRewardScripts();
     }
 };
 static CTestNetParams testNetParams;
@@ -696,6 +704,9 @@ public:
         // The best chain should have at least this much work.
         consensus.nMinimumChainWork = uint256S("0x00");
 
+        // By default assume that the signatures in ancestors of this block are valid.
+        consensus.defaultAssumeValid = uint256S("0x00");
+
         pchMessageStart[0] = 0xaa;
         pchMessageStart[1] = 0xe8;
         pchMessageStart[2] = 0x3f;
@@ -732,6 +743,7 @@ public:
         // Founders reward script expects a vector of 2-of-3 multisig addresses
         vFoundersRewardAddress = { "t2FwcEhFdNXuFMv1tcYwaBJtYVtMj8b1uTg" };
         assert(vFoundersRewardAddress.size() <= consensus.GetLastFoundersRewardBlockHeight(0));
+        DecodeFoundersRewardScripts();
 
         // do not require the wallet backup to be confirmed in regtest mode
         fRequireWalletBackup = false;
@@ -803,9 +815,22 @@ void SelectParams(const std::string& network)
 }
 
 
+// The founders reward addresses are expected to be multisig (P2SH) addresses
+void CChainParams::DecodeFoundersRewardScripts() {
+    KeyIO keyIO(*this);
+    vFoundersRewardScript.clear();
+    for (const std::string& strAddress : vFoundersRewardAddress) {
+        auto address = keyIO.DecodePaymentAddress(strAddress);
+        assert(address.has_value());
+        assert(std::holds_alternative<CScriptID>(address.value()));
+        CScriptID scriptID = std::get<CScriptID>(address.value());
+        vFoundersRewardScript.push_back(CScript() << OP_HASH160 << ToByteVector(scriptID) << OP_EQUAL);
+    }
+}
+
 // Block height must be >0 and <=last founders reward block height
 // Index variable i ranges from 0 - (vFoundersRewardAddress.size()-1)
-std::string CChainParams::GetFoundersRewardAddressAtHeight(int nHeight) const {
+size_t CChainParams::GetFoundersRewardIndexAtHeight(int nHeight) const {
     int preBlossomMaxHeight = consensus.GetLastFoundersRewardBlockHeight(0);
     // zip208
     // FounderAddressAdjustedHeight(height) :=
@@ -818,22 +843,19 @@ std::string CChainParams::GetFoundersRewardAddressAtHeight(int nHeight) const {
     }
     assert(nHeight > 0 && nHeight <= preBlossomMaxHeight);
     size_t addressChangeInterval = (preBlossomMaxHeight + vFoundersRewardAddress.size()) / vFoundersRewardAddress.size();
-    size_t i = nHeight / addressChangeInterval;
-    return vFoundersRewardAddress[i];
+    return nHeight / addressChangeInterval;
+}
+
+std::string CChainParams::GetFoundersRewardAddressAtHeight(int nHeight) const {
+    return vFoundersRewardAddress[GetFoundersRewardIndexAtHeight(nHeight)];
 }
 
 // Block height must be >0 and <=last founders reward block height
-// The founders reward address is expected to be a multisig (P2SH) address
-CScript CChainParams::GetFoundersRewardScriptAtHeight(int nHeight) const {
+// The script is decoded from the address when the parameters are set up, as
+// it is checked in the coinbase of every block up to Canopy.
+const CScript& CChainParams::GetFoundersRewardScriptAtHeight(int nHeight) const {
     assert(nHeight > 0 && nHeight <= consensus.GetLastFoundersRewardBlockHeight(nHeight));
-
-    KeyIO keyIO(*this);
-    auto address = keyIO.DecodePaymentAddress(GetFoundersRewardAddressAtHeight(nHeight).c_str());
-    assert(address.has_value());
-    assert(std::holds_alternative<CScriptID>(address.value()));
-    CScriptID scriptID = std::get<CScriptID>(address.value());
-    CScript script = CScript() << OP_HASH160 << ToByteVector(scriptID) << OP_EQUAL;
-    return script;
+    return vFoundersRewardScript[GetFoundersRewardIndexAtHeight(nHeight)];
 }
 
 std::string CChainParams::GetFoundersRewardAddressAtIndex(int i) const {
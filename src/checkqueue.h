@@ -7,6 +7,9 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
+#include <deque>
+#include <thread>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -14,10 +17,28 @@
 #include <boost/thread/mutex.hpp>
 
 #include "sync.h"
+#include "util/time.h"
 
-template <typename T>
+template <typename T, typename Q>
 class CCheckQueueControl;
 
+/** How the verifications added between two waits of a CCheckQueue were processed. */
+struct CCheckQueueStats
+{
+    //! The number of verifications added.
+    unsigned int nChecks = 0;
+    //! The number of batches they were processed in, by the workers and the master.
+    unsigned int nBatches = 0;
+    //! The number of workers (including the master) when the master finished waiting.
+    int nWorkers = 0;
+    //! The time from the first verification being added until the master finished waiting.
+    int64_t nWallMicros = 0;
+    //! The time spent running verifications, summed over the workers and the master.
+    int64_t nBusyMicros = 0;
+    //! The time the master spent waiting for the batches of other workers to finish.
+    int64_t nMasterWaitMicros = 0;
+};
+
 /** 
  * Queue for verifications that have to be performed.
   * The verifications are represented by a type T, which must provide an
@@ -67,13 +88,20 @@ private:
     //! The maximum number of elements to be processed in one batch
     unsigned int nBatchSize;
 
+    //! How the verifications added since the master last waited are being processed.
+    CCheckQueueStats stats;
+
+    //! When the first verification since the master last waited was added.
+    int64_t nStartMicros;
+
     /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    bool Loop(bool fMaster = false, CCheckQueueStats* pstats = nullptr)
     {
         boost::condition_variable& cond = fMaster ? condMaster : condWorker;
         std::vector<T> vChecks;
         vChecks.reserve(nBatchSize);
         unsigned int nNow = 0;
+        int64_t nBusyMicros = 0;
         bool fOk = true;
         do {
             {
@@ -82,6 +110,7 @@ private:
                 if (nNow) {
                     fAllOk &= fOk;
                     nTodo -= nNow;
+                    stats.nBusyMicros += nBusyMicros;
                     if (nTodo == 0 && !fMaster)
                         // We processed the last element; inform the master it can exit and return the result
                         condMaster.notify_one();
@@ -92,16 +121,30 @@ private:
                 // logically, the do loop starts here
                 while (queue.empty()) {
                     if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
                         bool fRet = fAllOk;
                         // reset the status for new work later
-                        if (fMaster)
+                        if (fMaster) {
                             fAllOk = true;
+                            if (pstats != nullptr) {
+                                *pstats = stats;
+                                pstats->nWorkers = nTotal;
+                                if (stats.nChecks > 0)
+                                    pstats->nWallMicros = GetTimeMicros() - nStartMicros;
+                            }
+                            stats = CCheckQueueStats();
+                        }
+                        nTotal--;
                         // return the current status
                         return fRet;
                     }
                     nIdle++;
-                    cond.wait(lock); // wait
+                    if (fMaster) {
+                        int64_t nWaitStart = GetTimeMicros();
+                        cond.wait(lock); // wait
+                        stats.nMasterWaitMicros += GetTimeMicros() - nWaitStart;
+                    } else {
+                        cond.wait(lock); // wait
+                    }
                     nIdle--;
                 }
                 // Decide how many work units to process now.
@@ -117,13 +160,16 @@ private:
                     vChecks[i].swap(queue.back());
                     queue.pop_back();
                 }
+                stats.nBatches++;
                 // Check whether we need to do work at all
                 fOk = fAllOk;
             }
             // execute work
+            int64_t nBatchStart = GetTimeMicros();
             for (T& check : vChecks)
                 if (fOk)
                     fOk = check();
+            nBusyMicros = GetTimeMicros() - nBatchStart;
             vChecks.clear();
         } while (true);
     }
@@ -133,7 +179,7 @@ public:
     boost::mutex ControlMutex;
 
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn), nStartMicros(0) {}
 
     //! Worker thread
     void Thread()
@@ -142,15 +188,19 @@ public:
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
-    bool Wait()
+    //! If pstats is not null, it is set to how the evaluations were processed.
+    bool Wait(CCheckQueueStats* pstats = nullptr)
     {
-        return Loop(true);
+        return Loop(true, pstats);
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
         boost::unique_lock<boost::mutex> lock(mutex);
+        if (stats.nChecks == 0)
+            nStartMicros = GetTimeMicros();
+        stats.nChecks += vChecks.size();
         for (T& check : vChecks) {
             queue.push_back(T());
             check.swap(queue.back());
@@ -168,22 +218,305 @@ public:
 
 };
 
-/** 
- * RAII-style controller object for a CCheckQueue that guarantees the passed
- * queue is finished before continuing.
+/** The number of workers (including the master) that get their own deque in a CWorkStealingCheckQueue. */
+static const int MAX_CHECKQUEUE_DEQUES = 65;
+
+/** The number of times an idle worker looks for new checks before it sleeps. */
+static const int CHECKQUEUE_SPIN_ROUNDS = 64;
+
+/**
+ * Queue for verifications that have to be performed, with the same interface
+ * and semantics as CCheckQueue, but without a lock shared by all the workers.
+ *
+ * Each worker (and the master) has its own deque of checks, with its own
+ * lock. The master spreads the checks it adds over the deques. A worker takes
+ * its batches from the back of its own deque, and when that is empty, steals
+ * from the front of the others'. Each batch is half of what is left in the
+ * deque it is taken from (up to nBatchSize), so that batches get smaller as
+ * the work runs out and the workers finish at about the same time.
+ *
+ * A worker that runs out of work first spins for a while, as new checks
+ * usually follow within microseconds while a block is being connected, and
+ * only then sleeps until the master adds more. The shared lock is only taken
+ * to sleep and to wake sleeping threads.
  */
 template <typename T>
+class CWorkStealingCheckQueue
+{
+private:
+    /** The checks queued for one worker. */
+    struct WorkerDeque {
+        boost::mutex mutex;
+        std::deque<T> checks;
+        //! The size of checks, so that empty deques are skipped without the lock.
+        std::atomic<unsigned int> nSize{0};
+    };
+
+    //! The deques of the workers; the master's is the first.
+    std::vector<WorkerDeque> deques;
+
+    //! The number of deques in use: one for the master, and one for each worker, up to the number of deques.
+    std::atomic<int> nDeques;
+
+    //! The deque the next checks are added to.
+    int nNextDeque;
+
+    //! Mutex for sleeping and waking the workers and the master.
+    boost::mutex mutex;
+
+    //! Worker threads sleep on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Master thread sleeps on this while the last batches are being run
+    boost::condition_variable condMaster;
+
+    //! The number of workers (not including the master) that are sleeping.
+    std::atomic<int> nSleeping;
+
+    //! The number of workers (not including the master) that are running.
+    std::atomic<int> nWorkers;
+
+    //! The number of checks that are queued in the deques.
+    std::atomic<unsigned int> nPending;
+
+    /**
+     * Number of verifications that haven't completed yet.
+     * This includes elements that are no longer queued, but still in the
+     * worker's own batches.
+     */
+    std::atomic<unsigned int> nTodo;
+
+    //! The temporary evaluation result.
+    std::atomic<bool> fAllOk;
+
+    //! The maximum number of elements to be processed in one batch
+    unsigned int nBatchSize;
+
+    //! How the verifications added since the master last waited are being
+    //! processed; the counters that the workers update are kept apart.
+    CCheckQueueStats stats;
+    std::atomic<unsigned int> nBatches;
+    std::atomic<int64_t> nBusyMicros;
+
+    //! When the first verification since the master last waited was added.
+    int64_t nStartMicros;
+
+    /** Move a batch of checks from a deque into vChecks, returning their number. */
+    unsigned int Take(WorkerDeque& deque, bool fOwn, std::vector<T>& vChecks)
+    {
+        if (deque.nSize == 0)
+            return 0;
+        boost::unique_lock<boost::mutex> lock(deque.mutex);
+        unsigned int nSize = deque.checks.size();
+        if (nSize == 0)
+            return 0;
+        unsigned int nNow = std::max(1U, std::min(nBatchSize, nSize / 2));
+        vChecks.resize(nNow);
+        for (unsigned int i = 0; i < nNow; i++) {
+            // The owner takes the most recently added checks, and thieves the
+            // oldest, so that they rarely want the same ones.
+            if (fOwn) {
+                vChecks[i].swap(deque.checks.back());
+                deque.checks.pop_back();
+            } else {
+                vChecks[i].swap(deque.checks.front());
+                deque.checks.pop_front();
+            }
+        }
+        deque.nSize = nSize - nNow;
+        nPending -= nNow;
+        return nNow;
+    }
+
+    /** Find a batch of checks for the worker with the given deque. */
+    unsigned int FindBatch(int nOwn, std::vector<T>& vChecks)
+    {
+        unsigned int nNow = Take(deques[nOwn], true, vChecks);
+        int nCount = nDeques;
+        for (int i = 1; nNow == 0 && i < nCount && nPending > 0; i++) {
+            nNow = Take(deques[(nOwn + i) % nCount], false, vChecks);
+        }
+        return nNow;
+    }
+
+    /** Internal function that does bulk of the verification work. */
+    bool Loop(bool fMaster = false, CCheckQueueStats* pstats = nullptr)
+    {
+        int nOwn = 0;
+        if (!fMaster) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            int nWorker = nWorkers++;
+            // Workers beyond the number of deques share them.
+            if (nDeques < MAX_CHECKQUEUE_DEQUES) {
+                nOwn = nDeques++;
+            } else {
+                nOwn = 1 + nWorker % (MAX_CHECKQUEUE_DEQUES - 1);
+            }
+        }
+        // A worker stops when it is interrupted while sleeping.
+        struct WorkerGuard {
+            std::atomic<int>& nWorkers;
+            bool fMaster;
+            ~WorkerGuard() { if (!fMaster) nWorkers--; }
+        } guard{nWorkers, fMaster};
+
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        int nSpins = 0;
+        while (true) {
+            unsigned int nNow = FindBatch(nOwn, vChecks);
+            if (nNow > 0) {
+                nSpins = 0;
+                // Check whether we need to do work at all
+                bool fOk = fAllOk;
+                int64_t nBatchStart = GetTimeMicros();
+                for (T& check : vChecks)
+                    if (fOk)
+                        fOk = check();
+                if (!fOk)
+                    fAllOk = false;
+                nBusyMicros += GetTimeMicros() - nBatchStart;
+                nBatches++;
+                // The checks are destroyed before they are counted as done,
+                // so that the master does not return while they still exist.
+                vChecks.clear();
+                if ((nTodo -= nNow) == 0 && !fMaster) {
+                    // We processed the last element; inform the master it can exit and return the result
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    condMaster.notify_one();
+                }
+                continue;
+            }
+            if (nPending > 0)
+                continue;
+            if (fMaster) {
+                // Only the master adds checks, so all that is left is to wait
+                // for the batches that the workers are running.
+                {
+                    boost::unique_lock<boost::mutex> lock(mutex);
+                    int64_t nWaitStart = GetTimeMicros();
+                    while (nTodo != 0) {
+                        condMaster.wait(lock);
+                    }
+                    stats.nMasterWaitMicros += GetTimeMicros() - nWaitStart;
+                }
+                bool fRet = fAllOk;
+                // reset the status for new work later
+                fAllOk = true;
+                if (pstats != nullptr) {
+                    *pstats = stats;
+                    pstats->nBatches = nBatches;
+                    pstats->nBusyMicros = nBusyMicros;
+                    pstats->nWorkers = nWorkers + 1;
+                    if (stats.nChecks > 0)
+                        pstats->nWallMicros = GetTimeMicros() - nStartMicros;
+                }
+                stats = CCheckQueueStats();
+                nBatches = 0;
+                nBusyMicros = 0;
+                // return the current status
+                return fRet;
+            }
+            if (++nSpins < CHECKQUEUE_SPIN_ROUNDS) {
+                std::this_thread::yield();
+                continue;
+            }
+            nSpins = 0;
+            boost::unique_lock<boost::mutex> lock(mutex);
+            nSleeping++;
+            while (nPending == 0) {
+                try {
+                    condWorker.wait(lock); // wait
+                } catch (...) {
+                    nSleeping--;
+                    throw;
+                }
+            }
+            nSleeping--;
+        }
+    }
+
+public:
+    //! Mutex to ensure only one concurrent CCheckQueueControl
+    boost::mutex ControlMutex;
+
+    //! Create a new check queue
+    CWorkStealingCheckQueue(unsigned int nBatchSizeIn) :
+        deques(MAX_CHECKQUEUE_DEQUES), nDeques(1), nNextDeque(0), nSleeping(0), nWorkers(0),
+        nPending(0), nTodo(0), fAllOk(true), nBatchSize(nBatchSizeIn),
+        nBatches(0), nBusyMicros(0), nStartMicros(0) {}
+
+    //! Worker thread
+    void Thread()
+    {
+        Loop();
+    }
+
+    //! Wait until execution finishes, and return whether all evaluations were successful.
+    //! If pstats is not null, it is set to how the evaluations were processed.
+    bool Wait(CCheckQueueStats* pstats = nullptr)
+    {
+        return Loop(true, pstats);
+    }
+
+    //! Add a batch of checks to the queue
+    void Add(std::vector<T>& vChecks)
+    {
+        if (vChecks.empty())
+            return;
+        if (stats.nChecks == 0)
+            nStartMicros = GetTimeMicros();
+        stats.nChecks += vChecks.size();
+        nTodo += vChecks.size();
+
+        // Spread the checks over the deques, starting after the last one added to.
+        int nCount = nDeques;
+        size_t nChunk = std::max<size_t>(1, (vChecks.size() + nCount - 1) / nCount);
+        for (size_t nAdded = 0; nAdded < vChecks.size(); nAdded += nChunk) {
+            nNextDeque = (nNextDeque + 1) % nCount;
+            WorkerDeque& deque = deques[nNextDeque];
+            size_t nEnd = std::min(nAdded + nChunk, vChecks.size());
+            boost::unique_lock<boost::mutex> lock(deque.mutex);
+            for (size_t i = nAdded; i < nEnd; i++) {
+                deque.checks.push_back(T());
+                vChecks[i].swap(deque.checks.back());
+            }
+            deque.nSize = deque.checks.size();
+            nPending += nEnd - nAdded;
+        }
+
+        // Workers that are spinning will find the checks by themselves.
+        if (nSleeping > 0) {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            if (vChecks.size() == 1)
+                condWorker.notify_one();
+            else
+                condWorker.notify_all();
+        }
+    }
+
+    ~CWorkStealingCheckQueue()
+    {
+    }
+
+};
+
+/** 
+ * RAII-style controller object for a CCheckQueue (or CWorkStealingCheckQueue)
+ * that guarantees the passed queue is finished before continuing.
+ */
+template <typename T, typename Q = CCheckQueue<T>>
 class CCheckQueueControl
 {
 private:
-    CCheckQueue<T> * const pqueue;
+    Q * const pqueue;
     bool fDone;
 
 public:
     CCheckQueueControl() = delete;
     CCheckQueueControl(const CCheckQueueControl&) = delete;
     CCheckQueueControl& operator=(const CCheckQueueControl&) = delete;
-    explicit CCheckQueueControl(CCheckQueue<T> * const pqueueIn) : pqueue(pqueueIn), fDone(false)
+    explicit CCheckQueueControl(Q * const pqueueIn) : pqueue(pqueueIn), fDone(false)
     {
         // passed queue is supposed to be unused, or NULL
         if (pqueue != NULL) {
@@ -191,11 +524,13 @@ public:
         }
     }
 
-    bool Wait()
+    //! If pstats is not null and there is a queue, it is set to how the
+    //! verifications were processed.
+    bool Wait(CCheckQueueStats* pstats = nullptr)
     {
         if (pqueue == NULL)
             return true;
-        bool fRet = pqueue->Wait();
+        bool fRet = pqueue->Wait(pstats);
         fDone = true;
         return fRet;
     }
@@ -5,6 +5,7 @@
 
 #include "coins.h"
 
+#include "consensus/consensus.h"
 #include "memusage.h"
 #include "random.h"
 #include "version.h"
@@ -14,47 +15,38 @@
 
 #include <tracing.h>
 
-/**
- * calculate number of bytes for the bitmask, and its number of non-zero bytes
- * each bit in the bitmask represents the availability of one output, but the
- * availabilities of the first two outputs are encoded separately
- */
-void CCoins::CalcMaskSize(unsigned int &nBytes, unsigned int &nNonzeroBytes) const {
-    unsigned int nLastUsedByte = 0;
-    for (unsigned int b = 0; 2+b*8 < vout.size(); b++) {
-        bool fZero = true;
-        for (unsigned int i = 0; i < 8 && 2+b*8+i < vout.size(); i++) {
-            if (!vout[2+b*8+i].IsNull()) {
-                fZero = false;
-                continue;
-            }
-        }
-        if (!fZero) {
-            nLastUsedByte = b + 1;
-            nNonzeroBytes++;
+bool CCoinsView::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return false; }
+bool CCoinsView::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return false; }
+bool CCoinsView::GetOrchardAnchorAt(const uint256 &rt, OrchardMerkleFrontier &tree) const { return false; }
+bool CCoinsView::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return false; }
+bool CCoinsView::GetCoin(const COutPoint &outpoint, Coin &coin) const { return false; }
+std::vector<std::optional<Coin>> CCoinsView::GetCoins(const std::vector<COutPoint> &outpoints) const {
+    std::vector<std::optional<Coin>> coins(outpoints.size());
+    Coin coin;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        if (GetCoin(outpoints[i], coin)) {
+            coins[i] = std::move(coin);
         }
     }
-    nBytes += nLastUsedByte;
+    return coins;
 }
-
-bool CCoins::Spend(uint32_t nPos)
+bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
 {
-    if (nPos >= vout.size() || vout[nPos].IsNull())
-        return false;
-    vout[nPos].SetNull();
-    Cleanup();
-    return true;
+    Coin coin;
+    return GetCoin(outpoint, coin);
 }
-bool CCoinsView::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const { return false; }
-bool CCoinsView::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return false; }
-bool CCoinsView::GetOrchardAnchorAt(const uint256 &rt, OrchardMerkleFrontier &tree) const { return false; }
-bool CCoinsView::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return false; }
-bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
-bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
 uint256 CCoinsView::GetBestAnchor(ShieldedType type) const { return uint256(); };
 HistoryIndex CCoinsView::GetHistoryLength(uint32_t epochId) const { return 0; }
 HistoryNode CCoinsView::GetHistoryAt(uint32_t epochId, HistoryIndex index) const { return HistoryNode(); }
+std::vector<HistoryNode> CCoinsView::GetHistoryNodes(uint32_t epochId, const std::vector<HistoryIndex> &indices) const {
+    std::vector<HistoryNode> nodes;
+    nodes.reserve(indices.size());
+    for (HistoryIndex index : indices) {
+        nodes.push_back(GetHistoryAt(epochId, index));
+    }
+    return nodes;
+}
 uint256 CCoinsView::GetHistoryRoot(uint32_t epochId) const { return uint256(); }
 
 bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
@@ -70,6 +62,8 @@ bool CCoinsView::BatchWrite(CCoinsMap &mapCoins,
                             CNullifiersMap &mapOrchardNullifiers,
                             CHistoryCacheMap &historyCacheMap) { return false; }
 bool CCoinsView::GetStats(CCoinsStats &stats) const { return false; }
+bool CCoinsView::DumpSnapshot(CAutoFile &file, CCoinsSnapshotStats &stats) const { return false; }
+void CCoinsView::Prefetch(CCoinsCacheKeys &keys) const { }
 
 
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
@@ -78,14 +72,17 @@ bool CCoinsViewBacked::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tr
 bool CCoinsViewBacked::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const { return base->GetSaplingAnchorAt(rt, tree); }
 bool CCoinsViewBacked::GetOrchardAnchorAt(const uint256 &rt, OrchardMerkleFrontier &tree) const { return base->GetOrchardAnchorAt(rt, tree); }
 bool CCoinsViewBacked::GetNullifier(const uint256 &nullifier, ShieldedType type) const { return base->GetNullifier(nullifier, type); }
-bool CCoinsViewBacked::GetCoins(const uint256 &txid, CCoins &coins) const { return base->GetCoins(txid, coins); }
-bool CCoinsViewBacked::HaveCoins(const uint256 &txid) const { return base->HaveCoins(txid); }
+bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
+std::vector<std::optional<Coin>> CCoinsViewBacked::GetCoins(const std::vector<COutPoint> &outpoints) const { return base->GetCoins(outpoints); }
+bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 uint256 CCoinsViewBacked::GetBestAnchor(ShieldedType type) const { return base->GetBestAnchor(type); }
 HistoryIndex CCoinsViewBacked::GetHistoryLength(uint32_t epochId) const { return base->GetHistoryLength(epochId); }
 HistoryNode CCoinsViewBacked::GetHistoryAt(uint32_t epochId, HistoryIndex index) const { return base->GetHistoryAt(epochId, index); }
+std::vector<HistoryNode> CCoinsViewBacked::GetHistoryNodes(uint32_t epochId, const std::vector<HistoryIndex> &indices) const { return base->GetHistoryNodes(epochId, indices); }
 uint256 CCoinsViewBacked::GetHistoryRoot(uint32_t epochId) const { return base->GetHistoryRoot(epochId); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
+void CCoinsViewBacked::Prefetch(CCoinsCacheKeys &keys) const { base->Prefetch(keys); }
 bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
                                   const uint256 &hashBlock,
                                   const uint256 &hashSproutAnchor,
@@ -105,14 +102,16 @@ bool CCoinsViewBacked::BatchWrite(CCoinsMap &mapCoins,
                             historyCacheMap);
 }
 bool CCoinsViewBacked::GetStats(CCoinsStats &stats) const { return base->GetStats(stats); }
+bool CCoinsViewBacked::DumpSnapshot(CAutoFile &file, CCoinsSnapshotStats &stats) const { return base->DumpSnapshot(file, stats); }
 
 SaltedTxidHasher::SaltedTxidHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
-    assert(!hasModifier);
 }
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
@@ -124,24 +123,24 @@ size_t CCoinsViewCache::DynamicMemoryUsage() const {
            memusage::DynamicUsage(cacheSaplingNullifiers) +
            memusage::DynamicUsage(cacheOrchardNullifiers) +
            memusage::DynamicUsage(historyCacheMap) +
+           memusage::DynamicUsage(cacheHistoryNodes) +
            cachedCoinsUsage;
 }
 
-CCoinsMap::const_iterator CCoinsViewCache::FetchCoins(const uint256 &txid) const {
-    CCoinsMap::iterator it = cacheCoins.find(txid);
+CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
+    CCoinsMap::iterator it = cacheCoins.find(outpoint);
     if (it != cacheCoins.end())
         return it;
-    CCoins tmp;
-    if (!base->GetCoins(txid, tmp))
+    Coin tmp;
+    if (!base->GetCoin(outpoint, tmp))
         return cacheCoins.end();
-    CCoinsMap::iterator ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry())).first;
-    tmp.swap(ret->second.coins);
-    if (ret->second.coins.IsPruned()) {
-        // The parent only has an empty entry for this txid; we can consider our
+    CCoinsMap::iterator ret = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::forward_as_tuple(std::move(tmp))).first;
+    if (ret->second.coin.IsSpent()) {
+        // The parent only has an empty entry for this outpoint; we can consider our
         // version as fresh.
         ret->second.flags = CCoinsCacheEntry::FRESH;
     }
-    cachedCoinsUsage += ret->second.coins.DynamicMemoryUsage();
+    cachedCoinsUsage += ret->second.coin.DynamicMemoryUsage();
     return ret;
 }
 
@@ -249,19 +248,51 @@ HistoryIndex CCoinsViewCache::GetHistoryLength(uint32_t epochId) const {
 }
 
 HistoryNode CCoinsViewCache::GetHistoryAt(uint32_t epochId, HistoryIndex index) const {
+    return GetHistoryNodes(epochId, {index})[0];
+}
+
+std::vector<HistoryNode> CCoinsViewCache::GetHistoryNodes(uint32_t epochId, const std::vector<HistoryIndex> &indices) const {
     HistoryCache& historyCache = SelectHistoryCache(epochId);
 
-    if (index >= historyCache.length) {
-        // Caller should ensure that it is limiting history
-        // request to 0..GetHistoryLength(epochId)-1 range
-        throw std::runtime_error("Invalid history request");
+    std::vector<HistoryNode> nodes(indices.size());
+    std::vector<HistoryIndex> missing;
+    std::vector<size_t> missingPos;
+    for (size_t i = 0; i < indices.size(); i++) {
+        HistoryIndex index = indices[i];
+        if (index >= historyCache.length) {
+            // Caller should ensure that it is limiting history
+            // request to 0..GetHistoryLength(epochId)-1 range
+            throw std::runtime_error("Invalid history request");
+        }
+
+        if (index >= historyCache.updateDepth) {
+            nodes[i] = historyCache.appends[index];
+            continue;
+        }
+
+        auto it = cacheHistoryNodes.find({epochId, index});
+        if (it != cacheHistoryNodes.end()) {
+            nodes[i] = it->second;
+        } else {
+            missing.push_back(index);
+            missingPos.push_back(i);
+        }
     }
 
-    if (index >= historyCache.updateDepth) {
-        return historyCache.appends[index];
+    if (!missing.empty()) {
+        // The nodes in use are few, so rather than tracking which are stale,
+        // start over when the limit is reached.
+        if (cacheHistoryNodes.size() + missing.size() > MAX_CACHED_HISTORY_NODES) {
+            cacheHistoryNodes.clear();
+        }
+        std::vector<HistoryNode> fetched = base->GetHistoryNodes(epochId, missing);
+        for (size_t i = 0; i < missing.size(); i++) {
+            nodes[missingPos[i]] = fetched[i];
+            cacheHistoryNodes[{epochId, missing[i]}] = fetched[i];
+        }
     }
 
-    return base->GetHistoryAt(epochId, index);
+    return nodes;
 }
 
 uint256 CCoinsViewCache::GetHistoryRoot(uint32_t epochId) const {
@@ -400,6 +431,21 @@ uint32_t CCoinsViewCache::PreloadHistoryTree(uint32_t epochId, bool extra, std::
         return 1;
     }
 
+    // The positions and altitudes of the nodes to load, which are then read
+    // in one batch.
+    std::vector<HistoryIndex> positions;
+    std::vector<uint32_t> altitudes;
+    auto draft = [&](uint32_t pos, uint32_t alt) {
+        positions.push_back(pos);
+        altitudes.push_back(alt);
+    };
+    auto load = [&]() {
+        std::vector<HistoryNode> nodes = GetHistoryNodes(epochId, positions);
+        for (size_t i = 0; i < nodes.size(); i++) {
+            draftMMRNode(entry_indices, entries, nodes[i], altitudes[i], positions[i]);
+        }
+    };
+
     uint32_t last_peak_pos = 0;
     uint32_t last_peak_alt = 0;
     uint32_t alt = 0;
@@ -455,7 +501,7 @@ uint32_t CCoinsViewCache::PreloadHistoryTree(uint32_t epochId, bool extra, std::
 
         // If the peak exists, we take it and then continue with its right sibling.
         if (peak_pos < treeLength) {
-            draftMMRNode(entry_indices, entries, GetHistoryAt(epochId, peak_pos), alt, peak_pos);
+            draft(peak_pos, alt);
 
             last_peak_pos = peak_pos;
             last_peak_alt = alt;
@@ -465,10 +511,13 @@ uint32_t CCoinsViewCache::PreloadHistoryTree(uint32_t epochId, bool extra, std::
         }
     }
 
-    total_peaks = entries.size();
+    total_peaks = positions.size();
 
     // Return early if we don't require extra nodes.
-    if (!extra) return total_peaks;
+    if (!extra) {
+        load();
+        return total_peaks;
+    }
 
     alt = last_peak_alt;
     peak_pos = last_peak_pos;
@@ -493,15 +542,16 @@ uint32_t CCoinsViewCache::PreloadHistoryTree(uint32_t epochId, bool extra, std::
         alt = alt - 1;
 
         // drafting left child
-        draftMMRNode(entry_indices, entries, GetHistoryAt(epochId, left_pos), alt, left_pos);
+        draft(left_pos, alt);
 
         // drafting right child
-        draftMMRNode(entry_indices, entries, GetHistoryAt(epochId, right_pos), alt, right_pos);
+        draft(right_pos, alt);
 
         // continuing on right slope
         peak_pos = right_pos;
     }
 
+    load();
     return total_peaks;
 }
 
@@ -717,61 +767,120 @@ void CCoinsViewCache::SetNullifiers(const CTransaction& tx, bool spent) {
     }
 }
 
-bool CCoinsViewCache::GetCoins(const uint256 &txid, CCoins &coins) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+bool CCoinsViewCache::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it != cacheCoins.end()) {
-        coins = it->second.coins;
-        return true;
+        coin = it->second.coin;
+        return !coin.IsSpent();
     }
     return false;
 }
 
-CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
-    assert(!hasModifier);
-    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
-    size_t cachedCoinUsage = 0;
-    if (ret.second) {
-        if (!base->GetCoins(txid, ret.first->second.coins)) {
-            // The parent view does not have this entry; mark it as fresh.
-            ret.first->second.coins.Clear();
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
-        } else if (ret.first->second.coins.IsPruned()) {
-            // The parent view only has a pruned entry for this; mark it as fresh.
-            ret.first->second.flags = CCoinsCacheEntry::FRESH;
+std::vector<std::optional<Coin>> CCoinsViewCache::GetCoins(const std::vector<COutPoint> &outpoints) const {
+    std::vector<std::optional<Coin>> coins(outpoints.size());
+    std::vector<COutPoint> missing;
+    std::vector<size_t> missingPos;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        CCoinsMap::const_iterator it = cacheCoins.find(outpoints[i]);
+        if (it == cacheCoins.end()) {
+            missing.push_back(outpoints[i]);
+            missingPos.push_back(i);
+        } else if (!it->second.coin.IsSpent()) {
+            coins[i] = it->second.coin;
+        }
+    }
+
+    if (!missing.empty()) {
+        // Cache what was found, as FetchCoin does.
+        std::vector<std::optional<Coin>> fetched = base->GetCoins(missing);
+        for (size_t i = 0; i < missing.size(); i++) {
+            if (!fetched[i]) continue;
+            CCoinsMap::iterator it;
+            bool inserted;
+            std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(missing[i]), std::forward_as_tuple(std::move(*fetched[i])));
+            if (inserted) {
+                if (it->second.coin.IsSpent()) {
+                    it->second.flags = CCoinsCacheEntry::FRESH;
+                }
+                cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
+            }
+            if (!it->second.coin.IsSpent()) {
+                coins[missingPos[i]] = it->second.coin;
+            }
         }
-    } else {
-        cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
-    // Assume that whenever ModifyCoins is called, the entry will be modified.
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, cachedCoinUsage);
+
+    return coins;
+}
+
+void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possible_overwrite) {
+    assert(!coin.IsSpent());
+    if (coin.out.scriptPubKey.IsUnspendable()) return;
+    CCoinsMap::iterator it;
+    bool inserted;
+    std::tie(it, inserted) = cacheCoins.emplace(std::piecewise_construct, std::forward_as_tuple(outpoint), std::tuple<>());
+    bool fresh = false;
+    if (!inserted) {
+        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    }
+    if (!possible_overwrite) {
+        if (!it->second.coin.IsSpent()) {
+            throw std::logic_error("Adding new coin that replaces non-pruned entry");
+        }
+        fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
+    }
+    it->second.coin = std::move(coin);
+    it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
+    cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
 }
 
-CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid) {
-    assert(!hasModifier);
-    std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
-    ret.first->second.coins.Clear();
-    ret.first->second.flags = CCoinsCacheEntry::FRESH;
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
-    return CCoinsModifier(*this, ret.first, 0);
+void AddCoins(CCoinsViewCache& cache, const CTransaction &tx, int nHeight, bool check) {
+    bool fCoinbase = tx.IsCoinBase();
+    const uint256& txid = tx.GetHash();
+    for (size_t i = 0; i < tx.vout.size(); ++i) {
+        // Always set the possible_overwrite flag to AddCoin for coinbase txn,
+        // as we can't rule out there being an unspent coinbase output with the
+        // same txid (as in the pre-BIP 30 Bitcoin chain).
+        bool overwrite = check ? cache.HaveCoin(COutPoint(txid, i)) : fCoinbase;
+        cache.AddCoin(COutPoint(txid, i), Coin(tx.vout[i], nHeight, fCoinbase), overwrite);
+    }
+}
+
+bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
+    CCoinsMap::iterator it = FetchCoin(outpoint);
+    if (it == cacheCoins.end()) return false;
+    cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+    if (moveout) {
+        *moveout = std::move(it->second.coin);
+    }
+    if (it->second.flags & CCoinsCacheEntry::FRESH) {
+        cacheCoins.erase(it);
+    } else {
+        it->second.flags |= CCoinsCacheEntry::DIRTY;
+        it->second.coin.Clear();
+    }
+    return true;
 }
 
-const CCoins* CCoinsViewCache::AccessCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
+static const Coin coinEmpty;
+
+const Coin& CCoinsViewCache::AccessCoin(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
     if (it == cacheCoins.end()) {
-        return NULL;
+        return coinEmpty;
     } else {
-        return &it->second.coins;
+        return it->second.coin;
     }
 }
 
-bool CCoinsViewCache::HaveCoins(const uint256 &txid) const {
-    CCoinsMap::const_iterator it = FetchCoins(txid);
-    // We're using vtx.empty() instead of IsPruned here for performance reasons,
-    // as we only care about the case where a transaction was replaced entirely
-    // in a reorganization (which wipes vout entirely, as opposed to spending
-    // which just cleans individual outputs).
-    return (it != cacheCoins.end() && !it->second.coins.vout.empty());
+bool CCoinsViewCache::HaveCoin(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = FetchCoin(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
+}
+
+bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
+    return (it != cacheCoins.end() && !it->second.coin.IsSpent());
 }
 
 uint256 CCoinsViewCache::GetBestBlock() const {
@@ -807,16 +916,44 @@ void CCoinsViewCache::SetBestBlock(const uint256 &hashBlockIn) {
     hashBlock = hashBlockIn;
 }
 
+/**
+ * If the parent's map is empty, there is nothing to merge with: take over the
+ * child's map, with its nodes and the pool they were allocated from, instead
+ * of moving the entries over one at a time. keep(entry) is called on each
+ * entry and returns whether the parent keeps it, adjusting its flags. Returns
+ * false, and leaves both maps alone, if the parent's map has entries.
+ */
+template<typename Map, typename Keep>
+static bool BatchWriteSwap(Map &mapChild, Map &mapParent, Keep keep)
+{
+    if (!mapParent.empty()) {
+        return false;
+    }
+    mapParent.swap(mapChild);
+    for (typename Map::iterator it = mapParent.begin(); it != mapParent.end();) {
+        if (keep(it->second)) {
+            ++it;
+        } else {
+            it = mapParent.erase(it);
+        }
+    }
+    return true;
+}
+
 void BatchWriteNullifiers(CNullifiersMap &mapNullifiers, CNullifiersMap &cacheNullifiers)
 {
+    if (BatchWriteSwap(mapNullifiers, cacheNullifiers, [](CNullifiersCacheEntry& entry) {
+        return (entry.flags & CNullifiersCacheEntry::DIRTY) != 0;
+    })) {
+        return;
+    }
+
     for (CNullifiersMap::iterator child_it = mapNullifiers.begin(); child_it != mapNullifiers.end();) {
         if (child_it->second.flags & CNullifiersCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
             CNullifiersMap::iterator parent_it = cacheNullifiers.find(child_it->first);
 
             if (parent_it == cacheNullifiers.end()) {
-                CNullifiersCacheEntry& entry = cacheNullifiers[child_it->first];
-                entry.entered = child_it->second.entered;
-                entry.flags = CNullifiersCacheEntry::DIRTY;
+                cacheNullifiers.emplace(child_it->first, child_it->second);
             } else {
                 if (parent_it->second.entered != child_it->second.entered) {
                     parent_it->second.entered = child_it->second.entered;
@@ -835,15 +972,24 @@ void BatchWriteAnchors(
     size_t &cachedCoinsUsage
 )
 {
+    if (BatchWriteSwap(mapAnchors, cacheAnchors, [&](MapEntry& entry) {
+        if (!(entry.flags & MapEntry::DIRTY)) {
+            return false;
+        }
+        entry.flags = MapEntry::DIRTY;
+        cachedCoinsUsage += entry.tree.DynamicMemoryUsage();
+        return true;
+    })) {
+        return;
+    }
+
     for (MapIterator child_it = mapAnchors.begin(); child_it != mapAnchors.end();)
     {
         if (child_it->second.flags & MapEntry::DIRTY) {
             MapIterator parent_it = cacheAnchors.find(child_it->first);
 
             if (parent_it == cacheAnchors.end()) {
-                MapEntry& entry = cacheAnchors[child_it->first];
-                entry.entered = child_it->second.entered;
-                entry.tree = child_it->second.tree;
+                MapEntry& entry = cacheAnchors.emplace(child_it->first, std::move(child_it->second)).first->second;
                 entry.flags = MapEntry::DIRTY;
 
                 cachedCoinsUsage += entry.tree.DynamicMemoryUsage();
@@ -862,7 +1008,7 @@ void BatchWriteAnchors(
 
 void BatchWriteHistory(CHistoryCacheMap& historyCacheMap, CHistoryCacheMap& historyCacheMapIn) {
     for (auto nextHistoryCache = historyCacheMapIn.begin(); nextHistoryCache != historyCacheMapIn.end(); nextHistoryCache++) {
-        auto historyCacheIn = nextHistoryCache->second;
+        HistoryCache& historyCacheIn = nextHistoryCache->second;
         auto epochId = nextHistoryCache->first;
 
         auto historyCache = historyCacheMap.find(epochId);
@@ -883,8 +1029,9 @@ void BatchWriteHistory(CHistoryCacheMap& historyCacheMap, CHistoryCacheMap& hist
             // write current root
             historyCache->second.root = historyCacheIn.root;
         } else {
-            // Just insert the history cache into its parent
-            historyCacheMap.insert({epochId, historyCacheIn});
+            // Just move the history cache into its parent; the child's map is
+            // cleared after the write.
+            historyCacheMap.emplace(epochId, std::move(historyCacheIn));
         }
     }
 }
@@ -901,35 +1048,66 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
                                  CNullifiersMap &mapSaplingNullifiers,
                                  CNullifiersMap &mapOrchardNullifiers,
                                  CHistoryCacheMap &historyCacheMapIn) {
-    assert(!hasModifier);
+    // A parent that was just flushed, such as the coins tip after a periodic
+    // flush, takes over the child's entries as they are, leaving mapCoins
+    // empty for the loop below. The entries that loop would move up keep
+    // their flags, as it does when the parent has no entry.
+    BatchWriteSwap(mapCoins, cacheCoins, [&](CCoinsCacheEntry& entry) {
+        if (!(entry.flags & CCoinsCacheEntry::DIRTY)) {
+            return false;
+        }
+        if ((entry.flags & CCoinsCacheEntry::FRESH) && entry.coin.IsSpent()) {
+            return false;
+        }
+        cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
+        return true;
+    });
+
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) { // Ignore non-dirty entries (optimization).
             CCoinsMap::iterator itUs = cacheCoins.find(it->first);
             if (itUs == cacheCoins.end()) {
-                if (!it->second.coins.IsPruned()) {
-                    // The parent cache does not have an entry, while the child
-                    // cache does have (a non-pruned) one. Move the data up, and
-                    // mark it as fresh (if the grandparent did have it, we
-                    // would have pulled it in at first GetCoins).
-                    assert(it->second.flags & CCoinsCacheEntry::FRESH);
+                // The parent cache does not have an entry, while the child does.
+                // We can ignore it if it's both FRESH and pruned in the child.
+                if (!(it->second.flags & CCoinsCacheEntry::FRESH && it->second.coin.IsSpent())) {
+                    // Otherwise we will need to create it in the parent
+                    // and move the data up and mark it as dirty.
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
-                    entry.coins.swap(it->second.coins);
-                    cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
-                    entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+                    entry.coin = std::move(it->second.coin);
+                    cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
+                    entry.flags = CCoinsCacheEntry::DIRTY;
+                    // We can mark it FRESH in the parent if it was FRESH in the child.
+                    // Otherwise it might have just been flushed from the parent's cache
+                    // and already exist in the grandparent.
+                    if (it->second.flags & CCoinsCacheEntry::FRESH)
+                        entry.flags |= CCoinsCacheEntry::FRESH;
                 }
             } else {
-                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
+                // Assert that the child cache entry was not marked FRESH if the
+                // parent cache entry is unspent. If this ever happens, it means
+                // the FRESH flag was misapplied and there is a logic error in
+                // the calling code.
+                if ((it->second.flags & CCoinsCacheEntry::FRESH) && !itUs->second.coin.IsSpent())
+                    throw std::logic_error("FRESH flag misapplied to cache entry for base transaction with spendable outputs");
+
+                // Found the entry in the parent cache
+                if ((itUs->second.flags & CCoinsCacheEntry::FRESH) && it->second.coin.IsSpent()) {
                     // The grandparent does not have an entry, and the child is
                     // modified and being pruned. This means we can just delete
                     // it from the parent.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
-                    cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
-                    itUs->second.coins.swap(it->second.coins);
-                    cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
+                    cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
+                    itUs->second.coin = std::move(it->second.coin);
+                    cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
                     itUs->second.flags |= CCoinsCacheEntry::DIRTY;
+                    // NOTE: It is possible the child has a FRESH flag here in
+                    // the event the entry we found in the parent is pruned. But
+                    // we must not copy that FRESH flag to the parent as that
+                    // pruned state likely still needs to be communicated to the
+                    // grandparent.
                 }
             }
         }
@@ -954,6 +1132,15 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins,
 }
 
 bool CCoinsViewCache::Flush() {
+    // The cached history nodes are only used below the update depth of each
+    // tree; those that the flushed updates replace are dropped below, before
+    // the depth is reset by reloading the trees from the base. The depths are
+    // taken first, as the base may take the history caches over (see
+    // CCoinsViewFlushLayer::BatchWrite).
+    std::vector<std::pair<uint32_t, HistoryIndex>> vHistoryUpdates;
+    for (const auto& [epochId, historyCache] : historyCacheMap) {
+        vHistoryUpdates.emplace_back(epochId, historyCache.updateDepth);
+    }
     bool fOk = base->BatchWrite(cacheCoins,
                                 hashBlock,
                                 hashSproutAnchor,
@@ -966,27 +1153,75 @@ bool CCoinsViewCache::Flush() {
                                 cacheSaplingNullifiers,
                                 cacheOrchardNullifiers,
                                 historyCacheMap);
-    cacheCoins.clear();
+    // Swap in fresh pool-backed maps instead of clearing, so that the
+    // chunks holding the flushed entries are released in one go.
+    CCoinsMap().swap(cacheCoins);
     cacheSproutAnchors.clear();
     cacheSaplingAnchors.clear();
     cacheOrchardAnchors.clear();
-    cacheSproutNullifiers.clear();
-    cacheSaplingNullifiers.clear();
-    cacheOrchardNullifiers.clear();
+    CNullifiersMap().swap(cacheSproutNullifiers);
+    CNullifiersMap().swap(cacheSaplingNullifiers);
+    CNullifiersMap().swap(cacheOrchardNullifiers);
+    for (const auto& [epochId, updateDepth] : vHistoryUpdates) {
+        cacheHistoryNodes.erase(
+            cacheHistoryNodes.lower_bound({epochId, updateDepth}),
+            cacheHistoryNodes.upper_bound({epochId, std::numeric_limits<HistoryIndex>::max()}));
+    }
     historyCacheMap.clear();
     cachedCoinsUsage = 0;
     return fOk;
 }
 
+void CCoinsViewCache::Uncache(const COutPoint& outpoint)
+{
+    CCoinsMap::iterator it = cacheCoins.find(outpoint);
+    if (it != cacheCoins.end() && it->second.flags == 0) {
+        cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+        cacheCoins.erase(it);
+    }
+}
+
 unsigned int CCoinsViewCache::GetCacheSize() const {
     return cacheCoins.size();
 }
 
+template<typename Map>
+static void GetCachedAnchors(const Map& cacheAnchors, std::vector<uint256>& anchors)
+{
+    for (const auto& entry : cacheAnchors) {
+        if (entry.second.entered) {
+            anchors.push_back(entry.first);
+        }
+    }
+}
+
+static void GetCachedNullifiers(const CNullifiersMap& cacheNullifiers, std::vector<uint256>& nullifiers)
+{
+    for (const auto& entry : cacheNullifiers) {
+        nullifiers.push_back(entry.first);
+    }
+}
+
+void CCoinsViewCache::GetCachedKeys(CCoinsCacheKeys &keys) const {
+    keys.coins.reserve(cacheCoins.size());
+    for (const auto& entry : cacheCoins) {
+        if (!entry.second.coin.IsSpent()) {
+            keys.coins.push_back(entry.first);
+        }
+    }
+    GetCachedAnchors(cacheSproutAnchors, keys.sproutAnchors);
+    GetCachedAnchors(cacheSaplingAnchors, keys.saplingAnchors);
+    GetCachedAnchors(cacheOrchardAnchors, keys.orchardAnchors);
+    GetCachedNullifiers(cacheSproutNullifiers, keys.sproutNullifiers);
+    GetCachedNullifiers(cacheSaplingNullifiers, keys.saplingNullifiers);
+    GetCachedNullifiers(cacheOrchardNullifiers, keys.orchardNullifiers);
+}
+
 const CTxOut &CCoinsViewCache::GetOutputFor(const CTxIn& input) const
 {
-    const CCoins* coins = AccessCoins(input.prevout.hash);
-    assert(coins && coins->IsAvailable(input.prevout.n));
-    return coins->vout[input.prevout.n];
+    const Coin& coin = AccessCoin(input.prevout);
+    assert(!coin.IsSpent());
+    return coin.out;
 }
 
 CAmount CCoinsViewCache::GetValueIn(const CTransaction& tx) const
@@ -1096,9 +1331,7 @@ bool CCoinsViewCache::HaveInputs(const CTransaction& tx) const
 {
     if (!tx.IsCoinBase()) {
         for (unsigned int i = 0; i < tx.vin.size(); i++) {
-            const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins* coins = AccessCoins(prevout.hash);
-            if (!coins || !coins->IsAvailable(prevout.n)) {
+            if (!HaveCoin(tx.vin[i].prevout)) {
                 return false;
             }
         }
@@ -1128,32 +1361,25 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight) const
     double dResult = 0.0;
     for (const CTxIn& txin : tx.vin)
     {
-        const CCoins* coins = AccessCoins(txin.prevout.hash);
-        assert(coins);
-        if (!coins->IsAvailable(txin.prevout.n)) continue;
-        if (coins->nHeight < nHeight) {
-            dResult += coins->vout[txin.prevout.n].nValue * (nHeight-coins->nHeight);
+        const Coin& coin = AccessCoin(txin.prevout);
+        if (coin.IsSpent()) continue;
+        if (coin.nHeight < nHeight) {
+            dResult += coin.out.nValue * (nHeight - coin.nHeight);
         }
     }
 
     return tx.ComputePriority(dResult);
 }
 
-CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
-    assert(!cache.hasModifier);
-    cache.hasModifier = true;
-}
+static const size_t MAX_OUTPUTS_PER_BLOCK = MAX_BLOCK_SIZE / ::GetSerializeSize(CTxOut(), SER_NETWORK, PROTOCOL_VERSION);
 
-CCoinsModifier::~CCoinsModifier()
+const Coin& AccessByTxid(const CCoinsViewCache& view, const uint256& txid)
 {
-    assert(cache.hasModifier);
-    cache.hasModifier = false;
-    it->second.coins.Cleanup();
-    cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
-    if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
-        cache.cacheCoins.erase(it);
-    } else {
-        // If the coin still exists after the modification, add the new usage
-        cache.cachedCoinsUsage += it->second.coins.DynamicMemoryUsage();
+    COutPoint iter(txid, 0);
+    while (iter.n < MAX_OUTPUTS_PER_BLOCK) {
+        const Coin& alternate = view.AccessCoin(iter);
+        if (!alternate.IsSpent()) return alternate;
+        ++iter.n;
     }
+    return coinEmpty;
 }
@@ -0,0 +1,133 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "compactblocks.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "coins.h"
+#include "main.h"
+#include "streams.h"
+#include "version.h"
+
+#include <algorithm>
+
+CCompactBlockCache compactBlockCache(DEFAULT_COMPACT_BLOCK_CACHE_SIZE * 1024 * 1024);
+
+CCompactTx MakeCompactTx(const CTransaction& tx, uint64_t nIndex)
+{
+    CCompactTx ctx;
+    ctx.nIndex = nIndex;
+    ctx.txid = tx.GetHash();
+    for (const SpendDescription& spend : tx.vShieldedSpend)
+        ctx.vSpends.push_back(spend.nullifier);
+    for (const OutputDescription& output : tx.vShieldedOutput) {
+        CCompactSaplingOutput coutput;
+        coutput.cmu = output.cmu;
+        coutput.ephemeralKey = output.ephemeralKey;
+        std::copy_n(output.encCiphertext.begin(), ZC_COMPACT_CIPHERTEXT_SIZE, coutput.ciphertext.begin());
+        ctx.vOutputs.push_back(coutput);
+    }
+    const OrchardBundle& orchardBundle = tx.GetOrchardBundle();
+    if (orchardBundle.GetNumActions() > 0) {
+        for (const auto& action : orchardBundle.GetDetails()->actions()) {
+            CCompactOrchardAction caction;
+            auto nullifier = action.nullifier();
+            std::copy(nullifier.begin(), nullifier.end(), caction.nullifier.begin());
+            auto cmx = action.cmx();
+            std::copy(cmx.begin(), cmx.end(), caction.cmx.begin());
+            auto ephemeralKey = action.ephemeral_key();
+            std::copy(ephemeralKey.begin(), ephemeralKey.end(), caction.ephemeralKey.begin());
+            auto encCiphertext = action.enc_ciphertext();
+            std::copy_n(encCiphertext.begin(), ZC_COMPACT_CIPHERTEXT_SIZE, caction.ciphertext.begin());
+            ctx.vActions.push_back(caction);
+        }
+    }
+    return ctx;
+}
+
+CCompactBlock MakeCompactBlock(const CBlock& block, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+
+    CCompactBlock compact;
+    compact.nHeight = pindex->nHeight;
+    compact.hash = block.GetHash();
+    compact.hashPrevBlock = block.hashPrevBlock;
+    compact.nTime = block.nTime;
+
+    SaplingMerkleTree saplingTree;
+    if (pcoinsTip->GetSaplingAnchorAt(pindex->hashFinalSaplingRoot, saplingTree))
+        compact.nSaplingTreeSize = saplingTree.size();
+    OrchardMerkleFrontier orchardTree;
+    if (pcoinsTip->GetOrchardAnchorAt(pindex->hashFinalOrchardRoot, orchardTree))
+        compact.nOrchardTreeSize = orchardTree.size();
+
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        const CTransaction& tx = block.vtx[i];
+        if (tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty() && tx.GetOrchardBundle().GetNumActions() == 0)
+            continue;
+        compact.vtx.push_back(MakeCompactTx(tx, i));
+    }
+    return compact;
+}
+
+CCompactBlockCache::Entry CCompactBlockCache::Get(const uint256& hash)
+{
+    LOCK(cs);
+    auto it = mapEntries.find(hash);
+    if (it == mapEntries.end())
+        return nullptr;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+}
+
+void CCompactBlockCache::Insert(const uint256& hash, const Entry& entry)
+{
+    LOCK(cs);
+    if (mapEntries.count(hash) || entry->size() > nMaxSize)
+        return;
+    lru.emplace_front(hash, entry);
+    mapEntries.emplace(hash, lru.begin());
+    nSize += entry->size();
+    Trim();
+}
+
+void CCompactBlockCache::SetMaxSize(size_t nMaxSizeIn)
+{
+    LOCK(cs);
+    nMaxSize = nMaxSizeIn;
+    Trim();
+}
+
+void CCompactBlockCache::Trim()
+{
+    AssertLockHeld(cs);
+    while (nSize > nMaxSize) {
+        nSize -= lru.back().second->size();
+        mapEntries.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+CCompactBlockCache::Entry GetCompactBlock(const CBlockIndex* pindex, const CBlock* pblock)
+{
+    AssertLockHeld(cs_main);
+    CCompactBlockCache::Entry entry = compactBlockCache.Get(pindex->GetBlockHash());
+    if (entry)
+        return entry;
+
+    CBlock block;
+    if (!pblock) {
+        if (!(pindex->nStatus & BLOCK_HAVE_DATA) || !ReadBlockFromDisk(block, pindex, Params().GetConsensus()))
+            return nullptr;
+        pblock = &block;
+    }
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << MakeCompactBlock(*pblock, pindex);
+    entry = std::make_shared<const std::vector<unsigned char>>(ss.begin(), ss.end());
+    compactBlockCache.Insert(pindex->GetBlockHash(), entry);
+    return entry;
+}
@@ -0,0 +1,166 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_COMPACTBLOCKS_H
+#define ZCASH_COMPACTBLOCKS_H
+
+#include "primitives/block.h"
+#include "serialize.h"
+#include "sync.h"
+#include "uint256.h"
+#include "zcash/Zcash.h"
+
+#include <array>
+#include <list>
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+class CBlockIndex;
+
+/** The leading part of a note ciphertext that a light client trial-decrypts. */
+#define ZC_COMPACT_CIPHERTEXT_SIZE (ZC_NOTEPLAINTEXT_LEADING + ZC_DIVERSIFIER_SIZE + ZC_V_SIZE + ZC_R_SIZE)
+
+/** Default for -lightwalletdcompactcache, in megabytes. */
+static const unsigned int DEFAULT_COMPACT_BLOCK_CACHE_SIZE = 64;
+/** Largest number of compact blocks served at once. */
+static const int MAX_COMPACT_BLOCKS_PER_REQUEST = 1000;
+
+/** The parts of a Sapling output a light client needs to detect its notes. */
+struct CCompactSaplingOutput
+{
+    uint256 cmu;
+    uint256 ephemeralKey;
+    std::array<unsigned char, ZC_COMPACT_CIPHERTEXT_SIZE> ciphertext;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(cmu);
+        READWRITE(ephemeralKey);
+        READWRITE(ciphertext);
+    }
+};
+
+/** The parts of an Orchard action a light client needs to detect its notes and spends. */
+struct CCompactOrchardAction
+{
+    uint256 nullifier;
+    uint256 cmx;
+    uint256 ephemeralKey;
+    std::array<unsigned char, ZC_COMPACT_CIPHERTEXT_SIZE> ciphertext;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nullifier);
+        READWRITE(cmx);
+        READWRITE(ephemeralKey);
+        READWRITE(ciphertext);
+    }
+};
+
+/** A transaction with shielded components, reduced to what light clients need. */
+struct CCompactTx
+{
+    //! The index of the transaction in its block.
+    uint64_t nIndex;
+    uint256 txid;
+    //! The nullifiers of its Sapling spends.
+    std::vector<uint256> vSpends;
+    std::vector<CCompactSaplingOutput> vOutputs;
+    std::vector<CCompactOrchardAction> vActions;
+
+    CCompactTx() : nIndex(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(COMPACTSIZE(nIndex));
+        READWRITE(txid);
+        READWRITE(vSpends);
+        READWRITE(vOutputs);
+        READWRITE(vActions);
+    }
+};
+
+/**
+ * A block reduced to what light clients need, as lightwalletd serves it: the
+ * transactions with shielded components, and the sizes of the note
+ * commitment trees after the block. Transactions without any are left out.
+ */
+struct CCompactBlock
+{
+    uint32_t nHeight;
+    uint256 hash;
+    uint256 hashPrevBlock;
+    uint32_t nTime;
+    //! Zero if the tree is not known, which is the case before its pool activates.
+    uint32_t nSaplingTreeSize;
+    uint32_t nOrchardTreeSize;
+    std::vector<CCompactTx> vtx;
+
+    CCompactBlock() : nHeight(0), nTime(0), nSaplingTreeSize(0), nOrchardTreeSize(0) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(nHeight);
+        READWRITE(hash);
+        READWRITE(hashPrevBlock);
+        READWRITE(nTime);
+        READWRITE(nSaplingTreeSize);
+        READWRITE(nOrchardTreeSize);
+        READWRITE(vtx);
+    }
+};
+
+/** Reduce a transaction to its compact form, as the transaction at nIndex in its block. */
+CCompactTx MakeCompactTx(const CTransaction& tx, uint64_t nIndex);
+
+/** Reduce a block to its compact form. Requires cs_main, to look up the tree sizes. */
+CCompactBlock MakeCompactBlock(const CBlock& block, const CBlockIndex* pindex);
+
+/**
+ * The serialized compact forms of the blocks served last, by block hash. The
+ * compact form of a block does not depend on which chain is active, so
+ * entries stay valid across reorgs.
+ */
+class CCompactBlockCache
+{
+public:
+    typedef std::shared_ptr<const std::vector<unsigned char>> Entry;
+
+    explicit CCompactBlockCache(size_t nMaxSize) : nMaxSize(nMaxSize), nSize(0) {}
+
+    Entry Get(const uint256& hash);
+    void Insert(const uint256& hash, const Entry& entry);
+    void SetMaxSize(size_t nMaxSizeIn);
+
+private:
+    CCriticalSection cs;
+    size_t nMaxSize;
+    size_t nSize;
+    //! Most recently used first.
+    std::list<std::pair<uint256, Entry>> lru;
+    std::map<uint256, std::list<std::pair<uint256, Entry>>::iterator> mapEntries;
+
+    void Trim();
+};
+
+extern CCompactBlockCache compactBlockCache;
+
+/**
+ * The serialized compact form of a block, from the cache or else made from
+ * pblock if given, or read from the block files. Returns nullptr if the
+ * block cannot be read. Requires cs_main.
+ */
+CCompactBlockCache::Entry GetCompactBlock(const CBlockIndex* pindex, const CBlock* pblock = nullptr);
+
+#endif // ZCASH_COMPACTBLOCKS_H
@@ -58,8 +58,9 @@ std::set<FundingStreamElement> GetActiveFundingStreamElements(
     if (params.NetworkUpgradeActive(nHeight, Consensus::UPGRADE_CANOPY)) {
         for (uint32_t idx = Consensus::FIRST_FUNDING_STREAM; idx < Consensus::MAX_FUNDING_STREAMS; idx++) {
             // The following indexed access is safe as Consensus::MAX_FUNDING_STREAMS is used
-            // in the definition of vFundingStreams.
-            auto fs = params.vFundingStreams[idx];
+            // in the definition of vFundingStreams. It is not copied, as
+            // that would copy every address of the stream.
+            const auto& fs = params.vFundingStreams[idx];
             // Funding period is [startHeight, endHeight)
             if (fs && nHeight >= fs.value().GetStartHeight() && nHeight < fs.value().GetEndHeight()) {
                 requiredElements.insert(std::make_pair(
@@ -81,7 +82,7 @@ std::vector<FSInfo> GetActiveFundingStreams(
     // Funding streams are disabled if Canopy is not active.
     if (params.NetworkUpgradeActive(nHeight, Consensus::UPGRADE_CANOPY)) {
         for (uint32_t idx = Consensus::FIRST_FUNDING_STREAM; idx < Consensus::MAX_FUNDING_STREAMS; idx++) {
-            auto fs = params.vFundingStreams[idx];
+            const auto& fs = params.vFundingStreams[idx];
             if (fs && nHeight >= fs.value().GetStartHeight() && nHeight < fs.value().GetEndHeight()) {
                 activeStreams.push_back(FundingStreamInfo[idx]);
             }
@@ -366,6 +366,11 @@ struct Params {
     int64_t MaxActualTimespan(int nHeight) const;
 
     uint256 nMinimumChainWork;
+    /**
+     * The default for -assumevalid: a block whose ancestors' proofs, scripts
+     * and signatures need not be checked, updated with each release.
+     */
+    uint256 defaultAssumeValid;
 };
 } // namespace Consensus
 
@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string>
 
 /** A hasher class for SHA-256. */
 class CSHA256
@@ -30,4 +31,32 @@ private:
     void FinalizeNoPadding(unsigned char hash[OUTPUT_SIZE], bool enforce_compression);
 };
 
+namespace sha256_implementation {
+/** The hardware-accelerated SHA-256 implementations that SHA256AutoDetect may pick. */
+enum UseImplementation : uint8_t {
+    STANDARD = 0,
+    USE_SSE41 = 1 << 0,
+    USE_AVX2 = 1 << 1,
+    USE_SHANI = 1 << 2,
+    USE_SSE41_AND_AVX2 = USE_SSE41 | USE_AVX2,
+    USE_ALL = USE_SSE41 | USE_AVX2 | USE_SHANI,
+};
+}
+
+/**
+ * Select the fastest SHA-256 implementations the CPU supports, among those
+ * allowed, after checking them against the standard one. Returns a
+ * description of the implementations in use. Until this is called, the
+ * standard implementation is used.
+ */
+std::string SHA256AutoDetect(sha256_implementation::UseImplementation use_implementation = sha256_implementation::USE_ALL);
+
+/**
+ * Compute the double SHA-256 of each of `blocks` 64-byte inputs, writing
+ * each 32-byte result to output. This is the hash of a pair of child nodes
+ * in a Merkle tree, and is computed several inputs at a time where the CPU
+ * allows it.
+ */
+void SHA256D64(unsigned char* output, const unsigned char* input, size_t blocks);
+
 #endif // BITCOIN_CRYPTO_SHA256_H
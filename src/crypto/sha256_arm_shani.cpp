@@ -0,0 +1,142 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+//
+// SHA-256 with the ARMv8 cryptography extensions. Each SHA256H/SHA256H2 pair
+// performs four rounds.
+
+#ifdef ENABLE_ARM_SHANI
+
+#include <stdint.h>
+#include <stddef.h>
+#include <arm_acle.h>
+#include <arm_neon.h>
+
+#include "crypto/common.h"
+
+namespace {
+
+alignas(16) const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+alignas(16) const uint32_t INIT[8] = {
+    0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul,
+};
+
+alignas(16) const uint32_t PADDING64[16] = {
+    0x80000000ul, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x200,
+};
+
+alignas(16) const uint32_t PADDING32[8] = {
+    0x80000000ul, 0, 0, 0, 0, 0, 0, 0x100,
+};
+
+/** Byte-swap each 32-bit word, to read the big-endian message words. */
+uint32x4_t inline LoadMessage(const unsigned char* chunk)
+{
+    return vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(chunk)));
+}
+
+/**
+ * Four rounds of SHA-256. msg holds the last sixteen message words; from the
+ * fifth group of rounds on, the oldest four are replaced by the next ones.
+ */
+void inline QuadRound(uint32x4_t& state0, uint32x4_t& state1, uint32x4_t* msg, int i)
+{
+    if (i >= 4) {
+        msg[i & 3] = vsha256su1q_u32(vsha256su0q_u32(msg[i & 3], msg[(i + 1) & 3]), msg[(i + 2) & 3], msg[(i + 3) & 3]);
+    }
+    uint32x4_t wk = vaddq_u32(msg[i & 3], vld1q_u32(&K256[4 * i]));
+    uint32x4_t tmp = state0;
+    state0 = vsha256hq_u32(state0, state1, wk);
+    state1 = vsha256h2q_u32(state1, tmp, wk);
+}
+
+/** One SHA-256 transformation of each of two states, interleaved. */
+void inline Transform2(uint32x4_t& a0, uint32x4_t& a1, uint32x4_t* msga, uint32x4_t& b0, uint32x4_t& b1, uint32x4_t* msgb)
+{
+    const uint32x4_t a0_save = a0, a1_save = a1, b0_save = b0, b1_save = b1;
+    for (int i = 0; i < 16; i++) {
+        QuadRound(a0, a1, msga, i);
+        QuadRound(b0, b1, msgb, i);
+    }
+    a0 = vaddq_u32(a0, a0_save);
+    a1 = vaddq_u32(a1, a1_save);
+    b0 = vaddq_u32(b0, b0_save);
+    b1 = vaddq_u32(b1, b1_save);
+}
+
+} // namespace
+
+namespace sha256_arm_shani {
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    uint32x4_t state0 = vld1q_u32(&s[0]), state1 = vld1q_u32(&s[4]), msg[4];
+    while (blocks--) {
+        const uint32x4_t state0_save = state0, state1_save = state1;
+        for (int i = 0; i < 4; i++) {
+            msg[i] = LoadMessage(chunk + 16 * i);
+        }
+        for (int i = 0; i < 16; i++) {
+            QuadRound(state0, state1, msg, i);
+        }
+        state0 = vaddq_u32(state0, state0_save);
+        state1 = vaddq_u32(state1, state1_save);
+        chunk += 64;
+    }
+    vst1q_u32(&s[0], state0);
+    vst1q_u32(&s[4], state1);
+}
+} // namespace sha256_arm_shani
+
+namespace sha256d64_arm_shani {
+void Transform_2way(unsigned char* out, const unsigned char* in)
+{
+    uint32x4_t a0, a1, b0, b1, msga[4], msgb[4];
+    alignas(16) uint32_t sa[8], sb[8];
+
+    // The inputs, and then the padding block of a 64-byte message.
+    a0 = b0 = vld1q_u32(&INIT[0]);
+    a1 = b1 = vld1q_u32(&INIT[4]);
+    for (int i = 0; i < 4; i++) {
+        msga[i] = LoadMessage(in + 16 * i);
+        msgb[i] = LoadMessage(in + 64 + 16 * i);
+    }
+    Transform2(a0, a1, msga, b0, b1, msgb);
+    for (int i = 0; i < 4; i++) {
+        msga[i] = msgb[i] = vld1q_u32(&PADDING64[4 * i]);
+    }
+    Transform2(a0, a1, msga, b0, b1, msgb);
+
+    // The 32-byte digests, padded.
+    msga[0] = a0;
+    msga[1] = a1;
+    msgb[0] = b0;
+    msgb[1] = b1;
+    msga[2] = msgb[2] = vld1q_u32(&PADDING32[0]);
+    msga[3] = msgb[3] = vld1q_u32(&PADDING32[4]);
+    a0 = b0 = vld1q_u32(&INIT[0]);
+    a1 = b1 = vld1q_u32(&INIT[4]);
+    Transform2(a0, a1, msga, b0, b1, msgb);
+
+    vst1q_u32(&sa[0], a0);
+    vst1q_u32(&sa[4], a1);
+    vst1q_u32(&sb[0], b0);
+    vst1q_u32(&sb[4], b1);
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(out + 4 * i, sa[i]);
+        WriteBE32(out + 32 + 4 * i, sb[i]);
+    }
+}
+} // namespace sha256d64_arm_shani
+
+#endif // ENABLE_ARM_SHANI
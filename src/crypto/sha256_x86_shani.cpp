@@ -0,0 +1,167 @@
+// Copyright (c) 2018 The Bitcoin Core developers
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+//
+// SHA-256 with the x86 SHA extensions. The instructions keep the state in
+// the order ABEF and CDGH, and each performs two rounds.
+
+#ifdef ENABLE_X86_SHANI
+
+#include <stdint.h>
+#include <stddef.h>
+#include <immintrin.h>
+
+#include "crypto/common.h"
+
+namespace {
+
+alignas(16) const uint32_t K256[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+alignas(16) const uint32_t INIT[8] = {
+    0x6a09e667ul, 0xbb67ae85ul, 0x3c6ef372ul, 0xa54ff53aul, 0x510e527ful, 0x9b05688cul, 0x1f83d9abul, 0x5be0cd19ul,
+};
+
+/** Byte-swap each 32-bit word, to read the big-endian message words. */
+__m128i inline LoadMessage(const unsigned char* chunk)
+{
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+    return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)chunk), MASK);
+}
+
+/** Load a state into the order of the SHA instructions. */
+void inline Load(const uint32_t* s, __m128i& state0, __m128i& state1)
+{
+    __m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[0]), 0xB1); // CDAB
+    state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&s[4]), 0x1B);      // EFGH
+    state0 = _mm_alignr_epi8(tmp, state1, 8);                                     // ABEF
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);                                  // CDGH
+}
+
+/** Store a state from the order of the SHA instructions. */
+void inline Save(uint32_t* s, __m128i state0, __m128i state1)
+{
+    __m128i tmp = _mm_shuffle_epi32(state0, 0x1B);   // FEBA
+    state1 = _mm_shuffle_epi32(state1, 0xB1);        // DCHG
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);     // DCBA
+    state1 = _mm_alignr_epi8(state1, tmp, 8);        // ABEF
+    _mm_storeu_si128((__m128i*)&s[0], state0);
+    _mm_storeu_si128((__m128i*)&s[4], state1);
+}
+
+/**
+ * Four rounds of SHA-256. msg holds the last sixteen message words; from the
+ * fifth group of rounds on, the oldest four are replaced by the next ones.
+ */
+void inline QuadRound(__m128i& state0, __m128i& state1, __m128i* msg, int i)
+{
+    if (i >= 4) {
+        __m128i tmp = _mm_add_epi32(_mm_sha256msg1_epu32(msg[i & 3], msg[(i + 1) & 3]), _mm_alignr_epi8(msg[(i + 3) & 3], msg[(i + 2) & 3], 4));
+        msg[i & 3] = _mm_sha256msg2_epu32(tmp, msg[(i + 3) & 3]);
+    }
+    __m128i wk = _mm_add_epi32(msg[i & 3], _mm_load_si128((const __m128i*)&K256[4 * i]));
+    state1 = _mm_sha256rnds2_epu32(state1, state0, wk);
+    state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(wk, 0x0E));
+}
+
+/** One SHA-256 transformation of each of two states, interleaved. */
+void inline Transform2(__m128i& a0, __m128i& a1, __m128i* msga, __m128i& b0, __m128i& b1, __m128i* msgb)
+{
+    const __m128i a0_save = a0, a1_save = a1, b0_save = b0, b1_save = b1;
+    for (int i = 0; i < 16; i++) {
+        QuadRound(a0, a1, msga, i);
+        QuadRound(b0, b1, msgb, i);
+    }
+    a0 = _mm_add_epi32(a0, a0_save);
+    a1 = _mm_add_epi32(a1, a1_save);
+    b0 = _mm_add_epi32(b0, b0_save);
+    b1 = _mm_add_epi32(b1, b1_save);
+}
+
+/** The message words of the padding block of a 64-byte message. */
+void inline Padding64(__m128i* msg)
+{
+    msg[0] = _mm_set_epi32(0, 0, 0, 0x80000000);
+    msg[1] = _mm_setzero_si128();
+    msg[2] = _mm_setzero_si128();
+    msg[3] = _mm_set_epi32(0x200, 0, 0, 0);
+}
+
+/** The message words of a 32-byte digest, padded. */
+void inline Digest32(const uint32_t* s, __m128i* msg)
+{
+    msg[0] = _mm_loadu_si128((const __m128i*)&s[0]);
+    msg[1] = _mm_loadu_si128((const __m128i*)&s[4]);
+    msg[2] = _mm_set_epi32(0, 0, 0, 0x80000000);
+    msg[3] = _mm_set_epi32(0x100, 0, 0, 0);
+}
+
+} // namespace
+
+namespace sha256_x86_shani {
+void Transform(uint32_t* s, const unsigned char* chunk, size_t blocks)
+{
+    __m128i state0, state1, msg[4];
+    Load(s, state0, state1);
+    while (blocks--) {
+        const __m128i state0_save = state0, state1_save = state1;
+        for (int i = 0; i < 4; i++) {
+            msg[i] = LoadMessage(chunk + 16 * i);
+        }
+        for (int i = 0; i < 16; i++) {
+            QuadRound(state0, state1, msg, i);
+        }
+        state0 = _mm_add_epi32(state0, state0_save);
+        state1 = _mm_add_epi32(state1, state1_save);
+        chunk += 64;
+    }
+    Save(s, state0, state1);
+}
+} // namespace sha256_x86_shani
+
+namespace sha256d64_x86_shani {
+void Transform_2way(unsigned char* out, const unsigned char* in)
+{
+    __m128i a0, a1, b0, b1, msga[4], msgb[4];
+    alignas(16) uint32_t sa[8], sb[8];
+
+    // The inputs, and then the padding block of a 64-byte message.
+    Load(INIT, a0, a1);
+    Load(INIT, b0, b1);
+    for (int i = 0; i < 4; i++) {
+        msga[i] = LoadMessage(in + 16 * i);
+        msgb[i] = LoadMessage(in + 64 + 16 * i);
+    }
+    Transform2(a0, a1, msga, b0, b1, msgb);
+    Padding64(msga);
+    Padding64(msgb);
+    Transform2(a0, a1, msga, b0, b1, msgb);
+
+    // The 32-byte digests, padded.
+    Save(sa, a0, a1);
+    Save(sb, b0, b1);
+    Digest32(sa, msga);
+    Digest32(sb, msgb);
+    Load(INIT, a0, a1);
+    Load(INIT, b0, b1);
+    Transform2(a0, a1, msga, b0, b1, msgb);
+
+    Save(sa, a0, a1);
+    Save(sb, b0, b1);
+    for (int i = 0; i < 8; i++) {
+        WriteBE32(out + 4 * i, sa[i]);
+        WriteBE32(out + 32 + 4 * i, sb[i]);
+    }
+}
+} // namespace sha256d64_x86_shani
+
+#endif // ENABLE_X86_SHANI
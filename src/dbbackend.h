@@ -0,0 +1,104 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_DBBACKEND_H
+#define ZCASH_DBBACKEND_H
+
+#include "fs.h"
+
+#include <memory>
+#include <optional>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct CDBOptions;
+
+/**
+ * A serialized key or value. A slice returned by a backend stays valid until
+ * the iterator that returned it moves.
+ */
+struct CDBSlice
+{
+    const char* data;
+    size_t size;
+
+    CDBSlice(const char* dataIn, size_t sizeIn) : data(dataIn), size(sizeIn) {}
+};
+
+/** Changes queued to be written to a backend in one atomic write. */
+class CDBBackendBatch
+{
+public:
+    virtual ~CDBBackendBatch() {}
+
+    virtual void Put(const CDBSlice& key, const CDBSlice& value) = 0;
+    virtual void Delete(const CDBSlice& key) = 0;
+    virtual void Clear() = 0;
+};
+
+/** An iterator over a snapshot of a backend, in key order. */
+class CDBBackendIterator
+{
+public:
+    virtual ~CDBBackendIterator() {}
+
+    virtual bool Valid() const = 0;
+    virtual void SeekToFirst() = 0;
+    //! Move to the first key at or after key.
+    virtual void Seek(const CDBSlice& key) = 0;
+    virtual void Next() = 0;
+    virtual CDBSlice Key() const = 0;
+    virtual CDBSlice Value() const = 0;
+};
+
+/**
+ * An ordered key-value store that a CDBWrapper keeps its records in. The
+ * backend of each database is chosen by its profile (see CDBOptions), and
+ * errors are reported by throwing dbwrapper_error.
+ */
+class CDBBackend
+{
+public:
+    virtual ~CDBBackend() {}
+
+    //! Read the value of key. Returns false if there is none.
+    virtual bool Get(const CDBSlice& key, std::string& strValue) const = 0;
+
+    //! Read the values of several keys. Entry i is the value of keys[i], or
+    //! empty if there is none. The default reads the keys one at a time in
+    //! key order, so that neighbouring keys are read from the same table
+    //! blocks; backends with a native multi-get may override it.
+    virtual std::vector<std::optional<std::string>> GetMany(const std::vector<CDBSlice>& keys) const;
+
+    virtual std::unique_ptr<CDBBackendBatch> NewBatch() const = 0;
+    //! Apply a batch created by NewBatch(), flushing it to disk if fSync.
+    virtual void Write(CDBBackendBatch& batch, bool fSync) = 0;
+
+    virtual std::unique_ptr<CDBBackendIterator> NewIterator() const = 0;
+
+    //! The memory used by the write buffers and caches of the database.
+    virtual size_t DynamicMemoryUsage() const = 0;
+    //! The approximate size of the database on disk, in bytes.
+    virtual uint64_t ApproximateSize() const = 0;
+    //! The number of table files at each level, for backends that keep
+    //! their tables in levels.
+    virtual std::vector<int64_t> GetFilesPerLevel() const { return {}; }
+};
+
+/** Names of the backends that -dboptions can select. */
+extern const std::vector<std::string> DB_BACKEND_NAMES;
+static const char* const DEFAULT_DB_BACKEND = "leveldb";
+
+/**
+ * Open the database at path with the backend named by dbOptions. If fMemory,
+ * the database is kept in memory; if fWipe, existing data is removed first.
+ */
+std::unique_ptr<CDBBackend> OpenDBBackend(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions);
+
+/** The backends, defined in dbbackend_<name>.cpp. */
+std::unique_ptr<CDBBackend> OpenLevelDBBackend(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions);
+
+#endif // ZCASH_DBBACKEND_H
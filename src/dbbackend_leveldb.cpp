@@ -0,0 +1,252 @@
+// Copyright (c) 2012-2014 The Bitcoin Core developers
+// Copyright (c) 2019-2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "dbbackend.h"
+
+#include "dbwrapper.h"
+#include "util/strencodings.h"
+#include "util/system.h"
+
+#include <leveldb/cache.h>
+#include <leveldb/db.h>
+#include <leveldb/env.h>
+#include <leveldb/filter_policy.h>
+#include <leveldb/write_batch.h>
+#include <memenv.h>
+
+//! Number of levels in a LevelDB database (leveldb::config::kNumLevels, which
+//! is not part of the public headers).
+static const int LEVELDB_NUM_LEVELS = 7;
+
+/** Handle a LevelDB error by throwing dbwrapper_error. */
+static void HandleError(const leveldb::Status& status)
+{
+    if (status.ok())
+        return;
+    LogPrintf("%s\n", status.ToString());
+    if (status.IsCorruption())
+        throw dbwrapper_error("Database corrupted");
+    if (status.IsIOError())
+        throw dbwrapper_error("Database I/O error");
+    if (status.IsNotFound())
+        throw dbwrapper_error("Database entry missing");
+    throw dbwrapper_error("Unknown database error");
+}
+
+bool DBCompressionAvailable()
+{
+    // LevelDB silently stores blocks uncompressed when it was built without
+    // Snappy, so find out by compressing something very compressible.
+    static const bool fAvailable = []() {
+        std::unique_ptr<leveldb::Env> env(leveldb::NewMemEnv(leveldb::Env::Default()));
+        leveldb::Options options;
+        options.create_if_missing = true;
+        options.env = env.get();
+        options.compression = leveldb::kSnappyCompression;
+        leveldb::DB* pdb;
+        if (!leveldb::DB::Open(options, "/probe", &pdb).ok()) {
+            return false;
+        }
+        std::unique_ptr<leveldb::DB> db(pdb);
+        std::string strValue(1 << 16, 'x');
+        if (!db->Put(leveldb::WriteOptions(), "k", strValue).ok()) {
+            return false;
+        }
+        db->CompactRange(nullptr, nullptr);
+        leveldb::Range range("", "l");
+        uint64_t nSize = 0;
+        db->GetApproximateSizes(&range, 1, &nSize);
+        return nSize < strValue.size() / 2;
+    }();
+    return fAvailable;
+}
+
+namespace {
+
+leveldb::Slice ToLevelDB(const CDBSlice& slice)
+{
+    return leveldb::Slice(slice.data, slice.size);
+}
+
+CDBSlice FromLevelDB(const leveldb::Slice& slice)
+{
+    return CDBSlice(slice.data(), slice.size());
+}
+
+leveldb::Options GetOptions(size_t nCacheSize, const CDBOptions& dbOptions)
+{
+    leveldb::Options options;
+    size_t nBlockCacheSize = nCacheSize / 100 * dbOptions.nBlockCachePercent;
+    options.block_cache = leveldb::NewLRUCache(nBlockCacheSize);
+    options.write_buffer_size = (nCacheSize - nBlockCacheSize) / 2; // up to two write buffers may be held in memory simultaneously
+    options.filter_policy = dbOptions.nBloomBits > 0 ? leveldb::NewBloomFilterPolicy(dbOptions.nBloomBits) : NULL;
+    options.compression = dbOptions.fCompression ? leveldb::kSnappyCompression : leveldb::kNoCompression;
+    options.max_open_files = dbOptions.nMaxOpenFiles;
+    options.max_file_size = dbOptions.nMaxFileSize;
+    if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
+        // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
+        // on corruption in later versions.
+        options.paranoid_checks = true;
+    }
+    return options;
+}
+
+class CLevelDBBatch : public CDBBackendBatch
+{
+public:
+    leveldb::WriteBatch batch;
+
+    void Put(const CDBSlice& key, const CDBSlice& value) override { batch.Put(ToLevelDB(key), ToLevelDB(value)); }
+    void Delete(const CDBSlice& key) override { batch.Delete(ToLevelDB(key)); }
+    void Clear() override { batch.Clear(); }
+};
+
+class CLevelDBIterator : public CDBBackendIterator
+{
+    std::unique_ptr<leveldb::Iterator> piter;
+
+public:
+    explicit CLevelDBIterator(leveldb::Iterator* piterIn) : piter(piterIn) {}
+
+    bool Valid() const override { return piter->Valid(); }
+    void SeekToFirst() override { piter->SeekToFirst(); }
+    void Seek(const CDBSlice& key) override { piter->Seek(ToLevelDB(key)); }
+    void Next() override { piter->Next(); }
+    CDBSlice Key() const override { return FromLevelDB(piter->key()); }
+    CDBSlice Value() const override { return FromLevelDB(piter->value()); }
+};
+
+class CLevelDBBackend : public CDBBackend
+{
+private:
+    //! custom environment this database is using (may be NULL in case of default environment)
+    leveldb::Env* penv;
+
+    //! database options used
+    leveldb::Options options;
+
+    //! options used when reading from the database
+    leveldb::ReadOptions readoptions;
+
+    //! options used when iterating over values of the database
+    leveldb::ReadOptions iteroptions;
+
+    //! options used when writing to the database
+    leveldb::WriteOptions writeoptions;
+
+    //! options used when sync writing to the database
+    leveldb::WriteOptions syncoptions;
+
+    //! the database itself
+    leveldb::DB* pdb;
+
+public:
+    CLevelDBBackend(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions)
+    {
+        penv = NULL;
+        readoptions.verify_checksums = true;
+        iteroptions.verify_checksums = true;
+        iteroptions.fill_cache = false;
+        syncoptions.sync = true;
+        options = GetOptions(nCacheSize, dbOptions);
+        options.create_if_missing = true;
+        if (fMemory) {
+            penv = leveldb::NewMemEnv(leveldb::Env::Default());
+            options.env = penv;
+        } else {
+            if (fWipe) {
+                LogPrintf("Wiping LevelDB in %s\n", path.string());
+                leveldb::Status result = leveldb::DestroyDB(path.string(), options);
+                HandleError(result);
+            }
+            TryCreateDirectory(path);
+            LogPrintf("Opening LevelDB in %s\n", path.string());
+        }
+        leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
+        HandleError(status);
+        LogPrintf("Opened LevelDB successfully\n");
+    }
+
+    ~CLevelDBBackend()
+    {
+        delete pdb;
+        pdb = NULL;
+        delete options.filter_policy;
+        options.filter_policy = NULL;
+        delete options.block_cache;
+        options.block_cache = NULL;
+        delete penv;
+        options.env = NULL;
+    }
+
+    bool Get(const CDBSlice& key, std::string& strValue) const override
+    {
+        leveldb::Status status = pdb->Get(readoptions, ToLevelDB(key), &strValue);
+        if (!status.ok()) {
+            if (status.IsNotFound())
+                return false;
+            LogPrintf("LevelDB read failure: %s\n", status.ToString());
+            HandleError(status);
+        }
+        return true;
+    }
+
+    std::unique_ptr<CDBBackendBatch> NewBatch() const override
+    {
+        return std::make_unique<CLevelDBBatch>();
+    }
+
+    void Write(CDBBackendBatch& batch, bool fSync) override
+    {
+        leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &static_cast<CLevelDBBatch&>(batch).batch);
+        HandleError(status);
+    }
+
+    std::unique_ptr<CDBBackendIterator> NewIterator() const override
+    {
+        return std::make_unique<CLevelDBIterator>(pdb->NewIterator(iteroptions));
+    }
+
+    size_t DynamicMemoryUsage() const override
+    {
+        std::string strValue;
+        int64_t nValue;
+        if (pdb->GetProperty("leveldb.approximate-memory-usage", &strValue) && ParseInt64(strValue, &nValue)) {
+            return nValue;
+        }
+        return 0;
+    }
+
+    uint64_t ApproximateSize() const override
+    {
+        // Every key is serialized with a one-byte prefix, so this range covers
+        // the whole database.
+        leveldb::Range range("", "\xff\xff");
+        uint64_t nSize = 0;
+        pdb->GetApproximateSizes(&range, 1, &nSize);
+        return nSize;
+    }
+
+    std::vector<int64_t> GetFilesPerLevel() const override
+    {
+        std::vector<int64_t> vFiles;
+        std::string strValue;
+        int64_t nValue;
+        for (int nLevel = 0; nLevel < LEVELDB_NUM_LEVELS; nLevel++) {
+            if (!pdb->GetProperty(strprintf("leveldb.num-files-at-level%d", nLevel), &strValue) || !ParseInt64(strValue, &nValue)) {
+                break;
+            }
+            vFiles.push_back(nValue);
+        }
+        return vFiles;
+    }
+};
+
+} // namespace
+
+std::unique_ptr<CDBBackend> OpenLevelDBBackend(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions)
+{
+    return std::make_unique<CLevelDBBackend>(path, nCacheSize, fMemory, fWipe, dbOptions);
+}
@@ -1,82 +1,220 @@
 // Copyright (c) 2012-2014 The Bitcoin Core developers
-// Copyright (c) 2019-2022 The Zcash developers
+// Copyright (c) 2019-2023 The Zcash developers
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "dbwrapper.h"
 
 #include "fs.h"
+#include "sync.h"
+#include "util/strencodings.h"
 #include "util/system.h"
 
-#include <leveldb/cache.h>
-#include <leveldb/env.h>
-#include <leveldb/filter_policy.h>
-#include <memenv.h>
+#include <rust/metrics.h>
 #include <stdint.h>
 
+#include <algorithm>
+#include <map>
+
+#include <boost/algorithm/string.hpp>
 #include <boost/scoped_ptr.hpp>
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+const std::vector<std::string> DB_PROFILE_NAMES = {"blockindex", "chainstate", "txindex", "addressindex", "spentindex", "timestampindex"};
+
+static std::map<std::string, CDBOptions> mapDBOptions;
+
+/** The open databases that have a profile name, for GetDBMemoryUsage(). */
+static CCriticalSection cs_openDBs;
+static std::multimap<std::string, const CDBWrapper*> mapOpenDBs GUARDED_BY(cs_openDBs);
+
+std::string CDBOptions::ToString() const
 {
-    leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
-    options.compression = leveldb::kNoCompression;
-    options.max_open_files = 64;
-    if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
-        // LevelDB versions before 1.16 consider short writes to be corruption. Only trigger error
-        // on corruption in later versions.
-        options.paranoid_checks = true;
-    }
-    return options;
+    return strprintf("backend=%s,compression=%d,maxopenfiles=%d,maxfilesize=%u,bloombits=%d,blockcache=%d",
+        strBackend, fCompression, nMaxOpenFiles, nMaxFileSize >> 20, nBloomBits, nBlockCachePercent);
 }
 
-CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe)
+static bool ParseDBSetting(CDBOptions& dbOptions, const std::string& strSetting, std::string& strError)
 {
-    penv = NULL;
-    readoptions.verify_checksums = true;
-    iteroptions.verify_checksums = true;
-    iteroptions.fill_cache = false;
-    syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
-    options.create_if_missing = true;
-    if (fMemory) {
-        penv = leveldb::NewMemEnv(leveldb::Env::Default());
-        options.env = penv;
+    size_t nPos = strSetting.find('=');
+    if (nPos == std::string::npos) {
+        strError = strprintf("expected <setting>=<value>, got '%s'", strSetting);
+        return false;
+    }
+    std::string strKey = strSetting.substr(0, nPos);
+    if (strKey == "backend") {
+        std::string strBackend = strSetting.substr(nPos + 1);
+        if (std::find(DB_BACKEND_NAMES.begin(), DB_BACKEND_NAMES.end(), strBackend) == DB_BACKEND_NAMES.end()) {
+            strError = strprintf("unknown backend '%s' (expected one of %s)", strBackend, boost::algorithm::join(DB_BACKEND_NAMES, ", "));
+            return false;
+        }
+        dbOptions.strBackend = strBackend;
+        return true;
+    }
+    int64_t nValue;
+    if (!ParseInt64(strSetting.substr(nPos + 1), &nValue)) {
+        strError = strprintf("invalid value for %s", strKey);
+        return false;
+    }
+    if (strKey == "compression" && (nValue == 0 || nValue == 1)) {
+        dbOptions.fCompression = nValue;
+    } else if (strKey == "maxopenfiles" && nValue >= 1 && nValue <= 50000) {
+        dbOptions.nMaxOpenFiles = nValue;
+    } else if (strKey == "maxfilesize" && nValue >= 1 && nValue <= 1024) {
+        dbOptions.nMaxFileSize = nValue << 20;
+    } else if (strKey == "bloombits" && nValue >= 0 && nValue <= 64) {
+        dbOptions.nBloomBits = nValue;
+    } else if (strKey == "blockcache" && nValue >= 0 && nValue <= 100) {
+        dbOptions.nBlockCachePercent = nValue;
     } else {
-        if (fWipe) {
-            LogPrintf("Wiping LevelDB in %s\n", path.string());
-            leveldb::Status result = leveldb::DestroyDB(path.string(), options);
-            dbwrapper_private::HandleError(result);
+        strError = strprintf("unknown setting or value out of range: '%s'", strSetting);
+        return false;
+    }
+    return true;
+}
+
+bool ParseDBOptions(const std::vector<std::string>& vArgs, std::string& strError)
+{
+    std::map<std::string, CDBOptions> mapParsed;
+    for (const std::string& strArg : vArgs) {
+        size_t nPos = strArg.find(':');
+        std::string strName = strArg.substr(0, nPos);
+        if (std::find(DB_PROFILE_NAMES.begin(), DB_PROFILE_NAMES.end(), strName) == DB_PROFILE_NAMES.end()) {
+            strError = strprintf("Unknown database profile '%s' in -dboptions (expected one of %s)",
+                strName, boost::algorithm::join(DB_PROFILE_NAMES, ", "));
+            return false;
+        }
+        if (nPos == std::string::npos) {
+            strError = strprintf("No settings given for database profile '%s' in -dboptions", strName);
+            return false;
+        }
+        // Later arguments for the same profile add to the earlier ones.
+        auto it = mapParsed.find(strName);
+        if (it == mapParsed.end()) {
+            it = mapParsed.emplace(strName, CDBOptions()).first;
+            it->second.strName = strName;
+        }
+        std::vector<std::string> vSettings;
+        boost::split(vSettings, strArg.substr(nPos + 1), boost::is_any_of(","));
+        for (const std::string& strSetting : vSettings) {
+            std::string strSettingError;
+            if (!ParseDBSetting(it->second, strSetting, strSettingError)) {
+                strError = strprintf("Invalid -dboptions for database profile '%s': %s", strName, strSettingError);
+                return false;
+            }
+        }
+    }
+    mapDBOptions.swap(mapParsed);
+    return true;
+}
+
+CDBOptions GetDBOptions(const std::string& strName)
+{
+    auto it = mapDBOptions.find(strName);
+    if (it != mapDBOptions.end()) {
+        return it->second;
+    }
+    CDBOptions dbOptions;
+    dbOptions.strName = strName;
+    return dbOptions;
+}
+
+const std::vector<std::string> DB_BACKEND_NAMES = {"leveldb"};
+
+std::vector<std::optional<std::string>> CDBBackend::GetMany(const std::vector<CDBSlice>& keys) const
+{
+    // The backends order keys bytewise.
+    std::vector<size_t> order(keys.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        const unsigned char* pa = (const unsigned char*)keys[a].data;
+        const unsigned char* pb = (const unsigned char*)keys[b].data;
+        return std::lexicographical_compare(pa, pa + keys[a].size, pb, pb + keys[b].size);
+    });
+
+    std::vector<std::optional<std::string>> values(keys.size());
+    std::string strValue;
+    for (size_t i : order) {
+        if (Get(keys[i], strValue)) {
+            values[i] = std::move(strValue);
         }
-        TryCreateDirectory(path);
-        LogPrintf("Opening LevelDB in %s\n", path.string());
     }
-    leveldb::Status status = leveldb::DB::Open(options, path.string(), &pdb);
-    dbwrapper_private::HandleError(status);
-    LogPrintf("Opened LevelDB successfully\n");
+    return values;
+}
+
+std::unique_ptr<CDBBackend> OpenDBBackend(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions)
+{
+    if (dbOptions.strBackend == "leveldb") {
+        return OpenLevelDBBackend(path, nCacheSize, fMemory, fWipe, dbOptions);
+    }
+    throw dbwrapper_error(strprintf("Unknown database backend '%s'", dbOptions.strBackend));
+}
+
+CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, const CDBOptions& dbOptions)
+    : pdb(OpenDBBackend(path, nCacheSize, fMemory, fWipe, dbOptions)), strName(dbOptions.strName)
+{
+    if (!strName.empty()) {
+        LogPrint("db", "Using %s profile %s: %s\n", dbOptions.strBackend, strName, dbOptions.ToString());
+        nLastMetricsUpdate = GetTimeMillis();
+        UpdateMetrics();
+        LOCK(cs_openDBs);
+        mapOpenDBs.emplace(strName, this);
+    }
 }
 
 CDBWrapper::~CDBWrapper()
 {
-    delete pdb;
-    pdb = NULL;
-    delete options.filter_policy;
-    options.filter_policy = NULL;
-    delete options.block_cache;
-    options.block_cache = NULL;
-    delete penv;
-    options.env = NULL;
+    if (!strName.empty()) {
+        LOCK(cs_openDBs);
+        for (auto it = mapOpenDBs.begin(); it != mapOpenDBs.end(); ++it) {
+            if (it->second == this) {
+                mapOpenDBs.erase(it);
+                break;
+            }
+        }
+    }
 }
 
 bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
 {
-    leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
-    dbwrapper_private::HandleError(status);
+    pdb->Write(*batch.batch, fSync);
+    // Querying the backend for the gauges is too costly to do on every write.
+    int64_t nNow = GetTimeMillis();
+    int64_t nLast = nLastMetricsUpdate;
+    if (!strName.empty() && nNow - nLast >= DBWRAPPER_METRICS_INTERVAL_MS &&
+        nLastMetricsUpdate.compare_exchange_strong(nLast, nNow)) {
+        UpdateMetrics();
+    }
     return true;
 }
 
+void CDBWrapper::UpdateMetrics() const
+{
+    MetricsGauge("zcash.db.memory.bytes", pdb->DynamicMemoryUsage(), "db", strName.c_str());
+    MetricsGauge("zcash.db.size.bytes", pdb->ApproximateSize(), "db", strName.c_str());
+    std::vector<int64_t> vFiles = pdb->GetFilesPerLevel();
+    for (size_t nLevel = 0; nLevel < vFiles.size(); nLevel++) {
+        std::string strLevel = std::to_string(nLevel);
+        MetricsGauge("zcash.db.files", vFiles[nLevel], "db", strName.c_str(), "level", strLevel.c_str());
+    }
+}
+
+size_t CDBWrapper::DynamicMemoryUsage() const
+{
+    return pdb->DynamicMemoryUsage();
+}
+
+std::map<std::string, size_t> GetDBMemoryUsage()
+{
+    LOCK(cs_openDBs);
+    std::map<std::string, size_t> mapUsage;
+    for (const auto& [strName, pdbw] : mapOpenDBs) {
+        mapUsage[strName] += pdbw->DynamicMemoryUsage();
+    }
+    return mapUsage;
+}
+
 bool CDBWrapper::IsEmpty()
 {
     boost::scoped_ptr<CDBIterator> it(NewIterator());
@@ -84,25 +222,9 @@ bool CDBWrapper::IsEmpty()
     return !(it->Valid());
 }
 
-CDBIterator::~CDBIterator() { delete piter; }
+CDBBatch::CDBBatch(const CDBWrapper &_parent) : parent(_parent), batch(_parent.pdb->NewBatch()) {}
+
+CDBIterator::~CDBIterator() {}
 bool CDBIterator::Valid() { return piter->Valid(); }
 void CDBIterator::SeekToFirst() { piter->SeekToFirst(); }
 void CDBIterator::Next() { piter->Next(); }
-
-namespace dbwrapper_private {
-
-void HandleError(const leveldb::Status& status)
-{
-    if (status.ok())
-        return;
-    LogPrintf("%s\n", status.ToString());
-    if (status.IsCorruption())
-        throw dbwrapper_error("Database corrupted");
-    if (status.IsIOError())
-        throw dbwrapper_error("Database I/O error");
-    if (status.IsNotFound())
-        throw dbwrapper_error("Database entry missing");
-    throw dbwrapper_error("Unknown database error");
-}
-
-};
@@ -7,17 +7,19 @@
 #define BITCOIN_DBWRAPPER_H
 
 #include "clientversion.h"
+#include "dbbackend.h"
 #include "fs.h"
 #include "serialize.h"
 #include "streams.h"
 #include "util/system.h"
 #include "version.h"
 
-#include <leveldb/db.h>
-#include <leveldb/write_batch.h>
+#include <atomic>
 
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
+/** Minimum interval between two updates of the metrics of a database by WriteBatch() */
+static const int64_t DBWRAPPER_METRICS_INTERVAL_MS = 10 * 1000;
 
 class dbwrapper_error : public std::runtime_error
 {
@@ -27,15 +29,58 @@ public:
 
 class CDBWrapper;
 
-/** These should be considered an implementation detail of the specific database.
+/**
+ * Backend and tuning of one database. Each database opened by the node has a
+ * named profile (see DB_PROFILE_NAMES), whose defaults can be overridden
+ * with -dboptions. The tuning settings are those of LevelDB; other backends
+ * map them onto their own equivalents.
  */
-namespace dbwrapper_private {
+struct CDBOptions
+{
+    //! Profile name, also used to label the database metrics. Empty for
+    //! databases that are not tracked.
+    std::string strName;
+    //! The backend that stores the database (see DB_BACKEND_NAMES).
+    std::string strBackend;
+    //! Compress table blocks with Snappy, if LevelDB was built with it.
+    bool fCompression;
+    //! Maximum number of open files; LevelDB enforces a minimum of 74.
+    int nMaxOpenFiles;
+    //! Target size of a table file, in bytes.
+    size_t nMaxFileSize;
+    //! Bits per key of the Bloom filters in table files (0 disables them).
+    int nBloomBits;
+    //! Share of the database cache given to the block cache, in percent. The
+    //! rest is split between the two write buffers.
+    int nBlockCachePercent;
+
+    CDBOptions() : strBackend(DEFAULT_DB_BACKEND), fCompression(false), nMaxOpenFiles(64), nMaxFileSize(2 << 20), nBloomBits(10), nBlockCachePercent(50) {}
+
+    std::string ToString() const;
+};
+
+/** Names of the profiles that can be configured with -dboptions. */
+extern const std::vector<std::string> DB_PROFILE_NAMES;
 
-/** Handle database error by throwing dbwrapper_error exception.
+/**
+ * Parse -dboptions arguments of the form
+ * <profile>:<setting>=<value>[,<setting>=<value>...] and make them the
+ * overrides returned by GetDBOptions. Returns false and sets strError if an
+ * argument is invalid.
  */
-void HandleError(const leveldb::Status& status);
+bool ParseDBOptions(const std::vector<std::string>& vArgs, std::string& strError);
 
-};
+/** The options configured for the named profile. */
+CDBOptions GetDBOptions(const std::string& strName);
+
+/** Whether LevelDB was built with Snappy, so that compression has an effect. */
+bool DBCompressionAvailable();
+
+/**
+ * The memory used by the write buffers and block caches of the open
+ * databases that have a profile name, by profile name.
+ */
+std::map<std::string, size_t> GetDBMemoryUsage();
 
 /** Batch of changes queued to be written to a CDBWrapper */
 class CDBBatch
@@ -44,13 +89,18 @@ class CDBBatch
 
 private:
     const CDBWrapper &parent;
-    leveldb::WriteBatch batch;
+    std::unique_ptr<CDBBackendBatch> batch;
 
 public:
     /**
      * @param[in] _parent   CDBWrapper that this batch is to be submitted to
      */
-    CDBBatch(const CDBWrapper &_parent) : parent(_parent) { };
+    CDBBatch(const CDBWrapper &_parent);
+
+    void Clear()
+    {
+        batch->Clear();
+    }
 
     template <typename K, typename V>
     void Write(const K& key, const V& value)
@@ -58,14 +108,12 @@ public:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
         ssKey << key;
-        leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         CDataStream ssValue(SER_DISK, CLIENT_VERSION);
         ssValue.reserve(DBWRAPPER_PREALLOC_VALUE_SIZE);
         ssValue << value;
-        leveldb::Slice slValue(ssValue.data(), ssValue.size());
 
-        batch.Put(slKey, slValue);
+        batch->Put(CDBSlice(ssKey.data(), ssKey.size()), CDBSlice(ssValue.data(), ssValue.size()));
     }
 
     template <typename K>
@@ -74,9 +122,8 @@ public:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
         ssKey << key;
-        leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
-        batch.Delete(slKey);
+        batch->Delete(CDBSlice(ssKey.data(), ssKey.size()));
     }
 };
 
@@ -84,16 +131,16 @@ class CDBIterator
 {
 private:
     const CDBWrapper &parent;
-    leveldb::Iterator *piter;
+    std::unique_ptr<CDBBackendIterator> piter;
 
 public:
 
     /**
      * @param[in] _parent          Parent CDBWrapper instance.
-     * @param[in] _piter           The original leveldb iterator.
+     * @param[in] _piter           The iterator of the parent's backend.
      */
-    CDBIterator(const CDBWrapper &_parent, leveldb::Iterator *_piter) :
-        parent(_parent), piter(_piter) { };
+    CDBIterator(const CDBWrapper &_parent, std::unique_ptr<CDBBackendIterator> _piter) :
+        parent(_parent), piter(std::move(_piter)) { };
     ~CDBIterator();
 
     bool Valid();
@@ -104,16 +151,15 @@ public:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(GetSerializeSize(ssKey, key));
         ssKey << key;
-        leveldb::Slice slKey(ssKey.data(), ssKey.size());
-        piter->Seek(slKey);
+        piter->Seek(CDBSlice(ssKey.data(), ssKey.size()));
     }
 
     void Next();
 
     template<typename K> bool GetKey(K& key) {
-        leveldb::Slice slKey = piter->key();
+        CDBSlice slKey = piter->Key();
         try {
-            CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            CDataStream ssKey(slKey.data, slKey.data + slKey.size, SER_DISK, CLIENT_VERSION);
             ssKey >> key;
         } catch(std::exception &e) {
             return false;
@@ -122,9 +168,9 @@ public:
     }
 
     template<typename V> bool GetValue(V& value) {
-        leveldb::Slice slValue = piter->value();
+        CDBSlice slValue = piter->Value();
         try {
-            CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(slValue.data, slValue.data + slValue.size, SER_DISK, CLIENT_VERSION);
             ssValue >> value;
         } catch(std::exception &e) {
             return false;
@@ -133,43 +179,48 @@ public:
     }
 
     unsigned int GetValueSize() {
-        return piter->value().size();
+        return piter->Value().size;
+    }
+
+    //! The serialized key and value, for copying records verbatim.
+    std::vector<unsigned char> GetKeyBytes() {
+        CDBSlice slKey = piter->Key();
+        return std::vector<unsigned char>(slKey.data, slKey.data + slKey.size);
+    }
+
+    std::vector<unsigned char> GetValueBytes() {
+        CDBSlice slValue = piter->Value();
+        return std::vector<unsigned char>(slValue.data, slValue.data + slValue.size);
     }
 
 };
 
 class CDBWrapper
 {
-private:
-    //! custom environment this database is using (may be NULL in case of default environment)
-    leveldb::Env* penv;
-
-    //! database options used
-    leveldb::Options options;
-
-    //! options used when reading from the database
-    leveldb::ReadOptions readoptions;
+    friend class CDBBatch;
 
-    //! options used when iterating over values of the database
-    leveldb::ReadOptions iteroptions;
+private:
+    //! the database itself
+    std::unique_ptr<CDBBackend> pdb;
 
-    //! options used when writing to the database
-    leveldb::WriteOptions writeoptions;
+    //! name used to label the metrics of this database (may be empty)
+    std::string strName;
 
-    //! options used when sync writing to the database
-    leveldb::WriteOptions syncoptions;
+    //! time of the last update of the metrics, in milliseconds
+    std::atomic<int64_t> nLastMetricsUpdate{0};
 
-    //! the database itself
-    leveldb::DB* pdb;
+    //! Update the gauges describing the size and shape of the database.
+    void UpdateMetrics() const;
 
 public:
     /**
-     * @param[in] path        Location in the filesystem where leveldb data will be stored.
-     * @param[in] nCacheSize  Configures various leveldb cache settings.
-     * @param[in] fMemory     If true, use leveldb's memory environment.
+     * @param[in] path        Location in the filesystem where the data will be stored.
+     * @param[in] nCacheSize  Configures the caches and write buffers of the backend.
+     * @param[in] fMemory     If true, keep the database in memory.
      * @param[in] fWipe       If true, remove all existing data.
+     * @param[in] dbOptions   Backend and tuning profile of this database.
      */
-    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory = false, bool fWipe = false, const CDBOptions& dbOptions = CDBOptions());
     ~CDBWrapper();
 
     template <typename K, typename V>
@@ -178,15 +229,10 @@ public:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
         ssKey << key;
-        leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
-        if (!status.ok()) {
-            if (status.IsNotFound())
-                return false;
-            LogPrintf("LevelDB read failure: %s\n", status.ToString());
-            dbwrapper_private::HandleError(status);
+        if (!pdb->Get(CDBSlice(ssKey.data(), ssKey.size()), strValue)) {
+            return false;
         }
         try {
             CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
@@ -197,6 +243,41 @@ public:
         return true;
     }
 
+    /**
+     * Read the values of several keys at once. Entry i of the result holds the
+     * value of keys[i], or is empty if there is none or it does not
+     * deserialize. The keys are read in key order, whatever their order here.
+     */
+    template <typename V, typename K>
+    std::vector<std::optional<V>> ReadMany(const std::vector<K>& keys) const
+    {
+        std::vector<CDataStream> vKeys;
+        vKeys.reserve(keys.size());
+        std::vector<CDBSlice> slKeys;
+        slKeys.reserve(keys.size());
+        for (const K& key : keys) {
+            vKeys.emplace_back(SER_DISK, CLIENT_VERSION);
+            CDataStream& ssKey = vKeys.back();
+            ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+            ssKey << key;
+            slKeys.emplace_back(ssKey.data(), ssKey.size());
+        }
+
+        std::vector<std::optional<std::string>> vValues = pdb->GetMany(slKeys);
+        std::vector<std::optional<V>> values(keys.size());
+        for (size_t i = 0; i < vValues.size(); i++) {
+            if (!vValues[i]) continue;
+            try {
+                CDataStream ssValue(vValues[i]->data(), vValues[i]->data() + vValues[i]->size(), SER_DISK, CLIENT_VERSION);
+                V value;
+                ssValue >> value;
+                values[i] = std::move(value);
+            } catch (const std::exception&) {
+            }
+        }
+        return values;
+    }
+
     template <typename K, typename V>
     bool Write(const K& key, const V& value, bool fSync = false)
     {
@@ -211,17 +292,9 @@ public:
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
         ssKey << key;
-        leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
-        if (!status.ok()) {
-            if (status.IsNotFound())
-                return false;
-            LogPrintf("LevelDB read failure: %s\n", status.ToString());
-            dbwrapper_private::HandleError(status);
-        }
-        return true;
+        return pdb->Get(CDBSlice(ssKey.data(), ssKey.size()), strValue);
     }
 
     template <typename K>
@@ -234,7 +307,7 @@ public:
 
     bool WriteBatch(CDBBatch& batch, bool fSync = false);
 
-    // not available for LevelDB; provide for compatibility with BDB
+    // not available for the backends; provide for compatibility with BDB
     bool Flush()
     {
         return true;
@@ -248,9 +321,15 @@ public:
 
     CDBIterator *NewIterator()
     {
-        return new CDBIterator(*this, pdb->NewIterator(iteroptions));
+        return new CDBIterator(*this, pdb->NewIterator());
     }
 
+    /**
+     * Return the backend's estimate of the memory used by this database's
+     * write buffers and caches.
+     */
+    size_t DynamicMemoryUsage() const;
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
@@ -0,0 +1,42 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "diskrecord.h"
+
+#include <rust/compression.h>
+
+void CDiskRecord::Compress()
+{
+    rust::Vec<uint8_t> compressed = compression::compress({data.data(), data.size()}, DISK_RECORD_COMPRESSION_LEVEL);
+    if (compressed.size() < data.size()) {
+        data.assign(compressed.begin(), compressed.end());
+        fCompressed = true;
+    }
+}
+
+std::vector<unsigned char>& DiskRecordReadBuffer()
+{
+    static thread_local std::vector<unsigned char> buffer;
+    return buffer;
+}
+
+std::vector<unsigned char>& DiskRecordDecompressBuffer()
+{
+    static thread_local std::vector<unsigned char> buffer;
+    return buffer;
+}
+
+bool IsValidDiskRecordSize(unsigned int nSizeField)
+{
+    return (nSizeField & ~DISK_RECORD_COMPRESSED) <= MAX_BLOCK_SIZE;
+}
+
+bool DecompressDiskRecord(const std::vector<unsigned char>& compressed, std::vector<unsigned char>& data)
+{
+    rust::Vec<uint8_t> decompressed;
+    if (!compression::decompress({compressed.data(), compressed.size()}, MAX_BLOCK_SIZE, decompressed))
+        return false;
+    data.assign(decompressed.begin(), decompressed.end());
+    return true;
+}
@@ -0,0 +1,106 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_DISKRECORD_H
+#define ZCASH_DISKRECORD_H
+
+#include "clientversion.h"
+#include "consensus/consensus.h"
+#include "streams.h"
+
+#include <vector>
+
+/**
+ * Set in the size of the index header (magic bytes and size) before a block
+ * or undo data in the block and undo files when it is stored compressed (see
+ * -compressblockfiles); the rest of the size is then that of its raw DEFLATE
+ * stream. Sizes are otherwise at most MAX_BLOCK_SIZE, so older versions skip
+ * compressed blocks when they scan the block files.
+ */
+static const unsigned int DISK_RECORD_COMPRESSED = 0x80000000;
+/** The DEFLATE level blocks and undo data are stored at, as they are being connected. */
+static const uint8_t DISK_RECORD_COMPRESSION_LEVEL = 1;
+
+/**
+ * A block or undo data as it is stored in the block or undo files, after its
+ * index header: compressed if asked for and smaller that way, and serialized
+ * as it is otherwise. Only serializations of at most MAX_BLOCK_SIZE bytes are
+ * compressed, so that reading one back is bounded.
+ */
+class CDiskRecord
+{
+private:
+    std::vector<unsigned char> data;
+    bool fCompressed;
+
+    //! Replace data by its compression, if that is smaller.
+    void Compress();
+
+public:
+    template <typename T>
+    CDiskRecord(const T& obj, bool fCompress) : data(SerializeToVector(obj, SER_DISK, CLIENT_VERSION)), fCompressed(false)
+    {
+        if (fCompress && data.size() <= MAX_BLOCK_SIZE)
+            Compress();
+    }
+
+    //! The size recorded in the index header.
+    unsigned int GetSizeField() const { return data.size() | (fCompressed ? DISK_RECORD_COMPRESSED : 0); }
+    //! The size taken after the index header.
+    unsigned int size() const { return data.size(); }
+    const std::vector<unsigned char>& GetData() const { return data; }
+};
+
+/**
+ * Whether the size in an index header is that of a compressed record, or of
+ * a serialization, of at most MAX_BLOCK_SIZE bytes.
+ */
+bool IsValidDiskRecordSize(unsigned int nSizeField);
+
+/** Decompress a record stored compressed into the serialization it was made of. */
+bool DecompressDiskRecord(const std::vector<unsigned char>& compressed, std::vector<unsigned char>& data);
+
+/**
+ * Buffers owned by the calling thread that records are read and decompressed
+ * into, so that reading a block or undo data reuses the memory the thread's
+ * previous read allocated rather than allocating its size anew. They hold at
+ * most MAX_BLOCK_SIZE bytes each.
+ */
+std::vector<unsigned char>& DiskRecordReadBuffer();
+std::vector<unsigned char>& DiskRecordDecompressBuffer();
+
+/**
+ * Read the record of the given index header size from the stream, and
+ * deserialize it into obj.
+ *
+ * A record of a valid size that is not already in memory is read whole with
+ * a single read into the thread's read buffer and deserialized from there,
+ * rather than with a read for each field.
+ */
+template <typename Stream, typename T>
+void ReadDiskRecord(Stream& s, unsigned int nSizeField, T& obj)
+{
+    if (nSizeField & DISK_RECORD_COMPRESSED) {
+        if (!IsValidDiskRecordSize(nSizeField))
+            throw std::ios_base::failure("ReadDiskRecord: compressed record too large");
+        std::vector<unsigned char>& compressed = DiskRecordReadBuffer();
+        compressed.resize(nSizeField & ~DISK_RECORD_COMPRESSED);
+        s.read((char*)compressed.data(), compressed.size());
+        std::vector<unsigned char>& data = DiskRecordDecompressBuffer();
+        if (!DecompressDiskRecord(compressed, data))
+            throw std::ios_base::failure("ReadDiskRecord: corrupt compressed record");
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, (const char*)data.data(), (const char*)data.data() + data.size());
+        reader >> obj;
+    } else if (IsContiguousReadStream<Stream>::value || !IsValidDiskRecordSize(nSizeField)) {
+        s >> obj;
+    } else {
+        std::vector<unsigned char>& data = DiskRecordReadBuffer();
+        data.resize(nSizeField);
+        s.read((char*)data.data(), data.size());
+        CSpanReader reader(SER_DISK, CLIENT_VERSION, (const char*)data.data(), (const char*)data.data() + data.size());
+        reader >> obj;
+    }
+}
+
+#endif // ZCASH_DISKRECORD_H
@@ -0,0 +1,89 @@
+#include "hash.h"
+#include "policy/policy.h"
+#include "script/interpreter.h"
+#include "script/script.h"
+#include "script/standard.h"
+
+// Checks that VerifyScript, with its fast path for P2PKH spends, agrees with
+// running every script through the interpreter.
+
+// A signature checker whose verdict depends only on its inputs, so that both
+// outcomes of OP_CHECKSIG are reachable without valid signatures.
+class FuzzSignatureChecker : public BaseSignatureChecker
+{
+public:
+    bool CheckSig(
+        const std::vector<unsigned char>& scriptSig,
+        const std::vector<unsigned char>& vchPubKey,
+        const CScript& scriptCode,
+        uint32_t consensusBranchId) const override
+    {
+        uint160 hash = Hash160(scriptSig.begin(), scriptSig.end());
+        return (hash.begin()[0] ^ vchPubKey.size() ^ scriptCode.size()) & 1;
+    }
+};
+
+static const unsigned int FUZZ_FLAGS[] = {
+    SCRIPT_VERIFY_NONE,
+    SCRIPT_VERIFY_P2SH,
+    MANDATORY_SCRIPT_VERIFY_FLAGS,
+    STANDARD_SCRIPT_VERIFY_FLAGS,
+};
+
+// The first byte of the input selects the flags, and whether the P2PKH output
+// commits to the last push of the scriptSig; the rest is the scriptSig.
+bool fuzz_VerifyScriptFunction (const std::vector<unsigned char> data) {
+        if (data.empty()) return true;
+        unsigned int flags = FUZZ_FLAGS[data[0] % (sizeof(FUZZ_FLAGS) / sizeof(FUZZ_FLAGS[0]))];
+        CScript scriptSig(data.begin() + 1, data.end());
+
+        std::vector<unsigned char> vchPubKey(data.begin(), data.end());
+        if (data[0] & 0x80) {
+            CScript::const_iterator pc = scriptSig.begin();
+            opcodetype opcode;
+            std::vector<unsigned char> vch;
+            while (scriptSig.GetOp(pc, opcode, vch)) {
+                vchPubKey = vch;
+            }
+        }
+        uint160 hash = Hash160(vchPubKey.begin(), vchPubKey.end());
+        CScript scriptPubKey = CScript() << OP_DUP << OP_HASH160 << ToByteVector(hash) << OP_EQUALVERIFY << OP_CHECKSIG;
+
+        FuzzSignatureChecker checker;
+        ScriptError serror, serrorInterpreted;
+        bool fResult = VerifyScript(scriptSig, scriptPubKey, flags, checker, 0, &serror);
+        bool fResultInterpreted = VerifyScriptInterpreted(scriptSig, scriptPubKey, flags, checker, 0, &serrorInterpreted);
+        if (fResult != fResultInterpreted || serror != serrorInterpreted) {
+            abort();
+        }
+        return fResult;
+}
+
+#ifdef FUZZ_WITH_AFL
+
+// AFL
+
+int fuzz_VerifyScript (int argc, char *argv[]) {
+        std::ifstream t(argv[1]);
+        std::vector<unsigned char> vec((std::istreambuf_iterator<char>(t)),
+                                         std::istreambuf_iterator<char>());
+        if (fuzz_VerifyScriptFunction (vec)) { fprintf(stdout, "Verified the script.") ; return 0; }
+        else { fprintf(stderr, "Could not verify the script.") ; return -1; }
+}
+
+int main (int argc, char *argv[]) { return fuzz_VerifyScript(argc, argv); }
+
+#endif
+
+#ifdef FUZZ_WITH_LIBFUZZER
+
+// libFuzzer
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *Data, size_t Size) {
+    std::vector<unsigned char> vect(Size);
+    memcpy(vect.data(), Data, Size);
+    fuzz_VerifyScriptFunction(vect);
+    return 0;  // Non-zero return values are reserved for future use.
+}
+
+#endif
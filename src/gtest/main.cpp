@@ -1,4 +1,5 @@
 #include "gmock/gmock.h"
+#include "crypto/sha256.h"
 #include "init.h"
 #include "key.h"
 #include "pubkey.h"
@@ -64,6 +65,7 @@ public:
 
 int main(int argc, char **argv) {
   assert(sodium_init() != -1);
+  SHA256AutoDetect();
   ECC_Start();
 
     // Log all errors to a common test file.
@@ -564,6 +564,47 @@ TEST(ContextualCheckShieldedInputsTest, BadTxnsInvalidJoinsplitSignature) {
     ContextualCheckShieldedInputs(tx, txdata, state, view, saplingAuth, orchardAuth, consensus, 0, false, true, [](const Consensus::Params&) { return false; });
 }
 
+TEST(ContextualCheckShieldedInputsTest, JoinsplitSignatureBatch) {
+    SelectParams(CBaseChainParams::REGTEST);
+    auto consensus = Params().GetConsensus();
+    std::optional<rust::Box<sapling::BatchValidator>> saplingAuth = std::nullopt;
+    auto orchardAuth = orchard::AuthValidator::Disabled();
+    auto saplingBranchId = NetworkUpgradeInfo[Consensus::UPGRADE_SAPLING].nBranchId;
+
+    CMutableTransaction mtx = GetValidTransaction(saplingBranchId);
+    CTransaction tx(mtx);
+    mtx.joinSplitSig.bytes[0] += 1;
+    CTransaction badTx(mtx);
+
+    // Recreate the fake coins being spent.
+    std::vector<CTxOut> allPrevOutputs;
+    allPrevOutputs.resize(tx.vin.size());
+    const PrecomputedTransactionData txdata(tx, allPrevOutputs);
+    const PrecomputedTransactionData badTxdata(badTx, allPrevOutputs);
+
+    MockCValidationState state;
+    AssumeShieldedInputsExistAndAreSpendable baseView;
+    CCoinsViewCache view(&baseView);
+
+    // A batch containing only valid signatures validates.
+    ed25519::BatchValidator batch;
+    EXPECT_TRUE(ContextualCheckShieldedInputs(
+        tx, txdata, state, view, saplingAuth, orchardAuth, consensus, saplingBranchId, false, true,
+        [](const Consensus::Params&) { return false; }, &batch));
+    EXPECT_TRUE(batch.Validate());
+    EXPECT_THROW(batch.Validate(), std::logic_error);
+
+    // An invalid signature is only detected when the batch is validated.
+    ed25519::BatchValidator badBatch;
+    EXPECT_TRUE(ContextualCheckShieldedInputs(
+        tx, txdata, state, view, saplingAuth, orchardAuth, consensus, saplingBranchId, false, true,
+        [](const Consensus::Params&) { return false; }, &badBatch));
+    EXPECT_TRUE(ContextualCheckShieldedInputs(
+        badTx, badTxdata, state, view, saplingAuth, orchardAuth, consensus, saplingBranchId, false, true,
+        [](const Consensus::Params&) { return false; }, &badBatch));
+    EXPECT_FALSE(badBatch.Validate());
+}
+
 TEST(ContextualCheckShieldedInputsTest, JoinsplitSignatureDetectsOldBranchId) {
     SelectParams(CBaseChainParams::REGTEST);
     auto consensus = Params().GetConsensus();
@@ -139,6 +139,23 @@ TEST(FoundersRewardTest, General) {
     EXPECT_DEATH(params.GetFoundersRewardAddressAtHeight(maxHeight+1), "nHeight"); 
 }
 
+// The scripts are decoded once, when the parameters are set up, and must match
+// the addresses they are looked up by.
+TEST(FoundersRewardTest, ScriptMatchesAddress) {
+    for (const std::string& network : {CBaseChainParams::MAIN, CBaseChainParams::TESTNET, CBaseChainParams::REGTEST}) {
+        SelectParams(network);
+        CChainParams params = Params();
+        KeyIO keyIO(params);
+        int maxHeight = GetLastFoundersRewardHeight(params.GetConsensus());
+        for (int nHeight = 1; nHeight <= maxHeight; nHeight += std::max(1, std::min(997, maxHeight - nHeight))) {
+            auto address = keyIO.DecodePaymentAddress(params.GetFoundersRewardAddressAtHeight(nHeight));
+            ASSERT_TRUE(address.has_value());
+            CScript script = CScript() << OP_HASH160 << ToByteVector(std::get<CScriptID>(address.value())) << OP_EQUAL;
+            EXPECT_EQ(HexStr(params.GetFoundersRewardScriptAtHeight(nHeight)), HexStr(script));
+        }
+    }
+}
+
 TEST(FoundersRewardTest, RegtestGetLastBlockBlossom) {
     int blossomActivationHeight = Consensus::PRE_BLOSSOM_REGTEST_HALVING_INTERVAL / 2; // = 75
     auto params = RegtestActivateBlossom(false, blossomActivationHeight).GetConsensus();
@@ -21,11 +21,11 @@ public:
         return false;
     }
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         return false;
     }
 
-    bool HaveCoins(const uint256 &txid) const {
+    bool HaveCoin(const COutPoint &outpoint) const {
         return false;
     }
 
@@ -213,3 +213,64 @@ TEST(History, GarbageMemoryHash) {
     // Check history root and garbage history root are equal
     EXPECT_EQ(historyRoot, historyRootGarbage);
 }
+
+// Checks the nodes a tip flushed to base keeps cached against those of a
+// view that never flushes.
+static void CheckCachedNodesAcrossFlushes(CCoinsView* base) {
+    const auto epochId = NetworkUpgradeInfo[Consensus::UPGRADE_HEARTWOOD].nBranchId;
+
+    FakeCoinsViewDB fakeDB;
+    CCoinsViewCache tip(base);
+    CCoinsViewCache reference(&fakeDB);
+
+    // Each block is connected or disconnected in a view of its own, and the
+    // tip is flushed every few blocks, keeping the nodes it has read.
+    size_t nBlocks = 0;
+    auto update = [&](std::function<void(CCoinsViewCache&)> f) {
+        CCoinsViewCache view(&tip);
+        f(view);
+        view.Flush();
+        f(reference);
+        if (++nBlocks % 3 == 0) {
+            tip.Flush();
+        }
+        EXPECT_EQ(tip.GetHistoryRoot(epochId), reference.GetHistoryRoot(epochId));
+    };
+
+    for (uint64_t n = 1; n <= 20; n++) {
+        update([&](CCoinsViewCache& view) { view.PushHistoryNode(epochId, getLeafN(n)); });
+    }
+    // A reorg replaces nodes that the tip may have cached.
+    for (int i = 0; i < 4; i++) {
+        update([&](CCoinsViewCache& view) { view.PopHistoryNode(epochId); });
+    }
+    for (uint64_t n = 101; n <= 110; n++) {
+        update([&](CCoinsViewCache& view) { view.PushHistoryNode(epochId, getLeafN(n)); });
+    }
+    tip.Flush();
+
+    HistoryIndex length = reference.GetHistoryLength(epochId);
+    ASSERT_EQ(tip.GetHistoryLength(epochId), length);
+    std::vector<HistoryIndex> indices;
+    for (HistoryIndex i = 0; i < length; i++) {
+        indices.push_back(i);
+    }
+    std::vector<HistoryNode> nodes = tip.GetHistoryNodes(epochId, indices);
+    for (HistoryIndex i = 0; i < length; i++) {
+        HistoryNode expected = reference.GetHistoryAt(epochId, i);
+        EXPECT_EQ(0, memcmp(nodes[i].bytes, expected.bytes, NODE_SERIALIZED_LENGTH));
+    }
+}
+
+TEST(History, CachedNodesAcrossFlushes) {
+    // Stands in for the database, holding the trees flushed from the tip.
+    FakeCoinsViewDB fakeDB;
+    CCoinsViewCache backing(&fakeDB);
+    CheckCachedNodesAcrossFlushes(&backing);
+
+    // With -asynccoinsflush, the tip is flushed to a layer that takes its
+    // caches over and writes them to the database in the background.
+    CCoinsViewDB db(1 << 23, true);
+    CCoinsViewFlushLayer flushLayer(&db);
+    CheckCachedNodesAcrossFlushes(&flushLayer);
+}
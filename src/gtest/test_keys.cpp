@@ -1,5 +1,6 @@
 #include <chainparams.h>
 #include <key_io.h>
+#include <util/strencodings.h>
 #include <zcash/Address.hpp>
 
 #include "util/test.h"
@@ -66,6 +67,34 @@ TEST(Keys, EncodeAndDecodeSapling)
     }
 }
 
+TEST(Keys, EncodedAddressesAreCachedPerNetwork)
+{
+    auto addr = GetTestMasterSaplingSpendingKey().Derive(0).ToXFVK().DefaultAddress();
+    CKeyID keyId = CKeyID(uint160(ParseHex("91b24bf9f5288532960ac687abb035127b1d28a5")));
+
+    SelectParams(CBaseChainParams::MAIN);
+    KeyIO mainKeyIO(Params());
+    std::string mainAddr = mainKeyIO.EncodePaymentAddress(addr);
+    std::string mainDest = mainKeyIO.EncodeDestination(keyId);
+    // Encoding again returns the cached strings.
+    EXPECT_EQ(mainKeyIO.EncodePaymentAddress(addr), mainAddr);
+    EXPECT_EQ(mainKeyIO.EncodeDestination(keyId), mainDest);
+
+    SelectParams(CBaseChainParams::TESTNET);
+    KeyIO testKeyIO(Params());
+    std::string testAddr = testKeyIO.EncodePaymentAddress(addr);
+    std::string testDest = testKeyIO.EncodeDestination(keyId);
+    EXPECT_NE(testAddr, mainAddr);
+    EXPECT_NE(testDest, mainDest);
+    EXPECT_EQ(testAddr.substr(0, 13), "ztestsapling1");
+    EXPECT_TRUE(testKeyIO.DecodePaymentAddress(testAddr) == libzcash::PaymentAddress(addr));
+    EXPECT_TRUE(testKeyIO.DecodeDestination(testDest) == CTxDestination(keyId));
+
+    EXPECT_EQ(testKeyIO.EncodeDestination(CNoDestination()), "");
+
+    SelectParams(CBaseChainParams::MAIN);
+}
+
 #define MAKE_STRING(x) std::string((x), (x) + sizeof(x))
 
 namespace libzcash {
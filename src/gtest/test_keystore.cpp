@@ -464,6 +464,51 @@ TEST(KeystoreTests, StoreAndRetrieveLegacyHDSeedInEncryptedStore) {
     EXPECT_EQ(seed3, seedOut.value());
 }
 
+TEST(KeystoreTests, UnlockChecksSampleOfKeys) {
+    TestCCryptoKeyStore keyStore;
+    uint256 r {GetRandHash()};
+    CKeyingMaterial vMasterKey (r.begin(), r.end());
+
+    std::vector<CKey> keys;
+    for (int i = 0; i < 20; i++) {
+        CKey key = CKey::TestOnlyRandomKey(true);
+        ASSERT_TRUE(keyStore.AddKeyPubKey(key, key.GetPubKey()));
+        keys.push_back(key);
+    }
+    ASSERT_TRUE(keyStore.AddSproutSpendingKey(libzcash::SproutSpendingKey::random()));
+    ASSERT_TRUE(keyStore.EncryptKeys(vMasterKey));
+    ASSERT_TRUE(keyStore.Lock());
+
+    // Only a few keys are checked up front, but all of them can be used.
+    nWalletUnlockCheckKeys = 3;
+    uint256 r2 {GetRandHash()};
+    CKeyingMaterial vRandomKey (r2.begin(), r2.end());
+    EXPECT_FALSE(keyStore.Unlock(vRandomKey));
+    ASSERT_TRUE(keyStore.Unlock(vMasterKey));
+    for (const CKey& key : keys) {
+        CKey keyOut;
+        ASSERT_TRUE(keyStore.GetKey(key.GetPubKey().GetID(), keyOut));
+        EXPECT_EQ(key, keyOut);
+    }
+
+    // A key that does not decrypt is detected either when unlocking or
+    // when it is first used.
+    ASSERT_TRUE(keyStore.Lock());
+    CKey corrupted = CKey::TestOnlyRandomKey(true);
+    std::vector<unsigned char> vchGarbage(48);
+    GetRandBytes(vchGarbage.data(), vchGarbage.size());
+    ASSERT_TRUE(keyStore.AddCryptedKey(corrupted.GetPubKey(), vchGarbage));
+    EXPECT_DEATH({
+        keyStore.Unlock(vMasterKey);
+        CKey keyOut;
+        keyStore.GetKey(corrupted.GetPubKey().GetID(), keyOut);
+    }, "");
+
+    // Checking every key detects it when unlocking.
+    nWalletUnlockCheckKeys = DEFAULT_WALLET_UNLOCK_CHECK_KEYS;
+    EXPECT_DEATH(keyStore.Unlock(vMasterKey), "");
+}
+
 TEST(KeystoreTests, StoreAndRetrieveSpendingKeyInEncryptedStore) {
     TestCCryptoKeyStore keyStore;
     uint256 r {GetRandHash()};
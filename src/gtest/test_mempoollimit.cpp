@@ -109,6 +109,47 @@ TEST(MempoolLimitTests, WeightedTxTreeCheckSizeAfterDropping)
     }
 }
 
+TEST(MempoolLimitTests, WeightedTxTreeBulkUpdates)
+{
+    // Apply the same changes one at a time to one tree and in bulk to the
+    // other; the bulk removal is large enough to take the rebuild path.
+    WeightedTxTree single(0);
+    WeightedTxTree bulk(0);
+    std::vector<WeightedTxInfo> infos;
+    for (int i = 0; i < 1000; i++) {
+        infos.push_back(WeightedTxInfo(ArithToUint256(i + 1), TxWeight(MIN_TX_COST + i, MIN_TX_COST + i + (i % 3 == 0 ? LOW_FEE_PENALTY : 0))));
+        single.add(infos.back());
+    }
+    bulk.add(infos);
+    EXPECT_EQ(1000, bulk.getSize());
+    EXPECT_EQ(single.getTotalWeight().cost, bulk.getTotalWeight().cost);
+    EXPECT_EQ(single.getTotalWeight().evictionWeight, bulk.getTotalWeight().evictionWeight);
+
+    // Duplicates and unknown txids are ignored.
+    bulk.add(infos[0]);
+    bulk.remove(ArithToUint256(5000));
+    EXPECT_EQ(1000, bulk.getSize());
+
+    std::vector<uint256> txIds;
+    for (int i = 0; i < 1000; i += 2) {
+        txIds.push_back(infos[i].txId);
+        single.remove(infos[i].txId);
+    }
+    txIds.push_back(ArithToUint256(5000));
+    bulk.remove(txIds);
+    EXPECT_EQ(500, bulk.getSize());
+    EXPECT_EQ(single.getTotalWeight().cost, bulk.getTotalWeight().cost);
+    EXPECT_EQ(single.getTotalWeight().evictionWeight, bulk.getTotalWeight().evictionWeight);
+
+    // Every remaining transaction can still be found and removed.
+    for (int i = 1; i < 1000; i += 2) {
+        bulk.remove(infos[i].txId);
+    }
+    EXPECT_EQ(0, bulk.getSize());
+    EXPECT_EQ(0, bulk.getTotalWeight().cost);
+    EXPECT_EQ(0, bulk.getTotalWeight().evictionWeight);
+}
+
 TEST(MempoolLimitTests, WeightedTxInfoFromTx)
 {
     LoadProofParameters();
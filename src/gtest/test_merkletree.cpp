@@ -17,6 +17,7 @@
 
 #include <stdexcept>
 
+#include "random.h"
 #include "util/strencodings.h"
 #include "version.h"
 #include "serialize.h"
@@ -287,6 +288,142 @@ TEST(merkletree, testZeroElements) {
     }
 }
 
+TEST(merkletree, WitnessAppendAll) {
+    SproutMerkleTree tree;
+    std::vector<SproutWitness> witnesses;
+
+    // Witnesses at a spread of positions, some sharing cursors.
+    for (int i = 0; i < 300; i++) {
+        libzcash::SHA256Compress cm = GetRandHash();
+        for (auto& witness : witnesses) {
+            witness.append(cm);
+        }
+        tree.append(cm);
+        if (i % 7 == 0 || i % 64 == 63) {
+            witnesses.push_back(tree.witness());
+        }
+    }
+
+    std::vector<SproutWitness> expected(witnesses);
+    std::vector<SproutWitness*> vWitnesses;
+    for (auto& witness : witnesses) {
+        vWitnesses.push_back(&witness);
+    }
+
+    // Appending in batches of any size matches appending one at a time.
+    for (size_t nBatch : {1, 2, 5, 64, 300}) {
+        std::vector<libzcash::SHA256Compress> objs;
+        for (size_t i = 0; i < nBatch; i++) {
+            objs.push_back(GetRandHash());
+            tree.append(objs.back());
+            for (auto& witness : expected) {
+                witness.append(objs.back());
+            }
+        }
+        SproutWitness::append_all(vWitnesses, objs);
+
+        for (size_t i = 0; i < witnesses.size(); i++) {
+            ASSERT_TRUE(witnesses[i] == expected[i]);
+            ASSERT_EQ(witnesses[i].root(), tree.root());
+        }
+    }
+}
+
+template<typename Tree, typename Hash>
+void test_append_many()
+{
+    for (size_t nStart : {0, 1, 2, 3, 4, 7, 8, 33}) {
+        for (size_t nCount : {0, 1, 2, 3, 5, 16, 61}) {
+            Tree expected, tree;
+            for (size_t i = 0; i < nStart; i++) {
+                Hash cm = GetRandHash();
+                expected.append(cm);
+                tree.append(cm);
+            }
+            std::vector<Hash> objs;
+            for (size_t i = 0; i < nCount; i++) {
+                objs.push_back(GetRandHash());
+                expected.append(objs.back());
+            }
+            tree.append_many(objs);
+            ASSERT_TRUE(tree == expected);
+            ASSERT_EQ(tree.root(), expected.root());
+        }
+    }
+}
+
+TEST(merkletree, AppendMany) {
+    test_append_many<SproutMerkleTree, libzcash::SHA256Compress>();
+    test_append_many<SaplingMerkleTree, libzcash::PedersenHash>();
+
+    // A tree cannot be overfilled, and is left as it was.
+    SproutTestingMerkleTree tree;
+    std::vector<libzcash::SHA256Compress> objs(1 << INCREMENTAL_MERKLE_TREE_DEPTH_TESTING);
+    tree.append_many(objs);
+    ASSERT_THROW(tree.append_many({libzcash::SHA256Compress()}), std::runtime_error);
+    objs.push_back(libzcash::SHA256Compress());
+    SproutTestingMerkleTree other;
+    ASSERT_THROW(other.append_many(objs), std::runtime_error);
+    ASSERT_EQ(other.size(), 0);
+}
+
+TEST(merkletree, CompletedSubtreeRoot) {
+    SaplingTestingMerkleTree tree;
+    ASSERT_FALSE(tree.completed_subtree_root(2).has_value());
+
+    // Two subtrees of four leaves each make up the first half of the tree.
+    std::vector<libzcash::PedersenHash> vRoots;
+    for (int i = 0; i < 8; i++) {
+        tree.append(GetRandHash());
+        auto root = tree.completed_subtree_root(2);
+        ASSERT_EQ(root.has_value(), tree.size() % 4 == 0);
+        if (root.has_value()) {
+            vRoots.push_back(root.value());
+        }
+    }
+    ASSERT_EQ(vRoots.size(), 2);
+    libzcash::PedersenHash half = libzcash::PedersenHash::combine(vRoots[0], vRoots[1], 2);
+    ASSERT_EQ(tree.completed_subtree_root(3).value(), half);
+    ASSERT_EQ(tree.root(), libzcash::PedersenHash::combine(half, libzcash::PedersenHash::EmptyRoot(3), 3));
+
+    // The subtree of the whole tree is the tree.
+    tree.append_many(std::vector<libzcash::PedersenHash>(8, GetRandHash()));
+    ASSERT_EQ(tree.completed_subtree_root(INCREMENTAL_MERKLE_TREE_DEPTH_TESTING).value(), tree.root());
+}
+
+TEST(merkletree, RootCache) {
+    SaplingMerkleTree tree;
+    SaplingMerkleTree other;
+    ASSERT_EQ(tree.root(), SaplingMerkleTree::empty_root());
+
+    for (int i = 0; i < 5; i++) {
+        tree.append(GetRandHash());
+    }
+    SaplingWitness witness = tree.witness();
+    uint256 root = tree.root();
+    ASSERT_EQ(tree.root(), root);
+    ASSERT_EQ(witness.root(), root);
+
+    // Appending and deserializing over a tree or witness drop cached roots.
+    libzcash::PedersenHash cm = GetRandHash();
+    tree.append(cm);
+    witness.append(cm);
+    ASSERT_NE(tree.root(), root);
+    ASSERT_EQ(witness.root(), tree.root());
+
+    ASSERT_EQ(other.root(), SaplingMerkleTree::empty_root());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << tree;
+    ss >> other;
+    ASSERT_EQ(other.root(), tree.root());
+
+    SaplingWitness otherWitness = other.witness();
+    ASSERT_EQ(otherWitness.root(), tree.root());
+    ss << SaplingMerkleTree().witness();
+    ss >> otherWitness;
+    ASSERT_EQ(otherWitness.root(), SaplingMerkleTree::empty_root());
+}
+
 TEST(orchardMerkleTree, emptyroot) {
     // This literal is the depth-32 empty tree root with the bytes reversed, to
     // account for the fact that uint256S() loads a big-endian representation of
@@ -415,6 +415,59 @@ TEST(NoteEncryption, AcceptsValidNoteZip212Enabled)
     RegtestDeactivateSapling();
 }
 
+TEST(NoteEncryption, SaplingKeyAgreementBatch)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, 5);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, 30);
+    const Consensus::Params& params = Params().GetConsensus();
+    int height = 40;
+
+    using namespace libzcash;
+    auto ivk = SaplingSpendingKey(uint256()).expanded_spending_key().full_viewing_key().in_viewing_key();
+    auto otherIvk = SaplingSpendingKey(uint256S("01")).expanded_spending_key().full_viewing_key().in_viewing_key();
+    SaplingPaymentAddress addr = *ivk.address({0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+
+    std::array<unsigned char, ZC_MEMO_SIZE> memo = {};
+    SaplingNote note(addr, 39393, Zip212Enabled::BeforeZip212);
+    uint256 cmu = note.cmu().value();
+    auto enc = SaplingNotePlaintext(note, memo).encrypt(addr.pk_d).value();
+    auto ct = enc.first;
+    auto epk = enc.second.get_epk();
+
+    // Not a canonical scalar, nor a canonical point.
+    uint256 invalid = uint256S("ffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
+
+    std::vector<std::optional<uint256>> dhsecrets;
+    ASSERT_TRUE(SaplingKeyAgreementBatch(epk, {invalid, otherIvk, ivk}, dhsecrets));
+    ASSERT_EQ(dhsecrets.size(), 3);
+    EXPECT_FALSE(dhsecrets[0].has_value());
+    ASSERT_TRUE(dhsecrets[1].has_value());
+    ASSERT_TRUE(dhsecrets[2].has_value());
+
+    // The secrets are those computed one key at a time.
+    uint256 expected;
+    ASSERT_TRUE(librustzcash_sapling_ka_agree(true, epk.begin(), ivk.begin(), expected.begin()));
+    EXPECT_EQ(dhsecrets[2].value(), expected);
+    ASSERT_TRUE(librustzcash_sapling_ka_agree(true, epk.begin(), otherIvk.begin(), expected.begin()));
+    EXPECT_EQ(dhsecrets[1].value(), expected);
+
+    // Only the recipient's secret decrypts the note, as decrypt() would.
+    auto plaintext = SaplingNotePlaintext::decrypt_with_dhsecret(params, height, ct, ivk, epk, cmu, dhsecrets[2].value());
+    ASSERT_TRUE(plaintext.has_value());
+    EXPECT_EQ(plaintext->value(), note.value());
+    EXPECT_TRUE(SaplingNotePlaintext::decrypt(params, height, ct, ivk, epk, cmu).has_value());
+    EXPECT_FALSE(SaplingNotePlaintext::decrypt_with_dhsecret(params, height, ct, otherIvk, epk, cmu, dhsecrets[1].value()));
+    EXPECT_FALSE(AttemptSaplingNoteDecryption(ct, dhsecrets[1].value(), epk));
+
+    EXPECT_FALSE(SaplingKeyAgreementBatch(invalid, {ivk}, dhsecrets));
+    ASSERT_TRUE(SaplingKeyAgreementBatch(epk, {}, dhsecrets));
+    EXPECT_TRUE(dhsecrets.empty());
+
+    // Revert to test default
+    RegtestDeactivateSapling();
+}
+
 TEST(NoteEncryption, SaplingApi)
 {
     using namespace libzcash;
@@ -0,0 +1,44 @@
+#include <gtest/gtest.h>
+
+#include "primitives/transaction.h"
+#include "proof_cache.h"
+#include "random.h"
+
+TEST(ProofCache, ShieldedBundles) {
+    CMutableTransaction mtx;
+    mtx.nVersion = SAPLING_TX_VERSION;
+    mtx.fOverwintered = true;
+    mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    mtx.nExpiryHeight = GetRand(1000);
+    CTransaction tx(mtx);
+
+    EXPECT_FALSE(AreShieldedBundlesCached(tx, 0x76b809bb, false));
+    CacheShieldedBundles(tx, 0x76b809bb);
+
+    // Entries are bound to the consensus branch ID.
+    EXPECT_TRUE(AreShieldedBundlesCached(tx, 0x76b809bb, false));
+    EXPECT_FALSE(AreShieldedBundlesCached(tx, 0x2bb40e60, false));
+
+    // Entries are bound to the transaction.
+    mtx.nExpiryHeight += 1;
+    EXPECT_FALSE(AreShieldedBundlesCached(CTransaction(mtx), 0x76b809bb, false));
+
+    // Erasing on lookup only succeeds once.
+    EXPECT_TRUE(AreShieldedBundlesCached(tx, 0x76b809bb, true));
+    EXPECT_FALSE(AreShieldedBundlesCached(tx, 0x76b809bb, false));
+}
+
+TEST(ProofCache, SproutProof) {
+    JSDescription jsdesc;
+    jsdesc.proof = libzcash::GrothProof();
+    jsdesc.vpub_old = 1;
+    uint256 hSig = GetRandHash();
+
+    EXPECT_FALSE(IsSproutProofCached(jsdesc, hSig));
+    CacheSproutProof(jsdesc, hSig);
+    EXPECT_TRUE(IsSproutProofCached(jsdesc, hSig));
+    EXPECT_FALSE(IsSproutProofCached(jsdesc, GetRandHash()));
+
+    jsdesc.vpub_new = 1;
+    EXPECT_FALSE(IsSproutProofCached(jsdesc, hSig));
+}
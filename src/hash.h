@@ -14,6 +14,7 @@
 #include "uint256.h"
 #include "version.h"
 
+#include <string.h>
 #include <vector>
 
 #include <rust/blake2b.h>
@@ -152,11 +153,25 @@ public:
 };
 
 
-/** A writer stream (for serialization) that computes a 256-bit BLAKE2b hash. */
+/**
+ * A writer stream (for serialization) that computes a 256-bit BLAKE2b hash.
+ *
+ * Serialization writes one field at a time, mostly a few bytes long, so
+ * writes are collected in a buffer and passed to the Rust state together.
+ */
 class CBLAKE2bWriter
 {
 private:
     rust::Box<blake2b::State> state;
+    unsigned char buf[256];
+    size_t bufsize = 0;
+
+    void Flush() {
+        if (bufsize > 0) {
+            state->update({buf, bufsize});
+            bufsize = 0;
+        }
+    }
 
 public:
     int nType;
@@ -171,12 +186,21 @@ public:
     int GetVersion() const { return nVersion; }
 
     CBLAKE2bWriter& write(const char *pch, size_t size) {
-        state->update({(const unsigned char*)pch, size});
+        if (bufsize + size > sizeof(buf)) {
+            Flush();
+            if (size >= sizeof(buf)) {
+                state->update({(const unsigned char*)pch, size});
+                return (*this);
+            }
+        }
+        memcpy(buf + bufsize, pch, size);
+        bufsize += size;
         return (*this);
     }
 
     // invalidates the object
     uint256 GetHash() {
+        Flush();
         uint256 result;
         state->finalize({result.begin(), result.size()});
         return result;
@@ -238,4 +262,17 @@ public:
  */
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
 
+/** Optimized SipHash-2-4 implementation for uint256 followed by a uint32_t.
+ *
+ *  It is identical to:
+ *    SipHasher(k0, k1)
+ *      .Write(val.GetUint64(0))
+ *      .Write(val.GetUint64(1))
+ *      .Write(val.GetUint64(2))
+ *      .Write(val.GetUint64(3))
+ *      .Write(extra) (as 4 little-endian bytes)
+ *      .Finalize()
+ */
+uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
+
 #endif // BITCOIN_HASH_H
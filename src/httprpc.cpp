@@ -3,6 +3,7 @@
 #include "chainparams.h"
 #include "httpserver.h"
 #include "key_io.h"
+#include "rpc/jsonstream.h"
 #include "rpc/protocol.h"
 #include "rpc/server.h"
 #include "random.h"
@@ -178,6 +179,23 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
         if (valRequest.isObject()) {
             jreq.parse(valRequest);
 
+            // Results that can be very large are written to the reply as
+            // they are built.
+            RPCStreamedResult streamed = tableRPC.prepareStreamed(jreq.strMethod, jreq.params);
+            if (streamed) {
+                req->WriteHeader("Content-Type", "application/json");
+                CJSONStreamWriter writer([req](const char* data, size_t len) { req->WriteReplyBody(data, len); });
+                writer.BeginObject();
+                writer.Key("result");
+                streamed(writer);
+                writer.KeyValue("error", NullUniValue);
+                writer.KeyValue("id", jreq.id);
+                writer.EndObject();
+                writer.Flush();
+                req->WriteReply(HTTP_OK, "\n");
+                return true;
+            }
+
             UniValue result = tableRPC.execute(jreq.strMethod, jreq.params);
 
             // Send reply
@@ -185,7 +203,7 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
 
         // array of requests
         } else if (valRequest.isArray())
-            strReply = JSONRPCExecBatch(valRequest.get_array());
+            strReply = JSONRPCExecBatch(valRequest.get_array(), HTTPQueueWork);
         else
             throw JSONRPCError(RPC_PARSE_ERROR, "Top-level object parse error");
 
@@ -201,6 +219,35 @@ static bool HTTPReq_JSONRPC(HTTPRequest* req, const std::string &)
     return true;
 }
 
+/** How much of a JSON-RPC request body is looked at to pick its work queue */
+static const size_t JSONRPC_QUEUE_PEEK_SIZE = 4096;
+
+/**
+ * Send calls to wallet methods to the wallet work queue, so that they are
+ * not held up behind a flood of other calls. This runs on the event loop
+ * thread, so rather than parsing the request it looks for the first
+ * "method" near the start of the body; a batch goes by its first call. A
+ * request it gets wrong is still executed, only on the other queue.
+ */
+static HTTPWorkQueueId HTTPReq_JSONRPCQueue(HTTPRequest* req)
+{
+    std::string strBody = req->PeekBody(JSONRPC_QUEUE_PEEK_SIZE);
+    size_t pos = strBody.find("\"method\"");
+    if (pos == std::string::npos)
+        return HTTP_WORK_QUEUE_RPC;
+    pos = strBody.find_first_not_of(" \t\r\n", pos + 8);
+    if (pos == std::string::npos || strBody[pos] != ':')
+        return HTTP_WORK_QUEUE_RPC;
+    pos = strBody.find_first_not_of(" \t\r\n", pos + 1);
+    if (pos == std::string::npos || strBody[pos] != '"')
+        return HTTP_WORK_QUEUE_RPC;
+    size_t end = strBody.find('"', pos + 1);
+    if (end == std::string::npos)
+        return HTTP_WORK_QUEUE_RPC;
+    const CRPCCommand* pcmd = tableRPC[strBody.substr(pos + 1, end - pos - 1)];
+    return pcmd && pcmd->category == "wallet" ? HTTP_WORK_QUEUE_WALLET : HTTP_WORK_QUEUE_RPC;
+}
+
 static bool InitRPCAuthentication()
 {
     if (mapArgs["-rpcpassword"] == "")
@@ -225,7 +272,7 @@ bool StartHTTPRPC()
     if (!InitRPCAuthentication())
         return false;
 
-    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC);
+    RegisterHTTPHandler("/", true, HTTPReq_JSONRPC, HTTPReq_JSONRPCQueue);
 
     assert(EventBase());
     httpRPCTimerInterface = new HTTPRPCTimerInterface(EventBase());
@@ -12,6 +12,7 @@
 #include "rpc/protocol.h" // For HTTP status codes
 #include "sync.h"
 #include "ui_interface.h"
+#include "util/time.h"
 
 #include <deque>
 #include <stdio.h>
@@ -31,6 +32,8 @@
 #include <event2/util.h>
 #include <event2/keyvalq_struct.h>
 
+#include <rust/metrics.h>
+
 #ifdef EVENT__HAVE_NETINET_IN_H
 #include <netinet/in.h>
 #ifdef _XOPEN_SOURCE_EXTENDED
@@ -61,9 +64,29 @@ private:
     HTTPRequestHandler func;
 };
 
+/** Work item that runs a function, queued by HTTPQueueWork */
+class HTTPFunctionWorkItem : public HTTPClosure
+{
+public:
+    HTTPFunctionWorkItem(const std::function<void()>& func): func(func)
+    {
+    }
+    void operator()()
+    {
+        func();
+    }
+
+private:
+    std::function<void()> func;
+};
+
 /** Simple work queue for distributing work over multiple threads.
- * Work items are simply callable objects.
+ * Work items are simply callable objects. The time items wait in the queue
+ * and take to run are recorded as metrics, labelled with the queue's name.
  */
+/** How long the work item this thread is running waited in its queue. */
+static thread_local int64_t nWorkItemQueueMicros = 0;
+
 template <typename WorkItem>
 class WorkQueue
 {
@@ -71,13 +94,16 @@ private:
     /** Mutex protects entire object */
     Mutex cs;
     std::condition_variable cond;
-    std::deque<std::unique_ptr<WorkItem>> queue;
+    //! Items with the time they were queued at.
+    std::deque<std::pair<std::unique_ptr<WorkItem>, int64_t>> queue;
     bool running;
     size_t maxDepth;
+    const char* name;
 
 public:
-    WorkQueue(size_t maxDepth) : running(true),
-                                 maxDepth(maxDepth)
+    WorkQueue(size_t maxDepth, const char* name) : running(true),
+                                 maxDepth(maxDepth),
+                                 name(name)
     {
     }
     /** Precondition: worker threads have all stopped (they have been joined).
@@ -90,9 +116,11 @@ public:
     {
         LOCK(cs);
         if (queue.size() >= maxDepth) {
+            MetricsIncrementCounter("zcash.http.rejected", "queue", name);
             return false;
         }
-        queue.emplace_back(std::unique_ptr<WorkItem>(item));
+        queue.emplace_back(std::unique_ptr<WorkItem>(item), GetTimeMicros());
+        MetricsGauge("zcash.http.queued", queue.size(), "queue", name);
         cond.notify_one();
         return true;
     }
@@ -101,18 +129,26 @@ public:
     {
         while (true) {
             std::unique_ptr<WorkItem> i;
+            int64_t nStart;
             {
                 WAIT_LOCK(cs, lock);
                 while (running && queue.empty())
                     cond.wait(lock);
                 if (!running)
                     break;
-                i = std::move(queue.front());
+                i = std::move(queue.front().first);
+                nStart = GetTimeMicros();
+                nWorkItemQueueMicros = nStart - queue.front().second;
+                MetricsHistogram("zcash.http.wait.seconds", nWorkItemQueueMicros * 0.000001, "queue", name);
                 queue.pop_front();
+                MetricsGauge("zcash.http.queued", queue.size(), "queue", name);
             }
             (*i)();
+            nWorkItemQueueMicros = 0;
+            MetricsHistogram("zcash.http.run.seconds", (GetTimeMicros() - nStart) * 0.000001, "queue", name);
         }
     }
+    const char* GetName() const { return name; }
     /** Interrupt and exit loops */
     void Interrupt()
     {
@@ -125,13 +161,29 @@ public:
 struct HTTPPathHandler
 {
     HTTPPathHandler() {}
-    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler):
-        prefix(prefix), exactMatch(exactMatch), handler(handler)
+    HTTPPathHandler(std::string prefix, bool exactMatch, HTTPRequestHandler handler, HTTPWorkQueueSelector selectQueue):
+        prefix(prefix), exactMatch(exactMatch), handler(handler), selectQueue(selectQueue)
     {
     }
     std::string prefix;
     bool exactMatch;
     HTTPRequestHandler handler;
+    HTTPWorkQueueSelector selectQueue;
+};
+
+/** The name and options of each work queue, by HTTPWorkQueueId */
+struct HTTPWorkQueueConfig
+{
+    const char* name;
+    const char* threadName;
+    const char* threadsArg;
+    int defaultThreads;
+    const char* depthArg;
+};
+static const HTTPWorkQueueConfig workQueueConfig[HTTP_WORK_QUEUE_COUNT] = {
+    {"rpc", "zc-http-worker", "-rpcthreads", DEFAULT_HTTP_THREADS, "-rpcworkqueue"},
+    {"wallet", "zc-http-wallet", "-rpcwalletthreads", DEFAULT_HTTP_WALLET_THREADS, "-rpcwalletworkqueue"},
+    {"rest", "zc-http-rest", "-restthreads", DEFAULT_HTTP_REST_THREADS, "-restworkqueue"},
 };
 
 /** HTTP module state */
@@ -142,8 +194,9 @@ static struct event_base* eventBase = 0;
 struct evhttp* eventHTTP = 0;
 //! List of subnets to allow RPC connections from
 static std::vector<CSubNet> rpc_allow_subnets;
-//! Work queue for handling longer requests off the event loop thread
-static WorkQueue<HTTPClosure>* workQueue = 0;
+//! Work queues for handling longer requests off the event loop thread, by
+//! HTTPWorkQueueId; null for those that hand their requests to the RPC queue
+static WorkQueue<HTTPClosure>* workQueues[HTTP_WORK_QUEUE_COUNT] = {};
 //! Handlers for (sub)paths
 std::vector<HTTPPathHandler> pathHandlers;
 //! Bound listening sockets
@@ -258,13 +311,18 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
 
     // Dispatch to worker thread
     if (i != iend) {
+        HTTPWorkQueueId queueId = i->selectQueue ? i->selectQueue(hreq.get()) : HTTP_WORK_QUEUE_RPC;
+        if (!workQueues[queueId])
+            queueId = HTTP_WORK_QUEUE_RPC;
+        WorkQueue<HTTPClosure>* workQueue = workQueues[queueId];
         std::unique_ptr<HTTPWorkItem> item(new HTTPWorkItem(std::move(hreq), path, i->handler));
         assert(workQueue);
         if (workQueue->Enqueue(item.get()))
         {
             item.release(); /* if true, queue took ownership */
         } else {
-            LogPrintf("WARNING: request rejected because http work queue depth exceeded, it can be increased with the -rpcworkqueue= setting\n");
+            LogPrintf("WARNING: request rejected because http %s work queue depth exceeded, it can be increased with the %s= setting\n",
+                      workQueue->GetName(), workQueueConfig[queueId].depthArg);
             item->req->WriteReply(HTTP_INTERNAL, "Work queue depth exceeded");
         }
     } else {
@@ -272,6 +330,18 @@ static void http_request_cb(struct evhttp_request* req, void* arg)
     }
 }
 
+bool HTTPQueueWork(const std::function<void()>& func)
+{
+    WorkQueue<HTTPClosure>* workQueue = workQueues[HTTP_WORK_QUEUE_RPC];
+    if (!workQueue)
+        return false;
+    std::unique_ptr<HTTPFunctionWorkItem> item(new HTTPFunctionWorkItem(func));
+    if (!workQueue->Enqueue(item.get()))
+        return false;
+    item.release(); /* queue took ownership */
+    return true;
+}
+
 /** Callback to reject HTTP requests after shutdown. */
 static void http_reject_request_cb(struct evhttp_request* req, void*)
 {
@@ -330,9 +400,15 @@ static bool HTTPBindAddresses(struct evhttp* http)
 }
 
 /** Simple wrapper to set thread name and run work queue */
-static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue)
+int64_t GetWorkItemQueueMicros()
 {
-    RenameThread("zc-http-worker");
+    return nWorkItemQueueMicros;
+}
+
+static void HTTPWorkQueueRun(WorkQueue<HTTPClosure>* queue, const char* threadName)
+{
+    RenameThread(threadName);
+    ApplyThreadAffinity("http");
     queue->Run();
 }
 
@@ -407,10 +483,17 @@ bool InitHTTPServer()
     }
 
     LogPrint("http", "Initialized HTTP server\n");
-    int workQueueDepth = std::max((long)GetArg("-rpcworkqueue", DEFAULT_HTTP_WORKQUEUE), 1L);
-    LogPrintf("HTTP: creating work queue of depth %d\n", workQueueDepth);
-
-    workQueue = new WorkQueue<HTTPClosure>(workQueueDepth);
+    for (int id = 0; id < HTTP_WORK_QUEUE_COUNT; id++) {
+        const HTTPWorkQueueConfig& config = workQueueConfig[id];
+        // The RPC queue is where the others fall back to, so it always exists.
+        if (id != HTTP_WORK_QUEUE_RPC && GetArg(config.threadsArg, config.defaultThreads) <= 0) {
+            LogPrintf("HTTP: %s requests share the rpc work queue\n", config.name);
+            continue;
+        }
+        int workQueueDepth = std::max((long)GetArg(config.depthArg, DEFAULT_HTTP_WORKQUEUE), 1L);
+        LogPrintf("HTTP: creating %s work queue of depth %d\n", config.name, workQueueDepth);
+        workQueues[id] = new WorkQueue<HTTPClosure>(workQueueDepth, config.name);
+    }
     eventBase = base;
     eventHTTP = http;
     return true;
@@ -423,14 +506,19 @@ static std::vector<std::thread> g_thread_http_workers;
 bool StartHTTPServer()
 {
     LogPrint("http", "Starting HTTP server\n");
-    int rpcThreads = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L);
-    LogPrintf("HTTP: starting %d worker threads\n", rpcThreads);
     std::packaged_task<bool(event_base*, evhttp*)> task(ThreadHTTP);
     threadResult = task.get_future();
     threadHTTP = std::thread(std::move(task), eventBase, eventHTTP);
 
-    for (int i = 0; i < rpcThreads; i++) {
-        g_thread_http_workers.emplace_back(HTTPWorkQueueRun, workQueue);
+    for (int id = 0; id < HTTP_WORK_QUEUE_COUNT; id++) {
+        if (!workQueues[id])
+            continue;
+        const HTTPWorkQueueConfig& config = workQueueConfig[id];
+        int nThreads = std::max((long)GetArg(config.threadsArg, config.defaultThreads), 1L);
+        LogPrintf("HTTP: starting %d %s worker threads\n", nThreads, config.name);
+        for (int i = 0; i < nThreads; i++) {
+            g_thread_http_workers.emplace_back(HTTPWorkQueueRun, workQueues[id], config.threadName);
+        }
     }
     return true;
 }
@@ -446,20 +534,25 @@ void InterruptHTTPServer()
         // Reject requests on current connections
         evhttp_set_gencb(eventHTTP, http_reject_request_cb, NULL);
     }
-    if (workQueue)
-        workQueue->Interrupt();
+    for (WorkQueue<HTTPClosure>* workQueue : workQueues) {
+        if (workQueue)
+            workQueue->Interrupt();
+    }
 }
 
 void StopHTTPServer()
 {
     LogPrint("http", "Stopping HTTP server\n");
-    if (workQueue) {
+    if (workQueues[HTTP_WORK_QUEUE_RPC]) {
         LogPrint("http", "Waiting for HTTP worker threads to exit\n");
         for (auto& thread: g_thread_http_workers) {
             thread.join();
         }
         g_thread_http_workers.clear();
-        delete workQueue;
+        for (WorkQueue<HTTPClosure>*& workQueue : workQueues) {
+            delete workQueue;
+            workQueue = nullptr;
+        }
     }
     if (eventBase) {
         LogPrint("http", "Waiting for HTTP event thread to exit\n");
@@ -564,6 +657,17 @@ std::string HTTPRequest::ReadBody()
     return rv;
 }
 
+std::string HTTPRequest::PeekBody(size_t nMaxSize)
+{
+    struct evbuffer* buf = evhttp_request_get_input_buffer(req);
+    if (!buf)
+        return "";
+    std::string rv(std::min(nMaxSize, evbuffer_get_length(buf)), '\0');
+    ev_ssize_t nCopied = evbuffer_copyout(buf, &rv[0], rv.size());
+    rv.resize(nCopied > 0 ? nCopied : 0);
+    return rv;
+}
+
 void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
 {
     struct evkeyvalq* headers = evhttp_request_get_output_headers(req);
@@ -576,6 +680,14 @@ void HTTPRequest::WriteHeader(const std::string& hdr, const std::string& value)
  * Replies must be sent in the main loop in the main http thread,
  * this cannot be done from worker threads.
  */
+void HTTPRequest::WriteReplyBody(const char* data, size_t len)
+{
+    assert(!replySent && req);
+    struct evbuffer* evb = evhttp_request_get_output_buffer(req);
+    assert(evb);
+    evbuffer_add(evb, data, len);
+}
+
 void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
 {
     assert(!replySent && req);
@@ -643,10 +755,10 @@ HTTPRequest::RequestMethod HTTPRequest::GetRequestMethod()
     }
 }
 
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler)
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler, const HTTPWorkQueueSelector &selectQueue)
 {
     LogPrint("http", "Registering HTTP handler for %s (exactmatch %d)\n", prefix, exactMatch);
-    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler));
+    pathHandlers.push_back(HTTPPathHandler(prefix, exactMatch, handler, selectQueue));
 }
 
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch)
@@ -11,6 +11,8 @@
 #include <functional>
 
 static const int DEFAULT_HTTP_THREADS=4;
+static const int DEFAULT_HTTP_WALLET_THREADS=2;
+static const int DEFAULT_HTTP_REST_THREADS=2;
 static const int DEFAULT_HTTP_WORKQUEUE=16;
 static const int DEFAULT_HTTP_SERVER_TIMEOUT=30;
 
@@ -33,16 +35,43 @@ void InterruptHTTPServer();
 /** Stop HTTP server */
 void StopHTTPServer();
 
+/** The work queues requests are dispatched to. Each has its own worker
+ * threads and depth, so that a flood of one kind of request cannot crowd out
+ * the others. A queue configured with no threads hands its requests to the
+ * RPC queue.
+ */
+enum HTTPWorkQueueId {
+    HTTP_WORK_QUEUE_RPC,
+    HTTP_WORK_QUEUE_WALLET,
+    HTTP_WORK_QUEUE_REST,
+    HTTP_WORK_QUEUE_COUNT
+};
+
 /** Handler for requests to a certain HTTP path */
 typedef std::function<void(HTTPRequest* req, const std::string &)> HTTPRequestHandler;
+/** Picks the work queue for a request. This runs on the event loop thread,
+ * so it must be cheap.
+ */
+typedef std::function<HTTPWorkQueueId(HTTPRequest* req)> HTTPWorkQueueSelector;
 /** Register handler for prefix.
  * If multiple handlers match a prefix, the first-registered one will
- * be invoked.
+ * be invoked. Requests go to the RPC work queue unless selectQueue picks
+ * another.
  */
-void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler);
+void RegisterHTTPHandler(const std::string &prefix, bool exactMatch, const HTTPRequestHandler &handler, const HTTPWorkQueueSelector &selectQueue = nullptr);
 /** Unregister handler for prefix */
 void UnregisterHTTPHandler(const std::string &prefix, bool exactMatch);
 
+/** Run a function on one of the HTTP worker threads, as a request would be.
+ * Returns false if the work queue is full or the server is not running.
+ */
+bool HTTPQueueWork(const std::function<void()>& func);
+
+/** How long the work item this thread is running waited in its work queue,
+ * in microseconds, or 0 if the thread is not running one.
+ */
+int64_t GetWorkItemQueueMicros();
+
 /** Return evhttp event base. This can be used by submodules to
  * queue timers or custom events.
  */
@@ -98,6 +127,12 @@ public:
      */
     std::string ReadBody();
 
+    /**
+     * Return up to the first nMaxSize bytes of the request body, without
+     * consuming it.
+     */
+    std::string PeekBody(size_t nMaxSize);
+
     /**
      * Write output header.
      *
@@ -105,6 +140,12 @@ public:
      */
     virtual void WriteHeader(const std::string& hdr, const std::string& value);
 
+    /**
+     * Append to the body of the reply, ahead of what WriteReply is given.
+     * Large bodies can be written in pieces this way rather than as one string.
+     */
+    virtual void WriteReplyBody(const char* data, size_t len);
+
     /**
      * Write HTTP reply.
      * nStatus is the HTTP status code to send.
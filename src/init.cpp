@@ -11,15 +11,19 @@
 #include "init.h"
 #include "addrman.h"
 #include "amount.h"
+#include "asyncrpcqueue.h"
 #include "checkpoints.h"
 #include "compat/sanity.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
+#include "crypto/sha256.h"
 #include "deprecation.h"
+#include "compactblocks.h"
 #include "experimental_features.h"
 #include "fs.h"
 #include "httpserver.h"
 #include "httprpc.h"
+#include "insightindex.h"
 #include "key.h"
 #if defined(ENABLE_MINING) || defined(ENABLE_WALLET)
 #include "key_io.h"
@@ -30,13 +34,18 @@
 #include "miner.h"
 #include "net.h"
 #include "policy/policy.h"
+#include "proof_cache.h"
+#include "rpc/responsecache.h"
 #include "rpc/server.h"
 #include "rpc/register.h"
 #include "script/standard.h"
 #include "script/sigcache.h"
 #include "scheduler.h"
+#include "startupprofile.h"
+#include "support/hugepages.h"
 #include "txdb.h"
 #include "torcontrol.h"
+#include "txreconciliation.h"
 #include "ui_interface.h"
 #include "util/system.h"
 #include "util/moneystr.h"
@@ -46,6 +55,8 @@
 #include "wallet/walletdb.h"
 #endif
 #include "warnings.h"
+#include <atomic>
+#include <future>
 #include <stdint.h>
 #include <stdio.h>
 
@@ -54,6 +65,7 @@
 #endif
 
 #include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/algorithm/string/split.hpp>
@@ -82,10 +94,15 @@ static const bool DEFAULT_PROXYRANDOMIZE = true;
 static const bool DEFAULT_REST_ENABLE = false;
 static const bool DEFAULT_DISABLE_SAFEMODE = false;
 static const bool DEFAULT_STOPAFTERBLOCKIMPORT = false;
+static const int DEFAULT_PROVING_THREADS = 0;
 
 // The time that the wallet will wait for the block index to load
 // during startup before timing out.
 static const int64_t WALLET_INITIAL_SYNC_TIMEOUT = 1000 * 60 * 5;
+/** How often, in seconds, the memory usage metrics are updated. */
+static const int64_t MEMORY_USAGE_METRICS_INTERVAL = 60;
+/** Number of threads servicing the task scheduler. */
+static const int SCHEDULER_THREADS = 2;
 
 #if ENABLE_ZMQ
 static CZMQNotificationInterface* pzmqNotificationInterface = NULL;
@@ -109,6 +126,8 @@ enum BindFlags {
 };
 
 static const char* FEE_ESTIMATES_FILENAME="fee_estimates.dat";
+//! Set once the saved mempool has been loaded, so that it is only replaced by a complete one.
+static std::atomic<bool> fDumpMempoolLater(false);
 CClientUIInterface uiInterface; // Declared but not defined in ui_interface.h
 
 //////////////////////////////////////////////////////////////////////////////
@@ -152,9 +171,9 @@ class CCoinsViewErrorCatcher : public CCoinsViewBacked
 {
 public:
     CCoinsViewErrorCatcher(CCoinsView* view) : CCoinsViewBacked(view) {}
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
         try {
-            return CCoinsViewBacked::GetCoins(txid, coins);
+            return CCoinsViewBacked::GetCoin(outpoint, coin);
         } catch(const std::runtime_error& e) {
             uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
             LogPrintf("Error reading from database: %s\n", e.what());
@@ -165,6 +184,15 @@ public:
             abort();
         }
     }
+    std::vector<std::optional<Coin>> GetCoins(const std::vector<COutPoint> &outpoints) const {
+        try {
+            return CCoinsViewBacked::GetCoins(outpoints);
+        } catch(const std::runtime_error& e) {
+            uiInterface.ThreadSafeMessageBox(_("Error reading from database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+            LogPrintf("Error reading from database: %s\n", e.what());
+            abort();
+        }
+    }
     // Writes do not need similar protection, as failure to write is handled by the caller.
 };
 
@@ -179,6 +207,8 @@ void Interrupt(boost::thread_group& threadGroup)
     InterruptRPC();
     InterruptREST();
     InterruptTorControl();
+    if (pinsightindex)
+        pinsightindex->Interrupt();
     threadGroup.interrupt_all();
 }
 
@@ -214,6 +244,10 @@ void Shutdown()
     StopTorControl();
     UnregisterNodeSignals(GetNodeSignals());
 
+    if (fDumpMempoolLater && GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        DumpMempool();
+    }
+
     if (fFeeEstimatesInitialized)
     {
         fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
@@ -225,15 +259,36 @@ void Shutdown()
         fFeeEstimatesInitialized = false;
     }
 
+    // The index thread takes cs_main, so it is stopped first.
+    if (pinsightindex) {
+        UnregisterValidationInterface(pinsightindex);
+        delete pinsightindex;
+        pinsightindex = NULL;
+    }
+#ifdef ENABLE_WALLET
+    // So does the wallet's notification thread, once its queue is delivered.
+    if (pwalletMain) {
+        UnregisterValidationInterface(pwalletMain);
+    }
+#endif
+
+    // Block prechecks read from the chain state, which is deleted below.
+    ClearBlockPrechecks();
+
     {
         LOCK(cs_main);
         if (pcoinsTip != NULL) {
+            if (GetBoolArg("-persistcoinscache", DEFAULT_PERSIST_COINS_CACHE)) {
+                DumpCoinsCacheKeys();
+            }
             FlushStateToDisk();
         }
         delete pcoinsTip;
         pcoinsTip = NULL;
         delete pcoinscatcher;
         pcoinscatcher = NULL;
+        delete pcoinsFlushLayer;
+        pcoinsFlushLayer = NULL;
         delete pcoinsdbview;
         pcoinsdbview = NULL;
         delete pblocktree;
@@ -311,7 +366,13 @@ bool static Bind(const CService &addr, unsigned int flags) {
 
 void OnRPCStopped()
 {
-    g_best_block_cv.notify_all();
+    {
+        // Under the lock, so that no waiter can miss it between testing
+        // whether RPC is running and waiting.
+        LOCK(g_best_block_mutex);
+        g_best_block_cv.notify_all();
+    }
+    mempool.NotifySequenceWaiters();
     LogPrint("rpc", "RPC stopped.\n");
 }
 
@@ -336,11 +397,16 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-alerts", strprintf(_("Receive and display P2P network alerts (default: %u)"), DEFAULT_ALERTS));
     strUsage += HelpMessageOpt("-alertnotify=<cmd>", _("Execute command when a relevant alert is received or we see a really long fork (%s in cmd is replaced by message)"));
     strUsage += HelpMessageOpt("-allowdeprecated=<feature>", strprintf(_("Explicitly allow the use of the specified deprecated feature. Multiple instances of this parameter are permitted; values for <feature> must be selected from among {%s}"), GetAllowableDeprecatedFeatures()));
+    strUsage += HelpMessageOpt("-asynccoinsflush", strprintf(_("Write the UTXO cache to the chainstate database on a background thread, so that block validation can continue while it is written (default: %u)"), DEFAULT_ASYNC_COINS_FLUSH));
+    strUsage += HelpMessageOpt("-blockfilterindex", strprintf(_("Maintain an index of the compact block filters of BIP 158, used by the getblockfilter rpc call and -peerblockfilters; it is built in the background when first enabled (default: %u)"), DEFAULT_BLOCKFILTERINDEX));
     strUsage += HelpMessageOpt("-blocknotify=<cmd>", _("Execute command when the best block changes (%s in cmd is replaced by block hash)"));
+    strUsage += HelpMessageOpt("-blockprefetch=<n>", strprintf(_("During initial block download and reindexing, read and check up to <n> blocks from disk beyond the -proofbatchblocks blocks after the block being connected; values above 0 imply -pipelineblockconnect (0 to %d, default: %d)"),
+        MAX_BLOCK_PREFETCH, DEFAULT_BLOCK_PREFETCH));
     if (showDebug)
         strUsage += HelpMessageOpt("-blocksonly", strprintf(_("Whether to reject transactions from network peers. Automatic broadcast and rebroadcast of any transactions from inbound peers is disabled, unless '-whitelistforcerelay' is '1', in which case whitelisted peers' transactions will be relayed. RPC transactions are not affected. (default: %u)"), DEFAULT_BLOCKSONLY));
     strUsage += HelpMessageOpt("-checkblocks=<n>", strprintf(_("How many blocks to check at startup (default: %u, 0 = all)"), DEFAULT_CHECKBLOCKS));
     strUsage += HelpMessageOpt("-checklevel=<n>", strprintf(_("How thorough the block verification of -checkblocks is (0-4, default: %u)"), DEFAULT_CHECKLEVEL));
+    strUsage += HelpMessageOpt("-checkblocksinbackground", strprintf(_("Disconnect and reconnect the blocks of -checkblocks (levels 3 and 4 of -checklevel) once the node has started, rather than before (default: %u)"), DEFAULT_CHECK_BLOCKS_IN_BACKGROUND));
     strUsage += HelpMessageOpt("-conf=<file>", strprintf(_("Specify configuration file (default: %s)"), BITCOIN_CONF_FILENAME));
     if (mode == HMM_BITCOIND)
     {
@@ -348,19 +414,36 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-daemon", _("Run in the background as a daemon and accept commands"));
 #endif
     }
+    strUsage += HelpMessageOpt("-assumevalid=<hex>", strprintf(_("If this block is in the chain assume that it and its ancestors are valid and potentially skip their proof, script and signature verification (0 to verify all, default: %s, testnet: %s)"),
+        Params(CBaseChainParams::MAIN).GetConsensus().defaultAssumeValid.GetHex(), Params(CBaseChainParams::TESTNET).GetConsensus().defaultAssumeValid.GetHex()));
     strUsage += HelpMessageOpt("-datadir=<dir>", _("Specify data directory (this path cannot use '~')"));
     strUsage += HelpMessageOpt("-paramsdir=<dir>", _("Specify Zcash network parameters directory"));
     strUsage += HelpMessageOpt("-dbcache=<n>", strprintf(_("Set database cache size in megabytes (%d to %d, default: %d)"), nMinDbCache, nMaxDbCache, nDefaultDbCache));
+    strUsage += HelpMessageOpt("-dboptions=<db>:<setting>=<n>[,...]", strprintf(_("Choose the backend of the database <db> (%s) and tune it. Settings are backend (%s), compression (0 or 1; needs LevelDB built with Snappy), maxopenfiles, maxfilesize (in MiB), bloombits (0 disables the filter) and blockcache (percentage of the database's cache for reading; the rest buffers writes). Can be specified multiple times (default: %s)"),
+        boost::algorithm::join(DB_PROFILE_NAMES, ", "), boost::algorithm::join(DB_BACKEND_NAMES, ", "), CDBOptions().ToString()));
     strUsage += HelpMessageOpt("-debuglogfile=<file>", strprintf(_("Specify location of debug log file: this can be an absolute path or a path relative to the data directory (default: %s)"), DEFAULT_DEBUGLOGFILE));
     strUsage += HelpMessageOpt("-exportdir=<dir>", _("Specify directory to be used when exporting data"));
+    strUsage += HelpMessageOpt("-deferheadersolutions", strprintf(_("Do not check the Equihash solutions of headers up to the last checkpoint height until their blocks are received. Incompatible with flags that disable checkpoints. (default = %u)"), DEFAULT_DEFER_HEADER_SOLUTIONS));
     strUsage += HelpMessageOpt("-ibdskiptxverification", strprintf(_("Skip transaction verification during initial block download up to the last checkpoint height. Incompatible with flags that disable checkpoints. (default = %u)"), DEFAULT_IBD_SKIP_TX_VERIFICATION));
+    strUsage += HelpMessageOpt("-hugepages=<mode>", strprintf(_("Back the coins cache, the block index and the mempool maps with huge pages: transparent (madvise), explicit (the reserved pages, then transparent) or 0 to disable. Falls back to ordinary pages where they are unavailable (default: %s)"), DEFAULT_HUGEPAGES));
     strUsage += HelpMessageOpt("-loadblock=<file>", _("Imports blocks from external blk000??.dat file on startup"));
     strUsage += HelpMessageOpt("-maxorphantx=<n>", strprintf(_("Keep at most <n> unconnectable transactions in memory (default: %u)"), DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, <0 = leave that many cores free, default: %d)"),
+#ifndef WIN32
+    strUsage += HelpMessageOpt("-compressblockfiles", strprintf(_("Store new blocks and undo data compressed, where that makes them smaller. Blocks stored this way cannot be read by earlier versions (default: %u)"), DEFAULT_COMPRESS_BLOCK_FILES));
+    strUsage += HelpMessageOpt("-packblockfiles", strprintf(_("Replace the block files that are older than the last %u blocks by compressed files, and delete their undo data. The blocks can still be served and reindexed (default: %u)"), MIN_BLOCKS_TO_KEEP, DEFAULT_PACK_BLOCK_FILES));
+    strUsage += HelpMessageOpt("-mmapblockfiles", strprintf(_("Read blocks from finalized block files through memory mappings instead of buffered file reads (default: %u)"), DEFAULT_MMAP_BLOCK_FILES));
+#endif
+    strUsage += HelpMessageOpt("-par=<n>", strprintf(_("Set the number of script verification threads (%u to %d, 0 = auto, that is one per CPU given to scriptcheck threads by -threadaffinity or else one per core, <0 = leave that many cores free, default: %d)"),
         -GetNumCores(), MAX_SCRIPTCHECK_THREADS, DEFAULT_SCRIPTCHECK_THREADS));
+    strUsage += HelpMessageOpt("-persistcoinscache", strprintf(_("Save the keys of the coins cache entries on shutdown, and look them up again in the background on startup (default: %u)"), DEFAULT_PERSIST_COINS_CACHE));
+    strUsage += HelpMessageOpt("-persistmempool", strprintf(_("Save the mempool on shutdown and load it on restart (default: %u)"), DEFAULT_PERSIST_MEMPOOL));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-pid=<file>", strprintf(_("Specify pid file (default: %s)"), BITCOIN_PID_FILENAME));
 #endif
+    strUsage += HelpMessageOpt("-pipelineblockconnect", strprintf(_("During initial block download, read and check the next block (including its proofs where possible) while the current block is being connected (default: %u)"), DEFAULT_PIPELINE_BLOCK_CONNECT));
+    strUsage += HelpMessageOpt("-proofbatchblocks=<n>", strprintf(_("Batch-validate the Sapling and Orchard proofs and signatures of up to <n> consecutive blocks at a time during initial block download; values above 1 imply -pipelineblockconnect (1 to %d, default: %d)"),
+        MAX_PROOF_BATCH_BLOCKS, DEFAULT_PROOF_BATCH_BLOCKS));
+    strUsage += HelpMessageOpt("-provingthreads=<n>", strprintf(_("Set the number of threads used to create and validate Orchard proofs (0 = one per CPU given to proving threads by -threadaffinity, or else one per core, default: %d)"), DEFAULT_PROVING_THREADS));
     strUsage += HelpMessageOpt("-prune=<n>", strprintf(_("Reduce storage requirements by pruning (deleting) old blocks. This mode disables wallet support and is incompatible with -txindex. "
             "Warning: Reverting this setting requires re-downloading the entire blockchain. "
             "(default: 0 = disable pruning blocks, >%u = target size in MiB to use for block files)"), MIN_DISK_SPACE_FOR_BLOCK_FILES / 1024 / 1024));
@@ -371,33 +454,45 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-reindex-chainstate", _("Rebuild chain state from the currently indexed blocks"));
     strUsage += HelpMessageOpt("-reindex", _("Rebuild chain state and block index from the blk*.dat files on disk"));
 #endif
+    strUsage += HelpMessageOpt("-reindex-insight", _("Rebuild the transaction index, the address, spent and timestamp indexes of -insightexplorer and -lightwalletd, the block filter index and the supply index from the active chain"));
+    strUsage += HelpMessageOpt("-supplyindex", strprintf(_("Maintain an index of the value pools and the issued supply at each height, used by the getsupplyinfo rpc call; it is built in the background when first enabled (default: %u)"), DEFAULT_SUPPLYINDEX));
 #ifndef WIN32
     strUsage += HelpMessageOpt("-sysperms", _("Create new files with system default permissions, instead of umask 077 (only effective with disabled wallet functionality)"));
 #endif
+    strUsage += HelpMessageOpt("-threadaffinity=<class>:<cpus>", strprintf(_("Bind the threads of a class (%s) to a comma-separated list of CPUs and CPU ranges, e.g. scriptcheck:0-7,16-23, so that they and the memory they allocate stay on one NUMA node. Can be specified multiple times (Linux only)"),
+        boost::algorithm::join(THREAD_AFFINITY_CLASSES, ", ")));
     strUsage += HelpMessageOpt("-txexpirynotify=<cmd>", _("Execute command when transaction expires (%s in cmd is replaced by transaction id)"));
-    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call (default: %u)"), DEFAULT_TXINDEX));
+    strUsage += HelpMessageOpt("-txindex", strprintf(_("Maintain a full transaction index, used by the getrawtransaction rpc call; it is built in the background when first enabled (default: %u)"), DEFAULT_TXINDEX));
 
     strUsage += HelpMessageGroup(_("Connection options:"));
     strUsage += HelpMessageOpt("-addnode=<ip>", _("Add a node to connect to and attempt to keep the connection open"));
     strUsage += HelpMessageOpt("-banscore=<n>", strprintf(_("Threshold for disconnecting misbehaving peers (default: %u)"), DEFAULT_BANSCORE_THRESHOLD));
     strUsage += HelpMessageOpt("-bantime=<n>", strprintf(_("Number of seconds to keep misbehaving peers from reconnecting (default: %u)"), DEFAULT_MISBEHAVING_BANTIME));
     strUsage += HelpMessageOpt("-bind=<addr>", _("Bind to given address and always listen on it. Use [host]:port notation for IPv6"));
+    strUsage += HelpMessageOpt("-blockservethreads=<n>", strprintf(_("Send blocks more than %d blocks deep requested by peers from <n> threads of their own, so that they do not hold up the handling of other messages (0 to %d, 0 = disabled, default: %d)"),
+        MAX_CMPCTBLOCK_DEPTH, MAX_BLOCK_SERVE_THREADS, DEFAULT_BLOCK_SERVE_THREADS));
     strUsage += HelpMessageOpt("-connect=<ip>", _("Connect only to the specified node(s); -noconnect or -connect=0 alone to disable automatic connections"));
     strUsage += HelpMessageOpt("-discover", _("Discover own IP addresses (default: 1 when listening and no -externalip or -proxy)"));
     strUsage += HelpMessageOpt("-dns", _("Allow DNS lookups for -addnode, -seednode and -connect") + " " + strprintf(_("(default: %u)"), DEFAULT_NAME_LOOKUP));
     strUsage += HelpMessageOpt("-dnsseed", _("Query for peer addresses via DNS lookup, if low on addresses (default: 1 unless -connect/-noconnect)"));
     strUsage += HelpMessageOpt("-externalip=<ip>", _("Specify your own public address"));
+    strUsage += HelpMessageOpt("-fastblockrelay", strprintf(_("Send a new block that extends our tip to the peers that asked for compact block announcements once its header, proof of work and transactions have been checked, before its proofs, signatures and spends are (default: %u)"), DEFAULT_FAST_BLOCK_RELAY));
     strUsage += HelpMessageOpt("-forcednsseed", strprintf(_("Always query for peer addresses via DNS lookup (default: %u)"), DEFAULT_FORCEDNSSEED));
     strUsage += HelpMessageOpt("-listen", _("Accept connections from outside (default: 1 if no -proxy or -connect/-noconnect)"));
     strUsage += HelpMessageOpt("-listenonion", strprintf(_("Automatically create Tor hidden service (default: %d)"), DEFAULT_LISTEN_ONION));
     strUsage += HelpMessageOpt("-maxconnections=<n>", strprintf(_("Maintain at most <n> connections to peers (default: %u)"), DEFAULT_MAX_PEER_CONNECTIONS));
+    strUsage += HelpMessageOpt("-maxpeerprocessing=<n>", strprintf(_("Process the messages of a peer after those of the others once they have taken more than <n> milliseconds of CPU time per second on average, with bursts of up to %d seconds' worth (0 = no limit, default: %d)"), PEER_PROCESSING_BURST_SECONDS, DEFAULT_MAX_PEER_PROCESSING));
     strUsage += HelpMessageOpt("-maxreceivebuffer=<n>", strprintf(_("Maximum per-connection receive buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXRECEIVEBUFFER));
     strUsage += HelpMessageOpt("-maxsendbuffer=<n>", strprintf(_("Maximum per-connection send buffer, <n>*1000 bytes (default: %u)"), DEFAULT_MAXSENDBUFFER));
     strUsage += HelpMessageOpt("-mempoolevictionmemoryminutes=<n>", strprintf(_("The number of minutes before allowing rejected transactions to re-enter the mempool. (default: %u)"), DEFAULT_MEMPOOL_EVICTION_MEMORY_MINUTES));
+    strUsage += HelpMessageOpt("-mempoolproofbatch=<n>", strprintf(_("Collect shielded transactions relayed by peers for up to %dms and validate the proofs of up to <n> of them as a batch, outside the main lock (0 to %d, 0 = disabled, default: %d)"),
+        MEMPOOL_PROOF_BATCH_WINDOW_MS, MAX_MEMPOOL_PROOF_BATCH, DEFAULT_MEMPOOL_PROOF_BATCH));
     strUsage += HelpMessageOpt("-mempooltxcostlimit=<n>",strprintf(_("An upper bound on the maximum size in bytes of all transactions in the mempool. (default: %s)"), DEFAULT_MEMPOOL_TOTAL_COST_LIMIT));
+    strUsage += HelpMessageOpt("-msghandlerthreads=<n>", strprintf(_("Number of threads processing peer messages (1 to %d, default: %d)"), MAX_MESSAGE_HANDLER_THREADS, DEFAULT_MESSAGE_HANDLER_THREADS));
     strUsage += HelpMessageOpt("-onion=<ip:port>", strprintf(_("Use separate SOCKS5 proxy to reach peers via Tor hidden services (default: %s)"), "-proxy"));
     strUsage += HelpMessageOpt("-onlynet=<net>", _("Only connect to nodes in network <net> (ipv4, ipv6 or onion)"));
     strUsage += HelpMessageOpt("-permitbaremultisig", strprintf(_("Relay non-P2SH multisig (default: %u)"), DEFAULT_PERMIT_BAREMULTISIG));
+    strUsage += HelpMessageOpt("-peerblockfilters", strprintf(_("Serve compact block filters to peers per BIP 157; requires -blockfilterindex (default: %u)"), DEFAULT_PEERBLOCKFILTERS));
     strUsage += HelpMessageOpt("-peerbloomfilters", strprintf(_("Support filtering of blocks and transaction with bloom filters (default: %u)"), DEFAULT_PEERBLOOMFILTERS));
     if (showDebug)
         strUsage += HelpMessageOpt("-enforcenodebloom", strprintf("Enforce minimum protocol version to limit use of bloom filters (default: %u)", DEFAULT_ENFORCENODEBLOOM));
@@ -406,9 +501,14 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-proxy=<ip:port>", _("Connect through SOCKS5 proxy"));
     strUsage += HelpMessageOpt("-proxyrandomize", strprintf(_("Randomize credentials for every proxy connection. This enables Tor stream isolation (default: %u)"), DEFAULT_PROXYRANDOMIZE));
     strUsage += HelpMessageOpt("-seednode=<ip>", _("Connect to a node to retrieve peer addresses, and disconnect"));
+    strUsage += HelpMessageOpt("-socketevents=<mode>", strprintf(_("How to wait for peer sockets: %s (default: %s)"),
+        GetSupportedSocketEventsModes(), GetSocketEventsModeName(GetDefaultSocketEventsMode())));
     strUsage += HelpMessageOpt("-timeout=<n>", strprintf(_("Specify connection timeout in milliseconds (minimum: 1, default: %d)"), DEFAULT_CONNECT_TIMEOUT));
     strUsage += HelpMessageOpt("-torcontrol=<ip>:<port>", strprintf(_("Tor control port to use if onion listening enabled (default: %s)"), DEFAULT_TOR_CONTROL));
     strUsage += HelpMessageOpt("-torpassword=<pass>", _("Tor control port password (default: empty)"));
+    strUsage += HelpMessageOpt("-txreconciliation", strprintf(_("Offer peers to announce transactions by set reconciliation, sending only the transactions the other side is missing (default: %u)"), DEFAULT_TXRECONCILIATION_ENABLE));
+    strUsage += HelpMessageOpt("-txrelaydelayinbound=<n>", strprintf(_("Average delay in seconds between announcements of new transactions to inbound peers, which all get them at the same times (0 to %u, default: %u)"), MAX_INVENTORY_INTERVAL, DEFAULT_INBOUND_INVENTORY_INTERVAL));
+    strUsage += HelpMessageOpt("-txrelaydelayoutbound=<n>", strprintf(_("Average delay in seconds between announcements of new transactions to each outbound peer (0 to %u, default: %u)"), MAX_INVENTORY_INTERVAL, DEFAULT_OUTBOUND_INVENTORY_INTERVAL));
     strUsage += HelpMessageOpt("-whitebind=<addr>", _("Bind to given address and whitelist peers connecting to it. Use [host]:port notation for IPv6"));
     strUsage += HelpMessageOpt("-whitelist=<netmask>", _("Whitelist peers connecting from the given netmask or IP address. Can be specified multiple times.") +
         " " + _("Whitelisted peers cannot be DoS banned and their transactions are always relayed, even if they are already in the mempool, useful e.g. for a gateway"));
@@ -426,6 +526,10 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-zmqpubhashtx=<address>", _("Enable publish hash transaction in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawblock=<address>", _("Enable publish raw block in <address>"));
     strUsage += HelpMessageOpt("-zmqpubrawtx=<address>", _("Enable publish raw transaction in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubcompactblock=<address>", _("Enable publish the compact form of each connected block in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubnullifiers=<address>", _("Enable publish the shielded nullifiers of each connected and disconnected block in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubsequence=<address>", _("Enable publish block connections and disconnections, and mempool additions and removals, in <address>"));
+    strUsage += HelpMessageOpt("-zmqpubcompactmempooltx=<address>", _("Enable publish the compact form of each transaction added to the mempool, and the txid of each removed, in <address>"));
 #endif
 
     strUsage += HelpMessageGroup(_("Monitoring options:"));
@@ -446,6 +550,7 @@ std::string HelpMessage(HelpMessageMode mode)
         strUsage += HelpMessageOpt("-dropmessagestest=<n>", "Randomly drop 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-fuzzmessagestest=<n>", "Randomly fuzz 1 of every <n> network messages");
         strUsage += HelpMessageOpt("-stopafterblockimport", strprintf("Stop running after importing blocks from disk (default: %u)", DEFAULT_STOPAFTERBLOCKIMPORT));
+        strUsage += HelpMessageOpt("-importreport=<file>", "Write the throughput, flush stalls and peak memory of importing blocks from disk to <file> as JSON, once the imported blocks are connected");
         strUsage += HelpMessageOpt("-nuparams=hexBranchId:activationHeight", "Use given activation height for specified network upgrade (regtest-only)");
         strUsage += HelpMessageOpt("-nurejectoldversions", strprintf("Reject peers that don't know about the current epoch (regtest-only) (default: %u)", DEFAULT_NU_REJECT_OLD_VERSIONS));
         strUsage += HelpMessageOpt(
@@ -460,11 +565,13 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageOpt("-experimentalfeatures", _("Enable use of experimental features"));
     strUsage += HelpMessageOpt("-help-debug", _("Show all debugging options (usage: --help -help-debug)"));
     strUsage += HelpMessageOpt("-logips", strprintf(_("Include IP addresses in debug output (default: %u)"), DEFAULT_LOGIPS));
+    strUsage += HelpMessageOpt("-lograte=<n>", strprintf(_("Drop debug output beyond <n> lines per second in each category, except for warnings and errors (0 = no limit, default: %d)"), DEFAULT_LOGRATE));
     strUsage += HelpMessageOpt("-logtimestamps", strprintf(_("Prepend debug output with timestamp (default: %u)"), DEFAULT_LOGTIMESTAMPS));
     if (showDebug)
     {
         strUsage += HelpMessageOpt("-limitfreerelay=<n>", strprintf("Continuously rate-limit free transactions to <n>*1000 bytes per minute (default: %u)", DEFAULT_LIMITFREERELAY));
         strUsage += HelpMessageOpt("-relaypriority", strprintf("Require high priority for relaying free or low-fee transactions (default: %u)", DEFAULT_RELAYPRIORITY));
+        strUsage += HelpMessageOpt("-maxproofcachesize=<n>", strprintf("Limit size of shielded proof cache to <n> MiB (default: %u)", DEFAULT_MAX_PROOF_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxsigcachesize=<n>", strprintf("Limit size of signature cache to <n> MiB (default: %u)", DEFAULT_MAX_SIG_CACHE_SIZE));
         strUsage += HelpMessageOpt("-maxtipage=<n>", strprintf("Maximum tip age in seconds to consider node in initial block download (default: %u)", DEFAULT_MAX_TIP_AGE));
     }
@@ -511,15 +618,23 @@ std::string HelpMessage(HelpMessageMode mode)
     strUsage += HelpMessageGroup(_("RPC server options:"));
     strUsage += HelpMessageOpt("-server", _("Accept command line and JSON-RPC commands"));
     strUsage += HelpMessageOpt("-rest", strprintf(_("Accept public REST requests (default: %u)"), DEFAULT_REST_ENABLE));
+    strUsage += HelpMessageOpt("-lightwalletdcompactcache=<n>", strprintf(_("With -lightwalletd, keep up to <n> MiB of the compact blocks served by REST in memory (default: %u)"), DEFAULT_COMPACT_BLOCK_CACHE_SIZE));
     strUsage += HelpMessageOpt("-rpcbind=<addr>", _("Bind to given address to listen for JSON-RPC connections. Use [host]:port notation for IPv6. This option can be specified multiple times (default: bind to all interfaces)"));
     strUsage += HelpMessageOpt("-rpcuser=<user>", _("Username for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcpassword=<pw>", _("Password for JSON-RPC connections"));
     strUsage += HelpMessageOpt("-rpcauth=<userpw>", _("Username and hashed password for JSON-RPC connections. The field <userpw> comes in the format: <USERNAME>:<SALT>$<HASH>. A canonical python script is included in share/rpcuser. This option can be specified multiple times"));
     strUsage += HelpMessageOpt("-rpcport=<port>", strprintf(_("Listen for JSON-RPC connections on <port> (default: %u or testnet: %u)"), 8232, 18232));
     strUsage += HelpMessageOpt("-rpcallowip=<ip>", _("Allow JSON-RPC connections from specified source. Valid for <ip> are a single IP (e.g. 1.2.3.4), a network/netmask (e.g. 1.2.3.4/255.255.255.0) or a network/CIDR (e.g. 1.2.3.4/24). This option can be specified multiple times"));
+    strUsage += HelpMessageOpt("-rpcasyncretention=<n>", strprintf(_("Keep the results of up to <n> finished async operations until they are fetched with z_getoperationresult, forgetting the oldest first (default: %u)"), DEFAULT_ASYNC_RPC_RETENTION));
+    strUsage += HelpMessageOpt("-rpcbatchthreads=<n>", strprintf(_("Execute up to <n> read-only calls of a JSON-RPC batch in parallel, on the threads servicing RPC calls (default: %d)"), DEFAULT_RPC_BATCH_THREADS));
+    strUsage += HelpMessageOpt("-rpcresponsecache=<n>", strprintf(_("Keep up to <n> MiB of the getblock, getblockheader and getrawtransaction results and REST blocks and transactions about blocks too deep to be reorged in memory, or 0 to not keep any (default: %u)"), DEFAULT_RPC_RESPONSE_CACHE_SIZE));
     strUsage += HelpMessageOpt("-rpcthreads=<n>", strprintf(_("Set the number of threads to service RPC calls (default: %d)"), DEFAULT_HTTP_THREADS));
+    strUsage += HelpMessageOpt("-rpcwalletthreads=<n>", strprintf(_("Set the number of threads to service wallet RPC calls, or 0 to service them with the other RPC calls (default: %d)"), DEFAULT_HTTP_WALLET_THREADS));
+    strUsage += HelpMessageOpt("-restthreads=<n>", strprintf(_("Set the number of threads to service REST requests, or 0 to service them with the RPC calls (default: %d)"), DEFAULT_HTTP_REST_THREADS));
     if (showDebug) {
         strUsage += HelpMessageOpt("-rpcworkqueue=<n>", strprintf("Set the depth of the work queue to service RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-rpcwalletworkqueue=<n>", strprintf("Set the depth of the work queue to service wallet RPC calls (default: %d)", DEFAULT_HTTP_WORKQUEUE));
+        strUsage += HelpMessageOpt("-restworkqueue=<n>", strprintf("Set the depth of the work queue to service REST requests (default: %d)", DEFAULT_HTTP_WORKQUEUE));
         strUsage += HelpMessageOpt("-rpcservertimeout=<n>", strprintf("Timeout during HTTP requests (default: %d)", DEFAULT_HTTP_SERVER_TIMEOUT));
     }
 
@@ -541,6 +656,38 @@ std::string HelpMessage(HelpMessageMode mode)
     return strUsage;
 }
 
+std::vector<std::pair<std::string, size_t>> GetMemoryUsage()
+{
+    std::vector<std::pair<std::string, size_t>> vUsage;
+    {
+        LOCK(cs_main);
+        if (pcoinsTip != nullptr) {
+            vUsage.emplace_back("coins_cache", pcoinsTip->DynamicMemoryUsage());
+        }
+        vUsage.emplace_back("block_index", BlockIndexDynamicMemoryUsage());
+        vUsage.emplace_back("recent_rejects", RecentRejectsDynamicMemoryUsage());
+    }
+    vUsage.emplace_back("mempool", mempool.DynamicMemoryUsage());
+    vUsage.emplace_back("signature_cache", SignatureCacheDynamicMemoryUsage());
+    vUsage.emplace_back("proof_cache", ProofCacheDynamicMemoryUsage());
+    vUsage.emplace_back("addrman", addrman.DynamicMemoryUsage());
+    for (const auto& [strName, nUsage] : GetDBMemoryUsage()) {
+        vUsage.emplace_back("leveldb_" + strName, nUsage);
+    }
+#ifdef ENABLE_WALLET
+    if (pwalletMain != nullptr) {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        vUsage.emplace_back("wallet", pwalletMain->DynamicMemoryUsage());
+        vUsage.emplace_back("orchard_wallet", pwalletMain->OrchardDynamicMemoryUsage());
+    }
+#endif
+
+    for (const auto& [strComponent, nUsage] : vUsage) {
+        MetricsGauge("zcash.memory.usage.bytes", nUsage, "component", strComponent.c_str());
+    }
+    return vUsage;
+}
+
 static void BlockNotifyCallback(bool initialSync, const CBlockIndex *pBlockIndex)
 {
     if (initialSync || !pBlockIndex)
@@ -598,11 +745,11 @@ struct CImportingNow
 void CleanupBlockRevFiles()
 {
     using namespace fs;
-    std::map<std::string, path> mapBlockFiles;
+    std::map<std::string, std::vector<path>> mapBlockFiles;
 
-    // Glob all blk?????.dat and rev?????.dat files from the blocks directory.
-    // Remove the rev files immediately and insert the blk file paths into an
-    // ordered map keyed by block file index.
+    // Glob all blk?????.dat, pak?????.dat and rev?????.dat files from the
+    // blocks directory. Remove the rev files immediately and insert the blk
+    // and pak file paths into an ordered map keyed by block file index.
     LogPrintf("Removing unusable blk?????.dat and rev?????.dat files for -reindex with -prune\n");
     path blocksdir = GetDataDir() / "blocks";
     for (directory_iterator it(blocksdir); it != directory_iterator(); it++) {
@@ -610,9 +757,10 @@ void CleanupBlockRevFiles()
             it->path().filename().string().length() == 12 &&
             it->path().filename().string().substr(8,4) == ".dat")
         {
-            if (it->path().filename().string().substr(0,3) == "blk")
-                mapBlockFiles[it->path().filename().string().substr(3,5)] = it->path();
-            else if (it->path().filename().string().substr(0,3) == "rev")
+            std::string strPrefix = it->path().filename().string().substr(0,3);
+            if (strPrefix == "blk" || strPrefix == "pak")
+                mapBlockFiles[it->path().filename().string().substr(3,5)].push_back(it->path());
+            else if (strPrefix == "rev")
                 remove(it->path());
         }
     }
@@ -622,12 +770,32 @@ void CleanupBlockRevFiles()
     // keeping a separate counter.  Once we hit a gap (or if 0 doesn't exist)
     // start removing block files.
     int nContigCounter = 0;
-    for (const std::pair<std::string, path>& item : mapBlockFiles) {
+    for (const std::pair<const std::string, std::vector<path>>& item : mapBlockFiles) {
         if (atoi(item.first) == nContigCounter) {
             nContigCounter++;
             continue;
         }
-        remove(item.second);
+        for (const path& file : item.second)
+            remove(file);
+    }
+}
+
+/**
+ * Make the checks of levels 3 and 4 of -checklevel that were left for after
+ * startup by -checkblocksinbackground. They hold the main lock throughout, so
+ * blocks are only connected once they are done, but RPC methods that do not
+ * need the chain state are served meanwhile.
+ */
+void ThreadVerifyCoins()
+{
+    const CChainParams& chainparams = Params();
+    CStartupPhaseTimer timer("verifydbbackground");
+    if (!CVerifyDB().VerifyDB(chainparams, pcoinsTip, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
+                              GetArg("-checkblocks", DEFAULT_CHECKBLOCKS), true)) {
+        uiInterface.ThreadSafeMessageBox(
+            _("Corrupted block database detected") + ". " + _("Please restart with -reindex or -reindex-chainstate to recover."),
+            "", CClientUIInterface::MSG_ERROR);
+        StartShutdown();
     }
 }
 
@@ -741,38 +909,97 @@ void ThreadStartWalletNotifier()
     ThreadNotifyWallets(pindexLastTip);
 }
 
+/** Where an import of blocks from disk started, for -importreport. */
+struct CImportStart {
+    int nHeight;
+    int64_t nMicros;
+    CConnectTotals totals;
+    CResourceUsage usage;
+
+    CImportStart() : nMicros(GetTimeMicros()), usage(CResourceUsage::Now()) {
+        LOCK(cs_main);
+        nHeight = chainActive.Height();
+        totals = GetConnectTotals();
+    }
+};
+
+/** Write what the import since start did to path, as JSON. */
+static void WriteImportReport(const fs::path& path, const CImportStart& start)
+{
+    int64_t nMicros = std::max<int64_t>(1, GetTimeMicros() - start.nMicros);
+    CResourceUsage usage = CResourceUsage::Now();
+    int nHeight;
+    CConnectTotals totals;
+    {
+        LOCK(cs_main);
+        nHeight = chainActive.Height();
+        totals = GetConnectTotals();
+    }
+    double dSeconds = nMicros * 0.000001;
+    uint64_t nBlocks = totals.nBlocks - start.totals.nBlocks;
+    uint64_t nTransactions = totals.nTransactions - start.totals.nTransactions;
+    uint64_t nProofs = totals.nProofs - start.totals.nProofs;
+
+    UniValue report(UniValue::VOBJ);
+    report.pushKV("startheight", start.nHeight);
+    report.pushKV("endheight", nHeight);
+    report.pushKV("seconds", dSeconds);
+    report.pushKV("blocks", nBlocks);
+    report.pushKV("transactions", nTransactions);
+    report.pushKV("proofs", nProofs);
+    report.pushKV("blockspersecond", nBlocks / dSeconds);
+    report.pushKV("transactionspersecond", nTransactions / dSeconds);
+    report.pushKV("proofspersecond", nProofs / dSeconds);
+    report.pushKV("flushes", totals.nFlushes - start.totals.nFlushes);
+    report.pushKV("flushseconds", (totals.nFlushMicros - start.totals.nFlushMicros) * 0.000001);
+    // Since startup, as the longest stall cannot be told apart by import.
+    report.pushKV("maxflushseconds", totals.nMaxFlushMicros * 0.000001);
+    report.pushKV("usercpuseconds", (usage.nUserMicros - start.usage.nUserMicros) * 0.000001);
+    report.pushKV("systemcpuseconds", (usage.nSystemMicros - start.usage.nSystemMicros) * 0.000001);
+    report.pushKV("peakrsskb", usage.nMaxResidentKilobytes);
+
+    std::string strReport = report.write(2) + "\n";
+    FILE* file = fsbridge::fopen(path, "w");
+    if (!file || fwrite(strReport.data(), 1, strReport.size(), file) != strReport.size()) {
+        LogPrintf("Warning: Could not write import report to %s\n", path.string());
+    } else {
+        LogPrintf("Wrote import report to %s\n", path.string());
+    }
+    if (file)
+        fclose(file);
+}
+
 void ThreadImport(std::vector<fs::path> vImportFiles, const CChainParams& chainparams)
 {
     RenameThread("zcash-loadblk");
     CImportingNow imp;
+    CImportStart importStart;
+
+    // Warm up the coins cache with the entries it held at the last shutdown,
+    // before any stored blocks are connected. A reindexed chain state is new.
+    if (!fReindex && GetBoolArg("-persistcoinscache", DEFAULT_PERSIST_COINS_CACHE)) {
+        LoadCoinsCacheKeys();
+    }
 
     // -reindex
     if (fReindex) {
-        nSizeReindexed = 0;  // will be modified inside LoadExternalBlockFile
+        nSizeReindexed = 0;  // will be modified inside ReindexBlockFiles
         // Find the summary size of all block files first
         int nFile = 0;
         size_t fullSize = 0;
         while (true) {
             CDiskBlockPos pos(nFile, 0);
-            fs::path blkFile = GetBlockPosFilename(pos, "blk");
+            // A packed file is read in place of its block file.
+            fs::path blkFile = GetBlockPosFilename(pos, "pak");
+            if (!fs::exists(blkFile))
+                blkFile = GetBlockPosFilename(pos, "blk");
             if (!fs::exists(blkFile))
                 break; // No block files left to reindex
             nFile++;
             fullSize += fs::file_size(blkFile);
         }
         nFullSizeToReindex = std::max<size_t>(1, fullSize);
-        nFile = 0;
-        while (true) {
-            CDiskBlockPos pos(nFile, 0);
-            if (!fs::exists(GetBlockPosFilename(pos, "blk")))
-                break; // No block files left to reindex
-            FILE *file = OpenBlockFile(pos, true);
-            if (!file)
-                break; // This error is logged in OpenBlockFile
-            LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
-            LoadExternalBlockFile(chainparams, file, &pos);
-            nFile++;
-        }
+        ReindexBlockFiles(chainparams, nFile);
         pblocktree->WriteReindexing(false);
         fReindex = false;
         nSizeReindexed = 0;
@@ -814,10 +1041,20 @@ void ThreadImport(std::vector<fs::path> vImportFiles, const CChainParams& chainp
         StartShutdown();
     }
 
+    if (mapArgs.count("-importreport")) {
+        WriteImportReport(GetArg("-importreport", ""), importStart);
+    }
+
     if (GetBoolArg("-stopafterblockimport", DEFAULT_STOPAFTERBLOCKIMPORT)) {
         LogPrintf("Stopping after block import\n");
         StartShutdown();
     }
+
+    if (GetBoolArg("-persistmempool", DEFAULT_PERSIST_MEMPOOL)) {
+        LoadMempool(chainparams);
+        // Keep the saved mempool if loading it was cut short.
+        fDumpMempoolLater = !ShutdownRequested();
+    }
 }
 
 /** Sanity checks
@@ -838,7 +1075,8 @@ bool InitSanityCheck(void)
 
 
 static void ZC_LoadParams(
-    const CChainParams& chainparams
+    const CChainParams& chainparams,
+    bool fPreloadProvingKeys
 )
 {
     struct timeval tv_start, tv_end;
@@ -882,7 +1120,7 @@ static void ZC_LoadParams(
         sapling_output_str.length(),
         reinterpret_cast<const codeunit*>(sprout_groth16_str.c_str()),
         sprout_groth16_str.length(),
-        true
+        fPreloadProvingKeys
     );
 
     gettimeofday(&tv_end, 0);
@@ -1003,7 +1241,8 @@ void InitLogging()
     pTracingHandle = tracing_init(
         pathDebugCStr, pathDebugLen,
         initialFilter.c_str(),
-        fLogTimestamps);
+        fLogTimestamps,
+        std::max<int64_t>(GetArg("-lograte", DEFAULT_LOGRATE), 0));
 
     LogPrintf("\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
     LogPrintf("Zcash version %s (%s)\n", FormatFullVersion(), CLIENT_DATE);
@@ -1028,6 +1267,10 @@ void InitLogging()
  */
 bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 {
+    // Each phase of startup is logged with the time and resources it took,
+    // which getstartupinfo reports.
+    CStartupPhaseTimer timerSetup("setup");
+
     // ********************************************************* Step 1: setup
 #ifdef _MSC_VER
     // Turn off Microsoft heap dump noise
@@ -1079,9 +1322,6 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     std::set_new_handler(new_handler_terminate);
 
-    // Set up global Rayon threadpool.
-    zcashd_init_rayon_threadpool();
-
     // ********************************************************* Step 2: parameter interactions
     const CChainParams& chainparams = Params();
 
@@ -1097,6 +1337,10 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetArg("-prune", 0)) {
         if (GetBoolArg("-txindex", DEFAULT_TXINDEX))
             return InitError(_("Prune mode is incompatible with -txindex."));
+        if (GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX))
+            return InitError(_("Prune mode is incompatible with -blockfilterindex."));
+        if (GetBoolArg("-supplyindex", DEFAULT_SUPPLYINDEX))
+            return InitError(_("Prune mode is incompatible with -supplyindex."));
 #ifdef ENABLE_WALLET
         if (GetBoolArg("-rescan", false)) {
             return InitError(_("Rescans are not possible in pruned mode. You will need to use -reindex which will download the whole blockchain again."));
@@ -1104,13 +1348,27 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 #endif
     }
 
+    nMessageHandlerThreads = std::max(1, std::min((int)GetArg("-msghandlerthreads", DEFAULT_MESSAGE_HANDLER_THREADS), MAX_MESSAGE_HANDLER_THREADS));
+    nMaxPeerProcessing = std::max((int64_t)0, GetArg("-maxpeerprocessing", DEFAULT_MAX_PEER_PROCESSING));
+    nInboundInventoryInterval = std::max(0, std::min((int)GetArg("-txrelaydelayinbound", DEFAULT_INBOUND_INVENTORY_INTERVAL), (int)MAX_INVENTORY_INTERVAL));
+    nOutboundInventoryInterval = std::max(0, std::min((int)GetArg("-txrelaydelayoutbound", DEFAULT_OUTBOUND_INVENTORY_INTERVAL), (int)MAX_INVENTORY_INTERVAL));
+    fTxReconciliation = GetBoolArg("-txreconciliation", DEFAULT_TXRECONCILIATION_ENABLE);
+    fFastBlockRelay = GetBoolArg("-fastblockrelay", DEFAULT_FAST_BLOCK_RELAY);
+
+    if (mapArgs.count("-socketevents")) {
+        std::string strMode = GetArg("-socketevents", "");
+        if (!ParseSocketEventsMode(strMode, socketEventsMode))
+            return InitError(strprintf(_("Unsupported -socketevents mode '%s' (supported: %s)"), strMode, GetSupportedSocketEventsModes()));
+    }
+
     // Make sure enough file descriptors are available
     int nBind = std::max((int)mapArgs.count("-bind") + (int)mapArgs.count("-whitebind"), 1);
     int nUserMaxConnections = GetArg("-maxconnections", DEFAULT_MAX_PEER_CONNECTIONS);
     nMaxConnections = std::max(nUserMaxConnections, 0);
 
     // Trim requested connection counts, to fit into system limitations
-    nMaxConnections = std::max(std::min(nMaxConnections, FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS), 0);
+    if (socketEventsMode == SocketEventsMode::SELECT)
+        nMaxConnections = std::max(std::min(nMaxConnections, FD_SETSIZE - nBind - MIN_CORE_FILEDESCRIPTORS), 0);
     int nFD = RaiseFileDescriptorLimit(nMaxConnections + MIN_CORE_FILEDESCRIPTORS);
     if (nFD < MIN_CORE_FILEDESCRIPTORS)
         return InitError(_("Not enough file descriptors available."));
@@ -1126,6 +1384,11 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             return InitError(_("-ibdskiptxverification requires checkpoints to be enabled; it is incompatible with flags that disable checkpoints"));
         }
     }
+    if (GetBoolArg("-deferheadersolutions", DEFAULT_DEFER_HEADER_SOLUTIONS)) {
+        if (!GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED)) {
+            return InitError(_("-deferheadersolutions requires checkpoints to be enabled; it is incompatible with flags that disable checkpoints"));
+        }
+    }
 
     // ********************************************************* Step 3: parameter-to-internal-flags
 
@@ -1167,19 +1430,92 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t mempoolEvictionMemorySeconds = GetArg("-mempoolevictionmemoryminutes", DEFAULT_MEMPOOL_EVICTION_MEMORY_MINUTES) * 60;
     mempool.SetMempoolCostLimit(mempoolTotalCostLimit, mempoolEvictionMemorySeconds);
 
+    nMempoolProofBatch = GetArg("-mempoolproofbatch", DEFAULT_MEMPOOL_PROOF_BATCH);
+    if (nMempoolProofBatch < 0 || nMempoolProofBatch > MAX_MEMPOOL_PROOF_BATCH) {
+        return InitError(strprintf(_("-mempoolproofbatch must be between 0 and %d"), MAX_MEMPOOL_PROOF_BATCH));
+    }
+
+    nBlockServeThreads = GetArg("-blockservethreads", DEFAULT_BLOCK_SERVE_THREADS);
+    if (nBlockServeThreads < 0 || nBlockServeThreads > MAX_BLOCK_SERVE_THREADS) {
+        return InitError(strprintf(_("-blockservethreads must be between 0 and %d"), MAX_BLOCK_SERVE_THREADS));
+    }
+
     fCheckBlockIndex = GetBoolArg("-checkblockindex", chainparams.DefaultConsistencyChecks());
     fIBDSkipTxVerification = GetBoolArg("-ibdskiptxverification", DEFAULT_IBD_SKIP_TX_VERIFICATION);
+    hashAssumeValid = uint256S(GetArg("-assumevalid", chainparams.GetConsensus().defaultAssumeValid.GetHex()));
+    if (!hashAssumeValid.IsNull())
+        LogPrintf("Assuming ancestors of block %s have valid proofs, scripts and signatures.\n", hashAssumeValid.GetHex());
+    else
+        LogPrintf("Validating proofs, scripts and signatures for all blocks.\n");
+    fDeferHeaderSolutions = GetBoolArg("-deferheadersolutions", DEFAULT_DEFER_HEADER_SOLUTIONS);
+    fMmapBlockFiles = GetBoolArg("-mmapblockfiles", DEFAULT_MMAP_BLOCK_FILES);
+    fPackBlockFiles = GetBoolArg("-packblockfiles", DEFAULT_PACK_BLOCK_FILES);
+    fCompressBlockFiles = GetBoolArg("-compressblockfiles", DEFAULT_COMPRESS_BLOCK_FILES);
+    nProofBatchBlocks = GetArg("-proofbatchblocks", DEFAULT_PROOF_BATCH_BLOCKS);
+    if (nProofBatchBlocks < 1 || nProofBatchBlocks > MAX_PROOF_BATCH_BLOCKS) {
+        return InitError(strprintf(_("-proofbatchblocks must be between 1 and %d"), MAX_PROOF_BATCH_BLOCKS));
+    }
+    nBlockPrefetch = GetArg("-blockprefetch", DEFAULT_BLOCK_PREFETCH);
+    if (nBlockPrefetch < 0 || nBlockPrefetch > MAX_BLOCK_PREFETCH) {
+        return InitError(strprintf(_("-blockprefetch must be between 0 and %d"), MAX_BLOCK_PREFETCH));
+    }
+    fPipelineBlockConnect = GetBoolArg("-pipelineblockconnect", DEFAULT_PIPELINE_BLOCK_CONNECT || nProofBatchBlocks > 1 || nBlockPrefetch > 0);
     fCheckpointsEnabled = GetBoolArg("-checkpoints", DEFAULT_CHECKPOINTS_ENABLED);
 
-    // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency
+    {
+        std::string strError;
+        if (!ParseDBOptions(mapMultiArgs["-dboptions"], strError)) {
+            return InitError(strError);
+        }
+        for (const std::string& strName : DB_PROFILE_NAMES) {
+            if (GetDBOptions(strName).fCompression && !DBCompressionAvailable()) {
+                InitWarning(strprintf(_("Compression was requested for the %s database, but LevelDB was built without Snappy support. The database will be stored uncompressed."), strName));
+            }
+        }
+    }
+
+    {
+        std::string strError;
+        if (!ParseThreadAffinity(mapMultiArgs["-threadaffinity"], strError)) {
+            return InitError(strError);
+        }
+    }
+
+    {
+        // Set before the block index and the caches allocate anything.
+        std::string strHugePages = GetArg("-hugepages", DEFAULT_HUGEPAGES);
+        HugePageMode hugePageMode;
+        if (!ParseHugePageMode(strHugePages, hugePageMode)) {
+            return InitError(strprintf(_("Unknown -hugepages mode '%s'"), strHugePages));
+        }
+        SetHugePageMode(hugePageMode);
+    }
+
+    // -par=0 means autodetect, but nScriptCheckThreads==0 means no concurrency.
+    // Script checks bound to a set of CPUs get one thread per CPU.
     nScriptCheckThreads = GetArg("-par", DEFAULT_SCRIPTCHECK_THREADS);
-    if (nScriptCheckThreads <= 0)
+    std::vector<int> vScriptCheckCPUs = GetThreadAffinity("scriptcheck");
+    if (nScriptCheckThreads == 0 && !vScriptCheckCPUs.empty())
+        nScriptCheckThreads = vScriptCheckCPUs.size();
+    else if (nScriptCheckThreads <= 0)
         nScriptCheckThreads += GetNumCores();
     if (nScriptCheckThreads <= 1)
         nScriptCheckThreads = 0;
     else if (nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
         nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
 
+    // Set up global Rayon threadpool. Like the script checks, proving threads
+    // bound to a set of CPUs get one thread per CPU, so that giving the two
+    // classes disjoint sets keeps them from competing for cores.
+    {
+        int nProvingThreads = std::max(0, (int)GetArg("-provingthreads", DEFAULT_PROVING_THREADS));
+        std::vector<int> vProvingCPUs = GetThreadAffinity("proving");
+        if (nProvingThreads == 0)
+            nProvingThreads = vProvingCPUs.size();
+        std::vector<size_t> vCPUs(vProvingCPUs.begin(), vProvingCPUs.end());
+        zcashd_init_rayon_threadpool(nProvingThreads, vCPUs.data(), vCPUs.size());
+    }
+
     fServer = GetBoolArg("-server", false);
 
     // block pruning; get the amount of disk space (in MiB) to allot for block & undo files
@@ -1246,6 +1582,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetBoolArg("-peerbloomfilters", DEFAULT_PEERBLOOMFILTERS))
         nLocalServices |= NODE_BLOOM;
 
+    if (GetBoolArg("-peerblockfilters", DEFAULT_PEERBLOCKFILTERS)) {
+        if (!GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX)) {
+            return InitError(_("-peerblockfilters requires -blockfilterindex."));
+        }
+        nLocalServices |= NODE_COMPACT_FILTERS;
+    }
+
     nMaxTipAge = GetArg("-maxtipage", DEFAULT_MAX_TIP_AGE);
 
     KeyIO keyIO(chainparams);
@@ -1370,6 +1713,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         return false;
     }
 
+    // Select the SHA-256 implementation before anything is hashed.
+    std::string sha256_algo = SHA256AutoDetect();
+
     // Initialize elliptic curve code
     ECC_Start();
     globalVerifyHandle.reset(new ECCVerifyHandle());
@@ -1399,6 +1745,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     // if (GetBoolArg("-shrinkdebugfile", !fDebug))
     //     ShrinkDebugFile();
 
+    LogPrintf("Using the '%s' SHA256 implementation\n", sha256_algo);
 #ifdef ENABLE_WALLET
     LogPrintf("Using BerkeleyDB version %s\n", DbEnv::version(0, 0, 0));
 #endif
@@ -1408,17 +1755,36 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     LogPrintf("Using data directory %s\n", strDataDir);
     LogPrintf("Using config file %s\n", GetConfigFile(GetArg("-conf", BITCOIN_CONF_FILENAME)).string());
     LogPrintf("Using at most %i connections (%i file descriptors available)\n", nMaxConnections, nFD);
+    if (GetHugePageMode() != HugePageMode::OFF)
+        LogPrintf("Using %s huge pages for the coins cache, block index and mempool\n", GetHugePageMode() == HugePageMode::HUGETLB ? "explicit" : "transparent");
     std::ostringstream strErrors;
 
-    LogPrintf("Using %u threads for script verification\n", nScriptCheckThreads);
+    LogPrintf("Using %u threads for script and transaction verification\n", nScriptCheckThreads);
     if (nScriptCheckThreads) {
-        for (int i=0; i<nScriptCheckThreads-1; i++)
+        for (int i=0; i<nScriptCheckThreads-1; i++) {
             threadGroup.create_thread(&ThreadScriptCheck);
+            threadGroup.create_thread(&ThreadTransactionCheck);
+            threadGroup.create_thread(&ThreadHeaderCheck);
+#ifdef ENABLE_WALLET
+            threadGroup.create_thread(&ThreadSaplingTrialDecryption);
+#endif
+        }
+    }
+
+    if (nMempoolProofBatch > 0) {
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "mempoolproofs", &ThreadMempoolProofBatch));
+    }
+
+    for (int i = 0; i < nBlockServeThreads; i++) {
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "blockserve", &ThreadServeBlocks));
     }
 
-    // Start the lightweight task scheduler thread
+    // Start the lightweight task scheduler threads; with two, a long-running
+    // task such as dumping the address manager does not hold up the others.
     CScheduler::Function serviceLoop = boost::bind(&CScheduler::serviceQueue, &scheduler);
-    threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    for (int i = 0; i < SCHEDULER_THREADS; i++) {
+        threadGroup.create_thread(boost::bind(&TraceThread<CScheduler::Function>, "scheduler", serviceLoop));
+    }
 
     // Count uptime
     MarkStartTime();
@@ -1443,6 +1809,9 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         if (!metrics_run(metricsBindCstr, vAllowCstr.data(), vAllowCstr.size(), prometheusPort)) {
             return InitError(strprintf(_("Failed to start Prometheus metrics exporter")));
         }
+
+        // Walking the wallet's transactions is too slow to do on every scrape.
+        scheduler.scheduleEvery([]() { GetMemoryUsage(); }, MEMORY_USAGE_METRICS_INTERVAL);
     }
 
     // Expose binary metadata to metrics, using a single time series with value 1.
@@ -1461,8 +1830,21 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         );
     }
 
-    // Initialize Zcash circuit parameters
-    ZC_LoadParams(chainparams);
+    // Initialize Zcash circuit parameters. The proving keys are built in the
+    // background if this node may create proofs, that is if the wallet is
+    // enabled or coinbase outputs are sent to a shielded -mineraddress, and
+    // otherwise when the first proof is created.
+    bool fPreloadProvingKeys = false;
+#ifdef ENABLE_WALLET
+    fPreloadProvingKeys |= !fDisableWallet;
+#endif
+#ifdef ENABLE_MINING
+    if (mapArgs.count("-mineraddress")) {
+        auto addr = keyIO.DecodePaymentAddress(mapArgs["-mineraddress"]);
+        fPreloadProvingKeys |= addr.has_value() && !std::holds_alternative<CKeyID>(addr.value());
+    }
+#endif
+    ZC_LoadParams(chainparams, fPreloadProvingKeys);
 
     /* Start the RPC server already.  It will be started in "warmup" mode
      * and not really process calls already (but it will signify connections
@@ -1477,15 +1859,18 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
 
     int64_t nStart;
+    timerSetup.Stop();
 
     // ********************************************************* Step 5: verify wallet database integrity
 #ifdef ENABLE_WALLET
     if (!fDisableWallet) {
+        CStartupPhaseTimer timer("verifywallet");
         if (!CWallet::Verify())
             return false;
     } // (!fDisableWallet)
 #endif // ENABLE_WALLET
     // ********************************************************* Step 6: network initialization
+    CStartupPhaseTimer timerNetwork("network");
 
     RegisterNodeSignals(GetNodeSignals());
 
@@ -1618,8 +2003,17 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             GetArg("-maxuploadtarget", DEFAULT_MAX_UPLOAD_TARGET)*1024*1024);
     }
 
+    timerNetwork.Stop();
+
     // ********************************************************* Step 7: load block chain
 
+    // The known and banned addresses are only needed once the node starts,
+    // so they are loaded while the block chain is.
+    std::future<void> addressesLoaded = std::async(std::launch::async, [] {
+        CStartupPhaseTimer timer("addresses");
+        LoadAddresses();
+    });
+
     fReindex = GetBoolArg("-reindex", false);
     bool fReindexChainState = GetBoolArg("-reindex-chainstate", false);
 
@@ -1629,31 +2023,75 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     int64_t nTotalCache = (GetArg("-dbcache", nDefaultDbCache) << 20);
     nTotalCache = std::max(nTotalCache, nMinDbCache << 20); // total cache cannot be less than nMinDbCache
     nTotalCache = std::min(nTotalCache, nMaxDbCache << 20); // total cache cannot be greater than nMaxDbcache
-    int64_t nBlockTreeDBCache = nTotalCache / 8;
-    if (nBlockTreeDBCache > (1 << 21) && !GetBoolArg("-txindex", DEFAULT_TXINDEX))
-        nBlockTreeDBCache = (1 << 21); // block tree db cache shouldn't be larger than 2 MiB
+    int64_t nBlockTreeDBCache = std::min(nTotalCache / 8, (int64_t)1 << 21); // block tree db cache shouldn't be larger than 2 MiB
 
     // https://github.com/bitpay/bitcoin/commit/c91d78b578a8700a45be936cb5bb0931df8f4b87#diff-c865a8939105e6350a50af02766291b7R1233
     if (GetBoolArg("-insightexplorer", false)) {
         if (!GetBoolArg("-txindex", false)) {
             return InitError(_("-insightexplorer requires -txindex."));
         }
-        // increase cache if additional indices are needed
-        nBlockTreeDBCache = nTotalCache * 3 / 4;
     }
     nTotalCache -= nBlockTreeDBCache;
+    // The transaction and insight explorer indexes have their own databases,
+    // which get the share of the cache that used to enlarge the block index
+    // database.
+    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
+    int64_t nTxIndexDBCache = fTxIndex ? nTotalCache / 8 : 0;
+    nTotalCache -= nTxIndexDBCache;
+    fBlockFilterIndex = GetBoolArg("-blockfilterindex", DEFAULT_BLOCKFILTERINDEX);
+    int64_t nBlockFilterIndexDBCache = fBlockFilterIndex ? nTotalCache / 16 : 0;
+    nTotalCache -= nBlockFilterIndexDBCache;
+    // One small entry per height.
+    fSupplyIndex = GetBoolArg("-supplyindex", DEFAULT_SUPPLYINDEX);
+    int64_t nSupplyIndexDBCache = fSupplyIndex ? std::min(nTotalCache / 32, (int64_t)1 << 23) : 0;
+    nTotalCache -= nSupplyIndexDBCache;
+    fAddressIndex = fExperimentalInsightExplorer || fExperimentalLightWalletd;
+    fSpentIndex = fExperimentalInsightExplorer;
+    fTimestampIndex = fExperimentalInsightExplorer;
+    fSubtreeIndex = fExperimentalLightWalletd;
+    int64_t nAddressIndexDBCache = 0;
+    int64_t nSpentIndexDBCache = 0;
+    int64_t nTimestampIndexDBCache = 0;
+    // A few hundred entries at most; the cache only has to hold the counts.
+    int64_t nSubtreeIndexDBCache = fSubtreeIndex ? (1 << 20) : 0;
+    if (fExperimentalInsightExplorer) {
+        int64_t nInsightIndexDBCache = nTotalCache * 5 / 7;
+        nAddressIndexDBCache = nInsightIndexDBCache / 2;
+        nSpentIndexDBCache = nInsightIndexDBCache * 3 / 8;
+        nTimestampIndexDBCache = nInsightIndexDBCache - nAddressIndexDBCache - nSpentIndexDBCache;
+    } else if (fExperimentalLightWalletd) {
+        nAddressIndexDBCache = nTotalCache / 4;
+    }
+    responseCache.SetMaxSize(std::max<int64_t>(GetArg("-rpcresponsecache", DEFAULT_RPC_RESPONSE_CACHE_SIZE), 0) << 20);
+    if (fExperimentalLightWalletd) {
+        compactBlockCache.SetMaxSize(std::max<int64_t>(GetArg("-lightwalletdcompactcache", DEFAULT_COMPACT_BLOCK_CACHE_SIZE), 0) << 20);
+    }
+    nTotalCache -= nAddressIndexDBCache + nSpentIndexDBCache + nTimestampIndexDBCache + nSubtreeIndexDBCache;
     int64_t nCoinDBCache = std::min(nTotalCache / 2, (nTotalCache / 4) + (1 << 23)); // use 25%-50% of the remainder for disk cache
     nTotalCache -= nCoinDBCache;
     nCoinCacheUsage = nTotalCache; // the rest goes to in-memory cache
     LogPrintf("Cache configuration:\n");
     LogPrintf("* Using %.1fMiB for block index database\n", nBlockTreeDBCache * (1.0 / 1024 / 1024));
+    if (fTxIndex) {
+        LogPrintf("* Using %.1fMiB for transaction index database\n", nTxIndexDBCache * (1.0 / 1024 / 1024));
+    }
+    if (fBlockFilterIndex) {
+        LogPrintf("* Using %.1fMiB for block filter index database\n", nBlockFilterIndexDBCache * (1.0 / 1024 / 1024));
+    }
+    if (fSupplyIndex) {
+        LogPrintf("* Using %.1fMiB for supply index database\n", nSupplyIndexDBCache * (1.0 / 1024 / 1024));
+    }
+    if (fAddressIndex) {
+        LogPrintf("* Using %.1fMiB for insight explorer index databases\n",
+            (nAddressIndexDBCache + nSpentIndexDBCache + nTimestampIndexDBCache + nSubtreeIndexDBCache) * (1.0 / 1024 / 1024));
+    }
     LogPrintf("* Using %.1fMiB for chain state database\n", nCoinDBCache * (1.0 / 1024 / 1024));
     LogPrintf("* Using %.1fMiB for in-memory UTXO set\n", nCoinCacheUsage * (1.0 / 1024 / 1024));
 
     bool clearWitnessCaches = false;
 
     bool fLoaded = false;
-    while (!fLoaded) {
+    while (!fLoaded && !fRequestShutdown) {
         bool fReset = fReindex;
         std::string strLoadError;
 
@@ -1664,13 +2102,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             try {
                 UnloadBlockIndex();
                 delete pcoinsTip;
+                delete pcoinsFlushLayer;
                 delete pcoinsdbview;
                 delete pcoinscatcher;
                 delete pblocktree;
 
                 pblocktree = new CBlockTreeDB(nBlockTreeDBCache, false, fReindex);
                 pcoinsdbview = new CCoinsViewDB(nCoinDBCache, false, fReindex || fReindexChainState);
-                pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                if (GetBoolArg("-asynccoinsflush", DEFAULT_ASYNC_COINS_FLUSH)) {
+                    pcoinsFlushLayer = new CCoinsViewFlushLayer(pcoinsdbview);
+                    pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsFlushLayer);
+                } else {
+                    pcoinsFlushLayer = NULL;
+                    pcoinscatcher = new CCoinsViewErrorCatcher(pcoinsdbview);
+                }
                 pcoinsTip = new CCoinsViewCache(pcoinscatcher);
 
                 if (fReindex) {
@@ -1678,11 +2123,20 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     //If we're reindexing in prune mode, wipe away unusable block files and all undo data files
                     if (fPruneMode)
                         CleanupBlockRevFiles();
+                } else {
+                    // If necessary, upgrade from the per-transaction coins database format.
+                    if (!pcoinsdbview->Upgrade()) {
+                        strLoadError = _("Error upgrading chainstate database");
+                        break;
+                    }
                 }
 
-                if (!LoadBlockIndex()) {
-                    strLoadError = _("Error loading block database");
-                    break;
+                {
+                    CStartupPhaseTimer timer("loadblockindex");
+                    if (!LoadBlockIndex()) {
+                        strLoadError = _("Error loading block database");
+                        break;
+                    }
                 }
 
                 // If the loaded chain has a wrong genesis, bail out immediately
@@ -1696,28 +2150,6 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     break;
                 }
 
-                // Check for changed -txindex state
-                if (fTxIndex != GetBoolArg("-txindex", DEFAULT_TXINDEX)) {
-                    strLoadError = _("You need to rebuild the database using -reindex-chainstate to change -txindex");
-                    break;
-                }
-
-                // Check for changed -insightexplorer state
-                bool fInsightExplorerPreviouslySet = false;
-                pblocktree->ReadFlag("insightexplorer", fInsightExplorerPreviouslySet);
-                if (fExperimentalInsightExplorer != fInsightExplorerPreviouslySet) {
-                    strLoadError = _("You need to rebuild the database using -reindex to change -insightexplorer");
-                    break;
-                }
-
-                // Check for changed -lightwalletd state
-                bool fLightWalletdPreviouslySet = false;
-                pblocktree->ReadFlag("lightwalletd", fLightWalletdPreviouslySet);
-                if (fExperimentalLightWalletd != fLightWalletdPreviouslySet) {
-                    strLoadError = _("You need to rebuild the database using -reindex to change -lightwalletd");
-                    break;
-                }
-
                 // Check for changed -prune state.  What we are concerned about is a user who has pruned blocks
                 // in the past, but is now trying to run unpruned.
                 if (fHavePruned && !fPruneMode) {
@@ -1727,6 +2159,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
                 if (!fReindex && chainActive.Tip() != NULL) {
                     uiInterface.InitMessage(_("Rewinding blocks if needed..."));
+                    CStartupPhaseTimer timer("rewindblockindex");
                     if (!RewindBlockIndex(chainparams, clearWitnessCaches)) {
                         strLoadError = _("Unable to rewind the database to a pre-upgrade state. You will need to redownload the blockchain");
                         break;
@@ -1750,10 +2183,16 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
                     }
                 }
 
-                if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview, GetArg("-checklevel", DEFAULT_CHECKLEVEL),
-                              GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
-                    strLoadError = _("Corrupted block database detected");
-                    break;
+                {
+                    CStartupPhaseTimer timer("verifydb");
+                    int nCheckLevel = GetArg("-checklevel", DEFAULT_CHECKLEVEL);
+                    if (GetBoolArg("-checkblocksinbackground", DEFAULT_CHECK_BLOCKS_IN_BACKGROUND))
+                        nCheckLevel = std::min(nCheckLevel, 2);
+                    if (!CVerifyDB().VerifyDB(chainparams, pcoinsdbview, nCheckLevel,
+                                  GetArg("-checkblocks", DEFAULT_CHECKBLOCKS))) {
+                        strLoadError = _("Corrupted block database detected");
+                        break;
+                    }
                 }
             } catch (const std::exception& e) {
                 if (fDebug) LogPrintf("%s\n", e.what());
@@ -1764,7 +2203,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
             fLoaded = true;
         } while(false);
 
-        if (!fLoaded) {
+        if (!fLoaded && !fRequestShutdown) {
             // first suggest a reindex
             if (!fReset) {
                 bool fRet = uiInterface.ThreadSafeQuestion(
@@ -1794,12 +2233,39 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     }
     LogPrintf(" block index %15dms\n", GetTimeMillis() - nStart);
 
-    fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
-    CAutoFile est_filein(fsbridge::fopen(est_path, "rb"), SER_DISK, CLIENT_VERSION);
-    // Allowed to fail as this file IS missing on first startup.
-    if (!est_filein.IsNull())
-        mempool.ReadFeeEstimates(est_filein);
-    fFeeEstimatesInitialized = true;
+    // The transaction and insight explorer indexes are (re)built in the
+    // background from the active chain, so enabling them, or recovering them
+    // after a crash, does not need a reindex of the chain.
+    if (fTxIndex || fAddressIndex || fBlockFilterIndex || fSupplyIndex) {
+        uiInterface.InitMessage(_("Loading transaction indexes..."));
+        CStartupPhaseTimer timer("txindexes");
+        bool fReindexInsight = fReindex || GetBoolArg("-reindex-insight", false);
+        std::string strError;
+        try {
+            pinsightindex = new CInsightIndex(nTxIndexDBCache, nAddressIndexDBCache, nSpentIndexDBCache, nTimestampIndexDBCache, nSubtreeIndexDBCache, nBlockFilterIndexDBCache, nSupplyIndexDBCache, false, fReindexInsight);
+        } catch (const std::exception& e) {
+            if (fDebug) LogPrintf("%s\n", e.what());
+            return InitError(_("Error opening transaction index databases"));
+        }
+        {
+            LOCK(cs_main);
+            if (!pinsightindex->Init(strError)) {
+                return InitError(strError + ". " + _("Please restart with -reindex-insight to rebuild the transaction indexes."));
+            }
+        }
+        RegisterValidationInterface(pinsightindex);
+        pinsightindex->Start();
+    }
+
+    {
+        CStartupPhaseTimer timer("feeestimates");
+        fs::path est_path = GetDataDir() / FEE_ESTIMATES_FILENAME;
+        CAutoFile est_filein(fsbridge::fopen(est_path, "rb"), SER_DISK, CLIENT_VERSION);
+        // Allowed to fail as this file IS missing on first startup.
+        if (!est_filein.IsNull())
+            mempool.ReadFeeEstimates(est_filein);
+        fFeeEstimatesInitialized = true;
+    }
 
 
     // ********************************************************* Step 8: load wallet
@@ -1808,6 +2274,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         pwalletMain = NULL;
         LogPrintf("Wallet disabled!\n");
     } else {
+        CStartupPhaseTimer timer("wallet");
         CWallet::InitLoadWallet(chainparams, clearWitnessCaches || fReindex);
         if (!pwalletMain)
             return false;
@@ -1876,6 +2343,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
         nLocalServices &= ~NODE_NETWORK;
         if (!fReindex) {
             uiInterface.InitMessage(_("Pruning blockstore..."));
+            CStartupPhaseTimer timer("prune");
             PruneAndFlush();
         }
     }
@@ -1910,6 +2378,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // Wait for genesis block to be processed
     {
+        CStartupPhaseTimer timer("genesiswait");
         WAIT_LOCK(g_genesis_wait_mutex, lock);
         // We previously could hang here if StartShutdown() is called prior to
         // ThreadImport getting started, so instead we just wait on a timer to
@@ -1951,8 +2420,13 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
     if (GetBoolArg("-listenonion", DEFAULT_LISTEN_ONION))
         StartTorControl(threadGroup, scheduler);
 
+    addressesLoaded.wait();
     StartNode(threadGroup, scheduler);
 
+    if (GetBoolArg("-checkblocksinbackground", DEFAULT_CHECK_BLOCKS_IN_BACKGROUND)) {
+        threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "verifydb", &ThreadVerifyCoins));
+    }
+
 #ifdef ENABLE_MINING
     // Generate coins in the background
     GenerateBitcoins(GetBoolArg("-gen", DEFAULT_GENERATE), GetArg("-genproclimit", DEFAULT_GENERATE_THREADS), chainparams);
@@ -1960,6 +2434,7 @@ bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler)
 
     // ********************************************************* Step 12: finished
 
+    SetStartupFinished();
     SetRPCWarmupFinished();
     uiInterface.InitMessage(_("Done loading"));
 
@@ -8,6 +8,8 @@
 #define BITCOIN_INIT_H
 
 #include <string>
+#include <utility>
+#include <vector>
 
 #include <tracing.h>
 
@@ -32,6 +34,13 @@ void InitLogging();
 void InitParameterInteraction();
 bool AppInit2(boost::thread_group& threadGroup, CScheduler& scheduler);
 
+/**
+ * Estimates the memory used by each of the node's major caches and indexes,
+ * and updates the zcash.memory.usage.bytes gauge with them. Components that
+ * have not been loaded yet are left out.
+ */
+std::vector<std::pair<std::string, size_t>> GetMemoryUsage();
+
 /** The help message mode determines what help message to show */
 enum HelpMessageMode {
     HMM_BITCOIND
@@ -0,0 +1,930 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "insightindex.h"
+
+#include "addressindex.h"
+#include "blockfilter.h"
+#include "chainparams.h"
+#include "main.h"
+#include "serialize.h"
+#include "spentindex.h"
+#include "subtreeindex.h"
+#include "supplyindex.h"
+#include "timestampindex.h"
+#include "undo.h"
+#include "util/system.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+
+CInsightIndex* pinsightindex = NULL;
+
+/** Number of legacy entries erased from the block index database per batch. */
+static const size_t LEGACY_ERASE_BATCH_SIZE = 100000;
+
+/** Log the progress of a rebuild every this many blocks. */
+static const int LOG_PROGRESS_INTERVAL = 10000;
+
+/** How long RPC methods wait for the indexes to catch up with the tip. */
+static const std::chrono::seconds SYNC_WAIT_TIMEOUT(30);
+/** Same, while the indexes are still being built. */
+static const std::chrono::seconds BUILD_WAIT_TIMEOUT(5);
+
+CInsightIndex::CInsightIndex(size_t nTxCache, size_t nAddressCache, size_t nSpentCache, size_t nTimestampCache, size_t nSubtreeCache, size_t nBlockFilterCache, size_t nSupplyCache, bool fMemory, bool fWipe)
+    : fAddressBalances(false), fWakeUp(false), fInterrupt(false), fCaughtUp(false), fFailed(false), fLegacyTxIndex(false)
+{
+    if (fTxIndex) {
+        vIndexes.emplace_back(TX, new CInsightIndexDB("tx", nTxCache, fMemory, fWipe));
+    }
+    if (fAddressIndex) {
+        vIndexes.emplace_back(ADDRESS, new CInsightIndexDB("address", nAddressCache, fMemory, fWipe));
+    }
+    if (fSpentIndex) {
+        vIndexes.emplace_back(SPENT, new CInsightIndexDB("spent", nSpentCache, fMemory, fWipe));
+    }
+    if (fTimestampIndex) {
+        vIndexes.emplace_back(TIMESTAMP, new CInsightIndexDB("timestamp", nTimestampCache, fMemory, fWipe));
+    }
+    if (fSubtreeIndex) {
+        vIndexes.emplace_back(SUBTREE, new CInsightIndexDB("subtree", nSubtreeCache, fMemory, fWipe));
+    }
+    if (fBlockFilterIndex) {
+        vIndexes.emplace_back(BLOCKFILTER, new CInsightIndexDB("blockfilter", nBlockFilterCache, fMemory, fWipe));
+    }
+    if (fSupplyIndex) {
+        vIndexes.emplace_back(SUPPLY, new CInsightIndexDB("supply", nSupplyCache, fMemory, fWipe));
+    }
+}
+
+CInsightIndex::~CInsightIndex()
+{
+    Stop();
+}
+
+bool CInsightIndex::Init(std::string& strError)
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs);
+    fLegacyTxIndex = GetDB(TX) != nullptr && pblocktree != NULL && pblocktree->HasLegacyTxIndex();
+    for (Index& index : vIndexes) {
+        uint256 hashBest;
+        if (!index.db->ReadBestBlock(hashBest)) {
+            index.pindexBest = nullptr;
+            // An address index built from scratch keeps the balances.
+            if (index.type == ADDRESS && !index.db->WriteHasAddressBalances()) {
+                strError = "Failed to write to the address index";
+                return false;
+            }
+            fAddressBalances |= index.type == ADDRESS;
+            continue;
+        }
+        if (index.type == ADDRESS) {
+            fAddressBalances = index.db->HasAddressBalances();
+        }
+        BlockMap::iterator it = mapBlockIndex.find(hashBest);
+        if (it == mapBlockIndex.end()) {
+            strError = strprintf("The %s is synced to unknown block %s", GetName(index.type), hashBest.GetHex());
+            return false;
+        }
+        index.pindexBest = it->second;
+        LogPrintf("%s: %s at height %d\n", __func__, GetName(index.type), index.pindexBest->nHeight);
+    }
+    return true;
+}
+
+const char* CInsightIndex::GetName(IndexType type)
+{
+    switch (type) {
+        case TX: return "txindex";
+        case ADDRESS: return "addressindex";
+        case SPENT: return "spentindex";
+        case TIMESTAMP: return "timestampindex";
+        case SUBTREE: return "subtreeindex";
+        case BLOCKFILTER: return "blockfilterindex";
+        case SUPPLY: return "supplyindex";
+    }
+    assert(false);
+    return "";
+}
+
+CInsightIndexDB* CInsightIndex::GetDB(IndexType type) const
+{
+    for (const Index& index : vIndexes) {
+        if (index.type == type) {
+            return index.db.get();
+        }
+    }
+    return nullptr;
+}
+
+bool CInsightIndex::IsSyncedTo(const CBlockIndex* pindex) const
+{
+    for (const Index& index : vIndexes) {
+        // The indexes may already have moved on to a descendant.
+        if (index.pindexBest == nullptr || index.pindexBest->GetAncestor(pindex->nHeight) != pindex) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void CInsightIndex::ConnectTxIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockIndex* pindex)
+{
+    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
+    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
+    vPos.reserve(block.vtx.size());
+    for (const CTransaction& tx : block.vtx) {
+        vPos.push_back(std::make_pair(tx.GetHash(), pos));
+        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
+    }
+    db.WriteTxIndex(batch, vPos);
+}
+
+// https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2597
+void CInsightIndex::ConnectAddressIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex)
+{
+    std::vector<CAddressIndexDbEntry> addressIndex;
+    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
+
+    for (unsigned int i = 0; i < block.vtx.size(); i++) {
+        const CTransaction &tx = block.vtx[i];
+        uint256 const hash = tx.GetHash();
+
+        if (!tx.IsCoinBase()) {
+            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            for (size_t j = 0; j < tx.vin.size(); j++) {
+                const CTxIn &input = tx.vin[j];
+                const CTxOut &prevout = txundo.vprevout[j].out;
+                CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
+                if (scriptType != CScript::UNKNOWN) {
+                    uint160 const addrHash = prevout.scriptPubKey.AddressHash();
+
+                    // record spending activity
+                    addressIndex.push_back(std::make_pair(
+                        CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, j, true),
+                        prevout.nValue * -1));
+
+                    // remove address from unspent index
+                    addressUnspentIndex.push_back(std::make_pair(
+                        CAddressUnspentKey(scriptType, addrHash, input.prevout.hash, input.prevout.n),
+                        CAddressUnspentValue()));
+                }
+            }
+        }
+
+        for (unsigned int k = 0; k < tx.vout.size(); k++) {
+            const CTxOut &out = tx.vout[k];
+            CScript::ScriptType scriptType = out.scriptPubKey.GetType();
+            if (scriptType != CScript::UNKNOWN) {
+                uint160 const addrHash = out.scriptPubKey.AddressHash();
+
+                // record receiving activity
+                addressIndex.push_back(std::make_pair(
+                    CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, k, false),
+                    out.nValue));
+
+                // record unspent output
+                addressUnspentIndex.push_back(std::make_pair(
+                    CAddressUnspentKey(scriptType, addrHash, hash, k),
+                    CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
+            }
+        }
+    }
+
+    db.WriteAddressIndex(batch, addressIndex);
+    db.UpdateAddressUnspentIndex(batch, addressUnspentIndex);
+    if (fAddressBalances) {
+        UpdateAddressBalances(batch, db, addressIndex, false);
+    }
+}
+
+// https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2236
+void CInsightIndex::DisconnectAddressIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex)
+{
+    std::vector<CAddressIndexDbEntry> addressIndex;
+    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
+
+    // Legacy undo records only have the height of the coin they restore for
+    // the last spend of a transaction's outputs (see ApplyTxInUndo). The
+    // height of the others is found from that record if it is in the same
+    // block, and otherwise from an unspent output of the same transaction.
+    std::map<uint256, int> mapPrevHeights;
+    for (size_t i = 1; i < block.vtx.size(); i++) {
+        const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+        for (size_t j = 0; j < block.vtx[i].vin.size(); j++) {
+            if (txundo.vprevout[j].nHeight != 0) {
+                mapPrevHeights[block.vtx[i].vin[j].prevout.hash] = txundo.vprevout[j].nHeight;
+            }
+        }
+    }
+    auto prevHeight = [&](const Coin& coin, const uint256& prevHash) -> int {
+        if (coin.nHeight != 0) {
+            return coin.nHeight;
+        }
+        auto it = mapPrevHeights.find(prevHash);
+        if (it == mapPrevHeights.end()) {
+            LOCK(cs_main);
+            const Coin& alternate = AccessByTxid(*pcoinsTip, prevHash);
+            it = mapPrevHeights.emplace(prevHash, alternate.IsSpent() ? 0 : alternate.nHeight).first;
+        }
+        return it->second;
+    };
+
+    // undo transactions in reverse order
+    for (int i = block.vtx.size() - 1; i >= 0; i--) {
+        const CTransaction &tx = block.vtx[i];
+        uint256 const hash = tx.GetHash();
+
+        for (unsigned int k = tx.vout.size(); k-- > 0;) {
+            const CTxOut &out = tx.vout[k];
+            CScript::ScriptType scriptType = out.scriptPubKey.GetType();
+            if (scriptType != CScript::UNKNOWN) {
+                uint160 const addrHash = out.scriptPubKey.AddressHash();
+
+                // undo receiving activity
+                addressIndex.push_back(std::make_pair(
+                    CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, k, false),
+                    out.nValue));
+
+                // undo unspent index
+                addressUnspentIndex.push_back(std::make_pair(
+                    CAddressUnspentKey(scriptType, addrHash, hash, k),
+                    CAddressUnspentValue()));
+            }
+        }
+
+        if (i > 0) { // not coinbases
+            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            for (unsigned int j = tx.vin.size(); j-- > 0;) {
+                const CTxIn &input = tx.vin[j];
+                const Coin &coin = txundo.vprevout[j];
+                const CTxOut &prevout = coin.out;
+                CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
+                if (scriptType != CScript::UNKNOWN) {
+                    uint160 const addrHash = prevout.scriptPubKey.AddressHash();
+
+                    // undo spending activity
+                    addressIndex.push_back(std::make_pair(
+                        CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, j, true),
+                        prevout.nValue * -1));
+
+                    // restore unspent index, unless the height of the coin
+                    // is lost
+                    int nPrevHeight = prevHeight(coin, input.prevout.hash);
+                    if (nPrevHeight != 0) {
+                        addressUnspentIndex.push_back(std::make_pair(
+                            CAddressUnspentKey(scriptType, addrHash, input.prevout.hash, input.prevout.n),
+                            CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, nPrevHeight)));
+                    } else {
+                        LogPrintf("%s: no height for the unspent entry of %s:%u\n", __func__, input.prevout.hash.ToString(), input.prevout.n);
+                    }
+                }
+            }
+        }
+    }
+
+    db.EraseAddressIndex(batch, addressIndex);
+    db.UpdateAddressUnspentIndex(batch, addressUnspentIndex);
+    if (fAddressBalances) {
+        UpdateAddressBalances(batch, db, addressIndex, true);
+    }
+}
+
+void CInsightIndex::UpdateAddressBalances(CDBBatch& batch, CInsightIndexDB& db, const std::vector<CAddressIndexDbEntry>& addressIndex, bool fDisconnect)
+{
+    struct Change {
+        CAddressBalanceValue totals;
+        const uint256* pLastTx = nullptr;
+    };
+    std::map<std::pair<unsigned int, uint160>, Change> mapChanges;
+
+    // The entries of a transaction are next to each other, so it is counted
+    // once per address.
+    for (const CAddressIndexDbEntry& entry : addressIndex) {
+        Change& change = mapChanges[std::make_pair(entry.first.type, entry.first.hashBytes)];
+        change.totals.balance += entry.second;
+        if (entry.second > 0) {
+            change.totals.received += entry.second;
+        }
+        if (change.pLastTx == nullptr || *change.pLastTx != entry.first.txhash) {
+            change.totals.txCount++;
+            change.pLastTx = &entry.first.txhash;
+        }
+    }
+
+    const int nSign = fDisconnect ? -1 : 1;
+    for (const auto& it : mapChanges) {
+        CAddressBalanceValue value;
+        db.ReadAddressBalance(it.first.second, it.first.first, value);
+        value.balance += nSign * it.second.totals.balance;
+        value.received += nSign * it.second.totals.received;
+        value.txCount += nSign * it.second.totals.txCount;
+        db.WriteAddressBalance(batch, it.first.second, it.first.first, value);
+    }
+}
+
+void CInsightIndex::ConnectSpentIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex)
+{
+    std::vector<CSpentIndexDbEntry> spentIndex;
+
+    for (unsigned int i = 1; i < block.vtx.size(); i++) {
+        const CTransaction &tx = block.vtx[i];
+        uint256 const hash = tx.GetHash();
+        const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+
+        for (size_t j = 0; j < tx.vin.size(); j++) {
+            const CTxIn &input = tx.vin[j];
+            const CTxOut &prevout = txundo.vprevout[j].out;
+            CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
+            const uint160 addrHash = prevout.scriptPubKey.AddressHash();
+
+            // Add the spent index to determine the txid and input that spent an output
+            // and to find the amount and address from an input.
+            // If we do not recognize the script type, we still add an entry to the
+            // spentindex db, with a script type of 0 and addrhash of all zeroes.
+            spentIndex.push_back(std::make_pair(
+                CSpentIndexKey(input.prevout.hash, input.prevout.n),
+                CSpentIndexValue(hash, j, pindex->nHeight, prevout.nValue, scriptType, addrHash)));
+        }
+    }
+
+    db.UpdateSpentIndex(batch, spentIndex);
+}
+
+void CInsightIndex::DisconnectSpentIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block)
+{
+    std::vector<CSpentIndexDbEntry> spentIndex;
+
+    for (int i = block.vtx.size() - 1; i > 0; i--) {
+        const CTransaction &tx = block.vtx[i];
+        for (unsigned int j = tx.vin.size(); j-- > 0;) {
+            // undo and delete the spent index
+            spentIndex.push_back(std::make_pair(
+                CSpentIndexKey(tx.vin[j].prevout.hash, tx.vin[j].prevout.n),
+                CSpentIndexValue()));
+        }
+    }
+
+    db.UpdateSpentIndex(batch, spentIndex);
+}
+
+void CInsightIndex::ConnectTimestampIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlockIndex* pindex)
+{
+    unsigned int logicalTS = pindex->nTime;
+    unsigned int prevLogicalTS = 0;
+
+    // retrieve logical timestamp of the previous block
+    if (pindex->pprev)
+        if (!db.ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
+            LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
+
+    if (logicalTS <= prevLogicalTS) {
+        logicalTS = prevLogicalTS + 1;
+        LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
+    }
+
+    db.WriteTimestampIndex(batch, CTimestampIndexKey(logicalTS, pindex->GetBlockHash()));
+    db.WriteTimestampBlockIndex(batch, CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS));
+}
+
+// As in lightwalletd, only the Sapling and Orchard trees are divided into
+// subtrees; Sprout is left out.
+bool CInsightIndex::ConnectSubtreeIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockIndex* pindex, bool& fStale)
+{
+    const Consensus::Params& consensus = Params().GetConsensus();
+    const CBlockIndex* pindexPrev = pindex->pprev;
+
+    // The trees before the block are the final trees of its parent, which
+    // the coins database keeps as anchors while the parent is in the active
+    // chain. Before the upgrades, they are empty.
+    SaplingMerkleTree saplingTree;
+    OrchardMerkleFrontier orchardTree;
+    {
+        LOCK(cs_main);
+        fStale = !chainActive.Contains(pindexPrev);
+        if (fStale) {
+            return true;
+        }
+        if (consensus.NetworkUpgradeActive(pindexPrev->nHeight, Consensus::UPGRADE_SAPLING) &&
+            !pcoinsTip->GetSaplingAnchorAt(pindexPrev->hashFinalSaplingRoot, saplingTree)) {
+            return error("%s: no Sapling tree for block %s", __func__, pindexPrev->GetBlockHash().ToString());
+        }
+        if (consensus.NetworkUpgradeActive(pindexPrev->nHeight, Consensus::UPGRADE_NU5) &&
+            !pcoinsTip->GetOrchardAnchorAt(pindexPrev->hashFinalOrchardRoot, orchardTree)) {
+            return error("%s: no Orchard tree for block %s", __func__, pindexPrev->GetBlockHash().ToString());
+        }
+    }
+
+    // The subtrees completed by the block are numbered on from those of the
+    // trees before it.
+    const size_t nSubtreeSize = size_t(1) << SUBTREE_INDEX_HEIGHT;
+    const uint32_t nSaplingBefore = saplingTree.size() / nSubtreeSize;
+    const uint32_t nOrchardBefore = orchardTree.size() / nSubtreeSize;
+
+    std::vector<uint256> vSaplingRoots;
+    std::vector<libzcash::PedersenHash> vCommitments;
+    for (const CTransaction& tx : block.vtx) {
+        for (const OutputDescription& output : tx.vShieldedOutput) {
+            vCommitments.push_back(output.cmu);
+        }
+    }
+    // The commitments are appended in batches that end where a subtree is
+    // completed.
+    for (size_t i = 0; i < vCommitments.size();) {
+        size_t nBatch = std::min(nSubtreeSize - saplingTree.size() % nSubtreeSize, vCommitments.size() - i);
+        saplingTree.append_many(std::vector<libzcash::PedersenHash>(vCommitments.begin() + i, vCommitments.begin() + i + nBatch));
+        i += nBatch;
+        if (auto root = saplingTree.completed_subtree_root(SUBTREE_INDEX_HEIGHT)) {
+            vSaplingRoots.push_back(root.value());
+        }
+    }
+
+    std::vector<uint256> vOrchardRoots;
+    for (const CTransaction& tx : block.vtx) {
+        if (!orchardTree.AppendBundleSubtrees(tx.GetOrchardBundle(), SUBTREE_INDEX_HEIGHT, vOrchardRoots)) {
+            return error("%s: block %s overfills the Orchard tree", __func__, pindex->GetBlockHash().ToString());
+        }
+    }
+
+    auto writeRoots = [&](ShieldedType type, uint32_t nCount, const std::vector<uint256>& vRoots) {
+        if (vRoots.empty()) {
+            return;
+        }
+        for (const uint256& root : vRoots) {
+            db.WriteSubtreeIndex(batch, type, nCount++, CSubtreeIndexValue(root, pindex->GetBlockHash(), pindex->nHeight));
+        }
+        db.WriteSubtreeCount(batch, type, nCount);
+    };
+    writeRoots(SAPLING, nSaplingBefore, vSaplingRoots);
+    writeRoots(ORCHARD, nOrchardBefore, vOrchardRoots);
+    return true;
+}
+
+void CInsightIndex::DisconnectSubtreeIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlockIndex* pindex)
+{
+    // The subtrees that the block completed are the last ones.
+    for (ShieldedType type : {SAPLING, ORCHARD}) {
+        uint32_t nCount = 0;
+        if (!db.ReadSubtreeCount(type, nCount)) {
+            continue;
+        }
+        uint32_t nNewCount = nCount;
+        CSubtreeIndexValue value;
+        while (nNewCount > 0 && db.ReadSubtreeIndex(type, nNewCount - 1, value) && value.blockHash == pindex->GetBlockHash()) {
+            db.EraseSubtreeIndex(batch, type, --nNewCount);
+        }
+        if (nNewCount != nCount) {
+            db.WriteSubtreeCount(batch, type, nNewCount);
+        }
+    }
+}
+
+bool CInsightIndex::ConnectBlockFilterIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex)
+{
+    // The header of the filter chains on from that of the parent, which the
+    // index is synced to.
+    uint256 prevHeader;
+    if (pindex->pprev != nullptr) {
+        CBlockFilterIndexValue prev;
+        if (!db.ReadBlockFilter(pindex->pprev->GetBlockHash(), prev)) {
+            return error("%s: no filter for the parent of block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+        prevHeader = prev.header;
+    }
+    BlockFilter filter(BlockFilterType::BASIC, block, blockUndo);
+    db.WriteBlockFilter(batch, pindex->GetBlockHash(), CBlockFilterIndexValue(filter, prevHeader));
+    return true;
+}
+
+bool CInsightIndex::ConnectSupplyIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex)
+{
+    CSupplyIndexValue value;
+    value.blockHash = pindex->GetBlockHash();
+
+    // The genesis block has an entry with everything zero, from which the
+    // totals of the other blocks follow.
+    if (pindex->pprev != nullptr) {
+        CSupplyIndexValue prev;
+        if (!db.ReadSupplyIndex(pindex->pprev->nHeight, prev) || prev.blockHash != pindex->pprev->GetBlockHash()) {
+            return error("%s: no entry for the parent of block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+
+        // As in ReceivedBlockTransactions, a shielded pool gains what the
+        // transparent value balance of a transaction gives up.
+        for (const CTransaction& tx : block.vtx) {
+            for (const CTxOut& txout : tx.vout) {
+                value.valueDelta[SUPPLY_TRANSPARENT] += txout.nValue;
+            }
+            for (const JSDescription& js : tx.vJoinSplit) {
+                value.valueDelta[SUPPLY_SPROUT] += js.vpub_old - js.vpub_new;
+            }
+            value.valueDelta[SUPPLY_SAPLING] -= tx.GetValueBalanceSapling();
+            value.valueDelta[SUPPLY_ORCHARD] -= tx.GetOrchardBundle().GetValueBalance();
+        }
+        for (const CTxUndo& txUndo : blockUndo.vtxundo) {
+            for (const Coin& coin : txUndo.vprevout) {
+                value.valueDelta[SUPPLY_TRANSPARENT] -= coin.out.nValue;
+            }
+        }
+
+        value.nSubsidy = GetBlockSubsidy(pindex->nHeight, Params().GetConsensus());
+        value.nChainSubsidy = prev.nChainSubsidy + value.nSubsidy;
+        for (int i = 0; i < SUPPLY_POOL_COUNT; i++) {
+            value.chainValue[i] = prev.chainValue[i] + value.valueDelta[i];
+        }
+    }
+    db.WriteSupplyIndex(batch, pindex->nHeight, value);
+    return true;
+}
+
+bool CInsightIndex::SyncStep(bool& fSynced)
+{
+    const CChainParams& chainparams = Params();
+    const CBlockIndex* pindex = nullptr;
+    bool fConnect = true;
+    std::vector<Index*> vTargets;
+
+    fSynced = false;
+    {
+        LOCK2(cs_main, cs);
+        const CBlockIndex* pindexTip = chainActive.Tip();
+        if (pindexTip == nullptr) {
+            fSynced = true;
+            return true;
+        }
+
+        // An index whose best block was disconnected from the active chain
+        // (or never made it to disk before a crash) first walks back to the
+        // fork point, one block at a time.
+        for (Index& index : vIndexes) {
+            if (index.pindexBest != nullptr && !chainActive.Contains(index.pindexBest)) {
+                pindex = index.pindexBest;
+                fConnect = false;
+                vTargets.push_back(&index);
+                break;
+            }
+        }
+
+        // Otherwise the indexes furthest behind (after a change of options,
+        // some may be ahead of the others) connect the next block.
+        if (pindex == nullptr) {
+            int nHeight = pindexTip->nHeight;
+            for (const Index& index : vIndexes) {
+                nHeight = std::min(nHeight, index.pindexBest ? index.pindexBest->nHeight : -1);
+            }
+            if (nHeight == pindexTip->nHeight) {
+                fSynced = true;
+                return true;
+            }
+            pindex = chainActive[nHeight + 1];
+            for (Index& index : vIndexes) {
+                if ((index.pindexBest ? index.pindexBest->nHeight : -1) == nHeight) {
+                    vTargets.push_back(&index);
+                }
+            }
+        }
+    }
+
+    // Only the address and spent indexes (and the block filter and supply
+    // indexes, of the blocks they add) need the undo data, and the timestamp index needs
+    // neither it nor the block, which matters when the other indexes are
+    // already built.
+    bool fNeedBlock = false;
+    bool fNeedUndo = false;
+    bool fNeedGenesis = false;
+    for (const Index* index : vTargets) {
+        fNeedBlock |= index->type != TIMESTAMP;
+        fNeedUndo |= index->type == ADDRESS || index->type == SPENT || ((index->type == BLOCKFILTER || index->type == SUPPLY) && fConnect);
+        fNeedGenesis |= index->type == BLOCKFILTER;
+    }
+
+    // The genesis block has no entries, as its coinbase is unspendable, but
+    // it does have a block filter, and a supply entry with nothing in it.
+    CBlock block;
+    CBlockUndo blockUndo;
+    if ((pindex->pprev != nullptr || fNeedGenesis) && fNeedBlock) {
+        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus())) {
+            return error("%s: failed to read block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+    }
+    if (pindex->pprev != nullptr && fNeedUndo) {
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (pos.IsNull() || !UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash())) {
+            return error("%s: failed to read undo data of block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+        if (blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
+            return error("%s: block and undo data of %s inconsistent", __func__, pindex->GetBlockHash().ToString());
+        }
+    }
+
+    const CBlockIndex* pindexNewBest = fConnect ? pindex : pindex->pprev;
+    for (Index* index : vTargets) {
+        CInsightIndexDB& db = *index->db;
+        CDBBatch batch(db);
+        if (pindex->pprev != nullptr || index->type == BLOCKFILTER || index->type == SUPPLY) {
+            switch (index->type) {
+                case TX:
+                    // As in ConnectBlock before, the entries of disconnected
+                    // transactions are kept; they still point to the block
+                    // data, and are overwritten if the transaction is mined
+                    // again.
+                    if (fConnect) {
+                        ConnectTxIndex(batch, db, block, pindex);
+                    }
+                    break;
+                case ADDRESS:
+                    if (fConnect) {
+                        ConnectAddressIndex(batch, db, block, blockUndo, pindex);
+                    } else {
+                        DisconnectAddressIndex(batch, db, block, blockUndo, pindex);
+                    }
+                    break;
+                case SPENT:
+                    if (fConnect) {
+                        ConnectSpentIndex(batch, db, block, blockUndo, pindex);
+                    } else {
+                        DisconnectSpentIndex(batch, db, block);
+                    }
+                    break;
+                case TIMESTAMP:
+                    // As before the indexes moved out of the block index,
+                    // the timestamps of disconnected blocks are kept, and
+                    // filtered out by readers asking for active blocks only.
+                    if (fConnect) {
+                        ConnectTimestampIndex(batch, db, pindex);
+                    }
+                    break;
+                case SUBTREE:
+                    if (fConnect) {
+                        bool fStale = false;
+                        if (!ConnectSubtreeIndex(batch, db, block, pindex, fStale)) {
+                            return false;
+                        }
+                        // The chain was reorganized past the parent since it
+                        // was picked; the next step walks the index back.
+                        if (fStale) {
+                            continue;
+                        }
+                    } else {
+                        DisconnectSubtreeIndex(batch, db, pindex);
+                    }
+                    break;
+                case BLOCKFILTER:
+                    if (fConnect) {
+                        if (!ConnectBlockFilterIndex(batch, db, block, blockUndo, pindex)) {
+                            return false;
+                        }
+                    } else {
+                        db.EraseBlockFilter(batch, pindex->GetBlockHash());
+                    }
+                    break;
+                case SUPPLY:
+                    if (fConnect) {
+                        if (!ConnectSupplyIndex(batch, db, block, blockUndo, pindex)) {
+                            return false;
+                        }
+                    } else {
+                        db.EraseSupplyIndex(batch, pindex->nHeight);
+                    }
+                    break;
+            }
+        }
+        if (!db.WriteBlockBatch(batch, pindexNewBest->GetBlockHash())) {
+            return error("%s: failed to write index entries of block %s", __func__, pindex->GetBlockHash().ToString());
+        }
+        LOCK(cs);
+        index->pindexBest = pindexNewBest;
+    }
+    condSync.notify_all();
+
+    if (fConnect && pindex->nHeight % LOG_PROGRESS_INTERVAL == 0) {
+        LogPrintf("%s: indexes at height %d\n", __func__, pindex->nHeight);
+    }
+    return true;
+}
+
+bool CInsightIndex::Sync()
+{
+    bool fSynced = false;
+    while (!fSynced) {
+        if (!SyncStep(fSynced)) {
+            LOCK(cs);
+            fFailed = true;
+            condSync.notify_all();
+            return false;
+        }
+    }
+    LOCK(cs);
+    fCaughtUp = true;
+    return true;
+}
+
+void CInsightIndex::ThreadSync()
+{
+    // Earlier versions wrote the indexes to the block index database. That
+    // space is reclaimed once the indexes here have caught up, as the
+    // transaction index of earlier versions is still used for lookups until
+    // then.
+    bool fEraseLegacy = pblocktree != NULL && pblocktree->HasLegacyIndexes();
+    bool fErasingLegacy = false;
+
+    while (true) {
+        bool fSynced = false;
+        if (!SyncStep(fSynced)) {
+            LogPrintf("%s: the indexes could not be updated; restart with -reindex-insight to rebuild them\n", __func__);
+            LOCK(cs);
+            fFailed = true;
+            condSync.notify_all();
+            return;
+        }
+
+        // One batch at a time, so that the indexes keep following the active
+        // chain meanwhile.
+        if (fSynced && fEraseLegacy) {
+            if (!fErasingLegacy) {
+                LogPrintf("%s: erasing the indexes of earlier versions from the block index database\n", __func__);
+                LOCK(cs);
+                fLegacyTxIndex = false;
+                fErasingLegacy = true;
+            }
+            bool fDone = false;
+            if (!pblocktree->EraseLegacyIndexes(LEGACY_ERASE_BATCH_SIZE, fDone)) {
+                LogPrintf("%s: failed to erase the indexes of earlier versions\n", __func__);
+                fEraseLegacy = false;
+            } else if (fDone) {
+                fEraseLegacy = false;
+            }
+        }
+
+        WAIT_LOCK(cs, lock);
+        if (fSynced) {
+            if (!fCaughtUp) {
+                LogPrintf("%s: indexes are synced to the active chain\n", __func__);
+                fCaughtUp = true;
+                condSync.notify_all();
+            }
+            // UpdatedBlockTip is not signalled during initial block
+            // download, so the active chain is also polled.
+            if (!fWakeUp && !fInterrupt && !fEraseLegacy) {
+                condSync.wait_for(lock, std::chrono::seconds(1));
+            }
+            fWakeUp = false;
+        }
+        if (fInterrupt) return;
+    }
+}
+
+void CInsightIndex::UpdatedBlockTip(const CBlockIndex *pindex, const CBlock *pblock)
+{
+    LOCK(cs);
+    fWakeUp = true;
+    condSync.notify_all();
+}
+
+void CInsightIndex::Start()
+{
+    assert(!threadSync.joinable());
+    threadSync = std::thread(&TraceThread<std::function<void()>>, "insightindex", std::function<void()>([this] { ThreadSync(); }));
+}
+
+void CInsightIndex::Interrupt()
+{
+    LOCK(cs);
+    fInterrupt = true;
+    condSync.notify_all();
+}
+
+void CInsightIndex::Stop()
+{
+    Interrupt();
+    if (threadSync.joinable()) {
+        threadSync.join();
+    }
+}
+
+bool CInsightIndex::BlockUntilSyncedToCurrentChain()
+{
+    AssertLockNotHeld(cs_main);
+    const CBlockIndex* pindexTip;
+    {
+        LOCK(cs_main);
+        pindexTip = chainActive.Tip();
+    }
+    if (pindexTip == nullptr) {
+        return true;
+    }
+
+    WAIT_LOCK(cs, lock);
+    // Building the indexes can take hours, so callers are not held up for
+    // long while that is the case.
+    condSync.wait_for(lock, fCaughtUp ? SYNC_WAIT_TIMEOUT : BUILD_WAIT_TIMEOUT, [&] {
+        return fFailed || fInterrupt || IsSyncedTo(pindexTip);
+    });
+    return !fFailed && IsSyncedTo(pindexTip);
+}
+
+bool CInsightIndex::HasBlock(const CBlockIndex* pindex) const
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs);
+    return IsSyncedTo(pindex);
+}
+
+std::vector<CIndexSummary> CInsightIndex::GetSummaries() const
+{
+    std::vector<CIndexSummary> vSummaries;
+    LOCK2(cs_main, cs);
+    for (const Index& index : vIndexes) {
+        CIndexSummary summary;
+        summary.name = GetName(index.type);
+        summary.fSynced = index.pindexBest != nullptr && index.pindexBest == chainActive.Tip();
+        summary.nBestHeight = index.pindexBest ? index.pindexBest->nHeight : -1;
+        vSummaries.push_back(summary);
+    }
+    return vSummaries;
+}
+
+bool CInsightIndex::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos)
+{
+    CInsightIndexDB* db = GetDB(TX);
+    if (db == nullptr) {
+        return false;
+    }
+    if (db->ReadTxIndex(txid, pos)) {
+        return true;
+    }
+    LOCK(cs);
+    return fLegacyTxIndex && pblocktree->ReadLegacyTxIndex(txid, pos);
+}
+
+bool CInsightIndex::ReadAddressIndex(uint160 addressHash, int type, std::vector<CAddressIndexDbEntry> &addressIndex, int start, int end)
+{
+    CInsightIndexDB* db = GetDB(ADDRESS);
+    return db != nullptr && db->ReadAddressIndex(addressHash, type, addressIndex, start, end);
+}
+
+bool CInsightIndex::ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &vect)
+{
+    CInsightIndexDB* db = GetDB(ADDRESS);
+    return db != nullptr && db->ReadAddressUnspentIndex(addressHash, type, vect);
+}
+
+bool CInsightIndex::ForEachAddressIndex(uint160 addressHash, int type, int start, int end, const CAddressIndexKey *pFrom, const AddressIndexVisitor &visit)
+{
+    CInsightIndexDB* db = GetDB(ADDRESS);
+    return db != nullptr && db->ForEachAddressIndex(addressHash, type, start, end, pFrom, visit);
+}
+
+bool CInsightIndex::ForEachAddressUnspentIndex(uint160 addressHash, int type, const CAddressUnspentKey *pFrom, const AddressUnspentVisitor &visit)
+{
+    CInsightIndexDB* db = GetDB(ADDRESS);
+    return db != nullptr && db->ForEachAddressUnspentIndex(addressHash, type, pFrom, visit);
+}
+
+bool CInsightIndex::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value)
+{
+    CInsightIndexDB* db = GetDB(ADDRESS);
+    if (db == nullptr || !fAddressBalances) {
+        return false;
+    }
+    // An address without entries has no balance record.
+    if (!db->ReadAddressBalance(addressHash, type, value)) {
+        value.SetNull();
+    }
+    return true;
+}
+
+bool CInsightIndex::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
+{
+    CInsightIndexDB* db = GetDB(SPENT);
+    return db != nullptr && db->ReadSpentIndex(key, value);
+}
+
+bool CInsightIndex::ReadTimestampIndex(unsigned int high, unsigned int low,
+    const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &vect)
+{
+    CInsightIndexDB* db = GetDB(TIMESTAMP);
+    return db != nullptr && db->ReadTimestampIndex(high, low, fActiveOnly, vect);
+}
+
+bool CInsightIndex::ReadSubtreeIndex(ShieldedType type, uint32_t nStart, uint32_t nLimit, std::vector<CSubtreeIndexValue> &vect)
+{
+    CInsightIndexDB* db = GetDB(SUBTREE);
+    return db != nullptr && db->ReadSubtreeIndex(type, nStart, nLimit, vect);
+}
+
+bool CInsightIndex::ReadBlockFilter(const uint256 &hash, CBlockFilterIndexValue &value)
+{
+    CInsightIndexDB* db = GetDB(BLOCKFILTER);
+    return db != nullptr && db->ReadBlockFilter(hash, value);
+}
+
+bool CInsightIndex::ReadSupplyIndex(int nStart, int nEnd, std::vector<std::pair<int, CSupplyIndexValue>> &vect)
+{
+    CInsightIndexDB* db = GetDB(SUPPLY);
+    return db != nullptr && db->ReadSupplyIndex(nStart, nEnd, vect);
+}
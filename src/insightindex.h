@@ -0,0 +1,193 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_INSIGHTINDEX_H
+#define ZCASH_INSIGHTINDEX_H
+
+#include "sync.h"
+#include "txdb.h"
+#include "validationinterface.h"
+
+#include <condition_variable>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class CBlock;
+class CBlockIndex;
+class CBlockUndo;
+
+/** The state of one index, as reported by the getindexinfo RPC method. */
+struct CIndexSummary {
+    std::string name;
+    bool fSynced;
+    //! -1 if the index is empty.
+    int nBestHeight;
+};
+
+/**
+ * Maintains the transaction index (-txindex), the insight explorer indexes
+ * (address, spent and timestamp) used by -insightexplorer and -lightwalletd,
+ * the index of note commitment subtree roots used by -lightwalletd, the
+ * compact block filters of -blockfilterindex, and the value pools at each
+ * height of -supplyindex.
+ *
+ * Each index is kept in its own CInsightIndexDB, with its own cache budget,
+ * and is written by a background thread that follows the active chain from
+ * the block and undo data on disk, so that connecting a block never waits for
+ * the index writes. The entries of a block are written in one batch together
+ * with the block the index is then synced to. After a crash, an index resumes
+ * from the last block it recorded, disconnecting blocks that are no longer in
+ * the active chain, and an index that cannot be recovered can be rebuilt with
+ * -reindex-insight without touching the block index or the chain state.
+ *
+ * The index lags behind the tip by the time it takes to write a block; RPC
+ * methods call BlockUntilSyncedToCurrentChain() (before taking cs_main)
+ * to observe the entries of the blocks connected so far.
+ */
+class CInsightIndex : public CValidationInterface
+{
+private:
+    enum IndexType {
+        TX,
+        ADDRESS,
+        SPENT,
+        TIMESTAMP,
+        SUBTREE,
+        BLOCKFILTER,
+        SUPPLY,
+    };
+
+    struct Index {
+        IndexType type;
+        std::unique_ptr<CInsightIndexDB> db;
+        //! The block the index is synced to, or null if it is empty.
+        const CBlockIndex* pindexBest;
+
+        Index(IndexType typeIn, CInsightIndexDB* dbIn) : type(typeIn), db(dbIn), pindexBest(nullptr) {}
+    };
+
+    //! The indexes that are enabled; fixed at construction.
+    std::vector<Index> vIndexes;
+    //! Whether the address index keeps the balances of the addresses; fixed
+    //! by Init().
+    bool fAddressBalances;
+
+    //! Guards the best blocks of the indexes and the state below.
+    mutable Mutex cs;
+    std::condition_variable condSync;
+    bool fWakeUp;
+    bool fInterrupt;
+    //! Whether the indexes have caught up with the active chain once.
+    bool fCaughtUp;
+    //! Set if an index could not be updated; it then stays where it is.
+    bool fFailed;
+    //! Whether transactions missing from the transaction index are looked up
+    //! in the one earlier versions kept in the block index database, until
+    //! this one has caught up and that one is erased.
+    bool fLegacyTxIndex;
+
+    std::thread threadSync;
+
+    static const char* GetName(IndexType type);
+    CInsightIndexDB* GetDB(IndexType type) const;
+    bool IsSyncedTo(const CBlockIndex* pindex) const;
+
+    void ConnectTxIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockIndex* pindex);
+    void ConnectAddressIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex);
+    void DisconnectAddressIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex);
+    //! Add the address index entries of a block to the balances, or take
+    //! them off if fDisconnect is set.
+    void UpdateAddressBalances(CDBBatch& batch, CInsightIndexDB& db, const std::vector<CAddressIndexDbEntry>& addressIndex, bool fDisconnect);
+    void ConnectSpentIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex);
+    void DisconnectSpentIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block);
+    void ConnectTimestampIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlockIndex* pindex);
+    //! Sets fStale, writing nothing, if the parent of the block is no longer
+    //! in the active chain, as the note commitment trees are then unknown.
+    bool ConnectSubtreeIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockIndex* pindex, bool& fStale);
+    void DisconnectSubtreeIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlockIndex* pindex);
+    bool ConnectBlockFilterIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex);
+    bool ConnectSupplyIndex(CDBBatch& batch, CInsightIndexDB& db, const CBlock& block, const CBlockUndo& blockUndo, const CBlockIndex* pindex);
+
+    //! Connect the next block of the active chain to the indexes furthest
+    //! behind, or disconnect the best block of an index that is on a fork.
+    //! Sets fSynced when every index is synced to the tip instead.
+    bool SyncStep(bool& fSynced);
+    void ThreadSync();
+
+protected:
+    void UpdatedBlockTip(const CBlockIndex *pindex, const CBlock *pblock);
+
+public:
+    //! Opens the indexes that fTxIndex, fAddressIndex, fSpentIndex,
+    //! fTimestampIndex, fSubtreeIndex, fBlockFilterIndex and fSupplyIndex
+    //! enable, wiping them first if fWipe is set.
+    CInsightIndex(size_t nTxCache, size_t nAddressCache, size_t nSpentCache, size_t nTimestampCache, size_t nSubtreeCache, size_t nBlockFilterCache, size_t nSupplyCache, bool fMemory = false, bool fWipe = false);
+    ~CInsightIndex();
+
+    //! Look up the blocks the indexes are synced to. Must be called after the
+    //! block index has been loaded. Returns false if an index refers to a
+    //! block that is not known, in which case it has to be rebuilt.
+    bool Init(std::string& strError);
+
+    //! Start the thread that keeps the indexes synced to the active chain.
+    void Start();
+    void Interrupt();
+    void Stop();
+
+    //! Bring the indexes up to date with the active chain on the calling
+    //! thread, for callers that did not Start() the background thread.
+    bool Sync();
+
+    //! Wait until the indexes contain the blocks of the active chain as of
+    //! this call. Returns false if they do not get there within a timeout
+    //! (which is short while they are still being built), or have failed.
+    //! Must not be called with cs_main held.
+    bool BlockUntilSyncedToCurrentChain();
+
+    //! Whether every index includes the block pindex of the active chain.
+    //! Requires cs_main.
+    bool HasBlock(const CBlockIndex* pindex) const;
+
+    //! The best block of each index, and whether it is the tip of the
+    //! active chain.
+    std::vector<CIndexSummary> GetSummaries() const;
+
+    bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
+
+    // START insightexplorer
+    bool ReadAddressIndex(uint160 addressHash, int type, std::vector<CAddressIndexDbEntry> &addressIndex, int start = 0, int end = 0);
+    bool ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &vect);
+    bool ForEachAddressIndex(uint160 addressHash, int type, int start, int end, const CAddressIndexKey *pFrom, const AddressIndexVisitor &visit);
+    bool ForEachAddressUnspentIndex(uint160 addressHash, int type, const CAddressUnspentKey *pFrom, const AddressUnspentVisitor &visit);
+    //! Returns false if the balances are not kept, as the address index was
+    //! built by an earlier version; -reindex-insight rebuilds it with them.
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
+    bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
+    bool ReadTimestampIndex(unsigned int high, unsigned int low,
+            const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &vect);
+    // END insightexplorer
+
+    //! The roots of up to nLimit complete subtrees of the Sapling or Orchard
+    //! note commitment tree (see SUBTREE_INDEX_HEIGHT), from the one with
+    //! index nStart, and the blocks that completed them. Returns false if the
+    //! subtree index is not enabled.
+    bool ReadSubtreeIndex(ShieldedType type, uint32_t nStart, uint32_t nLimit, std::vector<CSubtreeIndexValue> &vect);
+
+    //! The basic filter of a block, with its hash and header. Returns false
+    //! if the block filter index is not enabled or does not have the block
+    //! (yet).
+    bool ReadBlockFilter(const uint256 &hash, CBlockFilterIndexValue &value);
+
+    //! The value pools at the heights from nStart to nEnd that the supply
+    //! index has. Returns false if the supply index is not enabled.
+    bool ReadSupplyIndex(int nStart, int nEnd, std::vector<std::pair<int, CSupplyIndexValue>> &vect);
+};
+
+/** The transaction and insight explorer indexes, if -txindex is enabled. */
+extern CInsightIndex* pinsightindex;
+
+#endif // ZCASH_INSIGHTINDEX_H
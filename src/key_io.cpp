@@ -15,6 +15,8 @@
 #include <assert.h>
 #include <string.h>
 #include <algorithm>
+#include <map>
+#include <mutex>
 #include <variant>
 #include "util/match.h"
 
@@ -253,6 +255,44 @@ public:
 const size_t ConvertedSaplingPaymentAddressSize = ((32 + 11) * 8 + 4) / 5;
 const size_t ConvertedSaplingExtendedFullViewingKeySize = (ZIP32_XFVK_SIZE * 8 + 4) / 5;
 const size_t ConvertedSaplingExtendedSpendingKeySize = (ZIP32_XSK_SIZE * 8 + 4) / 5;
+/**
+ * Encoded addresses, by network and address. RPC responses encode the same
+ * few addresses for row after row, and each encoding is a base58check
+ * double-SHA256 or a bech32(m) encoding (with F4Jumble for unified
+ * addresses). When the cache is full it is cleared, which keeps it bounded
+ * without tracking use.
+ */
+template <typename Address>
+class EncodedAddressCache
+{
+    std::mutex mutex;
+    std::map<std::pair<std::string, Address>, std::string> mapEncoded;
+
+public:
+    template <typename Encode>
+    std::string Get(const KeyConstants& keyConstants, const Address& address, Encode encode)
+    {
+        auto key = std::make_pair(keyConstants.NetworkIDString(), address);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = mapEncoded.find(key);
+            if (it != mapEncoded.end()) {
+                return it->second;
+            }
+        }
+        std::string encoded = encode();
+        std::lock_guard<std::mutex> lock(mutex);
+        if (mapEncoded.size() >= ENCODED_ADDRESS_CACHE_SIZE) {
+            mapEncoded.clear();
+        }
+        mapEncoded.emplace(std::move(key), encoded);
+        return encoded;
+    }
+};
+
+EncodedAddressCache<CTxDestination> destinationCache;
+EncodedAddressCache<libzcash::PaymentAddress> paymentAddressCache;
+
 } // namespace
 
 CTxDestination KeyIO::DecodeDestination(const std::string& str) const
@@ -357,7 +397,12 @@ std::string KeyIO::EncodeExtKey(const CExtKey& key) const
 
 std::string KeyIO::EncodeDestination(const CTxDestination& dest) const
 {
-    return std::visit(DestinationEncoder(keyConstants), dest);
+    if (!IsValidDestination(dest)) {
+        return "";
+    }
+    return destinationCache.Get(keyConstants, dest, [&]() {
+        return std::visit(DestinationEncoder(keyConstants), dest);
+    });
 }
 
 bool KeyIO::IsValidDestinationString(const std::string& str) const
@@ -367,7 +412,9 @@ bool KeyIO::IsValidDestinationString(const std::string& str) const
 
 std::string KeyIO::EncodePaymentAddress(const libzcash::PaymentAddress& zaddr) const
 {
-    return std::visit(PaymentAddressEncoder(keyConstants), zaddr);
+    return paymentAddressCache.Get(keyConstants, zaddr, [&]() {
+        return std::visit(PaymentAddressEncoder(keyConstants), zaddr);
+    });
 }
 
 template<typename T1, typename T2>
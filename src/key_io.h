@@ -16,6 +16,9 @@
 #include <vector>
 #include <string>
 
+/** Maximum number of encoded addresses of each kind that KeyIO keeps. */
+static const size_t ENCODED_ADDRESS_CACHE_SIZE = 100000;
+
 class KeyIO {
 private:
     const KeyConstants& keyConstants;
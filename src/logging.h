@@ -18,6 +18,7 @@
 static const bool DEFAULT_LOGTIMEMICROS = false;
 static const bool DEFAULT_LOGIPS        = false;
 static const bool DEFAULT_LOGTIMESTAMPS = true;
+static const int64_t DEFAULT_LOGRATE    = 0;
 extern const char * const DEFAULT_DEBUGLOGFILE;
 
 extern bool fPrintToConsole;
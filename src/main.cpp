@@ -9,6 +9,10 @@
 #include "addrman.h"
 #include "alert.h"
 #include "arith_uint256.h"
+#include "blockencodings.h"
+#include "blockfilter.h"
+#include "blockpack.h"
+#include "diskrecord.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
@@ -19,16 +23,21 @@
 #include "deprecation.h"
 #include "experimental_features.h"
 #include "init.h"
+#include "insightindex.h"
 #include "key_io.h"
+#include "memusage.h"
 #include "merkleblock.h"
 #include "metrics.h"
 #include "net.h"
 #include "policy/policy.h"
 #include "pow.h"
+#include "proof_cache.h"
 #include "reverse_iterator.h"
 #include "txmempool.h"
+#include "txreconciliation.h"
 #include "ui_interface.h"
 #include "undo.h"
+#include "util/mappedfile.h"
 #include "util/system.h"
 #include "util/moneystr.h"
 #include "validationinterface.h"
@@ -38,7 +47,13 @@
 
 #include <algorithm>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
 #include <sstream>
+#include <thread>
+#include <unordered_set>
 #include <variant>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -73,6 +88,8 @@ using namespace std;
 RecursiveMutex cs_main;
 
 BlockMap mapBlockIndex;
+/** The entries of mapBlockIndex. */
+static CBlockIndexArena blockIndexArena;
 CChain chainActive;
 CBlockIndex *pindexBestHeader = NULL;
 static std::atomic<int64_t> nTimeBestReceived(0); // Used only to inform the wallet of when we last received a block
@@ -87,6 +104,9 @@ bool fTxIndex = false;
 bool fAddressIndex = false;     // insightexplorer || lightwalletd
 bool fSpentIndex = false;       // insightexplorer
 bool fTimestampIndex = false;   // insightexplorer
+bool fSubtreeIndex = false;     // lightwalletd
+bool fBlockFilterIndex = false;
+bool fSupplyIndex = false;
 bool fHavePruned = false;
 bool fPruneMode = false;
 int32_t nPreferredTxVersion = DEFAULT_PREFERRED_TX_VERSION;
@@ -94,6 +114,19 @@ bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fCheckBlockIndex = false;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
 bool fIBDSkipTxVerification = DEFAULT_IBD_SKIP_TX_VERIFICATION;
+uint256 hashAssumeValid;
+unsigned int nInboundInventoryInterval = DEFAULT_INBOUND_INVENTORY_INTERVAL;
+unsigned int nOutboundInventoryInterval = DEFAULT_OUTBOUND_INVENTORY_INTERVAL;
+bool fDeferHeaderSolutions = DEFAULT_DEFER_HEADER_SOLUTIONS;
+bool fMmapBlockFiles = DEFAULT_MMAP_BLOCK_FILES;
+bool fPackBlockFiles = DEFAULT_PACK_BLOCK_FILES;
+bool fCompressBlockFiles = DEFAULT_COMPRESS_BLOCK_FILES;
+bool fPipelineBlockConnect = DEFAULT_PIPELINE_BLOCK_CONNECT;
+bool fFastBlockRelay = DEFAULT_FAST_BLOCK_RELAY;
+int nProofBatchBlocks = DEFAULT_PROOF_BATCH_BLOCKS;
+int nBlockPrefetch = DEFAULT_BLOCK_PREFETCH;
+int nMempoolProofBatch = DEFAULT_MEMPOOL_PROOF_BATCH;
+int nBlockServeThreads = DEFAULT_BLOCK_SERVE_THREADS;
 bool fCoinbaseEnforcedShieldingEnabled = true;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
@@ -111,9 +144,21 @@ CTxMemPool mempool(::minRelayTxFee);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    //! Serialized size, counted against the quota of fromPeer.
+    unsigned int nTxSize;
+    //! Position in the order the orphans were received in.
+    uint64_t nSequence;
+};
+/** The orphans received from one peer, so they can be found without a scan of mapOrphanTransactions. */
+struct COrphanPeer {
+    //! Orphan txids by nSequence, oldest first.
+    map<uint64_t, uint256> mapOrphans;
+    size_t nBytes = 0;
 };
 map<uint256, COrphanTx> mapOrphanTransactions GUARDED_BY(cs_main);;
 map<uint256, set<uint256> > mapOrphanTransactionsByPrev GUARDED_BY(cs_main);;
+map<NodeId, COrphanPeer> mapOrphanTransactionsByPeer GUARDED_BY(cs_main);
+static uint64_t nOrphanSequence GUARDED_BY(cs_main) = 0;
 void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
 
 /**
@@ -204,6 +249,8 @@ namespace {
      * missing the data for the block.
      */
     set<CBlockIndex*, CBlockIndexWorkComparator> setBlockIndexCandidates;
+    /** The entries of mapBlockIndex that are not the pprev of any other. */
+    std::unordered_set<const CBlockIndex*> setBlockIndexTips;
     /** Number of nodes with fSyncStarted. */
     int nSyncStarted = 0;
     /** All pairs A->B, where A (or one if its ancestors) misses transactions, but B has transactions.
@@ -230,10 +277,20 @@ namespace {
 
     /**
      * Sources of received blocks, saved to be able to send them reject
-     * messages or ban them when processing happens afterwards. Protected by
-     * cs_main.
+     * messages or ban them when processing happens afterwards, and whether
+     * they may be banned for it: a block received as a compact block may
+     * have been relayed before it was fully validated (see -fastblockrelay),
+     * so its sender is not punished if it fails in ConnectBlock. Protected
+     * by cs_main.
+     */
+    map<uint256, std::pair<NodeId, bool>> mapBlockSource;
+
+    /**
+     * The last block relayed to peers before it was connected
+     * (-fastblockrelay), so that it is not sent to them again once it is.
+     * Protected by cs_main.
      */
-    map<uint256, NodeId> mapBlockSource;
+    const CBlockIndex* pindexFastRelayed = NULL;
 
     /**
      * Filter for transactions that were recently rejected by
@@ -290,6 +347,24 @@ namespace {
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /**
+     * Inbound peers all announce transactions at the same times, so that
+     * connecting many times to us does not reveal more about the origin of a
+     * transaction than connecting once. When they do, the transactions to
+     * announce are looked up in the mempool and sorted once, in a batch that
+     * each of those peers announces its own transactions from. Protected by
+     * cs_main.
+     */
+    int64_t nNextInvSendInbound = 0;
+    struct TxAnnouncementBatch {
+        //! The announcement time that the batch is for.
+        int64_t nTime = 0;
+        //! The transactions in the order they are announced in, each with its
+        //! mempool entry, whose tx is null if it should not be announced.
+        std::vector<std::pair<uint256, TxMempoolInfo>> vTx;
+    };
+    TxAnnouncementBatch inboundAnnouncements;
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -330,6 +405,8 @@ struct CNodeState {
     uint256 hashLastUnknownBlock;
     //! The last full block we both have.
     CBlockIndex *pindexLastCommonBlock;
+    //! The best header we have sent our peer.
+    CBlockIndex *pindexBestHeaderSent;
     //! Whether we've started headers synchronization with this peer.
     bool fSyncStarted;
     //! Since when we're stalling block download progress (in microseconds), or 0.
@@ -337,8 +414,21 @@ struct CNodeState {
     list<QueuedBlock> vBlocksInFlight;
     int nBlocksInFlight;
     int nBlocksInFlightValidHeaders;
+    //! Rate at which this peer delivers the blocks we request (in bytes per
+    //! second), or 0 until one arrives.
+    double dDownloadRate;
+    //! Average size of the blocks this peer delivered.
+    double dAverageBlockSize;
+    //! When this peer last delivered a block we requested (in microseconds).
+    int64_t nLastBlockDelivery;
     //! Whether we consider this a preferred download peer.
     bool fPreferredDownload;
+    //! Whether this peer wants invs or headers (when possible) for block announcements.
+    bool fPreferHeaders;
+    //! The block we asked this peer for the missing transactions of with a
+    //! getblocktxn message, with those found in our mempool filled in.
+    std::shared_ptr<PartiallyDownloadedBlock> partialBlock;
+    uint256 hashPartialBlock;
 
     CNodeState() {
         fCurrentlyConnected = false;
@@ -347,17 +437,25 @@ struct CNodeState {
         pindexBestKnownBlock = NULL;
         hashLastUnknownBlock.SetNull();
         pindexLastCommonBlock = NULL;
+        pindexBestHeaderSent = NULL;
         fSyncStarted = false;
         nStallingSince = 0;
         nBlocksInFlight = 0;
         nBlocksInFlightValidHeaders = 0;
+        dDownloadRate = 0;
+        dAverageBlockSize = 0;
+        nLastBlockDelivery = 0;
         fPreferredDownload = false;
+        fPreferHeaders = false;
     }
 };
 
 /** Map maintaining per-node state. Requires cs_main. */
 map<NodeId, CNodeState> mapNodeState;
 
+/** The peers we have asked to announce new blocks with cmpctblock messages, least recently useful first. Requires cs_main. */
+std::list<NodeId> lNodesAnnouncingCompactBlocks;
+
 // Requires cs_main.
 CNodeState *State(NodeId pnode) {
     map<NodeId, CNodeState>::iterator it = mapNodeState.find(pnode);
@@ -409,11 +507,47 @@ void FinalizeNode(NodeId nodeid) {
     for (const QueuedBlock& entry : state->vBlocksInFlight)
         mapBlocksInFlight.erase(entry.hash);
     EraseOrphansFor(nodeid);
+    lNodesAnnouncingCompactBlocks.remove(nodeid);
     nPreferredDownload -= state->fPreferredDownload;
+    txReconciliation.ForgetPeer(nodeid);
 
     mapNodeState.erase(nodeid);
 }
 
+// Requires cs_main.
+// Update the download rate of a peer that delivered a block we requested
+// from it. Blocks are sent one after the other, so a block took from when it
+// was requested or the previous block arrived, whichever is later.
+void RecordBlockDelivery(NodeId nodeid, const uint256& hash, size_t nBytes) {
+    map<uint256, pair<NodeId, list<QueuedBlock>::iterator> >::iterator itInFlight = mapBlocksInFlight.find(hash);
+    if (itInFlight == mapBlocksInFlight.end() || itInFlight->second.first != nodeid)
+        return;
+    CNodeState *state = State(nodeid);
+    int64_t nNow = GetTimeMicros();
+    int64_t nStart = std::max(itInFlight->second.second->nTime, state->nLastBlockDelivery);
+    double dRate = nBytes * 1000000.0 / std::max<int64_t>(nNow - nStart, 1000);
+    if (state->dDownloadRate == 0) {
+        state->dDownloadRate = dRate;
+        state->dAverageBlockSize = nBytes;
+    } else {
+        state->dDownloadRate = 0.75 * state->dDownloadRate + 0.25 * dRate;
+        state->dAverageBlockSize = 0.75 * state->dAverageBlockSize + 0.25 * nBytes;
+    }
+    state->nLastBlockDelivery = nNow;
+}
+
+// Requires cs_main.
+// The number of blocks to keep requested from a peer: enough for
+// BLOCK_DOWNLOAD_QUEUE_SECONDS at its measured download rate, so that slow
+// peers hold fewer blocks of the download window.
+int GetBlocksInTransitLimit(const CNodeState *state) {
+    if (state->dDownloadRate == 0)
+        return MAX_BLOCKS_IN_TRANSIT_PER_PEER;
+    double dBlocks = state->dDownloadRate * BLOCK_DOWNLOAD_QUEUE_SECONDS / std::max(state->dAverageBlockSize, 1.0);
+    return std::max(MIN_BLOCKS_IN_TRANSIT_PER_PEER,
+                    (int)std::min<double>(dBlocks, MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER));
+}
+
 // Requires cs_main.
 // Returns a bool indicating whether we requested this block.
 bool MarkBlockAsReceived(const uint256& hash) {
@@ -425,6 +559,8 @@ bool MarkBlockAsReceived(const uint256& hash) {
         state->vBlocksInFlight.erase(itInFlight->second.second);
         state->nBlocksInFlight--;
         state->nStallingSince = 0;
+        if (state->partialBlock && state->hashPartialBlock == hash)
+            state->partialBlock.reset();
         mapBlocksInFlight.erase(itInFlight);
         return true;
     }
@@ -449,6 +585,36 @@ void MarkBlockAsInFlight(NodeId nodeid, const uint256& hash, const Consensus::Pa
     mapBlocksInFlight[hash] = std::make_pair(nodeid, it);
 }
 
+// Requires cs_main.
+// Ask a peer that just gave us a new tip to announce its next blocks with
+// cmpctblock messages, so that they reach us without an inv/getdata round
+// trip. Only the peers that did so most recently are kept in this mode.
+void MaybeSetPeerAsAnnouncingCompactBlocks(CNode* pfrom) {
+    if (!pfrom->fSupportsCompactBlocks)
+        return;
+    NodeId nodeid = pfrom->GetId();
+    for (std::list<NodeId>::iterator it = lNodesAnnouncingCompactBlocks.begin(); it != lNodesAnnouncingCompactBlocks.end(); ++it) {
+        if (*it == nodeid) {
+            lNodesAnnouncingCompactBlocks.erase(it);
+            lNodesAnnouncingCompactBlocks.push_back(nodeid);
+            return;
+        }
+    }
+    if (lNodesAnnouncingCompactBlocks.size() >= MAX_CMPCTBLOCK_ANNOUNCING_PEERS) {
+        NodeId evicted = lNodesAnnouncingCompactBlocks.front();
+        lNodesAnnouncingCompactBlocks.pop_front();
+        LOCK(cs_vNodes);
+        for (CNode* pnode : vNodes) {
+            if (pnode->GetId() == evicted) {
+                pnode->PushMessage("sendcmpct", false, CMPCTBLOCKS_VERSION);
+                break;
+            }
+        }
+    }
+    pfrom->PushMessage("sendcmpct", true, CMPCTBLOCKS_VERSION);
+    lNodesAnnouncingCompactBlocks.push_back(nodeid);
+}
+
 /** Check whether the last unknown block a peer advertized is not yet known. */
 void ProcessBlockAvailability(NodeId nodeid) {
     CNodeState *state = State(nodeid);
@@ -482,6 +648,17 @@ void UpdateBlockAvailability(NodeId nodeid, const uint256 &hash) {
     }
 }
 
+// Requires cs_main.
+/** Whether a peer has a header, by what it has announced to us or we have sent it. */
+bool PeerHasHeader(CNodeState *state, const CBlockIndex *pindex)
+{
+    if (state->pindexBestKnownBlock && pindex == state->pindexBestKnownBlock->GetAncestor(pindex->nHeight))
+        return true;
+    if (state->pindexBestHeaderSent && pindex == state->pindexBestHeaderSent->GetAncestor(pindex->nHeight))
+        return true;
+    return false;
+}
+
 /** Find the last common ancestor two blocks have.
  *  Both pa and pb must be non-NULL. */
 CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
@@ -502,8 +679,9 @@ CBlockIndex* LastCommonAncestor(CBlockIndex* pa, CBlockIndex* pb) {
 }
 
 /** Update pindexLastCommonBlock and add not-in-flight missing successors to vBlocks, until it has
- *  at most count entries. */
-void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller) {
+ *  at most count entries. If nothing can be fetched because of the download window, nodeStaller is
+ *  the peer that the first block of the window is in flight from, and pindexStalled that block. */
+void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBlockIndex*>& vBlocks, NodeId& nodeStaller, CBlockIndex*& pindexStalled) {
     if (count == 0)
         return;
 
@@ -539,6 +717,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
     int nWindowEnd = state->pindexLastCommonBlock->nHeight + BLOCK_DOWNLOAD_WINDOW;
     int nMaxHeight = std::min<int>(state->pindexBestKnownBlock->nHeight, nWindowEnd + 1);
     NodeId waitingfor = -1;
+    CBlockIndex *pindexWaitingFor = NULL;
     while (pindexWalk->nHeight < nMaxHeight) {
         // Read up to 128 (or more, if more blocks than that are needed) successors of pindexWalk (towards
         // pindexBestKnownBlock) into vToFetch. We fetch 128, because CBlockIndex::GetAncestor may be as expensive
@@ -570,6 +749,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
                     if (vBlocks.size() == 0 && waitingfor != nodeid) {
                         // We aren't able to fetch anything, but we would be if the download window was one larger.
                         nodeStaller = waitingfor;
+                        pindexStalled = pindexWaitingFor;
                     }
                     return;
                 }
@@ -580,6 +760,7 @@ void FindNextBlocksToDownload(NodeId nodeid, unsigned int count, std::vector<CBl
             } else if (waitingfor == -1) {
                 // This is the first already-in-flight block.
                 waitingfor = mapBlocksInFlight[pindex->GetBlockHash()].first;
+                pindexWaitingFor = pindex;
             }
         }
     }
@@ -599,6 +780,8 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats) {
         if (queue.pindex)
             stats.vHeightInFlight.push_back(queue.pindex->nHeight);
     }
+    stats.dDownloadRate = state->dDownloadRate;
+    stats.nBlocksInTransitLimit = GetBlocksInTransitLimit(state);
     return true;
 }
 
@@ -639,6 +822,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsViewFlushLayer *pcoinsFlushLayer = NULL;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -646,6 +830,8 @@ CBlockTreeDB *pblocktree = NULL;
 // mapOrphanTransactions
 //
 
+void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
+
 bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
 {
     // See doc/book/src/design/p2p-data-propagation.md for why mapOrphanTransactions uses
@@ -662,14 +848,29 @@ bool AddOrphanTx(const CTransaction& tx, NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(c
     // 10,000 orphans, each of which is at most 5,000 bytes big is
     // at most 500 megabytes of orphans:
     unsigned int sz = GetSerializeSize(tx, SER_NETWORK, tx.nVersion);
-    if (sz > 5000)
+    if (sz > MAX_ORPHAN_TX_SIZE)
     {
         LogPrint("mempool", "ignoring large orphan tx (size: %u, hash: %s)\n", sz, hash.ToString());
         return false;
     }
 
-    mapOrphanTransactions[hash].tx = tx;
-    mapOrphanTransactions[hash].fromPeer = peer;
+    // A peer that is over its quota makes room with its own oldest orphans,
+    // so that it cannot push the orphans of other peers out of the pool.
+    COrphanPeer& orphanPeer = mapOrphanTransactionsByPeer[peer];
+    int nEvicted = 0;
+    while (!orphanPeer.mapOrphans.empty() && orphanPeer.nBytes + sz > MAX_PEER_ORPHAN_TX_BYTES) {
+        EraseOrphanTx(orphanPeer.mapOrphans.begin()->second);
+        ++nEvicted;
+    }
+    if (nEvicted > 0) LogPrint("mempool", "Evicted %d orphan tx from peer %d over its quota\n", nEvicted, peer);
+
+    COrphanTx& orphan = mapOrphanTransactions[hash];
+    orphan.tx = tx;
+    orphan.fromPeer = peer;
+    orphan.nTxSize = sz;
+    orphan.nSequence = nOrphanSequence++;
+    orphanPeer.mapOrphans.emplace(orphan.nSequence, hash);
+    orphanPeer.nBytes += sz;
     for (const CTxIn& txin : tx.vin)
         mapOrphanTransactionsByPrev[txin.prevout.hash].insert(hash);
 
@@ -692,23 +893,29 @@ void static EraseOrphanTx(uint256 hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
         if (itPrev->second.empty())
             mapOrphanTransactionsByPrev.erase(itPrev);
     }
+    map<NodeId, COrphanPeer>::iterator itPeer = mapOrphanTransactionsByPeer.find(it->second.fromPeer);
+    if (itPeer != mapOrphanTransactionsByPeer.end()) {
+        itPeer->second.mapOrphans.erase(it->second.nSequence);
+        itPeer->second.nBytes -= it->second.nTxSize;
+        if (itPeer->second.mapOrphans.empty())
+            mapOrphanTransactionsByPeer.erase(itPeer);
+    }
     mapOrphanTransactions.erase(it);
 }
 
 void EraseOrphansFor(NodeId peer)
 {
-    int nErased = 0;
-    map<uint256, COrphanTx>::iterator iter = mapOrphanTransactions.begin();
-    while (iter != mapOrphanTransactions.end())
-    {
-        map<uint256, COrphanTx>::iterator maybeErase = iter++; // increment to avoid iterator becoming invalid
-        if (maybeErase->second.fromPeer == peer)
-        {
-            EraseOrphanTx(maybeErase->second.tx.GetHash());
-            ++nErased;
-        }
-    }
-    if (nErased > 0) LogPrint("mempool", "Erased %d orphan tx from peer %d\n", nErased, peer);
+    map<NodeId, COrphanPeer>::iterator itPeer = mapOrphanTransactionsByPeer.find(peer);
+    if (itPeer == mapOrphanTransactionsByPeer.end())
+        return;
+    // Erasing the last orphan of the peer also erases its entry.
+    std::vector<uint256> vErase;
+    vErase.reserve(itPeer->second.mapOrphans.size());
+    for (const auto& entry : itPeer->second.mapOrphans)
+        vErase.push_back(entry.second);
+    for (const uint256& hash : vErase)
+        EraseOrphanTx(hash);
+    LogPrint("mempool", "Erased %d orphan tx from peer %d\n", vErase.size(), peer);
 }
 
 
@@ -717,12 +924,15 @@ unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans) EXCLUSIVE_LOCKS_REQUIRE
     unsigned int nEvicted = 0;
     while (mapOrphanTransactions.size() > nMaxOrphans)
     {
-        // Evict a random orphan:
-        uint256 randomhash = GetRandHash();
-        map<uint256, COrphanTx>::iterator it = mapOrphanTransactions.lower_bound(randomhash);
-        if (it == mapOrphanTransactions.end())
-            it = mapOrphanTransactions.begin();
-        EraseOrphanTx(it->first);
+        // Evict the oldest orphan of the peer whose orphans take up the most
+        // space; there are at most as many peers as connections to scan.
+        map<NodeId, COrphanPeer>::const_iterator itLargest = mapOrphanTransactionsByPeer.begin();
+        for (auto it = mapOrphanTransactionsByPeer.begin(); it != mapOrphanTransactionsByPeer.end(); ++it) {
+            if (it->second.nBytes > itLargest->second.nBytes)
+                itLargest = it;
+        }
+        assert(itLargest != mapOrphanTransactionsByPeer.end());
+        EraseOrphanTx(itLargest->second.mapOrphans.begin()->second);
         ++nEvicted;
     }
     return nEvicted;
@@ -844,7 +1054,7 @@ bool ContextualCheckTransaction(
     auto dosLevelPotentiallyRelaxing = isMined ? DOS_LEVEL_BLOCK : (
         isInitBlockDownload(chainparams.GetConsensus()) ? 0 : DOS_LEVEL_MEMPOOL);
 
-    auto consensus = chainparams.GetConsensus();
+    const Consensus::Params& consensus = chainparams.GetConsensus();
     auto consensusBranchId = CurrentEpochBranchId(nHeight, consensus);
 
     bool overwinterActive = consensus.NetworkUpgradeActive(nHeight, Consensus::UPGRADE_OVERWINTER);
@@ -966,10 +1176,14 @@ bool ContextualCheckTransaction(
     // ZIP 207 consensus funding streams active at the current block height. To avoid
     // double-decrypting, we detect any shielded funding streams during the Heartwood
     // consensus check. If Canopy is not yet active, fundingStreamElements will be empty.
-    std::set<Consensus::FundingStreamElement> fundingStreamElements = Consensus::GetActiveFundingStreamElements(
-        nHeight,
-        GetBlockSubsidy(nHeight, consensus),
-        consensus);
+    // Only coinbase transactions look at them.
+    std::set<Consensus::FundingStreamElement> fundingStreamElements;
+    if (tx.IsCoinBase()) {
+        fundingStreamElements = Consensus::GetActiveFundingStreamElements(
+            nHeight,
+            GetBlockSubsidy(nHeight, consensus),
+            consensus);
+    }
 
     // Rules that apply to Heartwood and later:
     if (heartwoodActive) {
@@ -1240,6 +1454,124 @@ bool ContextualCheckTransaction(
     return true;
 }
 
+enum class SaplingBundleAssembly {
+    Ok,
+    InvalidSpend,
+    InvalidOutput,
+};
+
+/**
+ * Assembles the Sapling bundle of a transaction for passing to
+ * `sapling::BatchValidator::check_bundle`. `bundleRet` is only set if this
+ * returns `SaplingBundleAssembly::Ok`.
+ */
+static SaplingBundleAssembly AssembleSaplingBundle(
+    const CTransaction& tx,
+    std::optional<rust::Box<sapling::Bundle>>& bundleRet)
+{
+    auto assembler = sapling::new_bundle_assembler();
+
+    for (const SpendDescription &spend : tx.vShieldedSpend) {
+        if (!assembler->add_spend(
+            spend.cv.GetRawBytes(),
+            spend.anchor.GetRawBytes(),
+            spend.nullifier.GetRawBytes(),
+            spend.rk.GetRawBytes(),
+            spend.zkproof,
+            spend.spendAuthSig
+        )) {
+            return SaplingBundleAssembly::InvalidSpend;
+        }
+    }
+
+    for (const OutputDescription &output : tx.vShieldedOutput) {
+        if (!assembler->add_output(
+            output.cv.GetRawBytes(),
+            output.cmu.GetRawBytes(),
+            output.ephemeralKey.GetRawBytes(),
+            output.encCiphertext,
+            output.outCiphertext,
+            output.zkproof
+        )) {
+            return SaplingBundleAssembly::InvalidOutput;
+        }
+    }
+
+    bundleRet.emplace(sapling::finish_bundle_assembly(
+        std::move(assembler),
+        tx.GetValueBalanceSapling(),
+        tx.bindingSig));
+    return SaplingBundleAssembly::Ok;
+}
+
+/**
+ * Check the JoinSplit signature of a transaction against the given signature
+ * hash, reporting whether it was instead made for the previous epoch.
+ */
+static bool CheckJoinSplitSignature(
+        const CTransaction& tx,
+        const uint256& dataToBeSigned,
+        const uint256& prevDataToBeSigned,
+        CValidationState &state,
+        int dosLevel,
+        uint32_t consensusBranchId,
+        uint32_t prevConsensusBranchId)
+{
+    if (!ed25519_verify(&tx.joinSplitPubKey, &tx.joinSplitSig, dataToBeSigned.begin(), 32)) {
+        // Check whether the failure was caused by an outdated consensus
+        // branch ID; if so, inform the node that they need to upgrade. We
+        // only check the previous epoch's branch ID, on the assumption that
+        // users creating transactions will notice their transactions
+        // failing before a second network upgrade occurs.
+        if (ed25519_verify(&tx.joinSplitPubKey,
+                           &tx.joinSplitSig,
+                           prevDataToBeSigned.begin(), 32)) {
+            return state.DoS(
+                dosLevel, false, REJECT_INVALID, strprintf(
+                    "old-consensus-branch-id (Expected %s, found %s)",
+                    HexInt(consensusBranchId),
+                    HexInt(prevConsensusBranchId)));
+        }
+        return state.DoS(
+            dosLevel,
+            error("ContextualCheckShieldedInputs(): invalid joinsplit signature"),
+            REJECT_INVALID, "bad-txns-invalid-joinsplit-signature");
+    }
+    return true;
+}
+
+/**
+ * Check one at a time, in order, the JoinSplit signatures of the given
+ * transactions of a block, whose batch validation failed. The first invalid
+ * signature is reported as a check without batching would report it.
+ */
+static bool CheckJoinSplitSignatures(
+        const CBlock& block,
+        const std::vector<size_t>& txIndices,
+        const std::vector<std::shared_ptr<const PrecomputedTransactionData>>& txdata,
+        CValidationState &state,
+        uint32_t consensusBranchId,
+        const Consensus::Params& consensus)
+{
+    auto prevConsensusBranchId = PrevEpochBranchId(consensusBranchId, consensus);
+    for (size_t i : txIndices) {
+        const CTransaction &tx = block.vtx[i];
+        uint256 dataToBeSigned = SignatureHash(
+            CScript(), tx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId, *txdata[i]);
+        uint256 prevDataToBeSigned = SignatureHash(
+            CScript(), tx, NOT_AN_INPUT, SIGHASH_ALL, 0, prevConsensusBranchId, *txdata[i]);
+        if (!CheckJoinSplitSignature(tx, dataToBeSigned, prevDataToBeSigned, state, 100,
+                                     consensusBranchId, prevConsensusBranchId))
+        {
+            return error(
+                "ConnectBlock(): JoinSplit signature of %s is invalid: %s",
+                tx.GetHash().ToString(),
+                FormatStateMessage(state));
+        }
+    }
+    return true;
+}
+
 bool ContextualCheckShieldedInputs(
         const CTransaction& tx,
         const PrecomputedTransactionData& txdata,
@@ -1251,7 +1583,8 @@ bool ContextualCheckShieldedInputs(
         uint32_t consensusBranchId,
         bool nu5Active,
         bool isMined,
-        bool (*isInitBlockDownload)(const Consensus::Params&))
+        bool (*isInitBlockDownload)(const Consensus::Params&),
+        ed25519::BatchValidator* joinSplitAuth)
 {
     // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
     // for an attacker to attempt to split the network.
@@ -1291,76 +1624,42 @@ bool ContextualCheckShieldedInputs(
         }
     }
 
-    if (!tx.vJoinSplit.empty())
-    {
-        if (!ed25519_verify(&tx.joinSplitPubKey, &tx.joinSplitSig, dataToBeSigned.begin(), 32)) {
-            // Check whether the failure was caused by an outdated consensus
-            // branch ID; if so, inform the node that they need to upgrade. We
-            // only check the previous epoch's branch ID, on the assumption that
-            // users creating transactions will notice their transactions
-            // failing before a second network upgrade occurs.
-            if (ed25519_verify(&tx.joinSplitPubKey,
-                               &tx.joinSplitSig,
-                               prevDataToBeSigned.begin(), 32)) {
-                return state.DoS(
-                    dosLevelPotentiallyRelaxing, false, REJECT_INVALID, strprintf(
-                        "old-consensus-branch-id (Expected %s, found %s)",
-                        HexInt(consensusBranchId),
-                        HexInt(prevConsensusBranchId)));
-            }
-            return state.DoS(
-                dosLevelPotentiallyRelaxing,
-                error("ContextualCheckShieldedInputs(): invalid joinsplit signature"),
-                REJECT_INVALID, "bad-txns-invalid-joinsplit-signature");
+    if (!tx.vJoinSplit.empty() && joinSplitAuth != nullptr) {
+        // Queue the JoinSplit signature to be batch-validated. If the batch
+        // fails, the caller checks the signatures individually with
+        // CheckJoinSplitSignature() to find the invalid one.
+        joinSplitAuth->Queue(&tx.joinSplitPubKey, &tx.joinSplitSig, dataToBeSigned.begin(), 32);
+    } else if (!tx.vJoinSplit.empty()) {
+        if (!CheckJoinSplitSignature(tx, dataToBeSigned, prevDataToBeSigned, state,
+                                     dosLevelPotentiallyRelaxing, consensusBranchId, prevConsensusBranchId))
+        {
+            return false;
         }
     }
 
     if (!tx.vShieldedSpend.empty() ||
         !tx.vShieldedOutput.empty())
     {
-        auto assembler = sapling::new_bundle_assembler();
-
-        for (const SpendDescription &spend : tx.vShieldedSpend) {
-            if (!assembler->add_spend(
-                spend.cv.GetRawBytes(),
-                spend.anchor.GetRawBytes(),
-                spend.nullifier.GetRawBytes(),
-                spend.rk.GetRawBytes(),
-                spend.zkproof,
-                spend.spendAuthSig
-            )) {
-                return state.DoS(
-                    dosLevelPotentiallyRelaxing,
-                    error("ContextualCheckShieldedInputs(): Sapling spend description invalid"),
-                    REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
-            }
-        }
-
-        for (const OutputDescription &output : tx.vShieldedOutput) {
-            if (!assembler->add_output(
-                output.cv.GetRawBytes(),
-                output.cmu.GetRawBytes(),
-                output.ephemeralKey.GetRawBytes(),
-                output.encCiphertext,
-                output.outCiphertext,
-                output.zkproof
-            )) {
-                // This should be a non-contextual check, but we check it here
-                // as we need to pass over the outputs anyway in order to then
-                // call ctx->final_check().
-                return state.DoS(100, error("ContextualCheckShieldedInputs(): Sapling output description invalid"),
-                                      REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
-            }
+        std::optional<rust::Box<sapling::Bundle>> bundle;
+        switch (AssembleSaplingBundle(tx, bundle)) {
+        case SaplingBundleAssembly::Ok:
+            break;
+        case SaplingBundleAssembly::InvalidSpend:
+            return state.DoS(
+                dosLevelPotentiallyRelaxing,
+                error("ContextualCheckShieldedInputs(): Sapling spend description invalid"),
+                REJECT_INVALID, "bad-txns-sapling-spend-description-invalid");
+        case SaplingBundleAssembly::InvalidOutput:
+            // This should be a non-contextual check, but we check it here
+            // as we need to pass over the outputs anyway in order to then
+            // call ctx->final_check().
+            return state.DoS(100, error("ContextualCheckShieldedInputs(): Sapling output description invalid"),
+                                  REJECT_INVALID, "bad-txns-sapling-output-description-invalid");
         }
 
-        auto bundle = sapling::finish_bundle_assembly(
-            std::move(assembler),
-            tx.GetValueBalanceSapling(),
-            tx.bindingSig);
-
         // Queue Sapling bundle to be batch-validated. This also checks some consensus rules.
         if (saplingAuth.has_value()) {
-            if (!saplingAuth.value()->check_bundle(std::move(bundle), dataToBeSigned.GetRawBytes())) {
+            if (!saplingAuth.value()->check_bundle(std::move(bundle.value()), dataToBeSigned.GetRawBytes())) {
                 return state.DoS(
                     dosLevelPotentiallyRelaxing,
                     error("ContextualCheckShieldedInputs(): Sapling bundle invalid"),
@@ -1378,6 +1677,68 @@ bool ContextualCheckShieldedInputs(
 }
 
 
+/**
+ * Whether the signature hash of a transaction's shielded components can be
+ * computed without the coins it spends. ZIP 244 signature hashes commit to the
+ * coins spent by transparent inputs.
+ */
+static bool IsShieldedSigHashContextFree(const CTransaction& tx)
+{
+    return !(tx.nVersionGroupId == ZIP225_VERSION_GROUP_ID && !tx.IsCoinBase() && !tx.vin.empty());
+}
+
+enum class ShieldedAuthQueueing {
+    Queued,
+    NotApplicable,
+    Invalid,
+};
+
+/**
+ * Queue the Sapling and Orchard bundles of a transaction into the given
+ * batches without looking at the coins it spends, for callers that check
+ * bundle authorization ahead of ContextualCheckShieldedInputs().
+ *
+ * Returns `NotApplicable` if the transaction has no Sapling or Orchard bundle,
+ * or if its signature hash cannot be computed here (see
+ * IsShieldedSigHashContextFree()). Returns `Invalid` (with `saplingAuth` no
+ * longer usable) if the Sapling bundle could not be queued.
+ */
+static ShieldedAuthQueueing QueueContextFreeShieldedAuth(
+    const CTransaction& tx,
+    uint32_t consensusBranchId,
+    sapling::BatchValidator& saplingAuth,
+    orchard::AuthValidator& orchardAuth)
+{
+    bool fHasSaplingBundle = !(tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty());
+    if (!fHasSaplingBundle && !tx.GetOrchardBundle().IsPresent()) {
+        return ShieldedAuthQueueing::NotApplicable;
+    }
+    if (!IsShieldedSigHashContextFree(tx)) {
+        return ShieldedAuthQueueing::NotApplicable;
+    }
+
+    uint256 dataToBeSigned;
+    try {
+        const std::vector<CTxOut> noPrevOutputs;
+        PrecomputedTransactionData txdata(tx, noPrevOutputs);
+        dataToBeSigned = SignatureHash(CScript(), tx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId, txdata);
+    } catch (const std::exception&) {
+        return ShieldedAuthQueueing::NotApplicable;
+    }
+
+    if (fHasSaplingBundle) {
+        std::optional<rust::Box<sapling::Bundle>> bundle;
+        if (AssembleSaplingBundle(tx, bundle) != SaplingBundleAssembly::Ok ||
+            !saplingAuth.check_bundle(std::move(bundle.value()), dataToBeSigned.GetRawBytes()))
+        {
+            return ShieldedAuthQueueing::Invalid;
+        }
+    }
+    tx.GetOrchardBundle().QueueAuthValidation(orchardAuth, dataToBeSigned);
+    return ShieldedAuthQueueing::Queued;
+}
+
+
 bool CheckTransaction(const CTransaction& tx, CValidationState &state,
                       ProofVerifier& verifier)
 {
@@ -1767,13 +2128,15 @@ static std::string FormatStateMessage(const CValidationState &state)
         state.GetRejectCode());
 }
 
-bool AcceptToMemoryPool(
+static bool AcceptToMemoryPoolWithTime(
         const CChainParams& chainparams,
         CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-        bool* pfMissingInputs, bool fRejectAbsurdFee)
+        bool* pfMissingInputs, int64_t nAcceptTime, bool fRejectAbsurdFee, bool fProofsVerified)
 {
     AssertLockHeld(cs_main);
     LOCK(pool.cs); // mempool "read lock" (held through pool.addUnchecked())
+    auto span = TracingSpan("debug", "profile", "AcceptToMemoryPool");
+    auto spanGuard = span.Enter();
     if (pfMissingInputs) {
         *pfMissingInputs = false;
     }
@@ -1788,7 +2151,7 @@ bool AcceptToMemoryPool(
         return false;
     }
 
-    auto verifier = ProofVerifier::Strict();
+    auto verifier = fProofsVerified ? ProofVerifier::Disabled() : ProofVerifier::Strict();
     if (!CheckTransaction(tx, state, verifier))
         return false;
 
@@ -1849,15 +2212,28 @@ bool AcceptToMemoryPool(
         CCoinsViewMemPool viewMemPool(pcoinsTip, pool);
         view.SetBackend(viewMemPool);
 
-        // do we already have it?
-        if (view.HaveCoins(hash))
-            return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+        // Read the inputs of a transaction that has several in one batch,
+        // rather than one lookup per input in the loop below.
+        if (tx.vin.size() > 1) {
+            std::vector<COutPoint> vPrevouts;
+            vPrevouts.reserve(tx.vin.size());
+            for (const CTxIn& txin : tx.vin) {
+                vPrevouts.push_back(txin.prevout);
+            }
+            view.GetCoins(vPrevouts);
+        }
 
         // do all inputs exist?
-        // Note that this does not check for the presence of actual outputs (see the next check for that),
-        // and only helps with filling in pfMissingInputs (to determine missing vs spent).
         for (const CTxIn txin : tx.vin) {
-            if (!view.HaveCoins(txin.prevout.hash)) {
+            if (!view.HaveCoin(txin.prevout)) {
+                // Are inputs missing because we already have the tx?
+                for (size_t out = 0; out < tx.vout.size(); out++) {
+                    // Optimistically just do efficient check of cache for outputs
+                    if (pcoinsTip->HaveCoinInCache(COutPoint(hash, out))) {
+                        return state.Invalid(false, REJECT_ALREADY_KNOWN, "txn-already-known");
+                    }
+                }
+                // Otherwise assume this might be an orphan tx for which we just haven't seen parents yet
                 if (pfMissingInputs)
                     *pfMissingInputs = true;
                 return false; // fMissingInputs and !state.IsInvalid() is used to detect this condition, don't set state.Invalid()
@@ -1906,8 +2282,8 @@ bool AcceptToMemoryPool(
         // during reorgs to ensure COINBASE_MATURITY is still met.
         bool fSpendsCoinbase = false;
         for (const CTxIn &txin : tx.vin) {
-            const CCoins *coins = view.AccessCoins(txin.prevout.hash);
-            if (coins->IsCoinBase()) {
+            const Coin &coin = view.AccessCoin(txin.prevout);
+            if (coin.IsCoinBase()) {
                 fSpendsCoinbase = true;
                 break;
             }
@@ -1916,7 +2292,7 @@ bool AcceptToMemoryPool(
         // For v1-v4 transactions, we don't yet know if the transaction commits
         // to consensusBranchId, but if the entry gets added to the mempool, then
         // it has passed ContextualCheckInputs and therefore this is correct.
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), fSpendsCoinbase, nSigOps, consensusBranchId);
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), fSpendsCoinbase, nSigOps, consensusBranchId);
         unsigned int nSize = entry.GetTxSize();
 
         // Before zcashd 4.2.0, we had a condition here to always accept a tx if it contained
@@ -1970,8 +2346,8 @@ bool AcceptToMemoryPool(
         for (const auto& input : tx.vin) {
             allPrevOutputs.push_back(view.GetOutputFor(input));
         }
-        PrecomputedTransactionData txdata(tx, allPrevOutputs);
-        if (!ContextualCheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, txdata, chainparams.GetConsensus(), consensusBranchId))
+        auto txdata = std::make_shared<const PrecomputedTransactionData>(tx, allPrevOutputs);
+        if (!ContextualCheckInputs(tx, state, view, true, STANDARD_SCRIPT_VERIFY_FLAGS, true, *txdata, chainparams.GetConsensus(), consensusBranchId))
         {
             return false;
         }
@@ -1985,7 +2361,7 @@ bool AcceptToMemoryPool(
         // There is a similar check in CreateNewBlock() to prevent creating
         // invalid blocks, however allowing such transactions into the mempool
         // can be exploited as a DoS attack.
-        if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, chainparams.GetConsensus(), consensusBranchId))
+        if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, *txdata, chainparams.GetConsensus(), consensusBranchId))
         {
             return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against MANDATORY but not STANDARD flags %s, %s",
                 __func__, hash.ToString(), FormatStateMessage(state));
@@ -1994,16 +2370,23 @@ bool AcceptToMemoryPool(
         // This will be a single-transaction batch, which will be more efficient
         // than unbatched if the transaction contains at least one Sapling Spend
         // or at least two Sapling Outputs.
-        std::optional<rust::Box<sapling::BatchValidator>> saplingAuth = sapling::init_batch_validator();
+        std::optional<rust::Box<sapling::BatchValidator>> saplingAuth;
 
         // This will be a single-transaction batch, which is still more efficient as every
         // Orchard bundle contains at least two signatures.
-        std::optional<orchard::AuthValidator> orchardAuth = orchard::AuthValidator::Batch();
+        std::optional<orchard::AuthValidator> orchardAuth;
+
+        // If the caller has already checked the proofs and bundle authorizations
+        // against this branch ID, only the stateful checks remain to be done.
+        if (!fProofsVerified) {
+            saplingAuth = sapling::init_batch_validator();
+            orchardAuth = orchard::AuthValidator::Batch();
+        }
 
         // Check shielded input signatures.
         if (!ContextualCheckShieldedInputs(
             tx,
-            txdata,
+            *txdata,
             state,
             view,
             saplingAuth,
@@ -2017,14 +2400,25 @@ bool AcceptToMemoryPool(
         }
 
         // Check Sapling and Orchard bundle authorizations.
-        // `saplingAuth` and `orchardAuth` are known here to be non-null.
-        if (!saplingAuth.value()->validate()) {
+        if (saplingAuth.has_value() && !saplingAuth.value()->validate()) {
             return state.DoS(100, false, REJECT_INVALID, "bad-sapling-bundle-authorization");
         }
-        if (!orchardAuth.value().Validate()) {
+        if (orchardAuth.has_value() && !orchardAuth.value().Validate()) {
             return state.DoS(100, false, REJECT_INVALID, "bad-orchard-bundle-authorization");
         }
 
+        // Let ConnectBlock() skip the bundles if this transaction is mined in
+        // the next block.
+        if (!(tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty()) ||
+            tx.GetOrchardBundle().IsPresent())
+        {
+            CacheShieldedBundles(tx, consensusBranchId);
+        }
+
+        // Let ConnectBlock() check the scripts again with the same signature
+        // hash data.
+        entry.SetTxData(txdata);
+
         {
             // Store transaction in memory
             pool.addUnchecked(hash, entry, !IsInitialBlockDownload(chainparams.GetConsensus()));
@@ -2057,14 +2451,23 @@ bool AcceptToMemoryPool(
     return true;
 }
 
+bool AcceptToMemoryPool(
+        const CChainParams& chainparams,
+        CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+        bool* pfMissingInputs, bool fRejectAbsurdFee, bool fProofsVerified)
+{
+    return AcceptToMemoryPoolWithTime(chainparams, pool, state, tx, fLimitFree, pfMissingInputs,
+        GetTime(), fRejectAbsurdFee, fProofsVerified);
+}
+
 bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
     std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
-    if (!fTimestampIndex) {
+    if (!fTimestampIndex || !pinsightindex) {
         LogPrint("rpc", "Timestamp index not enabled");
         return false;
     }
-    if (!pblocktree->ReadTimestampIndex(high, low, fActiveOnly, hashes)) {
+    if (!pinsightindex->ReadTimestampIndex(high, low, fActiveOnly, hashes)) {
         LogPrint("rpc", "Unable to get hashes for timestamps");
         return false;
     }
@@ -2074,14 +2477,14 @@ bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value)
 {
     AssertLockHeld(cs_main);
-    if (!fSpentIndex) {
+    if (!fSpentIndex || !pinsightindex) {
         LogPrint("rpc", "Spent index not enabled");
         return false;
     }
     if (mempool.getSpentIndex(key, value))
         return true;
 
-    if (!pblocktree->ReadSpentIndex(key, value)) {
+    if (!pinsightindex->ReadSpentIndex(key, value)) {
         LogPrint("rpc", "Unable to get spent index information");
         return false;
     }
@@ -2092,11 +2495,11 @@ bool GetAddressIndex(const uint160& addressHash, int type,
                      std::vector<CAddressIndexDbEntry>& addressIndex,
                      int start, int end)
 {
-    if (!fAddressIndex) {
+    if (!fAddressIndex || !pinsightindex) {
         LogPrint("rpc", "address index not enabled");
         return false;
     }
-    if (!pblocktree->ReadAddressIndex(addressHash, type, addressIndex, start, end)) {
+    if (!pinsightindex->ReadAddressIndex(addressHash, type, addressIndex, start, end)) {
         LogPrint("rpc", "unable to get txids for address");
         return false;
     }
@@ -2106,17 +2509,136 @@ bool GetAddressIndex(const uint160& addressHash, int type,
 bool GetAddressUnspent(const uint160& addressHash, int type,
                        std::vector<CAddressUnspentDbEntry>& unspentOutputs)
 {
-    if (!fAddressIndex) {
+    if (!fAddressIndex || !pinsightindex) {
+        LogPrint("rpc", "address index not enabled");
+        return false;
+    }
+    if (!pinsightindex->ReadAddressUnspentIndex(addressHash, type, unspentOutputs)) {
+        LogPrint("rpc", "unable to get txids for address");
+        return false;
+    }
+    return true;
+}
+
+bool ForEachAddressIndex(const uint160& addressHash, int type, int start, int end,
+                         const CAddressIndexKey* pFrom, const AddressIndexVisitor& visit)
+{
+    if (!fAddressIndex || !pinsightindex) {
+        LogPrint("rpc", "address index not enabled");
+        return false;
+    }
+    if (!pinsightindex->ForEachAddressIndex(addressHash, type, start, end, pFrom, visit)) {
+        LogPrint("rpc", "unable to get txids for address");
+        return false;
+    }
+    return true;
+}
+
+bool ForEachAddressUnspent(const uint160& addressHash, int type,
+                           const CAddressUnspentKey* pFrom, const AddressUnspentVisitor& visit)
+{
+    if (!fAddressIndex || !pinsightindex) {
         LogPrint("rpc", "address index not enabled");
         return false;
     }
-    if (!pblocktree->ReadAddressUnspentIndex(addressHash, type, unspentOutputs)) {
+    if (!pinsightindex->ForEachAddressUnspentIndex(addressHash, type, pFrom, visit)) {
         LogPrint("rpc", "unable to get txids for address");
         return false;
     }
     return true;
 }
 
+bool GetAddressBalance(const uint160& addressHash, int type, CAddressBalanceValue& value)
+{
+    return fAddressIndex && pinsightindex && pinsightindex->ReadAddressBalance(addressHash, type, value);
+}
+
+/**
+ * The block files that have been replaced by packed files (see
+ * -packblockfiles), with the sizes of those, and the packed files whose index
+ * has been read, most recently used first.
+ */
+static CCriticalSection cs_packedBlockFiles;
+static std::map<int, uint64_t> mapPackedBlockFiles GUARDED_BY(cs_packedBlockFiles);
+static std::list<std::pair<int, std::shared_ptr<const CPackedBlockFile>>> listOpenPackedBlockFiles GUARDED_BY(cs_packedBlockFiles);
+
+/** Get the packed file of the given block file, or nullptr if it has not been packed. */
+static std::shared_ptr<const CPackedBlockFile> GetPackedBlockFile(int nFile)
+{
+    LOCK(cs_packedBlockFiles);
+    if (mapPackedBlockFiles.count(nFile) == 0) {
+        return nullptr;
+    }
+    for (auto it = listOpenPackedBlockFiles.begin(); it != listOpenPackedBlockFiles.end(); ++it) {
+        if (it->first == nFile) {
+            listOpenPackedBlockFiles.splice(listOpenPackedBlockFiles.begin(), listOpenPackedBlockFiles, it);
+            return it->second;
+        }
+    }
+
+    std::shared_ptr<const CPackedBlockFile> packed = CPackedBlockFile::Open(GetBlockPosFilename(CDiskBlockPos(nFile, 0), "pak"));
+    if (!packed) {
+        return nullptr;
+    }
+    listOpenPackedBlockFiles.emplace_front(nFile, packed);
+    if (listOpenPackedBlockFiles.size() > MAX_OPEN_PACKED_BLOCK_FILES) {
+        listOpenPackedBlockFiles.pop_back();
+    }
+    return packed;
+}
+
+/** The size of the packed file of the given block file, if it has been packed. */
+static std::optional<uint64_t> GetPackedBlockFileSize(int nFile)
+{
+    LOCK(cs_packedBlockFiles);
+    auto it = mapPackedBlockFiles.find(nFile);
+    if (it == mapPackedBlockFiles.end()) {
+        return std::nullopt;
+    }
+    return it->second;
+}
+
+static void AddPackedBlockFile(int nFile, uint64_t nSize)
+{
+    LOCK(cs_packedBlockFiles);
+    mapPackedBlockFiles[nFile] = nSize;
+}
+
+static void RemovePackedBlockFile(int nFile)
+{
+    LOCK(cs_packedBlockFiles);
+    mapPackedBlockFiles.erase(nFile);
+    listOpenPackedBlockFiles.remove_if([&](const std::pair<int, std::shared_ptr<const CPackedBlockFile>>& entry) {
+        return entry.first == nFile;
+    });
+}
+
+/** Find the packed block files in the blocks directory. */
+static void LoadPackedBlockFiles()
+{
+    {
+        LOCK(cs_packedBlockFiles);
+        mapPackedBlockFiles.clear();
+        listOpenPackedBlockFiles.clear();
+    }
+    fs::path blocksdir = GetDataDir() / "blocks";
+    if (!fs::is_directory(blocksdir)) {
+        return;
+    }
+    for (fs::directory_iterator it(blocksdir); it != fs::directory_iterator(); it++) {
+        std::string strName = it->path().filename().string();
+        if (fs::is_regular_file(*it) && strName.length() == 12 &&
+            strName.substr(0, 3) == "pak" && strName.substr(8, 4) == ".dat") {
+            int nFile = atoi(strName.substr(3, 5));
+            // A packed file that cannot be read is ignored, and its blocks
+            // are read from the block file if it is still there.
+            if (CPackedBlockFile::Open(it->path())) {
+                AddPackedBlockFile(nFile, fs::file_size(it->path()));
+            }
+        }
+    }
+}
+
 /**
  * Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock.
  * If blockIndex is provided, the transaction is fetched from the corresponding block.
@@ -2137,17 +2659,51 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::P
 
         if (fTxIndex) {
             CDiskTxPos postx;
-            if (pblocktree->ReadTxIndex(hash, postx)) {
-                CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
-                if (file.IsNull())
-                    return error("%s: OpenBlockFile failed", __func__);
+            if (pinsightindex != NULL && pinsightindex->ReadTxIndex(hash, postx)) {
                 CBlockHeader header;
-                try {
-                    file >> header;
-                    fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
-                    file >> txOut;
-                } catch (const std::exception& e) {
-                    return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                std::shared_ptr<const CPackedBlockFile> packed = GetPackedBlockFile(postx.nFile);
+                if (packed) {
+                    std::vector<unsigned char> data;
+                    if (!packed->Read(postx.nPos, data))
+                        return error("%s: reading the packed block failed", __func__);
+                    try {
+                        CSpanReader filein(SER_DISK, CLIENT_VERSION, (const char*)data.data(), (const char*)data.data() + data.size());
+                        filein >> header;
+                        filein.ignore(postx.nTxOffset);
+                        filein >> txOut;
+                    } catch (const std::exception& e) {
+                        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                    }
+                } else {
+                    // Read from the index header, to find whether the block
+                    // is stored compressed.
+                    static const unsigned int nHeaderSize = CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+                    if (postx.nPos < nHeaderSize)
+                        return error("%s: invalid block position %s", __func__, postx.ToString());
+                    CAutoFile file(OpenBlockFile(CDiskBlockPos(postx.nFile, postx.nPos - nHeaderSize), true), SER_DISK, CLIENT_VERSION);
+                    if (file.IsNull())
+                        return error("%s: OpenBlockFile failed", __func__);
+                    try {
+                        CMessageHeader::MessageStartChars blkStart;
+                        unsigned int nSize;
+                        file >> FLATDATA(blkStart) >> nSize;
+                        if (nSize & DISK_RECORD_COMPRESSED) {
+                            std::vector<unsigned char> compressed(nSize & ~DISK_RECORD_COMPRESSED), data;
+                            file.read((char*)compressed.data(), compressed.size());
+                            if (!DecompressDiskRecord(compressed, data))
+                                return error("%s: the compressed block is corrupt", __func__);
+                            CSpanReader filein(SER_DISK, CLIENT_VERSION, (const char*)data.data(), (const char*)data.data() + data.size());
+                            filein >> header;
+                            filein.ignore(postx.nTxOffset);
+                            filein >> txOut;
+                        } else {
+                            file >> header;
+                            fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+                            file >> txOut;
+                        }
+                    } catch (const std::exception& e) {
+                        return error("%s: Deserialize or I/O error - %s", __func__, e.what());
+                    }
                 }
                 hashBlock = header.GetHash();
                 if (txOut.GetHash() != hash)
@@ -2160,15 +2716,9 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::P
         }
 
         if (fAllowSlow) { // use coin database to locate block that contains transaction, and scan it
-            int nHeight = -1;
-            {
-                CCoinsViewCache &view = *pcoinsTip;
-                const CCoins* coins = view.AccessCoins(hash);
-                if (coins)
-                    nHeight = coins->nHeight;
-            }
-            if (nHeight > 0)
-                pindexSlow = chainActive[nHeight];
+            const Coin& coin = AccessByTxid(*pcoinsTip, hash);
+            if (!coin.IsSpent())
+                pindexSlow = chainActive[coin.nHeight];
         }
     }
 
@@ -2194,6 +2744,11 @@ bool GetTransaction(const uint256& hash, CTransaction& txOut, const Consensus::P
 //
 
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    return WriteBlockToDisk(CDiskRecord(block, fCompressBlockFiles), pos, messageStart);
+}
+
+bool WriteBlockToDisk(const CDiskRecord& record, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
     CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
@@ -2201,31 +2756,133 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
         return error("WriteBlockToDisk: OpenBlockFile failed");
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, block);
-    fileout << FLATDATA(messageStart) << nSize;
+    fileout << FLATDATA(messageStart) << record.GetSizeField();
 
     // Write block
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
         return error("WriteBlockToDisk: ftell failed");
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    fileout.write((const char*)record.GetData().data(), record.size());
 
     return true;
 }
 
+/**
+ * The size a block takes in its block file, with its index header, if it is
+ * stored at the given position of a block file (rather than a packed file).
+ */
+static std::optional<unsigned int> GetBlockDiskSize(const CDiskBlockPos& pos)
+{
+    static const unsigned int nHeaderSize = CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nHeaderSize)
+        return std::nullopt;
+    CAutoFile filein(OpenBlockFile(CDiskBlockPos(pos.nFile, pos.nPos - nHeaderSize), true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return std::nullopt;
+    try {
+        CMessageHeader::MessageStartChars blkStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blkStart) >> nSize;
+        return (nSize & ~DISK_RECORD_COMPRESSED) + nHeaderSize;
+    } catch (const std::exception&) {
+        return std::nullopt;
+    }
+}
+
+/** Block files mapped into memory for reading (see -mmapblockfiles), most recently used first. */
+static CCriticalSection cs_mappedBlockFiles;
+static std::list<std::pair<int, std::shared_ptr<const CMappedFile>>> listMappedBlockFiles GUARDED_BY(cs_mappedBlockFiles);
+
+/**
+ * Get a memory mapping of the given block file, mapping it if necessary.
+ * Returns nullptr if the file cannot be mapped, or is still being written to.
+ */
+static std::shared_ptr<const CMappedFile> GetMappedBlockFile(int nFile)
+{
+    {
+        LOCK(cs_LastBlockFile);
+        // The file currently being written to may still grow, and will be
+        // truncated when it is finalized.
+        if (nFile >= nLastBlockFile) {
+            return nullptr;
+        }
+    }
+
+    LOCK(cs_mappedBlockFiles);
+    for (auto it = listMappedBlockFiles.begin(); it != listMappedBlockFiles.end(); ++it) {
+        if (it->first == nFile) {
+            listMappedBlockFiles.splice(listMappedBlockFiles.begin(), listMappedBlockFiles, it);
+            return it->second;
+        }
+    }
+
+    std::shared_ptr<const CMappedFile> mapped = CMappedFile::Open(GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk"));
+    if (!mapped) {
+        return nullptr;
+    }
+    listMappedBlockFiles.emplace_front(nFile, mapped);
+    if (listMappedBlockFiles.size() > MAX_MAPPED_BLOCK_FILES) {
+        // Readers of the evicted file keep their own reference to it.
+        listMappedBlockFiles.pop_back();
+    }
+    return mapped;
+}
+
+/** Drop the mappings of block files that are about to be deleted. */
+static void UnmapBlockFiles(const std::set<int>& setFiles)
+{
+    LOCK(cs_mappedBlockFiles);
+    listMappedBlockFiles.remove_if([&](const std::pair<int, std::shared_ptr<const CMappedFile>>& entry) {
+        return setFiles.count(entry.first) > 0;
+    });
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    std::shared_ptr<const CPackedBlockFile> packed;
+    std::shared_ptr<const CMappedFile> mapped;
+    if (!pos.IsNull()) {
+        packed = GetPackedBlockFile(pos.nFile);
+    }
+    if (fMmapBlockFiles && !packed && !pos.IsNull()) {
+        mapped = GetMappedBlockFile(pos.nFile);
+    }
+
+    // The index header (magic bytes and size) precedes the block data, and
+    // records whether the block is stored compressed.
+    static const unsigned int nHeaderSize = CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (!packed && !pos.IsNull() && pos.nPos < nHeaderSize)
+        return error("ReadBlockFromDisk: invalid block position %s", pos.ToString());
+    CDiskBlockPos hpos = pos;
+    hpos.nPos -= packed || pos.IsNull() ? 0 : nHeaderSize;
 
     // Read block
     try {
-        filein >> block;
+        CMessageHeader::MessageStartChars blkStart;
+        unsigned int nSize;
+        if (packed) {
+            std::vector<unsigned char>& data = DiskRecordReadBuffer();
+            if (!packed->Read(pos.nPos, data))
+                return error("ReadBlockFromDisk: reading the packed block failed for %s", pos.ToString());
+            CSpanReader filein(SER_DISK, CLIENT_VERSION, (const char*)data.data(), (const char*)data.data() + data.size());
+            filein >> block;
+        } else if (mapped) {
+            if (pos.nPos >= mapped->Size())
+                return error("ReadBlockFromDisk: position is past the end of the block file for %s", pos.ToString());
+            CSpanReader filein(SER_DISK, CLIENT_VERSION, mapped->begin() + hpos.nPos, mapped->end());
+            filein >> FLATDATA(blkStart) >> nSize;
+            ReadDiskRecord(filein, nSize, block);
+        } else {
+            // Open history file to read
+            CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+            filein >> FLATDATA(blkStart) >> nSize;
+            ReadDiskRecord(filein, nSize, block);
+        }
     }
     catch (const std::exception& e) {
         return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
@@ -2254,13 +2911,82 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
-CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
+/**
+ * Read the serialized block stored after the index header that ends at the
+ * start of the stream, checking only the header's magic bytes and size.
+ */
+template <typename Stream>
+static bool ReadRawBlock(Stream& filein, std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
-    CAmount nSubsidy = 12.5 * COIN;
+    CMessageHeader::MessageStartChars blkStart;
+    unsigned int blkSize;
+    filein >> FLATDATA(blkStart) >> blkSize;
+
+    if (memcmp(blkStart, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+        return error("ReadRawBlockFromDisk: Block magic mismatch for %s: %s versus expected %s", pos.ToString(),
+                HexStr(blkStart, blkStart + CMessageHeader::MESSAGE_START_SIZE),
+                HexStr(messageStart, messageStart + CMessageHeader::MESSAGE_START_SIZE));
+
+    if (!IsValidDiskRecordSize(blkSize))
+        return error("ReadRawBlockFromDisk: Block data is larger than maximum deserialization size for %s: %s versus %s",
+                pos.ToString(), blkSize & ~DISK_RECORD_COMPRESSED, MAX_BLOCK_SIZE);
+
+    if (blkSize & DISK_RECORD_COMPRESSED) {
+        std::vector<unsigned char> compressed(blkSize & ~DISK_RECORD_COMPRESSED);
+        filein.read((char*)compressed.data(), compressed.size());
+        if (!DecompressDiskRecord(compressed, block))
+            return error("ReadRawBlockFromDisk: the compressed block is corrupt for %s", pos.ToString());
+        return true;
+    }
+    block.resize(blkSize);
+    filein.read((char*)block.data(), blkSize);
+    return true;
+}
 
-    // Mining slow start
-    // The subsidy is ramped up linearly, skipping the middle payout of
-    // MAX_SUBSIDY/2 to keep the monetary curve consistent with no slow start.
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
+{
+    // The index header (magic bytes and size) precedes the block data.
+    static const unsigned int nHeaderSize = CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.IsNull() || pos.nPos < nHeaderSize)
+        return error("ReadRawBlockFromDisk: invalid block position %s", pos.ToString());
+    CDiskBlockPos hpos = pos;
+    hpos.nPos -= nHeaderSize;
+
+    std::shared_ptr<const CPackedBlockFile> packed = GetPackedBlockFile(pos.nFile);
+    if (packed) {
+        return packed->Read(pos.nPos, block);
+    }
+
+    std::shared_ptr<const CMappedFile> mapped;
+    if (fMmapBlockFiles) {
+        mapped = GetMappedBlockFile(hpos.nFile);
+    }
+
+    try {
+        if (mapped) {
+            if (hpos.nPos >= mapped->Size())
+                return error("ReadRawBlockFromDisk: position is past the end of the block file for %s", pos.ToString());
+            CSpanReader filein(SER_DISK, CLIENT_VERSION, mapped->begin() + hpos.nPos, mapped->end());
+            return ReadRawBlock(filein, block, pos, messageStart);
+        } else {
+            CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+            if (filein.IsNull())
+                return error("ReadRawBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+            return ReadRawBlock(filein, block, pos, messageStart);
+        }
+    }
+    catch (const std::exception& e) {
+        return error("%s: Read from block file failed - %s at %s", __func__, e.what(), pos.ToString());
+    }
+}
+
+CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
+{
+    CAmount nSubsidy = 12.5 * COIN;
+
+    // Mining slow start
+    // The subsidy is ramped up linearly, skipping the middle payout of
+    // MAX_SUBSIDY/2 to keep the monetary curve consistent with no slow start.
     if (nHeight < consensusParams.SubsidySlowStartShift()) {
         nSubsidy /= consensusParams.nSubsidySlowStartInterval;
         nSubsidy *= nHeight;
@@ -2494,13 +3220,13 @@ void static InvalidChainFound(CBlockIndex* pindexNew, const CChainParams& chainP
 void static InvalidBlockFound(CBlockIndex *pindex, const CValidationState &state, const CChainParams& chainParams) {
     int nDoS = 0;
     if (state.IsInvalid(nDoS)) {
-        std::map<uint256, NodeId>::iterator it = mapBlockSource.find(pindex->GetBlockHash());
-        if (it != mapBlockSource.end() && State(it->second)) {
+        std::map<uint256, std::pair<NodeId, bool>>::iterator it = mapBlockSource.find(pindex->GetBlockHash());
+        if (it != mapBlockSource.end() && State(it->second.first)) {
             assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
             CBlockReject reject = {(unsigned char)state.GetRejectCode(), state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), pindex->GetBlockHash()};
-            State(it->second)->rejects.push_back(reject);
-            if (nDoS > 0)
-                Misbehaving(it->second, nDoS);
+            State(it->second.first)->rejects.push_back(reject);
+            if (nDoS > 0 && it->second.second)
+                Misbehaving(it->second.first, nDoS);
         }
     }
     if (!state.CorruptionPossible()) {
@@ -2517,20 +3243,10 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     if (!tx.IsCoinBase()) {
         txundo.vprevout.reserve(tx.vin.size());
         for (const CTxIn &txin : tx.vin) {
-            CCoinsModifier coins = inputs.ModifyCoins(txin.prevout.hash);
-            unsigned nPos = txin.prevout.n;
-
-            if (nPos >= coins->vout.size() || coins->vout[nPos].IsNull())
-                assert(false);
             // mark an outpoint spent, and construct undo information
-            txundo.vprevout.push_back(CTxInUndo(coins->vout[nPos]));
-            coins->Spend(nPos);
-            if (coins->vout.size() == 0) {
-                CTxInUndo& undo = txundo.vprevout.back();
-                undo.nHeight = coins->nHeight;
-                undo.fCoinBase = coins->fCoinBase;
-                undo.nVersion = coins->nVersion;
-            }
+            txundo.vprevout.emplace_back();
+            bool is_spent = inputs.SpendCoin(txin.prevout, &txundo.vprevout.back());
+            assert(is_spent);
         }
     }
 
@@ -2538,7 +3254,7 @@ void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, CTxUndo &txund
     inputs.SetNullifiers(tx, true);
 
     // add outputs
-    inputs.ModifyNewCoins(tx.GetHash())->FromTx(tx, nHeight);
+    AddCoins(inputs, tx, nHeight);
 }
 
 void UpdateCoins(const CTransaction& tx, CCoinsViewCache& inputs, int nHeight)
@@ -2555,6 +3271,15 @@ bool CScriptCheck::operator()() {
     return true;
 }
 
+bool CTransactionCheck::operator()() {
+    CValidationState state;
+    return CheckTransaction(*ptx, state, *verifier);
+}
+
+bool CHeaderCheck::operator()() {
+    return CheckEquihashSolution(pheader, *params);
+}
+
 int GetSpendHeight(const CCoinsViewCache& inputs)
 {
     LOCK(cs_main);
@@ -2601,15 +3326,15 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
         for (unsigned int i = 0; i < tx.vin.size(); i++)
         {
             const COutPoint &prevout = tx.vin[i].prevout;
-            const CCoins *coins = inputs.AccessCoins(prevout.hash);
-            assert(coins);
+            const Coin& coin = inputs.AccessCoin(prevout);
+            assert(!coin.IsSpent());
 
-            if (coins->IsCoinBase()) {
+            if (coin.IsCoinBase()) {
                 // Ensure that coinbases are matured
-                if (nSpendHeight - coins->nHeight < COINBASE_MATURITY) {
+                if (nSpendHeight - coin.nHeight < COINBASE_MATURITY) {
                     return state.Invalid(false,
                         REJECT_INVALID, "bad-txns-premature-spend-of-coinbase",
-                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coins->nHeight));
+                        strprintf("tried to spend coinbase at depth %d", nSpendHeight - coin.nHeight));
                 }
 
                 // Ensure that coinbases cannot be spent to transparent outputs
@@ -2624,8 +3349,8 @@ bool CheckTxInputs(const CTransaction& tx, CValidationState& state, const CCoins
             }
 
             // Check for negative or overflow input values
-            nValueIn += coins->vout[prevout.n].nValue;
-            if (!MoneyRange(coins->vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coin.out.nValue;
+            if (!MoneyRange(coin.out.nValue) || !MoneyRange(nValueIn))
                 return state.DoS(100, false, REJECT_INVALID, "bad-txns-inputvalues-outofrange");
 
         }
@@ -2658,7 +3383,7 @@ bool ContextualCheckInputs(
     bool fScriptChecks,
     unsigned int flags,
     bool cacheStore,
-    PrecomputedTransactionData& txdata,
+    const PrecomputedTransactionData& txdata,
     const Consensus::Params& consensusParams,
     uint32_t consensusBranchId,
     std::vector<CScriptCheck> *pvChecks)
@@ -2682,11 +3407,17 @@ bool ContextualCheckInputs(
         if (fScriptChecks) {
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
-                const CCoins* coins = inputs.AccessCoins(prevout.hash);
-                assert(coins);
+                const Coin& coin = inputs.AccessCoin(prevout);
+                assert(!coin.IsSpent());
+
+                // We very carefully only pass in things to CScriptCheck which
+                // are clearly committed to by tx' witness hash. This provides
+                // a sanity check that our caching is not introducing consensus
+                // failures through additional data in, eg, the coins being
+                // spent being checked as a part of CScriptCheck.
 
                 // Verify signature
-                CScriptCheck check(*coins, tx, i, flags, cacheStore, consensusBranchId, &txdata);
+                CScriptCheck check(coin.out, tx, i, flags, cacheStore, consensusBranchId, &txdata);
                 if (pvChecks) {
                     pvChecks->push_back(CScriptCheck());
                     check.swap(pvChecks->back());
@@ -2699,7 +3430,7 @@ bool ContextualCheckInputs(
                     // notice their transactions failing before a second network
                     // upgrade occurs.
                     auto prevConsensusBranchId = PrevEpochBranchId(consensusBranchId, consensusParams);
-                    CScriptCheck checkPrev(*coins, tx, i, flags, cacheStore, prevConsensusBranchId, &txdata);
+                    CScriptCheck checkPrev(coin.out, tx, i, flags, cacheStore, prevConsensusBranchId, &txdata);
                     if (checkPrev()) {
                         return state.DoS(
                             10, false, REJECT_INVALID, strprintf(
@@ -2714,7 +3445,7 @@ bool ContextualCheckInputs(
                         // arguments; if so, don't trigger DoS protection to
                         // avoid splitting the network between upgraded and
                         // non-upgraded nodes.
-                        CScriptCheck check2(*coins, tx, i,
+                        CScriptCheck check2(coin.out, tx, i,
                                 flags & ~STANDARD_NOT_MANDATORY_VERIFY_FLAGS, cacheStore, consensusBranchId, &txdata);
                         if (check2())
                             return state.Invalid(false, REJECT_NONSTANDARD, strprintf("non-mandatory-script-verify-flag (%s)", ScriptErrorString(check.GetScriptError())));
@@ -2733,7 +3464,7 @@ bool ContextualCheckInputs(
 
 namespace {
 
-bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+bool UndoWriteToDisk(const CBlockUndo& blockundo, const CDiskRecord& record, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
     // Open history file to append
     CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
@@ -2741,15 +3472,14 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
         return error("%s: OpenUndoFile failed", __func__);
 
     // Write index header
-    unsigned int nSize = GetSerializeSize(fileout, blockundo);
-    fileout << FLATDATA(messageStart) << nSize;
+    fileout << FLATDATA(messageStart) << record.GetSizeField();
 
     // Write undo data
     long fileOutPos = ftell(fileout.Get());
     if (fileOutPos < 0)
         return error("%s: ftell failed", __func__);
     pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
+    fileout.write((const char*)record.GetData().data(), record.size());
 
     // calculate & write checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
@@ -2760,17 +3490,28 @@ bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint
     return true;
 }
 
+} // anon namespace
+
 bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock)
 {
+    // The index header precedes the undo data, and records whether it is
+    // stored compressed.
+    static const unsigned int nHeaderSize = CMessageHeader::MESSAGE_START_SIZE + sizeof(unsigned int);
+    if (pos.nPos < nHeaderSize)
+        return error("%s: invalid undo position %s", __func__, pos.ToString());
+
     // Open history file to read
-    CAutoFile filein(OpenUndoFile(pos, true), SER_DISK, CLIENT_VERSION);
+    CAutoFile filein(OpenUndoFile(CDiskBlockPos(pos.nFile, pos.nPos - nHeaderSize), true), SER_DISK, CLIENT_VERSION);
     if (filein.IsNull())
         return error("%s: OpenBlockFile failed", __func__);
 
     // Read block
     uint256 hashChecksum;
     try {
-        filein >> blockundo;
+        CMessageHeader::MessageStartChars blkStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blkStart) >> nSize;
+        ReadDiskRecord(filein, nSize, blockundo);
         filein >> hashChecksum;
     }
     catch (const std::exception& e) {
@@ -2787,123 +3528,94 @@ bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uin
     return true;
 }
 
-} // anon namespace
+enum DisconnectResult
+{
+    DISCONNECT_OK,      // All good.
+    DISCONNECT_UNCLEAN, // Rolled back, but UTXO set was inconsistent with block.
+    DISCONNECT_FAILED   // Something else went wrong.
+};
 
 /**
- * Apply the undo operation of a CTxInUndo to the given chain state.
- * @param undo The undo object.
+ * Restore the UTXO in a Coin at a given COutPoint.
+ * @param undo The Coin to be restored.
  * @param view The coins view to which to apply the changes.
  * @param out The out point that corresponds to the tx input.
- * @return True on success.
+ * @return A DisconnectResult as an int
  */
-static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const COutPoint& out)
+static int ApplyTxInUndo(Coin&& undo, CCoinsViewCache& view, const COutPoint& out)
 {
     bool fClean = true;
 
-    CCoinsModifier coins = view.ModifyCoins(out.hash);
-    if (undo.nHeight != 0) {
-        // undo data contains height: this is the last output of the prevout tx being spent
-        if (!coins->IsPruned())
-            fClean = fClean && error("%s: undo data overwriting existing transaction", __func__);
-        coins->Clear();
-        coins->fCoinBase = undo.fCoinBase;
-        coins->nHeight = undo.nHeight;
-        coins->nVersion = undo.nVersion;
-    } else {
-        if (coins->IsPruned())
-            fClean = fClean && error("%s: undo data adding output to missing transaction", __func__);
+    if (view.HaveCoin(out))
+        fClean = error("%s: undo data overwriting existing output", __func__);
+
+    if (undo.nHeight == 0) {
+        // Missing undo metadata (height and coinbase). Older versions included this
+        // information only in undo records for the last spend of a transactions'
+        // outputs. This implies that it must be present for some other output of the same tx.
+        const Coin& alternate = AccessByTxid(view, out.hash);
+        if (!alternate.IsSpent()) {
+            undo.nHeight = alternate.nHeight;
+            undo.fCoinBase = alternate.fCoinBase;
+        } else {
+            error("%s: undo data adding output to missing transaction", __func__);
+            return DISCONNECT_FAILED;
+        }
     }
-    if (coins->IsAvailable(out.n))
-        fClean = fClean && error("%s: undo data overwriting existing output", __func__);
-    if (coins->vout.size() < out.n+1)
-        coins->vout.resize(out.n+1);
-    coins->vout[out.n] = undo.txout;
+    view.AddCoin(out, std::move(undo), !fClean);
 
-    return fClean;
+    return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
-enum DisconnectResult
-{
-    DISCONNECT_OK,      // All good.
-    DISCONNECT_UNCLEAN, // Rolled back, but UTXO set was inconsistent with block.
-    DISCONNECT_FAILED   // Something else went wrong.
-};
-
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
+ *  The undo data is read from disk unless pblockUndo has it already; it is
+ *  consumed either way.
  *  When UNCLEAN or FAILED is returned, view is left in an indeterminate state.
- *  The addressIndex and spentIndex will be updated if requested.
  */
 static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& state,
     const CBlockIndex* pindex, CCoinsViewCache& view, const CChainParams& chainparams,
-    const bool updateIndices)
+    CBlockUndo* pblockUndo = nullptr)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
     bool fClean = true;
 
-    CBlockUndo blockUndo;
-    CDiskBlockPos pos = pindex->GetUndoPos();
-    if (pos.IsNull()) {
-        error("DisconnectBlock(): no undo data available");
-        return DISCONNECT_FAILED;
-    }
-    if (!UndoReadFromDisk(blockUndo, pos, pindex->pprev->GetBlockHash())) {
-        error("DisconnectBlock(): failure reading undo data");
-        return DISCONNECT_FAILED;
+    CBlockUndo blockUndoRead;
+    if (pblockUndo == nullptr) {
+        CDiskBlockPos pos = pindex->GetUndoPos();
+        if (pos.IsNull()) {
+            error("DisconnectBlock(): no undo data available");
+            return DISCONNECT_FAILED;
+        }
+        if (!UndoReadFromDisk(blockUndoRead, pos, pindex->pprev->GetBlockHash())) {
+            error("DisconnectBlock(): failure reading undo data");
+            return DISCONNECT_FAILED;
+        }
+        pblockUndo = &blockUndoRead;
     }
+    CBlockUndo& blockUndo = *pblockUndo;
 
     if (blockUndo.vtxundo.size() + 1 != block.vtx.size()) {
         error("DisconnectBlock(): block and undo data inconsistent");
         return DISCONNECT_FAILED;
     }
-    std::vector<CAddressIndexDbEntry> addressIndex;
-    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
-    std::vector<CSpentIndexDbEntry> spentIndex;
 
     // undo transactions in reverse order
     for (int i = block.vtx.size() - 1; i >= 0; i--) {
         const CTransaction &tx = block.vtx[i];
         uint256 const hash = tx.GetHash();
 
-        // insightexplorer
-        // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2236
-        if (fAddressIndex && updateIndices) {
-            for (unsigned int k = tx.vout.size(); k-- > 0;) {
-                const CTxOut &out = tx.vout[k];
-                CScript::ScriptType scriptType = out.scriptPubKey.GetType();
-                if (scriptType != CScript::UNKNOWN) {
-                    uint160 const addrHash = out.scriptPubKey.AddressHash();
-
-                    // undo receiving activity
-                    addressIndex.push_back(make_pair(
-                        CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, k, false),
-                        out.nValue));
-
-                    // undo unspent index
-                    addressUnspentIndex.push_back(make_pair(
-                        CAddressUnspentKey(scriptType, addrHash, hash, k),
-                        CAddressUnspentValue()));
-                }
-            }
-        }
-
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
-        {
-        CCoinsModifier outs = view.ModifyCoins(hash);
-        outs->ClearUnspendable();
-
-        CCoins outsBlock(tx, pindex->nHeight);
-        // The CCoins serialization does not serialize negative numbers.
-        // No network rules currently depend on the version here, so an inconsistency is harmless
-        // but it must be corrected before txout nversion ever influences a network rule.
-        if (outsBlock.nVersion < 0)
-            outs->nVersion = outsBlock.nVersion;
-        if (*outs != outsBlock)
-            fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
-
-        // remove outputs
-        outs->Clear();
+        for (size_t o = 0; o < tx.vout.size(); o++) {
+            if (!tx.vout[o].scriptPubKey.IsUnspendable()) {
+                COutPoint out(hash, o);
+                Coin coin;
+                bool is_spent = view.SpendCoin(out, &coin);
+                if (!is_spent || tx.vout[o] != coin.out || pindex->nHeight != coin.nHeight || tx.IsCoinBase() != coin.fCoinBase) {
+                    fClean = fClean && error("DisconnectBlock(): added transaction mismatch? database corrupted");
+                }
+            }
         }
 
         // unspend nullifiers
@@ -2911,44 +3623,16 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
 
         // restore inputs
         if (i > 0) { // not coinbases
-            const CTxUndo &txundo = blockUndo.vtxundo[i-1];
+            CTxUndo &txundo = blockUndo.vtxundo[i-1];
             if (txundo.vprevout.size() != tx.vin.size()) {
                 error("DisconnectBlock(): transaction and undo data inconsistent");
                 return DISCONNECT_FAILED;
             }
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
-                const CTxInUndo &undo = txundo.vprevout[j];
-                if (!ApplyTxInUndo(undo, view, out))
-                    fClean = false;
-
-                // insightexplorer
-                // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2304
-                const CTxIn input = tx.vin[j];
-                if (fAddressIndex && updateIndices) {
-                    const CTxOut &prevout = view.GetOutputFor(input);
-                    CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
-                    if (scriptType != CScript::UNKNOWN) {
-                        uint160 const addrHash = prevout.scriptPubKey.AddressHash();
-
-                        // undo spending activity
-                        addressIndex.push_back(make_pair(
-                            CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, j, true),
-                            prevout.nValue * -1));
-
-                        // restore unspent index
-                        addressUnspentIndex.push_back(make_pair(
-                            CAddressUnspentKey(scriptType, addrHash, input.prevout.hash, input.prevout.n),
-                            CAddressUnspentValue(prevout.nValue, prevout.scriptPubKey, undo.nHeight)));
-                    }
-                }
-                // insightexplorer
-                if (fSpentIndex && updateIndices) {
-                    // undo and delete the spent index
-                    spentIndex.push_back(make_pair(
-                        CSpentIndexKey(input.prevout.hash, input.prevout.n),
-                        CSpentIndexValue()));
-                }
+                int res = ApplyTxInUndo(std::move(txundo.vprevout[j]), view, out);
+                if (res == DISCONNECT_FAILED) return DISCONNECT_FAILED;
+                fClean = fClean && res != DISCONNECT_UNCLEAN;
             }
         }
     }
@@ -2989,24 +3673,6 @@ static DisconnectResult DisconnectBlock(const CBlock& block, CValidationState& s
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
-    // insightexplorer
-    if (fAddressIndex && updateIndices) {
-        if (!pblocktree->EraseAddressIndex(addressIndex)) {
-            AbortNode(state, "Failed to delete address index");
-            return DISCONNECT_FAILED;
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            AbortNode(state, "Failed to write address unspent index");
-            return DISCONNECT_FAILED;
-        }
-    }
-    // insightexplorer
-    if (fSpentIndex && updateIndices) {
-        if (!pblocktree->UpdateSpentIndex(spentIndex)) {
-            AbortNode(state, "Failed to write transaction index");
-            return DISCONNECT_FAILED;
-        }
-    }
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
@@ -3016,38 +3682,153 @@ void static FlushBlockFile(bool fFinalize = false)
 
     CDiskBlockPos posOld(nLastBlockFile, 0);
 
-    FILE *fileOld = OpenBlockFile(posOld);
-    if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
-        FileCommit(fileOld);
-        fclose(fileOld);
-    }
-
-    fileOld = OpenUndoFile(posOld);
-    if (fileOld) {
-        if (fFinalize)
-            TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
-        FileCommit(fileOld);
-        fclose(fileOld);
-    }
+    FILE *fileBlock = OpenBlockFile(posOld);
+    FILE *fileUndo = OpenUndoFile(posOld);
+    if (fFinalize) {
+        if (fileBlock)
+            TruncateFile(fileBlock, vinfoBlockFile[nLastBlockFile].nSize);
+        if (fileUndo)
+            TruncateFile(fileUndo, vinfoBlockFile[nLastBlockFile].nUndoSize);
+    }
+
+    // The block and undo files are independent, so sync them at the same
+    // time; where each sync waits on the storage, this halves the wait. Both
+    // are synced before this returns, so before the block index that refers
+    // to them is written.
+    std::thread undoCommit;
+    if (fileBlock && fileUndo) {
+        undoCommit = std::thread([fileUndo]() { FileCommit(fileUndo); });
+    } else if (fileUndo) {
+        FileCommit(fileUndo);
+    }
+    if (fileBlock)
+        FileCommit(fileBlock);
+    if (undoCommit.joinable())
+        undoCommit.join();
+
+    if (fileBlock)
+        fclose(fileBlock);
+    if (fileUndo)
+        fclose(fileUndo);
 }
 
 bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigned int nAddSize);
 
-static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+// The script checks of a block are spread over the most threads, so they do
+// not share a single lock.
+static CWorkStealingCheckQueue<CScriptCheck> scriptcheckqueue(128);
 
 void ThreadScriptCheck() {
     RenameThread("zc-scriptcheck");
+    ApplyThreadAffinity("scriptcheck");
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CTransactionCheck> txcheckqueue(16);
+
+void ThreadTransactionCheck() {
+    RenameThread("zc-txcheck");
+    txcheckqueue.Thread();
+}
+
+static CCheckQueue<CHeaderCheck> headercheckqueue(8);
+
+void ThreadHeaderCheck() {
+    RenameThread("zc-headercheck");
+    headercheckqueue.Thread();
+}
+
+/**
+ * Record how the verifications of one round of a check queue were processed,
+ * in the zcash.checkqueue.* metrics labelled by queue. A round is counted as
+ * underutilized when it had fewer batches than the queue had workers, so that
+ * some of the -par threads had nothing to do.
+ */
+static void RecordCheckQueueStats(const char* queue, const CCheckQueueStats& stats)
+{
+    if (stats.nChecks == 0) {
+        return;
+    }
+    MetricsHistogram("zcash.checkqueue.jobs", stats.nChecks, "queue", queue);
+    MetricsHistogram("zcash.checkqueue.batch.size", double(stats.nChecks) / std::max(1U, stats.nBatches), "queue", queue);
+    MetricsHistogram("zcash.checkqueue.master.wait.seconds", stats.nMasterWaitMicros * 0.000001, "queue", queue);
+    if (stats.nWallMicros > 0 && stats.nWorkers > 0) {
+        double busy = double(stats.nBusyMicros) / (double(stats.nWallMicros) * stats.nWorkers);
+        MetricsHistogram("zcash.checkqueue.busy.ratio", std::min(1.0, busy), "queue", queue);
+    }
+    MetricsGauge("zcash.checkqueue.workers", stats.nWorkers, "queue", queue);
+    MetricsIncrementCounter("zcash.checkqueue.rounds", "queue", queue);
+    if (stats.nBatches < (unsigned int)stats.nWorkers) {
+        MetricsIncrementCounter("zcash.checkqueue.underutilized", "queue", queue);
+    }
+}
+
 static int64_t nTimeVerify = 0;
 static int64_t nTimeConnect = 0;
 static int64_t nTimeIndex = 0;
 static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
+/**
+ * Whether no ("transparent"), some ("mixed") or all ("shielded") of the
+ * transactions of a block have shielded components.
+ */
+static const char* BlockShieldedMix(const CBlock& block)
+{
+    size_t nShielded = 0;
+    for (const CTransaction& tx : block.vtx) {
+        if (!tx.vJoinSplit.empty() ||
+            !tx.vShieldedSpend.empty() ||
+            !tx.vShieldedOutput.empty() ||
+            tx.GetOrchardBundle().IsPresent()) {
+            nShielded++;
+        }
+    }
+    return nShielded == 0 ? "transparent" : nShielded == block.vtx.size() ? "shielded" : "mixed";
+}
+
+/**
+ * Record the time a phase of connecting a block took, in microseconds, in
+ * the zcash.chain.connect.phase.seconds histogram, by phase and by the mix
+ * of transactions of the block (see BlockShieldedMix).
+ */
+static void RecordConnectPhase(const char* phase, const char* mix, int64_t nMicros)
+{
+    MetricsHistogram("zcash.chain.connect.phase.seconds", nMicros * 0.000001, "phase", phase, "mix", mix);
+}
+
+static CConnectTotals connectTotals GUARDED_BY(cs_main);
+
+CConnectTotals GetConnectTotals()
+{
+    AssertLockHeld(cs_main);
+    return connectTotals;
+}
+
+size_t BlockIndexDynamicMemoryUsage()
+{
+    AssertLockHeld(cs_main);
+    return blockIndexArena.DynamicMemoryUsage() + memusage::DynamicUsage(mapBlockIndex) +
+        memusage::MallocUsage(sizeof(CBlockIndex*) * (chainActive.Height() + 1));
+}
+
+size_t RecentRejectsDynamicMemoryUsage()
+{
+    AssertLockHeld(cs_main);
+    return recentRejects ? recentRejects->DynamicMemoryUsage() : 0;
+}
+
+/** The shielded proofs and Orchard actions of a block, as counted in CConnectTotals::nProofs. */
+static uint64_t BlockProofCount(const CBlock& block)
+{
+    uint64_t nProofs = 0;
+    for (const CTransaction& tx : block.vtx) {
+        nProofs += tx.vJoinSplit.size() + tx.vShieldedSpend.size() + tx.vShieldedOutput.size() +
+            tx.GetOrchardBundle().GetNumActions();
+    }
+    return nProofs;
+}
+
 /**
  * Determine whether to do transaction checks when verifying blocks.
  * Returns `false` (allowing transaction checks to be skipped) only if all
@@ -3063,106 +3844,567 @@ static bool ShouldCheckTransactions(const CChainParams& chainparams, const CBloc
              && Checkpoints::IsAncestorOfLastCheckpoint(chainparams.Checkpoints(), pindex));
 }
 
-bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams,
-                  bool fJustCheck, CheckAs blockChecks)
-{
-    AssertLockHeld(cs_main);
+/** How much work, in seconds, an assumed-valid block must be behind the best header. */
+static const int64_t ASSUME_VALID_MIN_AGE = 60 * 60 * 24 * 7 * 2;
 
-    bool fCheckAuthDataRoot = true;
-    bool fExpensiveChecks = true;
+/** The number of recent block templates whose contents are remembered. */
+static const size_t MAX_REMEMBERED_BLOCK_TEMPLATES = 64;
 
-    switch (blockChecks) {
-    case CheckAs::Block:
-        break;
-    case CheckAs::BlockTemplate:
-        // Disable checking proofs and signatures for block templates, to avoid
-        // checking them twice for transactions that were already checked when
-        // added to the mempool.
-        fExpensiveChecks = false;
-    case CheckAs::SlowBenchmark:
-        // Disable checking the authDataRoot for block templates and slow block
-        // benchmarks.
-        fCheckAuthDataRoot = false;
-        break;
-    default:
-        assert(false);
-    }
+/**
+ * The most recent block templates made by CreateNewBlock(), oldest first,
+ * identified by BlockTemplateKey(). Their transactions had their proofs,
+ * scripts and signatures checked when they entered the mempool.
+ */
+static std::deque<uint256> recentBlockTemplates GUARDED_BY(cs_main);
+static std::set<uint256> setRecentBlockTemplates GUARDED_BY(cs_main);
 
-    // If this block is an ancestor of a checkpoint, disable expensive checks
-    if (fCheckpointsEnabled && Checkpoints::IsAncestorOfLastCheckpoint(chainparams.Checkpoints(), pindex)) {
-        fExpensiveChecks = false;
+/**
+ * Identifies the contents of a block on top of a given block: the merkle root
+ * commits to the transaction IDs, and from NU5 on the block commitments hash
+ * commits to their authorizing data, which ConnectBlock() checks.
+ */
+static uint256 BlockTemplateKey(const uint256& hashPrevBlock, const uint256& hashMerkleRoot, const uint256& hashBlockCommitments)
+{
+    CHashWriter ss(SER_GETHASH, 0);
+    ss << hashPrevBlock << hashMerkleRoot << hashBlockCommitments;
+    return ss.GetHash();
+}
+
+void RememberBlockTemplate(const CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    uint256 key = BlockTemplateKey(block.hashPrevBlock, block.hashMerkleRoot, block.hashBlockCommitments);
+    if (!setRecentBlockTemplates.insert(key).second) {
+        return;
+    }
+    recentBlockTemplates.push_back(key);
+    if (recentBlockTemplates.size() > MAX_REMEMBERED_BLOCK_TEMPLATES) {
+        setRecentBlockTemplates.erase(recentBlockTemplates.front());
+        recentBlockTemplates.pop_front();
     }
+}
 
-    // proof verification is expensive, disable if possible
-    auto verifier = fExpensiveChecks ? ProofVerifier::Strict() : ProofVerifier::Disabled();
+/**
+ * Determine whether to do the expensive checks (proofs, scripts and
+ * signatures) when connecting a block. They are skipped for ancestors of the
+ * last checkpoint, and for ancestors of the -assumevalid block as long as:
+ *   - it is an ancestor of the best header, which has at least the minimum
+ *     chain work, so that a chain merely claiming it is not trusted;
+ *   - the block is at least two weeks of work behind the best header, so
+ *     that a recent block is not trusted on the release's say-so alone.
+ * They are also skipped for a block with the same contents as one of our
+ * recent block templates, such as a solved block submitted by a pool.
+ * Every other check, including the value pool balances, is still made.
+ */
+static bool ShouldRunExpensiveChecks(const CChainParams& chainparams, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (pindex->pprev != NULL &&
+        setRecentBlockTemplates.count(BlockTemplateKey(
+            pindex->pprev->GetBlockHash(), pindex->hashMerkleRoot, pindex->hashBlockCommitments)))
+        return false;
+    if (fCheckpointsEnabled && Checkpoints::IsAncestorOfLastCheckpoint(chainparams.Checkpoints(), pindex))
+        return false;
+    if (hashAssumeValid.IsNull() || pindexBestHeader == NULL)
+        return true;
+    BlockMap::const_iterator it = mapBlockIndex.find(hashAssumeValid);
+    if (it == mapBlockIndex.end())
+        return true;
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    return !(it->second->GetAncestor(pindex->nHeight) == pindex
+             && pindexBestHeader->GetAncestor(pindex->nHeight) == pindex
+             && pindexBestHeader->nChainWork >= UintToArith256(consensusParams.nMinimumChainWork)
+             && GetBlockProofEquivalentTime(*pindexBestHeader, *pindex, *pindexBestHeader, consensusParams) > ASSUME_VALID_MIN_AGE);
+}
 
-    // Disable Sapling and Orchard batch validation if possible.
-    std::optional<rust::Box<sapling::BatchValidator>> saplingAuth = fExpensiveChecks ?
-        std::optional(sapling::init_batch_validator()) : std::nullopt;
-    std::optional<orchard::AuthValidator> orchardAuth = fExpensiveChecks ?
-        orchard::AuthValidator::Batch() : orchard::AuthValidator::Disabled();
+/**
+ * The context-free checks for a block on the path towards the best chain,
+ * run on a separate thread while the blocks before it are being connected
+ * (see -pipelineblockconnect). This covers reading the block from disk,
+ * CheckBlock() (including Sprout proofs), and the authorization of the
+ * Sapling and Orchard bundles whose signature hashes do not depend on the
+ * coins being spent; that is all of them except those in v5 transactions
+ * that have transparent inputs.
+ *
+ * Blocks are checked in windows of up to -proofbatchblocks consecutive
+ * blocks, which share a single Sapling batch and a single Orchard batch. If
+ * the batch for a window fails, none of its blocks are treated as having had
+ * their bundles checked, and ConnectBlock() falls back to validating each
+ * block's bundles itself, which identifies the offending block.
+ *
+ * The results are only consumed by ConnectBlock() once the block is actually
+ * being connected on top of its parent, so a block found to be invalid here
+ * is handled by the usual ConnectTip() / InvalidBlockFound() path.
+ */
+class CBlockPrecheck
+{
+public:
+    const CBlockIndex* const pindex;
+    const CDiskBlockPos pos;
+    const uint256 hash;
+    const int nHeight;
+    const bool fExpensiveChecks;
+    const bool fCheckTransactions;
 
-    // If in initial block download, and this block is an ancestor of a checkpoint,
-    // and -ibdskiptxverification is set, disable all transaction checks.
-    bool fCheckTransactions = ShouldCheckTransactions(chainparams, pindex);
+    CBlock block;
+    //! Whether the block was read from disk.
+    bool fRead = false;
+    //! The result of CheckBlock(); if false, `state` holds the reason.
+    bool fValid = false;
+    CValidationState state;
+    //! Whether every shielded bundle queued in this block's window was valid.
+    bool fShieldedAuthValid = false;
+    //! Which of the block's transactions had their shielded bundles queued.
+    std::vector<bool> vShieldedAuthChecked;
+    //! Completion of the window this block belongs to.
+    std::shared_future<void> result;
+    //! Set once the precheck is no longer wanted, so that it is skipped if
+    //! its window has not reached it yet.
+    std::atomic<bool> fCancelled{false};
 
-    // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
-    if (!CheckBlock(block, state, chainparams, verifier,
-        !fJustCheck, !fJustCheck, fCheckTransactions))
-    {
-        return false;
+    CBlockPrecheck(const CBlockIndex* pindexIn, bool fExpensiveChecksIn, bool fCheckTransactionsIn) :
+        pindex(pindexIn), pos(pindexIn->GetBlockPos()), hash(pindexIn->GetBlockHash()),
+        nHeight(pindexIn->nHeight), fExpensiveChecks(fExpensiveChecksIn),
+        fCheckTransactions(fCheckTransactionsIn) {}
+
+    ~CBlockPrecheck() {
+        // The precheck thread may still be writing to this precheck.
+        fCancelled = true;
+        if (result.valid()) {
+            result.wait();
+        }
     }
 
-    // verify that the view's current state corresponds to the previous block
-    uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
-    assert(hashPrevBlock == view.GetBestBlock());
+    bool IsShieldedAuthChecked(size_t i) const {
+        return fShieldedAuthValid && i < vShieldedAuthChecked.size() && vShieldedAuthChecked[i];
+    }
+};
 
-    // Special case for the genesis block, skipping connection of its transactions
-    // (its coinbase is unspendable)
-    if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
-        if (!fJustCheck) {
-            view.SetBestBlock(pindex->GetBlockHash());
-            // Before the genesis block, there was an empty tree
-            SproutMerkleTree tree;
-            pindex->hashSproutAnchor = tree.root();
-            // The genesis block contained no JoinSplits
-            pindex->hashFinalSproutRoot = pindex->hashSproutAnchor;
+/**
+ * Queue the Sapling and Orchard bundles of the given block into the batches,
+ * for every transaction whose signature hash can be computed without the coins
+ * it spends. Returns false if the batches can no longer be used.
+ */
+static bool QueueBlockPrecheckAuth(
+    CBlockPrecheck& precheck,
+    sapling::BatchValidator& saplingAuth,
+    orchard::AuthValidator& orchardAuth,
+    const Consensus::Params& consensus)
+{
+    auto consensusBranchId = CurrentEpochBranchId(precheck.nHeight, consensus);
+    precheck.vShieldedAuthChecked.assign(precheck.block.vtx.size(), false);
+    for (size_t i = 0; i < precheck.block.vtx.size(); i++) {
+        switch (QueueContextFreeShieldedAuth(precheck.block.vtx[i], consensusBranchId, saplingAuth, orchardAuth)) {
+        case ShieldedAuthQueueing::Queued:
+            precheck.vShieldedAuthChecked[i] = true;
+            break;
+        case ShieldedAuthQueueing::NotApplicable:
+            // Leave this transaction for ConnectBlock() to check or reject.
+            break;
+        case ShieldedAuthQueueing::Invalid:
+            return false;
         }
-        return true;
     }
+    return true;
+}
 
-    // Reject a block that results in a negative shielded value pool balance.
-    if (chainparams.ZIP209Enabled()) {
-        // Sprout
-        //
-        // We can expect nChainSproutValue to be valid after the hardcoded
-        // height, and this will be enforced on all descendant blocks. If
-        // the node was reindexed then this will be enforced for all blocks.
-        if (pindex->nChainSproutValue) {
-            if (*pindex->nChainSproutValue < 0) {
-                return state.DoS(100, error("ConnectBlock(): turnstile violation in Sprout shielded value pool"),
-                             REJECT_INVALID, "turnstile-violation-sprout-shielded-pool");
+/**
+ * The coins, anchors and nullifiers that connecting the given block will look
+ * up, other than the coins it creates itself.
+ */
+static void GetBlockInputKeys(const CBlock& block, CCoinsCacheKeys& keys)
+{
+    std::set<uint256> setBlockTxids;
+    for (const CTransaction& tx : block.vtx) {
+        setBlockTxids.insert(tx.GetHash());
+    }
+    for (const CTransaction& tx : block.vtx) {
+        if (!tx.IsCoinBase()) {
+            for (const CTxIn& txin : tx.vin) {
+                if (!setBlockTxids.count(txin.prevout.hash)) {
+                    keys.coins.push_back(txin.prevout);
+                }
             }
         }
-
-        // Sapling
-        //
-        // If we've reached ConnectBlock, we have all transactions of
-        // parents and can expect nChainSaplingValue not to be std::nullopt.
-        // However, the miner and mining RPCs may not have populated this
-        // value and will call `TestBlockValidity`. So, we act
-        // conditionally.
-        if (pindex->nChainSaplingValue) {
-            if (*pindex->nChainSaplingValue < 0) {
-                return state.DoS(100, error("ConnectBlock(): turnstile violation in Sapling shielded value pool"),
-                             REJECT_INVALID, "turnstile-violation-sapling-shielded-pool");
+        for (const JSDescription& joinsplit : tx.vJoinSplit) {
+            keys.sproutAnchors.push_back(joinsplit.anchor);
+            for (const uint256& nf : joinsplit.nullifiers) {
+                keys.sproutNullifiers.push_back(nf);
             }
         }
-
-        // Orchard
-        //
-        // If we've reached ConnectBlock, we have all transactions of
+        for (const SpendDescription& spend : tx.vShieldedSpend) {
+            keys.saplingAnchors.push_back(spend.anchor);
+            keys.saplingNullifiers.push_back(spend.nullifier);
+        }
+        std::optional<uint256> orchardAnchor = tx.GetOrchardBundle().GetAnchor();
+        if (orchardAnchor) {
+            keys.orchardAnchors.push_back(orchardAnchor.value());
+        }
+        for (const uint256& nf : tx.GetOrchardBundle().GetNullifiers()) {
+            keys.orchardNullifiers.push_back(nf);
+        }
+    }
+}
+
+static void RunBlockPrecheckWindow(
+    const std::vector<CBlockPrecheck*> window,
+    const CChainParams& chainparams,
+    const CCoinsView* coinsView)
+{
+    const Consensus::Params& consensus = chainparams.GetConsensus();
+    auto saplingAuth = sapling::init_batch_validator();
+    auto orchardAuth = orchard::AuthValidator::Batch();
+    bool fBatchUsable = true;
+    size_t nBatchBytes = 0;
+
+    for (CBlockPrecheck* precheck : window) {
+        if (precheck->fCancelled) {
+            continue;
+        }
+        if (!ReadBlockFromDisk(precheck->block, precheck->pos, consensus) || precheck->block.GetHash() != precheck->hash) {
+            break;
+        }
+        precheck->fRead = true;
+
+        auto verifier = precheck->fExpensiveChecks ? ProofVerifier::Strict() : ProofVerifier::Disabled();
+        precheck->fValid = CheckBlock(precheck->block, precheck->state, chainparams, verifier,
+                                      true, true, precheck->fCheckTransactions);
+        if (!precheck->fValid) {
+            // Descendants of an invalid block will never be connected.
+            break;
+        }
+
+        // Warm the database's caches for the lookups ConnectBlock() will make.
+        CCoinsCacheKeys keys;
+        GetBlockInputKeys(precheck->block, keys);
+        coinsView->Prefetch(keys);
+
+        if (precheck->fExpensiveChecks && fBatchUsable) {
+            fBatchUsable = QueueBlockPrecheckAuth(*precheck, *saplingAuth, orchardAuth, consensus);
+        }
+
+        // Stop reading ahead once the window holds too much block data.
+        nBatchBytes += ::GetSerializeSize(precheck->block, SER_NETWORK, PROTOCOL_VERSION);
+        if (nBatchBytes >= MAX_PROOF_BATCH_BYTES) {
+            break;
+        }
+    }
+
+    bool fShieldedAuthValid = fBatchUsable && saplingAuth->validate() && orchardAuth.Validate();
+    for (CBlockPrecheck* precheck : window) {
+        precheck->fShieldedAuthValid = fShieldedAuthValid;
+    }
+}
+
+/**
+ * Runs the precheck windows one at a time, in the order they were started, on
+ * a single thread that is started when first needed. Reading further ahead
+ * (-blockprefetch) queues more windows rather than starting more threads.
+ */
+class CBlockPrecheckThread
+{
+private:
+    struct Window {
+        std::vector<CBlockPrecheck*> prechecks;
+        const CChainParams& chainparams;
+        const CCoinsView* coinsView;
+        std::promise<void> done;
+
+        Window(std::vector<CBlockPrecheck*> prechecksIn, const CChainParams& chainparamsIn, const CCoinsView* coinsViewIn) :
+            prechecks(std::move(prechecksIn)), chainparams(chainparamsIn), coinsView(coinsViewIn) {}
+    };
+
+    std::mutex cs;
+    std::condition_variable cond;
+    std::deque<std::unique_ptr<Window>> queue;
+    bool fStop = false;
+    std::thread thread;
+
+    void Run()
+    {
+        while (true) {
+            std::unique_ptr<Window> window;
+            {
+                std::unique_lock<std::mutex> lock(cs);
+                cond.wait(lock, [this] { return fStop || !queue.empty(); });
+                // The windows still queued when stopping are run, as their
+                // prechecks wait for them.
+                if (queue.empty()) {
+                    return;
+                }
+                window = std::move(queue.front());
+                queue.pop_front();
+            }
+            try {
+                RunBlockPrecheckWindow(window->prechecks, window->chainparams, window->coinsView);
+                window->done.set_value();
+            } catch (...) {
+                window->done.set_exception(std::current_exception());
+            }
+        }
+    }
+
+public:
+    ~CBlockPrecheckThread() { Stop(); }
+
+    std::shared_future<void> Start(std::vector<CBlockPrecheck*> prechecks, const CChainParams& chainparams, const CCoinsView* coinsView)
+    {
+        std::unique_ptr<Window> window(new Window(std::move(prechecks), chainparams, coinsView));
+        std::shared_future<void> result = window->done.get_future().share();
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            if (!thread.joinable()) {
+                fStop = false;
+                thread = std::thread(&TraceThread<std::function<void()>>, "blockprecheck", std::function<void()>([this] { Run(); }));
+            }
+            queue.push_back(std::move(window));
+        }
+        cond.notify_one();
+        return result;
+    }
+
+    //! Run the windows still queued, then stop the thread.
+    void Stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(cs);
+            fStop = true;
+        }
+        cond.notify_one();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+};
+
+static CBlockPrecheckThread blockPrecheckThread;
+
+/** Prechecks of the blocks expected to be connected next, in order (protected by cs_main). */
+static std::deque<std::unique_ptr<CBlockPrecheck>> pendingBlockPrechecks;
+
+/**
+ * Start running the context-free checks for the window of blocks after pindex
+ * on the path to pindexMostWork, on the precheck thread.
+ */
+static void StartBlockPrecheckWindow(const CChainParams& chainparams, const CBlockIndex* pindex, CBlockIndex* pindexMostWork)
+{
+    AssertLockHeld(cs_main);
+    int nEndHeight = std::min(pindex->nHeight + nProofBatchBlocks, pindexMostWork->nHeight);
+    std::vector<CBlockPrecheck*> window;
+    for (int nHeight = pindex->nHeight + 1; nHeight <= nEndHeight; nHeight++) {
+        const CBlockIndex* pindexCheck = pindexMostWork->GetAncestor(nHeight);
+        // The same choice of checks as ConnectBlock() makes for CheckAs::Block.
+        // It may change before the block is connected, in which case
+        // ConnectBlock() does not use the precheck.
+        bool fExpensiveChecks = ShouldRunExpensiveChecks(chainparams, pindexCheck);
+        bool fCheckTransactions = ShouldCheckTransactions(chainparams, pindexCheck);
+        pendingBlockPrechecks.emplace_back(new CBlockPrecheck(pindexCheck, fExpensiveChecks, fCheckTransactions));
+        window.push_back(pendingBlockPrechecks.back().get());
+    }
+    if (window.empty()) {
+        return;
+    }
+
+    std::shared_future<void> result = blockPrecheckThread.Start(window, chainparams, pcoinsTip);
+    for (CBlockPrecheck* precheck : window) {
+        precheck->result = result;
+    }
+}
+
+/**
+ * Keep prechecks running ahead of pindexConnect, which is about to be
+ * connected: a window of -proofbatchblocks blocks, and -blockprefetch blocks
+ * beyond it, in windows of up to -proofbatchblocks blocks each.
+ */
+static void ExtendBlockPrechecks(const CChainParams& chainparams, const CBlockIndex* pindexConnect, CBlockIndex* pindexMostWork)
+{
+    AssertLockHeld(cs_main);
+    const CBlockIndex* pindexLast = pindexConnect;
+    if (!pendingBlockPrechecks.empty()) {
+        pindexLast = pendingBlockPrechecks.back()->pindex;
+        if (pindexMostWork->GetAncestor(pindexLast->nHeight) != pindexLast) {
+            // We are now heading towards a different chain.
+            pendingBlockPrechecks.clear();
+            pindexLast = pindexConnect;
+        }
+    }
+    size_t nTarget = nProofBatchBlocks + nBlockPrefetch;
+    while (pendingBlockPrechecks.size() < nTarget) {
+        size_t nPending = pendingBlockPrechecks.size();
+        StartBlockPrecheckWindow(chainparams, pindexLast, pindexMostWork);
+        if (pendingBlockPrechecks.size() == nPending) {
+            // We have reached pindexMostWork.
+            break;
+        }
+        pindexLast = pendingBlockPrechecks.back()->pindex;
+    }
+}
+
+/**
+ * Take the completed precheck for pindex, if one was started. Returns NULL if
+ * there is none, or if it failed to read the block.
+ */
+static std::unique_ptr<CBlockPrecheck> TakeBlockPrecheck(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    while (!pendingBlockPrechecks.empty() && pendingBlockPrechecks.front()->pindex != pindex) {
+        // Prechecks of blocks that are no longer being connected next.
+        pendingBlockPrechecks.pop_front();
+    }
+    if (pendingBlockPrechecks.empty()) {
+        return nullptr;
+    }
+    std::unique_ptr<CBlockPrecheck> precheck = std::move(pendingBlockPrechecks.front());
+    pendingBlockPrechecks.pop_front();
+    try {
+        precheck->result.get();
+    } catch (const std::exception& e) {
+        LogPrintf("%s: precheck of block %s failed: %s\n", __func__, pindex->GetBlockHash().ToString(), e.what());
+        return nullptr;
+    }
+    if (!precheck->fRead) {
+        return nullptr;
+    }
+    return precheck;
+}
+
+bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
+                  CCoinsViewCache& view, const CChainParams& chainparams,
+                  bool fJustCheck, CheckAs blockChecks, const CBlockPrecheck* precheck)
+{
+    AssertLockHeld(cs_main);
+    auto span = TracingSpan("debug", "profile", "ConnectBlock");
+    auto spanGuard = span.Enter();
+    int64_t nTimeCheckStart = GetTimeMicros();
+
+    bool fCheckAuthDataRoot = true;
+    bool fExpensiveChecks = true;
+
+    switch (blockChecks) {
+    case CheckAs::Block:
+        break;
+    case CheckAs::BlockTemplate:
+        // Disable checking proofs and signatures for block templates, to avoid
+        // checking them twice for transactions that were already checked when
+        // added to the mempool.
+        fExpensiveChecks = false;
+    case CheckAs::SlowBenchmark:
+        // Disable checking the authDataRoot for block templates and slow block
+        // benchmarks.
+        fCheckAuthDataRoot = false;
+        break;
+    default:
+        assert(false);
+    }
+
+    // If this block is an ancestor of a checkpoint or of the -assumevalid
+    // block, disable expensive checks
+    if (!ShouldRunExpensiveChecks(chainparams, pindex)) {
+        fExpensiveChecks = false;
+    }
+
+    // proof verification is expensive, disable if possible
+    auto verifier = fExpensiveChecks ? ProofVerifier::Strict() : ProofVerifier::Disabled();
+
+    // Disable Sapling and Orchard batch validation if possible.
+    std::optional<rust::Box<sapling::BatchValidator>> saplingAuth = fExpensiveChecks ?
+        std::optional(sapling::init_batch_validator()) : std::nullopt;
+    std::optional<orchard::AuthValidator> orchardAuth = fExpensiveChecks ?
+        orchard::AuthValidator::Batch() : orchard::AuthValidator::Disabled();
+    // JoinSplit signatures are batch-validated along with the bundles.
+    std::optional<ed25519::BatchValidator> joinSplitAuth;
+    if (fExpensiveChecks) {
+        joinSplitAuth.emplace();
+    }
+
+    // If in initial block download, and this block is an ancestor of a checkpoint,
+    // and -ibdskiptxverification is set, disable all transaction checks.
+    bool fCheckTransactions = ShouldCheckTransactions(chainparams, pindex);
+
+    if (precheck != NULL) {
+        assert(precheck->pindex == pindex && blockChecks == CheckAs::Block && !fJustCheck);
+        // The choice of checks is made again here, as initial block download
+        // may have ended, or the best header or the time may have moved the
+        // -assumevalid decision, since the precheck was started. Unless the
+        // precheck ran the same transaction checks, and the proof checks if
+        // they are to be run now, its result does not stand for CheckBlock()
+        // below.
+        if (precheck->fCheckTransactions != fCheckTransactions ||
+            (fExpensiveChecks && !precheck->fExpensiveChecks)) {
+            LogPrintf("%s: discarding the precheck of block %s, which was made with other checks\n", __func__, pindex->GetBlockHash().ToString());
+            precheck = NULL;
+        }
+    }
+
+    if (precheck != NULL) {
+        // The context-free checks were already run by the block connection pipeline.
+        if (!precheck->fValid) {
+            state = precheck->state;
+            return false;
+        }
+    } else if (!CheckBlock(block, state, chainparams, verifier,
+        !fJustCheck, !fJustCheck, fCheckTransactions))
+    {
+        // Check it again to verify JoinSplit proofs, and in case a previous version let a bad block in
+        return false;
+    }
+
+    // Only the blocks being connected to the active chain are measured, and
+    // not the checks of block templates.
+    const char* mix = (!fJustCheck && blockChecks == CheckAs::Block) ? BlockShieldedMix(block) : nullptr;
+    if (mix) {
+        RecordConnectPhase("check", mix, GetTimeMicros() - nTimeCheckStart);
+    }
+
+    // verify that the view's current state corresponds to the previous block
+    uint256 hashPrevBlock = pindex->pprev == NULL ? uint256() : pindex->pprev->GetBlockHash();
+    assert(hashPrevBlock == view.GetBestBlock());
+
+    // Special case for the genesis block, skipping connection of its transactions
+    // (its coinbase is unspendable)
+    if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
+        if (!fJustCheck) {
+            view.SetBestBlock(pindex->GetBlockHash());
+            // Before the genesis block, there was an empty tree
+            SproutMerkleTree tree;
+            pindex->hashSproutAnchor = tree.root();
+            // The genesis block contained no JoinSplits
+            pindex->hashFinalSproutRoot = pindex->hashSproutAnchor;
+        }
+        return true;
+    }
+
+    // Reject a block that results in a negative shielded value pool balance.
+    if (chainparams.ZIP209Enabled()) {
+        // Sprout
+        //
+        // We can expect nChainSproutValue to be valid after the hardcoded
+        // height, and this will be enforced on all descendant blocks. If
+        // the node was reindexed then this will be enforced for all blocks.
+        if (pindex->nChainSproutValue) {
+            if (*pindex->nChainSproutValue < 0) {
+                return state.DoS(100, error("ConnectBlock(): turnstile violation in Sprout shielded value pool"),
+                             REJECT_INVALID, "turnstile-violation-sprout-shielded-pool");
+            }
+        }
+
+        // Sapling
+        //
+        // If we've reached ConnectBlock, we have all transactions of
+        // parents and can expect nChainSaplingValue not to be std::nullopt.
+        // However, the miner and mining RPCs may not have populated this
+        // value and will call `TestBlockValidity`. So, we act
+        // conditionally.
+        if (pindex->nChainSaplingValue) {
+            if (*pindex->nChainSaplingValue < 0) {
+                return state.DoS(100, error("ConnectBlock(): turnstile violation in Sapling shielded value pool"),
+                             REJECT_INVALID, "turnstile-violation-sapling-shielded-pool");
+            }
+        }
+
+        // Orchard
+        //
+        // If we've reached ConnectBlock, we have all transactions of
         // parents and can expect nChainOrchardValue not to be std::nullopt.
         // However, the miner and mining RPCs may not have populated this
         // value and will call `TestBlockValidity`. So, we act
@@ -3176,12 +4418,29 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     }
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
-    // unless those are already completely spent.
-    for (const CTransaction& tx : block.vtx) {
-        const CCoins* coins = view.AccessCoins(tx.GetHash());
-        if (coins && !coins->IsPruned())
-            return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                             REJECT_INVALID, "bad-txns-BIP30");
+    // unless those are already completely spent. The coins the block spends
+    // are read along with them, so that the lookups reach the coins database
+    // as one sorted batch rather than one at a time.
+    {
+        std::vector<COutPoint> vOutpoints;
+        for (const CTransaction& tx : block.vtx) {
+            for (size_t o = 0; o < tx.vout.size(); o++) {
+                vOutpoints.emplace_back(tx.GetHash(), o);
+            }
+        }
+        size_t nOutputs = vOutpoints.size();
+        for (const CTransaction& tx : block.vtx) {
+            if (tx.IsCoinBase()) continue;
+            for (const CTxIn& txin : tx.vin) {
+                vOutpoints.push_back(txin.prevout);
+            }
+        }
+        std::vector<std::optional<Coin>> vCoins = view.GetCoins(vOutpoints);
+        for (size_t i = 0; i < nOutputs; i++) {
+            if (vCoins[i])
+                return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                                 REJECT_INVALID, "bad-txns-BIP30");
+        }
     }
 
     unsigned int flags = SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
@@ -3190,19 +4449,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     CBlockUndo blockundo;
 
-    CCheckQueueControl<CScriptCheck> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
+    CCheckQueueControl<CScriptCheck, CWorkStealingCheckQueue<CScriptCheck>> control(fExpensiveChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     int64_t nTimeStart = GetTimeMicros();
+    int64_t nTimeCoins = 0;
     CAmount nFees = 0;
     int nInputs = 0;
     unsigned int nSigOps = 0;
-    CDiskTxPos pos(pindex->GetBlockPos(), GetSizeOfCompactSize(block.vtx.size()));
-    std::vector<std::pair<uint256, CDiskTxPos> > vPos;
-    vPos.reserve(block.vtx.size());
     blockundo.vtxundo.reserve(block.vtx.size() - 1);
-    std::vector<CAddressIndexDbEntry> addressIndex;
-    std::vector<CAddressUnspentDbEntry> addressUnspentIndex;
-    std::vector<CSpentIndexDbEntry> spentIndex;
 
     // Construct the incremental merkle tree at the current
     // block position,
@@ -3223,6 +4477,9 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     SaplingMerkleTree sapling_tree;
     assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
+    // Sapling anchors are never within the block, so the block's note
+    // commitments are appended to the tree together at the end.
+    std::vector<libzcash::PedersenHash> vSaplingCommitments;
 
     OrchardMerkleFrontier orchard_tree;
     if (pindex->pprev && chainparams.GetConsensus().NetworkUpgradeActive(pindex->pprev->nHeight, Consensus::UPGRADE_NU5)) {
@@ -3246,18 +4503,33 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     size_t total_sapling_tx = 0;
     size_t total_orchard_tx = 0;
 
-    std::vector<PrecomputedTransactionData> txdata;
-    txdata.reserve(block.vtx.size()); // Required so that pointers to individual PrecomputedTransactionData don't get invalidated
+    // The script checks queued below point into these until control.Wait().
+    std::vector<std::shared_ptr<const PrecomputedTransactionData>> txdata;
+    txdata.reserve(block.vtx.size());
+    // The transactions whose JoinSplit signature is queued in joinSplitAuth.
+    std::vector<size_t> vJoinSplitAuthTxs;
+    // Checked one at a time, the JoinSplit signature of a transaction is
+    // checked before any later check of the block. So if a later check fails
+    // while the batch holds an invalid signature, that signature is reported.
+    auto checkJoinSplitAuthFirst = [&](bool fValid) {
+        if (!fValid && !vJoinSplitAuthTxs.empty() && !joinSplitAuth.value().Validate()) {
+            CValidationState sigState;
+            if (!CheckJoinSplitSignatures(block, vJoinSplitAuthTxs, txdata, sigState,
+                                          consensusBranchId, chainparams.GetConsensus())) {
+                state = sigState;
+            }
+        }
+        return fValid;
+    };
     for (unsigned int i = 0; i < block.vtx.size(); i++)
     {
         const CTransaction &tx = block.vtx[i];
-        const uint256 hash = tx.GetHash();
 
         nInputs += tx.vin.size();
         nSigOps += GetLegacySigOpCount(tx);
         if (nSigOps > MAX_BLOCK_SIGOPS)
-            return state.DoS(100, error("ConnectBlock(): too many sigops"),
-                             REJECT_INVALID, "bad-blk-sigops");
+            return checkJoinSplitAuthFirst(state.DoS(100, error("ConnectBlock(): too many sigops"),
+                             REJECT_INVALID, "bad-blk-sigops"));
 
         // Coinbase transactions are the only case where this vector will not be the same
         // length as `tx.vin` (since coinbase transactions have a single synthetic input).
@@ -3266,50 +4538,27 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         // txid.
         std::vector<CTxOut> allPrevOutputs;
 
+        // Transactions from our mempool were checked with the same signature
+        // hash data, unless the consensus branch has changed since.
+        std::shared_ptr<const PrecomputedTransactionData> txdataCached;
+        if (!tx.IsCoinBase()) {
+            txdataCached = mempool.GetTxData(tx.GetWTxId(), consensusBranchId);
+        }
+
         // Are the shielded spends' requirements met?
         if (!Consensus::CheckTxShieldedInputs(tx, state, view, 100)) {
-            return false;
+            return checkJoinSplitAuthFirst(false);
         }
 
         if (!tx.IsCoinBase())
         {
             if (!view.HaveInputs(tx))
-                return state.DoS(100, error("ConnectBlock(): inputs missing/spent"),
-                                 REJECT_INVALID, "bad-txns-inputs-missingorspent");
-
-            for (const auto& input : tx.vin) {
-                allPrevOutputs.push_back(view.GetOutputFor(input));
-            }
-
-            // insightexplorer
-            // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2597
-            if (fAddressIndex || fSpentIndex) {
-                for (size_t j = 0; j < tx.vin.size(); j++) {
-
-                    const CTxIn input = tx.vin[j];
-                    const CTxOut &prevout = allPrevOutputs[j];
-                    CScript::ScriptType scriptType = prevout.scriptPubKey.GetType();
-                    const uint160 addrHash = prevout.scriptPubKey.AddressHash();
-                    if (fAddressIndex && scriptType != CScript::UNKNOWN) {
-                        // record spending activity
-                        addressIndex.push_back(make_pair(
-                            CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, j, true),
-                            prevout.nValue * -1));
-
-                        // remove address from unspent index
-                        addressUnspentIndex.push_back(make_pair(
-                            CAddressUnspentKey(scriptType, addrHash, input.prevout.hash, input.prevout.n),
-                            CAddressUnspentValue()));
-                    }
-                    if (fSpentIndex) {
-                        // Add the spent index to determine the txid and input that spent an output
-                        // and to find the amount and address from an input.
-                        // If we do not recognize the script type, we still add an entry to the
-                        // spentindex db, with a script type of 0 and addrhash of all zeroes.
-                        spentIndex.push_back(make_pair(
-                            CSpentIndexKey(input.prevout.hash, input.prevout.n),
-                            CSpentIndexValue(hash, j, pindex->nHeight, prevout.nValue, scriptType, addrHash)));
-                    }
+                return checkJoinSplitAuthFirst(state.DoS(100, error("ConnectBlock(): inputs missing/spent"),
+                                 REJECT_INVALID, "bad-txns-inputs-missingorspent"));
+
+            if (!txdataCached) {
+                for (const auto& input : tx.vin) {
+                    allPrevOutputs.push_back(view.GetOutputFor(input));
                 }
             }
 
@@ -3318,11 +4567,15 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             // an incredibly-expensive-to-validate block.
             nSigOps += GetP2SHSigOpCount(tx, view);
             if (nSigOps > MAX_BLOCK_SIGOPS)
-                return state.DoS(100, error("ConnectBlock(): too many sigops"),
-                                 REJECT_INVALID, "bad-blk-sigops");
+                return checkJoinSplitAuthFirst(state.DoS(100, error("ConnectBlock(): too many sigops"),
+                                 REJECT_INVALID, "bad-blk-sigops"));
         }
 
-        txdata.emplace_back(tx, allPrevOutputs);
+        if (txdataCached) {
+            txdata.push_back(txdataCached);
+        } else {
+            txdata.push_back(std::make_shared<const PrecomputedTransactionData>(tx, allPrevOutputs));
+        }
 
         if (!tx.IsCoinBase())
         {
@@ -3330,58 +4583,50 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
             std::vector<CScriptCheck> vChecks;
             bool fCacheResults = fJustCheck; /* Don't cache results if we're actually connecting blocks (still consult the cache, though) */
-            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, fCacheResults, txdata.back(), chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
-                return error("ConnectBlock(): CheckInputs on %s failed with %s",
-                    tx.GetHash().ToString(), FormatStateMessage(state));
+            if (!ContextualCheckInputs(tx, state, view, fExpensiveChecks, flags, fCacheResults, *txdata.back(), chainparams.GetConsensus(), consensusBranchId, nScriptCheckThreads ? &vChecks : NULL))
+                return checkJoinSplitAuthFirst(error("ConnectBlock(): CheckInputs on %s failed with %s",
+                    tx.GetHash().ToString(), FormatStateMessage(state)));
             control.Add(vChecks);
         }
 
-        // Check shielded inputs.
+        // Check shielded inputs. Bundles whose authorization was already
+        // validated by the block connection pipeline are not queued again.
+        // Skip the Sapling and Orchard bundles if they were already checked
+        // ahead of this block, or when the transaction entered the mempool.
+        bool fShieldedAuthChecked = (precheck != NULL && precheck->IsShieldedAuthChecked(i)) ||
+            (saplingAuth.has_value() && AreShieldedBundlesCached(tx, consensusBranchId, !fJustCheck));
+        std::optional<rust::Box<sapling::BatchValidator>> noSaplingAuth;
+        std::optional<orchard::AuthValidator> noOrchardAuth;
+        if (!tx.vJoinSplit.empty() && joinSplitAuth.has_value()) {
+            vJoinSplitAuthTxs.push_back(i);
+        }
         if (!ContextualCheckShieldedInputs(
             tx,
-            txdata.back(),
+            *txdata.back(),
             state,
             view,
-            saplingAuth,
-            orchardAuth,
+            fShieldedAuthChecked ? noSaplingAuth : saplingAuth,
+            fShieldedAuthChecked ? noOrchardAuth : orchardAuth,
             chainparams.GetConsensus(),
             consensusBranchId,
             chainparams.GetConsensus().NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_NU5),
-            true))
+            true,
+            IsInitialBlockDownload,
+            joinSplitAuth.has_value() ? &joinSplitAuth.value() : nullptr))
         {
-            return error(
+            return checkJoinSplitAuthFirst(error(
                 "ConnectBlock(): ContextualCheckShieldedInputs() on %s failed with %s",
                 tx.GetHash().ToString(),
-                FormatStateMessage(state));
-        }
-
-        // insightexplorer
-        // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-7ec3c68a81efff79b6ca22ac1f1eabbaR2656
-        if (fAddressIndex) {
-            for (unsigned int k = 0; k < tx.vout.size(); k++) {
-                const CTxOut &out = tx.vout[k];
-                CScript::ScriptType scriptType = out.scriptPubKey.GetType();
-                if (scriptType != CScript::UNKNOWN) {
-                    uint160 const addrHash = out.scriptPubKey.AddressHash();
-
-                    // record receiving activity
-                    addressIndex.push_back(make_pair(
-                        CAddressIndexKey(scriptType, addrHash, pindex->nHeight, i, hash, k, false),
-                        out.nValue));
-
-                    // record unspent output
-                    addressUnspentIndex.push_back(make_pair(
-                        CAddressUnspentKey(scriptType, addrHash, hash, k),
-                        CAddressUnspentValue(out.nValue, out.scriptPubKey, pindex->nHeight)));
-                }
-            }
+                FormatStateMessage(state)));
         }
 
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
         }
+        int64_t nTimeCoinsStart = GetTimeMicros();
         UpdateCoins(tx, view, i == 0 ? undoDummy : blockundo.vtxundo.back(), pindex->nHeight);
+        nTimeCoins += GetTimeMicros() - nTimeCoinsStart;
 
         for (const JSDescription &joinsplit : tx.vJoinSplit) {
             for (const uint256 &note_commitment : joinsplit.commitments) {
@@ -3392,13 +4637,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
 
         for (const OutputDescription &outputDescription : tx.vShieldedOutput) {
-            sapling_tree.append(outputDescription.cmu);
+            vSaplingCommitments.push_back(outputDescription.cmu);
         }
 
         if (!orchard_tree.AppendBundle(tx.GetOrchardBundle())) {
-            return state.DoS(100,
+            return checkJoinSplitAuthFirst(state.DoS(100,
                 error("ConnectBlock(): block would overfill the Orchard commitment tree."),
-                REJECT_INVALID, "orchard-commitment-tree-full");
+                REJECT_INVALID, "orchard-commitment-tree-full"));
         };
 
         if (!(tx.vShieldedSpend.empty() && tx.vShieldedOutput.empty())) {
@@ -3408,10 +4653,8 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (tx.GetOrchardBundle().IsPresent()) {
             total_orchard_tx += 1;
         }
-
-        vPos.push_back(std::make_pair(tx.GetHash(), pos));
-        pos.nTxOffset += ::GetSerializeSize(tx, SER_DISK, CLIENT_VERSION);
     }
+    sapling_tree.append_many(vSaplingCommitments);
 
     // Derive the various block commitments.
     // We only derive them if they will be used for this block.
@@ -3466,18 +4709,18 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
                 hashChainHistoryRoot.value(),
                 hashAuthDataRoot.value());
             if (block.hashBlockCommitments != hashBlockCommitments) {
-                return state.DoS(100,
+                return checkJoinSplitAuthFirst(state.DoS(100,
                     error("ConnectBlock(): block's hashBlockCommitments is incorrect (should be ZIP 244 block commitment)"),
-                    REJECT_INVALID, "bad-block-commitments-hash");
+                    REJECT_INVALID, "bad-block-commitments-hash"));
             }
         }
     } else if (IsActivationHeight(pindex->nHeight, chainparams.GetConsensus(), Consensus::UPGRADE_HEARTWOOD)) {
         // In the block that activates ZIP 221, block.hashBlockCommitments MUST
         // be set to all zero bytes.
         if (!block.hashBlockCommitments.IsNull()) {
-            return state.DoS(100,
+            return checkJoinSplitAuthFirst(state.DoS(100,
                 error("ConnectBlock(): block's hashBlockCommitments is incorrect (should be null)"),
-                REJECT_INVALID, "bad-heartwood-root-in-block");
+                REJECT_INVALID, "bad-heartwood-root-in-block"));
         }
     } else if (chainparams.GetConsensus().NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_HEARTWOOD)) {
         // If Heartwood is active, block.hashBlockCommitments must be the same as
@@ -3489,17 +4732,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         //   this epoch's tree root, but as we haven't updated the tree for this
         //   block yet, view.GetHistoryRoot() returns the root we need.
         if (block.hashBlockCommitments != hashChainHistoryRoot.value()) {
-            return state.DoS(100,
+            return checkJoinSplitAuthFirst(state.DoS(100,
                 error("ConnectBlock(): block's hashBlockCommitments is incorrect (should be history tree root)"),
-                REJECT_INVALID, "bad-heartwood-root-in-block");
+                REJECT_INVALID, "bad-heartwood-root-in-block"));
         }
     } else if (chainparams.GetConsensus().NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_SAPLING)) {
         // If Sapling is active, block.hashBlockCommitments must be the
         // same as the root of the Sapling tree
         if (block.hashBlockCommitments != sapling_tree.root()) {
-            return state.DoS(100,
+            return checkJoinSplitAuthFirst(state.DoS(100,
                 error("ConnectBlock(): block's hashBlockCommitments is incorrect (should be Sapling tree root)"),
-                REJECT_INVALID, "bad-sapling-root-in-block");
+                REJECT_INVALID, "bad-sapling-root-in-block"));
         }
     }
 
@@ -3535,13 +4778,36 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
 
     int64_t nTime1 = GetTimeMicros(); nTimeConnect += nTime1 - nTimeStart;
     LogPrint("bench", "      - Connect %u transactions: %.2fms (%.3fms/tx, %.3fms/txin) [%.2fs]\n", (unsigned)block.vtx.size(), 0.001 * (nTime1 - nTimeStart), 0.001 * (nTime1 - nTimeStart) / block.vtx.size(), nInputs <= 1 ? 0 : 0.001 * (nTime1 - nTimeStart) / (nInputs-1), nTimeConnect * 0.000001);
+    if (mix) {
+        RecordConnectPhase("transactions", mix, nTime1 - nTimeStart - nTimeCoins);
+        RecordConnectPhase("coins", mix, nTimeCoins);
+    }
 
     CAmount blockReward = nFees + GetBlockSubsidy(pindex->nHeight, chainparams.GetConsensus());
     if (block.vtx[0].GetValueOut() > blockReward)
-        return state.DoS(100,
+        return checkJoinSplitAuthFirst(state.DoS(100,
                          error("ConnectBlock(): coinbase pays too much (actual=%d vs limit=%d)",
                                block.vtx[0].GetValueOut(), blockReward),
-                               REJECT_INVALID, "bad-cb-amount");
+                               REJECT_INVALID, "bad-cb-amount"));
+
+    // Ensure JoinSplit signatures are valid (if we are checking them). If the
+    // batch fails, find the transaction that caused it.
+    int64_t nTimeBatch = GetTimeMicros();
+    bool fJoinSplitAuthValid = !joinSplitAuth.has_value() || joinSplitAuth.value().Validate();
+    if (mix && joinSplitAuth.has_value()) {
+        int64_t nTimeBatchEnd = GetTimeMicros();
+        RecordConnectPhase("joinsplitbatch", mix, nTimeBatchEnd - nTimeBatch);
+        nTimeBatch = nTimeBatchEnd;
+    }
+    if (!fJoinSplitAuthValid) {
+        if (!CheckJoinSplitSignatures(block, vJoinSplitAuthTxs, txdata, state,
+                                      consensusBranchId, chainparams.GetConsensus())) {
+            return false;
+        }
+        return state.DoS(100,
+            error("ConnectBlock(): a JoinSplit signature within the block is invalid"),
+            REJECT_INVALID, "bad-txns-invalid-joinsplit-signature");
+    }
 
     // Ensure Sapling authorizations are valid (if we are checking them)
     if (saplingAuth.has_value() && !saplingAuth.value()->validate()) {
@@ -3549,6 +4815,11 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             error("ConnectBlock(): a Sapling bundle within the block is invalid"),
             REJECT_INVALID, "bad-sapling-bundle-authorization");
     }
+    if (mix && saplingAuth.has_value()) {
+        int64_t nTimeBatchEnd = GetTimeMicros();
+        RecordConnectPhase("saplingbatch", mix, nTimeBatchEnd - nTimeBatch);
+        nTimeBatch = nTimeBatchEnd;
+    }
 
     // Ensure Orchard signatures are valid (if we are checking them)
     if (orchardAuth.has_value() && !orchardAuth.value().Validate()) {
@@ -3556,10 +4827,21 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             error("ConnectBlock(): an Orchard bundle within the block is invalid"),
             REJECT_INVALID, "bad-orchard-bundle-authorization");
     }
+    if (mix && orchardAuth.has_value()) {
+        int64_t nTimeBatchEnd = GetTimeMicros();
+        RecordConnectPhase("orchardbatch", mix, nTimeBatchEnd - nTimeBatch);
+        nTimeBatch = nTimeBatchEnd;
+    }
 
-    if (!control.Wait())
+    // The time left waiting for the script checks of the other threads.
+    CCheckQueueStats scriptCheckStats;
+    if (!control.Wait(&scriptCheckStats))
         return state.DoS(100, false);
+    RecordCheckQueueStats("script", scriptCheckStats);
     int64_t nTime2 = GetTimeMicros(); nTimeVerify += nTime2 - nTimeStart;
+    if (mix) {
+        RecordConnectPhase("scriptwait", mix, nTime2 - nTimeBatch);
+    }
     LogPrint("bench", "    - Verify %u txins: %.2fms (%.3fms/txin) [%.2fs]\n", nInputs - 1, 0.001 * (nTime2 - nTimeStart), nInputs <= 1 ? 0 : 0.001 * (nTime2 - nTimeStart) / (nInputs-1), nTimeVerify * 0.000001);
 
     if (fJustCheck)
@@ -3570,9 +4852,10 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     {
         if (pindex->GetUndoPos().IsNull()) {
             CDiskBlockPos _pos;
-            if (!FindUndoPos(state, pindex->nFile, _pos, ::GetSerializeSize(blockundo, SER_DISK, CLIENT_VERSION) + 40))
+            CDiskRecord record(blockundo, fCompressBlockFiles);
+            if (!FindUndoPos(state, pindex->nFile, _pos, record.size() + 40))
                 return error("ConnectBlock(): FindUndoPos failed");
-            if (!UndoWriteToDisk(blockundo, _pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
+            if (!UndoWriteToDisk(blockundo, record, _pos, pindex->pprev->GetBlockHash(), chainparams.MessageStart()))
                 return AbortNode(state, "Failed to write undo data");
 
             // update nUndoPos in block index
@@ -3595,51 +4878,17 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         setDirtyBlockIndex.insert(pindex);
     }
 
-    if (fTxIndex)
-        if (!pblocktree->WriteTxIndex(vPos))
-            return AbortNode(state, "Failed to write transaction index");
-
-    // START insightexplorer
-    if (fAddressIndex) {
-        if (!pblocktree->WriteAddressIndex(addressIndex)) {
-            return AbortNode(state, "Failed to write address index");
-        }
-        if (!pblocktree->UpdateAddressUnspentIndex(addressUnspentIndex)) {
-            return AbortNode(state, "Failed to write address unspent index");
-        }
-    }
-    if (fSpentIndex) {
-        if (!pblocktree->UpdateSpentIndex(spentIndex)) {
-            return AbortNode(state, "Failed to write spent index");
-        }
-    }
-    if (fTimestampIndex) {
-        unsigned int logicalTS = pindex->nTime;
-        unsigned int prevLogicalTS = 0;
-
-        // retrieve logical timestamp of the previous block
-        if (pindex->pprev)
-            if (!pblocktree->ReadTimestampBlockIndex(pindex->pprev->GetBlockHash(), prevLogicalTS))
-                LogPrintf("%s: Failed to read previous block's logical timestamp\n", __func__);
-
-        if (logicalTS <= prevLogicalTS) {
-            logicalTS = prevLogicalTS + 1;
-            LogPrintf("%s: Previous logical timestamp is newer Actual[%d] prevLogical[%d] Logical[%d]\n", __func__, pindex->nTime, prevLogicalTS, logicalTS);
-        }
-
-        if (!pblocktree->WriteTimestampIndex(CTimestampIndexKey(logicalTS, pindex->GetBlockHash())))
-            return AbortNode(state, "Failed to write timestamp index");
-
-        if (!pblocktree->WriteTimestampBlockIndex(CTimestampBlockIndexKey(pindex->GetBlockHash()), CTimestampBlockIndexValue(logicalTS)))
-            return AbortNode(state, "Failed to write blockhash index");
-    }
-    // END insightexplorer
+    // The transaction and insight explorer indexes are written by
+    // CInsightIndex once the block is part of the active chain.
 
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
     int64_t nTime3 = GetTimeMicros(); nTimeIndex += nTime3 - nTime2;
     LogPrint("bench", "    - Index writing: %.2fms [%.2fs]\n", 0.001 * (nTime3 - nTime2), nTimeIndex * 0.000001);
+    if (mix) {
+        RecordConnectPhase("index", mix, nTime3 - nTime2);
+    }
 
     return true;
 }
@@ -3651,6 +4900,9 @@ enum FlushStateMode {
     FLUSH_STATE_ALWAYS
 };
 
+static bool FindFilesToPack(const CChainParams& chainparams, std::set<int>& setFilesToPack);
+static void UnlinkPackedFiles(const std::set<int>& setFilesToPack);
+
 /**
  * Update the on-disk chain state.
  * The caches and indexes are flushed depending on the mode we're called with
@@ -3662,21 +4914,30 @@ bool static FlushStateToDisk(
     CValidationState &state,
     FlushStateMode mode) {
     LOCK2(cs_main, cs_LastBlockFile);
+    auto span = TracingSpan("debug", "profile", "FlushStateToDisk");
+    auto spanGuard = span.Enter();
     static int64_t nLastWrite = 0;
     static int64_t nLastFlush = 0;
+    // Memory used by the coins that are being written in the background.
+    static size_t nFlushingCacheSize = 0;
     std::set<int> setFilesToPrune;
+    std::set<int> setFilesToPack;
     bool fFlushForPrune = false;
     try {
-    if (fPruneMode && fCheckForPruning && !fReindex) {
-        FindFilesToPrune(setFilesToPrune, chainparams.PruneAfterHeight());
+    if (fCheckForPruning && !fReindex) {
         fCheckForPruning = false;
-        if (!setFilesToPrune.empty()) {
-            fFlushForPrune = true;
-            if (!fHavePruned) {
+        if (fPackBlockFiles && FindFilesToPack(chainparams, setFilesToPack)) {
+            // Pack the remaining files on later flushes.
+            fCheckForPruning = true;
+        }
+        if (fPruneMode) {
+            FindFilesToPrune(setFilesToPrune, chainparams.PruneAfterHeight());
+            if (!setFilesToPrune.empty() && !fHavePruned) {
                 pblocktree->WriteFlag("prunedblockfiles", true);
                 fHavePruned = true;
             }
         }
+        fFlushForPrune = !setFilesToPrune.empty() || !setFilesToPack.empty();
     }
     int64_t nNow = GetTimeMicros();
     // Avoid writing/flushing immediately after startup.
@@ -3686,7 +4947,14 @@ bool static FlushStateToDisk(
     if (nLastFlush == 0) {
         nLastFlush = nNow;
     }
-    size_t cacheSize = pcoinsTip->DynamicMemoryUsage();
+    // Release the coins of a background write that has finished.
+    if (pcoinsFlushLayer) {
+        if (!pcoinsFlushLayer->Collect())
+            return AbortNode(state, "Failed to write to coin database");
+        if (!pcoinsFlushLayer->IsWriting())
+            nFlushingCacheSize = 0;
+    }
+    size_t cacheSize = pcoinsTip->DynamicMemoryUsage() + nFlushingCacheSize;
     // The cache is large and close to the limit, but we have time now (not in the middle of a block processing).
     bool fCacheLarge = mode == FLUSH_STATE_PERIODIC && cacheSize * (10.0/9) > nCoinCacheUsage;
     // The cache is over the limit, we have to write now.
@@ -3697,6 +4965,12 @@ bool static FlushStateToDisk(
     bool fPeriodicFlush = mode == FLUSH_STATE_PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
     // Combine all conditions that result in a full cache flush.
     bool fDoFullFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+    // Flushing while a background write is in progress means waiting for it,
+    // so put off the flushes that are only opportunistic.
+    bool fMustFlush = (mode == FLUSH_STATE_ALWAYS) || fCacheCritical || fFlushForPrune;
+    if (fDoFullFlush && !fMustFlush && pcoinsFlushLayer && pcoinsFlushLayer->IsWriting()) {
+        fDoFullFlush = false;
+    }
     // Write blocks and block index to disk.
     if (fDoFullFlush || fPeriodicWrite) {
         // Depend on nMinDiskSpace to ensure we can write block index
@@ -3712,34 +4986,54 @@ bool static FlushStateToDisk(
                 vFiles.push_back(make_pair(*it, &vinfoBlockFile[*it]));
                 it = setDirtyFileInfo.erase(it);
             }
-            std::vector<const CBlockIndex*> vBlocks;
-            vBlocks.reserve(setDirtyBlockIndex.size());
-            for (set<CBlockIndex*>::iterator it = setDirtyBlockIndex.begin(); it != setDirtyBlockIndex.end(); ) {
-                vBlocks.push_back(*it);
-                it = setDirtyBlockIndex.erase(it);
-            }
+            std::vector<CBlockIndex*> vDirty(setDirtyBlockIndex.begin(), setDirtyBlockIndex.end());
+            setDirtyBlockIndex.clear();
+            std::vector<const CBlockIndex*> vBlocks(vDirty.begin(), vDirty.end());
             if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                 return AbortNode(state, "Files to write to block index database");
             }
+            // The solutions can now be read back from the database.
+            for (CBlockIndex* pindex : vDirty)
+                pindex->TrimSolution();
         }
-        // Finally remove any pruned files
-        if (fFlushForPrune)
+        // Finally remove any pruned files, and the files that have been packed
+        if (fFlushForPrune) {
             UnlinkPrunedFiles(setFilesToPrune);
+            UnlinkPackedFiles(setFilesToPack);
+        }
         nLastWrite = nNow;
     }
     // Flush best chain related state. This can only be done if the blocks / block index write was also done.
     if (fDoFullFlush) {
-        // Typical CCoins structures on disk are around 128 bytes in size.
+        int64_t nFlushStart = GetTimeMicros();
+        // Typical Coin structures on disk are around 48 bytes in size.
         // Pushing a new one to the database can cause it to be written
         // twice (once in the log, and once in the tables). This is already
         // an overestimation, as most will delete an existing entry or
         // overwrite one. Still, use a conservative safety factor of 2.
-        if (!CheckDiskSpace(128 * 2 * 2 * pcoinsTip->GetCacheSize()))
+        if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
             return state.Error("out of disk space");
         // Flush the chainstate (which may refer to block index entries).
+        // With -asynccoinsflush this only hands the cache over to
+        // pcoinsFlushLayer, which writes it in the background.
+        size_t nTipCacheSize = pcoinsTip->DynamicMemoryUsage();
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        if (pcoinsFlushLayer) {
+            nFlushingCacheSize = nTipCacheSize;
+            // Callers flushing with FLUSH_STATE_ALWAYS expect the database to
+            // be up to date, and pruned blocks can no longer be replayed.
+            if (mode == FLUSH_STATE_ALWAYS || fFlushForPrune) {
+                if (!pcoinsFlushLayer->Sync())
+                    return AbortNode(state, "Failed to write to coin database");
+                nFlushingCacheSize = 0;
+            }
+        }
         nLastFlush = nNow;
+        int64_t nFlushTime = GetTimeMicros() - nFlushStart;
+        connectTotals.nFlushes++;
+        connectTotals.nFlushMicros += nFlushTime;
+        connectTotals.nMaxFlushMicros = std::max(connectTotals.nMaxFlushMicros, nFlushTime);
     }
     // Don't flush the wallet witness cache (SetBestChain()) here, see #4301
     } catch (const std::runtime_error& e) {
@@ -3753,10 +5047,113 @@ void FlushStateToDisk() {
     FlushStateToDisk(Params(), state, FLUSH_STATE_ALWAYS);
 }
 
-void PruneAndFlush() {
-    CValidationState state;
-    fCheckForPruning = true;
-    FlushStateToDisk(Params(), state, FLUSH_STATE_NONE);
+static const char* COINS_CACHE_FILENAME = "coinscache.dat";
+static const uint32_t COINS_CACHE_FILE_VERSION = 1;
+/** Number of keys looked up per acquisition of cs_main while warming up. */
+static const size_t COINS_CACHE_LOAD_BATCH_SIZE = 1000;
+
+bool DumpCoinsCacheKeys()
+{
+    CCoinsCacheKeys keys;
+    {
+        LOCK(cs_main);
+        pcoinsTip->GetCachedKeys(keys);
+    }
+
+    fs::path path = GetDataDir() / COINS_CACHE_FILENAME;
+    fs::path pathNew = GetDataDir() / (std::string(COINS_CACHE_FILENAME) + ".new");
+    try {
+        CAutoFile file(fsbridge::fopen(pathNew, "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return error("%s: failed to open %s", __func__, pathNew.string());
+        file << COINS_CACHE_FILE_VERSION;
+        file << keys;
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathNew, path))
+            return error("%s: failed to rename %s", __func__, pathNew.string());
+    } catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    LogPrintf("%s: saved %u coins, %u anchors and %u nullifiers\n", __func__,
+        keys.coins.size(),
+        keys.sproutAnchors.size() + keys.saplingAnchors.size() + keys.orchardAnchors.size(),
+        keys.sproutNullifiers.size() + keys.saplingNullifiers.size() + keys.orchardNullifiers.size());
+    return true;
+}
+
+void LoadCoinsCacheKeys()
+{
+    CAutoFile file(fsbridge::fopen(GetDataDir() / COINS_CACHE_FILENAME, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull())
+        return;
+
+    CCoinsCacheKeys keys;
+    try {
+        uint32_t nVersion;
+        file >> nVersion;
+        if (nVersion != COINS_CACHE_FILE_VERSION) {
+            LogPrintf("%s: unknown version %u of %s, ignoring it\n", __func__, nVersion, COINS_CACHE_FILENAME);
+            return;
+        }
+        file >> keys;
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to read %s: %s\n", __func__, COINS_CACHE_FILENAME, e.what());
+        return;
+    }
+
+    // Leave room for the blocks connected meanwhile and afterwards, so that
+    // warming up does not cause the cache to be flushed.
+    const size_t nMaxUsage = nCoinCacheUsage / 2;
+    int64_t nStart = GetTimeMillis();
+    size_t nLookups = 0;
+    bool fFull = false;
+    auto lookUp = [&](size_t nKeys, std::function<void(size_t)> lookUpKey) {
+        for (size_t i = 0; i < nKeys && !fFull; ) {
+            boost::this_thread::interruption_point();
+            LOCK(cs_main);
+            for (size_t nEnd = std::min(nKeys, i + COINS_CACHE_LOAD_BATCH_SIZE); i < nEnd; i++) {
+                lookUpKey(i);
+                nLookups++;
+            }
+            fFull = pcoinsTip->DynamicMemoryUsage() >= nMaxUsage;
+        }
+    };
+
+    // The anchors are few, and needed by every shielded transaction.
+    lookUp(keys.sproutAnchors.size(), [&](size_t i) {
+        SproutMerkleTree tree;
+        pcoinsTip->GetSproutAnchorAt(keys.sproutAnchors[i], tree);
+    });
+    lookUp(keys.saplingAnchors.size(), [&](size_t i) {
+        SaplingMerkleTree tree;
+        pcoinsTip->GetSaplingAnchorAt(keys.saplingAnchors[i], tree);
+    });
+    lookUp(keys.orchardAnchors.size(), [&](size_t i) {
+        OrchardMerkleFrontier tree;
+        pcoinsTip->GetOrchardAnchorAt(keys.orchardAnchors[i], tree);
+    });
+    lookUp(keys.coins.size(), [&](size_t i) {
+        pcoinsTip->HaveCoin(keys.coins[i]);
+    });
+    lookUp(keys.sproutNullifiers.size(), [&](size_t i) {
+        pcoinsTip->GetNullifier(keys.sproutNullifiers[i], SPROUT);
+    });
+    lookUp(keys.saplingNullifiers.size(), [&](size_t i) {
+        pcoinsTip->GetNullifier(keys.saplingNullifiers[i], SAPLING);
+    });
+    lookUp(keys.orchardNullifiers.size(), [&](size_t i) {
+        pcoinsTip->GetNullifier(keys.orchardNullifiers[i], ORCHARD);
+    });
+
+    LogPrintf("%s: looked up %u coins cache entries in %dms%s\n", __func__,
+        nLookups, GetTimeMillis() - nStart, fFull ? " (cache limit reached)" : "");
+}
+
+void PruneAndFlush() {
+    CValidationState state;
+    fCheckForPruning = true;
+    FlushStateToDisk(Params(), state, FLUSH_STATE_NONE);
 }
 
 struct PoolMetrics {
@@ -3899,18 +5296,147 @@ void static UpdateTip(CBlockIndex *pindexNew, const CChainParams& chainParams) {
     }
 }
 
+/** The number of threads that read the blocks of a reorg ahead of DisconnectTip. */
+static const int DISCONNECT_PREFETCH_THREADS = 4;
+
+/** The block and undo data of a block about to be disconnected, read ahead. */
+class CDisconnectPrefetch
+{
+public:
+    const CBlockIndex* const pindex;
+    const CDiskBlockPos pos;
+    const CDiskBlockPos undoPos;
+    const uint256 hash;
+    const uint256 hashPrev;
+
+    CBlock block;
+    CBlockUndo blockUndo;
+    //! Whether both were read from disk.
+    bool fRead = false;
+    //! Completion of the thread that reads this block.
+    std::shared_future<void> result;
+
+    explicit CDisconnectPrefetch(const CBlockIndex* pindexIn) :
+        pindex(pindexIn), pos(pindexIn->GetBlockPos()), undoPos(pindexIn->GetUndoPos()),
+        hash(pindexIn->GetBlockHash()), hashPrev(pindexIn->pprev->GetBlockHash()) {}
+
+    ~CDisconnectPrefetch() {
+        // The reading thread may still be writing to this prefetch.
+        if (result.valid()) {
+            result.wait();
+        }
+    }
+};
+
+static void ReadDisconnectPrefetches(const std::vector<CDisconnectPrefetch*> vPrefetch, const Consensus::Params& consensus)
+{
+    for (CDisconnectPrefetch* prefetch : vPrefetch) {
+        prefetch->fRead = ReadBlockFromDisk(prefetch->block, prefetch->pos, consensus) &&
+            prefetch->block.GetHash() == prefetch->hash &&
+            !prefetch->undoPos.IsNull() &&
+            UndoReadFromDisk(prefetch->blockUndo, prefetch->undoPos, prefetch->hashPrev);
+    }
+}
+
+/**
+ * Start reading the blocks from chainActive's tip down to (not including)
+ * pindexFork, with their undo data, on DISCONNECT_PREFETCH_THREADS threads.
+ * The prefetches are in the order the blocks are disconnected in, and each
+ * thread reads every DISCONNECT_PREFETCH_THREADS-th of them from the tip
+ * down, so that the first blocks needed are read first.
+ */
+static std::vector<std::unique_ptr<CDisconnectPrefetch>> StartDisconnectPrefetches(
+    const CChainParams& chainparams, const CBlockIndex* pindexFork)
+{
+    AssertLockHeld(cs_main);
+    std::vector<std::unique_ptr<CDisconnectPrefetch>> vPrefetches;
+    for (const CBlockIndex* pindex = chainActive.Tip(); pindex && pindex != pindexFork && pindex->pprev; pindex = pindex->pprev) {
+        vPrefetches.emplace_back(new CDisconnectPrefetch(pindex));
+    }
+    for (size_t nThread = 0; nThread < DISCONNECT_PREFETCH_THREADS && nThread < vPrefetches.size(); nThread++) {
+        std::vector<CDisconnectPrefetch*> vThreadPrefetches;
+        for (size_t i = nThread; i < vPrefetches.size(); i += DISCONNECT_PREFETCH_THREADS) {
+            vThreadPrefetches.push_back(vPrefetches[i].get());
+        }
+        std::shared_future<void> result = std::async(
+            std::launch::async, ReadDisconnectPrefetches, vThreadPrefetches, std::cref(chainparams.GetConsensus())).share();
+        for (CDisconnectPrefetch* prefetch : vThreadPrefetches) {
+            prefetch->result = result;
+        }
+    }
+    return vPrefetches;
+}
+
+/**
+ * Add the transactions of the blocks disconnected by a reorg back to the
+ * mempool, those of the oldest block first, so that transactions are added
+ * after the ones they spend. Coinbase transactions, and those that no longer
+ * fit the new chain, are left out along with their descendants. Transactions
+ * mined again in the new chain must already have been dropped from
+ * disconnected (see ForgetReconfirmedTransactions), as they would otherwise
+ * be taken as no longer fitting it, and their descendants would be removed.
+ */
+static void ResurrectDisconnectedTransactions(const CChainParams& chainparams, std::deque<CTransaction>& disconnected)
+{
+    AssertLockHeld(cs_main);
+    for (const CTransaction& tx : disconnected) {
+        // ignore validation errors in resurrected transactions
+        list<CTransaction> removed;
+        CValidationState stateDummy;
+        if (tx.IsCoinBase() || !AcceptToMemoryPool(chainparams, mempool, stateDummy, tx, false, NULL))
+            mempool.remove(tx, removed, true);
+    }
+    disconnected.clear();
+}
+
+/**
+ * Drop the transactions of a block connected during a reorg from the
+ * transactions of the blocks it disconnected, which are still to be added
+ * back to the mempool.
+ */
+static void ForgetReconfirmedTransactions(const CBlock& block, std::deque<CTransaction>& disconnected)
+{
+    std::set<uint256> setConfirmed;
+    for (const CTransaction& tx : block.vtx) {
+        setConfirmed.insert(tx.GetHash());
+    }
+    disconnected.erase(
+        std::remove_if(disconnected.begin(), disconnected.end(), [&](const CTransaction& tx) {
+            return setConfirmed.count(tx.GetHash()) > 0;
+        }),
+        disconnected.end());
+}
+
 /**
  * Disconnect chainActive's tip. You probably want to call mempool.removeForReorg and
  * mempool.removeWithoutBranchId after this, with cs_main held.
+ *
+ * The block and undo data are taken from prefetch if it has them. If
+ * pdisconnected is set, the transactions of the block are put in front of it
+ * (see ResurrectDisconnectedTransactions) instead of being added back to the
+ * mempool straight away.
  */
-bool static DisconnectTip(CValidationState &state, const CChainParams& chainparams, bool fBare = false)
+bool static DisconnectTip(CValidationState &state, const CChainParams& chainparams, bool fBare = false,
+                          CDisconnectPrefetch* prefetch = nullptr, std::deque<CTransaction>* pdisconnected = nullptr)
 {
+    auto span = TracingSpan("debug", "profile", "DisconnectTip");
+    auto spanGuard = span.Enter();
     CBlockIndex *pindexDelete = chainActive.Tip();
     assert(pindexDelete);
-    // Read block from disk.
-    CBlock block;
-    if (!ReadBlockFromDisk(block, pindexDelete, chainparams.GetConsensus()))
+    // Read block from disk, unless it was read ahead.
+    CBlock blockRead;
+    const CBlock* pblock = &blockRead;
+    CBlockUndo* pblockUndo = nullptr;
+    if (prefetch != nullptr && prefetch->pindex == pindexDelete) {
+        prefetch->result.wait();
+        if (prefetch->fRead) {
+            pblock = &prefetch->block;
+            pblockUndo = &prefetch->blockUndo;
+        }
+    }
+    if (pblockUndo == nullptr && !ReadBlockFromDisk(blockRead, pindexDelete, chainparams.GetConsensus()))
         return AbortNode(state, "Failed to read block");
+    const CBlock& block = *pblock;
     // Apply the block atomically to the chain state.
     uint256 sproutAnchorBeforeDisconnect = pcoinsTip->GetBestAnchor(SPROUT);
     uint256 saplingAnchorBeforeDisconnect = pcoinsTip->GetBestAnchor(SAPLING);
@@ -3918,8 +5444,7 @@ bool static DisconnectTip(CValidationState &state, const CChainParams& chainpara
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        // insightexplorer: update indices (true)
-        if (DisconnectBlock(block, state, pindexDelete, view, chainparams, true) != DISCONNECT_OK)
+        if (DisconnectBlock(block, state, pindexDelete, view, chainparams, pblockUndo) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
     }
@@ -3933,12 +5458,16 @@ bool static DisconnectTip(CValidationState &state, const CChainParams& chainpara
 
     if (!fBare) {
         // Resurrect mempool transactions from the disconnected block.
-        for (const CTransaction &tx : block.vtx) {
-            // ignore validation errors in resurrected transactions
-            list<CTransaction> removed;
-            CValidationState stateDummy;
-            if (tx.IsCoinBase() || !AcceptToMemoryPool(chainparams, mempool, stateDummy, tx, false, NULL))
-                mempool.remove(tx, removed, true);
+        if (pdisconnected != nullptr) {
+            pdisconnected->insert(pdisconnected->begin(), block.vtx.begin(), block.vtx.end());
+        } else {
+            for (const CTransaction &tx : block.vtx) {
+                // ignore validation errors in resurrected transactions
+                list<CTransaction> removed;
+                CValidationState stateDummy;
+                if (tx.IsCoinBase() || !AcceptToMemoryPool(chainparams, mempool, stateDummy, tx, false, NULL))
+                    mempool.remove(tx, removed, true);
+            }
         }
         if (sproutAnchorBeforeDisconnect != sproutAnchorAfterDisconnect) {
             // The anchor may not change between block disconnects,
@@ -3978,18 +5507,22 @@ uint64_t nNotifiedSequence = 0;
 
 /**
  * Connect a new block to chainActive. pblock is either NULL or a pointer to a CBlock
- * corresponding to pindexNew, to bypass loading it again from disk.
+ * corresponding to pindexNew, to bypass loading it again from disk. precheck is
+ * either NULL or the completed precheck of pindexNew.
  * You probably want to call mempool.removeWithoutBranchId after this, with cs_main held.
  */
-bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const CBlock* pblock)
+bool static ConnectTip(CValidationState& state, const CChainParams& chainparams, CBlockIndex* pindexNew, const CBlock* pblock,
+                       const CBlockPrecheck* precheck = NULL)
 {
     assert(pblock && pindexNew->pprev == chainActive.Tip());
+    auto span = TracingSpan("debug", "profile", "ConnectTip");
+    auto spanGuard = span.Enter();
     // Apply the block atomically to the chain state.
     int64_t nTime2 = GetTimeMicros();
     int64_t nTime3;
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams);
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams, false, CheckAs::Block, precheck);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -4003,11 +5536,14 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     }
     int64_t nTime4 = GetTimeMicros(); nTimeFlush += nTime4 - nTime3;
     LogPrint("bench", "  - Flush: %.2fms [%.2fs]\n", (nTime4 - nTime3) * 0.001, nTimeFlush * 0.000001);
+    const char* mix = BlockShieldedMix(*pblock);
+    RecordConnectPhase("flush", mix, nTime4 - nTime3);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(chainparams, state, FLUSH_STATE_IF_NEEDED))
         return false;
     int64_t nTime5 = GetTimeMicros(); nTimeChainState += nTime5 - nTime4;
     LogPrint("bench", "  - Writing chainstate: %.2fms [%.2fs]\n", (nTime5 - nTime4) * 0.001, nTimeChainState * 0.000001);
+    RecordConnectPhase("chainstate", mix, nTime5 - nTime4);
     // Remove conflicting transactions from the mempool.
     std::list<CTransaction> txConflicted;
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload(chainparams.GetConsensus()));
@@ -4031,8 +5567,12 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
 
     int64_t nTime6 = GetTimeMicros(); nTimePostConnect += nTime6 - nTime5;
     LogPrint("bench", "  - Connect postprocess: %.2fms [%.2fs]\n", (nTime6 - nTime5) * 0.001, nTimePostConnect * 0.000001);
+    RecordConnectPhase("postprocess", mix, nTime6 - nTime5);
     // Total connection time benchmarking occurs in ActivateBestChainStep.
     MetricsIncrementCounter("zcash.chain.verified.block.total");
+    connectTotals.nBlocks++;
+    connectTotals.nTransactions += pblock->vtx.size();
+    connectTotals.nProofs += BlockProofCount(*pblock);
     return true;
 }
 
@@ -4166,13 +5706,27 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
         return false;
     }
 
-    // Disconnect active blocks which are no longer in the best chain.
+    // Disconnect active blocks which are no longer in the best chain. When
+    // there are several, their block and undo data are read ahead in
+    // parallel, and their transactions are added back to the mempool once
+    // the new blocks are connected, so that those mined again in the new
+    // chain are not added and removed again, and none are checked against
+    // the intermediate tips.
     bool fBlocksDisconnected = false;
-    while (chainActive.Tip() && chainActive.Tip() != pindexFork) {
-        if (!DisconnectTip(state, chainparams))
+    std::vector<std::unique_ptr<CDisconnectPrefetch>> vDisconnectPrefetches;
+    if (reorgLength > 1) {
+        vDisconnectPrefetches = StartDisconnectPrefetches(chainparams, pindexFork);
+    }
+    std::deque<CTransaction> disconnected;
+    for (size_t i = 0; chainActive.Tip() && chainActive.Tip() != pindexFork; i++) {
+        CDisconnectPrefetch* prefetch = i < vDisconnectPrefetches.size() ? vDisconnectPrefetches[i].get() : nullptr;
+        if (!DisconnectTip(state, chainparams, false, prefetch, &disconnected)) {
+            ResurrectDisconnectedTransactions(chainparams, disconnected);
             return false;
+        }
         fBlocksDisconnected = true;
     }
+    vDisconnectPrefetches.clear();
 
     // Build list of new blocks to connect.
     std::vector<CBlockIndex*> vpindexToConnect;
@@ -4196,8 +5750,12 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
             int64_t nTime1 = GetTimeMicros();
             const CBlock* pconnectBlock;
             CBlock block;
+            std::unique_ptr<CBlockPrecheck> precheck;
             if (pblock && pindexConnect == pindexMostWork) {
                 pconnectBlock = pblock;
+            } else if ((precheck = TakeBlockPrecheck(pindexConnect))) {
+                // The block was already read from disk by the pipeline.
+                pconnectBlock = &precheck->block;
             } else {
                 // read the block to be connected from disk
                 if (!ReadBlockFromDisk(block, pindexConnect, chainparams.GetConsensus()))
@@ -4206,8 +5764,15 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
             }
             int64_t nTime2 = GetTimeMicros(); nTimeReadFromDisk += nTime2 - nTime1;
             LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
+            RecordConnectPhase("read", BlockShieldedMix(*pconnectBlock), nTime2 - nTime1);
+
+            // Check the next blocks on the path to pindexMostWork while this
+            // one is being connected.
+            if (fPipelineBlockConnect && IsInitialBlockDownload(chainparams.GetConsensus())) {
+                ExtendBlockPrechecks(chainparams, pindexConnect, pindexMostWork);
+            }
 
-            if (!ConnectTip(state, chainparams, pindexConnect, pconnectBlock)) {
+            if (!ConnectTip(state, chainparams, pindexConnect, pconnectBlock, precheck.get())) {
                 if (state.IsInvalid()) {
                     // The block violates a consensus rule.
                     if (!state.CorruptionPossible())
@@ -4218,9 +5783,13 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
                     break;
                 } else {
                     // A system error occurred (disk space, database error, ...).
+                    ResurrectDisconnectedTransactions(chainparams, disconnected);
                     return false;
                 }
             } else {
+                if (!disconnected.empty()) {
+                    ForgetReconfirmedTransactions(*pconnectBlock, disconnected);
+                }
                 int64_t nTime3 = GetTimeMicros(); nTimeTotal += nTime3 - nTime1;
                 LogPrint("bench", "- Connect block: %.2fms [%.2fs]\n", (nTime3 - nTime1) * 0.001, nTimeTotal * 0.000001);
                 MetricsHistogram("zcash.chain.verified.block.seconds", (nTime3 - nTime1) * 0.000001);
@@ -4236,6 +5805,7 @@ static bool ActivateBestChainStep(CValidationState& state, const CChainParams& c
     }
 
     if (fBlocksDisconnected) {
+        ResurrectDisconnectedTransactions(chainparams, disconnected);
         mempool.removeForReorg(pcoinsTip, chainActive.Tip()->nHeight + 1, STANDARD_LOCKTIME_VERIFY_FLAGS);
     }
     mempool.removeWithoutBranchId(
@@ -4287,6 +5857,7 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
 
         bool fInitialDownload;
         int nNewHeight;
+        bool fFastRelayed;
         {
             LOCK(cs_main);
             if (pindexMostWork == NULL) {
@@ -4308,6 +5879,7 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
             pindexNewTip = chainActive.Tip();
             fInitialDownload = IsInitialBlockDownload(chainparams.GetConsensus());
             nNewHeight = chainActive.Height();
+            fFastRelayed = pindexNewTip == pindexFastRelayed;
         }
         // When we reach this point, we switched to a new tip (stored in pindexNewTip).
 
@@ -4320,14 +5892,27 @@ bool ActivateBestChain(CValidationState& state, const CChainParams& chainparams,
             int nBlockEstimate = 0;
             if (fCheckpointsEnabled)
                 nBlockEstimate = Checkpoints::GetTotalBlocksEstimate(chainparams.Checkpoints());
+            // Peers that asked for it get the new tip as a cmpctblock right
+            // away, if we have it in memory, instead of an inv to request it by.
+            // It is serialized once, and the same buffer is queued for each of them.
+            // A tip that was relayed before it was connected has already
+            // been sent to those peers, which the inv is then skipped for.
+            std::shared_ptr<const CSerializeData> pcmpctblock;
+            if (pblock && pblock->GetHash() == hashNewTip && !fFastRelayed)
+                pcmpctblock = CNode::MakeSharedMessage("cmpctblock", CBlockHeaderAndShortTxIDs(*pblock));
             {
                 LOCK(cs_vNodes);
-                for (CNode* pnode : vNodes)
-                    if (nNewHeight > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate))
-                        pnode->PushBlockInventory(hashNewTip);
+                for (CNode* pnode : vNodes) {
+                    if (nNewHeight > (pnode->nStartingHeight != -1 ? pnode->nStartingHeight - 2000 : nBlockEstimate)) {
+                        if (pcmpctblock && pnode->fPreferCompactBlocks)
+                            pnode->PushSharedMessage("cmpctblock", pcmpctblock);
+                        else
+                            pnode->PushBlockInventory(hashNewTip);
+                    }
+                }
             }
             // Notify external listeners about the new tip.
-            GetMainSignals().UpdatedBlockTip(pindexNewTip);
+            GetMainSignals().UpdatedBlockTip(pindexNewTip, pblock && pblock->GetHash() == hashNewTip ? pblock : NULL);
         }
     } while (pindexNewTip != pindexMostWork);
     CheckBlockIndex(chainparams.GetConsensus());
@@ -4423,8 +6008,8 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const Consensus::Params&
         return it->second;
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(block);
-    assert(pindexNew);
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
+    *pindexNew = CBlockIndex(block);
     // We assign the sequence id to blocks only when the full data is available,
     // to avoid miners withholding blocks but broadcasting headers, to get a
     // competitive advantage.
@@ -4460,7 +6045,9 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const Consensus::Params&
         }
 
         pindexNew->BuildSkip();
+        setBlockIndexTips.erase(pindexNew->pprev);
     }
+    setBlockIndexTips.insert(pindexNew);
     pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : 0) + GetBlockProof(*pindexNew);
     pindexNew->RaiseValidity(BLOCK_VALID_TREE);
     if (pindexBestHeader == NULL || pindexBestHeader->nChainWork < pindexNew->nChainWork)
@@ -4471,6 +6058,12 @@ CBlockIndex* AddToBlockIndex(const CBlockHeader& block, const Consensus::Params&
     return pindexNew;
 }
 
+std::vector<const CBlockIndex*> GetBlockIndexTips()
+{
+    AssertLockHeld(cs_main);
+    return std::vector<const CBlockIndex*>(setBlockIndexTips.begin(), setBlockIndexTips.end());
+}
+
 void FallbackSproutValuePoolBalance(
     CBlockIndex *pindex,
     const CChainParams& chainparams
@@ -4646,7 +6239,7 @@ bool FindBlockPos(CValidationState &state, CDiskBlockPos &pos, unsigned int nAdd
         unsigned int nOldChunks = (pos.nPos + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         unsigned int nNewChunks = (vinfoBlockFile[nFile].nSize + BLOCKFILE_CHUNK_SIZE - 1) / BLOCKFILE_CHUNK_SIZE;
         if (nNewChunks > nOldChunks) {
-            if (fPruneMode)
+            if (fPruneMode || fPackBlockFiles)
                 fCheckForPruning = true;
             if (CheckDiskSpace(nNewChunks * BLOCKFILE_CHUNK_SIZE - pos.nPos)) {
                 FILE *file = OpenBlockFile(pos);
@@ -4679,7 +6272,7 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
     unsigned int nOldChunks = (pos.nPos + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     unsigned int nNewChunks = (nNewSize + UNDOFILE_CHUNK_SIZE - 1) / UNDOFILE_CHUNK_SIZE;
     if (nNewChunks > nOldChunks) {
-        if (fPruneMode)
+        if (fPruneMode || fPackBlockFiles)
             fCheckForPruning = true;
         if (CheckDiskSpace(nNewChunks * UNDOFILE_CHUNK_SIZE - pos.nPos)) {
             FILE *file = OpenUndoFile(pos);
@@ -4700,7 +6293,8 @@ bool CheckBlockHeader(
     const CBlockHeader& block,
     CValidationState& state,
     const CChainParams& chainparams,
-    bool fCheckPOW)
+    bool fCheckPOW,
+    bool fCheckSolution)
 {
     // Check block version
     if (block.nVersion < MIN_BLOCK_VERSION)
@@ -4708,7 +6302,7 @@ bool CheckBlockHeader(
                          REJECT_INVALID, "version-too-low");
 
     // Check Equihash solution is valid
-    if (fCheckPOW && !CheckEquihashSolution(&block, chainparams.GetConsensus()))
+    if (fCheckPOW && fCheckSolution && !CheckEquihashSolution(&block, chainparams.GetConsensus()))
         return state.DoS(100, error("CheckBlockHeader(): Equihash solution invalid"),
                          REJECT_INVALID, "invalid-solution");
 
@@ -4738,7 +6332,7 @@ bool CheckBlock(const CBlock& block,
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
-        uint256 hashMerkleRoot2 = block.BuildMerkleTree(&mutated);
+        uint256 hashMerkleRoot2 = block.ComputeMerkleRoot(&mutated);
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, error("CheckBlock(): hashMerkleRoot mismatch"),
                              REJECT_INVALID, "bad-txnmrklroot", true);
@@ -4772,12 +6366,29 @@ bool CheckBlock(const CBlock& block,
     // skip all transaction checks if this flag is not set
     if (!fCheckTransactions) return true;
 
-    // Check transactions
-    for (const CTransaction& tx : block.vtx)
-        if (!CheckTransaction(tx, state, verifier))
-            return error("CheckBlock(): CheckTransaction of %s failed with %s",
-                tx.GetHash().ToString(),
-                FormatStateMessage(state));
+    // Check transactions, spreading them across the transaction checking
+    // threads if there are any.
+    bool fTransactionsOk = false;
+    if (nScriptCheckThreads && block.vtx.size() > 1) {
+        CCheckQueueControl<CTransactionCheck> control(&txcheckqueue);
+        std::vector<CTransactionCheck> vChecks;
+        vChecks.reserve(block.vtx.size());
+        for (const CTransaction& tx : block.vtx)
+            vChecks.emplace_back(tx, verifier);
+        control.Add(vChecks);
+        CCheckQueueStats txCheckStats;
+        fTransactionsOk = control.Wait(&txCheckStats);
+        RecordCheckQueueStats("transaction", txCheckStats);
+    }
+    // Otherwise, or if a check failed, check them in order so that the
+    // first invalid transaction is the one reported.
+    if (!fTransactionsOk) {
+        for (const CTransaction& tx : block.vtx)
+            if (!CheckTransaction(tx, state, verifier))
+                return error("CheckBlock(): CheckTransaction of %s failed with %s",
+                    tx.GetHash().ToString(),
+                    FormatStateMessage(state));
+    }
 
     unsigned int nSigOps = 0;
     for (const CTransaction& tx : block.vtx)
@@ -4921,10 +6532,12 @@ bool ContextualCheckBlock(
         // The last Founders' Reward block is defined as the block just before the
         // first subsidy halving block, which occurs at halving_interval + slow_start_shift.
         bool found = false;
+        const CScript& foundersRewardScript = chainparams.GetFoundersRewardScriptAtHeight(nHeight);
+        const CAmount foundersReward = GetBlockSubsidy(nHeight, consensusParams) / 5;
 
         for (const CTxOut& output : block.vtx[0].vout) {
-            if (output.scriptPubKey == chainparams.GetFoundersRewardScriptAtHeight(nHeight)) {
-                if (output.nValue == (GetBlockSubsidy(nHeight, consensusParams) / 5)) {
+            if (output.scriptPubKey == foundersRewardScript) {
+                if (output.nValue == foundersReward) {
                     found = true;
                     break;
                 }
@@ -4940,7 +6553,12 @@ bool ContextualCheckBlock(
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+/**
+ * Add a header to the block index if it is valid. With fSolutionChecked, the
+ * Equihash solution has already been checked, or is left to CheckBlock for
+ * when the block arrives (see -deferheadersolutions).
+ */
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, bool fSolutionChecked=false)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -4957,7 +6575,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
         return true;
     }
 
-    if (!CheckBlockHeader(block, state, chainparams))
+    if (!CheckBlockHeader(block, state, chainparams, true, !fSolutionChecked))
         return false;
 
     // Get prev block index
@@ -4983,6 +6601,29 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
     return true;
 }
 
+/**
+ * Relay a block that extends our tip, and has passed the checks of
+ * AcceptBlock, as a cmpctblock to the peers that asked for new blocks that
+ * way, before it is connected (-fastblockrelay). Requires cs_main.
+ */
+static void RelayBlockBeforeConnecting(const CBlock& block, CBlockIndex* pindex)
+{
+    std::shared_ptr<const CSerializeData> pcmpctblock = CNode::MakeSharedMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+    LOCK(cs_vNodes);
+    for (CNode* pnode : vNodes) {
+        if (!pnode->fPreferCompactBlocks || pnode->fDisconnect)
+            continue;
+        CNodeState *state = State(pnode->GetId());
+        if (state == NULL || PeerHasHeader(state, pindex) || !PeerHasHeader(state, pindex->pprev))
+            continue;
+        LogPrint("net", "%s: sending cmpctblock %s to peer=%d before connecting it\n", __func__,
+            pindex->GetBlockHash().ToString(), pnode->id);
+        pnode->PushSharedMessage("cmpctblock", pcmpctblock);
+        state->pindexBestHeaderSent = pindex;
+    }
+    pindexFastRelayed = pindex;
+}
+
 /**
  * Store block on disk.
  * If dbp is non-NULL, the file is known to already reside on disk.
@@ -4990,15 +6631,18 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
  * JoinSplit proofs are not verified here; the only
  * caller of AcceptBlock (ProcessNewBlock) later invokes ActivateBestChain,
  * which ultimately calls ConnectBlock in a manner that can verify the proofs.
+ *
+ * If fSolutionChecked is set, the block's Equihash solution has already been
+ * checked by the caller, as ReadBlockFromDisk does.
  */
-static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp)
+static bool AcceptBlock(const CBlock& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex, bool fRequested, const CDiskBlockPos* dbp, bool fSolutionChecked=false)
 {
     AssertLockHeld(cs_main);
 
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, fSolutionChecked))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -5026,7 +6670,8 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     auto verifier = ProofVerifier::Disabled();
 
     bool fCheckTransactions = ShouldCheckTransactions(chainparams, pindex);
-    if ((!CheckBlock(block, state, chainparams, verifier, true, true, fCheckTransactions)) ||
+    // The proof of work was checked with the header.
+    if ((!CheckBlock(block, state, chainparams, verifier, !fSolutionChecked, true, fCheckTransactions)) ||
          !ContextualCheckBlock(block, state, chainparams, pindex->pprev, fCheckTransactions)) {
         if (state.IsInvalid() && !state.CorruptionPossible()) {
             pindex->nStatus |= BLOCK_FAILED_VALID;
@@ -5035,19 +6680,32 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
         return false;
     }
 
+    // The block passed every check but those that ConnectBlock makes against
+    // the coins, including its proofs and signatures. If it extends our tip,
+    // relay it now rather than after those, which take much longer.
+    if (fFastBlockRelay && dbp == NULL && pindex->pprev == chainActive.Tip() &&
+        !IsInitialBlockDownload(chainparams.GetConsensus())) {
+        RelayBlockBeforeConnecting(block, pindex);
+    }
+
     int nHeight = pindex->nHeight;
 
     // Write block to history file
     try {
-        unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
         CDiskBlockPos blockPos;
-        if (dbp != NULL)
+        if (dbp != NULL) {
             blockPos = *dbp;
-        if (!FindBlockPos(state, blockPos, nBlockSize+8, nHeight, block.GetBlockTime(), dbp != NULL))
-            return error("AcceptBlock(): FindBlockPos failed");
-        if (dbp == NULL)
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            // The block may be stored compressed.
+            unsigned int nBlockSize = GetBlockDiskSize(blockPos).value_or(::GetSerializeSize(block, SER_DISK, CLIENT_VERSION) + 8);
+            if (!FindBlockPos(state, blockPos, nBlockSize, nHeight, block.GetBlockTime(), true))
+                return error("AcceptBlock(): FindBlockPos failed");
+        } else {
+            CDiskRecord record(block, fCompressBlockFiles);
+            if (!FindBlockPos(state, blockPos, record.size()+8, nHeight, block.GetBlockTime()))
+                return error("AcceptBlock(): FindBlockPos failed");
+            if (!WriteBlockToDisk(record, blockPos, chainparams.MessageStart()))
                 AbortNode(state, "Failed to write block");
+        }
         if (!ReceivedBlockTransactions(block, state, chainparams, pindex, blockPos))
             return error("AcceptBlock(): ReceivedBlockTransactions failed");
     } catch (const std::runtime_error& e) {
@@ -5073,7 +6731,7 @@ static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned
 }
 
 
-bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp)
+bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool fMayBan)
 {
     auto span = TracingSpan("info", "main", "ProcessNewBlock");
     auto spanGuard = span.Enter();
@@ -5086,7 +6744,7 @@ bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, c
         CBlockIndex *pindex = NULL;
         bool ret = AcceptBlock(*pblock, state, chainparams, &pindex, fRequested, dbp);
         if (pindex && pfrom) {
-            mapBlockSource[pindex->GetBlockHash()] = pfrom->GetId();
+            mapBlockSource[pindex->GetBlockHash()] = std::make_pair(pfrom->GetId(), fMayBan);
         }
         CheckBlockIndex(chainparams.GetConsensus());
         if (!ret)
@@ -5147,8 +6805,9 @@ bool TestBlockValidity(
 uint64_t CalculateCurrentUsage()
 {
     uint64_t retval = 0;
-    for (const CBlockFileInfo &file : vinfoBlockFile) {
-        retval += file.nSize + file.nUndoSize;
+    for (size_t i = 0; i < vinfoBlockFile.size(); i++) {
+        const CBlockFileInfo &file = vinfoBlockFile[i];
+        retval += GetPackedBlockFileSize(i).value_or(file.nSize) + file.nUndoSize;
     }
     return retval;
 }
@@ -5183,19 +6842,109 @@ void PruneOneBlockFile(const int fileNumber)
 
     vinfoBlockFile[fileNumber].SetNull();
     setDirtyFileInfo.insert(fileNumber);
+    RemovePackedBlockFile(fileNumber);
 }
 
 
 void UnlinkPrunedFiles(std::set<int>& setFilesToPrune)
 {
+    UnmapBlockFiles(setFilesToPrune);
     for (set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
+        fs::remove(GetBlockPosFilename(pos, "pak"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
     }
 }
 
+/**
+ * Pack a block file (see -packblockfiles), and drop its undo data, which is
+ * too old to be needed to disconnect its blocks. Its block and undo files
+ * can be deleted once the block index no longer refers to the undo data.
+ */
+static bool PackOneBlockFile(const CChainParams& chainparams, int fileNumber)
+{
+    AssertLockHeld(cs_main);
+    std::vector<unsigned int> vPositions;
+    std::vector<CBlockIndex*> vUndo;
+    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex) {
+        CBlockIndex* pindex = item.second;
+        if (pindex->nFile == fileNumber) {
+            if (pindex->nStatus & BLOCK_HAVE_DATA)
+                vPositions.push_back(pindex->nDataPos);
+            if (pindex->nStatus & BLOCK_HAVE_UNDO)
+                vUndo.push_back(pindex);
+        }
+    }
+
+    CDiskBlockPos pos(fileNumber, 0);
+    if (!GetPackedBlockFileSize(fileNumber)) {
+        int64_t nStart = GetTimeMillis();
+        fs::path path = GetBlockPosFilename(pos, "pak");
+        if (!CPackedBlockFile::Pack(GetBlockPosFilename(pos, "blk"), vPositions, chainparams.MessageStart(), path))
+            return false;
+        uint64_t nSize = fs::file_size(path);
+        AddPackedBlockFile(fileNumber, nSize);
+        LogPrint("prune", "Pack: packed %u blocks of blk%05u.dat from %dMiB into %dMiB in %dms\n",
+            vPositions.size(), fileNumber, vinfoBlockFile[fileNumber].nSize/1024/1024, nSize/1024/1024,
+            GetTimeMillis() - nStart);
+    }
+
+    for (CBlockIndex* pindex : vUndo) {
+        pindex->nStatus &= ~BLOCK_HAVE_UNDO;
+        pindex->nUndoPos = 0;
+        setDirtyBlockIndex.insert(pindex);
+    }
+    vinfoBlockFile[fileNumber].nUndoSize = 0;
+    setDirtyFileInfo.insert(fileNumber);
+    return true;
+}
+
+/**
+ * Pack the next block file that no longer has a block within
+ * MIN_BLOCKS_TO_KEEP of the main chain's tip. A file is packed at a time, as
+ * the main lock is held meanwhile; returns whether there is more to pack.
+ */
+static bool FindFilesToPack(const CChainParams& chainparams, std::set<int>& setFilesToPack)
+{
+    LOCK2(cs_main, cs_LastBlockFile);
+    if (chainActive.Tip() == NULL || chainActive.Tip()->nHeight <= (int)chainparams.PruneAfterHeight()) {
+        return false;
+    }
+
+    unsigned int nLastBlockWeCanPack = chainActive.Tip()->nHeight - MIN_BLOCKS_TO_KEEP;
+    for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
+        const CBlockFileInfo& info = vinfoBlockFile[fileNumber];
+        if (info.nSize == 0 || info.nHeightLast > nLastBlockWeCanPack)
+            continue;
+        // A packed file may still have undo data, or its block file, left
+        // from a reindex or from before a restart.
+        if (GetPackedBlockFileSize(fileNumber) && info.nUndoSize == 0 &&
+            !fs::exists(GetBlockPosFilename(CDiskBlockPos(fileNumber, 0), "blk")))
+            continue;
+        if (!setFilesToPack.empty())
+            return true;
+        if (PackOneBlockFile(chainparams, fileNumber))
+            setFilesToPack.insert(fileNumber);
+        else
+            break;
+    }
+    return false;
+}
+
+/** Delete the block and undo files that have been packed. */
+static void UnlinkPackedFiles(const std::set<int>& setFilesToPack)
+{
+    UnmapBlockFiles(setFilesToPack);
+    for (int nFile : setFilesToPack) {
+        CDiskBlockPos pos(nFile, 0);
+        fs::remove(GetBlockPosFilename(pos, "blk"));
+        fs::remove(GetBlockPosFilename(pos, "rev"));
+        LogPrintf("Pack: %s deleted blk/rev (%05u)\n", __func__, nFile);
+    }
+}
+
 /* Calculate the block/rev files that should be deleted to remain under target*/
 void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight)
 {
@@ -5218,7 +6967,7 @@ void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight
 
     if (nCurrentUsage + nBuffer >= nPruneTarget) {
         for (int fileNumber = 0; fileNumber < nLastBlockFile; fileNumber++) {
-            nBytesToPrune = vinfoBlockFile[fileNumber].nSize + vinfoBlockFile[fileNumber].nUndoSize;
+            nBytesToPrune = GetPackedBlockFileSize(fileNumber).value_or(vinfoBlockFile[fileNumber].nSize) + vinfoBlockFile[fileNumber].nUndoSize;
 
             if (vinfoBlockFile[fileNumber].nSize == 0)
                 continue;
@@ -5302,9 +7051,7 @@ CBlockIndex * InsertBlockIndex(uint256 hash)
         return (*mi).second;
 
     // Create new
-    CBlockIndex* pindexNew = new CBlockIndex();
-    if (!pindexNew)
-        throw runtime_error("LoadBlockIndex(): new CBlockIndex failed");
+    CBlockIndex* pindexNew = blockIndexArena.Allocate();
     mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
     pindexNew->phashBlock = &((*mi).first);
 
@@ -5316,18 +7063,41 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     if (!pblocktree->LoadBlockIndexGuts(InsertBlockIndex, chainparams))
         return false;
 
-    // Calculate nChainWork
-    vector<pair<int, CBlockIndex*> > vSortedByHeight;
-    vSortedByHeight.reserve(mapBlockIndex.size());
+    // Calculate nChainWork, in order of height. Heights are dense, so the
+    // entries are bucketed by height rather than sorted.
+    int nMaxHeight = 0;
     for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
-    {
-        CBlockIndex* pindex = item.second;
-        vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        nMaxHeight = std::max(nMaxHeight, item.second->nHeight);
+    vector<size_t> vHeightStart(nMaxHeight + 2, 0);
+    for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
+        vHeightStart[item.second->nHeight + 1]++;
+    for (int nHeight = 1; nHeight <= nMaxHeight + 1; nHeight++)
+        vHeightStart[nHeight] += vHeightStart[nHeight - 1];
+    vector<CBlockIndex*> vSortedByHeight(mapBlockIndex.size());
+    for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
+        vSortedByHeight[vHeightStart[item.second->nHeight]++] = item.second;
+
+    // The entries were allocated in the order of their hashes, as they were
+    // read. Reallocate them in height order, so that the blocks of a chain
+    // are next to each other. Nothing else refers to them yet but pprev, and
+    // pskip is only built below, so it holds the new entry meanwhile.
+    CBlockIndexArena arenaSorted;
+    for (CBlockIndex*& pindex : vSortedByHeight) {
+        CBlockIndex* pindexSorted = arenaSorted.Allocate();
+        *pindexSorted = *pindex;
+        pindex->pskip = pindexSorted;
+        pindex = pindexSorted;
+    }
+    for (BlockMap::value_type& item : mapBlockIndex)
+        item.second = item.second->pskip;
+    for (CBlockIndex* pindex : vSortedByHeight) {
+        if (pindex->pprev)
+            pindex->pprev = pindex->pprev->pskip;
+        pindex->pskip = NULL;
     }
-    sort(vSortedByHeight.begin(), vSortedByHeight.end());
-    for (const std::pair<int, CBlockIndex*>& item : vSortedByHeight)
+    blockIndexArena = std::move(arenaSorted);
+    for (CBlockIndex* pindex : vSortedByHeight)
     {
-        CBlockIndex* pindex = item.second;
         pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : 0) + GetBlockProof(*pindex);
         // We can link the chain of blocks for which we've received transactions at some point.
         // Pruned nodes may have deleted the block.
@@ -5393,8 +7163,11 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
             pindexBestInvalid = pindex;
-        if (pindex->pprev)
+        if (pindex->pprev) {
             pindex->BuildSkip();
+            setBlockIndexTips.erase(pindex->pprev);
+        }
+        setBlockIndexTips.insert(pindex);
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == NULL || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
@@ -5429,6 +7202,8 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     for (std::set<int>::iterator it = setBlkDataFiles.begin(); it != setBlkDataFiles.end(); it++)
     {
         CDiskBlockPos pos(*it, 0);
+        if (GetPackedBlockFileSize(*it))
+            continue;
         if (CAutoFile(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION).IsNull()) {
             return false;
         }
@@ -5444,27 +7219,6 @@ bool static LoadBlockIndexDB(const CChainParams& chainparams)
     pblocktree->ReadReindexing(fReindexing);
     if(fReindexing) fReindex = true;
 
-    // Check whether we have a transaction index
-    pblocktree->ReadFlag("txindex", fTxIndex);
-    LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
-
-    // insightexplorer and lightwalletd
-    // Check whether block explorer features are enabled
-    bool fInsightExplorer = false;
-    bool fLightWalletd = false;
-    pblocktree->ReadFlag("insightexplorer", fInsightExplorer);
-    pblocktree->ReadFlag("lightwalletd", fLightWalletd);
-    LogPrintf("%s: insight explorer %s\n", __func__, fInsightExplorer ? "enabled" : "disabled");
-    LogPrintf("%s: light wallet daemon %s\n", __func__, fLightWalletd ? "enabled" : "disabled");
-    if (fInsightExplorer) {
-        fAddressIndex = true;
-        fSpentIndex = true;
-        fTimestampIndex = true;
-    }
-    else if (fLightWalletd) {
-        fAddressIndex = true;
-    }
-
     // Fill in-memory data
     for (const std::pair<uint256, CBlockIndex*>& item : mapBlockIndex)
     {
@@ -5509,7 +7263,72 @@ CVerifyDB::~CVerifyDB()
     uiInterface.ShowProgress("", 100);
 }
 
-bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
+/** The number of blocks VerifyDB reads and checks at a time. */
+static const size_t VERIFYDB_BATCH_BLOCKS = 64;
+
+/** A block read by VerifyDB, with the error the checks that need no chain state found. */
+struct CVerifiedBlock {
+    CBlock block;
+    std::string strError;
+};
+
+/**
+ * Read the blocks from vIndexes[nFirst] on, a batch of them, on several
+ * threads, and make the checks of levels 1 and 2 on them if fCheck is set.
+ * The main lock is held by the caller, and not taken here.
+ */
+static void ReadVerifyBatch(
+    const CChainParams& chainparams,
+    const std::vector<CBlockIndex*>& vIndexes,
+    const std::vector<bool>& vCheckTransactions,
+    size_t nFirst, int nCheckLevel, bool fCheck,
+    std::vector<CVerifiedBlock>& vBlocks)
+{
+    size_t nCount = std::min(VERIFYDB_BATCH_BLOCKS, vIndexes.size() - std::min(nFirst, vIndexes.size()));
+    vBlocks.resize(nCount);
+    std::atomic<size_t> nNext{0};
+    auto check = [&]() {
+        auto verifier = ProofVerifier::Disabled(); // No need to verify JoinSplits twice
+        for (size_t i = nNext++; i < nCount && !ShutdownRequested(); i = nNext++) {
+            CBlockIndex* pindex = vIndexes[nFirst + i];
+            CBlock& block = vBlocks[i].block;
+            CValidationState state;
+            // check level 0: read from disk
+            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus())) {
+                vBlocks[i].strError = strprintf("*** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                continue;
+            }
+            if (!fCheck)
+                continue;
+
+            // check level 1: verify block validity
+            if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams, verifier, true, true, vCheckTransactions[nFirst + i])) {
+                vBlocks[i].strError = strprintf("*** found bad block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                continue;
+            }
+
+            // check level 2: verify undo validity
+            if (nCheckLevel >= 2) {
+                CBlockUndo undo;
+                CDiskBlockPos pos = pindex->GetUndoPos();
+                if (!pos.IsNull()) {
+                    if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
+                        vBlocks[i].strError = strprintf("*** found bad undo data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                }
+            }
+        }
+    };
+    std::vector<std::thread> vThreads;
+    for (int i = 1; i < std::min<int>(std::max(1, nScriptCheckThreads), nCount); i++) {
+        vThreads.emplace_back(check);
+    }
+    check();
+    for (std::thread& thread : vThreads) {
+        thread.join();
+    }
+}
+
+bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth, bool fCoinsOnly)
 {
     LOCK(cs_main);
     if (chainActive.Tip() == NULL || chainActive.Tip()->pprev == NULL)
@@ -5521,78 +7340,112 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     if (nCheckDepth > chainActive.Height())
         nCheckDepth = chainActive.Height();
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
-    LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+    if (fCoinsOnly && nCheckLevel < 3)
+        return true;
+    LogPrintf("Verifying last %i blocks at level %i%s\n", nCheckDepth, nCheckLevel, fCoinsOnly ? " (levels 3 and 4 only)" : "");
     CCoinsViewCache coins(coinsview);
     CBlockIndex* pindexState = chainActive.Tip();
     CBlockIndex* pindexFailure = NULL;
     int nGoodTransactions = 0;
     CValidationState state;
 
-    // Flags used to permit skipping checks for efficiency
-    auto verifier = ProofVerifier::Disabled(); // No need to verify JoinSplits twice
-    bool fCheckTransactions = true;
-
-    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev)
-    {
-        boost::this_thread::interruption_point();
-        uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
+    // The blocks to check, from the tip back. Whether their transactions are
+    // checked is found here, as that needs the main lock the threads reading
+    // them do not take.
+    std::vector<CBlockIndex*> vIndexes;
+    std::vector<bool> vCheckTransactions;
+    for (CBlockIndex* pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev) {
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
+        vIndexes.push_back(pindex);
+        vCheckTransactions.push_back(ShouldCheckTransactions(chainparams, pindex));
+    }
+
+    // The next batch of blocks is read and checked on several threads while
+    // the current one is disconnected.
+    std::vector<CVerifiedBlock> vBlocks;
+    ReadVerifyBatch(chainparams, vIndexes, vCheckTransactions, 0, nCheckLevel, !fCoinsOnly, vBlocks);
+    for (size_t nFirst = 0; nFirst < vIndexes.size(); nFirst += VERIFYDB_BATCH_BLOCKS) {
+        // Only the blocks that can still be disconnected are needed for
+        // the checks of level 3.
+        if (fCoinsOnly && pindexState != vIndexes[nFirst])
+            break;
 
-        CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-
-        // check level 1: verify block validity
-        fCheckTransactions = ShouldCheckTransactions(chainparams, pindex);
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams, verifier, true, true, fCheckTransactions))
-            return error("VerifyDB(): *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            CDiskBlockPos pos = pindex->GetUndoPos();
-            if (!pos.IsNull()) {
-                if (!UndoReadFromDisk(undo, pos, pindex->pprev->GetBlockHash()))
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
-        }
-
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
-            // insightexplorer: do not update indices (false)
-            DisconnectResult res = DisconnectBlock(block, state, pindex, coins, chainparams, false);
-            if (res == DISCONNECT_FAILED) {
-                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            }
-            pindexState = pindex->pprev;
-            if (res == DISCONNECT_UNCLEAN) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else {
-                nGoodTransactions += block.vtx.size();
+        std::vector<CVerifiedBlock> vNextBlocks;
+        std::thread reader([&]() {
+            ReadVerifyBatch(chainparams, vIndexes, vCheckTransactions, nFirst + VERIFYDB_BATCH_BLOCKS, nCheckLevel, !fCoinsOnly, vNextBlocks);
+        });
+        std::string strError;
+        // The blocks are not all read once shutdown is requested.
+        for (size_t i = 0; i < vBlocks.size() && !ShutdownRequested(); i++) {
+            CBlockIndex* pindex = vIndexes[nFirst + i];
+            const CBlock& block = vBlocks[i].block;
+            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100)))));
+            if (!vBlocks[i].strError.empty()) {
+                strError = vBlocks[i].strError;
+                break;
             }
-        }
 
+            // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+            if (nCheckLevel >= 3 && pindex == pindexState && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
+                DisconnectResult res = DisconnectBlock(block, state, pindex, coins, chainparams);
+                if (res == DISCONNECT_FAILED) {
+                    strError = strprintf("*** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                    break;
+                }
+                pindexState = pindex->pprev;
+                if (res == DISCONNECT_UNCLEAN) {
+                    nGoodTransactions = 0;
+                    pindexFailure = pindex;
+                } else {
+                    nGoodTransactions += block.vtx.size();
+                }
+            }
+        }
+        reader.join();
+        boost::this_thread::interruption_point();
         if (ShutdownRequested())
             return true;
+        if (!strError.empty())
+            return error("VerifyDB(): %s", strError);
+        vBlocks.swap(vNextBlocks);
     }
     if (pindexFailure)
         return error("VerifyDB(): *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
 
-    // check level 4: try reconnecting blocks
+    // check level 4: try reconnecting blocks, read ahead as in level 3
     if (nCheckLevel >= 4) {
-        CBlockIndex *pindex = pindexState;
-        while (pindex != chainActive.Tip()) {
-            boost::this_thread::interruption_point();
-            uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
+        std::vector<CBlockIndex*> vReconnect;
+        for (CBlockIndex* pindex = pindexState; pindex != chainActive.Tip(); ) {
             pindex = chainActive.Next(pindex);
-            CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-                return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            if (!ConnectBlock(block, state, pindex, coins, chainparams))
-                return error("VerifyDB(): *** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+            vReconnect.push_back(pindex);
+        }
+        ReadVerifyBatch(chainparams, vReconnect, {}, 0, nCheckLevel, false, vBlocks);
+        for (size_t nFirst = 0; nFirst < vReconnect.size(); nFirst += VERIFYDB_BATCH_BLOCKS) {
+            std::vector<CVerifiedBlock> vNextBlocks;
+            std::thread reader([&]() {
+                ReadVerifyBatch(chainparams, vReconnect, {}, nFirst + VERIFYDB_BATCH_BLOCKS, nCheckLevel, false, vNextBlocks);
+            });
+            std::string strError;
+            for (size_t i = 0; i < vBlocks.size() && !ShutdownRequested(); i++) {
+                CBlockIndex* pindex = vReconnect[nFirst + i];
+                uiInterface.ShowProgress(_("Verifying blocks..."), std::max(1, std::min(99, 100 - (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * 50))));
+                if (!vBlocks[i].strError.empty()) {
+                    strError = vBlocks[i].strError;
+                    break;
+                }
+                if (!ConnectBlock(vBlocks[i].block, state, pindex, coins, chainparams)) {
+                    strError = strprintf("*** found unconnectable block at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+                    break;
+                }
+            }
+            reader.join();
+            boost::this_thread::interruption_point();
+            if (ShutdownRequested())
+                return true;
+            if (!strError.empty())
+                return error("VerifyDB(): %s", strError);
+            vBlocks.swap(vNextBlocks);
         }
     }
 
@@ -5702,6 +7555,9 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
     // Collect blocks to be removed (blocks in mapBlockIndex must be at least BLOCK_VALID_TREE).
     // We do this after actual disconnecting, otherwise we'll end up writing the lack of data
     // to disk before writing the chainstate, resulting in a failure to continue if interrupted.
+    // This is the only pass over the whole block index; blocks with less work
+    // than the tip are not made candidates, as PruneBlockIndexCandidates would
+    // only remove them again.
     std::vector<const CBlockIndex*> vBlocks;
     for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
         CBlockIndex* pindexIter = it->second;
@@ -5728,11 +7584,18 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
                     ++ret.first;
                 }
             }
-        } else if (pindexIter->IsValid(BLOCK_VALID_TRANSACTIONS) && pindexIter->nChainTx) {
+        } else if (pindexIter->IsValid(BLOCK_VALID_TRANSACTIONS) && pindexIter->nChainTx &&
+                   !setBlockIndexCandidates.value_comp()(pindexIter, chainActive.Tip())) {
             setBlockIndexCandidates.insert(pindexIter);
         }
     }
 
+    // Nothing was rewound, so the block index is as it was loaded, and
+    // neither it nor the chain state needs to be written.
+    if (rewindLength == 0 && vBlocks.empty()) {
+        return true;
+    }
+
     // Set pindexBestHeader to the current chain tip
     // (since we are about to delete the block it is pointing to)
     pindexBestHeader = chainActive.Tip();
@@ -5746,8 +7609,8 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
     for (auto pindex : vBlocks) {
         auto ret = mapBlockIndex.find(*pindex->phashBlock);
         if (ret != mapBlockIndex.end()) {
+            // The entry itself is freed with the rest of the arena.
             mapBlockIndex.erase(ret);
-            delete pindex;
         }
     }
 
@@ -5770,22 +7633,35 @@ bool RewindBlockIndex(const CChainParams& chainparams, bool& clearWitnessCaches)
     return true;
 }
 
+void ClearBlockPrechecks()
+{
+    {
+        LOCK(cs_main);
+        pendingBlockPrechecks.clear();
+    }
+    blockPrecheckThread.Stop();
+}
+
 void UnloadBlockIndex()
 {
     LOCK(cs_main);
+    pendingBlockPrechecks.clear();
     setBlockIndexCandidates.clear();
+    setBlockIndexTips.clear();
     chainActive.SetTip(NULL);
     pindexBestInvalid = NULL;
     pindexBestHeader = NULL;
     mempool.clear();
     mapOrphanTransactions.clear();
     mapOrphanTransactionsByPrev.clear();
+    mapOrphanTransactionsByPeer.clear();
     nSyncStarted = 0;
     mapBlocksUnlinked.clear();
     vinfoBlockFile.clear();
     nLastBlockFile = 0;
     nBlockSequenceId = 1;
     mapBlockSource.clear();
+    pindexFastRelayed = NULL;
     mapBlocksInFlight.clear();
     nQueuedValidatedHeaders = 0;
     nPreferredDownload = 0;
@@ -5794,15 +7670,24 @@ void UnloadBlockIndex()
     mapNodeState.clear();
     recentRejects.reset(NULL);
 
-    for (BlockMap::value_type& entry : mapBlockIndex) {
-        delete entry.second;
-    }
     mapBlockIndex.clear();
+    blockIndexArena.Clear();
     fHavePruned = false;
+    {
+        LOCK(cs_packedBlockFiles);
+        mapPackedBlockFiles.clear();
+        listOpenPackedBlockFiles.clear();
+    }
 }
 
 bool LoadBlockIndex()
 {
+    // The packed block files are read from on reindex too.
+    LoadPackedBlockFiles();
+    // Pack the files that became old enough while the node was stopped.
+    if (fPackBlockFiles)
+        fCheckForPruning = true;
+
     // Load block index from databases
     if (!fReindex && !LoadBlockIndexDB(Params()))
         return false;
@@ -5820,22 +7705,6 @@ bool InitBlockIndex(const CChainParams& chainparams)
     if (chainActive.Genesis() != NULL)
         return true;
 
-    // Use the provided setting for -txindex in the new database
-    fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
-    pblocktree->WriteFlag("txindex", fTxIndex);
-
-    // Use the provided setting for -insightexplorer or -lightwalletd in the new database
-    pblocktree->WriteFlag("insightexplorer", fExperimentalInsightExplorer);
-    pblocktree->WriteFlag("lightwalletd", fExperimentalLightWalletd);
-    if (fExperimentalInsightExplorer) {
-        fAddressIndex = true;
-        fSpentIndex = true;
-        fTimestampIndex = true;
-    }
-    else if (fExperimentalLightWalletd) {
-        fAddressIndex = true;
-    }
-
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -5843,12 +7712,12 @@ bool InitBlockIndex(const CChainParams& chainparams)
         try {
             CBlock &block = const_cast<CBlock&>(chainparams.GenesisBlock());
             // Start new block file
-            unsigned int nBlockSize = ::GetSerializeSize(block, SER_DISK, CLIENT_VERSION);
+            CDiskRecord record(block, fCompressBlockFiles);
             CDiskBlockPos blockPos;
             CValidationState state;
-            if (!FindBlockPos(state, blockPos, nBlockSize+8, 0, block.GetBlockTime()))
+            if (!FindBlockPos(state, blockPos, record.size()+8, 0, block.GetBlockTime()))
                 return error("LoadBlockIndex(): FindBlockPos failed");
-            if (!WriteBlockToDisk(block, blockPos, chainparams.MessageStart()))
+            if (!WriteBlockToDisk(record, blockPos, chainparams.MessageStart()))
                 return error("LoadBlockIndex(): writing genesis block to disk failed");
             CBlockIndex *pindex = AddToBlockIndex(block, chainparams.GetConsensus());
             if (!ReceivedBlockTransactions(block, state, chainparams, pindex, blockPos))
@@ -5900,7 +7769,7 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                     continue;
                 // read size
                 blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SIZE)
+                if ((nSize & ~DISK_RECORD_COMPRESSED) < 80 || !IsValidDiskRecordSize(nSize))
                     continue;
             } catch (const std::exception&) {
                 // no valid block header found; don't complain
@@ -5911,10 +7780,10 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
                 uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
                     dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
+                blkdat.SetLimit(nBlockPos + (nSize & ~DISK_RECORD_COMPRESSED));
                 blkdat.SetPos(nBlockPos);
                 CBlock block;
-                blkdat >> block;
+                ReadDiskRecord(blkdat, nSize, block);
                 nRewind = blkdat.GetPos();
 
                 // detect out of order blocks, and store them for later
@@ -5985,31 +7854,252 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
     return nLoaded > 0;
 }
 
-void static CheckBlockIndex(const Consensus::Params& consensusParams)
-{
-    if (!fCheckBlockIndex) {
-        return;
-    }
-
-    LOCK(cs_main);
+/** A block found in the block files by a reindex. */
+struct CReindexBlock {
+    uint256 hash;
+    uint256 hashPrev;
+    CDiskBlockPos pos;
+    //! The size of the block, with its header, in the block file.
+    unsigned int nSize;
+};
 
-    // During a reindex, we read the genesis block and call CheckBlockIndex before ActivateBestChain,
-    // so we have the genesis block in mapBlockIndex but no active chain.  (A few of the tests when
-    // iterating the block tree require that chainActive has been initialized.)
-    if (chainActive.Height() < 0) {
-        assert(mapBlockIndex.size() <= 1);
+/**
+ * Find the blocks in the block file nFile, or in its packed file, without
+ * checking them. Half of the file's size is added to nSizeReindexed once it
+ * has been scanned, and the other half as its blocks are added to the index.
+ */
+static void ScanBlockFile(const CChainParams& chainparams, int nFile, std::vector<CReindexBlock>& vBlocks)
+{
+    CDiskBlockPos pos(nFile, 0);
+    std::shared_ptr<const CPackedBlockFile> packed = GetPackedBlockFile(nFile);
+    if (packed) {
+        LogPrintf("Reindexing packed block file pak%05u.dat...\n", (unsigned int)nFile);
+        for (const CPackedBlock& entry : packed->GetBlocks()) {
+            if (ShutdownRequested())
+                break;
+            std::vector<unsigned char> data;
+            if (!packed->Read(entry.nPos, data))
+                continue; // This error is logged in Read
+            try {
+                CSpanReader filein(SER_DISK, CLIENT_VERSION, (const char*)data.data(), (const char*)data.data() + data.size());
+                CBlockHeader header;
+                filein >> header;
+                vBlocks.push_back({header.GetHash(), header.hashPrevBlock, CDiskBlockPos(nFile, entry.nPos), entry.nCompressedSize + 8});
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+        nSizeReindexed += GetPackedBlockFileSize(nFile).value_or(0) / 2;
         return;
     }
 
-    // Build forward-pointing map of the entire block tree.
-    std::multimap<CBlockIndex*,CBlockIndex*> forward;
-    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
-        forward.insert(std::make_pair(it->second->pprev, it->second));
-    }
-
-    assert(forward.size() == mapBlockIndex.size());
+    size_t nFileSize = fs::file_size(GetBlockPosFilename(pos, "blk"));
+    FILE* file = OpenBlockFile(pos, true);
+    if (!file)
+        return; // This error is logged in OpenBlockFile
+    LogPrintf("Reindexing block file blk%05u.dat...\n", (unsigned int)nFile);
 
-    std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> rangeGenesis = forward.equal_range(NULL);
+    try {
+        // This takes over file and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(file, 2*MAX_BLOCK_SIZE, MAX_BLOCK_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        while (!blkdat.eof() && !ShutdownRequested()) {
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                blkdat.FindByte(chainparams.MessageStart()[0]);
+                nRewind = blkdat.GetPos()+1;
+                blkdat >> FLATDATA(buf);
+                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if ((nSize & ~DISK_RECORD_COMPRESSED) < 80 || !IsValidDiskRecordSize(nSize))
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+            try {
+                // read block
+                uint64_t nBlockPos = blkdat.GetPos();
+                blkdat.SetLimit(nBlockPos + (nSize & ~DISK_RECORD_COMPRESSED));
+                blkdat.SetPos(nBlockPos);
+                CBlock block;
+                ReadDiskRecord(blkdat, nSize, block);
+                nRewind = blkdat.GetPos();
+                vBlocks.push_back({block.GetHash(), block.hashPrevBlock, CDiskBlockPos(nFile, nBlockPos), (nSize & ~DISK_RECORD_COMPRESSED) + 8});
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+            }
+        }
+    } catch (const std::runtime_error& e) {
+        AbortNode(std::string("System error: ") + e.what());
+    }
+    nSizeReindexed += nFileSize / 2;
+}
+
+/** The number of blocks a reindex reads from disk at a time. */
+static const size_t REINDEX_BATCH_BLOCKS = 64;
+
+bool ReindexBlockFiles(const CChainParams& chainparams, int nFiles)
+{
+    int64_t nStart = GetTimeMillis();
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    int nThreads = std::max(1, nScriptCheckThreads);
+
+    // Find the blocks in the files, a file at a time on each thread.
+    std::vector<std::vector<CReindexBlock>> vFileBlocks(nFiles);
+    {
+        std::atomic<int> nNext{0};
+        auto scan = [&]() {
+            for (int nFile = nNext++; nFile < nFiles; nFile = nNext++) {
+                ScanBlockFile(chainparams, nFile, vFileBlocks[nFile]);
+            }
+        };
+        std::vector<std::thread> vThreads;
+        for (int i = 1; i < std::min(nThreads, nFiles); i++) {
+            vThreads.emplace_back(scan);
+        }
+        scan();
+        for (std::thread& thread : vThreads) {
+            thread.join();
+        }
+    }
+    // The scans stop early on shutdown, and the files are then not reindexed.
+    boost::this_thread::interruption_point();
+    if (ShutdownRequested())
+        throw boost::thread_interrupted();
+
+    // Order the blocks so that each follows its parent, starting from the
+    // genesis block. A block found more than once is taken from where it was
+    // found first, and blocks whose parent was not found are left out.
+    std::map<uint256, const CReindexBlock*> mapFound;
+    std::multimap<uint256, const CReindexBlock*> mapChildren;
+    for (const std::vector<CReindexBlock>& vBlocks : vFileBlocks) {
+        for (const CReindexBlock& found : vBlocks) {
+            if (mapFound.emplace(found.hash, &found).second)
+                mapChildren.emplace(found.hashPrev, &found);
+        }
+    }
+    std::vector<const CReindexBlock*> vOrdered;
+    auto itGenesis = mapFound.find(consensusParams.hashGenesisBlock);
+    if (itGenesis != mapFound.end())
+        vOrdered.push_back(itGenesis->second);
+    for (size_t i = 0; i < vOrdered.size(); i++) {
+        auto range = mapChildren.equal_range(vOrdered[i]->hash);
+        for (auto it = range.first; it != range.second; it++) {
+            vOrdered.push_back(it->second);
+        }
+    }
+    LogPrintf("%s: found %u blocks, %u of them connected to the genesis block\n", __func__, mapFound.size(), vOrdered.size());
+
+    // Add the blocks to the index in that order. The next batch is read, and
+    // its Equihash solutions checked, on several threads while the current
+    // one is added.
+    auto readBatch = [&](size_t nFirst, std::vector<CBlock>& vBlocks) {
+        size_t nCount = std::min(REINDEX_BATCH_BLOCKS, vOrdered.size() - std::min(nFirst, vOrdered.size()));
+        vBlocks.resize(nCount);
+        std::atomic<size_t> nNext{0};
+        auto read = [&]() {
+            for (size_t i = nNext++; i < nCount; i = nNext++) {
+                if (!ReadBlockFromDisk(vBlocks[i], vOrdered[nFirst + i]->pos, consensusParams))
+                    vBlocks[i].SetNull();
+            }
+        };
+        std::vector<std::thread> vThreads;
+        for (int i = 1; i < std::min<int>(nThreads, nCount); i++) {
+            vThreads.emplace_back(read);
+        }
+        read();
+        for (std::thread& thread : vThreads) {
+            thread.join();
+        }
+    };
+    int nLoaded = 0;
+    std::vector<CBlock> vBlocks;
+    readBatch(0, vBlocks);
+    for (size_t nFirst = 0; nFirst < vOrdered.size(); nFirst += REINDEX_BATCH_BLOCKS) {
+        std::vector<CBlock> vNextBlocks;
+        std::thread reader([&]() { readBatch(nFirst + REINDEX_BATCH_BLOCKS, vNextBlocks); });
+        bool fError = false;
+        try {
+            for (size_t i = 0; i < vBlocks.size(); i++) {
+                boost::this_thread::interruption_point();
+                const CBlock& block = vBlocks[i];
+                const CReindexBlock& found = *vOrdered[nFirst + i];
+                nSizeReindexed += found.nSize / 2;
+                if (block.IsNull())
+                    continue; // This error is logged in ReadBlockFromDisk
+
+                {
+                    LOCK(cs_main);
+                    CValidationState state;
+                    auto mi = mapBlockIndex.find(found.hash);
+                    if (mi == mapBlockIndex.end() || (mi->second->nStatus & BLOCK_HAVE_DATA) == 0) {
+                        if (AcceptBlock(block, state, chainparams, NULL, true, &found.pos, true))
+                            nLoaded++;
+                        if (state.IsError()) {
+                            fError = true;
+                            break;
+                        }
+                    }
+                }
+
+                // Activate the genesis block so normal node progress can continue
+                if (found.hash == consensusParams.hashGenesisBlock) {
+                    CValidationState state;
+                    if (!ActivateBestChain(state, chainparams)) {
+                        fError = true;
+                        break;
+                    }
+                }
+
+                NotifyHeaderTip(consensusParams);
+            }
+        } catch (...) {
+            reader.join();
+            throw;
+        }
+        reader.join();
+        if (fError)
+            break;
+        vBlocks = std::move(vNextBlocks);
+    }
+
+    LogPrintf("Reindexed %i blocks in %dms\n", nLoaded, GetTimeMillis() - nStart);
+    return nLoaded > 0;
+}
+
+void static CheckBlockIndex(const Consensus::Params& consensusParams)
+{
+    if (!fCheckBlockIndex) {
+        return;
+    }
+
+    LOCK(cs_main);
+
+    // During a reindex, we read the genesis block and call CheckBlockIndex before ActivateBestChain,
+    // so we have the genesis block in mapBlockIndex but no active chain.  (A few of the tests when
+    // iterating the block tree require that chainActive has been initialized.)
+    if (chainActive.Height() < 0) {
+        assert(mapBlockIndex.size() <= 1);
+        return;
+    }
+
+    // Build forward-pointing map of the entire block tree.
+    std::multimap<CBlockIndex*,CBlockIndex*> forward;
+    for (BlockMap::iterator it = mapBlockIndex.begin(); it != mapBlockIndex.end(); it++) {
+        forward.insert(std::make_pair(it->second->pprev, it->second));
+    }
+
+    assert(forward.size() == mapBlockIndex.size());
+
+    std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> rangeGenesis = forward.equal_range(NULL);
     CBlockIndex *pindex = rangeGenesis.first->second;
     rangeGenesis.first++;
     assert(rangeGenesis.first == rangeGenesis.second); // There is only one index entry with parent NULL.
@@ -6085,6 +8175,8 @@ void static CheckBlockIndex(const Consensus::Params& consensusParams)
         } else { // If this block sorts worse than the current tip or some ancestor's block has never been seen, it cannot be in setBlockIndexCandidates.
             assert(setBlockIndexCandidates.count(pindex) == 0);
         }
+        // A block is a tip exactly when no block builds on it.
+        assert(setBlockIndexTips.count(pindex) == (forward.count(pindex) == 0 ? 1 : 0));
         // Check whether this block is in mapBlocksUnlinked.
         std::pair<std::multimap<CBlockIndex*,CBlockIndex*>::iterator,std::multimap<CBlockIndex*,CBlockIndex*>::iterator> rangeUnlinked = mapBlocksUnlinked.equal_range(pindex->pprev);
         bool foundInUnlinked = false;
@@ -6209,197 +8301,979 @@ bool static AlreadyHave(const CInv& inv) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
             // are re-validated once their parents have arrived, and all other
             // locations are only possible if the transaction has already been
             // validated (we don't care about alternative authorizing data).
-            return recentRejects->contains(inv.GetWideHash()) ||
-                   mempool.exists(inv.hash) ||
-                   mapOrphanTransactions.count(inv.hash) ||
-                   pcoinsTip->HaveCoins(inv.hash);
+            if (recentRejects->contains(inv.GetWideHash()) ||
+                mempool.exists(inv.hash) ||
+                mapOrphanTransactions.count(inv.hash)) {
+                return true;
+            }
+
+            // Use pcoinsTip->HaveCoinInCache as a quick approximation to exclude
+            // requesting or processing some txs which have already been included
+            // in a block.
+            for (size_t i = 0; i < 2; i++) {
+                if (pcoinsTip->HaveCoinInCache(COutPoint(inv.hash, i)))
+                    return true;
+            }
+            return false;
         }
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash);
     }
-    // Don't know what it is, just say we already got one
+    // Don't know what it is, just say we already got one
+    return true;
+}
+
+/** A block requested by a peer with getdata, to be read from disk and sent. */
+struct CBlockServeRequest
+{
+    CNode* pfrom = nullptr;
+    //! The type of the inv the block was requested with, or 0 if none.
+    int nType = 0;
+    uint256 hash;
+    CDiskBlockPos pos;
+    bool fSendCompact = false;
+    //! The tip to announce after the block, if it was the peer's hashContinue.
+    uint256 hashContinueTip;
+};
+
+/**
+ * Historical blocks waiting to be sent by ThreadServeBlocks(), at most one per
+ * peer. Each entry holds a reference to the peer.
+ */
+static boost::mutex csBlockServe;
+static boost::condition_variable condBlockServe;
+static std::deque<CBlockServeRequest> queueBlockServe;
+
+void static SendBlockFromDisk(const CBlockServeRequest& req, const Consensus::Params& consensusParams)
+{
+    CNode* pfrom = req.pfrom;
+    bool fRead;
+    if (req.fSendCompact)
+    {
+        CBlock block;
+        fRead = ReadBlockFromDisk(block, req.pos, consensusParams) && block.GetHash() == req.hash;
+        if (fRead)
+            pfrom->PushMessage("cmpctblock", CBlockHeaderAndShortTxIDs(block));
+    }
+    else if (req.nType == MSG_BLOCK || req.nType == MSG_CMPCT_BLOCK)
+    {
+        // The stored serialization is the one sent over the
+        // network, so copy it as-is rather than deserializing
+        // and reserializing the block.
+        std::vector<unsigned char> blockData;
+        fRead = ReadRawBlockFromDisk(blockData, req.pos, Params().MessageStart());
+        if (fRead)
+            pfrom->PushMessage("block", CFlatData(blockData));
+    }
+    else // MSG_FILTERED_BLOCK)
+    {
+        CBlock block;
+        fRead = ReadBlockFromDisk(block, req.pos, consensusParams) && block.GetHash() == req.hash;
+        bool send = false;
+        CMerkleBlock merkleBlock;
+        if (fRead) {
+            LOCK(pfrom->cs_filter);
+            if (pfrom->pfilter) {
+                send = true;
+                merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
+            }
+        }
+        if (send) {
+            pfrom->PushMessage("merkleblock", merkleBlock);
+            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+            // This avoids hurting performance by pointlessly requiring a round-trip
+            // Note that there is currently no way for a node to request any single transactions we didn't send here -
+            // they must either disconnect and retry or request the full block.
+            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+            // however we MUST always provide at least what the remote peer needs
+            typedef std::pair<unsigned int, uint256> PairType;
+            for (PairType& pair : merkleBlock.vMatchedTxn)
+                pfrom->PushMessage("tx", block.vtx[pair.first]);
+        }
+        // else
+            // no response
+    }
+
+    if (!fRead) {
+        // Without cs_main, a pruned node may have deleted the block file
+        // since the block was looked up.
+        if (!fPruneMode)
+            assert(!"cannot load block from disk");
+        LogPrint("net", "%s: block %s was pruned before it could be sent to peer=%d\n", __func__, req.hash.ToString(), pfrom->GetId());
+    } else if (!req.hashContinueTip.IsNull()) {
+        // Bypass PushBlockInventory, this must send even if redundant,
+        // and we want it right after the last block so they don't
+        // wait for other stuff first.
+        vector<CInv> vInv;
+        vInv.push_back(CInv(MSG_BLOCK, req.hashContinueTip));
+        pfrom->PushMessage("inv", vInv);
+        pfrom->hashContinue.SetNull();
+    }
+}
+
+void ThreadServeBlocks()
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    while (true) {
+        CBlockServeRequest req;
+        {
+            boost::unique_lock<boost::mutex> lock(csBlockServe);
+            while (queueBlockServe.empty()) {
+                condBlockServe.wait(lock);
+            }
+            req = queueBlockServe.front();
+            queueBlockServe.pop_front();
+        }
+        if (!req.pfrom->fDisconnect) {
+            SendBlockFromDisk(req, consensusParams);
+        }
+        req.pfrom->fServingBlock = false;
+        req.pfrom->Release();
+        WakeMessageHandler();
+    }
+}
+
+void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams)
+{
+    int currentHeight = GetHeight();
+
+    std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
+
+    vector<CInv> vNotFound;
+
+    // At most one block is sent per call. It is read from disk once cs_main
+    // has been released, so that serving old blocks to one peer does not
+    // hold up the message handlers of the others; with -blockservethreads,
+    // blocks away from the tip are handed to ThreadServeBlocks().
+    CBlockServeRequest req;
+    req.pfrom = pfrom;
+    bool fHistorical = false;
+
+    {
+    LOCK(cs_main);
+
+    while (it != pfrom->vRecvGetData.end()) {
+        // Don't bother if send buffer is too full to respond anyway
+        if (pfrom->nSendSize >= SendBufferSize())
+            break;
+
+        const CInv &inv = *it;
+        {
+            boost::this_thread::interruption_point();
+            it++;
+
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
+            {
+                bool send = false;
+                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
+                if (mi != mapBlockIndex.end())
+                {
+                    if (chainActive.Contains(mi->second)) {
+                        send = true;
+                    } else {
+                        static const int nOneMonth = 30 * 24 * 60 * 60;
+                        // To prevent fingerprinting attacks, only send blocks outside of the active
+                        // chain if they are valid, and no more than a month older (both in time, and in
+                        // best equivalent proof of work) than the best header chain we know about.
+                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
+                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
+                            (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, consensusParams) < nOneMonth);
+                        if (!send) {
+                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
+                        }
+                    }
+                }
+                // disconnect node in case we have reached the outbound limit for serving historical blocks
+                // never disconnect whitelisted nodes
+                static const int nOneWeek = 7 * 24 * 60 * 60; // assume > 1 week = historical
+                if (send && CNode::OutboundTargetReached(consensusParams.PoWTargetSpacing(currentHeight), true) && (
+                        (
+                            (pindexBestHeader != NULL) &&
+                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > nOneWeek)
+                        ) || inv.type == MSG_FILTERED_BLOCK
+                    ) && !pfrom->fWhitelisted)
+                {
+                    LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
+
+                    //disconnect node
+                    pfrom->fDisconnect = true;
+                    send = false;
+                }
+                // Pruned nodes may have deleted the block, so check whether
+                // it's available before trying to send.
+                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
+                {
+                    // Send block from disk. A compact block is only worth
+                    // sending for blocks near the tip, whose transactions the
+                    // peer is likely to have in its mempool.
+                    fHistorical = mi->second->nHeight < chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
+                    req.nType = inv.type;
+                    req.hash = inv.hash;
+                    req.pos = mi->second->GetBlockPos();
+                    req.fSendCompact = inv.type == MSG_CMPCT_BLOCK && pfrom->fSupportsCompactBlocks && !fHistorical;
+
+                    // Trigger the peer node to send a getblocks request for the next batch of inventory
+                    if (inv.hash == pfrom->hashContinue)
+                        req.hashContinueTip = chainActive.Tip()->GetBlockHash();
+                }
+            }
+            else if (inv.type == MSG_TX || inv.type == MSG_WTX)
+            {
+                // Send stream from relay memory
+                bool push = false;
+                auto mi = mapRelay.find(inv.hash);
+                if (mi != mapRelay.end() && !IsExpiringSoonTx(*mi->second, currentHeight + 1)) {
+                    // ZIP 239: MSG_TX should be used if and only if the tx is v4 or earlier.
+                    if ((mi->second->nVersion <= 4) != (inv.type == MSG_TX)) {
+                        Misbehaving(pfrom->GetId(), 100);
+                        LogPrint("net", "Wrong INV message type used for v%d tx", mi->second->nVersion);
+                        // Break so that this inv message will be erased from the queue
+                        // (otherwise the peer would repeatedly hit this case until its
+                        // Misbehaving level rises above -banscore, no matter what the
+                        // user set it to).
+                        break;
+                    }
+                    // Ensure we only reply with a transaction if it is exactly what the
+                    // peer requested from us. Otherwise we add it to vNotFound below.
+                    if (inv.hashAux == mi->second->GetAuthDigest()) {
+                        pfrom->PushMessage("tx", *mi->second);
+                        push = true;
+                    }
+                } else if (pfrom->timeLastMempoolReq) {
+                    auto txinfo = mempool.info(inv.hash);
+                    // To protect privacy, do not answer getdata using the mempool when
+                    // that TX couldn't have been INVed in reply to a MEMPOOL request.
+                    if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq && !IsExpiringSoonTx(*txinfo.tx, currentHeight + 1)) {
+                        // ZIP 239: MSG_TX should be used if and only if the tx is v4 or earlier.
+                        if ((txinfo.tx->nVersion <= 4) != (inv.type == MSG_TX)) {
+                            Misbehaving(pfrom->GetId(), 100);
+                            LogPrint("net", "Wrong INV message type used for v%d tx", txinfo.tx->nVersion);
+                            // Break so that this inv message will be erased from the queue.
+                            break;
+                        }
+                        // Ensure we only reply with a transaction if it is exactly what
+                        // the peer requested from us. Otherwise we add it to vNotFound
+                        // below.
+                        if (inv.hashAux == txinfo.tx->GetAuthDigest()) {
+                            pfrom->PushMessage("tx", *txinfo.tx);
+                            push = true;
+                        }
+                    }
+                }
+                if (!push) {
+                    vNotFound.push_back(inv);
+                }
+            }
+
+            // Track requests for our stuff.
+            GetMainSignals().Inventory(inv.hash);
+
+            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK || inv.type == MSG_CMPCT_BLOCK)
+                break;
+        }
+    }
+    }
+
+    if (req.nType != 0) {
+        if (fHistorical && nBlockServeThreads > 0) {
+            // The peer's further requests wait until this block is sent.
+            pfrom->fServingBlock = true;
+            pfrom->AddRef();
+            boost::unique_lock<boost::mutex> lock(csBlockServe);
+            queueBlockServe.push_back(req);
+            condBlockServe.notify_one();
+        } else {
+            SendBlockFromDisk(req, consensusParams);
+        }
+    }
+
+    pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
+
+    if (!vNotFound.empty()) {
+        // Let the peer know that we didn't find what it asked for, so it doesn't
+        // have to wait around forever. Currently only SPV clients actually care
+        // about this message: it's needed when they are recursively walking the
+        // dependencies of relevant unconfirmed transactions. SPV clients want to
+        // do that because they want to know about (and store and rebroadcast and
+        // risk analyze) the dependencies of transactions relevant to them, without
+        // having to download the entire memory pool.
+        pfrom->PushMessage("notfound", vNotFound);
+    }
+}
+
+/**
+ * Try to add a transaction received from a peer to the mempool, and handle the
+ * outcome: relay it and any orphans that depended on it, or add it to the
+ * orphans, or reject it.
+ */
+static void ProcessRelayedTransaction(
+    const CChainParams& chainparams,
+    CNode* pfrom,
+    const CTransaction& tx,
+    bool fProofsVerified) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    AssertLockHeld(cs_main);
+
+    vector<uint256> vWorkQueue;
+    vector<uint256> vEraseQueue;
+
+    const uint256& txid = tx.GetHash();
+    const WTxId& wtxid = tx.GetWTxId();
+
+    bool fMissingInputs = false;
+    CValidationState state;
+
+    // We do the AlreadyHave() check using a MSG_WTX inv unconditionally,
+    // because for pre-v5 transactions wtxid.authDigest is set to the same
+    // placeholder as is used for the CInv.hashAux field for MSG_TX.
+    if (!AlreadyHave(CInv(MSG_WTX, txid, wtxid.authDigest)) &&
+        AcceptToMemoryPool(chainparams, mempool, state, tx, true, &fMissingInputs, false, fProofsVerified))
+    {
+        mempool.check(pcoinsTip);
+        RelayTransaction(tx);
+        vWorkQueue.push_back(txid);
+
+        LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s: accepted %s (poolsz %u txn, %u kB)\n",
+            pfrom->id, pfrom->cleanSubVer,
+            tx.GetHash().ToString(),
+            mempool.size(), mempool.DynamicMemoryUsage() / 1000);
+
+        // Recursively process any orphan transactions that depended on this one
+        set<NodeId> setMisbehaving;
+        for (unsigned int i = 0; i < vWorkQueue.size(); i++)
+        {
+            map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
+            if (itByPrev == mapOrphanTransactionsByPrev.end())
+                continue;
+            for (set<uint256>::iterator mi = itByPrev->second.begin();
+                 mi != itByPrev->second.end();
+                 ++mi)
+            {
+                const uint256& orphanHash = *mi;
+                const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
+                NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
+                bool fMissingInputs2 = false;
+                // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
+                // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
+                // anyone relaying LegitTxX banned)
+                CValidationState stateDummy;
+
+
+                if (setMisbehaving.count(fromPeer))
+                    continue;
+                if (AcceptToMemoryPool(chainparams, mempool, stateDummy, orphanTx, true, &fMissingInputs2))
+                {
+                    LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
+                    RelayTransaction(orphanTx);
+                    vWorkQueue.push_back(orphanHash);
+                    vEraseQueue.push_back(orphanHash);
+                }
+                else if (!fMissingInputs2)
+                {
+                    int nDos = 0;
+                    if (stateDummy.IsInvalid(nDos) && nDos > 0)
+                    {
+                        // Punish peer that gave us an invalid orphan tx
+                        Misbehaving(fromPeer, nDos);
+                        setMisbehaving.insert(fromPeer);
+                        LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
+                    }
+                    // Has inputs but not accepted to mempool
+                    // Probably non-standard or insufficient fee/priority
+                    LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
+                    vEraseQueue.push_back(orphanHash);
+                    // Add the wtxid of this transaction to our reject filter.
+                    // Unlike upstream Bitcoin Core, we can unconditionally add
+                    // these, as they are always bound to the entirety of the
+                    // transaction regardless of version.
+                    assert(recentRejects);
+                    recentRejects->insert(orphanTx.GetWTxId().ToBytes());
+                }
+                mempool.check(pcoinsTip);
+            }
+        }
+
+        for (uint256 hash : vEraseQueue)
+            EraseOrphanTx(hash);
+    }
+    // TODO: currently, prohibit joinsplits and shielded spends/outputs/actions from entering mapOrphans
+    else if (fMissingInputs &&
+             tx.vJoinSplit.empty() &&
+             tx.vShieldedSpend.empty() &&
+             tx.vShieldedOutput.empty() &&
+             !tx.GetOrchardBundle().IsPresent())
+    {
+        AddOrphanTx(tx, pfrom->GetId());
+
+        // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
+        unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
+        unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
+        if (nEvicted > 0)
+            LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
+    } else {
+        // Add the wtxid of this transaction to our reject filter.
+        // Unlike upstream Bitcoin Core, we can unconditionally add
+        // these, as they are always bound to the entirety of the
+        // transaction regardless of version.
+        assert(recentRejects);
+        recentRejects->insert(tx.GetWTxId().ToBytes());
+
+        if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
+            // Always relay transactions received from whitelisted peers, even
+            // if they were already in the mempool or rejected from it due
+            // to policy, allowing the node to function as a gateway for
+            // nodes hidden behind it.
+            //
+            // Never relay transactions that we would assign a non-zero DoS
+            // score for, as we expect peers to do the same with us in that
+            // case.
+            int nDoS = 0;
+            if (!state.IsInvalid(nDoS) || nDoS == 0) {
+                LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
+                RelayTransaction(tx);
+            } else {
+                LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s (code %d))\n",
+                    tx.GetHash().ToString(), pfrom->id, state.GetRejectReason(), state.GetRejectCode());
+            }
+        }
+    }
+    int nDoS = 0;
+    if (state.IsInvalid(nDoS))
+    {
+        LogPrint("mempoolrej", "%s from peer=%d %s was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
+            pfrom->id, pfrom->cleanSubVer,
+            FormatStateMessage(state));
+        if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
+            pfrom->PushMessage("reject", std::string("tx"), (unsigned char)state.GetRejectCode(),
+                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), txid);
+        if (nDoS > 0)
+            Misbehaving(pfrom->GetId(), nDoS);
+    }
+}
+
+/**
+ * Shielded transactions received from peers while -mempoolproofbatch is set,
+ * waiting for ThreadMempoolProofBatch() to check their proofs. Each entry
+ * holds a reference to the peer that sent it.
+ */
+struct CMempoolProofBatchEntry
+{
+    CTransaction tx;
+    CNode* pfrom;
+    //! GetProofVerificationCost() of tx.
+    int64_t nCost;
+    //! The fee paid per unit of verification cost, or 0 if not yet known.
+    double dFeePerCost;
+    //! Set if the peer had used up its share of the queue when it sent tx.
+    bool fOverBudget;
+};
+
+/**
+ * Queued transactions are checked best first: those from peers within their
+ * budget, then by fee per unit of verification cost. Ties are broken by
+ * arrival, through the ordering of std::multiset.
+ */
+struct CompareMempoolProofBatchEntry
+{
+    bool operator()(const CMempoolProofBatchEntry& a, const CMempoolProofBatchEntry& b) const
+    {
+        if (a.fOverBudget != b.fOverBudget) {
+            return !a.fOverBudget;
+        }
+        return a.dFeePerCost > b.dFeePerCost;
+    }
+};
+
+static boost::mutex csMempoolProofBatch;
+static boost::condition_variable condMempoolProofBatch;
+static std::multiset<CMempoolProofBatchEntry, CompareMempoolProofBatchEntry> queueMempoolProofBatch;
+//! The transactions in queueMempoolProofBatch or being processed from it.
+static std::set<WTxId> setMempoolProofBatchTxs;
+//! The total verification cost of the queued transactions of each peer.
+static std::map<NodeId, int64_t> mapMempoolProofBatchPeerCost;
+
+/**
+ * An estimate of the work needed to check the proofs and signatures of tx,
+ * in units of roughly one Sapling Output proof checked as part of a batch.
+ */
+static int64_t GetProofVerificationCost(const CTransaction& tx)
+{
+    int64_t nCost = 1;
+    nCost += tx.vJoinSplit.size() * PROOF_COST_JOINSPLIT;
+    nCost += tx.vShieldedSpend.size() * PROOF_COST_SAPLING_SPEND;
+    nCost += tx.vShieldedOutput.size() * PROOF_COST_SAPLING_OUTPUT;
+    nCost += tx.GetOrchardBundle().GetNumActions() * PROOF_COST_ORCHARD_ACTION;
+    return nCost;
+}
+
+/**
+ * Queue a transaction received from a peer for its proofs to be checked as
+ * part of a batch. Returns false if the transaction should instead be
+ * processed immediately: if batching is disabled or the queue is full, if the
+ * transaction has no proofs, or if we already have it.
+ */
+static bool QueueForMempoolProofBatch(CNode* pfrom, const CTransaction& tx) EXCLUSIVE_LOCKS_REQUIRED(cs_main)
+{
+    if (nMempoolProofBatch == 0) {
+        return false;
+    }
+    if (tx.vJoinSplit.empty() &&
+        tx.vShieldedSpend.empty() &&
+        tx.vShieldedOutput.empty() &&
+        !tx.GetOrchardBundle().IsPresent())
+    {
+        return false;
+    }
+    const WTxId& wtxid = tx.GetWTxId();
+    if (AlreadyHave(CInv(MSG_WTX, tx.GetHash(), wtxid.authDigest))) {
+        return false;
+    }
+
+    // The fee is only known if the transparent inputs are, which they need
+    // not be yet; such a transaction is scheduled as if it paid nothing.
+    const int64_t nCost = GetProofVerificationCost(tx);
+    double dFeePerCost = 0;
+    {
+        LOCK(mempool.cs);
+        CCoinsViewMemPool viewMemPool(pcoinsTip, mempool);
+        CCoinsViewCache view(&viewMemPool);
+        if (view.HaveInputs(tx)) {
+            CAmount nFee = view.GetValueIn(tx) - tx.GetValueOut();
+            dFeePerCost = std::max<double>(0, nFee) / nCost;
+        }
+    }
+
+    boost::unique_lock<boost::mutex> lock(csMempoolProofBatch);
+    if (queueMempoolProofBatch.size() >= 4 * (size_t)nMempoolProofBatch) {
+        return false;
+    }
+    // Another peer sent us the same transaction, and it has yet to be processed.
+    if (!setMempoolProofBatchTxs.insert(wtxid).second) {
+        return true;
+    }
+    // A peer that keeps more than its share of verification work queued
+    // gets the rest of its transactions checked after everyone else's.
+    int64_t& nPeerCost = mapMempoolProofBatchPeerCost[pfrom->GetId()];
+    bool fOverBudget = nPeerCost >= MEMPOOL_PROOF_BATCH_PEER_COST * nMempoolProofBatch;
+    nPeerCost += nCost;
+    queueMempoolProofBatch.insert({tx, pfrom->AddRef(), nCost, dFeePerCost, fOverBudget});
+    condMempoolProofBatch.notify_one();
+    return true;
+}
+
+/**
+ * Check the Sapling and Orchard bundle authorizations of the given
+ * transactions in a single batch.
+ */
+static bool CheckShieldedAuthBatch(
+    std::vector<const CTransaction*>::const_iterator begin,
+    std::vector<const CTransaction*>::const_iterator end,
+    uint32_t consensusBranchId)
+{
+    auto saplingAuth = sapling::init_batch_validator();
+    auto orchardAuth = orchard::AuthValidator::Batch();
+    for (auto it = begin; it != end; ++it) {
+        if (QueueContextFreeShieldedAuth(**it, consensusBranchId, *saplingAuth, orchardAuth) == ShieldedAuthQueueing::Invalid) {
+            return false;
+        }
+    }
+    return saplingAuth->validate() && orchardAuth.Validate();
+}
+
+/**
+ * Check the Sapling and Orchard bundle authorizations of vtx[begin, end) as a
+ * batch, and if that fails, bisect it to find the transactions at fault. On
+ * return, vValid[i] is set for each transaction in the range that is valid.
+ */
+static void BisectShieldedAuthBatch(
+    const std::vector<const CTransaction*>& vtx,
+    size_t begin,
+    size_t end,
+    uint32_t consensusBranchId,
+    std::vector<bool>& vValid)
+{
+    if (CheckShieldedAuthBatch(vtx.begin() + begin, vtx.begin() + end, consensusBranchId)) {
+        std::fill(vValid.begin() + begin, vValid.begin() + end, true);
+        return;
+    }
+    if (end - begin == 1) {
+        return;
+    }
+    size_t mid = begin + (end - begin) / 2;
+    BisectShieldedAuthBatch(vtx, begin, mid, consensusBranchId, vValid);
+    BisectShieldedAuthBatch(vtx, mid, end, consensusBranchId, vValid);
+}
+
+/**
+ * Check the proofs of vtx, which must not need cs_main, against the given
+ * branch ID. On return, vProofsVerified[i] is set for each transaction whose
+ * proofs and bundle authorizations are valid, and which AcceptToMemoryPool()
+ * can therefore be told not to check again.
+ */
+static std::vector<bool> CheckMempoolProofBatch(const std::vector<const CTransaction*>& vtx, uint32_t consensusBranchId)
+{
+    // CheckTransaction() verifies the Sprout proofs, one transaction at a time.
+    std::vector<const CTransaction*> vBatchTx;
+    std::vector<size_t> vBatchIndex;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        const CTransaction& tx = *vtx[i];
+        if (!IsShieldedSigHashContextFree(tx)) {
+            continue;
+        }
+        CValidationState state;
+        auto verifier = ProofVerifier::Strict();
+        if (!CheckTransaction(tx, state, verifier)) {
+            continue;
+        }
+        vBatchTx.push_back(&tx);
+        vBatchIndex.push_back(i);
+    }
+
+    std::vector<bool> vValid(vBatchTx.size(), false);
+    if (!vBatchTx.empty()) {
+        BisectShieldedAuthBatch(vBatchTx, 0, vBatchTx.size(), consensusBranchId, vValid);
+    }
+    std::vector<bool> vProofsVerified(vtx.size(), false);
+    for (size_t j = 0; j < vBatchIndex.size(); j++) {
+        vProofsVerified[vBatchIndex[j]] = vValid[j];
+    }
+    LogPrint("mempool", "%s: checked proofs of %u of %u transactions (%u valid)\n", __func__,
+        vBatchTx.size(), vtx.size(), std::count(vValid.begin(), vValid.end(), true));
+    return vProofsVerified;
+}
+
+/**
+ * Check the proofs of a batch of transactions received from peers without
+ * holding cs_main, then add them to the mempool. Only the checks that depend
+ * on the chain state are left for AcceptToMemoryPool(). Transactions that fail
+ * here are given to AcceptToMemoryPool() unverified, so that they are
+ * rejected with the usual reasons.
+ */
+static void ProcessMempoolProofBatch(const CChainParams& chainparams, std::vector<CMempoolProofBatchEntry>& batch)
+{
+    const Consensus::Params& consensus = chainparams.GetConsensus();
+    uint32_t consensusBranchId;
+    {
+        LOCK(cs_main);
+        consensusBranchId = CurrentEpochBranchId(chainActive.Height() + 1, consensus);
+    }
+
+    std::vector<const CTransaction*> vtx;
+    for (const CMempoolProofBatchEntry& entry : batch) {
+        vtx.push_back(&entry.tx);
+    }
+    std::vector<bool> vProofsVerified = CheckMempoolProofBatch(vtx, consensusBranchId);
+
+    LOCK(cs_main);
+    // The bundle authorizations commit to the branch ID, so they only count
+    // as verified if the next block is still in the same epoch.
+    bool fSameBranch = CurrentEpochBranchId(chainActive.Height() + 1, consensus) == consensusBranchId;
+    for (size_t i = 0; i < batch.size(); i++) {
+        ProcessRelayedTransaction(chainparams, batch[i].pfrom, batch[i].tx, fSameBranch && vProofsVerified[i]);
+        {
+            boost::unique_lock<boost::mutex> lock(csMempoolProofBatch);
+            setMempoolProofBatchTxs.erase(batch[i].tx.GetWTxId());
+        }
+        batch[i].pfrom->Release();
+    }
+}
+
+void ThreadMempoolProofBatch()
+{
+    const CChainParams& chainparams = Params();
+    while (true) {
+        std::vector<CMempoolProofBatchEntry> batch;
+        {
+            boost::unique_lock<boost::mutex> lock(csMempoolProofBatch);
+            while (queueMempoolProofBatch.empty()) {
+                condMempoolProofBatch.wait(lock);
+            }
+            // Give a burst of transactions time to arrive, until we have a full batch.
+            auto deadline = boost::posix_time::microsec_clock::universal_time() +
+                boost::posix_time::milliseconds(MEMPOOL_PROOF_BATCH_WINDOW_MS);
+            while (queueMempoolProofBatch.size() < (size_t)nMempoolProofBatch &&
+                   condMempoolProofBatch.timed_wait(lock, deadline)) {}
+            while (!queueMempoolProofBatch.empty() && batch.size() < (size_t)nMempoolProofBatch) {
+                auto it = queueMempoolProofBatch.begin();
+                auto itPeer = mapMempoolProofBatchPeerCost.find(it->pfrom->GetId());
+                assert(itPeer != mapMempoolProofBatchPeerCost.end());
+                itPeer->second -= it->nCost;
+                if (itPeer->second == 0) {
+                    mapMempoolProofBatchPeerCost.erase(itPeer);
+                }
+                batch.push_back(*it);
+                queueMempoolProofBatch.erase(it);
+            }
+        }
+        ProcessMempoolProofBatch(chainparams, batch);
+    }
+}
+
+static const char* MEMPOOL_FILENAME = "mempool.dat";
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+/** Number of saved transactions whose proofs are checked together while loading. */
+static const size_t MEMPOOL_LOAD_BATCH_SIZE = 100;
+
+bool DumpMempool()
+{
+    int64_t nStart = GetTimeMillis();
+
+    std::vector<TxMempoolInfo> vInfo = mempool.infoAll();
+    std::map<uint256, std::pair<double, CAmount>> mapDeltas;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+    }
+
+    // The mempool is ordered by score, so write each transaction after its
+    // parents in the mempool, letting LoadMempool() accept them as it reads.
+    std::map<uint256, const TxMempoolInfo*> mapInfo;
+    for (const TxMempoolInfo& info : vInfo) {
+        mapInfo.emplace(info.tx->GetHash(), &info);
+    }
+    std::vector<const TxMempoolInfo*> vOrdered;
+    std::set<uint256> setVisited;
+    std::function<void(const TxMempoolInfo&)> visit = [&](const TxMempoolInfo& info) {
+        if (!setVisited.insert(info.tx->GetHash()).second) {
+            return;
+        }
+        for (const CTxIn& txin : info.tx->vin) {
+            auto it = mapInfo.find(txin.prevout.hash);
+            if (it != mapInfo.end()) {
+                visit(*it->second);
+            }
+        }
+        vOrdered.push_back(&info);
+    };
+    for (const TxMempoolInfo& info : vInfo) {
+        visit(info);
+    }
+
+    fs::path path = GetDataDir() / MEMPOOL_FILENAME;
+    fs::path pathNew = GetDataDir() / (std::string(MEMPOOL_FILENAME) + ".new");
+    try {
+        CAutoFile file(fsbridge::fopen(pathNew, "wb"), SER_DISK, CLIENT_VERSION);
+        if (file.IsNull())
+            return error("%s: failed to open %s", __func__, pathNew.string());
+        file << MEMPOOL_DUMP_VERSION;
+        // The deltas come first, so that they are applied before the fee
+        // checks of the transactions they are for.
+        file << mapDeltas;
+        file << (uint64_t)vOrdered.size();
+        for (const TxMempoolInfo* info : vOrdered) {
+            file << *info->tx;
+            file << info->nTime;
+        }
+        FileCommit(file.Get());
+        file.fclose();
+        if (!RenameOver(pathNew, path))
+            return error("%s: failed to rename %s", __func__, pathNew.string());
+    } catch (const std::exception& e) {
+        return error("%s: %s", __func__, e.what());
+    }
+    LogPrintf("%s: saved %u transactions and %u deltas in %dms\n", __func__,
+        vOrdered.size(), mapDeltas.size(), GetTimeMillis() - nStart);
     return true;
 }
 
-void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParams)
+bool LoadMempool(const CChainParams& chainparams)
 {
-    int currentHeight = GetHeight();
-
-    std::deque<CInv>::iterator it = pfrom->vRecvGetData.begin();
-
-    vector<CInv> vNotFound;
+    CAutoFile file(fsbridge::fopen(GetDataDir() / MEMPOOL_FILENAME, "rb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        LogPrintf("%s: no %s to load\n", __func__, MEMPOOL_FILENAME);
+        return false;
+    }
 
-    LOCK(cs_main);
+    const Consensus::Params& consensus = chainparams.GetConsensus();
+    int64_t nStart = GetTimeMillis();
+    size_t nAccepted = 0;
+    size_t nFailed = 0;
+    size_t nAlreadyThere = 0;
+    try {
+        uint64_t nVersion;
+        file >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION) {
+            LogPrintf("%s: unknown version %u of %s, ignoring it\n", __func__, nVersion, MEMPOOL_FILENAME);
+            return false;
+        }
 
-    while (it != pfrom->vRecvGetData.end()) {
-        // Don't bother if send buffer is too full to respond anyway
-        if (pfrom->nSendSize >= SendBufferSize())
-            break;
+        std::map<uint256, std::pair<double, CAmount>> mapDeltas;
+        file >> mapDeltas;
+        for (const auto& delta : mapDeltas) {
+            mempool.PrioritiseTransaction(delta.first, delta.first.ToString(), delta.second.first, delta.second.second);
+        }
 
-        const CInv &inv = *it;
-        {
-            boost::this_thread::interruption_point();
-            it++;
+        uint64_t nTxs;
+        file >> nTxs;
+        std::vector<std::pair<CTransaction, int64_t>> vBatch;
+        for (uint64_t i = 0; i < nTxs; ) {
+            vBatch.clear();
+            for (; i < nTxs && vBatch.size() < MEMPOOL_LOAD_BATCH_SIZE; i++) {
+                CTransaction tx;
+                int64_t nTime;
+                file >> tx;
+                file >> nTime;
+                vBatch.emplace_back(tx, nTime);
+            }
+            if (ShutdownRequested()) {
+                return false;
+            }
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
+            // As for relayed transactions, check the proofs without holding
+            // cs_main, and leave only the stateful checks for under it.
+            uint32_t consensusBranchId;
             {
-                bool send = false;
-                BlockMap::iterator mi = mapBlockIndex.find(inv.hash);
-                if (mi != mapBlockIndex.end())
-                {
-                    if (chainActive.Contains(mi->second)) {
-                        send = true;
-                    } else {
-                        static const int nOneMonth = 30 * 24 * 60 * 60;
-                        // To prevent fingerprinting attacks, only send blocks outside of the active
-                        // chain if they are valid, and no more than a month older (both in time, and in
-                        // best equivalent proof of work) than the best header chain we know about.
-                        send = mi->second->IsValid(BLOCK_VALID_SCRIPTS) && (pindexBestHeader != NULL) &&
-                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() < nOneMonth) &&
-                            (GetBlockProofEquivalentTime(*pindexBestHeader, *mi->second, *pindexBestHeader, consensusParams) < nOneMonth);
-                        if (!send) {
-                            LogPrintf("%s: ignoring request from peer=%i for old block that isn't in the main chain\n", __func__, pfrom->GetId());
-                        }
-                    }
-                }
-                // disconnect node in case we have reached the outbound limit for serving historical blocks
-                // never disconnect whitelisted nodes
-                static const int nOneWeek = 7 * 24 * 60 * 60; // assume > 1 week = historical
-                if (send && CNode::OutboundTargetReached(consensusParams.PoWTargetSpacing(currentHeight), true) && (
-                        (
-                            (pindexBestHeader != NULL) &&
-                            (pindexBestHeader->GetBlockTime() - mi->second->GetBlockTime() > nOneWeek)
-                        ) || inv.type == MSG_FILTERED_BLOCK
-                    ) && !pfrom->fWhitelisted)
-                {
-                    LogPrint("net", "historical block serving limit reached, disconnect peer=%d\n", pfrom->GetId());
-
-                    //disconnect node
-                    pfrom->fDisconnect = true;
-                    send = false;
-                }
-                // Pruned nodes may have deleted the block, so check whether
-                // it's available before trying to send.
-                if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
-                {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessage("block", block);
-                    else // MSG_FILTERED_BLOCK)
-                    {
-                        bool send = false;
-                        CMerkleBlock merkleBlock;
-                        {
-                            LOCK(pfrom->cs_filter);
-                            if (pfrom->pfilter) {
-                                send = true;
-                                merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
-                            }
-                        }
-                        if (send) {
-                            pfrom->PushMessage("merkleblock", merkleBlock);
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            for (PairType& pair : merkleBlock.vMatchedTxn)
-                                pfrom->PushMessage("tx", block.vtx[pair.first]);
-                        }
-                        // else
-                            // no response
-                    }
-
-                    // Trigger the peer node to send a getblocks request for the next batch of inventory
-                    if (inv.hash == pfrom->hashContinue)
-                    {
-                        // Bypass PushBlockInventory, this must send even if redundant,
-                        // and we want it right after the last block so they don't
-                        // wait for other stuff first.
-                        vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-                        pfrom->PushMessage("inv", vInv);
-                        pfrom->hashContinue.SetNull();
-                    }
-                }
+                LOCK(cs_main);
+                consensusBranchId = CurrentEpochBranchId(chainActive.Height() + 1, consensus);
             }
-            else if (inv.type == MSG_TX || inv.type == MSG_WTX)
-            {
-                // Send stream from relay memory
-                bool push = false;
-                auto mi = mapRelay.find(inv.hash);
-                if (mi != mapRelay.end() && !IsExpiringSoonTx(*mi->second, currentHeight + 1)) {
-                    // ZIP 239: MSG_TX should be used if and only if the tx is v4 or earlier.
-                    if ((mi->second->nVersion <= 4) != (inv.type == MSG_TX)) {
-                        Misbehaving(pfrom->GetId(), 100);
-                        LogPrint("net", "Wrong INV message type used for v%d tx", mi->second->nVersion);
-                        // Break so that this inv message will be erased from the queue
-                        // (otherwise the peer would repeatedly hit this case until its
-                        // Misbehaving level rises above -banscore, no matter what the
-                        // user set it to).
-                        break;
-                    }
-                    // Ensure we only reply with a transaction if it is exactly what the
-                    // peer requested from us. Otherwise we add it to vNotFound below.
-                    if (inv.hashAux == mi->second->GetAuthDigest()) {
-                        pfrom->PushMessage("tx", *mi->second);
-                        push = true;
-                    }
-                } else if (pfrom->timeLastMempoolReq) {
-                    auto txinfo = mempool.info(inv.hash);
-                    // To protect privacy, do not answer getdata using the mempool when
-                    // that TX couldn't have been INVed in reply to a MEMPOOL request.
-                    if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq && !IsExpiringSoonTx(*txinfo.tx, currentHeight + 1)) {
-                        // ZIP 239: MSG_TX should be used if and only if the tx is v4 or earlier.
-                        if ((txinfo.tx->nVersion <= 4) != (inv.type == MSG_TX)) {
-                            Misbehaving(pfrom->GetId(), 100);
-                            LogPrint("net", "Wrong INV message type used for v%d tx", txinfo.tx->nVersion);
-                            // Break so that this inv message will be erased from the queue.
-                            break;
-                        }
-                        // Ensure we only reply with a transaction if it is exactly what
-                        // the peer requested from us. Otherwise we add it to vNotFound
-                        // below.
-                        if (inv.hashAux == txinfo.tx->GetAuthDigest()) {
-                            pfrom->PushMessage("tx", *txinfo.tx);
-                            push = true;
-                        }
-                    }
+            std::vector<const CTransaction*> vtx;
+            for (const auto& entry : vBatch) {
+                vtx.push_back(&entry.first);
+            }
+            std::vector<bool> vProofsVerified = CheckMempoolProofBatch(vtx, consensusBranchId);
+
+            LOCK(cs_main);
+            bool fSameBranch = CurrentEpochBranchId(chainActive.Height() + 1, consensus) == consensusBranchId;
+            for (size_t j = 0; j < vBatch.size(); j++) {
+                const CTransaction& tx = vBatch[j].first;
+                // The wallet may have resubmitted it already.
+                if (mempool.exists(tx.GetHash())) {
+                    nAlreadyThere++;
+                    continue;
                 }
-                if (!push) {
-                    vNotFound.push_back(inv);
+                CValidationState state;
+                if (AcceptToMemoryPoolWithTime(chainparams, mempool, state, tx, false, nullptr,
+                        vBatch[j].second, false, fSameBranch && vProofsVerified[j])) {
+                    nAccepted++;
+                } else {
+                    nFailed++;
                 }
             }
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to read %s: %s\n", __func__, MEMPOOL_FILENAME, e.what());
+        return false;
+    }
 
-            // Track requests for our stuff.
-            GetMainSignals().Inventory(inv.hash);
+    LogPrintf("%s: accepted %u transactions (%u failed, %u already there) in %dms\n", __func__,
+        nAccepted, nFailed, nAlreadyThere, GetTimeMillis() - nStart);
+    return true;
+}
 
-            if (inv.type == MSG_BLOCK || inv.type == MSG_FILTERED_BLOCK)
-                break;
+
+// Requires cs_main.
+// Whether the auth data of a block reconstructed from a cmpctblock message
+// matches the commitments in its header. The block must extend the tip, as
+// the commitments also cover the chain history up to it. A mempool
+// transaction that has the same txid as one in the block, but different auth
+// data, would otherwise only be caught when the block is connected, and the
+// block would be marked invalid instead of being downloaded in full.
+static bool CheckReconstructedBlockCommitments(const CChainParams& chainparams, const CBlock& block, const CBlockIndex* pindex)
+{
+    const Consensus::Params& consensusParams = chainparams.GetConsensus();
+    assert(pindex->pprev == chainActive.Tip());
+    if (!consensusParams.NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_NU5))
+        return true;
+    auto prevConsensusBranchId = CurrentEpochBranchId(pindex->nHeight - 1, consensusParams);
+    uint256 hashBlockCommitments = DeriveBlockCommitmentsHash(
+        pcoinsTip->GetHistoryRoot(prevConsensusBranchId),
+        block.BuildAuthDataMerkleTree());
+    return block.hashBlockCommitments == hashBlockCommitments;
+}
+
+// Process a block received in a block message, or reconstructed from
+// cmpctblock and blocktxn messages, and reply to the peer if it is invalid.
+static void ProcessReceivedBlock(const CChainParams& chainparams, CNode* pfrom, const std::string& strCommand, const CBlock& block, bool forceProcessing)
+{
+    {
+        LOCK(cs_main);
+        RecordBlockDelivery(pfrom->GetId(), block.GetHash(), GetSerializeSize(block, SER_NETWORK, PROTOCOL_VERSION));
+    }
+    CValidationState state;
+    // Compact blocks may be relayed before they are fully validated.
+    bool fMayBan = strCommand == "block";
+    ProcessNewBlock(state, chainparams, pfrom, &block, forceProcessing, NULL, fMayBan);
+    int nDoS;
+    if (state.IsInvalid(nDoS)) {
+        assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
+        pfrom->PushMessage("reject", strCommand, (unsigned char)state.GetRejectCode(),
+                           state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
+        if (nDoS > 0) {
+            LOCK(cs_main);
+            Misbehaving(pfrom->GetId(), nDoS);
         }
+    } else {
+        LOCK(cs_main);
+        if (chainActive.Tip()->GetBlockHash() == block.GetHash())
+            MaybeSetPeerAsAnnouncingCompactBlocks(pfrom);
     }
+}
 
-    pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
+// Check a getcfilters, getcfheaders or getcfcheckpt request as BIP 157 does,
+// and find its stop block, which is in the active chain and no more than
+// nMaxHeightDiff blocks above nStartHeight. Disconnects a peer that asks for
+// filters we do not serve, or for a malformed range.
+static bool PrepareBlockFilterRequest(CNode* pfrom, uint8_t nFilterType, uint32_t nStartHeight, const uint256& stopHash, uint32_t nMaxHeightDiff, const CBlockIndex*& pindexStop)
+{
+    if (!(nLocalServices & NODE_COMPACT_FILTERS) || pinsightindex == NULL ||
+        nFilterType != static_cast<uint8_t>(BlockFilterType::BASIC)) {
+        LogPrint("net", "Peer %d requested unsupported block filter type %d\n", pfrom->id, nFilterType);
+        pfrom->fDisconnect = true;
+        return false;
+    }
 
-    if (!vNotFound.empty()) {
-        // Let the peer know that we didn't find what it asked for, so it doesn't
-        // have to wait around forever. Currently only SPV clients actually care
-        // about this message: it's needed when they are recursively walking the
-        // dependencies of relevant unconfirmed transactions. SPV clients want to
-        // do that because they want to know about (and store and rebroadcast and
-        // risk analyze) the dependencies of transactions relevant to them, without
-        // having to download the entire memory pool.
-        pfrom->PushMessage("notfound", vNotFound);
+    LOCK(cs_main);
+    BlockMap::iterator it = mapBlockIndex.find(stopHash);
+    if (it == mapBlockIndex.end()) {
+        LogPrint("net", "Peer %d requested block filters up to unknown block %s\n", pfrom->id, stopHash.ToString());
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    // The block may just have been disconnected; the peer will ask again.
+    if (!chainActive.Contains(it->second)) {
+        LogPrint("net", "Peer %d requested block filters up to block %s, which is not in the active chain\n", pfrom->id, stopHash.ToString());
+        return false;
+    }
+    pindexStop = it->second;
+
+    uint32_t nStopHeight = pindexStop->nHeight;
+    if (nStartHeight > nStopHeight) {
+        LogPrint("net", "Peer %d sent invalid block filter request with start height %d and stop height %d\n",
+                 pfrom->id, nStartHeight, nStopHeight);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    if (nStopHeight - nStartHeight >= nMaxHeightDiff) {
+        LogPrint("net", "Peer %d requested too many block filters: %d / %d\n",
+                 pfrom->id, nStopHeight - nStartHeight + 1, nMaxHeightDiff);
+        pfrom->fDisconnect = true;
+        return false;
+    }
+    return true;
+}
+
+// Read the block filters of the blocks from nStartHeight up to pindexStop,
+// in height order. Returns false if the index has not got there yet.
+static bool ReadBlockFilters(uint32_t nStartHeight, const CBlockIndex* pindexStop, std::vector<std::pair<uint256, CBlockFilterIndexValue>>& vFilters)
+{
+    // Block index entries are never freed, and the ancestors of a block do
+    // not change, so cs_main is not needed to walk back from the stop block.
+    vFilters.resize(pindexStop->nHeight - nStartHeight + 1);
+    const CBlockIndex* pindex = pindexStop;
+    for (size_t i = vFilters.size(); i-- > 0; pindex = pindex->pprev) {
+        vFilters[i].first = pindex->GetBlockHash();
+        if (!pinsightindex->ReadBlockFilter(vFilters[i].first, vFilters[i].second)) {
+            return false;
+        }
     }
+    return true;
 }
 
 bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string strCommand, CDataStream& vRecv, int64_t nTimeReceived)
 {
+    std::string strSanitizedCommand = SanitizeString(strCommand);
+    auto span = TracingSpan("debug", "profile", "ProcessMessage", "command", strSanitizedCommand.c_str());
+    auto spanGuard = span.Enter();
     LogPrint("net", "received: %s (%u bytes) peer=%d\n", SanitizeString(strCommand), vRecv.size(), pfrom->id);
     if (mapArgs.count("-dropmessagestest") && GetRand(atoi(mapArgs["-dropmessagestest"])) == 0)
     {
@@ -6518,6 +9392,13 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
             UpdatePreferredDownload(pfrom, State(pfrom->GetId()));
         }
 
+        // Offer to reconcile transaction announcements; this must be sent
+        // before our verack.
+        if (fTxReconciliation && pfrom->nVersion >= CINV_WTX_VERSION && pfrom->fRelayTxes) {
+            uint64_t nSalt = txReconciliation.PreRegisterPeer(pfrom->GetId());
+            pfrom->PushMessage("sendtxrcncl", TXRECONCILIATION_VERSION, nSalt);
+        }
+
         // Change version
         pfrom->PushMessage("verack");
         pfrom->ssSend.SetVersion(min(pfrom->nVersion, PROTOCOL_VERSION));
@@ -6557,7 +9438,7 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
 
         // Relay alerts
         {
-            LOCK(cs_mapAlerts);
+            LOCK2(cs_vNodes, cs_mapAlerts);
             for (std::pair<const uint256, CAlert>& item : mapAlerts)
                 item.second.RelayTo(pfrom);
         }
@@ -6595,6 +9476,102 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
             LOCK(cs_main);
             State(pfrom->GetId())->fCurrentlyConnected = true;
         }
+
+        // Tell peers that know about wtxids that we can receive compact
+        // blocks; we ask for them to be announced that way later, once the
+        // peer has given us a new tip.
+        if (pfrom->nVersion >= CINV_WTX_VERSION) {
+            pfrom->PushMessage("sendcmpct", false, CMPCTBLOCKS_VERSION);
+        }
+
+        // Ask the peer to announce new blocks to us with headers rather than
+        // invs, so that we can request them without a getheaders round trip.
+        if (pfrom->nVersion >= SENDHEADERS_VERSION) {
+            pfrom->PushMessage("sendheaders");
+        }
+
+        // A peer that has not offered reconciliation by now never will.
+        txReconciliation.FinishHandshake(pfrom->GetId());
+    }
+
+
+    else if (strCommand == "sendheaders")
+    {
+        LOCK(cs_main);
+        State(pfrom->GetId())->fPreferHeaders = true;
+    }
+
+
+    else if (strCommand == "feefilter")
+    {
+        CAmount newFeeFilter = 0;
+        vRecv >> newFeeFilter;
+        if (MoneyRange(newFeeFilter)) {
+            pfrom->minFeeFilter = newFeeFilter;
+            LogPrint("net", "received: feefilter of %s from peer=%d\n", CFeeRate(newFeeFilter).ToString(), pfrom->id);
+        }
+    }
+
+
+    else if (strCommand == "sendtxrcncl")
+    {
+        uint32_t nPeerVersion;
+        uint64_t nRemoteSalt;
+        vRecv >> nPeerVersion >> nRemoteSalt;
+
+        // Ignored unless we offered reconciliation too and have not had the
+        // peer's verack yet.
+        TxReconciliationTracker::RegisterResult result = txReconciliation.RegisterPeer(
+            pfrom->GetId(), pfrom->fInbound, nPeerVersion, nRemoteSalt);
+        if (result == TxReconciliationTracker::RECON_PROTOCOL_VIOLATION) {
+            LogPrint("net", "peer=%d sent an invalid sendtxrcncl; disconnecting\n", pfrom->id);
+            pfrom->fDisconnect = true;
+            return false;
+        }
+        if (result == TxReconciliationTracker::RECON_SUCCESS)
+            LogPrint("net", "peer=%d will reconcile transaction announcements\n", pfrom->id);
+    }
+
+
+    else if (strCommand == "reqrecon")
+    {
+        uint32_t nRemoteSetSize;
+        vRecv >> nRemoteSetSize;
+
+        CTxSketch sketch;
+        if (txReconciliation.RespondToRequest(pfrom->GetId(), nRemoteSetSize, sketch)) {
+            pfrom->PushMessage("sketch", sketch);
+        }
+    }
+
+
+    else if (strCommand == "sketch")
+    {
+        CTxSketch sketch;
+        vRecv >> sketch;
+
+        bool fSuccess;
+        std::vector<WTxId> vAnnounce;
+        std::vector<uint32_t> vRequest;
+        if (txReconciliation.HandleSketch(pfrom->GetId(), sketch, fSuccess, vAnnounce, vRequest)) {
+            pfrom->PushMessage("reconcildiff", (uint8_t)fSuccess, vRequest);
+            for (const WTxId& wtxid : vAnnounce)
+                pfrom->PushTxInventory(wtxid);
+        }
+    }
+
+
+    else if (strCommand == "reconcildiff")
+    {
+        uint8_t fSuccess;
+        std::vector<uint32_t> vRequested;
+        vRecv >> fSuccess >> vRequested;
+
+        std::vector<WTxId> vAnnounce;
+        if (txReconciliation.HandleReconcilDiff(pfrom->GetId(), fSuccess, vRequested, vAnnounce)) {
+            for (const WTxId& wtxid : vAnnounce)
+                pfrom->PushTxInventory(wtxid);
+        }
     }
 
 
@@ -6727,8 +9704,8 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
                     CNodeState *nodestate = State(pfrom->GetId());
 
                     if (chainActive.Tip()->GetBlockTime() > GetTime() - chainparams.GetConsensus().PoWTargetSpacing(pindexBestHeader->nHeight) * 20 &&
-                        nodestate->nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
-                        vToFetch.push_back(inv);
+                        nodestate->nBlocksInFlight < GetBlocksInTransitLimit(nodestate)) {
+                        vToFetch.push_back(CInv(pfrom->fSupportsCompactBlocks ? MSG_CMPCT_BLOCK : MSG_BLOCK, inv.hash));
                         // Mark block as in flight already, even though the actual "getdata" message only goes out
                         // later (within the same cs_main lock, though).
                         MarkBlockAsInFlight(pfrom->GetId(), inv.hash, chainparams.GetConsensus());
@@ -6863,6 +9840,11 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
             if (--nLimit <= 0 || pindex->GetBlockHash() == hashStop)
                 break;
         }
+        // pindex can be NULL either if we sent chainActive.Tip() or if our
+        // peer has chainActive.Tip() (and thus we are sending an empty
+        // headers message). In both cases it is safe to assume the peer has
+        // the tip, so that new blocks can be announced to it with headers.
+        State(pfrom->GetId())->pindexBestHeaderSent = pindex ? pindex : chainActive.Tip();
         pfrom->PushMessage("headers", vHeaders);
     }
 
@@ -6877,149 +9859,20 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
             return true;
         }
 
-        vector<uint256> vWorkQueue;
-        vector<uint256> vEraseQueue;
         CTransaction tx;
         vRecv >> tx;
 
-        const uint256& txid = tx.GetHash();
         const WTxId& wtxid = tx.GetWTxId();
 
         LOCK(cs_main);
 
-        pfrom->AddKnownTx(wtxid);
-
-        bool fMissingInputs = false;
-        CValidationState state;
-
-        pfrom->setAskFor.erase(wtxid);
-        mapAlreadyAskedFor.erase(wtxid);
-
-        // We do the AlreadyHave() check using a MSG_WTX inv unconditionally,
-        // because for pre-v5 transactions wtxid.authDigest is set to the same
-        // placeholder as is used for the CInv.hashAux field for MSG_TX.
-        if (!AlreadyHave(CInv(MSG_WTX, txid, wtxid.authDigest)) &&
-            AcceptToMemoryPool(chainparams, mempool, state, tx, true, &fMissingInputs))
-        {
-            mempool.check(pcoinsTip);
-            RelayTransaction(tx);
-            vWorkQueue.push_back(txid);
-
-            LogPrint("mempool", "AcceptToMemoryPool: peer=%d %s: accepted %s (poolsz %u txn, %u kB)\n",
-                pfrom->id, pfrom->cleanSubVer,
-                tx.GetHash().ToString(),
-                mempool.size(), mempool.DynamicMemoryUsage() / 1000);
-
-            // Recursively process any orphan transactions that depended on this one
-            set<NodeId> setMisbehaving;
-            for (unsigned int i = 0; i < vWorkQueue.size(); i++)
-            {
-                map<uint256, set<uint256> >::iterator itByPrev = mapOrphanTransactionsByPrev.find(vWorkQueue[i]);
-                if (itByPrev == mapOrphanTransactionsByPrev.end())
-                    continue;
-                for (set<uint256>::iterator mi = itByPrev->second.begin();
-                     mi != itByPrev->second.end();
-                     ++mi)
-                {
-                    const uint256& orphanHash = *mi;
-                    const CTransaction& orphanTx = mapOrphanTransactions[orphanHash].tx;
-                    NodeId fromPeer = mapOrphanTransactions[orphanHash].fromPeer;
-                    bool fMissingInputs2 = false;
-                    // Use a dummy CValidationState so someone can't setup nodes to counter-DoS based on orphan
-                    // resolution (that is, feeding people an invalid transaction based on LegitTxX in order to get
-                    // anyone relaying LegitTxX banned)
-                    CValidationState stateDummy;
-
-
-                    if (setMisbehaving.count(fromPeer))
-                        continue;
-                    if (AcceptToMemoryPool(chainparams, mempool, stateDummy, orphanTx, true, &fMissingInputs2))
-                    {
-                        LogPrint("mempool", "   accepted orphan tx %s\n", orphanHash.ToString());
-                        RelayTransaction(orphanTx);
-                        vWorkQueue.push_back(orphanHash);
-                        vEraseQueue.push_back(orphanHash);
-                    }
-                    else if (!fMissingInputs2)
-                    {
-                        int nDos = 0;
-                        if (stateDummy.IsInvalid(nDos) && nDos > 0)
-                        {
-                            // Punish peer that gave us an invalid orphan tx
-                            Misbehaving(fromPeer, nDos);
-                            setMisbehaving.insert(fromPeer);
-                            LogPrint("mempool", "   invalid orphan tx %s\n", orphanHash.ToString());
-                        }
-                        // Has inputs but not accepted to mempool
-                        // Probably non-standard or insufficient fee/priority
-                        LogPrint("mempool", "   removed orphan tx %s\n", orphanHash.ToString());
-                        vEraseQueue.push_back(orphanHash);
-                        // Add the wtxid of this transaction to our reject filter.
-                        // Unlike upstream Bitcoin Core, we can unconditionally add
-                        // these, as they are always bound to the entirety of the
-                        // transaction regardless of version.
-                        assert(recentRejects);
-                        recentRejects->insert(orphanTx.GetWTxId().ToBytes());
-                    }
-                    mempool.check(pcoinsTip);
-                }
-            }
+        pfrom->AddKnownTx(wtxid);
 
-            for (uint256 hash : vEraseQueue)
-                EraseOrphanTx(hash);
-        }
-        // TODO: currently, prohibit joinsplits and shielded spends/outputs/actions from entering mapOrphans
-        else if (fMissingInputs &&
-                 tx.vJoinSplit.empty() &&
-                 tx.vShieldedSpend.empty() &&
-                 tx.vShieldedOutput.empty() &&
-                 !tx.GetOrchardBundle().IsPresent())
-        {
-            AddOrphanTx(tx, pfrom->GetId());
+        pfrom->setAskFor.erase(wtxid);
+        mapAlreadyAskedFor.erase(wtxid);
 
-            // DoS prevention: do not allow mapOrphanTransactions to grow unbounded
-            unsigned int nMaxOrphanTx = (unsigned int)std::max((int64_t)0, GetArg("-maxorphantx", DEFAULT_MAX_ORPHAN_TRANSACTIONS));
-            unsigned int nEvicted = LimitOrphanTxSize(nMaxOrphanTx);
-            if (nEvicted > 0)
-                LogPrint("mempool", "mapOrphan overflow, removed %u tx\n", nEvicted);
-        } else {
-            // Add the wtxid of this transaction to our reject filter.
-            // Unlike upstream Bitcoin Core, we can unconditionally add
-            // these, as they are always bound to the entirety of the
-            // transaction regardless of version.
-            assert(recentRejects);
-            recentRejects->insert(tx.GetWTxId().ToBytes());
-
-            if (pfrom->fWhitelisted && GetBoolArg("-whitelistforcerelay", DEFAULT_WHITELISTFORCERELAY)) {
-                // Always relay transactions received from whitelisted peers, even
-                // if they were already in the mempool or rejected from it due
-                // to policy, allowing the node to function as a gateway for
-                // nodes hidden behind it.
-                //
-                // Never relay transactions that we would assign a non-zero DoS
-                // score for, as we expect peers to do the same with us in that
-                // case.
-                int nDoS = 0;
-                if (!state.IsInvalid(nDoS) || nDoS == 0) {
-                    LogPrintf("Force relaying tx %s from whitelisted peer=%d\n", tx.GetHash().ToString(), pfrom->id);
-                    RelayTransaction(tx);
-                } else {
-                    LogPrintf("Not relaying invalid transaction %s from whitelisted peer=%d (%s (code %d))\n",
-                        tx.GetHash().ToString(), pfrom->id, state.GetRejectReason(), state.GetRejectCode());
-                }
-            }
-        }
-        int nDoS = 0;
-        if (state.IsInvalid(nDoS))
-        {
-            LogPrint("mempoolrej", "%s from peer=%d %s was not accepted into the memory pool: %s\n", tx.GetHash().ToString(),
-                pfrom->id, pfrom->cleanSubVer,
-                FormatStateMessage(state));
-            if (state.GetRejectCode() < REJECT_INTERNAL) // Never send AcceptToMemoryPool's internal codes over P2P
-                pfrom->PushMessage("reject", strCommand, (unsigned char)state.GetRejectCode(),
-                                   state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), txid);
-            if (nDoS > 0)
-                Misbehaving(pfrom->GetId(), nDoS);
+        if (!QueueForMempoolProofBatch(pfrom, tx)) {
+            ProcessRelayedTransaction(chainparams, pfrom, tx, false);
         }
     }
 
@@ -7041,6 +9894,38 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Checking the Equihash solutions is most of the cost of accepting
+        // headers, so check the solutions of the headers we do not know yet
+        // before taking cs_main, spread across the header checking threads.
+        // Below the last checkpoint they can instead be left to CheckBlock
+        // for when each block arrives. If a check fails, the headers are
+        // checked again in order below so that the invalid one is reported.
+        bool fSolutionsChecked = false;
+        if (nCount > 0) {
+            std::vector<CHeaderCheck> vChecks;
+            {
+                LOCK(cs_main);
+                BlockMap::iterator mi = mapBlockIndex.find(headers.front().hashPrevBlock);
+                if (fDeferHeaderSolutions && fCheckpointsEnabled && mi != mapBlockIndex.end() &&
+                    mi->second->nHeight + (int)nCount <= Checkpoints::GetTotalBlocksEstimate(chainparams.Checkpoints())) {
+                    fSolutionsChecked = true;
+                } else {
+                    vChecks.reserve(nCount);
+                    for (const CBlockHeader& header : headers) {
+                        if (mapBlockIndex.count(header.GetHash()) == 0)
+                            vChecks.emplace_back(header, chainparams.GetConsensus());
+                    }
+                }
+            }
+            if (!fSolutionsChecked) {
+                CCheckQueueControl<CHeaderCheck> control(&headercheckqueue);
+                control.Add(vChecks);
+                CCheckQueueStats headerCheckStats;
+                fSolutionsChecked = control.Wait(&headerCheckStats);
+                RecordCheckQueueStats("header", headerCheckStats);
+            }
+        }
+
         {
         LOCK(cs_main);
 
@@ -7049,6 +9934,20 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
             return true;
         }
 
+        CNodeState *nodestate = State(pfrom->GetId());
+
+        // A peer announcing a new block with headers sends only the headers
+        // we do not have from its point of view. If they do not connect, we
+        // are missing some in between; ask for them instead of rejecting the
+        // headers as orphans.
+        if (mapBlockIndex.find(headers.front().hashPrevBlock) == mapBlockIndex.end() && nCount <= MAX_BLOCKS_TO_ANNOUNCE) {
+            pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+            LogPrint("net", "received header %s: missing prev block %s, sending getheaders (%d) to peer=%d\n",
+                headers.front().GetHash().ToString(), headers.front().hashPrevBlock.ToString(),
+                pindexBestHeader->nHeight, pfrom->id);
+            return true;
+        }
+
         // If we already know the last header in the message, then it contains
         // no new information for us.  In this case, we do not request
         // more headers later.  This prevents multiple chains of redundant
@@ -7068,7 +9967,7 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
                 Misbehaving(pfrom->GetId(), 20);
                 return error("non-continuous headers sequence");
             }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, fSolutionsChecked)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -7094,6 +9993,45 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
             pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexLast), uint256());
         }
 
+        // If the headers announce a chain with more work than our tip, and we
+        // are close to synced, request the blocks of it we do not have right
+        // away instead of waiting for the block download in SendMessages.
+        bool fCanDirectFetch = chainActive.Tip()->GetBlockTime() > GetTime() - chainparams.GetConsensus().PoWTargetSpacing(pindexBestHeader->nHeight) * 20;
+        if (fCanDirectFetch && pindexLast && pindexLast->IsValid(BLOCK_VALID_TREE) && chainActive.Tip()->nChainWork <= pindexLast->nChainWork) {
+            std::vector<CBlockIndex*> vToFetch;
+            CBlockIndex *pindexWalk = pindexLast;
+            // Calculate all the blocks we'd need to switch to pindexLast, up to a limit.
+            while (pindexWalk && !chainActive.Contains(pindexWalk) && vToFetch.size() <= MAX_BLOCKS_TO_ANNOUNCE) {
+                if (!(pindexWalk->nStatus & BLOCK_HAVE_DATA) && !mapBlocksInFlight.count(pindexWalk->GetBlockHash())) {
+                    vToFetch.push_back(pindexWalk);
+                }
+                pindexWalk = pindexWalk->pprev;
+            }
+            // If pindexWalk still isn't on our main chain, we're looking at a
+            // very large reorg at a time we think we're close to caught up to
+            // the main chain; leave it to the regular block download.
+            if (pindexWalk && chainActive.Contains(pindexWalk)) {
+                std::vector<CInv> vGetData;
+                // Download as much as possible, from earliest to latest.
+                for (auto it = vToFetch.rbegin(); it != vToFetch.rend(); ++it) {
+                    if (nodestate->nBlocksInFlight >= GetBlocksInTransitLimit(nodestate))
+                        break;
+                    CBlockIndex *pindex = *it;
+                    vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
+                    MarkBlockAsInFlight(pfrom->GetId(), pindex->GetBlockHash(), chainparams.GetConsensus(), pindex);
+                    LogPrint("net", "Requesting block %s from peer=%d\n", pindex->GetBlockHash().ToString(), pfrom->id);
+                }
+                // Only a block that extends our tip can be reconstructed from
+                // a compact block, so one is only asked for when a single
+                // block is being fetched.
+                if (vGetData.size() == 1 && pfrom->fSupportsCompactBlocks) {
+                    vGetData[0] = CInv(MSG_CMPCT_BLOCK, vGetData[0].hash);
+                }
+                if (!vGetData.empty())
+                    pfrom->PushMessage("getdata", vGetData);
+            }
+        }
+
         CheckBlockIndex(chainparams.GetConsensus());
         }
 
@@ -7107,24 +10045,213 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
 
         LogPrint("net", "received block %s peer=%d\n", block.GetHash().ToString(), pfrom->id);
 
-        CValidationState state;
         // Process all blocks from whitelisted peers, even if not requested,
         // unless we're still syncing with the network.
         // Such an unrequested block may still be processed, subject to the
         // conditions in AcceptBlock().
         bool forceProcessing = pfrom->fWhitelisted && !IsInitialBlockDownload(chainparams.GetConsensus());
-        ProcessNewBlock(state, chainparams, pfrom, &block, forceProcessing, NULL);
-        int nDoS;
-        if (state.IsInvalid(nDoS)) {
-            assert (state.GetRejectCode() < REJECT_INTERNAL); // Blocks are never rejected with internal reject codes
-            pfrom->PushMessage("reject", strCommand, (unsigned char)state.GetRejectCode(),
-                               state.GetRejectReason().substr(0, MAX_REJECT_MESSAGE_LENGTH), block.GetHash());
-            if (nDoS > 0) {
-                LOCK(cs_main);
-                Misbehaving(pfrom->GetId(), nDoS);
+        ProcessReceivedBlock(chainparams, pfrom, strCommand, block, forceProcessing);
+    }
+
+
+    else if (strCommand == "sendcmpct")
+    {
+        bool fAnnounceUsingCmpctBlock = false;
+        uint64_t nCmpctBlockVersion = 0;
+        vRecv >> fAnnounceUsingCmpctBlock >> nCmpctBlockVersion;
+        // Ignore versions we do not know, so that a peer can offer several.
+        if (nCmpctBlockVersion == CMPCTBLOCKS_VERSION) {
+            pfrom->fSupportsCompactBlocks = true;
+            pfrom->fPreferCompactBlocks = fAnnounceUsingCmpctBlock;
+        }
+    }
+
+
+    else if (strCommand == "cmpctblock" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        vRecv >> cmpctblock;
+
+        bool fBlockReconstructed = false;
+        CBlock block;
+        {
+        LOCK(cs_main);
+
+        if (mapBlockIndex.find(cmpctblock.header.hashPrevBlock) == mapBlockIndex.end()) {
+            // Doesn't connect (or is genesis); instead of DoSing in
+            // AcceptBlockHeader, ask for the headers in between.
+            if (!IsInitialBlockDownload(chainparams.GetConsensus()))
+                pfrom->PushMessage("getheaders", chainActive.GetLocator(pindexBestHeader), uint256());
+            return true;
+        }
+
+        CBlockIndex *pindex = NULL;
+        CValidationState state;
+        if (!AcceptBlockHeader(cmpctblock.header, state, chainparams, &pindex)) {
+            int nDoS;
+            if (state.IsInvalid(nDoS)) {
+                if (nDoS > 0)
+                    Misbehaving(pfrom->GetId(), nDoS);
+                LogPrintf("Peer %d sent us invalid header via cmpctblock\n", pfrom->id);
+                return true;
+            }
+        }
+        if (pindex == NULL)
+            return true;
+        UpdateBlockAvailability(pfrom->GetId(), pindex->GetBlockHash());
+
+        // Nothing to do if we have the block already.
+        if (pindex->nStatus & BLOCK_HAVE_DATA)
+            return true;
+
+        const uint256 hash = pindex->GetBlockHash();
+        CNodeState *nodestate = State(pfrom->GetId());
+        // Fetch the block in full instead, unless another peer is sending it.
+        auto requestFullBlock = [&]() {
+            auto itInFlight = mapBlocksInFlight.find(hash);
+            bool fInFlightFromPeer = itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId();
+            if (itInFlight == mapBlocksInFlight.end() && nodestate->nBlocksInFlight < GetBlocksInTransitLimit(nodestate)) {
+                MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex);
+                fInFlightFromPeer = true;
+            }
+            if (fInFlightFromPeer)
+                pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, hash)));
+        };
+
+        // Only reconstruct blocks that extend our tip, for which we can check
+        // the auth data commitment. One block per peer is reconstructed at a
+        // time; others it announces meanwhile are fetched in full.
+        if (IsInitialBlockDownload(chainparams.GetConsensus())) {
+            // If the block was requested from this peer, the request is done
+            // with, so that the block is fetched in full by the block download
+            // instead of waiting for it to time out.
+            auto itInFlight = mapBlocksInFlight.find(hash);
+            if (itInFlight != mapBlocksInFlight.end() && itInFlight->second.first == pfrom->GetId())
+                MarkBlockAsReceived(hash);
+            return true;
+        }
+        if (pindex->pprev != chainActive.Tip() ||
+            (nodestate->partialBlock && nodestate->hashPartialBlock != hash)) {
+            requestFullBlock();
+            return true;
+        }
+
+        std::shared_ptr<PartiallyDownloadedBlock> partialBlock = std::make_shared<PartiallyDownloadedBlock>(&mempool);
+        ReadStatus status = partialBlock->InitData(cmpctblock);
+        if (status == READ_STATUS_INVALID) {
+            Misbehaving(pfrom->GetId(), 100);
+            LogPrintf("Peer %d sent us invalid compact block\n", pfrom->id);
+            return true;
+        } else if (status == READ_STATUS_FAILED) {
+            // Short ID collision within the block.
+            requestFullBlock();
+            return true;
+        }
+
+        BlockTransactionsRequest req;
+        for (size_t i = 0; i < cmpctblock.BlockTxCount(); i++) {
+            if (!partialBlock->IsTxAvailable(i))
+                req.indexes.push_back(i);
+        }
+        if (req.indexes.empty()) {
+            if (partialBlock->FillBlock(block, std::vector<CTransaction>()) == READ_STATUS_OK &&
+                CheckReconstructedBlockCommitments(chainparams, block, pindex)) {
+                fBlockReconstructed = true;
+            } else {
+                requestFullBlock();
+            }
+        } else {
+            MarkBlockAsInFlight(pfrom->GetId(), hash, chainparams.GetConsensus(), pindex);
+            nodestate->partialBlock = partialBlock;
+            nodestate->hashPartialBlock = hash;
+            req.blockhash = hash;
+            pfrom->PushMessage("getblocktxn", req);
+        }
+        }
+
+        // The header is valid and extends our tip, so the block is processed
+        // whether or not we asked for it.
+        if (fBlockReconstructed)
+            ProcessReceivedBlock(chainparams, pfrom, strCommand, block, true);
+    }
+
+
+    else if (strCommand == "getblocktxn")
+    {
+        BlockTransactionsRequest req;
+        vRecv >> req;
+
+        LOCK(cs_main);
+
+        BlockMap::iterator it = mapBlockIndex.find(req.blockhash);
+        if (it == mapBlockIndex.end() || !(it->second->nStatus & BLOCK_HAVE_DATA) || !chainActive.Contains(it->second)) {
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block we don't have\n", pfrom->id);
+            return true;
+        }
+
+        if (it->second->nHeight < chainActive.Height() - MAX_BLOCKTXN_DEPTH) {
+            // Peers only reconstruct blocks near the tip; serve anything
+            // deeper as a full block, subject to the getdata limits.
+            LogPrint("net", "Peer %d sent us a getblocktxn for a block > %i deep\n", pfrom->id, MAX_BLOCKTXN_DEPTH);
+            pfrom->vRecvGetData.push_back(CInv(MSG_BLOCK, req.blockhash));
+            return true;
+        }
+
+        CBlock block;
+        if (!ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
+            assert(!"cannot load block from disk");
+
+        BlockTransactions resp(req);
+        for (size_t i = 0; i < req.indexes.size(); i++) {
+            if (req.indexes[i] >= block.vtx.size()) {
+                Misbehaving(pfrom->GetId(), 100);
+                LogPrintf("Peer %d sent us a getblocktxn with out-of-bounds tx indices\n", pfrom->id);
+                return true;
             }
+            resp.txn[i] = block.vtx[req.indexes[i]];
+        }
+        pfrom->PushMessage("blocktxn", resp);
+    }
+
+
+    else if (strCommand == "blocktxn" && !fImporting && !fReindex) // Ignore blocks received while importing
+    {
+        BlockTransactions resp;
+        vRecv >> resp;
+
+        bool fBlockReconstructed = false;
+        CBlock block;
+        {
+        LOCK(cs_main);
+
+        CNodeState *nodestate = State(pfrom->GetId());
+        if (!nodestate->partialBlock || nodestate->hashPartialBlock != resp.blockhash) {
+            LogPrint("net", "Peer %d sent us block transactions for block we weren't expecting\n", pfrom->id);
+            return true;
+        }
+        std::shared_ptr<PartiallyDownloadedBlock> partialBlock = nodestate->partialBlock;
+        nodestate->partialBlock.reset();
+
+        CBlockIndex* pindex = mapBlockIndex[resp.blockhash];
+        ReadStatus status = partialBlock->FillBlock(block, resp.txn);
+        if (status == READ_STATUS_INVALID) {
+            MarkBlockAsReceived(resp.blockhash);
+            Misbehaving(pfrom->GetId(), 100);
+            LogPrintf("Peer %d sent us invalid compact block/non-matching block transactions\n", pfrom->id);
+            return true;
+        } else if (status == READ_STATUS_FAILED || pindex->pprev != chainActive.Tip() ||
+                   !CheckReconstructedBlockCommitments(chainparams, block, pindex)) {
+            // A short ID collision, or the tip changed since the cmpctblock
+            // message; the block is still in flight from this peer, so ask
+            // it for the whole block.
+            pfrom->PushMessage("getdata", vector<CInv>(1, CInv(MSG_BLOCK, resp.blockhash)));
+        } else {
+            fBlockReconstructed = true;
+        }
         }
 
+        if (fBlockReconstructed)
+            ProcessReceivedBlock(chainparams, pfrom, strCommand, block, true);
     }
 
 
@@ -7143,7 +10270,10 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
         }
         pfrom->fSentAddr = true;
 
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         FastRandomContext insecure_rand;
         for (const CAddress &addr : vAddr)
@@ -7252,14 +10382,19 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
         vRecv >> alert;
 
         uint256 alertHash = alert.GetHash();
-        if (pfrom->setKnown.count(alertHash) == 0)
+        bool fKnown;
+        {
+            LOCK(cs_vNodes);
+            fKnown = pfrom->setKnown.count(alertHash) != 0;
+        }
+        if (!fKnown)
         {
             if (alert.ProcessAlert(chainparams.AlertKey()))
             {
                 // Relay
-                pfrom->setKnown.insert(alertHash);
                 {
                     LOCK(cs_vNodes);
+                    pfrom->setKnown.insert(alertHash);
                     for (CNode* pnode : vNodes)
                         alert.RelayTo(pnode);
                 }
@@ -7351,6 +10486,94 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
     }
 
 
+    else if (strCommand == "getcfilters")
+    {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 stopHash;
+        vRecv >> nFilterType >> nStartHeight >> stopHash;
+
+        const CBlockIndex* pindexStop;
+        if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, stopHash, MAX_GETCFILTERS_SIZE, pindexStop)) {
+            return true;
+        }
+
+        // The filters are computed ahead of time by the block filter index,
+        // so serving them is a few database reads, whatever the peer is
+        // looking for.
+        std::vector<std::pair<uint256, CBlockFilterIndexValue>> vFilters;
+        if (!ReadBlockFilters(nStartHeight, pindexStop, vFilters)) {
+            LogPrint("net", "Block filters up to %s are not indexed yet; not replying to peer %d\n", stopHash.ToString(), pfrom->id);
+            return true;
+        }
+        for (const auto& entry : vFilters) {
+            pfrom->PushMessage("cfilter", nFilterType, entry.first, entry.second.filter);
+        }
+    }
+
+
+    else if (strCommand == "getcfheaders")
+    {
+        uint8_t nFilterType;
+        uint32_t nStartHeight;
+        uint256 stopHash;
+        vRecv >> nFilterType >> nStartHeight >> stopHash;
+
+        const CBlockIndex* pindexStop;
+        if (!PrepareBlockFilterRequest(pfrom, nFilterType, nStartHeight, stopHash, MAX_GETCFHEADERS_SIZE, pindexStop)) {
+            return true;
+        }
+
+        // The header before the first block the peer asks for, and the
+        // filter hashes it can chain on from it.
+        uint256 prevHeader;
+        if (nStartHeight > 0) {
+            CBlockFilterIndexValue prev;
+            if (!pinsightindex->ReadBlockFilter(pindexStop->GetAncestor(nStartHeight - 1)->GetBlockHash(), prev)) {
+                LogPrint("net", "Block filters up to %s are not indexed yet; not replying to peer %d\n", stopHash.ToString(), pfrom->id);
+                return true;
+            }
+            prevHeader = prev.header;
+        }
+        std::vector<std::pair<uint256, CBlockFilterIndexValue>> vFilters;
+        if (!ReadBlockFilters(nStartHeight, pindexStop, vFilters)) {
+            LogPrint("net", "Block filters up to %s are not indexed yet; not replying to peer %d\n", stopHash.ToString(), pfrom->id);
+            return true;
+        }
+        std::vector<uint256> vFilterHashes;
+        vFilterHashes.reserve(vFilters.size());
+        for (const auto& entry : vFilters) {
+            vFilterHashes.push_back(entry.second.hash);
+        }
+        pfrom->PushMessage("cfheaders", nFilterType, stopHash, prevHeader, vFilterHashes);
+    }
+
+
+    else if (strCommand == "getcfcheckpt")
+    {
+        uint8_t nFilterType;
+        uint256 stopHash;
+        vRecv >> nFilterType >> stopHash;
+
+        const CBlockIndex* pindexStop;
+        if (!PrepareBlockFilterRequest(pfrom, nFilterType, 0, stopHash, std::numeric_limits<uint32_t>::max(), pindexStop)) {
+            return true;
+        }
+
+        std::vector<uint256> vHeaders(pindexStop->nHeight / CFCHECKPT_INTERVAL);
+        for (size_t i = 0; i < vHeaders.size(); i++) {
+            CBlockFilterIndexValue value;
+            const CBlockIndex* pindex = pindexStop->GetAncestor((i + 1) * CFCHECKPT_INTERVAL);
+            if (!pinsightindex->ReadBlockFilter(pindex->GetBlockHash(), value)) {
+                LogPrint("net", "Block filters up to %s are not indexed yet; not replying to peer %d\n", stopHash.ToString(), pfrom->id);
+                return true;
+            }
+            vHeaders[i] = value.header;
+        }
+        pfrom->PushMessage("cfcheckpt", nFilterType, stopHash, vHeaders);
+    }
+
+
     else if (strCommand == "reject")
     {
         if (fDebug) {
@@ -7380,7 +10603,8 @@ bool static ProcessMessage(const CChainParams& chainparams, CNode* pfrom, string
         // message would be undesirable as we transmit it ourselves.
     }
 
-    else if (!(strCommand == "tx" || strCommand == "block" || strCommand == "headers" || strCommand == "alert")) {
+    else if (!(strCommand == "tx" || strCommand == "block" || strCommand == "headers" || strCommand == "alert" ||
+               strCommand == "cmpctblock" || strCommand == "blocktxn")) {
         // Ignore unknown commands for extensibility
         LogPrint("net", "Unknown command \"%s\" from peer=%d\n", SanitizeString(strCommand), pfrom->id);
     }
@@ -7406,8 +10630,16 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
     //
     bool fOk = true;
 
-    if (!pfrom->vRecvGetData.empty())
+    // Wait for the block being sent to the peer, in order to keep the responses in order.
+    if (pfrom->fServingBlock) return fOk;
+
+    if (!pfrom->vRecvGetData.empty()) {
+        int64_t nCPUStart = GetThreadCPUMicros();
         ProcessGetData(pfrom, chainparams.GetConsensus());
+        int64_t nCPUTime = GetThreadCPUMicros() - nCPUStart;
+        pfrom->ChargeProcessing(nCPUTime);
+        MetricsHistogram("zcash.net.in.processing.seconds", nCPUTime * 0.000001, "command", "getdata");
+    }
 
     // this maintains the order of responses
     if (!pfrom->vRecvGetData.empty()) return fOk;
@@ -7452,9 +10684,9 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
         // Message size
         unsigned int nMessageSize = hdr.nMessageSize;
 
-        // Checksum
+        // Checksum, of the data as it was received
         CDataStream& vRecv = msg.vRecv;
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+        const uint256& hash = msg.GetMessageHash();
         if (memcmp(hash.begin(), hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE) != 0)
         {
             LogPrintf("%s(%s, %u bytes): CHECKSUM ERROR expected %s was %s\n", __func__,
@@ -7466,6 +10698,7 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
 
         // Process message
         bool fRet = false;
+        int64_t nCPUStart = GetThreadCPUMicros();
         try
         {
             fRet = ProcessMessage(chainparams, pfrom, strCommand, vRecv, msg.nTime);
@@ -7497,6 +10730,10 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
         } catch (...) {
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
+        int64_t nCPUTime = GetThreadCPUMicros() - nCPUStart;
+        pfrom->ChargeProcessing(nCPUTime);
+        MetricsHistogram("zcash.net.in.processing.seconds", nCPUTime * 0.000001,
+            "command", SanitizeString(strCommand).c_str());
 
         if (!fRet)
             LogPrintf("%s(%s, %u bytes) FAILED peer=%d\n", __func__, SanitizeString(strCommand), nMessageSize, pfrom->id);
@@ -7511,6 +10748,12 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom)
     return fOk;
 }
 
+/** Whether a transaction pays enough to be announced to a peer with the fee filter nFeeFilter. */
+static bool PassesFeeFilter(const TxMempoolInfo& txinfo, CAmount nFeeFilter)
+{
+    return nFeeFilter == 0 || txinfo.nFee >= CFeeRate(nFeeFilter).GetFeeForRelay(txinfo.nTxSize);
+}
+
 class CompareInvMempoolOrder
 {
     CTxMemPool *mp;
@@ -7581,24 +10824,24 @@ bool SendMessages(const Consensus::Params& params, CNode* pto)
         if (pto->nNextAddrSend < nNow) {
             pto->nNextAddrSend = PoissonNextSend(nNow, AVG_ADDRESS_BROADCAST_INTERVAL);
             vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            for (const CAddress& addr : pto->vAddrToSend)
             {
-                if (!pto->addrKnown.contains(addr.GetKey()))
+                LOCK(pto->cs_vAddrToSend);
+                vAddr.reserve(pto->vAddrToSend.size());
+                for (const CAddress& addr : pto->vAddrToSend)
                 {
-                    pto->addrKnown.insert(addr.GetKey());
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
+                    if (!pto->addrKnown.contains(addr.GetKey()))
                     {
-                        pto->PushMessage("addr", vAddr);
-                        vAddr.clear();
+                        pto->addrKnown.insert(addr.GetKey());
+                        vAddr.push_back(addr);
                     }
                 }
+                pto->vAddrToSend.clear();
+            }
+            // receiver rejects addr messages larger than 1000
+            for (size_t i = 0; i < vAddr.size(); i += 1000)
+            {
+                pto->PushMessage("addr", vector<CAddress>(vAddr.begin() + i, vAddr.begin() + std::min(i + 1000, vAddr.size())));
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
-                pto->PushMessage("addr", vAddr);
         }
 
         CNodeState &state = *State(pto->GetId());
@@ -7653,6 +10896,14 @@ bool SendMessages(const Consensus::Params& params, CNode* pto)
             GetMainSignals().Broadcast(nTimeBestReceived);
         }
 
+        //
+        // Message: reconciliation request
+        //
+        uint32_t nReconSetSize;
+        if (txReconciliation.ShouldRequest(pto->GetId(), nNow, nReconSetSize)) {
+            pto->PushMessage("reqrecon", nReconSetSize);
+        }
+
         //
         // Message: inventory
         //
@@ -7661,22 +10912,70 @@ bool SendMessages(const Consensus::Params& params, CNode* pto)
             LOCK(pto->cs_inventory);
             vInv.reserve(std::max<size_t>(pto->vInventoryBlockToSend.size(), INVENTORY_BROADCAST_MAX));
 
-            // Add blocks
-            for (const uint256& hash : pto->vInventoryBlockToSend) {
-                vInv.push_back(CInv(MSG_BLOCK, hash));
-                if (vInv.size() == MAX_INV_SZ) {
-                    pto->PushMessage("inv", vInv);
-                    vInv.clear();
+            // Announce new blocks. Each hash queued is a tip we switched to;
+            // a peer that asked for headers gets the headers from the last
+            // block it has up to the best of those tips, if that is on our
+            // chain and not too far away. Otherwise each tip is announced by
+            // an inv, unless the peer already has its header.
+            ProcessBlockAvailability(pto->GetId());
+            std::vector<CBlock> vHeaders;
+            CBlockIndex *pBestIndex = NULL;
+            bool fRevertToInv = !state.fPreferHeaders || pto->vInventoryBlockToSend.empty();
+            if (!fRevertToInv) {
+                BlockMap::iterator mi = mapBlockIndex.find(pto->vInventoryBlockToSend.back());
+                assert(mi != mapBlockIndex.end());
+                pBestIndex = mi->second;
+                if (!chainActive.Contains(pBestIndex)) {
+                    fRevertToInv = true;
+                } else {
+                    CBlockIndex *pindex = pBestIndex;
+                    while (pindex && !PeerHasHeader(&state, pindex)) {
+                        if (vHeaders.size() == MAX_BLOCKS_TO_ANNOUNCE) {
+                            fRevertToInv = true;
+                            break;
+                        }
+                        vHeaders.push_back(pindex->GetBlockHeader());
+                        pindex = pindex->pprev;
+                    }
+                }
+            }
+            if (!fRevertToInv) {
+                if (!vHeaders.empty()) {
+                    std::reverse(vHeaders.begin(), vHeaders.end());
+                    LogPrint("net", "%s: sending header(s) of %d new block(s) up to %s to peer=%d\n", __func__,
+                        vHeaders.size(), pBestIndex->GetBlockHash().ToString(), pto->id);
+                    pto->PushMessage("headers", vHeaders);
+                    state.pindexBestHeaderSent = pBestIndex;
+                }
+            } else {
+                for (const uint256& hash : pto->vInventoryBlockToSend) {
+                    BlockMap::iterator mi = mapBlockIndex.find(hash);
+                    if (mi != mapBlockIndex.end() && PeerHasHeader(&state, mi->second))
+                        continue;
+                    vInv.push_back(CInv(MSG_BLOCK, hash));
+                    if (vInv.size() == MAX_INV_SZ) {
+                        pto->PushMessage("inv", vInv);
+                        vInv.clear();
+                    }
                 }
             }
             pto->vInventoryBlockToSend.clear();
 
             // Check whether periodic sends should happen
             bool fSendTrickle = pto->fWhitelisted;
+            int64_t nTrickleTime = 0;
             if (pto->nNextInvSend < nNow) {
                 fSendTrickle = true;
-                // Use half the delay for outbound peers, as there is less privacy concern for them.
-                pto->nNextInvSend = PoissonNextSend(nNow, INVENTORY_BROADCAST_INTERVAL >> !pto->fInbound);
+                nTrickleTime = pto->nNextInvSend;
+                if (pto->fInbound) {
+                    if (nNextInvSendInbound < nNow)
+                        nNextInvSendInbound = PoissonNextSend(nNow, nInboundInventoryInterval);
+                    pto->nNextInvSend = nNextInvSendInbound;
+                } else {
+                    // Outbound peers get shorter delays (half by default), as
+                    // there is less privacy concern for them.
+                    pto->nNextInvSend = PoissonNextSend(nNow, nOutboundInventoryInterval);
+                }
             }
 
             // Time to send but the peer has requested we not relay transactions.
@@ -7691,6 +10990,7 @@ bool SendMessages(const Consensus::Params& params, CNode* pto)
             if (fSendTrickle && pto->fSendMempool) {
                 auto vtxinfo = mempool.infoAll();
                 pto->fSendMempool = false;
+                CAmount filterrate = pto->minFeeFilter;
 
                 LOCK(pto->cs_filter);
 
@@ -7703,6 +11003,7 @@ bool SendMessages(const Consensus::Params& params, CNode* pto)
                     // that understand MSG_WTX.
                     if (inv.type == MSG_WTX) assert(pto->nVersion >= CINV_WTX_VERSION);
                     if (IsExpiringSoonTx(*txinfo.tx, currentHeight + 1)) continue;
+                    if (!PassesFeeFilter(txinfo, filterrate)) continue;
                     if (pto->pfilter) {
                         if (!pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
                     }
@@ -7718,44 +11019,18 @@ bool SendMessages(const Consensus::Params& params, CNode* pto)
 
             // Determine transactions to relay
             if (fSendTrickle) {
-                // Produce a vector with all candidates for sending
-                vector<std::set<uint256>::iterator> vInvTx;
-                vInvTx.reserve(pto->setInventoryTxToSend.size());
-                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
-                    vInvTx.push_back(it);
-                }
-                // Sort the inventory we send for privacy and priority reasons.
-                // A heap is used so that not all items need sorting if only a few are being sent.
-                CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
-                std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
                 // No reason to drain out at many times the network's capacity,
                 // especially since we have many peers and some will draw much shorter delays.
+                unsigned int nMaxRelayedTransactions = std::max(INVENTORY_BROADCAST_MAX,
+                    7 * (pto->fInbound ? nInboundInventoryInterval : nOutboundInventoryInterval));
                 unsigned int nRelayedTransactions = 0;
-                LOCK(pto->cs_filter);
-                while (!vInvTx.empty() && nRelayedTransactions < INVENTORY_BROADCAST_MAX) {
-                    // Fetch the top element from the heap
-                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
-                    std::set<uint256>::iterator it = vInvTx.back();
-                    vInvTx.pop_back();
-                    uint256 hash = *it;
-                    // Remove it from the to-be-sent set
-                    pto->setInventoryTxToSend.erase(it);
-                    // Check if not in the filter already
-                    if (pto->filterInventoryKnown.contains(hash)) {
-                        continue;
-                    }
-                    // Not in the mempool anymore? don't bother sending it.
-                    auto txinfo = mempool.info(hash);
-                    if (!txinfo.tx) {
-                        continue;
-                    }
-                    CInv inv = InvForTransaction(txinfo.tx);
+                CAmount filterrate = pto->minFeeFilter;
+                auto announce = [&](const uint256& hash, std::shared_ptr<const CTransaction> tx) {
+                    CInv inv = InvForTransaction(tx);
                     // ZIP 239: We won't have v5 transactions in our mempool until after
                     // NU5 activates, at which point we will only be connected to peers
                     // that understand MSG_WTX.
                     if (inv.type == MSG_WTX) assert(pto->nVersion >= CINV_WTX_VERSION);
-                    if (IsExpiringSoonTx(*txinfo.tx, currentHeight + 1)) continue;
-                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
                     // Send
                     vInv.push_back(inv);
                     nRelayedTransactions++;
@@ -7767,7 +11042,7 @@ bool SendMessages(const Consensus::Params& params, CNode* pto)
                             vRelayExpiration.pop_front();
                         }
 
-                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(txinfo.tx)));
+                        auto ret = mapRelay.insert(std::make_pair(hash, std::move(tx)));
                         if (ret.second) {
                             vRelayExpiration.push_back(std::make_pair(nNow + 15 * 60 * 1000000, ret.first));
                         }
@@ -7777,6 +11052,80 @@ bool SendMessages(const Consensus::Params& params, CNode* pto)
                         vInv.clear();
                     }
                     pto->filterInventoryKnown.insert(hash);
+                };
+
+                LOCK(pto->cs_filter);
+
+                // Inbound peers announcing at the shared time first announce
+                // their transactions from the shared batch, building it if
+                // they are the first of them.
+                if (pto->fInbound && nTrickleTime != 0) {
+                    if (inboundAnnouncements.nTime != nTrickleTime) {
+                        std::vector<uint256> vHashes(pto->setInventoryTxToSend.begin(), pto->setInventoryTxToSend.end());
+                        LOCK(mempool.cs);
+                        std::sort(vHashes.begin(), vHashes.end(), [](const uint256& a, const uint256& b) {
+                            return mempool.CompareDepthAndScore(a, b);
+                        });
+                        inboundAnnouncements.nTime = nTrickleTime;
+                        inboundAnnouncements.vTx.clear();
+                        inboundAnnouncements.vTx.reserve(vHashes.size());
+                        for (const uint256& hash : vHashes) {
+                            // Not in the mempool anymore, or expiring soon? don't bother sending it.
+                            auto txinfo = mempool.info(hash);
+                            if (txinfo.tx && IsExpiringSoonTx(*txinfo.tx, currentHeight + 1))
+                                txinfo.tx.reset();
+                            inboundAnnouncements.vTx.emplace_back(hash, std::move(txinfo));
+                        }
+                    }
+                    for (const auto& announcement : inboundAnnouncements.vTx) {
+                        if (nRelayedTransactions >= nMaxRelayedTransactions)
+                            break;
+                        std::set<uint256>::iterator it = pto->setInventoryTxToSend.find(announcement.first);
+                        if (it == pto->setInventoryTxToSend.end())
+                            continue;
+                        pto->setInventoryTxToSend.erase(it);
+                        const TxMempoolInfo& txinfo = announcement.second;
+                        if (!txinfo.tx || pto->filterInventoryKnown.contains(announcement.first))
+                            continue;
+                        if (!PassesFeeFilter(txinfo, filterrate))
+                            continue;
+                        if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx))
+                            continue;
+                        announce(announcement.first, txinfo.tx);
+                    }
+                }
+
+                // Produce a vector with all (other) candidates for sending
+                vector<std::set<uint256>::iterator> vInvTx;
+                vInvTx.reserve(pto->setInventoryTxToSend.size());
+                for (std::set<uint256>::iterator it = pto->setInventoryTxToSend.begin(); it != pto->setInventoryTxToSend.end(); it++) {
+                    vInvTx.push_back(it);
+                }
+                // Sort the inventory we send for privacy and priority reasons.
+                // A heap is used so that not all items need sorting if only a few are being sent.
+                CompareInvMempoolOrder compareInvMempoolOrder(&mempool);
+                std::make_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
+                while (!vInvTx.empty() && nRelayedTransactions < nMaxRelayedTransactions) {
+                    // Fetch the top element from the heap
+                    std::pop_heap(vInvTx.begin(), vInvTx.end(), compareInvMempoolOrder);
+                    std::set<uint256>::iterator it = vInvTx.back();
+                    vInvTx.pop_back();
+                    uint256 hash = *it;
+                    // Remove it from the to-be-sent set
+                    pto->setInventoryTxToSend.erase(it);
+                    // Check if not in the filter already
+                    if (pto->filterInventoryKnown.contains(hash)) {
+                        continue;
+                    }
+                    // Not in the mempool anymore? don't bother sending it.
+                    auto txinfo = mempool.info(hash);
+                    if (!txinfo.tx) {
+                        continue;
+                    }
+                    if (IsExpiringSoonTx(*txinfo.tx, currentHeight + 1)) continue;
+                    if (!PassesFeeFilter(txinfo, filterrate)) continue;
+                    if (pto->pfilter && !pto->pfilter->IsRelevantAndUpdate(*txinfo.tx)) continue;
+                    announce(hash, std::move(txinfo.tx));
                 }
             }
         }
@@ -7819,16 +11168,33 @@ bool SendMessages(const Consensus::Params& params, CNode* pto)
         // Message: getdata (blocks)
         //
         vector<CInv> vGetData;
-        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload(params)) && state.nBlocksInFlight < MAX_BLOCKS_IN_TRANSIT_PER_PEER) {
+        int nBlocksInTransitLimit = GetBlocksInTransitLimit(&state);
+        if (!pto->fDisconnect && !pto->fClient && (fFetch || !IsInitialBlockDownload(params)) && state.nBlocksInFlight < nBlocksInTransitLimit) {
             vector<CBlockIndex*> vToDownload;
             NodeId staller = -1;
-            FindNextBlocksToDownload(pto->GetId(), MAX_BLOCKS_IN_TRANSIT_PER_PEER - state.nBlocksInFlight, vToDownload, staller);
+            CBlockIndex *pindexStalled = NULL;
+            FindNextBlocksToDownload(pto->GetId(), nBlocksInTransitLimit - state.nBlocksInFlight, vToDownload, staller, pindexStalled);
             for (CBlockIndex *pindex : vToDownload) {
                 vGetData.push_back(CInv(MSG_BLOCK, pindex->GetBlockHash()));
                 MarkBlockAsInFlight(pto->GetId(), pindex->GetBlockHash(), params, pindex);
                 LogPrint("net", "Requesting block %s (%d) peer=%d\n", pindex->GetBlockHash().ToString(),
                     pindex->nHeight, pto->id);
             }
+            if (state.nBlocksInFlight == 0 && staller != -1 && pindexStalled != NULL) {
+                // If this peer is much faster than the staller, and the block
+                // holding the window back has been in flight for a while,
+                // ask this peer for it instead.
+                CNodeState *stallerState = State(staller);
+                const QueuedBlock& stalledBlock = *mapBlocksInFlight[pindexStalled->GetBlockHash()].second;
+                if (state.dDownloadRate > 2 * stallerState->dDownloadRate &&
+                    stalledBlock.nTime < nNow - 1000000 * BLOCK_STALLING_TIMEOUT) {
+                    LogPrint("net", "Requesting stalled block %s (%d) from peer=%d instead of peer=%d\n",
+                        pindexStalled->GetBlockHash().ToString(), pindexStalled->nHeight, pto->id, staller);
+                    vGetData.push_back(CInv(MSG_BLOCK, pindexStalled->GetBlockHash()));
+                    MarkBlockAsInFlight(pto->GetId(), pindexStalled->GetBlockHash(), params, pindexStalled);
+                    staller = -1;
+                }
+            }
             if (state.nBlocksInFlight == 0 && staller != -1) {
                 if (State(staller)->nStallingSince == 0) {
                     State(staller)->nStallingSince = nNow;
@@ -7862,6 +11228,33 @@ bool SendMessages(const Consensus::Params& params, CNode* pto)
         if (!vGetData.empty())
             pto->PushMessage("getdata", vGetData);
 
+        //
+        // Message: feefilter
+        //
+        // Transactions below the minimum relay fee are only accepted while
+        // free transactions are (see -limitfreerelay), so we only ask peers
+        // not to announce them when free relay is off. During initial block
+        // download we ignore transactions altogether.
+        if (pto->nVersion >= FEEFILTER_VERSION && !pto->fWhitelisted) {
+            CAmount currentFilter = 0;
+            if (IsInitialBlockDownload(params)) {
+                currentFilter = MAX_MONEY;
+            } else if (GetArg("-limitfreerelay", DEFAULT_LIMITFREERELAY) <= 0) {
+                currentFilter = ::minRelayTxFee.GetFeePerK();
+            }
+            if (currentFilter != pto->lastSentFeeFilter) {
+                // Send a change soon, but at a random time, so that the
+                // time it is sent at does not tell peers apart.
+                if (pto->nextSendTimeFeeFilter > nNow + MAX_FEEFILTER_CHANGE_DELAY * 1000000) {
+                    pto->nextSendTimeFeeFilter = nNow + GetRand(MAX_FEEFILTER_CHANGE_DELAY * 1000000);
+                }
+                if (pto->nextSendTimeFeeFilter < nNow) {
+                    pto->PushMessage("feefilter", currentFilter);
+                    pto->lastSentFeeFilter = currentFilter;
+                    pto->nextSendTimeFeeFilter = PoissonNextSend(nNow, AVG_FEEFILTER_BROADCAST_INTERVAL);
+                }
+            }
+        }
     }
     return true;
 }
@@ -7886,6 +11279,7 @@ public:
         // orphan transactions
         mapOrphanTransactions.clear();
         mapOrphanTransactionsByPrev.clear();
+        mapOrphanTransactionsByPeer.clear();
     }
 } instance_of_cmaincleanup;
 
@@ -43,15 +43,20 @@
 #include <utility>
 #include <vector>
 
+#include <rust/ed25519.h>
 #include <rust/sapling.h>
 #include <rust/orchard.h>
 
 #include <boost/unordered_map.hpp>
 
 class CBlockIndex;
+class CBlockPrecheck;
 class CBlockTreeDB;
+class CBlockUndo;
+class CCoinsViewFlushLayer;
 class CBloomFilter;
 class CChainParams;
+class CDiskRecord;
 class CInv;
 class CScriptCheck;
 class CValidationInterface;
@@ -78,6 +83,10 @@ static const CAmount HIGH_TX_FEE_PER_KB = 0.01 * COIN;
 static const CAmount HIGH_MAX_TX_FEE = 100 * HIGH_TX_FEE_PER_KB;
 /** Default for -maxorphantx, maximum number of orphan transactions kept in memory */
 static const unsigned int DEFAULT_MAX_ORPHAN_TRANSACTIONS = 100;
+/** The largest transaction that is kept as an orphan, in bytes */
+static const unsigned int MAX_ORPHAN_TX_SIZE = 5000;
+/** The most bytes of orphan transactions kept from a single peer; a peer's oldest orphans make room for its new ones */
+static const unsigned int MAX_PEER_ORPHAN_TX_BYTES = 20 * MAX_ORPHAN_TX_SIZE;
 /** Default for -txexpirydelta, in number of blocks */
 static const unsigned int DEFAULT_PRE_BLOSSOM_TX_EXPIRY_DELTA = 20;
 static const unsigned int DEFAULT_POST_BLOSSOM_TX_EXPIRY_DELTA = DEFAULT_PRE_BLOSSOM_TX_EXPIRY_DELTA * Consensus::BLOSSOM_POW_TARGET_SPACING_RATIO;
@@ -94,13 +103,27 @@ static const unsigned int UNDOFILE_CHUNK_SIZE = 0x100000; // 1 MiB
 static const int MAX_SCRIPTCHECK_THREADS = 16;
 /** -par default (number of script-checking threads, 0 = auto) */
 static const int DEFAULT_SCRIPTCHECK_THREADS = 0;
-/** Number of blocks that can be requested at any given time from a single peer. */
+/** Number of blocks that can be requested at any given time from a single peer, until its download rate is known. */
 static const int MAX_BLOCKS_IN_TRANSIT_PER_PEER = 16;
+/** Bounds on the number of blocks requested at a time from a peer once its download rate is known. */
+static const int MIN_BLOCKS_IN_TRANSIT_PER_PEER = 2;
+static const int MAX_ADAPTIVE_BLOCKS_IN_TRANSIT_PER_PEER = 64;
+/** Seconds of block download, at a peer's measured rate, that we keep requested from it. */
+static const int BLOCK_DOWNLOAD_QUEUE_SECONDS = 10;
 /** Timeout in seconds during which a peer must stall block download progress before being disconnected. */
 static const unsigned int BLOCK_STALLING_TIMEOUT = 2;
+/** Maximum depth of a block that is sent as a cmpctblock in reply to a getdata. */
+static const int MAX_CMPCTBLOCK_DEPTH = 5;
+/** Maximum depth of a block whose transactions are served in reply to a getblocktxn. */
+static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Number of peers that are asked to announce new blocks to us as cmpctblock messages. */
+static const unsigned int MAX_CMPCTBLOCK_ANNOUNCING_PEERS = 3;
 /** Number of headers sent in one getheaders result. We rely on the assumption that if a peer sends
  *  less than this number, we reached its tip. Changing this value is a protocol upgrade. */
 static const unsigned int MAX_HEADERS_RESULTS = 160;
+/** Maximum number of new blocks announced to a peer in one headers message;
+ *  longer reorganizations are announced with an inv of the new tip. */
+static const unsigned int MAX_BLOCKS_TO_ANNOUNCE = 8;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
@@ -120,12 +143,22 @@ static const unsigned int MAX_REJECT_MESSAGE_LENGTH = 111;
 static const unsigned int AVG_LOCAL_ADDRESS_BROADCAST_INTERVAL = 24 * 24 * 60;
 /** Average delay between peer address broadcasts in seconds. */
 static const unsigned int AVG_ADDRESS_BROADCAST_INTERVAL = 30;
+/** Average delay between sending a peer our fee filter when it changes, in seconds. */
+static const unsigned int AVG_FEEFILTER_BROADCAST_INTERVAL = 10 * 60;
+/** Maximum delay before a change of our fee filter is sent to a peer, in seconds. */
+static const unsigned int MAX_FEEFILTER_CHANGE_DELAY = 5 * 60;
 /** Average delay between trickled inventory transmissions in seconds.
  *  Blocks and whitelisted receivers bypass this, outbound peers get half this delay. */
 static const unsigned int INVENTORY_BROADCAST_INTERVAL = 5;
 /** Maximum number of inventory items to send per transmission.
  *  Limits the impact of low-fee transaction floods. */
 static const unsigned int INVENTORY_BROADCAST_MAX = 7 * INVENTORY_BROADCAST_INTERVAL;
+/** Default for -txrelaydelayinbound, the average delay in seconds between transaction announcements to inbound peers. */
+static const unsigned int DEFAULT_INBOUND_INVENTORY_INTERVAL = INVENTORY_BROADCAST_INTERVAL;
+/** Default for -txrelaydelayoutbound, the average delay in seconds between transaction announcements to outbound peers. */
+static const unsigned int DEFAULT_OUTBOUND_INVENTORY_INTERVAL = INVENTORY_BROADCAST_INTERVAL >> 1;
+/** Maximum for -txrelaydelayinbound and -txrelaydelayoutbound. */
+static const unsigned int MAX_INVENTORY_INTERVAL = 60;
 
 static const unsigned int DEFAULT_LIMITFREERELAY = 15;
 static const bool DEFAULT_RELAYPRIORITY = false;
@@ -135,7 +168,58 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_IBD_SKIP_TX_VERIFICATION = false;
+static const bool DEFAULT_DEFER_HEADER_SOLUTIONS = false;
+static const bool DEFAULT_PIPELINE_BLOCK_CONNECT = false;
+/** -fastblockrelay default */
+static const bool DEFAULT_FAST_BLOCK_RELAY = false;
+/** -proofbatchblocks default (number of blocks whose shielded proofs are batched together) */
+static const int DEFAULT_PROOF_BATCH_BLOCKS = 1;
+/** Maximum value for -proofbatchblocks */
+static const int MAX_PROOF_BATCH_BLOCKS = 100;
+/** Maximum amount of block data read ahead into a single proof batch */
+static const size_t MAX_PROOF_BATCH_BYTES = 64 * 1024 * 1024;
+/** -mmapblockfiles default */
+static const bool DEFAULT_MMAP_BLOCK_FILES = false;
+/** Maximum number of block files kept memory-mapped with -mmapblockfiles */
+static const size_t MAX_MAPPED_BLOCK_FILES = 8;
+/** -compressblockfiles default */
+static const bool DEFAULT_COMPRESS_BLOCK_FILES = false;
+/** -packblockfiles default */
+static const bool DEFAULT_PACK_BLOCK_FILES = false;
+/** Maximum number of packed block files whose index is kept in memory */
+static const size_t MAX_OPEN_PACKED_BLOCK_FILES = 64;
+/** -asynccoinsflush default */
+static const bool DEFAULT_ASYNC_COINS_FLUSH = false;
+/** -blockprefetch default (number of blocks read ahead beyond the -proofbatchblocks window; 0 disables) */
+static const int DEFAULT_BLOCK_PREFETCH = 0;
+/** Maximum value for -blockprefetch */
+static const int MAX_BLOCK_PREFETCH = 64;
+/** -mempoolproofbatch default (maximum number of relayed transactions whose proofs are batched together; 0 disables) */
+static const int DEFAULT_MEMPOOL_PROOF_BATCH = 0;
+/** Maximum value for -mempoolproofbatch */
+static const int MAX_MEMPOOL_PROOF_BATCH = 1000;
+/** -blockservethreads default (number of threads sending historical blocks requested by peers; 0 sends them from the message handlers) */
+static const int DEFAULT_BLOCK_SERVE_THREADS = 0;
+/** Maximum value for -blockservethreads */
+static const int MAX_BLOCK_SERVE_THREADS = 16;
+/** How long relayed transactions are collected for before their proofs are batch-validated */
+static const int64_t MEMPOOL_PROOF_BATCH_WINDOW_MS = 50;
+/** Verification cost, per -mempoolproofbatch slot, a peer may have queued before its transactions are checked last */
+static const int64_t MEMPOOL_PROOF_BATCH_PEER_COST = 30;
+/** Relative cost of checking the proofs of one JoinSplit, Sapling Spend, Sapling Output and Orchard Action */
+static const int64_t PROOF_COST_JOINSPLIT = 30;
+static const int64_t PROOF_COST_SAPLING_SPEND = 10;
+static const int64_t PROOF_COST_SAPLING_OUTPUT = 8;
+static const int64_t PROOF_COST_ORCHARD_ACTION = 12;
 static const bool DEFAULT_TXINDEX = false;
+/** Default for -blockfilterindex */
+static const bool DEFAULT_BLOCKFILTERINDEX = false;
+/** Default for -supplyindex */
+static const bool DEFAULT_SUPPLYINDEX = false;
+/** Default for -persistcoinscache */
+static const bool DEFAULT_PERSIST_COINS_CACHE = false;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 /** Default for -nurejectoldversions */
@@ -147,6 +231,14 @@ static const bool DEFAULT_NU_REJECT_OLD_VERSIONS = true;
 
 static const bool DEFAULT_PEERBLOOMFILTERS = true;
 static const bool DEFAULT_ENFORCENODEBLOOM = false;
+/** Default for -peerblockfilters */
+static const bool DEFAULT_PEERBLOCKFILTERS = false;
+/** Maximum number of block filters sent in reply to a getcfilters, as in BIP 157. */
+static const uint32_t MAX_GETCFILTERS_SIZE = 1000;
+/** Maximum number of filter hashes sent in reply to a getcfheaders, as in BIP 157. */
+static const uint32_t MAX_GETCFHEADERS_SIZE = 2000;
+/** Interval between the filter headers sent in reply to a getcfcheckpt, as in BIP 157. */
+static const int CFCHECKPT_INTERVAL = 1000;
 
 struct BlockHasher
 {
@@ -194,10 +286,50 @@ extern bool fTimestampIndex;
 
 // END insightexplorer
 
+// Maintain an index of the roots of the complete 2^16-leaf subtrees of the
+// Sapling and Orchard note commitment trees (lightwalletd)
+extern bool fSubtreeIndex;
+
+// Maintain an index of the compact block filters of BIP 158, served to light
+// clients with -peerblockfilters and by the getblockfilter RPC method
+extern bool fBlockFilterIndex;
+
+// Maintain an index of the value pools and the issued supply at each height,
+// read by the getsupplyinfo RPC method
+extern bool fSupplyIndex;
+
 extern bool fIsBareMultisigStd;
 extern bool fCheckBlockIndex;
 extern bool fCheckpointsEnabled;
 extern bool fIBDSkipTxVerification;
+/** The block whose ancestors' proofs, scripts and signatures are not checked (-assumevalid). */
+extern uint256 hashAssumeValid;
+/** Average delays in seconds between transaction announcements to inbound and outbound peers. */
+extern unsigned int nInboundInventoryInterval;
+extern unsigned int nOutboundInventoryInterval;
+/**
+ * Whether the Equihash solutions of headers up to the last checkpoint height
+ * are left to be checked when their blocks arrive (-deferheadersolutions).
+ */
+extern bool fDeferHeaderSolutions;
+/** Whether to read blocks from memory-mapped block files where possible. */
+extern bool fMmapBlockFiles;
+/** Whether to store new blocks and undo data compressed (-compressblockfiles). */
+extern bool fCompressBlockFiles;
+/** Whether to pack old block files, and drop their undo data (-packblockfiles). */
+extern bool fPackBlockFiles;
+/** Whether to check the next block ahead of connecting it during initial block download. */
+extern bool fPipelineBlockConnect;
+/** Whether to relay new blocks to high-bandwidth compact block peers before connecting them (-fastblockrelay). */
+extern bool fFastBlockRelay;
+/** The number of consecutive blocks whose shielded proofs are batch-validated together. */
+extern int nProofBatchBlocks;
+/** The number of blocks to read from disk ahead of the block being connected during initial block download. */
+extern int nBlockPrefetch;
+/** The maximum number of relayed transactions whose proofs are batch-validated together, or 0. */
+extern int nMempoolProofBatch;
+/** The number of threads sending historical blocks requested by peers, or 0. */
+extern int nBlockServeThreads;
 // TODO: remove this flag by structuring our code such that
 // it is unneeded for testing
 extern bool fCoinbaseEnforcedShieldingEnabled;
@@ -213,6 +345,12 @@ extern int64_t nMaxTipAge;
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
 
+/**
+ * The entries of mapBlockIndex that no other entry builds on, that is, the
+ * tips of all the branches of the block tree. Requires cs_main.
+ */
+std::vector<const CBlockIndex*> GetBlockIndexTips();
+
 /** Minimum disk space required - used in CheckDiskSpace() */
 static const uint64_t nMinDiskSpace = 52428800;
 
@@ -228,6 +366,8 @@ static const unsigned int MIN_BLOCKS_TO_KEEP = 288;
 
 static const signed int DEFAULT_CHECKBLOCKS = MIN_BLOCKS_TO_KEEP;
 static const unsigned int DEFAULT_CHECKLEVEL = 3;
+/** -checkblocksinbackground default */
+static const bool DEFAULT_CHECK_BLOCKS_IN_BACKGROUND = false;
 
 /** Prefer to create v4 transactions. */
 static const int32_t DEFAULT_PREFERRED_TX_VERSION = SAPLING_TX_VERSION;
@@ -259,9 +399,10 @@ void UnregisterNodeSignals(CNodeSignals& nodeSignals);
  * @param[in]   pblock  The block we want to process.
  * @param[in]   fForceProcessing Process this block even if unrequested; used for non-network block sources and whitelisted peers.
  * @param[out]  dbp     The already known disk position of pblock, or NULL if not yet stored.
+ * @param[in]   fMayBan Whether pfrom may be penalised if pblock fails to connect, which is not the case for blocks that may have been relayed before they were fully validated.
  * @return True if state.IsValid()
  */
-bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp);
+bool ProcessNewBlock(CValidationState& state, const CChainParams& chainparams, const CNode* pfrom, const CBlock* pblock, bool fForceProcessing, const CDiskBlockPos* dbp, bool fMayBan = true);
 /** Check whether enough disk space is available for an incoming block */
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0);
 /** Open a block file (blk?????.dat) */
@@ -272,12 +413,20 @@ FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp = NULL);
+/**
+ * Rebuild the block index from the block files blk00000.dat to the one
+ * before nFiles: the files are scanned in parallel, and the blocks then added
+ * to the index in order, each after its parent.
+ */
+bool ReindexBlockFiles(const CChainParams& chainparams, int nFiles);
 /** Initialize a new block tree database + block data on disk */
 bool InitBlockIndex(const CChainParams& chainparams);
 /** Load the block tree and coins database from disk */
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/** Wait for the prechecks of blocks running in the background, and discard them */
+void ClearBlockPrechecks();
 /** Process protocol messages received from a given node */
 bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom);
 /**
@@ -289,6 +438,14 @@ bool ProcessMessages(const CChainParams& chainparams, CNode* pfrom);
 bool SendMessages(const Consensus::Params& params, CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the transaction checking thread */
+void ThreadTransactionCheck();
+/** Run an instance of the header checking thread */
+void ThreadHeaderCheck();
+/** Run the thread that batch-validates the proofs of relayed transactions (see -mempoolproofbatch) */
+void ThreadMempoolProofBatch();
+/** Run an instance of the thread that sends historical blocks to peers (see -blockservethreads) */
+void ThreadServeBlocks();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload(const Consensus::Params& params);
 /** testing-only, set or reset initial block down (IBD) state, return previous */
@@ -331,14 +488,53 @@ bool GetNodeStateStats(NodeId nodeid, CNodeStateStats &stats);
 void Misbehaving(NodeId nodeid, int howmuch);
 /** Flush all state, indexes and buffers to disk. */
 void FlushStateToDisk();
+
+/**
+ * The work done connecting blocks to the active chain, and the full flushes
+ * of the chain state, since startup.
+ */
+struct CConnectTotals {
+    uint64_t nBlocks = 0;
+    uint64_t nTransactions = 0;
+    //! The JoinSplits, Sapling spends and outputs, and Orchard actions.
+    uint64_t nProofs = 0;
+    uint64_t nFlushes = 0;
+    int64_t nFlushMicros = 0;
+    //! The longest a block had to wait for the chain state to be flushed.
+    int64_t nMaxFlushMicros = 0;
+};
+/** Requires cs_main. */
+CConnectTotals GetConnectTotals();
+/** The memory used by the block index and the active chain. Requires cs_main. */
+size_t BlockIndexDynamicMemoryUsage();
+/** The memory used by the filter of recently rejected transactions. Requires cs_main. */
+size_t RecentRejectsDynamicMemoryUsage();
 /** Prune block files and flush state to disk. */
 void PruneAndFlush();
+/** Save the keys of the entries in the coins cache, to be looked up again by
+ *  LoadCoinsCacheKeys() after a restart. Call before the final flush. */
+bool DumpCoinsCacheKeys();
+/** Look up the keys saved by DumpCoinsCacheKeys() in batches, taking cs_main
+ *  for each, until half of the coins cache is in use. */
+void LoadCoinsCacheKeys();
+/** Save the transactions in the mempool, with their entry times and the
+ *  deltas set by prioritisetransaction, to be reloaded by LoadMempool(). */
+bool DumpMempool();
+/** Add the transactions saved by DumpMempool() back to the mempool, checking
+ *  their proofs in batches outside cs_main. */
+bool LoadMempool(const CChainParams& chainparams);
 
-/** (try to) add transaction to memory pool **/
+/**
+ * (try to) add transaction to memory pool
+ *
+ * If fProofsVerified is set, the caller has already checked the transaction's
+ * Sprout proofs and its Sapling and Orchard bundle authorizations against the
+ * consensus branch ID of the next block, and they are not checked again.
+ **/
 bool AcceptToMemoryPool(
         const CChainParams& chainparams,
         CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-        bool* pfMissingInputs, bool fRejectAbsurdFee=false);
+        bool* pfMissingInputs, bool fRejectAbsurdFee=false, bool fProofsVerified=false);
 
 
 struct CNodeStateStats {
@@ -346,6 +542,8 @@ struct CNodeStateStats {
     int nSyncHeight;
     int nCommonHeight;
     std::vector<int> vHeightInFlight;
+    double dDownloadRate;
+    int nBlocksInTransitLimit;
 };
 
 
@@ -375,7 +573,7 @@ unsigned int GetP2SHSigOpCount(const CTransaction& tx, const CCoinsViewCache& ma
  * instead of being performed inline.
  */
 bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &view, bool fScriptChecks,
-                           unsigned int flags, bool cacheStore, PrecomputedTransactionData& txdata,
+                           unsigned int flags, bool cacheStore, const PrecomputedTransactionData& txdata,
                            const Consensus::Params& consensusParams, uint32_t consensusBranchId,
                            std::vector<CScriptCheck> *pvChecks = NULL);
 
@@ -396,6 +594,9 @@ bool ContextualCheckInputs(const CTransaction& tx, CValidationState &state, cons
  *
  * This does not modify the view to add the nullifiers to the spent set.
  *
+ * If `joinSplitAuth` is provided, the JoinSplit signature is queued there instead
+ * of being checked immediately.
+ *
  * The `isInitBlockDownload` argument is a function parameter to assist with testing.
  */
 bool ContextualCheckShieldedInputs(
@@ -409,7 +610,8 @@ bool ContextualCheckShieldedInputs(
         uint32_t consensusBranchId,
         bool nu5Active,
         bool isMined,
-        bool (*isInitBlockDownload)(const Consensus::Params&) = IsInitialBlockDownload);
+        bool (*isInitBlockDownload)(const Consensus::Params&) = IsInitialBlockDownload,
+        ed25519::BatchValidator* joinSplitAuth = nullptr);
 
 /** Check a transaction contextually against a set of consensus rules */
 bool ContextualCheckTransaction(const CTransaction& tx, CValidationState &state,
@@ -497,12 +699,12 @@ private:
     ScriptError error;
     // We store a pointer instead of a reference here, to allow it to be null for
     // performance reasons (enabling fast swaps in CCheckQueue::Loop).
-    PrecomputedTransactionData *txdata;
+    const PrecomputedTransactionData *txdata;
 
 public:
     CScriptCheck(): amount(0), ptxTo(0), nIn(0), nFlags(0), cacheStore(false), consensusBranchId(0), error(SCRIPT_ERR_UNKNOWN_ERROR) {}
-    CScriptCheck(const CCoins& txFromIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, uint32_t consensusBranchIdIn, PrecomputedTransactionData* txdataIn) :
-        scriptPubKey(txFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey), amount(txFromIn.vout[txToIn.vin[nInIn].prevout.n].nValue),
+    CScriptCheck(const CTxOut& outIn, const CTransaction& txToIn, unsigned int nInIn, unsigned int nFlagsIn, bool cacheIn, uint32_t consensusBranchIdIn, const PrecomputedTransactionData* txdataIn) :
+        scriptPubKey(outIn.scriptPubKey), amount(outIn.nValue),
         ptxTo(&txToIn), nIn(nInIn), nFlags(nFlagsIn), cacheStore(cacheIn), consensusBranchId(consensusBranchIdIn), error(SCRIPT_ERR_UNKNOWN_ERROR), txdata(txdataIn) { }
 
     bool operator()();
@@ -522,27 +724,98 @@ public:
     ScriptError GetScriptError() const { return error; }
 };
 
+/**
+ * Closure representing the context-free checks of one transaction in a block
+ * (see CheckTransaction()). The reason for a failure is not kept; the caller
+ * finds it by checking the transactions again in order.
+ * Note that this stores references to the transaction and the verifier
+ */
+class CTransactionCheck
+{
+private:
+    const CTransaction *ptx;
+    ProofVerifier *verifier;
+
+public:
+    CTransactionCheck(): ptx(0), verifier(0) {}
+    CTransactionCheck(const CTransaction& txIn, ProofVerifier& verifierIn) :
+        ptx(&txIn), verifier(&verifierIn) { }
+
+    bool operator()();
+
+    void swap(CTransactionCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(verifier, check.verifier);
+    }
+};
+
+/**
+ * Closure representing the Equihash solution check of one header received
+ * from a peer (see CheckEquihashSolution()).
+ * Note that this stores references to the header and the consensus parameters
+ */
+class CHeaderCheck
+{
+private:
+    const CBlockHeader *pheader;
+    const Consensus::Params *params;
+
+public:
+    CHeaderCheck(): pheader(0), params(0) {}
+    CHeaderCheck(const CBlockHeader& headerIn, const Consensus::Params& paramsIn) :
+        pheader(&headerIn), params(&paramsIn) { }
+
+    bool operator()();
+
+    void swap(CHeaderCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(params, check.params);
+    }
+};
+
 bool GetSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
 bool GetAddressIndex(const uint160& addressHash, int type,
         std::vector<CAddressIndexDbEntry> &addressIndex,
         int start = 0, int end = 0);
 bool GetAddressUnspent(const uint160& addressHash, int type,
         std::vector<CAddressUnspentDbEntry>& unspentOutputs);
+//! Visit the entries of GetAddressIndex() or GetAddressUnspent() one at a
+//! time, from the entry at pFrom if set, until visit returns false.
+bool ForEachAddressIndex(const uint160& addressHash, int type, int start, int end,
+        const CAddressIndexKey* pFrom, const AddressIndexVisitor& visit);
+bool ForEachAddressUnspent(const uint160& addressHash, int type,
+        const CAddressUnspentKey* pFrom, const AddressUnspentVisitor& visit);
+//! Returns false if the address index does not keep the balances.
+bool GetAddressBalance(const uint160& addressHash, int type, CAddressBalanceValue& value);
 bool GetTimestampIndex(unsigned int high, unsigned int low, bool fActiveOnly,
     std::vector<std::pair<uint256, unsigned int> > &hashes);
 
 /** Functions for disk access for blocks */
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/** Write a block, as it is to be stored (see -compressblockfiles), to disk. */
+bool WriteBlockToDisk(const CDiskRecord& record, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Read the serialized bytes of the block stored at the given position, without
+ * deserializing it. Only the magic bytes and size in the index header are checked.
+ */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
+/** Read the undo data at pos, checking its checksum, which commits to the hash of the previous block (hashBlock). */
+bool UndoReadFromDisk(CBlockUndo& blockundo, const CDiskBlockPos& pos, const uint256& hashBlock);
 
 /** Functions for validating blocks and updating the block tree */
 
 /** Context-independent validity checks */
 
+/**
+ * With fCheckSolution false, the Equihash solution is assumed to have been
+ * checked already, and only the proof of work is checked.
+ */
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state,
     const CChainParams& chainparams,
-    bool fCheckPOW = true);
+    bool fCheckPOW = true,
+    bool fCheckSolution = true);
 
 bool CheckBlock(const CBlock& block, CValidationState& state,
                 const CChainParams& chainparams,
@@ -580,10 +853,13 @@ enum class CheckAs {
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  If precheck is not NULL, it holds the results of the context-free checks
+ *  for this block that were run ahead of time, which are then not repeated. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
                   const CChainParams& chainparams,
-                  bool fJustCheck = false, CheckAs blockChecks = CheckAs::Block);
+                  bool fJustCheck = false, CheckAs blockChecks = CheckAs::Block,
+                  const CBlockPrecheck* precheck = NULL);
 
 /**
  * Check a block is completely valid from start to finish (only works on top
@@ -591,6 +867,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
  */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fIsBlockTemplate);
 
+/**
+ * Remember the contents of a block template that passed TestBlockValidity(),
+ * so that when the solved block is connected, the proofs, scripts and
+ * signatures of its transactions, already checked as they entered the
+ * mempool, are not checked again. Requires cs_main.
+ */
+void RememberBlockTemplate(const CBlock& block);
+
 
 /**
  * When there are blocks in the active chain with missing data (e.g. if the
@@ -607,7 +891,13 @@ class CVerifyDB {
 public:
     CVerifyDB();
     ~CVerifyDB();
-    bool VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth);
+    /**
+     * Check the last nCheckDepth blocks of the active chain at the given
+     * level. With fCoinsOnly, only the checks of levels 3 and 4 (disconnecting
+     * and reconnecting the blocks on a cache layer over coinsview) are made,
+     * the others having been made already.
+     */
+    bool VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth, bool fCoinsOnly = false);
 };
 
 /** Find the last common block between the parameter chain and a locator. */
@@ -625,6 +915,13 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/**
+ * Global variable that points to the layer below pcoinsTip that writes flushed
+ * coins to the database in the background, or NULL if -asynccoinsflush is not
+ * set (protected by cs_main)
+ */
+extern CCoinsViewFlushLayer *pcoinsFlushLayer;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -5,6 +5,7 @@
 #include "mempool_limit.h"
 
 #include "core_memusage.h"
+#include "hash.h"
 #include "logging.h"
 #include "random.h"
 #include "serialize.h"
@@ -12,6 +13,8 @@
 #include "util/time.h"
 #include "version.h"
 
+#include <limits>
+
 const TxWeight ZERO_WEIGHT = TxWeight(0, 0);
 
 void RecentlyEvictedList::pruneList()
@@ -44,33 +47,67 @@ bool RecentlyEvictedList::contains(const uint256& txId)
 }
 
 
+WeightedTxTree::WeightedTxTree(int64_t capacity_) :
+    capacity(capacity_),
+    k0(GetRand(std::numeric_limits<uint64_t>::max())),
+    k1(GetRand(std::numeric_limits<uint64_t>::max()))
+{
+    assert(capacity >= 0);
+}
+
 TxWeight WeightedTxTree::getWeightAt(size_t index) const
 {
-    return index < size ? txIdAndWeights[index].txWeight.add(childWeights[index]) : ZERO_WEIGHT;
+    return index < nodes.size() ? nodes[index].txInfo.txWeight.add(nodes[index].childWeight) : ZERO_WEIGHT;
 }
 
 void WeightedTxTree::backPropagate(size_t fromIndex, const TxWeight& weightDelta)
 {
     while (fromIndex > 0) {
         fromIndex = (fromIndex - 1) / 2;
-        childWeights[fromIndex] = childWeights[fromIndex].add(weightDelta);
+        nodes[fromIndex].childWeight = nodes[fromIndex].childWeight.add(weightDelta);
     }
 }
 
-size_t WeightedTxTree::findByEvictionWeight(size_t fromIndex, int64_t weightToFind) const
+void WeightedTxTree::rebuildChildWeights()
 {
-    int leftWeight = getWeightAt(fromIndex * 2 + 1).evictionWeight;
-    int rightWeight = getWeightAt(fromIndex).evictionWeight - getWeightAt(fromIndex * 2 + 2).evictionWeight;
-    // On Left
-    if (weightToFind < leftWeight) {
-        return findByEvictionWeight(fromIndex * 2 + 1, weightToFind);
+    for (Node& node : nodes) {
+        node.childWeight = ZERO_WEIGHT;
     }
-    // Found
-    if (weightToFind < rightWeight) {
-        return fromIndex;
+    // The children of a node come after it, so they are complete by the
+    // time it is added to its own parent.
+    for (size_t index = nodes.size(); index-- > 1; ) {
+        Node& parent = nodes[(index - 1) / 2];
+        parent.childWeight = parent.childWeight.add(getWeightAt(index));
+    }
+}
+
+bool WeightedTxTree::preferRebuild(size_t nChanges) const
+{
+    size_t depth = 1;
+    while ((size_t(1) << depth) <= nodes.size()) {
+        depth++;
+    }
+    return nChanges * depth > nodes.size();
+}
+
+size_t WeightedTxTree::findByEvictionWeight(int64_t weightToFind) const
+{
+    size_t index = 0;
+    while (true) {
+        int64_t leftWeight = getWeightAt(index * 2 + 1).evictionWeight;
+        int64_t rightWeight = getWeightAt(index).evictionWeight - getWeightAt(index * 2 + 2).evictionWeight;
+        if (weightToFind < leftWeight) {
+            // On Left
+            index = index * 2 + 1;
+        } else if (weightToFind < rightWeight) {
+            // Found
+            return index;
+        } else {
+            // On Right
+            index = index * 2 + 2;
+            weightToFind -= rightWeight;
+        }
     }
-    // On Right
-    return findByEvictionWeight(fromIndex * 2 + 2, weightToFind - rightWeight);
 }
 
 TxWeight WeightedTxTree::getTotalWeight() const
@@ -79,45 +116,144 @@ TxWeight WeightedTxTree::getTotalWeight() const
 }
 
 
+size_t WeightedTxTree::homeSlot(const uint256& txId) const
+{
+    return SipHashUint256(k0, k1, txId) & (indexSlots.size() - 1);
+}
+
+size_t WeightedTxTree::findSlot(const uint256& txId) const
+{
+    const size_t mask = indexSlots.size() - 1;
+    size_t slot = homeSlot(txId);
+    while (indexSlots[slot] != 0 && nodes[indexSlots[slot] - 1].txInfo.txId != txId) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void WeightedTxTree::eraseSlot(size_t slot)
+{
+    // Shift back the entries that follow in the same probe sequence, so that
+    // no lookup stops early at the slot being emptied.
+    const size_t mask = indexSlots.size() - 1;
+    size_t next = slot;
+    while (true) {
+        next = (next + 1) & mask;
+        if (indexSlots[next] == 0) {
+            break;
+        }
+        size_t home = homeSlot(nodes[indexSlots[next] - 1].txInfo.txId);
+        // Move the entry unless its home lies cyclically in (slot, next].
+        bool fStays = slot <= next ? (slot < home && home <= next) : (slot < home || home <= next);
+        if (!fStays) {
+            indexSlots[slot] = indexSlots[next];
+            slot = next;
+        }
+    }
+    indexSlots[slot] = 0;
+}
+
+void WeightedTxTree::reserveSlot()
+{
+    if (2 * (nodes.size() + 1) <= indexSlots.size()) {
+        return;
+    }
+    indexSlots.assign(std::max<size_t>(16, 2 * indexSlots.size()), 0);
+    for (size_t index = 0; index < nodes.size(); index++) {
+        indexSlots[findSlot(nodes[index].txInfo.txId)] = index + 1;
+    }
+}
+
+bool WeightedTxTree::appendNode(const WeightedTxInfo& weightedTxInfo)
+{
+    assert(nodes.size() < std::numeric_limits<uint32_t>::max());
+    reserveSlot();
+    size_t slot = findSlot(weightedTxInfo.txId);
+    if (indexSlots[slot] != 0) {
+        return false;
+    }
+    nodes.emplace_back(weightedTxInfo);
+    indexSlots[slot] = nodes.size();
+    return true;
+}
+
+void WeightedTxTree::replaceWithLastNode(size_t index)
+{
+    size_t lastIndex = nodes.size() - 1;
+    if (index < lastIndex) {
+        nodes[index].txInfo = nodes[lastIndex].txInfo;
+        indexSlots[findSlot(nodes[index].txInfo.txId)] = index + 1;
+    }
+    nodes.pop_back();
+}
+
+
 void WeightedTxTree::add(const WeightedTxInfo& weightedTxInfo)
 {
-    if (txIdToIndexMap.count(weightedTxInfo.txId) > 0) {
+    if (!appendNode(weightedTxInfo)) {
         // This should not happen, but should be prevented nonetheless
         return;
     }
-    txIdAndWeights.push_back(weightedTxInfo);
-    childWeights.push_back(ZERO_WEIGHT);
-    txIdToIndexMap[weightedTxInfo.txId] = size;
-    backPropagate(size, weightedTxInfo.txWeight);
-    size += 1;
+    backPropagate(nodes.size() - 1, weightedTxInfo.txWeight);
+}
+
+void WeightedTxTree::add(const std::vector<WeightedTxInfo>& weightedTxInfos)
+{
+    if (!preferRebuild(weightedTxInfos.size())) {
+        for (const WeightedTxInfo& weightedTxInfo : weightedTxInfos) {
+            add(weightedTxInfo);
+        }
+        return;
+    }
+    for (const WeightedTxInfo& weightedTxInfo : weightedTxInfos) {
+        appendNode(weightedTxInfo);
+    }
+    rebuildChildWeights();
 }
 
 void WeightedTxTree::remove(const uint256& txId)
 {
-    if (txIdToIndexMap.find(txId) == txIdToIndexMap.end()) {
+    if (nodes.empty()) {
+        return;
+    }
+    size_t slot = findSlot(txId);
+    if (indexSlots[slot] == 0) {
         // Remove may be called multiple times for a given tx, so this is necessary
         return;
     }
+    size_t removeIndex = indexSlots[slot] - 1;
+    eraseSlot(slot);
 
-    size_t removeIndex = txIdToIndexMap[txId];
-
-    // We reduce the size at the start of this method to avoid saying size - 1
-    // when referring to the last element of the array below
-    size -= 1;
-
-    TxWeight lastChildWeight = txIdAndWeights[size].txWeight;
-    backPropagate(size, lastChildWeight.negate());
-
-    if (removeIndex < size) {
-        TxWeight weightDelta = lastChildWeight.add(txIdAndWeights[removeIndex].txWeight.negate());
-        txIdAndWeights[removeIndex] = txIdAndWeights[size];
-        txIdToIndexMap[txIdAndWeights[removeIndex].txId] = removeIndex;
-        backPropagate(removeIndex, weightDelta);
+    size_t lastIndex = nodes.size() - 1;
+    TxWeight lastChildWeight = nodes[lastIndex].txInfo.txWeight;
+    backPropagate(lastIndex, lastChildWeight.negate());
+    if (removeIndex < lastIndex) {
+        backPropagate(removeIndex, lastChildWeight.add(nodes[removeIndex].txInfo.txWeight.negate()));
     }
+    replaceWithLastNode(removeIndex);
+}
 
-    txIdToIndexMap.erase(txId);
-    txIdAndWeights.pop_back();
-    childWeights.pop_back();
+void WeightedTxTree::remove(const std::vector<uint256>& txIds)
+{
+    if (!preferRebuild(txIds.size())) {
+        for (const uint256& txId : txIds) {
+            remove(txId);
+        }
+        return;
+    }
+    for (const uint256& txId : txIds) {
+        if (nodes.empty()) {
+            break;
+        }
+        size_t slot = findSlot(txId);
+        if (indexSlots[slot] == 0) {
+            continue;
+        }
+        size_t removeIndex = indexSlots[slot] - 1;
+        eraseSlot(slot);
+        replaceWithLastNode(removeIndex);
+    }
+    rebuildChildWeights();
 }
 
 std::optional<uint256> WeightedTxTree::maybeDropRandom()
@@ -127,14 +263,19 @@ std::optional<uint256> WeightedTxTree::maybeDropRandom()
         return std::nullopt;
     }
     LogPrint("mempool", "Mempool cost limit exceeded (cost=%d, limit=%d)\n", totalTxWeight.cost, capacity);
-    int randomWeight = GetRand(totalTxWeight.evictionWeight);
-    WeightedTxInfo drop = txIdAndWeights[findByEvictionWeight(0, randomWeight)];
+    int64_t randomWeight = GetRand(totalTxWeight.evictionWeight);
+    WeightedTxInfo drop = nodes[findByEvictionWeight(randomWeight)].txInfo;
     LogPrint("mempool", "Evicting transaction (txid=%s, cost=%d, evictionWeight=%d)\n",
         drop.txId.ToString(), drop.txWeight.cost, drop.txWeight.evictionWeight);
     remove(drop.txId);
     return drop.txId;
 }
 
+size_t WeightedTxTree::DynamicMemoryUsage() const
+{
+    return memusage::DynamicUsage(nodes) + memusage::DynamicUsage(indexSlots);
+}
+
 
 TxWeight TxWeight::add(const TxWeight& other) const
 {
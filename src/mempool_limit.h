@@ -86,20 +86,34 @@ struct WeightedTxInfo {
 // For performance reasons, the collection is represented as a complete binary
 // tree where each node knows the sum of the weights of the children. This
 // allows for addition, removal, and random selection/dropping in logarithmic time.
+//
+// The tree is laid out in a single array, and transactions are found by txid
+// through an open-addressing hash table of indexes into that array. Adding or
+// removing many transactions at once (for example when a block is connected)
+// recomputes the sums of the whole tree in one pass when that is cheaper than
+// updating the ancestors of each transaction in turn.
 class WeightedTxTree
 {
+    struct Node {
+        WeightedTxInfo txInfo;
+        // The sum of the weights of all children and descendants of this node.
+        TxWeight childWeight;
+
+        Node(const WeightedTxInfo& txInfo_) : txInfo(txInfo_), childWeight(0, 0) {}
+    };
+
     const int64_t capacity;
-    size_t size = 0;
 
-    // The following two vectors are the tree representation of this collection.
-    // We keep track of 3 data points for each node: A transaction's txid, its cost,
-    // and the sum of the weights of all children and descendant of that node.
-    std::vector<WeightedTxInfo> txIdAndWeights;
-    std::vector<TxWeight> childWeights;
+    // The tree representation of this collection; the children of the node
+    // at index i are at 2i + 1 and 2i + 2.
+    std::vector<Node> nodes;
 
-    // The following map is to simplify removal. When removing a tx, we do so by txid.
-    // This map allows looking up the transaction's index in the tree.
-    std::map<uint256, size_t> txIdToIndexMap;
+    // The txid index. Each slot holds 1 + the index of a node in the tree,
+    // or 0 if it is empty. Its size is a power of two, and it is kept at
+    // most half full so that probe sequences stay short.
+    std::vector<uint32_t> indexSlots;
+    // Salt for the hash of txids in indexSlots.
+    const uint64_t k0, k1;
 
     // Returns the sum of a node and all of its children's TxWeights for a given index.
     TxWeight getWeightAt(size_t index) const;
@@ -108,23 +122,49 @@ class WeightedTxTree
     // ancestors to reflect its cost.
     void backPropagate(size_t fromIndex, const TxWeight& weightDelta);
 
-    // For a given random cost + fee penalty, this method recursively finds the
-    // correct transaction. This is used by WeightedTxTree::maybeDropRandom().
-    size_t findByEvictionWeight(size_t fromIndex, int64_t weightToFind) const;
+    // Recompute the child weights of every node, in time linear in the size
+    // of the tree.
+    void rebuildChildWeights();
+
+    // Whether applying nChanges additions or removals is cheaper by
+    // rebuildChildWeights() than by backPropagate() for each of them.
+    bool preferRebuild(size_t nChanges) const;
+
+    // For a given random cost + fee penalty, this method finds the correct
+    // transaction. This is used by WeightedTxTree::maybeDropRandom().
+    size_t findByEvictionWeight(int64_t weightToFind) const;
+
+    size_t homeSlot(const uint256& txId) const;
+    // Returns the slot of txId in indexSlots if it is there, or else the
+    // empty slot where it would be inserted.
+    size_t findSlot(const uint256& txId) const;
+    void eraseSlot(size_t slot);
+    // Make room in indexSlots for one more transaction.
+    void reserveSlot();
+
+    // Append a node to the tree without updating its ancestors. Returns false
+    // if the transaction is already present.
+    bool appendNode(const WeightedTxInfo& weightedTxInfo);
+    // Move the last node of the tree into the place of the node at index,
+    // and shrink the tree by one, without updating any ancestors.
+    void replaceWithLastNode(size_t index);
 
 public:
-    WeightedTxTree(int64_t capacity_) : capacity(capacity_) {
-        assert(capacity >= 0);
-    }
+    WeightedTxTree(int64_t capacity_);
 
     TxWeight getTotalWeight() const;
+    size_t getSize() const { return nodes.size(); }
 
     void add(const WeightedTxInfo& weightedTxInfo);
+    void add(const std::vector<WeightedTxInfo>& weightedTxInfos);
     void remove(const uint256& txId);
+    void remove(const std::vector<uint256>& txIds);
 
     // If the total cost limit is exceeded, pick a random number based on the total cost
     // of the collection and remove the associated transaction.
     std::optional<uint256> maybeDropRandom();
+
+    size_t DynamicMemoryUsage() const;
 };
 
 
@@ -5,6 +5,8 @@
 #ifndef BITCOIN_MEMUSAGE_H
 #define BITCOIN_MEMUSAGE_H
 
+#include "support/allocators/pool.h"
+
 #include <stdlib.h>
 
 #include <map>
@@ -138,6 +140,26 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+/**
+ * Maps backed by a PoolAllocator are accounted by what their pool holds
+ * rather than by the number of elements: every chunk, plus the allocations
+ * that bypassed the pool. The latter are normally just the bucket array, in
+ * which case the figure is exact.
+ */
+template<typename X, typename Y, typename Z, typename P, typename T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, P, PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    const auto* pool = m.get_allocator().resource();
+    size_t usage = MallocUsage(sizeof(*pool)) + MallocUsage(sizeof(stl_shared_counter)) +
+                   MallocUsage(pool->CHUNK_SIZE_BYTES) * pool->NumAllocatedChunks() +
+                   MallocUsage(sizeof(void*) * pool->ChunkListCapacity());
+    size_t nLarge = pool->NumLargeAllocations();
+    if (nLarge > 0) {
+        usage += MallocUsage(pool->LargeAllocationBytes() / nLarge) * nLarge;
+    }
+    return usage;
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
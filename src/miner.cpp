@@ -42,7 +42,10 @@
 #ifdef ENABLE_MINING
 #include <functional>
 #endif
+#include <atomic>
+#include <future>
 #include <mutex>
+#include <thread>
 
 using namespace std;
 
@@ -122,6 +125,57 @@ bool IsShieldedMinerAddress(const MinerAddress& minerAddr) {
     return !std::holds_alternative<boost::shared_ptr<CReserveScript>>(minerAddr);
 }
 
+static bool IsSameMinerAddress(const MinerAddress& a, const MinerAddress& b) {
+    if (a.index() != b.index()) {
+        return false;
+    }
+    if (auto orchardAddr = std::get_if<libzcash::OrchardRawAddress>(&a)) {
+        return *orchardAddr == std::get<libzcash::OrchardRawAddress>(b);
+    }
+    if (auto saplingAddr = std::get_if<libzcash::SaplingPaymentAddress>(&a)) {
+        return *saplingAddr == std::get<libzcash::SaplingPaymentAddress>(b);
+    }
+    return std::get<boost::shared_ptr<CReserveScript>>(a)->reserveScript ==
+           std::get<boost::shared_ptr<CReserveScript>>(b)->reserveScript;
+}
+
+/**
+ * Work that CreateNewBlock() carries over between templates for the same
+ * block height on the same tip, as getblocktemplate is polled far more often
+ * than the tip changes:
+ *
+ * - The transactions whose scripts were checked, which need not be checked
+ *   again as long as they stay in the mempool.
+ * - The last coinbase transaction, which is reused while it pays the same
+ *   fees to the same address. A shielded coinbase output needs a proof, which
+ *   otherwise dominates the cost of a template.
+ */
+struct CBlockTemplateCache
+{
+    uint256 hashPrevBlock;
+    int nHeight = -1;
+    std::set<WTxId> setInputsChecked;
+    std::optional<CMutableTransaction> coinbase;
+    std::optional<MinerAddress> coinbaseAddress;
+    CAmount nCoinbaseFees = 0;
+};
+
+static CBlockTemplateCache blockTemplateCache GUARDED_BY(cs_main);
+
+/**
+ * The coinbase transaction of an empty block at a future height, built in the
+ * background by PrecomputeCoinbaseTransaction().
+ */
+struct CPrecomputedCoinbase
+{
+    int nHeight = -1;
+    std::optional<MinerAddress> address;
+    std::shared_future<CMutableTransaction> coinbase;
+};
+
+static Mutex cs_precomputedCoinbase;
+static CPrecomputedCoinbase precomputedCoinbase GUARDED_BY(cs_precomputedCoinbase);
+
 class AddFundingStreamValueToTx
 {
 private:
@@ -367,6 +421,112 @@ CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, C
         return mtx;
 }
 
+void PrecomputeCoinbaseTransaction(const CChainParams& chainparams, const MinerAddress& minerAddress, int nHeight)
+{
+    LOCK(cs_precomputedCoinbase);
+    CPrecomputedCoinbase& precomputed = precomputedCoinbase;
+    if (precomputed.coinbase.valid()) {
+        if (precomputed.nHeight == nHeight && IsSameMinerAddress(*precomputed.address, minerAddress)) {
+            return;
+        }
+        // Build one at a time, leaving this one to a later call.
+        if (precomputed.coinbase.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return;
+        }
+    }
+
+    precomputed.nHeight = nHeight;
+    precomputed.address = minerAddress;
+    precomputed.coinbase = std::async(std::launch::async, [&chainparams, minerAddress, nHeight] {
+        return CreateCoinbaseTransaction(chainparams, CAmount{0}, minerAddress, nHeight);
+    }).share();
+}
+
+std::optional<CMutableTransaction> GetPrecomputedCoinbaseTransaction(const MinerAddress& minerAddress, int nHeight, bool fWait)
+{
+    std::shared_future<CMutableTransaction> coinbase;
+    {
+        LOCK(cs_precomputedCoinbase);
+        const CPrecomputedCoinbase& precomputed = precomputedCoinbase;
+        if (!precomputed.coinbase.valid() ||
+            precomputed.nHeight != nHeight ||
+            !IsSameMinerAddress(*precomputed.address, minerAddress)) {
+            return std::nullopt;
+        }
+        coinbase = precomputed.coinbase;
+    }
+
+    if (!fWait && coinbase.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return std::nullopt;
+    }
+    try {
+        return coinbase.get();
+    } catch (const std::exception& e) {
+        LogPrintf("%s: failed to build the coinbase transaction for height %d: %s\n", __func__, nHeight, e.what());
+        return std::nullopt;
+    }
+}
+
+/**
+ * Checks the inputs of transactions that are candidates for a block template,
+ * before any are selected, spreading their script checks across the script
+ * checking threads. The transactions must only spend coins in view. Those
+ * that pass are added to setInputsChecked, and the others to setInputsFailed.
+ */
+static void CheckCandidateInputs(
+    const std::vector<const CTransaction*>& vTx,
+    const CCoinsViewCache& view,
+    const Consensus::Params& consensusParams,
+    uint32_t consensusBranchId,
+    std::set<WTxId>& setInputsChecked,
+    std::set<WTxId>& setInputsFailed)
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(mempool.cs);
+
+    // The inexpensive checks read the view, so they are done here.
+    std::vector<std::shared_ptr<const PrecomputedTransactionData>> vTxData(vTx.size());
+    std::vector<std::vector<CScriptCheck>> vChecks(vTx.size());
+    std::vector<char> vValid(vTx.size());
+    for (size_t i = 0; i < vTx.size(); i++) {
+        const CTransaction& tx = *vTx[i];
+        vTxData[i] = mempool.GetTxData(tx.GetWTxId(), consensusBranchId);
+        if (!vTxData[i]) {
+            std::vector<CTxOut> allPrevOutputs;
+            for (const auto& input : tx.vin) {
+                allPrevOutputs.push_back(view.GetOutputFor(input));
+            }
+            vTxData[i] = std::make_shared<const PrecomputedTransactionData>(tx, allPrevOutputs);
+        }
+
+        CValidationState state;
+        vValid[i] = ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, *vTxData[i], consensusParams, consensusBranchId, &vChecks[i]);
+    }
+
+    // Each thread takes a transaction at a time, so that its result is known.
+    std::atomic<size_t> nNext{0};
+    auto check = [&]() {
+        for (size_t i = nNext++; i < vTx.size(); i = nNext++) {
+            for (CScriptCheck& scriptCheck : vChecks[i]) {
+                if (!vValid[i]) break;
+                vValid[i] = scriptCheck();
+            }
+        }
+    };
+    std::vector<std::thread> vThreads;
+    for (int i = 1; i < std::min<int>(std::max(1, nScriptCheckThreads), vTx.size()); i++) {
+        vThreads.emplace_back(check);
+    }
+    check();
+    for (std::thread& thread : vThreads) {
+        thread.join();
+    }
+
+    for (size_t i = 0; i < vTx.size(); i++) {
+        (vValid[i] ? setInputsChecked : setInputsFailed).insert(vTx[i]->GetWTxId());
+    }
+}
+
 CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddress& minerAddress, const std::optional<CMutableTransaction>& next_cb_mtx)
 {
     // Create new block
@@ -412,6 +572,17 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
         const int64_t nMedianTimePast = pindexPrev->GetMedianTimePast();
         CCoinsViewCache view(pcoinsTip);
 
+        CBlockTemplateCache& cache = blockTemplateCache;
+        if (cache.hashPrevBlock != pindexPrev->GetBlockHash() || cache.nHeight != nHeight) {
+            cache = CBlockTemplateCache();
+            cache.hashPrevBlock = pindexPrev->GetBlockHash();
+            cache.nHeight = nHeight;
+        }
+        // The transactions included in this template or checked ahead of
+        // selection; the others are dropped from the cache, having left the
+        // mempool or been skipped.
+        std::set<WTxId> setInputsChecked;
+
         SaplingMerkleTree sapling_tree;
         assert(view.GetSaplingAnchorAt(view.GetBestAnchor(SAPLING), sapling_tree));
 
@@ -446,7 +617,7 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
                 for (const CTxIn& txin : tx.vin)
                 {
                     // Read prev transaction
-                    if (!view.HaveCoins(txin.prevout.hash))
+                    if (!view.HaveCoin(txin.prevout))
                     {
                         LogPrintf("INFO: missing coins for %s", txin.prevout.hash.GetHex());
                         // This should never happen; all transactions in the memory
@@ -474,13 +645,13 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
                         nTotalIn += mempool.mapTx.find(txin.prevout.hash)->GetTx().vout[txin.prevout.n].nValue;
                         continue;
                     }
-                    const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-                    assert(coins);
+                    const Coin& coin = view.AccessCoin(txin.prevout);
+                    assert(!coin.IsSpent());
 
-                    CAmount nValueIn = coins->vout[txin.prevout.n].nValue;
+                    CAmount nValueIn = coin.out.nValue;
                     nTotalIn += nValueIn;
 
-                    int nConf = nHeight - coins->nHeight;
+                    int nConf = nHeight - coin.nHeight;
 
                     dPriority += (double)nValueIn * nConf;
                 }
@@ -498,6 +669,15 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
                 CAmount feePaid = nTotalIn - tx.GetValueOut();
                 CFeeRate feeRate(feePaid, nTxSize);
 
+                // A transaction is selected by fee rate before its children,
+                // so rank it by the fee rate of the package it forms with its
+                // descendants if that is higher. Once it is in the block, the
+                // children that paid for it are released through mapDependers.
+                CFeeRate packageFeeRate(mi->GetModFeesWithDescendants(), mi->GetSizeWithDescendants());
+                if (feeRate < packageFeeRate) {
+                    feeRate = packageFeeRate;
+                }
+
                 if (porphan)
                 {
                     porphan->dPriority = dPriority;
@@ -518,6 +698,26 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
         TxPriorityCompare comparer(fSortedByFee);
         std::make_heap(vecPriority.begin(), vecPriority.end(), comparer);
 
+        // With script checking threads, check the inputs of the transactions
+        // most likely to be selected all at once, rather than one at a time as
+        // they are selected. Those spending outputs of other transactions in
+        // the mempool are still checked when they are selected.
+        std::set<WTxId> setInputsFailed;
+        if (nScriptCheckThreads) {
+            std::vector<TxPriority> vCandidates(vecPriority);
+            std::sort(vCandidates.rbegin(), vCandidates.rend(), comparer);
+            std::vector<const CTransaction*> vCandidateTxs;
+            uint64_t nCandidateSize = 0;
+            for (const TxPriority& candidate : vCandidates) {
+                if (nCandidateSize >= nBlockMaxSize) break;
+                const CTransaction* ptx = candidate.get<3>();
+                if (cache.setInputsChecked.count(ptx->GetWTxId())) continue;
+                nCandidateSize += ::GetSerializeSize(*ptx, SER_NETWORK, PROTOCOL_VERSION);
+                vCandidateTxs.push_back(ptx);
+            }
+            CheckCandidateInputs(vCandidateTxs, view, chainparams.GetConsensus(), consensusBranchId, setInputsChecked, setInputsFailed);
+        }
+
         // We want to track the value pool, but if the miner gets
         // invoked on an old block before the hardcoded fallback
         // is active we don't want to trip up any assertions. So,
@@ -614,20 +814,35 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
                 continue;
             }
 
-            std::vector<CTxOut> allPrevOutputs;
-            for (const auto& input : tx.vin) {
-                allPrevOutputs.push_back(view.GetOutputFor(input));
-            }
-
-            // Note that flags: we don't want to set mempool/IsStandard()
-            // policy here, but we still have to ensure that the block we
-            // create only contains transactions that are valid in new blocks.
-            CValidationState state;
-            PrecomputedTransactionData txdata(tx, allPrevOutputs);
-            if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, txdata, chainparams.GetConsensus(), consensusBranchId)) {
+            // The outputs a transaction spends are fixed by its inputs, so
+            // the scripts only need to be checked once per tip.
+            const WTxId wtxid = tx.GetWTxId();
+            if (setInputsFailed.count(wtxid)) {
                 LogPrintf("%s: skipping tx %s: Failed contextual inputs check.", __func__, hash.GetHex());
                 continue;
             }
+            if (!cache.setInputsChecked.count(wtxid) && !setInputsChecked.count(wtxid)) {
+                // Reuse the signature hash data from when the transaction was
+                // accepted, unless the consensus branch has changed since.
+                std::shared_ptr<const PrecomputedTransactionData> txdata = mempool.GetTxData(wtxid, consensusBranchId);
+                if (!txdata) {
+                    std::vector<CTxOut> allPrevOutputs;
+                    for (const auto& input : tx.vin) {
+                        allPrevOutputs.push_back(view.GetOutputFor(input));
+                    }
+                    txdata = std::make_shared<const PrecomputedTransactionData>(tx, allPrevOutputs);
+                }
+
+                // Note that flags: we don't want to set mempool/IsStandard()
+                // policy here, but we still have to ensure that the block we
+                // create only contains transactions that are valid in new blocks.
+                CValidationState state;
+                if (!ContextualCheckInputs(tx, state, view, true, MANDATORY_SCRIPT_VERIFY_FLAGS, true, *txdata, chainparams.GetConsensus(), consensusBranchId)) {
+                    LogPrintf("%s: skipping tx %s: Failed contextual inputs check.", __func__, hash.GetHex());
+                    continue;
+                }
+            }
+            setInputsChecked.insert(wtxid);
 
             if (chainparams.ZIP209Enabled() && monitoring_pool_balances) {
                 // Does this transaction lead to a turnstile violation?
@@ -700,21 +915,32 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
         last_block_num_txs = nBlockTx;
         last_block_size = nBlockSize;
         LogPrintf("%s: total tx: %u; total size: %u (excluding coinbase)", __func__, nBlockTx, nBlockSize);
+        cache.setInputsChecked.swap(setInputsChecked);
 
         // Create coinbase tx
         if (next_cb_mtx) {
             pblock->vtx[0] = *next_cb_mtx;
         } else {
-            pblock->vtx[0] = CreateCoinbaseTransaction(chainparams, nFees, minerAddress, nHeight);
+            if (!(cache.coinbase &&
+                  cache.nCoinbaseFees == nFees &&
+                  IsSameMinerAddress(*cache.coinbaseAddress, minerAddress)))
+            {
+                cache.coinbase = CreateCoinbaseTransaction(chainparams, nFees, minerAddress, nHeight);
+                cache.coinbaseAddress = minerAddress;
+                cache.nCoinbaseFees = nFees;
+            }
+            pblock->vtx[0] = *cache.coinbase;
         }
         pblocktemplate->vTxFees[0] = -nFees;
 
         // Update the Sapling commitment tree.
+        std::vector<libzcash::PedersenHash> vSaplingCommitments;
         for (const CTransaction& tx : pblock->vtx) {
             for (const OutputDescription& odesc : tx.vShieldedOutput) {
-                sapling_tree.append(odesc.cmu);
+                vSaplingCommitments.push_back(odesc.cmu);
             }
         }
+        sapling_tree.append_many(vSaplingCommitments);
 
         // Randomise nonce
         arith_uint256 nonce = UintToArith256(GetRandHash());
@@ -771,6 +997,7 @@ CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddre
         CValidationState state;
         if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, true))
             throw std::runtime_error(std::string("CreateNewBlock(): TestBlockValidity failed: ") + state.GetRejectReason());
+        RememberBlockTemplate(*pblock);
     }
 
     return pblocktemplate.release();
@@ -920,6 +1147,13 @@ void static BitcoinMiner(const CChainParams& chainparams)
     assert(solver == "tromp" || solver == "default");
     LogPrint("pow", "Using Equihash solver \"%s\" with n = %u, k = %u\n", solver, n, k);
 
+    // The tromp solver's buckets take over a hundred megabytes; allocate them
+    // once for this thread, and reset them for each nonce.
+    std::unique_ptr<equi> eq;
+    if (solver == "tromp") {
+        eq.reset(new equi(1));
+    }
+
     std::mutex m_cs;
     bool cancelSolver = false;
     boost::signals2::connection c = uiInterface.NotifyBlockTip.connect(
@@ -1054,28 +1288,27 @@ void static BitcoinMiner(const CChainParams& chainparams)
 
                 // TODO: factor this out into a function with the same API for each solver.
                 if (solver == "tromp") {
-                    // Create solver and initialize it.
-                    equi eq(1);
-                    eq.setstate(curr_state.inner);
+                    // Initialize the solver.
+                    eq->setstate(curr_state.inner);
 
                     // Initialization done, start algo driver.
-                    eq.digit0(0);
-                    eq.xfull = eq.bfull = eq.hfull = 0;
-                    eq.showbsizes(0);
+                    eq->digit0(0);
+                    eq->xfull = eq->bfull = eq->hfull = 0;
+                    eq->showbsizes(0);
                     for (u32 r = 1; r < WK; r++) {
-                        (r&1) ? eq.digitodd(r, 0) : eq.digiteven(r, 0);
-                        eq.xfull = eq.bfull = eq.hfull = 0;
-                        eq.showbsizes(r);
+                        (r&1) ? eq->digitodd(r, 0) : eq->digiteven(r, 0);
+                        eq->xfull = eq->bfull = eq->hfull = 0;
+                        eq->showbsizes(r);
                     }
-                    eq.digitK(0);
+                    eq->digitK(0);
                     ehSolverRuns.increment();
 
                     // Convert solution indices to byte array (decompress) and pass it to validBlock method.
-                    for (size_t s = 0; s < eq.nsols; s++) {
+                    for (size_t s = 0; s < eq->nsols; s++) {
                         LogPrint("pow", "Checking solution %d\n", s+1);
                         std::vector<eh_index> index_vector(PROOFSIZE);
                         for (size_t i = 0; i < PROOFSIZE; i++) {
-                            index_vector[i] = eq.sols[s][i];
+                            index_vector[i] = eq->sols[s][i];
                         }
                         std::vector<unsigned char> sol_char = GetMinimalFromIndices(index_vector, DIGITBITS);
 
@@ -94,6 +94,22 @@ struct CBlockTemplate
 
 CMutableTransaction CreateCoinbaseTransaction(const CChainParams& chainparams, CAmount nFees, const MinerAddress& minerAddress, int nHeight);
 
+/**
+ * Starts building, in the background, the coinbase transaction of an empty
+ * block at nHeight paying to a shielded miner address, so that a template can
+ * be returned without waiting for its proofs once the chain reaches the height
+ * before. Does nothing if that coinbase is already built or being built, or
+ * while the coinbase for another height is still being built.
+ */
+void PrecomputeCoinbaseTransaction(const CChainParams& chainparams, const MinerAddress& minerAddress, int nHeight);
+
+/**
+ * Returns the coinbase transaction built by PrecomputeCoinbaseTransaction for
+ * this address and height, if it has been built. If fWait is true, waits for
+ * it to be built if it is still being built.
+ */
+std::optional<CMutableTransaction> GetPrecomputedCoinbaseTransaction(const MinerAddress& minerAddress, int nHeight, bool fWait);
+
 /** Generate a new block, without valid proof-of-work */
 CBlockTemplate* CreateNewBlock(const CChainParams& chainparams, const MinerAddress& minerAddress, const std::optional<CMutableTransaction>& next_coinbase_mtx = std::nullopt);
 
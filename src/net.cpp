@@ -21,6 +21,7 @@
 #include "hash.h"
 #include "primitives/transaction.h"
 #include "scheduler.h"
+#include "txreconciliation.h"
 #include "ui_interface.h"
 
 #ifdef WIN32
@@ -69,6 +70,9 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+SocketEventsMode socketEventsMode = GetDefaultSocketEventsMode();
+int nMessageHandlerThreads = DEFAULT_MESSAGE_HANDLER_THREADS;
+int64_t nMaxPeerProcessing = DEFAULT_MAX_PEER_PROCESSING;
 bool fAddressesInitialized = false;
 std::string strSubVersion;
 
@@ -383,7 +387,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest)
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsUsableSocket(hSocket, socketEventsMode)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -447,6 +451,34 @@ void CNode::CloseSocketDisconnect()
         vRecvMsg.clear();
 }
 
+static void ReplenishProcessingBudget(CNode* pnode)
+{
+    // -maxpeerprocessing milliseconds per second is as many microseconds
+    // per millisecond.
+    int64_t nNow = GetTimeMicros();
+    pnode->nProcessingBudgetUsec = std::min(
+        pnode->nProcessingBudgetUsec + (nNow - pnode->nProcessingBudgetTime) * nMaxPeerProcessing / 1000,
+        nMaxPeerProcessing * 1000 * PEER_PROCESSING_BURST_SECONDS);
+    pnode->nProcessingBudgetTime = nNow;
+}
+
+void CNode::ChargeProcessing(int64_t nUsec)
+{
+    nProcessingUsec += nUsec;
+    if (nMaxPeerProcessing > 0) {
+        ReplenishProcessingBudget(this);
+        nProcessingBudgetUsec -= nUsec;
+    }
+}
+
+bool CNode::IsOverProcessingBudget()
+{
+    if (nMaxPeerProcessing <= 0)
+        return false;
+    ReplenishProcessingBudget(this);
+    return nProcessingBudgetUsec < 0;
+}
+
 void CNode::PushVersion()
 {
     int nBestHeight = g_signals.GetHeight().get_value_or(0);
@@ -699,6 +731,7 @@ void CNode::copyStats(CNodeStats &stats)
     // Raw ping time is in microseconds, but show it to user as whole seconds (Bitcoin users should be well used to small numbers with many decimal places by now :)
     stats.dPingTime = (((double)nPingUsecTime) / 1e6);
     stats.dPingWait = (((double)nPingUsecWait) / 1e6);
+    stats.dProcessingTime = (((double)nProcessingUsec) / 1e6);
 
     // Leave string empty if addrLocal invalid (not filled in yet)
     CService addrLocalUnlocked = GetAddrLocal();
@@ -737,12 +770,14 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
 
         if (msg.complete()) {
             msg.nTime = GetTimeMicros();
+            // finish the checksum here rather than on the handler thread
+            msg.GetMessageHash();
             std::string strCommand = SanitizeString(msg.hdr.GetCommand());
             MetricsIncrementCounter("zcash.net.in.messages", "command", strCommand.c_str());
             MetricsCounter(
                 "zcash.net.in.bytes", msg.hdr.nMessageSize,
                 "command", strCommand.c_str());
-            messageHandlerCondition.notify_one();
+            messageHandlerCondition.notify_all();
         }
     }
 
@@ -790,34 +825,77 @@ int CNetMessage::readData(const char *pch, unsigned int nBytes)
         vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
     }
 
+    hasher.Write((const unsigned char*)pch, nCopy);
     memcpy(&vRecv[nDataPos], pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
 }
 
+const uint256& CNetMessage::GetMessageHash() const
+{
+    assert(complete());
+    if (data_hash.IsNull())
+        hasher.Finalize(data_hash.begin());
+    return data_hash;
+}
+
+
+
 
 
 
 
 
 
+/** The most emptied send buffers a peer keeps for reuse. */
+static const size_t MAX_SEND_BUFFER_POOL_SIZE = 8;
+/** Larger send buffers, e.g. of blocks, are freed rather than kept for reuse. */
+static const size_t MAX_POOLED_SEND_BUFFER_SIZE = 64 * 1024;
+/** The most queued messages handed to the kernel in one sendmsg() call. */
+static const int MAX_SEND_IOVECS = 64;
 
+/**
+ * Send as much as the socket takes of the queued messages from it to end,
+ * starting nOffset bytes into the first one. Outside Windows, up to
+ * MAX_SEND_IOVECS messages are sent with one sendmsg() call.
+ */
+static int SendQueuedMessages(SOCKET hSocket, std::deque<CNetSendMessage>::const_iterator it,
+                              std::deque<CNetSendMessage>::const_iterator end, size_t nOffset)
+{
+#ifdef WIN32
+    const CSerializeData& data = it->Get();
+    return send(hSocket, &data[nOffset], data.size() - nOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+#else
+    struct iovec iov[MAX_SEND_IOVECS];
+    int nIov = 0;
+    for (; it != end && nIov < MAX_SEND_IOVECS; ++it, ++nIov) {
+        const CSerializeData& data = it->Get();
+        size_t nStart = nIov == 0 ? nOffset : 0;
+        iov[nIov].iov_base = const_cast<char*>(&data[nStart]);
+        iov[nIov].iov_len = data.size() - nStart;
+    }
+    struct msghdr msg = {};
+    msg.msg_iov = iov;
+    msg.msg_iovlen = nIov;
+    return sendmsg(hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
 
 // requires LOCK(cs_vSend)
-void SocketSendData(CNode *pnode)
+size_t SocketSendData(CNode *pnode)
 {
-    std::deque<CSerializeData>::iterator it = pnode->vSendMsg.begin();
+    std::deque<CNetSendMessage>::iterator it = pnode->vSendMsg.begin();
+    size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const CSerializeData &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        assert(it->Get().size() > pnode->nSendOffset);
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, &data[pnode->nSendOffset], data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            nBytes = SendQueuedMessages(pnode->hSocket, it, pnode->vSendMsg.end(), pnode->nSendOffset);
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetTime();
@@ -825,13 +903,30 @@ void SocketSendData(CNode *pnode)
                 LOCK(pnode->cs_vSend);
                 pnode->nSendBytes += nBytes;
             }
-            pnode->nSendOffset += nBytes;
+            nSentSize += nBytes;
             pnode->RecordBytesSent(nBytes);
-            if (pnode->nSendOffset == data.size()) {
+
+            // Step over the messages that were sent in full.
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                const CSerializeData& data = it->Get();
+                size_t nRemaining = data.size() - pnode->nSendOffset;
+                if (nLeft < nRemaining) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nRemaining;
                 pnode->nSendOffset = 0;
                 pnode->nSendSize -= data.size();
+                // Keep the emptied buffer for the next message.
+                if (!it->shared && pnode->vSendBufferPool.size() < MAX_SEND_BUFFER_POOL_SIZE &&
+                    it->data.capacity() <= MAX_POOLED_SEND_BUFFER_SIZE) {
+                    it->data.clear();
+                    pnode->vSendBufferPool.push_back(std::move(it->data));
+                }
                 it++;
-            } else {
+            }
+            if (pnode->nSendOffset != 0) {
                 // could not send full message; stop sending more
                 break;
             }
@@ -855,6 +950,7 @@ void SocketSendData(CNode *pnode)
         assert(pnode->nSendSize == 0);
     }
     pnode->vSendMsg.erase(pnode->vSendMsg.begin(), it);
+    return nSentSize;
 }
 
 static list<CNode*> vNodesDisconnected;
@@ -1036,7 +1132,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!IsUsableSocket(hSocket, socketEventsMode))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1084,6 +1180,41 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
 void ThreadSocketHandler()
 {
     unsigned int nPrevNodeCount = 0;
+
+    std::string strError;
+    std::unique_ptr<CSocketEvents> socketEvents = CSocketEvents::Create(socketEventsMode, strError);
+    if (!socketEvents) {
+        LogPrintf("Falling back to select() for peer sockets: %s\n", strError);
+        socketEvents = CSocketEvents::Create(SocketEventsMode::SELECT, strError);
+    }
+    const bool fEdgeTriggered = socketEvents->IsEdgeTriggered();
+    LogPrintf("Waiting for peer sockets with %s\n", GetSocketEventsModeName(socketEvents->GetMode()));
+
+    for (const ListenSocket& hListenSocket : vhListenSocket) {
+        if (!socketEvents->Add(hListenSocket.socket, true))
+            LogPrintf("Cannot wait for connections on listening socket: %s\n", NetworkErrorString(WSAGetLastError()));
+    }
+
+    // The node each registered socket belongs to. A socket closed by another
+    // thread is only forgotten here later, by which time its descriptor may
+    // have been reused by a new node; only the node that owns the descriptor
+    // at the time removes it.
+    std::map<SOCKET, CNode*> mapSocketNodes;
+    auto forgetSocket = [&](CNode* pnode) {
+        auto it = mapSocketNodes.find(pnode->hSocketEvents);
+        if (it != mapSocketNodes.end() && it->second == pnode) {
+            socketEvents->Remove(pnode->hSocketEvents);
+            mapSocketNodes.erase(it);
+        }
+        pnode->hSocketEvents = INVALID_SOCKET;
+        pnode->fSocketRecvReady = false;
+        pnode->fSocketSendReady = false;
+    };
+
+    // Set when an edge-triggered socket may still have data to receive or
+    // room to send, so that the next wait does not block.
+    bool fMoreWork = false;
+
     while (true)
     {
         //
@@ -1106,6 +1237,13 @@ void ThreadSocketHandler()
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
 
+                    // stop waiting for the socket while it is still open
+                    if (pnode->hSocketEvents != INVALID_SOCKET)
+                    {
+                        LOCK(pnode->cs_hSocket);
+                        forgetSocket(pnode);
+                    }
+
                     // close socket and cleanup
                     pnode->CloseSocketDisconnect();
 
@@ -1155,39 +1293,20 @@ void ThreadSocketHandler()
         }
 
         //
-        // Find which sockets have data to receive
+        // Find which sockets to wait for
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        for (const ListenSocket& hListenSocket : vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
-
         {
             LOCK(cs_vNodes);
             for (CNode* pnode : vNodes)
             {
-                // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
+                // With a level-triggered backend, implement the following logic:
+                // * If there is data to send, wait for sending data. As this only
                 //   happens when optimistic write failed, we choose to first drain the
                 //   write buffer in this case before receiving more. This avoids
                 //   needlessly queueing received data, if the remote peer is not themselves
                 //   receiving data. This means properly utilizing TCP flow control signaling.
                 // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
+                //   or there is space left in the buffer, wait for receiving data.
                 // * (if neither of the above applies, there is certainly one message
                 //   in the receiver buffer ready to be processed).
                 // Together, that means that at least one of the following is always possible,
@@ -1195,65 +1314,89 @@ void ThreadSocketHandler()
                 // * We send some data.
                 // * We wait for data to be received (and disconnect after timeout).
                 // * We process a message in the buffer (message handler thread).
+                // Edge-triggered backends always wait for both, and the same
+                // logic is applied when servicing the socket below.
+                uint8_t nInterest = 0;
+                if (!fEdgeTriggered) {
+                    bool select_send;
+                    {
+                        LOCK(pnode->cs_vSend);
+                        select_send = !pnode->vSendMsg.empty();
+                    }
 
-                bool select_send;
-                {
-                    LOCK(pnode->cs_vSend);
-                    select_send = !pnode->vSendMsg.empty();
-                }
+                    bool select_recv;
+                    {
+                        TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+                        select_recv = lockRecv && (
+                            pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                            pnode->GetTotalRecvSize() <= ReceiveFloodSize());
+                    }
 
-                bool select_recv;
-                {
-                    TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                    select_recv = lockRecv && (
-                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
-                        pnode->GetTotalRecvSize() <= ReceiveFloodSize());
+                    if (select_send) {
+                        nInterest = SOCKET_EVENT_SEND;
+                    } else if (select_recv) {
+                        nInterest = SOCKET_EVENT_RECV;
+                    }
                 }
 
                 LOCK(pnode->cs_hSocket);
+                if (pnode->hSocketEvents != INVALID_SOCKET && pnode->hSocketEvents != pnode->hSocket) {
+                    // closed by another thread
+                    forgetSocket(pnode);
+                }
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
 
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
-                have_fds = true;
-
-                if (select_send) {
-                    FD_SET(pnode->hSocket, &fdsetSend);
-                    continue;
+                if (pnode->hSocketEvents == INVALID_SOCKET) {
+                    if (!socketEvents->Add(pnode->hSocket, false)) {
+                        LogPrintf("Cannot wait for socket of peer=%d: %s\n", pnode->id, NetworkErrorString(WSAGetLastError()));
+                        pnode->fDisconnect = true;
+                        continue;
+                    }
+                    pnode->hSocketEvents = pnode->hSocket;
+                    mapSocketNodes[pnode->hSocket] = pnode;
                 }
-                if (select_recv) {
-                    FD_SET(pnode->hSocket, &fdsetRecv);
+                if (!fEdgeTriggered) {
+                    socketEvents->SetInterest(pnode->hSocket, nInterest);
+                    // readiness is only what the next wait reports
+                    pnode->fSocketRecvReady = false;
+                    pnode->fSocketSendReady = false;
                 }
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        boost::this_thread::interruption_point();
-
-        if (nSelect == SOCKET_ERROR)
+        const int64_t nTimeoutMs = fMoreWork ? 0 : 50; // frequency to poll pnode->vSend
+        fMoreWork = false;
+        std::vector<std::pair<SOCKET, uint8_t>> vReady;
+        if (!socketEvents->Wait(nTimeoutMs, vReady))
         {
-            if (have_fds)
-            {
-                int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
-            }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
+            int nErr = WSAGetLastError();
+            LogPrintf("socket %s error %s\n", GetSocketEventsModeName(socketEvents->GetMode()), NetworkErrorString(nErr));
+            vReady.clear();
+            MilliSleep(nTimeoutMs);
         }
+        boost::this_thread::interruption_point();
 
         //
-        // Accept new connections
+        // Accept new connections, and note which nodes are ready
         //
-        for (const ListenSocket& hListenSocket : vhListenSocket)
+        for (const std::pair<SOCKET, uint8_t>& ready : vReady)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            auto it = mapSocketNodes.find(ready.first);
+            if (it != mapSocketNodes.end()) {
+                CNode* pnode = it->second;
+                if (ready.second & (SOCKET_EVENT_RECV | SOCKET_EVENT_ERR))
+                    pnode->fSocketRecvReady = true;
+                if (ready.second & SOCKET_EVENT_SEND)
+                    pnode->fSocketSendReady = true;
+                continue;
+            }
+            for (const ListenSocket& hListenSocket : vhListenSocket)
             {
-                AcceptConnection(hListenSocket);
+                if (hListenSocket.socket != INVALID_SOCKET && hListenSocket.socket == ready.first)
+                {
+                    AcceptConnection(hListenSocket);
+                }
             }
         }
 
@@ -1273,24 +1416,27 @@ void ThreadSocketHandler()
 
             auto spanGuard = pnode->span.Enter();
 
-            //
-            // Receive
-            //
-            bool recvSet = false;
-            bool sendSet = false;
-            bool errorSet = false;
             {
                 LOCK(pnode->cs_hSocket);
                 if (pnode->hSocket == INVALID_SOCKET)
                     continue;
-                recvSet = FD_ISSET(pnode->hSocket, &fdsetRecv);
-                sendSet = FD_ISSET(pnode->hSocket, &fdsetSend);
-                errorSet = FD_ISSET(pnode->hSocket, &fdsetError);
             }
-            if (recvSet || errorSet)
+
+            bool fSendPending;
+            {
+                LOCK(pnode->cs_vSend);
+                fSendPending = !pnode->vSendMsg.empty();
+            }
+
+            //
+            // Receive
+            //
+            if (pnode->fSocketRecvReady && !(fEdgeTriggered && fSendPending))
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
+                if (lockRecv && (!fEdgeTriggered ||
+                        pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
+                        pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
                 {
                     {
                         // typical socket buffer is 8K-64K
@@ -1312,6 +1458,9 @@ void ThreadSocketHandler()
                                 pnode->nRecvBytes += nBytes;
                             }
                             pnode->RecordBytesRecv(nBytes);
+                            // a full buffer means there is likely more to read
+                            if (fEdgeTriggered && nBytes == (int)sizeof(pchBuf))
+                                fMoreWork = true;
                         }
                         else if (nBytes == 0)
                         {
@@ -1324,7 +1473,12 @@ void ThreadSocketHandler()
                         {
                             // error
                             int nErr = WSAGetLastError();
-                            if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+                            if (nErr == WSAEWOULDBLOCK)
+                            {
+                                // drained; wait for more data to arrive
+                                pnode->fSocketRecvReady = false;
+                            }
+                            else if (nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
                             {
                                 if (!pnode->fDisconnect)
                                     LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
@@ -1338,10 +1492,21 @@ void ThreadSocketHandler()
             //
             // Send
             //
-            if (sendSet)
+            if (pnode->fSocketSendReady && fSendPending)
             {
                 LOCK(pnode->cs_vSend);
-                SocketSendData(pnode);
+                size_t nSent = SocketSendData(pnode);
+                if (!pnode->vSendMsg.empty()) {
+                    if (nSent == 0) {
+                        // the socket buffer is full; wait until it drains
+                        pnode->fSocketSendReady = false;
+                    } else if (fEdgeTriggered) {
+                        fMoreWork = true;
+                    }
+                } else if (fEdgeTriggered && pnode->fSocketRecvReady) {
+                    // receiving was held off until the send buffer drained
+                    fMoreWork = true;
+                }
             }
 
             //
@@ -1670,8 +1835,17 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 }
 
 
-void ThreadMessageHandler()
+/**
+ * Process the messages of the peers whose id is nWorker modulo nWorkers.
+ *
+ * Keeping a peer on one thread keeps its messages in order, and lets the
+ * other threads serve their peers while a message takes long to process,
+ * e.g. a getdata for blocks that have to be read from disk. Handlers that
+ * change chain or mempool state are still serialized on cs_main.
+ */
+void ThreadMessageHandler(int nWorker, int nWorkers)
 {
+    ApplyThreadAffinity("msghand");
     const CChainParams& chainparams = Params();
     boost::mutex condition_mutex;
     boost::unique_lock<boost::mutex> lock(condition_mutex);
@@ -1682,14 +1856,36 @@ void ThreadMessageHandler()
         vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
-                pnode->AddRef();
+            for (CNode* pnode : vNodes) {
+                if (pnode->id % nWorkers == nWorker) {
+                    pnode->AddRef();
+                    vNodesCopy.push_back(pnode);
+                }
             }
         }
 
         bool fSleep = true;
 
+        auto receiveMessages = [&](CNode* pnode) {
+            TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
+            if (lockRecv)
+            {
+                if (!g_signals.ProcessMessages(chainparams, pnode))
+                    pnode->CloseSocketDisconnect();
+
+                if (pnode->nSendSize < SendBufferSize() && !pnode->fServingBlock)
+                {
+                    if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
+                    {
+                        fSleep = false;
+                    }
+                }
+            }
+        };
+        // The peers that have used up their processing budget, whose
+        // messages are only processed once no other peer has any left.
+        vector<CNode*> vDeprioritized;
+
         for (CNode* pnode : vNodesCopy)
         {
             if (pnode->fDisconnect)
@@ -1698,22 +1894,10 @@ void ThreadMessageHandler()
             auto spanGuard = pnode->span.Enter();
 
             // Receive messages
-            {
-                TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
-                if (lockRecv)
-                {
-                    if (!g_signals.ProcessMessages(chainparams, pnode))
-                        pnode->CloseSocketDisconnect();
-
-                    if (pnode->nSendSize < SendBufferSize())
-                    {
-                        if (!pnode->vRecvGetData.empty() || (!pnode->vRecvMsg.empty() && pnode->vRecvMsg[0].complete()))
-                        {
-                            fSleep = false;
-                        }
-                    }
-                }
-            }
+            if (pnode->IsOverProcessingBudget())
+                vDeprioritized.push_back(pnode);
+            else
+                receiveMessages(pnode);
             boost::this_thread::interruption_point();
 
             // Send messages
@@ -1724,6 +1908,16 @@ void ThreadMessageHandler()
             boost::this_thread::interruption_point();
         }
 
+        if (fSleep) {
+            for (CNode* pnode : vDeprioritized) {
+                if (pnode->fDisconnect)
+                    continue;
+                auto spanGuard = pnode->span.Enter();
+                receiveMessages(pnode);
+                boost::this_thread::interruption_point();
+            }
+        }
+
         {
             LOCK(cs_vNodes);
             for (CNode* pnode : vNodesCopy)
@@ -1762,7 +1956,7 @@ bool BindListenPort(const CService &addrBind, string& strError, bool fWhiteliste
         LogPrintf("%s\n", strError);
         return false;
     }
-    if (!IsSelectableSocket(hListenSocket))
+    if (!IsUsableSocket(hListenSocket, socketEventsMode))
     {
         strError = "Error: Couldn't create a listenable socket for incoming connections";
         LogPrintf("%s\n", strError);
@@ -1889,7 +2083,7 @@ void static Discover(boost::thread_group& threadGroup)
 #endif
 }
 
-void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
+void LoadAddresses()
 {
     uiInterface.InitMessage(_("Loading addresses..."));
     // Load addresses from peers.dat
@@ -1928,7 +2122,10 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
         CNode::SetBannedSetDirty(true); // force write
         DumpBanlist();
     }
+}
 
+void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
+{
     uiInterface.InitMessage(_("Starting network threads..."));
 
     fAddressesInitialized = true;
@@ -1964,10 +2161,13 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
         threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()>>, "msghand",
+            boost::function<void()>(boost::bind(&ThreadMessageHandler, i, nMessageHandlerThreads))));
+    }
 
-    // Dump network addresses
-    scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
+    // Dump network addresses; writing a large address manager takes a while
+    scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL, true);
 }
 
 bool StopNode()
@@ -2033,10 +2233,16 @@ instance_of_cnetcleanup;
 
 void RelayTransaction(const CTransaction& tx)
 {
+    const WTxId wtxid = tx.GetWTxId();
     LOCK(cs_vNodes);
     for (CNode* pnode : vNodes)
     {
-        pnode->PushTxInventory(tx.GetWTxId());
+        if (pnode->IsTxKnown(wtxid))
+            continue;
+        // Peers we reconcile with learn of the transaction at the next
+        // reconciliation, unless we flood to them.
+        if (!txReconciliation.AddToSet(pnode->GetId(), wtxid))
+            pnode->PushTxInventory(wtxid);
     }
 }
 
@@ -2190,6 +2396,8 @@ void CNode::Fuzz(int nChance)
 unsigned int ReceiveFloodSize() { return 1000*GetArg("-maxreceivebuffer", DEFAULT_MAXRECEIVEBUFFER); }
 unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", DEFAULT_MAXSENDBUFFER); }
 
+void WakeMessageHandler() { messageHandlerCondition.notify_all(); }
+
 CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNameIn, bool fInboundIn) :
     ssSend(SER_NETWORK, INIT_PROTO_VERSION),
     nTimeConnected(GetTime()),
@@ -2235,7 +2443,19 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nPingUsecStart = 0;
     nPingUsecTime = 0;
     fPingQueued = false;
+    fServingBlock = false;
+    fSupportsCompactBlocks = false;
+    fPreferCompactBlocks = false;
+    minFeeFilter = 0;
+    lastSentFeeFilter = 0;
+    nextSendTimeFeeFilter = 0;
+    hSocketEvents = INVALID_SOCKET;
+    fSocketRecvReady = false;
+    fSocketSendReady = false;
     nMinPingUsecTime = std::numeric_limits<int64_t>::max();
+    nProcessingUsec = 0;
+    nProcessingBudgetUsec = nMaxPeerProcessing * 1000 * PEER_PROCESSING_BURST_SECONDS;
+    nProcessingBudgetTime = GetTimeMicros();
 
     {
         LOCK(cs_nLastNodeId);
@@ -2352,32 +2572,64 @@ void CNode::EndMessage() UNLOCK_FUNCTION(cs_vSend)
         LEAVE_CRITICAL_SECTION(cs_vSend);
         return;
     }
-    // Set the size
-    unsigned int nSize = ssSend.size() - CMessageHeader::HEADER_SIZE;
-    WriteLE32((uint8_t*)&ssSend[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
+    LogPrint("net", "(%d bytes) peer=%d\n", ssSend.size() - CMessageHeader::HEADER_SIZE, id);
 
-    // Set the checksum
-    uint256 hash = Hash(ssSend.begin() + CMessageHeader::HEADER_SIZE, ssSend.end());
-    assert(ssSend.size () >= CMessageHeader::CHECKSUM_OFFSET + CMessageHeader::CHECKSUM_SIZE);
-    memcpy((char*)&ssSend[CMessageHeader::CHECKSUM_OFFSET], hash.begin(), CMessageHeader::CHECKSUM_SIZE);
-
-    LogPrint("net", "(%d bytes) peer=%d\n", nSize, id);
-
-    std::deque<CSerializeData>::iterator it = vSendMsg.insert(vSendMsg.end(), CSerializeData());
-    ssSend.GetAndClear(*it);
-    nSendSize += (*it).size();
+    // Move the message into a pooled buffer, and continue with the emptied
+    // one, so that neither the message nor its buffer is copied.
+    vSendMsg.emplace_back();
+    CSerializeData& data = vSendMsg.back().data;
+    if (!vSendBufferPool.empty()) {
+        data.swap(vSendBufferPool.back());
+        vSendBufferPool.pop_back();
+    }
+    ssSend.SwapAndClear(data);
+    FinalizeMessage(data);
+    nSendSize += data.size();
     MetricsCounter(
-        "zcash.net.out.bytes", (*it).size(),
+        "zcash.net.out.bytes", data.size(),
         "command", strSendCommand.c_str());
     strSendCommand.clear();
 
     // If write queue empty, attempt "optimistic write"
-    if (it == vSendMsg.begin())
+    if (vSendMsg.size() == 1)
         SocketSendData(this);
 
     LEAVE_CRITICAL_SECTION(cs_vSend);
 }
 
+/* static */ unsigned int CNode::FinalizeMessage(CSerializeData& msg)
+{
+    // Set the size
+    unsigned int nSize = msg.size() - CMessageHeader::HEADER_SIZE;
+    WriteLE32((uint8_t*)&msg[CMessageHeader::MESSAGE_SIZE_OFFSET], nSize);
+
+    // Set the checksum
+    uint256 hash = Hash(msg.begin() + CMessageHeader::HEADER_SIZE, msg.end());
+    assert(msg.size() >= CMessageHeader::CHECKSUM_OFFSET + CMessageHeader::CHECKSUM_SIZE);
+    memcpy((char*)&msg[CMessageHeader::CHECKSUM_OFFSET], hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+
+    return nSize;
+}
+
+void CNode::PushSharedMessage(const char* pszCommand, std::shared_ptr<const CSerializeData> msg)
+{
+    LOCK(cs_vSend);
+    std::string strCommand = SanitizeString(pszCommand);
+    LogPrint("net", "sending: %s (%d bytes) peer=%d\n", strCommand, msg->size() - CMessageHeader::HEADER_SIZE, id);
+    MetricsIncrementCounter("zcash.net.out.messages", "command", strCommand.c_str());
+    MetricsCounter(
+        "zcash.net.out.bytes", msg->size(),
+        "command", strCommand.c_str());
+
+    nSendSize += msg->size();
+    vSendMsg.emplace_back();
+    vSendMsg.back().shared = std::move(msg);
+
+    // If write queue empty, attempt "optimistic write"
+    if (vSendMsg.size() == 1)
+        SocketSendData(this);
+}
+
 /* static */ uint64_t CNode::CalculateKeyedNetGroup(const CAddress& ad)
 {
     static const uint64_t k0 = GetRand(std::numeric_limits<uint64_t>::max());
@@ -8,13 +8,16 @@
 #define BITCOIN_NET_H
 
 #include "addrdb.h"
+#include "amount.h"
 #include "bloom.h"
 #include "compat.h"
 #include "fs.h"
+#include "hash.h"
 #include "limitedmap.h"
 #include "netbase.h"
 #include "protocol.h"
 #include "random.h"
+#include "socketevents.h"
 #include "streams.h"
 #include "sync.h"
 #include "uint256.h"
@@ -23,6 +26,7 @@
 
 #include <atomic>
 #include <deque>
+#include <memory>
 #include <stdint.h>
 
 #ifndef WIN32
@@ -76,11 +80,29 @@ static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
 
+/**
+ * The default number of message handler threads. Each peer is always served
+ * by the same thread, so its messages are still processed in order.
+ */
+static const int DEFAULT_MESSAGE_HANDLER_THREADS = 4;
+/** The maximum number of message handler threads. */
+static const int MAX_MESSAGE_HANDLER_THREADS = 16;
+/**
+ * The default for -maxpeerprocessing, the milliseconds of CPU time per
+ * second that processing the messages of a peer may take on average before
+ * they are deprioritized (0 for no limit).
+ */
+static const int64_t DEFAULT_MAX_PEER_PROCESSING = 0;
+/** How many seconds' worth of -maxpeerprocessing a peer may use at once. */
+static const int64_t PEER_PROCESSING_BURST_SECONDS = 10;
+
 // NOTE: When adjusting this, update rpcnet:setban's help ("24h")
 static const unsigned int DEFAULT_MISBEHAVING_BANTIME = 60 * 60 * 24;  // Default 24-hour ban
 
 unsigned int ReceiveFloodSize();
 unsigned int SendBufferSize();
+/** Let the message handlers know that a peer has messages ready to process again. */
+void WakeMessageHandler();
 
 void AddOneShot(const std::string& strDest);
 void AddressCurrentlyConnected(const CService& addr);
@@ -92,12 +114,29 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest = NULL);
 bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOutbound = NULL, const char *strDest = NULL, bool fOneShot = false);
 unsigned short GetListenPort();
 bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
+/**
+ * Load the known addresses (peers.dat) and the banned ones (banlist.dat), which
+ * StartNode expects to have been done.
+ */
+void LoadAddresses();
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
-void SocketSendData(CNode *pnode);
+size_t SocketSendData(CNode *pnode);
 
 typedef int NodeId;
 
+/**
+ * A message queued for sending to a peer: either a buffer of its own, or a
+ * serialized message shared with other peers it is also sent to.
+ */
+struct CNetSendMessage
+{
+    CSerializeData data;
+    std::shared_ptr<const CSerializeData> shared;
+
+    const CSerializeData& Get() const { return shared ? *shared : data; }
+};
+
 struct CombinerAll
 {
     typedef bool result_type;
@@ -162,6 +201,12 @@ extern CAddrMan addrman;
 
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
 extern int nMaxConnections;
+/** How the socket handler thread waits for peer sockets (-socketevents) */
+extern SocketEventsMode socketEventsMode;
+/** Number of threads processing peer messages (-msghandlerthreads) */
+extern int nMessageHandlerThreads;
+/** Milliseconds of CPU time per second each peer's messages may take (-maxpeerprocessing) */
+extern int64_t nMaxPeerProcessing;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -204,6 +249,7 @@ public:
     bool fWhitelisted;
     double dPingTime;
     double dPingWait;
+    double dProcessingTime;
     std::string addrLocal;
 };
 
@@ -211,6 +257,9 @@ public:
 
 
 class CNetMessage {
+private:
+    mutable CHash256 hasher;        // hash of the data received so far
+    mutable uint256 data_hash;      // set once the message is complete
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
@@ -244,6 +293,10 @@ public:
         vRecv.SetVersion(nVersionIn);
     }
 
+    //! The double SHA-256 of the message data, which is hashed as it is
+    //! received. Only valid once the message is complete.
+    const uint256& GetMessageHash() const;
+
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
 };
@@ -261,14 +314,26 @@ public:
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes;
-    std::deque<CSerializeData> vSendMsg;
+    std::deque<CNetSendMessage> vSendMsg;
+    // Emptied buffers of sent messages, reused for the next ones (protected by cs_vSend)
+    std::vector<CSerializeData> vSendBufferPool;
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
+    // Only used by the socket handler thread: the socket as registered with
+    // the socket event backend, and whether it was last reported ready to
+    // receive or send and has not blocked since.
+    SOCKET hSocketEvents;
+    bool fSocketRecvReady;
+    bool fSocketSendReady;
     CCriticalSection cs_vRecv;
 
     CCriticalSection cs_sendProcessing;
 
     std::deque<CInv> vRecvGetData;
+    //! Set while a block this peer requested is being sent by a block serving
+    //! thread (see -blockservethreads). Its requests and messages are only
+    //! processed after that, to keep the responses in order.
+    std::atomic<bool> fServingBlock;
     std::deque<CNetMessage> vRecvMsg;
     CCriticalSection cs_vRecvMsg;
     uint64_t nRecvBytes;
@@ -332,9 +397,13 @@ public:
     std::atomic<int> nStartingHeight;
 
     // flood relay
+    // Protected by cs_vAddrToSend, as other peers' message handlers relay
+    // addresses to this one.
     std::vector<CAddress> vAddrToSend;
     CRollingBloomFilter addrKnown;
+    CCriticalSection cs_vAddrToSend;
     bool fGetAddr;
+    // Alerts known to the peer, protected by cs_vNodes.
     std::set<uint256> setKnown;
     int64_t nNextAddrSend;
     int64_t nNextLocalAddrSend;
@@ -369,6 +438,27 @@ public:
     // Whether a ping is requested.
     std::atomic<bool> fPingQueued;
 
+    // The CPU time (in usec) spent processing the peer's messages.
+    std::atomic<int64_t> nProcessingUsec;
+    // What is left of the peer's processing budget (see -maxpeerprocessing),
+    // and when it was last replenished. Only used by the thread that handles
+    // the peer's messages.
+    int64_t nProcessingBudgetUsec;
+    int64_t nProcessingBudgetTime;
+
+    // Compact block relay (BIP 152, with short IDs derived from wtxids):
+    // Whether the peer has told us with sendcmpct that it understands cmpctblock.
+    std::atomic<bool> fSupportsCompactBlocks;
+    // Whether the peer wants new blocks announced to it as cmpctblock messages.
+    std::atomic<bool> fPreferCompactBlocks;
+
+    // Fee filters (BIP 133): the fee rate (in zatoshis per 1000 bytes) below
+    // which the peer does not want transactions announced to it, and the one
+    // we last sent it and when we next consider sending ours.
+    std::atomic<CAmount> minFeeFilter;
+    CAmount lastSentFeeFilter;
+    int64_t nextSendTimeFeeFilter;
+
     CNode(SOCKET hSocketIn, const CAddress &addrIn, const std::string &addrNameIn = "", bool fInboundIn = false);
     ~CNode();
 
@@ -447,15 +537,22 @@ public:
         nRefCount--;
     }
 
+    /** Account for CPU time spent processing the peer's messages. */
+    void ChargeProcessing(int64_t nUsec);
+    /** Whether the peer has used up its -maxpeerprocessing budget. */
+    bool IsOverProcessingBudget();
+
 
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(addr.GetKey());
     }
 
     void PushAddress(const CAddress& addr, FastRandomContext &insecure_rand)
     {
+        LOCK(cs_vAddrToSend);
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
@@ -477,6 +574,12 @@ public:
         }
     }
 
+    bool IsTxKnown(const WTxId& wtxid)
+    {
+        LOCK(cs_inventory);
+        return filterInventoryKnown.contains(wtxid.ToBytes());
+    }
+
     void PushTxInventory(const WTxId& wtxid)
     {
         LOCK(cs_inventory);
@@ -502,6 +605,29 @@ public:
     // TODO: Document the precondition of this function.  Is cs_vSend locked?
     void EndMessage() UNLOCK_FUNCTION(cs_vSend);
 
+    //! Set the size and checksum in the header of a serialized message, and
+    //! return the size of its payload.
+    static unsigned int FinalizeMessage(CSerializeData& msg);
+
+    /**
+     * Serialize a message once, to send it to several peers with
+     * PushSharedMessage instead of serializing it again for each of them.
+     * Only for messages whose serialization is the same for every peer.
+     */
+    template<typename T1>
+    static std::shared_ptr<const CSerializeData> MakeSharedMessage(const char* pszCommand, const T1& a1)
+    {
+        CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+        ss.reserve(CMessageHeader::HEADER_SIZE + GetSerializeSize(a1, SER_NETWORK, PROTOCOL_VERSION));
+        ss << CMessageHeader(Params().MessageStart(), pszCommand, 0) << a1;
+        std::shared_ptr<CSerializeData> msg = std::make_shared<CSerializeData>();
+        ss.SwapAndClear(*msg);
+        FinalizeMessage(*msg);
+        return msg;
+    }
+
+    void PushSharedMessage(const char* pszCommand, std::shared_ptr<const CSerializeData> msg);
+
     void PushVersion();
 
 
@@ -11,6 +11,35 @@
 #include "txmempool.h"
 #include "util/system.h"
 
+#include <algorithm>
+
+/** Below this, the moving averages are normalized (every ~10000 blocks at the default decay) */
+static const double MIN_AVG_SCALE = 1e-9;
+
+FeeEstimateType GetFeeEstimateType(const CTransaction& tx)
+{
+    if (tx.GetOrchardBundle().GetNumActions() > 0) {
+        return FEE_ESTIMATE_ORCHARD;
+    }
+    if (!tx.vShieldedSpend.empty() || !tx.vShieldedOutput.empty() || !tx.vJoinSplit.empty()) {
+        return FEE_ESTIMATE_SAPLING;
+    }
+    return FEE_ESTIMATE_TRANSPARENT;
+}
+
+static const char* const FEE_ESTIMATE_TYPE_NAMES[NUM_FEE_ESTIMATE_TYPES] = {"transparent", "sapling", "orchard"};
+
+bool ParseFeeEstimateType(const std::string& name, FeeEstimateType& type)
+{
+    for (int i = 0; i < NUM_FEE_ESTIMATE_TYPES; i++) {
+        if (name == FEE_ESTIMATE_TYPE_NAMES[i]) {
+            type = (FeeEstimateType)i;
+            return true;
+        }
+    }
+    return false;
+}
+
 void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
                                 unsigned int maxConfirms, double _decay, std::string _dataTypeString)
 {
@@ -20,10 +49,6 @@ void TxConfirmStats::Initialize(std::vector<double>& defaultBuckets,
     buckets.insert(buckets.end(), defaultBuckets.begin(), defaultBuckets.end());
     buckets.push_back(std::numeric_limits<double>::infinity());
 
-    for (unsigned int i = 0; i < buckets.size(); i++) {
-        bucketMap[buckets[i]] = i;
-    }
-
     confAvg.resize(maxConfirms);
     curBlockConf.resize(maxConfirms);
     unconfTxs.resize(maxConfirms);
@@ -46,18 +71,22 @@ void TxConfirmStats::ClearCurrent(unsigned int nBlockHeight)
     for (unsigned int j = 0; j < buckets.size(); j++) {
         oldUnconfTxs[j] += unconfTxs[nBlockHeight%unconfTxs.size()][j];
         unconfTxs[nBlockHeight%unconfTxs.size()][j] = 0;
+    }
+    // Only the buckets that saw transactions have anything to clear.
+    for (unsigned int j : curBlockBuckets) {
         for (unsigned int i = 0; i < curBlockConf.size(); i++)
             curBlockConf[i][j] = 0;
         curBlockTxCt[j] = 0;
         curBlockVal[j] = 0;
     }
+    curBlockBuckets.clear();
 }
 
 unsigned int TxConfirmStats::FindBucketIndex(double val)
 {
-    auto it = bucketMap.lower_bound(val);
-    assert(it != bucketMap.end());
-    return it->second;
+    auto it = std::lower_bound(buckets.begin(), buckets.end(), val);
+    assert(it != buckets.end());
+    return it - buckets.begin();
 }
 
 void TxConfirmStats::Record(int blocksToConfirm, double val)
@@ -69,18 +98,36 @@ void TxConfirmStats::Record(int blocksToConfirm, double val)
     for (size_t i = blocksToConfirm; i <= curBlockConf.size(); i++) {
         curBlockConf[i - 1][bucketindex]++;
     }
+    if (curBlockTxCt[bucketindex] == 0)
+        curBlockBuckets.push_back(bucketindex);
     curBlockTxCt[bucketindex]++;
     curBlockVal[bucketindex] += val;
 }
 
 void TxConfirmStats::UpdateMovingAverages()
+{
+    // Decay every average at once, then add the current block's data to
+    // the buckets it touched, in stored units.
+    avgScale *= decay;
+    for (unsigned int j : curBlockBuckets) {
+        for (unsigned int i = 0; i < confAvg.size(); i++)
+            confAvg[i][j] += curBlockConf[i][j] / avgScale;
+        avg[j] += curBlockVal[j] / avgScale;
+        txCtAvg[j] += curBlockTxCt[j] / avgScale;
+    }
+    if (avgScale < MIN_AVG_SCALE)
+        NormalizeAverages();
+}
+
+void TxConfirmStats::NormalizeAverages()
 {
     for (unsigned int j = 0; j < buckets.size(); j++) {
         for (unsigned int i = 0; i < confAvg.size(); i++)
-            confAvg[i][j] = confAvg[i][j] * decay + curBlockConf[i][j];
-        avg[j] = avg[j] * decay + curBlockVal[j];
-        txCtAvg[j] = txCtAvg[j] * decay + curBlockTxCt[j];
+            confAvg[i][j] *= avgScale;
+        avg[j] *= avgScale;
+        txCtAvg[j] *= avgScale;
     }
+    avgScale = 1;
 }
 
 // returns -1 on error conditions
@@ -118,8 +165,8 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     // Start counting from highest(default) or lowest fee/pri transactions
     for (int bucket = startbucket; bucket >= 0 && bucket <= maxbucketindex; bucket += step) {
         curFarBucket = bucket;
-        nConf += confAvg[confTarget - 1][bucket];
-        totalNum += txCtAvg[bucket];
+        nConf += GetAvg(confAvg[confTarget - 1][bucket]);
+        totalNum += GetAvg(txCtAvg[bucket]);
         for (unsigned int confct = confTarget; confct < GetMaxConfirms(); confct++)
             extraNum += unconfTxs[(nBlockHeight - confct)%bins][bucket];
         extraNum += oldUnconfTxs[bucket];
@@ -157,6 +204,7 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
     // Find the bucket with the median transaction and then report the average fee from that bucket
     // This is a compromise between finding the median which we can't since we don't save all tx's
     // and reporting the average which is less accurate
+    // (The sums below are all in stored units, which does not change their ratios.)
     unsigned int minBucket = bestNearBucket < bestFarBucket ? bestNearBucket : bestFarBucket;
     unsigned int maxBucket = bestNearBucket > bestFarBucket ? bestNearBucket : bestFarBucket;
     for (unsigned int j = minBucket; j <= maxBucket; j++) {
@@ -184,6 +232,7 @@ double TxConfirmStats::EstimateMedianVal(int confTarget, double sufficientTxVal,
 
 void TxConfirmStats::Write(CAutoFile& fileout)
 {
+    NormalizeAverages();
     fileout << decay;
     fileout << buckets;
     fileout << avg;
@@ -209,6 +258,10 @@ void TxConfirmStats::Read(CAutoFile& filein)
     numBuckets = fileBuckets.size();
     if (numBuckets <= 1 || numBuckets > 1000)
         throw std::runtime_error("Corrupt estimates file. Must have between 2 and 1000 fee/pri buckets");
+    for (unsigned int i = 1; i < numBuckets; i++) {
+        if (!(fileBuckets[i - 1] < fileBuckets[i]))
+            throw std::runtime_error("Corrupt estimates file. Fee/pri buckets must be increasing");
+    }
     filein >> fileAvg;
     if (fileAvg.size() != numBuckets)
         throw std::runtime_error("Corrupt estimates file. Mismatch in fee/pri average bucket count");
@@ -230,16 +283,17 @@ void TxConfirmStats::Read(CAutoFile& filein)
     avg = fileAvg;
     confAvg = fileConfAvg;
     txCtAvg = fileTxCtAvg;
-    bucketMap.clear();
+    avgScale = 1;
 
     // Resize the current block variables which aren't stored in the data file
     // to match the number of confirms and buckets
     curBlockConf.resize(maxConfirms);
     for (unsigned int i = 0; i < maxConfirms; i++) {
-        curBlockConf[i].resize(buckets.size());
+        curBlockConf[i].assign(buckets.size(), 0);
     }
-    curBlockTxCt.resize(buckets.size());
-    curBlockVal.resize(buckets.size());
+    curBlockTxCt.assign(buckets.size(), 0);
+    curBlockVal.assign(buckets.size(), 0);
+    curBlockBuckets.clear();
 
     unconfTxs.resize(maxConfirms);
     for (unsigned int i = 0; i < maxConfirms; i++) {
@@ -247,9 +301,6 @@ void TxConfirmStats::Read(CAutoFile& filein)
     }
     oldUnconfTxs.resize(buckets.size());
 
-    for (unsigned int i = 0; i < buckets.size(); i++)
-        bucketMap[buckets[i]] = i;
-
     LogPrint("estimatefee", "Reading estimates: %u %s buckets counting confirms up to %u blocks\n",
              numBuckets, dataTypeString, maxConfirms);
 }
@@ -300,16 +351,19 @@ void CBlockPolicyEstimator::removeTx(uint256 hash)
         return;
     }
     TxConfirmStats *stats = pos->second.stats;
+    TxConfirmStats *typeStats = pos->second.typeStats;
     unsigned int entryHeight = pos->second.blockHeight;
     unsigned int bucketIndex = pos->second.bucketIndex;
 
     if (stats != NULL)
         stats->removeTx(entryHeight, nBestSeenHeight, bucketIndex);
-    mapMemPoolTxs.erase(hash);
+    if (typeStats != NULL)
+        typeStats->removeTx(entryHeight, nBestSeenHeight, bucketIndex);
+    mapMemPoolTxs.erase(pos);
 }
 
 CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
-    : nBestSeenHeight(0)
+    : nBestSeenHeight(0), nFeeEstimateCacheHeight(0)
 {
     minTrackedFee = _minRelayFee < CFeeRate(MIN_FEERATE) ? CFeeRate(MIN_FEERATE) : _minRelayFee;
     std::vector<double> vfeelist;
@@ -317,6 +371,10 @@ CBlockPolicyEstimator::CBlockPolicyEstimator(const CFeeRate& _minRelayFee)
         vfeelist.push_back(bucketBoundary);
     }
     feeStats.Initialize(vfeelist, MAX_BLOCK_CONFIRMS, DEFAULT_DECAY, "FeeRate");
+    for (int i = 0; i < NUM_FEE_ESTIMATE_TYPES; i++) {
+        typeFeeStats[i].Initialize(vfeelist, MAX_BLOCK_CONFIRMS, DEFAULT_DECAY,
+                                   strprintf("FeeRate(%s)", FEE_ESTIMATE_TYPE_NAMES[i]));
+    }
 
     minTrackedPriority = AllowFreeThreshold() < MIN_PRIORITY ? MIN_PRIORITY : AllowFreeThreshold();
     std::vector<double> vprilist;
@@ -394,8 +452,11 @@ void CBlockPolicyEstimator::processTransaction(const CTxMemPoolEntry& entry, boo
     }
     // Record this as a fee estimate
     else if (isFeeDataPoint(feeRate, curPri)) {
+        TxConfirmStats* typeStats = &typeFeeStats[GetFeeEstimateType(entry.GetTx())];
         mapMemPoolTxs[hash].stats = &feeStats;
+        mapMemPoolTxs[hash].typeStats = typeStats;
         mapMemPoolTxs[hash].bucketIndex = feeStats.NewTx(txHeight, (double)feeRate.GetFeePerK());
+        typeStats->NewTx(txHeight, (double)feeRate.GetFeePerK());
     }
     else {
         LogPrint("estimatefee", "not adding");
@@ -437,6 +498,7 @@ void CBlockPolicyEstimator::processBlockTx(unsigned int nBlockHeight, const CTxM
     // Record this as a fee estimate
     else if (isFeeDataPoint(feeRate, curPri)) {
         feeStats.Record(blocksToConfirm, (double)feeRate.GetFeePerK());
+        typeFeeStats[GetFeeEstimateType(entry.GetTx())].Record(blocksToConfirm, (double)feeRate.GetFeePerK());
     }
 }
 
@@ -485,6 +547,8 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     // Clear the current block states
     feeStats.ClearCurrent(nBlockHeight);
     priStats.ClearCurrent(nBlockHeight);
+    for (TxConfirmStats& stats : typeFeeStats)
+        stats.ClearCurrent(nBlockHeight);
 
     // Repopulate the current block states
     for (unsigned int i = 0; i < entries.size(); i++)
@@ -493,23 +557,43 @@ void CBlockPolicyEstimator::processBlock(unsigned int nBlockHeight,
     // Update all exponential averages with the current block states
     feeStats.UpdateMovingAverages();
     priStats.UpdateMovingAverages();
+    for (TxConfirmStats& stats : typeFeeStats)
+        stats.UpdateMovingAverages();
 
     LogPrint("estimatefee", "Blockpolicy after updating estimates for %u confirmed entries, new mempool map size %u\n",
              entries.size(), mapMemPoolTxs.size());
 }
 
 CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget)
+{
+    return estimateFee(confTarget, feeStats, -1);
+}
+
+CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget, FeeEstimateType type)
+{
+    assert(type >= 0 && type < NUM_FEE_ESTIMATE_TYPES);
+    return estimateFee(confTarget, typeFeeStats[type], type);
+}
+
+CFeeRate CBlockPolicyEstimator::estimateFee(int confTarget, TxConfirmStats& stats, int cacheType)
 {
     // Return failure if trying to analyze a target we're not tracking
-    if (confTarget <= 0 || (unsigned int)confTarget > feeStats.GetMaxConfirms())
+    if (confTarget <= 0 || (unsigned int)confTarget > stats.GetMaxConfirms())
         return CFeeRate(0);
 
-    double median = feeStats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
+    if (nFeeEstimateCacheHeight != nBestSeenHeight) {
+        mapFeeEstimateCache.clear();
+        nFeeEstimateCacheHeight = nBestSeenHeight;
+    }
+    auto it = mapFeeEstimateCache.find(std::make_pair(cacheType, confTarget));
+    if (it != mapFeeEstimateCache.end())
+        return it->second;
 
-    if (median < 0)
-        return CFeeRate(0);
+    double median = stats.EstimateMedianVal(confTarget, SUFFICIENT_FEETXS, MIN_SUCCESS_PCT, true, nBestSeenHeight);
 
-    return CFeeRate(median);
+    CFeeRate feeRate = median < 0 ? CFeeRate(0) : CFeeRate(median);
+    mapFeeEstimateCache.insert(std::make_pair(std::make_pair(cacheType, confTarget), feeRate));
+    return feeRate;
 }
 
 double CBlockPolicyEstimator::estimatePriority(int confTarget)
@@ -526,6 +610,10 @@ void CBlockPolicyEstimator::Write(CAutoFile& fileout)
     fileout << nBestSeenHeight;
     feeStats.Write(fileout);
     priStats.Write(fileout);
+    // Older versions stop reading here.
+    fileout << (uint32_t)NUM_FEE_ESTIMATE_TYPES;
+    for (TxConfirmStats& stats : typeFeeStats)
+        stats.Write(fileout);
 }
 
 void CBlockPolicyEstimator::Read(CAutoFile& filein)
@@ -535,4 +623,26 @@ void CBlockPolicyEstimator::Read(CAutoFile& filein)
     feeStats.Read(filein);
     priStats.Read(filein);
     nBestSeenHeight = nFileBestSeenHeight;
+    mapFeeEstimateCache.clear();
+
+    // Files written by older versions have no estimates by type, which
+    // then start out empty.
+    uint32_t nTypes;
+    try {
+        filein >> nTypes;
+    } catch (const std::ios_base::failure&) {
+        return;
+    }
+    if (nTypes != NUM_FEE_ESTIMATE_TYPES)
+        throw std::runtime_error("Corrupt estimates file. Unexpected number of transaction types");
+    TxConfirmStats fileTypeFeeStats[NUM_FEE_ESTIMATE_TYPES];
+    for (int i = 0; i < NUM_FEE_ESTIMATE_TYPES; i++) {
+        fileTypeFeeStats[i] = typeFeeStats[i];
+        fileTypeFeeStats[i].Read(filein);
+        // Transactions are tracked under the same bucket index in both.
+        if (!fileTypeFeeStats[i].HasSameBuckets(feeStats))
+            throw std::runtime_error("Corrupt estimates file. Mismatch in fee buckets by transaction type");
+    }
+    for (int i = 0; i < NUM_FEE_ESTIMATE_TYPES; i++)
+        typeFeeStats[i] = fileTypeFeeStats[i];
 }
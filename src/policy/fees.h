@@ -10,14 +10,34 @@
 
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 static const CAmount DEFAULT_FEE = 1000;
 
 class CAutoFile;
 class CFeeRate;
+class CTransaction;
 class CTxMemPoolEntry;
 
+/**
+ * The kinds of transaction whose fees are also estimated on their own, as
+ * their sizes and fees (under ZIP 317) differ a lot between them.
+ */
+enum FeeEstimateType {
+    //! Transactions with only transparent inputs and outputs.
+    FEE_ESTIMATE_TRANSPARENT,
+    //! Transactions with Sapling (or Sprout) but no Orchard components.
+    FEE_ESTIMATE_SAPLING,
+    //! Transactions with Orchard actions.
+    FEE_ESTIMATE_ORCHARD,
+    NUM_FEE_ESTIMATE_TYPES
+};
+
+FeeEstimateType GetFeeEstimateType(const CTransaction& tx);
+/** Parses the name of a FeeEstimateType ("transparent", "sapling" or "orchard"). */
+bool ParseFeeEstimateType(const std::string& name, FeeEstimateType& type);
+
 /** \class CBlockPolicyEstimator
  * The BlockPolicyEstimator is used for estimating the fee or priority needed
  * for a transaction to be included in a block within a certain number of
@@ -86,8 +106,14 @@ class TxConfirmStats
 {
 private:
     //Define the buckets we will group transactions into (both fee buckets and priority buckets)
-    std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive)
-    std::map<double, unsigned int> bucketMap; // Map of bucket upper-bound to index into all vectors by bucket
+    std::vector<double> buckets;              // The upper-bound of the range for the bucket (inclusive), in increasing order
+
+    // The moving averages below are stored divided by avgScale, which is
+    // decay^(number of blocks since they were last normalized). Decaying
+    // every average for a new block is then a single multiplication of
+    // avgScale, and only the buckets that saw transactions in the block
+    // have to be updated. Use GetAvg() to read their actual values.
+    double avgScale = 1;
 
     // For each bucket X:
     // Count the total # of txs in each bucket
@@ -107,6 +133,8 @@ private:
     std::vector<double> avg;
     // and calculate the total for the current block to update the moving average
     std::vector<double> curBlockVal;
+    // The buckets with a nonzero curBlockTxCt
+    std::vector<unsigned int> curBlockBuckets;
 
     // Combine the conf counts with tx counts to calculate the confirmation % for each Y,X
     // Combine the total value with the tx counts to calculate the avg fee/priority per bucket
@@ -121,6 +149,10 @@ private:
     // transactions still unconfirmed after MAX_CONFIRMS for each bucket
     std::vector<int> oldUnconfTxs;
 
+    double GetAvg(double storedAvg) const { return storedAvg * avgScale; }
+    /** Fold avgScale into the stored averages, so that it is 1 again */
+    void NormalizeAverages();
+
 public:
     /** Find the bucket index of a given value */
     unsigned int FindBucketIndex(double val);
@@ -173,6 +205,9 @@ public:
     double EstimateMedianVal(int confTarget, double sufficientTxVal,
                              double minSuccess, bool requireGreater, unsigned int nBlockHeight);
 
+    /** Whether other groups transactions into the same buckets */
+    bool HasSameBuckets(const TxConfirmStats& other) const { return buckets == other.buckets; }
+
     /** Return the max number of confirms we're tracking */
     unsigned int GetMaxConfirms() { return confAvg.size(); }
 
@@ -248,9 +283,17 @@ public:
     /** Is this transaction likely included in a block because of its priority?*/
     bool isPriDataPoint(const CFeeRate &fee, double pri);
 
-    /** Return a fee estimate */
+    /**
+     * Return a fee estimate. Estimates are cached until the next block is
+     * processed: transactions that entered the mempool since then cannot
+     * have been waiting for a confirmation target yet, so only conflicts and
+     * evictions could change them in the meantime.
+     */
     CFeeRate estimateFee(int confTarget);
 
+    /** Return a fee estimate for transactions of the given type only */
+    CFeeRate estimateFee(int confTarget, FeeEstimateType type);
+
     /** Return a priority estimate */
     double estimatePriority(int confTarget);
 
@@ -267,9 +310,12 @@ private:
     struct TxStatsInfo
     {
         TxConfirmStats *stats;
+        //! The fee stats of the type of the transaction, if it is tracked
+        //! in feeStats. They use the same buckets.
+        TxConfirmStats *typeStats;
         unsigned int blockHeight;
         unsigned int bucketIndex;
-        TxStatsInfo() : stats(NULL), blockHeight(0), bucketIndex(0) {}
+        TxStatsInfo() : stats(NULL), typeStats(NULL), blockHeight(0), bucketIndex(0) {}
     };
 
     // map of txids to information about that transaction
@@ -277,6 +323,14 @@ private:
 
     /** Classes to track historical data on transaction confirmations */
     TxConfirmStats feeStats, priStats;
+    /** Fee stats for each FeeEstimateType */
+    TxConfirmStats typeFeeStats[NUM_FEE_ESTIMATE_TYPES];
+
+    /** Fee estimates as of nBestSeenHeight, by type (or -1 for all) and target */
+    std::map<std::pair<int, int>, CFeeRate> mapFeeEstimateCache;
+    unsigned int nFeeEstimateCacheHeight;
+
+    CFeeRate estimateFee(int confTarget, TxConfirmStats& stats, int cacheType);
 
     /** Breakpoints to help determine whether a transaction was confirmed by priority or Fee */
     CFeeRate feeLikely, feeUnlikely;
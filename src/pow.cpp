@@ -112,7 +112,8 @@ bool CheckEquihashSolution(const CBlockHeader *pblock, const Consensus::Params&
     // I = the block header minus nonce and solution.
     CEquihashInput I{*pblock};
     // I||V
-    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    static thread_local CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss.clear();
     ss << I;
 
     return equihash::is_valid(
@@ -122,6 +123,37 @@ bool CheckEquihashSolution(const CBlockHeader *pblock, const Consensus::Params&
         {pblock->nSolution.data(), pblock->nSolution.size()});
 }
 
+bool CheckEquihashSolutions(const std::vector<CBlockHeader>& headers, const Consensus::Params& params)
+{
+    if (headers.empty()) {
+        return true;
+    }
+
+    // The inputs, nonces and solutions are each passed as one buffer of
+    // equal-length chunks. Solutions of another length are not valid.
+    size_t nSolutionSize = headers[0].nSolution.size();
+    CDataStream ssInputs(SER_NETWORK, PROTOCOL_VERSION);
+    std::vector<unsigned char> vNonces, vSolutions;
+    vNonces.reserve(headers.size() * 32);
+    vSolutions.reserve(headers.size() * nSolutionSize);
+    for (const CBlockHeader& header : headers) {
+        if (header.nSolution.size() != nSolutionSize) {
+            return false;
+        }
+        ssInputs << CEquihashInput{header};
+        vNonces.insert(vNonces.end(), header.nNonce.begin(), header.nNonce.end());
+        vSolutions.insert(vSolutions.end(), header.nSolution.begin(), header.nSolution.end());
+    }
+
+    std::vector<uint8_t> vValid(headers.size());
+    return equihash::is_valid_batch(
+        params.nEquihashN, params.nEquihashK,
+        {(const unsigned char*)ssInputs.data(), ssInputs.size()},
+        {vNonces.data(), vNonces.size()},
+        {vSolutions.data(), vSolutions.size()},
+        {vValid.data(), vValid.size()});
+}
+
 bool CheckProofOfWork(uint256 hash, unsigned int nBits, const Consensus::Params& params)
 {
     bool fNegative;
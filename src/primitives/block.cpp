@@ -10,6 +10,7 @@
 #include "tinyformat.h"
 #include "util/strencodings.h"
 #include "crypto/common.h"
+#include "crypto/sha256.h"
 
 #include <rust/constants.h>
 
@@ -37,6 +38,55 @@ uint256 CBlockHeader::GetHash() const
     return SerializeHash(*this);
 }
 
+/**
+ * Compute a Merkle root a level at a time, in place: the pairs of a level are
+ * adjacent, so each level is hashed with one call to hashPairs, and written
+ * over the start of the level below it. A last hash without a pair is hashed
+ * with itself. Sets *fMutated as BuildMerkleTree does.
+ */
+template <typename HashPairs>
+static uint256 ComputeMerkleRootInPlace(std::vector<uint256>& hashes, HashPairs hashPairs, bool* fMutated)
+{
+    bool mutated = false;
+    while (hashes.size() > 1) {
+        size_t nSize = hashes.size();
+        if (nSize % 2 == 0 && hashes[nSize-2] == hashes[nSize-1]) {
+            // Two identical hashes at the end of the list at a particular level.
+            mutated = true;
+        }
+        if (nSize % 2 == 1) {
+            hashes.push_back(hashes.back());
+        }
+        hashPairs(hashes.data(), hashes.data(), hashes.size() / 2);
+        hashes.resize(hashes.size() / 2);
+    }
+    if (fMutated) {
+        *fMutated = mutated;
+    }
+    return (hashes.empty() ? uint256() : hashes[0]);
+}
+
+static void HashMerklePairs(uint256* out, const uint256* in, size_t pairs)
+{
+    static_assert(sizeof(uint256) == 32, "the hashes of a level must be adjacent 64-byte pairs");
+    SHA256D64(out->begin(), in->begin(), pairs);
+}
+
+static void HashAuthDataPairs(uint256* out, const uint256* in, size_t pairs)
+{
+    for (size_t i = 0; i < pairs; i++) {
+        CBLAKE2bWriter ss(SER_GETHASH, 0, ZCASH_AUTH_DATA_HASH_PERSONALIZATION);
+        ss << in[2 * i];
+        ss << in[2 * i + 1];
+        out[i] = ss.GetHash();
+    }
+}
+
+// The leaves of the trees computed by this thread. The vector keeps its
+// capacity, so that computing the roots of blocks does not allocate once it
+// has grown to the largest block.
+static thread_local std::vector<uint256> merkleScratch;
+
 uint256 CBlock::BuildMerkleTree(bool* fMutated) const
 {
     /* WARNING! If you're reading this because you're learning about crypto
@@ -82,15 +132,18 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     bool mutated = false;
     for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
     {
-        for (int i = 0; i < nSize; i += 2)
-        {
-            int i2 = std::min(i+1, nSize-1);
-            if (i2 == i + 1 && i2 + 1 == nSize && vMerkleTree[j+i] == vMerkleTree[j+i2]) {
-                // Two identical hashes at the end of the list at a particular level.
-                mutated = true;
-            }
-            vMerkleTree.push_back(Hash(BEGIN(vMerkleTree[j+i]),  END(vMerkleTree[j+i]),
-                                       BEGIN(vMerkleTree[j+i2]), END(vMerkleTree[j+i2])));
+        if (nSize % 2 == 0 && vMerkleTree[j+nSize-2] == vMerkleTree[j+nSize-1]) {
+            // Two identical hashes at the end of the list at a particular level.
+            mutated = true;
+        }
+        // The pairs of a level are adjacent in vMerkleTree, so they are
+        // hashed at once; a last hash without a pair is hashed with itself.
+        size_t nNext = vMerkleTree.size();
+        vMerkleTree.resize(nNext + (nSize + 1) / 2);
+        HashMerklePairs(&vMerkleTree[nNext], &vMerkleTree[j], nSize / 2);
+        if (nSize % 2 == 1) {
+            const uint256& last = vMerkleTree[j+nSize-1];
+            vMerkleTree.back() = Hash(BEGIN(last), END(last), BEGIN(last), END(last));
         }
         j += nSize;
     }
@@ -100,6 +153,16 @@ uint256 CBlock::BuildMerkleTree(bool* fMutated) const
     return (vMerkleTree.empty() ? uint256() : vMerkleTree.back());
 }
 
+uint256 CBlock::ComputeMerkleRoot(bool* fMutated) const
+{
+    merkleScratch.clear();
+    merkleScratch.reserve(vtx.size() + 1);
+    for (const CTransaction& tx : vtx) {
+        merkleScratch.push_back(tx.GetHash());
+    }
+    return ComputeMerkleRootInPlace(merkleScratch, HashMerklePairs, fMutated);
+}
+
 std::vector<uint256> CBlock::GetMerkleBranch(int nIndex) const
 {
     if (vMerkleTree.empty())
@@ -147,35 +210,21 @@ static uint64_t next_pow2(uint64_t x)
 
 uint256 CBlock::BuildAuthDataMerkleTree() const
 {
-    std::vector<uint256> tree;
     auto perfectSize = next_pow2(vtx.size());
     assert((perfectSize & (perfectSize - 1)) == 0);
-    size_t expectedSize = std::max(perfectSize*2, (uint64_t)1) - 1;  // The total number of nodes.
-    tree.reserve(expectedSize);
 
     // Add the leaves to the tree. v1-v4 transactions will append empty leaves.
+    merkleScratch.clear();
+    merkleScratch.reserve(perfectSize);
     for (auto &tx : vtx) {
-        tree.push_back(tx.GetAuthDigest());
-    }
-    // Append empty leaves until we get a perfect tree.
-    tree.insert(tree.end(), perfectSize - vtx.size(), uint256());
-    assert(tree.size() == perfectSize);
-
-    int j = 0;
-    for (int layerWidth = perfectSize; layerWidth > 1; layerWidth = layerWidth / 2) {
-        for (int i = 0; i < layerWidth; i += 2) {
-            CBLAKE2bWriter ss(SER_GETHASH, 0, ZCASH_AUTH_DATA_HASH_PERSONALIZATION);
-            ss << tree[j + i];
-            ss << tree[j + i + 1];
-            tree.push_back(ss.GetHash());
-        }
-
-        // Move to the next layer.
-        j += layerWidth;
+        merkleScratch.push_back(tx.GetAuthDigest());
     }
+    // Append empty leaves until we get a perfect tree, so that no level has a
+    // hash without a pair.
+    merkleScratch.insert(merkleScratch.end(), perfectSize - vtx.size(), uint256());
+    assert(merkleScratch.size() == perfectSize);
 
-    assert(tree.size() == expectedSize);
-    return (tree.empty() ? uint256() : tree.back());
+    return ComputeMerkleRootInPlace(merkleScratch, HashAuthDataPairs, nullptr);
 }
 
 std::string CBlock::ToString() const
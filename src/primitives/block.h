@@ -138,6 +138,10 @@ public:
     // merkle root).
     uint256 BuildMerkleTree(bool* mutated = NULL) const;
 
+    // Compute the merkle root as BuildMerkleTree does, without building the
+    // in-memory tree, for when no merkle branch is needed.
+    uint256 ComputeMerkleRoot(bool* mutated = NULL) const;
+
     std::vector<uint256> GetMerkleBranch(int nIndex) const;
     static uint256 CheckMerkleBranch(uint256 hash, const std::vector<uint256>& vMerkleBranch, int nIndex);
 
@@ -153,25 +157,23 @@ public:
  * Custom serializer for CBlockHeader that omits the nonce and solution, for use
  * as input to Equihash.
  */
-class CEquihashInput : private CBlockHeader
+class CEquihashInput
 {
-public:
-    CEquihashInput(const CBlockHeader &header)
-    {
-        CBlockHeader::SetNull();
-        *((CBlockHeader*)this) = header;
-    }
-
-    ADD_SERIALIZE_METHODS;
+private:
+    // Refers to the header rather than copying it with its solution.
+    const CBlockHeader& header;
 
-    template <typename Stream, typename Operation>
-    inline void SerializationOp(Stream& s, Operation ser_action) {
-        READWRITE(this->nVersion);
-        READWRITE(hashPrevBlock);
-        READWRITE(hashMerkleRoot);
-        READWRITE(hashBlockCommitments);
-        READWRITE(nTime);
-        READWRITE(nBits);
+public:
+    CEquihashInput(const CBlockHeader &headerIn) : header(headerIn) {}
+
+    template <typename Stream>
+    void Serialize(Stream& s) const {
+        s << header.nVersion;
+        s << header.hashPrevBlock;
+        s << header.hashMerkleRoot;
+        s << header.hashBlockCommitments;
+        s << header.nTime;
+        s << header.nBits;
     }
 };
 
@@ -74,10 +74,19 @@ public:
 
     template<typename Stream>
     void Unserialize(Stream& s) {
-        RustStream rs(s);
         OrchardBundlePtr* bundle;
-        if (!orchard_bundle_parse(&rs, RustStream<Stream>::read_callback, &bundle)) {
-            throw std::ios_base::failure("Failed to parse v5 Orchard bundle");
+        if constexpr (IsContiguousReadStream<Stream>::value) {
+            size_t nConsumed;
+            if (!orchard_bundle_parse_slice(
+                    reinterpret_cast<const unsigned char*>(s.data()), s.size(), &bundle, &nConsumed)) {
+                throw std::ios_base::failure("Failed to parse v5 Orchard bundle");
+            }
+            s.ignore(nConsumed);
+        } else {
+            RustStream rs(s);
+            if (!orchard_bundle_parse(&rs, RustStream<Stream>::read_callback, &bundle)) {
+                throw std::ios_base::failure("Failed to parse v5 Orchard bundle");
+            }
         }
         inner.reset(bundle);
     }
@@ -188,6 +188,7 @@ void CTransaction::UpdateHash() const
     {
         throw std::ios_base::failure("CTransaction::UpdateHash: Invalid transaction format");
     }
+    *const_cast<uint32_t*>(&nSerializedSize) = ss.size();
 }
 
 CTransaction::CTransaction() : nVersion(CTransaction::SPROUT_MIN_CURRENT_VERSION),
@@ -259,6 +260,7 @@ CTransaction& CTransaction::operator=(const CTransaction &tx) {
     *const_cast<binding_sig_t*>(&bindingSig) = tx.bindingSig;
     *const_cast<uint256*>(&wtxid.hash) = tx.wtxid.hash;
     *const_cast<uint256*>(&wtxid.authDigest) = tx.wtxid.authDigest;
+    *const_cast<uint32_t*>(&nSerializedSize) = tx.nSerializedSize;
     return *this;
 }
 
@@ -711,6 +711,8 @@ private:
 
     /** Memory only. */
     const WTxId wtxid;
+    /** Memory only. The size of the serialization the hash was computed from, or 0 if none was. */
+    const uint32_t nSerializedSize{0};
     void UpdateHash() const;
 
 protected:
@@ -787,6 +789,16 @@ public:
 
     ADD_SERIALIZE_METHODS;
 
+    // Sizing a transaction (for GetSerializeSize, including that of a block)
+    // uses the size cached when its hash was computed, without a pass over it.
+    void Serialize(CSizeComputer& s) const {
+        if (nSerializedSize != 0) {
+            s.seek(nSerializedSize);
+        } else {
+            NCONST_PTR(this)->SerializationOp(s, CSerActionSerialize());
+        }
+    }
+
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action) {
         uint32_t header;
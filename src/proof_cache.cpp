@@ -0,0 +1,167 @@
+// Copyright (c) 2022 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include <proof_cache.h>
+
+#include <crypto/common.h>
+#include <crypto/sha256.h>
+#include <memusage.h>
+#include <random.h>
+#include <util/system.h>
+
+#include <variant>
+
+#include <boost/thread.hpp>
+#include <boost/unordered_set.hpp>
+
+namespace {
+
+/**
+ * We're hashing a nonce into the entries themselves, so we don't need extra
+ * blinding in the set hash computation.
+ */
+class CProofCacheHasher
+{
+public:
+    size_t operator()(const uint256& key) const {
+        return key.GetCheapHash();
+    }
+};
+
+class CProofCache
+{
+private:
+    //! Entries are SHA256(nonce || domain || data):
+    uint256 nonce;
+    typedef boost::unordered_set<uint256, CProofCacheHasher> map_type;
+    map_type setValid;
+    boost::shared_mutex cs_proofcache;
+
+public:
+    CProofCache()
+    {
+        GetRandBytes(nonce.begin(), 32);
+    }
+
+    CSHA256 EntryHasher(unsigned char domain) const
+    {
+        CSHA256 hasher;
+        hasher.Write(nonce.begin(), 32).Write(&domain, 1);
+        return hasher;
+    }
+
+    bool Get(const uint256& entry, bool fErase)
+    {
+        if (fErase) {
+            boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+            return setValid.erase(entry) > 0;
+        }
+        boost::shared_lock<boost::shared_mutex> lock(cs_proofcache);
+        return setValid.count(entry);
+    }
+
+    void Set(const uint256& entry)
+    {
+        size_t nMaxCacheSize = GetArg("-maxproofcachesize", DEFAULT_MAX_PROOF_CACHE_SIZE) * ((size_t) 1 << 20);
+        if (nMaxCacheSize <= 0) return;
+
+        boost::unique_lock<boost::shared_mutex> lock(cs_proofcache);
+        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
+        {
+            map_type::size_type s = GetRand(setValid.bucket_count());
+            map_type::local_iterator it = setValid.begin(s);
+            if (it != setValid.end(s)) {
+                setValid.erase(*it);
+            }
+        }
+
+        setValid.insert(entry);
+    }
+
+    size_t DynamicMemoryUsage()
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_proofcache);
+        return memusage::DynamicUsage(setValid);
+    }
+};
+
+static const unsigned char DOMAIN_SPROUT = 0;
+static const unsigned char DOMAIN_SHIELDED_BUNDLES = 1;
+
+CProofCache& GetProofCache()
+{
+    static CProofCache proofCache;
+    return proofCache;
+}
+
+/** Commits to every input of librustzcash_sprout_verify(). */
+uint256 SproutEntry(const JSDescription& jsdesc, const uint256& hSig)
+{
+    const auto& proof = std::get<libzcash::GrothProof>(jsdesc.proof);
+    unsigned char vpub[16];
+    WriteLE64(vpub, jsdesc.vpub_old);
+    WriteLE64(vpub + 8, jsdesc.vpub_new);
+
+    uint256 entry;
+    GetProofCache().EntryHasher(DOMAIN_SPROUT)
+        .Write(proof.data(), proof.size())
+        .Write(jsdesc.anchor.begin(), 32)
+        .Write(hSig.begin(), 32)
+        .Write(jsdesc.macs[0].begin(), 32)
+        .Write(jsdesc.macs[1].begin(), 32)
+        .Write(jsdesc.nullifiers[0].begin(), 32)
+        .Write(jsdesc.nullifiers[1].begin(), 32)
+        .Write(jsdesc.commitments[0].begin(), 32)
+        .Write(jsdesc.commitments[1].begin(), 32)
+        .Write(vpub, sizeof(vpub))
+        .Finalize(entry.begin());
+    return entry;
+}
+
+/**
+ * The txid commits to the effecting data of the transaction, and the auth
+ * digest to its authorizing data (for pre-v5 transactions, the txid already
+ * commits to both). The consensus branch ID determines the signature hash.
+ */
+uint256 ShieldedBundlesEntry(const CTransaction& tx, uint32_t consensusBranchId)
+{
+    const WTxId& wtxid = tx.GetWTxId();
+    unsigned char branchId[4];
+    WriteLE32(branchId, consensusBranchId);
+
+    uint256 entry;
+    GetProofCache().EntryHasher(DOMAIN_SHIELDED_BUNDLES)
+        .Write(wtxid.hash.begin(), 32)
+        .Write(wtxid.authDigest.begin(), 32)
+        .Write(branchId, sizeof(branchId))
+        .Finalize(entry.begin());
+    return entry;
+}
+
+}
+
+bool IsSproutProofCached(const JSDescription& jsdesc, const uint256& hSig)
+{
+    return GetProofCache().Get(SproutEntry(jsdesc, hSig), false);
+}
+
+void CacheSproutProof(const JSDescription& jsdesc, const uint256& hSig)
+{
+    GetProofCache().Set(SproutEntry(jsdesc, hSig));
+}
+
+bool AreShieldedBundlesCached(const CTransaction& tx, uint32_t consensusBranchId, bool fErase)
+{
+    return GetProofCache().Get(ShieldedBundlesEntry(tx, consensusBranchId), fErase);
+}
+
+void CacheShieldedBundles(const CTransaction& tx, uint32_t consensusBranchId)
+{
+    GetProofCache().Set(ShieldedBundlesEntry(tx, consensusBranchId));
+}
+
+size_t ProofCacheDynamicMemoryUsage()
+{
+    return GetProofCache().DynamicMemoryUsage();
+}
@@ -0,0 +1,42 @@
+// Copyright (c) 2022 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_PROOF_CACHE_H
+#define ZCASH_PROOF_CACHE_H
+
+#include <primitives/transaction.h>
+#include <uint256.h>
+
+// DoS prevention: limit cache size to less than 16MB (over 200000 entries on
+// 64-bit systems).
+static const unsigned int DEFAULT_MAX_PROOF_CACHE_SIZE = 16;
+
+/**
+ * Valid shielded proof cache, to avoid verifying the proofs and signatures of
+ * a shielded transaction twice (once when it is accepted into the mempool, and
+ * again when the block containing it is connected).
+ *
+ * Entries are salted with a random nonce chosen at startup, and the cache is
+ * limited to -maxproofcachesize MiB by evicting random entries.
+ */
+
+/** Whether the Groth16 proof of `jsdesc` with the given h_sig is known to be valid. */
+bool IsSproutProofCached(const JSDescription& jsdesc, const uint256& hSig);
+/** Record that the Groth16 proof of `jsdesc` with the given h_sig is valid. */
+void CacheSproutProof(const JSDescription& jsdesc, const uint256& hSig);
+
+/**
+ * Whether the Sapling and Orchard bundle authorizations of `tx` (proofs,
+ * spend authorization signatures and binding signatures) are known to be
+ * valid under the given consensus branch ID. If `fErase` is set, a matching
+ * entry is removed, as it is not expected to be needed again.
+ */
+bool AreShieldedBundlesCached(const CTransaction& tx, uint32_t consensusBranchId, bool fErase);
+/** Record that the Sapling and Orchard bundle authorizations of `tx` are valid under the given consensus branch ID. */
+void CacheShieldedBundles(const CTransaction& tx, uint32_t consensusBranchId);
+
+/** The memory used by the entries of the proof cache. */
+size_t ProofCacheDynamicMemoryUsage();
+
+#endif // ZCASH_PROOF_CACHE_H
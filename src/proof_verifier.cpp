@@ -4,6 +4,7 @@
 
 #include <proof_verifier.h>
 
+#include <proof_cache.h>
 #include <zcash/JoinSplit.hpp>
 
 #include <variant>
@@ -34,7 +35,11 @@ public:
     {
         uint256 h_sig = ZCJoinSplit::h_sig(jsdesc.randomSeed, jsdesc.nullifiers, joinSplitPubKey);
 
-        return librustzcash_sprout_verify(
+        if (IsSproutProofCached(jsdesc, h_sig)) {
+            return true;
+        }
+
+        bool fValid = librustzcash_sprout_verify(
             proof.begin(),
             jsdesc.anchor.begin(),
             h_sig.begin(),
@@ -47,6 +52,10 @@ public:
             jsdesc.vpub_old,
             jsdesc.vpub_new
         );
+        if (fValid) {
+            CacheSproutProof(jsdesc, h_sig);
+        }
+        return fValid;
     }
 };
 
@@ -73,6 +73,10 @@ enum {
     // Zcash nodes used to support this by default, without advertising this bit,
     // but no longer do as of protocol version 170004 (= NO_BLOOM_VERSION)
     NODE_BLOOM = (1 << 2),
+    // NODE_COMPACT_FILTERS means the node will serve the basic compact
+    // block filters of BIP 158 (getcfilters, getcfheaders, getcfcheckpt)
+    // per BIP 157.
+    NODE_COMPACT_FILTERS = (1 << 6),
 
     // Bits 24-31 are reserved for temporary experiments. Just pick a bit that
     // isn't getting used, or one not being used much, and notify the
@@ -129,6 +133,7 @@ enum GetDataMsg : uint32_t {
     MSG_WTX = 5,             //!< Defined in ZIP 239
     // The following can only occur in getdata. Invs always use TX/WTX or BLOCK.
     MSG_FILTERED_BLOCK = 3,  //!< Defined in BIP37
+    MSG_CMPCT_BLOCK = 4,     //!< Defined in BIP152
 };
 
 /** inv message data */
@@ -160,6 +165,7 @@ public:
         case MSG_TX:
         case MSG_BLOCK:
         case MSG_FILTERED_BLOCK:
+        case MSG_CMPCT_BLOCK:
             break;
         case MSG_WTX:
             if (nVersion < CINV_WTX_VERSION) {
@@ -192,7 +198,7 @@ public:
 public:
     int type;
     // The main hash. This is:
-    // - MSG_BLOCK: the block hash.
+    // - MSG_BLOCK and MSG_CMPCT_BLOCK: the block hash.
     // - MSG_TX and MSG_WTX: the txid.
     uint256 hash;
     // The auxiliary hash. This is:
@@ -5,10 +5,15 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "chainparams.h"
+#include "compactblocks.h"
+#include "experimental_features.h"
 #include "primitives/block.h"
 #include "primitives/transaction.h"
 #include "main.h"
 #include "httpserver.h"
+#include "insightindex.h"
+#include "rpc/jsonstream.h"
+#include "rpc/responsecache.h"
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
@@ -43,16 +48,19 @@ static const struct {
 };
 
 struct CCoin {
-    uint32_t nTxVer; // Don't call this nVersion, that name has a special meaning inside IMPLEMENT_SERIALIZE
     uint32_t nHeight;
     CTxOut out;
 
     ADD_SERIALIZE_METHODS;
 
+    CCoin() : nHeight(0) {}
+    CCoin(Coin&& in) : nHeight(in.nHeight), out(std::move(in.out)) {}
+
     template <typename Stream, typename Operation>
     inline void SerializationOp(Stream& s, Operation ser_action)
     {
-        READWRITE(nTxVer);
+        uint32_t nTxVerDummy = 0;
+        READWRITE(nTxVerDummy);
         READWRITE(nHeight);
         READWRITE(out);
     }
@@ -60,8 +68,10 @@ struct CCoin {
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, CJSONStreamWriter& writer);
 extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
+extern void mempoolToJSON(bool fVerbose, CJSONStreamWriter& writer);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
 
@@ -141,6 +151,7 @@ static bool rest_headers(HTTPRequest* req,
 
     std::vector<const CBlockIndex *> headers;
     headers.reserve(count);
+    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
     {
         LOCK(cs_main);
         BlockMap::const_iterator it = mapBlockIndex.find(hash);
@@ -151,11 +162,11 @@ static bool rest_headers(HTTPRequest* req,
                 break;
             pindex = chainActive.Next(pindex);
         }
-    }
-
-    CDataStream ssHeader(SER_NETWORK, PROTOCOL_VERSION);
-    for (const CBlockIndex *pindex : headers) {
-        ssHeader << pindex->GetBlockHeader();
+        // The solutions of the headers may be trimmed from the index under
+        // cs_main (see CBlockIndex::TrimSolution), so they are read with it held.
+        for (const CBlockIndex *pindex : headers) {
+            ssHeader << pindex->GetBlockHeader();
+        }
     }
 
     switch (rf) {
@@ -208,6 +219,8 @@ static bool rest_block(HTTPRequest* req,
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    // The JSON is that of getblock, and shares its cache entries.
+    const std::string key = ResponseCacheKey("getblock", hash, showTxDetails ? 2 : 1);
     CBlock block;
     CBlockIndex* pblockindex = NULL;
     {
@@ -215,6 +228,16 @@ static bool rest_block(HTTPRequest* req,
         if (mapBlockIndex.count(hash) == 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
 
+        if (rf == RF_JSON) {
+            std::optional<std::string> cached = GetCachedResponse(key);
+            if (cached) {
+                req->WriteHeader("Content-Type", "application/json");
+                req->WriteReplyBody(cached->data(), cached->size());
+                req->WriteReply(HTTP_OK, "\n");
+                return true;
+            }
+        }
+
         pblockindex = mapBlockIndex[hash];
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
@@ -242,14 +265,23 @@ static bool rest_block(HTTPRequest* req,
     }
 
     case RF_JSON: {
-        UniValue objBlock;
+        req->WriteHeader("Content-Type", "application/json");
         {
             LOCK(cs_main);
-            objBlock = blockToJSON(block, pblockindex, showTxDetails);
+            if (IsResponseCacheable(pblockindex)) {
+                std::string strJSON;
+                CJSONStreamWriter writer([&strJSON](const char* data, size_t len) { strJSON.append(data, len); });
+                blockToJSON(block, pblockindex, showTxDetails, writer);
+                writer.Flush();
+                CacheResponse(key, pblockindex, strJSON);
+                req->WriteReplyBody(strJSON.data(), strJSON.size());
+            } else {
+                CJSONStreamWriter writer([req](const char* data, size_t len) { req->WriteReplyBody(data, len); });
+                blockToJSON(block, pblockindex, showTxDetails, writer);
+                writer.Flush();
+            }
         }
-        string strJSON = objBlock.write() + "\n";
-        req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        req->WriteReply(HTTP_OK, "\n");
         return true;
     }
 
@@ -275,6 +307,62 @@ static bool rest_block_notxdetails(HTTPRequest* req, const std::string& strURIPa
 // A bit of a hack - dependency on a function defined in rpc/blockchain.cpp
 UniValue getblockchaininfo(const UniValue& params, bool fHelp);
 
+static bool rest_compactblocks(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!fExperimentalLightWalletd)
+        return RESTERR(req, HTTP_NOT_FOUND, "Compact blocks are only served with -lightwalletd");
+    if (!CheckWarmup(req))
+        return false;
+    vector<string> params;
+    const RetFormat rf = ParseDataFormat(params, strURIPart);
+    vector<string> path;
+    boost::split(path, params[0], boost::is_any_of("/"));
+
+    if (path.size() != 2)
+        return RESTERR(req, HTTP_BAD_REQUEST, "No height and count specified. Use /rest/compactblocks/<height>/<count>.<ext>.");
+
+    int nHeight;
+    if (!ParseInt32(path[0], &nHeight) || nHeight < 0)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height: " + path[0]);
+    int nCount;
+    if (!ParseInt32(path[1], &nCount) || nCount < 1 || nCount > MAX_COMPACT_BLOCKS_PER_REQUEST)
+        return RESTERR(req, HTTP_BAD_REQUEST, "Block count out of range: " + path[1]);
+    if (rf != RF_BINARY && rf != RF_HEX)
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: .bin, .hex)");
+
+    // The blocks of the active chain from the height on, each as its
+    // length and its serialized compact form.
+    std::vector<CCompactBlockCache::Entry> blocks;
+    {
+        LOCK(cs_main);
+        if (nHeight > chainActive.Height())
+            return RESTERR(req, HTTP_NOT_FOUND, "Block height out of range: " + path[0]);
+        for (const CBlockIndex* pindex = chainActive[nHeight];
+             pindex != NULL && blocks.size() < (size_t)nCount;
+             pindex = chainActive.Next(pindex)) {
+            CCompactBlockCache::Entry entry = GetCompactBlock(pindex);
+            if (!entry)
+                return RESTERR(req, HTTP_NOT_FOUND, pindex->GetBlockHash().GetHex() + " not available");
+            blocks.push_back(entry);
+        }
+    }
+
+    req->WriteHeader("Content-Type", rf == RF_BINARY ? "application/octet-stream" : "text/plain");
+    for (const CCompactBlockCache::Entry& entry : blocks) {
+        CDataStream ssLength(SER_NETWORK, PROTOCOL_VERSION);
+        WriteCompactSize(ssLength, entry->size());
+        if (rf == RF_BINARY) {
+            req->WriteReplyBody(&ssLength[0], ssLength.size());
+            req->WriteReplyBody((const char*)entry->data(), entry->size());
+        } else {
+            std::string strHex = HexStr(ssLength.begin(), ssLength.end()) + HexStr(entry->begin(), entry->end());
+            req->WriteReplyBody(strHex.data(), strHex.size());
+        }
+    }
+    req->WriteReply(HTTP_OK, rf == RF_HEX ? "\n" : "");
+    return true;
+}
+
 static bool rest_chaininfo(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -334,11 +422,11 @@ static bool rest_mempool_contents(HTTPRequest* req, const std::string& strURIPar
 
     switch (rf) {
     case RF_JSON: {
-        UniValue mempoolObject = mempoolToJSON(true);
-
-        string strJSON = mempoolObject.write() + "\n";
         req->WriteHeader("Content-Type", "application/json");
-        req->WriteReply(HTTP_OK, strJSON);
+        CJSONStreamWriter writer([req](const char* data, size_t len) { req->WriteReplyBody(data, len); });
+        mempoolToJSON(true, writer);
+        writer.Flush();
+        req->WriteReply(HTTP_OK, "\n");
         return true;
     }
     default: {
@@ -362,6 +450,21 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     if (!ParseHashStr(hashStr, hash))
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
+    if (pinsightindex != NULL) {
+        pinsightindex->BlockUntilSyncedToCurrentChain();
+    }
+
+    const std::string key = ResponseCacheKey("rest/tx", hash, 1);
+    if (rf == RF_JSON) {
+        LOCK(cs_main);
+        std::optional<std::string> cached = GetCachedResponse(key);
+        if (cached) {
+            req->WriteHeader("Content-Type", "application/json");
+            req->WriteReply(HTTP_OK, *cached + "\n");
+            return true;
+        }
+    }
+
     CTransaction tx;
     uint256 hashBlock = uint256();
     if (!GetTransaction(hash, tx, Params().GetConsensus(), hashBlock, true))
@@ -386,9 +489,17 @@ static bool rest_tx(HTTPRequest* req, const std::string& strURIPart)
     }
 
     case RF_JSON: {
-        UniValue objTx(UniValue::VOBJ);
-        TxToJSON(tx, hashBlock, objTx);
-        string strJSON = objTx.write() + "\n";
+        string strJSON;
+        {
+            LOCK(cs_main);
+            UniValue objTx(UniValue::VOBJ);
+            TxToJSON(tx, hashBlock, objTx);
+            strJSON = objTx.write();
+            BlockMap::iterator mi = mapBlockIndex.find(hashBlock);
+            if (mi != mapBlockIndex.end())
+                CacheResponse(key, mi->second, strJSON);
+        }
+        strJSON += "\n";
         req->WriteHeader("Content-Type", "application/json");
         req->WriteReply(HTTP_OK, strJSON);
         return true;
@@ -515,21 +626,10 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
             view.SetBackend(viewMempool); // switch cache backend to db+mempool in case user likes to query mempool
 
         for (size_t i = 0; i < vOutPoints.size(); i++) {
-            CCoins coins;
-            uint256 hash = vOutPoints[i].hash;
-            if (view.GetCoins(hash, coins)) {
-                mempool.pruneSpent(hash, coins);
-                if (coins.IsAvailable(vOutPoints[i].n)) {
-                    hits[i] = true;
-                    // Safe to index into vout here because IsAvailable checked if it's off the end of the array, or if
-                    // n is valid but points to an already spent output (IsNull).
-                    CCoin coin;
-                    coin.nTxVer = coins.nVersion;
-                    coin.nHeight = coins.nHeight;
-                    coin.out = coins.vout.at(vOutPoints[i].n);
-                    assert(!coin.out.IsNull());
-                    outs.push_back(coin);
-                }
+            Coin coin;
+            if (view.GetCoin(vOutPoints[i], coin) && !mempool.isSpent(vOutPoints[i])) {
+                hits[i] = true;
+                outs.emplace_back(std::move(coin));
             }
 
             bitmapStringRepresentation.append(hits[i] ? "1" : "0"); // form a binary string representation (human-readable for json output)
@@ -572,7 +672,6 @@ static bool rest_getutxos(HTTPRequest* req, const std::string& strURIPart)
         UniValue utxos(UniValue::VARR);
         for (const CCoin& coin : outs) {
             UniValue utxo(UniValue::VOBJ);
-            utxo.pushKV("txvers", (int32_t)coin.nTxVer);
             utxo.pushKV("height", (int32_t)coin.nHeight);
             utxo.pushKV("value", ValueFromAmount(coin.out.nValue));
 
@@ -610,13 +709,14 @@ static const struct {
       {"/rest/mempool/info", rest_mempool_info},
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
+      {"/rest/compactblocks/", rest_compactblocks},
       {"/rest/getutxos", rest_getutxos},
 };
 
 bool StartREST()
 {
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
-        RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler);
+        RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler, [](HTTPRequest*) { return HTTP_WORK_QUEUE_REST; });
     return true;
 }
 
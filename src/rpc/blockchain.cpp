@@ -5,17 +5,23 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "amount.h"
+#include "blockfilter.h"
 #include "chain.h"
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "consensus/validation.h"
 #include "experimental_features.h"
+#include "insightindex.h"
 #include "key_io.h"
 #include "main.h"
 #include "metrics.h"
 #include "primitives/transaction.h"
+#include "rpc/jsonstream.h"
+#include "rpc/responsecache.h"
 #include "rpc/server.h"
 #include "streams.h"
+#include "subtreeindex.h"
+#include "supplyindex.h"
 #include "sync.h"
 #include "util/system.h"
 
@@ -23,6 +29,8 @@
 
 #include <univalue.h>
 
+#include <chrono>
+#include <limits>
 #include <optional>
 #include <regex>
 
@@ -118,7 +126,7 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     result.pushKV("finalsaplingroot", blockindex->hashFinalSaplingRoot.GetHex());
     result.pushKV("time", (int64_t)blockindex->nTime);
     result.pushKV("nonce", blockindex->nNonce.GetHex());
-    result.pushKV("solution", HexStr(blockindex->nSolution));
+    result.pushKV("solution", HexStr(blockindex->GetSolution()));
     result.pushKV("bits", strprintf("%08x", blockindex->nBits));
     result.pushKV("difficulty", GetDifficulty(blockindex));
     result.pushKV("chainwork", blockindex->nChainWork.GetHex());
@@ -220,13 +228,13 @@ UniValue blockToDeltasJSON(const CBlock& block, const CBlockIndex* blockindex)
     return result;
 }
 
-UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+/** The fields of a block's JSON before its transactions, and those after. */
+static void BlockFieldsToJSON(const CBlock& block, const CBlockIndex* blockindex, UniValue& result, UniValue& after)
 {
     AssertLockHeld(cs_main);
     bool nu5Active = Params().GetConsensus().NetworkUpgradeActive(
         blockindex->nHeight, Consensus::UPGRADE_NU5);
 
-    UniValue result(UniValue::VOBJ);
     result.pushKV("hash", block.GetHash().GetHex());
     int confirmations = -1;
     // Only report confirmations if the block is on the main chain
@@ -244,41 +252,76 @@ UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool tx
         result.pushKV("finalorchardroot", blockindex->hashFinalOrchardRoot.GetHex());
     }
     result.pushKV("chainhistoryroot", blockindex->hashChainHistoryRoot.GetHex());
+
+    after.pushKV("time", block.GetBlockTime());
+    after.pushKV("nonce", block.nNonce.GetHex());
+    after.pushKV("solution", HexStr(block.nSolution));
+    after.pushKV("bits", strprintf("%08x", block.nBits));
+    after.pushKV("difficulty", GetDifficulty(blockindex));
+    after.pushKV("chainwork", blockindex->nChainWork.GetHex());
+    after.pushKV("anchor", blockindex->hashFinalSproutRoot.GetHex());
+
+    UniValue valuePools(UniValue::VARR);
+    valuePools.push_back(ValuePoolDesc("sprout", blockindex->nChainSproutValue, blockindex->nSproutValue));
+    valuePools.push_back(ValuePoolDesc("sapling", blockindex->nChainSaplingValue, blockindex->nSaplingValue));
+    valuePools.push_back(ValuePoolDesc("orchard", blockindex->nChainOrchardValue, blockindex->nOrchardValue));
+    after.pushKV("valuePools", valuePools);
+
+    if (blockindex->pprev)
+        after.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
+    CBlockIndex *pnext = chainActive.Next(blockindex);
+    if (pnext)
+        after.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
+}
+
+UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
+{
+    UniValue result(UniValue::VOBJ), after(UniValue::VOBJ);
+    BlockFieldsToJSON(block, blockindex, result, after);
     UniValue txs(UniValue::VARR);
+    txs.reserve(block.vtx.size());
     for (const CTransaction&tx : block.vtx)
     {
         if(txDetails)
         {
             UniValue objTx(UniValue::VOBJ);
             TxToJSON(tx, uint256(), objTx);
-            txs.push_back(objTx);
+            txs.push_back(std::move(objTx));
         }
         else
             txs.push_back(tx.GetHash().GetHex());
     }
-    result.pushKV("tx", txs);
-    result.pushKV("time", block.GetBlockTime());
-    result.pushKV("nonce", block.nNonce.GetHex());
-    result.pushKV("solution", HexStr(block.nSolution));
-    result.pushKV("bits", strprintf("%08x", block.nBits));
-    result.pushKV("difficulty", GetDifficulty(blockindex));
-    result.pushKV("chainwork", blockindex->nChainWork.GetHex());
-    result.pushKV("anchor", blockindex->hashFinalSproutRoot.GetHex());
-
-    UniValue valuePools(UniValue::VARR);
-    valuePools.push_back(ValuePoolDesc("sprout", blockindex->nChainSproutValue, blockindex->nSproutValue));
-    valuePools.push_back(ValuePoolDesc("sapling", blockindex->nChainSaplingValue, blockindex->nSaplingValue));
-    valuePools.push_back(ValuePoolDesc("orchard", blockindex->nChainOrchardValue, blockindex->nOrchardValue));
-    result.pushKV("valuePools", valuePools);
-
-    if (blockindex->pprev)
-        result.pushKV("previousblockhash", blockindex->pprev->GetBlockHash().GetHex());
-    CBlockIndex *pnext = chainActive.Next(blockindex);
-    if (pnext)
-        result.pushKV("nextblockhash", pnext->GetBlockHash().GetHex());
+    result.pushKV("tx", std::move(txs));
+    result.pushKVs(after);
     return result;
 }
 
+/**
+ * Write the same JSON as blockToJSON, building the JSON of one transaction
+ * at a time rather than of the whole block.
+ */
+void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, CJSONStreamWriter& writer)
+{
+    UniValue result(UniValue::VOBJ), after(UniValue::VOBJ);
+    BlockFieldsToJSON(block, blockindex, result, after);
+    writer.BeginObject();
+    writer.Members(result);
+    writer.Key("tx");
+    writer.BeginArray();
+    for (const CTransaction& tx : block.vtx) {
+        if (txDetails) {
+            UniValue objTx(UniValue::VOBJ);
+            TxToJSON(tx, uint256(), objTx);
+            writer.Value(objTx);
+        } else {
+            writer.Value(tx.GetHash().GetHex());
+        }
+    }
+    writer.EndArray();
+    writer.Members(after);
+    writer.EndObject();
+}
+
 UniValue getblockcount(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -292,8 +335,9 @@ UniValue getblockcount(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockcount", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Height();
+    // Health checks poll this, so it does not wait for cs_main.
+    const CBlockIndex* pindexTip = chainActive.PublishedTip();
+    return pindexTip ? pindexTip->nHeight : -1;
 }
 
 UniValue getbestblockhash(const UniValue& params, bool fHelp)
@@ -309,8 +353,7 @@ UniValue getbestblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getbestblockhash", "")
         );
 
-    LOCK(cs_main);
-    return chainActive.Tip()->GetBlockHash().GetHex();
+    return chainActive.PublishedTip()->GetBlockHash().GetHex();
 }
 
 UniValue getdifficulty(const UniValue& params, bool fHelp)
@@ -330,55 +373,96 @@ UniValue getdifficulty(const UniValue& params, bool fHelp)
     return GetNetworkDifficulty();
 }
 
+static UniValue MempoolEntryToJSON(const CTxMemPoolEntry& e, const CTxMemPoolSnapshot& snapshot, int nHeight)
+{
+    UniValue info(UniValue::VOBJ);
+    info.pushKV("size", (int)e.GetTxSize());
+    info.pushKV("fee", ValueFromAmount(e.GetFee()));
+    info.pushKV("modifiedfee", ValueFromAmount(e.GetModifiedFee()));
+    info.pushKV("time", e.GetTime());
+    info.pushKV("height", (int)e.GetHeight());
+    info.pushKV("startingpriority", e.GetPriority(e.GetHeight()));
+    info.pushKV("currentpriority", e.GetPriority(nHeight));
+    info.pushKV("descendantcount", e.GetCountWithDescendants());
+    info.pushKV("descendantsize", e.GetSizeWithDescendants());
+    info.pushKV("descendantfees", e.GetModFeesWithDescendants());
+    info.pushKV("ancestorcount", e.GetCountWithAncestors());
+    info.pushKV("ancestorsize", e.GetSizeWithAncestors());
+    info.pushKV("ancestorfees", e.GetModFeesWithAncestors());
+    const CTransaction& tx = e.GetTx();
+    set<string> setDepends;
+    for (const CTxIn& txin : tx.vin)
+    {
+        if (snapshot.exists(txin.prevout.hash))
+            setDepends.insert(txin.prevout.hash.ToString());
+    }
+
+    UniValue depends(UniValue::VARR);
+    for (const string& dep : setDepends)
+    {
+        depends.push_back(dep);
+    }
+
+    info.pushKV("depends", depends);
+    return info;
+}
+
 UniValue mempoolToJSON(bool fVerbose = false)
 {
+    // Work from a snapshot, so that transaction admission can go on while
+    // the response is built.
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
     if (fVerbose)
     {
-        LOCK(mempool.cs);
-        UniValue o(UniValue::VOBJ);
-        for (const CTxMemPoolEntry& e : mempool.mapTx)
+        int nHeight;
         {
-            const uint256& hash = e.GetTx().GetHash();
-            UniValue info(UniValue::VOBJ);
-            info.pushKV("size", (int)e.GetTxSize());
-            info.pushKV("fee", ValueFromAmount(e.GetFee()));
-            info.pushKV("modifiedfee", ValueFromAmount(e.GetModifiedFee()));
-            info.pushKV("time", e.GetTime());
-            info.pushKV("height", (int)e.GetHeight());
-            info.pushKV("startingpriority", e.GetPriority(e.GetHeight()));
-            info.pushKV("currentpriority", e.GetPriority(chainActive.Height()));
-            const CTransaction& tx = e.GetTx();
-            set<string> setDepends;
-            for (const CTxIn& txin : tx.vin)
-            {
-                if (mempool.exists(txin.prevout.hash))
-                    setDepends.insert(txin.prevout.hash.ToString());
-            }
-
-            UniValue depends(UniValue::VARR);
-            for (const string& dep : setDepends)
-            {
-                depends.push_back(dep);
-            }
-
-            info.pushKV("depends", depends);
-            o.pushKV(hash.ToString(), info);
+            LOCK(cs_main);
+            nHeight = chainActive.Height();
         }
+        // The txids are unique, so there is no need to look for an existing
+        // member before adding each one.
+        UniValue o(UniValue::VOBJ);
+        o.reserve(snapshot->vEntries.size());
+        for (const CTxMemPoolEntry& e : snapshot->vEntries)
+            o._pushKV(e.GetTx().GetHash().ToString(), MempoolEntryToJSON(e, *snapshot, nHeight));
         return o;
     }
     else
     {
-        vector<uint256> vtxid;
-        mempool.queryHashes(vtxid);
-
         UniValue a(UniValue::VARR);
-        for (const uint256& hash : vtxid)
-            a.push_back(hash.ToString());
+        a.reserve(snapshot->vEntries.size());
+        for (const CTxMemPoolEntry& e : snapshot->vEntries)
+            a.push_back(e.GetTx().GetHash().ToString());
 
         return a;
     }
 }
 
+/**
+ * Write the same JSON as mempoolToJSON, building the JSON of one entry at a
+ * time rather than of the whole mempool.
+ */
+void mempoolToJSON(bool fVerbose, CJSONStreamWriter& writer)
+{
+    std::shared_ptr<const CTxMemPoolSnapshot> snapshot = mempool.GetSnapshot();
+    if (fVerbose) {
+        int nHeight;
+        {
+            LOCK(cs_main);
+            nHeight = chainActive.Height();
+        }
+        writer.BeginObject();
+        for (const CTxMemPoolEntry& e : snapshot->vEntries)
+            writer.KeyValue(e.GetTx().GetHash().ToString(), MempoolEntryToJSON(e, *snapshot, nHeight));
+        writer.EndObject();
+    } else {
+        writer.BeginArray();
+        for (const CTxMemPoolEntry& e : snapshot->vEntries)
+            writer.Value(e.GetTx().GetHash().ToString());
+        writer.EndArray();
+    }
+}
+
 UniValue getrawmempool(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() > 1)
@@ -402,6 +486,12 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             "    \"height\" : n,           (numeric) block height when transaction entered pool\n"
             "    \"startingpriority\" : n, (numeric) priority when transaction entered pool\n"
             "    \"currentpriority\" : n,  (numeric) transaction priority now\n"
+            "    \"descendantcount\" : n,  (numeric) number of in-mempool descendant transactions (including this one)\n"
+            "    \"descendantsize\" : n,   (numeric) size of in-mempool descendants (including this one)\n"
+            "    \"descendantfees\" : n,   (numeric) modified fees (see above) of in-mempool descendants (including this one), in " + MINOR_CURRENCY_UNIT + "\n"
+            "    \"ancestorcount\" : n,    (numeric) number of in-mempool ancestor transactions (including this one)\n"
+            "    \"ancestorsize\" : n,     (numeric) size of in-mempool ancestors (including this one)\n"
+            "    \"ancestorfees\" : n,     (numeric) modified fees (see above) of in-mempool ancestors (including this one), in " + MINOR_CURRENCY_UNIT + "\n"
             "    \"depends\" : [           (array) unconfirmed transactions used as inputs for this transaction\n"
             "        \"transactionid\",    (string) parent transaction id\n"
             "       ... ]\n"
@@ -412,8 +502,6 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getrawmempool", "true")
         );
 
-    LOCK(cs_main);
-
     bool fVerbose = false;
     if (params.size() > 0)
         fVerbose = params[0].get_bool();
@@ -421,6 +509,17 @@ UniValue getrawmempool(const UniValue& params, bool fHelp)
     return mempoolToJSON(fVerbose);
 }
 
+/** Streams the result of getrawmempool with verbose set. */
+static RPCStreamedResult getrawmempool_streamed(const UniValue& params)
+{
+    if (params.size() != 1 || !params[0].isBool() || !params[0].get_bool())
+        return nullptr;
+
+    return [](CJSONStreamWriter& writer) {
+        mempoolToJSON(true, writer);
+    };
+}
+
 // insightexplorer
 UniValue getblockdeltas(const UniValue& params, bool fHelp)
 {
@@ -484,6 +583,8 @@ UniValue getblockdeltas(const UniValue& params, bool fHelp)
             "Run './zcash-cli help getblockdeltas' for instructions on how to enable this feature.");
     }
 
+    EnsureInsightIndexSynced();
+
     std::string strHash = params[0].get_str();
     uint256 hash(uint256S(strHash));
 
@@ -547,6 +648,8 @@ UniValue getblockhashes(const UniValue& params, bool fHelp)
             "Run './zcash-cli help getblockhashes' for instructions on how to enable this feature.");
     }
 
+    EnsureInsightIndexSynced();
+
     unsigned int high = params[0].get_int();
     unsigned int low = params[1].get_int();
     bool fActiveOnly = false;
@@ -631,10 +734,24 @@ UniValue getblockhash(const UniValue& params, bool fHelp)
             + HelpExampleRpc("getblockhash", "1000")
         );
 
-    LOCK(cs_main);
+    const CBlockIndex* pindexTip = chainActive.PublishedTip();
+    int nHeight = interpretHeightArg(params[0].get_int(), pindexTip ? pindexTip->nHeight : -1);
+    return pindexTip->GetAncestor(nHeight)->GetBlockHash().GetHex();
+}
+
+/** The result of getblockheader. Requires cs_main. */
+static UniValue BlockHeaderResult(const CBlockIndex* pblockindex, bool fVerbose)
+{
+    AssertLockHeld(cs_main);
+    if (!fVerbose)
+    {
+        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+        ssBlock << pblockindex->GetBlockHeader();
+        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
+        return strHex;
+    }
 
-    const CBlockIndex* pblockindex = chainActive[interpretHeightArg(params[0].get_int(), chainActive.Height())];
-    return pblockindex->GetBlockHash().GetHex();
+    return blockheaderToJSON(pblockindex);
 }
 
 UniValue getblockheader(const UniValue& params, bool fHelp)
@@ -681,17 +798,84 @@ UniValue getblockheader(const UniValue& params, bool fHelp)
     if (mapBlockIndex.count(hash) == 0)
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
 
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
+    return BlockHeaderResult(mapBlockIndex[hash], fVerbose);
+}
 
-    if (!fVerbose)
-    {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << pblockindex->GetBlockHeader();
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+/** Serves the result of getblockheader from the response cache, caching it if it was not. */
+static RPCStreamedResult getblockheader_streamed(const UniValue& params)
+{
+    if (params.size() < 1 || params.size() > 2)
+        return nullptr;
+
+    bool fVerbose = true;
+    if (params.size() > 1)
+        fVerbose = params[1].get_bool();
+
+    LOCK(cs_main);
+    uint256 hash(uint256S(params[0].get_str()));
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
+    if (mi == mapBlockIndex.end())
+        return nullptr;
+
+    std::string key = ResponseCacheKey("getblockheader", hash, fVerbose);
+    std::optional<std::string> cached = GetCachedResponse(key);
+    if (!cached) {
+        if (!IsResponseCacheable(mi->second))
+            return nullptr;
+        cached = BlockHeaderResult(mi->second, fVerbose).write();
+        CacheResponse(key, mi->second, *cached);
     }
+    return [strJSON = std::move(*cached)](CJSONStreamWriter& writer) {
+        writer.RawValue(strJSON);
+    };
+}
 
-    return blockheaderToJSON(pblockindex);
+/** The hash of the block getblock is asked for, by hash or height. */
+static uint256 ParseGetBlockHash(const UniValue& params)
+{
+    AssertLockHeld(cs_main);
+    std::string strHash = params[0].get_str();
+
+    // If height is supplied, find the hash
+    if (strHash.size() < (2 * sizeof(uint256))) {
+        strHash = chainActive[parseHeightArg(strHash, chainActive.Height())]->GetBlockHash().GetHex();
+    }
+
+    return uint256S(strHash);
+}
+
+static int ParseGetBlockVerbosity(const UniValue& params)
+{
+    int verbosity = 1;
+    if (params.size() > 1) {
+        if(params[1].isNum()) {
+            verbosity = params[1].get_int();
+        } else {
+            verbosity = params[1].get_bool() ? 1 : 0;
+        }
+    }
+
+    if (verbosity < 0 || verbosity > 2) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
+    }
+    return verbosity;
+}
+
+static CBlockIndex* ReadGetBlockBlock(const uint256& hash, CBlock& block)
+{
+    AssertLockHeld(cs_main);
+    if (mapBlockIndex.count(hash) == 0)
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+
+    CBlockIndex* pblockindex = mapBlockIndex[hash];
+
+    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
+
+    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+
+    return pblockindex;
 }
 
 UniValue getblock(const UniValue& params, bool fHelp)
@@ -747,58 +931,89 @@ UniValue getblock(const UniValue& params, bool fHelp)
 
     LOCK(cs_main);
 
-    std::string strHash = params[0].get_str();
-
-    // If height is supplied, find the hash
-    if (strHash.size() < (2 * sizeof(uint256))) {
-        strHash = chainActive[parseHeightArg(strHash, chainActive.Height())]->GetBlockHash().GetHex();
-    }
-
-    uint256 hash(uint256S(strHash));
-
-    int verbosity = 1;
-    if (params.size() > 1) {
-        if(params[1].isNum()) {
-            verbosity = params[1].get_int();
-        } else {
-            verbosity = params[1].get_bool() ? 1 : 0;
-        }
-    }
-
-    if (verbosity < 0 || verbosity > 2) {
-        throw JSONRPCError(RPC_INVALID_PARAMETER, "Verbosity must be in range from 0 to 2");
-    }
-
-    if (mapBlockIndex.count(hash) == 0)
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+    uint256 hash = ParseGetBlockHash(params);
+    int verbosity = ParseGetBlockVerbosity(params);
 
     CBlock block;
-    CBlockIndex* pblockindex = mapBlockIndex[hash];
-
-    if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
-
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+    CBlockIndex* pblockindex = ReadGetBlockBlock(hash, block);
 
     if (verbosity == 0)
     {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
+        std::vector<unsigned char> vchBlock = SerializeToVector(block, SER_NETWORK, PROTOCOL_VERSION);
+        std::string strHex = HexStr(vchBlock.begin(), vchBlock.end());
         return strHex;
     }
 
     return blockToJSON(block, pblockindex, verbosity >= 2);
 }
 
+/**
+ * Serves the result of getblock from the response cache, caching it if it
+ * was not, or otherwise streams it with verbosity 2, the largest one.
+ */
+static RPCStreamedResult getblock_streamed(const UniValue& params)
+{
+    if (params.size() < 1 || params.size() > 2)
+        return nullptr;
+
+    LOCK(cs_main);
+    uint256 hash = ParseGetBlockHash(params);
+    int verbosity = ParseGetBlockVerbosity(params);
+    BlockMap::iterator mi = mapBlockIndex.find(hash);
+    if (mi == mapBlockIndex.end())
+        return nullptr;
+
+    std::string key = ResponseCacheKey("getblock", hash, verbosity);
+    std::optional<std::string> cached = GetCachedResponse(key);
+    bool fCacheable = !cached && IsResponseCacheable(mi->second);
+    if (!cached && !fCacheable && verbosity != 2)
+        return nullptr;
+
+    std::shared_ptr<CBlock> block = std::make_shared<CBlock>();
+    CBlockIndex* pblockindex = nullptr;
+    if (!cached)
+        pblockindex = ReadGetBlockBlock(hash, *block);
+    if (fCacheable) {
+        if (verbosity == 0) {
+            std::vector<unsigned char> vchBlock = SerializeToVector(*block, SER_NETWORK, PROTOCOL_VERSION);
+            cached = UniValue(HexStr(vchBlock.begin(), vchBlock.end())).write();
+        } else {
+            std::string strJSON;
+            CJSONStreamWriter writer([&strJSON](const char* data, size_t len) { strJSON.append(data, len); });
+            blockToJSON(*block, pblockindex, verbosity >= 2, writer);
+            writer.Flush();
+            cached = std::move(strJSON);
+        }
+        CacheResponse(key, pblockindex, *cached);
+    }
+    if (cached) {
+        return [strJSON = std::move(*cached)](CJSONStreamWriter& writer) {
+            writer.RawValue(strJSON);
+        };
+    }
+    return [block, pblockindex](CJSONStreamWriter& writer) {
+        LOCK(cs_main);
+        blockToJSON(*block, pblockindex, true, writer);
+    };
+}
+
+/**
+ * The statistics computed by the last gettxoutsetinfo call. Computing them
+ * takes a pass over the whole coin database, so they are reused for as long
+ * as the chain state is at the same block. Holding the lock while computing
+ * them also makes concurrent calls (e.g. from monitoring) share one pass.
+ */
+static Mutex cs_txoutsetinfo;
+static std::optional<CCoinsStats> cachedTxOutSetStats GUARDED_BY(cs_txoutsetinfo);
+
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
         throw runtime_error(
             "gettxoutsetinfo\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "Note this call may take some time; the result is reused until the chain state\n"
+            "moves to another block.\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -816,17 +1031,102 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 
     UniValue ret(UniValue::VOBJ);
 
-    CCoinsStats stats;
+    uint256 hashBestBlock;
+    {
+        LOCK(cs_main);
+        hashBestBlock = pcoinsTip->GetBestBlock();
+    }
+
+    LOCK(cs_txoutsetinfo);
+    if (!cachedTxOutSetStats || cachedTxOutSetStats->hashBlock != hashBestBlock) {
+        CCoinsStats stats;
+        FlushStateToDisk();
+        if (!pcoinsTip->GetStats(stats)) {
+            return ret;
+        }
+        cachedTxOutSetStats = stats;
+    }
+
+    const CCoinsStats& stats = *cachedTxOutSetStats;
+    ret.pushKV("height", (int64_t)stats.nHeight);
+    ret.pushKV("bestblock", stats.hashBlock.GetHex());
+    ret.pushKV("transactions", (int64_t)stats.nTransactions);
+    ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
+    ret.pushKV("bytes_serialized", (int64_t)stats.nSerializedSize);
+    ret.pushKV("hash_serialized", stats.hashSerialized.GetHex());
+    ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
+    return ret;
+}
+
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"filename\"\n"
+            "\nWrites a snapshot of the chain state (the unspent transaction outputs, the\n"
+            "Sprout, Sapling and Orchard anchors and nullifiers, and the history trees)\n"
+            "as of the current tip to a file in the -exportdir directory. The file ends\n"
+            "with a hash committing to its contents.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"filename\"    (string, required) The filename, saved in the folder set by the zcashd -exportdir option\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"coins_written\": n,     (numeric) The number of unspent transaction outputs written\n"
+            "  \"records_written\": n,   (numeric) The number of chain state records written\n"
+            "  \"base_hash\": \"hex\",    (string) The hash of the block the snapshot was taken at\n"
+            "  \"base_height\": n,       (numeric) The height of that block\n"
+            "  \"path\": \"path\",        (string) The full path of the snapshot file\n"
+            "  \"snapshot_hash\": \"hex\" (string) The hash the file commits to\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo\"")
+        );
+
+    fs::path exportdir;
+    try {
+        exportdir = GetExportDir();
+    } catch (const std::runtime_error& e) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, e.what());
+    }
+    if (exportdir.empty()) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Cannot export the chain state until the zcashd -exportdir option has been set");
+    }
+    std::string unclean = params[0].get_str();
+    std::string clean = SanitizeFilename(unclean);
+    if (clean.compare(unclean) != 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Filename is invalid as only alphanumeric characters are allowed.  Try '%s' instead.", clean));
+    }
+    fs::path path = exportdir / clean;
+    fs::path temppath = exportdir / (clean + ".incomplete");
+    if (fs::exists(path) || fs::exists(temppath)) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot overwrite existing file " + path.string());
+    }
+
+    CAutoFile file(fsbridge::fopen(temppath, "wb"), SER_DISK, CLIENT_VERSION);
+    if (file.IsNull()) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot open chain state snapshot file");
+    }
+
+    // The snapshot is taken from the coin database, once the cache has been
+    // written to it.
+    CCoinsSnapshotStats stats;
     FlushStateToDisk();
-    if (pcoinsTip->GetStats(stats)) {
-        ret.pushKV("height", (int64_t)stats.nHeight);
-        ret.pushKV("bestblock", stats.hashBlock.GetHex());
-        ret.pushKV("transactions", (int64_t)stats.nTransactions);
-        ret.pushKV("txouts", (int64_t)stats.nTransactionOutputs);
-        ret.pushKV("bytes_serialized", (int64_t)stats.nSerializedSize);
-        ret.pushKV("hash_serialized", stats.hashSerialized.GetHex());
-        ret.pushKV("total_amount", ValueFromAmount(stats.nTotalAmount));
+    bool fWritten = pcoinsTip->DumpSnapshot(file, stats);
+    file.fclose();
+    if (!fWritten || !RenameOver(temppath, path)) {
+        fs::remove(temppath);
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to write the chain state snapshot; see debug.log for details");
     }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("coins_written", stats.nCoins);
+    ret.pushKV("records_written", stats.nRecords);
+    ret.pushKV("base_hash", stats.hashBlock.GetHex());
+    ret.pushKV("base_height", stats.nHeight);
+    ret.pushKV("path", path.string());
+    ret.pushKV("snapshot_hash", stats.hashSnapshot.GetHex());
     return ret;
 }
 
@@ -855,7 +1155,6 @@ UniValue gettxout(const UniValue& params, bool fHelp)
             "        ,...\n"
             "     ]\n"
             "  },\n"
-            "  \"version\" : n,              (numeric) The version\n"
             "  \"coinbase\" : true|false     (boolean) Coinbase or not\n"
             "}\n"
 
@@ -879,33 +1178,32 @@ UniValue gettxout(const UniValue& params, bool fHelp)
     if (params.size() > 2)
         fMempool = params[2].get_bool();
 
-    CCoins coins;
+    COutPoint out(hash, n);
+    Coin coin;
     if (fMempool) {
         LOCK(mempool.cs);
         CCoinsViewMemPool view(pcoinsTip, mempool);
-        if (!view.GetCoins(hash, coins))
+        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) { // TODO: filtering spent coins should be done by the CCoinsViewMemPool
             return NullUniValue;
-        mempool.pruneSpent(hash, coins); // TODO: this should be done by the CCoinsViewMemPool
+        }
     } else {
-        if (!pcoinsTip->GetCoins(hash, coins))
+        if (!pcoinsTip->GetCoin(out, coin)) {
             return NullUniValue;
+        }
     }
-    if (n<0 || (unsigned int)n>=coins.vout.size() || coins.vout[n].IsNull())
-        return NullUniValue;
 
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     CBlockIndex *pindex = it->second;
     ret.pushKV("bestblock", pindex->GetBlockHash().GetHex());
-    if ((unsigned int)coins.nHeight == MEMPOOL_HEIGHT)
+    if (coin.nHeight == MEMPOOL_HEIGHT)
         ret.pushKV("confirmations", 0);
     else
-        ret.pushKV("confirmations", pindex->nHeight - coins.nHeight + 1);
-    ret.pushKV("value", ValueFromAmount(coins.vout[n].nValue));
+        ret.pushKV("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1));
+    ret.pushKV("value", ValueFromAmount(coin.out.nValue));
     UniValue o(UniValue::VOBJ);
-    ScriptPubKeyToJSON(coins.vout[n].scriptPubKey, o, true);
+    ScriptPubKeyToJSON(coin.out.scriptPubKey, o, true);
     ret.pushKV("scriptPubKey", o);
-    ret.pushKV("version", coins.nVersion);
-    ret.pushKV("coinbase", coins.fCoinBase);
+    ret.pushKV("coinbase", (bool)coin.fCoinBase);
 
     return ret;
 }
@@ -1168,18 +1466,10 @@ UniValue getchaintips(const UniValue& params, bool fHelp)
 
     LOCK(cs_main);
 
-    /* Build up a list of chain tips.  We start with the list of all
-       known blocks, and successively remove blocks that appear as pprev
-       of another block.  */
-    std::set<const CBlockIndex*, CompareBlocksByHeight> setTips;
-    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
-        setTips.insert(item.second);
-    for (const std::pair<const uint256, CBlockIndex*>& item : mapBlockIndex)
-    {
-        const CBlockIndex* pprev = item.second->pprev;
-        if (pprev)
-            setTips.erase(pprev);
-    }
+    /* The chain tips are kept up to date as blocks are added to the
+       block index; sort them by height.  */
+    std::vector<const CBlockIndex*> vTips = GetBlockIndexTips();
+    std::set<const CBlockIndex*, CompareBlocksByHeight> setTips(vTips.begin(), vTips.end());
 
     // Always report the currently active tip.
     setTips.insert(chainActive.Tip());
@@ -1372,6 +1662,316 @@ UniValue z_gettreestate(const UniValue& params, bool fHelp)
     return res;
 }
 
+// lightwalletd
+UniValue z_getsubtreesbyindex(const UniValue& params, bool fHelp)
+{
+    std::string disabledMsg = "";
+    if (!fExperimentalLightWalletd) {
+        disabledMsg = experimentalDisabledHelpMsg("z_getsubtreesbyindex", {"lightwalletd"});
+    }
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "z_getsubtreesbyindex \"pool\" start_index ( limit )\n"
+            "\nReturns the roots of the complete subtrees of 2^16 note commitments of a\n"
+            "note commitment tree, in order, from the given subtree index.\n"
+            + disabledMsg +
+            "\nArguments:\n"
+            "1. \"pool\"         (string, required) The shielded pool: \"sapling\" or \"orchard\"\n"
+            "2. start_index      (numeric, required) The index of the first subtree to return\n"
+            "3. limit            (numeric, optional) The largest number of subtrees to return\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"pool\": \"pool\",      (string) The shielded pool\n"
+            "  \"start_index\": n,     (numeric) The index of the first subtree\n"
+            "  \"subtrees\": [\n"
+            "    {\n"
+            "      \"root\": \"hex\",    (string) The root of the subtree\n"
+            "      \"end_height\": n   (numeric) The height of the block that completed the subtree\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_getsubtreesbyindex", "\"sapling\" 0 10")
+            + HelpExampleRpc("z_getsubtreesbyindex", "\"sapling\", 0, 10")
+        );
+
+    if (!fExperimentalLightWalletd) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Error: z_getsubtreesbyindex is disabled. "
+            "Run './zcash-cli help z_getsubtreesbyindex' for instructions on how to enable this feature.");
+    }
+
+    std::string strPool = params[0].get_str();
+    ShieldedType type;
+    if (strPool == "sapling") {
+        type = SAPLING;
+    } else if (strPool == "orchard") {
+        type = ORCHARD;
+    } else {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid pool; expected \"sapling\" or \"orchard\"");
+    }
+    int nStart = params[1].get_int();
+    if (nStart < 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid start_index");
+    }
+    int nLimit = std::numeric_limits<int>::max();
+    if (params.size() > 2) {
+        nLimit = params[2].get_int();
+        if (nLimit < 0) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid limit");
+        }
+    }
+
+    EnsureInsightIndexSynced();
+
+    std::vector<CSubtreeIndexValue> vSubtrees;
+    if (pinsightindex == NULL || !pinsightindex->ReadSubtreeIndex(type, nStart, nLimit, vSubtrees)) {
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the subtree index");
+    }
+
+    UniValue subtrees(UniValue::VARR);
+    {
+        LOCK(cs_main);
+        for (const CSubtreeIndexValue& subtree : vSubtrees) {
+            // The index may not have caught up with a reorg yet.
+            BlockMap::const_iterator it = mapBlockIndex.find(subtree.blockHash);
+            if (it == mapBlockIndex.end() || !chainActive.Contains(it->second)) {
+                break;
+            }
+            UniValue entry(UniValue::VOBJ);
+            entry.pushKV("root", HexStr(subtree.root.begin(), subtree.root.end()));
+            entry.pushKV("end_height", subtree.blockHeight);
+            subtrees.push_back(entry);
+        }
+    }
+
+    UniValue res(UniValue::VOBJ);
+    res.pushKV("pool", strPool);
+    res.pushKV("start_index", nStart);
+    res.pushKV("subtrees", subtrees);
+    return res;
+}
+
+UniValue getblockfilter(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "getblockfilter \"blockhash\" ( \"filtertype\" )\n"
+            "\nReturns the BIP 158 compact filter of a block of the active chain.\n"
+            "Requires -blockfilterindex.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"      (string, required) The hash of the block\n"
+            "2. \"filtertype\"     (string, optional, default=\"basic\") The type name of the filter\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"filter\" : \"hex\",   (string) The hex-encoded filter data\n"
+            "  \"header\" : \"hex\"    (string) The hex-encoded filter header\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\" \"basic\"")
+            + HelpExampleRpc("getblockfilter", "\"00000000c937983704a73af28acdec37b049d214adbda81d7e2a3dd146f6ed09\", \"basic\"")
+        );
+
+    uint256 hash(ParseHashV(params[0], "blockhash"));
+    std::string strFilterType = "basic";
+    if (params.size() > 1) {
+        strFilterType = params[1].get_str();
+    }
+    BlockFilterType filterType;
+    if (!BlockFilterTypeByName(strFilterType, filterType)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown filtertype");
+    }
+    if (!fBlockFilterIndex || pinsightindex == NULL) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Index is not enabled for filtertype " + strFilterType);
+    }
+
+    EnsureInsightIndexSynced();
+
+    {
+        LOCK(cs_main);
+        BlockMap::iterator it = mapBlockIndex.find(hash);
+        if (it == mapBlockIndex.end()) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
+        }
+        if (!chainActive.Contains(it->second)) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block is not in the active chain");
+        }
+    }
+
+    CBlockFilterIndexValue value;
+    if (!pinsightindex->ReadBlockFilter(hash, value)) {
+        throw JSONRPCError(RPC_MISC_ERROR, "Filter not found. Block filters are still in the process of being indexed.");
+    }
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("filter", HexStr(value.filter));
+    ret.pushKV("header", value.header.GetHex());
+    return ret;
+}
+
+/** The most blocks getsupplyinfo lists with verbose set. */
+static const int MAX_SUPPLY_INFO_BLOCKS = 10000;
+
+static UniValue SupplyPoolsToJSON(const CSupplyIndexValue& value, const CSupplyIndexValue* pprev)
+{
+    UniValue pools(UniValue::VARR);
+    for (int i = 0; i < SUPPLY_POOL_COUNT; i++) {
+        CAmount nChainValue = value.chainValue[i];
+        std::optional<CAmount> valueDelta;
+        if (pprev != nullptr) {
+            valueDelta = nChainValue - pprev->chainValue[i];
+        }
+        pools.push_back(ValuePoolDesc(SupplyPoolName((SupplyPool)i), nChainValue, valueDelta));
+    }
+    return pools;
+}
+
+UniValue getsupplyinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "getsupplyinfo start_height ( end_height verbose )\n"
+            "\nReturns the value pools and the issued supply of the active chain at end_height,\n"
+            "and how they changed from the block before start_height. Unlike the valuePools of\n"
+            "getblockchaininfo, this includes the transparent pool, and takes the same time for\n"
+            "any range of heights. Requires -supplyindex.\n"
+            "\nThe issued supply is the sum of the block subsidies, including the funding streams;\n"
+            "the pools add up to less than it by the value that miners did not claim.\n"
+            "\nArguments:\n"
+            "1. start_height     (numeric, required) The first height of the range\n"
+            "2. end_height       (numeric, optional, default=start_height) The last height of the range\n"
+            "3. verbose          (boolean, optional, default=false) Also list the changes of each block,\n"
+            "                    for ranges of at most " + std::to_string(MAX_SUPPLY_INFO_BLOCKS) + " blocks\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"start_height\": n,           (numeric) The first height of the range\n"
+            "  \"end_height\": n,             (numeric) The last height of the range\n"
+            "  \"end_hash\": \"hash\",         (string) The hash of the block at end_height\n"
+            "  \"valuePools\": [              (array) The pools at end_height (chainValue), and their change over the range (valueDelta)\n"
+            "    {\n"
+            "      \"id\": \"name\",           (string) transparent, sprout, sapling or orchard\n"
+            "      \"monitored\": true,       (boolean) Always true\n"
+            "      \"chainValue\": x.xxx,     (numeric) The total value in the pool\n"
+            "      \"chainValueZat\": n,      (numeric) The total value in the pool, in " + MINOR_CURRENCY_UNIT + "\n"
+            "      \"valueDelta\": x.xxx,     (numeric) The change of the pool over the range\n"
+            "      \"valueDeltaZat\": n       (numeric) The change of the pool over the range, in " + MINOR_CURRENCY_UNIT + "\n"
+            "    }, ...\n"
+            "  ],\n"
+            "  \"chainSupply\": x.xxx,        (numeric) The sum of the pools at end_height\n"
+            "  \"chainSupplyZat\": n,\n"
+            "  \"supplyDelta\": x.xxx,        (numeric) The change of the sum over the range\n"
+            "  \"supplyDeltaZat\": n,\n"
+            "  \"chainIssued\": x.xxx,        (numeric) The subsidies of the blocks up to end_height\n"
+            "  \"chainIssuedZat\": n,\n"
+            "  \"issuedDelta\": x.xxx,        (numeric) The subsidies of the blocks of the range\n"
+            "  \"issuedDeltaZat\": n,\n"
+            "  \"blocks\": [                  (array, verbose only) For each block of the range\n"
+            "    {\n"
+            "      \"height\": n,\n"
+            "      \"hash\": \"hash\",\n"
+            "      \"subsidy\": x.xxx,        (numeric) The subsidy of the block\n"
+            "      \"subsidyZat\": n,\n"
+            "      \"valuePools\": [ ... ]    (array) As above, for the block\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsupplyinfo", "1000000 1100000")
+            + HelpExampleRpc("getsupplyinfo", "1000000, 1100000")
+        );
+
+    int nStart = params[0].get_int();
+    int nEnd = nStart;
+    if (params.size() > 1) {
+        nEnd = params[1].get_int();
+    }
+    bool fVerbose = false;
+    if (params.size() > 2) {
+        fVerbose = params[2].get_bool();
+    }
+    if (nStart < 0 || nEnd < nStart) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid range of heights");
+    }
+    if (fVerbose && nEnd - nStart >= MAX_SUPPLY_INFO_BLOCKS) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("verbose is limited to %d blocks", MAX_SUPPLY_INFO_BLOCKS));
+    }
+    if (!fSupplyIndex || pinsightindex == NULL) {
+        throw JSONRPCError(RPC_MISC_ERROR, "The supply index is not enabled; restart with -supplyindex");
+    }
+
+    EnsureInsightIndexSynced();
+
+    // The entry of the block before the range, which the changes are taken
+    // from, then either those of the whole range or only of its last block.
+    std::vector<std::pair<int, CSupplyIndexValue>> vEntries;
+    bool fReadPrev = nStart > 0;
+    bool fRead = true;
+    if (fReadPrev) {
+        fRead &= pinsightindex->ReadSupplyIndex(nStart - 1, nStart - 1, vEntries);
+    }
+    if (fVerbose) {
+        fRead &= pinsightindex->ReadSupplyIndex(nStart, nEnd, vEntries);
+    } else {
+        fRead &= pinsightindex->ReadSupplyIndex(nEnd, nEnd, vEntries);
+    }
+    if (!fRead) {
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Unable to read the supply index");
+    }
+
+    {
+        LOCK(cs_main);
+        if (nEnd > chainActive.Height()) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Block height out of range");
+        }
+        // The index may not have caught up with a reorg yet.
+        size_t nExpected = (fReadPrev ? 1 : 0) + (fVerbose ? nEnd - nStart + 1 : 1);
+        bool fActive = vEntries.size() == nExpected;
+        for (size_t i = 0; fActive && i < vEntries.size(); i++) {
+            fActive = vEntries[i].second.blockHash == chainActive[vEntries[i].first]->GetBlockHash();
+        }
+        if (!fActive) {
+            throw JSONRPCError(RPC_MISC_ERROR, "The supply index does not have these heights yet");
+        }
+    }
+
+    const CSupplyIndexValue* pprev = fReadPrev ? &vEntries.front().second : nullptr;
+    const CSupplyIndexValue& end = vEntries.back().second;
+    CAmount nSupply = end.GetChainSupply();
+    CAmount nSupplyDelta = nSupply - (pprev ? pprev->GetChainSupply() : 0);
+    CAmount nIssuedDelta = end.nChainSubsidy - (pprev ? pprev->nChainSubsidy : 0);
+
+    UniValue res(UniValue::VOBJ);
+    res.pushKV("start_height", nStart);
+    res.pushKV("end_height", nEnd);
+    res.pushKV("end_hash", end.blockHash.GetHex());
+    // Without a block before the range (from the genesis block), the changes
+    // are the totals.
+    CSupplyIndexValue zero;
+    res.pushKV("valuePools", SupplyPoolsToJSON(end, pprev ? pprev : &zero));
+    res.pushKV("chainSupply", ValueFromAmount(nSupply));
+    res.pushKV("chainSupplyZat", nSupply);
+    res.pushKV("supplyDelta", ValueFromAmount(nSupplyDelta));
+    res.pushKV("supplyDeltaZat", nSupplyDelta);
+    res.pushKV("chainIssued", ValueFromAmount(end.nChainSubsidy));
+    res.pushKV("chainIssuedZat", end.nChainSubsidy);
+    res.pushKV("issuedDelta", ValueFromAmount(nIssuedDelta));
+    res.pushKV("issuedDeltaZat", nIssuedDelta);
+    if (fVerbose) {
+        UniValue blocks(UniValue::VARR);
+        for (size_t i = fReadPrev ? 1 : 0; i < vEntries.size(); i++) {
+            const CSupplyIndexValue& value = vEntries[i].second;
+            UniValue entry(UniValue::VOBJ);
+            entry.pushKV("height", vEntries[i].first);
+            entry.pushKV("hash", value.blockHash.GetHex());
+            entry.pushKV("subsidy", ValueFromAmount(value.nSubsidy));
+            entry.pushKV("subsidyZat", value.nSubsidy);
+            entry.pushKV("valuePools", SupplyPoolsToJSON(value, i > 0 ? &vEntries[i - 1].second : &zero));
+            blocks.push_back(entry);
+        }
+        res.pushKV("blocks", blocks);
+    }
+    return res;
+}
+
 UniValue mempoolInfoToJSON()
 {
     UniValue ret(UniValue::VOBJ);
@@ -1406,6 +2006,51 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue getindexinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 1)
+        throw runtime_error(
+            "getindexinfo ( \"index_name\" )\n"
+            "\nReturns the status of the optional indexes (from -txindex, -insightexplorer,\n"
+            "-lightwalletd, -blockfilterindex and -supplyindex), which are built in the background.\n"
+            "\nArguments:\n"
+            "1. \"index_name\"    (string, optional) Only return the status of this index\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"name\" : {                  (json object) One for each enabled index: txindex, addressindex, spentindex, timestampindex, subtreeindex, blockfilterindex, supplyindex\n"
+            "    \"synced\" : true|false,    (boolean) Whether the index is synced to the tip of the active chain\n"
+            "    \"best_block_height\" : n,  (numeric) The height of the last block in the index, or -1 if it is empty\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getindexinfo", "")
+            + HelpExampleCli("getindexinfo", "\"txindex\"")
+            + HelpExampleRpc("getindexinfo", "")
+            + HelpExampleRpc("getindexinfo", "\"txindex\"")
+        );
+
+    std::string strName;
+    if (params.size() > 0) {
+        strName = params[0].get_str();
+    }
+
+    UniValue result(UniValue::VOBJ);
+    if (pinsightindex == NULL) {
+        return result;
+    }
+    for (const CIndexSummary& summary : pinsightindex->GetSummaries()) {
+        if (!strName.empty() && summary.name != strName) {
+            continue;
+        }
+        UniValue entry(UniValue::VOBJ);
+        entry.pushKV("synced", summary.fSynced);
+        entry.pushKV("best_block_height", summary.nBestHeight);
+        result.pushKV(summary.name, entry);
+    }
+    return result;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -1483,6 +2128,146 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
     return NullUniValue;
 }
 
+/** The timeout of the wait methods, in milliseconds; zero waits for as long as it takes. */
+static std::chrono::milliseconds ParseWaitTimeout(const UniValue& params, size_t nIndex)
+{
+    int64_t nTimeout = params.size() > nIndex ? params[nIndex].get_int64() : 0;
+    if (nTimeout < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative timeout");
+    return std::chrono::milliseconds(nTimeout);
+}
+
+/**
+ * Wait, without cs_main, until fDone holds for the best block, the timeout
+ * passes, or RPC stops. Returns the best block by then.
+ */
+static UniValue WaitForBestBlock(std::chrono::milliseconds timeout, const std::function<bool(const uint256&, int)>& fDone)
+{
+    UniValue ret(UniValue::VOBJ);
+    {
+        WAIT_LOCK(g_best_block_mutex, lock);
+        auto predicate = [&]() { return fDone(g_best_block, g_best_block_height) || !IsRPCRunning(); };
+        if (timeout.count() > 0) {
+            g_best_block_cv.wait_for(lock, timeout, predicate);
+        } else {
+            g_best_block_cv.wait(lock, predicate);
+        }
+        ret.pushKV("hash", g_best_block.GetHex());
+        ret.pushKV("height", g_best_block_height);
+    }
+    if (!IsRPCRunning())
+        throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+    return ret;
+}
+
+static const std::string strWaitBlockResult =
+    "\nResult:\n"
+    "{                           (json object)\n"
+    "  \"hash\" : \"hash\",         (string) The hash of the best block\n"
+    "  \"height\" : n             (numeric) Its height\n"
+    "}\n";
+
+UniValue waitfornewblock(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() > 2)
+        throw runtime_error(
+            "waitfornewblock ( timeout \"current_tip\" )\n"
+            "\nWaits for the best block to change, and returns it. Use this instead of polling\n"
+            "getbestblockhash; it does not hold up block validation while waiting.\n"
+            "\nArguments:\n"
+            "1. timeout          (numeric, optional, default=0) The most milliseconds to wait, or 0 to wait until it changes\n"
+            "2. \"current_tip\"    (string, optional) Return as soon as the best block is not this one, rather than the\n"
+            "                    best block when the call is made, so that no block between two calls is missed\n"
+            + strWaitBlockResult +
+            "\nExamples:\n"
+            + HelpExampleCli("waitfornewblock", "1000")
+            + HelpExampleRpc("waitfornewblock", "1000")
+        );
+
+    std::chrono::milliseconds timeout = ParseWaitTimeout(params, 0);
+    uint256 hashTip;
+    if (params.size() > 1) {
+        hashTip = ParseHashV(params[1], "current_tip");
+    } else {
+        LOCK(g_best_block_mutex);
+        hashTip = g_best_block;
+    }
+    return WaitForBestBlock(timeout, [&](const uint256& hash, int nHeight) { return hash != hashTip; });
+}
+
+UniValue waitforblock(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "waitforblock \"blockhash\" ( timeout )\n"
+            "\nWaits for a block to become the best block, and returns the best block.\n"
+            "\nArguments:\n"
+            "1. \"blockhash\"      (string, required) The block to wait for\n"
+            "2. timeout          (numeric, optional, default=0) The most milliseconds to wait, or 0 to wait until it is\n"
+            + strWaitBlockResult +
+            "\nExamples:\n"
+            + HelpExampleCli("waitforblock", "\"0000000000079f8ef3d2c688c244eb7a4570b24c9ed7b4a8c619eb02596f8862\" 1000")
+            + HelpExampleRpc("waitforblock", "\"0000000000079f8ef3d2c688c244eb7a4570b24c9ed7b4a8c619eb02596f8862\", 1000")
+        );
+
+    uint256 hashWaited = ParseHashV(params[0], "blockhash");
+    std::chrono::milliseconds timeout = ParseWaitTimeout(params, 1);
+    return WaitForBestBlock(timeout, [&](const uint256& hash, int nHeight) { return hash == hashWaited; });
+}
+
+UniValue waitforblockheight(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "waitforblockheight height ( timeout )\n"
+            "\nWaits for the best block to be at least at a height, and returns it.\n"
+            "\nArguments:\n"
+            "1. height           (numeric, required) The height to wait for\n"
+            "2. timeout          (numeric, optional, default=0) The most milliseconds to wait, or 0 to wait until it is\n"
+            + strWaitBlockResult +
+            "\nExamples:\n"
+            + HelpExampleCli("waitforblockheight", "100 1000")
+            + HelpExampleRpc("waitforblockheight", "100, 1000")
+        );
+
+    int nHeightWaited = params[0].get_int();
+    std::chrono::milliseconds timeout = ParseWaitTimeout(params, 1);
+    return WaitForBestBlock(timeout, [&](const uint256& hash, int nHeight) { return nHeight >= nHeightWaited; });
+}
+
+UniValue waitformempoolsequence(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2)
+        throw runtime_error(
+            "waitformempoolsequence sequence ( timeout )\n"
+            "\nWaits for a transaction to be added to or removed from the mempool after the given\n"
+            "mempool sequence number, and returns the sequence number then. The sequence counts\n"
+            "the transactions added and removed, as in the zmq \"sequence\" notifications. Use\n"
+            "this instead of polling getrawmempool.\n"
+            "\nArguments:\n"
+            "1. sequence         (numeric, required) The sequence number last seen, or 0 to get the current one\n"
+            "2. timeout          (numeric, optional, default=0) The most milliseconds to wait, or 0 to wait until it changes\n"
+            "\nResult:\n"
+            "{                           (json object)\n"
+            "  \"sequence\" : n           (numeric) The mempool sequence number\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("waitformempoolsequence", "42 1000")
+            + HelpExampleRpc("waitformempoolsequence", "42, 1000")
+        );
+
+    int64_t nSequence = params[0].get_int64();
+    if (nSequence < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative sequence");
+    std::chrono::milliseconds timeout = ParseWaitTimeout(params, 1);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("sequence", mempool.WaitForSequence(nSequence, timeout, [] { return !IsRPCRunning(); }));
+    if (!IsRPCRunning())
+        throw JSONRPCError(RPC_CLIENT_NOT_CONNECTED, "Shutting down");
+    return ret;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
@@ -1492,14 +2277,23 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblock",               &getblock,               true  },
     { "blockchain",         "getblockhash",           &getblockhash,           true  },
     { "blockchain",         "getblockheader",         &getblockheader,         true  },
+    { "blockchain",         "getblockfilter",         &getblockfilter,         true  },
     { "blockchain",         "getchaintips",           &getchaintips,           true  },
+    { "blockchain",         "getsupplyinfo",          &getsupplyinfo,          true  },
     { "blockchain",         "z_gettreestate",         &z_gettreestate,         true  },
+    { "blockchain",         "z_getsubtreesbyindex",   &z_getsubtreesbyindex,   true  },
     { "blockchain",         "getdifficulty",          &getdifficulty,          true  },
+    { "blockchain",         "getindexinfo",           &getindexinfo,           true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
+    { "blockchain",         "waitforblock",           &waitforblock,           true  },
+    { "blockchain",         "waitforblockheight",     &waitforblockheight,     true  },
+    { "blockchain",         "waitfornewblock",        &waitfornewblock,        true  },
+    { "blockchain",         "waitformempoolsequence", &waitformempoolsequence, true  },
 
     // insightexplorer
     { "blockchain",         "getblockdeltas",         &getblockdeltas,         false },
@@ -1514,4 +2308,7 @@ void RegisterBlockchainRPCCommands(CRPCTable &tableRPC)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+    tableRPC.appendStreamedCommand("getblock", &getblock_streamed);
+    tableRPC.appendStreamedCommand("getblockheader", &getblockheader_streamed);
+    tableRPC.appendStreamedCommand("getrawmempool", &getrawmempool_streamed);
 }
@@ -65,6 +65,12 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "listunspent", 2 },
     { "getblock", 1 },
     { "getblockheader", 1 },
+    { "waitfornewblock", 0 },
+    { "waitforblock", 1 },
+    { "waitforblockheight", 0 },
+    { "waitforblockheight", 1 },
+    { "waitformempoolsequence", 0 },
+    { "waitformempoolsequence", 1 },
     { "gettransaction", 1 },
     { "getrawtransaction", 1 },
     { "createrawtransaction", 0 },
@@ -104,6 +110,11 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblockhashes", 1},
     { "getblockhashes", 2},
     { "getblockdeltas", 0},
+    { "getsupplyinfo", 0},
+    { "getsupplyinfo", 1},
+    { "getsupplyinfo", 2},
+    { "z_getsubtreesbyindex", 1},
+    { "z_getsubtreesbyindex", 2},
     { "zcrawjoinsplit", 1 },
     { "zcrawjoinsplit", 2 },
     { "zcrawjoinsplit", 3 },
@@ -120,6 +131,9 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "z_getaddressforaccount", 0},
     { "z_getaddressforaccount", 1},
     { "z_getaddressforaccount", 2},
+    { "z_getaddressesforaccount", 0},
+    { "z_getaddressesforaccount", 1},
+    { "z_getaddressesforaccount", 2},
     { "z_getbalance", 1},
     { "z_getbalance", 2},
     { "z_getbalanceforaccount", 0},
@@ -132,11 +146,13 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "z_mergetoaddress", 2},
     { "z_mergetoaddress", 3},
     { "z_mergetoaddress", 4},
+    { "z_mergetoaddress", 6},
     { "z_sendmany", 1},
     { "z_sendmany", 2},
     { "z_sendmany", 3},
     { "z_shieldcoinbase", 2},
     { "z_shieldcoinbase", 3},
+    { "z_shieldcoinbase", 4},
     { "z_getoperationstatus", 0},
     { "z_getoperationresult", 0},
     { "z_importkey", 2 },
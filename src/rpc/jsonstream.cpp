@@ -0,0 +1,93 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "rpc/jsonstream.h"
+
+#include <assert.h>
+
+void CJSONStreamWriter::BeginElement()
+{
+    if (fPendingKey) {
+        fPendingKey = false;
+        return;
+    }
+    if (!vHasElement.empty()) {
+        if (vHasElement.back())
+            buffer += ',';
+        vHasElement.back() = true;
+    }
+}
+
+void CJSONStreamWriter::Append(const std::string& s)
+{
+    buffer += s;
+    if (buffer.size() >= CHUNK_SIZE)
+        Flush();
+}
+
+void CJSONStreamWriter::BeginObject()
+{
+    BeginElement();
+    buffer += '{';
+    vHasElement.push_back(false);
+}
+
+void CJSONStreamWriter::EndObject()
+{
+    assert(!vHasElement.empty() && !fPendingKey);
+    vHasElement.pop_back();
+    Append("}");
+}
+
+void CJSONStreamWriter::BeginArray()
+{
+    BeginElement();
+    buffer += '[';
+    vHasElement.push_back(false);
+}
+
+void CJSONStreamWriter::EndArray()
+{
+    assert(!vHasElement.empty() && !fPendingKey);
+    vHasElement.pop_back();
+    Append("]");
+}
+
+void CJSONStreamWriter::Key(const std::string& key)
+{
+    assert(!vHasElement.empty() && !fPendingKey);
+    BeginElement();
+    // The escaped key is the text of the string value.
+    buffer += UniValue(key).write();
+    buffer += ':';
+    fPendingKey = true;
+}
+
+void CJSONStreamWriter::Value(const UniValue& val)
+{
+    BeginElement();
+    Append(val.write());
+}
+
+void CJSONStreamWriter::RawValue(const std::string& json)
+{
+    BeginElement();
+    Append(json);
+}
+
+void CJSONStreamWriter::Members(const UniValue& obj)
+{
+    const std::vector<std::string>& keys = obj.getKeys();
+    const std::vector<UniValue>& values = obj.getValues();
+    for (size_t i = 0; i < keys.size(); i++)
+        KeyValue(keys[i], values[i]);
+}
+
+void CJSONStreamWriter::Flush()
+{
+    if (!buffer.empty()) {
+        sink(buffer.data(), buffer.size());
+        buffer.clear();
+    }
+}
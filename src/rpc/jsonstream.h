@@ -0,0 +1,63 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_RPC_JSONSTREAM_H
+#define ZCASH_RPC_JSONSTREAM_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+/**
+ * Writes a JSON document in pieces, with the same text UniValue::write()
+ * would give for it, so that large results do not have to be built as a
+ * UniValue first. Small values are written from UniValues; the text is
+ * handed to the sink in chunks of about CHUNK_SIZE bytes, and what is left
+ * when Flush() is called.
+ */
+class CJSONStreamWriter
+{
+public:
+    typedef std::function<void(const char* data, size_t len)> Sink;
+
+    static const size_t CHUNK_SIZE = 64 * 1024;
+
+    explicit CJSONStreamWriter(const Sink& sink) : sink(sink), fPendingKey(false) {}
+
+    CJSONStreamWriter(const CJSONStreamWriter&) = delete;
+    CJSONStreamWriter& operator=(const CJSONStreamWriter&) = delete;
+
+    void BeginObject();
+    void EndObject();
+    void BeginArray();
+    void EndArray();
+    //! Write the key of the next member of the current object.
+    void Key(const std::string& key);
+    void Value(const UniValue& val);
+    void KeyValue(const std::string& key, const UniValue& val)
+    {
+        Key(key);
+        Value(val);
+    }
+    //! Write a value that is already JSON text, such as a cached result.
+    void RawValue(const std::string& json);
+    //! Write each member of a UniValue object as a member of the current one.
+    void Members(const UniValue& obj);
+    //! Hand the text written so far to the sink.
+    void Flush();
+
+private:
+    Sink sink;
+    std::string buffer;
+    //! For each open object or array, whether it has an element yet.
+    std::vector<bool> vHasElement;
+    bool fPendingKey;
+
+    void BeginElement();
+    void Append(const std::string& s);
+};
+
+#endif // ZCASH_RPC_JSONSTREAM_H
@@ -585,16 +585,11 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     auto minerAddress = maybeMinerAddress.value();
 
     static unsigned int nTransactionsUpdatedLast;
-    static std::optional<CMutableTransaction> cached_next_cb_mtx;
-    static int cached_next_cb_height;
 
-    // Use the cached shielded coinbase only if the height hasn't changed.
+    // The coinbase of an empty block, if one was built in advance for the
+    // height of the template.
     const int nHeight = chainActive.Tip()->nHeight;
-    if (cached_next_cb_height != nHeight + 2) {
-        cached_next_cb_mtx = nullopt;
-    }
-
-    std::optional<CMutableTransaction> next_cb_mtx(cached_next_cb_mtx);
+    std::optional<CMutableTransaction> next_cb_mtx;
 
     if (!lpval.isNull())
     {
@@ -618,46 +613,50 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
             nTransactionsUpdatedLastLP = nTransactionsUpdatedLast;
         }
 
+        // Whether to respond with an empty block using a precomputed coinbase.
+        bool fUsePrecomputedCoinbase = IsShieldedMinerAddress(minerAddress);
+
         // Release the main lock while waiting
         // Don't call chainActive->Tip() without holding cs_main
         LEAVE_CRITICAL_SECTION(cs_main);
         {
             checktxtime = std::chrono::steady_clock::now() + std::chrono::seconds(10);
 
+            // While waiting, build the coinbase for the block following the next
+            // block in the background (since this is cpu-intensive), so that when
+            // the next block arrives, we can quickly respond with a template for
+            // the following block.
+            if (fUsePrecomputedCoinbase) {
+                PrecomputeCoinbaseTransaction(Params(), minerAddress, nHeight + 2);
+            }
+
             WAIT_LOCK(g_best_block_mutex, lock);
             while (g_best_block == hashWatchedChain && IsRPCRunning())
             {
-                // Before waiting, generate the coinbase for the block following the next
-                // block (since this is cpu-intensive), so that when next block arrives,
-                // we can quickly respond with a template for following block.
-                // Note that the time to create the coinbase tx here does not add to,
-                // but instead is included in, the 10 second delay, since we're waiting
-                // until an absolute time is reached.
-                if (!cached_next_cb_mtx && IsShieldedMinerAddress(minerAddress)) {
-                    cached_next_cb_height = nHeight + 2;
-                    cached_next_cb_mtx = CreateCoinbaseTransaction(
-                        Params(), CAmount{0}, minerAddress, cached_next_cb_height);
-                    next_cb_mtx = cached_next_cb_mtx;
-                }
                 bool timedout = g_best_block_cv.wait_until(lock, checktxtime) == std::cv_status::timeout;
 
                 // Optimization: even if timed out, a new block may have arrived
-                // while waiting for cs_main; if so, don't discard next_cb_mtx.
+                // while waiting for cs_main; if so, don't discard the coinbase.
                 if (g_best_block != hashWatchedChain) break;
 
                 // Timeout: Check transactions for update
                 if (timedout && mempool.GetTransactionsUpdated() != nTransactionsUpdatedLastLP) {
                     // Create a non-empty block.
-                    next_cb_mtx = nullopt;
+                    fUsePrecomputedCoinbase = false;
                     break;
                 }
                 checktxtime += std::chrono::seconds(10);
             }
             if (g_best_block_height != nHeight + 1) {
                 // Unexpected height (reorg or >1 blocks arrived while waiting) invalidates coinbase tx.
-                next_cb_mtx = nullopt;
+                fUsePrecomputedCoinbase = false;
             }
         }
+        if (fUsePrecomputedCoinbase) {
+            // Finishing a coinbase already being built is still quicker than
+            // building one with fees.
+            next_cb_mtx = GetPrecomputedCoinbaseTransaction(minerAddress, nHeight + 2, true);
+        }
         ENTER_CRITICAL_SECTION(cs_main);
 
         if (!IsRPCRunning())
@@ -672,6 +671,12 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
     if (!lpval.isNull() || pindexPrev != chainActive.Tip() ||
         (mempool.GetTransactionsUpdated() != nTransactionsUpdatedLast && GetTime() - nStart > 5))
     {
+        // The first template on a new tip is an empty block if its coinbase was
+        // already built in the background.
+        if (!next_cb_mtx && pindexPrev != chainActive.Tip() && IsShieldedMinerAddress(minerAddress)) {
+            next_cb_mtx = GetPrecomputedCoinbaseTransaction(minerAddress, chainActive.Height() + 1, false);
+        }
+
         // Clear pindexPrev so future calls make a new block, despite any failures from here on
         pindexPrev = nullptr;
 
@@ -705,6 +710,11 @@ UniValue getblocktemplate(const UniValue& params, bool fHelp)
         // Mark script as important because it was used at least for one coinbase output
         std::visit(KeepMinerAddress(), minerAddress);
 
+        // Start building the coinbase for the next height, for when the tip changes.
+        if (IsShieldedMinerAddress(minerAddress)) {
+            PrecomputeCoinbaseTransaction(Params(), minerAddress, pindexPrevNew->nHeight + 2);
+        }
+
         // Need to update only after we know CreateNewBlock succeeded
         pindexPrev = pindexPrevNew;
     }
@@ -906,30 +916,42 @@ UniValue submitblock(const UniValue& params, bool fHelp)
 
 UniValue estimatefee(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 1)
+    if (fHelp || params.size() < 1 || params.size() > 2)
         throw runtime_error(
-            "estimatefee nblocks\n"
+            "estimatefee nblocks ( \"type\" )\n"
             "\nEstimates the approximate fee per kilobyte\n"
             "needed for a transaction to begin confirmation\n"
             "within nblocks blocks.\n"
             "\nArguments:\n"
             "1. nblocks     (numeric)\n"
+            "2. \"type\"      (string, optional) Only consider transactions of this type:\n"
+            "                \"transparent\" (no shielded components), \"sapling\" (Sapling or\n"
+            "                Sprout, but no Orchard components) or \"orchard\".\n"
             "\nResult:\n"
             "n :    (numeric) estimated fee-per-kilobyte\n"
             "\n"
             "-1.0 is returned if not enough transactions and\n"
             "blocks have been observed to make an estimate.\n"
-            "\nExample:\n"
+            "\nExamples:\n"
             + HelpExampleCli("estimatefee", "6")
+            + HelpExampleCli("estimatefee", "6 \"orchard\"")
             );
 
-    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM));
+    RPCTypeCheck(params, boost::assign::list_of(UniValue::VNUM)(UniValue::VSTR));
 
     int nBlocks = params[0].get_int();
     if (nBlocks < 1)
         nBlocks = 1;
 
-    CFeeRate feeRate = mempool.estimateFee(nBlocks);
+    CFeeRate feeRate;
+    if (params.size() > 1) {
+        FeeEstimateType type;
+        if (!ParseFeeEstimateType(params[1].get_str(), type))
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid transaction type");
+        feeRate = mempool.estimateFee(nBlocks, type);
+    } else {
+        feeRate = mempool.estimateFee(nBlocks);
+    }
     if (feeRate == CFeeRate(0))
         return -1.0;
 
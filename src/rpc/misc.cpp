@@ -12,6 +12,8 @@
 #include "net.h"
 #include "netbase.h"
 #include "rpc/server.h"
+#include "startupprofile.h"
+#include "support/hugepages.h"
 #include "txmempool.h"
 #include "util/system.h"
 #ifdef ENABLE_WALLET
@@ -20,6 +22,7 @@
 #endif
 
 #include <stdint.h>
+#include <optional>
 #include <variant>
 
 #include <boost/assign/list_of.hpp>
@@ -619,6 +622,112 @@ static bool getAddressesFromParams(
     return true;
 }
 
+// The page of results asked for: at most limit results (all of them if it
+// is zero), from the cursor returned with the previous page if set.
+struct AddressIndexPage {
+    int limit = 0;
+    std::string cursor;
+};
+
+static AddressIndexPage getPageParams(const UniValue& params)
+{
+    AddressIndexPage page;
+    if (params[0].isObject()) {
+        UniValue limitValue = find_value(params[0].get_obj(), "limit");
+        UniValue cursorValue = find_value(params[0].get_obj(), "cursor");
+        if (!limitValue.isNull()) {
+            page.limit = limitValue.get_int();
+            if (page.limit <= 0) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "Limit is expected to be greater than zero");
+            }
+        }
+        if (!cursorValue.isNull()) {
+            if (page.limit == 0) {
+                throw JSONRPCError(RPC_INVALID_PARAMETER, "A cursor is only accepted together with a limit");
+            }
+            page.cursor = cursorValue.get_str();
+        }
+    }
+    return page;
+}
+
+// A cursor is the position of the next entry: the index of its address in
+// the request and its key in the address index.
+template <typename Key>
+static std::string makeCursor(size_t nAddress, const Key& key)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << (uint32_t)nAddress << key;
+    return HexStr(ss.begin(), ss.end());
+}
+
+template <typename Key>
+static void parseCursor(
+    const std::string& strCursor,
+    const std::vector<std::pair<uint160, int>>& addresses,
+    size_t& nAddress, Key& key)
+{
+    bool fValid = IsHex(strCursor);
+    if (fValid) {
+        CDataStream ss(ParseHex(strCursor), SER_NETWORK, PROTOCOL_VERSION);
+        uint32_t n = 0;
+        try {
+            ss >> n >> key;
+        } catch (const std::exception&) {
+            fValid = false;
+        }
+        nAddress = n;
+        fValid = fValid && ss.empty() && nAddress < addresses.size() &&
+            key.hashBytes == addresses[nAddress].first && (int)key.type == addresses[nAddress].second;
+    }
+    if (!fValid) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    }
+}
+
+// Visit the address index entries of the addresses in the height range, an
+// address at a time, reading them from the index as they are visited. Only
+// the page asked for is visited; if there are more entries, strNext is set
+// to the cursor of the next one. If fByTx is set, the limit counts the
+// transactions of each address rather than the entries, and a page does not
+// split the entries of a transaction.
+static void forEachAddressIndexEntry(
+    const std::vector<std::pair<uint160, int>>& addresses,
+    int start, int end,
+    const AddressIndexPage& page, bool fByTx, std::string& strNext,
+    const std::function<void(const CAddressIndexKey&, CAmount)>& visit)
+{
+    size_t nAddress = 0;
+    CAddressIndexKey keyFrom;
+    bool fFrom = !page.cursor.empty();
+    if (fFrom) {
+        parseCursor(page.cursor, addresses, nAddress, keyFrom);
+    }
+
+    int nCount = 0;
+    for (; nAddress < addresses.size() && strNext.empty(); nAddress++) {
+        std::optional<uint256> lastTx;
+        bool fFound = ForEachAddressIndex(addresses[nAddress].first, addresses[nAddress].second, start, end,
+            fFrom ? &keyFrom : nullptr,
+            [&](const CAddressIndexKey& key, CAmount nValue) {
+                bool fNew = !fByTx || lastTx != key.txhash;
+                if (fNew && page.limit > 0 && nCount == page.limit) {
+                    strNext = makeCursor(nAddress, key);
+                    return false;
+                }
+                nCount += fNew;
+                lastTx = key.txhash;
+                visit(key, nValue);
+                return true;
+            });
+        if (!fFound) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+                "No information available for address");
+        }
+        fFrom = false;
+    }
+}
+
 // insightexplorer
 UniValue getaddressmempool(const UniValue& params, bool fHelp)
 {
@@ -718,6 +827,9 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "      ,...\n"
             "    ],\n"
             "  \"chainInfo\"  (boolean, optional, default=false) Include chain info with results\n"
+            "  \"limit\"      (number, optional) Return a page of at most this many outputs, in the order of\n"
+            "               the index (by address, then outpoint) rather than by height\n"
+            "  \"cursor\"     (string, optional) The cursor returned with the previous page, to continue from\n"
             "}\n"
             "(or)\n"
             "\"address\"  (string) The base58check encoded address\n"
@@ -732,7 +844,7 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "    \"satoshis\"  (number) The number of zatoshis of the output\n"
             "  }, ...\n"
             "]\n\n"
-            "(or, if chainInfo is true):\n\n"
+            "(or, if chainInfo is true or limit is given):\n\n"
             "{\n"
             "  \"utxos\":\n"
             "    [\n"
@@ -745,8 +857,9 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "        \"satoshis\"    (number)  The number of zatoshis of the output\n"
             "      }, ...\n"
             "    ],\n"
-            "  \"hash\"              (string)  The block hash\n"
-            "  \"height\"            (numeric) The block height\n"
+            "  \"cursor\"            (string)  The cursor of the next page, if there are more outputs\n"
+            "  \"hash\"              (string)  The block hash, if chainInfo is true\n"
+            "  \"height\"            (numeric) The block height, if chainInfo is true\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressutxos", "'{\"addresses\": [\"tmYXBYJj1K7vhejSec5osXK2QsGa5MTisUQ\"], \"chainInfo\": true}'")
@@ -758,6 +871,8 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
             "Run './zcash-cli help getaddressutxos' for instructions on how to enable this feature.");
     }
 
+    EnsureInsightIndexSynced();
+
     bool includeChainInfo = false;
     if (params[0].isObject()) {
         UniValue chainInfo = find_value(params[0].get_obj(), "chainInfo");
@@ -769,39 +884,76 @@ UniValue getaddressutxos(const UniValue& params, bool fHelp)
     if (!getAddressesFromParams(params, addresses)) {
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
     }
-    std::vector<CAddressUnspentDbEntry> unspentOutputs;
-    for (const auto& it : addresses) {
-        if (!GetAddressUnspent(it.first, it.second, unspentOutputs)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
-        }
-    }
-    std::sort(unspentOutputs.begin(), unspentOutputs.end(),
-        [](const CAddressUnspentDbEntry& a, const CAddressUnspentDbEntry& b) -> bool {
-            return a.second.blockHeight < b.second.blockHeight;
-        });
+    AddressIndexPage page = getPageParams(params);
 
     UniValue utxos(UniValue::VARR);
-    for (const auto& it : unspentOutputs) {
+    auto pushOutput = [&](const CAddressUnspentKey& key, const CAddressUnspentValue& value) {
         UniValue output(UniValue::VOBJ);
         std::string address;
-        if (!getAddressFromIndex(it.first.type, it.first.hashBytes, address)) {
+        if (!getAddressFromIndex(key.type, key.hashBytes, address)) {
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
         }
 
         output.pushKV("address", address);
-        output.pushKV("txid", it.first.txhash.GetHex());
-        output.pushKV("outputIndex", (int)it.first.index);
-        output.pushKV("script", HexStr(it.second.script.begin(), it.second.script.end()));
-        output.pushKV("satoshis", it.second.satoshis);
-        output.pushKV("height", it.second.blockHeight);
+        output.pushKV("txid", key.txhash.GetHex());
+        output.pushKV("outputIndex", (int)key.index);
+        output.pushKV("script", HexStr(value.script.begin(), value.script.end()));
+        output.pushKV("satoshis", value.satoshis);
+        output.pushKV("height", value.blockHeight);
         utxos.push_back(output);
+    };
+
+    std::string strNext;
+    if (page.limit == 0) {
+        std::vector<CAddressUnspentDbEntry> unspentOutputs;
+        for (const auto& it : addresses) {
+            if (!GetAddressUnspent(it.first, it.second, unspentOutputs)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
+        }
+        std::sort(unspentOutputs.begin(), unspentOutputs.end(),
+            [](const CAddressUnspentDbEntry& a, const CAddressUnspentDbEntry& b) -> bool {
+                return a.second.blockHeight < b.second.blockHeight;
+            });
+        for (const auto& it : unspentOutputs) {
+            pushOutput(it.first, it.second);
+        }
+    } else {
+        // Pages are in the order of the index: by address, then outpoint.
+        size_t nAddress = 0;
+        CAddressUnspentKey keyFrom;
+        bool fFrom = !page.cursor.empty();
+        if (fFrom) {
+            parseCursor(page.cursor, addresses, nAddress, keyFrom);
+        }
+        for (; nAddress < addresses.size() && strNext.empty(); nAddress++) {
+            bool fFound = ForEachAddressUnspent(addresses[nAddress].first, addresses[nAddress].second,
+                fFrom ? &keyFrom : nullptr,
+                [&](const CAddressUnspentKey& key, const CAddressUnspentValue& value) {
+                    if ((int)utxos.size() == page.limit) {
+                        strNext = makeCursor(nAddress, key);
+                        return false;
+                    }
+                    pushOutput(key, value);
+                    return true;
+                });
+            if (!fFound) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "No information available for address");
+            }
+            fFrom = false;
+        }
     }
 
-    if (!includeChainInfo)
+    if (!includeChainInfo && page.limit == 0)
         return utxos;
 
     UniValue result(UniValue::VOBJ);
     result.pushKV("utxos", utxos);
+    if (!strNext.empty()) {
+        result.pushKV("cursor", strNext);
+    }
+    if (!includeChainInfo)
+        return result;
 
     LOCK(cs_main);  // for chainActive
     result.pushKV("hash", chainActive.Tip()->GetBlockHash().GetHex());
@@ -837,24 +989,6 @@ static void getHeightRange(const UniValue& params, int& start, int& end)
     }
 }
 
-// Parse an address list then fetch the corresponding addressindex information.
-static void getAddressesInHeightRange(
-    const UniValue& params,
-    int start, int end,
-    std::vector<std::pair<uint160, int>>& addresses,
-    std::vector<std::pair<CAddressIndexKey, CAmount>> &addressIndex)
-{
-    if (!getAddressesFromParams(params, addresses)) {
-        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
-    }
-    for (const auto& it : addresses) {
-        if (!GetAddressIndex(it.first, it.second, addressIndex, start, end)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
-                "No information available for address");
-        }
-    }
-}
-
 // insightexplorer
 UniValue getaddressdeltas(const UniValue& params, bool fHelp)
 {
@@ -879,6 +1013,8 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "  \"start\"       (number, optional) The start block height\n"
             "  \"end\"         (number, optional) The end block height\n"
             "  \"chainInfo\"   (boolean, optional, default=false) Include chain info in results, only applies if start and end specified\n"
+            "  \"limit\"       (number, optional) Return a page of at most this many changes\n"
+            "  \"cursor\"      (string, optional) The cursor returned with the previous page, to continue from\n"
             "}\n"
             "(or)\n"
             "\"address\"       (string) The base58check encoded address\n"
@@ -892,7 +1028,7 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "    \"address\"   (string) The base58check encoded address\n"
             "  }, ...\n"
             "]\n\n"
-            "(or, if chainInfo is true):\n\n"
+            "(or, if chainInfo is true or limit is given):\n\n"
             "{\n"
             "  \"deltas\":\n"
             "    [\n"
@@ -904,6 +1040,7 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "        \"address\"     (string)  The address base58check encoded\n"
             "      }, ...\n"
             "    ],\n"
+            "  \"cursor\"          (string)  The cursor of the next page, if there are more changes\n"
             "  \"start\":\n"
             "    {\n"
             "      \"hash\"          (string)  The start block hash\n"
@@ -925,13 +1062,17 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
             "Run './zcash-cli help getaddressdeltas' for instructions on how to enable this feature.");
     }
 
+    EnsureInsightIndexSynced();
+
     int start = 0;
     int end = 0;
     getHeightRange(params, start, end);
+    AddressIndexPage page = getPageParams(params);
 
     std::vector<std::pair<uint160, int>> addresses;
-    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
-    getAddressesInHeightRange(params, start, end, addresses, addressIndex);
+    if (!getAddressesFromParams(params, addresses)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
 
     bool includeChainInfo = false;
     if (params[0].isObject()) {
@@ -942,25 +1083,36 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     }
 
     UniValue deltas(UniValue::VARR);
-    for (const auto& it : addressIndex) {
-        std::string address;
-        if (!getAddressFromIndex(it.first.type, it.first.hashBytes, address)) {
-            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
-        }
+    std::string strNext;
+    forEachAddressIndexEntry(addresses, start, end, page, false, strNext,
+        [&](const CAddressIndexKey& key, CAmount nValue) {
+            std::string address;
+            if (!getAddressFromIndex(key.type, key.hashBytes, address)) {
+                throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Unknown address type");
+            }
 
-        UniValue delta(UniValue::VOBJ);
-        delta.pushKV("address", address);
-        delta.pushKV("blockindex", (int)it.first.txindex);
-        delta.pushKV("height", it.first.blockHeight);
-        delta.pushKV("index", (int)it.first.index);
-        delta.pushKV("satoshis", it.second);
-        delta.pushKV("txid", it.first.txhash.GetHex());
-        deltas.push_back(delta);
-    }
+            UniValue delta(UniValue::VOBJ);
+            delta.pushKV("address", address);
+            delta.pushKV("blockindex", (int)key.txindex);
+            delta.pushKV("height", key.blockHeight);
+            delta.pushKV("index", (int)key.index);
+            delta.pushKV("satoshis", nValue);
+            delta.pushKV("txid", key.txhash.GetHex());
+            deltas.push_back(delta);
+        });
 
     UniValue result(UniValue::VOBJ);
 
-    if (!(includeChainInfo && start > 0 && end > 0)) {
+    includeChainInfo = includeChainInfo && start > 0 && end > 0;
+    if (page.limit > 0) {
+        result.pushKV("deltas", deltas);
+        if (!strNext.empty()) {
+            result.pushKV("cursor", strNext);
+        }
+        if (!includeChainInfo) {
+            return result;
+        }
+    } else if (!includeChainInfo) {
         return deltas;
     }
 
@@ -977,7 +1129,9 @@ UniValue getaddressdeltas(const UniValue& params, bool fHelp)
     startInfo.pushKV("height", start);
     endInfo.pushKV("height", end);
 
-    result.pushKV("deltas", deltas);
+    if (page.limit == 0) {
+        result.pushKV("deltas", deltas);
+    }
     result.pushKV("start", startInfo);
     result.pushKV("end", endInfo);
 
@@ -993,7 +1147,7 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
     }
     if (fHelp || params.size() != 1)
         throw runtime_error(
-            "getaddressbalance {\"addresses\": [\"taddr\", ...]}\n"
+            "getaddressbalance {\"addresses\": [\"taddr\", ...], (\"mempool\": true|false)}\n"
             "\nReturns the balance for addresses.\n"
             + disabledMsg +
             "\nArguments:\n"
@@ -1002,7 +1156,8 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
             "    [\n"
             "      \"address\"  (string) The base58check encoded address\n"
             "      ,...\n"
-            "    ]\n"
+            "    ],\n"
+            "  \"mempool\"  (boolean, optional, default=false) Include the change to the balance by the mempool\n"
             "}\n"
             "(or)\n"
             "\"address\"  (string) The base58check encoded address\n"
@@ -1010,6 +1165,10 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
             "{\n"
             "  \"balance\"  (string) The current balance in zatoshis\n"
             "  \"received\"  (string) The total number of zatoshis received (including change)\n"
+            "  \"txcount\"  (number) The number of transactions paying to or spending from each address,\n"
+            "             added up over the addresses\n"
+            "  \"mempoolBalance\"  (number) The change to the balance by the transactions in the mempool,\n"
+            "             in zatoshis, if mempool is true\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddressbalance", "'{\"addresses\": [\"tmYXBYJj1K7vhejSec5osXK2QsGa5MTisUQ\"]}'")
@@ -1021,23 +1180,59 @@ UniValue getaddressbalance(const UniValue& params, bool fHelp)
             "Run './zcash-cli help getaddressbalance' for instructions on how to enable this feature.");
     }
 
+    EnsureInsightIndexSynced();
+
+    bool includeMempool = false;
+    if (params[0].isObject()) {
+        UniValue mempoolValue = find_value(params[0].get_obj(), "mempool");
+        if (!mempoolValue.isNull()) {
+            includeMempool = mempoolValue.get_bool();
+        }
+    }
     std::vector<std::pair<uint160, int>> addresses;
-    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
-    // this method doesn't take start and end block height params, so set
-    // to zero (full range, entire blockchain)
-    getAddressesInHeightRange(params, 0, 0, addresses, addressIndex);
+    if (!getAddressesFromParams(params, addresses)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
 
     CAmount balance = 0;
     CAmount received = 0;
-    for (const auto& it : addressIndex) {
-        if (it.second > 0) {
-            received += it.second;
+    int64_t txCount = 0;
+    for (const auto& it : addresses) {
+        CAddressBalanceValue totals;
+        if (GetAddressBalance(it.first, it.second, totals)) {
+            balance += totals.balance;
+            received += totals.received;
+            txCount += totals.txCount;
+            continue;
+        }
+
+        // The address index was built without the balances; add up the
+        // entries of the address instead, over the entire blockchain.
+        std::optional<uint256> lastTx;
+        bool fFound = ForEachAddressIndex(it.first, it.second, 0, 0, nullptr,
+            [&](const CAddressIndexKey& key, CAmount nValue) {
+                if (nValue > 0) {
+                    received += nValue;
+                }
+                balance += nValue;
+                if (lastTx != key.txhash) {
+                    txCount++;
+                    lastTx = key.txhash;
+                }
+                return true;
+            });
+        if (!fFound) {
+            throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+                "No information available for address");
         }
-        balance += it.second;
     }
     UniValue result(UniValue::VOBJ);
     result.pushKV("balance", balance);
     result.pushKV("received", received);
+    result.pushKV("txcount", txCount);
+    if (includeMempool) {
+        result.pushKV("mempoolBalance", mempool.getAddressBalanceDelta(addresses));
+    }
     return result;
 }
 
@@ -1065,6 +1260,9 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
             "    ]\n"
             "  \"start\" (number, optional) The start block height\n"
             "  \"end\" (number, optional) The end block height\n"
+            "  \"limit\" (number, optional) Return a page of at most this many txids of each address in\n"
+            "          turn; a transaction of several of the addresses appears once for each\n"
+            "  \"cursor\" (string, optional) The cursor returned with the previous page, to continue from\n"
             "}\n"
             "(or)\n"
             "\"address\"  (string) The base58check encoded address\n"
@@ -1072,7 +1270,12 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
             "[\n"
             "  \"transactionid\"  (string) The transaction id\n"
             "  ,...\n"
-            "]\n"
+            "]\n\n"
+            "(or, if limit is given):\n\n"
+            "{\n"
+            "  \"txids\": [\"transactionid\", ...],\n"
+            "  \"cursor\"  (string) The cursor of the next page, if there are more txids\n"
+            "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getaddresstxids", "'{\"addresses\": [\"tmYXBYJj1K7vhejSec5osXK2QsGa5MTisUQ\"], \"start\": 1000, \"end\": 2000}'")
             + HelpExampleRpc("getaddresstxids", "{\"addresses\": [\"tmYXBYJj1K7vhejSec5osXK2QsGa5MTisUQ\"], \"start\": 1000, \"end\": 2000}")
@@ -1083,28 +1286,50 @@ UniValue getaddresstxids(const UniValue& params, bool fHelp)
             "Run './zcash-cli help getaddresstxids' for instructions on how to enable this feature.");
     }
 
+    EnsureInsightIndexSynced();
+
     int start = 0;
     int end = 0;
     getHeightRange(params, start, end);
+    AddressIndexPage page = getPageParams(params);
 
     std::vector<std::pair<uint160, int>> addresses;
-    std::vector<std::pair<CAddressIndexKey, CAmount>> addressIndex;
-    getAddressesInHeightRange(params, start, end, addresses, addressIndex);
-
-    // This is an ordered set, sorted by (height,txindex) so result also sorted by height.
-    std::set<std::tuple<int, int, std::string>> txids;
+    if (!getAddressesFromParams(params, addresses)) {
+        throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Invalid address");
+    }
 
-    for (const auto& it : addressIndex) {
-        const int height = it.first.blockHeight;
-        const int txindex = it.first.txindex;
-        const std::string txid = it.first.txhash.GetHex();
-        // Duplicate entries (two addresses in same tx) are suppressed
-        txids.insert(std::make_tuple(height, txindex, txid));
+    if (page.limit > 0) {
+        // A page lists the transactions of each address in turn.
+        UniValue txids(UniValue::VARR);
+        std::string strNext;
+        std::optional<uint256> lastTx;
+        forEachAddressIndexEntry(addresses, start, end, page, true, strNext,
+            [&](const CAddressIndexKey& key, CAmount nValue) {
+                if (lastTx != key.txhash) {
+                    txids.push_back(key.txhash.GetHex());
+                    lastTx = key.txhash;
+                }
+            });
+        UniValue result(UniValue::VOBJ);
+        result.pushKV("txids", txids);
+        if (!strNext.empty()) {
+            result.pushKV("cursor", strNext);
+        }
+        return result;
     }
+
+    // This is an ordered set, sorted by (height,txindex) so result also sorted by height.
+    std::set<std::tuple<int, int, uint256>> txids;
+    std::string strNext;
+    forEachAddressIndexEntry(addresses, start, end, page, false, strNext,
+        [&](const CAddressIndexKey& key, CAmount nValue) {
+            // Duplicate entries (two addresses in same tx) are suppressed
+            txids.insert(std::make_tuple(key.blockHeight, (int)key.txindex, key.txhash));
+        });
     UniValue result(UniValue::VARR);
     for (const auto& it : txids) {
         // only push the txid, not the height
-        result.push_back(std::get<2>(it));
+        result.push_back(std::get<2>(it).GetHex());
     }
 
     return result;
@@ -1143,6 +1368,8 @@ UniValue getspentinfo(const UniValue& params, bool fHelp)
             "Run './zcash-cli help getspentinfo' for instructions on how to enable this feature.");
     }
 
+    EnsureInsightIndexSynced();
+
     UniValue txidValue = find_value(params[0].get_obj(), "txid");
     UniValue indexValue = find_value(params[0].get_obj(), "index");
 
@@ -1183,15 +1410,28 @@ static UniValue RPCLockedMemoryInfo()
     return obj;
 }
 
+static UniValue RPCHugePageInfo()
+{
+    HugePageStats stats = GetHugePageStats();
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("mapped", uint64_t(stats.mapped));
+    obj.pushKV("explicit", uint64_t(stats.explicit_mapped));
+    obj.pushKV("free", uint64_t(stats.free));
+    return obj;
+}
+
 UniValue getmemoryinfo(const UniValue& params, bool fHelp)
 {
     /* Please, avoid using the word "pool" here in the RPC interface or help,
      * as users will undoubtedly confuse it with the other "memory pool"
      */
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "getmemoryinfo\n"
+            "getmemoryinfo ( \"mode\" )\n"
             "Returns an object containing information about memory usage.\n"
+            "\nArguments:\n"
+            "1. \"mode\"              (string, optional, default=\"stats\") \"stats\" returns the locked memory statistics.\n"
+            "                         \"detailed\" also returns an estimate of the memory used by each major cache and index.\n"
             "\nResult:\n"
             "{\n"
             "  \"locked\": {               (json object) Information about locked memory manager\n"
@@ -1201,22 +1441,150 @@ UniValue getmemoryinfo(const UniValue& params, bool fHelp)
             "    \"locked\": xxxxxx,       (numeric) Amount of bytes that succeeded locking. If this number is smaller than total, locking pages failed at some point and key data could be swapped to disk.\n"
             "    \"chunks_used\": xxxxx,   (numeric) Number allocated chunks\n"
             "    \"chunks_free\": xxxxx,   (numeric) Number unused chunks\n"
+            "  },\n"
+            "  \"hugepages\": {            (json object) Information about the huge pages set up by -hugepages\n"
+            "    \"mapped\": xxxxx,        (numeric) Number of bytes mapped for huge pages\n"
+            "    \"explicit\": xxxxx,      (numeric) Of those, the bytes mapped from the reserved huge pages\n"
+            "    \"free\": xxxxx,          (numeric) Number of bytes in freed chunks kept for reuse\n"
+            "  },\n"
+            "  \"usage\": {                (json object, only in \"detailed\" mode) Estimated bytes of memory used by each component\n"
+            "    \"coins_cache\": xxxxx,   (numeric) The UTXO and shielded state cache\n"
+            "    \"block_index\": xxxxx,   (numeric) The block index and active chain\n"
+            "    \"recent_rejects\": xxx,  (numeric) The filter of recently rejected transactions\n"
+            "    \"mempool\": xxxxx,       (numeric) The memory pool\n"
+            "    \"signature_cache\": xx,  (numeric) The script signature cache\n"
+            "    \"proof_cache\": xxxxx,   (numeric) The shielded proof verification cache\n"
+            "    \"addrman\": xxxxx,       (numeric) The peer address manager\n"
+            "    \"leveldb_<name>\": xxx,  (numeric) The write buffer and block cache of each database\n"
+            "    \"wallet\": xxxxx,        (numeric) The wallet's transactions, if the wallet is enabled\n"
+            "    \"orchard_wallet\": xxx,  (numeric) A lower bound on the Orchard wallet's state, if the wallet is enabled\n"
             "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getmemoryinfo", "")
-            + HelpExampleRpc("getmemoryinfo", "")
+            + HelpExampleCli("getmemoryinfo", "\"detailed\"")
+            + HelpExampleRpc("getmemoryinfo", "\"detailed\"")
         );
+
+    std::string strMode = params.size() > 0 ? params[0].get_str() : "stats";
+    if (strMode != "stats" && strMode != "detailed") {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "unknown mode " + strMode);
+    }
+
     UniValue obj(UniValue::VOBJ);
     obj.pushKV("locked", RPCLockedMemoryInfo());
+    obj.pushKV("hugepages", RPCHugePageInfo());
+    if (strMode == "detailed") {
+        UniValue usage(UniValue::VOBJ);
+        for (const auto& [strComponent, nUsage] : GetMemoryUsage()) {
+            usage.pushKV(strComponent, uint64_t(nUsage));
+        }
+        obj.pushKV("usage", usage);
+    }
+    return obj;
+}
+
+UniValue getstartupinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getstartupinfo\n"
+            "Returns how long the phases of the node's startup took, and the resources they used.\n"
+            "Phases that ran at the same time as others are counted in the resources of each.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"total_ms\": xxxxx,           (numeric) The time from the start of the process to the end of startup\n"
+            "  \"phases\": [                  (array) The phases, in the order they finished\n"
+            "    {\n"
+            "      \"name\": \"xxxx\",          (string) The phase\n"
+            "      \"start_ms\": xxxxx,       (numeric) When the phase started, from the start of the process\n"
+            "      \"duration_ms\": xxxxx,    (numeric) How long the phase took\n"
+            "      \"cpu_user_ms\": xxxxx,    (numeric) The CPU time the process spent in user mode meanwhile\n"
+            "      \"cpu_system_ms\": xxxxx,  (numeric) The CPU time the process spent in the kernel meanwhile\n"
+            "      \"blocks_read\": xxxxx,    (numeric) The file system blocks the process read meanwhile\n"
+            "      \"blocks_written\": xxxxx  (numeric) The file system blocks the process wrote meanwhile\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getstartupinfo", "")
+            + HelpExampleRpc("getstartupinfo", "")
+        );
+
+    UniValue phases(UniValue::VARR);
+    for (const CStartupPhase& phase : GetStartupPhases()) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("name", phase.strName);
+        obj.pushKV("start_ms", phase.nStartMillis);
+        obj.pushKV("duration_ms", phase.nDurationMillis);
+        obj.pushKV("cpu_user_ms", phase.usage.nUserMicros / 1000);
+        obj.pushKV("cpu_system_ms", phase.usage.nSystemMicros / 1000);
+        obj.pushKV("blocks_read", phase.usage.nBlocksRead);
+        obj.pushKV("blocks_written", phase.usage.nBlocksWritten);
+        phases.push_back(obj);
+    }
+
+    UniValue obj(UniValue::VOBJ);
+    std::optional<int64_t> nStartupMillis = GetStartupMillis();
+    if (nStartupMillis.has_value())
+        obj.pushKV("total_ms", nStartupMillis.value());
+    obj.pushKV("phases", phases);
     return obj;
 }
 
+UniValue getlockstats(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getlockstats\n"
+            "Returns how long the sites that take locks (such as cs_main) waited for them, and the\n"
+            "hold times of a sample of one in " + std::to_string(LOCK_HOLD_SAMPLE_INTERVAL) + " of the locks each thread takes,\n"
+            "since the node started, by site, the sites that waited longest first.\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"lock\": \"xxxx\",          (string) The lock, as named at the site\n"
+            "    \"site\": \"file:line\",     (string) Where the lock is taken\n"
+            "    \"contentions\": n,        (numeric) The times the site had to wait for the lock\n"
+            "    \"wait_us\": n,            (numeric) The total time it waited, in microseconds\n"
+            "    \"max_wait_us\": n,        (numeric) The longest time it waited\n"
+            "    \"hold_samples\": n,       (numeric) The times its hold time was sampled\n"
+            "    \"hold_us\": n,            (numeric) The total of the sampled hold times, in microseconds\n"
+            "    \"max_hold_us\": n         (numeric) The longest sampled hold time\n"
+            "  }, ...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getlockstats", "")
+            + HelpExampleRpc("getlockstats", "")
+        );
+
+    std::vector<CLockSiteStats> vStats = GetLockStats();
+    std::sort(vStats.begin(), vStats.end(), [](const CLockSiteStats& a, const CLockSiteStats& b) {
+        return a.nWaitMicros > b.nWaitMicros;
+    });
+    UniValue result(UniValue::VARR);
+    for (const CLockSiteStats& stats : vStats) {
+        UniValue obj(UniValue::VOBJ);
+        obj.pushKV("lock", stats.strName);
+        obj.pushKV("site", strprintf("%s:%d", stats.strFile, stats.nLine));
+        obj.pushKV("contentions", stats.nContentions);
+        obj.pushKV("wait_us", stats.nWaitMicros);
+        obj.pushKV("max_wait_us", stats.nMaxWaitMicros);
+        obj.pushKV("hold_samples", stats.nHoldSamples);
+        obj.pushKV("hold_us", stats.nHoldMicros);
+        obj.pushKV("max_hold_us", stats.nMaxHoldMicros);
+        result.push_back(obj);
+    }
+    return result;
+}
+
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
     { "control",            "getinfo",                &getinfo,                true  }, /* uses wallet if enabled */
     { "control",            "getmemoryinfo",          &getmemoryinfo,          true  },
+    { "control",            "getstartupinfo",         &getstartupinfo,         true  },
+    { "control",            "getlockstats",           &getlockstats,           true  },
     { "util",               "validateaddress",        &validateaddress,        true  }, /* uses wallet if enabled */
     { "util",               "z_validateaddress",      &z_validateaddress,      true  }, /* uses wallet if enabled */
     { "util",               "createmultisig",         &createmultisig,         true  },
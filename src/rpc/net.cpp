@@ -96,6 +96,7 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"timeoffset\": ttt,         (numeric) The time offset in seconds\n"
             "    \"pingtime\": n,             (numeric) ping time\n"
             "    \"pingwait\": n,             (numeric) ping wait\n"
+            "    \"processingtime\": n,       (numeric) The CPU time spent processing the peer's messages, in seconds\n"
             "    \"version\": v,              (numeric) The peer version, such as 170002\n"
             "    \"subver\": \"/MagicBean:x.y.z[-v]/\",  (string) The string version\n"
             "    \"inbound\": true|false,     (boolean) Inbound (true) or Outbound (false)\n"
@@ -106,7 +107,9 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
             "    \"inflight\": [\n"
             "       n,                        (numeric) The heights of blocks we're currently asking from this peer\n"
             "       ...\n"
-            "    ]\n"
+            "    ],\n"
+            "    \"blockdownloadrate\": n,    (numeric) The rate in bytes per second at which the peer delivers the blocks we request, or 0 if it has not yet\n"
+            "    \"maxblocksinflight\": n,    (numeric) The number of blocks we request from the peer at a time, based on its download rate\n"
             "  }\n"
             "  ,...\n"
             "]\n"
@@ -141,6 +144,7 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
         obj.pushKV("pingtime", stats.dPingTime);
         if (stats.dPingWait > 0.0)
             obj.pushKV("pingwait", stats.dPingWait);
+        obj.pushKV("processingtime", stats.dProcessingTime);
         obj.pushKV("version", stats.nVersion);
         // Use the sanitized form of subver here, to avoid tricksy remote peers from
         // corrupting or modifying the JSON output by putting special characters in
@@ -157,6 +161,8 @@ UniValue getpeerinfo(const UniValue& params, bool fHelp)
                 heights.push_back(height);
             }
             obj.pushKV("inflight", heights);
+            obj.pushKV("blockdownloadrate", (int64_t)statestats.dDownloadRate);
+            obj.pushKV("maxblocksinflight", statestats.nBlocksInTransitLimit);
         }
         obj.pushKV("whitelisted", stats.fWhitelisted);
 
@@ -27,13 +27,18 @@ using namespace std;
  * 1.2 spec: https://www.jsonrpc.org/historical/jsonrpc12_proposal.html
  */
 
-string JSONRPCRequest(const string& strMethod, const UniValue& params, const UniValue& id)
+UniValue JSONRPCRequestObj(const string& strMethod, const UniValue& params, const UniValue& id)
 {
     UniValue request(UniValue::VOBJ);
     request.pushKV("method", strMethod);
     request.pushKV("params", params);
     request.pushKV("id", id);
-    return request.write() + "\n";
+    return request;
+}
+
+string JSONRPCRequest(const string& strMethod, const UniValue& params, const UniValue& id)
+{
+    return JSONRPCRequestObj(strMethod, params, id).write() + "\n";
 }
 
 UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const UniValue& id)
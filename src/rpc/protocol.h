@@ -79,6 +79,7 @@ enum RPCErrorCode
     RPC_WALLET_BACKUP_REQUIRED      = -18, //! User must acknowledge backup of the mnemonic seed.
 };
 
+UniValue JSONRPCRequestObj(const std::string& strMethod, const UniValue& params, const UniValue& id);
 std::string JSONRPCRequest(const std::string& strMethod, const UniValue& params, const UniValue& id);
 UniValue JSONRPCReplyObj(const UniValue& result, const UniValue& error, const UniValue& id);
 std::string JSONRPCReply(const UniValue& result, const UniValue& error, const UniValue& id);
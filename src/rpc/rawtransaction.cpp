@@ -8,6 +8,7 @@
 #include "consensus/validation.h"
 #include "core_io.h"
 #include "init.h"
+#include "insightindex.h"
 #include "deprecation.h"
 #include "key_io.h"
 #include "keystore.h"
@@ -16,6 +17,8 @@
 #include "net.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
+#include "rpc/jsonstream.h"
+#include "rpc/responsecache.h"
 #include "rpc/server.h"
 #include "script/script.h"
 #include "script/script_error.h"
@@ -229,6 +232,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
 
     KeyIO keyIO(Params());
     UniValue vin(UniValue::VARR);
+    vin.reserve(tx.vin.size());
     for (const CTxIn& txin : tx.vin) {
         UniValue in(UniValue::VOBJ);
         if (tx.IsCoinBase())
@@ -256,10 +260,11 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
             }
         }
         in.pushKV("sequence", (int64_t)txin.nSequence);
-        vin.push_back(in);
+        vin.push_back(std::move(in));
     }
-    entry.pushKV("vin", vin);
+    entry.pushKV("vin", std::move(vin));
     UniValue vout(UniValue::VARR);
+    vout.reserve(tx.vout.size());
     for (unsigned int i = 0; i < tx.vout.size(); i++) {
         const CTxOut& txout = tx.vout[i];
         UniValue out(UniValue::VOBJ);
@@ -279,9 +284,9 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
             out.pushKV("spentIndex", (int)spentInfo.inputIndex);
             out.pushKV("spentHeight", spentInfo.blockHeight);
         }
-        vout.push_back(out);
+        vout.push_back(std::move(out));
     }
-    entry.pushKV("vout", vout);
+    entry.pushKV("vout", std::move(vout));
 
     UniValue vjoinsplit = TxJoinSplitToJSON(tx);
     entry.pushKV("vjoinsplit", vjoinsplit);
@@ -335,6 +340,22 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry)
     }
 }
 
+/** The result of getrawtransaction. Requires cs_main. */
+static UniValue RawTransactionResult(const CTransaction& tx, const uint256& hash_block, bool fVerbose, const CBlockIndex* blockindex, bool in_active_chain)
+{
+    AssertLockHeld(cs_main);
+    string strHex = EncodeHexTx(tx);
+
+    if (!fVerbose)
+        return strHex;
+
+    UniValue result(UniValue::VOBJ);
+    if (blockindex) result.pushKV("in_active_chain", in_active_chain);
+    result.pushKV("hex", strHex);
+    TxToJSON(tx, hash_block, result);
+    return result;
+}
+
 UniValue getrawtransaction(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() < 1 || params.size() > 3)
@@ -503,6 +524,10 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             + HelpExampleCli("getrawtransaction", "\"mytxid\" 1 \"myblockhash\"")
         );
 
+    // The transaction index is written in the background, so wait for it to
+    // include the blocks connected so far.
+    bool fTxIndexSynced = fTxIndex && pinsightindex != NULL && pinsightindex->BlockUntilSyncedToCurrentChain();
+
     LOCK(cs_main);
 
     bool in_active_chain = true;
@@ -535,23 +560,57 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
             }
             errmsg = "No such transaction found in the provided block";
         } else {
-            errmsg = fTxIndex
+            errmsg = fTxIndexSynced
               ? "No such mempool or blockchain transaction"
+              : fTxIndex
+              ? "No such mempool transaction. Blockchain transactions are still in the process of being indexed"
               : "No such mempool transaction. Use -txindex to enable blockchain transaction queries";
         }
         throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, errmsg + ". Use gettransaction for wallet transactions.");
     }
 
-    string strHex = EncodeHexTx(tx);
+    return RawTransactionResult(tx, hash_block, fVerbose, blockindex, in_active_chain);
+}
 
-    if (!fVerbose)
-        return strHex;
+/**
+ * Serves the result of getrawtransaction for a transaction in a block buried
+ * deep enough from the response cache, caching it if it was not. Lookups in
+ * a given block are left to getrawtransaction, as are transactions that are
+ * not found, for its error.
+ */
+static RPCStreamedResult getrawtransaction_streamed(const UniValue& params)
+{
+    if (params.size() < 1 || params.size() > 2)
+        return nullptr;
 
-    UniValue result(UniValue::VOBJ);
-    if (blockindex) result.pushKV("in_active_chain", in_active_chain);
-    result.pushKV("hex", strHex);
-    TxToJSON(tx, hash_block, result);
-    return result;
+    uint256 hash = ParseHashV(params[0], "parameter 1");
+    bool fVerbose = false;
+    if (params.size() > 1)
+        fVerbose = (params[1].get_int() != 0);
+
+    if (fTxIndex && pinsightindex != NULL)
+        pinsightindex->BlockUntilSyncedToCurrentChain();
+
+    LOCK(cs_main);
+    std::string key = ResponseCacheKey("getrawtransaction", hash, fVerbose);
+    std::optional<std::string> cached = GetCachedResponse(key);
+    if (!cached) {
+        CTransaction tx;
+        uint256 hash_block;
+        if (!GetTransaction(hash, tx, Params().GetConsensus(), hash_block, true))
+            return nullptr;
+
+        UniValue result = RawTransactionResult(tx, hash_block, fVerbose, nullptr, true);
+        BlockMap::iterator mi = mapBlockIndex.find(hash_block);
+        if (mi == mapBlockIndex.end() || !IsResponseCacheable(mi->second)) {
+            return [result](CJSONStreamWriter& writer) { writer.Value(result); };
+        }
+        cached = result.write();
+        CacheResponse(key, mi->second, *cached);
+    }
+    return [strJSON = std::move(*cached)](CJSONStreamWriter& writer) {
+        writer.RawValue(strJSON);
+    };
 }
 
 UniValue gettxoutproof(const UniValue& params, bool fHelp)
@@ -590,6 +649,10 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp)
        oneTxid = hash;
     }
 
+    if (pinsightindex != NULL) {
+        pinsightindex->BlockUntilSyncedToCurrentChain();
+    }
+
     LOCK(cs_main);
 
     CBlockIndex* pblockindex = NULL;
@@ -602,9 +665,9 @@ UniValue gettxoutproof(const UniValue& params, bool fHelp)
             throw JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY, "Block not found");
         pblockindex = mapBlockIndex[hashBlock];
     } else {
-        CCoins coins;
-        if (pcoinsTip->GetCoins(oneTxid, coins) && coins.nHeight > 0 && coins.nHeight <= chainActive.Height())
-            pblockindex = chainActive[coins.nHeight];
+        const Coin& coin = AccessByTxid(*pcoinsTip, oneTxid);
+        if (!coin.IsSpent() && coin.nHeight > 0 && coin.nHeight <= (unsigned int)chainActive.Height())
+            pblockindex = chainActive[coin.nHeight];
     }
 
     if (pblockindex == NULL)
@@ -1045,9 +1108,7 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
         view.SetBackend(viewMempool); // temporarily switch cache backend to db+mempool view
 
         for (const CTxIn& txin : mergedTx.vin) {
-            const uint256& prevHash = txin.prevout.hash;
-            CCoins coins;
-            view.AccessCoins(prevHash); // this is certainly allowed to fail
+            view.AccessCoin(txin.prevout); // Load entries from viewChain into view; can fail.
         }
 
         view.SetBackend(viewDummy); // switch back to avoid locking mempool for too long
@@ -1095,20 +1156,22 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
             CScript scriptPubKey(pkData.begin(), pkData.end());
 
             {
-                CCoinsModifier coins = view.ModifyCoins(txid);
-                if (coins->IsAvailable(nOut) && coins->vout[nOut].scriptPubKey != scriptPubKey) {
+                COutPoint out(txid, nOut);
+                const Coin& coin = view.AccessCoin(out);
+                if (!coin.IsSpent() && coin.out.scriptPubKey != scriptPubKey) {
                     string err("Previous output scriptPubKey mismatch:\n");
-                    err = err + ScriptToAsmStr(coins->vout[nOut].scriptPubKey) + "\nvs:\n"+
+                    err = err + ScriptToAsmStr(coin.out.scriptPubKey) + "\nvs:\n"+
                         ScriptToAsmStr(scriptPubKey);
                     throw JSONRPCError(RPC_DESERIALIZATION_ERROR, err);
                 }
-                if ((unsigned int)nOut >= coins->vout.size())
-                    coins->vout.resize(nOut+1);
-                coins->vout[nOut].scriptPubKey = scriptPubKey;
-                coins->vout[nOut].nValue = 0;
+                Coin newcoin;
+                newcoin.out.scriptPubKey = scriptPubKey;
+                newcoin.out.nValue = 0;
                 if (prevOut.exists("amount")) {
-                    coins->vout[nOut].nValue = AmountFromValue(find_value(prevOut, "amount"));
+                    newcoin.out.nValue = AmountFromValue(find_value(prevOut, "amount"));
                 }
+                newcoin.nHeight = 1;
+                view.AddCoin(out, std::move(newcoin), true);
             }
 
             // if redeemScript given and not using the local wallet (private keys
@@ -1189,13 +1252,13 @@ UniValue signrawtransaction(const UniValue& params, bool fHelp)
     // Sign what we can:
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++) {
         CTxIn& txin = mergedTx.vin[i];
-        const CCoins* coins = view.AccessCoins(txin.prevout.hash);
-        if (coins == NULL || !coins->IsAvailable(txin.prevout.n)) {
+        const Coin& coin = view.AccessCoin(txin.prevout);
+        if (coin.IsSpent()) {
             TxInErrorToJSON(txin, vErrors, "Input not found or already spent");
             continue;
         }
-        const CScript& prevPubKey = coins->vout[txin.prevout.n].scriptPubKey;
-        const CAmount& amount = coins->vout[txin.prevout.n].nValue;
+        const CScript& prevPubKey = coin.out.scriptPubKey;
+        const CAmount& amount = coin.out.nValue;
 
         SignatureData sigdata;
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
@@ -1278,9 +1341,12 @@ UniValue sendrawtransaction(const UniValue& params, bool fHelp)
         fOverrideFees = params[1].get_bool();
 
     CCoinsViewCache &view = *pcoinsTip;
-    const CCoins* existingCoins = view.AccessCoins(hashTx);
+    bool fHaveChain = false;
+    for (size_t o = 0; !fHaveChain && o < tx.vout.size(); o++) {
+        const Coin& existingCoin = view.AccessCoin(COutPoint(hashTx, o));
+        fHaveChain = !existingCoin.IsSpent();
+    }
     bool fHaveMempool = mempool.exists(hashTx);
-    bool fHaveChain = existingCoins && existingCoins->nHeight < 1000000000;
     if (!fHaveMempool && !fHaveChain) {
         // push to local node and sync with wallets
         CValidationState state;
@@ -1321,4 +1387,5 @@ void RegisterRawTransactionRPCCommands(CRPCTable &tableRPC)
 {
     for (unsigned int vcidx = 0; vcidx < ARRAYLEN(commands); vcidx++)
         tableRPC.appendCommand(commands[vcidx].name, &commands[vcidx]);
+    tableRPC.appendStreamedCommand("getrawtransaction", &getrawtransaction_streamed);
 }
@@ -0,0 +1,164 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "rpc/responsecache.h"
+
+#include "chain.h"
+#include "insightindex.h"
+#include "main.h"
+#include "tinyformat.h"
+
+#include <rust/metrics.h>
+
+CResponseCache responseCache(DEFAULT_RPC_RESPONSE_CACHE_SIZE * 1024 * 1024);
+
+CCachedResponse::CCachedResponse(const std::string& strJSON, int nConfirmations, const uint256& hashBlockIn, const uint256& hashNextIn) :
+    hashBlock(hashBlockIn), hashNext(hashNextIn)
+{
+    const std::string strKey = "\"confirmations\":";
+    const std::string strValue = std::to_string(nConfirmations);
+    size_t nStart = 0;
+    size_t nPos = 0;
+    while ((nPos = strJSON.find(strKey, nPos)) != std::string::npos) {
+        size_t nValue = nPos + strKey.size();
+        size_t nEnd = nValue + strValue.size();
+        // A quote inside a string is escaped, so a match that follows the
+        // start of an object or a comma is a member, and not text in a
+        // string; its value has to end where the number does.
+        if (nPos > 0 && (strJSON[nPos - 1] == '{' || strJSON[nPos - 1] == ',') &&
+            strJSON.compare(nValue, strValue.size(), strValue) == 0 &&
+            nEnd < strJSON.size() && (strJSON[nEnd] == ',' || strJSON[nEnd] == '}')) {
+            vParts.push_back(strJSON.substr(nStart, nValue - nStart));
+            nStart = nEnd;
+            nPos = nEnd;
+        } else {
+            nPos = nValue;
+        }
+    }
+    vParts.push_back(strJSON.substr(nStart));
+
+    nSize = sizeof(*this);
+    for (const std::string& part : vParts)
+        nSize += sizeof(part) + part.size();
+}
+
+std::string CCachedResponse::Render(int nConfirmations) const
+{
+    const std::string strValue = std::to_string(nConfirmations);
+    std::string strJSON;
+    strJSON.reserve(nSize + vParts.size() * strValue.size());
+    strJSON += vParts[0];
+    for (size_t i = 1; i < vParts.size(); i++) {
+        strJSON += strValue;
+        strJSON += vParts[i];
+    }
+    return strJSON;
+}
+
+CResponseCache::Entry CResponseCache::Get(const std::string& key)
+{
+    LOCK(cs);
+    auto it = mapEntries.find(key);
+    if (it == mapEntries.end())
+        return nullptr;
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+}
+
+void CResponseCache::Insert(const std::string& key, const Entry& entry)
+{
+    LOCK(cs);
+    if (entry->size() + key.size() > nMaxSize)
+        return;
+    auto it = mapEntries.find(key);
+    if (it != mapEntries.end())
+        Erase(it);
+    lru.emplace_front(key, entry);
+    mapEntries.emplace(key, lru.begin());
+    nSize += entry->size() + key.size();
+    Trim();
+}
+
+void CResponseCache::SetMaxSize(size_t nMaxSizeIn)
+{
+    LOCK(cs);
+    nMaxSize = nMaxSizeIn;
+    Trim();
+}
+
+size_t CResponseCache::GetMaxSize()
+{
+    LOCK(cs);
+    return nMaxSize;
+}
+
+void CResponseCache::Erase(std::map<std::string, std::list<std::pair<std::string, Entry>>::iterator>::iterator it)
+{
+    AssertLockHeld(cs);
+    nSize -= it->second->second->size() + it->first.size();
+    lru.erase(it->second);
+    mapEntries.erase(it);
+}
+
+void CResponseCache::Trim()
+{
+    AssertLockHeld(cs);
+    while (nSize > nMaxSize)
+        Erase(mapEntries.find(lru.back().first));
+}
+
+std::string ResponseCacheKey(const std::string& strMethod, const uint256& hash, int nForm)
+{
+    return strprintf("%s/%s/%d", strMethod, hash.GetHex(), nForm);
+}
+
+/** The confirmations of a block in the active chain. */
+static int GetConfirmations(const CBlockIndex* pindex)
+{
+    return chainActive.Height() - pindex->nHeight + 1;
+}
+
+/**
+ * Whether neither a block nor the one after it can be reorged: a result that
+ * names the next block must not change when that one is replaced.
+ */
+static bool IsBuried(const CBlockIndex* pindex)
+{
+    return chainActive.Contains(pindex) && GetConfirmations(pindex) > MAX_REORG_LENGTH + 1;
+}
+
+bool IsResponseCacheable(const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_main);
+    if (responseCache.GetMaxSize() == 0 || !IsBuried(pindex))
+        return false;
+    // Results include the values of spent outputs from the spent index,
+    // which may not have reached the block yet.
+    return pinsightindex == nullptr || pinsightindex->HasBlock(pindex);
+}
+
+std::optional<std::string> GetCachedResponse(const std::string& key)
+{
+    AssertLockHeld(cs_main);
+    CResponseCache::Entry entry = responseCache.Get(key);
+    if (entry) {
+        BlockMap::const_iterator it = mapBlockIndex.find(entry->hashBlock);
+        if (it != mapBlockIndex.end() && IsBuried(it->second) &&
+            chainActive.Next(it->second)->GetBlockHash() == entry->hashNext) {
+            MetricsIncrementCounter("zcash.rpc.responsecache", "result", "hit");
+            return entry->Render(GetConfirmations(it->second));
+        }
+    }
+    MetricsIncrementCounter("zcash.rpc.responsecache", "result", "miss");
+    return std::nullopt;
+}
+
+void CacheResponse(const std::string& key, const CBlockIndex* pindex, const std::string& strJSON)
+{
+    AssertLockHeld(cs_main);
+    if (!IsResponseCacheable(pindex))
+        return;
+    responseCache.Insert(key, std::make_shared<const CCachedResponse>(
+        strJSON, GetConfirmations(pindex), pindex->GetBlockHash(), chainActive.Next(pindex)->GetBlockHash()));
+}
@@ -0,0 +1,104 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_RPC_RESPONSECACHE_H
+#define ZCASH_RPC_RESPONSECACHE_H
+
+#include "sync.h"
+#include "uint256.h"
+
+#include <list>
+#include <map>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+class CBlockIndex;
+
+/** Default for -rpcresponsecache, in megabytes. */
+static const unsigned int DEFAULT_RPC_RESPONSE_CACHE_SIZE = 32;
+
+/**
+ * The JSON text of a result about a block, or about a transaction in it. The
+ * only part of such a result that changes once the block is buried is its
+ * "confirmations" member, so the text is kept split around its value, which
+ * is filled in again when the result is served.
+ */
+class CCachedResponse
+{
+public:
+    //! The block the result is about, and the one after it in the active
+    //! chain when the result was made (the result's "nextblockhash").
+    const uint256 hashBlock;
+    const uint256 hashNext;
+
+    CCachedResponse(const std::string& strJSON, int nConfirmations, const uint256& hashBlockIn, const uint256& hashNextIn);
+
+    //! The text of the result with the given number of confirmations.
+    std::string Render(int nConfirmations) const;
+    //! About the memory the entry takes.
+    size_t size() const { return nSize; }
+
+private:
+    //! The text between the values of the "confirmations" members.
+    std::vector<std::string> vParts;
+    size_t nSize;
+};
+
+/**
+ * The results of getblock, getblockheader and getrawtransaction, and of the
+ * REST block and tx requests, about blocks buried too deep to be reorged,
+ * by key, most recently used first. Results about transactions in the
+ * mempool or in recent blocks are never cached; entries whose block has left
+ * the active chain regardless (invalidateblock) are ignored when looked up.
+ */
+class CResponseCache
+{
+public:
+    typedef std::shared_ptr<const CCachedResponse> Entry;
+
+    explicit CResponseCache(size_t nMaxSize) : nMaxSize(nMaxSize), nSize(0) {}
+
+    Entry Get(const std::string& key);
+    //! Insert an entry, replacing one with the same key.
+    void Insert(const std::string& key, const Entry& entry);
+    void SetMaxSize(size_t nMaxSizeIn);
+    size_t GetMaxSize();
+
+private:
+    CCriticalSection cs;
+    size_t nMaxSize;
+    size_t nSize;
+    //! Most recently used first.
+    std::list<std::pair<std::string, Entry>> lru;
+    std::map<std::string, std::list<std::pair<std::string, Entry>>::iterator> mapEntries;
+
+    void Erase(std::map<std::string, std::list<std::pair<std::string, Entry>>::iterator>::iterator it);
+    void Trim();
+};
+
+extern CResponseCache responseCache;
+
+/** The key of a result: the method, the block or transaction, and the form asked for. */
+std::string ResponseCacheKey(const std::string& strMethod, const uint256& hash, int nForm);
+
+/**
+ * Whether results about the block pindex can be cached: it is deep enough in
+ * the active chain that neither it nor the block after it can be reorged,
+ * and the indexes include it. Requires cs_main.
+ */
+bool IsResponseCacheable(const CBlockIndex* pindex);
+
+/**
+ * The cached text of a result, with its confirmations brought up to date, if
+ * it is cached and its block is still buried in the active chain. Requires
+ * cs_main.
+ */
+std::optional<std::string> GetCachedResponse(const std::string& key);
+
+/** Cache the text of a result about the block pindex, if it can be cached. Requires cs_main. */
+void CacheResponse(const std::string& key, const CBlockIndex* pindex, const std::string& strJSON);
+
+#endif // ZCASH_RPC_RESPONSECACHE_H
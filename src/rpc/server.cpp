@@ -7,7 +7,9 @@
 #include "rpc/server.h"
 
 #include "fs.h"
+#include "httpserver.h"
 #include "init.h"
+#include "insightindex.h"
 #include "key_io.h"
 #include "random.h"
 #include "sync.h"
@@ -16,7 +18,10 @@
 #include "util/strencodings.h"
 #include "asyncrpcqueue.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <set>
 
 #include <univalue.h>
 
@@ -28,6 +33,7 @@
 #include <boost/thread.hpp>
 #include <boost/algorithm/string/case_conv.hpp> // for to_upper()
 
+#include <rust/metrics.h>
 #include <tracing.h>
 
 using namespace RPCServer;
@@ -283,6 +289,80 @@ UniValue setlogfilter(const UniValue& params, bool fHelp)
 }
 
 
+UniValue startprofile(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 2) {
+        throw runtime_error(
+            "startprofile \"filename\" ( sampleinterval )\n"
+            "\nStarts writing a profile of the time spent in the tracing spans that pass the\n"
+            "log filter to a file in the data directory, in the Chrome trace event format\n"
+            "(which can be opened with chrome://tracing, Perfetto or speedscope).\n"
+            "\nThe spans of block validation, peer message processing, wallet scanning and\n"
+            "RPC calls have the \"profile\" target at the debug level, so they are enabled\n"
+            "with a filter such as:\n"
+            "\n    " + LogConfigFilter() + ",profile=debug\n"
+            "\nA profile that is already being written is finished first.\n"
+            "\nArguments:\n"
+            "1. \"filename\"      (string, required) The name of the profile file, which may only contain alphanumeric characters.\n"
+            "2. sampleinterval    (numeric, optional, default=1) Sample one in this many of the spans\n"
+            "                     entered outside of a sampled span, with all the spans within it.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("startprofile", "\"ibd\" 10")
+            + HelpExampleRpc("startprofile", "\"ibd\", 10")
+        );
+    }
+
+    std::string unclean = params[0].get_str();
+    std::string clean = SanitizeFilename(unclean);
+    if (clean.empty() || clean.compare(unclean) != 0) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Filename is invalid as only alphanumeric characters are allowed.  Try '%s' instead.", clean));
+    }
+    int64_t nSampleInterval = 1;
+    if (params.size() > 1) {
+        nSampleInterval = params[1].get_int64();
+        if (nSampleInterval < 1) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "sampleinterval must be at least 1");
+        }
+    }
+    if (!pTracingHandle) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Tracing is not initialized");
+    }
+
+    fs::path pathProfile = GetDataDir() / clean;
+    const fs::path::string_type& pathProfileStr = pathProfile.native();
+    static_assert(sizeof(fs::path::value_type) == sizeof(codeunit),
+                    "native path has unexpected code unit size");
+    if (!tracing_profile_start(
+            pTracingHandle,
+            reinterpret_cast<const codeunit*>(pathProfileStr.c_str()),
+            pathProfileStr.length(),
+            nSampleInterval)) {
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Starting the profile failed; check logs");
+    }
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("path", pathProfile.string());
+    return result;
+}
+
+UniValue stopprofile(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0) {
+        throw runtime_error(
+            "stopprofile\n"
+            "\nFinishes the profile started with startprofile.\n"
+            "\nResult:\n"
+            "true|false    (boolean) Whether a profile was being written, and was completed\n"
+            "\nExamples:\n"
+            + HelpExampleCli("stopprofile", "")
+            + HelpExampleRpc("stopprofile", "")
+        );
+    }
+
+    return pTracingHandle && tracing_profile_stop(pTracingHandle);
+}
+
+
 UniValue stop(const UniValue& params, bool fHelp)
 {
     // Accept the deprecated and ignored 'detach' boolean argument
@@ -305,6 +385,8 @@ static const CRPCCommand vRPCCommands[] =
     /* Overall control/query calls */
     { "control",            "help",                   &help,                   true  },
     { "control",            "setlogfilter",           &setlogfilter,           true  },
+    { "control",            "startprofile",           &startprofile,           true  },
+    { "control",            "stopprofile",            &stopprofile,            true  },
     { "control",            "stop",                   &stop,                   true  },
 };
 
@@ -342,14 +424,31 @@ bool CRPCTable::appendCommand(const std::string& name, const CRPCCommand* pcmd)
     return true;
 }
 
+bool CRPCTable::appendStreamedCommand(const std::string& name, rpcstreamfn_type fn)
+{
+    if (IsRPCRunning() || !mapCommands.count(name))
+        return false;
+
+    return mapStreamedCommands.emplace(name, fn).second;
+}
+
 bool StartRPC()
 {
     LogPrint("rpc", "Starting RPC\n");
     fRPCRunning = true;
     g_rpcSignals.Started();
 
+    // Long-running operations are queued behind z_sendmany (see their
+    // getPriority()), and should more workers be enabled, each of them may
+    // only occupy one.
+    std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
+    q->setRetention(std::max<int64_t>(0, GetArg("-rpcasyncretention", DEFAULT_ASYNC_RPC_RETENTION)));
+    for (const std::string& method : {"z_mergetoaddress", "z_shieldcoinbase", "saplingmigration"}) {
+        q->setConcurrencyLimit(method, 1);
+    }
+
     // Launch one async rpc worker.  The ability to launch multiple workers is not recommended at present and thus the option is disabled.
-    getAsyncRPCQueue()->addWorker();
+    q->addWorker();
 /*
     int n = GetArg("-rpcasyncthreads", 1);
     if (n<1) {
@@ -462,15 +561,147 @@ static UniValue JSONRPCExecOne(const UniValue& req)
     return rpc_result;
 }
 
-std::string JSONRPCExecBatch(const UniValue& vReq)
+/**
+ * Commands that only read the chain and mempool, which a batch executes in
+ * parallel. Others are executed in order, so that the requests after them
+ * see their effects.
+ */
+static const std::set<std::string> setParallelBatchCommands = {
+    "decoderawtransaction",
+    "decodescript",
+    "getaddressbalance",
+    "getaddressdeltas",
+    "getaddressmempool",
+    "getaddresstxids",
+    "getaddressutxos",
+    "getbestblockhash",
+    "getblock",
+    "getblockchaininfo",
+    "getblockcount",
+    "getblockdeltas",
+    "getblockhash",
+    "getblockhashes",
+    "getblockheader",
+    "getblocksubsidy",
+    "getchaintips",
+    "getdifficulty",
+    "getmempoolinfo",
+    "getrawmempool",
+    "getrawtransaction",
+    "getspentinfo",
+    "gettxout",
+    "gettxoutproof",
+    "z_gettreestate",
+};
+
+static bool IsParallelBatchRequest(const UniValue& req)
+{
+    if (!req.isObject())
+        return false;
+    const UniValue& valMethod = find_value(req.get_obj(), "method");
+    return valMethod.isStr() && setParallelBatchCommands.count(valMethod.get_str());
+}
+
+/**
+ * A run of consecutive read-only requests of a batch. Each thread executing
+ * it takes the next request until there are none left. It is shared with the
+ * helper threads, which may only start after the batch has been replied to.
+ */
+struct JSONRPCBatchRun
+{
+    std::vector<UniValue> vReq;
+    std::vector<UniValue> vReply;
+    std::atomic<size_t> nNext{0};
+
+    Mutex cs;
+    std::condition_variable cond;
+    size_t nDone = 0;
+
+    void Work()
+    {
+        size_t i;
+        while ((i = nNext++) < vReq.size()) {
+            vReply[i] = JSONRPCExecOne(vReq[i]);
+            LOCK(cs);
+            if (++nDone == vReq.size())
+                cond.notify_all();
+        }
+    }
+
+    void Wait()
+    {
+        WAIT_LOCK(cs, lock);
+        while (nDone < vReq.size())
+            cond.wait(lock);
+    }
+};
+
+std::string JSONRPCExecBatch(const UniValue& vReq, const std::function<bool(const std::function<void()>&)>& queueWork)
 {
+    size_t nMaxThreads = queueWork ? std::max<int64_t>(GetArg("-rpcbatchthreads", DEFAULT_RPC_BATCH_THREADS), 1) : 1;
+
     UniValue ret(UniValue::VARR);
-    for (size_t reqIdx = 0; reqIdx < vReq.size(); reqIdx++)
-        ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+    size_t reqIdx = 0;
+    while (reqIdx < vReq.size()) {
+        size_t nEnd = reqIdx;
+        while (nEnd < vReq.size() && IsParallelBatchRequest(vReq[nEnd]))
+            nEnd++;
+        if (nEnd - reqIdx < 2 || nMaxThreads < 2) {
+            ret.push_back(JSONRPCExecOne(vReq[reqIdx]));
+            reqIdx++;
+            continue;
+        }
+
+        auto run = std::make_shared<JSONRPCBatchRun>();
+        run->vReq.assign(vReq.getValues().begin() + reqIdx, vReq.getValues().begin() + nEnd);
+        run->vReply.resize(run->vReq.size());
+        size_t nHelpers = std::min(nMaxThreads, run->vReq.size()) - 1;
+        for (size_t i = 0; i < nHelpers; i++) {
+            // Requests a full queue cannot take are executed by this thread.
+            if (!queueWork([run]() { run->Work(); }))
+                break;
+        }
+        run->Work();
+        run->Wait();
+        ret.push_backV(run->vReply);
+        reqIdx = nEnd;
+    }
 
     return ret.write() + "\n";
 }
 
+/**
+ * Records the metrics of a call of an RPC method, by method: the time its
+ * HTTP request waited in the work queue, how long it ran and how much of
+ * that it waited for locks, the calls in flight, and the calls that failed.
+ */
+class CRPCMethodMetrics
+{
+private:
+    const std::string& strMethod;
+    int64_t nStart;
+    int64_t nLockWaitStart;
+
+public:
+    bool fSucceeded = false;
+
+    explicit CRPCMethodMetrics(const std::string& strMethodIn) :
+        strMethod(strMethodIn), nStart(GetTimeMicros()), nLockWaitStart(GetThreadLockWaitMicros())
+    {
+        MetricsHistogram("zcash.rpc.queue.seconds", GetWorkItemQueueMicros() * 0.000001, "method", strMethod.c_str());
+        MetricsIncrementGauge("zcash.rpc.inflight", 1, "method", strMethod.c_str());
+    }
+
+    ~CRPCMethodMetrics()
+    {
+        MetricsDecrementGauge("zcash.rpc.inflight", 1, "method", strMethod.c_str());
+        MetricsHistogram("zcash.rpc.execution.seconds", (GetTimeMicros() - nStart) * 0.000001, "method", strMethod.c_str());
+        MetricsHistogram("zcash.rpc.lockwait.seconds", (GetThreadLockWaitMicros() - nLockWaitStart) * 0.000001, "method", strMethod.c_str());
+        if (!fSucceeded)
+            MetricsIncrementCounter("zcash.rpc.errors", "method", strMethod.c_str());
+    }
+};
+
 UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params) const
 {
     // Return immediately if in warmup
@@ -487,10 +718,15 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
 
     g_rpcSignals.PreCommand(*pcmd);
 
+    auto span = TracingSpan("debug", "profile", "RPC", "method", pcmd->name.c_str());
+    auto spanGuard = span.Enter();
+    CRPCMethodMetrics metrics(pcmd->name);
     try
     {
         // Execute
-        return pcmd->actor(params, false);
+        UniValue result = pcmd->actor(params, false);
+        metrics.fSucceeded = true;
+        return result;
     }
     catch (const std::exception& e)
     {
@@ -500,6 +736,33 @@ UniValue CRPCTable::execute(const std::string &strMethod, const UniValue &params
     g_rpcSignals.PostCommand(*pcmd);
 }
 
+RPCStreamedResult CRPCTable::prepareStreamed(const std::string &strMethod, const UniValue &params) const
+{
+    std::map<std::string, rpcstreamfn_type>::const_iterator it = mapStreamedCommands.find(strMethod);
+    if (it == mapStreamedCommands.end())
+        return nullptr;
+
+    // Return immediately if in warmup
+    {
+        LOCK(cs_rpcWarmup);
+        if (fRPCInWarmup)
+            throw JSONRPCError(RPC_IN_WARMUP, rpcWarmupStatus);
+    }
+
+    RPCStreamedResult result;
+    try
+    {
+        result = it->second(params);
+    }
+    catch (const std::exception& e)
+    {
+        throw JSONRPCError(RPC_MISC_ERROR, e.what());
+    }
+    if (result)
+        g_rpcSignals.PreCommand(*mapCommands.at(strMethod));
+    return result;
+}
+
 std::vector<std::string> CRPCTable::listCommands() const
 {
     std::vector<std::string> commandList;
@@ -550,6 +813,14 @@ std::string experimentalDisabledHelpMsg(const std::string& rpc, const std::vecto
         + config;
 }
 
+void EnsureInsightIndexSynced()
+{
+    if (pinsightindex != NULL && !pinsightindex->BlockUntilSyncedToCurrentChain()) {
+        throw JSONRPCError(RPC_IN_WARMUP, "The insight explorer indexes are not synced to the current chain yet; "
+            "see debug.log for progress.");
+    }
+}
+
 void RPCRegisterTimerInterface(RPCTimerInterface *iface)
 {
     timerInterfaces.push_back(iface);
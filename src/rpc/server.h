@@ -20,6 +20,7 @@
 #include <univalue.h>
 
 class AsyncRPCQueue;
+class CJSONStreamWriter;
 class CRPCCommand;
 
 namespace RPCServer
@@ -118,6 +119,15 @@ void RPCRunLater(const std::string& name, std::function<void(void)> func, int64_
 
 typedef UniValue(*rpcfn_type)(const UniValue& params, bool fHelp);
 
+/** Writes the result of a call prepared by an rpcstreamfn_type. It must not throw. */
+typedef std::function<void(CJSONStreamWriter& writer)> RPCStreamedResult;
+/**
+ * Prepares to write the result of a call that can be too large to build as a
+ * UniValue, throwing any error. Returns an empty function for the calls it
+ * does not stream, which are executed by the command's actor as usual.
+ */
+typedef RPCStreamedResult(*rpcstreamfn_type)(const UniValue& params);
+
 class CRPCCommand
 {
 public:
@@ -134,6 +144,7 @@ class CRPCTable
 {
 private:
     std::map<std::string, const CRPCCommand*> mapCommands;
+    std::map<std::string, rpcstreamfn_type> mapStreamedCommands;
 public:
     CRPCTable();
     const CRPCCommand* operator[](const std::string& name) const;
@@ -148,6 +159,14 @@ public:
      */
     UniValue execute(const std::string &method, const UniValue &params) const;
 
+    /**
+     * Prepare to stream the result of a method, if it supports that for
+     * these arguments; otherwise returns an empty function, and the method is
+     * to be executed with execute().
+     * @throws an exception (UniValue) when an error happens.
+     */
+    RPCStreamedResult prepareStreamed(const std::string &method, const UniValue &params) const;
+
     /**
     * Returns a list of registered commands
     * @returns List of registered commands.
@@ -161,6 +180,12 @@ public:
      * Commands cannot be overwritten (returns false).
      */
     bool appendCommand(const std::string& name, const CRPCCommand* pcmd);
+
+    /**
+     * Lets an appended command stream its result, when prepareStreamed is
+     * used to execute it. Same restrictions as appendCommand.
+     */
+    bool appendStreamedCommand(const std::string& name, rpcstreamfn_type fn);
 };
 
 extern CRPCTable tableRPC;
@@ -188,10 +213,21 @@ extern void EnsureWalletIsUnlocked();
 bool StartRPC();
 void InterruptRPC();
 void StopRPC();
-std::string JSONRPCExecBatch(const UniValue& vReq);
+/** Default for -rpcbatchthreads. */
+static const int DEFAULT_RPC_BATCH_THREADS = 4;
+/**
+ * Execute a batch of requests, replying to them in order. Consecutive
+ * read-only requests are executed by up to -rpcbatchthreads threads: the
+ * calling one, and helpers passed to queueWork, if given, for it to run on
+ * other threads. The batch does not wait for helpers that never start.
+ */
+std::string JSONRPCExecBatch(const UniValue& vReq, const std::function<bool(const std::function<void()>&)>& queueWork = nullptr);
 
 extern std::string experimentalDisabledHelpMsg(const std::string& rpc, const std::vector<std::string>& enableArgs);
 
+/** Wait for the insight explorer indexes to include the current tip; throws RPC_IN_WARMUP while they are being built. Call before locking cs_main. */
+extern void EnsureInsightIndexSynced();
+
 extern int interpretHeightArg(int nHeight, int currentHeight);
 extern int parseHeightArg(const std::string& strHeight, int currentHeight);
 
@@ -29,6 +29,10 @@ extern "C" {
 
     /// Loads the zk-SNARK parameters into memory and saves
     /// paths as necessary. Only called once.
+    ///
+    /// If `preload_proving_keys` is true, the proving keys are
+    /// loaded on a background thread; otherwise they are loaded
+    /// when the first proof is created.
     void librustzcash_init_zksnark_params(
         const codeunit* spend_path,
         size_t spend_path_len,
@@ -36,7 +40,7 @@ extern "C" {
         size_t output_path_len,
         const codeunit* sprout_path,
         size_t sprout_path_len,
-        bool load_proving_keys
+        bool preload_proving_keys
     );
 
     /// Writes the "uncommitted" note value for empty leaves
@@ -62,6 +66,19 @@ extern "C" {
         unsigned char *result
     );
 
+    /// Computes the merkle tree hashes of `count` pairs of nodes at
+    /// the same depth, as librustzcash_merkle_hash would, converting
+    /// the resulting points to affine coordinates in one batch.
+    ///
+    /// `pairs` must be of length 64 * `count`, each pair being the
+    /// left then the right node, and `result` of length 32 * `count`.
+    void librustzcash_merkle_hash_batch(
+        size_t depth,
+        const unsigned char *pairs,
+        size_t count,
+        unsigned char *result
+    );
+
     /// Computes the signature for each Spend description, given the key
     /// `ask`, the re-randomization `ar`, the 32-byte sighash `sighash`,
     /// and an output `result` buffer of 64-bytes for the signature.
@@ -167,6 +184,23 @@ extern "C" {
         unsigned char *result
     );
 
+    /// Compute [sk] [8] P for some 32-byte
+    /// point P and each of `count` 32-byte
+    /// Fs in `sks`, normalizing the results
+    /// together. If P is invalid, returns
+    /// false. Otherwise, sets each entry of
+    /// `valid` to whether its sk is valid,
+    /// and if so writes its result to the
+    /// matching 32 bytes of `results`.
+    bool librustzcash_sapling_ka_agree_batch(
+        bool zip216_enabled,
+        const unsigned char *p,
+        const unsigned char *sks,
+        size_t count,
+        unsigned char *results,
+        bool *valid
+    );
+
     /// Compute g_d = GH(diversifier) and returns
     /// false if the diversifier is invalid.
     /// Computes [esk] g_d and writes the result
@@ -86,6 +86,35 @@ OrchardBundlePtr* orchard_unauthorized_bundle_prove_and_sign(
     size_t keys_len,
     const unsigned char* sighash);
 
+/// Pointer to Rust-allocated Orchard bundle with proofs but without
+/// authorizing signatures.
+struct OrchardProvenBundlePtr;
+typedef struct OrchardProvenBundlePtr OrchardProvenBundlePtr;
+
+/// Creates the proof for a copy of the bundle, so that it can be created
+/// while the rest of the transaction is built.
+///
+/// Returns `null` if an error occurs.
+///
+/// `bundle` is left unaltered, and can still be used to calculate the
+/// signature digest.
+OrchardProvenBundlePtr* orchard_unauthorized_bundle_prove(
+    const OrchardUnauthorizedBundlePtr* bundle);
+
+/// Frees an Orchard bundle returned from `orchard_unauthorized_bundle_prove`.
+void orchard_proven_bundle_free(OrchardProvenBundlePtr* bundle);
+
+/// Adds signatures to a bundle returned from `orchard_unauthorized_bundle_prove`.
+///
+/// Returns `null` if an error occurs.
+///
+/// `bundle` is always freed by this method.
+OrchardBundlePtr* orchard_proven_bundle_sign(
+    OrchardProvenBundlePtr* bundle,
+    const OrchardSpendingKeyPtr** keys,
+    size_t keys_len,
+    const unsigned char* sighash);
+
 /// Calculates a ZIP 244 shielded signature digest for the given under-construction
 /// transaction.
 ///
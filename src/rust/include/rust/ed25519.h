@@ -18,6 +18,9 @@
 extern "C" {
 #endif
 
+struct Ed25519BatchValidatorPtr;
+typedef struct Ed25519BatchValidatorPtr Ed25519BatchValidatorPtr;
+
 /// Generates a new Ed25519 keypair.
 void ed25519_generate_keypair(
     Ed25519SigningKey* sk,
@@ -52,8 +55,78 @@ bool ed25519_verify(
     const unsigned char* msg,
     size_t msglen);
 
+/// Initializes a new Ed25519 batch validator.
+///
+/// Please free this with `ed25519_batch_validation_free` if it is not passed
+/// to `ed25519_batch_validate`.
+Ed25519BatchValidatorPtr* ed25519_batch_validation_init();
+
+/// Frees a batch validator returned from `ed25519_batch_validation_init`.
+void ed25519_batch_validation_free(Ed25519BatchValidatorPtr* batch);
+
+/// Queues a purported `signature` on the given `msg` for batch validation.
+void ed25519_batch_queue(
+    Ed25519BatchValidatorPtr* batch,
+    const Ed25519VerificationKey* vk,
+    const Ed25519Signature* signature,
+    const unsigned char* msg,
+    size_t msglen);
+
+/// Validates every signature queued in this batch, using the same criteria as
+/// `ed25519_verify`.
+///
+/// Returns false if any signature in the batch is invalid; the signatures then
+/// need to be verified individually to find out which.
+///
+/// The batch validator is freed by this function.
+bool ed25519_batch_validate(Ed25519BatchValidatorPtr* batch);
+
 #ifdef __cplusplus
 }
+
+#include <memory>
+#include <stdexcept>
+
+namespace ed25519
+{
+/// A batch validation context for Ed25519 signatures.
+class BatchValidator
+{
+private:
+    std::unique_ptr<Ed25519BatchValidatorPtr, decltype(&ed25519_batch_validation_free)> inner;
+
+public:
+    BatchValidator() : inner(ed25519_batch_validation_init(), ed25519_batch_validation_free) {}
+
+    BatchValidator(BatchValidator&& batch) = default;
+    BatchValidator& operator=(BatchValidator&& batch) = default;
+
+    // BatchValidator should never be copied
+    BatchValidator(const BatchValidator&) = delete;
+    BatchValidator& operator=(const BatchValidator&) = delete;
+
+    /// Queues a signature to be validated as part of this batch.
+    void Queue(
+        const Ed25519VerificationKey* vk,
+        const Ed25519Signature* signature,
+        const unsigned char* msg,
+        size_t msglen)
+    {
+        ed25519_batch_queue(inner.get(), vk, signature, msg, msglen);
+    }
+
+    /// Validates the queued signatures.
+    ///
+    /// This must only be called once.
+    bool Validate()
+    {
+        if (!inner) {
+            throw std::logic_error("ed25519::BatchValidator::Validate() called multiple times");
+        }
+        return ed25519_batch_validate(inner.release());
+    }
+};
+} // namespace ed25519
 #endif
 
 #endif // ZCASH_RUST_INCLUDE_RUST_ED25519_H
@@ -5,12 +5,16 @@
 #ifndef ZCASH_RUST_INCLUDE_RUST_INIT_H
 #define ZCASH_RUST_INCLUDE_RUST_INIT_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-/// Initializes the global Rayon threadpool.
-void zcashd_init_rayon_threadpool();
+/// Initializes the global Rayon threadpool with `num_threads` threads, or one
+/// per core if `num_threads` is 0. If `cpus_len` is not 0, the threads are
+/// bound to the `cpus_len` CPUs at `cpus` (on Linux).
+void zcashd_init_rayon_threadpool(size_t num_threads, const size_t* cpus, size_t cpus_len);
 
 #ifdef __cplusplus
 }
@@ -40,6 +40,18 @@ bool orchard_bundle_parse(
     read_callback_t read_cb,
     OrchardBundlePtr** bundle_ret);
 
+/// Parses an authorized Orchard bundle from the start of the `data_len` bytes
+/// at `data`, without a callback for each read.
+///
+/// - If no error occurs, `bundle_ret` will point to a Rust-allocated Orchard
+///   bundle, and `consumed_ret` will be set to the number of bytes it took.
+/// - If an error occurs, `bundle_ret` and `consumed_ret` will be unaltered.
+bool orchard_bundle_parse_slice(
+    const unsigned char* data,
+    size_t data_len,
+    OrchardBundlePtr** bundle_ret,
+    size_t* consumed_ret);
+
 /// Serializes an authorized Orchard bundle to the given stream
 ///
 /// If `bundle == nullptr`, this serializes `nActionsOrchard = 0`.
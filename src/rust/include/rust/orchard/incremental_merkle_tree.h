@@ -70,6 +70,21 @@ bool orchard_merkle_frontier_append_bundle(
         OrchardMerkleFrontierPtr* tree_ptr,
         const OrchardBundlePtr* bundle);
 
+// Appends the commitments of the bundle as
+// `orchard_merkle_frontier_append_bundle` does, writing the root of each
+// subtree of `2^subtree_height` leaves that is completed along the way to
+// `roots_ret`, which has room for `roots_len` roots, and their number to
+// `num_roots_ret`.
+//
+// Returns `false` if the tree is full, or if `roots_ret` is too short.
+bool orchard_merkle_frontier_append_bundle_subtrees(
+        OrchardMerkleFrontierPtr* tree_ptr,
+        const OrchardBundlePtr* bundle,
+        uint8_t subtree_height,
+        unsigned char* roots_ret,
+        size_t roots_len,
+        size_t* num_roots_ret);
+
 // Computes the root of the provided orchard Merkle frontier
 void orchard_merkle_frontier_root(
         const OrchardMerkleFrontierPtr* tree_ptr,
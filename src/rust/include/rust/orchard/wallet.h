@@ -135,6 +135,26 @@ bool orchard_wallet_add_notes_from_bundle(
         push_spend_action_idx_callback_t spend_cb
         );
 
+/**
+ * As `orchard_wallet_add_notes_from_bundle`, for each of the `len` bundles of
+ * a block's transactions in order, trial-decrypting the actions of all of
+ * them together across the global thread pool. `txids`, `bundles`,
+ * `callbackReceivers` and `involved` each have an entry for every
+ * transaction; a null bundle pointer stands for a transaction without an
+ * Orchard bundle. `involved[i]` is set to whether the i-th bundle is
+ * involved with the wallet.
+ */
+void orchard_wallet_add_notes_from_bundles(
+        OrchardWalletPtr* wallet,
+        const unsigned char (*txids)[32],
+        const OrchardBundlePtr* const* bundles,
+        size_t len,
+        void* const* callbackReceivers,
+        push_action_ivk_callback_t push_cb,
+        push_spend_action_idx_callback_t spend_cb,
+        bool* involved
+        );
+
 /**
  * Decrypts a selection of notes from the bundle with specified incoming viewing
  * keys, and adds those notes to the wallet.
@@ -177,6 +197,13 @@ void orchard_wallet_commitment_tree_root(
         const OrchardWalletPtr* wallet,
         unsigned char* root_ret);
 
+/**
+ * Returns an estimate of the heap memory used by the wallet's indexes and note
+ * commitment tree. It does not count allocator overhead or the ommers of the
+ * tree's bridges, so it is a lower bound.
+ */
+size_t orchard_wallet_dynamic_usage(const OrchardWalletPtr* wallet);
+
 /**
  * Returns whether the specified transaction involves any Orchard notes that belong to
  * this wallet.
@@ -371,6 +398,18 @@ OrchardSpendInfoPtr* orchard_wallet_get_spend_info(
  */
 void orchard_wallet_gc_note_commitment_tree(OrchardWalletPtr* wallet);
 
+/**
+ * Stop witnessing the wallet's notes that are spent by any of the `len`
+ * transactions in `txids`, so that the next garbage collection of the note
+ * commitment tree can drop the data kept for their witnesses. Only
+ * transactions that can no longer be reorganized away may be passed.
+ * Returns the number of notes that were witnessed until now.
+ */
+size_t orchard_wallet_forget_spent_note_witnesses(
+        OrchardWalletPtr* wallet,
+        const unsigned char (*txids)[32],
+        size_t len);
+
 /**
  * Write the wallet's note commitment tree to the provided stream.
  */
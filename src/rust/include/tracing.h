@@ -24,11 +24,15 @@ typedef struct TracingHandle TracingHandle;
 /// component. The handle must be freed to close the logging component.
 ///
 /// If log_path is NULL, logging is sent to standard output.
+///
+/// If log_rate is non-zero, the debug and info events of each target are
+/// limited to log_rate per second, and the rest are dropped.
 TracingHandle* tracing_init(
     const codeunit* log_path,
     size_t log_path_len,
     const char* initial_filter,
-    bool log_timestamps);
+    bool log_timestamps,
+    uint64_t log_rate);
 
 /// Initializes the tracing crate for use in tests, returning a handle for the
 /// logging component. The handle must be freed to close the logging component.
@@ -48,6 +52,25 @@ void tracing_free(TracingHandle* handle);
 /// Returns `true` if the reload succeeded.
 bool tracing_reload(TracingHandle* handle, const char* new_filter);
 
+/// Starts writing a profile of the spans that pass the tracing filter to
+/// `profile_path`, in the Chrome trace event format, replacing any profile
+/// already being written.
+///
+/// One in `sample_interval` of the spans that a thread enters outside of any
+/// sampled span is sampled, along with every span entered within it.
+///
+/// Returns `true` if the profile file was created.
+bool tracing_profile_start(
+    TracingHandle* handle,
+    const codeunit* profile_path,
+    size_t profile_path_len,
+    uint64_t sample_interval);
+
+/// Finishes the profile being written, if any.
+///
+/// Returns `true` if a profile was being written and it was completed.
+bool tracing_profile_stop(TracingHandle* handle);
+
 struct TracingCallsite;
 typedef struct TracingCallsite TracingCallsite;
 
@@ -11,6 +11,7 @@ mod ffi {
         fn box_clone(&self) -> Box<State>;
         fn update(&mut self, input: &[u8]);
         fn finalize(&self, output: &mut [u8]);
+        fn finalize_indexed(&self, first_index: u32, output_len: usize, output: &mut [u8]);
     }
 }
 
@@ -41,4 +42,22 @@ impl State {
         assert!(output.len() <= hash.as_bytes().len());
         output.copy_from_slice(&hash.as_bytes()[..output.len()]);
     }
+
+    /// Fills each `output_len`-byte chunk of `output` with the hash of this
+    /// state followed by an index in little-endian order, counting up from
+    /// `first_index`. This is how Equihash solvers generate their initial
+    /// hashes, and saves them a state on the heap and a call into Rust for
+    /// every index.
+    fn finalize_indexed(&self, first_index: u32, output_len: usize, output: &mut [u8]) {
+        assert!(output_len > 0 && output.len() % output_len == 0);
+        for (i, chunk) in output.chunks_exact_mut(output_len).enumerate() {
+            let hash = self
+                .0
+                .clone()
+                .update(&(first_index + i as u32).to_le_bytes())
+                .finalize();
+            assert!(output_len <= hash.as_bytes().len());
+            chunk.copy_from_slice(&hash.as_bytes()[..output_len]);
+        }
+    }
 }
@@ -8,6 +8,7 @@ use orchard::keys::SpendingKey;
 use orchard::{
     builder::{Builder, InProgress, Unauthorized, Unproven},
     bundle::{Authorized, Flags},
+    circuit::Proof,
     keys::{FullViewingKey, OutgoingViewingKey},
     tree::{MerkleHashOrchard, MerklePath},
     value::NoteValue,
@@ -24,8 +25,8 @@ use zcash_primitives::transaction::{
 };
 
 use crate::{
+    orchard_proving_key,
     transaction_ffi::{PrecomputedTxParts, TransparentAuth},
-    ORCHARD_PK,
 };
 
 pub struct OrchardSpendInfo {
@@ -157,7 +158,7 @@ pub extern "C" fn orchard_unauthorized_bundle_prove_and_sign(
     let bundle = unsafe { Box::from_raw(bundle) };
     let keys = unsafe { slice::from_raw_parts(keys, keys_len) };
     let sighash = unsafe { sighash.as_ref() }.expect("sighash pointer may not be null.");
-    let pk = unsafe { ORCHARD_PK.as_ref() }.unwrap();
+    let pk = orchard_proving_key();
 
     let signing_keys = keys
         .iter()
@@ -185,6 +186,70 @@ pub extern "C" fn orchard_unauthorized_bundle_prove_and_sign(
     }
 }
 
+/// Creates the proof for a copy of the given bundle, which is left unaltered so that
+/// the signature digest can still be calculated from it.
+///
+/// Returns `null` if an error occurs.
+#[no_mangle]
+pub extern "C" fn orchard_unauthorized_bundle_prove(
+    bundle: *const Bundle<InProgress<Unproven, Unauthorized>, Amount>,
+) -> *mut Bundle<InProgress<Proof, Unauthorized>, Amount> {
+    let bundle = unsafe { bundle.as_ref() }.expect("bundle pointer may not be null.");
+    let pk = orchard_proving_key();
+
+    match bundle.clone().create_proof(pk, &mut OsRng) {
+        Ok(proven) => Box::into_raw(Box::new(proven)),
+        Err(e) => {
+            error!(
+                "An error occurred while proving the orchard bundle: {:?}",
+                e
+            );
+            std::ptr::null_mut()
+        }
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn orchard_proven_bundle_free(
+    bundle: *mut Bundle<InProgress<Proof, Unauthorized>, Amount>,
+) {
+    if !bundle.is_null() {
+        drop(unsafe { Box::from_raw(bundle) });
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn orchard_proven_bundle_sign(
+    bundle: *mut Bundle<InProgress<Proof, Unauthorized>, Amount>,
+    keys: *const *const SpendingKey,
+    keys_len: size_t,
+    sighash: *const [u8; 32],
+) -> *mut Bundle<Authorized, Amount> {
+    let bundle = unsafe { Box::from_raw(bundle) };
+    let keys = unsafe { slice::from_raw_parts(keys, keys_len) };
+    let sighash = unsafe { sighash.as_ref() }.expect("sighash pointer may not be null.");
+
+    let signing_keys = keys
+        .iter()
+        .map(|sk| {
+            unsafe { sk.as_ref() }
+                .expect("SpendingKey pointers must not be null")
+                .into()
+        })
+        .collect::<Vec<_>>();
+
+    match bundle.apply_signatures(&mut OsRng, *sighash, &signing_keys) {
+        Ok(signed) => Box::into_raw(Box::new(signed)),
+        Err(e) => {
+            error!(
+                "An error occurred while signing the orchard bundle: {:?}",
+                e
+            );
+            std::ptr::null_mut()
+        }
+    }
+}
+
 /// Calculates a ZIP 244 shielded signature digest for the given under-construction
 /// transaction.
 ///
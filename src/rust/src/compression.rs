@@ -0,0 +1,35 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+use miniz_oxide::{deflate::compress_to_vec, inflate::decompress_to_vec_with_limit};
+use tracing::error;
+
+#[cxx::bridge(namespace = "compression")]
+mod ffi {
+    extern "Rust" {
+        fn compress(input: &[u8], level: u8) -> Vec<u8>;
+        fn decompress(input: &[u8], max_len: usize, output: &mut Vec<u8>) -> bool;
+    }
+}
+
+/// Compresses `input` into a raw DEFLATE stream, at a level from 0 (no
+/// compression) to 10.
+fn compress(input: &[u8], level: u8) -> Vec<u8> {
+    compress_to_vec(input, level)
+}
+
+/// Decompresses the raw DEFLATE stream `input` into `output`. Returns false if
+/// the stream is invalid, or would decompress to more than `max_len` bytes.
+fn decompress(input: &[u8], max_len: usize, output: &mut Vec<u8>) -> bool {
+    match decompress_to_vec_with_limit(input, max_len) {
+        Ok(data) => {
+            *output = data;
+            true
+        }
+        Err(e) => {
+            error!("compression::decompress: {:?}", e);
+            false
+        }
+    }
+}
@@ -2,7 +2,7 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
-use ed25519_zebra::{Signature, SigningKey, VerificationKey};
+use ed25519_zebra::{batch, Signature, SigningKey, VerificationKey, VerificationKeyBytes};
 use libc::{c_uchar, size_t};
 use rand_core::OsRng;
 use std::convert::TryFrom;
@@ -65,3 +65,51 @@ pub extern "C" fn ed25519_verify(
 
     vk.verify(&signature, msg).is_ok()
 }
+
+/// Creates an Ed25519 batch validation context.
+///
+/// Please free this with `ed25519_batch_validation_free` if it is not passed to
+/// `ed25519_batch_validate`.
+#[no_mangle]
+pub extern "C" fn ed25519_batch_validation_init() -> *mut batch::Verifier {
+    Box::into_raw(Box::new(batch::Verifier::new()))
+}
+
+/// Frees an Ed25519 batch validation context returned from
+/// [`ed25519_batch_validation_init`].
+#[no_mangle]
+pub extern "C" fn ed25519_batch_validation_free(batch: *mut batch::Verifier) {
+    if !batch.is_null() {
+        drop(unsafe { Box::from_raw(batch) });
+    }
+}
+
+/// Queues a purported `signature` on the given `msg` for batch validation.
+#[no_mangle]
+pub extern "C" fn ed25519_batch_queue(
+    batch: *mut batch::Verifier,
+    vk: *const [u8; 32],
+    signature: *const [u8; 64],
+    msg: *const c_uchar,
+    msg_len: size_t,
+) {
+    let batch = unsafe { batch.as_mut() }.expect("batch must not be null");
+    let vk = VerificationKeyBytes::from(*unsafe { vk.as_ref() }.unwrap());
+    let signature = Signature::from(*unsafe { signature.as_ref() }.unwrap());
+    let msg = unsafe { slice::from_raw_parts(msg, msg_len) };
+
+    batch.queue((vk, signature, &msg));
+}
+
+/// Validates every signature queued in this batch.
+///
+/// Returns `false` if any signature in the batch is invalid, in which case the
+/// signatures must be checked individually with `ed25519_verify` to find which.
+///
+/// The batch validation context is freed by this function.
+#[no_mangle]
+pub extern "C" fn ed25519_batch_validate(batch: *mut batch::Verifier) -> bool {
+    assert!(!batch.is_null());
+    let batch = unsafe { Box::from_raw(batch) };
+    batch.verify(OsRng).is_ok()
+}
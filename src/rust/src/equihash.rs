@@ -1,3 +1,5 @@
+use blake2b_simd::{Params as Blake2bParams, State as Blake2bState};
+use rayon::prelude::*;
 use tracing::error;
 use zcash_primitives::block::equihash;
 
@@ -6,6 +8,14 @@ mod ffi {
     #[namespace = "equihash"]
     extern "Rust" {
         fn is_valid(n: u32, k: u32, input: &[u8], nonce: &[u8], soln: &[u8]) -> bool;
+        fn is_valid_batch(
+            n: u32,
+            k: u32,
+            inputs: &[u8],
+            nonces: &[u8],
+            solns: &[u8],
+            results: &mut [u8],
+        ) -> bool;
     }
 }
 
@@ -23,6 +33,9 @@ fn is_valid(n: u32, k: u32, input: &[u8], nonce: &[u8], soln: &[u8]) -> bool {
         );
         return false;
     }
+    if let Some(valid) = verify_on_stack(n, k, input, nonce, soln) {
+        return valid;
+    }
     if let Err(e) = equihash::is_valid_solution(n, k, input, nonce, soln) {
         error!("equihash::is_valid: is_valid_solution: {}", e);
         false
@@ -30,3 +43,175 @@ fn is_valid(n: u32, k: u32, input: &[u8], nonce: &[u8], soln: &[u8]) -> bool {
         true
     }
 }
+
+/// Validates `results.len()` solutions in parallel, each with its own input,
+/// nonce and solution taken in order from the equal-length chunks of `inputs`,
+/// `nonces` and `solns`. Sets each result to 1 if the solution is valid and 0
+/// otherwise, and returns whether they all are.
+pub(crate) fn is_valid_batch(
+    n: u32,
+    k: u32,
+    inputs: &[u8],
+    nonces: &[u8],
+    solns: &[u8],
+    results: &mut [u8],
+) -> bool {
+    let count = results.len();
+    if count == 0 {
+        return true;
+    }
+    if inputs.len() % count != 0 || nonces.len() % count != 0 || solns.len() % count != 0 {
+        error!(
+            "equihash::is_valid_batch: lengths are not multiples of {}",
+            count
+        );
+        results.iter_mut().for_each(|valid| *valid = 0);
+        return false;
+    }
+    results
+        .par_iter_mut()
+        .zip(inputs.par_chunks(inputs.len() / count))
+        .zip(nonces.par_chunks(nonces.len() / count))
+        .zip(solns.par_chunks(solns.len() / count))
+        .for_each(|(((valid, input), nonce), soln)| {
+            *valid = is_valid(n, k, input, nonce, soln) as u8
+        });
+    results.iter().all(|valid| *valid == 1)
+}
+
+/// The largest `k` the verifier below handles, for at most 512 indices.
+const MAX_K: u32 = 9;
+/// The largest expanded hash the verifier below handles, in bytes.
+const MAX_HASH_LENGTH: usize = 64;
+
+/// One node of the tree being verified: the part of its hash that has not
+/// collided yet, and its first (and smallest) index.
+#[derive(Clone, Copy)]
+struct StackNode {
+    hash: [u8; MAX_HASH_LENGTH],
+    len: usize,
+    first: u32,
+    height: u32,
+}
+
+/// Reads `len` bits from `bytes`, most significant first, starting at bit
+/// `start`.
+fn read_bits(bytes: &[u8], start: usize, len: usize) -> u32 {
+    let mut acc: u64 = 0;
+    let end = start + len;
+    for b in &bytes[start / 8..(end + 7) / 8] {
+        acc = (acc << 8) | u64::from(*b);
+    }
+    let shift = ((end + 7) / 8) * 8 - end;
+    ((acc >> shift) & ((1u64 << len) - 1)) as u32
+}
+
+/// Validates a solution with the same result as
+/// `equihash::is_valid_solution`, but without allocating: the tree is walked
+/// leaf by leaf, keeping only the nodes of the current path on a stack, and
+/// the BLAKE2b state of the input and nonce is built once and copied for each
+/// leaf.
+///
+/// The indices are checked to be distinct all at once rather than for every
+/// pair of subtrees, which is equivalent, as any two leaves are in different
+/// subtrees where their paths meet.
+///
+/// Returns None for parameters beyond the fixed bounds of the stack, which
+/// are left to the library.
+pub(crate) fn verify_on_stack(
+    n: u32,
+    k: u32,
+    input: &[u8],
+    nonce: &[u8],
+    soln: &[u8],
+) -> Option<bool> {
+    if k < 3 || k > MAX_K || n % (k + 1) != 0 {
+        return None;
+    }
+    let collision_bit_length = (n / (k + 1)) as usize;
+    let collision_byte_length = (collision_bit_length + 7) / 8;
+    let hash_length = (k as usize + 1) * collision_byte_length;
+    let indices_per_hash_output = (512 / n) as usize;
+    let hash_output = indices_per_hash_output * n as usize / 8;
+    if collision_bit_length < 8 || collision_bit_length + 1 > 25 || hash_length > MAX_HASH_LENGTH {
+        return None;
+    }
+
+    let num_indices = 1usize << k;
+    let mut indices = [0u32; 1 << MAX_K];
+    for (i, index) in indices[..num_indices].iter_mut().enumerate() {
+        *index = read_bits(
+            soln,
+            i * (collision_bit_length + 1),
+            collision_bit_length + 1,
+        );
+    }
+    let mut sorted = indices;
+    sorted[..num_indices].sort_unstable();
+    if sorted[..num_indices].windows(2).any(|w| w[0] == w[1]) {
+        return Some(false);
+    }
+
+    let mut personalization = [0u8; 16];
+    personalization[..8].copy_from_slice(b"ZcashPoW");
+    personalization[8..12].copy_from_slice(&n.to_le_bytes());
+    personalization[12..].copy_from_slice(&k.to_le_bytes());
+    let mut base_state: Blake2bState = Blake2bParams::new()
+        .hash_length(hash_output)
+        .personal(&personalization)
+        .to_state();
+    base_state.update(input).update(nonce);
+
+    let mut stack = [StackNode {
+        hash: [0; MAX_HASH_LENGTH],
+        len: 0,
+        first: 0,
+        height: 0,
+    }; MAX_K as usize + 1];
+    let mut depth = 0;
+
+    for index in &indices[..num_indices] {
+        let mut state = base_state.clone();
+        let hash = state
+            .update(&((*index as usize / indices_per_hash_output) as u32).to_le_bytes())
+            .finalize();
+        let start = (*index as usize % indices_per_hash_output) * n as usize / 8;
+        let bytes = &hash.as_bytes()[start..start + n as usize / 8];
+
+        // Expand each collision_bit_length chunk into its own big-endian
+        // collision_byte_length bytes.
+        let leaf = &mut stack[depth];
+        for j in 0..=k as usize {
+            let value = read_bits(bytes, j * collision_bit_length, collision_bit_length);
+            for b in 0..collision_byte_length {
+                leaf.hash[j * collision_byte_length + b] =
+                    (value >> (8 * (collision_byte_length - b - 1))) as u8;
+            }
+        }
+        leaf.len = hash_length;
+        leaf.first = *index;
+        leaf.height = 0;
+        depth += 1;
+
+        // Merge the subtrees that are complete.
+        while depth >= 2 && stack[depth - 1].height == stack[depth - 2].height {
+            let b = stack[depth - 1];
+            let a = &mut stack[depth - 2];
+            if a.hash[..collision_byte_length] != b.hash[..collision_byte_length]
+                || b.first < a.first
+            {
+                return Some(false);
+            }
+            let len = a.len - collision_byte_length;
+            for i in 0..len {
+                a.hash[i] = a.hash[i + collision_byte_length] ^ b.hash[i + collision_byte_length];
+            }
+            a.len = len;
+            a.height += 1;
+            depth -= 1;
+        }
+    }
+
+    debug_assert!(depth == 1);
+    Some(stack[0].hash[..stack[0].len].iter().all(|b| *b == 0))
+}
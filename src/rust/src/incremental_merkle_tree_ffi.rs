@@ -127,6 +127,82 @@ pub extern "C" fn orchard_merkle_frontier_append_bundle(
     true
 }
 
+/// Returns the root of the subtree of `2^subtree_height` leaves that the most
+/// recently appended leaf completed, if it completed one.
+fn completed_subtree_root(
+    tree: &bridgetree::Frontier<MerkleHashOrchard, MERKLE_DEPTH>,
+    subtree_height: u8,
+) -> Option<MerkleHashOrchard> {
+    let frontier = tree.value()?;
+    if (<u64>::from(frontier.position()) + 1) % (1 << subtree_height) != 0 {
+        return None;
+    }
+    // The leaf is then a right leaf, and the ommers below the subtree root
+    // are the complete subtrees to its left.
+    match frontier.leaf() {
+        bridgetree::Leaf::Right(left, right) => Some(
+            frontier
+                .ommers()
+                .iter()
+                .take(subtree_height as usize - 1)
+                .enumerate()
+                .fold(
+                    MerkleHashOrchard::combine(Altitude::from(0), left, right),
+                    |root, (i, ommer)| {
+                        MerkleHashOrchard::combine(Altitude::from(i as u8 + 1), ommer, &root)
+                    },
+                ),
+        ),
+        bridgetree::Leaf::Left(_) => None,
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn orchard_merkle_frontier_append_bundle_subtrees(
+    tree: *mut bridgetree::Frontier<MerkleHashOrchard, MERKLE_DEPTH>,
+    bundle: *const orchard::Bundle<Authorized, Amount>,
+    subtree_height: u8,
+    roots_ret: *mut [u8; 32],
+    roots_len: usize,
+    num_roots_ret: *mut usize,
+) -> bool {
+    let tree = unsafe {
+        tree.as_mut()
+            .expect("Orchard note commitment tree pointer may not be null.")
+    };
+    let num_roots_ret = unsafe {
+        num_roots_ret
+            .as_mut()
+            .expect("Cannot return to the null pointer.")
+    };
+    let roots_ret = if roots_len == 0 {
+        &mut [][..]
+    } else {
+        unsafe { std::slice::from_raw_parts_mut(roots_ret, roots_len) }
+    };
+    assert!(subtree_height >= 1 && subtree_height <= MERKLE_DEPTH);
+
+    *num_roots_ret = 0;
+    if let Some(bundle) = unsafe { bundle.as_ref() } {
+        for action in bundle.actions().iter() {
+            if !tree.append(&MerkleHashOrchard::from_cmx(action.cmx())) {
+                error!("Orchard note commitment tree is full.");
+                return false;
+            }
+            if let Some(root) = completed_subtree_root(tree, subtree_height) {
+                if *num_roots_ret == roots_ret.len() {
+                    error!("Too many completed Orchard subtrees for the buffer.");
+                    return false;
+                }
+                roots_ret[*num_roots_ret] = root.to_bytes();
+                *num_roots_ret += 1;
+            }
+        }
+    }
+
+    true
+}
+
 #[no_mangle]
 pub extern "C" fn orchard_merkle_frontier_root(
     tree: *const bridgetree::Frontier<MerkleHashOrchard, MERKLE_DEPTH>,
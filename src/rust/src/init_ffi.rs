@@ -1,7 +1,45 @@
+use std::slice;
+
 #[no_mangle]
-pub extern "C" fn zcashd_init_rayon_threadpool() {
+pub extern "C" fn zcashd_init_rayon_threadpool(
+    num_threads: usize,
+    cpus: *const usize,
+    cpus_len: usize,
+) {
+    let cpus = if cpus.is_null() {
+        vec![]
+    } else {
+        unsafe { slice::from_raw_parts(cpus, cpus_len) }.to_vec()
+    };
+
     rayon::ThreadPoolBuilder::new()
+        .num_threads(num_threads)
         .thread_name(|i| format!("zc-rayon-{}", i))
+        .start_handler(move |_| bind_to_cpus(&cpus))
         .build_global()
         .expect("Only initialized once");
 }
+
+/// Binds the calling thread to the given CPUs, if there are any.
+#[cfg(target_os = "linux")]
+fn bind_to_cpus(cpus: &[usize]) {
+    if cpus.is_empty() {
+        return;
+    }
+    unsafe {
+        let mut set: libc::cpu_set_t = std::mem::zeroed();
+        libc::CPU_ZERO(&mut set);
+        for &cpu in cpus {
+            libc::CPU_SET(cpu, &mut set);
+        }
+        if libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set) != 0 {
+            tracing::warn!(
+                "Failed to bind proving thread to its CPUs: {}",
+                std::io::Error::last_os_error()
+            );
+        }
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn bind_to_cpus(_cpus: &[usize]) {}
@@ -1,4 +1,7 @@
-use std::{mem, ptr};
+use std::{
+    io::{self, Write},
+    mem, ptr, slice,
+};
 
 use libc::size_t;
 use memuse::DynamicUsage;
@@ -69,6 +72,40 @@ pub extern "C" fn orchard_bundle_parse(
     }
 }
 
+#[no_mangle]
+pub extern "C" fn orchard_bundle_parse_slice(
+    data: *const u8,
+    data_len: usize,
+    bundle_ret: *mut *mut Bundle<Authorized, Amount>,
+    consumed_ret: *mut usize,
+) -> bool {
+    let data = if data_len == 0 {
+        &[][..]
+    } else {
+        unsafe { slice::from_raw_parts(data, data_len) }
+    };
+    // Reading from a slice advances it past the bytes that were read.
+    let mut reader = data;
+
+    match orchard_serialization::read_v5_bundle(&mut reader) {
+        Ok(parsed) => {
+            unsafe {
+                *bundle_ret = if let Some(bundle) = parsed {
+                    Box::into_raw(Box::new(bundle))
+                } else {
+                    ptr::null_mut::<Bundle<Authorized, Amount>>()
+                };
+                *consumed_ret = data_len - reader.len();
+            };
+            true
+        }
+        Err(e) => {
+            error!("Failed to parse Orchard bundle: {}", e);
+            false
+        }
+    }
+}
+
 #[no_mangle]
 pub extern "C" fn orchard_bundle_serialize(
     bundle: *const Bundle<Authorized, Amount>,
@@ -76,9 +113,12 @@ pub extern "C" fn orchard_bundle_serialize(
     write_cb: Option<WriteCb>,
 ) -> bool {
     let bundle = unsafe { bundle.as_ref() };
-    let writer = CppStreamWriter::from_raw_parts(stream, write_cb.unwrap());
+    // The bundle is written in many small pieces, so buffer them to pass them
+    // to the C++ stream in as few calls as possible.
+    let mut writer = io::BufWriter::new(CppStreamWriter::from_raw_parts(stream, write_cb.unwrap()));
 
-    match orchard_serialization::write_v5_bundle(bundle, writer) {
+    match orchard_serialization::write_v5_bundle(bundle, &mut writer).and_then(|()| writer.flush())
+    {
         Ok(()) => true,
         Err(e) => {
             error!("{}", e);
@@ -22,14 +22,17 @@
 use bellman::groth16::{self, prepare_verifying_key, Parameters, PreparedVerifyingKey};
 use blake2s_simd::Params as Blake2sParams;
 use bls12_381::Bls12;
-use group::{cofactor::CofactorGroup, GroupEncoding};
+use group::{cofactor::CofactorGroup, ff::PrimeField, Curve, GroupEncoding};
 use libc::{c_uchar, size_t};
 use rand_core::{OsRng, RngCore};
+use rayon::prelude::*;
 use std::fs::File;
 use std::io::BufReader;
 use std::path::{Path, PathBuf};
 use std::slice;
 use std::sync::Once;
+use std::thread::{self, JoinHandle};
+use std::time::UNIX_EPOCH;
 use subtle::CtOption;
 use tracing::info;
 
@@ -50,7 +53,11 @@ use zcash_primitives::{
         keys::FullViewingKey, note_encryption::sapling_ka_agree, redjubjub, Diversifier, Note,
         PaymentAddress, ProofGenerationKey, Rseed, ViewingKey,
     },
-    sapling::{merkle_hash, spend_sig},
+    sapling::{
+        merkle_hash,
+        pedersen_hash::{pedersen_hash, Personalization},
+        spend_sig,
+    },
     transaction::components::Amount,
     zip32::{self, sapling_address, sapling_derive_internal_fvk, sapling_find_address},
 };
@@ -60,6 +67,7 @@ use zcash_proofs::{
 };
 
 mod blake2b;
+mod compression;
 mod ed25519;
 mod equihash;
 mod metrics_ffi;
@@ -92,13 +100,103 @@ static mut SAPLING_SPEND_VK: Option<groth16::VerifyingKey<Bls12>> = None;
 static mut SAPLING_OUTPUT_VK: Option<groth16::VerifyingKey<Bls12>> = None;
 static mut SPROUT_GROTH16_VK: Option<PreparedVerifyingKey<Bls12>> = None;
 
-static mut SAPLING_SPEND_PARAMS: Option<Parameters<Bls12>> = None;
-static mut SAPLING_OUTPUT_PARAMS: Option<Parameters<Bls12>> = None;
 static mut SPROUT_GROTH16_PARAMS_PATH: Option<PathBuf> = None;
 
-static mut ORCHARD_PK: Option<orchard::circuit::ProvingKey> = None;
 static mut ORCHARD_VK: Option<orchard::circuit::VerifyingKey> = None;
 
+/// The proving keys, which are only needed to create proofs.
+struct ProvingKeys {
+    sapling_spend: Parameters<Bls12>,
+    sapling_output: Parameters<Bls12>,
+    orchard: orchard::circuit::ProvingKey,
+}
+
+/// How the proving keys will be obtained the first time they are needed.
+enum ProvingKeysLoader {
+    /// They are being loaded on a background thread.
+    Background(JoinHandle<ProvingKeys>),
+    /// They have not been loaded, and are loaded on the thread that first needs them.
+    Deferred(Box<dyn FnOnce() -> ProvingKeys + Send>),
+}
+
+static PROVING_KEYS_LOADED: Once = Once::new();
+static mut PROVING_KEYS_LOADER: Option<ProvingKeysLoader> = None;
+static mut PROVING_KEYS: Option<ProvingKeys> = None;
+
+/// Returns the proving keys, shared by every proof created in this process. They are
+/// built once, waiting for the background thread that loads them if it has not
+/// finished yet.
+fn proving_keys() -> &'static ProvingKeys {
+    PROVING_KEYS_LOADED.call_once(|| {
+        // The loader is only set while the parameters are initialized, which happens
+        // before any proof is created, and is only taken here.
+        let keys = match unsafe { PROVING_KEYS_LOADER.take() }
+            .expect("parameters should have been initialized")
+        {
+            ProvingKeysLoader::Background(handle) => handle
+                .join()
+                .expect("loading the proving keys should not fail"),
+            ProvingKeysLoader::Deferred(load) => {
+                info!(target: "main", "Loading proving keys");
+                load()
+            }
+        };
+        unsafe {
+            PROVING_KEYS = Some(keys);
+        }
+    });
+    unsafe { PROVING_KEYS.as_ref() }.unwrap()
+}
+
+pub(crate) fn sapling_spend_params() -> &'static Parameters<Bls12> {
+    &proving_keys().sapling_spend
+}
+
+pub(crate) fn sapling_output_params() -> &'static Parameters<Bls12> {
+    &proving_keys().sapling_output
+}
+
+pub(crate) fn orchard_proving_key() -> &'static orchard::circuit::ProvingKey {
+    &proving_keys().orchard
+}
+
+/// The name of the file, next to the Sapling parameters, that records the size and
+/// modification time of the parameter files when their hashes were last checked.
+const VERIFIED_PARAMS_CACHE_NAME: &str = "params.verified";
+
+/// Describes the parameter files as they are recorded in the cache, one line per
+/// file, or returns `None` if any of them cannot be inspected.
+fn describe_params_files(paths: &[&Path]) -> Option<String> {
+    let mut description = String::new();
+    for path in paths {
+        let metadata = std::fs::metadata(path).ok()?;
+        let modified = metadata.modified().ok()?.duration_since(UNIX_EPOCH).ok()?;
+        description.push_str(&format!(
+            "{} {} {}.{:09}\n",
+            path.display(),
+            metadata.len(),
+            modified.as_secs(),
+            modified.subsec_nanos()
+        ));
+    }
+    Some(description)
+}
+
+/// Reads the verifying key at the start of a Groth16 parameters file, without reading
+/// the rest of it.
+fn read_verifying_key(path: &Path) -> groth16::VerifyingKey<Bls12> {
+    let file = File::open(path).expect("couldn't open parameters file");
+    groth16::VerifyingKey::read(&mut BufReader::new(file))
+        .expect("couldn't deserialize verifying key")
+}
+
+/// Reads a Groth16 parameters file, without checking its hash.
+fn read_parameters(path: &Path) -> Parameters<Bls12> {
+    let file = File::open(path).expect("couldn't open parameters file");
+    Parameters::read(&mut BufReader::with_capacity(1024 * 1024, file), false)
+        .expect("couldn't deserialize parameters file")
+}
+
 /// Converts CtOption<t> into Option<T>
 fn de_ct<T>(ct: CtOption<T>) -> Option<T> {
     if ct.is_some().into() {
@@ -120,10 +218,14 @@ fn fixed_scalar_mult(from: &[u8; 32], p_g: &jubjub::SubgroupPoint) -> jubjub::Su
 /// Loads the zk-SNARK parameters into memory and saves paths as necessary.
 /// Only called once.
 ///
-/// If `load_proving_keys` is `false`, the proving keys will not be loaded, making it
-/// impossible to create proofs. This flag is for the Boost test suite, which never
-/// creates shielded transactions, but exercises code that requires the verifying keys to
-/// be present even if there are no shielded components to verify.
+/// The verifying keys are loaded before this returns. The hashes of the parameter files
+/// are only checked when they have changed since they were last checked.
+///
+/// If `preload_proving_keys` is `true`, the proving keys (including the Orchard proving
+/// key, whose keygen takes several seconds) are loaded on a background thread that the
+/// first proof waits for. Otherwise they are only loaded when the first proof is
+/// created, so that a node that never creates proofs, or the Boost test suite, does not
+/// spend the time and memory on them.
 #[no_mangle]
 pub extern "C" fn librustzcash_init_zksnark_params(
     #[cfg(not(target_os = "windows"))] spend_path: *const u8,
@@ -135,7 +237,7 @@ pub extern "C" fn librustzcash_init_zksnark_params(
     #[cfg(not(target_os = "windows"))] sprout_path: *const u8,
     #[cfg(target_os = "windows")] sprout_path: *const u16,
     sprout_path_len: usize,
-    load_proving_keys: bool,
+    preload_proving_keys: bool,
 ) {
     PROOF_PARAMETERS_LOADED.call_once(|| {
         #[cfg(not(target_os = "windows"))]
@@ -174,34 +276,91 @@ pub extern "C" fn librustzcash_init_zksnark_params(
             sprout_path.as_ref().map(Path::new),
         );
 
-        // Load params
-        let params = load_parameters(spend_path, output_path, sprout_path);
-        let sapling_spend_params = params.spend_params;
-        let sapling_output_params = params.output_params;
-
-        // We need to clone these because we aren't necessarily storing the proving
-        // parameters in memory.
-        let sapling_spend_vk = sapling_spend_params.vk.clone();
-        let sapling_output_vk = sapling_output_params.vk.clone();
+        // The hashes of the parameter files are checked when they are first loaded, and
+        // the files are then recorded in a cache so that later starts only have to read
+        // the parts of the files they need.
+        let cache_path = spend_path.with_file_name(VERIFIED_PARAMS_CACHE_NAME);
+        let mut params_files = vec![spend_path, output_path];
+        params_files.extend(sprout_path);
+        let description = describe_params_files(&params_files);
+        let verified =
+            description.is_some() && std::fs::read_to_string(&cache_path).ok() == description;
+
+        let (sapling_spend_vk, sapling_output_vk, sprout_vk, loader) = if verified {
+            info!(target: "main", "Parameter files were already verified, skipping hash checks");
+            let sapling_spend_vk = read_verifying_key(spend_path);
+            let sapling_output_vk = read_verifying_key(output_path);
+            let sprout_vk = sprout_path.map(|p| prepare_verifying_key(&read_verifying_key(p)));
+
+            let (spend_path, output_path) = (spend_path.to_owned(), output_path.to_owned());
+            let loader = move || ProvingKeys {
+                sapling_spend: read_parameters(&spend_path),
+                sapling_output: read_parameters(&output_path),
+                orchard: orchard::circuit::ProvingKey::build(),
+            };
+            (
+                sapling_spend_vk,
+                sapling_output_vk,
+                sprout_vk,
+                Box::new(loader) as Box<dyn FnOnce() -> ProvingKeys + Send>,
+            )
+        } else {
+            // Load params, checking their hashes.
+            let params = load_parameters(spend_path, output_path, sprout_path);
+            if let Some(description) = description {
+                if let Err(e) = std::fs::write(&cache_path, description) {
+                    info!(target: "main", "Could not record the verified parameter files: {}", e);
+                }
+            }
+
+            // We need to clone these because we aren't necessarily storing the proving
+            // parameters in memory.
+            let sapling_spend_vk = params.spend_params.vk.clone();
+            let sapling_output_vk = params.output_params.vk.clone();
+
+            let (sapling_spend, sapling_output) = (params.spend_params, params.output_params);
+            let loader = move || ProvingKeys {
+                sapling_spend,
+                sapling_output,
+                orchard: orchard::circuit::ProvingKey::build(),
+            };
+            (
+                sapling_spend_vk,
+                sapling_output_vk,
+                params.sprout_vk,
+                Box::new(loader) as Box<dyn FnOnce() -> ProvingKeys + Send>,
+            )
+        };
 
         // Generate Orchard parameters.
         info!(target: "main", "Loading Orchard parameters");
-        let orchard_pk = load_proving_keys.then(orchard::circuit::ProvingKey::build);
         let orchard_vk = orchard::circuit::VerifyingKey::build();
 
+        // The proving keys are loaded in the background, so that validation can start
+        // without them; the first proof waits for them.
+        let loader = if preload_proving_keys {
+            ProvingKeysLoader::Background(
+                thread::Builder::new()
+                    .name("zc-params".into())
+                    .spawn(loader)
+                    .expect("couldn't start the thread loading the proving keys"),
+            )
+        } else {
+            ProvingKeysLoader::Deferred(loader)
+        };
+
         // Caller is responsible for calling this function once, so
         // these global mutations are safe.
         unsafe {
-            SAPLING_SPEND_PARAMS = load_proving_keys.then(|| sapling_spend_params);
-            SAPLING_OUTPUT_PARAMS = load_proving_keys.then(|| sapling_output_params);
             SPROUT_GROTH16_PARAMS_PATH = sprout_path.map(|p| p.to_owned());
 
             SAPLING_SPEND_VK = Some(sapling_spend_vk);
             SAPLING_OUTPUT_VK = Some(sapling_output_vk);
-            SPROUT_GROTH16_VK = params.sprout_vk;
+            SPROUT_GROTH16_VK = sprout_vk;
 
-            ORCHARD_PK = orchard_pk;
             ORCHARD_VK = Some(orchard_vk);
+
+            PROVING_KEYS_LOADER = Some(loader);
         }
     });
 }
@@ -243,6 +402,49 @@ pub extern "C" fn librustzcash_merkle_hash(
     *result = tmp;
 }
 
+/// Computes the merkle tree hashes of `count` pairs of nodes at the same
+/// depth, with the same results as `librustzcash_merkle_hash`. The Pedersen
+/// hashes are computed in parallel, and their points are converted to affine
+/// coordinates together, with one field inversion for the whole batch.
+///
+/// `pairs` must point to `count` pairs of 32-byte scalars, left then right,
+/// and `result` to `count` 32-byte outputs.
+#[no_mangle]
+pub extern "C" fn librustzcash_merkle_hash_batch(
+    depth: size_t,
+    pairs: *const [c_uchar; 64],
+    count: size_t,
+    result: *mut [c_uchar; 32],
+) {
+    if count == 0 {
+        return;
+    }
+    // Should be okay, because caller is responsible for ensuring the
+    // pointers are valid pointers to `count` elements.
+    let pairs = unsafe { slice::from_raw_parts(pairs, count) };
+    let result = unsafe { slice::from_raw_parts_mut(result, count) };
+
+    let bits = |bytes: &[u8]| -> Vec<bool> {
+        (0..bls12_381::Scalar::NUM_BITS as usize)
+            .map(|i| (bytes[i / 8] >> (i % 8)) & 1 == 1)
+            .collect()
+    };
+    let points: Vec<jubjub::ExtendedPoint> = pairs
+        .par_iter()
+        .map(|pair| {
+            let mut input = bits(&pair[..32]);
+            input.extend(bits(&pair[32..]));
+            pedersen_hash(Personalization::MerkleTree(depth), input).into()
+        })
+        .collect();
+
+    let mut affine = vec![jubjub::AffinePoint::identity(); count];
+    jubjub::ExtendedPoint::batch_normalize(&points, &mut affine);
+    for (out, point) in result.iter_mut().zip(affine.iter()) {
+        *out = point.get_u().to_repr();
+    }
+}
+
 #[no_mangle] // ToScalar
 pub extern "C" fn librustzcash_to_scalar(input: *const [c_uchar; 64], result: *mut [c_uchar; 32]) {
     // Should be okay, because caller is responsible for ensuring
@@ -507,6 +709,64 @@ pub extern "C" fn librustzcash_sapling_ka_agree(
     true
 }
 
+/// Computes \[sk\] \[8\] P for some 32-byte point P and each of `count`
+/// 32-byte Fs, as librustzcash_sapling_ka_agree does, decoding P once and
+/// converting the results to affine coordinates in one batch.
+///
+/// If P is invalid, returns false. Otherwise, sets each entry of `valid` to
+/// whether the corresponding sk is valid, and if so writes its result to the
+/// corresponding 32-byte entry of `results`.
+#[no_mangle]
+pub extern "C" fn librustzcash_sapling_ka_agree_batch(
+    zip216_enabled: bool,
+    p: *const [c_uchar; 32],
+    sks: *const [c_uchar; 32],
+    count: size_t,
+    results: *mut [c_uchar; 32],
+    valid: *mut bool,
+) -> bool {
+    // Deserialize p
+    let p = match de_ct(if zip216_enabled {
+        jubjub::ExtendedPoint::from_bytes(unsafe { &*p })
+    } else {
+        jubjub::AffinePoint::from_bytes_pre_zip216_compatibility(unsafe { *p }).map(|p| p.into())
+    }) {
+        Some(p) => p,
+        None => return false,
+    };
+    if count == 0 {
+        return true;
+    }
+    // Should be okay, because caller is responsible for ensuring the
+    // pointers are valid pointers to `count` elements.
+    let sks = unsafe { slice::from_raw_parts(sks, count) };
+    let results = unsafe { slice::from_raw_parts_mut(results, count) };
+    let valid = unsafe { slice::from_raw_parts_mut(valid, count) };
+
+    let points: Vec<jubjub::ExtendedPoint> = sks
+        .iter()
+        .zip(valid.iter_mut())
+        .map(|(sk, valid)| match de_ct(jubjub::Scalar::from_bytes(sk)) {
+            Some(sk) => {
+                *valid = true;
+                sapling_ka_agree(&sk, &p).into()
+            }
+            None => {
+                *valid = false;
+                jubjub::ExtendedPoint::identity()
+            }
+        })
+        .collect();
+
+    let mut affine = vec![jubjub::AffinePoint::identity(); count];
+    jubjub::ExtendedPoint::batch_normalize(&points, &mut affine);
+    for (out, point) in results.iter_mut().zip(affine.iter()) {
+        *out = point.to_bytes();
+    }
+
+    true
+}
+
 /// Compute g_d = GH(diversifier) and returns false if the diversifier is
 /// invalid. Computes \[esk\] g_d and writes the result to the 32-byte `result`
 /// buffer. Returns false if `esk` is not a valid scalar.
@@ -691,7 +951,7 @@ pub extern "C" fn librustzcash_sapling_output_proof(
         payment_address,
         rcm,
         value,
-        unsafe { SAPLING_OUTPUT_PARAMS.as_ref() }.unwrap(),
+        sapling_output_params(),
     );
 
     // Write the proof out to the caller
@@ -849,7 +1109,7 @@ pub extern "C" fn librustzcash_sapling_spend_proof(
             value,
             anchor,
             merkle_path,
-            unsafe { SAPLING_SPEND_PARAMS.as_ref() }.unwrap(),
+            sapling_spend_params(),
             &prepare_verifying_key(unsafe { SAPLING_SPEND_VK.as_ref() }.unwrap()),
         )
         .expect("proving should not fail");
@@ -0,0 +1,51 @@
+use crate::equihash::{is_valid_batch, verify_on_stack};
+use zcash_primitives::block::equihash;
+
+#[test]
+fn stack_verifier_matches_library() {
+    // The 96, 5 test vector from the C++ tests, as a minimal solution.
+    let input = b"Equihash is an asymmetric PoW based on the Generalised Birthday problem.";
+    let mut nonce = [0u8; 32];
+    nonce[0] = 1;
+    let indices: [u32; 32] = [
+        2261, 15185, 36112, 104243, 23779, 118390, 118332, 130041, 32642, 69878, 76925, 80080,
+        45858, 116805, 92842, 111026, 15972, 115059, 85191, 90330, 68190, 122819, 81830, 91132,
+        23460, 49807, 52426, 80391, 69567, 114474, 104973, 122568,
+    ];
+    let mut soln = vec![0u8; 32 * 17 / 8];
+    for (i, index) in indices.iter().enumerate() {
+        for bit in 0..17 {
+            if (index >> (16 - bit)) & 1 == 1 {
+                let pos = i * 17 + bit;
+                soln[pos / 8] |= 0x80 >> (pos % 8);
+            }
+        }
+    }
+
+    assert_eq!(verify_on_stack(96, 5, input, &nonce, &soln), Some(true));
+    assert!(equihash::is_valid_solution(96, 5, input, &nonce, &soln).is_ok());
+
+    // Every single-bit change gives the same result as the library.
+    for i in 0..soln.len() * 8 {
+        let mut mutated = soln.clone();
+        mutated[i / 8] ^= 1 << (i % 8);
+        assert_eq!(
+            verify_on_stack(96, 5, input, &nonce, &mutated),
+            Some(equihash::is_valid_solution(96, 5, input, &nonce, &mutated).is_ok())
+        );
+    }
+
+    let mut results = [0u8; 3];
+    let mut bad = soln.clone();
+    bad[3] ^= 1;
+    let solns = [soln.clone(), bad, soln].concat();
+    assert!(!is_valid_batch(
+        96,
+        5,
+        &[&input[..], &input[..], &input[..]].concat(),
+        &[nonce, nonce, nonce].concat(),
+        &solns,
+        &mut results
+    ));
+    assert_eq!(results, [1, 0, 1]);
+}
@@ -5,6 +5,7 @@ use zcash_primitives::constants::{
     VALUE_COMMITMENT_VALUE_GENERATOR,
 };
 
+mod equihash;
 mod key_agreement;
 mod key_components;
 mod mmr;
@@ -1,28 +1,32 @@
 use libc::c_char;
+use std::cell::RefCell;
 use std::ffi::CStr;
 use std::fs::File;
+use std::io::{self, BufWriter, Write};
 use std::path::Path;
 use std::slice;
 use std::str;
 use std::sync::{
-    atomic::{AtomicUsize, Ordering},
-    Mutex,
+    atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering},
+    Arc, Mutex,
 };
+use std::time::Instant;
 
 use tracing::{
     callsite::{Callsite, Identifier},
     field::{FieldSet, Value},
     level_enabled,
     metadata::Kind,
-    span::Entered,
+    span::{Entered, Id},
     subscriber::{Interest, Subscriber},
-    Event, Metadata, Span,
+    Event, Level, Metadata, Span,
 };
-use tracing_appender::non_blocking::WorkerGuard;
+use tracing_appender::non_blocking::{ErrorCounter, WorkerGuard};
 use tracing_core::Once;
 use tracing_subscriber::{
     filter::EnvFilter,
-    layer::{Layer, SubscriberExt},
+    layer::{Context, Layer, SubscriberExt},
+    registry::LookupSpan,
     reload::{self, Handle},
     util::SubscriberInitExt,
 };
@@ -53,7 +57,11 @@ where
 
 pub struct TracingHandle {
     _file_guard: Option<WorkerGuard>,
+    /// The lines that the file writer dropped because its buffer was full.
+    file_errors: Option<ErrorCounter>,
     reload_handle: Box<dyn ReloadHandle>,
+    profiler: Arc<Profiler>,
+    rate_limiter: Arc<RateLimiter>,
 }
 
 #[no_mangle]
@@ -63,6 +71,7 @@ pub extern "C" fn tracing_init(
     log_path_len: usize,
     initial_filter: *const c_char,
     log_timestamps: bool,
+    log_rate: u64,
 ) -> *mut TracingHandle {
     let initial_filter = unsafe { CStr::from_ptr(initial_filter) }
         .to_str()
@@ -82,38 +91,46 @@ pub extern "C" fn tracing_init(
 
     let log_path = log_path.as_ref().map(Path::new);
 
-    let (file_logger, file_no_timestamps, file_guard) = if let Some(log_path) = log_path {
-        let file_appender = tracing_appender::rolling::never(
-            log_path.parent().unwrap(),
-            log_path.file_name().unwrap(),
-        );
-        let (non_blocking, file_guard) = tracing_appender::non_blocking(file_appender);
-
-        if log_timestamps {
-            (
-                Some(
-                    tracing_subscriber::fmt::layer()
-                        .with_ansi(false)
-                        .with_writer(non_blocking),
-                ),
-                None,
-                Some(file_guard),
-            )
+    let (file_logger, file_no_timestamps, file_guard, file_errors) =
+        if let Some(log_path) = log_path {
+            let file_appender = tracing_appender::rolling::never(
+                log_path.parent().unwrap(),
+                log_path.file_name().unwrap(),
+            );
+            // The background writer flushes after each batch of lines that it
+            // takes from the channel, so buffer the file to write each batch at
+            // once rather than line by line.
+            let (non_blocking, file_guard) =
+                tracing_appender::non_blocking(BufWriter::new(file_appender));
+            let file_errors = non_blocking.error_counter();
+
+            if log_timestamps {
+                (
+                    Some(
+                        tracing_subscriber::fmt::layer()
+                            .with_ansi(false)
+                            .with_writer(non_blocking),
+                    ),
+                    None,
+                    Some(file_guard),
+                    Some(file_errors),
+                )
+            } else {
+                (
+                    None,
+                    Some(
+                        tracing_subscriber::fmt::layer()
+                            .with_ansi(false)
+                            .with_writer(non_blocking)
+                            .without_time(),
+                    ),
+                    Some(file_guard),
+                    Some(file_errors),
+                )
+            }
         } else {
-            (
-                None,
-                Some(
-                    tracing_subscriber::fmt::layer()
-                        .with_ansi(false)
-                        .with_writer(non_blocking)
-                        .without_time(),
-                ),
-                Some(file_guard),
-            )
-        }
-    } else {
-        (None, None, None)
-    };
+            (None, None, None, None)
+        };
 
     let (stdout_logger, stdout_no_timestamps) = if file_logger.is_none() {
         if log_timestamps {
@@ -133,18 +150,27 @@ pub extern "C" fn tracing_init(
     };
 
     let (filter, reload_handle) = reload::Layer::new(EnvFilter::from(initial_filter));
+    let profiler = Arc::new(Profiler::default());
+    let rate_limiter = Arc::new(RateLimiter::new(log_rate));
 
+    // The rate limiter is inside the filter, so that it only counts the
+    // events that pass the filter.
     tracing_subscriber::registry()
         .with(stdout_logger)
         .with(stdout_no_timestamps)
         .with(file_logger)
         .with(file_no_timestamps)
+        .with(ProfileLayer(profiler.clone()))
+        .with(RateLimitLayer(rate_limiter.clone()))
         .with(filter)
         .init();
 
     Box::into_raw(Box::new(TracingHandle {
         _file_guard: file_guard,
+        file_errors,
         reload_handle: Box::new(reload_handle),
+        profiler,
+        rate_limiter,
     }))
 }
 
@@ -176,21 +202,43 @@ pub extern "C" fn tracing_init_test(
         .without_time();
 
     let (filter, reload_handle) = reload::Layer::new(EnvFilter::from(initial_filter));
+    let profiler = Arc::new(Profiler::default());
 
     tracing_subscriber::registry()
         .with(file_logger)
+        .with(ProfileLayer(profiler.clone()))
         .with(filter)
         .init();
 
     Box::into_raw(Box::new(TracingHandle {
         _file_guard: None,
+        file_errors: None,
         reload_handle: Box::new(reload_handle),
+        profiler,
+        rate_limiter: Arc::new(RateLimiter::new(0)),
     }))
 }
 
 #[no_mangle]
 pub extern "C" fn tracing_free(handle: *mut TracingHandle) {
-    drop(unsafe { Box::from_raw(handle) });
+    let handle = unsafe { Box::from_raw(handle) };
+
+    let rate_limited = handle.rate_limiter.dropped.load(Ordering::Relaxed);
+    let overflowed = handle
+        .file_errors
+        .as_ref()
+        .map_or(0, |errors| errors.dropped_lines());
+    if rate_limited > 0 || overflowed > 0 {
+        tracing::warn!(
+            "{} log lines were dropped by -lograte, and {} because the log writer fell behind",
+            rate_limited,
+            overflowed,
+        );
+    }
+
+    // Dropping the guard waits for the background writer to write out the
+    // lines that are still queued.
+    drop(handle);
 }
 
 #[no_mangle]
@@ -216,6 +264,279 @@ pub extern "C" fn tracing_reload(handle: *mut TracingHandle, new_filter: *const
     }
 }
 
+/// A profile being written in the Chrome trace event format.
+struct Profile {
+    writer: BufWriter<File>,
+    start: Instant,
+    events: u64,
+}
+
+impl Profile {
+    fn write_event(
+        &mut self,
+        meta: &Metadata<'_>,
+        tid: u64,
+        entered: Instant,
+        exited: Instant,
+    ) -> io::Result<()> {
+        if self.events > 0 {
+            self.writer.write_all(b",\n")?;
+        }
+        self.events += 1;
+        // The names and targets of the C++ callsites are plain identifiers,
+        // but escape them in case a Rust span uses anything else.
+        let escape = |s: &str| s.replace('\\', "\\\\").replace('"', "\\\"");
+        write!(
+            self.writer,
+            "{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"ts\":{:.3},\"dur\":{:.3},\"pid\":1,\"tid\":{}}}",
+            escape(meta.name()),
+            escape(meta.target()),
+            entered.saturating_duration_since(self.start).as_secs_f64() * 1e6,
+            exited.saturating_duration_since(entered).as_secs_f64() * 1e6,
+            tid,
+        )
+    }
+
+    fn finish(mut self) -> io::Result<()> {
+        self.writer.write_all(b"\n]\n")?;
+        self.writer.flush()
+    }
+}
+
+/// Records the time spent in the spans that pass the log filter into a
+/// profile, while one is being written.
+///
+/// One in `sample_interval` of the spans that a thread enters outside of any
+/// sampled span is sampled, along with every span entered within it, so that
+/// each sample is a complete stack.
+#[derive(Default)]
+struct Profiler {
+    active: AtomicBool,
+    roots: AtomicU64,
+    sample_interval: AtomicU64,
+    profile: Mutex<Option<Profile>>,
+}
+
+static NEXT_PROFILE_THREAD_ID: AtomicU64 = AtomicU64::new(1);
+
+thread_local! {
+    /// The ID of this thread in profiles.
+    static PROFILE_THREAD_ID: u64 = NEXT_PROFILE_THREAD_ID.fetch_add(1, Ordering::Relaxed);
+    /// The sampled spans that this thread is in, and when it entered them.
+    static SAMPLED_SPANS: RefCell<Vec<(Id, Instant)>> = RefCell::new(vec![]);
+}
+
+impl Profiler {
+    fn start(&self, path: &Path, sample_interval: u64) -> io::Result<()> {
+        let mut writer = BufWriter::new(File::create(path)?);
+        writer.write_all(b"[\n")?;
+        let mut profile = self.profile.lock().unwrap();
+        if let Some(previous) = profile.take() {
+            previous.finish()?;
+        }
+        self.sample_interval
+            .store(sample_interval.max(1), Ordering::Relaxed);
+        *profile = Some(Profile {
+            writer,
+            start: Instant::now(),
+            events: 0,
+        });
+        self.active.store(true, Ordering::Release);
+        Ok(())
+    }
+
+    fn stop(&self) -> io::Result<bool> {
+        let mut profile = self.profile.lock().unwrap();
+        self.active.store(false, Ordering::Release);
+        match profile.take() {
+            Some(profile) => profile.finish().map(|()| true),
+            None => Ok(false),
+        }
+    }
+
+    fn record(&self, meta: &Metadata<'_>, entered: Instant, exited: Instant) {
+        let mut profile = self.profile.lock().unwrap();
+        let result = match profile.as_mut() {
+            // Spans entered before the profile was started are left out.
+            Some(p) if entered >= p.start => {
+                let tid = PROFILE_THREAD_ID.with(|tid| *tid);
+                p.write_event(meta, tid, entered, exited)
+            }
+            _ => Ok(()),
+        };
+        if let Err(e) = result {
+            self.active.store(false, Ordering::Release);
+            *profile = None;
+            drop(profile);
+            tracing::error!("Writing the profile failed: {}", e);
+        }
+    }
+}
+
+struct ProfileLayer(Arc<Profiler>);
+
+impl<S> Layer<S> for ProfileLayer
+where
+    S: Subscriber + for<'a> LookupSpan<'a>,
+{
+    fn on_enter(&self, id: &Id, _ctx: Context<'_, S>) {
+        if !self.0.active.load(Ordering::Relaxed) {
+            return;
+        }
+        SAMPLED_SPANS.with(|spans| {
+            let mut spans = spans.borrow_mut();
+            if !spans.is_empty()
+                || self.0.roots.fetch_add(1, Ordering::Relaxed)
+                    % self.0.sample_interval.load(Ordering::Relaxed)
+                    == 0
+            {
+                spans.push((id.clone(), Instant::now()));
+            }
+        });
+    }
+
+    fn on_exit(&self, id: &Id, ctx: Context<'_, S>) {
+        let entered = SAMPLED_SPANS.with(|spans| {
+            let mut spans = spans.borrow_mut();
+            spans
+                .iter()
+                .rposition(|(entered_id, _)| entered_id == id)
+                .map(|i| spans.remove(i).1)
+        });
+        if let (Some(entered), Some(meta)) = (entered, ctx.metadata(id)) {
+            self.0.record(meta, entered, Instant::now());
+        }
+    }
+}
+
+/// Limits the events of each target (the category of the C++ log macros) to a
+/// number per second, so that a flood of messages in one category cannot hold
+/// up the log writer or crowd out the rest of the log. Warnings and errors are
+/// never dropped.
+///
+/// Targets are counted in a fixed table of slots indexed by a hash of their
+/// names, so targets that share a slot share a limit, and the counts are reset
+/// without synchronization at the start of each second; the limit is
+/// approximate, but the hot path takes no locks.
+struct RateLimiter {
+    /// The events allowed per target per second, or 0 for no limit.
+    limit: u64,
+    start: Instant,
+    slots: Vec<RateLimitSlot>,
+    dropped: AtomicU64,
+}
+
+#[derive(Default)]
+struct RateLimitSlot {
+    second: AtomicU64,
+    count: AtomicU64,
+}
+
+const RATE_LIMIT_SLOTS: usize = 64;
+
+impl RateLimiter {
+    fn new(limit: u64) -> Self {
+        RateLimiter {
+            limit,
+            start: Instant::now(),
+            slots: (0..RATE_LIMIT_SLOTS)
+                .map(|_| RateLimitSlot::default())
+                .collect(),
+            dropped: AtomicU64::new(0),
+        }
+    }
+
+    fn allow(&self, meta: &Metadata<'_>) -> bool {
+        if self.limit == 0 || !meta.is_event() || *meta.level() <= Level::WARN {
+            return true;
+        }
+
+        // FNV-1a, which is plenty for a handful of short category names.
+        let hash = meta
+            .target()
+            .bytes()
+            .fold(0xcbf29ce484222325u64, |hash, b| {
+                (hash ^ u64::from(b)).wrapping_mul(0x100000001b3)
+            });
+        let slot = &self.slots[hash as usize % RATE_LIMIT_SLOTS];
+
+        let second = self.start.elapsed().as_secs();
+        if slot.second.swap(second, Ordering::Relaxed) != second {
+            slot.count.store(0, Ordering::Relaxed);
+        }
+        if slot.count.fetch_add(1, Ordering::Relaxed) < self.limit {
+            true
+        } else {
+            self.dropped.fetch_add(1, Ordering::Relaxed);
+            false
+        }
+    }
+}
+
+struct RateLimitLayer(Arc<RateLimiter>);
+
+impl<S: Subscriber> Layer<S> for RateLimitLayer {
+    fn register_callsite(&self, meta: &'static Metadata<'static>) -> Interest {
+        // Events have to be counted each time they are logged.
+        if self.0.limit > 0 && meta.is_event() && *meta.level() > Level::WARN {
+            Interest::sometimes()
+        } else {
+            Interest::always()
+        }
+    }
+
+    fn enabled(&self, meta: &Metadata<'_>, _ctx: Context<'_, S>) -> bool {
+        self.0.allow(meta)
+    }
+}
+
+/// Starts writing a profile of the spans that pass the log filter to the given
+/// path, replacing any profile already being written.
+///
+/// Returns `true` if the profile file was created.
+#[no_mangle]
+pub extern "C" fn tracing_profile_start(
+    handle: *mut TracingHandle,
+    #[cfg(not(target_os = "windows"))] profile_path: *const u8,
+    #[cfg(target_os = "windows")] profile_path: *const u16,
+    profile_path_len: usize,
+    sample_interval: u64,
+) -> bool {
+    let handle = unsafe { &*handle };
+    let profile_path = unsafe { slice::from_raw_parts(profile_path, profile_path_len) };
+
+    #[cfg(not(target_os = "windows"))]
+    let profile_path = OsStr::from_bytes(profile_path);
+
+    #[cfg(target_os = "windows")]
+    let profile_path = OsString::from_wide(profile_path);
+
+    let profile_path = Path::new(&profile_path);
+
+    match handle.profiler.start(profile_path, sample_interval) {
+        Ok(()) => true,
+        Err(e) => {
+            tracing::error!("Starting the profile failed: {}", e);
+            false
+        }
+    }
+}
+
+/// Finishes the profile being written, if any.
+///
+/// Returns `true` if a profile was being written and it was completed.
+#[no_mangle]
+pub extern "C" fn tracing_profile_stop(handle: *mut TracingHandle) -> bool {
+    let handle = unsafe { &*handle };
+    match handle.profiler.stop() {
+        Ok(stopped) => stopped,
+        Err(e) => {
+            tracing::error!("Finishing the profile failed: {}", e);
+            false
+        }
+    }
+}
+
 pub struct FfiCallsite {
     interest: AtomicUsize,
     meta: Option<Metadata<'static>>,
@@ -1,9 +1,11 @@
 use byteorder::{LittleEndian, ReadBytesExt, WriteBytesExt};
 use incrementalmerkletree::{bridgetree, bridgetree::BridgeTree, Position, Tree};
 use libc::c_uchar;
+use rayon::prelude::*;
 use std::collections::{BTreeMap, BTreeSet};
 use std::convert::TryInto;
 use std::io;
+use std::mem;
 use std::ptr;
 use std::slice;
 use tracing::error;
@@ -403,6 +405,75 @@ impl Wallet {
         involvement
     }
 
+    /// Add the notes of the bundles of a block's transactions, in order, as
+    /// `add_notes_from_bundle` does for each of them. The actions of all the
+    /// bundles are trial-decrypted together across the global thread pool,
+    /// so that a block with many actions, or a wallet with many keys, is not
+    /// decrypted one bundle at a time.
+    #[tracing::instrument(level = "trace", skip(self, bundles))]
+    pub fn add_notes_from_bundles(
+        &mut self,
+        bundles: &[(TxId, Option<&Bundle<Authorized, Amount>>)],
+    ) -> Vec<BundleWalletInvolvement> {
+        let keys = self
+            .key_store
+            .viewing_keys
+            .keys()
+            .cloned()
+            .collect::<Vec<_>>();
+
+        let actions = bundles
+            .iter()
+            .enumerate()
+            .flat_map(|(bundle_idx, (_, bundle))| {
+                let len = bundle.map_or(0, |bundle| bundle.actions().len());
+                (0..len).map(move |action_idx| (bundle_idx, action_idx))
+            })
+            .collect::<Vec<_>>();
+
+        // Each action is decrypted with the first key that can, as in
+        // `Bundle::decrypt_outputs_with_keys`. The results stay in order.
+        let decrypted = actions
+            .par_iter()
+            .filter_map(|&(bundle_idx, action_idx)| {
+                let bundle = bundles[bundle_idx].1.unwrap();
+                keys.iter().find_map(|ivk| {
+                    bundle.decrypt_output_with_key(action_idx, ivk).map(
+                        |(note, recipient, memo)| {
+                            (bundle_idx, action_idx, ivk.clone(), note, recipient, memo)
+                        },
+                    )
+                })
+            })
+            .collect::<Vec<_>>();
+
+        // A bundle may spend notes received earlier in the block, so the
+        // wallet is updated one bundle at a time.
+        let mut decrypted = decrypted.into_iter().peekable();
+        let mut result = Vec::with_capacity(bundles.len());
+        for (bundle_idx, (txid, bundle)) in bundles.iter().enumerate() {
+            let mut involvement = BundleWalletInvolvement::new();
+            if let Some(bundle) = bundle {
+                involvement.spend_action_metadata = self.add_potential_spends(txid, bundle);
+            }
+            while let Some((_, action_idx, ivk, note, recipient, memo)) =
+                decrypted.next_if(|item| item.0 == bundle_idx)
+            {
+                assert!(self.add_decrypted_note(
+                    txid,
+                    action_idx,
+                    ivk.clone(),
+                    note,
+                    recipient,
+                    memo
+                ));
+                involvement.receive_action_metadata.insert(action_idx, ivk);
+            }
+            result.push(involvement);
+        }
+        result
+    }
+
     /// Restore note and potential spend data from a bundle using the provided
     /// metadata.
     ///
@@ -694,6 +765,74 @@ impl Wallet {
         self.witness_tree.root(checkpoint_depth)
     }
 
+    /// Stops witnessing the notes spent by the given transactions, so that the
+    /// parts of the note commitment tree kept only for their witnesses are
+    /// dropped by the next garbage collection. The caller must only pass
+    /// transactions that are too deep to be reorganized away. Returns the
+    /// number of notes that were witnessed until now.
+    pub fn forget_spent_note_witnesses(&mut self, spending_txids: &BTreeSet<TxId>) -> usize {
+        let mut forgotten = 0;
+        for (outpoint, inpoint) in &self.mined_notes {
+            if !spending_txids.contains(&inpoint.txid) {
+                continue;
+            }
+            let position = self
+                .wallet_note_positions
+                .get(&outpoint.txid)
+                .and_then(|tx_notes| tx_notes.note_positions.get(&outpoint.action_idx));
+            if let Some(position) = position {
+                if self.witness_tree.remove_witness(*position) {
+                    forgotten += 1;
+                }
+            }
+        }
+        forgotten
+    }
+
+    /// Returns an estimate of the heap memory used by the wallet's indexes and
+    /// note commitment tree.
+    ///
+    /// This counts the entries of the maps and the fixed-size parts of the
+    /// tree's bridges and checkpoints, but not the allocator's overhead or the
+    /// ommers held by each bridge, so it is a lower bound.
+    pub fn dynamic_usage(&self) -> usize {
+        fn map_usage<K, V>(len: usize) -> usize {
+            len * (mem::size_of::<K>() + mem::size_of::<V>())
+        }
+
+        let key_store =
+            map_usage::<OrderedAddress, IncomingViewingKey>(self.key_store.payment_addresses.len())
+                + map_usage::<IncomingViewingKey, FullViewingKey>(
+                    self.key_store.viewing_keys.len(),
+                )
+                + map_usage::<FullViewingKey, SpendingKey>(self.key_store.spending_keys.len());
+        let received_notes = map_usage::<TxId, TxNotes>(self.wallet_received_notes.len())
+            + self
+                .wallet_received_notes
+                .values()
+                .map(|tx_notes| map_usage::<usize, DecryptedNote>(tx_notes.decrypted_notes.len()))
+                .sum::<usize>();
+        let note_positions = map_usage::<TxId, NotePositions>(self.wallet_note_positions.len())
+            + self
+                .wallet_note_positions
+                .values()
+                .map(|positions| map_usage::<usize, Position>(positions.note_positions.len()))
+                .sum::<usize>();
+        let spends = map_usage::<Nullifier, OutPoint>(self.nullifiers.len())
+            + map_usage::<OutPoint, InPoint>(self.mined_notes.len())
+            + map_usage::<Nullifier, BTreeSet<InPoint>>(self.potential_spends.len())
+            + self
+                .potential_spends
+                .values()
+                .map(|inpoints| map_usage::<InPoint, ()>(inpoints.len()))
+                .sum::<usize>();
+        let witness_tree = mem::size_of_val(self.witness_tree.prior_bridges())
+            + map_usage::<Position, usize>(self.witness_tree.witnessed_indices().len())
+            + mem::size_of_val(&self.witness_tree.checkpoints()[..]);
+
+        key_store + received_notes + note_positions + spends + witness_tree
+    }
+
     /// Fetches the information necessary to spend the note at the given `OutPoint`,
     /// relative to the specified root of the Orchard note commitment tree.
     ///
@@ -880,6 +1019,48 @@ pub extern "C" fn orchard_wallet_add_notes_from_bundle(
     }
 }
 
+#[no_mangle]
+pub extern "C" fn orchard_wallet_add_notes_from_bundles(
+    wallet: *mut Wallet,
+    txids: *const [c_uchar; 32],
+    bundles: *const *const Bundle<Authorized, Amount>,
+    bundles_len: usize,
+    cb_receivers: *const Option<FFICallbackReceiver>,
+    action_ivk_push_cb: Option<ActionIvkPushCb>,
+    spend_idx_push_cb: Option<SpendIndexPushCb>,
+    involved: *mut bool,
+) {
+    let wallet = unsafe { wallet.as_mut() }.expect("Wallet pointer may not be null");
+    let txids = unsafe { slice::from_raw_parts(txids, bundles_len) };
+    let bundle_ptrs = unsafe { slice::from_raw_parts(bundles, bundles_len) };
+    let cb_receivers = unsafe { slice::from_raw_parts(cb_receivers, bundles_len) };
+    let involved = unsafe { slice::from_raw_parts_mut(involved, bundles_len) };
+
+    let bundles = txids
+        .iter()
+        .zip(bundle_ptrs.iter())
+        .map(|(txid, bundle)| (TxId::from_bytes(*txid), unsafe { bundle.as_ref() }))
+        .collect::<Vec<_>>();
+
+    let added = wallet.add_notes_from_bundles(&bundles);
+    for (i, added) in added.into_iter().enumerate() {
+        involved[i] =
+            !(added.receive_action_metadata.is_empty() && added.spend_action_metadata.is_empty());
+        for (action_idx, ivk) in added.receive_action_metadata.into_iter() {
+            let action_ivk = FFIActionIvk {
+                action_idx: action_idx.try_into().unwrap(),
+                ivk_ptr: Box::into_raw(Box::new(ivk.clone())),
+            };
+            unsafe { (action_ivk_push_cb.unwrap())(cb_receivers[i], action_ivk) };
+        }
+        for action_idx in added.spend_action_metadata {
+            unsafe {
+                (spend_idx_push_cb.unwrap())(cb_receivers[i], action_idx.try_into().unwrap())
+            };
+        }
+    }
+}
+
 #[no_mangle]
 pub extern "C" fn orchard_wallet_load_bundle(
     wallet: *mut Wallet,
@@ -950,6 +1131,12 @@ pub extern "C" fn orchard_wallet_commitment_tree_root(
     *root_ret = wallet.note_commitment_tree_root(0).unwrap().to_bytes();
 }
 
+#[no_mangle]
+pub extern "C" fn orchard_wallet_dynamic_usage(wallet: *const Wallet) -> usize {
+    let wallet = unsafe { wallet.as_ref() }.expect("Wallet pointer may not be null");
+    wallet.dynamic_usage()
+}
+
 #[no_mangle]
 pub extern "C" fn orchard_wallet_add_spending_key(wallet: *mut Wallet, sk: *const SpendingKey) {
     let wallet = unsafe { wallet.as_mut() }.expect("Wallet pointer may not be null");
@@ -1256,6 +1443,22 @@ pub extern "C" fn orchard_wallet_gc_note_commitment_tree(wallet: *mut Wallet) {
     wallet.witness_tree.garbage_collect();
 }
 
+#[no_mangle]
+pub extern "C" fn orchard_wallet_forget_spent_note_witnesses(
+    wallet: *mut Wallet,
+    txids: *const [c_uchar; 32],
+    txids_len: usize,
+) -> usize {
+    let wallet = unsafe { wallet.as_mut() }.expect("Wallet pointer may not be null.");
+    let txids = if txids_len == 0 {
+        &[][..]
+    } else {
+        unsafe { slice::from_raw_parts(txids, txids_len) }
+    };
+    let spending_txids = txids.iter().map(|txid| TxId::from_bytes(*txid)).collect();
+    wallet.forget_spent_note_witnesses(&spending_txids)
+}
+
 const NOTE_STATE_V1: u8 = 1;
 
 #[no_mangle]
@@ -12,7 +12,7 @@
 
 #include <boost/bind/bind.hpp>
 
-CScheduler::CScheduler() : nThreadsServicingQueue(0), stopRequested(false), stopWhenEmpty(false)
+CScheduler::CScheduler() : nThreadsServicingQueue(0), nLongTasksRunning(0), stopRequested(false), stopWhenEmpty(false)
 {
 }
 
@@ -22,6 +22,19 @@ CScheduler::~CScheduler()
 }
 
 
+CScheduler::TaskQueue::iterator CScheduler::nextRunnableTask()
+{
+    if (nLongTasksRunning == 0 || nLongTasksRunning + 1 < nThreadsServicingQueue) {
+        return taskQueue.begin();
+    }
+    for (TaskQueue::iterator it = taskQueue.begin(); it != taskQueue.end(); ++it) {
+        if (!it->second.fLongRunning) {
+            return it;
+        }
+    }
+    return taskQueue.end();
+}
+
 void CScheduler::serviceQueue()
 {
     boost::unique_lock<boost::mutex> lock(newTaskMutex);
@@ -31,40 +44,49 @@ void CScheduler::serviceQueue()
     // when the thread is waiting or when the user's function
     // is called.
     while (!shouldStop()) {
+        bool fRunningLong = false;
         try {
-            while (!shouldStop() && taskQueue.empty()) {
+            TaskQueue::iterator it = nextRunnableTask();
+            if (it == taskQueue.end()) {
                 // Wait until there is something to do.
                 newTaskScheduled.wait(lock);
+                continue;
             }
 
-            // Wait until either there is a new task, or until
-            // the time of the first item on the queue:
-
-            // Some boost versions have a conflicting overload of wait_until that returns void.
-            // Explicitly use a template here to avoid hitting that overload.
-            while (!shouldStop() && !taskQueue.empty())
-            {
-                auto copy = taskQueue.begin()->first;
-                if (newTaskScheduled.wait_until<>(lock, copy) == boost::cv_status::timeout) {
-                    break;
-                }
-            }
-
-            // If there are multiple threads, the queue can empty while we're waiting (another
-            // thread may service the task we were waiting on).
-            if (shouldStop() || taskQueue.empty())
+            // Wait until either there is a new task, or a long-running task
+            // has finished, or until the time of the task, and look again:
+            // another thread may have serviced the task in the meantime.
+            if (it->first > boost::chrono::system_clock::now()) {
+                // Some boost versions have a conflicting overload of wait_until that returns void.
+                // Explicitly use a template here to avoid hitting that overload.
+                auto copy = it->first;
+                newTaskScheduled.wait_until<>(lock, copy);
                 continue;
+            }
 
-            Function f = taskQueue.begin()->second;
-            taskQueue.erase(taskQueue.begin());
+            Task task = it->second;
+            taskQueue.erase(it);
+            if (task.fLongRunning) {
+                fRunningLong = true;
+                ++nLongTasksRunning;
+            }
 
             {
                 // Unlock before calling f, so it can reschedule itself or another task
                 // without deadlocking:
                 reverse_lock<boost::unique_lock<boost::mutex> > rlock(lock);
-                f();
+                task.f();
+            }
+
+            if (fRunningLong) {
+                --nLongTasksRunning;
+                // Another long-running task may now be started.
+                newTaskScheduled.notify_all();
             }
         } catch (...) {
+            if (fRunningLong) {
+                --nLongTasksRunning;
+            }
             --nThreadsServicingQueue;
             throw;
         }
@@ -85,29 +107,29 @@ void CScheduler::stop(bool drain)
     newTaskScheduled.notify_all();
 }
 
-void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t)
+void CScheduler::schedule(CScheduler::Function f, boost::chrono::system_clock::time_point t, bool fLongRunning)
 {
     {
         boost::unique_lock<boost::mutex> lock(newTaskMutex);
-        taskQueue.insert(std::make_pair(t, f));
+        taskQueue.insert(std::make_pair(t, Task{f, fLongRunning}));
     }
     newTaskScheduled.notify_one();
 }
 
-void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleFromNow(CScheduler::Function f, int64_t deltaSeconds, bool fLongRunning)
 {
-    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds));
+    schedule(f, boost::chrono::system_clock::now() + boost::chrono::seconds(deltaSeconds), fLongRunning);
 }
 
-static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds)
+static void Repeat(CScheduler* s, CScheduler::Function f, int64_t deltaSeconds, bool fLongRunning)
 {
     f();
-    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds), deltaSeconds);
+    s->scheduleFromNow(boost::bind(&Repeat, s, f, deltaSeconds, fLongRunning), deltaSeconds, fLongRunning);
 }
 
-void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds)
+void CScheduler::scheduleEvery(CScheduler::Function f, int64_t deltaSeconds, bool fLongRunning)
 {
-    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds), deltaSeconds);
+    scheduleFromNow(boost::bind(&Repeat, this, f, deltaSeconds, fLongRunning), deltaSeconds, fLongRunning);
 }
 
 size_t CScheduler::getQueueInfo(boost::chrono::system_clock::time_point &first,
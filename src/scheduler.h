@@ -26,6 +26,11 @@
 // s->scheduleFromNow(boost::bind(Class::func, this, argument), 3);
 // boost::thread* t = new boost::thread(boost::bind(CScheduler::serviceQueue, s));
 //
+// Any number of threads may service the queue. A task that may take a while
+// (such as writing a large file) should be scheduled as long-running: while
+// one is running, the other threads do not start another, so that with two
+// or more threads the short tasks are not held up behind it.
+//
 // ... then at program shutdown, clean up the thread running serviceQueue:
 // t->interrupt();
 // t->join();
@@ -42,17 +47,17 @@ public:
     typedef std::function<void(void)> Function;
 
     // Call func at/after time t
-    void schedule(Function f, boost::chrono::system_clock::time_point t);
+    void schedule(Function f, boost::chrono::system_clock::time_point t, bool fLongRunning = false);
 
     // Convenience method: call f once deltaSeconds from now
-    void scheduleFromNow(Function f, int64_t deltaSeconds);
+    void scheduleFromNow(Function f, int64_t deltaSeconds, bool fLongRunning = false);
 
     // Another convenience method: call f approximately
     // every deltaSeconds forever, starting deltaSeconds from now.
     // To be more precise: every time f is finished, it
     // is rescheduled to run deltaSeconds later. If you
     // need more accurate scheduling, don't use this method.
-    void scheduleEvery(Function f, int64_t deltaSeconds);
+    void scheduleEvery(Function f, int64_t deltaSeconds, bool fLongRunning = false);
 
     // To keep things as simple as possible, there is no unschedule.
 
@@ -71,13 +76,25 @@ public:
                         boost::chrono::system_clock::time_point &last) const;
 
 private:
-    std::multimap<boost::chrono::system_clock::time_point, Function> taskQueue;
+    struct Task {
+        Function f;
+        bool fLongRunning;
+    };
+    typedef std::multimap<boost::chrono::system_clock::time_point, Task> TaskQueue;
+
+    TaskQueue taskQueue;
     boost::condition_variable newTaskScheduled;
     mutable boost::mutex newTaskMutex;
     int nThreadsServicingQueue;
+    // Number of long-running tasks being run
+    int nLongTasksRunning;
     bool stopRequested;
     bool stopWhenEmpty;
     bool shouldStop() { return stopRequested || (stopWhenEmpty && taskQueue.empty()); }
+    // The earliest task that the calling thread may start: a long-running
+    // task only if it leaves a thread free for the other tasks, or none is
+    // running yet.
+    TaskQueue::iterator nextRunnableTask();
 };
 
 #endif
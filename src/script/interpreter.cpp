@@ -19,6 +19,8 @@
 #include <rust/constants.h>
 #include <rust/transaction.h>
 
+#include <optional>
+
 using namespace std;
 
 typedef vector<unsigned char> valtype;
@@ -1449,6 +1451,52 @@ bool TransactionSignatureChecker::CheckLockTime(const CScriptNum& nLockTime) con
 }
 
 
+/**
+ * Verify a pay-to-pubkey-hash spend whose scriptSig is just a push of a
+ * signature and a push of a public key, without running the interpreter.
+ *
+ * Returns true or false where VerifyScript would succeed, or fail with
+ * SCRIPT_ERR_EVAL_FALSE because the signature does not verify (as OP_CHECKSIG
+ * then leaves false on the stack). Returns nullopt for every other spend,
+ * including every other way of failing, which are left to the interpreter so
+ * that it reports the same error it always has.
+ */
+static std::optional<bool> VerifyPayToPubKeyHash(
+    const CScript& scriptSig,
+    const CScript& scriptPubKey,
+    unsigned int flags,
+    const BaseSignatureChecker& checker,
+    uint32_t consensusBranchId)
+{
+    if (!scriptPubKey.IsPayToPublicKeyHash() || scriptSig.size() > MAX_SCRIPT_SIZE)
+        return std::nullopt;
+
+    // The pushes of the scriptSig, as EvalScript makes them.
+    CScript::const_iterator pc = scriptSig.begin();
+    opcodetype opSig, opPubKey;
+    valtype vchSig, vchPubKey;
+    if (!scriptSig.GetOp(pc, opSig, vchSig) || !scriptSig.GetOp(pc, opPubKey, vchPubKey) || pc != scriptSig.end())
+        return std::nullopt;
+    if (opSig > OP_PUSHDATA4 || opPubKey > OP_PUSHDATA4)
+        return std::nullopt;
+    if (vchSig.size() > MAX_SCRIPT_ELEMENT_SIZE || vchPubKey.size() > MAX_SCRIPT_ELEMENT_SIZE)
+        return std::nullopt;
+    if ((flags & SCRIPT_VERIFY_MINIMALDATA) != 0 &&
+        (!CheckMinimalPush(vchSig, opSig) || !CheckMinimalPush(vchPubKey, opPubKey)))
+        return std::nullopt;
+
+    // OP_DUP OP_HASH160 <hash> OP_EQUALVERIFY
+    valtype vchHash(20);
+    CHash160().Write(begin_ptr(vchPubKey), vchPubKey.size()).Finalize(begin_ptr(vchHash));
+    if (!std::equal(vchHash.begin(), vchHash.end(), scriptPubKey.begin() + 3))
+        return std::nullopt;
+
+    // OP_CHECKSIG, leaving its result alone on the stack.
+    if (!CheckSignatureEncoding(vchSig, flags, NULL) || !CheckPubKeyEncoding(vchPubKey, flags, NULL))
+        return std::nullopt;
+    return checker.CheckSig(vchSig, vchPubKey, scriptPubKey, consensusBranchId);
+}
+
 bool VerifyScript(
     const CScript& scriptSig,
     const CScript& scriptPubKey,
@@ -1456,6 +1504,27 @@ bool VerifyScript(
     const BaseSignatureChecker& checker,
     uint32_t consensusBranchId,
     ScriptError* serror)
+{
+    if ((flags & SCRIPT_VERIFY_SIGPUSHONLY) != 0 && !scriptSig.IsPushOnly()) {
+        return set_error(serror, SCRIPT_ERR_SIG_PUSHONLY);
+    }
+
+    // Most transparent inputs spend pay-to-pubkey-hash outputs.
+    std::optional<bool> fVerified = VerifyPayToPubKeyHash(scriptSig, scriptPubKey, flags, checker, consensusBranchId);
+    if (fVerified.has_value()) {
+        return *fVerified ? set_success(serror) : set_error(serror, SCRIPT_ERR_EVAL_FALSE);
+    }
+
+    return VerifyScriptInterpreted(scriptSig, scriptPubKey, flags, checker, consensusBranchId, serror);
+}
+
+bool VerifyScriptInterpreted(
+    const CScript& scriptSig,
+    const CScript& scriptPubKey,
+    unsigned int flags,
+    const BaseSignatureChecker& checker,
+    uint32_t consensusBranchId,
+    ScriptError* serror)
 {
     set_error(serror, SCRIPT_ERR_UNKNOWN_ERROR);
 
@@ -193,4 +193,17 @@ bool VerifyScript(
     uint32_t consensusBranchId,
     ScriptError* serror = NULL);
 
+/**
+ * VerifyScript without its fast path for pay-to-pubkey-hash spends, which
+ * runs every script through EvalScript. The two always agree; this is for
+ * checking that they do.
+ */
+bool VerifyScriptInterpreted(
+    const CScript& scriptSig,
+    const CScript& scriptPubKey,
+    unsigned int flags,
+    const BaseSignatureChecker& checker,
+    uint32_t consensusBranchId,
+    ScriptError* serror = NULL);
+
 #endif // BITCOIN_SCRIPT_INTERPRETER_H
@@ -6,26 +6,38 @@
 
 #include "sigcache.h"
 
-#include "memusage.h"
+#include "cuckoocache.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util/system.h"
 
+#include <rust/metrics.h>
+
+#include <cstring>
+
 #include <boost/thread.hpp>
-#include <boost/unordered_set.hpp>
 
 namespace {
 
 /**
  * We're hashing a nonce into the entries themselves, so we don't need extra
  * blinding in the set hash computation.
+ *
+ * This may exhibit platform endian dependent behavior but because these are
+ * nonced hashes (random) and this state is only ever used locally it is safe.
+ * All that matters is local consistency.
  */
-class CSignatureCacheHasher
+class SignatureCacheHasher
 {
 public:
-    size_t operator()(const uint256& key) const {
-        return key.GetCheapHash();
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        static_assert(hash_select < 8, "SignatureCacheHasher only has 8 hashes available.");
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
     }
 };
 
@@ -33,21 +45,28 @@ public:
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
  * twice for every transaction (once when accepted into memory pool, and
  * again when accepted into the block chain)
+ *
+ * Lookups, including those that erase the entry they find when a block is
+ * connected, only take the lock shared; only insertions take it exclusively.
  */
 class CSignatureCache
 {
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
+    typedef CuckooCache::cache<uint256, SignatureCacheHasher> map_type;
     map_type setValid;
+    //! Whether -maxsigcachesize left room for any entries.
+    bool fEnabled;
     boost::shared_mutex cs_sigcache;
 
-
 public:
     CSignatureCache()
     {
         GetRandBytes(nonce.begin(), 32);
+        int64_t nMaxCacheSize = std::max((int64_t)0, GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE));
+        fEnabled = nMaxCacheSize > 0;
+        setValid.setup_bytes(std::min(nMaxCacheSize, (int64_t)MAX_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20));
     }
 
     void
@@ -56,53 +75,67 @@ public:
         CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
     }
 
+    /**
+     * Returns whether the entry is in the cache, marking it for eviction if
+     * erase is true.
+     */
     bool
-    Get(const uint256& entry)
+    Get(const uint256& entry, const bool erase)
     {
         boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
-    }
-
-    void Erase(const uint256& entry)
-    {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
+        return setValid.contains(entry, erase);
     }
 
     void Set(const uint256& entry)
     {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-        if (nMaxCacheSize <= 0) return;
+        if (!fEnabled) return;
 
         boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
-        {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
-            }
-        }
-
         setValid.insert(entry);
     }
+
+    size_t DynamicMemoryUsage()
+    {
+        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
+        return setValid.memory_usage();
+    }
 };
 
+CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache;
+    return signatureCache;
+}
+
+}
+
+size_t SignatureCacheDynamicMemoryUsage()
+{
+    return GetSignatureCache().DynamicMemoryUsage();
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
 
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(entry)) {
-        if (!store) {
-            signatureCache.Erase(entry);
+    // Signatures are stored when transactions are accepted to the mempool,
+    // and consumed when blocks containing them are connected.
+    if (signatureCache.Get(entry, !store)) {
+        if (store) {
+            MetricsIncrementCounter("zcash.sigcache.mempool.hits");
+        } else {
+            MetricsIncrementCounter("zcash.sigcache.block.hits");
         }
         return true;
     }
+    if (store) {
+        MetricsIncrementCounter("zcash.sigcache.mempool.misses");
+    } else {
+        MetricsIncrementCounter("zcash.sigcache.block.misses");
+    }
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
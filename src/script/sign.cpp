@@ -12,7 +12,12 @@
 #include "primitives/transaction.h"
 #include "script/standard.h"
 #include "uint256.h"
+#include "util/system.h"
 
+#include <algorithm>
+#include <atomic>
+#include <set>
+#include <thread>
 
 using namespace std;
 
@@ -155,6 +160,103 @@ bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& fromPu
     return solved && VerifyScript(sigdata.scriptSig, fromPubKey, STANDARD_SCRIPT_VERIFY_FLAGS, creator.Checker(), consensusBranchId);
 }
 
+/**
+ * Copy the keys and scripts that scriptPubKey could be signed with from
+ * keystore to signingKeys, looking each up only once.
+ */
+static void CopySigningKeys(
+    const CKeyStore& keystore,
+    const CScript& scriptPubKey,
+    CBasicKeyStore& signingKeys,
+    std::set<CKeyID>& setKeyIDs,
+    std::set<CScriptID>& setScriptIDs)
+{
+    std::vector<valtype> vSolutions;
+    txnouttype whichType;
+    if (!Solver(scriptPubKey, whichType, vSolutions)) {
+        return;
+    }
+    std::vector<CKeyID> vKeyIDs;
+    switch (whichType) {
+    case TX_PUBKEY:
+        vKeyIDs.push_back(CPubKey(vSolutions[0]).GetID());
+        break;
+    case TX_PUBKEYHASH:
+        vKeyIDs.push_back(CKeyID(uint160(vSolutions[0])));
+        break;
+    case TX_SCRIPTHASH: {
+        CScriptID scriptID = CScriptID(uint160(vSolutions[0]));
+        CScript redeemScript;
+        if (setScriptIDs.insert(scriptID).second && keystore.GetCScript(scriptID, redeemScript)) {
+            signingKeys.AddCScript(redeemScript);
+            CopySigningKeys(keystore, redeemScript, signingKeys, setKeyIDs, setScriptIDs);
+        }
+        break;
+    }
+    case TX_MULTISIG:
+        for (size_t i = 1; i + 1 < vSolutions.size(); i++) {
+            vKeyIDs.push_back(CPubKey(vSolutions[i]).GetID());
+        }
+        break;
+    default:
+        break;
+    }
+    for (const CKeyID& keyID : vKeyIDs) {
+        CKey key;
+        if (setKeyIDs.insert(keyID).second && keystore.GetKey(keyID, key)) {
+            signingKeys.AddKeyPubKey(key, key.GetPubKey());
+        }
+    }
+}
+
+bool ProduceSignatures(
+    const CKeyStore& keystore,
+    const CTransaction& txTo,
+    const PrecomputedTransactionData& txToData,
+    const std::vector<CTxOut>& vPrevOutputs,
+    int nHashType,
+    uint32_t consensusBranchId,
+    std::vector<SignatureData>& vSigData)
+{
+    assert(vPrevOutputs.size() == txTo.vin.size());
+
+    // The wallet decrypts a key on each lookup, so the keys are looked up
+    // here, once each, and the signing threads use the copies.
+    CBasicKeyStore signingKeys;
+    std::set<CKeyID> setKeyIDs;
+    std::set<CScriptID> setScriptIDs;
+    std::set<CScript> setScriptPubKeys;
+    for (const CTxOut& prevOutput : vPrevOutputs) {
+        if (setScriptPubKeys.insert(prevOutput.scriptPubKey).second) {
+            CopySigningKeys(keystore, prevOutput.scriptPubKey, signingKeys, setKeyIDs, setScriptIDs);
+        }
+    }
+
+    vSigData.assign(txTo.vin.size(), SignatureData());
+    std::atomic<size_t> nNext{0};
+    std::atomic<bool> fFailed{false};
+    auto sign = [&]() {
+        for (size_t nIn = nNext++; nIn < txTo.vin.size() && !fFailed; nIn = nNext++) {
+            if (!ProduceSignature(
+                    TransactionSignatureCreator(&signingKeys, &txTo, txToData, nIn, vPrevOutputs[nIn].nValue, nHashType),
+                    vPrevOutputs[nIn].scriptPubKey, vSigData[nIn], consensusBranchId)) {
+                fFailed = true;
+            }
+        }
+    };
+    // A thread is only worth starting for a few inputs.
+    size_t nThreads = std::min(txTo.vin.size() / 4, (size_t)std::max(1, GetNumCores()));
+    std::vector<std::thread> vThreads;
+    for (size_t i = 1; i < nThreads; i++) {
+        vThreads.emplace_back(sign);
+    }
+    sign();
+    for (std::thread& thread : vThreads) {
+        thread.join();
+    }
+    return !fFailed;
+}
+
 SignatureData DataFromTransaction(const CMutableTransaction& tx, unsigned int nIn)
 {
     SignatureData data;
@@ -13,6 +13,7 @@ class CKeyID;
 class CKeyStore;
 class CScript;
 class CTransaction;
+class CTxOut;
 
 struct CMutableTransaction;
 
@@ -71,6 +72,22 @@ struct SignatureData {
 /** Produce a script signature using a generic signature creator. */
 bool ProduceSignature(const BaseSignatureCreator& creator, const CScript& scriptPubKey, SignatureData& sigdata, uint32_t consensusBranchId);
 
+/**
+ * Produce the script signatures of all the inputs of txTo, which spend
+ * vPrevOutputs, spreading the inputs across threads. txToData is shared by
+ * all of them, and each key or script is looked up in keystore once, before
+ * the signing starts. vSigData is set to the signature of each input, and
+ * false is returned if any of them could not be produced.
+ */
+bool ProduceSignatures(
+    const CKeyStore& keystore,
+    const CTransaction& txTo,
+    const PrecomputedTransactionData& txToData,
+    const std::vector<CTxOut>& vPrevOutputs,
+    int nHashType,
+    uint32_t consensusBranchId,
+    std::vector<SignatureData>& vSigData);
+
 /** Produce a script signature for a transaction. */
 bool SignSignature(
     const CKeyStore &keystore,
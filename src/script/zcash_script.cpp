@@ -91,11 +91,19 @@ unsigned int GetLegacySigOpCount(const CTransaction& tx)
 struct PrecomputedTransaction {
     const CTransaction tx;
     const PrecomputedTransactionData txdata;
+    /** The outputs spent by tx, if it was created with allPrevOutputs. */
+    std::vector<CTxOut> prevOutputs;
 
     PrecomputedTransaction(
         CTransaction txIn,
         const unsigned char* allPrevOutputs,
-        size_t allPrevOutputsLen) : tx(txIn), txdata(txIn, allPrevOutputs, allPrevOutputsLen) {}
+        size_t allPrevOutputsLen) : tx(txIn), txdata(txIn, allPrevOutputs, allPrevOutputsLen)
+    {
+        if (allPrevOutputs != nullptr) {
+            TxInputStream stream(SER_NETWORK, PROTOCOL_VERSION, allPrevOutputs, allPrevOutputsLen);
+            stream >> prevOutputs;
+        }
+    }
 };
 
 void* zcash_script_new_precomputed_tx(
@@ -193,6 +201,40 @@ int zcash_script_verify_precomputed(
         NULL);
 }
 
+int zcash_script_verify_all_precomputed(
+    const void* pre_preTx,
+    unsigned int flags,
+    uint32_t consensusBranchId,
+    unsigned int* nInFailed,
+    zcash_script_error* err)
+{
+    const PrecomputedTransaction* preTx = static_cast<const PrecomputedTransaction*>(pre_preTx);
+    const std::vector<CTxOut>& prevOutputs = preTx->prevOutputs;
+    if (!(preTx->tx.IsCoinBase() ? prevOutputs.empty() : preTx->tx.vin.size() == prevOutputs.size()))
+        return set_error(err, zcash_script_ERR_ALL_PREV_OUTPUTS_SIZE_MISMATCH);
+
+    try {
+        // Regardless of the verification result, the tx did not error.
+        set_error(err, zcash_script_ERR_OK);
+        for (unsigned int nIn = 0; nIn < prevOutputs.size(); nIn++) {
+            if (!VerifyScript(
+                    preTx->tx.vin[nIn].scriptSig,
+                    prevOutputs[nIn].scriptPubKey,
+                    flags,
+                    TransactionSignatureChecker(&preTx->tx, preTx->txdata, nIn, prevOutputs[nIn].nValue),
+                    consensusBranchId,
+                    NULL)) {
+                if (nInFailed)
+                    *nInFailed = nIn;
+                return 0;
+            }
+        }
+        return 1;
+    } catch (const std::exception&) {
+        return set_error(err, zcash_script_ERR_VERIFY_SCRIPT); // Error during script verification
+    }
+}
+
 int zcash_script_verify(
     const unsigned char *scriptPubKey, unsigned int scriptPubKeyLen,
     int64_t amount,
@@ -34,7 +34,7 @@
 extern "C" {
 #endif
 
-#define ZCASH_SCRIPT_API_VER 3
+#define ZCASH_SCRIPT_API_VER 4
 
 typedef enum zcash_script_error_t
 {
@@ -116,6 +116,32 @@ EXPORT_SYMBOL int zcash_script_verify_precomputed(
     uint32_t consensusBranchId,
     zcash_script_error* err);
 
+/// Returns 1 if every input of the precomputed transaction pointed to by
+/// preTx correctly spends the matching output in the allPrevOutputs it was
+/// created with, under the additional constraints specified by flags.
+///
+/// preTx must have been created with zcash_script_new_precomputed_tx_v5.
+/// The transaction is deserialized and its signature hash data computed once
+/// for all of its inputs, rather than once per input as with
+/// zcash_script_verify_v5. The precomputed transaction is not modified, so
+/// callers wanting to verify inputs in parallel may instead call
+/// zcash_script_verify_precomputed for different inputs of the same preTx
+/// from multiple threads.
+///
+/// If not NULL, nInFailed will be set to the index of the first input that
+/// failed verification, if any.
+/// If not NULL, err will contain an error/success code for the operation.
+/// Note that script verification failure is indicated by err being set to
+/// zcash_script_ERR_OK and a return value of 0.
+///
+/// Defined since API version 4.
+EXPORT_SYMBOL int zcash_script_verify_all_precomputed(
+    const void* preTx,
+    unsigned int flags,
+    uint32_t consensusBranchId,
+    unsigned int* nInFailed,
+    zcash_script_error* err);
+
 /// Returns 1 if the input nIn of the serialized transaction pointed to by
 /// txTo correctly spends the scriptPubKey pointed to by scriptPubKey under
 /// the additional constraints specified by flags.
@@ -0,0 +1,308 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "socketevents.h"
+
+#include "netbase.h"
+#include "tinyformat.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <map>
+#include <set>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+#ifdef HAVE_SYS_EVENT_H
+#include <sys/event.h>
+#include <sys/time.h>
+#endif
+#ifndef WIN32
+#include <sys/select.h>
+#endif
+
+std::string GetSocketEventsModeName(SocketEventsMode mode)
+{
+    switch (mode) {
+        case SocketEventsMode::SELECT: return "select";
+        case SocketEventsMode::EPOLL: return "epoll";
+        case SocketEventsMode::KQUEUE: return "kqueue";
+    }
+    assert(false);
+}
+
+bool ParseSocketEventsMode(const std::string& str, SocketEventsMode& mode)
+{
+    if (str == "select") {
+        mode = SocketEventsMode::SELECT;
+#ifdef HAVE_SYS_EPOLL_H
+    } else if (str == "epoll") {
+        mode = SocketEventsMode::EPOLL;
+#endif
+#ifdef HAVE_SYS_EVENT_H
+    } else if (str == "kqueue") {
+        mode = SocketEventsMode::KQUEUE;
+#endif
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string GetSupportedSocketEventsModes()
+{
+    std::string strModes;
+#ifdef HAVE_SYS_EPOLL_H
+    strModes += "epoll, ";
+#endif
+#ifdef HAVE_SYS_EVENT_H
+    strModes += "kqueue, ";
+#endif
+    return strModes + "select";
+}
+
+SocketEventsMode GetDefaultSocketEventsMode()
+{
+#if defined(HAVE_SYS_EPOLL_H)
+    return SocketEventsMode::EPOLL;
+#elif defined(HAVE_SYS_EVENT_H)
+    return SocketEventsMode::KQUEUE;
+#else
+    return SocketEventsMode::SELECT;
+#endif
+}
+
+bool IsUsableSocket(SOCKET s, SocketEventsMode mode)
+{
+    return mode != SocketEventsMode::SELECT || IsSelectableSocket(s);
+}
+
+class CSelectSocketEvents : public CSocketEvents
+{
+private:
+    std::set<SOCKET> setListen;
+    std::map<SOCKET, uint8_t> mapInterest;
+
+public:
+    SocketEventsMode GetMode() const override { return SocketEventsMode::SELECT; }
+
+    bool Add(SOCKET s, bool fListen) override
+    {
+        if (!IsSelectableSocket(s))
+            return false;
+        if (fListen) {
+            setListen.insert(s);
+        } else {
+            mapInterest[s] = 0;
+        }
+        return true;
+    }
+
+    void Remove(SOCKET s) override
+    {
+        setListen.erase(s);
+        mapInterest.erase(s);
+    }
+
+    void SetInterest(SOCKET s, uint8_t nEvents) override
+    {
+        auto it = mapInterest.find(s);
+        if (it != mapInterest.end())
+            it->second = nEvents;
+    }
+
+    bool Wait(int64_t nTimeoutMs, std::vector<std::pair<SOCKET, uint8_t>>& vReady) override
+    {
+        struct timeval timeout = MillisToTimeval(nTimeoutMs);
+
+        fd_set fdsetRecv;
+        fd_set fdsetSend;
+        fd_set fdsetError;
+        FD_ZERO(&fdsetRecv);
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        SOCKET hSocketMax = 0;
+        bool have_fds = false;
+
+        for (SOCKET s : setListen) {
+            FD_SET(s, &fdsetRecv);
+            hSocketMax = std::max(hSocketMax, s);
+            have_fds = true;
+        }
+        for (const auto& interest : mapInterest) {
+            FD_SET(interest.first, &fdsetError);
+            if (interest.second & SOCKET_EVENT_RECV)
+                FD_SET(interest.first, &fdsetRecv);
+            if (interest.second & SOCKET_EVENT_SEND)
+                FD_SET(interest.first, &fdsetSend);
+            hSocketMax = std::max(hSocketMax, interest.first);
+            have_fds = true;
+        }
+
+        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        if (nSelect == SOCKET_ERROR)
+            return false;
+
+        for (SOCKET s : setListen) {
+            if (FD_ISSET(s, &fdsetRecv))
+                vReady.emplace_back(s, SOCKET_EVENT_RECV);
+        }
+        for (const auto& interest : mapInterest) {
+            uint8_t nEvents = 0;
+            if (FD_ISSET(interest.first, &fdsetRecv))
+                nEvents |= SOCKET_EVENT_RECV;
+            if (FD_ISSET(interest.first, &fdsetSend))
+                nEvents |= SOCKET_EVENT_SEND;
+            if (FD_ISSET(interest.first, &fdsetError))
+                nEvents |= SOCKET_EVENT_ERR;
+            if (nEvents)
+                vReady.emplace_back(interest.first, nEvents);
+        }
+        return true;
+    }
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+class CEpollSocketEvents : public CSocketEvents
+{
+private:
+    int fdEpoll;
+    std::vector<struct epoll_event> vEvents;
+
+public:
+    explicit CEpollSocketEvents(int fdEpollIn) : fdEpoll(fdEpollIn), vEvents(256) {}
+    ~CEpollSocketEvents() { close(fdEpoll); }
+
+    SocketEventsMode GetMode() const override { return SocketEventsMode::EPOLL; }
+
+    bool Add(SOCKET s, bool fListen) override
+    {
+        struct epoll_event event = {};
+        event.events = fListen ? EPOLLIN : (EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET);
+        event.data.fd = s;
+        return epoll_ctl(fdEpoll, EPOLL_CTL_ADD, s, &event) == 0;
+    }
+
+    void Remove(SOCKET s) override
+    {
+        // The event argument is ignored, but must not be null before Linux 2.6.9.
+        struct epoll_event event = {};
+        epoll_ctl(fdEpoll, EPOLL_CTL_DEL, s, &event);
+    }
+
+    bool Wait(int64_t nTimeoutMs, std::vector<std::pair<SOCKET, uint8_t>>& vReady) override
+    {
+        int nReady = epoll_wait(fdEpoll, vEvents.data(), vEvents.size(), nTimeoutMs);
+        if (nReady < 0)
+            return errno == EINTR;
+
+        for (int i = 0; i < nReady; i++) {
+            uint8_t nEvents = 0;
+            if (vEvents[i].events & EPOLLIN)
+                nEvents |= SOCKET_EVENT_RECV;
+            if (vEvents[i].events & EPOLLOUT)
+                nEvents |= SOCKET_EVENT_SEND;
+            if (vEvents[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+                nEvents |= SOCKET_EVENT_ERR;
+            vReady.emplace_back((SOCKET)vEvents[i].data.fd, nEvents);
+        }
+        return true;
+    }
+};
+#endif // HAVE_SYS_EPOLL_H
+
+#ifdef HAVE_SYS_EVENT_H
+class CKqueueSocketEvents : public CSocketEvents
+{
+private:
+    int fdKqueue;
+    std::vector<struct kevent> vEvents;
+
+public:
+    explicit CKqueueSocketEvents(int fdKqueueIn) : fdKqueue(fdKqueueIn), vEvents(256) {}
+    ~CKqueueSocketEvents() { close(fdKqueue); }
+
+    SocketEventsMode GetMode() const override { return SocketEventsMode::KQUEUE; }
+
+    bool Add(SOCKET s, bool fListen) override
+    {
+        struct kevent changes[2];
+        EV_SET(&changes[0], s, EVFILT_READ, EV_ADD | (fListen ? 0 : EV_CLEAR), 0, 0, nullptr);
+        EV_SET(&changes[1], s, EVFILT_WRITE, EV_ADD | EV_CLEAR, 0, 0, nullptr);
+        return kevent(fdKqueue, changes, fListen ? 1 : 2, nullptr, 0, nullptr) == 0;
+    }
+
+    void Remove(SOCKET s) override
+    {
+        // Listening sockets have no write filter, so delete the filters one
+        // at a time and ignore the errors.
+        struct kevent change;
+        EV_SET(&change, s, EVFILT_READ, EV_DELETE, 0, 0, nullptr);
+        kevent(fdKqueue, &change, 1, nullptr, 0, nullptr);
+        EV_SET(&change, s, EVFILT_WRITE, EV_DELETE, 0, 0, nullptr);
+        kevent(fdKqueue, &change, 1, nullptr, 0, nullptr);
+    }
+
+    bool Wait(int64_t nTimeoutMs, std::vector<std::pair<SOCKET, uint8_t>>& vReady) override
+    {
+        struct timespec timeout;
+        timeout.tv_sec = nTimeoutMs / 1000;
+        timeout.tv_nsec = (nTimeoutMs % 1000) * 1000000;
+        int nReady = kevent(fdKqueue, nullptr, 0, vEvents.data(), vEvents.size(), &timeout);
+        if (nReady < 0)
+            return errno == EINTR;
+
+        // Each filter is reported separately; the caller merges the events
+        // of a socket.
+        for (int i = 0; i < nReady; i++) {
+            uint8_t nEvents = 0;
+            if (vEvents[i].filter == EVFILT_READ)
+                nEvents |= SOCKET_EVENT_RECV;
+            if (vEvents[i].filter == EVFILT_WRITE)
+                nEvents |= SOCKET_EVENT_SEND;
+            if (vEvents[i].flags & (EV_EOF | EV_ERROR))
+                nEvents |= SOCKET_EVENT_ERR;
+            vReady.emplace_back((SOCKET)vEvents[i].ident, nEvents);
+        }
+        return true;
+    }
+};
+#endif // HAVE_SYS_EVENT_H
+
+std::unique_ptr<CSocketEvents> CSocketEvents::Create(SocketEventsMode mode, std::string& strError)
+{
+    switch (mode) {
+        case SocketEventsMode::SELECT:
+            return std::unique_ptr<CSocketEvents>(new CSelectSocketEvents());
+        case SocketEventsMode::EPOLL: {
+#ifdef HAVE_SYS_EPOLL_H
+            int fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+            if (fdEpoll >= 0)
+                return std::unique_ptr<CSocketEvents>(new CEpollSocketEvents(fdEpoll));
+            strError = strprintf("epoll_create1 failed: %s", NetworkErrorString(errno));
+#else
+            strError = "epoll is not supported on this platform";
+#endif
+            return nullptr;
+        }
+        case SocketEventsMode::KQUEUE: {
+#ifdef HAVE_SYS_EVENT_H
+            int fdKqueue = kqueue();
+            if (fdKqueue >= 0)
+                return std::unique_ptr<CSocketEvents>(new CKqueueSocketEvents(fdKqueue));
+            strError = strprintf("kqueue failed: %s", NetworkErrorString(errno));
+#else
+            strError = "kqueue is not supported on this platform";
+#endif
+            return nullptr;
+        }
+    }
+    assert(false);
+}
@@ -0,0 +1,80 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_SOCKETEVENTS_H
+#define ZCASH_SOCKETEVENTS_H
+
+#include "compat.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/** What a socket is ready for, as reported by CSocketEvents::Wait. */
+enum SocketEvent : uint8_t {
+    SOCKET_EVENT_RECV = 1,
+    SOCKET_EVENT_SEND = 2,
+    SOCKET_EVENT_ERR = 4,
+};
+
+/** The ways of waiting for peer sockets that can be chosen with -socketevents. */
+enum class SocketEventsMode {
+    SELECT,
+    EPOLL,
+    KQUEUE,
+};
+
+std::string GetSocketEventsModeName(SocketEventsMode mode);
+bool ParseSocketEventsMode(const std::string& str, SocketEventsMode& mode);
+/** The modes available on this platform, best first, as a comma-separated list. */
+std::string GetSupportedSocketEventsModes();
+/** The best mode available on this platform. */
+SocketEventsMode GetDefaultSocketEventsMode();
+/** Whether a socket can be waited for in the given mode (select() is limited to FD_SETSIZE). */
+bool IsUsableSocket(SOCKET s, SocketEventsMode mode);
+
+/**
+ * Waits until any of a set of sockets is ready for I/O.
+ *
+ * The select() backend is level triggered: on each Wait it is told what to
+ * wait for on every connected socket (see SetInterest), and reports a socket
+ * for as long as it is ready. Wait costs a pass over all the sockets, and
+ * they must be below FD_SETSIZE.
+ *
+ * The epoll and kqueue backends register a socket with the kernel once, and
+ * are edge triggered for connected sockets: a socket is only reported when it
+ * becomes ready to receive or send, so the caller has to remember that it is
+ * ready until a recv or send on it would block. Wait only costs as much as
+ * the number of sockets that are ready. Listening sockets are always
+ * reported for as long as they have a connection to accept.
+ *
+ * Sockets must be removed before they are closed, or, when a socket was
+ * closed by another thread, before its descriptor is added again.
+ */
+class CSocketEvents
+{
+public:
+    virtual ~CSocketEvents() {}
+
+    virtual SocketEventsMode GetMode() const = 0;
+    bool IsEdgeTriggered() const { return GetMode() != SocketEventsMode::SELECT; }
+
+    //! Start waiting for a socket: for connections if fListen, otherwise to
+    //! receive and send.
+    virtual bool Add(SOCKET s, bool fListen) = 0;
+    virtual void Remove(SOCKET s) = 0;
+    //! What to wait for on a connected socket on the next Wait, as a mask of
+    //! SocketEvent. Only used by level-triggered backends.
+    virtual void SetInterest(SOCKET s, uint8_t nEvents) {}
+
+    //! Wait up to nTimeoutMs milliseconds for a socket to become ready, and
+    //! append the ready sockets to vReady. Returns false on error, with the
+    //! error in WSAGetLastError().
+    virtual bool Wait(int64_t nTimeoutMs, std::vector<std::pair<SOCKET, uint8_t>>& vReady) = 0;
+
+    static std::unique_ptr<CSocketEvents> Create(SocketEventsMode mode, std::string& strError);
+};
+
+#endif // ZCASH_SOCKETEVENTS_H
@@ -0,0 +1,93 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "startupprofile.h"
+
+#include "sync.h"
+#include "util/system.h"
+#include "util/time.h"
+
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+static const int64_t nProcessStartMillis = GetTimeMillis();
+
+static CCriticalSection cs_startupPhases;
+static std::vector<CStartupPhase> vStartupPhases GUARDED_BY(cs_startupPhases);
+static std::optional<int64_t> nStartupMillis GUARDED_BY(cs_startupPhases);
+
+CResourceUsage CResourceUsage::Now()
+{
+    CResourceUsage usage;
+#ifndef WIN32
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        usage.nUserMicros = ru.ru_utime.tv_sec * 1000000LL + ru.ru_utime.tv_usec;
+        usage.nSystemMicros = ru.ru_stime.tv_sec * 1000000LL + ru.ru_stime.tv_usec;
+        usage.nBlocksRead = ru.ru_inblock;
+        usage.nBlocksWritten = ru.ru_oublock;
+#ifdef MAC_OSX
+        usage.nMaxResidentKilobytes = ru.ru_maxrss / 1024;
+#else
+        usage.nMaxResidentKilobytes = ru.ru_maxrss;
+#endif
+    }
+#endif
+    return usage;
+}
+
+CStartupPhaseTimer::CStartupPhaseTimer(const std::string& strNameIn) :
+    strName(strNameIn), nStartMillis(GetTimeMillis()), usageStart(CResourceUsage::Now()), fStopped(false)
+{
+}
+
+CStartupPhaseTimer::~CStartupPhaseTimer()
+{
+    Stop();
+}
+
+void CStartupPhaseTimer::Stop()
+{
+    if (fStopped)
+        return;
+    fStopped = true;
+
+    CResourceUsage usageEnd = CResourceUsage::Now();
+    CStartupPhase phase;
+    phase.strName = strName;
+    phase.nStartMillis = nStartMillis - nProcessStartMillis;
+    phase.nDurationMillis = GetTimeMillis() - nStartMillis;
+    phase.usage.nUserMicros = usageEnd.nUserMicros - usageStart.nUserMicros;
+    phase.usage.nSystemMicros = usageEnd.nSystemMicros - usageStart.nSystemMicros;
+    phase.usage.nBlocksRead = usageEnd.nBlocksRead - usageStart.nBlocksRead;
+    phase.usage.nBlocksWritten = usageEnd.nBlocksWritten - usageStart.nBlocksWritten;
+    LogPrintf("Startup: %s took %dms (cpu: %dms user, %dms system; blocks: %d read, %d written)\n",
+        phase.strName, phase.nDurationMillis,
+        phase.usage.nUserMicros / 1000, phase.usage.nSystemMicros / 1000,
+        phase.usage.nBlocksRead, phase.usage.nBlocksWritten);
+
+    LOCK(cs_startupPhases);
+    vStartupPhases.push_back(phase);
+}
+
+std::vector<CStartupPhase> GetStartupPhases()
+{
+    LOCK(cs_startupPhases);
+    return vStartupPhases;
+}
+
+void SetStartupFinished()
+{
+    int64_t nMillis = GetTimeMillis() - nProcessStartMillis;
+    LogPrintf("Startup: finished in %dms\n", nMillis);
+    LOCK(cs_startupPhases);
+    nStartupMillis = nMillis;
+}
+
+std::optional<int64_t> GetStartupMillis()
+{
+    LOCK(cs_startupPhases);
+    return nStartupMillis;
+}
@@ -0,0 +1,65 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_STARTUPPROFILE_H
+#define ZCASH_STARTUPPROFILE_H
+
+#include <optional>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/** The CPU time and block I/O the process has used so far. */
+struct CResourceUsage {
+    int64_t nUserMicros = 0;
+    int64_t nSystemMicros = 0;
+    //! Reads and writes of the file systems that were not served by the cache.
+    int64_t nBlocksRead = 0;
+    int64_t nBlocksWritten = 0;
+    //! The largest the resident set of the process has been.
+    int64_t nMaxResidentKilobytes = 0;
+
+    static CResourceUsage Now();
+};
+
+/** A phase of startup, and the time and resources it took. */
+struct CStartupPhase {
+    std::string strName;
+    //! Since the process started.
+    int64_t nStartMillis;
+    int64_t nDurationMillis;
+    //! Of the whole process while the phase ran, including any phase that
+    //! ran at the same time as it.
+    CResourceUsage usage;
+};
+
+/**
+ * Records a phase of startup from its construction to Stop() or its
+ * destruction, and logs it.
+ */
+class CStartupPhaseTimer
+{
+private:
+    std::string strName;
+    int64_t nStartMillis;
+    CResourceUsage usageStart;
+    bool fStopped;
+
+public:
+    explicit CStartupPhaseTimer(const std::string& strNameIn);
+    ~CStartupPhaseTimer();
+
+    void Stop();
+};
+
+/** The phases of startup so far, in the order they finished. */
+std::vector<CStartupPhase> GetStartupPhases();
+
+/** Record that startup has finished, and log how long it took. */
+void SetStartupFinished();
+
+/** How long startup took, once it has finished. */
+std::optional<int64_t> GetStartupMillis();
+
+#endif // ZCASH_STARTUPPROFILE_H
@@ -20,6 +20,7 @@
 #include <stdio.h>
 #include <string>
 #include <string.h>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -68,6 +69,21 @@ public:
     }
 };
 
+/**
+ * Whether the bytes of a stream that have not been read yet are contiguous in
+ * memory at data(), with size() of them left, and ignore() skips over them.
+ * Rust code can parse such a stream in place from a slice, rather than making
+ * a RustStream callback for each read.
+ */
+template<typename Stream, typename = void>
+struct IsContiguousReadStream : std::false_type {};
+
+template<typename Stream>
+struct IsContiguousReadStream<Stream, std::void_t<
+    decltype(std::declval<const Stream&>().data()),
+    decltype(std::declval<const Stream&>().size()),
+    decltype(std::declval<Stream&>().ignore(0))>> : std::true_type {};
+
 template<typename Stream>
 class OverrideStream
 {
@@ -394,6 +410,18 @@ public:
         d.insert(d.end(), begin(), end());
         clear();
     }
+
+    /**
+     * Replace the contents of d with those of the stream without copying
+     * them, and continue with the buffer of d, emptied, so that its capacity
+     * is reused.
+     */
+    void SwapAndClear(vector_type& d) {
+        d.clear();
+        vch.swap(d);
+        d.erase(d.begin(), d.begin() + nReadPos);
+        nReadPos = 0;
+    }
 };
 
 class CDataStream : public CBaseDataStream<CSerializeData>
@@ -542,6 +570,106 @@ public:
     }
 };
 
+/** Minimal stream for reading from an existing range of bytes, such as a
+ *  memory-mapped file, without copying it into a buffer first.
+ *
+ *  The bytes must outlive the reader.
+ */
+class CSpanReader
+{
+private:
+    const int nType;
+    const int nVersion;
+
+    const char* pbegin;
+    const char* pend;
+
+public:
+    CSpanReader(int nTypeIn, int nVersionIn, const char* pbeginIn, const char* pendIn) :
+        nType(nTypeIn), nVersion(nVersionIn), pbegin(pbeginIn), pend(pendIn) {}
+
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+
+    /** The bytes that have not been read yet. */
+    const char* data() const     { return pbegin; }
+    size_t size() const          { return pend - pbegin; }
+    bool empty() const           { return pbegin == pend; }
+
+    void read(char* pch, size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::read: end of data");
+        memcpy(pch, pbegin, nSize);
+        pbegin += nSize;
+    }
+
+    void ignore(size_t nSize)
+    {
+        if (nSize > size())
+            throw std::ios_base::failure("CSpanReader::ignore: end of data");
+        pbegin += nSize;
+    }
+
+    template<typename T>
+    CSpanReader& operator>>(T&& obj)
+    {
+        // Unserialize from this stream
+        ::Unserialize(*this, obj);
+        return (*this);
+    }
+};
+
+/**
+ * Minimal stream that serializes by appending to a plain byte vector, which
+ * unlike the buffer of a CDataStream is not cleansed when it is freed.
+ */
+class CVectorWriter
+{
+private:
+    const int nType;
+    const int nVersion;
+
+    std::vector<unsigned char>& vch;
+
+public:
+    CVectorWriter(int nTypeIn, int nVersionIn, std::vector<unsigned char>& vchIn) :
+        nType(nTypeIn), nVersion(nVersionIn), vch(vchIn) {}
+
+    int GetType() const          { return nType; }
+    int GetVersion() const       { return nVersion; }
+
+    void write(const char* pch, size_t nSize)
+    {
+        vch.insert(vch.end(), (const unsigned char*)pch, (const unsigned char*)pch + nSize);
+    }
+
+    template<typename T>
+    CVectorWriter& operator<<(const T& obj)
+    {
+        // Serialize to this stream
+        ::Serialize(*this, obj);
+        return (*this);
+    }
+};
+
+/**
+ * Serialize obj into a byte vector in two passes: size it with
+ * GetSerializeSize, which is cheap for transactions and blocks since
+ * transactions cache their size, and then write it into a vector reserved to
+ * exactly that size, so that a large object is written without the vector
+ * growing and copying itself along the way.
+ */
+template<typename T>
+std::vector<unsigned char> SerializeToVector(const T& obj, int nType, int nVersion)
+{
+    std::vector<unsigned char> vch;
+    vch.reserve(GetSerializeSize(obj, nType, nVersion));
+    CVectorWriter writer(nType, nVersion, vch);
+    writer << obj;
+    return vch;
+}
+
 /** Non-refcounted RAII wrapper around a FILE* that implements a ring buffer to
  *  deserialize from. It guarantees the ability to rewind a given number of bytes.
  *
@@ -0,0 +1,63 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_SUBTREEINDEX_H
+#define ZCASH_SUBTREEINDEX_H
+
+#include "serialize.h"
+#include "uint256.h"
+
+/**
+ * Height of the subtrees of the note commitment trees whose roots are
+ * indexed: each subtree holds 2^16 note commitments, as in lightwalletd's
+ * GetSubtreeRoots.
+ */
+static const uint8_t SUBTREE_INDEX_HEIGHT = 16;
+
+/** The subtree with the given index (from 0) of a note commitment tree. */
+struct CSubtreeIndexKey {
+    //! A ShieldedType.
+    uint8_t pool;
+    uint32_t index;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 5;
+    }
+    // Big-endian, so that the subtrees of a pool are iterated in order.
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata8(s, pool);
+        ser_writedata32be(s, index);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        pool = ser_readdata8(s);
+        index = ser_readdata32be(s);
+    }
+
+    CSubtreeIndexKey(uint8_t poolIn, uint32_t indexIn) : pool(poolIn), index(indexIn) {}
+    CSubtreeIndexKey() : pool(0), index(0) {}
+};
+
+/** The root of a complete subtree, and the block that completed it. */
+struct CSubtreeIndexValue {
+    uint256 root;
+    uint256 blockHash;
+    int blockHeight;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(root);
+        READWRITE(blockHash);
+        READWRITE(blockHeight);
+    }
+
+    CSubtreeIndexValue(const uint256& rootIn, const uint256& hash, int height) :
+        root(rootIn), blockHash(hash), blockHeight(height) {}
+    CSubtreeIndexValue() : blockHeight(0) {}
+};
+
+#endif // ZCASH_SUBTREEINDEX_H
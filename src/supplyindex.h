@@ -0,0 +1,98 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_SUPPLYINDEX_H
+#define ZCASH_SUPPLYINDEX_H
+
+#include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
+
+/** The value pools whose balances the supply index keeps. */
+enum SupplyPool : uint8_t {
+    SUPPLY_TRANSPARENT,
+    SUPPLY_SPROUT,
+    SUPPLY_SAPLING,
+    SUPPLY_ORCHARD,
+    SUPPLY_POOL_COUNT,
+};
+
+/** The name of a pool, as in the valuePools of getblockchaininfo. */
+inline const char* SupplyPoolName(SupplyPool pool)
+{
+    switch (pool) {
+        case SUPPLY_TRANSPARENT: return "transparent";
+        case SUPPLY_SPROUT: return "sprout";
+        case SUPPLY_SAPLING: return "sapling";
+        case SUPPLY_ORCHARD: return "orchard";
+        case SUPPLY_POOL_COUNT: break;
+    }
+    return "";
+}
+
+/** The block of the active chain at a height. */
+struct CSupplyIndexKey {
+    uint32_t height;
+
+    size_t GetSerializeSize(int nType, int nVersion) const {
+        return 4;
+    }
+    // Big-endian, so that a range of heights is iterated in order.
+    template<typename Stream>
+    void Serialize(Stream& s) const {
+        ser_writedata32be(s, height);
+    }
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        height = ser_readdata32be(s);
+    }
+
+    explicit CSupplyIndexKey(uint32_t heightIn) : height(heightIn) {}
+    CSupplyIndexKey() : height(0) {}
+};
+
+/**
+ * How a block changed the value pools and the issued supply, and their
+ * totals up to and including it, so that the supply over a range of heights
+ * takes two reads instead of a walk over the blocks.
+ *
+ * The transparent pool is the value of the unspent transparent outputs, and
+ * the subsidy is what the block was allowed to issue (including the funding
+ * streams); the sum of the pools falls short of the issued subsidy by the
+ * value that miners left unclaimed. The genesis block changes nothing, as its
+ * coinbase output is unspendable.
+ */
+struct CSupplyIndexValue {
+    uint256 blockHash;
+    CAmount nSubsidy;
+    CAmount nChainSubsidy;
+    CAmount valueDelta[SUPPLY_POOL_COUNT];
+    CAmount chainValue[SUPPLY_POOL_COUNT];
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(blockHash);
+        READWRITE(nSubsidy);
+        READWRITE(nChainSubsidy);
+        for (int i = 0; i < SUPPLY_POOL_COUNT; i++) {
+            READWRITE(valueDelta[i]);
+            READWRITE(chainValue[i]);
+        }
+    }
+
+    //! The sum of the pools.
+    CAmount GetChainSupply() const {
+        CAmount nSupply = 0;
+        for (int i = 0; i < SUPPLY_POOL_COUNT; i++) {
+            nSupply += chainValue[i];
+        }
+        return nSupply;
+    }
+
+    CSupplyIndexValue() : nSubsidy(0), nChainSubsidy(0), valueDelta{}, chainValue{} {}
+};
+
+#endif // ZCASH_SUPPLYINDEX_H
@@ -0,0 +1,228 @@
+// Copyright (c) 2022 The Bitcoin Core developers
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include "support/hugepages.h"
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * A memory resource that serves small, fixed-size blocks out of large chunks.
+ *
+ * Node-based containers such as boost::unordered_map perform one heap
+ * allocation per element. For the coins and nullifier caches that is
+ * millions of tiny allocations, each carrying malloc bookkeeping overhead
+ * that the cache size accounting could only estimate. PoolResource instead
+ * carves blocks out of chunks of CHUNK_SIZE_BYTES, and keeps freed blocks on
+ * a free list per size class so they are reused before the current chunk is
+ * consumed further. Chunks are only returned to the system when the resource
+ * is destroyed, which makes releasing a whole cache a handful of frees.
+ *
+ * Chunks are backed by huge pages when -hugepages is set (see
+ * HugePageAllocate).
+ *
+ * Requests that are larger than MAX_BLOCK_SIZE_BYTES or more strictly aligned
+ * than ALIGN_BYTES (in practice, the bucket arrays of the map) are forwarded
+ * to operator new, and their sizes are tracked so that DynamicMemoryUsage()
+ * reports everything the resource holds.
+ *
+ * The resource is not thread-safe; like the container using it, access must
+ * be externally synchronized.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+public:
+    static constexpr std::size_t CHUNK_SIZE_BYTES = 256 << 10;
+
+private:
+    /** In-place linked list of the free blocks of one size class. */
+    struct ListNode {
+        ListNode* m_next;
+        explicit ListNode(ListNode* next) : m_next(next) {}
+    };
+    static_assert(std::is_trivially_destructible<ListNode>::value, "ListNode must be trivially destructible");
+
+    /** Every block is a multiple of this, so that a ListNode fits in any of them. */
+    static constexpr std::size_t ELEM_ALIGN_BYTES = alignof(ListNode) > ALIGN_BYTES ? alignof(ListNode) : ALIGN_BYTES;
+    static_assert((ELEM_ALIGN_BYTES & (ELEM_ALIGN_BYTES - 1)) == 0, "ELEM_ALIGN_BYTES must be a power of two");
+    static_assert(sizeof(ListNode) <= ELEM_ALIGN_BYTES, "units of ELEM_ALIGN_BYTES must fit a ListNode");
+    static_assert(ELEM_ALIGN_BYTES <= alignof(std::max_align_t), "chunks from operator new must be aligned enough");
+    static_assert(MAX_BLOCK_SIZE_BYTES <= CHUNK_SIZE_BYTES, "a block must fit in a chunk");
+
+    std::vector<unsigned char*> m_chunks;
+    std::array<ListNode*, MAX_BLOCK_SIZE_BYTES / ELEM_ALIGN_BYTES + 1> m_free_lists{};
+    unsigned char* m_available_begin = nullptr;
+    unsigned char* m_available_end = nullptr;
+
+    std::size_t m_large_allocations = 0;
+    std::size_t m_large_allocation_bytes = 0;
+
+    /** Number of ELEM_ALIGN_BYTES units needed to store bytes (at least one). */
+    static constexpr std::size_t NumElemAlignBytes(std::size_t bytes)
+    {
+        return (bytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + (bytes == 0);
+    }
+
+    static constexpr bool IsFreeListUsable(std::size_t bytes, std::size_t alignment)
+    {
+        return alignment <= ELEM_ALIGN_BYTES && bytes <= MAX_BLOCK_SIZE_BYTES;
+    }
+
+    void PushFree(void* p, std::size_t units)
+    {
+        m_free_lists[units] = new (p) ListNode(m_free_lists[units]);
+    }
+
+    void AllocateChunk()
+    {
+        // Whatever is left of the current chunk is a multiple of
+        // ELEM_ALIGN_BYTES, so hand it to the matching free list.
+        std::size_t remaining = m_available_end - m_available_begin;
+        if (remaining != 0) {
+            PushFree(m_available_begin, remaining / ELEM_ALIGN_BYTES);
+        }
+        m_chunks.reserve(m_chunks.size() + 1);
+        m_available_begin = static_cast<unsigned char*>(HugePageAllocate(CHUNK_SIZE_BYTES));
+        m_available_end = m_available_begin + CHUNK_SIZE_BYTES;
+        m_chunks.push_back(m_available_begin);
+    }
+
+public:
+    /** No memory is allocated until the first request, so empty containers are cheap. */
+    PoolResource() {}
+
+    PoolResource(const PoolResource&) = delete;
+    PoolResource& operator=(const PoolResource&) = delete;
+
+    ~PoolResource()
+    {
+        for (unsigned char* chunk : m_chunks) {
+            HugePageDeallocate(chunk, CHUNK_SIZE_BYTES);
+        }
+    }
+
+    void* Allocate(std::size_t bytes, std::size_t alignment)
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            const std::size_t units = NumElemAlignBytes(bytes);
+            if (m_free_lists[units] != nullptr) {
+                ListNode* node = m_free_lists[units];
+                m_free_lists[units] = node->m_next;
+                return node;
+            }
+            const std::size_t round_bytes = units * ELEM_ALIGN_BYTES;
+            if (round_bytes > static_cast<std::size_t>(m_available_end - m_available_begin)) {
+                AllocateChunk();
+            }
+            void* p = m_available_begin;
+            m_available_begin += round_bytes;
+            return p;
+        }
+        void* p = ::operator new(bytes);
+        ++m_large_allocations;
+        m_large_allocation_bytes += bytes;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t bytes, std::size_t alignment) noexcept
+    {
+        if (IsFreeListUsable(bytes, alignment)) {
+            PushFree(p, NumElemAlignBytes(bytes));
+        } else {
+            assert(m_large_allocations > 0 && m_large_allocation_bytes >= bytes);
+            --m_large_allocations;
+            m_large_allocation_bytes -= bytes;
+            ::operator delete(p);
+        }
+    }
+
+    std::size_t NumAllocatedChunks() const { return m_chunks.size(); }
+    std::size_t ChunkListCapacity() const { return m_chunks.capacity(); }
+    std::size_t NumLargeAllocations() const { return m_large_allocations; }
+    std::size_t LargeAllocationBytes() const { return m_large_allocation_bytes; }
+};
+
+/**
+ * Allocator for node-based containers that draws from a PoolResource.
+ *
+ * A default-constructed allocator creates a fresh resource, and every
+ * allocator rebound or copied from it shares that resource. As a result each
+ * container owns exactly one pool: destroying the container (or swapping in
+ * a new, empty one) returns all of its chunks at once. Allocators propagate
+ * on move and swap, so containers can hand their contents, pool included, to
+ * each other in constant time. Copies of a container get their own pool.
+ */
+template <class T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES = alignof(T)>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template <class U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+private:
+    std::shared_ptr<ResourceType> m_resource;
+
+    template <class U, std::size_t M, std::size_t A>
+    friend class PoolAllocator;
+
+public:
+    PoolAllocator() : m_resource(std::make_shared<ResourceType>()) {}
+
+    template <class U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) noexcept
+        : m_resource(other.m_resource) {}
+
+    PoolAllocator select_on_container_copy_construction() const
+    {
+        return PoolAllocator();
+    }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(m_resource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept
+    {
+        m_resource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const noexcept { return m_resource.get(); }
+};
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return a.resource() == b.resource();
+}
+
+template <class T1, class T2, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T1, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a,
+                const PoolAllocator<T2, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b) noexcept
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
@@ -0,0 +1,197 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "support/hugepages.h"
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#ifndef WIN32
+#include <sys/mman.h> // for mmap, madvise
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <new>
+#include <stdint.h>
+#include <vector>
+
+namespace {
+
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+const size_t REGION_SIZE = 32 << 20;
+//! Chunks are rounded up to this, which keeps them cache line aligned.
+const size_t CHUNK_ALIGN = 64;
+
+std::atomic<HugePageMode> g_mode{HugePageMode::OFF};
+//! Whether any region was mapped, so that chunks can be freed without taking
+//! the lock while huge pages have never been used.
+std::atomic<bool> g_fMapped{false};
+
+class HugePageRegions
+{
+    std::mutex mutex;
+    //! The mapped regions, by their first byte.
+    std::vector<unsigned char*> vRegions;
+    unsigned char* pAvailableBegin = nullptr;
+    unsigned char* pAvailableEnd = nullptr;
+    //! Freed chunks, by size.
+    std::map<size_t, std::vector<void*>> mapFree;
+    bool fHugeTLBExhausted = false;
+    HugePageStats stats{};
+
+    unsigned char* MapRegion(HugePageMode mode)
+    {
+#if defined(MAP_HUGETLB)
+        if (mode == HugePageMode::HUGETLB && !fHugeTLBExhausted) {
+            void* p = mmap(nullptr, REGION_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                stats.explicit_mapped += REGION_SIZE;
+                return static_cast<unsigned char*>(p);
+            }
+            fHugeTLBExhausted = true;
+        }
+#endif
+#if defined(MADV_HUGEPAGE)
+        // Map a huge page more than needed, and trim it to a region that
+        // starts on a huge page boundary.
+        void* p = mmap(nullptr, REGION_SIZE + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return nullptr;
+        }
+        uintptr_t nBegin = reinterpret_cast<uintptr_t>(p);
+        uintptr_t nAligned = (nBegin + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1);
+        if (nAligned > nBegin) {
+            munmap(p, nAligned - nBegin);
+        }
+        if (nAligned < nBegin + HUGE_PAGE_SIZE) {
+            munmap(reinterpret_cast<void*>(nAligned + REGION_SIZE), nBegin + HUGE_PAGE_SIZE - nAligned);
+        }
+        // If transparent huge pages are disabled this fails, and the region
+        // is backed by ordinary pages.
+        madvise(reinterpret_cast<void*>(nAligned), REGION_SIZE, MADV_HUGEPAGE);
+        return reinterpret_cast<unsigned char*>(nAligned);
+#else
+        return nullptr;
+#endif
+    }
+
+public:
+    void* Allocate(size_t bytes, HugePageMode mode)
+    {
+        bytes = (bytes + CHUNK_ALIGN - 1) & ~(CHUNK_ALIGN - 1);
+        if (bytes > REGION_SIZE) {
+            return nullptr;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = mapFree.find(bytes);
+        if (it != mapFree.end() && !it->second.empty()) {
+            void* p = it->second.back();
+            it->second.pop_back();
+            stats.free -= bytes;
+            return p;
+        }
+        if (bytes > size_t(pAvailableEnd - pAvailableBegin)) {
+            // The rest of the current region is left unused; with the chunk
+            // sizes in use it is a small fraction of a region.
+            unsigned char* pRegion = MapRegion(mode);
+            if (pRegion == nullptr) {
+                return nullptr;
+            }
+            vRegions.insert(std::upper_bound(vRegions.begin(), vRegions.end(), pRegion), pRegion);
+            stats.mapped += REGION_SIZE;
+            g_fMapped = true;
+            pAvailableBegin = pRegion;
+            pAvailableEnd = pRegion + REGION_SIZE;
+        }
+        void* p = pAvailableBegin;
+        pAvailableBegin += bytes;
+        return p;
+    }
+
+    //! Keep a chunk for reuse if it is in a region. Returns false otherwise.
+    bool Deallocate(void* p, size_t bytes)
+    {
+        bytes = (bytes + CHUNK_ALIGN - 1) & ~(CHUNK_ALIGN - 1);
+        unsigned char* pch = static_cast<unsigned char*>(p);
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = std::upper_bound(vRegions.begin(), vRegions.end(), pch);
+        if (it == vRegions.begin() || pch >= *std::prev(it) + REGION_SIZE) {
+            return false;
+        }
+        mapFree[bytes].push_back(p);
+        stats.free += bytes;
+        return true;
+    }
+
+    HugePageStats GetStats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+};
+
+HugePageRegions& Regions()
+{
+    // Never destroyed, so that chunks can still be freed by static
+    // destructors.
+    static HugePageRegions* regions = new HugePageRegions();
+    return *regions;
+}
+
+} // namespace
+
+bool ParseHugePageMode(const std::string& strMode, HugePageMode& mode)
+{
+    if (strMode == "0") {
+        mode = HugePageMode::OFF;
+    } else if (strMode == "1" || strMode == "transparent") {
+        mode = HugePageMode::MADVISE;
+    } else if (strMode == "explicit") {
+        mode = HugePageMode::HUGETLB;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void SetHugePageMode(HugePageMode mode)
+{
+    g_mode = mode;
+}
+
+HugePageMode GetHugePageMode()
+{
+    return g_mode;
+}
+
+void* HugePageAllocate(size_t bytes)
+{
+    HugePageMode mode = g_mode;
+    if (mode != HugePageMode::OFF) {
+        void* p = Regions().Allocate(bytes, mode);
+        if (p != nullptr) {
+            return p;
+        }
+    }
+    return ::operator new(bytes);
+}
+
+void HugePageDeallocate(void* p, size_t bytes) noexcept
+{
+    if (p == nullptr) {
+        return;
+    }
+    if (!g_fMapped || !Regions().Deallocate(p, bytes)) {
+        ::operator delete(p);
+    }
+}
+
+HugePageStats GetHugePageStats()
+{
+    return Regions().GetStats();
+}
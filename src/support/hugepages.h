@@ -0,0 +1,67 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_SUPPORT_HUGEPAGES_H
+#define ZCASH_SUPPORT_HUGEPAGES_H
+
+#include <stddef.h>
+#include <string>
+
+/**
+ * Huge page backing for the large, randomly accessed structures: the chunks
+ * of the pools behind the coins, nullifier and mempool maps, and the chunks
+ * of the block index arena. With gigabytes of these, a TLB entry per 4 KiB
+ * page misses on most lookups; backing them with 2 MiB pages covers the same
+ * memory with a fraction of the entries.
+ *
+ * Chunks are carved out of 32 MiB regions that are mapped once and
+ * never unmapped. A freed chunk is kept for the next chunk of the same size,
+ * so the memory stays with the process (and on huge pages) for its lifetime.
+ */
+enum class HugePageMode {
+    //! Chunks come from operator new.
+    OFF,
+    //! Regions are aligned to the huge page size and marked with
+    //! MADV_HUGEPAGE, for the kernel to back with transparent huge pages
+    //! (-hugepages=transparent).
+    MADVISE,
+    //! Regions are mapped from the reserved huge pages (MAP_HUGETLB), falling
+    //! back to transparent huge pages once none are left
+    //! (-hugepages=explicit).
+    HUGETLB,
+};
+
+static const char* const DEFAULT_HUGEPAGES = "0";
+
+/** Parse a -hugepages value: 0, transparent or explicit (1 is transparent). */
+bool ParseHugePageMode(const std::string& strMode, HugePageMode& mode);
+
+/**
+ * Set the backing of the chunks allocated from now on. Chunks that were
+ * already allocated are freed correctly either way.
+ */
+void SetHugePageMode(HugePageMode mode);
+HugePageMode GetHugePageMode();
+
+/**
+ * Allocate a chunk of bytes, aligned at least as operator new aligns. Falls
+ * back to operator new when huge pages are off, unavailable on this platform,
+ * or cannot be mapped, so this never returns nullptr.
+ */
+void* HugePageAllocate(size_t bytes);
+/** Free a chunk returned by HugePageAllocate(bytes). */
+void HugePageDeallocate(void* p, size_t bytes) noexcept;
+
+struct HugePageStats {
+    //! Bytes of the regions mapped so far.
+    size_t mapped;
+    //! Of those, the bytes mapped from the reserved huge pages.
+    size_t explicit_mapped;
+    //! Bytes of freed chunks waiting to be reused.
+    size_t free;
+};
+
+HugePageStats GetHugePageStats();
+
+#endif // ZCASH_SUPPORT_HUGEPAGES_H
@@ -23,7 +23,9 @@
 #endif
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <thread>
 #ifdef ARENA_DEBUG
 #include <iomanip>
 #include <iostream>
@@ -288,29 +290,61 @@ size_t PosixLockedPageAllocator::GetLimit()
 LockedPool::LockedPool(std::unique_ptr<LockedPageAllocator> allocator_in, LockingFailed_Callback lf_cb_in):
     allocator(std::move(allocator_in)), lf_cb(lf_cb_in), cumulative_bytes_locked(0)
 {
+    size_t num_shards = std::min<size_t>(MAX_SHARDS, std::max(1u, std::thread::hardware_concurrency()));
+    for (size_t i = 0; i < num_shards; ++i) {
+        shards.push_back(std::make_unique<Shard>());
+    }
 }
 
 LockedPool::~LockedPool()
 {
 }
-void* LockedPool::alloc(size_t size)
+
+size_t LockedPool::thread_shard() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
+    static std::atomic<size_t> next_thread_index{0};
+    thread_local size_t thread_index = next_thread_index++;
+    return thread_index % shards.size();
+}
 
+void* LockedPool::alloc_from(Shard& shard, size_t size)
+{
+    for (auto &arena: shard.arenas) {
+        void *addr = arena.alloc(size);
+        if (addr) {
+            return addr;
+        }
+    }
+    return nullptr;
+}
+
+void* LockedPool::alloc(size_t size)
+{
     // Don't handle impossible sizes
     if (size == 0 || size > ARENA_SIZE)
         return nullptr;
 
-    // Try allocating from each current arena
-    for (auto &arena: arenas) {
-        void *addr = arena.alloc(size);
+    // Try allocating from the arenas of this thread's shard, then from those
+    // of the other shards
+    const size_t first = thread_shard();
+    for (size_t i = 0; i < shards.size(); ++i) {
+        Shard& shard = *shards[(first + i) % shards.size()];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        void *addr = alloc_from(shard, size);
         if (addr) {
             return addr;
         }
     }
-    // If that fails, create a new one
-    if (new_arena(ARENA_SIZE, ARENA_ALIGN)) {
-        return arenas.back().alloc(size);
+    // If that fails, create a new one in this thread's shard, unless another
+    // thread has done so in the meantime
+    Shard& shard = *shards[first];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    void *addr = alloc_from(shard, size);
+    if (addr) {
+        return addr;
+    }
+    if (new_arena(shard, ARENA_SIZE, ARENA_ALIGN)) {
+        return shard.arenas.back().alloc(size);
     }
     return nullptr;
 }
@@ -322,41 +356,51 @@ void LockedPool::free(void *ptr) noexcept
         return;
     }
 
-    std::lock_guard<std::mutex> lock(mutex);
-    // TODO we can do better than this linear search by keeping a map of arena
-    // extents to arena, and looking up the address.
-    for (auto &arena: arenas) {
-        if (arena.addressInArena(ptr)) {
-            arena.free(ptr);
-            return;
+    std::pair<Shard*, LockedPageArena*> owner{nullptr, nullptr};
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        // The first arena that ends after ptr is the only one that can hold it.
+        auto it = arenas_by_end.upper_bound(static_cast<char*>(ptr));
+        if (it != arenas_by_end.end() && it->second.second->addressInArena(ptr)) {
+            owner = it->second;
         }
     }
-    assert(!"LockedPool: invalid address not pointing to any arena");
+    if (owner.second == nullptr) {
+        assert(!"LockedPool: invalid address not pointing to any arena");
+        return;
+    }
+    std::lock_guard<std::mutex> lock(owner.first->mutex);
+    owner.second->free(ptr);
 }
 
 LockedPool::Stats LockedPool::stats() const
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    LockedPool::Stats r{0, 0, 0, cumulative_bytes_locked, 0, 0};
-    for (const auto &arena: arenas) {
-        Arena::Stats i = arena.stats();
-        r.used += i.used;
-        r.free += i.free;
-        r.total += i.total;
-        r.chunks_used += i.chunks_used;
-        r.chunks_free += i.chunks_free;
+    LockedPool::Stats r{0, 0, 0, 0, 0, 0};
+    for (const auto &shard: shards) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        for (const auto &arena: shard->arenas) {
+            Arena::Stats i = arena.stats();
+            r.used += i.used;
+            r.free += i.free;
+            r.total += i.total;
+            r.chunks_used += i.chunks_used;
+            r.chunks_free += i.chunks_free;
+        }
     }
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    r.locked = cumulative_bytes_locked;
     return r;
 }
 
-bool LockedPool::new_arena(size_t size, size_t align)
+bool LockedPool::new_arena(Shard& shard, size_t size, size_t align)
 {
+    std::unique_lock<std::shared_mutex> lock(mutex);
     bool locked;
     // If this is the first arena, handle this specially: Cap the upper size
     // by the process limit. This makes sure that the first arena will at least
     // be locked. An exception to this is if the process limit is 0:
     // in this case no memory can be locked at all so we'll skip past this logic.
-    if (arenas.empty()) {
+    if (arenas_by_end.empty()) {
         size_t limit = allocator->GetLimit();
         if (limit > 0) {
             size = std::min(size, limit);
@@ -374,7 +418,8 @@ bool LockedPool::new_arena(size_t size, size_t align)
             return false;
         }
     }
-    arenas.emplace_back(allocator.get(), addr, size, align);
+    shard.arenas.emplace_back(allocator.get(), addr, size, align);
+    arenas_by_end.emplace(static_cast<char*>(addr) + size, std::make_pair(&shard, &shard.arenas.back()));
     return true;
 }
 
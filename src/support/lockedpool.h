@@ -11,7 +11,9 @@
 #include <map>
 #include <mutex>
 #include <memory>
+#include <shared_mutex>
 #include <unordered_map>
+#include <vector>
 
 /**
  * OS-dependent allocation and deallocation of locked/pinned memory pages.
@@ -122,6 +124,12 @@ private:
  * memory. This has been done as the sizes and bases of objects are not in themselves sensitive
  * information, as to conserve precious locked memory. In some operating systems
  * the amount of memory that can be locked is small.
+ *
+ * The arenas are divided over shards, each with its own mutex, and each thread
+ * allocates from the arenas of its own shard first. Threads that allocate at the
+ * same time, such as those signing or proving in parallel, then rarely wait for
+ * each other. A new arena is only created once the arenas of every shard are
+ * full, so sharding does not lock more memory than before.
  */
 class LockedPool
 {
@@ -137,6 +145,10 @@ public:
      */
     static const size_t ARENA_ALIGN = 16;
 
+    /** Maximum number of shards. There is one per hardware thread up to this.
+     */
+    static const size_t MAX_SHARDS = 8;
+
     /** Callback when allocation succeeds but locking fails.
      */
     typedef bool (*LockingFailed_Callback)();
@@ -193,14 +205,33 @@ private:
         LockedPageAllocator *allocator;
     };
 
-    bool new_arena(size_t size, size_t align);
+    /** A group of arenas that threads allocate from. Its mutex protects the
+     * arenas and their chunks.
+     */
+    struct Shard
+    {
+        std::list<LockedPageArena> arenas;
+        mutable std::mutex mutex;
+    };
+
+    /** The shard that the calling thread allocates from first. */
+    size_t thread_shard() const;
+    /** Allocate from the arenas of a shard. Requires shard.mutex. */
+    static void* alloc_from(Shard& shard, size_t size);
+    /** Add a new arena to a shard. Requires shard.mutex. */
+    bool new_arena(Shard& shard, size_t size, size_t align);
 
-    std::list<LockedPageArena> arenas;
+    std::vector<std::unique_ptr<Shard>> shards;
     LockingFailed_Callback lf_cb;
+    /** The arenas of all shards by their end address, to find the arena that a
+     * chunk is freed to. Arenas are only removed when the pool is destroyed.
+     */
+    std::map<char*, std::pair<Shard*, LockedPageArena*>> arenas_by_end;
     size_t cumulative_bytes_locked;
-    /** Mutex protects access to this pool's data structures, including arenas.
+    /** Mutex protects arenas_by_end and cumulative_bytes_locked. It is taken
+     * after a shard's mutex when both are held.
      */
-    mutable std::mutex mutex;
+    mutable std::shared_mutex mutex;
 };
 
 /**
@@ -10,10 +10,13 @@
 
 #include <stdio.h>
 
+#include <algorithm>
 #include <map>
 #include <memory>
 #include <set>
 
+#include <rust/metrics.h>
+
 #ifdef DEBUG_LOCKCONTENTION
 #if !defined(HAVE_THREAD_LOCAL)
 static_assert(false, "thread_local is not supported");
@@ -25,6 +28,81 @@ void PrintLockContention(const char* pszName, const char* pszFile, int nLine)
 }
 #endif /* DEBUG_LOCKCONTENTION */
 
+struct LockStatsData {
+    std::mutex mutex;
+    //! By the file and line of the lock site; __FILE__ is the same string
+    //! for all the sites of a file.
+    std::map<std::pair<const char*, int>, CLockSiteStats> mapSites;
+};
+static LockStatsData& GetLockStatsData() {
+    // Never destroyed, as locks are still taken by global destructors.
+    static LockStatsData& data = *new LockStatsData();
+    return data;
+}
+
+static CLockSiteStats& LockSiteStats(LockStatsData& data, const char* pszName, const char* pszFile, int nLine)
+{
+    CLockSiteStats& stats = data.mapSites[std::make_pair(pszFile, nLine)];
+    if (stats.nLine == 0) {
+        stats.strName = pszName;
+        stats.strFile = pszFile;
+        stats.nLine = nLine;
+    }
+    return stats;
+}
+
+static std::string LockSite(const char* pszFile, int nLine)
+{
+    return strprintf("%s:%d", pszFile, nLine);
+}
+
+static thread_local int64_t nThreadLockWaitMicros = 0;
+
+int64_t GetThreadLockWaitMicros()
+{
+    return nThreadLockWaitMicros;
+}
+
+void RecordLockWait(const char* pszName, const char* pszFile, int nLine, int64_t nMicros)
+{
+    nThreadLockWaitMicros += nMicros;
+    {
+        LockStatsData& data = GetLockStatsData();
+        std::lock_guard<std::mutex> lock(data.mutex);
+        CLockSiteStats& stats = LockSiteStats(data, pszName, pszFile, nLine);
+        stats.nContentions++;
+        stats.nWaitMicros += nMicros;
+        stats.nMaxWaitMicros = std::max(stats.nMaxWaitMicros, nMicros);
+    }
+    MetricsHistogram("zcash.sync.lock.wait.seconds", nMicros * 0.000001,
+        "lock", pszName, "site", LockSite(pszFile, nLine).c_str());
+}
+
+void RecordLockHold(const char* pszName, const char* pszFile, int nLine, int64_t nMicros)
+{
+    {
+        LockStatsData& data = GetLockStatsData();
+        std::lock_guard<std::mutex> lock(data.mutex);
+        CLockSiteStats& stats = LockSiteStats(data, pszName, pszFile, nLine);
+        stats.nHoldSamples++;
+        stats.nHoldMicros += nMicros;
+        stats.nMaxHoldMicros = std::max(stats.nMaxHoldMicros, nMicros);
+    }
+    MetricsHistogram("zcash.sync.lock.hold.seconds", nMicros * 0.000001,
+        "lock", pszName, "site", LockSite(pszFile, nLine).c_str());
+}
+
+std::vector<CLockSiteStats> GetLockStats()
+{
+    LockStatsData& data = GetLockStatsData();
+    std::lock_guard<std::mutex> lock(data.mutex);
+    std::vector<CLockSiteStats> vStats;
+    vStats.reserve(data.mapSites.size());
+    for (const auto& site : data.mapSites)
+        vStats.push_back(site.second);
+    return vStats;
+}
+
 #ifdef DEBUG_LOCKORDER
 //
 // Early deadlock detection.
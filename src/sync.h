@@ -12,9 +12,12 @@
 #include <boost/thread/condition_variable.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
+#include <chrono>
 #include <condition_variable>
+#include <string>
 #include <thread>
 #include <mutex>
+#include <vector>
 
 
 ////////////////////////////////////////////////
@@ -118,22 +121,87 @@ typedef AnnotatedMixin<std::mutex> Mutex;
 void PrintLockContention(const char* pszName, const char* pszFile, int nLine);
 #endif
 
+/**
+ * Lock statistics, by lock site (the file and line of the LOCK): every
+ * acquisition that has to wait for the lock is timed, and one in
+ * LOCK_HOLD_SAMPLE_INTERVAL of the acquisitions of each thread is timed
+ * until the lock is released (which, for a WAIT_LOCK, includes the time
+ * spent waiting on a condition variable with it). The times are also
+ * recorded in the zcash.sync.lock.wait.seconds and
+ * zcash.sync.lock.hold.seconds histograms.
+ */
+static const unsigned int LOCK_HOLD_SAMPLE_INTERVAL = 64;
+
+struct CLockSiteStats {
+    std::string strName;
+    std::string strFile;
+    int nLine = 0;
+    //! The acquisitions that had to wait, and how long they waited.
+    uint64_t nContentions = 0;
+    int64_t nWaitMicros = 0;
+    int64_t nMaxWaitMicros = 0;
+    //! The acquisitions whose hold time was sampled, and how long they held the lock.
+    uint64_t nHoldSamples = 0;
+    int64_t nHoldMicros = 0;
+    int64_t nMaxHoldMicros = 0;
+};
+
+/** The statistics of all the lock sites that have waited or been sampled. */
+std::vector<CLockSiteStats> GetLockStats();
+void RecordLockWait(const char* pszName, const char* pszFile, int nLine, int64_t nMicros);
+/** The total time this thread has waited for locks, in microseconds. */
+int64_t GetThreadLockWaitMicros();
+void RecordLockHold(const char* pszName, const char* pszFile, int nLine, int64_t nMicros);
+
+static inline int64_t LockStatsMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** Whether the hold time of the acquisition this thread is making is sampled. */
+static inline bool SampleLockHold()
+{
+    static thread_local unsigned int nUntilSample = LOCK_HOLD_SAMPLE_INTERVAL;
+    if (--nUntilSample > 0)
+        return false;
+    nUntilSample = LOCK_HOLD_SAMPLE_INTERVAL;
+    return true;
+}
+
 /** Wrapper around std::unique_lock style lock for Mutex. */
 template <typename Mutex, typename Base = typename Mutex::UniqueLock>
 class SCOPED_LOCKABLE UniqueLock : public Base
 {
 private:
+    //! Where the lock was taken, if its hold time is sampled.
+    const char* pszSampledName = nullptr;
+    const char* pszSampledFile = nullptr;
+    int nSampledLine = 0;
+    int64_t nSampledSince = 0;
+
+    void StartHoldSample(const char* pszName, const char* pszFile, int nLine)
+    {
+        if (SampleLockHold()) {
+            pszSampledName = pszName;
+            pszSampledFile = pszFile;
+            nSampledLine = nLine;
+            nSampledSince = LockStatsMicros();
+        }
+    }
+
     void Enter(const char* pszName, const char* pszFile, int nLine)
     {
         EnterCritical(pszName, pszFile, nLine, (void*)(Base::mutex()));
-#ifdef DEBUG_LOCKCONTENTION
         if (!Base::try_lock()) {
+#ifdef DEBUG_LOCKCONTENTION
             PrintLockContention(pszName, pszFile, nLine);
 #endif
+            int64_t nWaitStart = LockStatsMicros();
             Base::lock();
-#ifdef DEBUG_LOCKCONTENTION
+            RecordLockWait(pszName, pszFile, nLine, LockStatsMicros() - nWaitStart);
         }
-#endif
+        StartHoldSample(pszName, pszFile, nLine);
     }
 
     bool TryEnter(const char* pszName, const char* pszFile, int nLine)
@@ -142,6 +210,8 @@ private:
         Base::try_lock();
         if (!Base::owns_lock())
             LeaveCritical();
+        else
+            StartHoldSample(pszName, pszFile, nLine);
         return Base::owns_lock();
     }
 
@@ -167,8 +237,11 @@ public:
 
     ~UniqueLock() UNLOCK_FUNCTION()
     {
-        if (Base::owns_lock())
+        if (Base::owns_lock()) {
+            if (pszSampledName)
+                RecordLockHold(pszSampledName, pszSampledFile, nSampledLine, LockStatsMicros() - nSampledSince);
             LeaveCritical();
+        }
     }
 
     operator bool()
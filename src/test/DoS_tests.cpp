@@ -34,9 +34,16 @@ extern unsigned int LimitOrphanTxSize(unsigned int nMaxOrphans);
 struct COrphanTx {
     CTransaction tx;
     NodeId fromPeer;
+    unsigned int nTxSize;
+    uint64_t nSequence;
+};
+struct COrphanPeer {
+    std::map<uint64_t, uint256> mapOrphans;
+    size_t nBytes = 0;
 };
 extern std::map<uint256, COrphanTx> mapOrphanTransactions;
 extern std::map<uint256, std::set<uint256> > mapOrphanTransactionsByPrev;
+extern std::map<NodeId, COrphanPeer> mapOrphanTransactionsByPeer;
 
 CService ip(uint32_t i)
 {
@@ -208,6 +215,64 @@ BOOST_DATA_TEST_CASE(DoS_mapOrphans, boost::unit_test::data::xrange(static_cast<
     LimitOrphanTxSize(0);
     BOOST_CHECK(mapOrphanTransactions.empty());
     BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPeer.empty());
+}
+
+BOOST_AUTO_TEST_CASE(DoS_mapOrphansPeerQuota)
+{
+    CKey key = CKey::TestOnlyRandomKey(true);
+
+    // Orphans are padded to a fixed size so the quota is easy to count.
+    auto makeOrphan = [&]() {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.n = 0;
+        tx.vin[0].prevout.hash = GetRandHash();
+        tx.vin[0].scriptSig << std::vector<unsigned char>(900, 0x01);
+        tx.vout.resize(1);
+        tx.vout[0].nValue = 1*CENT;
+        tx.vout[0].scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+        return CTransaction(tx);
+    };
+    const unsigned int nTxSize = GetSerializeSize(makeOrphan(), SER_NETWORK, PROTOCOL_VERSION);
+    const size_t nPerPeer = MAX_PEER_ORPHAN_TX_BYTES / nTxSize;
+
+    // Peer 1 fills its quota; each further orphan replaces its oldest one.
+    std::vector<uint256> vPeer1;
+    for (size_t i = 0; i < nPerPeer + 5; i++) {
+        CTransaction tx = makeOrphan();
+        BOOST_CHECK(AddOrphanTx(tx, 1));
+        vPeer1.push_back(tx.GetHash());
+    }
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), nPerPeer);
+    BOOST_CHECK_EQUAL(mapOrphanTransactionsByPeer[1].nBytes, nPerPeer * nTxSize);
+    for (size_t i = 0; i < 5; i++) {
+        BOOST_CHECK(!mapOrphanTransactions.count(vPeer1[i]));
+    }
+    BOOST_CHECK(mapOrphanTransactions.count(vPeer1.back()));
+
+    // Peer 1 cannot push out the orphans of peer 2.
+    CTransaction txPeer2 = makeOrphan();
+    BOOST_CHECK(AddOrphanTx(txPeer2, 2));
+    BOOST_CHECK(AddOrphanTx(makeOrphan(), 1));
+    BOOST_CHECK(mapOrphanTransactions.count(txPeer2.GetHash()));
+
+    // Over the global limit, the peer using the most space is evicted from.
+    LimitOrphanTxSize(nPerPeer);
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), nPerPeer);
+    BOOST_CHECK(mapOrphanTransactions.count(txPeer2.GetHash()));
+
+    // Erasing the orphans of a peer leaves the others alone.
+    EraseOrphansFor(1);
+    BOOST_CHECK_EQUAL(mapOrphanTransactions.size(), 1);
+    BOOST_CHECK(mapOrphanTransactions.count(txPeer2.GetHash()));
+    BOOST_CHECK(!mapOrphanTransactionsByPeer.count(1));
+    BOOST_CHECK_EQUAL(mapOrphanTransactionsByPeer[2].nBytes, nTxSize);
+
+    EraseOrphansFor(2);
+    BOOST_CHECK(mapOrphanTransactions.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPrev.empty());
+    BOOST_CHECK(mapOrphanTransactionsByPeer.empty());
 }
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -7,8 +7,10 @@
 #include <string>
 #include <boost/test/unit_test.hpp>
 
+#include "clientversion.h"
 #include "hash.h"
 #include "random.h"
+#include "streams.h"
 
 using namespace std;
 
@@ -520,4 +522,36 @@ BOOST_AUTO_TEST_CASE(caddrinfo_get_new_bucket)
     //  than 64 buckets.
     BOOST_CHECK(buckets.size() > 64);
 }
+
+BOOST_AUTO_TEST_CASE(addrman_serialization)
+{
+    CAddrManTest addrman;
+
+    // Set addrman addr placement to be deterministic.
+    addrman.MakeDeterministic();
+
+    for (int i = 0; i < 64; i++) {
+        CService addr = CService("250." + boost::to_string(i) + ".1.1", 8333);
+        addrman.Add(CAddress(addr), CNetAddr("252." + boost::to_string(i) + ".1.1"));
+        if (i < 16)
+            addrman.Good(CAddress(addr));
+    }
+
+    // Test 35: The stored bucket placement restores the same tables, so
+    //  they serialize the same again.
+    CDataStream ssPeers(SER_DISK, CLIENT_VERSION);
+    ssPeers << addrman;
+    std::string strPeers = ssPeers.str();
+    CAddrManTest addrman2;
+    ssPeers >> addrman2;
+    BOOST_CHECK_EQUAL(addrman2.size(), addrman.size());
+    for (int i = 0; i < 64; i++) {
+        BOOST_CHECK(addrman2.Find(CNetAddr("250." + boost::to_string(i) + ".1.1")) != NULL);
+    }
+    CDataStream ssPeers2(SER_DISK, CLIENT_VERSION);
+    ssPeers2 << addrman2;
+    BOOST_CHECK(ssPeers2.str() == strPeers);
+    BOOST_CHECK(addrman2.Select(true).ToString() != "[::]:0");
+}
+
 BOOST_AUTO_TEST_SUITE_END()
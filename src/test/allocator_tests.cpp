@@ -5,7 +5,10 @@
 
 #include "util/system.h"
 
+#include "memusage.h"
+#include "support/allocators/pool.h"
 #include "support/allocators/secure.h"
+#include "support/hugepages.h"
 #include "test/test_bitcoin.h"
 
 #include <boost/test/unit_test.hpp>
@@ -226,4 +229,120 @@ BOOST_AUTO_TEST_CASE(lockedpool_tests_live)
     pool.free(nullptr);
 }
 
+BOOST_AUTO_TEST_CASE(pool_resource_tests)
+{
+    PoolResource<64, 8> resource;
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0);
+
+    // Blocks come out of a single chunk, and freed blocks are reused.
+    void *a0 = resource.Allocate(24, 8);
+    void *a1 = resource.Allocate(24, 8);
+    BOOST_CHECK(a0 && a1 && a0 != a1);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1);
+    resource.Deallocate(a0, 24, 8);
+    void *a2 = resource.Allocate(24, 8);
+    BOOST_CHECK(a2 == a0);
+
+    // Sizes are rounded up to the alignment, so close sizes share a free list.
+    resource.Deallocate(a1, 24, 8);
+    void *a3 = resource.Allocate(20, 8);
+    BOOST_CHECK(a3 == a1);
+    resource.Deallocate(a3, 20, 8);
+    resource.Deallocate(a2, 24, 8);
+
+    // Large requests bypass the pool but are still tracked.
+    void *big = resource.Allocate(1000, 8);
+    BOOST_CHECK(big);
+    BOOST_CHECK_EQUAL(resource.NumLargeAllocations(), 1);
+    BOOST_CHECK_EQUAL(resource.LargeAllocationBytes(), 1000);
+    resource.Deallocate(big, 1000, 8);
+    BOOST_CHECK_EQUAL(resource.NumLargeAllocations(), 0);
+    BOOST_CHECK_EQUAL(resource.LargeAllocationBytes(), 0);
+
+    // Filling a chunk moves on to the next one.
+    size_t perChunk = PoolResource<64, 8>::CHUNK_SIZE_BYTES / 64;
+    std::vector<void*> blocks;
+    for (size_t i = 0; i < perChunk + 1; i++) {
+        blocks.push_back(resource.Allocate(64, 8));
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+    for (void *p : blocks) {
+        resource.Deallocate(p, 64, 8);
+    }
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map_tests)
+{
+    typedef PoolAllocator<std::pair<const int, uint64_t>, 64> Alloc;
+    typedef boost::unordered_map<int, uint64_t, boost::hash<int>, std::equal_to<int>, Alloc> Map;
+
+    Map m;
+    BOOST_CHECK_EQUAL(m.get_allocator().resource()->NumAllocatedChunks(), 0);
+    for (int i = 0; i < 10000; i++) {
+        m[i] = i;
+    }
+    BOOST_CHECK(m.get_allocator().resource()->NumAllocatedChunks() > 0);
+    size_t usage = memusage::DynamicUsage(m);
+    BOOST_CHECK(usage >= m.get_allocator().resource()->NumAllocatedChunks() * Alloc::ResourceType::CHUNK_SIZE_BYTES);
+
+    // Copies get their own pool.
+    Map copy(m);
+    BOOST_CHECK(copy.get_allocator() != m.get_allocator());
+    BOOST_CHECK_EQUAL(copy.size(), m.size());
+    BOOST_CHECK_EQUAL(copy[1234], 1234);
+
+    // Swapping exchanges the pools along with the contents.
+    Map empty;
+    auto *pool = m.get_allocator().resource();
+    empty.swap(m);
+    BOOST_CHECK(empty.get_allocator().resource() == pool);
+    BOOST_CHECK_EQUAL(empty.size(), 10000);
+    BOOST_CHECK(m.empty());
+    BOOST_CHECK_EQUAL(m.get_allocator().resource()->NumAllocatedChunks(), 0);
+
+    // Erasing keeps the memory in the pool; only a fresh map releases it.
+    empty.clear();
+    BOOST_CHECK_EQUAL(empty.get_allocator().resource(), pool);
+    BOOST_CHECK(memusage::DynamicUsage(empty) > usage / 2);
+    Map().swap(empty);
+    BOOST_CHECK(memusage::DynamicUsage(empty) < usage / 2);
+}
+
+BOOST_AUTO_TEST_CASE(hugepage_tests)
+{
+    HugePageMode mode;
+    BOOST_CHECK(ParseHugePageMode("0", mode) && mode == HugePageMode::OFF);
+    BOOST_CHECK(ParseHugePageMode("1", mode) && mode == HugePageMode::MADVISE);
+    BOOST_CHECK(ParseHugePageMode("transparent", mode) && mode == HugePageMode::MADVISE);
+    BOOST_CHECK(ParseHugePageMode("explicit", mode) && mode == HugePageMode::HUGETLB);
+    BOOST_CHECK(!ParseHugePageMode("2", mode));
+    BOOST_CHECK(!ParseHugePageMode("", mode));
+
+    const size_t nChunk = PoolResource<64, 8>::CHUNK_SIZE_BYTES;
+    SetHugePageMode(HugePageMode::MADVISE);
+    HugePageStats before = GetHugePageStats();
+    unsigned char *a = static_cast<unsigned char*>(HugePageAllocate(nChunk));
+    memset(a, 1, nChunk);
+    HugePageDeallocate(a, nChunk);
+    // Where huge pages could be mapped, a freed chunk is reused for the next
+    // chunk of its size; elsewhere chunks come from operator new.
+    void *b = HugePageAllocate(nChunk);
+    if (GetHugePageStats().mapped > 0) {
+        BOOST_CHECK(b == a);
+        BOOST_CHECK_EQUAL(GetHugePageStats().free, before.free);
+    }
+
+    // A pool draws its chunks from the huge pages too, and chunks allocated
+    // in one mode are freed correctly after switching to another.
+    {
+        PoolResource<64, 8> resource;
+        void *p = resource.Allocate(64, 8);
+        memset(p, 2, 64);
+        SetHugePageMode(HugePageMode::OFF);
+    }
+    HugePageDeallocate(b, nChunk);
+    BOOST_CHECK(GetHugePageStats().free >= before.free);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,212 @@
+// Copyright (c) 2011-2016 The Bitcoin Core developers
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockencodings.h"
+#include "random.h"
+#include "streams.h"
+#include "txmempool.h"
+#include "version.h"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockencodings_tests, TestingSetup)
+
+static CBlock BuildBlockTestCase() {
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+
+    block.vtx.resize(3);
+    block.vtx[0] = tx;
+    block.nVersion = 4;
+    block.hashPrevBlock = GetRandHash();
+    block.nBits = 0x207fffff;
+
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = 0;
+    block.vtx[1] = tx;
+
+    tx.vin.resize(10);
+    for (size_t i = 0; i < tx.vin.size(); i++) {
+        tx.vin[i].prevout.hash = GetRandHash();
+        tx.vin[i].prevout.n = 0;
+    }
+    block.vtx[2] = tx;
+
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(SimpleRoundTripTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase());
+
+    CMutableTransaction tx2(block.vtx[2]);
+    pool.addUnchecked(tx2.GetHash(), entry.FromTx(tx2));
+
+    // Do a simple ShortTxIDs RT
+    {
+        CBlockHeaderAndShortTxIDs shortIDs(block);
+
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << shortIDs;
+
+        CBlockHeaderAndShortTxIDs shortIDs2;
+        stream >> shortIDs2;
+        BOOST_CHECK_EQUAL(shortIDs2.BlockTxCount(), block.vtx.size());
+        BOOST_CHECK_EQUAL(shortIDs2.GetShortID(block.vtx[1].GetWTxId()), shortIDs.GetShortID(block.vtx[1].GetWTxId()));
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs2) == READ_STATUS_OK);
+        BOOST_CHECK( partialBlock.IsTxAvailable(0));
+        BOOST_CHECK(!partialBlock.IsTxAvailable(1));
+        BOOST_CHECK( partialBlock.IsTxAvailable(2));
+        BOOST_CHECK_EQUAL(partialBlock.GetPrefilledCount(), 1);
+        BOOST_CHECK_EQUAL(partialBlock.GetMempoolCount(), 1);
+
+        // A transaction that does not belong to the block gives a different
+        // merkle root, so the block has to be fetched in full.
+        {
+            PartiallyDownloadedBlock partialBlockCopy = partialBlock;
+            CBlock block2;
+            CMutableTransaction txWrong(block.vtx[1]);
+            txWrong.vout[0].nValue = 43;
+            BOOST_CHECK(partialBlockCopy.FillBlock(block2, {txWrong}) == READ_STATUS_FAILED);
+        }
+
+        // Too few or too many transactions are invalid.
+        {
+            PartiallyDownloadedBlock partialBlockCopy = partialBlock;
+            CBlock block2;
+            BOOST_CHECK(partialBlockCopy.FillBlock(block2, {}) == READ_STATUS_INVALID);
+        }
+        {
+            PartiallyDownloadedBlock partialBlockCopy = partialBlock;
+            CBlock block2;
+            BOOST_CHECK(partialBlockCopy.FillBlock(block2, {block.vtx[1], block.vtx[1]}) == READ_STATUS_INVALID);
+        }
+
+        CBlock block3;
+        BOOST_CHECK(partialBlock.FillBlock(block3, {block.vtx[1]}) == READ_STATUS_OK);
+        BOOST_CHECK_EQUAL(block.GetHash().ToString(), block3.GetHash().ToString());
+        BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), block3.BuildMerkleTree().ToString());
+        BOOST_CHECK(block3.vtx[2].GetHash() == block.vtx[2].GetHash());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(AllInMempoolTest)
+{
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    CBlock block(BuildBlockTestCase());
+
+    CMutableTransaction tx1(block.vtx[1]);
+    CMutableTransaction tx2(block.vtx[2]);
+    pool.addUnchecked(tx1.GetHash(), entry.FromTx(tx1));
+    pool.addUnchecked(tx2.GetHash(), entry.FromTx(tx2));
+
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs) == READ_STATUS_OK);
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK(partialBlock.IsTxAvailable(i));
+    }
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, {}) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+}
+
+BOOST_AUTO_TEST_CASE(PrefilledShieldedOnlyTransaction)
+{
+    CTxMemPool pool(CFeeRate(0));
+    CBlock block(BuildBlockTestCase());
+
+    // A transaction with no transparent inputs or outputs can be prefilled.
+    CMutableTransaction tx;
+    tx.vJoinSplit.push_back(JSDescription());
+    block.vtx[0] = tx;
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs) == READ_STATUS_OK);
+    BOOST_CHECK(partialBlock.IsTxAvailable(0));
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, {block.vtx[1], block.vtx[2]}) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+}
+
+BOOST_AUTO_TEST_CASE(ShortIDCommitsToAuthDigest)
+{
+    CBlock block(BuildBlockTestCase());
+    CBlockHeaderAndShortTxIDs shortIDs(block);
+
+    // Transactions with the same txid but different authorizing data (as v5
+    // transactions can have) get different short IDs.
+    uint256 txid = GetRandHash();
+    WTxId wtxid1(txid, GetRandHash());
+    WTxId wtxid2(txid, GetRandHash());
+    BOOST_CHECK(shortIDs.GetShortID(wtxid1) != shortIDs.GetShortID(wtxid2));
+    BOOST_CHECK_EQUAL(shortIDs.GetShortID(wtxid1), shortIDs.GetShortID(WTxId(txid, wtxid1.authDigest)));
+    BOOST_CHECK_EQUAL(shortIDs.GetShortID(wtxid1) >> 48, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest)
+{
+    BlockTransactionsRequest req1;
+    req1.blockhash = GetRandHash();
+    req1.indexes.resize(4);
+    req1.indexes[0] = 0;
+    req1.indexes[1] = 1;
+    req1.indexes[2] = 3;
+    req1.indexes[3] = 4;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << req1;
+
+    BlockTransactionsRequest req2;
+    stream >> req2;
+
+    BOOST_CHECK_EQUAL(req1.blockhash.ToString(), req2.blockhash.ToString());
+    BOOST_CHECK_EQUAL(req1.indexes.size(), req2.indexes.size());
+    BOOST_CHECK_EQUAL(req1.indexes[0], req2.indexes[0]);
+    BOOST_CHECK_EQUAL(req1.indexes[1], req2.indexes[1]);
+    BOOST_CHECK_EQUAL(req1.indexes[2], req2.indexes[2]);
+    BOOST_CHECK_EQUAL(req1.indexes[3], req2.indexes[3]);
+}
+
+BOOST_AUTO_TEST_CASE(TransactionsRequestDeserializationOverflowTest) {
+    // Check that the differential encoding cannot address an index past
+    // 16 bits.
+    BlockTransactionsRequest req0;
+    req0.blockhash = GetRandHash();
+    req0.indexes.resize(2);
+    req0.indexes[0] = 0x7fff;
+    req0.indexes[1] = 0xffff;
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << req0;
+    BlockTransactionsRequest req1;
+    stream >> req1;
+    BOOST_CHECK_EQUAL(req1.indexes[1], 0xffff);
+
+    // An offset that takes the next index past 0xffff is rejected.
+    uint64_t nIndexes = 2, nFirst = 0x8000, nSecond = 0x8000;
+    CDataStream stream2(SER_NETWORK, PROTOCOL_VERSION);
+    stream2 << req0.blockhash << COMPACTSIZE(nIndexes) << COMPACTSIZE(nFirst) << COMPACTSIZE(nSecond);
+    BlockTransactionsRequest req2;
+    BOOST_CHECK_THROW(stream2 >> req2, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
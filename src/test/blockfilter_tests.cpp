@@ -0,0 +1,173 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockfilter.h"
+#include "hash.h"
+#include "primitives/block.h"
+#include "random.h"
+#include "script/script.h"
+#include "undo.h"
+
+#include "test/test_bitcoin.h"
+
+#include <ios>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilter_tests, BasicTestingSetup)
+
+static GCSFilter::Element RandomElement()
+{
+    uint256 hash = GetRandHash();
+    return GCSFilter::Element(hash.begin(), hash.end());
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_test)
+{
+    GCSFilter::ElementSet included, excluded;
+    for (int i = 0; i < 100; i++) {
+        included.insert(RandomElement());
+        excluded.insert(RandomElement());
+    }
+
+    GCSFilter::Params params(0, 0, 10, 1 << 10);
+    GCSFilter filter(params, included);
+    BOOST_CHECK_EQUAL(filter.GetN(), 100U);
+    for (const GCSFilter::Element& element : included) {
+        BOOST_CHECK(filter.Match(element));
+        // A set matches if any of its elements does.
+        GCSFilter::ElementSet query = excluded;
+        query.insert(element);
+        BOOST_CHECK(filter.MatchAny(query));
+    }
+
+    // With M = 2^10, about one in ten sets of 100 elements has a false
+    // positive, so a few are allowed.
+    size_t nFalsePositives = 0;
+    for (const GCSFilter::Element& element : excluded) {
+        nFalsePositives += filter.Match(element);
+    }
+    BOOST_CHECK(nFalsePositives < 5);
+
+    // The encoding decodes to the same filter.
+    GCSFilter decoded(params, filter.GetEncoded());
+    BOOST_CHECK_EQUAL(decoded.GetN(), filter.GetN());
+    BOOST_CHECK(decoded.GetEncoded() == filter.GetEncoded());
+    for (const GCSFilter::Element& element : included) {
+        BOOST_CHECK(decoded.Match(element));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(gcsfilter_empty_and_malformed)
+{
+    GCSFilter::Params params(0, 0, 10, 1 << 10);
+    GCSFilter empty(params, GCSFilter::ElementSet());
+    BOOST_CHECK_EQUAL(empty.GetN(), 0U);
+    BOOST_CHECK_EQUAL(empty.GetEncoded().size(), 1U);
+    BOOST_CHECK(!empty.Match(RandomElement()));
+
+    GCSFilter::ElementSet elements;
+    for (int i = 0; i < 10; i++) {
+        elements.insert(RandomElement());
+    }
+    std::vector<unsigned char> encoded = GCSFilter(params, elements).GetEncoded();
+
+    // Truncated data, trailing data, and a count beyond the data are all
+    // rejected.
+    std::vector<unsigned char> truncated(encoded.begin(), encoded.end() - 1);
+    BOOST_CHECK_THROW(GCSFilter filter(params, truncated), std::ios_base::failure);
+    std::vector<unsigned char> extended = encoded;
+    extended.push_back(0);
+    BOOST_CHECK_THROW(GCSFilter filter(params, extended), std::ios_base::failure);
+    std::vector<unsigned char> miscounted = encoded;
+    miscounted[0] = 100;
+    BOOST_CHECK_THROW(GCSFilter filter(params, miscounted), std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_basic_test)
+{
+    CScript included_scripts[5], excluded_scripts[3];
+
+    // Output scripts of the block.
+    included_scripts[0] << std::vector<unsigned char>(65, 0) << OP_CHECKSIG;
+    included_scripts[1] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    included_scripts[2] << OP_HASH160 << std::vector<unsigned char>(20, 2) << OP_EQUAL;
+    // Scripts of the outputs the block spends.
+    included_scripts[3] << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 3) << OP_EQUALVERIFY << OP_CHECKSIG;
+    included_scripts[4] << OP_HASH160 << std::vector<unsigned char>(20, 4) << OP_EQUAL;
+
+    // OP_RETURN outputs, and the inputs' scriptSigs, are left out.
+    excluded_scripts[0] << OP_RETURN << OP_4 << OP_ADD << OP_8 << OP_EQUAL;
+    excluded_scripts[1] << std::vector<unsigned char>(33, 5) << OP_CHECKSIG;
+    excluded_scripts[2] << OP_0 << std::vector<unsigned char>(32, 6);
+
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << OP_0 << OP_0;
+    coinbase.vout.resize(2);
+    coinbase.vout[0].scriptPubKey = included_scripts[0];
+    coinbase.vout[1].scriptPubKey = excluded_scripts[0];
+
+    CMutableTransaction tx;
+    tx.vin.resize(2);
+    tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    tx.vin[0].scriptSig = excluded_scripts[1];
+    tx.vin[1].prevout = COutPoint(GetRandHash(), 1);
+    tx.vin[1].scriptSig = excluded_scripts[2];
+    tx.vout.resize(3);
+    tx.vout[0].scriptPubKey = included_scripts[1];
+    tx.vout[1].scriptPubKey = included_scripts[2];
+    // Empty scripts are left out too.
+    tx.vout[2].scriptPubKey = CScript();
+
+    CBlock block;
+    block.hashPrevBlock = GetRandHash();
+    block.vtx.push_back(coinbase);
+    block.vtx.push_back(tx);
+
+    CBlockUndo block_undo;
+    block_undo.vtxundo.emplace_back();
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(100, included_scripts[3]), 1000, true);
+    block_undo.vtxundo.back().vprevout.emplace_back(CTxOut(200, included_scripts[4]), 10000, false);
+
+    BlockFilter block_filter(BlockFilterType::BASIC, block, block_undo);
+    BOOST_CHECK(block_filter.GetBlockHash() == block.GetHash());
+    const GCSFilter& filter = block_filter.GetFilter();
+    BOOST_CHECK_EQUAL(filter.GetN(), 5U);
+    for (const CScript& script : included_scripts) {
+        BOOST_CHECK(filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+    for (const CScript& script : excluded_scripts) {
+        BOOST_CHECK(!filter.Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+
+    // The filter is reconstructed from its encoding and the block hash.
+    BlockFilter decoded(BlockFilterType::BASIC, block.GetHash(), block_filter.GetEncodedFilter());
+    BOOST_CHECK(decoded.GetHash() == block_filter.GetHash());
+    for (const CScript& script : included_scripts) {
+        BOOST_CHECK(decoded.GetFilter().Match(GCSFilter::Element(script.begin(), script.end())));
+    }
+
+    // The filter header commits to the filter hash and the previous header.
+    uint256 prev_header = GetRandHash();
+    uint256 filter_hash = block_filter.GetHash();
+    BOOST_CHECK(block_filter.ComputeHeader(prev_header) ==
+                Hash(filter_hash.begin(), filter_hash.end(), prev_header.begin(), prev_header.end()));
+    CBlockFilterIndexValue value(block_filter, prev_header);
+    BOOST_CHECK(value.filter == block_filter.GetEncodedFilter());
+    BOOST_CHECK(value.hash == filter_hash);
+    BOOST_CHECK(value.header == block_filter.ComputeHeader(prev_header));
+}
+
+BOOST_AUTO_TEST_CASE(blockfilter_type_names)
+{
+    BlockFilterType filter_type;
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(BlockFilterType::BASIC), "basic");
+    BOOST_CHECK_EQUAL(BlockFilterTypeName(BlockFilterType::INVALID), "");
+    BOOST_CHECK(BlockFilterTypeByName("basic", filter_type));
+    BOOST_CHECK(filter_type == BlockFilterType::BASIC);
+    BOOST_CHECK(!BlockFilterTypeByName("unknown", filter_type));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,64 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "blockpack.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "primitives/block.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockpack_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(pack_and_read)
+{
+    const CMessageHeader::MessageStartChars& messageStart = Params().MessageStart();
+    fs::path pathBlocks = pathTemp / "blk00000.dat";
+    fs::path pathPacked = pathTemp / "pak00000.dat";
+
+    // Write two blocks in the format of block files.
+    std::vector<std::vector<unsigned char>> vData;
+    std::vector<unsigned int> vPositions;
+    {
+        CAutoFile file(fsbridge::fopen(pathBlocks, "wb"), SER_DISK, CLIENT_VERSION);
+        for (uint32_t nTime = 1; nTime <= 2; nTime++) {
+            CBlock block;
+            block.nTime = nTime;
+            block.nSolution.resize(1344, nTime);
+            CDataStream ss(SER_DISK, CLIENT_VERSION);
+            ss << block;
+            vData.emplace_back(ss.begin(), ss.end());
+            file << FLATDATA(messageStart) << (unsigned int)ss.size();
+            vPositions.push_back(ftell(file.Get()));
+            file.write((const char*)vData.back().data(), vData.back().size());
+        }
+    }
+
+    // The positions need not be in order, and may repeat.
+    BOOST_CHECK(CPackedBlockFile::Pack(pathBlocks, {vPositions[1], vPositions[0], vPositions[1]}, messageStart, pathPacked));
+    BOOST_CHECK(!fs::exists(pathTemp / "pak00000.dat.tmp"));
+    std::unique_ptr<CPackedBlockFile> packed = CPackedBlockFile::Open(pathPacked);
+    BOOST_REQUIRE(packed);
+    BOOST_CHECK_EQUAL(packed->GetBlocks().size(), 2);
+    BOOST_CHECK(fs::file_size(pathPacked) < fs::file_size(pathBlocks));
+
+    std::vector<unsigned char> data;
+    for (size_t i = 0; i < vPositions.size(); i++) {
+        BOOST_CHECK(packed->Read(vPositions[i], data));
+        BOOST_CHECK(data == vData[i]);
+    }
+    BOOST_CHECK(!packed->Read(vPositions[0] + 1, data));
+
+    // A position without a block is not packed.
+    BOOST_CHECK(!CPackedBlockFile::Pack(pathBlocks, {vPositions[0] + 1}, messageStart, pathTemp / "pak00001.dat"));
+    BOOST_CHECK(!fs::exists(pathTemp / "pak00001.dat"));
+
+    // Other files are not opened as packed files.
+    BOOST_CHECK(!CPackedBlockFile::Open(pathBlocks));
+    BOOST_CHECK(!CPackedBlockFile::Open(pathTemp / "pak00002.dat"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,167 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "arith_uint256.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "consensus/upgrades.h"
+#include "consensus/validation.h"
+#include "main.h"
+#include "random.h"
+#include "script/interpreter.h"
+#include "util/time.h"
+#include "validationinterface.h"
+#include "zcash/IncrementalMerkleTree.hpp"
+#include "zcash/Proof.hpp"
+
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+#include <rust/ed25519.h>
+
+#ifdef ENABLE_MINING
+namespace {
+
+/**
+ * Stops assuming blocks are valid once the block before the one under test
+ * has been checked, that is after the block under test has been prechecked
+ * and before it is connected.
+ */
+class AssumeValidResetter : public CValidationInterface
+{
+public:
+    uint256 hashBefore;
+    uint256 hashChecked;
+    std::string strCheckedReason;
+
+protected:
+    void BlockChecked(const CBlock& block, const CValidationState& state) override {
+        if (block.GetHash() == hashBefore) {
+            hashAssumeValid.SetNull();
+        } else if (block.GetHash() == hashChecked) {
+            strCheckedReason = state.GetRejectReason();
+        }
+    }
+};
+
+/** A transaction with a single JoinSplit whose proof is not valid. */
+CMutableTransaction InvalidProofJoinSplitTransaction(uint32_t consensusBranchId)
+{
+    CMutableTransaction mtx;
+    mtx.fOverwintered = true;
+    mtx.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    mtx.nVersion = SAPLING_TX_VERSION;
+
+    Ed25519SigningKey joinSplitPrivKey;
+    ed25519_generate_keypair(&joinSplitPrivKey, &mtx.joinSplitPubKey);
+
+    mtx.vJoinSplit.push_back(JSDescription());
+    JSDescription& jsdesc = mtx.vJoinSplit[0];
+    jsdesc.anchor = SproutMerkleTree::empty_root();
+    jsdesc.nullifiers[0] = GetRandHash();
+    jsdesc.nullifiers[1] = GetRandHash();
+    jsdesc.commitments[0] = GetRandHash();
+    jsdesc.commitments[1] = GetRandHash();
+    jsdesc.proof = libzcash::GrothProof();
+
+    CTransaction signTx(mtx);
+    std::vector<CTxOut> allPrevOutputs;
+    const PrecomputedTransactionData txdata(signTx, allPrevOutputs);
+    uint256 dataToBeSigned = SignatureHash(CScript(), signTx, NOT_AN_INPUT, SIGHASH_ALL, 0, consensusBranchId, txdata);
+    assert(ed25519_sign(
+        &joinSplitPrivKey,
+        dataToBeSigned.begin(), 32,
+        &mtx.joinSplitSig));
+    return mtx;
+}
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(blockprecheck_tests, TestChain100Setup)
+
+BOOST_AUTO_TEST_CASE(precheck_without_proofs_is_not_used_for_proof_checks)
+{
+    const CChainParams& chainparams = Params();
+    int nActivationHeight = chainActive.Height() + 1;
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, nActivationHeight);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, nActivationHeight);
+
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CBlock block1 = CreateAndProcessBlock({}, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block1.GetHash());
+
+    // A block whose only flaw is the Sprout proof, so it is only rejected
+    // when proofs are checked.
+    uint32_t consensusBranchId = CurrentEpochBranchId(nActivationHeight + 1, chainparams.GetConsensus());
+    CBlock block2 = CreateAndProcessBlock({InvalidProofJoinSplitTransaction(consensusBranchId)}, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block1.GetHash());
+
+    CBlockIndex* pindex1;
+    CBlockIndex* pindex2;
+    {
+        LOCK(cs_main);
+        pindex1 = mapBlockIndex[block1.GetHash()];
+        pindex2 = mapBlockIndex[block2.GetHash()];
+        BOOST_CHECK(pindex2->nStatus & BLOCK_FAILED_MASK);
+    }
+
+    // A best header far enough ahead of block 2 for it to be assumed valid.
+    uint256 hashFakeHeader = GetRandHash();
+    CBlockIndex fakeHeader;
+    fakeHeader.phashBlock = &hashFakeHeader;
+    fakeHeader.pprev = pindex2;
+    fakeHeader.nHeight = pindex2->nHeight + 1;
+    fakeHeader.nBits = pindex2->nBits;
+    fakeHeader.nChainWork = pindex2->nChainWork + GetBlockProof(*pindex2) * 100000;
+    fakeHeader.BuildSkip();
+
+    bool fPipelineBlockConnectBefore = fPipelineBlockConnect;
+    CBlockIndex* pindexBestHeaderBefore = pindexBestHeader;
+    AssumeValidResetter resetter;
+    resetter.hashBefore = block1.GetHash();
+    resetter.hashChecked = block2.GetHash();
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(InvalidateBlock(state, chainparams, pindex1));
+        BOOST_CHECK(chainActive.Tip() == pindex1->pprev);
+        BOOST_CHECK(ReconsiderBlock(state, pindex1));
+
+        // Connect blocks 1 and 2 through the pipeline, so that block 2 is
+        // prechecked while block 1 is being connected, with block 2 assumed
+        // valid. It is no longer assumed valid by the time it is connected.
+        fPipelineBlockConnect = true;
+        TestSetIBD(true);
+        SetMockTime(GetTime() + 2 * 24 * 60 * 60);
+        hashAssumeValid = block2.GetHash();
+        pindexBestHeader = &fakeHeader;
+    }
+    RegisterValidationInterface(&resetter);
+
+    CValidationState state;
+    BOOST_CHECK(ActivateBestChain(state, chainparams));
+
+    UnregisterValidationInterface(&resetter);
+    {
+        LOCK(cs_main);
+        pindexBestHeader = pindexBestHeaderBefore;
+        hashAssumeValid.SetNull();
+        SetMockTime(0);
+        TestSetIBD(false);
+        fPipelineBlockConnect = fPipelineBlockConnectBefore;
+
+        // The precheck of block 2 skipped its proofs, so it was checked again
+        // with them, and rejected.
+        BOOST_CHECK_EQUAL(resetter.strCheckedReason, "bad-txns-joinsplit-verification-failed");
+        BOOST_CHECK(chainActive.Tip() == pindex1);
+        BOOST_CHECK(pindex2->nStatus & BLOCK_FAILED_MASK);
+    }
+
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_SAPLING, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+    UpdateNetworkUpgradeParameters(Consensus::UPGRADE_OVERWINTER, Consensus::NetworkUpgrade::NO_ACTIVATION_HEIGHT);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+#endif // ENABLE_MINING
@@ -134,20 +134,16 @@ std::unordered_multiset<size_t> UniqueCheck::results;
 std::atomic<size_t> FakeCheckCheckCompletion::n_calls{0};
 std::atomic<size_t> MemoryCheck::fake_allocated_memory{0};
 
-// Queue Typedefs
-typedef CCheckQueue<FakeCheckCheckCompletion> Correct_Queue;
-typedef CCheckQueue<FakeCheck> Standard_Queue;
-typedef CCheckQueue<FailingCheck> Failing_Queue;
-typedef CCheckQueue<UniqueCheck> Unique_Queue;
-typedef CCheckQueue<MemoryCheck> Memory_Queue;
-typedef CCheckQueue<FrozenCleanupCheck> FrozenCleanup_Queue;
-
+// Each test is run against both CCheckQueue and CWorkStealingCheckQueue, as
+// the Queue template parameter.
 
 /** This test case checks that the CCheckQueue works properly
  * with each specified size_t Checks pushed.
  */
+template <template <typename> class Queue>
 void Correct_Queue_range(std::vector<size_t> range)
 {
+    typedef Queue<FakeCheckCheckCompletion> Correct_Queue;
     auto small_queue = std::unique_ptr<Correct_Queue>(new Correct_Queue {QUEUE_BATCH_SIZE});
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
@@ -158,7 +154,7 @@ void Correct_Queue_range(std::vector<size_t> range)
     for (auto i : range) {
         size_t total = i;
         FakeCheckCheckCompletion::n_calls = 0;
-        CCheckQueueControl<FakeCheckCheckCompletion> control(small_queue.get());
+        CCheckQueueControl<FakeCheckCheckCompletion, Correct_Queue> control(small_queue.get());
         while (total) {
             vChecks.resize(std::min(total, (size_t) GetRand(10)));
             total -= vChecks.size();
@@ -180,7 +176,8 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Zero)
 {
     std::vector<size_t> range;
     range.push_back((size_t)0);
-    Correct_Queue_range(range);
+    Correct_Queue_range<CCheckQueue>(range);
+    Correct_Queue_range<CWorkStealingCheckQueue>(range);
 }
 /** Test that 1 check is correct
  */
@@ -188,7 +185,8 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_One)
 {
     std::vector<size_t> range;
     range.push_back((size_t)1);
-    Correct_Queue_range(range);
+    Correct_Queue_range<CCheckQueue>(range);
+    Correct_Queue_range<CWorkStealingCheckQueue>(range);
 }
 /** Test that MAX check is correct
  */
@@ -196,7 +194,8 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Max)
 {
     std::vector<size_t> range;
     range.push_back(100000);
-    Correct_Queue_range(range);
+    Correct_Queue_range<CCheckQueue>(range);
+    Correct_Queue_range<CWorkStealingCheckQueue>(range);
 }
 /** Test that random numbers of checks are correct
  */
@@ -206,13 +205,16 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Correct_Random)
     range.reserve(100000/1000);
     for (size_t i = 2; i < 100000; i += std::max((size_t)1, (size_t)GetRand(std::min((size_t)1000, ((size_t)100000) - i))))
         range.push_back(i);
-    Correct_Queue_range(range);
+    Correct_Queue_range<CCheckQueue>(range);
+    Correct_Queue_range<CWorkStealingCheckQueue>(range);
 }
 
 
 /** Test that failing checks are caught */
-BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
+template <template <typename> class Queue>
+static void CheckQueue_Catches_Failure()
 {
+    typedef Queue<FailingCheck> Failing_Queue;
     auto fail_queue = std::unique_ptr<Failing_Queue>(new Failing_Queue {QUEUE_BATCH_SIZE});
 
     boost::thread_group tg;
@@ -221,7 +223,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
     }
 
     for (size_t i = 0; i < 1001; ++i) {
-        CCheckQueueControl<FailingCheck> control(fail_queue.get());
+        CCheckQueueControl<FailingCheck, Failing_Queue> control(fail_queue.get());
         size_t remaining = i;
         while (remaining) {
             size_t r = GetRand(10);
@@ -242,10 +244,18 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
     tg.interrupt_all();
     tg.join_all();
 }
+
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Catches_Failure)
+{
+    CheckQueue_Catches_Failure<CCheckQueue>();
+    CheckQueue_Catches_Failure<CWorkStealingCheckQueue>();
+}
 // Test that a block validation which fails does not interfere with
 // future blocks, ie, the bad state is cleared.
-BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
+template <template <typename> class Queue>
+static void CheckQueue_Recovers_From_Failure()
 {
+    typedef Queue<FailingCheck> Failing_Queue;
     auto fail_queue = std::unique_ptr<Failing_Queue>(new Failing_Queue {QUEUE_BATCH_SIZE});
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
@@ -254,7 +264,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
 
     for (auto times = 0; times < 10; ++times) {
         for (bool end_fails : {true, false}) {
-            CCheckQueueControl<FailingCheck> control(fail_queue.get());
+            CCheckQueueControl<FailingCheck, Failing_Queue> control(fail_queue.get());
             {
                 std::vector<FailingCheck> vChecks;
                 vChecks.resize(100, false);
@@ -269,12 +279,21 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
     tg.join_all();
 }
 
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Recovers_From_Failure)
+{
+    CheckQueue_Recovers_From_Failure<CCheckQueue>();
+    CheckQueue_Recovers_From_Failure<CWorkStealingCheckQueue>();
+}
+
 // Test that unique checks are actually all called individually, rather than
 // just one check being called repeatedly. Test that checks are not called
 // more than once as well
-BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
+template <template <typename> class Queue>
+static void CheckQueue_UniqueCheck()
 {
+    typedef Queue<UniqueCheck> Unique_Queue;
     auto queue = std::unique_ptr<Unique_Queue>(new Unique_Queue {QUEUE_BATCH_SIZE});
+    UniqueCheck::results.clear();
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
        tg.create_thread([&]{queue->Thread();});
@@ -284,7 +303,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
     size_t COUNT = 100000;
     size_t total = COUNT;
     {
-        CCheckQueueControl<UniqueCheck> control(queue.get());
+        CCheckQueueControl<UniqueCheck, Unique_Queue> control(queue.get());
         while (total) {
             size_t r = GetRand(10);
             std::vector<UniqueCheck> vChecks;
@@ -302,14 +321,22 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
     tg.join_all();
 }
 
+BOOST_AUTO_TEST_CASE(test_CheckQueue_UniqueCheck)
+{
+    CheckQueue_UniqueCheck<CCheckQueue>();
+    CheckQueue_UniqueCheck<CWorkStealingCheckQueue>();
+}
+
 
 // Test that blocks which might allocate lots of memory free their memory aggressively.
 //
 // This test attempts to catch a pathological case where by lazily freeing
 // checks might mean leaving a check un-swapped out, and decreasing by 1 each
 // time could leave the data hanging across a sequence of blocks.
-BOOST_AUTO_TEST_CASE(test_CheckQueue_Memory)
+template <template <typename> class Queue>
+static void CheckQueue_Memory()
 {
+    typedef Queue<MemoryCheck> Memory_Queue;
     auto queue = std::unique_ptr<Memory_Queue>(new Memory_Queue {QUEUE_BATCH_SIZE});
     boost::thread_group tg;
     for (auto x = 0; x < nScriptCheckThreads; ++x) {
@@ -318,7 +345,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Memory)
     for (size_t i = 0; i < 1000; ++i) {
         size_t total = i;
         {
-            CCheckQueueControl<MemoryCheck> control(queue.get());
+            CCheckQueueControl<MemoryCheck, Memory_Queue> control(queue.get());
             while (total) {
                 size_t r = GetRand(10);
                 std::vector<MemoryCheck> vChecks;
@@ -337,10 +364,18 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_Memory)
     tg.join_all();
 }
 
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Memory)
+{
+    CheckQueue_Memory<CCheckQueue>();
+    CheckQueue_Memory<CWorkStealingCheckQueue>();
+}
+
 // Test that a new verification cannot occur until all checks 
 // have been destructed
-BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
+template <template <typename> class Queue>
+static void CheckQueue_FrozenCleanup()
 {
+    typedef Queue<FrozenCleanupCheck> FrozenCleanup_Queue;
     auto queue = std::unique_ptr<FrozenCleanup_Queue>(new FrozenCleanup_Queue {QUEUE_BATCH_SIZE});
     boost::thread_group tg;
     bool fails = false;
@@ -348,7 +383,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
         tg.create_thread([&]{queue->Thread();});
     }
     std::thread t0([&]() {
-        CCheckQueueControl<FrozenCleanupCheck> control(queue.get());
+        CCheckQueueControl<FrozenCleanupCheck, FrozenCleanup_Queue> control(queue.get());
         std::vector<FrozenCleanupCheck> vChecks(1);
         // Freezing can't be the default initialized behavior given how the queue
         // swaps in default initialized Checks (otherwise freezing destructor
@@ -377,10 +412,18 @@ BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
     BOOST_REQUIRE(!fails);
 }
 
+BOOST_AUTO_TEST_CASE(test_CheckQueue_FrozenCleanup)
+{
+    CheckQueue_FrozenCleanup<CCheckQueue>();
+    CheckQueue_FrozenCleanup<CWorkStealingCheckQueue>();
+}
+
 
 /** Test that CCheckQueueControl is threadsafe */
-BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Locks)
+template <template <typename> class Queue>
+static void CheckQueueControl_Locks()
 {
+    typedef Queue<FakeCheck> Standard_Queue;
     auto queue = std::unique_ptr<Standard_Queue>(new Standard_Queue{QUEUE_BATCH_SIZE});
     {
         boost::thread_group tg;
@@ -389,7 +432,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Locks)
         for (size_t i = 0; i < 3; ++i) {
             tg.create_thread(
                     [&]{
-                    CCheckQueueControl<FakeCheck> control(queue.get());
+                    CCheckQueueControl<FakeCheck, Standard_Queue> control(queue.get());
                     // While sleeping, no other thread should execute to this point
                     auto observed = ++nThreads;
                     MilliSleep(10);
@@ -410,7 +453,7 @@ BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Locks)
         {
             std::unique_lock<std::mutex> l(m);
             tg.create_thread([&]{
-                    CCheckQueueControl<FakeCheck> control(queue.get());
+                    CCheckQueueControl<FakeCheck, Standard_Queue> control(queue.get());
                     std::unique_lock<std::mutex> l(m);
                     has_lock = true;
                     cv.notify_one();
@@ -438,5 +481,45 @@ BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Locks)
         tg.join_all();
     }
 }
+
+BOOST_AUTO_TEST_CASE(test_CheckQueueControl_Locks)
+{
+    CheckQueueControl_Locks<CCheckQueue>();
+    CheckQueueControl_Locks<CWorkStealingCheckQueue>();
+}
+
+/** Test that the stats of each wait cover the checks added since the last one */
+template <template <typename> class Queue>
+static void CheckQueue_Stats()
+{
+    typedef Queue<FakeCheck> Standard_Queue;
+    auto queue = std::unique_ptr<Standard_Queue>(new Standard_Queue{QUEUE_BATCH_SIZE});
+    boost::thread_group tg;
+    for (auto x = 0; x < nScriptCheckThreads; ++x) {
+        tg.create_thread([&]{queue->Thread();});
+    }
+
+    for (size_t nChecks : {0, 1, 1000}) {
+        CCheckQueueControl<FakeCheck, Standard_Queue> control(queue.get());
+        std::vector<FakeCheck> vChecks(nChecks);
+        control.Add(vChecks);
+        CCheckQueueStats stats;
+        BOOST_REQUIRE(control.Wait(&stats));
+        BOOST_CHECK_EQUAL(stats.nChecks, nChecks);
+        BOOST_CHECK(stats.nBatches <= nChecks);
+        BOOST_CHECK(nChecks == 0 || stats.nBatches >= (nChecks + QUEUE_BATCH_SIZE - 1) / QUEUE_BATCH_SIZE);
+        BOOST_CHECK(stats.nWorkers >= 1 && stats.nWorkers <= nScriptCheckThreads + 1);
+        BOOST_CHECK(stats.nBusyMicros >= 0);
+        BOOST_CHECK(stats.nMasterWaitMicros >= 0);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(test_CheckQueue_Stats)
+{
+    CheckQueue_Stats<CCheckQueue>();
+    CheckQueue_Stats<CWorkStealingCheckQueue>();
+}
 BOOST_AUTO_TEST_SUITE_END()
 
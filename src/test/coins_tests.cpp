@@ -11,6 +11,7 @@
 #include "test/test_bitcoin.h"
 #include "consensus/validation.h"
 #include "main.h"
+#include "txdb.h"
 #include "undo.h"
 #include "primitives/transaction.h"
 #include "pubkey.h"
@@ -26,13 +27,22 @@
 
 namespace
 {
+//! equality test
+bool operator==(const Coin &a, const Coin &b) {
+    // Empty Coin objects are always equal.
+    if (a.IsSpent() && b.IsSpent()) return true;
+    return a.fCoinBase == b.fCoinBase &&
+           a.nHeight == b.nHeight &&
+           a.out == b.out;
+}
+
 class CCoinsViewTest : public CCoinsView
 {
     uint256 hashBestBlock_;
     uint256 hashBestSproutAnchor_;
     uint256 hashBestSaplingAnchor_;
     uint256 hashBestOrchardAnchor_;
-    std::map<uint256, CCoins> map_;
+    std::map<COutPoint, Coin> map_;
     std::map<uint256, SproutMerkleTree> mapSproutAnchors_;
     std::map<uint256, SaplingMerkleTree> mapSaplingAnchors_;
     std::map<uint256, OrchardMerkleFrontier> mapOrchardAnchors_;
@@ -137,24 +147,24 @@ public:
         }
     }
 
-    bool GetCoins(const uint256& txid, CCoins& coins) const
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const
     {
-        std::map<uint256, CCoins>::const_iterator it = map_.find(txid);
+        std::map<COutPoint, Coin>::const_iterator it = map_.find(outpoint);
         if (it == map_.end()) {
             return false;
         }
-        coins = it->second;
-        if (coins.IsPruned() && insecure_rand() % 2 == 0) {
+        coin = it->second;
+        if (coin.IsSpent() && insecure_rand() % 2 == 0) {
             // Randomly return false in case of an empty entry.
             return false;
         }
         return true;
     }
 
-    bool HaveCoins(const uint256& txid) const
+    bool HaveCoin(const COutPoint& outpoint) const
     {
-        CCoins coins;
-        return GetCoins(txid, coins);
+        Coin coin;
+        return GetCoin(outpoint, coin);
     }
 
     uint256 GetBestBlock() const { return hashBestBlock_; }
@@ -209,8 +219,8 @@ public:
         for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end(); ) {
             if (it->second.flags & CCoinsCacheEntry::DIRTY) {
                 // Same optimization used in CCoinsViewDB is to only write dirty entries.
-                map_[it->first] = it->second.coins;
-                if (it->second.coins.IsPruned() && insecure_rand() % 3 == 0) {
+                map_[it->first] = it->second.coin;
+                if (it->second.coin.IsSpent() && insecure_rand() % 3 == 0) {
                     // Randomly delete empty entries on write.
                     map_.erase(it->first);
                 }
@@ -257,7 +267,7 @@ public:
                      memusage::DynamicUsage(cacheOrchardNullifiers) +
                      memusage::DynamicUsage(historyCacheMap);
         for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end(); it++) {
-            ret += it->second.coins.DynamicMemoryUsage();
+            ret += it->second.coin.DynamicMemoryUsage();
         }
         BOOST_CHECK_EQUAL(DynamicMemoryUsage(), ret);
     }
@@ -434,7 +444,7 @@ static const unsigned int NUM_SIMULATION_ITERATIONS = 40000;
 // This is a large randomized insert/remove simulation test on a variable-size
 // stack of caches on top of CCoinsViewTest.
 //
-// It will randomly create/update/delete CCoins entries to a tip of caches, with
+// It will randomly create/update/delete Coin entries to a tip of caches, with
 // txids picked from a limited list of random 256-bit hashes. Occasionally, a
 // new tip is added to the stack of caches, or the tip is flushed and removed.
 //
@@ -446,13 +456,15 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     bool removed_all_caches = false;
     bool reached_4_caches = false;
     bool added_an_entry = false;
+    bool added_an_unspendable_entry = false;
     bool removed_an_entry = false;
     bool updated_an_entry = false;
     bool found_an_entry = false;
     bool missed_an_entry = false;
+    bool uncached_an_entry = false;
 
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -470,36 +482,52 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
         // Do a random modification.
         {
             uint256 txid = txids[insecure_rand() % txids.size()]; // txid we're going to modify in this iteration.
-            CCoins& coins = result[txid];
-            CCoinsModifier entry = stack.back()->ModifyCoins(txid);
-            BOOST_CHECK(coins == *entry);
-            if (insecure_rand() % 5 == 0 || coins.IsPruned()) {
-                if (coins.IsPruned()) {
-                    added_an_entry = true;
+            Coin& coin = result[COutPoint(txid, 0)];
+            const Coin& entry = (insecure_rand() % 500 == 0) ? AccessByTxid(*stack.back(), txid) : stack.back()->AccessCoin(COutPoint(txid, 0));
+            BOOST_CHECK(coin == entry);
+
+            if (insecure_rand() % 5 == 0 || coin.IsSpent()) {
+                Coin newcoin;
+                newcoin.out.nValue = insecure_rand();
+                newcoin.nHeight = 1;
+                if (insecure_rand() % 16 == 0 && coin.IsSpent()) {
+                    newcoin.out.scriptPubKey.assign(1 + (insecure_rand() & 0x3F), OP_RETURN);
+                    BOOST_CHECK(newcoin.out.scriptPubKey.IsUnspendable());
+                    added_an_unspendable_entry = true;
                 } else {
-                    updated_an_entry = true;
+                    // Random sizes so we can test memory usage accounting
+                    newcoin.out.scriptPubKey.assign(insecure_rand() & 0x3F, 0);
+                    (coin.IsSpent() ? added_an_entry : updated_an_entry) = true;
+                    coin = newcoin;
                 }
-                coins.nVersion = insecure_rand();
-                coins.vout.resize(1);
-                coins.vout[0].nValue = insecure_rand();
-                *entry = coins;
+                stack.back()->AddCoin(COutPoint(txid, 0), std::move(newcoin), !coin.IsSpent() || insecure_rand() & 1);
             } else {
-                coins.Clear();
-                entry->Clear();
                 removed_an_entry = true;
+                coin.Clear();
+                stack.back()->SpendCoin(COutPoint(txid, 0));
             }
         }
 
+        // Once every 10 iterations, remove a random entry from the cache.
+        if (insecure_rand() % 10 == 0) {
+            COutPoint out(txids[insecure_rand() % txids.size()], 0);
+            int cacheid = insecure_rand() % stack.size();
+            stack[cacheid]->Uncache(out);
+            uncached_an_entry |= !stack[cacheid]->HaveCoinInCache(out);
+        }
+
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                    found_an_entry = true;
-                } else {
-                    BOOST_CHECK(it->second.IsPruned());
+            for (auto it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
+                if (coin.IsSpent()) {
                     missed_an_entry = true;
+                } else {
+                    BOOST_CHECK(stack.back()->HaveCoinInCache(it->first));
+                    found_an_entry = true;
                 }
             }
             for (const CCoinsViewCacheTest *test : stack) {
@@ -539,10 +567,12 @@ BOOST_AUTO_TEST_CASE(coins_cache_simulation_test)
     BOOST_CHECK(removed_all_caches);
     BOOST_CHECK(reached_4_caches);
     BOOST_CHECK(added_an_entry);
+    BOOST_CHECK(added_an_unspendable_entry);
     BOOST_CHECK(removed_an_entry);
     BOOST_CHECK(updated_an_entry);
     BOOST_CHECK(found_an_entry);
     BOOST_CHECK(missed_an_entry);
+    BOOST_CHECK(uncached_an_entry);
 }
 
 BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
@@ -589,13 +619,64 @@ BOOST_AUTO_TEST_CASE(coins_coinbase_spends)
     }
 }
 
+BOOST_AUTO_TEST_CASE(coins_flush_into_empty_parent)
+{
+    CCoinsViewTest base;
+    COutPoint spent(GetRandHash(), 0);
+    {
+        CCoinsViewCacheTest cache(&base);
+        Coin coin;
+        coin.out.nValue = 100;
+        coin.out.scriptPubKey = CScript() << OP_TRUE;
+        cache.AddCoin(spent, std::move(coin), false);
+        BOOST_CHECK(cache.Flush());
+    }
+
+    // A child with a spend of a coin from the base, a new coin, an entry
+    // that was only read, and a nullifier, flushed into a parent that holds
+    // nothing.
+    CCoinsViewCacheTest parent(&base);
+    COutPoint added(GetRandHash(), 1);
+    COutPoint read(GetRandHash(), 2);
+    TxWithNullifiers txWithNullifiers;
+    {
+        CCoinsViewCacheTest child(&parent);
+        BOOST_CHECK(child.SpendCoin(spent));
+        Coin coin;
+        coin.out.nValue = 200;
+        coin.out.scriptPubKey = CScript() << OP_TRUE;
+        child.AddCoin(added, std::move(coin), false);
+        BOOST_CHECK(!child.HaveCoin(read));
+        child.SetNullifiers(txWithNullifiers.tx, true);
+        // The parent's FetchCoin cached the spent coin; start it over empty.
+        parent.Uncache(spent);
+        BOOST_CHECK_EQUAL(parent.GetCacheSize(), 0U);
+        child.SelfTest();
+        BOOST_CHECK(child.Flush());
+        BOOST_CHECK_EQUAL(child.GetCacheSize(), 0U);
+    }
+
+    // The parent has the entries a merge would have given it.
+    BOOST_CHECK_EQUAL(parent.GetCacheSize(), 2U);
+    BOOST_CHECK(parent.HaveCoinInCache(added));
+    BOOST_CHECK(!parent.HaveCoinInCache(spent));
+    BOOST_CHECK(parent.GetNullifier(txWithNullifiers.saplingNullifier, SAPLING));
+    parent.SelfTest();
+
+    // And writes them on to the base.
+    BOOST_CHECK(parent.Flush());
+    BOOST_CHECK(!base.HaveCoin(spent));
+    BOOST_CHECK(base.HaveCoin(added));
+    BOOST_CHECK(base.GetNullifier(txWithNullifiers.sproutNullifier, SPROUT));
+}
+
 // This test is similar to the previous test
 // except the emphasis is on testing the functionality of UpdateCoins
 // random txs are created and UpdateCoins is used to update the cache stack
 BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
 {
     // A simple map to track what we expect the cache stack to represent.
-    std::map<uint256, CCoins> result;
+    std::map<COutPoint, Coin> result;
 
     // The cache stack.
     CCoinsViewTest base; // A CCoinsViewTest at the bottom.
@@ -634,8 +715,7 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
                 tx.vin[0].prevout.n = 0;
 
                 // Update the expected result of prevouthash to know these coins are spent
-                CCoins& oldcoins = result[prevouthash];
-                oldcoins.Clear();
+                result[tx.vin[0].prevout].Clear();
 
                 alltxids.erase(prevouthash);
                 coinbaseids.erase(prevouthash);
@@ -646,21 +726,20 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
             alltxids.insert(tx.GetHash());
 
             // Update the expected result to know about the new output coins
-            CCoins &coins = result[tx.GetHash()];
-            coins.FromTx(tx, height);
+            assert(tx.vout.size() == 1);
+            const COutPoint outpoint(tx.GetHash(), 0);
+            result[outpoint] = Coin(tx.vout[0], height, CTransaction(tx).IsCoinBase());
 
             UpdateCoins(tx, *(stack.back()), height);
         }
 
         // Once every 1000 iterations and at the end, verify the full cache.
         if (insecure_rand() % 1000 == 1 || i == NUM_SIMULATION_ITERATIONS - 1) {
-            for (std::map<uint256, CCoins>::iterator it = result.begin(); it != result.end(); it++) {
-                const CCoins* coins = stack.back()->AccessCoins(it->first);
-                if (coins) {
-                    BOOST_CHECK(*coins == it->second);
-                 } else {
-                    BOOST_CHECK(it->second.IsPruned());
-                 }
+            for (auto it = result.begin(); it != result.end(); it++) {
+                bool have = stack.back()->HaveCoin(it->first);
+                const Coin& coin = stack.back()->AccessCoin(it->first);
+                BOOST_CHECK(have == !coin.IsSpent());
+                BOOST_CHECK(coin == it->second);
             }
         }
 
@@ -688,31 +767,410 @@ BOOST_AUTO_TEST_CASE(updatecoins_simulation_test)
     }
 }
 
+BOOST_FIXTURE_TEST_CASE(coins_flush_layer, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewFlushLayer layer(&db);
+    CCoinsViewCache cache(&layer);
+
+    COutPoint outpoint(GetRandHash(), 0);
+    Coin coin;
+    coin.out.nValue = 1000;
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+    coin.nHeight = 1;
+    cache.AddCoin(outpoint, std::move(coin), false);
+    uint256 hashBlock = GetRandHash();
+    cache.SetBestBlock(hashBlock);
+
+    // The flushed entries can be read through the layer whether or not the
+    // background write has finished.
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(layer.IsWriting());
+    BOOST_CHECK(cache.HaveCoin(outpoint));
+    BOOST_CHECK(layer.GetBestBlock() == hashBlock);
+    BOOST_CHECK(layer.Sync());
+    BOOST_CHECK(!layer.IsWriting());
+    BOOST_CHECK(db.HaveCoin(outpoint));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+
+    // Spend the coin on top of the layer and flush again.
+    BOOST_CHECK(cache.SpendCoin(outpoint));
+    BOOST_CHECK(cache.Flush());
+    BOOST_CHECK(!cache.HaveCoin(outpoint));
+    BOOST_CHECK(layer.Sync());
+    BOOST_CHECK(!db.HaveCoin(outpoint));
+    BOOST_CHECK(db.GetBestBlock() == hashBlock);
+}
+
+BOOST_AUTO_TEST_CASE(nullifier_filter)
+{
+    CNullifierFilter filter;
+
+    // An unbuilt filter admits everything.
+    BOOST_CHECK(filter.MayContain(GetRandHash()));
+
+    std::vector<uint256> nullifiers;
+    std::vector<uint64_t> hashes;
+    for (int i = 0; i < 1000; i++) {
+        nullifiers.push_back(GetRandHash());
+        hashes.push_back(filter.Hash(nullifiers.back()));
+    }
+    filter.Reset(hashes);
+    for (const uint256& nf : nullifiers) {
+        BOOST_CHECK(filter.MayContain(nf));
+    }
+    uint256 added = GetRandHash();
+    filter.Insert(added);
+    BOOST_CHECK(filter.MayContain(added));
+
+    // Nearly all unknown nullifiers are rejected.
+    int nFalsePositives = 0;
+    for (int i = 0; i < 10000; i++) {
+        if (filter.MayContain(GetRandHash())) {
+            nFalsePositives++;
+        }
+    }
+    BOOST_CHECK(nFalsePositives < 10);
+
+    BOOST_CHECK(!filter.IsSaturated());
+    for (size_t i = 0; i < CNullifierFilter::MIN_CAPACITY; i++) {
+        filter.Insert(GetRandHash());
+    }
+    BOOST_CHECK(filter.IsSaturated());
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_nullifier_filter, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+
+    uint256 sproutNf = GetRandHash();
+    uint256 saplingNf = GetRandHash();
+    uint256 orchardNf = GetRandHash();
+    BOOST_CHECK(!db.GetNullifier(sproutNf, SPROUT));
+    BOOST_CHECK(!db.GetNullifier(saplingNf, SAPLING));
+    BOOST_CHECK(!db.GetNullifier(orchardNf, ORCHARD));
+
+    // Nullifiers written through a cache flush can be found again, both
+    // directly and through the background flush layer.
+    CCoinsViewFlushLayer layer(&db);
+    CCoinsViewCache cache(&layer);
+    CCoinsViewCache direct(&db);
+    for (CCoinsViewCache* view : {&direct, &cache}) {
+        CMutableTransaction mtx;
+        JSDescription jsdesc;
+        jsdesc.nullifiers[0] = sproutNf;
+        mtx.vJoinSplit.push_back(jsdesc);
+        view->SetNullifiers(CTransaction(mtx), true);
+        BOOST_CHECK(view->Flush());
+        BOOST_CHECK(layer.Sync());
+        BOOST_CHECK(db.GetNullifier(sproutNf, SPROUT));
+        BOOST_CHECK(!db.GetNullifier(sproutNf, SAPLING));
+        sproutNf = GetRandHash();
+        BOOST_CHECK(!db.GetNullifier(sproutNf, SPROUT));
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_get_many, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewFlushLayer layer(&db);
+
+    std::vector<COutPoint> outpoints;
+    {
+        CCoinsViewCache cache(&layer);
+        for (uint32_t i = 0; i < 20; i++) {
+            outpoints.emplace_back(GetRandHash(), i);
+            Coin coin;
+            coin.out.nValue = 1000 + i;
+            coin.out.scriptPubKey = CScript() << OP_TRUE;
+            coin.nHeight = 1;
+            cache.AddCoin(outpoints.back(), std::move(coin), false);
+        }
+        BOOST_CHECK(cache.Flush());
+        BOOST_CHECK(layer.Sync());
+    }
+
+    // A coin spent in the cache and one that never existed are not found,
+    // and the others are returned in the order they were asked for.
+    CCoinsViewCache cache(&layer);
+    BOOST_CHECK(cache.SpendCoin(outpoints[3]));
+    std::vector<COutPoint> query(outpoints.rbegin(), outpoints.rend());
+    query.emplace_back(GetRandHash(), 0);
+    query.push_back(outpoints[0]);
+    std::vector<std::optional<Coin>> coins = cache.GetCoins(query);
+    BOOST_CHECK_EQUAL(coins.size(), query.size());
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        const std::optional<Coin>& coin = coins[outpoints.size() - 1 - i];
+        if (i == 3) {
+            BOOST_CHECK(!coin);
+        } else {
+            BOOST_CHECK(coin && coin->out.nValue == 1000 + (CAmount)i);
+        }
+    }
+    BOOST_CHECK(!coins[outpoints.size()]);
+    BOOST_CHECK(coins.back() && coins.back()->out.nValue == 1000);
+
+    // What was read is now in the cache, and reading it again agrees.
+    BOOST_CHECK(cache.HaveCoinInCache(outpoints[0]));
+    std::vector<std::optional<Coin>> direct = db.GetCoins(outpoints);
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        BOOST_CHECK(direct[i] && direct[i]->out.nValue == 1000 + (CAmount)i);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_cache_keys, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewCache cache(&db);
+
+    COutPoint unspent(GetRandHash(), 0);
+    COutPoint spent(GetRandHash(), 1);
+    for (const COutPoint& outpoint : {unspent, spent}) {
+        Coin coin;
+        coin.out.nValue = 1000;
+        coin.out.scriptPubKey = CScript() << OP_TRUE;
+        coin.nHeight = 1;
+        cache.AddCoin(outpoint, std::move(coin), false);
+    }
+    BOOST_CHECK(cache.SpendCoin(spent));
+
+    SaplingMerkleTree tree;
+    tree.append(GetRandHash());
+    cache.PushAnchor(tree);
+    CMutableTransaction mtx;
+    JSDescription jsdesc;
+    jsdesc.nullifiers[0] = GetRandHash();
+    mtx.vJoinSplit.push_back(jsdesc);
+    cache.SetNullifiers(CTransaction(mtx), true);
+
+    // Spent coins are left out, as there is nothing to look up for them.
+    CCoinsCacheKeys keys;
+    cache.GetCachedKeys(keys);
+    BOOST_CHECK(keys.coins == std::vector<COutPoint>(1, unspent));
+    BOOST_CHECK(keys.saplingAnchors == std::vector<uint256>(1, tree.root()));
+    BOOST_CHECK(keys.sproutNullifiers == std::vector<uint256>(1, jsdesc.nullifiers[0]));
+    BOOST_CHECK(keys.orchardAnchors.empty());
+
+    // Once flushed, looking the keys up again fills a new cache.
+    BOOST_CHECK(cache.Flush());
+    CCoinsViewCache warm(&db);
+    BOOST_CHECK(warm.HaveCoin(unspent));
+    SaplingMerkleTree found;
+    BOOST_CHECK(warm.GetSaplingAnchorAt(keys.saplingAnchors[0], found));
+    CCoinsCacheKeys warmKeys;
+    warm.GetCachedKeys(warmKeys);
+    BOOST_CHECK(warmKeys.coins == keys.coins);
+    BOOST_CHECK(warmKeys.saplingAnchors == keys.saplingAnchors);
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_stats, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewCache cache(&db);
+
+    // Enough coins for GetStats() to decode them in several chunks; the
+    // result must not depend on that. The coins are taken in database key
+    // order to compute the expected hash.
+    std::map<std::vector<unsigned char>, std::pair<COutPoint, CTxOut>> coins;
+    for (int i = 0; i < 3000; i++) {
+        uint256 txid = GetRandHash();
+        for (uint32_t n = 0; n < 3; n++) {
+            Coin coin;
+            coin.out.nValue = insecure_rand() % 1000000;
+            coin.out.scriptPubKey = CScript() << OP_TRUE << i;
+            coin.nHeight = 1;
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            ssKey << 'C' << txid << VARINT(n);
+            coins[std::vector<unsigned char>(ssKey.begin(), ssKey.end())] = std::make_pair(COutPoint(txid, n), coin.out);
+            cache.AddCoin(COutPoint(txid, n), std::move(coin), false);
+        }
+    }
+    uint256 hashBlock;
+    {
+        LOCK(cs_main);
+        hashBlock = chainActive.Genesis()->GetBlockHash();
+    }
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(cache.Flush());
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << hashBlock;
+    CAmount nTotalAmount = 0;
+    uint256 prevHash;
+    bool fInTransaction = false;
+    for (const auto& entry : coins) {
+        const COutPoint& outpoint = entry.second.first;
+        if (!fInTransaction || outpoint.hash != prevHash) {
+            if (fInTransaction)
+                ss << VARINT(0);
+            fInTransaction = true;
+            prevHash = outpoint.hash;
+        }
+        ss << VARINT(outpoint.n + 1);
+        ss << entry.second.second;
+        nTotalAmount += entry.second.second.nValue;
+    }
+    ss << VARINT(0);
+
+    CCoinsStats stats;
+    BOOST_CHECK(db.GetStats(stats));
+    BOOST_CHECK(stats.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(stats.nTransactions, 3000U);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, 9000U);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, nTotalAmount);
+    BOOST_CHECK(stats.hashSerialized == ss.GetHash());
+}
+
+BOOST_FIXTURE_TEST_CASE(coins_db_snapshot, TestingSetup)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    CCoinsViewCache cache(&db);
+
+    COutPoint outpoint(GetRandHash(), 0);
+    Coin coin;
+    coin.out.nValue = 1000;
+    coin.out.scriptPubKey = CScript() << OP_TRUE;
+    coin.nHeight = 1;
+    cache.AddCoin(outpoint, std::move(coin), false);
+    CMutableTransaction mtx;
+    JSDescription jsdesc;
+    jsdesc.nullifiers[0] = GetRandHash();
+    mtx.vJoinSplit.push_back(jsdesc);
+    cache.SetNullifiers(CTransaction(mtx), true);
+    uint256 hashBlock;
+    {
+        LOCK(cs_main);
+        hashBlock = chainActive.Genesis()->GetBlockHash();
+    }
+    cache.SetBestBlock(hashBlock);
+    BOOST_CHECK(cache.Flush());
+
+    fs::path path = GetDataDir() / "snapshot";
+    CCoinsSnapshotStats stats;
+    {
+        CAutoFile file(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(db.DumpSnapshot(file, stats));
+    }
+    BOOST_CHECK(stats.hashBlock == hashBlock);
+    BOOST_CHECK_EQUAL(stats.nHeight, 0);
+    BOOST_CHECK_EQUAL(stats.nCoins, 1U);
+
+    // Read the snapshot back, and check that it commits to its contents.
+    CAutoFile file(fsbridge::fopen(path, "rb"), SER_DISK, CLIENT_VERSION);
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    unsigned char magic[sizeof(SNAPSHOT_MAGIC_BYTES)];
+    file.read((char*)magic, sizeof(magic));
+    BOOST_CHECK(memcmp(magic, SNAPSHOT_MAGIC_BYTES, sizeof(magic)) == 0);
+    ss.write((const char*)magic, sizeof(magic));
+    uint32_t nVersion;
+    std::string strNetwork;
+    uint256 hashBase;
+    int nHeight;
+    file >> nVersion >> strNetwork >> hashBase >> nHeight;
+    ss << nVersion << strNetwork << hashBase << nHeight;
+    BOOST_CHECK_EQUAL(nVersion, SNAPSHOT_VERSION);
+    BOOST_CHECK_EQUAL(strNetwork, Params().NetworkIDString());
+    BOOST_CHECK(hashBase == hashBlock);
+
+    uint64_t nRecords = 0;
+    bool fNullifier = false;
+    while (true) {
+        std::vector<unsigned char> vchKey, vchValue;
+        file >> vchKey;
+        ss << vchKey;
+        if (vchKey.empty()) break;
+        file >> vchValue;
+        ss << vchValue;
+        nRecords++;
+        fNullifier |= vchKey[0] == 's';
+    }
+    BOOST_CHECK(fNullifier);
+    uint64_t nRecordsWritten;
+    file >> nRecordsWritten;
+    ss << nRecordsWritten;
+    BOOST_CHECK_EQUAL(nRecordsWritten, nRecords);
+    BOOST_CHECK_EQUAL(stats.nRecords, nRecords);
+    uint256 hashSnapshot;
+    file >> hashSnapshot;
+    BOOST_CHECK(hashSnapshot == ss.GetHash());
+    BOOST_CHECK(hashSnapshot == stats.hashSnapshot);
+}
+
 BOOST_AUTO_TEST_CASE(ccoins_serialization)
 {
     // Good example
+    CDataStream ss1(ParseHex("97f23c835800816115944e077fe7c803cfa57f29b36bf87c1d35"), SER_DISK, CLIENT_VERSION);
+    Coin cc1;
+    ss1 >> cc1;
+    BOOST_CHECK_EQUAL(cc1.fCoinBase, false);
+    BOOST_CHECK_EQUAL(cc1.nHeight, 203998);
+    BOOST_CHECK_EQUAL(cc1.out.nValue, 60000000000ULL);
+    BOOST_CHECK_EQUAL(HexStr(cc1.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
+
+    // Good example
+    CDataStream ss2(ParseHex("8ddf77bbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa4"), SER_DISK, CLIENT_VERSION);
+    Coin cc2;
+    ss2 >> cc2;
+    BOOST_CHECK_EQUAL(cc2.fCoinBase, true);
+    BOOST_CHECK_EQUAL(cc2.nHeight, 120891);
+    BOOST_CHECK_EQUAL(cc2.out.nValue, 110397);
+    BOOST_CHECK_EQUAL(HexStr(cc2.out.scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
+
+    // Smallest possible example
+    CDataStream ss3(ParseHex("000006"), SER_DISK, CLIENT_VERSION);
+    Coin cc3;
+    ss3 >> cc3;
+    BOOST_CHECK_EQUAL(cc3.fCoinBase, false);
+    BOOST_CHECK_EQUAL(cc3.nHeight, 0);
+    BOOST_CHECK_EQUAL(cc3.out.nValue, 0);
+    BOOST_CHECK_EQUAL(cc3.out.scriptPubKey.size(), 0);
+
+    // scriptPubKey that ends beyond the end of the stream
+    CDataStream ss4(ParseHex("000007"), SER_DISK, CLIENT_VERSION);
+    try {
+        Coin cc4;
+        ss4 >> cc4;
+        BOOST_CHECK_MESSAGE(false, "We should have thrown");
+    } catch (const std::ios_base::failure& e) {
+    }
+
+    // Very large scriptPubKey (3*10^9 bytes) past the end of the stream
+    CDataStream tmp(SER_DISK, CLIENT_VERSION);
+    uint64_t x = 3000000000ULL;
+    tmp << VARINT(x);
+    BOOST_CHECK_EQUAL(HexStr(tmp.begin(), tmp.end()), "8a95c0bb00");
+    CDataStream ss5(ParseHex("00008a95c0bb00"), SER_DISK, CLIENT_VERSION);
+    try {
+        Coin cc5;
+        ss5 >> cc5;
+        BOOST_CHECK_MESSAGE(false, "We should have thrown");
+    } catch (const std::ios_base::failure& e) {
+    }
+}
+
+BOOST_AUTO_TEST_CASE(legacy_coins_serialization)
+{
+    // Pre-pertxout database records must stay readable for CCoinsViewDB::Upgrade().
     CDataStream ss1(ParseHex("0104835800816115944e077fe7c803cfa57f29b36bf87c1d358bb85e"), SER_DISK, CLIENT_VERSION);
-    CCoins cc1;
+    CLegacyCoins cc1;
     ss1 >> cc1;
-    BOOST_CHECK_EQUAL(cc1.nVersion, 1);
     BOOST_CHECK_EQUAL(cc1.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc1.nHeight, 203998);
     BOOST_CHECK_EQUAL(cc1.vout.size(), 2);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(0), false);
-    BOOST_CHECK_EQUAL(cc1.IsAvailable(1), true);
+    BOOST_CHECK(cc1.vout[0].IsNull());
+    BOOST_CHECK(!cc1.vout[1].IsNull());
     BOOST_CHECK_EQUAL(cc1.vout[1].nValue, 60000000000ULL);
     BOOST_CHECK_EQUAL(HexStr(cc1.vout[1].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("816115944e077fe7c803cfa57f29b36bf87c1d35"))))));
 
     // Good example
     CDataStream ss2(ParseHex("0109044086ef97d5790061b01caab50f1b8e9c50a5057eb43c2d9563a4eebbd123008c988f1a4a4de2161e0f50aac7f17e7f9555caa486af3b"), SER_DISK, CLIENT_VERSION);
-    CCoins cc2;
+    CLegacyCoins cc2;
     ss2 >> cc2;
-    BOOST_CHECK_EQUAL(cc2.nVersion, 1);
     BOOST_CHECK_EQUAL(cc2.fCoinBase, true);
     BOOST_CHECK_EQUAL(cc2.nHeight, 120891);
     BOOST_CHECK_EQUAL(cc2.vout.size(), 17);
     for (int i = 0; i < 17; i++) {
-        BOOST_CHECK_EQUAL(cc2.IsAvailable(i), i == 4 || i == 16);
+        BOOST_CHECK_EQUAL(cc2.vout[i].IsNull(), i != 4 && i != 16);
     }
     BOOST_CHECK_EQUAL(cc2.vout[4].nValue, 234925952);
     BOOST_CHECK_EQUAL(HexStr(cc2.vout[4].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("61b01caab50f1b8e9c50a5057eb43c2d9563a4ee"))))));
@@ -720,37 +1178,29 @@ BOOST_AUTO_TEST_CASE(ccoins_serialization)
     BOOST_CHECK_EQUAL(HexStr(cc2.vout[16].scriptPubKey), HexStr(GetScriptForDestination(CKeyID(uint160(ParseHex("8c988f1a4a4de2161e0f50aac7f17e7f9555caa4"))))));
 
     // Smallest possible example
-    CDataStream ssx(SER_DISK, CLIENT_VERSION);
-    BOOST_CHECK_EQUAL(HexStr(ssx.begin(), ssx.end()), "");
-
     CDataStream ss3(ParseHex("0002000600"), SER_DISK, CLIENT_VERSION);
-    CCoins cc3;
+    CLegacyCoins cc3;
     ss3 >> cc3;
-    BOOST_CHECK_EQUAL(cc3.nVersion, 0);
     BOOST_CHECK_EQUAL(cc3.fCoinBase, false);
     BOOST_CHECK_EQUAL(cc3.nHeight, 0);
     BOOST_CHECK_EQUAL(cc3.vout.size(), 1);
-    BOOST_CHECK_EQUAL(cc3.IsAvailable(0), true);
+    BOOST_CHECK(!cc3.vout[0].IsNull());
     BOOST_CHECK_EQUAL(cc3.vout[0].nValue, 0);
     BOOST_CHECK_EQUAL(cc3.vout[0].scriptPubKey.size(), 0);
 
     // scriptPubKey that ends beyond the end of the stream
     CDataStream ss4(ParseHex("0002000800"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc4;
+        CLegacyCoins cc4;
         ss4 >> cc4;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
     }
 
     // Very large scriptPubKey (3*10^9 bytes) past the end of the stream
-    CDataStream tmp(SER_DISK, CLIENT_VERSION);
-    uint64_t x = 3000000000ULL;
-    tmp << VARINT(x);
-    BOOST_CHECK_EQUAL(HexStr(tmp.begin(), tmp.end()), "8a95c0bb00");
     CDataStream ss5(ParseHex("0002008a95c0bb0000"), SER_DISK, CLIENT_VERSION);
     try {
-        CCoins cc5;
+        CLegacyCoins cc5;
         ss5 >> cc5;
         BOOST_CHECK_MESSAGE(false, "We should have thrown");
     } catch (const std::ios_base::failure& e) {
@@ -0,0 +1,129 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "compactblocks.h"
+#include "chain.h"
+#include "main.h"
+#include "random.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(compactblocks_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(make_compact_block)
+{
+    CBlock block;
+    block.nTime = 1234;
+    block.hashPrevBlock = GetRandHash();
+
+    // Transactions without shielded components are left out.
+    CMutableTransaction transparent;
+    transparent.vout.resize(1);
+    block.vtx.push_back(transparent);
+
+    CMutableTransaction shielded;
+    shielded.fOverwintered = true;
+    shielded.nVersion = SAPLING_TX_VERSION;
+    shielded.nVersionGroupId = SAPLING_VERSION_GROUP_ID;
+    shielded.vShieldedSpend.resize(1);
+    shielded.vShieldedSpend[0].nullifier = GetRandHash();
+    shielded.vShieldedOutput.resize(2);
+    for (OutputDescription& output : shielded.vShieldedOutput) {
+        output.cmu = GetRandHash();
+        output.ephemeralKey = GetRandHash();
+        GetRandBytes(output.encCiphertext.data(), output.encCiphertext.size());
+    }
+    block.vtx.push_back(shielded);
+
+    CBlockIndex index(block);
+    index.nHeight = 10;
+    index.hashFinalSaplingRoot = SaplingMerkleTree::empty_root();
+
+    CCompactBlock compact;
+    {
+        LOCK(cs_main);
+        compact = MakeCompactBlock(block, &index);
+    }
+    BOOST_CHECK_EQUAL(compact.nHeight, 10);
+    BOOST_CHECK(compact.hash == block.GetHash());
+    BOOST_CHECK(compact.hashPrevBlock == block.hashPrevBlock);
+    BOOST_CHECK_EQUAL(compact.nTime, 1234);
+    BOOST_CHECK_EQUAL(compact.nSaplingTreeSize, 0);
+    BOOST_CHECK_EQUAL(compact.nOrchardTreeSize, 0);
+    BOOST_CHECK_EQUAL(compact.vtx.size(), 1);
+
+    const CCompactTx& ctx = compact.vtx[0];
+    BOOST_CHECK_EQUAL(ctx.nIndex, 1);
+    BOOST_CHECK(ctx.txid == block.vtx[1].GetHash());
+    BOOST_CHECK(ctx.vSpends == std::vector<uint256>{shielded.vShieldedSpend[0].nullifier});
+    BOOST_CHECK_EQUAL(ctx.vOutputs.size(), 2);
+    for (size_t i = 0; i < ctx.vOutputs.size(); i++) {
+        const OutputDescription& output = shielded.vShieldedOutput[i];
+        BOOST_CHECK(ctx.vOutputs[i].cmu == output.cmu);
+        BOOST_CHECK(ctx.vOutputs[i].ephemeralKey == output.ephemeralKey);
+        BOOST_CHECK(std::equal(ctx.vOutputs[i].ciphertext.begin(), ctx.vOutputs[i].ciphertext.end(), output.encCiphertext.begin()));
+    }
+    BOOST_CHECK(ctx.vActions.empty());
+
+    // Each output takes its two fields, 52 bytes of ciphertext and no more.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << ctx.vOutputs[0];
+    BOOST_CHECK_EQUAL(ss.size(), 32 + 32 + ZC_COMPACT_CIPHERTEXT_SIZE);
+    BOOST_CHECK_EQUAL(ZC_COMPACT_CIPHERTEXT_SIZE, 52);
+}
+
+BOOST_AUTO_TEST_CASE(make_compact_tx)
+{
+    // Mempool transactions are published in compact form whether or not
+    // they have shielded components.
+    CMutableTransaction mtx;
+    mtx.vout.resize(1);
+    CTransaction tx(mtx);
+    CCompactTx ctx = MakeCompactTx(tx, 0);
+    BOOST_CHECK_EQUAL(ctx.nIndex, 0);
+    BOOST_CHECK(ctx.txid == tx.GetHash());
+    BOOST_CHECK(ctx.vSpends.empty());
+    BOOST_CHECK(ctx.vOutputs.empty());
+    BOOST_CHECK(ctx.vActions.empty());
+
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << ctx;
+    BOOST_CHECK_EQUAL(ss.size(), 1 + 32 + 3);
+}
+
+BOOST_AUTO_TEST_CASE(compact_block_cache)
+{
+    CCompactBlockCache cache(250);
+    std::vector<uint256> hashes;
+    for (int i = 0; i < 3; i++) {
+        hashes.push_back(GetRandHash());
+        cache.Insert(hashes[i], std::make_shared<const std::vector<unsigned char>>(100, i));
+    }
+
+    // The least recently used entry was dropped to stay within the size.
+    BOOST_CHECK(!cache.Get(hashes[0]));
+    BOOST_CHECK(cache.Get(hashes[1]));
+    BOOST_CHECK_EQUAL((*cache.Get(hashes[2]))[0], 2);
+
+    // Looking an entry up makes it the most recently used.
+    BOOST_CHECK(cache.Get(hashes[1]));
+    uint256 hash = GetRandHash();
+    cache.Insert(hash, std::make_shared<const std::vector<unsigned char>>(100, 3));
+    BOOST_CHECK(cache.Get(hashes[1]));
+    BOOST_CHECK(!cache.Get(hashes[2]));
+    BOOST_CHECK(cache.Get(hash));
+
+    // Entries larger than the cache are not kept.
+    uint256 hashLarge = GetRandHash();
+    cache.Insert(hashLarge, std::make_shared<const std::vector<unsigned char>>(300, 4));
+    BOOST_CHECK(!cache.Get(hashLarge));
+    BOOST_CHECK(cache.Get(hash));
+
+    cache.SetMaxSize(0);
+    BOOST_CHECK(!cache.Get(hash));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -11,6 +11,7 @@
 #include "crypto/sha512.h"
 #include "crypto/hmac_sha256.h"
 #include "crypto/hmac_sha512.h"
+#include "hash.h"
 #include "test_random.h"
 #include "util/strencodings.h"
 #include "test/test_bitcoin.h"
@@ -268,6 +269,34 @@ BOOST_AUTO_TEST_CASE(sha256_testvectors) {
     TestSHA256(test1, "a316d55510b49662420f49d145d42fb83f31ef8dc016aa4e32df049991a91e26");
 }
 
+BOOST_AUTO_TEST_CASE(sha256d64)
+{
+    // Each implementation the CPU supports agrees with hashing the inputs one
+    // at a time, for batches that do and do not fill the multi-way transforms.
+    for (auto use_implementation : {sha256_implementation::STANDARD,
+                                    sha256_implementation::USE_SSE41,
+                                    sha256_implementation::USE_SSE41_AND_AVX2,
+                                    sha256_implementation::USE_SHANI,
+                                    sha256_implementation::USE_ALL}) {
+        SHA256AutoDetect(use_implementation);
+        for (int i = 0; i <= 32; i++) {
+            unsigned char in[64 * 32];
+            unsigned char out1[32 * 32], out2[32 * 32];
+            for (int j = 0; j < 64 * i; j++) {
+                in[j] = insecure_rand();
+            }
+            for (int j = 0; j < i; j++) {
+                CHash256().Write(in + 64 * j, 64).Finalize(out1 + 32 * j);
+            }
+            SHA256D64(out2, in, i);
+            BOOST_CHECK(memcmp(out1, out2, 32 * i) == 0);
+        }
+        TestSHA256(std::string(1000000, 'a'),
+                   "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+    }
+    SHA256AutoDetect();
+}
+
 BOOST_AUTO_TEST_CASE(sha512_testvectors) {
     TestSHA512("",
                "cf83e1357eefb8bdf1542850d66d8007d620e4050b5715dc83f4a921d36ce9ce"
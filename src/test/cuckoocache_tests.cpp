@@ -0,0 +1,112 @@
+// Copyright (c) 2012-2016 The Bitcoin Core developers
+// Copyright (c) 2022 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "cuckoocache.h"
+#include "random.h"
+#include "uint256.h"
+
+#include "test/test_bitcoin.h"
+
+#include <cstring>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/** Takes the 8 hashes from the bytes of the (random) key, as the signature cache does. */
+class KeyHasher
+{
+public:
+    template <uint8_t hash_select>
+    uint32_t operator()(const uint256& key) const
+    {
+        uint32_t u;
+        std::memcpy(&u, key.begin() + 4 * hash_select, 4);
+        return u;
+    }
+};
+
+typedef CuckooCache::cache<uint256, KeyHasher> cache_type;
+
+/** The fraction of hashes that are still in a cache after inserting load * size of them. */
+double HitRate(double load)
+{
+    cache_type set;
+    uint32_t nSize = set.setup(1 << 14);
+    std::vector<uint256> hashes(load * nSize);
+    for (uint256& hash : hashes) {
+        hash = GetRandHash();
+        set.insert(hash);
+    }
+
+    size_t nHits = 0;
+    for (const uint256& hash : hashes) {
+        nHits += set.contains(hash, false);
+    }
+    return double(nHits) / hashes.size();
+}
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(cuckoocache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(cuckoocache_no_fakes)
+{
+    cache_type set;
+    set.setup_bytes(32 << 10);
+    for (int i = 0; i < 20000; i++) {
+        set.insert(GetRandHash());
+    }
+    for (int i = 0; i < 20000; i++) {
+        BOOST_CHECK(!set.contains(GetRandHash(), false));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_hit_rate)
+{
+    // The cache should hold nearly everything inserted up to its capacity,
+    // and keep most of its capacity full when more is inserted.
+    BOOST_CHECK(HitRate(0.5) > 0.99);
+    BOOST_CHECK(HitRate(0.9) > 0.95);
+    BOOST_CHECK(HitRate(2.0) * 2.0 > 0.85);
+}
+
+BOOST_AUTO_TEST_CASE(cuckoocache_erase)
+{
+    cache_type set;
+    uint32_t nSize = set.setup(1 << 12);
+    std::vector<uint256> hashes(nSize);
+    for (size_t i = 0; i < hashes.size() / 2; i++) {
+        hashes[i] = GetRandHash();
+        set.insert(hashes[i]);
+    }
+
+    // Erasing only marks an entry as reusable, so it is still found...
+    for (size_t i = 0; i < hashes.size() / 4; i++) {
+        BOOST_CHECK(set.contains(hashes[i], true));
+    }
+    for (size_t i = 0; i < hashes.size() / 2; i++) {
+        BOOST_CHECK(set.contains(hashes[i], false));
+    }
+
+    // ...until its slot is needed, when erased entries are evicted before the
+    // entries that were kept.
+    for (size_t i = hashes.size() / 2; i < hashes.size(); i++) {
+        hashes[i] = GetRandHash();
+        set.insert(hashes[i]);
+    }
+    size_t nErasedHits = 0, nKeptHits = 0;
+    for (size_t i = 0; i < hashes.size() / 4; i++) {
+        nErasedHits += set.contains(hashes[i], false);
+    }
+    for (size_t i = hashes.size() / 4; i < hashes.size() / 2; i++) {
+        nKeptHits += set.contains(hashes[i], false);
+    }
+    BOOST_CHECK(nKeptHits > nErasedHits);
+    BOOST_CHECK(double(nKeptHits) / (hashes.size() / 4) > 0.75);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -231,4 +231,73 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
 
 
 
+BOOST_AUTO_TEST_CASE(dbwrapper_readmany)
+{
+    path ph = temp_directory_path() / unique_path();
+    CDBWrapper dbw(ph, (1 << 20), true, false);
+    std::vector<uint256> keys;
+    for (int i = 0; i < 100; i++) {
+        keys.push_back(GetRandHash());
+        BOOST_CHECK(dbw.Write(std::make_pair('k', keys.back()), i));
+    }
+    BOOST_CHECK(dbw.Write('x', std::string("not an int")));
+
+    // The results follow the order of the keys, with missing keys and values
+    // that do not deserialize left empty.
+    std::vector<std::pair<char, uint256>> query;
+    for (int i = 99; i >= 0; i -= 3) {
+        query.emplace_back('k', keys[i]);
+    }
+    query.emplace_back('k', GetRandHash());
+    std::vector<std::optional<int>> values = dbw.ReadMany<int>(query);
+    BOOST_CHECK_EQUAL(values.size(), query.size());
+    for (size_t i = 0; i + 1 < query.size(); i++) {
+        BOOST_CHECK(values[i] && *values[i] == 99 - 3 * (int)i);
+    }
+    BOOST_CHECK(!values.back());
+    BOOST_CHECK(!dbw.ReadMany<uint256>(std::vector<char>(1, 'x'))[0]);
+    BOOST_CHECK(dbw.ReadMany<int>(std::vector<char>()).empty());
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_options)
+{
+    std::string strError;
+
+    // Settings are applied per profile; other profiles keep the defaults.
+    BOOST_CHECK(ParseDBOptions({"blockindex:maxopenfiles=1000,maxfilesize=32", "blockindex:bloombits=0"}, strError));
+    CDBOptions blockindex = GetDBOptions("blockindex");
+    BOOST_CHECK_EQUAL(blockindex.strName, "blockindex");
+    BOOST_CHECK_EQUAL(blockindex.nMaxOpenFiles, 1000);
+    BOOST_CHECK_EQUAL(blockindex.nMaxFileSize, (size_t)32 << 20);
+    BOOST_CHECK_EQUAL(blockindex.nBloomBits, 0);
+    BOOST_CHECK(!blockindex.fCompression);
+    CDBOptions chainstate = GetDBOptions("chainstate");
+    BOOST_CHECK_EQUAL(chainstate.strName, "chainstate");
+    BOOST_CHECK_EQUAL(chainstate.ToString(), CDBOptions().ToString());
+
+    BOOST_CHECK(!ParseDBOptions({"wallet:compression=1"}, strError));
+    BOOST_CHECK(!ParseDBOptions({"chainstate"}, strError));
+    BOOST_CHECK(!ParseDBOptions({"chainstate:compression=2"}, strError));
+    BOOST_CHECK(!ParseDBOptions({"chainstate:blockcache=101"}, strError));
+    BOOST_CHECK(!ParseDBOptions({"chainstate:writebuffer=1"}, strError));
+    BOOST_CHECK(!ParseDBOptions({"chainstate:backend=bdb"}, strError));
+
+    // A database opened with a profile works as usual.
+    BOOST_CHECK(ParseDBOptions({"chainstate:backend=leveldb,compression=1,blockcache=25,bloombits=0"}, strError));
+    BOOST_CHECK_EQUAL(GetDBOptions("chainstate").strBackend, DEFAULT_DB_BACKEND);
+    {
+        path ph = temp_directory_path() / unique_path();
+        CDBWrapper dbw(ph, (1 << 20), true, false, GetDBOptions("chainstate"));
+        char key = 'k';
+        uint256 in = GetRandHash();
+        uint256 res;
+
+        BOOST_CHECK(dbw.Write(key, in));
+        BOOST_CHECK(dbw.Read(key, res));
+        BOOST_CHECK_EQUAL(res.ToString(), in.ToString());
+    }
+
+    BOOST_CHECK(ParseDBOptions({}, strError));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
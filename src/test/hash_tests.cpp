@@ -7,6 +7,7 @@
 #include "util/strencodings.h"
 #include "test/test_bitcoin.h"
 
+#include <algorithm>
 #include <vector>
 
 #include <boost/test/unit_test.hpp>
@@ -107,6 +108,9 @@ BOOST_AUTO_TEST_CASE(siphash)
     BOOST_CHECK_EQUAL(hasher.Finalize(),  0xe612a3cb9ecba951ull);
 
     BOOST_CHECK_EQUAL(SipHashUint256(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100")), 0x7127512f72f27cceull);
+    // The 32 bytes of the uint256 followed by the 4 bytes of the extra value
+    // are the first 36 bytes of the input used for the spec's test vectors.
+    BOOST_CHECK_EQUAL(SipHashUint256Extra(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL, uint256S("1f1e1d1c1b1a191817161514131211100f0e0d0c0b0a09080706050403020100"), 0x23222120), siphash_4_2_testvec[36]);
 
     // Check test vectors from spec, one byte at a time
     CSipHasher hasher2(0x0706050403020100ULL, 0x0F0E0D0C0B0A0908ULL);
@@ -125,4 +129,35 @@ BOOST_AUTO_TEST_CASE(siphash)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blake2b_writer_buffering)
+{
+    const unsigned char personal[blake2b::PERSONALBYTES] = {'Z','c','a','s','h','_','T','e','s','t','_','_','_','_','_','_'};
+    std::vector<unsigned char> data(2000);
+    for (size_t i = 0; i < data.size(); i++)
+        data[i] = i * 7 + 3;
+
+    CBLAKE2bWriter whole(SER_GETHASH, 0, personal);
+    whole.write((const char*)data.data(), data.size());
+    uint256 expected = whole.GetHash();
+
+    // Writes smaller than, filling and larger than the buffer, in any mix,
+    // hash the same as one write.
+    const size_t chunkSizes[] = {1, 7, 32, 255, 256, 257, 600};
+    for (size_t first : chunkSizes) {
+        CBLAKE2bWriter chunked(SER_GETHASH, 0, personal);
+        size_t pos = 0, i = 0;
+        while (pos < data.size()) {
+            size_t size = std::min(data.size() - pos, i++ == 0 ? first : chunkSizes[i % ARRAYLEN(chunkSizes)]);
+            chunked.write((const char*)data.data() + pos, size);
+            pos += size;
+        }
+        BOOST_CHECK(chunked.GetHash() == expected);
+    }
+
+    CBLAKE2bWriter empty(SER_GETHASH, 0, personal);
+    empty.write((const char*)data.data(), 0);
+    CBLAKE2bWriter empty2(SER_GETHASH, 0, personal);
+    BOOST_CHECK(empty.GetHash() == empty2.GetHash());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,255 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "addressindex.h"
+#include "consensus/validation.h"
+#include "insightindex.h"
+#include "key.h"
+#include "main.h"
+#include "random.h"
+#include "script/sign.h"
+#include "script/standard.h"
+#include "spentindex.h"
+#include "subtreeindex.h"
+#include "supplyindex.h"
+#include "streams.h"
+#include "test/test_bitcoin.h"
+#include "txdb.h"
+#include "util/time.h"
+
+#include <limits>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_AUTO_TEST_SUITE(insightindex_tests)
+
+#ifdef ENABLE_MINING
+BOOST_FIXTURE_TEST_CASE(insightindex_follows_active_chain, TestChain100Setup)
+{
+    fTxIndex = true;
+    fAddressIndex = true;
+    fSpentIndex = true;
+    fTimestampIndex = true;
+    fSubtreeIndex = true;
+    fSupplyIndex = true;
+
+    CInsightIndex index(1 << 20, 1 << 20, 1 << 20, 1 << 20, 1 << 20, 0, 1 << 20, true);
+    {
+        LOCK(cs_main);
+        std::string strError;
+        BOOST_CHECK(index.Init(strError));
+    }
+    BOOST_CHECK(index.Sync());
+
+    // Spend the first (P2PK) coinbase to a P2PKH address, and pay the
+    // coinbase of the block to the same address.
+    CKeyID keyID = coinbaseKey.GetPubKey().GetID();
+    CScript scriptP2PK = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    CScript scriptP2PKH = GetScriptForDestination(keyID);
+
+    CMutableTransaction spend;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptP2PKH;
+
+    const PrecomputedTransactionData txdata(spend, {coinbaseTxns[0].vout[0]});
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptP2PK, spend, 0, SIGHASH_ALL, coinbaseTxns[0].vout[0].nValue, SPROUT_BRANCH_ID, txdata);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    CBlock block = CreateAndProcessBlock({spend}, scriptP2PKH);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    const int nHeight = chainActive.Height();
+
+    // Nothing is written until the index catches up with the chain.
+    std::vector<CAddressUnspentDbEntry> unspent;
+    BOOST_CHECK(index.ReadAddressUnspentIndex(keyID, CScript::P2PKH, unspent));
+    BOOST_CHECK(unspent.empty());
+    CDiskTxPos postx;
+    BOOST_CHECK(!index.ReadTxIndex(spend.GetHash(), postx));
+    BOOST_CHECK(index.Sync());
+
+    // The transaction index points into the block on disk.
+    BOOST_CHECK(index.ReadTxIndex(spend.GetHash(), postx));
+    {
+        CAutoFile file(OpenBlockFile(postx, true), SER_DISK, CLIENT_VERSION);
+        BOOST_CHECK(!file.IsNull());
+        CBlockHeader header;
+        CTransaction tx;
+        file >> header;
+        fseek(file.Get(), postx.nTxOffset, SEEK_CUR);
+        file >> tx;
+        BOOST_CHECK(header.GetHash() == block.GetHash());
+        BOOST_CHECK(tx.GetHash() == spend.GetHash());
+    }
+
+    unspent.clear();
+    BOOST_CHECK(index.ReadAddressUnspentIndex(keyID, CScript::P2PKH, unspent));
+    BOOST_CHECK_EQUAL(unspent.size(), 2);
+    for (const auto& entry : unspent) {
+        BOOST_CHECK_EQUAL(entry.second.blockHeight, nHeight);
+    }
+
+    std::vector<CAddressIndexDbEntry> deltas;
+    BOOST_CHECK(index.ReadAddressIndex(keyID, CScript::P2PKH, deltas));
+    BOOST_CHECK_EQUAL(deltas.size(), 2);
+
+    // The balance is kept up to date, as the index was built from scratch.
+    CAddressBalanceValue balance;
+    BOOST_CHECK(index.ReadAddressBalance(keyID, CScript::P2PKH, balance));
+    BOOST_CHECK_EQUAL(balance.balance, deltas[0].second + deltas[1].second);
+    BOOST_CHECK_EQUAL(balance.received, balance.balance);
+    BOOST_CHECK_EQUAL(balance.txCount, 2);
+
+    // Entries are visited from the given one on, until told to stop.
+    std::vector<CAddressIndexKey> vVisited;
+    BOOST_CHECK(index.ForEachAddressIndex(keyID, CScript::P2PKH, 0, 0, &deltas[1].first,
+        [&](const CAddressIndexKey& key, CAmount nValue) {
+            vVisited.push_back(key);
+            return true;
+        }));
+    BOOST_CHECK_EQUAL(vVisited.size(), 1);
+    BOOST_CHECK(vVisited[0].txhash == deltas[1].first.txhash);
+    vVisited.clear();
+    BOOST_CHECK(index.ForEachAddressIndex(keyID, CScript::P2PKH, 0, 0, nullptr,
+        [&](const CAddressIndexKey& key, CAmount nValue) {
+            vVisited.push_back(key);
+            return false;
+        }));
+    BOOST_CHECK_EQUAL(vVisited.size(), 1);
+
+    CSpentIndexKey spentKey(coinbaseTxns[0].GetHash(), 0);
+    CSpentIndexValue spentValue;
+    BOOST_CHECK(index.ReadSpentIndex(spentKey, spentValue));
+    BOOST_CHECK(spentValue.txid == spend.GetHash());
+    BOOST_CHECK_EQUAL(spentValue.inputIndex, 0);
+    BOOST_CHECK_EQUAL(spentValue.blockHeight, nHeight);
+
+    // Every block but the genesis block has a timestamp entry.
+    std::vector<std::pair<uint256, unsigned int>> hashes;
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(index.ReadTimestampIndex(std::numeric_limits<unsigned int>::max(), 0, true, hashes));
+    }
+    BOOST_CHECK_EQUAL(hashes.size(), (size_t)nHeight);
+
+    // The chain has no shielded outputs, so no subtree is complete.
+    std::vector<CSubtreeIndexValue> vSubtrees;
+    BOOST_CHECK(index.ReadSubtreeIndex(SAPLING, 0, 10, vSubtrees));
+    BOOST_CHECK(vSubtrees.empty());
+
+    // Every block, from the genesis block on, has a supply entry. The miners
+    // claimed the whole subsidy, and the transaction moved value within the
+    // transparent pool.
+    std::vector<std::pair<int, CSupplyIndexValue>> vSupply;
+    BOOST_CHECK(index.ReadSupplyIndex(0, nHeight, vSupply));
+    BOOST_CHECK_EQUAL(vSupply.size(), (size_t)nHeight + 1);
+    BOOST_CHECK_EQUAL(vSupply[0].first, 0);
+    BOOST_CHECK_EQUAL(vSupply[0].second.GetChainSupply(), 0);
+    const CSupplyIndexValue& supply = vSupply.back().second;
+    BOOST_CHECK_EQUAL(vSupply.back().first, nHeight);
+    BOOST_CHECK(supply.blockHash == block.GetHash());
+    BOOST_CHECK_EQUAL(supply.nSubsidy, GetBlockSubsidy(nHeight, Params().GetConsensus()));
+    BOOST_CHECK_EQUAL(supply.valueDelta[SUPPLY_TRANSPARENT], supply.nSubsidy);
+    BOOST_CHECK_EQUAL(supply.valueDelta[SUPPLY_SAPLING], 0);
+    BOOST_CHECK_EQUAL(supply.chainValue[SUPPLY_TRANSPARENT], supply.nChainSubsidy);
+    BOOST_CHECK_EQUAL(supply.GetChainSupply(), supply.nChainSubsidy);
+    BOOST_CHECK_EQUAL(supply.nChainSubsidy, vSupply[nHeight - 1].second.nChainSubsidy + supply.nSubsidy);
+
+    // Disconnecting the block removes its entries once the index catches up.
+    {
+        CValidationState state;
+        {
+            LOCK(cs_main);
+            BOOST_CHECK(InvalidateBlock(state, Params(), chainActive.Tip()));
+        }
+        BOOST_CHECK(ActivateBestChain(state, Params()));
+        BOOST_CHECK_EQUAL(chainActive.Height(), nHeight - 1);
+    }
+    BOOST_CHECK(index.Sync());
+    BOOST_CHECK(index.BlockUntilSyncedToCurrentChain());
+
+    unspent.clear();
+    BOOST_CHECK(index.ReadAddressUnspentIndex(keyID, CScript::P2PKH, unspent));
+    BOOST_CHECK(unspent.empty());
+    deltas.clear();
+    BOOST_CHECK(index.ReadAddressIndex(keyID, CScript::P2PKH, deltas));
+    BOOST_CHECK(deltas.empty());
+    BOOST_CHECK(index.ReadAddressBalance(keyID, CScript::P2PKH, balance));
+    BOOST_CHECK(balance.IsNull());
+    BOOST_CHECK_EQUAL(balance.balance, 0);
+    BOOST_CHECK(!index.ReadSpentIndex(spentKey, spentValue));
+
+    // The timestamp of the disconnected block is kept, but is not active.
+    hashes.clear();
+    {
+        LOCK(cs_main);
+        BOOST_CHECK(index.ReadTimestampIndex(std::numeric_limits<unsigned int>::max(), 0, true, hashes));
+    }
+    BOOST_CHECK_EQUAL(hashes.size(), (size_t)nHeight - 1);
+
+    vSupply.clear();
+    BOOST_CHECK(index.ReadSupplyIndex(0, nHeight, vSupply));
+    BOOST_CHECK_EQUAL(vSupply.size(), (size_t)nHeight);
+
+    std::vector<CIndexSummary> vSummaries = index.GetSummaries();
+    BOOST_CHECK_EQUAL(vSummaries.size(), 6U);
+    for (const CIndexSummary& summary : vSummaries) {
+        BOOST_CHECK(summary.fSynced);
+        BOOST_CHECK_EQUAL(summary.nBestHeight, nHeight - 1);
+    }
+
+    fTxIndex = false;
+    fAddressIndex = false;
+    fSpentIndex = false;
+    fTimestampIndex = false;
+    fSubtreeIndex = false;
+    fSupplyIndex = false;
+}
+#endif // ENABLE_MINING
+
+BOOST_FIXTURE_TEST_CASE(insightindex_serves_legacy_txindex, TestingSetup)
+{
+    fTxIndex = true;
+
+    // An entry of the transaction index that earlier versions kept in the
+    // block index database.
+    uint256 txid = GetRandHash();
+    CDiskTxPos pos(CDiskBlockPos(1, 2), 3);
+    BOOST_CHECK(pblocktree->WriteFlag("txindex", true));
+    BOOST_CHECK(pblocktree->Write(std::make_pair('t', txid), pos));
+
+    CInsightIndex index(1 << 20, 0, 0, 0, 0, 0, 0, true);
+    {
+        LOCK(cs_main);
+        std::string strError;
+        BOOST_CHECK(index.Init(strError));
+    }
+
+    // It is looked up while the new index does not have the transaction.
+    CDiskTxPos postx;
+    BOOST_CHECK(index.ReadTxIndex(txid, postx));
+    BOOST_CHECK_EQUAL(postx.nFile, 1);
+    BOOST_CHECK_EQUAL(postx.nPos, 2U);
+    BOOST_CHECK_EQUAL(postx.nTxOffset, 3U);
+
+    // Once the new index has caught up, the legacy entries are erased.
+    index.Start();
+    for (int i = 0; i < 100 && pblocktree->HasLegacyTxIndex(); i++) {
+        MilliSleep(100);
+    }
+    BOOST_CHECK(!pblocktree->HasLegacyTxIndex());
+    BOOST_CHECK(!pblocktree->ReadLegacyTxIndex(txid, postx));
+    BOOST_CHECK(!index.ReadTxIndex(txid, postx));
+    index.Stop();
+
+    fTxIndex = false;
+}
+
+BOOST_AUTO_TEST_SUITE_END()
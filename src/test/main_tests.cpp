@@ -4,6 +4,7 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "chainparams.h"
+#include "diskrecord.h"
 #include "main.h"
 
 #include "test/test_bitcoin.h"
@@ -124,4 +125,86 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     BOOST_CHECK(Test());
 }
 
+BOOST_AUTO_TEST_CASE(read_raw_block_from_disk)
+{
+    const CChainParams& chainparams = Params();
+    const CBlock& genesis = chainparams.GenesisBlock();
+
+    // Use a block file that the node itself doesn't write to.
+    CDiskBlockPos pos(1, 0);
+    BOOST_REQUIRE(WriteBlockToDisk(genesis, pos, chainparams.MessageStart()));
+
+    // The raw bytes are the block's network serialization.
+    std::vector<unsigned char> blockData;
+    BOOST_REQUIRE(ReadRawBlockFromDisk(blockData, pos, chainparams.MessageStart()));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << genesis;
+    BOOST_CHECK(blockData == std::vector<unsigned char>(ss.begin(), ss.end()));
+
+    // The index header must match.
+    CMessageHeader::MessageStartChars badStart = {0, 0, 0, 0};
+    BOOST_CHECK(!ReadRawBlockFromDisk(blockData, pos, badStart));
+
+    // There is no index header before the start of the file.
+    BOOST_CHECK(!ReadRawBlockFromDisk(blockData, CDiskBlockPos(1, 0), chainparams.MessageStart()));
+}
+
+BOOST_AUTO_TEST_CASE(compressed_block_on_disk)
+{
+    const CChainParams& chainparams = Params();
+    CMutableTransaction mtx;
+    mtx.vout.resize(100);
+    for (CTxOut& out : mtx.vout)
+        out.scriptPubKey = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    CBlock block;
+    block.vtx.push_back(CTransaction(mtx));
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    std::vector<unsigned char> serialized(ss.begin(), ss.end());
+
+    // Records are only compressed when asked for, and smaller that way.
+    CDiskRecord raw(block, false);
+    BOOST_CHECK_EQUAL(raw.GetSizeField(), serialized.size());
+    CDiskRecord record(block, true);
+    BOOST_CHECK(record.GetSizeField() & DISK_RECORD_COMPRESSED);
+    BOOST_CHECK(record.size() < serialized.size());
+    BOOST_CHECK(IsValidDiskRecordSize(record.GetSizeField()));
+    BOOST_CHECK(!IsValidDiskRecordSize(MAX_BLOCK_SIZE + 1));
+
+    CDataStream ssRecord(SER_DISK, CLIENT_VERSION);
+    ssRecord.write((const char*)record.GetData().data(), record.size());
+    CBlock read;
+    ReadDiskRecord(ssRecord, record.GetSizeField(), read);
+    BOOST_CHECK(read.GetHash() == block.GetHash());
+    BOOST_CHECK_EQUAL(read.vtx.size(), 1);
+
+    // Raw reads return the block as it was serialized.
+    CDiskBlockPos pos(2, 0);
+    BOOST_REQUIRE(WriteBlockToDisk(record, pos, chainparams.MessageStart()));
+    std::vector<unsigned char> blockData;
+    BOOST_REQUIRE(ReadRawBlockFromDisk(blockData, pos, chainparams.MessageStart()));
+    BOOST_CHECK(blockData == serialized);
+}
+
+BOOST_AUTO_TEST_CASE(trimmed_solution)
+{
+    const CBlock& genesis = Params().GenesisBlock();
+    uint256 hash = genesis.GetHash();
+    CBlockIndex index(genesis);
+    index.phashBlock = &hash;
+
+    std::vector<const CBlockIndex*> vBlocks = {&index};
+    BOOST_REQUIRE(pblocktree->WriteBatchSync({}, 0, vBlocks));
+
+    LOCK(cs_main);
+    index.TrimSolution();
+    BOOST_CHECK(index.nSolution.empty());
+    BOOST_CHECK(index.GetSolution() == genesis.nSolution);
+    BOOST_CHECK(index.GetBlockHeader().GetHash() == hash);
+
+    // A trimmed entry can be rewritten, and is read back from the cache.
+    BOOST_REQUIRE(pblocktree->WriteBatchSync({}, 0, vBlocks));
+    BOOST_CHECK(index.GetSolution() == genesis.nSolution);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
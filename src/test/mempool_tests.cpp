@@ -4,9 +4,15 @@
 // file COPYING or https://www.opensource.org/licenses/mit-license.php .
 
 #include "consensus/upgrades.h"
+#include "consensus/validation.h"
+#include "key.h"
 #include "main.h"
+#include "random.h"
+#include "script/sign.h"
+#include "streams.h"
 #include "txmempool.h"
 #include "util/system.h"
+#include "util/time.h"
 
 #include "test/test_bitcoin.h"
 
@@ -104,6 +110,151 @@ BOOST_AUTO_TEST_CASE(MempoolRemoveTest)
     removed.clear();
 }
 
+BOOST_AUTO_TEST_CASE(MempoolPackageTrackingTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool(CFeeRate(0));
+
+    // A chain of three transactions, each spending the one before.
+    CMutableTransaction tx[3];
+    for (int i = 0; i < 3; i++) {
+        tx[i].vin.resize(1);
+        tx[i].vin[0].scriptSig = CScript() << OP_11;
+        if (i > 0) {
+            tx[i].vin[0].prevout.hash = tx[i - 1].GetHash();
+            tx[i].vin[0].prevout.n = 0;
+        }
+        tx[i].vout.resize(1);
+        tx[i].vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx[i].vout[0].nValue = 10000LL * (3 - i);
+    }
+    const CAmount nFees[3] = {1000, 2000, 4000};
+    for (int i = 0; i < 3; i++) {
+        pool.addUnchecked(tx[i].GetHash(), entry.Fee(nFees[i]).FromTx(tx[i]));
+    }
+    auto get = [&](int i) { return pool.mapTx.find(tx[i].GetHash()); };
+    const uint64_t nSize = get(0)->GetTxSize();
+
+    BOOST_CHECK_EQUAL(get(0)->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(get(0)->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(get(0)->GetModFeesWithDescendants(), 7000);
+    BOOST_CHECK_EQUAL(get(1)->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(get(1)->GetCountWithDescendants(), 2);
+    BOOST_CHECK_EQUAL(get(2)->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(get(2)->GetSizeWithAncestors(), get(0)->GetSizeWithDescendants());
+    BOOST_CHECK_EQUAL(get(2)->GetModFeesWithAncestors(), 7000);
+
+    // Fee deltas are carried into the packages.
+    pool.PrioritiseTransaction(tx[1].GetHash(), tx[1].GetHash().ToString(), 0, 500);
+    BOOST_CHECK_EQUAL(get(0)->GetModFeesWithDescendants(), 7500);
+    BOOST_CHECK_EQUAL(get(2)->GetModFeesWithAncestors(), 7500);
+    BOOST_CHECK_EQUAL(get(1)->GetModFeesWithAncestors(), 3500);
+
+    // Mining the first transaction takes it out of its descendants' packages.
+    std::list<CTransaction> removed;
+    pool.remove(tx[0], removed, false);
+    BOOST_CHECK_EQUAL(removed.size(), 1);
+    BOOST_CHECK_EQUAL(get(1)->GetCountWithAncestors(), 1);
+    BOOST_CHECK_EQUAL(get(1)->GetModFeesWithAncestors(), 2500);
+    BOOST_CHECK_EQUAL(get(2)->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(get(2)->GetSizeWithAncestors(), get(2)->GetTxSize() + get(1)->GetTxSize());
+    BOOST_CHECK_EQUAL(get(2)->GetModFeesWithAncestors(), 6500);
+
+    // Disconnecting its block adds it back, ahead of the transactions that
+    // spend it.
+    pool.addUnchecked(tx[0].GetHash(), entry.Fee(nFees[0]).FromTx(tx[0]));
+    BOOST_CHECK_EQUAL(get(0)->GetCountWithDescendants(), 3);
+    BOOST_CHECK_EQUAL(get(0)->GetSizeWithDescendants(), nSize + get(1)->GetTxSize() + get(2)->GetTxSize());
+    BOOST_CHECK_EQUAL(get(0)->GetModFeesWithDescendants(), 7500);
+    BOOST_CHECK_EQUAL(get(1)->GetCountWithAncestors(), 2);
+    BOOST_CHECK_EQUAL(get(2)->GetCountWithAncestors(), 3);
+    BOOST_CHECK_EQUAL(get(2)->GetModFeesWithAncestors(), 7500);
+
+    // Removing the middle transaction recursively leaves the first alone.
+    removed.clear();
+    pool.remove(tx[1], removed, true);
+    BOOST_CHECK_EQUAL(removed.size(), 2);
+    BOOST_CHECK_EQUAL(get(0)->GetCountWithDescendants(), 1);
+    BOOST_CHECK_EQUAL(get(0)->GetSizeWithDescendants(), nSize);
+    BOOST_CHECK_EQUAL(get(0)->GetModFeesWithDescendants(), 1000);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolSnapshotTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction tx1;
+    tx1.vin.resize(1);
+    tx1.vin[0].scriptSig = CScript() << OP_11;
+    tx1.vout.resize(1);
+    tx1.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    tx1.vout[0].nValue = 10000LL;
+    CMutableTransaction tx2 = tx1;
+    tx2.vin[0].prevout.hash = tx1.GetHash();
+
+    auto empty = pool.GetSnapshot();
+    BOOST_CHECK(empty->vEntries.empty());
+    BOOST_CHECK(pool.GetSnapshot() == empty);
+
+    pool.addUnchecked(tx1.GetHash(), entry.Fee(1000).FromTx(tx1));
+    pool.addUnchecked(tx2.GetHash(), entry.Fee(1000).FromTx(tx2));
+    auto snapshot = pool.GetSnapshot();
+    BOOST_CHECK(snapshot != empty);
+    BOOST_CHECK(pool.GetSnapshot() == snapshot);
+    BOOST_CHECK_EQUAL(snapshot->vEntries.size(), 2);
+    BOOST_CHECK(snapshot->exists(tx1.GetHash()));
+    BOOST_CHECK(snapshot->exists(tx2.GetHash()));
+
+    // Fee deltas are seen by the next snapshot, while earlier ones stay
+    // as they were. The higher modified fee puts tx2 first.
+    pool.PrioritiseTransaction(tx2.GetHash(), tx2.GetHash().ToString(), 0, 500);
+    auto prioritised = pool.GetSnapshot();
+    BOOST_CHECK(prioritised != snapshot);
+    BOOST_CHECK(prioritised->vEntries[0].GetTx().GetHash() == tx2.GetHash());
+    BOOST_CHECK_EQUAL(prioritised->vEntries[0].GetModifiedFee(), 1500);
+    for (const CTxMemPoolEntry& e : snapshot->vEntries) {
+        BOOST_CHECK_EQUAL(e.GetModifiedFee(), 1000);
+    }
+
+    std::list<CTransaction> removed;
+    pool.remove(tx1, removed, true);
+    BOOST_CHECK(pool.GetSnapshot()->vEntries.empty());
+    BOOST_CHECK(!pool.GetSnapshot()->exists(tx1.GetHash()));
+    BOOST_CHECK_EQUAL(prioritised->vEntries.size(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(MempoolTxDataTest)
+{
+    TestMemPoolEntryHelper entry;
+    CTxMemPool pool(CFeeRate(0));
+
+    CMutableTransaction mtx;
+    mtx.vin.resize(1);
+    mtx.vin[0].scriptSig = CScript() << OP_11;
+    mtx.vout.resize(1);
+    mtx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+    mtx.vout[0].nValue = 10000LL;
+    CTransaction tx(mtx);
+
+    auto txdata = std::make_shared<const PrecomputedTransactionData>(tx, std::vector<CTxOut>());
+    CTxMemPoolEntry e = entry.BranchId(SPROUT_BRANCH_ID).FromTx(mtx);
+    size_t nUsage = e.DynamicMemoryUsage();
+    e.SetTxData(txdata);
+    BOOST_CHECK(e.DynamicMemoryUsage() > nUsage);
+    BOOST_CHECK(!pool.GetTxData(tx.GetWTxId(), SPROUT_BRANCH_ID));
+    pool.addUnchecked(tx.GetHash(), e);
+
+    // Only handed out for the same wtxid and consensus branch.
+    BOOST_CHECK(pool.GetTxData(tx.GetWTxId(), SPROUT_BRANCH_ID) == txdata);
+    BOOST_CHECK(!pool.GetTxData(tx.GetWTxId(), NetworkUpgradeInfo[Consensus::UPGRADE_OVERWINTER].nBranchId));
+    BOOST_CHECK(!pool.GetTxData(WTxId(tx.GetHash(), GetRandHash()), SPROUT_BRANCH_ID));
+
+    std::list<CTransaction> removed;
+    pool.remove(tx, removed, true);
+    BOOST_CHECK(!pool.GetTxData(tx.GetWTxId(), SPROUT_BRANCH_ID));
+}
+
 BOOST_AUTO_TEST_CASE(MempoolIndexingTest)
 {
     CTxMemPool pool(CFeeRate(0));
@@ -237,6 +388,41 @@ BOOST_AUTO_TEST_CASE(RemoveWithoutBranchId) {
     BOOST_CHECK_EQUAL(pool.size(), 0);
 }
 
+BOOST_AUTO_TEST_CASE(RemoveExpired) {
+    CTxMemPool pool(CFeeRate(0));
+    TestMemPoolEntryHelper entry;
+    entry.hadNoDependencies = true;
+
+    // Transactions expiring after heights 0 (never) to 9.
+    std::map<uint256, uint32_t> mapExpiry;
+    for (uint32_t i = 0; i < 20; i++) {
+        CMutableTransaction tx = CMutableTransaction();
+        tx.vout.resize(1);
+        tx.vout[0].scriptPubKey = CScript() << OP_11 << OP_EQUAL;
+        tx.vout[0].nValue = (i + 1) * COIN;
+        tx.nExpiryHeight = i % 10;
+        pool.addUnchecked(tx.GetHash(), entry.FromTx(tx));
+        mapExpiry[tx.GetHash()] = tx.nExpiryHeight;
+    }
+
+    // Each height removes exactly the transactions that expire at it.
+    for (unsigned int nHeight = 1; nHeight <= 10; nHeight++) {
+        std::vector<uint256> ids = pool.removeExpired(nHeight);
+        BOOST_CHECK_EQUAL(ids.size(), nHeight == 1 ? 0 : 2);
+        for (const uint256& id : ids) {
+            BOOST_CHECK_EQUAL(mapExpiry[id], nHeight - 1);
+        }
+        BOOST_CHECK_EQUAL(pool.size(), 20 - (nHeight - 1) * 2);
+    }
+
+    // Only the transactions that never expire are left.
+    BOOST_CHECK(pool.removeExpired(1000000).empty());
+    for (const CTxMemPoolEntry& e : pool.mapTx) {
+        BOOST_CHECK_EQUAL(e.GetTx().nExpiryHeight, 0);
+    }
+    BOOST_CHECK_EQUAL(pool.size(), 2);
+}
+
 // Test that nCheckFrequency is set correctly when calling setSanityCheck().
 // https://github.com/zcash/zcash/issues/3134
 BOOST_AUTO_TEST_CASE(SetSanityCheck) {
@@ -247,4 +433,78 @@ BOOST_AUTO_TEST_CASE(SetSanityCheck) {
     BOOST_CHECK_EQUAL(pool.GetCheckFrequency(), 0);
 }
 
+#ifdef ENABLE_MINING
+BOOST_FIXTURE_TEST_CASE(MempoolDumpAndLoad, TestChain100Setup)
+{
+    CScript scriptPubKey = CScript() << ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+    auto spend = [&](const CTransaction& txFrom, CAmount nValue) {
+        CMutableTransaction mtx;
+        mtx.vin.resize(1);
+        mtx.vin[0].prevout.hash = txFrom.GetHash();
+        mtx.vin[0].prevout.n = 0;
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = nValue;
+        mtx.vout[0].scriptPubKey = scriptPubKey;
+
+        const PrecomputedTransactionData txdata(mtx, {txFrom.vout[0]});
+        std::vector<unsigned char> vchSig;
+        uint256 hash = SignatureHash(scriptPubKey, mtx, 0, SIGHASH_ALL, txFrom.vout[0].nValue, SPROUT_BRANCH_ID, txdata);
+        BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+        vchSig.push_back((unsigned char)SIGHASH_ALL);
+        mtx.vin[0].scriptSig << vchSig;
+        return CTransaction(mtx);
+    };
+
+    // The child pays the higher fee rate, so it is ahead of its parent in the
+    // mempool, but has to be written after it.
+    CTransaction parent = spend(coinbaseTxns[0], coinbaseTxns[0].vout[0].nValue - 1000);
+    CTransaction child = spend(parent, 11*CENT);
+
+    int64_t nTime = GetTime();
+    SetMockTime(nTime);
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_CHECK(AcceptToMemoryPool(Params(), mempool, state, parent, false, nullptr));
+        BOOST_CHECK(AcceptToMemoryPool(Params(), mempool, state, child, false, nullptr));
+    }
+    uint256 hashUnknown = GetRandHash();
+    mempool.PrioritiseTransaction(child.GetHash(), child.GetHash().ToString(), 1.0, 500);
+    mempool.PrioritiseTransaction(hashUnknown, hashUnknown.ToString(), 0, 700);
+    BOOST_CHECK(DumpMempool());
+
+    mempool.clear();
+    {
+        LOCK(mempool.cs);
+        mempool.mapDeltas.clear();
+    }
+    SetMockTime(nTime + 600);
+    BOOST_CHECK(LoadMempool(Params()));
+
+    BOOST_CHECK_EQUAL(mempool.size(), 2);
+    {
+        LOCK(mempool.cs);
+        auto it = mempool.mapTx.find(child.GetHash());
+        BOOST_CHECK(it != mempool.mapTx.end());
+        BOOST_CHECK_EQUAL(it->GetTime(), nTime);
+        BOOST_CHECK_EQUAL(it->GetModifiedFee(), parent.vout[0].nValue - child.vout[0].nValue + 500);
+        BOOST_CHECK(mempool.mapTx.find(parent.GetHash()) != mempool.mapTx.end());
+        BOOST_CHECK_EQUAL(mempool.mapDeltas.size(), 2);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[child.GetHash()].first, 1.0);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[hashUnknown].second, 700);
+    }
+
+    // A version that is not known is ignored.
+    {
+        CAutoFile file(fsbridge::fopen(GetDataDir() / "mempool.dat", "wb"), SER_DISK, CLIENT_VERSION);
+        file << (uint64_t)2;
+    }
+    mempool.clear();
+    BOOST_CHECK(!LoadMempool(Params()));
+    BOOST_CHECK_EQUAL(mempool.size(), 0);
+
+    SetMockTime(0);
+}
+#endif // ENABLE_MINING
+
 BOOST_AUTO_TEST_SUITE_END()
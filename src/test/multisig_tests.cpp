@@ -7,11 +7,13 @@
 #include "key.h"
 #include "keystore.h"
 #include "policy/policy.h"
+#include "random.h"
 #include "script/script.h"
 #include "script/script_error.h"
 #include "script/interpreter.h"
 #include "script/sign.h"
 #include "script/ismine.h"
+#include "script/standard.h"
 #include "uint256.h"
 #include "test/test_bitcoin.h"
 
@@ -235,5 +237,71 @@ BOOST_DATA_TEST_CASE(multisig_Sign, boost::unit_test::data::xrange(static_cast<i
     }
 }
 
+// Parameterized testing over consensus branch ids
+BOOST_DATA_TEST_CASE(multisig_ProduceSignatures, boost::unit_test::data::xrange(static_cast<int>(Consensus::MAX_NETWORK_UPGRADES)))
+{
+    uint32_t consensusBranchId = NetworkUpgradeInfo[sample].nBranchId;
+
+    // Test ProduceSignatures() over enough inputs for several threads, with
+    // keys and a redeem script shared between them.
+    CBasicKeyStore keystore;
+    CKey key[3];
+    for (int i = 0; i < 3; i++)
+    {
+        key[i] = CKey::TestOnlyRandomKey(true);
+        keystore.AddKey(key[i]);
+    }
+
+    CScript escrow;
+    escrow << OP_2 << ToByteVector(key[0].GetPubKey()) << ToByteVector(key[1].GetPubKey()) << ToByteVector(key[2].GetPubKey()) << OP_3 << OP_CHECKMULTISIG;
+    keystore.AddCScript(escrow);
+
+    std::vector<CTxOut> vPrevOutputs;
+    for (int i = 0; i < 30; i++)
+    {
+        CScript scriptPubKey;
+        if (i % 5 == 4) {
+            scriptPubKey = GetScriptForDestination(CScriptID(escrow));
+        } else {
+            scriptPubKey = GetScriptForDestination(key[i % 3].GetPubKey().GetID());
+        }
+        vPrevOutputs.push_back(CTxOut(10 + i, scriptPubKey));
+    }
+
+    CMutableTransaction txTo;
+    txTo.vin.resize(vPrevOutputs.size());
+    for (size_t i = 0; i < txTo.vin.size(); i++)
+    {
+        txTo.vin[i].prevout.n = i;
+        txTo.vin[i].prevout.hash = GetRandHash();
+    }
+    txTo.vout.resize(1);
+    txTo.vout[0].nValue = 1;
+
+    {
+        CTransaction tx(txTo);
+        PrecomputedTransactionData txdata(tx, vPrevOutputs);
+        std::vector<SignatureData> vSigData;
+        BOOST_CHECK(ProduceSignatures(keystore, tx, txdata, vPrevOutputs, SIGHASH_ALL, consensusBranchId, vSigData));
+        BOOST_CHECK_EQUAL(vSigData.size(), vPrevOutputs.size());
+        for (size_t i = 0; i < vSigData.size(); i++)
+        {
+            ScriptError err;
+            BOOST_CHECK_MESSAGE(VerifyScript(vSigData[i].scriptSig, vPrevOutputs[i].scriptPubKey, STANDARD_SCRIPT_VERIFY_FLAGS,
+                                             TransactionSignatureChecker(&tx, txdata, i, vPrevOutputs[i].nValue), consensusBranchId, &err),
+                                strprintf("ProduceSignatures %d", i));
+        }
+    }
+
+    // An input whose key is missing fails the whole transaction.
+    vPrevOutputs[7].scriptPubKey = GetScriptForDestination(CKey::TestOnlyRandomKey(true).GetPubKey().GetID());
+    {
+        CTransaction tx(txTo);
+        PrecomputedTransactionData txdata(tx, vPrevOutputs);
+        std::vector<SignatureData> vSigData;
+        BOOST_CHECK(!ProduceSignatures(keystore, tx, txdata, vPrevOutputs, SIGHASH_ALL, consensusBranchId, vSigData));
+    }
+}
+
 
 BOOST_AUTO_TEST_SUITE_END()
@@ -143,4 +143,39 @@ BOOST_AUTO_TEST_CASE(caddrdb_read_corrupted)
     BOOST_CHECK(addrman2.size() == 0);
 }
 
+BOOST_AUTO_TEST_CASE(cnetmessage_hash)
+{
+    std::vector<unsigned char> vPayload(100000);
+    for (size_t i = 0; i < vPayload.size(); i++)
+        vPayload[i] = i * 7;
+
+    CDataStream ssMsg(SER_NETWORK, PROTOCOL_VERSION);
+    ssMsg << CMessageHeader(Params().MessageStart(), "block", vPayload.size());
+    ssMsg.write((const char*)vPayload.data(), vPayload.size());
+
+    // The data is hashed as it arrives, in pieces of any size.
+    CNetMessage msg(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+    const char* pch = &ssMsg[0];
+    unsigned int nBytes = ssMsg.size();
+    unsigned int nChunk = 1;
+    while (nBytes > 0) {
+        unsigned int nSize = std::min(nChunk, nBytes);
+        int handled = msg.in_data ? msg.readData(pch, nSize) : msg.readHeader(pch, nSize);
+        BOOST_REQUIRE(handled > 0);
+        pch += handled;
+        nBytes -= handled;
+        nChunk = nChunk * 3 + 1;
+    }
+    BOOST_REQUIRE(msg.complete());
+    BOOST_CHECK(msg.GetMessageHash() == Hash(vPayload.begin(), vPayload.end()));
+
+    // An empty message hashes to the hash of no data.
+    CDataStream ssEmpty(SER_NETWORK, PROTOCOL_VERSION);
+    ssEmpty << CMessageHeader(Params().MessageStart(), "verack", 0);
+    CNetMessage msgEmpty(Params().MessageStart(), SER_NETWORK, PROTOCOL_VERSION);
+    BOOST_CHECK_EQUAL(msgEmpty.readHeader(&ssEmpty[0], ssEmpty.size()), (int)ssEmpty.size());
+    BOOST_REQUIRE(msgEmpty.complete());
+    BOOST_CHECK(msgEmpty.GetMessageHash() == Hash(vPayload.begin(), vPayload.begin()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -50,6 +50,7 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
 
         // calculate actual merkle root and height
         uint256 merkleRoot1 = block.BuildMerkleTree();
+        BOOST_CHECK(block.ComputeMerkleRoot() == merkleRoot1);
         std::vector<uint256> vTxid(nTx, uint256());
         for (unsigned int j=0; j<nTx; j++)
             vTxid[j] = block.vtx[j].GetHash();
@@ -109,6 +110,28 @@ BOOST_AUTO_TEST_CASE(pmt_test1)
     }
 }
 
+BOOST_AUTO_TEST_CASE(compute_merkle_root_mutation)
+{
+    // Repeating the last two transactions leaves the root unchanged, and is
+    // detected whether or not the in-memory tree is built.
+    CBlock block;
+    for (unsigned int j = 0; j < 6; j++) {
+        CMutableTransaction tx;
+        tx.nLockTime = j;
+        block.vtx.push_back(CTransaction(tx));
+    }
+    bool fMutated = true;
+    uint256 root = block.ComputeMerkleRoot(&fMutated);
+    BOOST_CHECK(!fMutated);
+    block.vtx.push_back(block.vtx[4]);
+    block.vtx.push_back(block.vtx[5]);
+    BOOST_CHECK(block.ComputeMerkleRoot(&fMutated) == root);
+    BOOST_CHECK(fMutated);
+    fMutated = false;
+    BOOST_CHECK(block.BuildMerkleTree(&fMutated) == root);
+    BOOST_CHECK(fMutated);
+}
+
 BOOST_AUTO_TEST_CASE(pmt_malleability)
 {
     std::vector<uint256> vTxid = boost::assign::list_of
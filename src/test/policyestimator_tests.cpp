@@ -183,6 +183,14 @@ BOOST_AUTO_TEST_CASE(BlockPolicyEstimates)
         BOOST_CHECK(mpool.estimateFee(i).GetFeePerK() < origFeeEst[i-1] - deltaFee);
         BOOST_CHECK(mpool.estimatePriority(i) < origPriEst[i-1] - deltaPri);
     }
+
+    // All of the transactions were transparent, so there is nothing to
+    // estimate the fees of shielded transactions from.
+    for (int i = 1; i < 10; i++) {
+        BOOST_CHECK(mpool.estimateFee(i, FEE_ESTIMATE_TRANSPARENT) == mpool.estimateFee(i));
+        BOOST_CHECK(mpool.estimateFee(i, FEE_ESTIMATE_SAPLING) == CFeeRate(0));
+        BOOST_CHECK(mpool.estimateFee(i, FEE_ESTIMATE_ORCHARD) == CFeeRate(0));
+    }
 }
 
 
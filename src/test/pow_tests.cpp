@@ -165,4 +165,26 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test_blossom)
     RegtestDeactivateBlossom();
 }
 
+BOOST_AUTO_TEST_CASE(check_equihash_solutions)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+    CBlockHeader genesis = Params().GenesisBlock().GetBlockHeader();
+    BOOST_CHECK(CheckEquihashSolution(&genesis, params));
+
+    std::vector<CBlockHeader> headers(5, genesis);
+    BOOST_CHECK(CheckEquihashSolutions(headers, params));
+    BOOST_CHECK(CheckEquihashSolutions({}, params));
+
+    // One bad solution fails the batch.
+    headers[3].nSolution[100] ^= 1;
+    BOOST_CHECK(!CheckEquihashSolution(&headers[3], params));
+    BOOST_CHECK(!CheckEquihashSolutions(headers, params));
+
+    // So does one of the wrong length.
+    headers[3] = genesis;
+    headers[4].nSolution.pop_back();
+    BOOST_CHECK(!CheckEquihashSolutions(headers, params));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,52 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "rpc/responsecache.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(responsecache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(render_confirmations)
+{
+    // Only the members that hold the confirmations the text was made with
+    // are filled in again.
+    const std::string strJSON =
+        "{\"hash\":\"00ab\",\"confirmations\":120,\"note\":\"\\\"confirmations\\\":120,\","
+        "\"tx\":[{\"confirmations\":1200},{\"confirmations\":120}],\"height\":7}";
+    CCachedResponse entry(strJSON, 120, uint256(), uint256());
+    BOOST_CHECK_EQUAL(entry.Render(120), strJSON);
+    BOOST_CHECK_EQUAL(entry.Render(1000),
+        "{\"hash\":\"00ab\",\"confirmations\":1000,\"note\":\"\\\"confirmations\\\":120,\","
+        "\"tx\":[{\"confirmations\":1200},{\"confirmations\":1000}],\"height\":7}");
+
+    // Results without confirmations are served as they are.
+    CCachedResponse hex("\"0400000001\"", 120, uint256(), uint256());
+    BOOST_CHECK_EQUAL(hex.Render(121), "\"0400000001\"");
+}
+
+BOOST_AUTO_TEST_CASE(evict_least_recently_used)
+{
+    CResponseCache cache(0);
+    CResponseCache::Entry entry = std::make_shared<const CCachedResponse>(std::string(1000, 'a'), 1, uint256(), uint256());
+    cache.Insert("a", entry);
+    BOOST_CHECK(!cache.Get("a"));
+
+    cache.SetMaxSize(3 * entry->size());
+    cache.Insert("a", entry);
+    cache.Insert("b", entry);
+    BOOST_CHECK(cache.Get("a"));
+    cache.Insert("c", entry);
+    cache.Insert("c", entry);
+    BOOST_CHECK(cache.Get("a"));
+    BOOST_CHECK(!cache.Get("b"));
+    BOOST_CHECK(cache.Get("c"));
+
+    cache.SetMaxSize(2 * entry->size());
+    BOOST_CHECK(!cache.Get("a"));
+    BOOST_CHECK(cache.Get("c"));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
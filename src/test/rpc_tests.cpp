@@ -7,9 +7,11 @@
 #include "rpc/client.h"
 
 #include "experimental_features.h"
+#include "insightindex.h"
 #include "key_io.h"
 #include "main.h"
 #include "netbase.h"
+#include "rpc/jsonstream.h"
 #include "util/strencodings.h"
 
 #include "test/test_bitcoin.h"
@@ -19,8 +21,13 @@
 
 #include <univalue.h>
 
+#include <thread>
+
 using namespace std;
 
+extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern void blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails, CJSONStreamWriter& writer);
+
 BOOST_FIXTURE_TEST_SUITE(rpc_tests, TestingSetup)
 
 BOOST_AUTO_TEST_CASE(rpc_rawparams)
@@ -341,6 +348,7 @@ BOOST_AUTO_TEST_CASE(rpc_insightexplorer)
     CheckRPCThrows("getblockhashes 0 0",
         "Error: getblockhashes is disabled. "
         "Run './zcash-cli help getblockhashes' for instructions on how to enable this feature.");
+    BOOST_CHECK(CallRPC("getindexinfo").get_obj().empty());
 
     fExperimentalInsightExplorer = true;
     // During startup of the real system, fExperimentalInsightExplorer ("-insightexplorer")
@@ -348,6 +356,22 @@ BOOST_AUTO_TEST_CASE(rpc_insightexplorer)
     fAddressIndex = true;
     fSpentIndex = true;
     fTimestampIndex = true;
+    // Likewise the indexes are opened at startup, and kept in sync by their
+    // own thread; here they are synced once.
+    pinsightindex = new CInsightIndex(0, 1 << 20, 1 << 20, 1 << 20, 0, 0, 0, true);
+    {
+        LOCK(cs_main);
+        std::string strError;
+        BOOST_CHECK(pinsightindex->Init(strError));
+    }
+    BOOST_CHECK(pinsightindex->Sync());
+
+    UniValue indexInfo = CallRPC("getindexinfo");
+    BOOST_CHECK_EQUAL(indexInfo.size(), 3U);
+    BOOST_CHECK(find_value(find_value(indexInfo, "addressindex"), "synced").get_bool());
+    BOOST_CHECK_EQUAL(find_value(find_value(indexInfo, "timestampindex"), "best_block_height").get_int(), 0);
+    BOOST_CHECK_EQUAL(CallRPC("getindexinfo spentindex").size(), 1U);
+    BOOST_CHECK(CallRPC("getindexinfo txindex").empty());
 
     // must be a legal mainnet address
     const string addr = "t1T3G72ToPuCDTiCEytrU1VUBRHsNupEBut";
@@ -407,10 +431,135 @@ BOOST_AUTO_TEST_CASE(rpc_insightexplorer)
         "Error parsing JSON:{\"noOrphans\":True,\"logicalTimes\":false}");
 
     // revert
+    delete pinsightindex;
+    pinsightindex = NULL;
     fExperimentalInsightExplorer = false;
     fAddressIndex = false;
     fSpentIndex = false;
     fTimestampIndex = false;
 }
 
+BOOST_AUTO_TEST_CASE(rpc_json_stream)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.pushKV("a \"quoted\" key", "line\nbreak");
+    obj.pushKV("empty", UniValue(UniValue::VARR));
+    UniValue arr(UniValue::VARR);
+    arr.push_back(1);
+    arr.push_back(UniValue(UniValue::VOBJ));
+    arr.push_back(NullUniValue);
+    obj.pushKV("arr", arr);
+    obj.pushKV("flag", true);
+
+    // Written in pieces, the text is the same as UniValue writes.
+    std::string strStreamed;
+    size_t nChunks = 0;
+    {
+        CJSONStreamWriter writer([&](const char* data, size_t len) {
+            strStreamed.append(data, len);
+            nChunks++;
+        });
+        writer.BeginObject();
+        writer.KeyValue("a \"quoted\" key", "line\nbreak");
+        writer.Key("empty");
+        writer.BeginArray();
+        writer.EndArray();
+        writer.Key("arr");
+        writer.BeginArray();
+        writer.Value(1);
+        writer.BeginObject();
+        writer.EndObject();
+        writer.Value(NullUniValue);
+        writer.EndArray();
+        writer.Members(UniValue(UniValue::VOBJ));
+        writer.KeyValue("flag", true);
+        writer.EndObject();
+        BOOST_CHECK(strStreamed.empty());
+        writer.Flush();
+    }
+    BOOST_CHECK_EQUAL(strStreamed, obj.write());
+    BOOST_CHECK_EQUAL(nChunks, 1);
+
+    // Large documents are handed over in chunks.
+    strStreamed.clear();
+    nChunks = 0;
+    UniValue big(UniValue::VARR);
+    {
+        CJSONStreamWriter writer([&](const char* data, size_t len) {
+            strStreamed.append(data, len);
+            nChunks++;
+        });
+        writer.BeginArray();
+        for (int i = 0; i < 10000; i++) {
+            std::string str(20, 'a' + i % 26);
+            big.push_back(str);
+            writer.Value(str);
+        }
+        writer.EndArray();
+        writer.Flush();
+    }
+    BOOST_CHECK_EQUAL(strStreamed, big.write());
+    BOOST_CHECK(nChunks > 1);
+
+    // Streaming a block gives the same JSON as building it.
+    LOCK(cs_main);
+    CBlock block;
+    BOOST_CHECK(ReadBlockFromDisk(block, chainActive.Tip(), Params().GetConsensus()));
+    std::string strBlock;
+    {
+        CJSONStreamWriter writer([&](const char* data, size_t len) { strBlock.append(data, len); });
+        blockToJSON(block, chainActive.Tip(), true, writer);
+        writer.Flush();
+    }
+    BOOST_CHECK_EQUAL(strBlock, blockToJSON(block, chainActive.Tip(), true).write());
+}
+
+BOOST_AUTO_TEST_CASE(rpc_batch_parallel)
+{
+    if (RPCIsInWarmup(nullptr))
+        SetRPCWarmupFinished();
+
+    UniValue vReq(UniValue::VARR);
+    std::vector<std::string> vMethods =
+        {"getblockcount", "getbestblockhash", "getblockhash", "getblockcount", "help", "getblockcount", "nosuchmethod"};
+    for (size_t i = 0; i < vMethods.size(); i++) {
+        UniValue req(UniValue::VOBJ);
+        req.pushKV("id", (int)i);
+        req.pushKV("method", vMethods[i]);
+        UniValue params(UniValue::VARR);
+        if (vMethods[i] == "getblockhash")
+            params.push_back(0);
+        req.pushKV("params", params);
+        vReq.push_back(req);
+    }
+    vReq.push_back("not an object");
+
+    std::vector<std::thread> vThreads;
+    auto queueWork = [&](const std::function<void()>& func) {
+        vThreads.emplace_back(func);
+        return true;
+    };
+    UniValue vReply;
+    BOOST_CHECK(vReply.read(JSONRPCExecBatch(vReq, queueWork)));
+    for (std::thread& t : vThreads)
+        t.join();
+    BOOST_CHECK(!vThreads.empty());
+
+    // The replies are in the order of the requests.
+    BOOST_CHECK_EQUAL(vReply.size(), vReq.size());
+    for (size_t i = 0; i < vMethods.size(); i++)
+        BOOST_CHECK_EQUAL(find_value(vReply[i], "id").get_int(), (int)i);
+    BOOST_CHECK_EQUAL(find_value(vReply[0], "result").get_int(), chainActive.Height());
+    BOOST_CHECK_EQUAL(find_value(vReply[1], "result").get_str(), chainActive.Tip()->GetBlockHash().GetHex());
+    BOOST_CHECK_EQUAL(find_value(vReply[2], "result").get_str(), Params().GenesisBlock().GetHash().GetHex());
+    BOOST_CHECK(find_value(vReply[4], "error").isNull());
+    BOOST_CHECK_EQUAL(find_value(find_value(vReply[6], "error"), "code").get_int(), RPC_METHOD_NOT_FOUND);
+    BOOST_CHECK(!find_value(vReply[7], "error").isNull());
+
+    // Without helpers, the batch is executed on the calling thread.
+    UniValue vSerialReply;
+    BOOST_CHECK(vSerialReply.read(JSONRPCExecBatch(vReq)));
+    BOOST_CHECK_EQUAL(vSerialReply.write(), vReply.write());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -108,4 +108,53 @@ BOOST_AUTO_TEST_CASE(manythreads)
     BOOST_CHECK_EQUAL(counterSum, 200);
 }
 
+BOOST_AUTO_TEST_CASE(long_running_tasks)
+{
+    // With two threads, a long-running task leaves the other thread to the
+    // short tasks, and a second long-running task waits for the first.
+    CScheduler scheduler;
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fRelease = false;
+    bool fShortDone = false;
+    int nLongRunning = 0;
+    int nMaxLongRunning = 0;
+    int nLongDone = 0;
+
+    CScheduler::Function longTask = [&]() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nMaxLongRunning = std::max(nMaxLongRunning, ++nLongRunning);
+        cond.notify_all();
+        cond.wait(lock, [&] { return fRelease; });
+        --nLongRunning;
+        ++nLongDone;
+    };
+    CScheduler::Function shortTask = [&]() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fShortDone = true;
+        cond.notify_all();
+    };
+
+    boost::chrono::system_clock::time_point now = boost::chrono::system_clock::now();
+    scheduler.schedule(longTask, now, true);
+    scheduler.schedule(longTask, now, true);
+    scheduler.schedule(shortTask, now + boost::chrono::milliseconds(10));
+
+    boost::thread_group threads;
+    for (int i = 0; i < 2; i++)
+        threads.create_thread(boost::bind(&CScheduler::serviceQueue, &scheduler));
+
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        BOOST_CHECK(cond.wait_for(lock, boost::chrono::seconds(10), [&] { return fShortDone && nLongRunning == 1; }));
+        fRelease = true;
+        cond.notify_all();
+    }
+
+    scheduler.stop(true);
+    threads.join_all();
+    BOOST_CHECK_EQUAL(nLongDone, 2);
+    BOOST_CHECK_EQUAL(nMaxLongRunning, 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -93,6 +93,23 @@ void DoTest(const CScript& scriptPubKey, const CScript& scriptSig, int flags, ui
         0, flags,
         consensusBranchId,
         NULL) == expect,message);
+
+    CDataStream sAllPrevOutputs(SER_NETWORK, PROTOCOL_VERSION);
+    sAllPrevOutputs << txCredit.vout;
+    zcash_script_error zerr;
+    void* preTx = zcash_script_new_precomputed_tx_v5(
+        (const unsigned char*)&stream[0], stream.size(),
+        (const unsigned char*)&sAllPrevOutputs[0], sAllPrevOutputs.size(),
+        &zerr);
+    BOOST_CHECK_MESSAGE(preTx != NULL && zerr == zcash_script_ERR_OK, message);
+    if (preTx != NULL) {
+        unsigned int nInFailed = UINT_MAX;
+        BOOST_CHECK_MESSAGE(zcash_script_verify_all_precomputed(
+            preTx, flags, consensusBranchId, &nInFailed, &zerr) == expect, message);
+        BOOST_CHECK_MESSAGE(zerr == zcash_script_ERR_OK, message);
+        BOOST_CHECK_MESSAGE(nInFailed == (expect ? UINT_MAX : 0), message);
+        zcash_script_free_precomputed_tx(preTx);
+    }
 #endif
 }
 
@@ -45,6 +45,32 @@ BOOST_AUTO_TEST_CASE(skiplist_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(blockindexarena_test)
+{
+    CBlockIndexArena arena;
+    std::vector<CBlockIndex*> vIndex;
+    for (size_t i = 0; i < 3 * CBlockIndexArena::CHUNK_SIZE + 1; i++) {
+        CBlockIndex* pindex = arena.Allocate();
+        BOOST_CHECK(pindex->pprev == NULL && pindex->nHeight == 0);
+        pindex->nHeight = i;
+        pindex->pprev = vIndex.empty() ? NULL : vIndex.back();
+        pindex->BuildSkip();
+        vIndex.push_back(pindex);
+    }
+    BOOST_CHECK_EQUAL(arena.size(), vIndex.size());
+
+    // Entries are contiguous within a chunk, and never move.
+    for (size_t i = 0; i < vIndex.size(); i++) {
+        BOOST_CHECK_EQUAL(vIndex[i]->nHeight, (int)i);
+        if (i % CBlockIndexArena::CHUNK_SIZE != 0)
+            BOOST_CHECK(vIndex[i] == vIndex[i - 1] + 1);
+    }
+    BOOST_CHECK(vIndex.back()->GetAncestor(1) == vIndex[1]);
+
+    arena.Clear();
+    BOOST_CHECK_EQUAL(arena.size(), 0);
+}
+
 BOOST_AUTO_TEST_CASE(getlocator_test)
 {
     // Build a main chain 100000 blocks long.
@@ -76,6 +102,7 @@ BOOST_AUTO_TEST_CASE(getlocator_test)
     // Build a CChain for the main branch.
     CChain chain;
     chain.SetTip(&vBlocksMain.back());
+    BOOST_CHECK(chain.PublishedTip() == chain.Tip());
 
     // Test 100 random starting points for locators.
     for (int n=0; n<100; n++) {
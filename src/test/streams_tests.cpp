@@ -6,6 +6,7 @@
 #include "main.h"
 #include "test/test_bitcoin.h"
 #include "test/test_random.h"
+#include "util/mappedfile.h"
 
 #include <boost/test/unit_test.hpp>
 
@@ -254,4 +255,90 @@ BOOST_AUTO_TEST_CASE(streams_buffered_file_rand)
     fs::remove("streams_test_tmp");
 }
 
+BOOST_AUTO_TEST_CASE(streams_mapped_file)
+{
+    FILE* file = fopen("streams_test_tmp", "w+b");
+    // The value at each offset is the offset.
+    for (uint8_t j = 0; j < 40; ++j) {
+        fwrite(&j, 1, 1, file);
+    }
+    fclose(file);
+
+    std::unique_ptr<CMappedFile> mapped = CMappedFile::Open("streams_test_tmp");
+#ifdef WIN32
+    BOOST_CHECK(!mapped);
+#else
+    BOOST_REQUIRE(mapped);
+    BOOST_CHECK_EQUAL(mapped->Size(), 40);
+
+    CSpanReader reader(222, 333, mapped->begin() + 10, mapped->end());
+    BOOST_CHECK_EQUAL(reader.GetType(), 222);
+    BOOST_CHECK_EQUAL(reader.GetVersion(), 333);
+    BOOST_CHECK_EQUAL(reader.size(), 30);
+
+    uint8_t i;
+    reader >> i;
+    BOOST_CHECK_EQUAL(i, 10);
+    reader.ignore(19);
+    reader >> i;
+    BOOST_CHECK_EQUAL(i, 30);
+    BOOST_CHECK_EQUAL(reader.size(), 9);
+
+    // Reading past the end of the mapping fails without consuming anything.
+    uint8_t a[10];
+    try {
+        reader.read((char*)a, sizeof(a));
+        BOOST_CHECK(false);
+    } catch (const std::exception& e) {
+        BOOST_CHECK(strstr(e.what(), "CSpanReader::read: end of data") != nullptr);
+    }
+    BOOST_CHECK_EQUAL(reader.size(), 9);
+    reader.read((char*)a, 9);
+    BOOST_CHECK_EQUAL(a[8], 39);
+    BOOST_CHECK(reader.empty());
+#endif
+
+    // Files that can't be opened are not mapped.
+    BOOST_CHECK(!CMappedFile::Open("streams_test_missing"));
+    mapped.reset();
+    fs::remove("streams_test_tmp");
+}
+
+BOOST_AUTO_TEST_CASE(streams_swap_and_clear)
+{
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << uint8_t(1) << uint8_t(2) << uint8_t(3);
+    uint8_t i;
+    ss >> i;
+
+    // Only the unread part is handed over, and the stream continues with
+    // the emptied buffer that replaced it.
+    CSerializeData d(1000, 'x');
+    const size_t nCapacity = d.capacity();
+    ss.SwapAndClear(d);
+    BOOST_CHECK(d == CSerializeData({2, 3}));
+    BOOST_CHECK(ss.empty());
+    ss << uint8_t(4);
+    BOOST_CHECK_EQUAL(ss.size(), 1);
+    BOOST_CHECK_EQUAL(ss[0], 4);
+    ss.SwapAndClear(d);
+    BOOST_CHECK(d == CSerializeData({4}));
+    BOOST_CHECK(d.capacity() >= nCapacity);
+}
+
+BOOST_AUTO_TEST_CASE(streams_serialize_to_vector)
+{
+    std::vector<std::string> vObj{"a", std::string(1000, 'b'), ""};
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << vObj << uint64_t(7);
+
+    // The vector holds the same bytes, in a buffer of exactly their size.
+    std::vector<unsigned char> vch = SerializeToVector(vObj, SER_DISK, CLIENT_VERSION);
+    BOOST_CHECK_EQUAL(vch.size(), GetSerializeSize(vObj, SER_DISK, CLIENT_VERSION));
+    BOOST_CHECK_EQUAL(vch.capacity(), vch.size());
+    CVectorWriter writer(SER_DISK, CLIENT_VERSION, vch);
+    writer << uint64_t(7);
+    BOOST_CHECK(std::equal(vch.begin(), vch.end(), ss.begin(), ss.end()));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -5,6 +5,10 @@
 #include <sync.h>
 #include <test/test_bitcoin.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include <boost/test/unit_test.hpp>
 
 namespace {
@@ -49,4 +53,47 @@ BOOST_AUTO_TEST_CASE(potential_deadlock_detected)
     #endif
 }
 
+BOOST_AUTO_TEST_CASE(lock_stats)
+{
+    Mutex mutex;
+    std::atomic<bool> fHeld{false};
+    int nLine = 0;
+    std::thread holder;
+    {
+        LOCK(mutex);
+        holder = std::thread([&] {
+            fHeld = true;
+            nLine = __LINE__ + 1;
+            LOCK(mutex);
+        });
+        while (!fHeld)
+            std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    holder.join();
+
+    // The other thread waited for the lock.
+    std::vector<CLockSiteStats> vStats = GetLockStats();
+    auto it = std::find_if(vStats.begin(), vStats.end(), [&](const CLockSiteStats& stats) {
+        return stats.nLine == nLine && stats.strFile == __FILE__;
+    });
+    BOOST_REQUIRE(it != vStats.end());
+    BOOST_CHECK_EQUAL(it->strName, "mutex");
+    BOOST_CHECK_EQUAL(it->nContentions, 1u);
+    BOOST_CHECK(it->nWaitMicros > 0 && it->nWaitMicros == it->nMaxWaitMicros);
+
+    // The hold times of one in LOCK_HOLD_SAMPLE_INTERVAL locks are sampled.
+    for (unsigned int i = 0; i < LOCK_HOLD_SAMPLE_INTERVAL; i++) {
+        nLine = __LINE__ + 1;
+        LOCK(mutex);
+    }
+    vStats = GetLockStats();
+    it = std::find_if(vStats.begin(), vStats.end(), [&](const CLockSiteStats& stats) {
+        return stats.nLine == nLine && stats.strFile == __FILE__;
+    });
+    BOOST_REQUIRE(it != vStats.end());
+    BOOST_CHECK_EQUAL(it->nHoldSamples, 1u);
+    BOOST_CHECK_EQUAL(it->nContentions, 0u);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -13,6 +13,7 @@
 #ifdef ENABLE_MINING
 #include "crypto/equihash.h"
 #endif
+#include "crypto/sha256.h"
 #include "fs.h"
 #include "key.h"
 #include "main.h"
@@ -46,6 +47,7 @@ extern void noui_connect();
 BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
 {
     assert(sodium_init() != -1);
+    SHA256AutoDetect();
     ECC_Start();
     SetupEnvironment();
     SetupNetworking();
@@ -58,7 +60,8 @@ BasicTestingSetup::BasicTestingSetup(const std::string& chainName)
     //     pTracingHandle = tracing_init(
     //         nullptr, 0,
     //         initialFilter.c_str(),
-    //         false);
+    //         false,
+    //         0);
     // }
 
     fCheckBlockIndex = true;
@@ -92,7 +95,8 @@ TestingSetup::TestingSetup(const std::string& chainName) : BasicTestingSetup(cha
         sapling_output_str.length(),
         reinterpret_cast<const codeunit*>(sprout_groth16_str.c_str()),
         sprout_groth16_str.length(),
-        // Only load the verifying keys, which some tests need.
+        // Only load the verifying keys, which some tests need; the proving
+        // keys are loaded if a test creates a proof.
         false
     );
 
@@ -0,0 +1,168 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "txreconciliation.h"
+#include "random.h"
+#include "streams.h"
+#include "util/time.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <set>
+
+#include <boost/test/unit_test.hpp>
+
+static WTxId RandomWTxId()
+{
+    return WTxId(GetRandHash(), GetRandHash());
+}
+
+static std::set<uint256> Hashes(const std::vector<WTxId>& vWTxIds)
+{
+    std::set<uint256> hashes;
+    for (const WTxId& wtxid : vWTxIds)
+        hashes.insert(wtxid.hash);
+    return hashes;
+}
+
+BOOST_FIXTURE_TEST_SUITE(txreconciliation_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(sketch_decode)
+{
+    // Fixed IDs, as a small share of random differences cannot be recovered.
+    std::vector<uint32_t> vShared, vOnlyA, vOnlyB;
+    for (uint32_t i = 0; i < 500; i++)
+        vShared.push_back(i * 2654435761u);
+    for (uint32_t i = 500; i < 520; i++) {
+        vOnlyA.push_back(i * 2654435761u);
+        vOnlyB.push_back((i + 20) * 2654435761u);
+    }
+
+    size_t nCells = CTxSketch::CellsForCapacity(vOnlyA.size() + vOnlyB.size());
+    CTxSketch a(nCells), b(nCells);
+    for (uint32_t id : vShared) {
+        a.Add(id);
+        b.Add(id);
+    }
+    for (uint32_t id : vOnlyA)
+        a.Add(id);
+    for (uint32_t id : vOnlyB)
+        b.Add(id);
+
+    // The sketch survives serialization.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << a;
+    CTxSketch received;
+    ss >> received;
+    BOOST_CHECK_EQUAL(received.size(), nCells);
+
+    BOOST_CHECK(received.Subtract(b));
+    std::vector<uint32_t> vHere, vThere;
+    BOOST_CHECK(received.Decode(vHere, vThere));
+    std::sort(vHere.begin(), vHere.end());
+    std::sort(vThere.begin(), vThere.end());
+    std::sort(vOnlyA.begin(), vOnlyA.end());
+    std::sort(vOnlyB.begin(), vOnlyB.end());
+    BOOST_CHECK(vHere == vOnlyA);
+    BOOST_CHECK(vThere == vOnlyB);
+
+    // A difference far beyond the capacity cannot be recovered.
+    CTxSketch small(CTxSketch::CellsForCapacity(2));
+    for (uint32_t id : vShared)
+        small.Add(id);
+    vHere.clear();
+    vThere.clear();
+    BOOST_CHECK(!small.Decode(vHere, vThere));
+
+    // Sketches of different sizes cannot be subtracted.
+    BOOST_CHECK(!small.Subtract(b));
+
+    // Sizes that are not a multiple of three are rejected.
+    CDataStream ssBad(SER_NETWORK, PROTOCOL_VERSION);
+    ssBad << std::vector<CTxSketch::Cell>(4);
+    BOOST_CHECK_THROW(ssBad >> received, std::ios_base::failure);
+}
+
+BOOST_AUTO_TEST_CASE(reconcile_sets)
+{
+    TxReconciliationTracker initiator, responder;
+    const NodeId peerResponder = 100, peerInitiator = 200;
+
+    // The first outbound peers are flooded to.
+    for (NodeId id = 0; id < MAX_OUTBOUND_FLOOD_TO; id++) {
+        initiator.PreRegisterPeer(id);
+        BOOST_CHECK_EQUAL(initiator.RegisterPeer(id, false, TXRECONCILIATION_VERSION, 1), TxReconciliationTracker::RECON_SUCCESS);
+        BOOST_CHECK(!initiator.AddToSet(id, RandomWTxId()));
+    }
+
+    // Handshake.
+    BOOST_CHECK_EQUAL(initiator.RegisterPeer(peerResponder, false, 1, 0), TxReconciliationTracker::RECON_NOT_FOUND);
+    uint64_t nSaltInitiator = initiator.PreRegisterPeer(peerResponder);
+    uint64_t nSaltResponder = responder.PreRegisterPeer(peerInitiator);
+    BOOST_CHECK_EQUAL(initiator.RegisterPeer(peerResponder, false, TXRECONCILIATION_VERSION, nSaltResponder), TxReconciliationTracker::RECON_SUCCESS);
+    BOOST_CHECK_EQUAL(responder.RegisterPeer(peerInitiator, true, TXRECONCILIATION_VERSION, nSaltInitiator), TxReconciliationTracker::RECON_SUCCESS);
+    BOOST_CHECK_EQUAL(responder.RegisterPeer(peerInitiator, true, TXRECONCILIATION_VERSION, nSaltInitiator), TxReconciliationTracker::RECON_ALREADY_REGISTERED);
+    initiator.PreRegisterPeer(300);
+    BOOST_CHECK_EQUAL(initiator.RegisterPeer(300, false, 0, 0), TxReconciliationTracker::RECON_PROTOCOL_VIOLATION);
+
+    std::vector<WTxId> vOnlyInitiator, vOnlyResponder;
+    for (int i = 0; i < 200; i++) {
+        WTxId wtxid = RandomWTxId();
+        BOOST_CHECK(initiator.AddToSet(peerResponder, wtxid));
+        BOOST_CHECK(responder.AddToSet(peerInitiator, wtxid));
+    }
+    for (int i = 0; i < 2; i++) {
+        vOnlyInitiator.push_back(RandomWTxId());
+        BOOST_CHECK(initiator.AddToSet(peerResponder, vOnlyInitiator.back()));
+        vOnlyResponder.push_back(RandomWTxId());
+        BOOST_CHECK(responder.AddToSet(peerInitiator, vOnlyResponder.back()));
+    }
+
+    // Only the initiator asks for reconciliations.
+    int64_t nLater = GetTimeMicros() + 3600 * 1000000LL;
+    uint32_t nSetSize;
+    BOOST_CHECK(!responder.ShouldRequest(peerInitiator, nLater, nSetSize));
+    BOOST_CHECK(initiator.ShouldRequest(peerResponder, nLater, nSetSize));
+    BOOST_CHECK_EQUAL(nSetSize, 202);
+
+    CTxSketch sketch;
+    BOOST_CHECK(responder.RespondToRequest(peerInitiator, nSetSize, sketch));
+    BOOST_CHECK(sketch.size() > 0);
+
+    bool fSuccess;
+    std::vector<WTxId> vAnnounceInitiator, vAnnounceResponder;
+    std::vector<uint32_t> vRequest;
+    BOOST_CHECK(initiator.HandleSketch(peerResponder, sketch, fSuccess, vAnnounceInitiator, vRequest));
+    BOOST_CHECK(fSuccess);
+    BOOST_CHECK_EQUAL(vRequest.size(), vOnlyResponder.size());
+    BOOST_CHECK(Hashes(vAnnounceInitiator) == Hashes(vOnlyInitiator));
+
+    // An unsolicited sketch is ignored.
+    BOOST_CHECK(!initiator.HandleSketch(peerResponder, sketch, fSuccess, vAnnounceInitiator, vRequest));
+
+    BOOST_CHECK(responder.HandleReconcilDiff(peerInitiator, true, vRequest, vAnnounceResponder));
+    BOOST_CHECK(Hashes(vAnnounceResponder) == Hashes(vOnlyResponder));
+    BOOST_CHECK(!responder.HandleReconcilDiff(peerInitiator, true, vRequest, vAnnounceResponder));
+
+    // When the sketch cannot be decoded, both sides announce their sets.
+    responder.AddToSet(peerInitiator, RandomWTxId());
+    for (int i = 0; i < 100; i++)
+        initiator.AddToSet(peerResponder, RandomWTxId());
+    BOOST_CHECK(initiator.ShouldRequest(peerResponder, 2 * nLater, nSetSize));
+    BOOST_CHECK(responder.RespondToRequest(peerInitiator, 1, sketch));
+    vAnnounceInitiator.clear();
+    vAnnounceResponder.clear();
+    BOOST_CHECK(initiator.HandleSketch(peerResponder, sketch, fSuccess, vAnnounceInitiator, vRequest));
+    BOOST_CHECK(!fSuccess);
+    BOOST_CHECK(vRequest.empty());
+    BOOST_CHECK_EQUAL(vAnnounceInitiator.size(), 100);
+    BOOST_CHECK(responder.HandleReconcilDiff(peerInitiator, false, vRequest, vAnnounceResponder));
+    BOOST_CHECK_EQUAL(vAnnounceResponder.size(), 1);
+
+    responder.ForgetPeer(peerInitiator);
+    BOOST_CHECK(!responder.IsPeerRegistered(peerInitiator));
+    BOOST_CHECK(!responder.AddToSet(peerInitiator, RandomWTxId()));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -622,4 +622,29 @@ BOOST_AUTO_TEST_CASE(test_ArbitraryIntStr)
         "309485009821345068724781055");
 }
 
+BOOST_AUTO_TEST_CASE(util_ParseThreadAffinity)
+{
+    std::string strError;
+
+    // Ranges are expanded, and later arguments add to earlier ones.
+    BOOST_CHECK(ParseThreadAffinity({"scriptcheck:0-3,8", "scriptcheck:2", "http:5"}, strError));
+    BOOST_CHECK(GetThreadAffinity("scriptcheck") == std::vector<int>({0, 1, 2, 3, 8}));
+    BOOST_CHECK(GetThreadAffinity("http") == std::vector<int>({5}));
+    BOOST_CHECK(GetThreadAffinity("proving").empty());
+
+    BOOST_CHECK(!ParseThreadAffinity({"validation:0"}, strError));
+    BOOST_CHECK(!ParseThreadAffinity({"scriptcheck"}, strError));
+    BOOST_CHECK(!ParseThreadAffinity({"scriptcheck:"}, strError));
+    BOOST_CHECK(!ParseThreadAffinity({"scriptcheck:3-1"}, strError));
+    BOOST_CHECK(!ParseThreadAffinity({"scriptcheck:-1"}, strError));
+    BOOST_CHECK(!ParseThreadAffinity({"scriptcheck:0-x"}, strError));
+    BOOST_CHECK(!ParseThreadAffinity({"scriptcheck:1024"}, strError));
+
+    // A failed parse leaves the previous settings in place.
+    BOOST_CHECK(GetThreadAffinity("http") == std::vector<int>({5}));
+
+    BOOST_CHECK(ParseThreadAffinity({}, strError));
+    BOOST_CHECK(GetThreadAffinity("scriptcheck").empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
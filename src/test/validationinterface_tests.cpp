@@ -0,0 +1,79 @@
+// Copyright (c) 2022 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "validationinterface.h"
+
+#include "primitives/block.h"
+#include "primitives/transaction.h"
+#include "random.h"
+
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <thread>
+
+#include <boost/test/unit_test.hpp>
+
+namespace {
+
+/** Records the updates it is sent, taking a while over each. */
+class SlowListener : public CValidationInterface
+{
+public:
+    std::vector<uint256> vUpdated;
+    std::vector<uint256> vBlocks;
+    std::atomic<int> nInFlight{0};
+
+protected:
+    void UpdatedTransaction(const uint256 &hash) override {
+        nInFlight++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        vUpdated.push_back(hash);
+        nInFlight--;
+    }
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, std::optional<MerkleFrontiers> added) override {
+        vBlocks.push_back(pblock->GetHash());
+    }
+};
+
+}
+
+BOOST_FIXTURE_TEST_SUITE(validationinterface_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(queued_validation_interface)
+{
+    SlowListener listener;
+    RegisterQueuedValidationInterface(&listener, "test", 2);
+
+    // The updates are delivered in order, after they are sent.
+    std::vector<uint256> vHashes;
+    for (int i = 0; i < 5; i++) {
+        vHashes.push_back(GetRandHash());
+        GetMainSignals().UpdatedTransaction(vHashes.back());
+    }
+
+    // The block is copied, so it need not outlive the update.
+    uint256 hashBlock;
+    {
+        CBlock block;
+        block.nNonce = GetRandHash();
+        hashBlock = block.GetHash();
+        GetMainSignals().ChainTip(nullptr, &block, std::nullopt);
+    }
+
+    SyncWithQueuedValidationInterfaces();
+    BOOST_CHECK_EQUAL(listener.nInFlight.load(), 0);
+    BOOST_CHECK(listener.vUpdated == vHashes);
+    BOOST_REQUIRE_EQUAL(listener.vBlocks.size(), 1);
+    BOOST_CHECK(listener.vBlocks[0] == hashBlock);
+
+    // Updates still queued are delivered when unregistering.
+    GetMainSignals().UpdatedTransaction(GetRandHash());
+    UnregisterValidationInterface(&listener);
+    BOOST_CHECK_EQUAL(listener.vUpdated.size(), 6);
+    GetMainSignals().UpdatedTransaction(GetRandHash());
+    BOOST_CHECK_EQUAL(listener.vUpdated.size(), 6);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
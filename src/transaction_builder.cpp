@@ -15,6 +15,8 @@
 #include <librustzcash.h>
 #include <rust/ed25519.h>
 
+#include <future>
+
 uint256 ProduceZip244SignatureHash(
     const CTransaction& tx,
     const std::vector<CTxOut>& allPrevOutputs,
@@ -92,6 +94,18 @@ std::optional<UnauthorizedBundle> Builder::Build() {
     }
 }
 
+bool UnauthorizedBundle::Prove()
+{
+    if (!inner) {
+        throw std::logic_error("orchard::UnauthorizedBundle has already been used");
+    }
+
+    if (!proven) {
+        proven.reset(orchard_unauthorized_bundle_prove(inner.get()));
+    }
+    return proven != nullptr;
+}
+
 std::optional<OrchardBundle> UnauthorizedBundle::ProveAndSign(
     const std::vector<libzcash::OrchardSpendingKey>& keys,
     uint256 sighash)
@@ -105,8 +119,15 @@ std::optional<OrchardBundle> UnauthorizedBundle::ProveAndSign(
         pKeys.push_back(key.inner.get());
     }
 
-    auto authorizedBundle = orchard_unauthorized_bundle_prove_and_sign(
-        inner.release(), pKeys.data(), pKeys.size(), sighash.begin());
+    OrchardBundlePtr* authorizedBundle;
+    if (proven) {
+        inner.reset();
+        authorizedBundle = orchard_proven_bundle_sign(
+            proven.release(), pKeys.data(), pKeys.size(), sighash.begin());
+    } else {
+        authorizedBundle = orchard_unauthorized_bundle_prove_and_sign(
+            inner.release(), pKeys.data(), pKeys.size(), sighash.begin());
+    }
     if (authorizedBundle == nullptr) {
         return std::nullopt;
     } else {
@@ -550,6 +571,16 @@ TransactionBuilderResult TransactionBuilder::Build()
         }
     }
 
+    // The Orchard proof does not depend on the rest of the transaction, so
+    // create it while the Sapling and Sprout proofs are being created. This
+    // waits for it on every return.
+    std::future<bool> orchardProof;
+    if (orchardBundle.has_value()) {
+        orchardProof = std::async(std::launch::async, [&]() {
+            return orchardBundle->Prove();
+        });
+    }
+
     //
     // Sapling spends and outputs
     //
@@ -635,6 +666,11 @@ TransactionBuilderResult TransactionBuilder::Build()
     // Signatures
     //
 
+    // A failed proof is retried, and reported, by ProveAndSign below.
+    if (orchardProof.valid()) {
+        orchardProof.wait();
+    }
+
     auto consensusBranchId = CurrentEpochBranchId(nHeight, consensusParams);
 
     // Empty output script.
@@ -703,19 +739,12 @@ TransactionBuilderResult TransactionBuilder::Build()
     // Transparent signatures
     CTransaction txNewConst(mtx);
     const PrecomputedTransactionData txdata(txNewConst, tIns);
-    for (int nIn = 0; nIn < mtx.vin.size(); nIn++) {
-        auto tIn = tIns[nIn];
-        SignatureData sigdata;
-        bool signSuccess = ProduceSignature(
-            TransactionSignatureCreator(
-                keystore, &txNewConst, txdata, nIn, tIn.nValue, SIGHASH_ALL),
-            tIn.scriptPubKey, sigdata, consensusBranchId);
-
-        if (!signSuccess) {
-            return TransactionBuilderResult("Failed to sign transaction");
-        } else {
-            UpdateTransaction(mtx, nIn, sigdata);
-        }
+    std::vector<SignatureData> vSigData;
+    if (!mtx.vin.empty() && !ProduceSignatures(*keystore, txNewConst, txdata, tIns, SIGHASH_ALL, consensusBranchId, vSigData)) {
+        return TransactionBuilderResult("Failed to sign transaction");
+    }
+    for (size_t nIn = 0; nIn < vSigData.size(); nIn++) {
+        UpdateTransaction(mtx, nIn, vSigData[nIn]);
     }
 
     return TransactionBuilderResult(CTransaction(mtx));
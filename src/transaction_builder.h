@@ -138,9 +138,12 @@ private:
     /// An optional Orchard bundle (with `nullptr` corresponding to `None`).
     /// Memory is allocated by Rust.
     std::unique_ptr<OrchardUnauthorizedBundlePtr, decltype(&orchard_unauthorized_bundle_free)> inner;
+    /// The bundle with its proof, once `Prove()` has been called.
+    /// Memory is allocated by Rust.
+    std::unique_ptr<OrchardProvenBundlePtr, decltype(&orchard_proven_bundle_free)> proven;
 
-    UnauthorizedBundle() : inner(nullptr, orchard_unauthorized_bundle_free) {}
-    UnauthorizedBundle(OrchardUnauthorizedBundlePtr* bundle) : inner(bundle, orchard_unauthorized_bundle_free) {}
+    UnauthorizedBundle() : inner(nullptr, orchard_unauthorized_bundle_free), proven(nullptr, orchard_proven_bundle_free) {}
+    UnauthorizedBundle(OrchardUnauthorizedBundlePtr* bundle) : inner(bundle, orchard_unauthorized_bundle_free), proven(nullptr, orchard_proven_bundle_free) {}
     friend class Builder;
     // The parentheses here are necessary to avoid the following compilation error:
     //     error: C++ requires a type specifier for all declarations
@@ -155,16 +158,26 @@ public:
     // UnauthorizedBundle should never be copied
     UnauthorizedBundle(const UnauthorizedBundle&) = delete;
     UnauthorizedBundle& operator=(const UnauthorizedBundle&) = delete;
-    UnauthorizedBundle(UnauthorizedBundle&& bundle) : inner(std::move(bundle.inner)) {}
+    UnauthorizedBundle(UnauthorizedBundle&& bundle) : inner(std::move(bundle.inner)), proven(std::move(bundle.proven)) {}
     UnauthorizedBundle& operator=(UnauthorizedBundle&& bundle)
     {
         if (this != &bundle) {
             inner = std::move(bundle.inner);
+            proven = std::move(bundle.proven);
         }
         return *this;
     }
 
-    /// Adds proofs and signatures to this bundle.
+    /// Creates the proof for this bundle, ahead of `ProveAndSign`. The proof
+    /// does not depend on the signature hash, so it can be created on another
+    /// thread while the rest of the transaction is built; the bundle must not
+    /// be otherwise used until this returns.
+    ///
+    /// Returns `false` if an error occurs.
+    bool Prove();
+
+    /// Adds proofs and signatures to this bundle. The proof is only created
+    /// here if `Prove()` has not already been called.
     ///
     /// Returns `std::nullopt` if an error occurs.
     ///
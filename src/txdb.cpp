@@ -7,14 +7,27 @@
 #include "txdb.h"
 
 #include "chainparams.h"
+#include "compat/byteswap.h"
 #include "hash.h"
+#include "init.h"
 #include "main.h"
 #include "pow.h"
+#include "random.h"
+#include "subtreeindex.h"
+#include "supplyindex.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util/system.h"
+#include "util/time.h"
 #include "zcash/History.hpp"
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <thread>
+
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -27,6 +40,7 @@ static const char DB_ORCHARD_ANCHOR = 'Y';
 static const char DB_NULLIFIER = 's';
 static const char DB_SAPLING_NULLIFIER = 'S';
 static const char DB_ORCHARD_NULLIFIER = 'O';
+static const char DB_COIN = 'C';
 static const char DB_COINS = 'c';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
@@ -47,15 +61,175 @@ static const char DB_MMR_ROOT = 'r';
 // insightexplorer
 static const char DB_ADDRESSINDEX = 'd';
 static const char DB_ADDRESSUNSPENTINDEX = 'u';
+static const char DB_ADDRESSBALANCE = 'k';
+static const char DB_ADDRESSBALANCES_FLAG = 'K';
 static const char DB_SPENTINDEX = 'p';
 static const char DB_TIMESTAMPINDEX = 'T';
 static const char DB_BLOCKHASHINDEX = 'h';
 
-CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe) {
+// lightwalletd
+static const char DB_SUBTREEINDEX = 'q';
+static const char DB_SUBTREECOUNT = 'Q';
+
+// block filters
+static const char DB_BLOCKFILTER = 'g';
+
+// value pools
+static const char DB_SUPPLYINDEX = 'v';
+
+namespace {
+
+struct CoinEntry {
+    COutPoint* outpoint;
+    char key;
+    CoinEntry(const COutPoint* ptr) : outpoint(const_cast<COutPoint*>(ptr)), key(DB_COIN) {}
+
+    template<typename Stream>
+    void Serialize(Stream &s) const {
+        s << key;
+        s << outpoint->hash;
+        s << VARINT(outpoint->n);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream& s) {
+        s >> key;
+        s >> outpoint->hash;
+        s >> VARINT(outpoint->n);
+    }
+};
+
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe)
+static char NullifierDBChar(ShieldedType type) {
+    switch (type) {
+        case SPROUT:
+            return DB_NULLIFIER;
+        case SAPLING:
+            return DB_SAPLING_NULLIFIER;
+        case ORCHARD:
+            return DB_ORCHARD_NULLIFIER;
+        default:
+            throw runtime_error("Unknown shielded type");
+    }
+}
+
+CNullifierFilter::CNullifierFilter() :
+    nBitMask(0), nInserted(0), nCapacity(0),
+    k0(GetRand(std::numeric_limits<uint64_t>::max())),
+    k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
+uint64_t CNullifierFilter::Hash(const uint256& nf) const {
+    return SipHashUint256(k0, k1, nf);
+}
+
+void CNullifierFilter::InsertHash(uint64_t hash) {
+    // Derive the probe positions from the two halves of the hash by double
+    // hashing; h2 is odd so that the probes are distinct.
+    uint64_t h1 = hash & 0xffffffff;
+    uint64_t h2 = (hash >> 32) | 1;
+    for (unsigned int i = 0; i < NUM_HASH_FUNCS; i++) {
+        uint64_t bit = (h1 + i * h2) & nBitMask;
+        vData[bit >> 6] |= uint64_t(1) << (bit & 63);
+    }
+    nInserted++;
+}
+
+void CNullifierFilter::Reset(const std::vector<uint64_t>& hashes) {
+    size_t nCapacityNew = std::max(MIN_CAPACITY, hashes.size() * 2);
+    uint64_t nBits = 64;
+    while (nBits < nCapacityNew * BITS_PER_ELEMENT) {
+        nBits <<= 1;
+    }
+
+    LOCK(cs);
+    vData.assign(nBits / 64, 0);
+    nBitMask = nBits - 1;
+    nInserted = 0;
+    nCapacity = nCapacityNew;
+    for (uint64_t hash : hashes) {
+        InsertHash(hash);
+    }
+}
+
+void CNullifierFilter::Insert(const uint256& nf) {
+    LOCK(cs);
+    if (nCapacity == 0) {
+        return;
+    }
+    InsertHash(Hash(nf));
+}
+
+bool CNullifierFilter::MayContain(const uint256& nf) const {
+    LOCK(cs);
+    if (nCapacity == 0) {
+        return true;
+    }
+    uint64_t hash = Hash(nf);
+    uint64_t h1 = hash & 0xffffffff;
+    uint64_t h2 = (hash >> 32) | 1;
+    for (unsigned int i = 0; i < NUM_HASH_FUNCS; i++) {
+        uint64_t bit = (h1 + i * h2) & nBitMask;
+        if (!(vData[bit >> 6] & (uint64_t(1) << (bit & 63)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool CNullifierFilter::IsSaturated() const {
+    LOCK(cs);
+    return nCapacity != 0 && nInserted > nCapacity;
+}
+
+size_t CNullifierFilter::DynamicMemoryUsage() const {
+    LOCK(cs);
+    return memusage::DynamicUsage(vData);
+}
+
+CCoinsViewDB::CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / dbName, nCacheSize, fMemory, fWipe, GetDBOptions("chainstate")) {
+    LoadNullifierFilter(SPROUT);
+    LoadNullifierFilter(SAPLING);
+    LoadNullifierFilter(ORCHARD);
+}
+
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, GetDBOptions("chainstate"))
 {
+    LoadNullifierFilter(SPROUT);
+    LoadNullifierFilter(SAPLING);
+    LoadNullifierFilter(ORCHARD);
+}
+
+void CCoinsViewDB::LoadNullifierFilter(ShieldedType type) {
+    int64_t nStart = GetTimeMillis();
+    char dbChar = NullifierDBChar(type);
+    CNullifierFilter& filter = nullifierFilters[type];
+
+    // Collect the hashes first, so that the filter can be sized for the
+    // number of nullifiers before anything is inserted.
+    std::vector<uint64_t> hashes;
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(dbChar, uint256()));
+    while (pcursor->Valid()) {
+        std::pair<char, uint256> key;
+        if (!pcursor->GetKey(key) || key.first != dbChar) {
+            break;
+        }
+        hashes.push_back(filter.Hash(key.second));
+        pcursor->Next();
+    }
+    filter.Reset(hashes);
+
+    LogPrint("coindb", "Loaded %u nullifiers of pool %d into a %.1fMiB filter in %dms\n",
+        hashes.size(), type, filter.DynamicMemoryUsage() * (1.0 / (1 << 20)), GetTimeMillis() - nStart);
+}
+
+void CCoinsViewDB::RefreshNullifierFilters() {
+    for (ShieldedType type : {SPROUT, SAPLING, ORCHARD}) {
+        if (nullifierFilters[type].IsSaturated()) {
+            LoadNullifierFilter(type);
+        }
+    }
 }
 
 bool CCoinsViewDB::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
@@ -96,29 +270,28 @@ bool CCoinsViewDB::GetOrchardAnchorAt(const uint256 &rt, OrchardMerkleFrontier &
 
 bool CCoinsViewDB::GetNullifier(const uint256 &nf, ShieldedType type) const {
     bool spent = false;
-    char dbChar;
-    switch (type) {
-        case SPROUT:
-            dbChar = DB_NULLIFIER;
-            break;
-        case SAPLING:
-            dbChar = DB_SAPLING_NULLIFIER;
-            break;
-        case ORCHARD:
-            dbChar = DB_ORCHARD_NULLIFIER;
-            break;
-        default:
-            throw runtime_error("Unknown shielded type");
+    char dbChar = NullifierDBChar(type);
+    if (!nullifierFilters[type].MayContain(nf)) {
+        return false;
     }
     return db.Read(make_pair(dbChar, nf), spent);
 }
 
-bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    return db.Read(CoinEntry(&outpoint), coin);
+}
+
+std::vector<std::optional<Coin>> CCoinsViewDB::GetCoins(const std::vector<COutPoint> &outpoints) const {
+    std::vector<CoinEntry> keys;
+    keys.reserve(outpoints.size());
+    for (const COutPoint& outpoint : outpoints) {
+        keys.emplace_back(&outpoint);
+    }
+    return db.ReadMany<Coin>(keys);
 }
 
-bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    return db.Exists(CoinEntry(&outpoint));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -162,12 +335,39 @@ HistoryIndex CCoinsViewDB::GetHistoryLength(uint32_t epochId) const {
 }
 
 HistoryNode CCoinsViewDB::GetHistoryAt(uint32_t epochId, HistoryIndex index) const {
-    HistoryNode mmrNode = {};
-
     if (index >= GetHistoryLength(epochId)) {
         throw runtime_error("History data inconsistent - reindex?");
     }
 
+    return ReadHistoryNode(epochId, index);
+}
+
+std::vector<HistoryNode> CCoinsViewDB::GetHistoryNodes(uint32_t epochId, const std::vector<HistoryIndex> &indices) const {
+    HistoryIndex historyLength = GetHistoryLength(epochId);
+
+    // Read the nodes in key order. The index is serialized little-endian, so
+    // that is the order of the byte-swapped indices.
+    std::vector<size_t> order(indices.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        if (indices[i] >= historyLength) {
+            throw runtime_error("History data inconsistent - reindex?");
+        }
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return bswap_64(indices[a]) < bswap_64(indices[b]);
+    });
+
+    std::vector<HistoryNode> nodes(indices.size());
+    for (size_t i : order) {
+        nodes[i] = ReadHistoryNode(epochId, indices[i]);
+    }
+    return nodes;
+}
+
+HistoryNode CCoinsViewDB::ReadHistoryNode(uint32_t epochId, HistoryIndex index) const {
+    HistoryNode mmrNode = {};
+
     if (libzcash::IsV1HistoryTree(epochId)) {
         // History nodes serialized by `zcashd` versions that were unaware of NU5, used
         // the previous shorter maximum serialized length. Because we stored this as an
@@ -205,24 +405,27 @@ uint256 CCoinsViewDB::GetHistoryRoot(uint32_t epochId) const {
     return root;
 }
 
-void BatchWriteNullifiers(CDBBatch& batch, CNullifiersMap& mapToUse, const char& dbChar)
+void BatchWriteNullifiers(CDBBatch& batch, const CNullifiersMap& mapToUse, const char& dbChar, CNullifierFilter& filter)
 {
-    for (CNullifiersMap::iterator it = mapToUse.begin(); it != mapToUse.end();) {
+    for (CNullifiersMap::const_iterator it = mapToUse.begin(); it != mapToUse.end(); it++) {
         if (it->second.flags & CNullifiersCacheEntry::DIRTY) {
-            if (!it->second.entered)
+            if (!it->second.entered) {
                 batch.Erase(make_pair(dbChar, it->first));
-            else
+            } else {
+                // The filter must learn of the nullifier before the batch
+                // is committed, or a lookup in between could miss it.
+                filter.Insert(it->first);
                 batch.Write(make_pair(dbChar, it->first), true);
+            }
             // TODO: changed++? ... See comment in CCoinsViewDB::BatchWrite. If this is needed we could return an int
         }
-        it = mapToUse.erase(it);
     }
 }
 
 template<typename Map, typename MapIterator, typename MapEntry, typename Tree>
-void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
+void BatchWriteAnchors(CDBBatch& batch, const Map& mapToUse, const char& dbChar)
 {
-    for (MapIterator it = mapToUse.begin(); it != mapToUse.end();) {
+    for (MapIterator it = mapToUse.begin(); it != mapToUse.end(); it++) {
         if (it->second.flags & MapEntry::DIRTY) {
             if (!it->second.entered)
                 batch.Erase(make_pair(dbChar, it->first));
@@ -233,13 +436,12 @@ void BatchWriteAnchors(CDBBatch& batch, Map& mapToUse, const char& dbChar)
             }
             // TODO: changed++?
         }
-        it = mapToUse.erase(it);
     }
 }
 
-void BatchWriteHistory(CDBBatch& batch, CHistoryCacheMap& historyCacheMap) {
+void BatchWriteHistory(CDBBatch& batch, const CHistoryCacheMap& historyCacheMap) {
     for (auto nextHistoryCache = historyCacheMap.begin(); nextHistoryCache != historyCacheMap.end(); nextHistoryCache++) {
-        auto historyCache = nextHistoryCache->second;
+        const auto& historyCache = nextHistoryCache->second;
         auto epochId = nextHistoryCache->first;
 
         // delete old entries since updateDepth
@@ -263,6 +465,41 @@ void BatchWriteHistory(CDBBatch& batch, CHistoryCacheMap& historyCacheMap) {
     }
 }
 
+/** Add the shielded state and best block markers of a cache flush to a batch. */
+static void BatchWriteChainState(CDBBatch& batch,
+                                 const uint256 &hashBlock,
+                                 const uint256 &hashSproutAnchor,
+                                 const uint256 &hashSaplingAnchor,
+                                 const uint256 &hashOrchardAnchor,
+                                 const CAnchorsSproutMap &mapSproutAnchors,
+                                 const CAnchorsSaplingMap &mapSaplingAnchors,
+                                 const CAnchorsOrchardMap &mapOrchardAnchors,
+                                 const CNullifiersMap &mapSproutNullifiers,
+                                 const CNullifiersMap &mapSaplingNullifiers,
+                                 const CNullifiersMap &mapOrchardNullifiers,
+                                 const CHistoryCacheMap &historyCacheMap,
+                                 std::array<CNullifierFilter, 3>& nullifierFilters)
+{
+    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::const_iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR);
+    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::const_iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
+    ::BatchWriteAnchors<CAnchorsOrchardMap, CAnchorsOrchardMap::const_iterator, CAnchorsOrchardCacheEntry, OrchardMerkleFrontier>(batch, mapOrchardAnchors, DB_ORCHARD_ANCHOR);
+
+    ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER, nullifierFilters[SPROUT]);
+    ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER, nullifierFilters[SAPLING]);
+    ::BatchWriteNullifiers(batch, mapOrchardNullifiers, DB_ORCHARD_NULLIFIER, nullifierFilters[ORCHARD]);
+
+    ::BatchWriteHistory(batch, historyCacheMap);
+
+    if (!hashBlock.IsNull())
+        batch.Write(DB_BEST_BLOCK, hashBlock);
+    if (!hashSproutAnchor.IsNull())
+        batch.Write(DB_BEST_SPROUT_ANCHOR, hashSproutAnchor);
+    if (!hashSaplingAnchor.IsNull())
+        batch.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
+    if (!hashOrchardAnchor.IsNull())
+        batch.Write(DB_BEST_ORCHARD_ANCHOR, hashOrchardAnchor);
+}
+
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
                               const uint256 &hashBlock,
                               const uint256 &hashSproutAnchor,
@@ -280,40 +517,355 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins,
     size_t changed = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
             else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+                batch.Write(entry, it->second.coin);
             changed++;
         }
         count++;
         it = mapCoins.erase(it);
     }
 
-    ::BatchWriteAnchors<CAnchorsSproutMap, CAnchorsSproutMap::iterator, CAnchorsSproutCacheEntry, SproutMerkleTree>(batch, mapSproutAnchors, DB_SPROUT_ANCHOR);
-    ::BatchWriteAnchors<CAnchorsSaplingMap, CAnchorsSaplingMap::iterator, CAnchorsSaplingCacheEntry, SaplingMerkleTree>(batch, mapSaplingAnchors, DB_SAPLING_ANCHOR);
-    ::BatchWriteAnchors<CAnchorsOrchardMap, CAnchorsOrchardMap::iterator, CAnchorsOrchardCacheEntry, OrchardMerkleFrontier>(batch, mapOrchardAnchors, DB_ORCHARD_ANCHOR);
+    BatchWriteChainState(batch, hashBlock, hashSproutAnchor, hashSaplingAnchor, hashOrchardAnchor,
+                         mapSproutAnchors, mapSaplingAnchors, mapOrchardAnchors,
+                         mapSproutNullifiers, mapSaplingNullifiers, mapOrchardNullifiers,
+                         historyCacheMap, nullifierFilters);
+    mapSproutAnchors.clear();
+    mapSaplingAnchors.clear();
+    mapOrchardAnchors.clear();
+    mapSproutNullifiers.clear();
+    mapSaplingNullifiers.clear();
+    mapOrchardNullifiers.clear();
+
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    bool ret = db.WriteBatch(batch);
+    RefreshNullifierFilters();
+    return ret;
+}
 
-    ::BatchWriteNullifiers(batch, mapSproutNullifiers, DB_NULLIFIER);
-    ::BatchWriteNullifiers(batch, mapSaplingNullifiers, DB_SAPLING_NULLIFIER);
-    ::BatchWriteNullifiers(batch, mapOrchardNullifiers, DB_ORCHARD_NULLIFIER);
+bool CCoinsViewDB::WriteSnapshot(const CCoinsMap &mapCoins,
+                                 const uint256 &hashBlock,
+                                 const uint256 &hashSproutAnchor,
+                                 const uint256 &hashSaplingAnchor,
+                                 const uint256 &hashOrchardAnchor,
+                                 const CAnchorsSproutMap &mapSproutAnchors,
+                                 const CAnchorsSaplingMap &mapSaplingAnchors,
+                                 const CAnchorsOrchardMap &mapOrchardAnchors,
+                                 const CNullifiersMap &mapSproutNullifiers,
+                                 const CNullifiersMap &mapSaplingNullifiers,
+                                 const CNullifiersMap &mapOrchardNullifiers,
+                                 const CHistoryCacheMap &historyCacheMap) {
+    CDBBatch batch(db);
+    size_t changed = 0;
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); it++) {
+        if (it->second.flags & CCoinsCacheEntry::DIRTY) {
+            CoinEntry entry(&it->first);
+            if (it->second.coin.IsSpent())
+                batch.Erase(entry);
+            else
+                batch.Write(entry, it->second.coin);
+            changed++;
+        }
+    }
 
-    ::BatchWriteHistory(batch, historyCacheMap);
+    BatchWriteChainState(batch, hashBlock, hashSproutAnchor, hashSaplingAnchor, hashOrchardAnchor,
+                         mapSproutAnchors, mapSaplingAnchors, mapOrchardAnchors,
+                         mapSproutNullifiers, mapSaplingNullifiers, mapOrchardNullifiers,
+                         historyCacheMap, nullifierFilters);
+
+    LogPrint("coindb", "Committing %u changed transaction outputs (out of %u) to coin database in the background...\n", (unsigned int)changed, (unsigned int)mapCoins.size());
+    bool ret = db.WriteBatch(batch);
+    RefreshNullifierFilters();
+    return ret;
+}
+
+CCoinsViewFlushLayer::~CCoinsViewFlushLayer() {
+    Sync();
+}
+
+bool CCoinsViewFlushLayer::GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const {
+    CAnchorsSproutMap::const_iterator it = cacheSproutAnchors.find(rt);
+    if (it != cacheSproutAnchors.end()) {
+        if (it->second.entered) {
+            tree = it->second.tree;
+            return true;
+        }
+        return false;
+    }
+    return db->GetSproutAnchorAt(rt, tree);
+}
+
+bool CCoinsViewFlushLayer::GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const {
+    CAnchorsSaplingMap::const_iterator it = cacheSaplingAnchors.find(rt);
+    if (it != cacheSaplingAnchors.end()) {
+        if (it->second.entered) {
+            tree = it->second.tree;
+            return true;
+        }
+        return false;
+    }
+    return db->GetSaplingAnchorAt(rt, tree);
+}
+
+bool CCoinsViewFlushLayer::GetOrchardAnchorAt(const uint256 &rt, OrchardMerkleFrontier &tree) const {
+    CAnchorsOrchardMap::const_iterator it = cacheOrchardAnchors.find(rt);
+    if (it != cacheOrchardAnchors.end()) {
+        if (it->second.entered) {
+            tree = it->second.tree;
+            return true;
+        }
+        return false;
+    }
+    return db->GetOrchardAnchorAt(rt, tree);
+}
+
+bool CCoinsViewFlushLayer::GetNullifier(const uint256 &nf, ShieldedType type) const {
+    const CNullifiersMap* cacheToUse;
+    switch (type) {
+        case SPROUT:
+            cacheToUse = &cacheSproutNullifiers;
+            break;
+        case SAPLING:
+            cacheToUse = &cacheSaplingNullifiers;
+            break;
+        case ORCHARD:
+            cacheToUse = &cacheOrchardNullifiers;
+            break;
+        default:
+            throw std::runtime_error("Unknown shielded type");
+    }
+    CNullifiersMap::const_iterator it = cacheToUse->find(nf);
+    if (it != cacheToUse->end())
+        return it->second.entered;
+    return db->GetNullifier(nf, type);
+}
+
+bool CCoinsViewFlushLayer::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
+    if (it != cacheCoins.end()) {
+        coin = it->second.coin;
+        return !coin.IsSpent();
+    }
+    return db->GetCoin(outpoint, coin);
+}
+
+std::vector<std::optional<Coin>> CCoinsViewFlushLayer::GetCoins(const std::vector<COutPoint> &outpoints) const {
+    std::vector<std::optional<Coin>> coins(outpoints.size());
+    std::vector<COutPoint> missing;
+    std::vector<size_t> missingPos;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        CCoinsMap::const_iterator it = cacheCoins.find(outpoints[i]);
+        if (it == cacheCoins.end()) {
+            missing.push_back(outpoints[i]);
+            missingPos.push_back(i);
+        } else if (!it->second.coin.IsSpent()) {
+            coins[i] = it->second.coin;
+        }
+    }
+    if (!missing.empty()) {
+        std::vector<std::optional<Coin>> fetched = db->GetCoins(missing);
+        for (size_t i = 0; i < missing.size(); i++) {
+            coins[missingPos[i]] = std::move(fetched[i]);
+        }
+    }
+    return coins;
+}
+
+bool CCoinsViewFlushLayer::HaveCoin(const COutPoint &outpoint) const {
+    CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
+    if (it != cacheCoins.end())
+        return !it->second.coin.IsSpent();
+    return db->HaveCoin(outpoint);
+}
 
+uint256 CCoinsViewFlushLayer::GetBestBlock() const {
     if (!hashBlock.IsNull())
-        batch.Write(DB_BEST_BLOCK, hashBlock);
-    if (!hashSproutAnchor.IsNull())
-        batch.Write(DB_BEST_SPROUT_ANCHOR, hashSproutAnchor);
-    if (!hashSaplingAnchor.IsNull())
-        batch.Write(DB_BEST_SAPLING_ANCHOR, hashSaplingAnchor);
-    if (!hashOrchardAnchor.IsNull())
-        batch.Write(DB_BEST_ORCHARD_ANCHOR, hashOrchardAnchor);
+        return hashBlock;
+    return db->GetBestBlock();
+}
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
-    return db.WriteBatch(batch);
+uint256 CCoinsViewFlushLayer::GetBestAnchor(ShieldedType type) const {
+    switch (type) {
+        case SPROUT:
+            if (!hashSproutAnchor.IsNull())
+                return hashSproutAnchor;
+            break;
+        case SAPLING:
+            if (!hashSaplingAnchor.IsNull())
+                return hashSaplingAnchor;
+            break;
+        case ORCHARD:
+            if (!hashOrchardAnchor.IsNull())
+                return hashOrchardAnchor;
+            break;
+        default:
+            throw std::runtime_error("Unknown shielded type");
+    }
+    return db->GetBestAnchor(type);
+}
+
+HistoryIndex CCoinsViewFlushLayer::GetHistoryLength(uint32_t epochId) const {
+    CHistoryCacheMap::const_iterator it = historyCacheMap.find(epochId);
+    if (it != historyCacheMap.end())
+        return it->second.length;
+    return db->GetHistoryLength(epochId);
+}
+
+HistoryNode CCoinsViewFlushLayer::GetHistoryAt(uint32_t epochId, HistoryIndex index) const {
+    CHistoryCacheMap::const_iterator it = historyCacheMap.find(epochId);
+    if (it != historyCacheMap.end()) {
+        const HistoryCache& historyCache = it->second;
+        if (index >= historyCache.length) {
+            throw std::runtime_error("Invalid history request");
+        }
+        if (index >= historyCache.updateDepth) {
+            return historyCache.appends.at(index);
+        }
+    }
+    return db->GetHistoryAt(epochId, index);
+}
+
+std::vector<HistoryNode> CCoinsViewFlushLayer::GetHistoryNodes(uint32_t epochId, const std::vector<HistoryIndex> &indices) const {
+    CHistoryCacheMap::const_iterator it = historyCacheMap.find(epochId);
+    if (it == historyCacheMap.end()) {
+        return db->GetHistoryNodes(epochId, indices);
+    }
+
+    const HistoryCache& historyCache = it->second;
+    std::vector<HistoryNode> nodes(indices.size());
+    std::vector<HistoryIndex> missing;
+    std::vector<size_t> missingPos;
+    for (size_t i = 0; i < indices.size(); i++) {
+        if (indices[i] >= historyCache.length) {
+            throw std::runtime_error("Invalid history request");
+        }
+        if (indices[i] >= historyCache.updateDepth) {
+            nodes[i] = historyCache.appends.at(indices[i]);
+        } else {
+            missing.push_back(indices[i]);
+            missingPos.push_back(i);
+        }
+    }
+    if (!missing.empty()) {
+        std::vector<HistoryNode> fetched = db->GetHistoryNodes(epochId, missing);
+        for (size_t i = 0; i < missing.size(); i++) {
+            nodes[missingPos[i]] = fetched[i];
+        }
+    }
+    return nodes;
+}
+
+uint256 CCoinsViewFlushLayer::GetHistoryRoot(uint32_t epochId) const {
+    CHistoryCacheMap::const_iterator it = historyCacheMap.find(epochId);
+    if (it != historyCacheMap.end())
+        return it->second.root;
+    return db->GetHistoryRoot(epochId);
+}
+
+bool CCoinsViewFlushLayer::BatchWrite(CCoinsMap &mapCoins,
+                                      const uint256 &hashBlockIn,
+                                      const uint256 &hashSproutAnchorIn,
+                                      const uint256 &hashSaplingAnchorIn,
+                                      const uint256 &hashOrchardAnchorIn,
+                                      CAnchorsSproutMap &mapSproutAnchors,
+                                      CAnchorsSaplingMap &mapSaplingAnchors,
+                                      CAnchorsOrchardMap &mapOrchardAnchors,
+                                      CNullifiersMap &mapSproutNullifiers,
+                                      CNullifiersMap &mapSaplingNullifiers,
+                                      CNullifiersMap &mapOrchardNullifiers,
+                                      CHistoryCacheMap &historyCacheMapIn) {
+    // The cache above may refer to entries of the previous write (for
+    // example by marking its own entries FRESH), so those must be in the
+    // database before they can be replaced.
+    if (!Sync())
+        return false;
+
+    // The layer is empty now, so taking over the maps is just a swap.
+    cacheCoins.swap(mapCoins);
+    cacheSproutAnchors.swap(mapSproutAnchors);
+    cacheSaplingAnchors.swap(mapSaplingAnchors);
+    cacheOrchardAnchors.swap(mapOrchardAnchors);
+    cacheSproutNullifiers.swap(mapSproutNullifiers);
+    cacheSaplingNullifiers.swap(mapSaplingNullifiers);
+    cacheOrchardNullifiers.swap(mapOrchardNullifiers);
+    historyCacheMap.swap(historyCacheMapIn);
+    hashBlock = hashBlockIn;
+    hashSproutAnchor = hashSproutAnchorIn;
+    hashSaplingAnchor = hashSaplingAnchorIn;
+    hashOrchardAnchor = hashOrchardAnchorIn;
+
+    writeResult = std::async(std::launch::async, &CCoinsViewFlushLayer::WriteToDB, this);
+    return true;
 }
 
-CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
+bool CCoinsViewFlushLayer::GetStats(CCoinsStats &stats) const {
+    return db->GetStats(stats);
+}
+
+bool CCoinsViewFlushLayer::DumpSnapshot(CAutoFile &file, CCoinsSnapshotStats &stats) const {
+    return db->DumpSnapshot(file, stats);
+}
+
+void CCoinsViewFlushLayer::Prefetch(CCoinsCacheKeys &keys) const {
+    // The entries held here are found without reading the database anyway.
+    db->Prefetch(keys);
+}
+
+bool CCoinsViewFlushLayer::WriteToDB() {
+    RenameThread("zc-coinsflush");
+    try {
+        return db->WriteSnapshot(cacheCoins, hashBlock,
+                                 hashSproutAnchor, hashSaplingAnchor, hashOrchardAnchor,
+                                 cacheSproutAnchors, cacheSaplingAnchors, cacheOrchardAnchors,
+                                 cacheSproutNullifiers, cacheSaplingNullifiers, cacheOrchardNullifiers,
+                                 historyCacheMap);
+    } catch (const std::exception& e) {
+        LogPrintf("%s: %s\n", __func__, e.what());
+        return false;
+    }
+}
+
+void CCoinsViewFlushLayer::Release() {
+    // Swap with empty maps rather than clearing, to also free the buckets.
+    CCoinsMap().swap(cacheCoins);
+    CAnchorsSproutMap().swap(cacheSproutAnchors);
+    CAnchorsSaplingMap().swap(cacheSaplingAnchors);
+    CAnchorsOrchardMap().swap(cacheOrchardAnchors);
+    CNullifiersMap().swap(cacheSproutNullifiers);
+    CNullifiersMap().swap(cacheSaplingNullifiers);
+    CNullifiersMap().swap(cacheOrchardNullifiers);
+    historyCacheMap.clear();
+    hashBlock.SetNull();
+    hashSproutAnchor.SetNull();
+    hashSaplingAnchor.SetNull();
+    hashOrchardAnchor.SetNull();
+}
+
+bool CCoinsViewFlushLayer::Collect() {
+    if (writeResult.valid() &&
+        writeResult.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return !fWriteFailed;
+    }
+    return Sync();
+}
+
+bool CCoinsViewFlushLayer::Sync() {
+    if (writeResult.valid()) {
+        if (writeResult.get()) {
+            Release();
+        } else {
+            // Keep the entries, so that lookups stay consistent with the
+            // cache above until the node shuts down.
+            LogPrintf("%s: failed to write the coins cache to the database\n", __func__);
+            fWriteFailed = true;
+        }
+    }
+    return !fWriteFailed;
+}
+
+CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe, GetDBOptions("blockindex")) {
 }
 
 bool CBlockTreeDB::ReadBlockFileInfo(int nFile, CBlockFileInfo &info) {
@@ -336,43 +888,103 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
     return Read(DB_LAST_BLOCK, nFile);
 }
 
+namespace {
+
+/** Number of coin records decoded by a GetStats() worker at a time. */
+const size_t STATS_CHUNK_SIZE = 4096;
+
+struct StatsChunkEntry {
+    COutPoint outpoint;
+    Coin coin;
+    unsigned int nValueSize;
+};
+
+typedef std::vector<std::pair<std::vector<unsigned char>, std::vector<unsigned char>>> StatsRawChunk;
+
+std::vector<StatsChunkEntry> DecodeStatsChunk(const StatsRawChunk& chunk)
+{
+    std::vector<StatsChunkEntry> entries(chunk.size());
+    for (size_t i = 0; i < chunk.size(); i++) {
+        CoinEntry key(&entries[i].outpoint);
+        CDataStream ssKey(chunk[i].first, SER_DISK, CLIENT_VERSION);
+        ssKey >> key;
+        CDataStream ssValue(chunk[i].second, SER_DISK, CLIENT_VERSION);
+        ssValue >> entries[i].coin;
+        entries[i].nValueSize = chunk[i].second.size();
+    }
+    return entries;
+}
+
+}
+
 bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
     boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
-    pcursor->Seek(DB_COINS);
+    pcursor->Seek(DB_COIN);
 
     CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
     stats.hashBlock = GetBestBlock();
     ss << stats.hashBlock;
     CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (pcursor->GetValue(coins)) {
+    // Coins are stored in (txid, output index) order, so the outputs of each
+    // transaction are adjacent. They are hashed in the same way as the
+    // per-transaction records they replaced.
+    bool fInTransaction = false;
+    uint256 prevHash;
+    auto addChunk = [&](const std::vector<StatsChunkEntry>& entries) {
+        for (const StatsChunkEntry& entry : entries) {
+            if (!fInTransaction || entry.outpoint.hash != prevHash) {
+                if (fInTransaction)
+                    ss << VARINT(0);
                 stats.nTransactions++;
-                for (unsigned int i=0; i<coins.vout.size(); i++) {
-                    const CTxOut &out = coins.vout[i];
-                    if (!out.IsNull()) {
-                        stats.nTransactionOutputs++;
-                        ss << VARINT(i+1);
-                        ss << out;
-                        nTotalAmount += out.nValue;
-                    }
+                stats.nSerializedSize += 32;
+                fInTransaction = true;
+                prevHash = entry.outpoint.hash;
+            }
+            stats.nTransactionOutputs++;
+            ss << VARINT(entry.outpoint.n + 1);
+            ss << entry.coin.out;
+            nTotalAmount += entry.coin.out.nValue;
+            stats.nSerializedSize += entry.nValueSize;
+        }
+    };
+
+    // Decompressing the coins (P2PK scripts in particular) costs more than
+    // reading them, so chunks of records are decoded on worker threads while
+    // this thread keeps reading, and hashes the decoded chunks in order.
+    const size_t nMaxPending = std::max(GetNumCores(), 1);
+    std::deque<std::future<std::vector<StatsChunkEntry>>> pending;
+    try {
+        StatsRawChunk chunk;
+        bool fDone = false;
+        while (!fDone) {
+            boost::this_thread::interruption_point();
+            std::vector<unsigned char> vchKey;
+            fDone = !pcursor->Valid() || (vchKey = pcursor->GetKeyBytes()).empty() || vchKey[0] != DB_COIN;
+            if (!fDone) {
+                chunk.emplace_back(std::move(vchKey), pcursor->GetValueBytes());
+                pcursor->Next();
+            }
+            if (chunk.size() == STATS_CHUNK_SIZE || (fDone && !chunk.empty())) {
+                if (pending.size() == nMaxPending) {
+                    addChunk(pending.front().get());
+                    pending.pop_front();
                 }
-                stats.nSerializedSize += 32 + pcursor->GetValueSize();
-                ss << VARINT(0);
-            } else {
-                return error("CCoinsViewDB::GetStats() : unable to read value");
+                pending.push_back(std::async(std::launch::async, DecodeStatsChunk, std::move(chunk)));
+                chunk.clear();
             }
-        } else {
-            break;
         }
-        pcursor->Next();
+        while (!pending.empty()) {
+            addChunk(pending.front().get());
+            pending.pop_front();
+        }
+    } catch (const std::exception& e) {
+        return error("CCoinsViewDB::GetStats() : unable to read value: %s", e.what());
     }
+    if (fInTransaction)
+        ss << VARINT(0);
     {
         LOCK(cs_main);
         stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
@@ -382,6 +994,168 @@ bool CCoinsViewDB::GetStats(CCoinsStats &stats) const {
     return true;
 }
 
+bool CCoinsViewDB::DumpSnapshot(CAutoFile &file, CCoinsSnapshotStats &stats) const {
+    // The iterator reads the database as of its creation, so the snapshot is
+    // consistent even if the chain state is flushed while it is written.
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+
+    pcursor->Seek(DB_BEST_BLOCK);
+    if (!(pcursor->Valid() &&
+          pcursor->GetKeyBytes() == std::vector<unsigned char>(1, DB_BEST_BLOCK) &&
+          pcursor->GetValue(stats.hashBlock))) {
+        return error("CCoinsViewDB::DumpSnapshot() : no best block");
+    }
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator it = mapBlockIndex.find(stats.hashBlock);
+        if (it == mapBlockIndex.end())
+            return error("CCoinsViewDB::DumpSnapshot() : best block %s not found", stats.hashBlock.ToString());
+        stats.nHeight = it->second->nHeight;
+    }
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    auto write = [&](const auto& obj) {
+        file << obj;
+        ss << obj;
+    };
+    try {
+        file.write((const char*)SNAPSHOT_MAGIC_BYTES, sizeof(SNAPSHOT_MAGIC_BYTES));
+        ss.write((const char*)SNAPSHOT_MAGIC_BYTES, sizeof(SNAPSHOT_MAGIC_BYTES));
+        write(SNAPSHOT_VERSION);
+        write(Params().NetworkIDString());
+        write(stats.hashBlock);
+        write(stats.nHeight);
+
+        for (pcursor->SeekToFirst(); pcursor->Valid(); pcursor->Next()) {
+            boost::this_thread::interruption_point();
+            std::vector<unsigned char> vchKey = pcursor->GetKeyBytes();
+            write(vchKey);
+            write(pcursor->GetValueBytes());
+            stats.nRecords++;
+            if (!vchKey.empty() && vchKey[0] == DB_COIN)
+                stats.nCoins++;
+        }
+
+        write(std::vector<unsigned char>());
+        write(stats.nRecords);
+        stats.hashSnapshot = ss.GetHash();
+        file << stats.hashSnapshot;
+    } catch (const std::exception& e) {
+        return error("CCoinsViewDB::DumpSnapshot() : %s", e.what());
+    }
+    return true;
+}
+
+void CCoinsViewDB::Prefetch(CCoinsCacheKeys &keys) const {
+    // Reading neighbouring keys one after another touches each table block
+    // once, rather than once per lookup in the order the block uses them.
+    std::sort(keys.coins.begin(), keys.coins.end());
+    for (auto* hashes : {&keys.sproutAnchors, &keys.saplingAnchors, &keys.orchardAnchors,
+                         &keys.sproutNullifiers, &keys.saplingNullifiers, &keys.orchardNullifiers}) {
+        std::sort(hashes->begin(), hashes->end());
+    }
+
+    try {
+        for (const uint256& rt : keys.sproutAnchors) {
+            db.Exists(make_pair(DB_SPROUT_ANCHOR, rt));
+        }
+        for (const uint256& rt : keys.saplingAnchors) {
+            db.Exists(make_pair(DB_SAPLING_ANCHOR, rt));
+        }
+        for (const uint256& rt : keys.orchardAnchors) {
+            db.Exists(make_pair(DB_ORCHARD_ANCHOR, rt));
+        }
+        for (const COutPoint& outpoint : keys.coins) {
+            db.Exists(CoinEntry(&outpoint));
+        }
+        for (const uint256& nf : keys.sproutNullifiers) {
+            db.Exists(make_pair(DB_NULLIFIER, nf));
+        }
+        for (const uint256& nf : keys.saplingNullifiers) {
+            db.Exists(make_pair(DB_SAPLING_NULLIFIER, nf));
+        }
+        for (const uint256& nf : keys.orchardNullifiers) {
+            db.Exists(make_pair(DB_ORCHARD_NULLIFIER, nf));
+        }
+    } catch (const dbwrapper_error& e) {
+        // The lookups that follow will report the failure.
+        LogPrint("coindb", "%s: %s\n", __func__, e.what());
+    }
+}
+
+
+/** Upgrade the database from older formats.
+ *
+ * Currently implemented: from per-transaction CCoins records ('c') to
+ * per-output Coin records ('C').
+ */
+bool CCoinsViewDB::Upgrade() {
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    if (!pcursor->Valid()) {
+        return true;
+    }
+
+    int64_t count = 0;
+    LogPrintf("Upgrading utxo-set database...\n");
+    LogPrintf("[0%%]...");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    static const size_t nBatchSize = 1 << 24;
+    size_t nBatchBytes = 0;
+    CDBBatch batch(db);
+    int reportDone = 0;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested()) {
+            break;
+        }
+        std::pair<char, uint256> key;
+        if (pcursor->GetKey(key) && key.first == DB_COINS) {
+            if (count++ % 256 == 0) {
+                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
+                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone);
+                if (reportDone < percentageDone/10) {
+                    // report max. every 10% step
+                    LogPrintf("[%d%%]...", percentageDone);
+                    reportDone = percentageDone/10;
+                }
+            }
+            CLegacyCoins old_coins;
+            if (!pcursor->GetValue(old_coins)) {
+                return error("%s: cannot parse CCoins record", __func__);
+            }
+            COutPoint outpoint(key.second, 0);
+            for (size_t i = 0; i < old_coins.vout.size(); ++i) {
+                if (!old_coins.vout[i].IsNull() && !old_coins.vout[i].scriptPubKey.IsUnspendable()) {
+                    Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase);
+                    outpoint.n = i;
+                    CoinEntry entry(&outpoint);
+                    batch.Write(entry, newcoin);
+                }
+            }
+            // Each batch removes the records it converts, so an interrupted
+            // upgrade resumes where it stopped.
+            batch.Erase(key);
+            nBatchBytes += pcursor->GetValueSize();
+            if (nBatchBytes > nBatchSize) {
+                if (!db.WriteBatch(batch))
+                    return error("%s: failed to write upgraded coins", __func__);
+                batch.Clear();
+                nBatchBytes = 0;
+            }
+            pcursor->Next();
+        } else {
+            break;
+        }
+    }
+    if (!db.WriteBatch(batch))
+        return error("%s: failed to write upgraded coins", __func__);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
+    return !ShutdownRequested();
+}
+
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<std::pair<int, const CBlockFileInfo*> >::const_iterator it=fileInfo.begin(); it != fileInfo.end(); it++) {
@@ -394,6 +1168,10 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::ReadDiskBlockIndex(const uint256 &hash, CDiskBlockIndex &diskindex) {
+    return Read(make_pair(DB_BLOCK_INDEX, hash), diskindex);
+}
+
 bool CBlockTreeDB::EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo) {
     CDBBatch batch(*this);
     for (std::vector<const CBlockIndex*>::const_iterator it=blockinfo.begin(); it != blockinfo.end(); it++) {
@@ -402,22 +1180,247 @@ bool CBlockTreeDB::EraseBatchSync(const std::vector<const CBlockIndex*>& blockin
     return WriteBatch(batch, true);
 }
 
-bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
+// Earlier versions kept the transaction and insight explorer indexes in the
+// block index database. Their entries are erased once the indexes have moved
+// out.
+template <typename K>
+static bool EraseKeysWithPrefix(CDBWrapper &db, char chPrefix, size_t nMaxEntries, size_t &nErased)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    CDBBatch batch(db);
+
+    pcursor->Seek(chPrefix);
+    while (pcursor->Valid() && nErased < nMaxEntries) {
+        boost::this_thread::interruption_point();
+        std::pair<char, K> key;
+        if (!(pcursor->GetKey(key) && key.first == chPrefix))
+            break;
+        batch.Erase(key);
+        nErased++;
+        pcursor->Next();
+    }
+    return db.WriteBatch(batch);
+}
+
+bool CBlockTreeDB::HasLegacyIndexes() {
+    bool fTxIndex = false;
+    bool fInsightExplorer = false;
+    bool fLightWalletd = false;
+    ReadFlag("txindex", fTxIndex);
+    ReadFlag("insightexplorer", fInsightExplorer);
+    ReadFlag("lightwalletd", fLightWalletd);
+    return fTxIndex || fInsightExplorer || fLightWalletd;
+}
+
+bool CBlockTreeDB::HasLegacyTxIndex() {
+    bool fTxIndex = false;
+    ReadFlag("txindex", fTxIndex);
+    return fTxIndex;
+}
+
+bool CBlockTreeDB::ReadLegacyTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair(DB_TXINDEX, txid), pos);
 }
 
-bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
-    CDBBatch batch(*this);
+bool CBlockTreeDB::EraseLegacyIndexes(size_t nMaxEntries, bool &fDone) {
+    size_t nErased = 0;
+    if (!EraseKeysWithPrefix<uint256>(*this, DB_TXINDEX, nMaxEntries, nErased) ||
+        !EraseKeysWithPrefix<CAddressIndexKey>(*this, DB_ADDRESSINDEX, nMaxEntries, nErased) ||
+        !EraseKeysWithPrefix<CAddressUnspentKey>(*this, DB_ADDRESSUNSPENTINDEX, nMaxEntries, nErased) ||
+        !EraseKeysWithPrefix<CSpentIndexKey>(*this, DB_SPENTINDEX, nMaxEntries, nErased) ||
+        !EraseKeysWithPrefix<CTimestampIndexKey>(*this, DB_TIMESTAMPINDEX, nMaxEntries, nErased) ||
+        !EraseKeysWithPrefix<CTimestampBlockIndexKey>(*this, DB_BLOCKHASHINDEX, nMaxEntries, nErased)) {
+        return false;
+    }
+    fDone = nErased < nMaxEntries;
+    if (fDone) {
+        // Versions that still look for the indexes here will then ask for
+        // a reindex instead of using an empty index.
+        return WriteFlag("txindex", false) &&
+            WriteFlag("insightexplorer", false) && WriteFlag("lightwalletd", false);
+    }
+    return true;
+}
+
+bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
+    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
+}
+
+bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
+    char ch;
+    if (!Read(std::make_pair(DB_FLAG, name), ch))
+        return false;
+    fValue = ch == '1';
+    return true;
+}
+
+bool CBlockTreeDB::LoadBlockIndexGuts(
+    std::function<CBlockIndex*(const uint256&)> insertBlockIndex,
+    const CChainParams& chainParams)
+{
+    // The entries are read by several threads, each with its own cursor over
+    // the keys whose hash starts with a range of byte values. Only the block
+    // map they insert into is shared.
+    Mutex csInsert;
+    std::atomic<bool> fFailed{false};
+    auto load = [&](int nStart, int nEnd) {
+        boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+        uint256 hashStart;
+        *hashStart.begin() = nStart;
+        pcursor->Seek(make_pair(DB_BLOCK_INDEX, hashStart));
+
+        while (pcursor->Valid() && !fFailed && !ShutdownRequested()) {
+            std::pair<char, uint256> key;
+            if (!pcursor->GetKey(key) || key.first != DB_BLOCK_INDEX || *key.second.begin() >= nEnd)
+                break;
+            CDiskBlockIndex diskindex;
+            if (!pcursor->GetValue(diskindex)) {
+                fFailed = true;
+                error("LoadBlockIndex() : failed to read value");
+                break;
+            }
+
+            // Consistency checks. LevelDB checks the entry against its
+            // checksum as it is read, so the header is only hashed once, to
+            // match it with its key; the Equihash solution was checked when
+            // the header was accepted, and is not checked again.
+            if (diskindex.GetBlockHash() != key.second) {
+                fFailed = true;
+                error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, key = %s",
+                    diskindex.ToString(), key.second.ToString());
+                break;
+            }
+            if (!CheckProofOfWork(key.second, diskindex.nBits, Params().GetConsensus())) {
+                fFailed = true;
+                error("LoadBlockIndex(): CheckProofOfWork failed: %s", key.second.ToString());
+                break;
+            }
+
+            // Construct block index object
+            CBlockIndex* pindexNew;
+            {
+                LOCK(csInsert);
+                pindexNew = insertBlockIndex(key.second);
+                pindexNew->pprev = insertBlockIndex(diskindex.hashPrev);
+            }
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nDataPos       = diskindex.nDataPos;
+            pindexNew->nUndoPos       = diskindex.nUndoPos;
+            pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->hashBlockCommitments  = diskindex.hashBlockCommitments;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            // The solution is read back from the database when it is needed.
+            pindexNew->fSolutionTrimmed = true;
+            pindexNew->nStatus        = diskindex.nStatus;
+            pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
+            pindexNew->nTx            = diskindex.nTx;
+            pindexNew->nSproutValue   = diskindex.nSproutValue;
+            pindexNew->nSaplingValue  = diskindex.nSaplingValue;
+            pindexNew->nOrchardValue  = diskindex.nOrchardValue;
+            pindexNew->hashFinalSaplingRoot = diskindex.hashFinalSaplingRoot;
+            pindexNew->hashFinalOrchardRoot = diskindex.hashFinalOrchardRoot;
+            pindexNew->hashChainHistoryRoot = diskindex.hashChainHistoryRoot;
+            pindexNew->hashAuthDataRoot = diskindex.hashAuthDataRoot;
+
+            // ZIP 221 consistency checks
+            // These checks should only be performed for block index entries marked
+            // as consensus-valid (at the time they were written).
+            //
+            if (pindexNew->IsValid(BLOCK_VALID_CONSENSUS)) {
+                // We assume block index entries on disk that are not at least
+                // CHAIN_HISTORY_ROOT_VERSION were created by nodes that were
+                // not Heartwood aware. Such a node would not see Heartwood block
+                // headers as valid, and so this must *either* be an index entry
+                // for a block header on a non-Heartwood chain, or be marked as
+                // consensus-invalid.
+                //
+                // It can also happen that the block index entry was written
+                // by this node when it was Heartwood-aware (so its version
+                // will be >= CHAIN_HISTORY_ROOT_VERSION), but received from
+                // a non-upgraded peer. However that case the entry will be
+                // marked as consensus-invalid.
+                //
+                if (diskindex.nClientVersion >= NU5_DATA_VERSION &&
+                    chainParams.GetConsensus().NetworkUpgradeActive(pindexNew->nHeight, Consensus::UPGRADE_NU5)) {
+                    // From NU5 onwards we don't enforce a consistency check, because
+                    // after ZIP 244, hashBlockCommitments will not match any stored
+                    // commitment.
+                } else if (diskindex.nClientVersion >= CHAIN_HISTORY_ROOT_VERSION &&
+                    chainParams.GetConsensus().NetworkUpgradeActive(pindexNew->nHeight, Consensus::UPGRADE_HEARTWOOD)) {
+                    if (pindexNew->hashBlockCommitments != pindexNew->hashChainHistoryRoot) {
+                        fFailed = true;
+                        error(
+                            "LoadBlockIndex(): block index inconsistency detected (post-Heartwood; hashBlockCommitments %s != hashChainHistoryRoot %s): %s",
+                            pindexNew->hashBlockCommitments.ToString(), pindexNew->hashChainHistoryRoot.ToString(), pindexNew->ToString());
+                        break;
+                    }
+                } else {
+                    if (pindexNew->hashBlockCommitments != pindexNew->hashFinalSaplingRoot) {
+                        fFailed = true;
+                        error(
+                            "LoadBlockIndex(): block index inconsistency detected (pre-Heartwood; hashBlockCommitments %s != hashFinalSaplingRoot %s): %s",
+                            pindexNew->hashBlockCommitments.ToString(), pindexNew->hashFinalSaplingRoot.ToString(), pindexNew->ToString());
+                        break;
+                    }
+                }
+            }
+
+            pcursor->Next();
+        }
+    };
+
+    int nThreads = std::min(std::max(1, nScriptCheckThreads), 16);
+    std::vector<std::thread> vThreads;
+    for (int i = 1; i < nThreads; i++) {
+        vThreads.emplace_back(load, 256 * i / nThreads, 256 * (i + 1) / nThreads);
+    }
+    load(0, 256 / nThreads);
+    for (std::thread& thread : vThreads) {
+        thread.join();
+    }
+    boost::this_thread::interruption_point();
+
+    // A load cut short by a shutdown leaves placeholder entries in the block
+    // map, which must not be used.
+    if (ShutdownRequested()) {
+        LogPrintf("LoadBlockIndex(): interrupted by a shutdown request\n");
+        return false;
+    }
+
+    return !fFailed;
+}
+
+CInsightIndexDB::CInsightIndexDB(const std::string& strName, size_t nCacheSize, bool fMemory, bool fWipe)
+    : CDBWrapper(GetDataDir() / "indexes" / strName, nCacheSize, fMemory, fWipe, GetDBOptions(strName + "index")) {
+}
+
+bool CInsightIndexDB::ReadBestBlock(uint256 &hashBlock) {
+    return Read(DB_BEST_BLOCK, hashBlock);
+}
+
+bool CInsightIndexDB::WriteBlockBatch(CDBBatch &batch, const uint256 &hashBestBlock) {
+    batch.Write(DB_BEST_BLOCK, hashBestBlock);
+    return WriteBatch(batch);
+}
+
+bool CInsightIndexDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
+    return Read(make_pair(DB_TXINDEX, txid), pos);
+}
+
+void CInsightIndexDB::WriteTxIndex(CDBBatch &batch, const std::vector<std::pair<uint256, CDiskTxPos> >&vect) {
     for (std::vector<std::pair<uint256,CDiskTxPos> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_TXINDEX, it->first), it->second);
-    return WriteBatch(batch);
 }
 
 // START insightexplorer
 // https://github.com/bitpay/bitcoin/commit/017f548ea6d89423ef568117447e61dd5707ec42#diff-81e4f16a1b5d5b7ca25351a63d07cb80R183
-bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDbEntry> &vect)
+void CInsightIndexDB::UpdateAddressUnspentIndex(CDBBatch &batch, const std::vector<CAddressUnspentDbEntry> &vect)
 {
-    CDBBatch batch(*this);
     for (std::vector<CAddressUnspentDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_ADDRESSUNSPENTINDEX, it->first));
@@ -425,14 +1428,26 @@ bool CBlockTreeDB::UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDb
             batch.Write(make_pair(DB_ADDRESSUNSPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &unspentOutputs)
+bool CInsightIndexDB::ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &unspentOutputs)
+{
+    return ForEachAddressUnspentIndex(addressHash, type, nullptr,
+        [&](const CAddressUnspentKey &key, const CAddressUnspentValue &value) {
+            unspentOutputs.push_back(make_pair(key, value));
+            return true;
+        });
+}
+
+bool CInsightIndexDB::ForEachAddressUnspentIndex(uint160 addressHash, int type, const CAddressUnspentKey *pFrom, const AddressUnspentVisitor &visit)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    if (pFrom != nullptr) {
+        pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, *pFrom));
+    } else {
+        pcursor->Seek(make_pair(DB_ADDRESSUNSPENTINDEX, CAddressIndexIteratorKey(type, addressHash)));
+    }
 
     while (pcursor->Valid()) {
         boost::this_thread::interruption_point();
@@ -442,34 +1457,44 @@ bool CBlockTreeDB::ReadAddressUnspentIndex(uint160 addressHash, int type, std::v
         CAddressUnspentValue nValue;
         if (!pcursor->GetValue(nValue))
             return error("failed to get address unspent value");
-        unspentOutputs.push_back(make_pair(key.second, nValue));
+        if (!visit(key.second, nValue))
+            break;
         pcursor->Next();
     }
     return true;
 }
 
-bool CBlockTreeDB::WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
-    CDBBatch batch(*this);
+void CInsightIndexDB::WriteAddressIndex(CDBBatch &batch, const std::vector<CAddressIndexDbEntry> &vect) {
     for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Write(make_pair(DB_ADDRESSINDEX, it->first), it->second);
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect) {
-    CDBBatch batch(*this);
+void CInsightIndexDB::EraseAddressIndex(CDBBatch &batch, const std::vector<CAddressIndexDbEntry> &vect) {
     for (std::vector<CAddressIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++)
         batch.Erase(make_pair(DB_ADDRESSINDEX, it->first));
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadAddressIndex(
+bool CInsightIndexDB::ReadAddressIndex(
         uint160 addressHash, int type,
         std::vector<CAddressIndexDbEntry> &addressIndex,
         int start, int end)
+{
+    return ForEachAddressIndex(addressHash, type, start, end, nullptr,
+        [&](const CAddressIndexKey &key, CAmount nValue) {
+            addressIndex.push_back(make_pair(key, nValue));
+            return true;
+        });
+}
+
+bool CInsightIndexDB::ForEachAddressIndex(
+        uint160 addressHash, int type, int start, int end,
+        const CAddressIndexKey *pFrom, const AddressIndexVisitor &visit)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    if (start > 0 && end > 0) {
+    if (pFrom != nullptr) {
+        pcursor->Seek(make_pair(DB_ADDRESSINDEX, *pFrom));
+    } else if (start > 0 && end > 0) {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorHeightKey(type, addressHash, start)));
     } else {
         pcursor->Seek(make_pair(DB_ADDRESSINDEX, CAddressIndexIteratorKey(type, addressHash)));
@@ -485,18 +1510,38 @@ bool CBlockTreeDB::ReadAddressIndex(
         CAmount nValue;
         if (!pcursor->GetValue(nValue))
             return error("failed to get address index value");
-        addressIndex.push_back(make_pair(key.second, nValue));
+        if (!visit(key.second, nValue))
+            break;
         pcursor->Next();
     }
     return true;
 }
 
-bool CBlockTreeDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
+bool CInsightIndexDB::HasAddressBalances() {
+    return Exists(DB_ADDRESSBALANCES_FLAG);
+}
+
+bool CInsightIndexDB::WriteHasAddressBalances() {
+    return Write(DB_ADDRESSBALANCES_FLAG, '1');
+}
+
+bool CInsightIndexDB::ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value) {
+    return Read(make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), value);
+}
+
+void CInsightIndexDB::WriteAddressBalance(CDBBatch &batch, uint160 addressHash, int type, const CAddressBalanceValue &value) {
+    if (value.IsNull()) {
+        batch.Erase(make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)));
+    } else {
+        batch.Write(make_pair(DB_ADDRESSBALANCE, CAddressIndexIteratorKey(type, addressHash)), value);
+    }
+}
+
+bool CInsightIndexDB::ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value) {
     return Read(make_pair(DB_SPENTINDEX, key), value);
 }
 
-bool CBlockTreeDB::UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect) {
-    CDBBatch batch(*this);
+void CInsightIndexDB::UpdateSpentIndex(CDBBatch &batch, const std::vector<CSpentIndexDbEntry> &vect) {
     for (std::vector<CSpentIndexDbEntry>::const_iterator it=vect.begin(); it!=vect.end(); it++) {
         if (it->second.IsNull()) {
             batch.Erase(make_pair(DB_SPENTINDEX, it->first));
@@ -504,16 +1549,13 @@ bool CBlockTreeDB::UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect)
             batch.Write(make_pair(DB_SPENTINDEX, it->first), it->second);
         }
     }
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::WriteTimestampIndex(const CTimestampIndexKey &timestampIndex) {
-    CDBBatch batch(*this);
+void CInsightIndexDB::WriteTimestampIndex(CDBBatch &batch, const CTimestampIndexKey &timestampIndex) {
     batch.Write(make_pair(DB_TIMESTAMPINDEX, timestampIndex), 0);
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadTimestampIndex(unsigned int high, unsigned int low,
+bool CInsightIndexDB::ReadTimestampIndex(unsigned int high, unsigned int low,
     const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &hashes)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
@@ -539,15 +1581,13 @@ bool CBlockTreeDB::ReadTimestampIndex(unsigned int high, unsigned int low,
     return true;
 }
 
-bool CBlockTreeDB::WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex,
+void CInsightIndexDB::WriteTimestampBlockIndex(CDBBatch &batch, const CTimestampBlockIndexKey &blockhashIndex,
     const CTimestampBlockIndexValue &logicalts)
 {
-    CDBBatch batch(*this);
     batch.Write(make_pair(DB_BLOCKHASHINDEX, blockhashIndex), logicalts);
-    return WriteBatch(batch);
 }
 
-bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp)
+bool CInsightIndexDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &ltimestamp)
 {
     CTimestampBlockIndexValue(lts);
     if (!Read(std::make_pair(DB_BLOCKHASHINDEX, hash), lts))
@@ -558,114 +1598,88 @@ bool CBlockTreeDB::ReadTimestampBlockIndex(const uint256 &hash, unsigned int &lt
 }
 // END insightexplorer
 
-bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
-    return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
+bool CInsightIndexDB::ReadSubtreeCount(ShieldedType type, uint32_t &nCount) {
+    return Read(std::make_pair(DB_SUBTREECOUNT, (uint8_t)type), nCount);
 }
 
-bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
-    char ch;
-    if (!Read(std::make_pair(DB_FLAG, name), ch))
-        return false;
-    fValue = ch == '1';
+void CInsightIndexDB::WriteSubtreeCount(CDBBatch &batch, ShieldedType type, uint32_t nCount) {
+    batch.Write(std::make_pair(DB_SUBTREECOUNT, (uint8_t)type), nCount);
+}
+
+void CInsightIndexDB::WriteSubtreeIndex(CDBBatch &batch, ShieldedType type, uint32_t nIndex, const CSubtreeIndexValue &value) {
+    batch.Write(std::make_pair(DB_SUBTREEINDEX, CSubtreeIndexKey(type, nIndex)), value);
+}
+
+void CInsightIndexDB::EraseSubtreeIndex(CDBBatch &batch, ShieldedType type, uint32_t nIndex) {
+    batch.Erase(std::make_pair(DB_SUBTREEINDEX, CSubtreeIndexKey(type, nIndex)));
+}
+
+bool CInsightIndexDB::ReadSubtreeIndex(ShieldedType type, uint32_t nIndex, CSubtreeIndexValue &value) {
+    return Read(std::make_pair(DB_SUBTREEINDEX, CSubtreeIndexKey(type, nIndex)), value);
+}
+
+bool CInsightIndexDB::ReadSubtreeIndex(ShieldedType type, uint32_t nStart, uint32_t nLimit, std::vector<CSubtreeIndexValue> &vect)
+{
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(std::make_pair(DB_SUBTREEINDEX, CSubtreeIndexKey(type, nStart)));
+
+    while (pcursor->Valid() && vect.size() < nLimit) {
+        std::pair<char, CSubtreeIndexKey> key;
+        if (!(pcursor->GetKey(key) && key.first == DB_SUBTREEINDEX && key.second.pool == type)) {
+            break;
+        }
+        CSubtreeIndexValue value;
+        if (!pcursor->GetValue(value)) {
+            return error("failed to get subtree index value");
+        }
+        vect.push_back(value);
+        pcursor->Next();
+    }
     return true;
 }
 
-bool CBlockTreeDB::LoadBlockIndexGuts(
-    std::function<CBlockIndex*(const uint256&)> insertBlockIndex,
-    const CChainParams& chainParams)
+void CInsightIndexDB::WriteBlockFilter(CDBBatch &batch, const uint256 &hash, const CBlockFilterIndexValue &value) {
+    batch.Write(std::make_pair(DB_BLOCKFILTER, hash), value);
+}
+
+void CInsightIndexDB::EraseBlockFilter(CDBBatch &batch, const uint256 &hash) {
+    batch.Erase(std::make_pair(DB_BLOCKFILTER, hash));
+}
+
+bool CInsightIndexDB::ReadBlockFilter(const uint256 &hash, CBlockFilterIndexValue &value) {
+    return Read(std::make_pair(DB_BLOCKFILTER, hash), value);
+}
+
+void CInsightIndexDB::WriteSupplyIndex(CDBBatch &batch, int nHeight, const CSupplyIndexValue &value) {
+    batch.Write(std::make_pair(DB_SUPPLYINDEX, CSupplyIndexKey(nHeight)), value);
+}
+
+void CInsightIndexDB::EraseSupplyIndex(CDBBatch &batch, int nHeight) {
+    batch.Erase(std::make_pair(DB_SUPPLYINDEX, CSupplyIndexKey(nHeight)));
+}
+
+bool CInsightIndexDB::ReadSupplyIndex(int nHeight, CSupplyIndexValue &value) {
+    return Read(std::make_pair(DB_SUPPLYINDEX, CSupplyIndexKey(nHeight)), value);
+}
+
+bool CInsightIndexDB::ReadSupplyIndex(int nStart, int nEnd, std::vector<std::pair<int, CSupplyIndexValue>> &vect)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
 
-    pcursor->Seek(make_pair(DB_BLOCK_INDEX, uint256()));
+    pcursor->Seek(std::make_pair(DB_SUPPLYINDEX, CSupplyIndexKey(nStart)));
 
-    // Load mapBlockIndex
     while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        std::pair<char, uint256> key;
-        if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
-            CDiskBlockIndex diskindex;
-            if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
-                pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
-                pindexNew->nHeight        = diskindex.nHeight;
-                pindexNew->nFile          = diskindex.nFile;
-                pindexNew->nDataPos       = diskindex.nDataPos;
-                pindexNew->nUndoPos       = diskindex.nUndoPos;
-                pindexNew->hashSproutAnchor     = diskindex.hashSproutAnchor;
-                pindexNew->nVersion       = diskindex.nVersion;
-                pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
-                pindexNew->hashBlockCommitments  = diskindex.hashBlockCommitments;
-                pindexNew->nTime          = diskindex.nTime;
-                pindexNew->nBits          = diskindex.nBits;
-                pindexNew->nNonce         = diskindex.nNonce;
-                pindexNew->nSolution      = diskindex.nSolution;
-                pindexNew->nStatus        = diskindex.nStatus;
-                pindexNew->nCachedBranchId = diskindex.nCachedBranchId;
-                pindexNew->nTx            = diskindex.nTx;
-                pindexNew->nSproutValue   = diskindex.nSproutValue;
-                pindexNew->nSaplingValue  = diskindex.nSaplingValue;
-                pindexNew->nOrchardValue  = diskindex.nOrchardValue;
-                pindexNew->hashFinalSaplingRoot = diskindex.hashFinalSaplingRoot;
-                pindexNew->hashFinalOrchardRoot = diskindex.hashFinalOrchardRoot;
-                pindexNew->hashChainHistoryRoot = diskindex.hashChainHistoryRoot;
-                pindexNew->hashAuthDataRoot = diskindex.hashAuthDataRoot;
-
-                // Consistency checks
-                auto header = pindexNew->GetBlockHeader();
-                if (header.GetHash() != pindexNew->GetBlockHash())
-                    return error("LoadBlockIndex(): block header inconsistency detected: on-disk = %s, in-memory = %s",
-                       diskindex.ToString(),  pindexNew->ToString());
-                if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, Params().GetConsensus()))
-                    return error("LoadBlockIndex(): CheckProofOfWork failed: %s", pindexNew->ToString());
-
-                // ZIP 221 consistency checks
-                // These checks should only be performed for block index entries marked
-                // as consensus-valid (at the time they were written).
-                //
-                if (pindexNew->IsValid(BLOCK_VALID_CONSENSUS)) {
-                    // We assume block index entries on disk that are not at least
-                    // CHAIN_HISTORY_ROOT_VERSION were created by nodes that were
-                    // not Heartwood aware. Such a node would not see Heartwood block
-                    // headers as valid, and so this must *either* be an index entry
-                    // for a block header on a non-Heartwood chain, or be marked as
-                    // consensus-invalid.
-                    //
-                    // It can also happen that the block index entry was written
-                    // by this node when it was Heartwood-aware (so its version
-                    // will be >= CHAIN_HISTORY_ROOT_VERSION), but received from
-                    // a non-upgraded peer. However that case the entry will be
-                    // marked as consensus-invalid.
-                    //
-                    if (diskindex.nClientVersion >= NU5_DATA_VERSION &&
-                        chainParams.GetConsensus().NetworkUpgradeActive(pindexNew->nHeight, Consensus::UPGRADE_NU5)) {
-                        // From NU5 onwards we don't enforce a consistency check, because
-                        // after ZIP 244, hashBlockCommitments will not match any stored
-                        // commitment.
-                    } else if (diskindex.nClientVersion >= CHAIN_HISTORY_ROOT_VERSION &&
-                        chainParams.GetConsensus().NetworkUpgradeActive(pindexNew->nHeight, Consensus::UPGRADE_HEARTWOOD)) {
-                        if (pindexNew->hashBlockCommitments != pindexNew->hashChainHistoryRoot) {
-                            return error(
-                                "LoadBlockIndex(): block index inconsistency detected (post-Heartwood; hashBlockCommitments %s != hashChainHistoryRoot %s): %s",
-                                pindexNew->hashBlockCommitments.ToString(), pindexNew->hashChainHistoryRoot.ToString(), pindexNew->ToString());
-                        }
-                    } else {
-                        if (pindexNew->hashBlockCommitments != pindexNew->hashFinalSaplingRoot) {
-                            return error(
-                                "LoadBlockIndex(): block index inconsistency detected (pre-Heartwood; hashBlockCommitments %s != hashFinalSaplingRoot %s): %s",
-                                pindexNew->hashBlockCommitments.ToString(), pindexNew->hashFinalSaplingRoot.ToString(), pindexNew->ToString());
-                        }
-                    }
-                }
-
-                pcursor->Next();
-            } else {
-                return error("LoadBlockIndex() : failed to read value");
-            }
-        } else {
+        std::pair<char, CSupplyIndexKey> key;
+        if (!(pcursor->GetKey(key) && key.first == DB_SUPPLYINDEX && key.second.height <= (uint32_t)nEnd)) {
             break;
         }
+        CSupplyIndexValue value;
+        if (!pcursor->GetValue(value)) {
+            return error("failed to get supply index value");
+        }
+        vect.emplace_back(key.second.height, value);
+        pcursor->Next();
     }
-
     return true;
 }
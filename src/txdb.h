@@ -10,7 +10,12 @@
 #include "coins.h"
 #include "dbwrapper.h"
 #include "chain.h"
+#include "sync.h"
 
+#include <array>
+#include <functional>
+
+#include <future>
 #include <map>
 #include <string>
 #include <utility>
@@ -29,14 +34,21 @@ struct CAddressIndexIteratorKey;
 struct CAddressIndexIteratorHeightKey;
 struct CSpentIndexKey;
 struct CSpentIndexValue;
+struct CAddressBalanceValue;
 struct CTimestampIndexKey;
 struct CTimestampIndexIteratorKey;
 struct CTimestampBlockIndexKey;
 struct CTimestampBlockIndexValue;
+struct CSubtreeIndexValue;
+struct CBlockFilterIndexValue;
+struct CSupplyIndexValue;
 
 typedef std::pair<CAddressUnspentKey, CAddressUnspentValue> CAddressUnspentDbEntry;
 typedef std::pair<CAddressIndexKey, CAmount> CAddressIndexDbEntry;
 typedef std::pair<CSpentIndexKey, CSpentIndexValue> CSpentIndexDbEntry;
+//! Visits the address index entries in key order; returns false to stop.
+typedef std::function<bool(const CAddressIndexKey&, CAmount)> AddressIndexVisitor;
+typedef std::function<bool(const CAddressUnspentKey&, const CAddressUnspentValue&)> AddressUnspentVisitor;
 // END insightexplorer
 
 class uint256;
@@ -73,11 +85,123 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
+/** Legacy class to deserialize pre-pertxout database entries without reindex.
+ *  Only used by CCoinsViewDB::Upgrade() and by benchmarks that ship legacy
+ *  chainstate fixtures. */
+class CLegacyCoins
+{
+public:
+    //! whether transaction is a coinbase
+    bool fCoinBase;
+
+    //! unspent transaction outputs; spent outputs are .IsNull(); spent outputs at the end of the array are dropped
+    std::vector<CTxOut> vout;
+
+    //! at which height this transaction was included in the active block chain
+    int nHeight;
+
+    //! empty constructor
+    CLegacyCoins() : fCoinBase(false), vout(0), nHeight(0) { }
+
+    template<typename Stream>
+    void Unserialize(Stream &s) {
+        unsigned int nCode = 0;
+        // version
+        int nVersionDummy;
+        ::Unserialize(s, VARINT(nVersionDummy));
+        // header code
+        ::Unserialize(s, VARINT(nCode));
+        fCoinBase = nCode & 1;
+        std::vector<bool> vAvail(2, false);
+        vAvail[0] = (nCode & 2) != 0;
+        vAvail[1] = (nCode & 4) != 0;
+        unsigned int nMaskCode = (nCode / 8) + ((nCode & 6) != 0 ? 0 : 1);
+        // spentness bitmask
+        while (nMaskCode > 0) {
+            unsigned char chAvail = 0;
+            ::Unserialize(s, chAvail);
+            for (unsigned int p = 0; p < 8; p++) {
+                bool f = (chAvail & (1 << p)) != 0;
+                vAvail.push_back(f);
+            }
+            if (chAvail != 0)
+                nMaskCode--;
+        }
+        // txouts themself
+        vout.assign(vAvail.size(), CTxOut());
+        for (unsigned int i = 0; i < vAvail.size(); i++) {
+            if (vAvail[i])
+                ::Unserialize(s, REF(CTxOutCompressor(vout[i])));
+        }
+        // coinbase height
+        ::Unserialize(s, VARINT(nHeight));
+    }
+};
+
+/**
+ * In-memory Bloom filter over the nullifiers of one shielded pool in the coin
+ * database.
+ *
+ * Nearly every nullifier lookup that reaches the database is for a nullifier
+ * that has not been revealed, and is answered by a fruitless LevelDB seek.
+ * If the filter reports a nullifier as absent, it is definitely not in the
+ * database, so most of those seeks can be skipped. Nullifiers can only be
+ * added: ones erased during a reorg leave their bits set, which merely costs
+ * a database lookup. Once more nullifiers have been inserted than the filter
+ * was sized for, it reports itself as saturated and should be rebuilt.
+ *
+ * Until it has been built, the filter admits every nullifier.
+ */
+class CNullifierFilter
+{
+private:
+    mutable CCriticalSection cs;
+    std::vector<uint64_t> vData;
+    uint64_t nBitMask;
+    size_t nInserted;
+    size_t nCapacity;
+    const uint64_t k0, k1;
+
+    void InsertHash(uint64_t hash);
+
+public:
+    static const unsigned int BITS_PER_ELEMENT = 16;
+    static const unsigned int NUM_HASH_FUNCS = 8;
+    static const size_t MIN_CAPACITY = 1 << 16;
+
+    CNullifierFilter();
+
+    //! Salted hash of a nullifier, as consumed by Reset().
+    uint64_t Hash(const uint256& nf) const;
+
+    //! Rebuild the filter from the hashes of every nullifier in the pool,
+    //! leaving room for as many again before it saturates.
+    void Reset(const std::vector<uint64_t>& hashes);
+    void Insert(const uint256& nf);
+    bool MayContain(const uint256& nf) const;
+    bool IsSaturated() const;
+    size_t DynamicMemoryUsage() const;
+};
+
+/** Identifies a chain state snapshot file written by CCoinsViewDB::DumpSnapshot(). */
+static const unsigned char SNAPSHOT_MAGIC_BYTES[] = {'z', 'u', 't', 'x', 'o', 0xff};
+static const uint32_t SNAPSHOT_VERSION = 1;
+
 /** CCoinsView backed by the coin database (chainstate/) */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+    //! Indexed by ShieldedType.
+    std::array<CNullifierFilter, 3> nullifierFilters;
+
+    //! Rebuild the nullifier filter of a pool from the database.
+    void LoadNullifierFilter(ShieldedType type);
+    //! Rebuild the filters that have saturated after a write.
+    void RefreshNullifierFilters();
+    //! Read a history node that is known to be within the tree.
+    HistoryNode ReadHistoryNode(uint32_t epochId, HistoryIndex index) const;
+
     CCoinsViewDB(std::string dbName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
@@ -86,12 +210,14 @@ public:
     bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
     bool GetOrchardAnchorAt(const uint256 &rt, OrchardMerkleFrontier &tree) const;
     bool GetNullifier(const uint256 &nf, ShieldedType type) const;
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    std::vector<std::optional<Coin>> GetCoins(const std::vector<COutPoint> &outpoints) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
     uint256 GetBestBlock() const;
     uint256 GetBestAnchor(ShieldedType type) const;
     HistoryIndex GetHistoryLength(uint32_t epochId) const;
     HistoryNode GetHistoryAt(uint32_t epochId, HistoryIndex index) const;
+    std::vector<HistoryNode> GetHistoryNodes(uint32_t epochId, const std::vector<HistoryIndex> &indices) const;
     uint256 GetHistoryRoot(uint32_t epochId) const;
     bool BatchWrite(CCoinsMap &mapCoins,
                     const uint256 &hashBlock,
@@ -106,6 +232,133 @@ public:
                     CNullifiersMap &mapOrchardNullifiers,
                     CHistoryCacheMap &historyCacheMap);
     bool GetStats(CCoinsStats &stats) const;
+
+    //! Write every record of the database, as of the start of the call, to
+    //! file. The snapshot consists of:
+    //! - SNAPSHOT_MAGIC_BYTES, SNAPSHOT_VERSION and the network ID string;
+    //! - the best block hash and its height;
+    //! - each record as a pair of byte vectors (key and value, as stored);
+    //! - an empty vector, then the number of records;
+    //! - the SHA256d hash of everything before it.
+    //! Records are copied verbatim, so that the coins, the anchors and
+    //! nullifiers of each shielded pool and the history trees of each epoch
+    //! can be restored in an empty database exactly as they were.
+    bool DumpSnapshot(CAutoFile &file, CCoinsSnapshotStats &stats) const;
+
+    //! Reads the entries in key order and discards them. The nullifier
+    //! filters are not consulted, as they are rebuilt by the thread writing
+    //! to the database.
+    void Prefetch(CCoinsCacheKeys &keys) const;
+
+    //! Like BatchWrite, but leaves the maps untouched so that other threads
+    //! can keep reading them while the write is in progress.
+    bool WriteSnapshot(const CCoinsMap &mapCoins,
+                       const uint256 &hashBlock,
+                       const uint256 &hashSproutAnchor,
+                       const uint256 &hashSaplingAnchor,
+                       const uint256 &hashOrchardAnchor,
+                       const CAnchorsSproutMap &mapSproutAnchors,
+                       const CAnchorsSaplingMap &mapSaplingAnchors,
+                       const CAnchorsOrchardMap &mapOrchardAnchors,
+                       const CNullifiersMap &mapSproutNullifiers,
+                       const CNullifiersMap &mapSaplingNullifiers,
+                       const CNullifiersMap &mapOrchardNullifiers,
+                       const CHistoryCacheMap &historyCacheMap);
+
+    //! Attempt to update from an older database format. Returns false if an error
+    //! occurred or the upgrade was interrupted by a shutdown request.
+    bool Upgrade();
+};
+
+/**
+ * Sits between a coins cache and the coin database, and holds the contents of
+ * the cache while a background thread writes them to the database. This lets
+ * validation continue against the (now empty) cache instead of waiting for
+ * the write. Lookups are answered from the entries being written, and fall
+ * through to the database for everything else, so readers see the in-flight
+ * state until it has been committed. The best block is written in the same
+ * database batch as the entries, so the database on disk is always
+ * consistent with one of the flushed states.
+ *
+ * The entries are only replaced or released by the thread flushing the cache
+ * above (under cs_main), and only while no write is in progress, so lookups
+ * do not need to synchronize with the writer, which only reads them.
+ */
+class CCoinsViewFlushLayer : public CCoinsView
+{
+private:
+    CCoinsViewDB* db;
+
+    CCoinsMap cacheCoins;
+    uint256 hashBlock;
+    uint256 hashSproutAnchor;
+    uint256 hashSaplingAnchor;
+    uint256 hashOrchardAnchor;
+    CAnchorsSproutMap cacheSproutAnchors;
+    CAnchorsSaplingMap cacheSaplingAnchors;
+    CAnchorsOrchardMap cacheOrchardAnchors;
+    CNullifiersMap cacheSproutNullifiers;
+    CNullifiersMap cacheSaplingNullifiers;
+    CNullifiersMap cacheOrchardNullifiers;
+    CHistoryCacheMap historyCacheMap;
+
+    //! Result of the write in progress, if any.
+    std::future<bool> writeResult;
+    //! Set once a write has failed; the entries are then kept until shutdown.
+    bool fWriteFailed;
+
+    bool WriteToDB();
+    void Release();
+
+public:
+    CCoinsViewFlushLayer(CCoinsViewDB* dbIn) : db(dbIn), fWriteFailed(false) {}
+    ~CCoinsViewFlushLayer();
+
+    bool GetSproutAnchorAt(const uint256 &rt, SproutMerkleTree &tree) const;
+    bool GetSaplingAnchorAt(const uint256 &rt, SaplingMerkleTree &tree) const;
+    bool GetOrchardAnchorAt(const uint256 &rt, OrchardMerkleFrontier &tree) const;
+    bool GetNullifier(const uint256 &nf, ShieldedType type) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    std::vector<std::optional<Coin>> GetCoins(const std::vector<COutPoint> &outpoints) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
+    uint256 GetBestBlock() const;
+    uint256 GetBestAnchor(ShieldedType type) const;
+    HistoryIndex GetHistoryLength(uint32_t epochId) const;
+    HistoryNode GetHistoryAt(uint32_t epochId, HistoryIndex index) const;
+    std::vector<HistoryNode> GetHistoryNodes(uint32_t epochId, const std::vector<HistoryIndex> &indices) const;
+    uint256 GetHistoryRoot(uint32_t epochId) const;
+
+    //! Wait for the write in progress, if any, then take over the contents of
+    //! the given maps and start writing them to the database. Returns false if
+    //! the previous write failed.
+    bool BatchWrite(CCoinsMap &mapCoins,
+                    const uint256 &hashBlock,
+                    const uint256 &hashSproutAnchor,
+                    const uint256 &hashSaplingAnchor,
+                    const uint256 &hashOrchardAnchor,
+                    CAnchorsSproutMap &mapSproutAnchors,
+                    CAnchorsSaplingMap &mapSaplingAnchors,
+                    CAnchorsOrchardMap &mapOrchardAnchors,
+                    CNullifiersMap &mapSproutNullifiers,
+                    CNullifiersMap &mapSaplingNullifiers,
+                    CNullifiersMap &mapOrchardNullifiers,
+                    CHistoryCacheMap &historyCacheMap);
+
+    //! Only valid when no write is in progress; see Sync().
+    bool GetStats(CCoinsStats &stats) const;
+    bool DumpSnapshot(CAutoFile &file, CCoinsSnapshotStats &stats) const;
+    void Prefetch(CCoinsCacheKeys &keys) const;
+
+    //! Whether a write has been started and its entries not yet released.
+    bool IsWriting() const { return writeResult.valid(); }
+
+    //! Release the entries of a write that has finished, without waiting for
+    //! one that is still in progress. Returns false if the write failed.
+    bool Collect();
+
+    //! Wait for the write in progress, if any, and release its entries.
+    //! Returns false if the write failed.
+    bool Sync();
 };
 
 /** Access to the block database (blocks/index/) */
@@ -119,34 +372,103 @@ private:
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
     bool EraseBatchSync(const std::vector<const CBlockIndex*>& blockinfo);
+    bool ReadDiskBlockIndex(const uint256 &hash, CDiskBlockIndex &diskindex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &info);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindexing);
     bool ReadReindexing(bool &fReindexing);
+
+    //! Whether entries of the transaction or insight explorer indexes written
+    //! by earlier versions, which kept them in this database, may still be
+    //! present.
+    bool HasLegacyIndexes();
+    //! Whether the transaction index of earlier versions is present, and
+    //! look up a transaction in it.
+    bool HasLegacyTxIndex();
+    bool ReadLegacyTxIndex(const uint256 &txid, CDiskTxPos &pos);
+    //! Erase up to nMaxEntries of those entries, and clear the flags that
+    //! marked them as present once none are left. Sets fDone accordingly.
+    bool EraseLegacyIndexes(size_t nMaxEntries, bool &fDone);
+
+    bool WriteFlag(const std::string &name, bool fValue);
+    bool ReadFlag(const std::string &name, bool &fValue);
+    bool LoadBlockIndexGuts(
+        std::function<CBlockIndex*(const uint256&)> insertBlockIndex,
+        const CChainParams& chainParams);
+};
+
+/**
+ * Access to one of the transaction or insight explorer index databases
+ * (indexes/<name>/).
+ *
+ * Each index lives in its own database, so that its write volume does not
+ * compact the block index, and records the block it is synced to in the same
+ * batch as the entries for that block. See CInsightIndex.
+ */
+class CInsightIndexDB : public CDBWrapper
+{
+public:
+    CInsightIndexDB(const std::string& strName, size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+private:
+    CInsightIndexDB(const CInsightIndexDB&);
+    void operator=(const CInsightIndexDB&);
+public:
+    bool ReadBestBlock(uint256 &hashBlock);
+    //! Write the batch holding the entries of a block, along with the new
+    //! best block of the index.
+    bool WriteBlockBatch(CDBBatch &batch, const uint256 &hashBestBlock);
+
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
-    bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
+    void WriteTxIndex(CDBBatch &batch, const std::vector<std::pair<uint256, CDiskTxPos> > &vect);
 
     // START insightexplorer
-    bool UpdateAddressUnspentIndex(const std::vector<CAddressUnspentDbEntry> &vect);
+    void UpdateAddressUnspentIndex(CDBBatch &batch, const std::vector<CAddressUnspentDbEntry> &vect);
     bool ReadAddressUnspentIndex(uint160 addressHash, int type, std::vector<CAddressUnspentDbEntry> &vect);
-    bool WriteAddressIndex(const std::vector<CAddressIndexDbEntry> &vect);
-    bool EraseAddressIndex(const std::vector<CAddressIndexDbEntry> &vect);
+    //! Visit the unspent outputs of an address, from the one at pFrom if set.
+    bool ForEachAddressUnspentIndex(uint160 addressHash, int type, const CAddressUnspentKey *pFrom, const AddressUnspentVisitor &visit);
+    void WriteAddressIndex(CDBBatch &batch, const std::vector<CAddressIndexDbEntry> &vect);
+    void EraseAddressIndex(CDBBatch &batch, const std::vector<CAddressIndexDbEntry> &vect);
     bool ReadAddressIndex(uint160 addressHash, int type, std::vector<CAddressIndexDbEntry> &addressIndex, int start = 0, int end = 0);
+    //! Visit the entries of an address in the height range, from the one at
+    //! pFrom if set.
+    bool ForEachAddressIndex(uint160 addressHash, int type, int start, int end, const CAddressIndexKey *pFrom, const AddressIndexVisitor &visit);
+    //! Whether the balances are kept, which is the case if the address index
+    //! was built with them from the start.
+    bool HasAddressBalances();
+    bool WriteHasAddressBalances();
+    bool ReadAddressBalance(uint160 addressHash, int type, CAddressBalanceValue &value);
+    void WriteAddressBalance(CDBBatch &batch, uint160 addressHash, int type, const CAddressBalanceValue &value);
     bool ReadSpentIndex(CSpentIndexKey &key, CSpentIndexValue &value);
-    bool UpdateSpentIndex(const std::vector<CSpentIndexDbEntry> &vect);
-    bool WriteTimestampIndex(const CTimestampIndexKey &timestampIndex);
+    void UpdateSpentIndex(CDBBatch &batch, const std::vector<CSpentIndexDbEntry> &vect);
+    void WriteTimestampIndex(CDBBatch &batch, const CTimestampIndexKey &timestampIndex);
     bool ReadTimestampIndex(unsigned int high, unsigned int low,
             const bool fActiveOnly, std::vector<std::pair<uint256, unsigned int> > &vect);
-    bool WriteTimestampBlockIndex(const CTimestampBlockIndexKey &blockhashIndex,
+    void WriteTimestampBlockIndex(CDBBatch &batch, const CTimestampBlockIndexKey &blockhashIndex,
             const CTimestampBlockIndexValue &logicalts);
     bool ReadTimestampBlockIndex(const uint256 &hash, unsigned int &logicalTS);
     // END insightexplorer
 
-    bool WriteFlag(const std::string &name, bool fValue);
-    bool ReadFlag(const std::string &name, bool &fValue);
-    bool LoadBlockIndexGuts(
-        std::function<CBlockIndex*(const uint256&)> insertBlockIndex,
-        const CChainParams& chainParams);
+    //! The number of complete subtrees of a note commitment tree.
+    bool ReadSubtreeCount(ShieldedType type, uint32_t &nCount);
+    void WriteSubtreeCount(CDBBatch &batch, ShieldedType type, uint32_t nCount);
+    void WriteSubtreeIndex(CDBBatch &batch, ShieldedType type, uint32_t nIndex, const CSubtreeIndexValue &value);
+    void EraseSubtreeIndex(CDBBatch &batch, ShieldedType type, uint32_t nIndex);
+    bool ReadSubtreeIndex(ShieldedType type, uint32_t nIndex, CSubtreeIndexValue &value);
+    //! Read up to nLimit subtrees, from the one with index nStart.
+    bool ReadSubtreeIndex(ShieldedType type, uint32_t nStart, uint32_t nLimit, std::vector<CSubtreeIndexValue> &vect);
+
+    //! The filter of a block, keyed by its hash so that the filters of
+    //! blocks being disconnected can still be found.
+    void WriteBlockFilter(CDBBatch &batch, const uint256 &hash, const CBlockFilterIndexValue &value);
+    void EraseBlockFilter(CDBBatch &batch, const uint256 &hash);
+    bool ReadBlockFilter(const uint256 &hash, CBlockFilterIndexValue &value);
+
+    //! The value pools at a height of the active chain.
+    void WriteSupplyIndex(CDBBatch &batch, int nHeight, const CSupplyIndexValue &value);
+    void EraseSupplyIndex(CDBBatch &batch, int nHeight);
+    bool ReadSupplyIndex(int nHeight, CSupplyIndexValue &value);
+    //! Read the entries of the heights from nStart to nEnd, in order.
+    bool ReadSupplyIndex(int nStart, int nEnd, std::vector<std::pair<int, CSupplyIndexValue>> &vect);
 };
 
 #endif // BITCOIN_TXDB_H
@@ -11,6 +11,7 @@
 #include "consensus/validation.h"
 #include "main.h"
 #include "policy/fees.h"
+#include "script/interpreter.h"
 #include "streams.h"
 #include "timedata.h"
 #include "util/system.h"
@@ -24,7 +25,9 @@ using namespace std;
 
 CTxMemPoolEntry::CTxMemPoolEntry():
     nFee(0), nTxSize(0), nModSize(0), nUsageSize(0), nTime(0), dPriority(0.0),
-    hadNoDependencies(false), spendsCoinbase(false)
+    hadNoDependencies(false), spendsCoinbase(false),
+    nCountWithAncestors(0), nSizeWithAncestors(0), nModFeesWithAncestors(0),
+    nCountWithDescendants(0), nSizeWithDescendants(0), nModFeesWithDescendants(0)
 {
     nHeight = MEMPOOL_HEIGHT;
 }
@@ -43,6 +46,13 @@ CTxMemPoolEntry::CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
     feeRate = CFeeRate(nFee, nTxSize);
 
     feeDelta = 0;
+
+    nCountWithAncestors = 1;
+    nSizeWithAncestors = nTxSize;
+    nModFeesWithAncestors = nFee;
+    nCountWithDescendants = 1;
+    nSizeWithDescendants = nTxSize;
+    nModFeesWithDescendants = nFee;
 }
 
 CTxMemPoolEntry::CTxMemPoolEntry(const CTxMemPoolEntry& other)
@@ -59,11 +69,40 @@ CTxMemPoolEntry::GetPriority(unsigned int currentHeight) const
     return dResult;
 }
 
+void CTxMemPoolEntry::SetTxData(std::shared_ptr<const PrecomputedTransactionData> txdataIn)
+{
+    txdata = txdataIn;
+    // For v5 transactions, the Rust side keeps its own parsed copy of the
+    // transaction; count it as the size of the serialized transaction.
+    nUsageSize += memusage::MallocUsage(sizeof(PrecomputedTransactionData)) +
+        (txdata->preTx ? memusage::MallocUsage(nTxSize) : 0);
+}
+
 void CTxMemPoolEntry::UpdateFeeDelta(int64_t newFeeDelta)
 {
+    nModFeesWithAncestors += newFeeDelta - feeDelta;
+    nModFeesWithDescendants += newFeeDelta - feeDelta;
     feeDelta = newFeeDelta;
 }
 
+void CTxMemPoolEntry::UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithAncestors += modifySize;
+    assert(int64_t(nSizeWithAncestors) > 0);
+    nModFeesWithAncestors += modifyFee;
+    nCountWithAncestors += modifyCount;
+    assert(int64_t(nCountWithAncestors) > 0);
+}
+
+void CTxMemPoolEntry::UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount)
+{
+    nSizeWithDescendants += modifySize;
+    assert(int64_t(nSizeWithDescendants) > 0);
+    nModFeesWithDescendants += modifyFee;
+    nCountWithDescendants += modifyCount;
+    assert(int64_t(nCountWithDescendants) > 0);
+}
+
 CTxMemPool::CTxMemPool(const CFeeRate& _minReasonableRelayFee) :
     nTransactionsUpdated(0)
 {
@@ -85,17 +124,10 @@ CTxMemPool::~CTxMemPool()
     delete weightedTxTree;
 }
 
-void CTxMemPool::pruneSpent(const uint256 &hashTx, CCoins &coins)
+bool CTxMemPool::isSpent(const COutPoint& outpoint)
 {
     LOCK(cs);
-
-    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.lower_bound(COutPoint(hashTx, 0));
-
-    // iterate over all COutPoints in mapNextTx whose hash equals the provided hashTx
-    while (it != mapNextTx.end() && it->first.hash == hashTx) {
-        coins.Spend(it->first.n); // and remove those outputs from coins
-        it++;
-    }
+    return mapNextTx.count(outpoint);
 }
 
 unsigned int CTxMemPool::GetTransactionsUpdated() const
@@ -110,6 +142,163 @@ void CTxMemPool::AddTransactionsUpdated(unsigned int n)
     nTransactionsUpdated += n;
 }
 
+uint64_t CTxMemPool::NextSequence()
+{
+    LOCK(cs_sequence);
+    condSequence.notify_all();
+    return ++nMempoolSequence;
+}
+
+uint64_t CTxMemPool::GetSequence() const
+{
+    LOCK(cs_sequence);
+    return nMempoolSequence;
+}
+
+uint64_t CTxMemPool::WaitForSequence(uint64_t nSequence, std::chrono::milliseconds timeout, const std::function<bool()>& fInterrupted) const
+{
+    WAIT_LOCK(cs_sequence, lock);
+    auto predicate = [&]() { return nMempoolSequence > nSequence || fInterrupted(); };
+    if (timeout.count() > 0) {
+        condSequence.wait_for(lock, timeout, predicate);
+    } else {
+        condSequence.wait(lock, predicate);
+    }
+    return nMempoolSequence;
+}
+
+void CTxMemPool::NotifySequenceWaiters() const
+{
+    LOCK(cs_sequence);
+    condSequence.notify_all();
+}
+
+
+void CTxMemPool::CalculateAncestors(txiter it, setEntries& setAncestors) const
+{
+    std::vector<txiter> vToVisit{it};
+    while (!vToVisit.empty()) {
+        txiter child = vToVisit.back();
+        vToVisit.pop_back();
+        for (const CTxIn& txin : child->GetTx().vin) {
+            txiter parent = mapTx.find(txin.prevout.hash);
+            if (parent != mapTx.end() && setAncestors.insert(parent).second) {
+                vToVisit.push_back(parent);
+            }
+        }
+    }
+}
+
+void CTxMemPool::CalculateDescendants(txiter it, setEntries& setDescendants) const
+{
+    std::vector<txiter> vToVisit{it};
+    while (!vToVisit.empty()) {
+        txiter parent = vToVisit.back();
+        vToVisit.pop_back();
+        const CTransaction& tx = parent->GetTx();
+        for (unsigned int i = 0; i < tx.vout.size(); i++) {
+            CTxMemPoolNextTxMap::const_iterator next = mapNextTx.find(COutPoint(tx.GetHash(), i));
+            if (next == mapNextTx.end())
+                continue;
+            txiter child = mapTx.find(next->second.ptx->GetHash());
+            assert(child != mapTx.end());
+            if (setDescendants.insert(child).second) {
+                vToVisit.push_back(child);
+            }
+        }
+    }
+}
+
+void CTxMemPool::CalculatePackageState(txiter it, setEntries& setAncestors, setEntries& setDescendants,
+                                       uint64_t& nSizeWithAncestors, CAmount& nModFeesWithAncestors,
+                                       uint64_t& nSizeWithDescendants, CAmount& nModFeesWithDescendants) const
+{
+    CalculateAncestors(it, setAncestors);
+    CalculateDescendants(it, setDescendants);
+    nSizeWithAncestors = nSizeWithDescendants = it->GetTxSize();
+    nModFeesWithAncestors = nModFeesWithDescendants = it->GetModifiedFee();
+    for (txiter ancestor : setAncestors) {
+        nSizeWithAncestors += ancestor->GetTxSize();
+        nModFeesWithAncestors += ancestor->GetModifiedFee();
+    }
+    for (txiter descendant : setDescendants) {
+        nSizeWithDescendants += descendant->GetTxSize();
+        nModFeesWithDescendants += descendant->GetModifiedFee();
+    }
+}
+
+void CTxMemPool::RecalculatePackageState(txiter it)
+{
+    setEntries setAncestors, setDescendants;
+    uint64_t nSizeWithAncestors, nSizeWithDescendants;
+    CAmount nModFeesWithAncestors, nModFeesWithDescendants;
+    CalculatePackageState(it, setAncestors, setDescendants,
+                          nSizeWithAncestors, nModFeesWithAncestors,
+                          nSizeWithDescendants, nModFeesWithDescendants);
+    mapTx.modify(it, update_ancestor_state(
+        int64_t(nSizeWithAncestors) - int64_t(it->GetSizeWithAncestors()),
+        nModFeesWithAncestors - it->GetModFeesWithAncestors(),
+        int64_t(setAncestors.size() + 1) - int64_t(it->GetCountWithAncestors())));
+    mapTx.modify(it, update_descendant_state(
+        int64_t(nSizeWithDescendants) - int64_t(it->GetSizeWithDescendants()),
+        nModFeesWithDescendants - it->GetModFeesWithDescendants(),
+        int64_t(setDescendants.size() + 1) - int64_t(it->GetCountWithDescendants())));
+}
+
+void CTxMemPool::UpdatePackageStateForAdd(txiter it)
+{
+    setEntries setAncestors;
+    CalculateAncestors(it, setAncestors);
+    setEntries setDescendants;
+    CalculateDescendants(it, setDescendants);
+
+    if (setDescendants.empty()) {
+        // The usual case, where the new transaction only extends its
+        // ancestors' packages.
+        int64_t nSize = 0;
+        CAmount nFees = 0;
+        for (txiter ancestor : setAncestors) {
+            nSize += ancestor->GetTxSize();
+            nFees += ancestor->GetModifiedFee();
+            mapTx.modify(ancestor, update_descendant_state(it->GetTxSize(), it->GetModifiedFee(), 1));
+        }
+        mapTx.modify(it, update_ancestor_state(nSize, nFees, setAncestors.size()));
+        return;
+    }
+
+    // Transactions spending this one are already in the mempool when a block
+    // is disconnected, so the packages of all the entries it links together
+    // have changed.
+    RecalculatePackageState(it);
+    for (txiter ancestor : setAncestors) {
+        RecalculatePackageState(ancestor);
+    }
+    for (txiter descendant : setDescendants) {
+        RecalculatePackageState(descendant);
+    }
+}
+
+void CTxMemPool::UpdatePackageStateForRemove(const setEntries& setRemove)
+{
+    for (txiter it : setRemove) {
+        const int64_t nSize = it->GetTxSize();
+        const CAmount nFee = it->GetModifiedFee();
+        setEntries setAncestors;
+        CalculateAncestors(it, setAncestors);
+        for (txiter ancestor : setAncestors) {
+            if (!setRemove.count(ancestor)) {
+                mapTx.modify(ancestor, update_descendant_state(-nSize, -nFee, -1));
+            }
+        }
+        setEntries setDescendants;
+        CalculateDescendants(it, setDescendants);
+        for (txiter descendant : setDescendants) {
+            if (!setRemove.count(descendant)) {
+                mapTx.modify(descendant, update_ancestor_state(-nSize, -nFee, -1));
+            }
+        }
+    }
+}
 
 bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry, bool fCurrentEstimate)
 {
@@ -124,8 +313,9 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     cachedInnerUsage += entry.DynamicMemoryUsage();
 
     const CTransaction& tx = newit->GetTx();
-    mapRecentlyAddedTx[tx.GetHash()] = &tx;
+    mapRecentlyAddedTx[tx.GetHash()] = newit->GetSharedTx();
     nRecentlyAddedSequence += 1;
+    GetMainSignals().TransactionAddedToMempool(tx, NextSequence());
     for (unsigned int i = 0; i < tx.vin.size(); i++)
         mapNextTx[tx.vin[i].prevout] = CInPoint(&tx, i);
     for (const JSDescription &joinsplit : tx.vJoinSplit) {
@@ -149,6 +339,8 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
         }
     }
 
+    UpdatePackageStateForAdd(newit);
+
     nTransactionsUpdated++;
     totalTxSize += entry.GetTxSize();
     minerPolicyEstimator->processTransaction(entry, fCurrentEstimate);
@@ -156,12 +348,23 @@ bool CTxMemPool::addUnchecked(const uint256& hash, const CTxMemPoolEntry &entry,
     return true;
 }
 
+SaltedAddressHasher::SaltedAddressHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
+
 void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view)
 {
     LOCK(cs);
     const CTransaction& tx = entry.GetTx();
     std::vector<CMempoolAddressDeltaKey> inserted;
 
+    auto addDelta = [&](const CMempoolAddressDeltaKey& key, const CMempoolAddressDelta& delta) {
+        CMempoolAddressDeltas& address = mapAddress[std::make_pair(key.addressBytes, key.type)];
+        if (address.deltas.emplace(key, delta).second) {
+            address.balanceDelta += delta.amount;
+            nAddressDeltas++;
+        }
+        inserted.push_back(key);
+    };
+
     uint256 txhash = tx.GetHash();
     for (unsigned int j = 0; j < tx.vin.size(); j++) {
         const CTxIn input = tx.vin[j];
@@ -170,9 +373,7 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
         if (type == CScript::UNKNOWN)
             continue;
         CMempoolAddressDeltaKey key(type, prevout.scriptPubKey.AddressHash(), txhash, j, 1);
-        CMempoolAddressDelta delta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n);
-        mapAddress.insert(make_pair(key, delta));
-        inserted.push_back(key);
+        addDelta(key, CMempoolAddressDelta(entry.GetTime(), prevout.nValue * -1, input.prevout.hash, input.prevout.n));
     }
 
     for (unsigned int j = 0; j < tx.vout.size(); j++) {
@@ -181,11 +382,10 @@ void CTxMemPool::addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewC
         if (type == CScript::UNKNOWN)
             continue;
         CMempoolAddressDeltaKey key(type, out.scriptPubKey.AddressHash(), txhash, j, 0);
-        mapAddress.insert(make_pair(key, CMempoolAddressDelta(entry.GetTime(), out.nValue)));
-        inserted.push_back(key);
+        addDelta(key, CMempoolAddressDelta(entry.GetTime(), out.nValue));
     }
 
-    mapAddressInserted.insert(make_pair(txhash, inserted));
+    mapAddressInserted.insert(make_pair(txhash, std::move(inserted)));
 }
 
 // START insightexplorer
@@ -195,12 +395,24 @@ void CTxMemPool::getAddressIndex(
 {
     LOCK(cs);
     for (const auto& it : addresses) {
-        auto ait = mapAddress.lower_bound(CMempoolAddressDeltaKey(it.second, it.first));
-        while (ait != mapAddress.end() && (*ait).first.addressBytes == it.first && (*ait).first.type == it.second) {
-            results.push_back(*ait);
-            ait++;
+        auto ait = mapAddress.find(it);
+        if (ait != mapAddress.end()) {
+            results.insert(results.end(), ait->second.deltas.begin(), ait->second.deltas.end());
+        }
+    }
+}
+
+CAmount CTxMemPool::getAddressBalanceDelta(const std::vector<std::pair<uint160, int>>& addresses)
+{
+    LOCK(cs);
+    CAmount balanceDelta = 0;
+    for (const auto& it : addresses) {
+        auto ait = mapAddress.find(it);
+        if (ait != mapAddress.end()) {
+            balanceDelta += ait->second.balanceDelta;
         }
     }
+    return balanceDelta;
 }
 
 void CTxMemPool::removeAddressIndex(const uint256& txhash)
@@ -209,9 +421,19 @@ void CTxMemPool::removeAddressIndex(const uint256& txhash)
     auto it = mapAddressInserted.find(txhash);
 
     if (it != mapAddressInserted.end()) {
-        std::vector<CMempoolAddressDeltaKey> keys = it->second;
-        for (const auto& mit : keys) {
-            mapAddress.erase(mit);
+        for (const auto& key : it->second) {
+            auto ait = mapAddress.find(std::make_pair(key.addressBytes, key.type));
+            if (ait == mapAddress.end())
+                continue;
+            CMempoolAddressDeltas& address = ait->second;
+            auto dit = address.deltas.find(key);
+            if (dit != address.deltas.end()) {
+                address.balanceDelta -= dit->second.amount;
+                address.deltas.erase(dit);
+                nAddressDeltas--;
+            }
+            if (address.deltas.empty())
+                mapAddress.erase(ait);
         }
         mapAddressInserted.erase(it);
     }
@@ -240,7 +462,7 @@ void CTxMemPool::addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCac
 bool CTxMemPool::getSpentIndex(const CSpentIndexKey &key, CSpentIndexValue &value)
 {
     LOCK(cs);
-    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare>::iterator it = mapSpent.find(key);
+    CTxMemPoolSpentMap::iterator it = mapSpent.find(key);
     if (it != mapSpent.end()) {
         value = it->second;
         return true;
@@ -276,27 +498,41 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             // happen during chain re-orgs if origTx isn't re-accepted into
             // the mempool for any reason.
             for (unsigned int i = 0; i < origTx.vout.size(); i++) {
-                std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
+                CTxMemPoolNextTxMap::iterator it = mapNextTx.find(COutPoint(origTx.GetHash(), i));
                 if (it == mapNextTx.end())
                     continue;
                 txToRemove.push_back(it->second.ptx->GetHash());
             }
         }
+        std::vector<txiter> vRemove;
+        setEntries setRemove;
         while (!txToRemove.empty())
         {
             uint256 hash = txToRemove.front();
             txToRemove.pop_front();
-            if (!mapTx.count(hash))
+            txiter itRemove = mapTx.find(hash);
+            if (itRemove == mapTx.end() || !setRemove.insert(itRemove).second)
                 continue;
-            const CTransaction& tx = mapTx.find(hash)->GetTx();
+            vRemove.push_back(itRemove);
+            const CTransaction& tx = itRemove->GetTx();
             if (fRecursive) {
                 for (unsigned int i = 0; i < tx.vout.size(); i++) {
-                    std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(COutPoint(hash, i));
+                    CTxMemPoolNextTxMap::iterator it = mapNextTx.find(COutPoint(hash, i));
                     if (it == mapNextTx.end())
                         continue;
                     txToRemove.push_back(it->second.ptx->GetHash());
                 }
             }
+        }
+        // This needs the links between the transactions, so it goes first.
+        UpdatePackageStateForRemove(setRemove);
+        std::vector<uint256> vRemoveHashes;
+        vRemoveHashes.reserve(vRemove.size());
+        for (txiter itRemove : vRemove)
+        {
+            const uint256 hash = itRemove->GetTx().GetHash();
+            vRemoveHashes.push_back(hash);
+            const CTransaction& tx = itRemove->GetTx();
             mapRecentlyAddedTx.erase(hash);
             for (const CTxIn& txin : tx.vin)
                 mapNextTx.erase(txin.prevout);
@@ -312,6 +548,7 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
                 mapOrchardNullifiers.erase(orchardNullifier);
             }
             removed.push_back(tx);
+            GetMainSignals().TransactionRemovedFromMempool(tx, NextSequence());
             totalTxSize -= mapTx.find(hash)->GetTxSize();
             cachedInnerUsage -= mapTx.find(hash)->DynamicMemoryUsage();
             mapTx.erase(hash);
@@ -324,9 +561,7 @@ void CTxMemPool::remove(const CTransaction &origTx, std::list<CTransaction>& rem
             if (fSpentIndex)
                 removeSpentIndex(hash);
         }
-        for (CTransaction tx : removed) {
-            weightedTxTree->remove(tx.GetHash());
-        }
+        weightedTxTree->remove(vRemoveHashes);
     }
 }
 
@@ -344,9 +579,9 @@ void CTxMemPool::removeForReorg(const CCoinsViewCache *pcoins, unsigned int nMem
                 indexed_transaction_set::const_iterator it2 = mapTx.find(txin.prevout.hash);
                 if (it2 != mapTx.end())
                     continue;
-                const CCoins *coins = pcoins->AccessCoins(txin.prevout.hash);
-		if (nCheckFrequency != 0) assert(coins);
-                if (!coins || (coins->IsCoinBase() && ((signed long)nMemPoolHeight) - coins->nHeight < COINBASE_MATURITY)) {
+                const Coin &coin = pcoins->AccessCoin(txin.prevout);
+                if (nCheckFrequency != 0) assert(!coin.IsSpent());
+                if (coin.IsSpent() || (coin.IsCoinBase() && ((signed long)nMemPoolHeight) - coin.nHeight < COINBASE_MATURITY)) {
                     transactionsToRemove.push_back(tx);
                     break;
                 }
@@ -414,7 +649,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
     list<CTransaction> result;
     LOCK(cs);
     for (const CTxIn &txin : tx.vin) {
-        std::map<COutPoint, CInPoint>::iterator it = mapNextTx.find(txin.prevout);
+        CTxMemPoolNextTxMap::iterator it = mapNextTx.find(txin.prevout);
         if (it != mapNextTx.end()) {
             const CTransaction &txConflict = *it->second.ptx;
             if (txConflict != tx)
@@ -426,7 +661,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
 
     for (const JSDescription &joinsplit : tx.vJoinSplit) {
         for (const uint256 &nf : joinsplit.nullifiers) {
-            std::map<uint256, const CTransaction*>::iterator it = mapSproutNullifiers.find(nf);
+            CTxMemPoolNullifierMap::iterator it = mapSproutNullifiers.find(nf);
             if (it != mapSproutNullifiers.end()) {
                 const CTransaction &txConflict = *it->second;
                 if (txConflict != tx) {
@@ -436,7 +671,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
         }
     }
     for (const SpendDescription &spendDescription : tx.vShieldedSpend) {
-        std::map<uint256, const CTransaction*>::iterator it = mapSaplingNullifiers.find(spendDescription.nullifier);
+        CTxMemPoolNullifierMap::iterator it = mapSaplingNullifiers.find(spendDescription.nullifier);
         if (it != mapSaplingNullifiers.end()) {
             const CTransaction &txConflict = *it->second;
             if (txConflict != tx) {
@@ -445,7 +680,7 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
         }
     }
     for (const uint256 &orchardNullifier : tx.GetOrchardBundle().GetNullifiers()) {
-        std::map<uint256, const CTransaction*>::iterator it = mapOrchardNullifiers.find(orchardNullifier);
+        CTxMemPoolNullifierMap::iterator it = mapOrchardNullifiers.find(orchardNullifier);
         if (it != mapOrchardNullifiers.end()) {
             const CTransaction &txConflict = *it->second;
             if (txConflict != tx) {
@@ -457,15 +692,16 @@ void CTxMemPool::removeConflicts(const CTransaction &tx, std::list<CTransaction>
 
 std::vector<uint256> CTxMemPool::removeExpired(unsigned int nBlockHeight)
 {
-    // Remove expired txs from the mempool
+    // Remove expired txs from the mempool. They are the ones with a non-zero
+    // expiry height below nBlockHeight, which are at the start of the expiry
+    // index.
     LOCK(cs);
     list<CTransaction> transactionsToRemove;
-    for (indexed_transaction_set::const_iterator it = mapTx.begin(); it != mapTx.end(); it++)
+    const auto& byExpiry = mapTx.get<3>();
+    for (auto it = byExpiry.lower_bound(1); it != byExpiry.end() && it->GetTx().nExpiryHeight < nBlockHeight; it++)
     {
         const CTransaction& tx = it->GetTx();
-        if (IsExpiredTx(tx, nBlockHeight)) {
-            transactionsToRemove.push_back(tx);
-        }
+        transactionsToRemove.push_back(tx);
     }
     std::vector<uint256> ids;
     for (const CTransaction& tx : transactionsToRemove) {
@@ -485,14 +721,20 @@ void CTxMemPool::removeForBlock(const std::vector<CTransaction>& vtx, unsigned i
 {
     LOCK(cs);
     std::vector<CTxMemPoolEntry> entries;
+    std::vector<uint256> vHashes;
     for (const CTransaction& tx : vtx)
     {
         uint256 hash = tx.GetHash();
 
         indexed_transaction_set::iterator i = mapTx.find(hash);
-        if (i != mapTx.end())
+        if (i != mapTx.end()) {
             entries.push_back(*i);
+            vHashes.push_back(hash);
+        }
     }
+    // Take the transactions out of the cost tree together, rather than one
+    // at a time as remove() would.
+    weightedTxTree->remove(vHashes);
     for (const CTransaction& tx : vtx)
     {
         std::list<CTransaction> dummy;
@@ -529,7 +771,8 @@ void CTxMemPool::removeWithoutBranchId(uint32_t nMemPoolBranchId)
 void CTxMemPool::_clear()
 {
     mapTx.clear();
-    mapNextTx.clear();
+    // Swap in an empty map to release the pooled nodes as well.
+    CTxMemPoolNextTxMap().swap(mapNextTx);
     totalTxSize = 0;
     cachedInnerUsage = 0;
     ++nTransactionsUpdated;
@@ -573,17 +816,30 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
                 assert(tx2.vout.size() > txin.prevout.n && !tx2.vout[txin.prevout.n].IsNull());
                 fDependsWait = true;
             } else {
-                const CCoins* coins = pcoins->AccessCoins(txin.prevout.hash);
-                assert(coins && coins->IsAvailable(txin.prevout.n));
+                assert(pcoins->HaveCoin(txin.prevout));
             }
             // Check whether its inputs are marked in mapNextTx.
-            std::map<COutPoint, CInPoint>::const_iterator it3 = mapNextTx.find(txin.prevout);
+            CTxMemPoolNextTxMap::const_iterator it3 = mapNextTx.find(txin.prevout);
             assert(it3 != mapNextTx.end());
             assert(it3->second.ptx == &tx);
             assert(it3->second.n == i);
             i++;
         }
 
+        // Check the package state against the links to other mempool transactions.
+        setEntries setAncestors, setDescendants;
+        uint64_t nSizeWithAncestors, nSizeWithDescendants;
+        CAmount nModFeesWithAncestors, nModFeesWithDescendants;
+        CalculatePackageState(it, setAncestors, setDescendants,
+                              nSizeWithAncestors, nModFeesWithAncestors,
+                              nSizeWithDescendants, nModFeesWithDescendants);
+        assert(it->GetCountWithAncestors() == setAncestors.size() + 1);
+        assert(it->GetSizeWithAncestors() == nSizeWithAncestors);
+        assert(it->GetModFeesWithAncestors() == nModFeesWithAncestors);
+        assert(it->GetCountWithDescendants() == setDescendants.size() + 1);
+        assert(it->GetSizeWithDescendants() == nSizeWithDescendants);
+        assert(it->GetModFeesWithDescendants() == nModFeesWithDescendants);
+
         if (fDependsWait)
             waitingOnDependants.push_back(&(*it));
         else {
@@ -613,7 +869,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
             stepsSinceLastRemove = 0;
         }
     }
-    for (std::map<COutPoint, CInPoint>::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
+    for (CTxMemPoolNextTxMap::const_iterator it = mapNextTx.begin(); it != mapNextTx.end(); it++) {
         uint256 hash = it->second.ptx->GetHash();
         indexed_transaction_set::const_iterator it2 = mapTx.find(hash);
         const CTransaction& tx = it2->GetTx();
@@ -633,7 +889,7 @@ void CTxMemPool::check(const CCoinsViewCache *pcoins) const
 
 void CTxMemPool::checkNullifiers(ShieldedType type) const
 {
-    const std::map<uint256, const CTransaction*>* mapToUse;
+    const CTxMemPoolNullifierMap* mapToUse;
     switch (type) {
         case SPROUT:
             mapToUse = &mapSproutNullifiers;
@@ -721,12 +977,46 @@ std::vector<TxMempoolInfo> CTxMemPool::infoAll() const
     std::vector<TxMempoolInfo> ret;
     ret.reserve(mapTx.size());
     for (auto it : iters) {
-        ret.push_back(TxMempoolInfo{it->GetSharedTx(), it->GetTime(), CFeeRate(it->GetFee(), it->GetTxSize())});
+        ret.push_back(TxMempoolInfo{it->GetSharedTx(), it->GetTime(), CFeeRate(it->GetFee(), it->GetTxSize()), it->GetFee(), it->GetTxSize()});
     }
 
     return ret;
 }
 
+std::shared_ptr<const CTxMemPoolSnapshot> CTxMemPool::GetSnapshot() const
+{
+    std::shared_ptr<const CTxMemPoolSnapshot> current = std::atomic_load(&snapshot);
+    if (current && current->nTransactionsUpdated == nTransactionsUpdated) {
+        return current;
+    }
+
+    LOCK(cs);
+    // Another caller may have rebuilt it while we waited for the lock.
+    current = std::atomic_load(&snapshot);
+    if (current && current->nTransactionsUpdated == nTransactionsUpdated) {
+        return current;
+    }
+
+    auto rebuilt = std::make_shared<CTxMemPoolSnapshot>();
+    rebuilt->nTransactionsUpdated = nTransactionsUpdated;
+    rebuilt->vEntries.reserve(mapTx.size());
+    rebuilt->vSortedHashes.reserve(mapTx.size());
+    for (auto it : GetSortedDepthAndScore()) {
+        rebuilt->vEntries.push_back(*it);
+        rebuilt->vSortedHashes.push_back(it->GetTx().GetHash());
+    }
+    std::sort(rebuilt->vSortedHashes.begin(), rebuilt->vSortedHashes.end());
+
+    current = rebuilt;
+    std::atomic_store(&snapshot, current);
+    return current;
+}
+
+bool CTxMemPoolSnapshot::exists(const uint256& hash) const
+{
+    return std::binary_search(vSortedHashes.begin(), vSortedHashes.end(), hash);
+}
+
 std::shared_ptr<const CTransaction> CTxMemPool::get(const uint256& hash) const
 {
     LOCK(cs);
@@ -736,13 +1026,23 @@ std::shared_ptr<const CTransaction> CTxMemPool::get(const uint256& hash) const
     return i->GetSharedTx();
 }
 
+std::shared_ptr<const PrecomputedTransactionData> CTxMemPool::GetTxData(const WTxId& wtxid, uint32_t nBranchId) const
+{
+    LOCK(cs);
+    indexed_transaction_set::const_iterator i = mapTx.find(wtxid.hash);
+    if (i == mapTx.end() || i->GetTx().GetAuthDigest() != wtxid.authDigest ||
+        i->GetValidatedBranchId() != nBranchId)
+        return nullptr;
+    return i->GetTxData();
+}
+
 TxMempoolInfo CTxMemPool::info(const uint256& hash) const
 {
     LOCK(cs);
     indexed_transaction_set::const_iterator i = mapTx.find(hash);
     if (i == mapTx.end())
         return TxMempoolInfo();
-    return TxMempoolInfo{i->GetSharedTx(), i->GetTime(), CFeeRate(i->GetFee(), i->GetTxSize())};
+    return TxMempoolInfo{i->GetSharedTx(), i->GetTime(), CFeeRate(i->GetFee(), i->GetTxSize()), i->GetFee(), i->GetTxSize()};
 }
 
 CFeeRate CTxMemPool::estimateFee(int nBlocks) const
@@ -750,6 +1050,11 @@ CFeeRate CTxMemPool::estimateFee(int nBlocks) const
     LOCK(cs);
     return minerPolicyEstimator->estimateFee(nBlocks);
 }
+CFeeRate CTxMemPool::estimateFee(int nBlocks, FeeEstimateType type) const
+{
+    LOCK(cs);
+    return minerPolicyEstimator->estimateFee(nBlocks, type);
+}
 double CTxMemPool::estimatePriority(int nBlocks) const
 {
     LOCK(cs);
@@ -800,7 +1105,18 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const std::string str
         deltas.second += nFeeDelta;
         txiter it = mapTx.find(hash);
         if (it != mapTx.end()) {
+            ++nTransactionsUpdated;
             mapTx.modify(it, update_fee_delta(deltas.second));
+            setEntries setAncestors;
+            CalculateAncestors(it, setAncestors);
+            for (txiter ancestor : setAncestors) {
+                mapTx.modify(ancestor, update_descendant_state(0, nFeeDelta, 0));
+            }
+            setEntries setDescendants;
+            CalculateDescendants(it, setDescendants);
+            for (txiter descendant : setDescendants) {
+                mapTx.modify(descendant, update_ancestor_state(0, nFeeDelta, 0));
+            }
         }
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
@@ -845,20 +1161,21 @@ bool CTxMemPool::nullifierExists(const uint256& nullifier, ShieldedType type) co
     }
 }
 
-std::pair<std::vector<CTransaction>, uint64_t> CTxMemPool::DrainRecentlyAdded()
+std::pair<std::vector<std::shared_ptr<const CTransaction>>, uint64_t> CTxMemPool::DrainRecentlyAdded()
 {
     uint64_t recentlyAddedSequence;
-    std::vector<CTransaction> txs;
+    std::vector<std::shared_ptr<const CTransaction>> txs;
     {
         LOCK(cs);
         recentlyAddedSequence = nRecentlyAddedSequence;
-        for (const auto& kv : mapRecentlyAddedTx) {
-            txs.push_back(*(kv.second));
+        txs.reserve(mapRecentlyAddedTx.size());
+        for (auto& kv : mapRecentlyAddedTx) {
+            txs.push_back(std::move(kv.second));
         }
         mapRecentlyAddedTx.clear();
     }
 
-    return std::make_pair(txs, recentlyAddedSequence);
+    return std::make_pair(std::move(txs), recentlyAddedSequence);
 }
 
 void CTxMemPool::SetNotifiedSequence(uint64_t recentlyAddedSequence) {
@@ -880,20 +1197,52 @@ bool CCoinsViewMemPool::GetNullifier(const uint256 &nf, ShieldedType type) const
     return mempool.nullifierExists(nf, type) || base->GetNullifier(nf, type);
 }
 
-bool CCoinsViewMemPool::GetCoins(const uint256 &txid, CCoins &coins) const {
+bool CCoinsViewMemPool::GetCoin(const COutPoint &outpoint, Coin &coin) const {
     // If an entry in the mempool exists, always return that one, as it's guaranteed to never
     // conflict with the underlying cache, and it cannot have pruned entries (as it contains full)
     // transactions. First checking the underlying cache risks returning a pruned entry instead.
-    shared_ptr<const CTransaction> ptx = mempool.get(txid);
+    shared_ptr<const CTransaction> ptx = mempool.get(outpoint.hash);
     if (ptx) {
-        coins = CCoins(*ptx, MEMPOOL_HEIGHT);
-        return true;
+        if (outpoint.n < ptx->vout.size()) {
+            coin = Coin(ptx->vout[outpoint.n], MEMPOOL_HEIGHT, false);
+            return true;
+        } else {
+            return false;
+        }
     }
-    return (base->GetCoins(txid, coins) && !coins.IsPruned());
+    return (base->GetCoin(outpoint, coin) && !coin.IsSpent());
 }
 
-bool CCoinsViewMemPool::HaveCoins(const uint256 &txid) const {
-    return mempool.exists(txid) || base->HaveCoins(txid);
+std::vector<std::optional<Coin>> CCoinsViewMemPool::GetCoins(const std::vector<COutPoint> &outpoints) const {
+    // As in GetCoin, outputs of mempool transactions take precedence; the
+    // rest are read from the base view in one call.
+    std::vector<std::optional<Coin>> coins(outpoints.size());
+    std::vector<COutPoint> missing;
+    std::vector<size_t> missingPos;
+    for (size_t i = 0; i < outpoints.size(); i++) {
+        shared_ptr<const CTransaction> ptx = mempool.get(outpoints[i].hash);
+        if (ptx) {
+            if (outpoints[i].n < ptx->vout.size()) {
+                coins[i] = Coin(ptx->vout[outpoints[i].n], MEMPOOL_HEIGHT, false);
+            }
+        } else {
+            missing.push_back(outpoints[i]);
+            missingPos.push_back(i);
+        }
+    }
+    if (!missing.empty()) {
+        std::vector<std::optional<Coin>> fetched = base->GetCoins(missing);
+        for (size_t i = 0; i < missing.size(); i++) {
+            if (fetched[i] && !fetched[i]->IsSpent()) {
+                coins[missingPos[i]] = std::move(fetched[i]);
+            }
+        }
+    }
+    return coins;
+}
+
+bool CCoinsViewMemPool::HaveCoin(const COutPoint &outpoint) const {
+    return mempool.exists(outpoint) || base->HaveCoin(outpoint);
 }
 
 size_t CTxMemPool::DynamicMemoryUsage() const {
@@ -901,9 +1250,9 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
 
     size_t total = 0;
 
-    // Estimate the overhead of mapTx to be 9 pointers + an allocation, as no exact formula for
+    // Estimate the overhead of mapTx to be 12 pointers + an allocation, as no exact formula for
     // boost::multi_index_contained is implemented.
-    total += memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 9 * sizeof(void*)) * mapTx.size();
+    total += memusage::MallocUsage(sizeof(CTxMemPoolEntry) + 12 * sizeof(void*)) * mapTx.size();
 
     // Two metadata maps inherited from Bitcoin Core
     total += memusage::DynamicUsage(mapNextTx) + memusage::DynamicUsage(mapDeltas);
@@ -920,11 +1269,12 @@ size_t CTxMemPool::DynamicMemoryUsage() const {
              memusage::DynamicUsage(mapOrchardNullifiers);
 
     // DoS mitigation
-    total += memusage::DynamicUsage(recentlyEvicted) + memusage::DynamicUsage(weightedTxTree);
+    total += memusage::DynamicUsage(recentlyEvicted) + weightedTxTree->DynamicMemoryUsage();
 
     // Insight-related structures
     size_t insight = 0;
-    insight += memusage::DynamicUsage(mapAddress);
+    insight += memusage::DynamicUsage(mapAddress) +
+               memusage::MallocUsage(sizeof(memusage::stl_tree_node<std::pair<const CMempoolAddressDeltaKey, CMempoolAddressDelta>>)) * nAddressDeltas;
     insight += memusage::DynamicUsage(mapAddressInserted);
     insight += memusage::DynamicUsage(mapSpent);
     insight += memusage::DynamicUsage(mapSpentInserted);
@@ -940,6 +1290,12 @@ void CTxMemPool::SetMempoolCostLimit(int64_t totalCostLimit, int64_t evictionMem
     delete weightedTxTree;
     recentlyEvicted = new RecentlyEvictedList(evictionMemorySeconds);
     weightedTxTree = new WeightedTxTree(totalCostLimit);
+    std::vector<WeightedTxInfo> weightedTxInfos;
+    weightedTxInfos.reserve(mapTx.size());
+    for (const CTxMemPoolEntry& entry : mapTx) {
+        weightedTxInfos.push_back(WeightedTxInfo::from(entry.GetTx(), entry.GetFee()));
+    }
+    weightedTxTree->add(weightedTxInfos);
 }
 
 bool CTxMemPool::IsRecentlyEvicted(const uint256& txId) {
@@ -7,7 +7,12 @@
 #ifndef BITCOIN_TXMEMPOOL_H
 #define BITCOIN_TXMEMPOOL_H
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <list>
+#include <set>
 #include <memory>
 
 #include "amount.h"
@@ -23,8 +28,10 @@
 #include "boost/multi_index_container.hpp"
 #include "boost/multi_index/ordered_index.hpp"
 #include "boost/multi_index/hashed_index.hpp"
+#include <boost/unordered_map.hpp>
 
 class CAutoFile;
+struct PrecomputedTransactionData;
 
 inline double AllowFreeThreshold()
 {
@@ -42,7 +49,7 @@ inline bool AllowFree(double dPriority)
     return dPriority > AllowFreeThreshold();
 }
 
-/** Fake height value used in CCoins to signify they are only in the memory pool (since 0.8) */
+/** Fake height value used in Coin to signify they are only in the memory pool (since 0.8) */
 static const unsigned int MEMPOOL_HEIGHT = 0x7FFFFFFF;
 
 /**
@@ -65,6 +72,17 @@ private:
     unsigned int sigOpCount;   //!< Legacy sig ops plus P2SH sig op count
     int64_t feeDelta;          //!< Used for determining the priority of the transaction for mining in a block
     uint32_t nBranchId;        //!< Branch ID this transaction is known to commit to, cached for efficiency
+    std::shared_ptr<const PrecomputedTransactionData> txdata; //!< Signature hash data computed when validating the scripts
+
+    // The packages of this transaction with its in-mempool ancestors and with
+    // its in-mempool descendants, both including the transaction itself. They
+    // are maintained by CTxMemPool as transactions are added and removed.
+    uint64_t nCountWithAncestors;
+    uint64_t nSizeWithAncestors;
+    CAmount nModFeesWithAncestors;
+    uint64_t nCountWithDescendants;
+    uint64_t nSizeWithDescendants;
+    CAmount nModFeesWithDescendants;
 
 public:
     CTxMemPoolEntry(const CTransaction& _tx, const CAmount& _nFee,
@@ -89,9 +107,26 @@ public:
 
     // Updates the fee delta used for mining priority score
     void UpdateFeeDelta(int64_t feeDelta);
+    // Adjust the package state when an ancestor or descendant is added or removed
+    void UpdateAncestorState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+    void UpdateDescendantState(int64_t modifySize, CAmount modifyFee, int64_t modifyCount);
+
+    uint64_t GetCountWithAncestors() const { return nCountWithAncestors; }
+    uint64_t GetSizeWithAncestors() const { return nSizeWithAncestors; }
+    CAmount GetModFeesWithAncestors() const { return nModFeesWithAncestors; }
+    uint64_t GetCountWithDescendants() const { return nCountWithDescendants; }
+    uint64_t GetSizeWithDescendants() const { return nSizeWithDescendants; }
+    CAmount GetModFeesWithDescendants() const { return nModFeesWithDescendants; }
 
     bool GetSpendsCoinbase() const { return spendsCoinbase; }
     uint32_t GetValidatedBranchId() const { return nBranchId; }
+
+    /**
+     * Keep the signature hash data the scripts were validated with, so that
+     * ConnectBlock() can check them again without recomputing it.
+     */
+    void SetTxData(std::shared_ptr<const PrecomputedTransactionData> txdataIn);
+    std::shared_ptr<const PrecomputedTransactionData> GetTxData() const { return txdata; }
 };
 
 struct update_fee_delta
@@ -104,6 +139,32 @@ private:
     int64_t feeDelta;
 };
 
+struct update_ancestor_state
+{
+    update_ancestor_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateAncestorState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
+struct update_descendant_state
+{
+    update_descendant_state(int64_t _modifySize, CAmount _modifyFee, int64_t _modifyCount) :
+        modifySize(_modifySize), modifyFee(_modifyFee), modifyCount(_modifyCount) { }
+
+    void operator() (CTxMemPoolEntry &e) { e.UpdateDescendantState(modifySize, modifyFee, modifyCount); }
+
+private:
+    int64_t modifySize;
+    CAmount modifyFee;
+    int64_t modifyCount;
+};
+
 // extracts a TxMemPoolEntry's transaction hash
 struct mempoolentry_txid
 {
@@ -114,6 +175,16 @@ struct mempoolentry_txid
     }
 };
 
+// extracts a TxMemPoolEntry's expiry height
+struct mempoolentry_expiryheight
+{
+    typedef uint32_t result_type;
+    result_type operator() (const CTxMemPoolEntry &entry) const
+    {
+        return entry.GetTx().nExpiryHeight;
+    }
+};
+
 class CompareTxMemPoolEntryByFee
 {
 public:
@@ -159,6 +230,38 @@ public:
     size_t DynamicMemoryUsage() const { return 0; }
 };
 
+/**
+ * The mempool's lookup tables from outpoints and nullifiers are only ever
+ * queried by key, so they are salted hash maps whose nodes come from a
+ * per-map PoolAllocator, as for the coins cache. The block size leaves room
+ * for the node's own link and hash fields on top of the stored pair.
+ */
+typedef PoolAllocator<std::pair<const COutPoint, CInPoint>,
+                      sizeof(std::pair<const COutPoint, CInPoint>) + sizeof(void*) * 4>
+    CTxMemPoolNextTxAllocator;
+typedef boost::unordered_map<COutPoint, CInPoint, SaltedOutpointHasher, std::equal_to<COutPoint>, CTxMemPoolNextTxAllocator> CTxMemPoolNextTxMap;
+
+typedef PoolAllocator<std::pair<const uint256, const CTransaction*>,
+                      sizeof(std::pair<const uint256, const CTransaction*>) + sizeof(void*) * 4>
+    CTxMemPoolNullifierAllocator;
+typedef boost::unordered_map<uint256, const CTransaction*, SaltedTxidHasher, std::equal_to<uint256>, CTxMemPoolNullifierAllocator> CTxMemPoolNullifierMap;
+
+class SaltedSpentIndexKeyHasher
+{
+private:
+    SaltedOutpointHasher hasher;
+
+public:
+    size_t operator()(const CSpentIndexKey& key) const {
+        return hasher(COutPoint(key.txid, key.outputIndex));
+    }
+};
+
+typedef PoolAllocator<std::pair<const CSpentIndexKey, CSpentIndexValue>,
+                      sizeof(std::pair<const CSpentIndexKey, CSpentIndexValue>) + sizeof(void*) * 4>
+    CTxMemPoolSpentAllocator;
+typedef boost::unordered_map<CSpentIndexKey, CSpentIndexValue, SaltedSpentIndexKeyHasher, std::equal_to<CSpentIndexKey>, CTxMemPoolSpentAllocator> CTxMemPoolSpentMap;
+
 /**
  * Information about a mempool transaction.
  */
@@ -172,6 +275,50 @@ struct TxMempoolInfo
 
     /** Feerate of the transaction. */
     CFeeRate feeRate;
+
+    /** Fee and size of the transaction, for comparing with a peer's fee filter. */
+    CAmount nFee;
+    size_t nTxSize;
+};
+
+/**
+ * An immutable copy of the mempool entries, for callers that read all of
+ * them (such as the getrawmempool RPC method). Once obtained from CTxMemPool::GetSnapshot() it
+ * can be iterated without holding CTxMemPool::cs, so that building large
+ * responses does not hold up transaction admission.
+ */
+struct CTxMemPoolSnapshot
+{
+    //! The value of CTxMemPool::GetTransactionsUpdated() it was taken at.
+    unsigned int nTransactionsUpdated;
+    //! The entries, in the same order as queryHashes() returns them.
+    std::vector<CTxMemPoolEntry> vEntries;
+
+    bool exists(const uint256& hash) const;
+
+private:
+    //! The txids of vEntries, sorted.
+    std::vector<uint256> vSortedHashes;
+
+    friend class CTxMemPool;
+};
+
+/**
+ * Hashes the (address hash, address type) pairs of the mempool address index,
+ * salted so that the addresses sharing a bucket cannot be chosen by others.
+ */
+class SaltedAddressHasher
+{
+private:
+    /** Salt */
+    const uint64_t k0, k1;
+
+public:
+    SaltedAddressHasher();
+
+    size_t operator()(const std::pair<uint160, int>& address) const {
+        return CSipHasher(k0, k1).Write(address.first.begin(), address.first.size()).Write(address.second).Finalize();
+    }
 };
 
 /**
@@ -196,19 +343,32 @@ class CTxMemPool
 {
 private:
     uint32_t nCheckFrequency; //!< Value n means that n times in 2^32 we check.
-    unsigned int nTransactionsUpdated;
+    //! Only changed with cs held, but atomic so that GetSnapshot() can
+    //! check whether the snapshot is current without taking cs.
+    std::atomic<unsigned int> nTransactionsUpdated;
+    //! The last snapshot returned by GetSnapshot(). Only accessed through
+    //! std::atomic_load and std::atomic_store.
+    mutable std::shared_ptr<const CTxMemPoolSnapshot> snapshot;
     CBlockPolicyEstimator* minerPolicyEstimator;
 
     uint64_t totalTxSize = 0;  //!< sum of all mempool tx' byte sizes
     uint64_t cachedInnerUsage; //!< sum of dynamic memory usage of all the map elements (NOT the maps themselves)
 
-    std::map<uint256, const CTransaction*> mapRecentlyAddedTx;
+    std::map<uint256, std::shared_ptr<const CTransaction>> mapRecentlyAddedTx;
     uint64_t nRecentlyAddedSequence = 0;
     uint64_t nNotifiedSequence = 0;
-
-    std::map<uint256, const CTransaction*> mapSproutNullifiers;
-    std::map<uint256, const CTransaction*> mapSaplingNullifiers;
-    std::map<uint256, const CTransaction*> mapOrchardNullifiers;
+    //! Counts the transactions added to and removed from the mempool, to
+    //! order the TransactionAddedToMempool and TransactionRemovedFromMempool
+    //! notifications. It has its own lock so that it can be waited on.
+    mutable Mutex cs_sequence;
+    mutable std::condition_variable condSequence;
+    uint64_t nMempoolSequence GUARDED_BY(cs_sequence) = 0;
+
+    uint64_t NextSequence();
+
+    CTxMemPoolNullifierMap mapSproutNullifiers;
+    CTxMemPoolNullifierMap mapSaplingNullifiers;
+    CTxMemPoolNullifierMap mapOrchardNullifiers;
     RecentlyEvictedList* recentlyEvicted = new RecentlyEvictedList(DEFAULT_MEMPOOL_EVICTION_MEMORY_MINUTES * 60);
     WeightedTxTree* weightedTxTree = new WeightedTxTree(DEFAULT_MEMPOOL_TOTAL_COST_LIMIT);
 
@@ -231,7 +391,10 @@ public:
             boost::multi_index::ordered_unique<
                 boost::multi_index::identity<CTxMemPoolEntry>,
                 CompareTxMemPoolEntryByScore
-            >
+            >,
+            // sorted by expiry height (0, for no expiry, first), so that
+            // removeExpired only visits the transactions that expire
+            boost::multi_index::ordered_non_unique<mempoolentry_expiryheight>
         >
     > indexed_transaction_set;
 
@@ -277,15 +440,41 @@ public:
 
 private:
     // insightexplorer
-    std::map<CMempoolAddressDeltaKey, CMempoolAddressDelta, CMempoolAddressDeltaKeyCompare> mapAddress;
-    std::map<uint256, std::vector<CMempoolAddressDeltaKey> > mapAddressInserted;
-    std::map<CSpentIndexKey, CSpentIndexValue, CSpentIndexKeyCompare> mapSpent;
-    std::map<uint256, std::vector<CSpentIndexKey>> mapSpentInserted;
+    // mapAddress holds the deltas of each address in a map of its own, so
+    // that reading or updating the deltas of an address touches only those.
+    boost::unordered_map<std::pair<uint160, int>, CMempoolAddressDeltas, SaltedAddressHasher> mapAddress;
+    //! The number of deltas in mapAddress, for DynamicMemoryUsage().
+    size_t nAddressDeltas = 0;
+    boost::unordered_map<uint256, std::vector<CMempoolAddressDeltaKey>, SaltedTxidHasher> mapAddressInserted;
+    CTxMemPoolSpentMap mapSpent;
+    boost::unordered_map<uint256, std::vector<CSpentIndexKey>, SaltedTxidHasher> mapSpentInserted;
 
     std::vector<indexed_transaction_set::const_iterator> GetSortedDepthAndScore() const;
 
+    struct CompareIteratorByHash {
+        bool operator()(const txiter& a, const txiter& b) const {
+            return a->GetTx().GetHash() < b->GetTx().GetHash();
+        }
+    };
+    typedef std::set<txiter, CompareIteratorByHash> setEntries;
+
+    //! The in-mempool ancestors or descendants of it, not including it.
+    void CalculateAncestors(txiter it, setEntries& setAncestors) const;
+    void CalculateDescendants(txiter it, setEntries& setDescendants) const;
+    //! Account for it, newly added, in the package state of its ancestors
+    //! and descendants, and set its own.
+    void UpdatePackageStateForAdd(txiter it);
+    //! Take the entries of setRemove out of the package state of the
+    //! ancestors and descendants that remain.
+    void UpdatePackageStateForRemove(const setEntries& setRemove);
+    //! Recompute the package state of it from scratch.
+    void RecalculatePackageState(txiter it);
+    void CalculatePackageState(txiter it, setEntries& setAncestors, setEntries& setDescendants,
+                               uint64_t& nSizeWithAncestors, CAmount& nModFeesWithAncestors,
+                               uint64_t& nSizeWithDescendants, CAmount& nModFeesWithDescendants) const;
+
 public:
-    std::map<COutPoint, CInPoint> mapNextTx;
+    CTxMemPoolNextTxMap mapNextTx;
     std::map<uint256, std::pair<double, CAmount> > mapDeltas;
 
     /** Create a new CTxMemPool.
@@ -311,6 +500,8 @@ public:
     void addAddressIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
     void getAddressIndex(const std::vector<std::pair<uint160, int>>& addresses,
                          std::vector<std::pair<CMempoolAddressDeltaKey, CMempoolAddressDelta>>& results);
+    //! The sum of the mempool deltas of the addresses.
+    CAmount getAddressBalanceDelta(const std::vector<std::pair<uint160, int>>& addresses);
     void removeAddressIndex(const uint256& txhash);
 
     void addSpentIndex(const CTxMemPoolEntry &entry, const CCoinsViewCache &view);
@@ -330,9 +521,18 @@ public:
     void _clear(); // unlocked
     bool CompareDepthAndScore(const uint256& hasha, const uint256& hashb);
     void queryHashes(std::vector<uint256>& vtxid);
-    void pruneSpent(const uint256& hash, CCoins &coins);
+    bool isSpent(const COutPoint& outpoint);
     unsigned int GetTransactionsUpdated() const;
     void AddTransactionsUpdated(unsigned int n);
+    //! The number of transactions added to and removed from the mempool.
+    uint64_t GetSequence() const;
+    /**
+     * Wait until GetSequence() is above nSequence, for up to the timeout if
+     * it is not zero, or until fInterrupted returns true after
+     * NotifySequenceWaiters() is called. Returns GetSequence().
+     */
+    uint64_t WaitForSequence(uint64_t nSequence, std::chrono::milliseconds timeout, const std::function<bool()>& fInterrupted) const;
+    void NotifySequenceWaiters() const;
     /**
      * Check that none of this transactions inputs are in the mempool, and thus
      * the tx is not dependent on other mempool transactions to be included in a block.
@@ -346,7 +546,11 @@ public:
 
     bool nullifierExists(const uint256& nullifier, ShieldedType type) const;
 
-    std::pair<std::vector<CTransaction>, uint64_t> DrainRecentlyAdded();
+    /**
+     * Returns the transactions added since the last call, shared with their
+     * mempool entries rather than copied, and the sequence number of the last.
+     */
+    std::pair<std::vector<std::shared_ptr<const CTransaction>>, uint64_t> DrainRecentlyAdded();
     void SetNotifiedSequence(uint64_t recentlyAddedSequence);
     bool IsFullyNotified();
 
@@ -368,13 +572,36 @@ public:
         return (mapTx.count(hash) != 0);
     }
 
+    bool exists(const COutPoint& outpoint) const
+    {
+        LOCK(cs);
+        auto it = mapTx.find(outpoint.hash);
+        return (it != mapTx.end() && outpoint.n < it->GetTx().vout.size());
+    }
+
     std::shared_ptr<const CTransaction> get(const uint256& hash) const;
+    /**
+     * The signature hash data of the transaction with the given wtxid, if it
+     * is in the mempool and was validated under the given consensus branch
+     * ID. Returns null otherwise.
+     */
+    std::shared_ptr<const PrecomputedTransactionData> GetTxData(const WTxId& wtxid, uint32_t nBranchId) const;
     TxMempoolInfo info(const uint256& hash) const;
     std::vector<TxMempoolInfo> infoAll() const;
 
+    /**
+     * Return a snapshot of the current mempool state. It is shared between
+     * callers until the mempool changes, and is only rebuilt (which takes
+     * cs) if it has.
+     */
+    std::shared_ptr<const CTxMemPoolSnapshot> GetSnapshot() const;
+
     /** Estimate fee rate needed to get into the next nBlocks */
     CFeeRate estimateFee(int nBlocks) const;
 
+    /** Estimate fee rate needed for a transaction of the given type to get into the next nBlocks */
+    CFeeRate estimateFee(int nBlocks, FeeEstimateType type) const;
+
     /** Estimate priority needed to get into the next nBlocks */
     double estimatePriority(int nBlocks) const;
 
@@ -408,8 +635,9 @@ protected:
 public:
     CCoinsViewMemPool(CCoinsView *baseIn, CTxMemPool &mempoolIn);
     bool GetNullifier(const uint256 &txid, ShieldedType type) const;
-    bool GetCoins(const uint256 &txid, CCoins &coins) const;
-    bool HaveCoins(const uint256 &txid) const;
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const;
+    std::vector<std::optional<Coin>> GetCoins(const std::vector<COutPoint> &outpoints) const;
+    bool HaveCoin(const COutPoint &outpoint) const;
 };
 
 // We want to sort transactions by coin age priority
@@ -0,0 +1,305 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "txreconciliation.h"
+
+#include "hash.h"
+#include "random.h"
+#include "util/time.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <limits>
+
+bool fTxReconciliation = DEFAULT_TXRECONCILIATION_ENABLE;
+TxReconciliationTracker txReconciliation;
+
+/** The 32-bit finalizer of MurmurHash3, to spread the short IDs over the cells. */
+static uint32_t Mix32(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t CheckHash(uint32_t id)
+{
+    return Mix32(id ^ 0x5bd1e995);
+}
+
+CTxSketch::CTxSketch(size_t nCells) : vCells(nCells)
+{
+    assert(nCells % 3 == 0);
+}
+
+size_t CTxSketch::CellsForCapacity(size_t nCapacity)
+{
+    // Two cells per ID make the difference recoverable about 99% of the
+    // time; small tables need more, as two IDs that share all their cells
+    // cannot be recovered.
+    size_t nCells = 2 * nCapacity + 30;
+    return nCells + (3 - nCells % 3) % 3;
+}
+
+size_t CTxSketch::CellIndex(uint32_t id, int i) const
+{
+    static const uint32_t seeds[3] = {0x9e3779b9, 0x7f4a7c15, 0xf39cc060};
+    size_t nPartition = vCells.size() / 3;
+    return i * nPartition + Mix32(id ^ seeds[i]) % nPartition;
+}
+
+void CTxSketch::Toggle(uint32_t id, int32_t nCount)
+{
+    uint32_t nHash = CheckHash(id);
+    for (int i = 0; i < 3; i++) {
+        Cell& cell = vCells[CellIndex(id, i)];
+        cell.nCount += nCount;
+        cell.nIdSum ^= id;
+        cell.nHashSum ^= nHash;
+    }
+}
+
+void CTxSketch::Add(uint32_t id)
+{
+    if (!vCells.empty())
+        Toggle(id, 1);
+}
+
+bool CTxSketch::Subtract(const CTxSketch& other)
+{
+    if (other.vCells.size() != vCells.size())
+        return false;
+    for (size_t i = 0; i < vCells.size(); i++) {
+        vCells[i].nCount -= other.vCells[i].nCount;
+        vCells[i].nIdSum ^= other.vCells[i].nIdSum;
+        vCells[i].nHashSum ^= other.vCells[i].nHashSum;
+    }
+    return true;
+}
+
+bool CTxSketch::Decode(std::vector<uint32_t>& vOnlyHere, std::vector<uint32_t>& vOnlyThere) const
+{
+    CTxSketch remaining(*this);
+    std::vector<size_t> vPure;
+    for (size_t i = 0; i < remaining.vCells.size(); i++)
+        vPure.push_back(i);
+
+    // Take the ID out of each cell that holds just one, which may leave
+    // other cells holding just one.
+    while (!vPure.empty()) {
+        size_t nIndex = vPure.back();
+        vPure.pop_back();
+        const Cell& cell = remaining.vCells[nIndex];
+        if ((cell.nCount != 1 && cell.nCount != -1) || CheckHash(cell.nIdSum) != cell.nHashSum)
+            continue;
+        uint32_t id = cell.nIdSum;
+        int32_t nCount = cell.nCount;
+        if (nCount == 1) {
+            vOnlyHere.push_back(id);
+        } else {
+            vOnlyThere.push_back(id);
+        }
+        remaining.Toggle(id, -nCount);
+        for (int i = 0; i < 3; i++)
+            vPure.push_back(remaining.CellIndex(id, i));
+    }
+
+    for (const Cell& cell : remaining.vCells) {
+        if (!cell.IsEmpty())
+            return false;
+    }
+    return true;
+}
+
+uint32_t TxReconciliationTracker::PeerState::ShortId(const WTxId& wtxid) const
+{
+    return CSipHasher(k0, k1)
+        .Write(wtxid.hash.begin(), wtxid.hash.size())
+        .Write(wtxid.authDigest.begin(), wtxid.authDigest.size())
+        .Finalize() & 0xffffffff;
+}
+
+uint64_t TxReconciliationTracker::PreRegisterPeer(NodeId nodeid)
+{
+    LOCK(cs);
+    uint64_t nSalt = GetRand(std::numeric_limits<uint64_t>::max());
+    mapPreRegistered[nodeid] = nSalt;
+    return nSalt;
+}
+
+TxReconciliationTracker::RegisterResult TxReconciliationTracker::RegisterPeer(NodeId nodeid, bool fInbound, uint32_t nPeerVersion, uint64_t nRemoteSalt)
+{
+    LOCK(cs);
+    if (mapPeers.count(nodeid))
+        return RECON_ALREADY_REGISTERED;
+    std::map<NodeId, uint64_t>::iterator it = mapPreRegistered.find(nodeid);
+    if (it == mapPreRegistered.end())
+        return RECON_NOT_FOUND;
+    uint64_t nLocalSalt = it->second;
+    mapPreRegistered.erase(it);
+    // Versions above ours are compatible with ours.
+    if (nPeerVersion < 1)
+        return RECON_PROTOCOL_VIOLATION;
+
+    PeerState state;
+    state.fWeInitiate = !fInbound;
+    state.fFlood = !fInbound && nOutboundFlood < MAX_OUTBOUND_FLOOD_TO;
+    nOutboundFlood += state.fFlood;
+    uint256 hashSalt = (CHashWriter(SER_GETHASH, 0) << std::min(nLocalSalt, nRemoteSalt) << std::max(nLocalSalt, nRemoteSalt)).GetHash();
+    state.k0 = hashSalt.GetUint64(0);
+    state.k1 = hashSalt.GetUint64(1);
+    state.fSnapshot = false;
+    state.fAwaitingSketch = false;
+    state.nNextRequest = PoissonNextSend(GetTimeMicros(), RECON_REQUEST_INTERVAL);
+    mapPeers.emplace(nodeid, std::move(state));
+    return RECON_SUCCESS;
+}
+
+void TxReconciliationTracker::FinishHandshake(NodeId nodeid)
+{
+    LOCK(cs);
+    mapPreRegistered.erase(nodeid);
+}
+
+void TxReconciliationTracker::ForgetPeer(NodeId nodeid)
+{
+    LOCK(cs);
+    mapPreRegistered.erase(nodeid);
+    std::map<NodeId, PeerState>::iterator it = mapPeers.find(nodeid);
+    if (it != mapPeers.end()) {
+        nOutboundFlood -= it->second.fFlood;
+        mapPeers.erase(it);
+    }
+}
+
+bool TxReconciliationTracker::IsPeerRegistered(NodeId nodeid) const
+{
+    LOCK(cs);
+    return mapPeers.count(nodeid) != 0;
+}
+
+bool TxReconciliationTracker::AddToSet(NodeId nodeid, const WTxId& wtxid)
+{
+    LOCK(cs);
+    std::map<NodeId, PeerState>::iterator it = mapPeers.find(nodeid);
+    if (it == mapPeers.end() || it->second.fFlood)
+        return false;
+    PeerState& state = it->second;
+    if (state.mapSet.size() >= MAX_RECON_SET_SIZE)
+        return false;
+    state.mapSet.emplace(state.ShortId(wtxid), wtxid);
+    return true;
+}
+
+bool TxReconciliationTracker::ShouldRequest(NodeId nodeid, int64_t nNow, uint32_t& nSetSize)
+{
+    LOCK(cs);
+    std::map<NodeId, PeerState>::iterator it = mapPeers.find(nodeid);
+    if (it == mapPeers.end() || !it->second.fWeInitiate)
+        return false;
+    PeerState& state = it->second;
+    // A request the peer did not reply to by the next one is given up on.
+    if (state.nNextRequest > nNow)
+        return false;
+    state.nNextRequest = PoissonNextSend(nNow, RECON_REQUEST_INTERVAL);
+    state.fAwaitingSketch = true;
+    nSetSize = state.mapSet.size();
+    return true;
+}
+
+bool TxReconciliationTracker::RespondToRequest(NodeId nodeid, uint32_t nRemoteSetSize, CTxSketch& sketch)
+{
+    LOCK(cs);
+    std::map<NodeId, PeerState>::iterator it = mapPeers.find(nodeid);
+    if (it == mapPeers.end() || it->second.fWeInitiate)
+        return false;
+    PeerState& state = it->second;
+
+    // The previous reconciliation was not finished; reconcile its
+    // transactions again.
+    if (state.fSnapshot) {
+        state.mapSet.insert(state.mapSnapshot.begin(), state.mapSnapshot.end());
+    }
+    state.mapSnapshot.clear();
+    state.mapSnapshot.swap(state.mapSet);
+    state.fSnapshot = true;
+
+    // Expect the sets to differ by their difference in size, and by a
+    // quarter of the smaller set.
+    size_t nLocalSetSize = state.mapSnapshot.size();
+    size_t nCapacity = std::max<size_t>(nLocalSetSize, nRemoteSetSize) - std::min<size_t>(nLocalSetSize, nRemoteSetSize) +
+        std::min<size_t>(nLocalSetSize, nRemoteSetSize) / 4 + 1;
+    size_t nCells = CTxSketch::CellsForCapacity(nCapacity);
+    if (nCells > MAX_SKETCH_CELLS) {
+        // An empty sketch makes the peer fall back to announcing its set.
+        sketch = CTxSketch();
+        return true;
+    }
+    sketch = CTxSketch(nCells);
+    for (const auto& entry : state.mapSnapshot)
+        sketch.Add(entry.first);
+    return true;
+}
+
+bool TxReconciliationTracker::HandleSketch(NodeId nodeid, const CTxSketch& sketch, bool& fSuccess, std::vector<WTxId>& vAnnounce, std::vector<uint32_t>& vRequest)
+{
+    LOCK(cs);
+    std::map<NodeId, PeerState>::iterator it = mapPeers.find(nodeid);
+    if (it == mapPeers.end() || !it->second.fAwaitingSketch)
+        return false;
+    PeerState& state = it->second;
+    state.fAwaitingSketch = false;
+
+    fSuccess = false;
+    std::vector<uint32_t> vOnlyLocal;
+    if (sketch.size() > 0) {
+        CTxSketch diff(sketch);
+        CTxSketch local(sketch.size());
+        for (const auto& entry : state.mapSet)
+            local.Add(entry.first);
+        diff.Subtract(local);
+        fSuccess = diff.Decode(vRequest, vOnlyLocal);
+    }
+
+    if (fSuccess) {
+        for (uint32_t id : vOnlyLocal) {
+            std::map<uint32_t, WTxId>::iterator itTx = state.mapSet.find(id);
+            if (itTx != state.mapSet.end())
+                vAnnounce.push_back(itTx->second);
+        }
+    } else {
+        // Fall back to announcing everything.
+        vRequest.clear();
+        for (const auto& entry : state.mapSet)
+            vAnnounce.push_back(entry.second);
+    }
+    state.mapSet.clear();
+    return true;
+}
+
+bool TxReconciliationTracker::HandleReconcilDiff(NodeId nodeid, bool fSuccess, const std::vector<uint32_t>& vRequested, std::vector<WTxId>& vAnnounce)
+{
+    LOCK(cs);
+    std::map<NodeId, PeerState>::iterator it = mapPeers.find(nodeid);
+    if (it == mapPeers.end() || !it->second.fSnapshot)
+        return false;
+    PeerState& state = it->second;
+
+    if (fSuccess) {
+        for (uint32_t id : vRequested) {
+            std::map<uint32_t, WTxId>::iterator itTx = state.mapSnapshot.find(id);
+            if (itTx != state.mapSnapshot.end())
+                vAnnounce.push_back(itTx->second);
+        }
+    } else {
+        for (const auto& entry : state.mapSnapshot)
+            vAnnounce.push_back(entry.second);
+    }
+    state.mapSnapshot.clear();
+    state.fSnapshot = false;
+    return true;
+}
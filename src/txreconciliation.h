@@ -0,0 +1,174 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_TXRECONCILIATION_H
+#define ZCASH_TXRECONCILIATION_H
+
+#include "net.h"
+#include "primitives/transaction.h"
+#include "serialize.h"
+#include "sync.h"
+
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+/** Default for -txreconciliation. */
+static const bool DEFAULT_TXRECONCILIATION_ENABLE = false;
+/** Whether we offer to announce transactions by set reconciliation (-txreconciliation). */
+extern bool fTxReconciliation;
+
+/** The version of the reconciliation protocol announced in sendtxrcncl messages. */
+static const uint32_t TXRECONCILIATION_VERSION = 1;
+/** Number of outbound reconciling peers we still flood transactions to. */
+static const int MAX_OUTBOUND_FLOOD_TO = 4;
+/** Average delay in seconds between the reconciliations we ask a peer for. */
+static const int RECON_REQUEST_INTERVAL = 8;
+/** Number of transactions waiting to be reconciled with a peer above which they are flooded instead. */
+static const size_t MAX_RECON_SET_SIZE = 3000;
+/** Largest sketch we send or accept, in cells. */
+static const size_t MAX_SKETCH_CELLS = 3 * 3000;
+
+/**
+ * A sketch of a set of short transaction IDs, from which the difference
+ * between two sets can be recovered with about as much data as the
+ * difference is large, rather than the sets.
+ *
+ * This is an invertible Bloom lookup table: each ID is added to one cell in
+ * each third of the table. Subtracting the sketch of another set leaves only
+ * the IDs in one of the sets, and those are recovered by repeatedly taking
+ * the ID out of a cell that holds just one, which succeeds with high
+ * probability as long as the table has about two cells per ID left.
+ */
+class CTxSketch
+{
+public:
+    struct Cell {
+        int32_t nCount;
+        uint32_t nIdSum;
+        uint32_t nHashSum;
+
+        Cell() : nCount(0), nIdSum(0), nHashSum(0) {}
+        bool IsEmpty() const { return nCount == 0 && nIdSum == 0 && nHashSum == 0; }
+
+        ADD_SERIALIZE_METHODS;
+
+        template <typename Stream, typename Operation>
+        inline void SerializationOp(Stream& s, Operation ser_action) {
+            READWRITE(nCount);
+            READWRITE(nIdSum);
+            READWRITE(nHashSum);
+        }
+    };
+
+    explicit CTxSketch(size_t nCells = 0);
+
+    //! The number of cells to recover a difference of up to nCapacity IDs.
+    static size_t CellsForCapacity(size_t nCapacity);
+
+    size_t size() const { return vCells.size(); }
+    void Add(uint32_t id);
+    //! Subtract a sketch of the same size, leaving a sketch of the difference.
+    bool Subtract(const CTxSketch& other);
+    //! Recover the difference: the IDs only added to this sketch, and those
+    //! only in the subtracted one. Returns false if it could not be recovered.
+    bool Decode(std::vector<uint32_t>& vOnlyHere, std::vector<uint32_t>& vOnlyThere) const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action) {
+        READWRITE(vCells);
+        if (ser_action.ForRead() && (vCells.size() % 3 != 0 || vCells.size() > MAX_SKETCH_CELLS))
+            throw std::ios_base::failure("Invalid sketch size");
+    }
+
+private:
+    std::vector<Cell> vCells;
+
+    size_t CellIndex(uint32_t id, int i) const;
+    void Toggle(uint32_t id, int32_t nCount);
+};
+
+/**
+ * Announces transactions to peers by periodically reconciling, with each
+ * peer, the set of transactions we would have announced to it with the set
+ * it would have announced to us. Only the difference is then announced with
+ * inv messages, instead of each transaction being announced on every link.
+ *
+ * Peers offer reconciliation with a sendtxrcncl message (version and salt)
+ * between version and verack. The peer that made the connection asks for
+ * reconciliations (reqrecon, with its set size); the other replies with a
+ * sketch of its set, and is told which transactions to announce in a
+ * reconcildiff. If the difference cannot be recovered, both sides announce
+ * their whole sets.
+ *
+ * A few outbound peers still get every transaction by flooding, to keep
+ * transactions propagating quickly.
+ */
+class TxReconciliationTracker
+{
+public:
+    enum RegisterResult {
+        RECON_NOT_FOUND,
+        RECON_SUCCESS,
+        RECON_ALREADY_REGISTERED,
+        RECON_PROTOCOL_VIOLATION,
+    };
+
+    TxReconciliationTracker() : nOutboundFlood(0) {}
+
+    //! Start the handshake with a peer; returns the salt to send it.
+    uint64_t PreRegisterPeer(NodeId nodeid);
+    //! Complete the handshake when the peer's sendtxrcncl arrives.
+    RegisterResult RegisterPeer(NodeId nodeid, bool fInbound, uint32_t nPeerVersion, uint64_t nRemoteSalt);
+    //! The handshake is over once the peer's verack arrives; forget a peer
+    //! that did not offer reconciliation.
+    void FinishHandshake(NodeId nodeid);
+    void ForgetPeer(NodeId nodeid);
+    bool IsPeerRegistered(NodeId nodeid) const;
+
+    //! Queue a transaction to be reconciled with a peer. Returns false if it
+    //! should be announced to the peer directly instead.
+    bool AddToSet(NodeId nodeid, const WTxId& wtxid);
+
+    //! Whether it is time to ask a peer for a reconciliation, and if so the
+    //! size of our set to send along.
+    bool ShouldRequest(NodeId nodeid, int64_t nNow, uint32_t& nSetSize);
+    //! Build the sketch to reply to a peer's reqrecon with. Our set is kept
+    //! aside until the peer tells us what to announce.
+    bool RespondToRequest(NodeId nodeid, uint32_t nRemoteSetSize, CTxSketch& sketch);
+    //! Reconcile our set with the sketch a peer replied with. Sets whether the
+    //! difference could be recovered, the transactions to announce to the
+    //! peer and the short IDs to ask it for; returns false if we did not ask
+    //! for the sketch.
+    bool HandleSketch(NodeId nodeid, const CTxSketch& sketch, bool& fSuccess, std::vector<WTxId>& vAnnounce, std::vector<uint32_t>& vRequest);
+    //! Handle the peer's reconcildiff: the transactions to announce to it.
+    bool HandleReconcilDiff(NodeId nodeid, bool fSuccess, const std::vector<uint32_t>& vRequested, std::vector<WTxId>& vAnnounce);
+
+private:
+    struct PeerState {
+        bool fWeInitiate;
+        bool fFlood;
+        uint64_t k0, k1;
+        //! Transactions to reconcile, by short ID.
+        std::map<uint32_t, WTxId> mapSet;
+        //! The set our last sketch was built from, until the reconcildiff.
+        std::map<uint32_t, WTxId> mapSnapshot;
+        bool fSnapshot;
+        bool fAwaitingSketch;
+        int64_t nNextRequest;
+
+        uint32_t ShortId(const WTxId& wtxid) const;
+    };
+
+    mutable CCriticalSection cs;
+    std::map<NodeId, uint64_t> mapPreRegistered;
+    std::map<NodeId, PeerState> mapPeers;
+    int nOutboundFlood;
+};
+
+extern TxReconciliationTracker txReconciliation;
+
+#endif // ZCASH_TXRECONCILIATION_H
@@ -12,12 +12,49 @@
 
 const UniValue NullUniValue;
 
+UniValue::UniValue(const UniValue& other) :
+    typ(other.typ), val(other.val), keys(other.keys), values(other.values)
+{
+    if (other.keyIndex)
+        keyIndex.reset(new std::unordered_map<std::string, size_t>(*other.keyIndex));
+}
+
+UniValue& UniValue::operator=(const UniValue& other)
+{
+    if (this != &other) {
+        UniValue copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
 void UniValue::clear()
 {
     typ = VNULL;
     val.clear();
     keys.clear();
     values.clear();
+    keyIndex.reset();
+}
+
+void UniValue::reserve(size_t n)
+{
+    if (typ == VOBJ)
+        keys.reserve(n);
+    if (typ == VOBJ || typ == VARR)
+        values.reserve(n);
+}
+
+void UniValue::indexKeys()
+{
+    if (typ != VOBJ || keyIndex)
+        return;
+
+    keyIndex.reset(new std::unordered_map<std::string, size_t>());
+    keyIndex->reserve(keys.size());
+    // The first of duplicate keys is the one that is found, as without an index.
+    for (size_t i = 0; i < keys.size(); i++)
+        keyIndex->emplace(keys[i], i);
 }
 
 bool UniValue::setNull()
@@ -114,6 +151,15 @@ bool UniValue::push_back(const UniValue& val_)
     return true;
 }
 
+bool UniValue::push_back(UniValue&& val_)
+{
+    if (typ != VARR)
+        return false;
+
+    values.push_back(std::move(val_));
+    return true;
+}
+
 bool UniValue::push_backV(const std::vector<UniValue>& vec)
 {
     if (typ != VARR)
@@ -126,20 +172,32 @@ bool UniValue::push_backV(const std::vector<UniValue>& vec)
 
 void UniValue::_pushKV(const std::string& key, const UniValue& val_)
 {
+    _pushKV(key, UniValue(val_));
+}
+
+void UniValue::_pushKV(const std::string& key, UniValue&& val_)
+{
+    if (keyIndex)
+        keyIndex->emplace(key, keys.size());
     keys.push_back(key);
-    values.push_back(val_);
+    values.push_back(std::move(val_));
 }
 
 bool UniValue::pushKV(const std::string& key, const UniValue& val_)
+{
+    return pushKV(key, UniValue(val_));
+}
+
+bool UniValue::pushKV(const std::string& key, UniValue&& val_)
 {
     if (typ != VOBJ)
         return false;
 
     size_t idx;
     if (findKey(key, idx))
-        values[idx] = val_;
+        values[idx] = std::move(val_);
     else
-        _pushKV(key, val_);
+        _pushKV(key, std::move(val_));
     return true;
 }
 
@@ -166,6 +224,14 @@ void UniValue::getObjMap(std::map<std::string,UniValue>& kv) const
 
 bool UniValue::findKey(const std::string& key, size_t& retIdx) const
 {
+    if (keyIndex) {
+        auto it = keyIndex->find(key);
+        if (it == keyIndex->end())
+            return false;
+        retIdx = it->second;
+        return true;
+    }
+
     for (size_t i = 0; i < keys.size(); i++) {
         if (keys[i] == key) {
             retIdx = i;
@@ -233,9 +299,9 @@ const char *uvTypeName(UniValue::VType t)
 
 const UniValue& find_value(const UniValue& obj, const std::string& name)
 {
-    for (unsigned int i = 0; i < obj.keys.size(); i++)
-        if (obj.keys[i] == name)
-            return obj.values.at(i);
+    size_t index = 0;
+    if (obj.findKey(name, index))
+        return obj.values.at(index);
 
     return NullUniValue;
 }
@@ -360,6 +360,38 @@ BOOST_AUTO_TEST_CASE(univalue_object)
 
 }
 
+BOOST_AUTO_TEST_CASE(univalue_indexed_object)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.reserve(3);
+    obj.pushKV("first", 1);
+    obj.indexKeys();
+    obj.pushKV("second", 2);
+    UniValue third(UniValue::VARR);
+    third.push_back("x");
+    obj.pushKV("third", std::move(third));
+    BOOST_CHECK_EQUAL(obj.size(), 3);
+    BOOST_CHECK_EQUAL(obj["first"].getValStr(), "1");
+    BOOST_CHECK_EQUAL(obj["second"].getValStr(), "2");
+    BOOST_CHECK_EQUAL(find_value(obj, "third")[0].getValStr(), "x");
+    BOOST_CHECK(!obj.exists("fourth"));
+
+    // Replacing a member keeps its position.
+    obj.pushKV("first", "one");
+    BOOST_CHECK_EQUAL(obj.size(), 3);
+    BOOST_CHECK_EQUAL(obj[0].getValStr(), "one");
+
+    // A copy has its own index.
+    UniValue copy(obj);
+    copy.pushKV("fourth", 4);
+    BOOST_CHECK(copy.exists("fourth"));
+    BOOST_CHECK(!obj.exists("fourth"));
+    BOOST_CHECK_EQUAL(copy.write(), "{\"first\":\"one\",\"second\":2,\"third\":[\"x\"],\"fourth\":4}");
+
+    obj.clear();
+    BOOST_CHECK(!obj.exists("first"));
+}
+
 static const char *json1 =
 "[1.10000000,{\"key1\":\"str\\u0000\",\"key2\":800,\"key3\":{\"name\":\"martian http://test.com\"}}]";
 
@@ -0,0 +1,49 @@
+// Copyright (c) 2022 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "util/mappedfile.h"
+
+#include "logging.h"
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+std::unique_ptr<CMappedFile> CMappedFile::Open(const fs::path& path)
+{
+#ifndef WIN32
+    int fd = ::open(path.string().c_str(), O_RDONLY);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        ::close(fd);
+        return nullptr;
+    }
+
+    void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    // The mapping keeps the file open.
+    ::close(fd);
+    if (addr == MAP_FAILED) {
+        LogPrintf("%s: unable to map %s\n", __func__, path.string());
+        return nullptr;
+    }
+
+    return std::unique_ptr<CMappedFile>(new CMappedFile(static_cast<const char*>(addr), st.st_size));
+#else
+    return nullptr;
+#endif
+}
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap(const_cast<char*>(data), size);
+#endif
+}
@@ -0,0 +1,45 @@
+// Copyright (c) 2022 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_UTIL_MAPPEDFILE_H
+#define ZCASH_UTIL_MAPPEDFILE_H
+
+#include "fs.h"
+
+#include <memory>
+#include <stddef.h>
+
+/**
+ * A read-only memory mapping of an entire file.
+ *
+ * The file must not be truncated while it is mapped, as reading a mapped page
+ * past the end of the file raises SIGBUS.
+ */
+class CMappedFile
+{
+private:
+    const char* data;
+    size_t size;
+
+    CMappedFile(const char* dataIn, size_t sizeIn) : data(dataIn), size(sizeIn) {}
+
+public:
+    ~CMappedFile();
+
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+
+    /**
+     * Maps the file at the given path into memory. Returns nullptr if the file
+     * cannot be opened or mapped, if it is empty, or if this platform does not
+     * support memory-mapped files.
+     */
+    static std::unique_ptr<CMappedFile> Open(const fs::path& path);
+
+    const char* begin() const { return data; }
+    const char* end() const { return data + size; }
+    size_t Size() const { return size; }
+};
+
+#endif // ZCASH_UTIL_MAPPEDFILE_H
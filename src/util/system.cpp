@@ -43,6 +43,11 @@
 #include <sys/resource.h>
 #include <sys/stat.h>
 
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 #else
 
 #ifdef _MSC_VER
@@ -65,8 +70,10 @@
 #endif
 
 #include <boost/algorithm/string/case_conv.hpp> // for to_lower()
+#include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string/predicate.hpp> // for startswith() and endswith()
+#include <boost/algorithm/string/split.hpp>
 #include <boost/program_options/detail/config_file.hpp>
 #include <boost/program_options/parsers.hpp>
 #include <boost/thread.hpp>
@@ -657,6 +664,88 @@ void SetThreadPriority(int nPriority)
 #endif // WIN32
 }
 
+const std::vector<std::string> THREAD_AFFINITY_CLASSES = {"scriptcheck", "proving", "msghand", "http"};
+
+static std::map<std::string, std::vector<int>> mapThreadAffinity;
+
+/** The highest CPU number that -threadaffinity accepts. */
+static const int MAX_AFFINITY_CPU = 1023;
+
+bool ParseThreadAffinity(const std::vector<std::string>& vArgs, std::string& strError)
+{
+    std::map<std::string, std::vector<int>> mapParsed;
+    for (const std::string& strArg : vArgs) {
+        size_t nPos = strArg.find(':');
+        std::string strClass = strArg.substr(0, nPos);
+        if (std::find(THREAD_AFFINITY_CLASSES.begin(), THREAD_AFFINITY_CLASSES.end(), strClass) == THREAD_AFFINITY_CLASSES.end()) {
+            strError = strprintf("Unknown thread class '%s' in -threadaffinity (expected one of %s)",
+                strClass, boost::algorithm::join(THREAD_AFFINITY_CLASSES, ", "));
+            return false;
+        }
+        if (nPos == std::string::npos) {
+            strError = strprintf("No CPUs given for thread class '%s' in -threadaffinity", strClass);
+            return false;
+        }
+        // Later arguments for the same class add to the earlier ones.
+        std::vector<int>& vCPUs = mapParsed[strClass];
+        std::string strCPUs = strArg.substr(nPos + 1);
+        std::vector<std::string> vRanges;
+        boost::split(vRanges, strCPUs, boost::is_any_of(","));
+        for (const std::string& strRange : vRanges) {
+            size_t nDash = strRange.find('-');
+            int nFirst, nLast;
+            if (!ParseInt32(strRange.substr(0, nDash), &nFirst) ||
+                !ParseInt32(nDash == std::string::npos ? strRange : strRange.substr(nDash + 1), &nLast) ||
+                nFirst < 0 || nLast < nFirst || nLast > MAX_AFFINITY_CPU) {
+                strError = strprintf("Invalid CPUs '%s' for thread class '%s' in -threadaffinity", strRange, strClass);
+                return false;
+            }
+            for (int nCPU = nFirst; nCPU <= nLast; nCPU++) {
+                vCPUs.push_back(nCPU);
+            }
+        }
+        std::sort(vCPUs.begin(), vCPUs.end());
+        vCPUs.erase(std::unique(vCPUs.begin(), vCPUs.end()), vCPUs.end());
+    }
+    mapThreadAffinity.swap(mapParsed);
+    return true;
+}
+
+std::vector<int> GetThreadAffinity(const std::string& strClass)
+{
+    auto it = mapThreadAffinity.find(strClass);
+    if (it != mapThreadAffinity.end()) {
+        return it->second;
+    }
+    return std::vector<int>();
+}
+
+bool ApplyThreadAffinity(const std::string& strClass)
+{
+    std::vector<int> vCPUs = GetThreadAffinity(strClass);
+    if (vCPUs.empty()) {
+        return true;
+    }
+#if defined(__linux__)
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (int nCPU : vCPUs) {
+        if (nCPU < CPU_SETSIZE) {
+            CPU_SET(nCPU, &cpuset);
+        }
+    }
+    int nErr = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (nErr != 0) {
+        LogPrintf("Failed to bind %s thread to its CPUs: %s\n", strClass, strerror(nErr));
+        return false;
+    }
+    return true;
+#else
+    LogPrintf("Binding threads to CPUs is not supported on this platform; ignoring -threadaffinity for %s threads\n", strClass);
+    return false;
+#endif
+}
+
 std::string PrivacyInfo()
 {
     return "\n" +
@@ -188,6 +188,28 @@ int GetNumCores();
 void SetThreadPriority(int nPriority);
 void RenameThread(const char* name);
 
+/** Classes of threads that can be bound to CPUs with -threadaffinity. */
+extern const std::vector<std::string> THREAD_AFFINITY_CLASSES;
+
+/**
+ * Parse -threadaffinity arguments of the form <class>:<cpus>, where <cpus> is
+ * a comma-separated list of CPU numbers and ranges such as 0-7,16-23, and make
+ * them the sets returned by GetThreadAffinity. Returns false and sets strError
+ * if an argument is invalid.
+ */
+bool ParseThreadAffinity(const std::vector<std::string>& vArgs, std::string& strError);
+
+/** The CPUs that threads of the named class are bound to; empty if they are not bound. */
+std::vector<int> GetThreadAffinity(const std::string& strClass);
+
+/**
+ * Bind the calling thread to the CPUs of the named class, if any. Memory the
+ * thread then allocates comes from the NUMA node of those CPUs under the
+ * default first-touch policy. Returns false if binding is not supported on
+ * this platform or fails.
+ */
+bool ApplyThreadAffinity(const std::string& strClass);
+
 /**
  * .. and a wrapper that just calls func once
  */
@@ -11,6 +11,7 @@
 #include "util/time.h"
 
 #include <chrono>
+#include <time.h>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/thread.hpp>
 
@@ -42,6 +43,16 @@ int64_t GetTimeMicros()
             std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
+int64_t GetThreadCPUMicros()
+{
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+        return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    return GetTimeMicros();
+}
+
 void MilliSleep(int64_t n)
 {
     // This is defined to be an interruption point.
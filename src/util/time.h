@@ -13,6 +13,9 @@
 int64_t GetTime();
 int64_t GetTimeMillis();
 int64_t GetTimeMicros();
+/** The CPU time used by the calling thread, in microseconds, where the
+ * platform can tell it; otherwise the wall-clock time. */
+int64_t GetThreadCPUMicros();
 void SetMockTime(int64_t nMockTimeIn);
 void MilliSleep(int64_t n);
 
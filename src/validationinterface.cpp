@@ -9,12 +9,18 @@
 #include "chainparams.h"
 #include "init.h"
 #include "main.h"
+#include "sync.h"
 #include "txmempool.h"
 #include "ui_interface.h"
+#include "util/system.h"
 
 #include <boost/thread.hpp>
 
 #include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <thread>
 
 using namespace boost::placeholders;
@@ -26,11 +32,168 @@ CMainSignals& GetMainSignals()
     return g_signals;
 }
 
+/**
+ * A listener that delivers the updates sent by ThreadNotifyWallets to another
+ * listener in order, on a thread of its own, and its other updates directly.
+ * Blocks are copied once for all the updates that refer to them.
+ */
+class CQueuedValidationInterface : public CValidationInterface
+{
+private:
+    CValidationInterface* pinner;
+    const std::string name;
+    const size_t nMaxQueued;
+
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    std::deque<std::function<void()>> queue;
+    //! Whether an update taken from the queue is being delivered.
+    bool fBusy = false;
+    bool fStop = false;
+    boost::thread thread;
+
+    //! The last block queued, only used by ThreadNotifyWallets.
+    std::shared_ptr<const CBlock> lastBlock;
+
+    std::shared_ptr<const CBlock> ShareBlock(const CBlock* pblock)
+    {
+        if (!pblock) {
+            return nullptr;
+        }
+        if (!lastBlock || lastBlock->GetHash() != pblock->GetHash()) {
+            lastBlock = std::make_shared<const CBlock>(*pblock);
+        }
+        return lastBlock;
+    }
+
+    void Enqueue(std::function<void()> update)
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (queue.size() >= nMaxQueued) {
+            cond.wait(lock);
+        }
+        queue.push_back(std::move(update));
+        cond.notify_all();
+    }
+
+    void Run()
+    {
+        RenameThread(strprintf("zc-notify-%s", name).c_str());
+        while (true) {
+            std::function<void()> update;
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                fBusy = false;
+                cond.notify_all();
+                while (queue.empty() && !fStop) {
+                    cond.wait(lock);
+                }
+                // Updates still queued when stopping are delivered first.
+                if (queue.empty()) {
+                    return;
+                }
+                update = std::move(queue.front());
+                queue.pop_front();
+                fBusy = true;
+                cond.notify_all();
+            }
+            try {
+                update();
+            } catch (const std::exception& e) {
+                PrintExceptionContinue(&e, "CQueuedValidationInterface::Run()");
+            } catch (...) {
+                PrintExceptionContinue(NULL, "CQueuedValidationInterface::Run()");
+            }
+        }
+    }
+
+public:
+    CQueuedValidationInterface(CValidationInterface* pinnerIn, const std::string& nameIn, size_t nMaxQueuedIn) :
+        pinner(pinnerIn), name(nameIn), nMaxQueued(std::max<size_t>(1, nMaxQueuedIn))
+    {
+        thread = boost::thread([this] { Run(); });
+    }
+
+    ~CQueuedValidationInterface()
+    {
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            fStop = true;
+            cond.notify_all();
+        }
+        thread.join();
+    }
+
+    /** Waits until every update queued so far has been delivered. */
+    void Sync()
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while (!queue.empty() || fBusy) {
+            cond.wait(lock);
+        }
+    }
+
+protected:
+    void SyncTransaction(const CTransaction &tx, const CBlock *pblock, const int nHeight) override {
+        auto block = ShareBlock(pblock);
+        Enqueue([this, tx, block, nHeight] { pinner->SyncTransaction(tx, block.get(), nHeight); });
+    }
+    void SyncTransactions(const std::vector<CTransaction> &vtx, const CBlock *pblock, const int nHeight) override {
+        auto block = ShareBlock(pblock);
+        if (block && &vtx == &pblock->vtx) {
+            Enqueue([this, block, nHeight] { pinner->SyncTransactions(block->vtx, block.get(), nHeight); });
+        } else {
+            Enqueue([this, vtx, block, nHeight] { pinner->SyncTransactions(vtx, block.get(), nHeight); });
+        }
+    }
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, std::optional<MerkleFrontiers> added) override {
+        auto block = ShareBlock(pblock);
+        Enqueue([this, pindex, block, added] { pinner->ChainTip(pindex, block.get(), added); });
+    }
+    void UpdatedTransaction(const uint256 &hash) override {
+        Enqueue([this, hash] { pinner->UpdatedTransaction(hash); });
+    }
+
+    void UpdatedBlockTip(const CBlockIndex *pindex, const CBlock *pblock) override {
+        pinner->UpdatedBlockTip(pindex, pblock);
+    }
+    void EraseFromWallet(const uint256 &hash) override {
+        pinner->EraseFromWallet(hash);
+    }
+    void TransactionAddedToMempool(const CTransaction &tx, uint64_t nMempoolSequence) override {
+        pinner->TransactionAddedToMempool(tx, nMempoolSequence);
+    }
+    void TransactionRemovedFromMempool(const CTransaction &tx, uint64_t nMempoolSequence) override {
+        pinner->TransactionRemovedFromMempool(tx, nMempoolSequence);
+    }
+    void Inventory(const uint256 &hash) override {
+        pinner->Inventory(hash);
+    }
+    void ResendWalletTransactions(int64_t nBestBlockTime) override {
+        pinner->ResendWalletTransactions(nBestBlockTime);
+    }
+    void BlockChecked(const CBlock& block, const CValidationState& state) override {
+        pinner->BlockChecked(block, state);
+    }
+    void GetAddressForMining(std::optional<MinerAddress>& minerAddress) override {
+        pinner->GetAddressForMining(minerAddress);
+    }
+    void ResetRequestCount(const uint256 &hash) override {
+        pinner->ResetRequestCount(hash);
+    }
+};
+
+static CCriticalSection cs_queuedInterfaces;
+static std::map<CValidationInterface*, std::unique_ptr<CQueuedValidationInterface>> mapQueuedInterfaces GUARDED_BY(cs_queuedInterfaces);
+
 void RegisterValidationInterface(CValidationInterface* pwalletIn) {
-    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
+    g_signals.UpdatedBlockTip.connect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2));
     g_signals.SyncTransaction.connect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
+    g_signals.SyncTransactions.connect(boost::bind(&CValidationInterface::SyncTransactions, pwalletIn, _1, _2, _3));
     g_signals.EraseTransaction.connect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
     g_signals.UpdatedTransaction.connect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
+    g_signals.TransactionAddedToMempool.connect(boost::bind(&CValidationInterface::TransactionAddedToMempool, pwalletIn, _1, _2));
+    g_signals.TransactionRemovedFromMempool.connect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pwalletIn, _1, _2));
     g_signals.ChainTip.connect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3));
     g_signals.Inventory.connect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
     g_signals.Broadcast.connect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
@@ -39,17 +202,36 @@ void RegisterValidationInterface(CValidationInterface* pwalletIn) {
     g_signals.BlockFound.connect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
 }
 
+void RegisterQueuedValidationInterface(CValidationInterface* pwalletIn, const std::string& name, size_t nMaxQueued) {
+    LOCK(cs_queuedInterfaces);
+    auto queued = std::make_unique<CQueuedValidationInterface>(pwalletIn, name, nMaxQueued);
+    RegisterValidationInterface(queued.get());
+    mapQueuedInterfaces[pwalletIn] = std::move(queued);
+}
+
 void UnregisterValidationInterface(CValidationInterface* pwalletIn) {
+    {
+        LOCK(cs_queuedInterfaces);
+        auto it = mapQueuedInterfaces.find(pwalletIn);
+        if (it != mapQueuedInterfaces.end()) {
+            UnregisterValidationInterface(it->second.get());
+            mapQueuedInterfaces.erase(it);
+            return;
+        }
+    }
     g_signals.BlockFound.disconnect(boost::bind(&CValidationInterface::ResetRequestCount, pwalletIn, _1));
     g_signals.AddressForMining.disconnect(boost::bind(&CValidationInterface::GetAddressForMining, pwalletIn, _1));
     g_signals.BlockChecked.disconnect(boost::bind(&CValidationInterface::BlockChecked, pwalletIn, _1, _2));
     g_signals.Broadcast.disconnect(boost::bind(&CValidationInterface::ResendWalletTransactions, pwalletIn, _1));
     g_signals.Inventory.disconnect(boost::bind(&CValidationInterface::Inventory, pwalletIn, _1));
     g_signals.ChainTip.disconnect(boost::bind(&CValidationInterface::ChainTip, pwalletIn, _1, _2, _3));
+    g_signals.TransactionRemovedFromMempool.disconnect(boost::bind(&CValidationInterface::TransactionRemovedFromMempool, pwalletIn, _1, _2));
+    g_signals.TransactionAddedToMempool.disconnect(boost::bind(&CValidationInterface::TransactionAddedToMempool, pwalletIn, _1, _2));
     g_signals.UpdatedTransaction.disconnect(boost::bind(&CValidationInterface::UpdatedTransaction, pwalletIn, _1));
     g_signals.EraseTransaction.disconnect(boost::bind(&CValidationInterface::EraseFromWallet, pwalletIn, _1));
+    g_signals.SyncTransactions.disconnect(boost::bind(&CValidationInterface::SyncTransactions, pwalletIn, _1, _2, _3));
     g_signals.SyncTransaction.disconnect(boost::bind(&CValidationInterface::SyncTransaction, pwalletIn, _1, _2, _3));
-    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1));
+    g_signals.UpdatedBlockTip.disconnect(boost::bind(&CValidationInterface::UpdatedBlockTip, pwalletIn, _1, _2));
 }
 
 void UnregisterAllValidationInterfaces() {
@@ -59,16 +241,35 @@ void UnregisterAllValidationInterfaces() {
     g_signals.Broadcast.disconnect_all_slots();
     g_signals.Inventory.disconnect_all_slots();
     g_signals.ChainTip.disconnect_all_slots();
+    g_signals.TransactionRemovedFromMempool.disconnect_all_slots();
+    g_signals.TransactionAddedToMempool.disconnect_all_slots();
     g_signals.UpdatedTransaction.disconnect_all_slots();
     g_signals.EraseTransaction.disconnect_all_slots();
+    g_signals.SyncTransactions.disconnect_all_slots();
     g_signals.SyncTransaction.disconnect_all_slots();
     g_signals.UpdatedBlockTip.disconnect_all_slots();
+
+    LOCK(cs_queuedInterfaces);
+    mapQueuedInterfaces.clear();
+}
+
+void SyncWithQueuedValidationInterfaces() {
+    LOCK(cs_queuedInterfaces);
+    for (auto& queued : mapQueuedInterfaces) {
+        queued.second->Sync();
+    }
 }
 
 void SyncWithWallets(const CTransaction &tx, const CBlock *pblock, const int nHeight) {
     g_signals.SyncTransaction(tx, pblock, nHeight);
 }
 
+void SyncWithWallets(const std::vector<CTransaction> &vtx, const CBlock *pblock, const int nHeight) {
+    if (!vtx.empty()) {
+        g_signals.SyncTransactions(vtx, pblock, nHeight);
+    }
+}
+
 struct CachedBlockData {
     CBlockIndex *pindex;
     MerkleFrontiers oldTrees;
@@ -119,7 +320,7 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
         // Transactions that have been recently conflicted out of the mempool.
         std::pair<std::map<CBlockIndex*, std::list<CTransaction>>, uint64_t> recentlyConflicted;
         // Transactions that have been recently added to the mempool.
-        std::pair<std::vector<CTransaction>, uint64_t> recentlyAdded;
+        std::pair<std::vector<std::shared_ptr<const CTransaction>>, uint64_t> recentlyAdded;
 
         {
             LOCK(cs_main);
@@ -202,9 +403,7 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
 
             // Let wallets know transactions went from 1-confirmed to
             // 0-confirmed or conflicted:
-            for (const CTransaction &tx : block.vtx) {
-                SyncWithWallets(tx, NULL, pindexLastTip->nHeight);
-            }
+            SyncWithWallets(block.vtx, NULL, pindexLastTip->nHeight);
             // Update cached incremental witnesses
             // This will take the cs_main lock in order to obtain the CBlockLocator
             // used by `SetBestChain`, but as that write only occurs once every
@@ -236,13 +435,11 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
 
             // Tell wallet about transactions that went from mempool
             // to conflicted:
-            for (const CTransaction &tx : blockData.txConflicted) {
-                SyncWithWallets(tx, NULL, blockData.pindex->nHeight + 1);
-            }
+            SyncWithWallets(
+                std::vector<CTransaction>(blockData.txConflicted.begin(), blockData.txConflicted.end()),
+                NULL, blockData.pindex->nHeight + 1);
             // ... and about transactions that got confirmed:
-            for (const CTransaction &tx : block.vtx) {
-                SyncWithWallets(tx, &block, blockData.pindex->nHeight);
-            }
+            SyncWithWallets(block.vtx, &block, blockData.pindex->nHeight);
             // Update cached incremental witnesses
             // This will take the cs_main lock in order to obtain the CBlockLocator
             // used by `SetBestChain`, but as that write only occurs once every
@@ -259,10 +456,18 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
             pindexLastTip = blockData.pindex;
         }
 
-        // Notify transactions in the mempool
-        for (auto tx : recentlyAdded.first) {
+        // Notify transactions in the mempool, in batches so that wallets can
+        // share the work of scanning them without holding their locks for
+        // too long at a time.
+        const std::vector<std::shared_ptr<const CTransaction>>& vAdded = recentlyAdded.first;
+        for (size_t i = 0; i < vAdded.size(); i += WALLET_NOTIFY_BATCH_SIZE) {
+            std::vector<CTransaction> vBatch;
+            vBatch.reserve(std::min(WALLET_NOTIFY_BATCH_SIZE, vAdded.size() - i));
+            for (size_t j = i; j < std::min(i + WALLET_NOTIFY_BATCH_SIZE, vAdded.size()); j++) {
+                vBatch.push_back(*vAdded[j]);
+            }
             try {
-                SyncWithWallets(tx, NULL, pindexLastTip->nHeight + 1);
+                SyncWithWallets(vBatch, NULL, pindexLastTip->nHeight + 1);
             } catch (const boost::thread_interrupted&) {
                 throw;
             } catch (const std::exception& e) {
@@ -273,8 +478,10 @@ void ThreadNotifyWallets(CBlockIndex *pindexLastTip)
         }
 
         // Update the notified sequence numbers. We only need this in regtest mode,
-        // and should not lock on cs or cs_main here otherwise.
+        // and should not lock on cs or cs_main here otherwise. Listeners with
+        // queues of their own count as notified once they have caught up.
         if (chainParams.NetworkIDString() == "regtest") {
+            SyncWithQueuedValidationInterfaces();
             SetChainNotifiedSequence(chainParams, recentlyConflicted.second);
             mempool.SetNotifiedSequence(recentlyAdded.second);
         }
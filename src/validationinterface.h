@@ -8,6 +8,8 @@
 #define BITCOIN_VALIDATIONINTERFACE_H
 
 #include <optional>
+#include <string>
+#include <vector>
 
 #include <boost/signals2/signal.hpp>
 #include <boost/shared_ptr.hpp>
@@ -32,20 +34,47 @@ struct MerkleFrontiers {
 
 // These functions dispatch to one or all registered wallets
 
+/** The default number of notifications a queued listener can fall behind by */
+static const size_t DEFAULT_VALIDATION_QUEUE_SIZE = 100;
+
 /** Register a wallet to receive updates from core */
 void RegisterValidationInterface(CValidationInterface* pwalletIn);
-/** Unregister a wallet from core */
+/**
+ * Register a wallet to receive updates from core, with the updates sent by
+ * ThreadNotifyWallets (SyncTransaction, SyncTransactions, ChainTip and
+ * UpdatedTransaction) delivered in order on a thread of its own, so that a
+ * slow wallet does not hold up the other listeners. Once nMaxQueued updates
+ * are waiting for it, ThreadNotifyWallets waits for the wallet to catch up.
+ * Other updates are delivered directly, as with RegisterValidationInterface.
+ */
+void RegisterQueuedValidationInterface(CValidationInterface* pwalletIn, const std::string& name, size_t nMaxQueued = DEFAULT_VALIDATION_QUEUE_SIZE);
+/** Unregister a wallet from core, once it has received any queued updates */
 void UnregisterValidationInterface(CValidationInterface* pwalletIn);
 /** Unregister all wallets from core */
 void UnregisterAllValidationInterfaces();
+/** Wait until the queued listeners have received all the updates sent so far */
+void SyncWithQueuedValidationInterfaces();
 
 class CValidationInterface {
 protected:
-    virtual void UpdatedBlockTip(const CBlockIndex *pindex) {}
+    virtual void UpdatedBlockTip(const CBlockIndex *pindex, const CBlock *pblock) {}
     virtual void SyncTransaction(const CTransaction &tx, const CBlock *pblock, const int nHeight) {}
+    /**
+     * Notifies of several transactions with the same block (or none) at
+     * once, in order. Listeners that can handle a group more cheaply than
+     * its transactions one at a time override this; by default it calls
+     * SyncTransaction for each of them.
+     */
+    virtual void SyncTransactions(const std::vector<CTransaction> &vtx, const CBlock *pblock, const int nHeight) {
+        for (const CTransaction &tx : vtx) {
+            SyncTransaction(tx, pblock, nHeight);
+        }
+    }
     virtual void EraseFromWallet(const uint256 &hash) {}
     virtual void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, std::optional<MerkleFrontiers> added) {}
     virtual void UpdatedTransaction(const uint256 &hash) {}
+    virtual void TransactionAddedToMempool(const CTransaction &tx, uint64_t nMempoolSequence) {}
+    virtual void TransactionRemovedFromMempool(const CTransaction &tx, uint64_t nMempoolSequence) {}
     virtual void Inventory(const uint256 &hash) {}
     virtual void ResendWalletTransactions(int64_t nBestBlockTime) {}
     virtual void BlockChecked(const CBlock&, const CValidationState&) {}
@@ -54,17 +83,27 @@ protected:
     friend void ::RegisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterValidationInterface(CValidationInterface*);
     friend void ::UnregisterAllValidationInterfaces();
+    friend class CQueuedValidationInterface;
 };
 
 struct CMainSignals {
-    /** Notifies listeners of updated block chain tip */
-    boost::signals2::signal<void (const CBlockIndex *)> UpdatedBlockTip;
+    /** Notifies listeners of updated block chain tip, with the tip block if it is in memory (or NULL) */
+    boost::signals2::signal<void (const CBlockIndex *, const CBlock *)> UpdatedBlockTip;
     /** Notifies listeners of updated transaction data (transaction, and optionally the block it is found in. */
     boost::signals2::signal<void (const CTransaction &, const CBlock *, const int nHeight)> SyncTransaction;
+    /** Notifies listeners of updated transaction data for a group of transactions, all in the same block (or none). */
+    boost::signals2::signal<void (const std::vector<CTransaction> &, const CBlock *, const int nHeight)> SyncTransactions;
     /** Notifies listeners of an erased transaction (currently disabled, requires transaction replacement). */
     boost::signals2::signal<void (const uint256 &)> EraseTransaction;
     /** Notifies listeners of an updated transaction without new data (for now: a coinbase potentially becoming visible). */
     boost::signals2::signal<void (const uint256 &)> UpdatedTransaction;
+    /**
+     * Notifies listeners of a transaction entering or leaving the mempool,
+     * with the mempool sequence number the change was given. They are
+     * signalled with the mempool lock held, so listeners must not block.
+     */
+    boost::signals2::signal<void (const CTransaction &, uint64_t)> TransactionAddedToMempool;
+    boost::signals2::signal<void (const CTransaction &, uint64_t)> TransactionRemovedFromMempool;
     /** Notifies listeners of a change to the tip of the active block chain. */
     boost::signals2::signal<void (const CBlockIndex *, const CBlock *, std::optional<MerkleFrontiers>)> ChainTip;
     /** Notifies listeners about an inventory item being seen on the network. */
@@ -81,6 +120,9 @@ struct CMainSignals {
 
 CMainSignals& GetMainSignals();
 
+/** The maximum number of mempool transactions that wallets are notified of at once */
+static const size_t WALLET_NOTIFY_BATCH_SIZE = 100;
+
 void ThreadNotifyWallets(CBlockIndex *pindexLastTip);
 
 #endif // BITCOIN_VALIDATIONINTERFACE_H
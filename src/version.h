@@ -38,6 +38,13 @@ static const int NO_BLOOM_VERSION = 170004;
 //! - MSG_WTX type defined, which contains two 32-byte hashes.
 static const int CINV_WTX_VERSION = 170014;
 
+//! "sendheaders" command (BIP 130) and "feefilter" command (BIP 133) are
+//! sent to peers starting with this version. Peers ignore commands they do
+//! not know, so these share the version from which compact blocks are
+//! negotiated.
+static const int SENDHEADERS_VERSION = 170014;
+static const int FEEFILTER_VERSION = 170014;
+
 //! disconnect from testnet peers older than this proto version
 static const int MIN_TESTNET_PEER_PROTO_VERSION = 170040;
 
@@ -0,0 +1,123 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#include "wallet/asyncrpcoperation_batch.h"
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "chainparams.h"
+#include "miner.h"
+#include "util/system.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+AsyncRPCOperation_batch::AsyncRPCOperation_batch(
+        std::string method,
+        std::vector<std::shared_ptr<AsyncRPCOperation>> operations,
+        UniValue contextInfo) :
+        method_(method), operations_(operations), contextinfo_(contextInfo)
+{
+    assert(!operations_.empty());
+    LogPrint("zrpc", "%s: %s initialized with %d transactions\n", getId(), method_, operations_.size());
+}
+
+AsyncRPCOperation_batch::~AsyncRPCOperation_batch() {
+}
+
+void AsyncRPCOperation_batch::main() {
+    if (isCancelled()) {
+        // The operations release their inputs when run cancelled.
+        for (const auto& operation : operations_) {
+            operation->cancel();
+            operation->main();
+        }
+        return;
+    }
+
+    set_state(OperationStatus::EXECUTING);
+    start_execution_clock();
+
+#ifdef ENABLE_MINING
+    GenerateBitcoins(false, 0, Params());
+#endif
+
+    // Each operation proves its own transaction, so they are run on as
+    // many threads as there are cores.
+    std::atomic<size_t> nNext{0};
+    auto run = [&]() {
+        for (size_t i = nNext++; i < operations_.size(); i = nNext++) {
+            operations_[i]->main();
+        }
+    };
+    size_t nThreads = std::min(operations_.size(), (size_t)std::max(1, GetNumCores()));
+    std::vector<std::thread> vThreads;
+    for (size_t i = 1; i < nThreads; i++) {
+        vThreads.emplace_back(run);
+    }
+    run();
+    for (std::thread& thread : vThreads) {
+        thread.join();
+    }
+
+#ifdef ENABLE_MINING
+    GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1), Params());
+#endif
+
+    stop_execution_clock();
+
+    UniValue txids(UniValue::VARR);
+    size_t nFailed = 0;
+    std::string firstError;
+    for (const auto& operation : operations_) {
+        if (operation->isSuccess()) {
+            UniValue txid = find_value(operation->getResult(), "txid");
+            if (!txid.isNull()) {
+                txids.push_back(txid);
+            }
+        } else {
+            if (nFailed == 0) {
+                firstError = operation->getErrorMessage();
+            }
+            nFailed++;
+        }
+    }
+
+    if (nFailed == 0) {
+        UniValue result(UniValue::VOBJ);
+        result.pushKV("txids", txids);
+        set_result(result);
+        set_state(OperationStatus::SUCCESS);
+    } else {
+        // The transactions that were built have been sent regardless; their
+        // txids are in the statuses of their operations.
+        set_error_code(-1);
+        set_error_message(strprintf("%d of %d transactions failed: %s", nFailed, operations_.size(), firstError));
+        set_state(OperationStatus::FAILED);
+    }
+
+    LogPrintf("%s: %s finished (status=%s, %d transactions sent, %d failed)\n",
+        getId(), method_, getStateAsString(), txids.size(), nFailed);
+}
+
+/**
+ * Override getStatus() to append the context object and the status of the
+ * operation of each transaction to the default status object.
+ */
+UniValue AsyncRPCOperation_batch::getStatus() const {
+    UniValue obj = AsyncRPCOperation::getStatus();
+    if (!contextinfo_.isNull()) {
+        obj.pushKV("method", method_);
+        obj.pushKV("params", contextinfo_);
+    }
+    UniValue transactions(UniValue::VARR);
+    for (const auto& operation : operations_) {
+        transactions.push_back(operation->getStatus());
+    }
+    obj.pushKV("transactions", transactions);
+    return obj;
+}
@@ -0,0 +1,55 @@
+// Copyright (c) 2023 The Zcash developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or https://www.opensource.org/licenses/mit-license.php .
+
+#ifndef ZCASH_WALLET_ASYNCRPCOPERATION_BATCH_H
+#define ZCASH_WALLET_ASYNCRPCOPERATION_BATCH_H
+
+#include "asyncrpcoperation.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <univalue.h>
+
+/**
+ * An operation that builds and sends several transactions, each by an
+ * operation of its own, concurrently under a single operation id. The
+ * operations are not queued themselves; they are run by this one, and their
+ * statuses are reported with its own so that the progress of each
+ * transaction can be followed.
+ *
+ * The operations must not pause mining themselves (see pauseMining in
+ * AsyncRPCOperation_shieldcoinbase and AsyncRPCOperation_mergetoaddress), as
+ * this one does it once around all of them.
+ */
+class AsyncRPCOperation_batch : public AsyncRPCOperation {
+public:
+    AsyncRPCOperation_batch(
+        std::string method,
+        std::vector<std::shared_ptr<AsyncRPCOperation>> operations,
+        UniValue contextInfo = NullUniValue);
+    virtual ~AsyncRPCOperation_batch();
+
+    // We don't want to be copied or moved around
+    AsyncRPCOperation_batch(AsyncRPCOperation_batch const&) = delete;             // Copy construct
+    AsyncRPCOperation_batch(AsyncRPCOperation_batch&&) = delete;                  // Move construct
+    AsyncRPCOperation_batch& operator=(AsyncRPCOperation_batch const&) = delete;  // Copy assign
+    AsyncRPCOperation_batch& operator=(AsyncRPCOperation_batch &&) = delete;      // Move assign
+
+    virtual void main();
+
+    virtual UniValue getStatus() const;
+
+    virtual std::string getMethod() const { return method_; }
+
+    virtual AsyncRPCPriority getPriority() const { return AsyncRPCPriority::BACKGROUND; }
+
+private:
+    std::string method_;
+    std::vector<std::shared_ptr<AsyncRPCOperation>> operations_;
+    UniValue contextinfo_;     // optional data to include in return value from getStatus()
+};
+
+#endif // ZCASH_WALLET_ASYNCRPCOPERATION_BATCH_H
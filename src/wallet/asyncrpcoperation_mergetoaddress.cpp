@@ -153,7 +153,9 @@ void AsyncRPCOperation_mergetoaddress::main()
     bool success = false;
 
 #ifdef ENABLE_MINING
-    GenerateBitcoins(false, 0, Params());
+    if (pauseMining) {
+        GenerateBitcoins(false, 0, Params());
+    }
 #endif
 
     try {
@@ -178,7 +180,9 @@ void AsyncRPCOperation_mergetoaddress::main()
     }
 
 #ifdef ENABLE_MINING
-    GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1), Params());
+    if (pauseMining) {
+        GenerateBitcoins(GetBoolArg("-gen", false), GetArg("-genproclimit", 1), Params());
+    }
 #endif
 
     stop_execution_clock();
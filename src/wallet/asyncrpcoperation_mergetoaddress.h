@@ -76,10 +76,16 @@ public:
 
     virtual UniValue getStatus() const;
 
+    virtual std::string getMethod() const { return "z_mergetoaddress"; }
+
+    virtual AsyncRPCPriority getPriority() const { return AsyncRPCPriority::BACKGROUND; }
+
     bool testmode = false; // Set to true to disable sending txs and generating proofs
 
     bool paymentDisclosureMode = false; // Set to true to save esk for encrypted notes in payment disclosure database.
 
+    bool pauseMining = true; // Set to false when run by an AsyncRPCOperation_batch, which pauses mining itself.
+
 private:
     friend class TEST_FRIEND_AsyncRPCOperation_mergetoaddress; // class for unit testing
 
@@ -11,7 +11,11 @@
 #include "util/moneystr.h"
 #include "wallet.h"
 
+#include <algorithm>
+#include <atomic>
+#include <exception>
 #include <optional>
+#include <thread>
 #include <variant>
 
 const int MIGRATION_EXPIRY_DELTA = 450;
@@ -104,27 +108,29 @@ bool AsyncRPCOperation_saplingmigration::main_impl() {
     libzcash::SaplingPaymentAddress migrationDestAddress = getMigrationDestAddress(seed);
 
 
-    // Up to the limit of 5, as many transactions are sent as are needed to migrate the remaining funds
-    int numTxCreated = 0;
-    CAmount amountMigrated = 0;
-    std::vector<std::string> migrationTxIds;
+    // Up to the limit of 5, as many transactions are sent as are needed to
+    // migrate the remaining funds. They are all planned first, while holding
+    // the wallet lock only as needed to look up keys and witnesses, and then
+    // built (and their proofs created) concurrently.
+    struct MigrationInput {
+        libzcash::SproutSpendingKey sk;
+        libzcash::SproutNote note;
+        SproutWitness witness;
+    };
+    struct MigrationTx {
+        CAmount amountToSend;
+        std::vector<MigrationInput> inputs;
+    };
+    std::vector<MigrationTx> vPlanned;
     int noteIndex = 0;
-    CCoinsViewCache coinsView(pcoinsTip);
     do {
-        CAmount amountToSend = chooseAmount(availableFunds);
-        auto builder = TransactionBuilder(consensusParams, targetHeight_, std::nullopt, pwalletMain, &coinsView, &cs_main);
-        builder.SetExpiryHeight(targetHeight_ + MIGRATION_EXPIRY_DELTA);
-        LogPrint("zrpcunsafe", "%s: Beginning creating transaction with Sapling output amount=%s\n", getId(), FormatMoney(amountToSend - DEFAULT_FEE));
-        std::vector<SproutNoteEntry> fromNotes;
+        MigrationTx planned;
+        planned.amountToSend = chooseAmount(availableFunds);
+        LogPrint("zrpcunsafe", "%s: Planning transaction with Sapling output amount=%s\n", getId(), FormatMoney(planned.amountToSend - DEFAULT_FEE));
         CAmount fromNoteAmount = 0;
-        while (fromNoteAmount < amountToSend) {
-            auto sproutEntry = sproutEntries[noteIndex++];
-            fromNotes.push_back(sproutEntry);
+        while (fromNoteAmount < planned.amountToSend) {
+            const SproutNoteEntry& sproutEntry = sproutEntries[noteIndex++];
             fromNoteAmount += sproutEntry.note.value();
-        }
-        availableFunds -= fromNoteAmount;
-        std::optional<libzcash::SproutPaymentAddress> changeAddr;
-        for (const SproutNoteEntry& sproutEntry : fromNotes) {
             std::string data(sproutEntry.memo.begin(), sproutEntry.memo.end());
             LogPrint("zrpcunsafe", "%s: Adding Sprout note input (txid=%s, vJoinSplit=%d, jsoutindex=%d, amount=%s, memo=%s)\n",
                 getId(),
@@ -146,29 +152,70 @@ bool AsyncRPCOperation_saplingmigration::main_impl() {
                 // Sprout activation.
                 throw JSONRPCError(RPC_WALLET_ERROR, "Insufficient Sprout witnesses.");
             }
-            builder.AddSproutInput(sproutSk, sproutEntry.note, vInputWitnesses[0].value());
-            // Send change to the address of the first input
-            if (!changeAddr.has_value()) {
-                changeAddr = sproutSk.address();
+            planned.inputs.push_back({sproutSk, sproutEntry.note, vInputWitnesses[0].value()});
+        }
+        availableFunds -= fromNoteAmount;
+        vPlanned.push_back(std::move(planned));
+    } while (vPlanned.size() < 5 && availableFunds > CENT);
+
+    CCoinsViewCache coinsView(pcoinsTip);
+    auto ovk = ovkForShieldingFromTaddr(seed);
+    std::vector<std::optional<CTransaction>> vTxs(vPlanned.size());
+    std::vector<std::exception_ptr> vErrors(vPlanned.size());
+    std::atomic<size_t> nNext{0};
+    auto build = [&]() {
+        for (size_t i = nNext++; i < vPlanned.size(); i = nNext++) {
+            try {
+                const MigrationTx& planned = vPlanned[i];
+                auto builder = TransactionBuilder(consensusParams, targetHeight_, std::nullopt, pwalletMain, &coinsView, &cs_main);
+                builder.SetExpiryHeight(targetHeight_ + MIGRATION_EXPIRY_DELTA);
+                for (const MigrationInput& input : planned.inputs) {
+                    builder.AddSproutInput(input.sk, input.note, input.witness);
+                }
+                // The amount chosen *includes* the default fee for this transaction, i.e.
+                // the value of the Sapling output will be 0.00001 ZEC less.
+                builder.SetFee(DEFAULT_FEE);
+                builder.AddSaplingOutput(ovk, migrationDestAddress, planned.amountToSend - DEFAULT_FEE);
+                // Send change to the address of the first input
+                builder.SendChangeToSprout(planned.inputs[0].sk.address());
+                vTxs[i] = builder.Build().GetTxOrThrow();
+            } catch (...) {
+                vErrors[i] = std::current_exception();
             }
         }
-        assert(changeAddr.has_value());
-        // The amount chosen *includes* the default fee for this transaction, i.e.
-        // the value of the Sapling output will be 0.00001 ZEC less.
-        builder.SetFee(DEFAULT_FEE);
-        builder.AddSaplingOutput(ovkForShieldingFromTaddr(seed), migrationDestAddress, amountToSend - DEFAULT_FEE);
-        builder.SendChangeToSprout(changeAddr.value());
-        CTransaction tx = builder.Build().GetTxOrThrow();
+    };
+    size_t nThreads = std::min(vPlanned.size(), (size_t)std::max(1, GetNumCores()));
+    std::vector<std::thread> vThreads;
+    for (size_t i = 1; i < nThreads; i++) {
+        vThreads.emplace_back(build);
+    }
+    build();
+    for (std::thread& thread : vThreads) {
+        thread.join();
+    }
+    for (const std::exception_ptr& error : vErrors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // The transactions are only broadcast once the chain reaches the target
+    // height, as before.
+    int numTxCreated = 0;
+    CAmount amountMigrated = 0;
+    std::vector<std::string> migrationTxIds;
+    for (size_t i = 0; i < vPlanned.size(); i++) {
         if (isCancelled()) {
             LogPrint("zrpcunsafe", "%s: Canceled. Stopping.\n", getId());
             break;
         }
+        const CTransaction& tx = vTxs[i].value();
         pwalletMain->AddPendingSaplingMigrationTx(tx);
         LogPrint("zrpcunsafe", "%s: Added pending migration transaction with txid=%s\n", getId(), tx.GetHash().ToString());
         ++numTxCreated;
-        amountMigrated += amountToSend - DEFAULT_FEE;
+        amountMigrated += vPlanned[i].amountToSend - DEFAULT_FEE;
         migrationTxIds.push_back(tx.GetHash().ToString());
-    } while (numTxCreated < 5 && availableFunds > CENT);
+    }
 
     LogPrint("zrpcunsafe", "%s: Created %d transactions with total Sapling output amount=%s\n", getId(), numTxCreated, FormatMoney(amountMigrated));
     setMigrationResult(numTxCreated, amountMigrated, migrationTxIds);
@@ -26,6 +26,10 @@ public:
 
     virtual UniValue getStatus() const;
 
+    virtual std::string getMethod() const { return "saplingmigration"; }
+
+    virtual AsyncRPCPriority getPriority() const { return AsyncRPCPriority::BACKGROUND; }
+
 private:
     int targetHeight_;
 
@@ -7,6 +7,7 @@
 #include "amount.h"
 #include "asyncrpcoperation_common.h"
 #include "asyncrpcqueue.h"
+#include "consensus/consensus.h"
 #include "consensus/upgrades.h"
 #include "core_io.h"
 #include "experimental_features.h"
@@ -34,6 +35,9 @@
 #include <array>
 #include <iostream>
 #include <chrono>
+#include <future>
+#include <map>
+#include <mutex>
 #include <thread>
 #include <string>
 #include <utility>
@@ -43,6 +47,29 @@
 
 using namespace libzcash;
 
+/**
+ * z_sendmany requests whose recipients are paid by the transaction of the
+ * first of them, the leader.
+ */
+struct SendManyBatch {
+    std::string key;
+    std::chrono::steady_clock::time_point deadline;
+    std::weak_ptr<AsyncRPCOperation_sendmany> leader;
+    size_t nRequests{1};
+
+    // The outcome of the leader's transaction, set before done is ready.
+    std::promise<void> promise;
+    std::shared_future<void> done{promise.get_future().share()};
+    std::optional<uint256> txid;
+    UniValue result;
+    int errorCode{0};
+    std::string errorMessage;
+};
+
+// The batches that are still taking requests, by key.
+static std::mutex cs_sendManyBatches;
+static std::map<std::string, std::shared_ptr<SendManyBatch>> mapSendManyBatches;
+
 AsyncRPCOperation_sendmany::AsyncRPCOperation_sendmany(
         TransactionBuilder builder,
         ZTXOSelector ztxoSelector,
@@ -52,41 +79,19 @@ AsyncRPCOperation_sendmany::AsyncRPCOperation_sendmany(
         TransactionStrategy strategy,
         CAmount fee,
         UniValue contextInfo) :
-        builder_(std::move(builder)), ztxoSelector_(ztxoSelector), recipients_(recipients),
+        builder_(std::move(builder)), ztxoSelector_(ztxoSelector),
         mindepth_(minDepth), anchordepth_(anchorDepth), strategy_(strategy), fee_(fee),
         contextinfo_(contextInfo)
 {
     assert(fee_ >= 0);
     assert(mindepth_ >= 0);
-    assert(!recipients_.empty());
+    assert(!recipients.empty());
     assert(ztxoSelector.RequireSpendingKeys());
 
     sendFromAccount_ = pwalletMain->FindAccountForSelector(ztxoSelector_).value_or(ZCASH_LEGACY_ACCOUNT);
 
-    // Determine the target totals and recipient pools
-    for (const SendManyRecipient& recipient : recipients_) {
-        std::visit(match {
-            [&](const CKeyID& addr) {
-                transparentRecipients_ += 1;
-                txOutputAmounts_.t_outputs_total += recipient.amount;
-                recipientPools_.insert(OutputPool::Transparent);
-            },
-            [&](const CScriptID& addr) {
-                transparentRecipients_ += 1;
-                txOutputAmounts_.t_outputs_total += recipient.amount;
-                recipientPools_.insert(OutputPool::Transparent);
-            },
-            [&](const libzcash::SaplingPaymentAddress& addr) {
-                txOutputAmounts_.sapling_outputs_total += recipient.amount;
-                recipientPools_.insert(OutputPool::Sapling);
-            },
-            [&](const libzcash::OrchardRawAddress& addr) {
-                txOutputAmounts_.orchard_outputs_total += recipient.amount;
-                recipientPools_.insert(OutputPool::Orchard);
-                // No transaction allows sends from Sprout to Orchard.
-                assert(!ztxoSelector_.SelectsSprout());
-            }
-        }, recipient.address);
+    for (const SendManyRecipient& recipient : recipients) {
+        add_recipient(recipient);
     }
 
     // Log the context info i.e. the call parameters to z_sendmany
@@ -100,13 +105,165 @@ AsyncRPCOperation_sendmany::AsyncRPCOperation_sendmany(
 AsyncRPCOperation_sendmany::~AsyncRPCOperation_sendmany() {
 }
 
+void AsyncRPCOperation_sendmany::add_recipient(const SendManyRecipient& recipient) {
+    recipients_.push_back(recipient);
+
+    // Update the target totals and recipient pools
+    std::visit(match {
+        [&](const CKeyID& addr) {
+            transparentRecipients_ += 1;
+            txOutputAmounts_.t_outputs_total += recipient.amount;
+            recipientPools_.insert(OutputPool::Transparent);
+        },
+        [&](const CScriptID& addr) {
+            transparentRecipients_ += 1;
+            txOutputAmounts_.t_outputs_total += recipient.amount;
+            recipientPools_.insert(OutputPool::Transparent);
+        },
+        [&](const libzcash::SaplingPaymentAddress& addr) {
+            txOutputAmounts_.sapling_outputs_total += recipient.amount;
+            recipientPools_.insert(OutputPool::Sapling);
+        },
+        [&](const libzcash::OrchardRawAddress& addr) {
+            txOutputAmounts_.orchard_outputs_total += recipient.amount;
+            recipientPools_.insert(OutputPool::Orchard);
+            // No transaction allows sends from Sprout to Orchard.
+            assert(!ztxoSelector_.SelectsSprout());
+        }
+    }, recipient.address);
+}
+
+void AsyncRPCOperation_sendmany::Queue(
+        std::shared_ptr<AsyncRPCQueue> q,
+        std::shared_ptr<AsyncRPCOperation_sendmany> operation,
+        const std::string& source,
+        int nextBlockHeight)
+{
+    if (nSendManyBatchWindow > 0) {
+        TransactionStrategy strategy(operation->strategy_);
+        std::string key = strprintf("%s/%d/%d/%d/%d%d%d%d",
+            source, operation->mindepth_, operation->anchordepth_, operation->fee_,
+            strategy.AllowRevealedAmounts(), strategy.AllowRevealedRecipients(),
+            strategy.AllowRevealedSenders(), strategy.AllowLinkingAccountAddresses());
+
+        std::lock_guard<std::mutex> guard(cs_sendManyBatches);
+        auto it = mapSendManyBatches.find(key);
+        std::shared_ptr<AsyncRPCOperation_sendmany> leader;
+        if (it != mapSendManyBatches.end()) {
+            leader = it->second->leader.lock();
+        }
+        if (leader && !leader->isCancelled() && leader->can_merge(*operation, nextBlockHeight)) {
+            // The leader has not closed the batch, so it has not read its
+            // recipients yet.
+            for (const SendManyRecipient& recipient : operation->recipients_) {
+                leader->add_recipient(recipient);
+            }
+            it->second->nRequests++;
+            operation->batch_ = it->second;
+            LogPrint("zrpc", "%s: z_sendmany paid by the transaction of %s\n", operation->getId(), leader->getId());
+        } else {
+            // Start a new batch, replacing one that cannot take this request.
+            auto batch = std::make_shared<SendManyBatch>();
+            batch->key = key;
+            batch->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(nSendManyBatchWindow);
+            batch->leader = operation;
+            operation->batch_ = batch;
+            operation->batchleader_ = true;
+            mapSendManyBatches[key] = batch;
+        }
+    }
+    q->addOperation(operation);
+}
+
+bool AsyncRPCOperation_sendmany::can_merge(const AsyncRPCOperation_sendmany& other, int nextBlockHeight) const {
+    std::vector<SendManyRecipient> recipients(recipients_);
+    recipients.insert(recipients.end(), other.recipients_.begin(), other.recipients_.end());
+
+    size_t nOrchardOutputs = 0;
+    for (const SendManyRecipient& recipient : recipients) {
+        if (std::holds_alternative<libzcash::OrchardRawAddress>(recipient.address)) {
+            nOrchardOutputs += 1;
+        }
+    }
+    if (nOrchardOutputs > nOrchardActionLimit) {
+        return false;
+    }
+
+    try {
+        return EstimateTxSize(ztxoSelector_, recipients, nextBlockHeight) <= MAX_TX_SIZE_AFTER_SAPLING;
+    } catch (const UniValue& objError) {
+        return false;
+    }
+}
+
+void AsyncRPCOperation_sendmany::close_batch() {
+    std::this_thread::sleep_until(batch_->deadline);
+
+    std::lock_guard<std::mutex> guard(cs_sendManyBatches);
+    auto it = mapSendManyBatches.find(batch_->key);
+    if (it != mapSendManyBatches.end() && it->second == batch_) {
+        mapSendManyBatches.erase(it);
+    }
+    if (batch_->nRequests > 1) {
+        LogPrint("zrpc", "%s: z_sendmany paying %d requests to %d recipients in one transaction\n",
+            getId(), batch_->nRequests, recipients_.size());
+    }
+}
+
+void AsyncRPCOperation_sendmany::finish_batch(const std::optional<uint256>& txid) {
+    batch_->txid = txid;
+    batch_->result = getResult();
+    batch_->errorCode = getErrorCode();
+    batch_->errorMessage = getErrorMessage();
+    batch_->promise.set_value();
+}
+
+void AsyncRPCOperation_sendmany::main_batched() {
+    set_state(OperationStatus::EXECUTING);
+    start_execution_clock();
+
+    // The leader may not have started yet if there is more than one worker.
+    while (batch_->done.wait_for(std::chrono::milliseconds(100)) != std::future_status::ready) {
+        std::shared_ptr<AsyncRPCOperation_sendmany> leader = batch_->leader.lock();
+        if (!leader || leader->isCancelled()) {
+            stop_execution_clock();
+            set_error_code(-1);
+            set_error_message("the z_sendmany operation paying this request was cancelled");
+            set_state(OperationStatus::FAILED);
+            LogPrintf("%s: z_sendmany finished (status=%s, error=%s)\n", getId(), getStateAsString(), getErrorMessage());
+            return;
+        }
+    }
+
+    stop_execution_clock();
+    if (batch_->txid.has_value()) {
+        set_result(batch_->result);
+        set_state(OperationStatus::SUCCESS);
+        LogPrintf("%s: z_sendmany finished (status=%s, txid=%s)\n", getId(), getStateAsString(), batch_->txid.value().ToString());
+    } else {
+        set_error_code(batch_->errorCode);
+        set_error_message(batch_->errorMessage);
+        set_state(OperationStatus::FAILED);
+        LogPrintf("%s: z_sendmany finished (status=%s, error=%s)\n", getId(), getStateAsString(), getErrorMessage());
+    }
+}
+
 void AsyncRPCOperation_sendmany::main() {
     if (isCancelled())
         return;
 
+    if (batch_ && !batchleader_) {
+        main_batched();
+        return;
+    }
+
     set_state(OperationStatus::EXECUTING);
     start_execution_clock();
 
+    if (batch_) {
+        close_batch();
+    }
+
     bool success = false;
 
 #ifdef ENABLE_MINING
@@ -147,6 +304,10 @@ void AsyncRPCOperation_sendmany::main() {
         set_state(OperationStatus::FAILED);
     }
 
+    if (batch_) {
+        finish_batch(txid);
+    }
+
     std::string s = strprintf("%s: z_sendmany finished (status=%s", getId(), getStateAsString());
     if (txid.has_value()) {
         s += strprintf(", txid=%s)\n", txid.value().ToString());
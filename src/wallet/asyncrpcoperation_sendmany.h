@@ -15,6 +15,7 @@
 #include "wallet/paymentdisclosure.h"
 
 #include <array>
+#include <memory>
 #include <optional>
 #include <unordered_map>
 #include <tuple>
@@ -41,6 +42,18 @@ public:
     CAmount orchard_outputs_total{0};
 };
 
+class AsyncRPCQueue;
+struct SendManyBatch;
+
+/**
+ * Estimate the size of a transaction paying the recipients, to check it
+ * against the transaction size limit.
+ */
+size_t EstimateTxSize(
+        const ZTXOSelector& ztxoSelector,
+        const std::vector<SendManyRecipient>& recipients,
+        int nextBlockHeight);
+
 class AsyncRPCOperation_sendmany : public AsyncRPCOperation {
 public:
     AsyncRPCOperation_sendmany(
@@ -64,6 +77,22 @@ public:
 
     virtual UniValue getStatus() const;
 
+    virtual std::string getMethod() const { return "z_sendmany"; }
+
+    /**
+     * Add the operation to the queue. With -sendmanybatchwindow, the
+     * recipients of requests from the same source, with the same minimum
+     * confirmations, fee and privacy policy, that are queued within the
+     * window of the first are paid by the first request's transaction, as
+     * long as it stays within the size limits. Each operation then reports
+     * the outcome of that transaction.
+     */
+    static void Queue(
+        std::shared_ptr<AsyncRPCQueue> q,
+        std::shared_ptr<AsyncRPCOperation_sendmany> operation,
+        const std::string& source,
+        int nextBlockHeight);
+
     bool testmode{false};  // Set to true to disable sending txs and generating proofs
 
 private:
@@ -85,6 +114,24 @@ private:
     std::set<OutputPool> recipientPools_;
     TxOutputAmounts txOutputAmounts_;
 
+    // The batch this request is paid in, and whether this request builds its transaction.
+    std::shared_ptr<SendManyBatch> batch_;
+    bool batchleader_{false};
+
+    void add_recipient(const SendManyRecipient& recipient);
+
+    // Whether the recipients of another request can be added to this one's transaction.
+    bool can_merge(const AsyncRPCOperation_sendmany& other, int nextBlockHeight) const;
+
+    // Wait for the batch window to pass, then stop adding requests to the batch.
+    void close_batch();
+
+    // Report the outcome of the batch's transaction to the other requests.
+    void finish_batch(const std::optional<uint256>& txid);
+
+    // Wait for the batch's transaction and report its outcome.
+    void main_batched();
+
     /**
      * Compute the internal and external OVKs to use in transaction construction, given
      * the spendable inputs.
@@ -116,6 +163,10 @@ public:
     void set_state(OperationStatus state) {
         delegate->state_.store(state);
     }
+
+    size_t recipient_count() {
+        return delegate->recipients_.size();
+    }
 };
 
 
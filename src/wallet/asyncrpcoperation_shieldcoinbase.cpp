@@ -127,7 +127,9 @@ void AsyncRPCOperation_shieldcoinbase::main() {
     bool success = false;
 
 #ifdef ENABLE_MINING
-    GenerateBitcoins(false, 0, Params());
+    if (pauseMining) {
+        GenerateBitcoins(false, 0, Params());
+    }
 #endif
 
     try {
@@ -152,7 +154,9 @@ void AsyncRPCOperation_shieldcoinbase::main() {
     }
 
 #ifdef ENABLE_MINING
-    GenerateBitcoins(GetBoolArg("-gen",false), GetArg("-genproclimit", 1), Params());
+    if (pauseMining) {
+        GenerateBitcoins(GetBoolArg("-gen",false), GetArg("-genproclimit", 1), Params());
+    }
 #endif
 
     stop_execution_clock();
@@ -12,9 +12,13 @@
 #include "streams.h"
 #include "util/system.h"
 
+#include <functional>
 #include <string>
+#include <thread>
 #include <vector>
 
+int64_t nWalletUnlockCheckKeys = DEFAULT_WALLET_UNLOCK_CHECK_KEYS;
+
 int CCrypter::BytesToKeySHA512AES(const std::vector<unsigned char>& chSalt, const SecureString& strKeyData, int count, unsigned char *key,unsigned char *iv) const
 {
     // This mimics the behavior of openssl's EVP_BytesToKey with an aes256cbc
@@ -248,6 +252,16 @@ bool CCryptoKeyStore::Lock()
     return true;
 }
 
+bool CCryptoKeyStore::CheckDecrypted(bool fDecrypted) const
+{
+    AssertLockHeld(cs_KeyStore);
+    if (!fDecrypted && !vMasterKey.empty() && !fDecryptionThoroughlyChecked) {
+        LogPrintf("The wallet is probably corrupted: Some keys decrypt but not all.\n");
+        assert(false);
+    }
+    return fDecrypted;
+}
+
 bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
 {
     {
@@ -277,50 +291,79 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
                 keyPass = true;
             }
         }
-        CryptedKeyMap::const_iterator mi = mapCryptedKeys.begin();
-        for (; mi != mapCryptedKeys.end(); ++mi)
-        {
-            const CPubKey &vchPubKey = (*mi).second.first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-            CKey key;
-            if (!DecryptKey(vMasterKeyIn, vchCryptedSecret, vchPubKey, key))
-            {
-                keyFail = true;
-                break;
+        std::vector<std::function<bool()>> vChecks;
+        for (const auto& entry : mapCryptedKeys) {
+            vChecks.push_back([&]() {
+                CKey key;
+                return DecryptKey(vMasterKeyIn, entry.second.second, entry.second.first, key);
+            });
+        }
+        size_t nKeys = vChecks.size();
+        for (const auto& entry : mapCryptedSproutSpendingKeys) {
+            vChecks.push_back([&]() {
+                libzcash::SproutSpendingKey sk;
+                return DecryptSproutSpendingKey(vMasterKeyIn, entry.second, entry.first, sk);
+            });
+        }
+        size_t nSproutKeys = vChecks.size() - nKeys;
+        for (const auto& entry : mapCryptedSaplingSpendingKeys) {
+            vChecks.push_back([&]() {
+                libzcash::SaplingExtendedSpendingKey sk;
+                return DecryptSaplingSpendingKey(vMasterKeyIn, entry.second, entry.first, sk);
+            });
+        }
+        size_t nSaplingKeys = vChecks.size() - nKeys - nSproutKeys;
+
+        std::vector<size_t> vFirst;
+        std::vector<size_t> vRest;
+        bool fCheckedAll = true;
+        size_t nBegin = 0;
+        for (size_t nCount : {nKeys, nSproutKeys, nSaplingKeys}) {
+            // The maps are ordered by key material rather than by creation
+            // time, so a sample of their first entries is not biased towards
+            // the oldest or newest keys.
+            size_t nChecked = nCount;
+            if (fDecryptionThoroughlyChecked) {
+                nChecked = std::min<size_t>(nCount, 1);
+            } else if (nWalletUnlockCheckKeys > 0) {
+                nChecked = std::min<size_t>(nCount, nWalletUnlockCheckKeys);
             }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
+            fCheckedAll = fCheckedAll && nChecked == nCount;
+            for (size_t i = 0; i < nChecked; i++) {
+                (i == 0 ? vFirst : vRest).push_back(nBegin + i);
+            }
+            nBegin += nCount;
         }
-        CryptedSproutSpendingKeyMap::const_iterator miSprout = mapCryptedSproutSpendingKeys.begin();
-        for (; miSprout != mapCryptedSproutSpendingKeys.end(); ++miSprout)
-        {
-            const libzcash::SproutPaymentAddress &address = (*miSprout).first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*miSprout).second;
-            libzcash::SproutSpendingKey sk;
-            if (!DecryptSproutSpendingKey(vMasterKeyIn, vchCryptedSecret, address, sk))
-            {
+        // Check the first key of each type, which is enough to reject a wrong
+        // master key without decrypting every key.
+        for (size_t i : vFirst) {
+            if (vChecks[i]()) {
+                keyPass = true;
+            } else {
                 keyFail = true;
-                break;
             }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
         }
-        CryptedSaplingSpendingKeyMap::const_iterator miSapling = mapCryptedSaplingSpendingKeys.begin();
-        for (; miSapling != mapCryptedSaplingSpendingKeys.end(); ++miSapling)
-        {
-            const libzcash::SaplingExtendedFullViewingKey &extfvk = (*miSapling).first;
-            const std::vector<unsigned char> &vchCryptedSecret = (*miSapling).second;
-            libzcash::SaplingExtendedSpendingKey sk;
-            if (!DecryptSaplingSpendingKey(vMasterKeyIn, vchCryptedSecret, extfvk, sk))
-            {
-                keyFail = true;
-                break;
+
+        // Check the others across all cores, until one of them fails.
+        if (keyPass && !keyFail && !vRest.empty()) {
+            std::atomic<size_t> nNext{0};
+            std::atomic<bool> fFailed{false};
+            auto check = [&]() {
+                for (size_t i = nNext++; i < vRest.size() && !fFailed; i = nNext++) {
+                    if (!vChecks[vRest[i]]())
+                        fFailed = true;
+                }
+            };
+            size_t nThreads = std::min(vRest.size(), (size_t)std::max(1, GetNumCores()));
+            std::vector<std::thread> vThreads;
+            for (size_t i = 1; i < nThreads; i++) {
+                vThreads.emplace_back(check);
+            }
+            check();
+            for (std::thread& thread : vThreads) {
+                thread.join();
             }
-            keyPass = true;
-            if (fDecryptionThoroughlyChecked)
-                break;
+            keyFail = fFailed;
         }
         if (keyPass && keyFail)
         {
@@ -330,7 +373,9 @@ bool CCryptoKeyStore::Unlock(const CKeyingMaterial& vMasterKeyIn)
         if (keyFail || !keyPass)
             return false;
         vMasterKey = vMasterKeyIn;
-        fDecryptionThoroughlyChecked = true;
+        // Keys that were not checked are checked by CheckDecrypted when they
+        // are first used.
+        fDecryptionThoroughlyChecked = fDecryptionThoroughlyChecked || fCheckedAll;
     }
     NotifyStatusChanged(this);
     return true;
@@ -507,7 +552,7 @@ bool CCryptoKeyStore::GetKey(const CKeyID &address, CKey& keyOut) const
     {
         const CPubKey &vchPubKey = (*mi).second.first;
         const std::vector<unsigned char> &vchCryptedSecret = (*mi).second.second;
-        return DecryptKey(vMasterKey, vchCryptedSecret, vchPubKey, keyOut);
+        return CheckDecrypted(DecryptKey(vMasterKey, vchCryptedSecret, vchPubKey, keyOut));
     }
     return false;
 }
@@ -618,7 +663,7 @@ bool CCryptoKeyStore::GetSproutSpendingKey(const libzcash::SproutPaymentAddress
     if (mi != mapCryptedSproutSpendingKeys.end())
     {
         const std::vector<unsigned char> &vchCryptedSecret = (*mi).second;
-        return DecryptSproutSpendingKey(vMasterKey, vchCryptedSecret, address, skOut);
+        return CheckDecrypted(DecryptSproutSpendingKey(vMasterKey, vchCryptedSecret, address, skOut));
     }
     return false;
 }
@@ -634,7 +679,7 @@ bool CCryptoKeyStore::GetSaplingSpendingKey(
     for (auto entry : mapCryptedSaplingSpendingKeys) {
         if (entry.first == extfvk) {
             const std::vector<unsigned char> &vchCryptedSecret = entry.second;
-            return DecryptSaplingSpendingKey(vMasterKey, vchCryptedSecret, entry.first, skOut);
+            return CheckDecrypted(DecryptSaplingSpendingKey(vMasterKey, vchCryptedSecret, entry.first, skOut));
         }
     }
     return false;
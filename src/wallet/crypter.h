@@ -20,6 +20,15 @@ const unsigned int WALLET_CRYPTO_KEY_SIZE = 32;
 const unsigned int WALLET_CRYPTO_SALT_SIZE = 8;
 const unsigned int WALLET_CRYPTO_IV_SIZE = 16;
 
+/** Default for -walletunlockcheckkeys: check every key on the first unlock. */
+static const int64_t DEFAULT_WALLET_UNLOCK_CHECK_KEYS = 0;
+/**
+ * Number of keys of each type decrypted when the wallet is first unlocked,
+ * or 0 for all of them (-walletunlockcheckkeys). The other keys are checked
+ * when they are first decrypted.
+ */
+extern int64_t nWalletUnlockCheckKeys;
+
 /**
  * Private key encryption is done based on a CMasterKey,
  * which holds a salt and random encryption key.
@@ -147,6 +156,10 @@ private:
     //! keeps track of whether Unlock has run a thorough check before
     bool fDecryptionThoroughlyChecked;
 
+    //! Returns fDecrypted. A key that fails to decrypt while the wallet is
+    //! unlocked, and was not checked by Unlock, means the wallet is corrupted.
+    bool CheckDecrypted(bool fDecrypted) const;
+
 protected:
     bool SetCrypted();
 
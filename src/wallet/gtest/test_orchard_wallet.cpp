@@ -77,6 +77,34 @@ TEST(OrchardWalletTests, TxInvolvesMyNotes) {
     RegtestDeactivateNU5();
 }
 
+TEST(OrchardWalletTests, AddNotesOfBlock) {
+    auto consensusParams = RegtestActivateNU5();
+    OrchardWallet wallet;
+
+    auto sk = RandomOrchardSpendingKey();
+    wallet.AddSpendingKey(sk);
+
+    // The transactions of a block are added together, including one
+    // without an Orchard bundle.
+    auto tx = FakeOrchardTx(sk, libzcash::diversifier_index_t(0));
+    auto txNotOurs = FakeOrchardTx(RandomOrchardSpendingKey(), libzcash::diversifier_index_t(0));
+    CTransaction txTransparent;
+    auto tx1 = FakeOrchardTx(sk, libzcash::diversifier_index_t(1));
+    auto vTxMeta = wallet.AddNotesIfInvolvingMe(std::vector<const CTransaction*>{&tx, &txNotOurs, &txTransparent, &tx1});
+    ASSERT_EQ(vTxMeta.size(), 4);
+    ASSERT_TRUE(vTxMeta[0].has_value());
+    EXPECT_EQ(vTxMeta[0]->GetMyActionIVKs().size(), 1);
+    EXPECT_FALSE(vTxMeta[1].has_value());
+    EXPECT_FALSE(vTxMeta[2].has_value());
+    ASSERT_TRUE(vTxMeta[3].has_value());
+
+    EXPECT_TRUE(wallet.TxInvolvesMyNotes(tx.GetHash()));
+    EXPECT_FALSE(wallet.TxInvolvesMyNotes(txNotOurs.GetHash()));
+    EXPECT_TRUE(wallet.TxInvolvesMyNotes(tx1.GetHash()));
+
+    RegtestDeactivateNU5();
+}
+
 // This test is here instead of test_transaction_builder.cpp because it depends
 // on OrchardWallet, which only exists if the wallet is compiled in.
 TEST(TransactionBuilder, OrchardToOrchard) {
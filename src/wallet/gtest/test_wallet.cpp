@@ -381,6 +381,40 @@ TEST(WalletTests, FindUnspentSproutNotes) {
     mapBlockIndex.erase(blockHash3);
 }
 
+TEST(WalletTests, FindSproutNotesForAddress) {
+    SelectParams(CBaseChainParams::TESTNET);
+
+    CWallet wallet(Params());
+    LOCK2(cs_main, wallet.cs_wallet);
+
+    auto sk1 = libzcash::SproutSpendingKey::random();
+    auto sk2 = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk1);
+    wallet.AddSproutSpendingKey(sk2);
+
+    for (const auto& sk : {sk1, sk2}) {
+        auto wtx = GetValidSproutReceive(sk, 10, true);
+        auto note = GetSproutNote(sk, wtx, 0, 1);
+        mapSproutNoteData_t noteData;
+        noteData[JSOutPoint {wtx.GetHash(), 0, 1}] = SproutNoteData {sk.address(), note.nullifier(sk)};
+        wtx.SetSproutNoteData(noteData);
+        wallet.LoadWalletTx(wtx);
+    }
+
+    // Only the note to the filtered address is found.
+    std::vector<SproutNoteEntry> sproutEntries;
+    std::vector<SaplingNoteEntry> saplingEntries;
+    std::vector<OrchardNoteMetadata> orchardEntries;
+    auto noteFilter = NoteFilter::ForPaymentAddresses({sk2.address()});
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, orchardEntries, noteFilter, -1);
+    ASSERT_EQ(1, sproutEntries.size());
+    EXPECT_TRUE(sk2.address() == sproutEntries[0].address);
+
+    sproutEntries.clear();
+    wallet.GetFilteredNotes(sproutEntries, saplingEntries, orchardEntries, std::nullopt, -1);
+    EXPECT_EQ(2, sproutEntries.size());
+}
+
 
 TEST(WalletTests, SetSproutNoteAddrsInCWalletTx) {
     auto sk = libzcash::SproutSpendingKey::random();
@@ -586,6 +620,61 @@ TEST(WalletTests, FindMySaplingNotes) {
     RegtestDeactivateSapling();
 }
 
+TEST(WalletTests, FindMySaplingNotesBatch) {
+    LoadProofParameters();
+
+    auto consensusParams = RegtestActivateSapling();
+    TestWallet wallet(Params());
+    LOCK(wallet.cs_wallet);
+
+    auto sk = GetTestMasterSaplingSpendingKey();
+    auto extfvk = sk.ToXFVK();
+    auto pa = extfvk.DefaultAddress();
+    ASSERT_TRUE(wallet.AddSaplingZKey(sk));
+
+    // A transaction with two notes for the wallet, and one with none.
+    auto testNote = GetTestSaplingNote(pa, 50000);
+    auto builder = TransactionBuilder(consensusParams, 1, std::nullopt);
+    builder.AddSaplingSpend(sk.expsk, testNote.note, testNote.tree.root(), testNote.tree.witness());
+    builder.AddSaplingOutput(extfvk.fvk.ovk, pa, 25000, {});
+    auto tx1 = builder.Build().GetTxOrThrow();
+
+    auto otherSk = libzcash::SaplingSpendingKey::random();
+    auto otherNote = GetTestSaplingNote(otherSk.default_address(), 50000);
+    auto builder2 = TransactionBuilder(consensusParams, 1, std::nullopt);
+    builder2.AddSaplingSpend(otherSk.expanded_spending_key(), otherNote.note, otherNote.tree.root(), otherNote.tree.witness());
+    builder2.AddSaplingOutput(otherSk.full_viewing_key().ovk, otherSk.default_address(), 25000, {});
+    auto tx2 = builder2.Build().GetTxOrThrow();
+
+    // The batch finds the same notes as looking at each transaction alone.
+    auto batch = wallet.FindMySaplingNotes(std::vector<CTransaction>{tx1, tx2, tx1}, 1);
+    ASSERT_EQ(3, batch.size());
+    EXPECT_EQ(2, batch[0].first.size());
+    EXPECT_EQ(0, batch[1].first.size());
+    EXPECT_TRUE(batch[0].first == wallet.FindMySaplingNotes(tx1, 1).first);
+    EXPECT_TRUE(batch[2].first == batch[0].first);
+
+    // The notes are still found when the keys are split into several shards.
+    auto master = GetTestMasterSaplingSpendingKey();
+    for (uint32_t i = 0; i < 2 * SAPLING_TRIAL_DECRYPTION_SHARD_KEYS; i++) {
+        ASSERT_TRUE(wallet.AddSaplingFullViewingKey(master.Derive(i | HARDENED_KEY_LIMIT).ToXFVK()));
+    }
+    auto sharded = wallet.FindMySaplingNotes(std::vector<CTransaction>{tx1, tx2}, 1);
+    EXPECT_TRUE(sharded[0].first == batch[0].first);
+    EXPECT_EQ(0, sharded[1].first.size());
+
+    // A key is only tried on outputs at or after its birthday height.
+    std::map<libzcash::SaplingIncomingViewingKey, int> mapBirthHeights;
+    mapBirthHeights[extfvk.ToIncomingViewingKey()] = 5;
+    std::vector<const CTransaction*> vptx{&tx1, &tx1};
+    auto born = wallet.FindMySaplingNotes(vptx, std::vector<int>{4, 5}, &mapBirthHeights);
+    EXPECT_EQ(0, born[0].first.size());
+    EXPECT_TRUE(born[1].first == batch[0].first);
+
+    // Revert to default
+    RegtestDeactivateSapling();
+}
+
 TEST(WalletTests, FindMySproutNotes) {
     SelectParams(CBaseChainParams::REGTEST);
     CWallet wallet(Params());
@@ -1715,6 +1804,87 @@ TEST(WalletTests, CachedWitnessesCleanIndex) {
     }
 }
 
+TEST(WalletTests, LazyWitnessesKeepHeightsOfNotesWithoutWitnesses) {
+    SelectParams(CBaseChainParams::REGTEST);
+    TestWallet wallet(Params());
+    LOCK(wallet.cs_wallet);
+
+    MerkleFrontiers frontiers;
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    wallet.AddSproutSpendingKey(sk);
+
+    // The Sapling notes of these blocks are never witnessed, as their
+    // transactions have no Sapling outputs, like notes whose witnesses were
+    // pruned once spent.
+    std::vector<CBlock> blocks(4);
+    std::vector<CBlockIndex> indices(4);
+    std::vector<SaplingOutPoint> saplingNotes;
+    auto witnessHeight = [&](const SaplingOutPoint& op) {
+        return wallet.mapWallet[op.hash].mapSaplingNoteData[op].witnessHeight;
+    };
+    for (size_t i = 0; i < 2; i++) {
+        indices[i].nHeight = i + 1;
+        saplingNotes.push_back(CreateValidBlock(wallet, sk, indices[i], blocks[i], frontiers).second);
+    }
+    for (const SaplingOutPoint& op : saplingNotes) {
+        EXPECT_EQ(2, witnessHeight(op));
+    }
+
+    // With -lazywitnesses, their heights still follow the chain.
+    fLazyWitnesses = true;
+    for (size_t i = 2; i < 4; i++) {
+        indices[i].nHeight = i + 1;
+        saplingNotes.push_back(CreateValidBlock(wallet, sk, indices[i], blocks[i], frontiers).second);
+    }
+    for (const SaplingOutPoint& op : saplingNotes) {
+        EXPECT_EQ(4, witnessHeight(op));
+    }
+
+    // Disconnecting a block takes them back below it.
+    wallet.DecrementNoteWitnesses(Params().GetConsensus(), &indices[3]);
+    for (const SaplingOutPoint& op : saplingNotes) {
+        EXPECT_EQ(3, witnessHeight(op));
+    }
+
+    // A height that fell behind is brought up to date when -lazywitnesses
+    // stops, so that the witnesses can be incremented again.
+    wallet.mapWallet[saplingNotes[0].hash].mapSaplingNoteData[saplingNotes[0]].witnessHeight = 1;
+    fLazyWitnesses = false;
+    wallet.IncrementNoteWitnesses(Params().GetConsensus(), &indices[3], &blocks[3], frontiers, true);
+    for (const SaplingOutPoint& op : saplingNotes) {
+        EXPECT_EQ(4, witnessHeight(op));
+    }
+}
+
+TEST(WalletTests, WitnessesSkipPoolsWithoutKeysOrNotes) {
+    SelectParams(CBaseChainParams::REGTEST);
+    TestWallet wallet(Params());
+    LOCK(wallet.cs_wallet);
+
+    auto sk = libzcash::SproutSpendingKey::random();
+    auto wtx = GetValidSproutReceive(sk, 50, true);
+    CBlock block;
+    block.vtx.push_back(wtx);
+    CBlockIndex index(block);
+    index.nHeight = 1;
+
+    // Without keys or notes, neither tree is appended to.
+    MerkleFrontiers frontiers;
+    auto emptySproutRoot = frontiers.sprout.root();
+    auto emptySaplingRoot = frontiers.sapling.root();
+    wallet.IncrementNoteWitnesses(Params().GetConsensus(), &index, &block, frontiers, true);
+    EXPECT_EQ(emptySproutRoot, frontiers.sprout.root());
+    EXPECT_EQ(emptySaplingRoot, frontiers.sapling.root());
+
+    // Once there is a Sprout key, the Sprout tree is.
+    wallet.AddSproutSpendingKey(sk);
+    MerkleFrontiers frontiers2;
+    wallet.IncrementNoteWitnesses(Params().GetConsensus(), &index, &block, frontiers2, true);
+    EXPECT_NE(emptySproutRoot, frontiers2.sprout.root());
+    EXPECT_EQ(emptySaplingRoot, frontiers2.sapling.root());
+}
+
 TEST(WalletTests, ClearNoteWitnessCache) {
     SelectParams(CBaseChainParams::REGTEST);
     TestWallet wallet(Params());
@@ -2461,6 +2631,57 @@ TEST(WalletTests, GenerateUnifiedAddress) {
     RegtestDeactivateSapling();
 }
 
+TEST(WalletTests, GenerateUnifiedAddresses) {
+    (void) RegtestActivateSapling();
+    TestWallet wallet(Params());
+    wallet.GenerateNewSeed();
+
+    LOCK(wallet.cs_wallet);
+
+    std::set<ReceiverType> receiverTypes = {ReceiverType::P2PKH, ReceiverType::Sapling};
+    auto batchResult = wallet.GenerateUnifiedAddresses(0, receiverTypes, 10);
+    WalletUABatchGenerationResult expected = WalletUAGenerationError::NoSuchAccount;
+    EXPECT_EQ(batchResult, expected);
+
+    auto ufvkpair = wallet.GenerateNewUnifiedSpendingKey();
+    auto ufvk = wallet.GetUnifiedFullViewingKeyByAccount(ufvkpair.second).value();
+
+    // The first address is generated on its own, and the batch continues
+    // from the next valid diversifier index.
+    auto uaResult = wallet.GenerateUnifiedAddress(ufvkpair.second, receiverTypes);
+    auto ua = std::get_if<std::pair<libzcash::UnifiedAddress, libzcash::diversifier_index_t>>(&uaResult);
+    ASSERT_NE(ua, nullptr);
+
+    batchResult = wallet.GenerateUnifiedAddresses(ufvkpair.second, receiverTypes, 50);
+    auto uas = std::get_if<std::vector<std::pair<libzcash::UnifiedAddress, libzcash::diversifier_index_t>>>(&batchResult);
+    ASSERT_NE(uas, nullptr);
+    ASSERT_EQ(uas->size(), 50);
+
+    // The batch holds the same addresses as generating them one at a time.
+    auto j = ua->second;
+    for (const auto& addr : *uas) {
+        ASSERT_TRUE(j.increment());
+        auto next = std::get<std::pair<libzcash::UnifiedAddress, libzcash::diversifier_index_t>>(
+            ufvk.FindAddress(j, receiverTypes));
+        EXPECT_EQ(addr, next);
+        j = next.second;
+
+        auto u4r = wallet.FindUnifiedAddressByReceiver(addr.first.GetSaplingReceiver().value());
+        ASSERT_TRUE(u4r.has_value());
+        EXPECT_EQ(u4r.value(), addr.first);
+        EXPECT_TRUE(wallet.HaveKey(addr.first.GetP2PKHReceiver().value()));
+    }
+
+    // Address generation continues after the batch.
+    uaResult = wallet.GenerateUnifiedAddress(ufvkpair.second, receiverTypes);
+    ua = std::get_if<std::pair<libzcash::UnifiedAddress, libzcash::diversifier_index_t>>(&uaResult);
+    ASSERT_NE(ua, nullptr);
+    EXPECT_TRUE(uas->back().second < ua->second);
+
+    // Revert to default
+    RegtestDeactivateSapling();
+}
+
 TEST(WalletTests, GenerateUnifiedSpendingKeyAddsOrchardAddresses) {
     (void) RegtestActivateSapling();
     TestWallet wallet(Params());
@@ -189,17 +189,21 @@ class OrchardWallet
 {
 private:
     std::unique_ptr<OrchardWalletPtr, decltype(&orchard_wallet_free)> inner;
+    //! Whether a spending or full viewing key was added, so that the wallet
+    //! can skip the Orchard tree until it has one.
+    bool fHasKeys = false;
 
     friend class ::orchard::UnauthorizedBundle;
     friend class OrchardWalletNoteCommitmentTreeWriter;
     friend class OrchardWalletNoteCommitmentTreeLoader;
 public:
     OrchardWallet() : inner(orchard_wallet_new(), orchard_wallet_free) {}
-    OrchardWallet(OrchardWallet&& wallet_data) : inner(std::move(wallet_data.inner)) {}
+    OrchardWallet(OrchardWallet&& wallet_data) : inner(std::move(wallet_data.inner)), fHasKeys(wallet_data.fHasKeys) {}
     OrchardWallet& operator=(OrchardWallet&& wallet)
     {
         if (this != &wallet) {
             inner = std::move(wallet.inner);
+            fHasKeys = wallet.fHasKeys;
         }
         return *this;
     }
@@ -293,6 +297,45 @@ public:
         }
     }
 
+    /**
+     * As AddNotesIfInvolvingMe, for each of the transactions of a block in
+     * order. The actions of all of them are trial-decrypted together across
+     * threads, in a single call into the wallet.
+     */
+    std::vector<std::optional<OrchardWalletTxMeta>> AddNotesIfInvolvingMe(const std::vector<const CTransaction*>& vtx) {
+        std::vector<OrchardWalletTxMeta> vTxMeta(vtx.size());
+        std::vector<uint256> vTxids;
+        std::vector<const OrchardBundlePtr*> vBundles;
+        std::vector<void*> vReceivers;
+        vTxids.reserve(vtx.size());
+        vBundles.reserve(vtx.size());
+        vReceivers.reserve(vtx.size());
+        for (size_t i = 0; i < vtx.size(); i++) {
+            vTxids.push_back(vtx[i]->GetHash());
+            vBundles.push_back(vtx[i]->GetOrchardBundle().inner.get());
+            vReceivers.push_back(&vTxMeta[i]);
+        }
+        std::unique_ptr<bool[]> involved(new bool[vtx.size()]());
+        static_assert(sizeof(uint256) == 32, "uint256 must be passed as 32 bytes");
+        orchard_wallet_add_notes_from_bundles(
+                inner.get(),
+                reinterpret_cast<const unsigned char (*)[32]>(vTxids.data()),
+                vBundles.data(),
+                vtx.size(),
+                vReceivers.data(),
+                PushOrchardActionIVK,
+                PushSpendActionIdx,
+                involved.get());
+
+        std::vector<std::optional<OrchardWalletTxMeta>> result(vtx.size());
+        for (size_t i = 0; i < vtx.size(); i++) {
+            if (involved[i]) {
+                result[i] = std::move(vTxMeta[i]);
+            }
+        }
+        return result;
+    }
+
     /**
      * Decrypts a selection of notes from the specified transaction's
      * Orchard bundle with provided incoming viewing keys, and adds those
@@ -354,10 +397,20 @@ public:
 
     void AddSpendingKey(const libzcash::OrchardSpendingKey& sk) {
         orchard_wallet_add_spending_key(inner.get(), sk.inner.get());
+        fHasKeys = true;
     }
 
     void AddFullViewingKey(const libzcash::OrchardFullViewingKey& fvk) {
         orchard_wallet_add_full_viewing_key(inner.get(), fvk.inner.get());
+        fHasKeys = true;
+    }
+
+    /**
+     * Return whether any spending or full viewing key has been added, that
+     * is, whether any note could be decrypted.
+     */
+    bool HasKeys() const {
+        return fHasKeys;
     }
 
     std::optional<libzcash::OrchardSpendingKey> GetSpendingKeyForAddress(
@@ -449,6 +502,27 @@ public:
         orchard_wallet_gc_note_commitment_tree(inner.get());
     }
 
+    /**
+     * Stop witnessing the notes spent by the given transactions, which must
+     * be too deep to be reorganized away. Returns the number of notes that
+     * were witnessed until now.
+     */
+    size_t ForgetSpentNoteWitnesses(const std::vector<uint256>& spendingTxids) {
+        static_assert(sizeof(uint256) == 32, "uint256 must be passed as 32 bytes");
+        return orchard_wallet_forget_spent_note_witnesses(
+                inner.get(),
+                reinterpret_cast<const unsigned char (*)[32]>(spendingTxids.data()),
+                spendingTxids.size());
+    }
+
+    /**
+     * An estimate of the memory used by the Rust wallet state; see
+     * orchard_wallet_dynamic_usage.
+     */
+    size_t DynamicMemoryUsage() const {
+        return orchard_wallet_dynamic_usage(inner.get());
+    }
+
     static void PushSpendAction(void* receiver, RawOrchardActionSpend rawSpend) {
         uint256 txid;
         std::move(std::begin(rawSpend.outpointTxId), std::end(rawSpend.outpointTxId), txid.begin());
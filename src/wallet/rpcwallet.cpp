@@ -36,6 +36,7 @@
 #include "util/time.h"
 #include "asyncrpcoperation.h"
 #include "asyncrpcqueue.h"
+#include "wallet/asyncrpcoperation_batch.h"
 #include "wallet/asyncrpcoperation_mergetoaddress.h"
 #include "wallet/asyncrpcoperation_saplingmigration.h"
 #include "wallet/asyncrpcoperation_sendmany.h"
@@ -64,6 +65,9 @@ const std::string ADDR_TYPE_SPROUT = "sprout";
 const std::string ADDR_TYPE_SAPLING = "sapling";
 const std::string ADDR_TYPE_ORCHARD = "orchard";
 
+// The largest number of addresses z_getaddressesforaccount derives in one call.
+static const int64_t MAX_ADDRESSES_PER_ACCOUNT_REQUEST = 100000;
+
 extern UniValue TxJoinSplitToJSON(const CTransaction& tx);
 
 int64_t nWalletUnlockTime;
@@ -1678,7 +1682,7 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
     UniValue transactions(UniValue::VARR);
 
     for (const std::pair<const uint256, CWalletTx>& pairWtx : pwalletMain->mapWallet) {
-        CWalletTx tx = pairWtx.second;
+        const CWalletTx& tx = pairWtx.second;
 
         if (depth == -1 || tx.GetDepthInMainChain() < depth) {
             ListTransactions(tx, 0, true, transactions, filter);
@@ -1807,8 +1811,9 @@ UniValue backupwallet(const UniValue& params, bool fHelp)
             + HelpExampleRpc("backupwallet", "\"backupdata\"")
         );
 
-    LOCK2(cs_main, pwalletMain->cs_wallet);
-
+    // The wallet locks are not held while the file is copied: BackupWallet
+    // waits until the database is not in use, and keeps it from being opened
+    // until the copy is done, so transactions can still be created meanwhile.
     fs::path exportdir;
     try {
         exportdir = GetExportDir();
@@ -2865,7 +2870,17 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             }
 #endif
         } else if (benchmarktype == "verifyequihash") {
-            sample_times.push_back(benchmark_verify_equihash());
+            if (params.size() < 3) {
+                sample_times.push_back(benchmark_verify_equihash());
+            } else {
+                // Divide by the number of headers to get the average seconds
+                // per header verified in a batch.
+                int nHeaders = params[2].get_int();
+                if (nHeaders <= 0) {
+                    throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid number of headers");
+                }
+                sample_times.push_back(benchmark_verify_equihash_batch(nHeaders) / nHeaders);
+            }
         } else if (benchmarktype == "validatelargetx") {
             // Number of inputs in the spending transaction that we will simulate
             int nInputs = 11130;
@@ -2913,8 +2928,22 @@ UniValue zc_benchmark(const UniValue& params, bool fHelp)
             sample_times.push_back(benchmark_loadwallet());
         } else if (benchmarktype == "listunspent") {
             sample_times.push_back(benchmark_listunspent());
+        } else if (benchmarktype == "selectcoins") {
+            int nCoins = 10000;
+            if (params.size() >= 3) {
+                nCoins = params[2].get_int();
+            }
+            sample_times.push_back(benchmark_select_coins(nCoins));
         } else if (benchmarktype == "createsaplingspend") {
-            sample_times.push_back(benchmark_create_sapling_spend());
+            if (params.size() < 3) {
+                sample_times.push_back(benchmark_create_sapling_spend());
+            } else {
+                int nThreads = params[2].get_int();
+                std::vector<double> vals = benchmark_create_sapling_spend_threaded(nThreads);
+                // Divide by nThreads^2 to get average seconds per proof because
+                // we are creating one proof per thread.
+                sample_times.push_back(std::accumulate(vals.begin(), vals.end(), 0.0) / (nThreads*nThreads));
+            }
         } else if (benchmarktype == "createsaplingoutput") {
             sample_times.push_back(benchmark_create_sapling_output());
         } else if (benchmarktype == "verifysaplingspend") {
@@ -3389,6 +3418,47 @@ UniValue z_getnewaccount(const UniValue& params, bool fHelp)
     return result;
 }
 
+static std::set<libzcash::ReceiverType> ParseReceiverTypes(const UniValue& param)
+{
+    std::set<libzcash::ReceiverType> receiverTypes;
+    const auto& parsed = param.get_array();
+    for (size_t i = 0; i < parsed.size(); i++) {
+        const std::string& p = parsed[i].get_str();
+        if (p == "p2pkh") {
+            receiverTypes.insert(ReceiverType::P2PKH);
+        } else if (p == "sapling") {
+            receiverTypes.insert(ReceiverType::Sapling);
+        } else if (p == "orchard") {
+            receiverTypes.insert(ReceiverType::Orchard);
+        } else {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "receiver type arguments must be \"p2pkh\", \"sapling\", or \"orchard\"");
+        }
+    }
+    return receiverTypes;
+}
+
+static UniValue ReceiverTypesToJSON(const std::set<libzcash::ReceiverType>& receiverTypes)
+{
+    UniValue receiver_types(UniValue::VARR);
+    for (const auto& receiverType : receiverTypes) {
+        switch (receiverType) {
+            case ReceiverType::P2PKH:
+                receiver_types.push_back("p2pkh");
+                break;
+            case ReceiverType::Sapling:
+                receiver_types.push_back("sapling");
+                break;
+            case ReceiverType::Orchard:
+                receiver_types.push_back("orchard");
+                break;
+            default:
+                // Unreachable
+                assert(false);
+        }
+    }
+    return receiver_types;
+}
+
 UniValue z_getaddressforaccount(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
@@ -3436,19 +3506,7 @@ UniValue z_getaddressforaccount(const UniValue& params, bool fHelp)
 
     std::set<libzcash::ReceiverType> receiverTypes;
     if (params.size() >= 2) {
-        const auto& parsed = params[1].get_array();
-        for (size_t i = 0; i < parsed.size(); i++) {
-            const std::string& p = parsed[i].get_str();
-            if (p == "p2pkh") {
-                receiverTypes.insert(ReceiverType::P2PKH);
-            } else if (p == "sapling") {
-                receiverTypes.insert(ReceiverType::Sapling);
-            } else if (p == "orchard") {
-                receiverTypes.insert(ReceiverType::Orchard);
-            } else {
-                throw JSONRPCError(RPC_INVALID_PARAMETER, "receiver type arguments must be \"p2pkh\", \"sapling\", or \"orchard\"");
-            }
-        }
+        receiverTypes = ParseReceiverTypes(params[1]);
     }
     if (receiverTypes.empty()) {
         // Default is the best and second-best shielded receiver types, and the transparent (P2PKH) receiver type.
@@ -3536,24 +3594,133 @@ UniValue z_getaddressforaccount(const UniValue& params, bool fHelp)
         },
     }, res);
 
-    UniValue receiver_types(UniValue::VARR);
-    for (const auto& receiverType : receiverTypes) {
-        switch (receiverType) {
-            case ReceiverType::P2PKH:
-                receiver_types.push_back("p2pkh");
-                break;
-            case ReceiverType::Sapling:
-                receiver_types.push_back("sapling");
-                break;
-            case ReceiverType::Orchard:
-                receiver_types.push_back("orchard");
-                break;
-            default:
-                // Unreachable
-                assert(false);
-        }
+    result.pushKV("receiver_types", ReceiverTypesToJSON(receiverTypes));
+
+    return result;
+}
+
+UniValue z_getaddressesforaccount(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+    if (fHelp || params.size() < 2 || params.size() > 3)
+        throw runtime_error(
+            "z_getaddressesforaccount account count ( [\"receiver_type\", ...] )\n"
+            "\nFor the given account number, derives the next count Unified Addresses at"
+            "\nthe next unused diversifier indices that are valid for the list of receiver"
+            "\ntypes. This is equivalent to calling z_getaddressforaccount count times"
+            "\nwithout a diversifier index, but derives the addresses in parallel and"
+            "\nrecords them in the wallet together.\n"
+            "\nIf no list of receiver types is given (or the empty list \"[]\"), the same"
+            "\ndefault as for z_getaddressforaccount is used.\n"
+            "\nArguments:\n"
+            "1. account          (numeric, required) The account number, previously generated by z_getnewaccount.\n"
+            "2. count            (numeric, required) The number of addresses to derive, from 1 to "
+            + strprintf("%d", MAX_ADDRESSES_PER_ACCOUNT_REQUEST) + ".\n"
+            "3. receiver_types   (array, optional) The receiver types that the UAs contain.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"account\": n,                          (numeric) the specified account number\n"
+            "  \"receiver_types\": [\"orchard\",...]\",   (json array of string) the receiver types that the UAs contain (valid values are \"p2pkh\", \"sapling\", \"orchard\")\n"
+            "  \"addresses\": [\n"
+            "    {\n"
+            "      \"diversifier_index\": n,            (numeric) the index chosen\n"
+            "      \"address\"                          (string) The corresponding address\n"
+            "    }, ...\n"
+            "  ]\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_getaddressesforaccount", "4 1000")
+            + HelpExampleCli("z_getaddressesforaccount", "4 1000 '[\"sapling\",\"orchard\"]'")
+            + HelpExampleRpc("z_getaddressesforaccount", "4, 1000")
+        );
+
+    // cs_main is required for obtaining the current height, for
+    // CWallet::DefaultReceiverTypes
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+
+    int64_t accountInt = params[0].get_int64();
+    if (accountInt < 0 || accountInt >= ZCASH_LEGACY_ACCOUNT) {
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid account number, must be 0 <= account <= (2^31)-2.");
+    }
+    libzcash::AccountId account = accountInt;
+
+    int64_t count = params[1].get_int64();
+    if (count < 1 || count > MAX_ADDRESSES_PER_ACCOUNT_REQUEST) {
+        throw JSONRPCError(
+            RPC_INVALID_PARAMETER,
+            strprintf("Invalid count, must be between 1 and %d.", MAX_ADDRESSES_PER_ACCOUNT_REQUEST));
     }
-    result.pushKV("receiver_types", receiver_types);
+
+    std::set<libzcash::ReceiverType> receiverTypes;
+    if (params.size() >= 3) {
+        receiverTypes = ParseReceiverTypes(params[2]);
+    }
+    if (receiverTypes.empty()) {
+        receiverTypes = CWallet::DefaultReceiverTypes(chainActive.Height());
+    }
+
+    EnsureWalletIsUnlocked();
+    EnsureWalletIsBackedUp(Params());
+
+    auto res = pwalletMain->GenerateUnifiedAddresses(account, receiverTypes, count);
+
+    UniValue result(UniValue::VOBJ);
+    result.pushKV("account", (uint64_t)account);
+    result.pushKV("receiver_types", ReceiverTypesToJSON(receiverTypes));
+
+    std::visit(match {
+        [&](const std::vector<std::pair<libzcash::UnifiedAddress, libzcash::diversifier_index_t>>& addrs) {
+            KeyIO keyIO(Params());
+            UniValue addresses(UniValue::VARR);
+            for (const auto& addr : addrs) {
+                UniValue entry(UniValue::VOBJ);
+                UniValue j;
+                j.setNumStr(ArbitraryIntStr(std::vector(addr.second.begin(), addr.second.end())));
+                entry.pushKV("diversifier_index", j);
+                entry.pushKV("address", keyIO.EncodePaymentAddress(addr.first));
+                addresses.push_back(entry);
+            }
+            result.pushKV("addresses", addresses);
+        },
+        [&](WalletUAGenerationError err) {
+            std::string strErr;
+            switch (err) {
+                case WalletUAGenerationError::NoSuchAccount:
+                    strErr = tfm::format("Error: account %d has not been generated by z_getnewaccount.", account);
+                    break;
+                case WalletUAGenerationError::ExistingAddressMismatch:
+                    // Addresses are only generated at unused diversifier indices.
+                    assert(false);
+                case WalletUAGenerationError::WalletEncrypted:
+                    strErr = tfm::format("Error: wallet is encrypted.");
+            }
+            throw JSONRPCError(RPC_WALLET_ERROR, strErr);
+        },
+        [&](UnifiedAddressGenerationError err) {
+            std::string strErr;
+            switch (err) {
+                case UnifiedAddressGenerationError::NoAddressForDiversifier:
+                case UnifiedAddressGenerationError::InvalidTransparentChildIndex:
+                    strErr = tfm::format(
+                        "Error: ran out of diversifier indices that can generate an address with a transparent receiver.");
+                    break;
+                case UnifiedAddressGenerationError::ShieldedReceiverNotFound:
+                    strErr = tfm::format(
+                        "Error: cannot generate an address containing no shielded receivers.");
+                    break;
+                case UnifiedAddressGenerationError::ReceiverTypeNotAvailable:
+                    strErr = tfm::format(
+                        "Error: one or more of the requested receiver types does not have a corresponding spending key in this account.");
+                    break;
+                case UnifiedAddressGenerationError::DiversifierSpaceExhausted:
+                    strErr = tfm::format(
+                        "Error: ran out of diversifier indices. Generate a new account with z_getnewaccount");
+                    break;
+            }
+            throw JSONRPCError(RPC_WALLET_ERROR, strErr);
+        },
+    }, res);
 
     return result;
 }
@@ -4549,7 +4716,7 @@ UniValue z_viewtransaction(const UniValue& params, bool fHelp)
                 continue;
             }
             auto jsop = res->second;
-            auto wtxPrev = pwalletMain->mapWallet.at(jsop.hash);
+            const CWalletTx& wtxPrev = pwalletMain->mapWallet.at(jsop.hash);
 
             auto decrypted = wtxPrev.DecryptSproutNote(jsop);
             auto notePt = decrypted.first;
@@ -4643,7 +4810,7 @@ UniValue z_viewtransaction(const UniValue& params, bool fHelp)
             continue;
         }
         auto op = res->second;
-        auto wtxPrev = pwalletMain->mapWallet.at(op.hash);
+        const CWalletTx& wtxPrev = pwalletMain->mapWallet.at(op.hash);
 
         // We don't need to check the leadbyte here: if wtx exists in
         // the wallet, it must have been successfully decrypted. This
@@ -5008,6 +5175,8 @@ UniValue z_sendmany(const UniValue& params, bool fHelp)
             "\naddress, while change generated from a shielded address returns to itself."
             "\nWhen sending coinbase UTXOs to a shielded address, change is not allowed."
             "\nThe entire value of the UTXO(s) must be consumed."
+            "\nWith -sendmanybatchwindow, requests made soon after each other from the same fromaddress"
+            "\nand with the same minconf, fee and privacyPolicy are paid by one transaction.\n"
             + strprintf("\nBefore Sapling activates, the maximum number of zaddr outputs is %d due to transaction size limits.\n", Z_SENDMANY_MAX_ZADDR_OUTPUTS_BEFORE_SAPLING)
             + HelpRequiringPassphrase() + "\n"
             "\nArguments:\n"
@@ -5315,11 +5484,11 @@ UniValue z_sendmany(const UniValue& params, bool fHelp)
 
     // Create operation and add to global queue
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::shared_ptr<AsyncRPCOperation> operation(
+    std::shared_ptr<AsyncRPCOperation_sendmany> operation(
             new AsyncRPCOperation_sendmany(
                 std::move(builder), ztxoSelector, recipients, nMinDepth, nAnchorDepth, strategy, nFee, contextInfo)
             );
-    q->addOperation(operation);
+    AsyncRPCOperation_sendmany::Queue(q, operation, fromaddress, nextBlockHeight);
     AsyncRPCOperationId operationId = operation->getId();
     return operationId;
 }
@@ -5403,7 +5572,7 @@ UniValue z_getmigrationstatus(const UniValue& params, bool fHelp) {
     int numFinalizedMigrationTxs = 0;
     uint64_t timeStarted = 0;
     for (const auto& txPair : pwalletMain->mapWallet) {
-        CWalletTx tx = txPair.second;
+        const CWalletTx& tx = txPair.second;
         // A given transaction is defined as a migration transaction iff it has:
         // * one or more Sprout JoinSplits with nonzero vpub_new field; and
         // * no Sapling Spends, and;
@@ -5471,9 +5640,9 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() < 2 || params.size() > 4)
+    if (fHelp || params.size() < 2 || params.size() > 5)
         throw runtime_error(
-            "z_shieldcoinbase \"fromaddress\" \"tozaddress\" ( fee ) ( limit )\n"
+            "z_shieldcoinbase \"fromaddress\" \"tozaddress\" ( fee ) ( limit ) ( transactions )\n"
             "\nShield transparent coinbase funds by sending to a shielded zaddr.  This is an asynchronous operation and utxos"
             "\nselected for shielding will be locked.  If there is an error, they are unlocked.  The RPC call `listlockunspent`"
             "\ncan be used to return a list of locked utxos.  The number of coinbase utxos selected for shielding can be limited"
@@ -5488,12 +5657,16 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
             + strprintf("%s", FormatMoney(DEFAULT_FEE)) + ") The fee amount to attach to this transaction.\n"
             "4. limit                 (numeric, optional, default="
             + strprintf("%d", SHIELD_COINBASE_DEFAULT_LIMIT) + ") Limit on the maximum number of utxos to shield.  Set to 0 to use as many as will fit in the transaction.\n"
+            "5. transactions          (numeric, optional, default=1) The maximum number of transactions to shield utxos in, each with up to\n"
+            "                         limit utxos and paying fee. The transactions are built and proved concurrently under the one\n"
+            "                         operation id, and z_getoperationstatus reports the status of each of them.\n"
             "\nResult:\n"
             "{\n"
             "  \"remainingUTXOs\": xxx       (numeric) Number of coinbase utxos still available for shielding.\n"
             "  \"remainingValue\": xxx       (numeric) Value of coinbase utxos still available for shielding.\n"
             "  \"shieldingUTXOs\": xxx        (numeric) Number of coinbase utxos being shielded.\n"
             "  \"shieldingValue\": xxx        (numeric) Value of coinbase utxos being shielded.\n"
+            "  \"shieldingTransactions\": xxx (numeric) Number of transactions the utxos are being shielded in.\n"
             "  \"opid\": xxx          (string) An operationid to pass to z_getoperationstatus to get the result of the operation.\n"
             "}\n"
             "\nExamples:\n"
@@ -5576,6 +5749,14 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
         }
     }
 
+    int nTransactions = 1;
+    if (params.size() > 4) {
+        nTransactions = params[4].get_int();
+        if (nTransactions < 1) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Maximum number of transactions must be at least 1");
+        }
+    }
+
     const bool saplingActive =  Params().GetConsensus().NetworkUpgradeActive(nextBlockHeight, Consensus::UPGRADE_SAPLING);
 
     // We cannot create shielded transactions before Sapling activates.
@@ -5588,11 +5769,12 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
     assert(overwinterActive);
     unsigned int max_tx_size = MAX_TX_SIZE_AFTER_SAPLING;
 
-    // Prepare to get coinbase utxos
-    std::vector<ShieldCoinbaseUTXO> inputs;
-    CAmount shieldedValue = 0;
+    // Prepare to get coinbase utxos, in up to nTransactions transactions
+    std::vector<std::vector<ShieldCoinbaseUTXO>> vInputs(1);
+    std::vector<CAmount> vShieldedValue(1, 0);
     CAmount remainingValue = 0;
-    size_t estimatedTxSize = 2000;  // 1802 joinsplit description + tx overhead + wiggle room
+    const size_t baseTxSize = 2000;  // 1802 joinsplit description + tx overhead + wiggle room
+    size_t estimatedTxSize = baseTxSize;
     size_t utxoCounter = 0;
     bool maxedOutFlag = false;
     const size_t mempoolLimit = nLimit;
@@ -5628,14 +5810,21 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
         if (!maxedOutFlag) {
             size_t increase = (std::get_if<CScriptID>(&address) != nullptr) ? CTXIN_SPEND_P2SH_SIZE : CTXIN_SPEND_DUST_SIZE;
             if (estimatedTxSize + increase >= max_tx_size ||
-                (mempoolLimit > 0 && utxoCounter > mempoolLimit))
+                (mempoolLimit > 0 && vInputs.back().size() >= mempoolLimit))
             {
-                maxedOutFlag = true;
-            } else {
+                if (vInputs.size() < (size_t)nTransactions) {
+                    vInputs.emplace_back();
+                    vShieldedValue.push_back(0);
+                    estimatedTxSize = baseTxSize;
+                } else {
+                    maxedOutFlag = true;
+                }
+            }
+            if (!maxedOutFlag) {
                 estimatedTxSize += increase;
                 ShieldCoinbaseUTXO utxo = {out.tx->GetHash(), out.i, scriptPubKey, nValue};
-                inputs.push_back(utxo);
-                shieldedValue += nValue;
+                vInputs.back().push_back(utxo);
+                vShieldedValue.back() += nValue;
             }
         }
 
@@ -5644,24 +5833,37 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
         }
     }
 
-    size_t numUtxos = inputs.size();
-
-    if (numUtxos == 0) {
+    if (vInputs[0].empty()) {
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Could not find any coinbase funds to shield.");
     }
 
-    if (shieldedValue < nFee) {
+    if (vShieldedValue[0] < nFee) {
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS,
             strprintf("Insufficient coinbase funds, have %s, which is less than miners fee %s",
-            FormatMoney(shieldedValue), FormatMoney(nFee)));
+            FormatMoney(vShieldedValue[0]), FormatMoney(nFee)));
     }
 
     // Check that the user specified fee is sane (if too high, it can result in error -25 absurd fee)
-    CAmount netAmount = shieldedValue - nFee;
+    CAmount netAmount = vShieldedValue[0] - nFee;
     if (nFee > netAmount) {
         throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Fee %s is greater than the net amount to be shielded %s", FormatMoney(nFee), FormatMoney(netAmount)));
     }
 
+    // A later transaction that would fail the checks above is left out, and
+    // its utxos are left for a later call.
+    while (vInputs.size() > 1 && vShieldedValue.back() - nFee < nFee) {
+        remainingValue += vShieldedValue.back();
+        vInputs.pop_back();
+        vShieldedValue.pop_back();
+    }
+
+    size_t numUtxos = 0;
+    CAmount shieldedValue = 0;
+    for (size_t i = 0; i < vInputs.size(); i++) {
+        numUtxos += vInputs[i].size();
+        shieldedValue += vShieldedValue[i];
+    }
+
     // Keep record of parameters in context object
     UniValue contextInfo(UniValue::VOBJ);
     contextInfo.pushKV("fromaddress", params[0]);
@@ -5679,8 +5881,6 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
             orchardAnchor = anchorBlockIndex->hashFinalOrchardRoot;
         }
     }
-    TransactionBuilder builder = TransactionBuilder(
-        Params().GetConsensus(), nextBlockHeight, orchardAnchor, pwalletMain);
 
     // Contextual transaction we will build on
     // (used if no Sapling addresses are involved)
@@ -5693,8 +5893,24 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
 
     // Create operation and add to global queue
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::shared_ptr<AsyncRPCOperation> operation( new AsyncRPCOperation_shieldcoinbase(
-        std::move(builder), contextualTx, inputs, destaddress.value(), nFee, contextInfo) );
+    std::shared_ptr<AsyncRPCOperation> operation;
+    if (vInputs.size() == 1) {
+        TransactionBuilder builder = TransactionBuilder(
+            Params().GetConsensus(), nextBlockHeight, orchardAnchor, pwalletMain);
+        operation.reset(new AsyncRPCOperation_shieldcoinbase(
+            std::move(builder), contextualTx, vInputs[0], destaddress.value(), nFee, contextInfo));
+    } else {
+        std::vector<std::shared_ptr<AsyncRPCOperation>> operations;
+        for (const auto& inputs : vInputs) {
+            TransactionBuilder builder = TransactionBuilder(
+                Params().GetConsensus(), nextBlockHeight, orchardAnchor, pwalletMain);
+            auto txOperation = new AsyncRPCOperation_shieldcoinbase(
+                std::move(builder), contextualTx, inputs, destaddress.value(), nFee);
+            txOperation->pauseMining = false;
+            operations.emplace_back(txOperation);
+        }
+        operation.reset(new AsyncRPCOperation_batch("z_shieldcoinbase", operations, contextInfo));
+    }
     q->addOperation(operation);
     AsyncRPCOperationId operationId = operation->getId();
 
@@ -5704,6 +5920,7 @@ UniValue z_shieldcoinbase(const UniValue& params, bool fHelp)
     o.pushKV("remainingValue", ValueFromAmount(remainingValue));
     o.pushKV("shieldingUTXOs", static_cast<uint64_t>(numUtxos));
     o.pushKV("shieldingValue", ValueFromAmount(shieldedValue));
+    o.pushKV("shieldingTransactions", static_cast<uint64_t>(vInputs.size()));
     o.pushKV("opid", operationId);
     return o;
 }
@@ -5718,9 +5935,9 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() < 2 || params.size() > 6)
+    if (fHelp || params.size() < 2 || params.size() > 7)
         throw runtime_error(
-            "z_mergetoaddress [\"fromaddress\", ... ] \"toaddress\" ( fee ) ( transparent_limit ) ( shielded_limit ) ( memo )\n"
+            "z_mergetoaddress [\"fromaddress\", ... ] \"toaddress\" ( fee ) ( transparent_limit ) ( shielded_limit ) ( memo ) ( transactions )\n"
             "\nMerge multiple UTXOs and notes into a single UTXO or note.  Coinbase UTXOs are ignored; use `z_shieldcoinbase`"
             "\nto combine those into a single note."
             "\n\nThis is an asynchronous operation, and UTXOs selected for merging will be locked.  If there is an error, they"
@@ -5752,6 +5969,10 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
             "5. shielded_limit        (numeric, optional, default="
             + strprintf("%d Sprout or %d Sapling Notes", MERGE_TO_ADDRESS_DEFAULT_SPROUT_LIMIT, MERGE_TO_ADDRESS_DEFAULT_SAPLING_LIMIT) + ") Limit on the maximum number of notes to merge.  Set to 0 to merge as many as will fit in the transaction.\n"
             "6. \"memo\"                (string, optional) Encoded as hex. When toaddress is a zaddr, this will be stored in the memo field of the new note.\n"
+            "                         An empty string is the same as no memo.\n"
+            "7. transactions          (numeric, optional, default=1) The maximum number of transactions to merge in, each with up to\n"
+            "                         the limits above and paying fee. The transactions are built and proved concurrently under the\n"
+            "                         one operation id, and z_getoperationstatus reports the status of each of them.\n"
             "\nResult:\n"
             "{\n"
             "  \"remainingUTXOs\": xxx               (numeric) Number of UTXOs still available for merging.\n"
@@ -5762,6 +5983,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
             "  \"mergingTransparentValue\": xxx      (numeric) Value of UTXOs being merged.\n"
             "  \"mergingNotes\": xxx                 (numeric) Number of notes being merged.\n"
             "  \"mergingShieldedValue\": xxx         (numeric) Value of notes being merged.\n"
+            "  \"mergingTransactions\": xxx          (numeric) Number of transactions the UTXOs and notes are being merged in.\n"
             "  \"opid\": xxx                         (string) An operationid to pass to z_getoperationstatus to get the result of the operation.\n"
             "}\n"
             "\nExamples:\n"
@@ -5922,7 +6144,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
     }
 
     std::string memo;
-    if (params.size() > 5) {
+    if (params.size() > 5 && !params[5].get_str().empty()) {
         memo = params[5].get_str();
         if (!(isToSproutZaddr || isToSaplingZaddr)) {
             throw JSONRPCError(RPC_INVALID_PARAMETER, "Memo can not be used with a taddr.  It can only be used with a zaddr.");
@@ -5934,14 +6156,28 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         }
     }
 
+    int nTransactions = 1;
+    if (params.size() > 6) {
+        nTransactions = params[6].get_int();
+        if (nTransactions < 1) {
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Maximum number of transactions must be at least 1");
+        }
+    }
+
     MergeToAddressRecipient recipient(destaddress.value(), memo);
 
-    // Prepare to get UTXOs and notes
-    std::vector<MergeToAddressInputUTXO> utxoInputs;
-    std::vector<MergeToAddressInputSproutNote> sproutNoteInputs;
-    std::vector<MergeToAddressInputSaplingNote> saplingNoteInputs;
-    CAmount mergedUTXOValue = 0;
-    CAmount mergedNoteValue = 0;
+    // Prepare to get UTXOs and notes, in up to nTransactions transactions.
+    // UTXOs fill the transactions first, and notes fill what is left of them.
+    struct MergeGroup {
+        std::vector<MergeToAddressInputUTXO> utxoInputs;
+        std::vector<MergeToAddressInputSproutNote> sproutNoteInputs;
+        std::vector<MergeToAddressInputSaplingNote> saplingNoteInputs;
+        CAmount utxoValue = 0;
+        CAmount noteValue = 0;
+        size_t estimatedTxSize;
+
+        size_t NumNotes() const { return sproutNoteInputs.size() + saplingNoteInputs.size(); }
+    };
     CAmount remainingUTXOValue = 0;
     CAmount remainingNoteValue = 0;
     size_t utxoCounter = 0;
@@ -5951,12 +6187,23 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
     const size_t mempoolLimit = nUTXOLimit;
 
     unsigned int max_tx_size = saplingActive ? MAX_TX_SIZE_AFTER_SAPLING : MAX_TX_SIZE_BEFORE_SAPLING;
-    size_t estimatedTxSize = 200;  // tx overhead + wiggle room
+    size_t baseTxSize = 200;  // tx overhead + wiggle room
     if (isToSproutZaddr) {
-        estimatedTxSize += JOINSPLIT_SIZE(SAPLING_TX_VERSION); // We assume that sapling has activated
+        baseTxSize += JOINSPLIT_SIZE(SAPLING_TX_VERSION); // We assume that sapling has activated
     } else if (isToSaplingZaddr) {
-        estimatedTxSize += OUTPUTDESCRIPTION_SIZE;
+        baseTxSize += OUTPUTDESCRIPTION_SIZE;
     }
+    std::vector<MergeGroup> vGroups(1);
+    vGroups[0].estimatedTxSize = baseTxSize;
+    // Start another transaction if fewer than nTransactions have been started.
+    auto addGroup = [&]() {
+        if (vGroups.size() >= (size_t)nTransactions) {
+            return false;
+        }
+        vGroups.emplace_back();
+        vGroups.back().estimatedTxSize = baseTxSize;
+        return true;
+    };
 
     if (useAnyUTXO || taddrs.size() > 0) {
         // Get available utxos
@@ -5985,15 +6232,17 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
 
             if (!maxedOutUTXOsFlag) {
                 size_t increase = (std::get_if<CScriptID>(&address) != nullptr) ? CTXIN_SPEND_P2SH_SIZE : CTXIN_SPEND_DUST_SIZE;
-                if (estimatedTxSize + increase >= max_tx_size ||
-                    (mempoolLimit > 0 && utxoCounter > mempoolLimit))
+                if (vGroups.back().estimatedTxSize + increase >= max_tx_size ||
+                    (mempoolLimit > 0 && vGroups.back().utxoInputs.size() >= mempoolLimit))
                 {
-                    maxedOutUTXOsFlag = true;
-                } else {
-                    estimatedTxSize += increase;
+                    maxedOutUTXOsFlag = !addGroup();
+                }
+                if (!maxedOutUTXOsFlag) {
+                    MergeGroup& group = vGroups.back();
+                    group.estimatedTxSize += increase;
                     COutPoint utxo(out.tx->GetHash(), out.i);
-                    utxoInputs.emplace_back(utxo, nValue, scriptPubKey);
-                    mergedUTXOValue += nValue;
+                    group.utxoInputs.emplace_back(utxo, nValue, scriptPubKey);
+                    group.utxoValue += nValue;
                 }
             }
 
@@ -6038,27 +6287,35 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
                 "Cannot send between Sprout and Sapling addresses using z_mergetoaddress");
         }
 
-        // Find unspent notes and update estimated size
+        // Find unspent notes and update estimated size, moving on to the next
+        // transaction when one is full
+        size_t noteGroup = 0;
         for (const SproutNoteEntry& entry : sproutEntries) {
             noteCounter++;
             CAmount nValue = entry.note.value();
 
-            if (!maxedOutNotesFlag) {
+            while (!maxedOutNotesFlag) {
+                MergeGroup& group = vGroups[noteGroup];
                 // If we haven't added any notes yet and the merge is to a
                 // z-address, we have already accounted for the first JoinSplit.
-                size_t increase = (sproutNoteInputs.empty() && !isToSproutZaddr) || (sproutNoteInputs.size() % 2 == 0) ?
+                size_t increase = (group.sproutNoteInputs.empty() && !isToSproutZaddr) || (group.sproutNoteInputs.size() % 2 == 0) ?
                     JOINSPLIT_SIZE(SAPLING_TX_VERSION) : 0;
-                if (estimatedTxSize + increase >= max_tx_size ||
-                    (sproutNoteLimit > 0 && noteCounter > sproutNoteLimit))
+                if (group.estimatedTxSize + increase >= max_tx_size ||
+                    (sproutNoteLimit > 0 && group.NumNotes() >= sproutNoteLimit))
                 {
-                    maxedOutNotesFlag = true;
+                    if (noteGroup + 1 < vGroups.size() || addGroup()) {
+                        noteGroup++;
+                    } else {
+                        maxedOutNotesFlag = true;
+                    }
                 } else {
-                    estimatedTxSize += increase;
+                    group.estimatedTxSize += increase;
                     auto zaddr = entry.address;
                     SproutSpendingKey zkey;
                     pwalletMain->GetSproutSpendingKey(zaddr, zkey);
-                    sproutNoteInputs.emplace_back(entry.jsop, entry.note, nValue, zkey);
-                    mergedNoteValue += nValue;
+                    group.sproutNoteInputs.emplace_back(entry.jsop, entry.note, nValue, zkey);
+                    group.noteValue += nValue;
+                    break;
                 }
             }
 
@@ -6070,20 +6327,26 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         for (const SaplingNoteEntry& entry : saplingEntries) {
             noteCounter++;
             CAmount nValue = entry.note.value();
-            if (!maxedOutNotesFlag) {
+            while (!maxedOutNotesFlag) {
+                MergeGroup& group = vGroups[noteGroup];
                 size_t increase = SPENDDESCRIPTION_SIZE;
-                if (estimatedTxSize + increase >= max_tx_size ||
-                    (saplingNoteLimit > 0 && noteCounter > saplingNoteLimit))
+                if (group.estimatedTxSize + increase >= max_tx_size ||
+                    (saplingNoteLimit > 0 && group.NumNotes() >= saplingNoteLimit))
                 {
-                    maxedOutNotesFlag = true;
+                    if (noteGroup + 1 < vGroups.size() || addGroup()) {
+                        noteGroup++;
+                    } else {
+                        maxedOutNotesFlag = true;
+                    }
                 } else {
-                    estimatedTxSize += increase;
+                    group.estimatedTxSize += increase;
                     libzcash::SaplingExtendedSpendingKey extsk;
                     if (!pwalletMain->GetSaplingExtendedSpendingKey(entry.address, extsk)) {
                         throw JSONRPCError(RPC_INVALID_PARAMETER, "Could not find spending key for payment address.");
                     }
-                    saplingNoteInputs.emplace_back(entry.op, entry.note, nValue, extsk.expsk);
-                    mergedNoteValue += nValue;
+                    group.saplingNoteInputs.emplace_back(entry.op, entry.note, nValue, extsk.expsk);
+                    group.noteValue += nValue;
+                    break;
                 }
             }
 
@@ -6093,8 +6356,12 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         }
     }
 
-    size_t numUtxos = utxoInputs.size();
-    size_t numNotes = sproutNoteInputs.size() + saplingNoteInputs.size();
+    size_t numUtxos = 0;
+    size_t numNotes = 0;
+    for (const auto& group : vGroups) {
+        numUtxos += group.utxoInputs.size();
+        numNotes += group.NumNotes();
+    }
 
     if (numUtxos == 0 && numNotes == 0) {
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS, "Could not find any funds to merge.");
@@ -6108,7 +6375,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Destination address is also the only source address, and all its funds are already merged.");
     }
 
-    CAmount mergedValue = mergedUTXOValue + mergedNoteValue;
+    CAmount mergedValue = vGroups[0].utxoValue + vGroups[0].noteValue;
     if (mergedValue < nFee) {
         throw JSONRPCError(RPC_WALLET_INSUFFICIENT_FUNDS,
             strprintf("Insufficient funds, have %s, which is less than miners fee %s",
@@ -6121,13 +6388,35 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         throw JSONRPCError(RPC_INVALID_PARAMETER, strprintf("Fee %s is greater than the net amount to be shielded %s", FormatMoney(nFee), FormatMoney(netAmount)));
     }
 
+    // A later transaction that would fail the checks above is left out, and
+    // its UTXOs and notes are left for a later call.
+    while (vGroups.size() > 1 && vGroups.back().utxoValue + vGroups.back().noteValue - nFee < nFee) {
+        const MergeGroup& group = vGroups.back();
+        numUtxos -= group.utxoInputs.size();
+        numNotes -= group.NumNotes();
+        remainingUTXOValue += group.utxoValue;
+        remainingNoteValue += group.noteValue;
+        vGroups.pop_back();
+    }
+
+    CAmount mergedUTXOValue = 0;
+    CAmount mergedNoteValue = 0;
+    bool hasSproutNotes = false;
+    bool hasSaplingNotes = false;
+    for (const auto& group : vGroups) {
+        mergedUTXOValue += group.utxoValue;
+        mergedNoteValue += group.noteValue;
+        hasSproutNotes |= !group.sproutNoteInputs.empty();
+        hasSaplingNotes |= !group.saplingNoteInputs.empty();
+    }
+
     // Keep record of parameters in context object
     UniValue contextInfo(UniValue::VOBJ);
     contextInfo.pushKV("fromaddresses", params[0]);
     contextInfo.pushKV("toaddress", params[1]);
     contextInfo.pushKV("fee", ValueFromAmount(nFee));
 
-    if (!sproutNoteInputs.empty() || !saplingNoteInputs.empty() || !isToTaddr) {
+    if (hasSproutNotes || hasSaplingNotes || !isToTaddr) {
         // We have shielded inputs or the recipient is a shielded address, and
         // therefore we cannot create transactions before Sapling activates.
         if (!saplingActive) {
@@ -6136,7 +6425,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         }
     }
 
-    bool isSproutShielded = sproutNoteInputs.size() > 0 || isToSproutZaddr;
+    bool isSproutShielded = hasSproutNotes || isToSproutZaddr;
     // Contextual transaction we will build on
     CMutableTransaction contextualTx = CreateNewContextualCMutableTransaction(
         Params().GetConsensus(),
@@ -6146,26 +6435,41 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
         contextualTx.nVersion = 2; // Tx format should support vJoinSplit
     }
 
-    // Builder (used if Sapling addresses are involved)
-    std::optional<TransactionBuilder> builder;
-    if (isToSaplingZaddr || saplingNoteInputs.size() > 0) {
-        std::optional<uint256> orchardAnchor;
-        if (!isSproutShielded && nPreferredTxVersion >= ZIP225_MIN_TX_VERSION && nAnchorConfirmations > 0) {
-            // Allow Orchard recipients by setting an Orchard anchor.
-            auto orchardAnchorHeight = nextBlockHeight - nAnchorConfirmations;
-            if (Params().GetConsensus().NetworkUpgradeActive(orchardAnchorHeight, Consensus::UPGRADE_NU5)) {
-                auto anchorBlockIndex = chainActive[orchardAnchorHeight];
-                assert(anchorBlockIndex != nullptr);
-                orchardAnchor = anchorBlockIndex->hashFinalOrchardRoot;
-            }
+    std::optional<uint256> orchardAnchor;
+    if (!isSproutShielded && nPreferredTxVersion >= ZIP225_MIN_TX_VERSION && nAnchorConfirmations > 0) {
+        // Allow Orchard recipients by setting an Orchard anchor.
+        auto orchardAnchorHeight = nextBlockHeight - nAnchorConfirmations;
+        if (Params().GetConsensus().NetworkUpgradeActive(orchardAnchorHeight, Consensus::UPGRADE_NU5)) {
+            auto anchorBlockIndex = chainActive[orchardAnchorHeight];
+            assert(anchorBlockIndex != nullptr);
+            orchardAnchor = anchorBlockIndex->hashFinalOrchardRoot;
         }
-        builder = TransactionBuilder(Params().GetConsensus(), nextBlockHeight, orchardAnchor, pwalletMain);
     }
+    auto newOperation = [&](const MergeGroup& group, UniValue groupContextInfo) {
+        // Builder (used if Sapling addresses are involved)
+        std::optional<TransactionBuilder> builder;
+        if (isToSaplingZaddr || group.saplingNoteInputs.size() > 0) {
+            builder = TransactionBuilder(Params().GetConsensus(), nextBlockHeight, orchardAnchor, pwalletMain);
+        }
+        return new AsyncRPCOperation_mergetoaddress(
+            std::move(builder), contextualTx, group.utxoInputs, group.sproutNoteInputs, group.saplingNoteInputs,
+            recipient, nFee, groupContextInfo);
+    };
+
     // Create operation and add to global queue
     std::shared_ptr<AsyncRPCQueue> q = getAsyncRPCQueue();
-    std::shared_ptr<AsyncRPCOperation> operation(
-        new AsyncRPCOperation_mergetoaddress(
-            std::move(builder), contextualTx, utxoInputs, sproutNoteInputs, saplingNoteInputs, recipient, nFee, contextInfo) );
+    std::shared_ptr<AsyncRPCOperation> operation;
+    if (vGroups.size() == 1) {
+        operation.reset(newOperation(vGroups[0], contextInfo));
+    } else {
+        std::vector<std::shared_ptr<AsyncRPCOperation>> operations;
+        for (const auto& group : vGroups) {
+            auto txOperation = newOperation(group, NullUniValue);
+            txOperation->pauseMining = false;
+            operations.emplace_back(txOperation);
+        }
+        operation.reset(new AsyncRPCOperation_batch("z_mergetoaddress", operations, contextInfo));
+    }
     q->addOperation(operation);
     AsyncRPCOperationId operationId = operation->getId();
 
@@ -6179,6 +6483,7 @@ UniValue z_mergetoaddress(const UniValue& params, bool fHelp)
     o.pushKV("mergingTransparentValue", ValueFromAmount(mergedUTXOValue));
     o.pushKV("mergingNotes", static_cast<uint64_t>(numNotes));
     o.pushKV("mergingShieldedValue", ValueFromAmount(mergedNoteValue));
+    o.pushKV("mergingTransactions", static_cast<uint64_t>(vGroups.size()));
     o.pushKV("opid", operationId);
     return o;
 }
@@ -6231,6 +6536,44 @@ UniValue z_listoperationids(const UniValue& params, bool fHelp)
     return ret;
 }
 
+UniValue z_getoperationqueueinfo(const UniValue& params, bool fHelp)
+{
+    if (!EnsureWalletIsAvailable(fHelp))
+        return NullUniValue;
+
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "z_getoperationqueueinfo\n"
+            "\nReturns the state of the queue that async operations such as z_sendmany run from.\n"
+            "\nOperations created by z_mergetoaddress, z_shieldcoinbase and the Sapling migration only start\n"
+            "when no other operation is waiting.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"queued\": n,              (numeric) the number of operations waiting to start\n"
+            "  \"queued_background\": n,   (numeric) how many of those are long-running operations queued behind the others\n"
+            "  \"executing\": n,           (numeric) the number of operations executing\n"
+            "  \"finished\": n,            (numeric) the number of finished operations whose results are kept\n"
+            "  \"evicted\": n,             (numeric) the number of finished operations forgotten since startup, see -rpcasyncretention\n"
+            "  \"oldest_queued_ms\": n,    (numeric) how long the longest-waiting operation has been queued, in milliseconds\n"
+            "  \"average_wait_ms\": n      (numeric) the average time operations waited before starting, in milliseconds\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("z_getoperationqueueinfo", "")
+            + HelpExampleRpc("z_getoperationqueueinfo", "")
+        );
+
+    AsyncRPCQueueStats stats = getAsyncRPCQueue()->getStats();
+    UniValue ret(UniValue::VOBJ);
+    ret.pushKV("queued", (uint64_t)stats.nQueued);
+    ret.pushKV("queued_background", (uint64_t)stats.nQueuedBackground);
+    ret.pushKV("executing", (uint64_t)stats.nExecuting);
+    ret.pushKV("finished", (uint64_t)stats.nFinished);
+    ret.pushKV("evicted", stats.nEvicted);
+    ret.pushKV("oldest_queued_ms", stats.nOldestQueuedMillis);
+    ret.pushKV("average_wait_ms", stats.nAverageWaitMillis);
+    return ret;
+}
+
 
 UniValue z_getnotescount(const UniValue& params, bool fHelp)
 {
@@ -6351,12 +6694,14 @@ static const CRPCCommand commands[] =
     { "wallet",             "z_getoperationstatus",     &z_getoperationstatus,     true  },
     { "wallet",             "z_getoperationresult",     &z_getoperationresult,     true  },
     { "wallet",             "z_listoperationids",       &z_listoperationids,       true  },
+    { "wallet",             "z_getoperationqueueinfo",  &z_getoperationqueueinfo,  true  },
     { "wallet",             "z_getnewaddress",          &z_getnewaddress,          true  },
     { "wallet",             "z_getnewaccount",          &z_getnewaccount,          true  },
     { "wallet",             "z_listaccounts",           &z_listaccounts,           true  },
     { "wallet",             "z_listaddresses",          &z_listaddresses,          true  },
     { "wallet",             "z_listunifiedreceivers",   &z_listunifiedreceivers,   true  },
     { "wallet",             "z_getaddressforaccount",   &z_getaddressforaccount,   true  },
+    { "wallet",             "z_getaddressesforaccount", &z_getaddressesforaccount, true  },
     { "wallet",             "z_exportkey",              &z_exportkey,              true  },
     { "wallet",             "z_importkey",              &z_importkey,              true  },
     { "wallet",             "z_exportviewingkey",       &z_exportviewingkey,       true  },
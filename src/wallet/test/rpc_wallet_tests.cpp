@@ -1053,6 +1053,66 @@ BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_parallel_cancel)
     BOOST_CHECK(ids.size()==0);
 }
 
+class BackgroundSleepOperation : public MockSleepOperation {
+public:
+    BackgroundSleepOperation(int t) : MockSleepOperation(t) {}
+    virtual AsyncRPCPriority getPriority() const { return AsyncRPCPriority::BACKGROUND; }
+    virtual std::string getMethod() const { return "background"; }
+};
+
+// This tests the order operations start in, the concurrency limits and the retention
+BOOST_AUTO_TEST_CASE(rpc_wallet_async_operations_priority)
+{
+    std::shared_ptr<AsyncRPCQueue> q = std::make_shared<AsyncRPCQueue>();
+
+    // A normal operation queued after a background one starts first.
+    std::shared_ptr<AsyncRPCOperation> background(new BackgroundSleepOperation(500));
+    std::shared_ptr<AsyncRPCOperation> normal(new MockSleepOperation(500));
+    q->addOperation(background);
+    q->addOperation(normal);
+    AsyncRPCQueueStats stats = q->getStats();
+    BOOST_CHECK_EQUAL(stats.nQueued, 2);
+    BOOST_CHECK_EQUAL(stats.nQueuedBackground, 1);
+
+    q->addWorker();
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    BOOST_CHECK_EQUAL(normal->isExecuting(), true);
+    BOOST_CHECK_EQUAL(background->isReady(), true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    BOOST_CHECK_EQUAL(normal->isSuccess(), true);
+    BOOST_CHECK_EQUAL(background->isExecuting(), true);
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    BOOST_CHECK_EQUAL(background->isSuccess(), true);
+
+    stats = q->getStats();
+    BOOST_CHECK_EQUAL(stats.nQueued, 0);
+    BOOST_CHECK_EQUAL(stats.nExecuting, 0);
+    BOOST_CHECK_EQUAL(stats.nFinished, 2);
+
+    // Only the newest finished operation is kept.
+    q->setRetention(1);
+    stats = q->getStats();
+    BOOST_CHECK_EQUAL(stats.nFinished, 1);
+    BOOST_CHECK_EQUAL(stats.nEvicted, 1);
+    BOOST_CHECK(!q->getOperationForId(normal->getId()));
+    BOOST_CHECK(q->getOperationForId(background->getId()));
+
+    // With a limit of one, background operations run one at a time even
+    // when other workers are idle.
+    q->setConcurrencyLimit("background", 1);
+    q->addWorker();
+    std::shared_ptr<AsyncRPCOperation> first(new BackgroundSleepOperation(500));
+    std::shared_ptr<AsyncRPCOperation> second(new BackgroundSleepOperation(500));
+    q->addOperation(first);
+    q->addOperation(second);
+    std::this_thread::sleep_for(std::chrono::milliseconds(250));
+    BOOST_CHECK_EQUAL(first->isExecuting(), true);
+    BOOST_CHECK_EQUAL(second->isReady(), true);
+    q->finishAndWait();
+    BOOST_CHECK_EQUAL(first->isSuccess(), true);
+    BOOST_CHECK_EQUAL(second->isSuccess(), true);
+}
+
 // This tests z_getoperationstatus, z_getoperationresult, z_listoperationids
 BOOST_AUTO_TEST_CASE(rpc_z_getoperations)
 {
@@ -1310,6 +1370,37 @@ BOOST_AUTO_TEST_CASE(rpc_z_sendmany_internals)
             BOOST_CHECK( find_error(objError, "hexadecimal format"));
         }
     }
+
+    // requests queued within the batch window share a transaction
+    {
+        nSendManyBatchWindow = 100;
+        std::shared_ptr<AsyncRPCQueue> q = std::make_shared<AsyncRPCQueue>();
+        auto selector = pwalletMain->ZTXOSelectorForAddress(taddr1, true, false).value();
+        TransactionStrategy strategy;
+        std::vector<std::shared_ptr<AsyncRPCOperation_sendmany>> operations;
+        std::vector<CAmount> amounts = {1*COIN, 2*COIN, 5*COIN};
+        for (int i = 0; i < 3; i++) {
+            TransactionBuilder builder(consensusParams, nHeight + 1, std::nullopt, pwalletMain);
+            std::vector<SendManyRecipient> recipients = { SendManyRecipient(std::nullopt, zaddr1, amounts[i], "DEADBEEF") };
+            operations.emplace_back(new AsyncRPCOperation_sendmany(std::move(builder), selector, recipients, i < 2 ? 1 : 2, 1, strategy));
+            AsyncRPCOperation_sendmany::Queue(q, operations.back(), "taddr1", nHeight + 1);
+        }
+        nSendManyBatchWindow = DEFAULT_SENDMANY_BATCH_WINDOW;
+
+        // the third request has a different minconf
+        BOOST_CHECK_EQUAL(TEST_FRIEND_AsyncRPCOperation_sendmany(operations[0]).recipient_count(), 2);
+        BOOST_CHECK_EQUAL(TEST_FRIEND_AsyncRPCOperation_sendmany(operations[2]).recipient_count(), 1);
+
+        // both requests report the outcome of the shared transaction
+        for (auto& operation : operations) {
+            operation->main();
+        }
+        BOOST_CHECK(operations[0]->isFailed());
+        BOOST_CHECK(operations[1]->isFailed());
+        BOOST_CHECK_EQUAL(operations[1]->getErrorMessage(), operations[0]->getErrorMessage());
+        BOOST_CHECK(operations[0]->getErrorMessage().find("need 3.00001") != string::npos);
+        BOOST_CHECK(operations[2]->getErrorMessage().find("need 5.00001") != string::npos);
+    }
 }
 
 /*
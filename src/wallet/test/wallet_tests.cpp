@@ -325,4 +325,49 @@ BOOST_AUTO_TEST_CASE(coin_selection_tests)
     empty_wallet();
 }
 
+BOOST_AUTO_TEST_CASE(coin_selection_bnb_tests)
+{
+    CoinSet setCoinsRet;
+    CAmount nValueRet;
+
+    empty_wallet();
+    add_coin(1 * CENT);
+    add_coin(2 * CENT);
+    add_coin(3 * CENT);
+    add_coin(4 * CENT);
+    add_coin(7 * CENT, 1);
+
+    // 7 cents can be made from one confirmed coin only if it is old enough; otherwise 3 + 4
+    BOOST_CHECK( CWallet::SelectCoinsBnB(7 * CENT, 0, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 1U);
+    BOOST_CHECK( CWallet::SelectCoinsBnB(7 * CENT, 0, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+
+    // the fewest inputs win over the least excess within the window (7 rather than 4 + 2)
+    BOOST_CHECK( CWallet::SelectCoinsBnB(6 * CENT, 1 * CENT, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 1U);
+    BOOST_CHECK_EQUAL(nValueRet, 7 * CENT);
+    // and of as many inputs, the least excess (7 + 3 rather than 7 + 4)
+    BOOST_CHECK( CWallet::SelectCoinsBnB(10 * CENT, 1 * CENT, 1, 1, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
+    BOOST_CHECK_EQUAL(nValueRet, 10 * CENT);
+
+    // nothing adds up to the window, or there is not enough
+    BOOST_CHECK(!CWallet::SelectCoinsBnB(1.5 * CENT, 0, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK(!CWallet::SelectCoinsBnB(18 * CENT, 0, 1, 1, vCoins, setCoinsRet, nValueRet));
+
+    // many identical coins do not exhaust the search
+    empty_wallet();
+    for (int i = 0; i < 1000; i++)
+        add_coin(CENT);
+    add_coin(0.5 * CENT);
+    BOOST_CHECK( CWallet::SelectCoinsBnB(100.5 * CENT, 0, 1, 6, vCoins, setCoinsRet, nValueRet));
+    BOOST_CHECK_EQUAL(nValueRet, 100.5 * CENT);
+    BOOST_CHECK_EQUAL(setCoinsRet.size(), 101U);
+
+    empty_wallet();
+}
+
 BOOST_AUTO_TEST_SUITE_END()
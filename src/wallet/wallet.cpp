@@ -8,8 +8,10 @@
 
 #include "asyncrpcqueue.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "core_io.h"
+#include "core_memusage.h"
 #include "consensus/upgrades.h"
 #include "consensus/validation.h"
 #include "consensus/consensus.h"
@@ -34,8 +36,10 @@
 #include "wallet/asyncrpcoperation_saplingmigration.h"
 
 #include <algorithm>
+#include <atomic>
 #include <assert.h>
 #include <numeric>
+#include <thread>
 #include <variant>
 
 #include <boost/algorithm/string/replace.hpp>
@@ -50,6 +54,9 @@ CFeeRate payTxFee(DEFAULT_TRANSACTION_FEE);
 unsigned int nTxConfirmTarget = DEFAULT_TX_CONFIRM_TARGET;
 bool bSpendZeroConfChange = DEFAULT_SPEND_ZEROCONF_CHANGE;
 bool fSendFreeTransactions = DEFAULT_SEND_FREE_TRANSACTIONS;
+bool fLazyWitnesses = DEFAULT_LAZY_WITNESSES;
+int64_t nWitnessWriteInterval = WITNESS_WRITE_INTERVAL;
+int64_t nSendManyBatchWindow = DEFAULT_SENDMANY_BATCH_WINDOW;
 bool fPayAtLeastCustomFee = true;
 unsigned int nAnchorConfirmations = DEFAULT_ANCHOR_CONFIRMATIONS;
 unsigned int nOrchardActionLimit = DEFAULT_ORCHARD_ACTION_LIMIT;
@@ -232,6 +239,14 @@ bool CWallet::AddSaplingFullViewingKey(const libzcash::SaplingExtendedFullViewin
 bool CWallet::AddSaplingPaymentAddress(
     const libzcash::SaplingIncomingViewingKey &ivk,
     const libzcash::SaplingPaymentAddress &addr)
+{
+    return AddSaplingPaymentAddress(ivk, addr, nullptr);
+}
+
+bool CWallet::AddSaplingPaymentAddress(
+    const libzcash::SaplingIncomingViewingKey &ivk,
+    const libzcash::SaplingPaymentAddress &addr,
+    CWalletDB* pwalletdb)
 {
     AssertLockHeld(cs_wallet); // mapSaplingZKeyMetadata
 
@@ -243,6 +258,9 @@ bool CWallet::AddSaplingPaymentAddress(
         return true;
     }
 
+    if (pwalletdb) {
+        return pwalletdb->WriteSaplingPaymentAddress(addr, ivk);
+    }
     return CWalletDB(strWalletFile).WriteSaplingPaymentAddress(addr, ivk);
 }
 
@@ -839,6 +857,154 @@ WalletUAGenerationResult CWallet::GenerateUnifiedAddress(
     }
 }
 
+WalletUABatchGenerationResult CWallet::GenerateUnifiedAddresses(
+    const libzcash::AccountId& accountId,
+    const std::set<libzcash::ReceiverType>& receiverTypes,
+    size_t count)
+{
+    AssertLockHeld(cs_wallet); // mapUfvkAddressMetadata
+
+    if (!libzcash::HasShielded(receiverTypes)) {
+        return UnifiedAddressGenerationError::ShieldedReceiverNotFound;
+    }
+    // See GenerateUnifiedAddress for why transparent receivers require an
+    // unlocked wallet.
+    bool hasTransparent = receiverTypes.find(ReceiverType::P2PKH) != receiverTypes.end();
+    if (hasTransparent && (IsCrypted() || !GetMnemonicSeed().has_value())) {
+        return WalletUAGenerationError::WalletEncrypted;
+    }
+
+    auto ufvk = GetUnifiedFullViewingKeyByAccount(accountId);
+    if (!ufvk.has_value()) {
+        return WalletUAGenerationError::NoSuchAccount;
+    }
+    auto ufvkid = ufvk.value().GetKeyID();
+
+    std::optional<diversifier_index_t> j = diversifier_index_t(0);
+    auto metadata = mapUfvkAddressMetadata.find(ufvkid);
+    if (metadata != mapUfvkAddressMetadata.end()) {
+        j = metadata->second.GetNextDiversifierIndex();
+        if (!j.has_value()) {
+            return UnifiedAddressGenerationError::DiversifierSpaceExhausted;
+        }
+    }
+
+    // Try windows of candidate diversifier indices in parallel. About half of
+    // the indices are invalid for Sapling, so each window holds twice as many
+    // candidates as there are addresses still to find.
+    std::vector<std::pair<UnifiedAddress, diversifier_index_t>> addresses;
+    bool fExhausted = false;
+    while (addresses.size() < count) {
+        if (fExhausted) {
+            return UnifiedAddressGenerationError::DiversifierSpaceExhausted;
+        }
+        std::vector<diversifier_index_t> vCandidates;
+        size_t nWindow = 2 * (count - addresses.size()) + 16;
+        while (vCandidates.size() < nWindow && !fExhausted) {
+            vCandidates.push_back(j.value());
+            fExhausted = !j.value().increment();
+        }
+
+        std::vector<UnifiedAddressGenerationResult> vResults(
+            vCandidates.size(), UnifiedAddressGenerationError::NoAddressForDiversifier);
+        std::atomic<size_t> nNext{0};
+        auto derive = [&]() {
+            for (size_t i = nNext++; i < vCandidates.size(); i = nNext++) {
+                vResults[i] = ufvk.value().Address(vCandidates[i], receiverTypes);
+            }
+        };
+        size_t nThreads = std::min(vCandidates.size(), (size_t)std::max(1, GetNumCores()));
+        std::vector<std::thread> vThreads;
+        for (size_t i = 1; i < nThreads; i++) {
+            vThreads.emplace_back(derive);
+        }
+        derive();
+        for (std::thread& thread : vThreads) {
+            thread.join();
+        }
+
+        for (const auto& result : vResults) {
+            if (addresses.size() == count) {
+                break;
+            }
+            if (std::holds_alternative<UnifiedAddressGenerationError>(result)) {
+                auto err = std::get<UnifiedAddressGenerationError>(result);
+                if (err != UnifiedAddressGenerationError::NoAddressForDiversifier) {
+                    return err;
+                }
+                continue;
+            }
+            addresses.push_back(std::get<std::pair<UnifiedAddress, diversifier_index_t>>(result));
+        }
+    }
+
+    // Derive the transparent secret keys before changing the wallet, from a
+    // single derivation of the account's spending key.
+    std::vector<CKey> externalKeys;
+    if (hasTransparent) {
+        auto accountKey = GenerateUnifiedSpendingKeyForAccount(accountId).value().GetTransparentKey();
+        for (const auto& address : addresses) {
+            auto childIndex = address.second.ToTransparentChildIndex().value();
+            auto externalKey = accountKey.DeriveExternalSpendingKey(childIndex);
+            if (!externalKey.has_value()) {
+                return UnifiedAddressGenerationError::NoAddressForDiversifier;
+            }
+            externalKeys.push_back(externalKey.value());
+        }
+    }
+
+    std::optional<libzcash::SaplingIncomingViewingKey> saplingIvk;
+    if (receiverTypes.count(ReceiverType::Sapling) > 0) {
+        saplingIvk = ufvk.value().GetSaplingKey().value().ToIncomingViewingKey();
+    }
+    std::optional<libzcash::OrchardIncomingViewingKey> orchardIvk;
+    if (receiverTypes.count(ReceiverType::Orchard) > 0) {
+        orchardIvk = ufvk.value().GetOrchardKey().value().ToIncomingViewingKey();
+    }
+
+    std::optional<CWalletDB> walletdb;
+    BeginBlockWrites(walletdb);
+    for (size_t i = 0; i < addresses.size(); i++) {
+        const auto& address = addresses[i];
+        assert(mapUfvkAddressMetadata[ufvkid].SetReceivers(address.second, receiverTypes));
+        if (hasTransparent) {
+            AddTransparentSecretKey(
+                mnemonicHDChain.value().GetSeedFingerprint(),
+                externalKeys[i],
+                transparent::AccountKey::KeyPath(
+                    BIP44CoinType(), accountId, true, address.second.ToTransparentChildIndex().value())
+            );
+            assert(
+                CCryptoKeyStore::AddTransparentReceiverForUnifiedAddress(
+                    ufvkid, address.second, address.first
+                )
+            );
+        }
+        if (saplingIvk.has_value()) {
+            AddSaplingPaymentAddress(
+                saplingIvk.value(), address.first.GetSaplingReceiver().value(), walletdb ? &walletdb.value() : nullptr);
+        }
+        if (orchardIvk.has_value()) {
+            AddOrchardRawAddress(orchardIvk.value(), address.first.GetOrchardReceiver().value());
+        }
+
+        ZcashdUnifiedAddressMetadata addrmeta(ufvkid, address.second, receiverTypes);
+        if (fFileBacked) {
+            bool fWritten = walletdb ?
+                walletdb->WriteUnifiedAddressMetadata(addrmeta) :
+                CWalletDB(strWalletFile).WriteUnifiedAddressMetadata(addrmeta);
+            if (!fWritten) {
+                CommitBlockWrites(walletdb);
+                throw std::runtime_error(
+                        "CWallet::GenerateUnifiedAddresses(): Writing unified address metadata failed");
+            }
+        }
+    }
+    CommitBlockWrites(walletdb);
+
+    return addresses;
+}
+
 bool CWallet::LoadUnifiedFullViewingKey(const libzcash::UnifiedFullViewingKey &key)
 {
     return CCryptoKeyStore::AddUnifiedFullViewingKey(
@@ -1416,7 +1582,7 @@ void CWallet::ChainTipAdded(const CBlockIndex *pindex,
         nLastSetChain = nNow;
     }
     if (++nSetChainUpdates >= WITNESS_WRITE_UPDATES ||
-        nLastSetChain + (int64_t)WITNESS_WRITE_INTERVAL * 1000000 < nNow ||
+        nLastSetChain + nWitnessWriteInterval * 1000000 < nNow ||
         (chainParams.NetworkIDString() == CBaseChainParams::REGTEST && mapArgs.count("-regtestwalletsetbestchaineveryblock")))
     {
         nLastSetChain = nNow;
@@ -1427,6 +1593,8 @@ void CWallet::ChainTipAdded(const CBlockIndex *pindex,
             // the witnesses above; pindex can be behind chainActive.Tip().
             LOCK(cs_main);
             loc = chainActive.GetLocator(pindex);
+            // Only the witnesses that are still needed are written.
+            PruneSpentNoteWitnesses();
         }
         SetBestChain(loc);
     }
@@ -1438,7 +1606,13 @@ void CWallet::ChainTip(const CBlockIndex *pindex,
                        // witnesses / rewind the tree
                        std::optional<MerkleFrontiers> added)
 {
+    auto span = TracingSpan("debug", "profile", "WalletChainTip");
+    auto spanGuard = span.Enter();
     const auto& consensus = Params().GetConsensus();
+    {
+        LOCK(cs_wallet);
+        mapAnchorWitnesses.clear();
+    }
     if (added.has_value()) {
         ChainTipAdded(pindex, pblock, added.value(), true);
         // Prevent migration transactions from being created when node is syncing after launch,
@@ -2212,7 +2386,9 @@ SpendableInputs CWallet::FindSpendableInputs(
     bool selectOrchard{selector.SelectsOrchard()};
 
     SpendableInputs unspent;
-    for (auto const& [wtxid, wtx] : mapWallet) {
+    for (const CWalletTx* pwtx : GetUnspentCandidates()) {
+        const CWalletTx& wtx = *pwtx;
+        const uint256& wtxid = wtx.GetHash();
         bool isCoinbase = wtx.IsCoinBase();
         auto nDepth = wtx.GetDepthInMainChain();
 
@@ -2309,6 +2485,9 @@ SpendableInputs CWallet::FindSpendableInputs(
 
         if (selectSapling) {
             for (auto const& [op, nd] : wtx.mapSaplingNoteData) {
+                // skip notes which have been spent
+                if (nd.nullifier.has_value() && IsSaplingSpent(nd.nullifier.value())) continue;
+
                 auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
 
                 // The transaction would not have entered the wallet unless
@@ -2319,9 +2498,6 @@ SpendableInputs CWallet::FindSpendableInputs(
                 auto maybe_pa = nd.ivk.address(notePt.d);
                 assert(maybe_pa.has_value());
                 auto pa = maybe_pa.value();
-
-                // skip notes which have been spent
-                if (nd.nullifier.has_value() && IsSaplingSpent(nd.nullifier.value())) continue;
                 // skip notes which do not match the source
                 if (!this->SelectorMatchesAddress(selector, pa)) continue;
                 // skip notes if we don't have the spending key
@@ -2530,9 +2706,68 @@ void CWallet::ClearNoteWitnessCache()
             item.second.witnessHeight = -1;
         }
     }
+    setPrunedSaplingWitnesses.clear();
     nWitnessCacheSize = 0;
 }
 
+CBlockIndex* CWallet::GetEarliestNoteBlock() const
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs_wallet);
+    CBlockIndex* pindexEarliest = nullptr;
+    for (const std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        const CWalletTx& wtx = wtxItem.second;
+        if (wtx.mapSproutNoteData.empty() && wtx.mapSaplingNoteData.empty()) continue;
+        BlockMap::const_iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if (mi == mapBlockIndex.end() || !chainActive.Contains(mi->second)) continue;
+        if (pindexEarliest == nullptr || mi->second->nHeight < pindexEarliest->nHeight) {
+            pindexEarliest = mi->second;
+        }
+    }
+    return pindexEarliest;
+}
+
+void CWallet::PruneSpentNoteWitnesses()
+{
+    AssertLockHeld(cs_main);
+    LOCK(cs_wallet);
+    size_t nPruned = 0;
+    auto spentDeeply = [&](const auto& spend) { return IsSpendDeep(spend.second); };
+    // The Orchard wallet knows which of its notes each transaction spends.
+    std::vector<uint256> vOrchardSpendingTxids;
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        if (!wtxItem.second.orchardTxMeta.GetActionsSpendingMyNotes().empty() &&
+            IsSpendDeep(wtxItem.first)) {
+            vOrchardSpendingTxids.push_back(wtxItem.first);
+        }
+        for (mapSproutNoteData_t::value_type& item : wtxItem.second.mapSproutNoteData) {
+            SproutNoteData& nd = item.second;
+            if (nd.witnesses.empty() || !nd.nullifier) continue;
+            auto range = mapTxSproutNullifiers.equal_range(nd.nullifier.value());
+            if (std::any_of(range.first, range.second, spentDeeply)) {
+                nd.witnesses.clear();
+                nPruned++;
+            }
+        }
+        for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
+            SaplingNoteData& nd = item.second;
+            // The witness height is kept, so that the note is still
+            // considered up to date with the chain.
+            if (nd.witnesses.empty() || !nd.nullifier) continue;
+            auto range = mapTxSaplingNullifiers.equal_range(nd.nullifier.value());
+            if (std::any_of(range.first, range.second, spentDeeply)) {
+                nd.witnesses.clear();
+                setPrunedSaplingWitnesses.insert(item.first);
+                nPruned++;
+            }
+        }
+    }
+    nPruned += orchardWallet.ForgetSpentNoteWitnesses(vOrchardSpendingTxids);
+    if (nPruned > 0) {
+        LogPrintf("Dropped the cached witnesses of %d deeply spent notes\n", nPruned);
+    }
+}
+
 template<typename NoteDataMap>
 void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize)
 {
@@ -2560,8 +2795,8 @@ void CopyPreviousWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t nW
     }
 }
 
-template<typename NoteDataMap>
-void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const uint256& note_commitment)
+template<typename NoteDataMap, typename Witness>
+void CollectWitnessesToIncrement(NoteDataMap& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, std::vector<Witness*>& vWitnesses)
 {
     for (auto& item : noteDataMap) {
         auto* nd = &(item.second);
@@ -2569,17 +2804,30 @@ void AppendNoteCommitment(NoteDataMap& noteDataMap, int indexHeight, int64_t nWi
             // Check the validity of the cache
             // See comment in CopyPreviousWitnesses about validity.
             assert(nWitnessCacheSize >= nd->witnesses.size());
-            nd->witnesses.front().append(note_commitment);
+            vWitnesses.push_back(&nd->witnesses.front());
         }
     }
 }
 
-template<typename OutPoint, typename NoteData, typename Witness>
-void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const OutPoint& key, const Witness& witness)
+// Append the note commitments seen since the last call to the witnesses
+// being incremented.
+template<typename Witness, typename Hash>
+void AppendNoteCommitments(std::vector<Witness*>& vWitnesses, std::vector<Hash>& vCommitments)
+{
+    Witness::append_all(vWitnesses, vCommitments);
+    vCommitments.clear();
+}
+
+template<typename OutPoint, typename NoteData, typename Witness, typename Hash>
+void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeight, int64_t nWitnessCacheSize, const OutPoint& key, const Witness& witness,
+                       std::vector<Witness*>& vWitnesses, std::vector<Hash>& vCommitments)
 {
     if (noteDataMap.count(key) && noteDataMap[key].witnessHeight < indexHeight) {
         auto* nd = &(noteDataMap[key]);
+        // The new witness is only incremented with later commitments.
+        AppendNoteCommitments(vWitnesses, vCommitments);
         if (nd->witnesses.size() > 0) {
+            vWitnesses.erase(std::remove(vWitnesses.begin(), vWitnesses.end(), &nd->witnesses.front()), vWitnesses.end());
             // We think this can happen because we write out the
             // witness cache state after every block increment or
             // decrement, but the block index itself is written in
@@ -2597,6 +2845,7 @@ void WitnessNoteIfMine(std::map<OutPoint, NoteData>& noteDataMap, int indexHeigh
             nd->witnesses.clear();
         }
         nd->witnesses.push_front(witness);
+        vWitnesses.push_back(&nd->witnesses.front());
         // Set height to one less than pindex so it gets incremented
         nd->witnessHeight = indexHeight - 1;
         // Check the validity of the cache
@@ -2619,6 +2868,130 @@ void UpdateWitnessHeights(NoteDataMap& noteDataMap, int indexHeight, int64_t nWi
     }
 }
 
+/**
+ * With -lazywitnesses, the notes that have a witness keep the height of the
+ * block it was taken in. Those without one (not mined yet, or pruned once
+ * spent) are kept up to date with the chain as they are without it, so that
+ * incrementing their witnesses can resume when it stops.
+ */
+template<typename NoteDataMap>
+void UpdateLazyWitnessHeights(NoteDataMap& noteDataMap, int indexHeight)
+{
+    for (auto& item : noteDataMap) {
+        auto* nd = &(item.second);
+        if (nd->witnesses.empty() && nd->witnessHeight < indexHeight) {
+            nd->witnessHeight = indexHeight;
+        }
+    }
+}
+
+/**
+ * Append the Sapling note commitments of the blocks up to and including
+ * pindexTarget to witnesses that are each complete up to the end of the
+ * block at the height paired with it, reading the blocks from disk. Fails if
+ * a witness is not for the chain that pindexTarget is on.
+ */
+static bool CatchUpSaplingWitnesses(
+        std::vector<std::pair<SaplingWitness*, int>>& vWitnesses,
+        const CBlockIndex* pindexTarget,
+        const Consensus::Params& consensus)
+{
+    if (vWitnesses.empty()) {
+        return true;
+    }
+    std::sort(vWitnesses.begin(), vWitnesses.end(),
+        [](const std::pair<SaplingWitness*, int>& a, const std::pair<SaplingWitness*, int>& b) {
+            return a.second < b.second;
+        });
+    for (const std::pair<SaplingWitness*, int>& item : vWitnesses) {
+        if (item.second > pindexTarget->nHeight ||
+                item.first->root() != pindexTarget->GetAncestor(item.second)->hashFinalSaplingRoot) {
+            return false;
+        }
+    }
+
+    // Each witness is appended to from the block after its own.
+    std::vector<SaplingWitness*> vActive;
+    size_t nNext = 0;
+    for (int nHeight = vWitnesses.front().second + 1; nHeight <= pindexTarget->nHeight; nHeight++) {
+        while (nNext < vWitnesses.size() && vWitnesses[nNext].second < nHeight) {
+            vActive.push_back(vWitnesses[nNext].first);
+            nNext++;
+        }
+        const CBlockIndex* pindex = pindexTarget->GetAncestor(nHeight);
+        // Blocks without Sapling outputs leave the tree as it was.
+        if (pindex->hashFinalSaplingRoot == pindex->pprev->hashFinalSaplingRoot) {
+            continue;
+        }
+        CBlock block;
+        if (!ReadBlockFromDisk(block, pindex, consensus)) {
+            return false;
+        }
+        std::vector<libzcash::PedersenHash> vCommitments;
+        for (const CTransaction& tx : block.vtx) {
+            for (const OutputDescription& output : tx.vShieldedOutput) {
+                vCommitments.push_back(output.cmu);
+            }
+        }
+        SaplingWitness::append_all(vActive, vCommitments);
+    }
+    return true;
+}
+
+void CWallet::CatchUpLazySaplingWitnesses(const Consensus::Params& consensus, const CBlockIndex* pindex)
+{
+    AssertLockHeld(cs_wallet);
+    std::vector<std::pair<SaplingWitness*, int>> vWitnesses;
+    std::vector<SaplingNoteData*> vNoteData;
+    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+        for (mapSaplingNoteData_t::value_type& item : wtxItem.second.mapSaplingNoteData) {
+            SaplingNoteData* nd = &(item.second);
+            if (nd->witnessHeight >= 0 && nd->witnessHeight < pindex->nHeight - 1 && nd->witnesses.size() > 0) {
+                // The older cached witnesses are not for the blocks just
+                // before this one, so cannot be rewound to.
+                nd->witnesses.resize(1);
+                vWitnesses.emplace_back(&nd->witnesses.front(), nd->witnessHeight);
+                vNoteData.push_back(nd);
+            } else if (nd->witnessHeight >= 0 && nd->witnessHeight < pindex->nHeight - 1) {
+                // A note without a witness has nothing to catch up; only its
+                // height is brought up to date.
+                nd->witnessHeight = pindex->nHeight - 1;
+            }
+        }
+    }
+    if (vWitnesses.empty()) {
+        return;
+    }
+
+    LogPrintf("Catching up %d Sapling note witnesses to height %d\n", vWitnesses.size(), pindex->nHeight - 1);
+    bool fCaughtUp = CatchUpSaplingWitnesses(vWitnesses, pindex->pprev, consensus);
+    if (!fCaughtUp) {
+        LogPrintf("Could not catch up Sapling note witnesses; restart with -rescan to recover them\n");
+    }
+    for (SaplingNoteData* nd : vNoteData) {
+        if (fCaughtUp) {
+            nd->witnessHeight = pindex->nHeight - 1;
+        } else {
+            nd->witnesses.clear();
+            nd->witnessHeight = -1;
+        }
+    }
+}
+
+bool CWallet::HasSproutKeysOrNotes() const
+{
+    AssertLockHeld(cs_wallet);
+    LOCK(cs_KeyStore);
+    return fHaveSproutNotes || !mapNoteDecryptors.empty();
+}
+
+bool CWallet::HasSaplingKeysOrNotes() const
+{
+    AssertLockHeld(cs_wallet);
+    LOCK(cs_KeyStore);
+    return fHaveSaplingNotes || !mapSaplingFullViewingKeys.empty();
+}
+
 void CWallet::IncrementNoteWitnesses(
         const Consensus::Params& consensus,
         const CBlockIndex* pindex,
@@ -2627,22 +3000,53 @@ void CWallet::IncrementNoteWitnesses(
         bool performOrchardWalletUpdates)
 {
     LOCK(cs_wallet);
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-       ::CopyPreviousWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-       ::CopyPreviousWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+    auto span = TracingSpan("debug", "profile", "IncrementNoteWitnesses");
+    auto spanGuard = span.Enter();
+    // Only the pools that the wallet has notes or keys for can have notes of
+    // ours to witness; the others are skipped, tree and all.
+    bool fSprout = HasSproutKeysOrNotes();
+    bool fSapling = HasSaplingKeysOrNotes();
+    bool fOrchard = false;
+    // With -lazywitnesses, Sapling notes keep the witness taken in the block
+    // that has them, which GetSaplingNoteWitnesses catches up when they are
+    // spent; a wallet that used it is caught up here when it stops.
+    if (fSapling && !fLazyWitnesses) {
+        CatchUpLazySaplingWitnesses(consensus, pindex);
+    }
+    if (fSprout || fSapling) {
+        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+            if (fSprout) {
+                ::CopyPreviousWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
+            }
+            if (fSapling && !fLazyWitnesses) {
+                ::CopyPreviousWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+            }
+        }
     }
 
     if (performOrchardWalletUpdates && consensus.NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_NU5)) {
-        if (!orchardWallet.GetLastCheckpointHeight().has_value()) {
-            orchardWallet.InitNoteCommitmentTree(frontiers.orchard);
+        if (orchardWallet.HasKeys()) {
+            if (!orchardWallet.GetLastCheckpointHeight().has_value()) {
+                orchardWallet.InitNoteCommitmentTree(frontiers.orchard);
+            }
+            assert(orchardWallet.CheckpointNoteCommitmentTree(pindex->nHeight));
+            fOrchard = true;
+        } else if (orchardWallet.GetLastCheckpointHeight().has_value()) {
+            // A tree kept by an earlier version for a wallet without Orchard
+            // keys; it has nothing to witness. Without checkpoints it is
+            // initialized from the frontier once a key is added.
+            orchardWallet.Reset();
         }
-        assert(orchardWallet.CheckpointNoteCommitmentTree(pindex->nHeight));
     }
 
     if (nWitnessCacheSize < WITNESS_CACHE_SIZE) {
         nWitnessCacheSize += 1;
     }
 
+    if (!fSprout && !fSapling && !fOrchard) {
+        return;
+    }
+
     const CBlock* pblock {pblockIn};
     CBlock block;
     if (!pblock) {
@@ -2650,48 +3054,74 @@ void CWallet::IncrementNoteWitnesses(
         pblock = &block;
     }
 
+    // The witnesses to increment, and the commitments not yet appended to
+    // them. Commitments are appended to all the witnesses at once, and only
+    // need to be before witnessing a new note of ours.
+    std::vector<SproutWitness*> vSproutWitnesses;
+    std::vector<SaplingWitness*> vSaplingWitnesses;
+    if (fSprout || fSapling) {
+        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+            if (fSprout) {
+                ::CollectWitnessesToIncrement(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, vSproutWitnesses);
+            }
+            if (fSapling && !fLazyWitnesses) {
+                ::CollectWitnessesToIncrement(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, vSaplingWitnesses);
+            }
+        }
+    }
+    std::vector<libzcash::SHA256Compress> vSproutCommitments;
+    std::vector<libzcash::PedersenHash> vSaplingCommitments;
+    // The Sapling notes witnessed in this block, with -lazywitnesses.
+    std::vector<SaplingNoteData*> vNewSaplingNotes;
+
     for (const CTransaction& tx : pblock->vtx) {
+        if (!fSprout && !fSapling) {
+            break;
+        }
         auto hash = tx.GetHash();
         bool txIsOurs = mapWallet.count(hash);
         // Sprout
-        for (size_t i = 0; i < tx.vJoinSplit.size(); i++) {
+        for (size_t i = 0; fSprout && i < tx.vJoinSplit.size(); i++) {
             const JSDescription& jsdesc = tx.vJoinSplit[i];
             for (uint8_t j = 0; j < jsdesc.commitments.size(); j++) {
                 const uint256& note_commitment = jsdesc.commitments[j];
                 frontiers.sprout.append(note_commitment);
-
-                // Increment existing witnesses
-                for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                    ::AppendNoteCommitment(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-                }
+                vSproutCommitments.push_back(note_commitment);
 
                 // If this is our note, witness it
                 if (txIsOurs) {
                     JSOutPoint jsoutpt {hash, i, j};
-                    ::WitnessNoteIfMine(mapWallet[hash].mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, jsoutpt, frontiers.sprout.witness());
+                    ::WitnessNoteIfMine(mapWallet[hash].mapSproutNoteData, pindex->nHeight, nWitnessCacheSize, jsoutpt, frontiers.sprout.witness(),
+                                        vSproutWitnesses, vSproutCommitments);
                 }
             }
         }
         // Sapling
-        for (uint32_t i = 0; i < tx.vShieldedOutput.size(); i++) {
+        for (uint32_t i = 0; fSapling && i < tx.vShieldedOutput.size(); i++) {
             const uint256& note_commitment = tx.vShieldedOutput[i].cmu;
             frontiers.sapling.append(note_commitment);
-
-            // Increment existing witnesses
-            for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                ::AppendNoteCommitment(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, note_commitment);
-            }
+            vSaplingCommitments.push_back(note_commitment);
 
             // If this is our note, witness it
             if (txIsOurs) {
                 SaplingOutPoint outPoint {hash, i};
-                ::WitnessNoteIfMine(mapWallet[hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, outPoint, frontiers.sapling.witness());
+                ::WitnessNoteIfMine(mapWallet[hash].mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize, outPoint, frontiers.sapling.witness(),
+                                    vSaplingWitnesses, vSaplingCommitments);
+                auto it = mapWallet[hash].mapSaplingNoteData.find(outPoint);
+                if (fLazyWitnesses && it != mapWallet[hash].mapSaplingNoteData.end() &&
+                        it->second.witnessHeight == pindex->nHeight - 1) {
+                    vNewSaplingNotes.push_back(&(it->second));
+                }
             }
         }
     }
 
+    // Increment existing witnesses
+    ::AppendNoteCommitments(vSproutWitnesses, vSproutCommitments);
+    ::AppendNoteCommitments(vSaplingWitnesses, vSaplingCommitments);
+
     // If we're at or beyond NU5 activation, update the Orchard note commitment tree.
-    if (performOrchardWalletUpdates && consensus.NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_NU5)) {
+    if (fOrchard) {
         assert(orchardWallet.AppendNoteCommitments(pindex->nHeight, *pblock));
         // This assertion slows scanning for blocks with few shielded transactions by an
         // order of magnitude. It is only intended as a consistency check between the node
@@ -2702,9 +3132,20 @@ void CWallet::IncrementNoteWitnesses(
     }
 
     // Update witness heights
-    for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-        ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
-        ::UpdateWitnessHeights(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+    if (fSprout || fSapling) {
+        for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
+            if (fSprout) {
+                ::UpdateWitnessHeights(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
+            }
+            if (fSapling && !fLazyWitnesses) {
+                ::UpdateWitnessHeights(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+            } else if (fSapling) {
+                ::UpdateLazyWitnessHeights(wtxItem.second.mapSaplingNoteData, pindex->nHeight);
+            }
+        }
+    }
+    for (SaplingNoteData* nd : vNewSaplingNotes) {
+        nd->witnessHeight = pindex->nHeight;
     }
 
     // For performance reasons, we write out the witness cache in
@@ -2752,6 +3193,22 @@ void DecrementNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight, int64_t n
     }
 }
 
+template<typename NoteDataMap>
+void DecrementLazyNoteWitnesses(NoteDataMap& noteDataMap, int indexHeight)
+{
+    for (auto& item : noteDataMap) {
+        auto* nd = &(item.second);
+        // Only the witnesses up to the end of the block being removed are
+        // invalidated; earlier ones are caught up from the new blocks.
+        if (nd->witnessHeight == indexHeight) {
+            if (nd->witnesses.size() > 0) {
+                nd->witnesses.pop_front();
+            }
+            nd->witnessHeight = indexHeight - 1;
+        }
+    }
+}
+
 void CWallet::DecrementNoteWitnesses(const Consensus::Params& consensus, const CBlockIndex* pindex)
 {
     LOCK(cs_wallet);
@@ -2761,7 +3218,11 @@ void CWallet::DecrementNoteWitnesses(const Consensus::Params& consensus, const C
         hasSprout |= !wtxItem.second.mapSproutNoteData.empty();
         ::DecrementNoteWitnesses(wtxItem.second.mapSproutNoteData, pindex->nHeight, nWitnessCacheSize);
         hasSapling |= !wtxItem.second.mapSaplingNoteData.empty();
-        ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+        if (fLazyWitnesses) {
+            ::DecrementLazyNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight);
+        } else {
+            ::DecrementNoteWitnesses(wtxItem.second.mapSaplingNoteData, pindex->nHeight, nWitnessCacheSize);
+        }
     }
     if (nWitnessCacheSize > 0) {
         nWitnessCacheSize -= 1;
@@ -2771,8 +3232,9 @@ void CWallet::DecrementNoteWitnesses(const Consensus::Params& consensus, const C
     // because then the witness cache size can remain at 0.
     assert(!(hasSprout || hasSapling) || nWitnessCacheSize > 0);
 
-    // ORCHARD: rewind to the last checkpoint.
-    if (consensus.NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_NU5)) {
+    // ORCHARD: rewind to the last checkpoint. Until the wallet has Orchard
+    // keys the tree has none (see IncrementNoteWitnesses).
+    if (orchardWallet.GetLastCheckpointHeight().has_value() && consensus.NetworkUpgradeActive(pindex->nHeight, Consensus::UPGRADE_NU5)) {
         // pindex->nHeight is the height of the block being removed, so we rewind
         // to the previous block height
         uint32_t uResultHeight{0};
@@ -2957,11 +3419,121 @@ void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
-        for (std::pair<const uint256, CWalletTx>& item : mapWallet)
+        // Outputs may have become ours, for example by importing keys.
+        mapUnspentCandidates.clear();
+        for (std::pair<const uint256, CWalletTx>& item : mapWallet) {
             item.second.MarkDirty();
+            mapUnspentCandidates.emplace_hint(mapUnspentCandidates.end(), item.first, -1);
+        }
+    }
+}
+
+bool CWallet::IsSpendDeep(const uint256& spendingTxid) const
+{
+    std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(spendingTxid);
+    return mit != mapWallet.end() && mit->second.GetDepthInMainChain() >= (int)MAX_REORG_LENGTH;
+}
+
+bool CWallet::MayHaveUnspentOutputs(const CWalletTx& wtx) const
+{
+    auto spentDeeply = [&](const auto& spend) { return IsSpendDeep(spend.second); };
+
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++) {
+        if (IsMine(wtx.vout[i]) == ISMINE_NO) continue;
+        auto range = mapTxSpends.equal_range(COutPoint(hash, i));
+        if (!std::any_of(range.first, range.second, spentDeeply)) return true;
+    }
+    for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+        if (!item.second.nullifier) return true;
+        auto range = mapTxSproutNullifiers.equal_range(item.second.nullifier.value());
+        if (!std::any_of(range.first, range.second, spentDeeply)) return true;
+    }
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        if (!item.second.nullifier) return true;
+        auto range = mapTxSaplingNullifiers.equal_range(item.second.nullifier.value());
+        if (!std::any_of(range.first, range.second, spentDeeply)) return true;
+    }
+    // Orchard notes are tracked by the Orchard wallet.
+    return !wtx.orchardTxMeta.empty();
+}
+
+std::vector<const CWalletTx*> CWallet::GetUnspentCandidates() const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet);
+
+    // Whether the outputs are spent deeply enough only changes with the tip.
+    int nHeight = chainActive.Height();
+    std::vector<const CWalletTx*> vCandidates;
+    vCandidates.reserve(mapUnspentCandidates.size());
+    for (auto it = mapUnspentCandidates.begin(); it != mapUnspentCandidates.end(); ) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->first);
+        if (mit == mapWallet.end()) {
+            it = mapUnspentCandidates.erase(it);
+            continue;
+        }
+        if (it->second != nHeight) {
+            if (!MayHaveUnspentOutputs(mit->second)) {
+                it = mapUnspentCandidates.erase(it);
+                continue;
+            }
+            it->second = nHeight;
+        }
+        vCandidates.push_back(&mit->second);
+        ++it;
+    }
+    return vCandidates;
+}
+
+void CWallet::IndexNoteOwners(const CWalletTx& wtx)
+{
+    const uint256& hash = wtx.GetHash();
+    for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
+        mapSproutAddressTxids[item.second.address].insert(hash);
+    }
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        mapSaplingIvkTxids[item.second.ivk].insert(hash);
     }
 }
 
+std::vector<const CWalletTx*> CWallet::GetNoteFilterCandidates(const NoteFilter& noteFilter) const
+{
+    AssertLockHeld(cs_wallet);
+
+    std::set<uint256> setTxids;
+    for (const libzcash::SproutPaymentAddress& addr : noteFilter.GetSproutAddresses()) {
+        auto it = mapSproutAddressTxids.find(addr);
+        if (it != mapSproutAddressTxids.end()) {
+            setTxids.insert(it->second.begin(), it->second.end());
+        }
+    }
+    // Several addresses may share an incoming viewing key.
+    std::set<libzcash::SaplingIncomingViewingKey> setIvks;
+    for (const libzcash::SaplingPaymentAddress& addr : noteFilter.GetSaplingAddresses()) {
+        libzcash::SaplingIncomingViewingKey ivk;
+        if (GetSaplingIncomingViewingKey(addr, ivk)) {
+            setIvks.insert(ivk);
+        }
+    }
+    for (const libzcash::SaplingIncomingViewingKey& ivk : setIvks) {
+        auto it = mapSaplingIvkTxids.find(ivk);
+        if (it != mapSaplingIvkTxids.end()) {
+            setTxids.insert(it->second.begin(), it->second.end());
+        }
+    }
+
+    std::vector<const CWalletTx*> vCandidates;
+    vCandidates.reserve(setTxids.size());
+    for (const uint256& txid : setTxids) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(txid);
+        if (mit != mapWallet.end()) {
+            vCandidates.push_back(&mit->second);
+        }
+    }
+    return vCandidates;
+}
+
 /**
  * Ensure that every note in the wallet (for which we possess a spending key)
  * has a cached nullifier.
@@ -3011,6 +3583,8 @@ void CWallet::UpdateNullifierNoteMapWithTx(const CWalletTx& wtx)
 {
     {
         LOCK(cs_wallet);
+        fHaveSproutNotes |= !wtx.mapSproutNoteData.empty();
+        fHaveSaplingNotes |= !wtx.mapSaplingNoteData.empty();
         for (const mapSproutNoteData_t::value_type& item : wtx.mapSproutNoteData) {
             if (item.second.nullifier) {
                 mapSproutNullifiersToNotes[*item.second.nullifier] = item.first;
@@ -3035,6 +3609,12 @@ void CWallet::UpdateSaplingNullifierNoteMapWithTx(CWalletTx& wtx) {
         SaplingOutPoint op = item.first;
         SaplingNoteData nd = item.second;
 
+        // The witnesses of deeply spent notes are dropped, but their
+        // nullifiers are still needed to know that they are spent.
+        if (nd.witnesses.empty() && setPrunedSaplingWitnesses.count(op)) {
+            continue;
+        }
+
         if (nd.witnesses.empty()) {
             // The Sapling nullifier depends upon the position of the note in the
             // note commitment tree.
@@ -3093,12 +3673,19 @@ void CWallet::UpdateSaplingNullifierNoteMapForBlock(const CBlock *pblock) {
 
 void CWallet::LoadWalletTx(const CWalletTx& wtxIn) {
     uint256 hash = wtxIn.GetHash();
-    mapWallet[hash] = wtxIn;
-    CWalletTx& wtx = mapWallet[hash];
+    CWalletTx& wtx = mapWallet.insert_or_assign(hash, wtxIn).first->second;
     wtx.BindWallet(this);
     wtxOrdered.insert(make_pair(wtx.nOrderPos, &wtx));
-    UpdateNullifierNoteMapWithTx(mapWallet[hash]);
+    UpdateNullifierNoteMapWithTx(wtx);
+    for (const mapSaplingNoteData_t::value_type& item : wtx.mapSaplingNoteData) {
+        // Otherwise, a note without witnesses has no nullifier either.
+        if (item.second.witnesses.empty() && item.second.nullifier && item.second.witnessHeight >= 0) {
+            setPrunedSaplingWitnesses.insert(item.first);
+        }
+    }
     AddToSpends(hash);
+    mapUnspentCandidates[hash] = -1;
+    IndexNoteOwners(wtx);
 }
 
 bool CWallet::AddToWallet(const CWalletTx& wtxIn, CWalletDB* pwalletdb)
@@ -3107,11 +3694,13 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, CWalletDB* pwalletdb)
         uint256 hash = wtxIn.GetHash();
 
         LOCK(cs_wallet);
-        // Inserts only if not already there, returns tx inserted or tx found
-        pair<map<uint256, CWalletTx>::iterator, bool> ret = mapWallet.insert(make_pair(hash, wtxIn));
+        // Inserts only if not already there, returns tx inserted or tx found.
+        // The transaction is only copied if it is inserted.
+        pair<map<uint256, CWalletTx>::iterator, bool> ret = mapWallet.try_emplace(hash, wtxIn);
         CWalletTx& wtx = (*ret.first).second;
         wtx.BindWallet(this);
         UpdateNullifierNoteMapWithTx(wtx);
+        mapUnspentCandidates[hash] = -1;
         bool fInsertedNew = ret.second;
         if (fInsertedNew)
         {
@@ -3184,6 +3773,7 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, CWalletDB* pwalletdb)
                 fUpdated = true;
             }
         }
+        IndexNoteOwners(wtx);
 
         //// debug print
         LogPrintf("AddToWallet %s  %s%s\n", wtxIn.GetHash().ToString(), (fInsertedNew ? "new" : ""), (fUpdated ? "update" : ""));
@@ -3228,6 +3818,7 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
         }
         // Now copy over the updated note data
         wtx.mapSproutNoteData = tmp;
+        fHaveSproutNotes = true;
     }
 
     bool unchangedSaplingFlag = (wtxIn.mapSaplingNoteData.empty() || wtxIn.mapSaplingNoteData == wtx.mapSaplingNoteData);
@@ -3247,6 +3838,7 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
 
         // Now copy over the updated note data
         wtx.mapSaplingNoteData = tmp;
+        fHaveSaplingNotes = true;
     }
 
     bool unchangedOrchardFlag = (wtxIn.orchardTxMeta.empty() || wtxIn.orchardTxMeta == wtx.orchardTxMeta);
@@ -3254,27 +3846,84 @@ bool CWallet::UpdatedNoteData(const CWalletTx& wtxIn, CWalletTx& wtx)
         wtx.orchardTxMeta = wtxIn.orchardTxMeta;
     }
 
-    return !unchangedSproutFlag || !unchangedSaplingFlag || !unchangedOrchardFlag;
+    return !unchangedSproutFlag || !unchangedSaplingFlag || !unchangedOrchardFlag;
+}
+
+/**
+ * Add a transaction to the wallet, or update it.
+ * pblock is optional, but should be provided if the transaction is known to be in a block.
+ * If fUpdate is true, existing transactions will be updated.
+ *
+ * If pblock is null, this transaction has either recently entered the mempool from the
+ * network, is re-entering the mempool after a block was disconnected, or is exiting the
+ * mempool because it conflicts with another transaction. In all these cases, if there is
+ * an existing wallet transaction, the wallet transaction's Merkle branch data is _not_
+ * updated; instead, the transaction being in the mempool or conflicted is determined on
+ * the fly in CMerkleTx::GetDepthInMainChain().
+ */
+bool CWallet::AddToWalletIfInvolvingMe(
+        const Consensus::Params& consensus,
+        const CTransaction& tx,
+        const CBlock* pblock,
+        const int nHeight,
+        bool fUpdate)
+{
+    AssertLockHeld(cs_wallet);
+
+    // Check whether the transaction is already known by the wallet.
+    if (!fUpdate && mapWallet.count(tx.GetHash()) != 0) return false;
+
+    auto sproutNoteData = FindMySproutNotes(tx);
+    auto saplingNoteData = FindMySaplingNotes(tx, nHeight);
+    std::optional<OrchardWalletTxMeta> orchardTxMeta;
+    if (orchardWallet.HasKeys() && consensus.NetworkUpgradeActive(nHeight, Consensus::UPGRADE_NU5)) {
+        orchardTxMeta = orchardWallet.AddNotesIfInvolvingMe(tx);
+    }
+    return AddToWalletIfInvolvingMe(
+        consensus, tx, pblock, nHeight, fUpdate,
+        sproutNoteData, saplingNoteData, orchardTxMeta);
+}
+
+std::vector<std::optional<OrchardWalletTxMeta>> CWallet::AddOrchardNotesIfInvolvingMe(
+        const Consensus::Params& consensus,
+        const std::vector<const CTransaction*>& vtx,
+        const int nHeight,
+        bool fUpdate)
+{
+    AssertLockHeld(cs_wallet);
+    std::vector<std::optional<OrchardWalletTxMeta>> result(vtx.size());
+    if (!orchardWallet.HasKeys() || !consensus.NetworkUpgradeActive(nHeight, Consensus::UPGRADE_NU5)) {
+        return result;
+    }
+
+    std::vector<const CTransaction*> vtxToAdd;
+    std::vector<size_t> vIndices;
+    for (size_t i = 0; i < vtx.size(); i++) {
+        if (fUpdate || mapWallet.count(vtx[i]->GetHash()) == 0) {
+            vtxToAdd.push_back(vtx[i]);
+            vIndices.push_back(i);
+        }
+    }
+    if (vtxToAdd.empty()) {
+        return result;
+    }
+    auto vTxMeta = orchardWallet.AddNotesIfInvolvingMe(vtxToAdd);
+    for (size_t j = 0; j < vIndices.size(); j++) {
+        result[vIndices[j]] = std::move(vTxMeta[j]);
+    }
+    return result;
 }
 
-/**
- * Add a transaction to the wallet, or update it.
- * pblock is optional, but should be provided if the transaction is known to be in a block.
- * If fUpdate is true, existing transactions will be updated.
- *
- * If pblock is null, this transaction has either recently entered the mempool from the
- * network, is re-entering the mempool after a block was disconnected, or is exiting the
- * mempool because it conflicts with another transaction. In all these cases, if there is
- * an existing wallet transaction, the wallet transaction's Merkle branch data is _not_
- * updated; instead, the transaction being in the mempool or conflicted is determined on
- * the fly in CMerkleTx::GetDepthInMainChain().
- */
 bool CWallet::AddToWalletIfInvolvingMe(
         const Consensus::Params& consensus,
         const CTransaction& tx,
         const CBlock* pblock,
         const int nHeight,
-        bool fUpdate)
+        bool fUpdate,
+        const mapSproutNoteData_t& sproutNoteData,
+        const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>& saplingNoteDataAndAddressesToAdd,
+        const std::optional<OrchardWalletTxMeta>& orchardTxMeta,
+        CWalletDB* pwalletdb)
 {
     { // extra scope left in place for backport whitespace compatibility
         AssertLockHeld(cs_wallet);
@@ -3283,26 +3932,16 @@ bool CWallet::AddToWalletIfInvolvingMe(
         bool fExisted = mapWallet.count(tx.GetHash()) != 0;
         if (fExisted && !fUpdate) return false;
 
-        // Sprout
-        auto sproutNoteData = FindMySproutNotes(tx);
-
         // Sapling
-        auto saplingNoteDataAndAddressesToAdd = FindMySaplingNotes(tx, nHeight);
         auto saplingNoteData = saplingNoteDataAndAddressesToAdd.first;
         auto saplingAddressesToAdd = saplingNoteDataAndAddressesToAdd.second;
         for (const auto &addressToAdd : saplingAddressesToAdd) {
             // Add mapping between address and IVK for easy future lookup.
-            if (!AddSaplingPaymentAddress(addressToAdd.second, addressToAdd.first)) {
+            if (!AddSaplingPaymentAddress(addressToAdd.second, addressToAdd.first, pwalletdb)) {
                 return false;
             }
         }
 
-        // Orchard
-        std::optional<OrchardWalletTxMeta> orchardTxMeta;
-        if (consensus.NetworkUpgradeActive(nHeight, Consensus::UPGRADE_NU5)) {
-            orchardTxMeta = orchardWallet.AddNotesIfInvolvingMe(tx);
-        }
-
         if (fExisted || IsMine(tx) || IsFromMe(tx) ||
             sproutNoteData.size() > 0 ||
             saplingNoteData.size() > 0 ||
@@ -3326,6 +3965,10 @@ bool CWallet::AddToWalletIfInvolvingMe(
             if (pblock)
                 wtx.SetMerkleBranch(*pblock);
 
+            if (pwalletdb) {
+                return AddToWallet(wtx, pwalletdb);
+            }
+
             // Do not flush the wallet here for performance reasons; this is
             // safe, as in case of a crash, we rescan the necessary blocks on
             // startup through our SetBestChain-mechanism
@@ -3346,6 +3989,70 @@ void CWallet::SyncTransaction(const CTransaction& tx, const CBlock* pblock, cons
     MarkAffectedTransactionsDirty(tx);
 }
 
+void CWallet::SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock, const int nHeight)
+{
+    // Trial-decrypt the notes of the whole group up front. This only needs
+    // the keystore lock, so cs_wallet is not held while doing it.
+    std::vector<mapSproutNoteData_t> vSproutNoteData;
+    vSproutNoteData.reserve(vtx.size());
+    {
+        LOCK(cs_KeyStore);
+        for (const CTransaction& tx : vtx) {
+            vSproutNoteData.push_back(FindMySproutNotes(tx));
+        }
+    }
+    auto vSaplingNoteData = FindMySaplingNotes(vtx, nHeight);
+
+    LOCK(cs_wallet);
+    std::vector<const CTransaction*> vptx;
+    vptx.reserve(vtx.size());
+    for (const CTransaction& tx : vtx) {
+        vptx.push_back(&tx);
+    }
+    auto vOrchardTxMeta = AddOrchardNotesIfInvolvingMe(Params().GetConsensus(), vptx, nHeight, true);
+    // The writes for a block are made in one database transaction, instead
+    // of one per transaction.
+    std::optional<CWalletDB> walletdb;
+    if (pblock) {
+        BeginBlockWrites(walletdb);
+    }
+    try {
+        for (size_t i = 0; i < vtx.size(); i++) {
+            if (AddToWalletIfInvolvingMe(Params().GetConsensus(), vtx[i], pblock, nHeight, true,
+                                         vSproutNoteData[i], vSaplingNoteData[i], vOrchardTxMeta[i],
+                                         walletdb ? &walletdb.value() : nullptr)) {
+                MarkAffectedTransactionsDirty(vtx[i]);
+            }
+        }
+    } catch (...) {
+        CommitBlockWrites(walletdb);
+        throw;
+    }
+    CommitBlockWrites(walletdb);
+}
+
+void CWallet::BeginBlockWrites(std::optional<CWalletDB>& walletdb)
+{
+    if (!fFileBacked) {
+        return;
+    }
+    walletdb.emplace(strWalletFile, "r+", false);
+    if (!walletdb->TxnBegin()) {
+        // Fall back to writing each transaction on its own.
+        walletdb.reset();
+    }
+}
+
+void CWallet::CommitBlockWrites(std::optional<CWalletDB>& walletdb)
+{
+    // What was written is committed even if the block was not processed to
+    // the end, as the wallet in memory already reflects it.
+    if (walletdb && !walletdb->TxnCommit()) {
+        LogPrintf("%s: Failed to commit wallet writes\n", __func__);
+    }
+    walletdb.reset();
+}
+
 void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
 {
     // If a transaction changes 'conflicted' state, that changes the balance
@@ -3358,18 +4065,21 @@ void CWallet::MarkAffectedTransactionsDirty(const CTransaction& tx)
     }
     for (const JSDescription& jsdesc : tx.vJoinSplit) {
         for (const uint256& nullifier : jsdesc.nullifiers) {
-            if (mapSproutNullifiersToNotes.count(nullifier) &&
-                mapWallet.count(mapSproutNullifiersToNotes[nullifier].hash)) {
-                mapWallet[mapSproutNullifiersToNotes[nullifier].hash].MarkDirty();
+            auto itNote = mapSproutNullifiersToNotes.find(nullifier);
+            if (itNote != mapSproutNullifiersToNotes.end()) {
+                auto itTx = mapWallet.find(itNote->second.hash);
+                if (itTx != mapWallet.end())
+                    itTx->second.MarkDirty();
             }
         }
     }
 
     for (const SpendDescription &spend : tx.vShieldedSpend) {
-        uint256 nullifier = spend.nullifier;
-        if (mapSaplingNullifiersToNotes.count(nullifier) &&
-            mapWallet.count(mapSaplingNullifiersToNotes[nullifier].hash)) {
-            mapWallet[mapSaplingNullifiersToNotes[nullifier].hash].MarkDirty();
+        auto itNote = mapSaplingNullifiersToNotes.find(spend.nullifier);
+        if (itNote != mapSaplingNullifiersToNotes.end()) {
+            auto itTx = mapWallet.find(itNote->second.hash);
+            if (itTx != mapWallet.end())
+                itTx->second.MarkDirty();
         }
     }
 }
@@ -3380,6 +4090,7 @@ void CWallet::EraseFromWallet(const uint256 &hash)
         return;
     {
         LOCK(cs_wallet);
+        mapUnspentCandidates.erase(hash);
         if (mapWallet.erase(hash))
             CWalletDB(strWalletFile).EraseTx(hash);
     }
@@ -3480,47 +4191,204 @@ mapSproutNoteData_t CWallet::FindMySproutNotes(const CTransaction &tx) const
  * the result of FindMySaplingNotes (for the addresses available at the time) will
  * already have been cached in CWalletTx.mapSaplingNoteData.
  */
+static CCheckQueue<CSaplingTrialDecryption> saplingdecryptionqueue(16);
+
+void ThreadSaplingTrialDecryption() {
+    RenameThread("zc-saplingdecrypt");
+    saplingdecryptionqueue.Thread();
+}
+
+bool CSaplingTrialDecryption::operator()() {
+    // The key agreements of the shard's keys share the ephemeral key, and
+    // are computed together.
+    std::vector<uint256> vIvks(pvIvks->begin() + nKeyBegin, pvIvks->begin() + nKeyEnd);
+    std::vector<std::optional<uint256>> vDhSecrets;
+    if (!SaplingKeyAgreementBatch(poutput->ephemeralKey, vIvks, vDhSecrets)) {
+        // Not decrypting an output is not a failure.
+        return true;
+    }
+    for (size_t nKey = nKeyBegin; nKey < nKeyEnd; nKey++) {
+        const std::optional<uint256>& dhsecret = vDhSecrets[nKey - nKeyBegin];
+        if (!dhsecret) {
+            continue;
+        }
+        const SaplingIncomingViewingKey& ivk = (*pvIvks)[nKey];
+        auto plaintext = SaplingNotePlaintext::decrypt_with_dhsecret(*params, nHeight, poutput->encCiphertext, ivk, poutput->ephemeralKey, poutput->cmu, dhsecret.value());
+        if (plaintext) {
+            presult->nKey = nKey;
+            presult->address = ivk.address(plaintext.value().d);
+            break;
+        }
+    }
+    // Not decrypting an output is not a failure.
+    return true;
+}
+
 std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> CWallet::FindMySaplingNotes(const CTransaction &tx, int height) const
 {
-    LOCK(cs_KeyStore);
-    uint256 hash = tx.GetHash();
+    return FindMySaplingNotes(std::vector<const CTransaction*>{&tx}, std::vector<int>{height})[0];
+}
 
-    mapSaplingNoteData_t noteData;
-    SaplingIncomingViewingKeyMap viewingKeysToAdd;
+std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> CWallet::FindMySaplingNotes(const std::vector<CTransaction>& vtx, int height) const
+{
+    std::vector<const CTransaction*> vptx;
+    vptx.reserve(vtx.size());
+    for (const CTransaction& tx : vtx) {
+        vptx.push_back(&tx);
+    }
+    return FindMySaplingNotes(vptx, std::vector<int>(vtx.size(), height));
+}
 
-    // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
-    for (uint32_t i = 0; i < tx.vShieldedOutput.size(); ++i) {
-        const OutputDescription output = tx.vShieldedOutput[i];
-        for (auto it = mapSaplingFullViewingKeys.begin(); it != mapSaplingFullViewingKeys.end(); ++it) {
-            SaplingIncomingViewingKey ivk = it->first;
+/**
+ * Finds the Sapling notes of each of the given transactions. The keystore
+ * lock is only held to take a snapshot of the viewing keys; every output of
+ * the group is then tried with each key on the trial decryption queue. The
+ * keys are split into shards that are tried in separate checks, so that a
+ * wallet with many viewing keys spreads a block with few outputs over all
+ * the queue's threads.
+ *
+ * With birthday heights, the keys are ordered by birthday, so that the keys
+ * an output is tried with are the shards up to the last key born at or
+ * before its height.
+ */
+std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> CWallet::FindMySaplingNotes(
+    const std::vector<const CTransaction*>& vtx, const std::vector<int>& vHeights,
+    const std::map<SaplingIncomingViewingKey, int>* pBirthHeights) const
+{
+    assert(vtx.size() == vHeights.size());
+    auto span = TracingSpan("debug", "profile", "FindMySaplingNotes");
+    auto spanGuard = span.Enter();
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> result(vtx.size());
 
-            auto result = SaplingNotePlaintext::decrypt(Params().GetConsensus(), height, output.encCiphertext, ivk, output.ephemeralKey, output.cmu);
-            if (!result) {
-                continue;
+    // The (transaction, output) indices to be decrypted.
+    std::vector<std::pair<size_t, uint32_t>> vOutputs;
+    for (size_t n = 0; n < vtx.size(); n++) {
+        for (uint32_t i = 0; i < vtx[n]->vShieldedOutput.size(); ++i) {
+            vOutputs.emplace_back(n, i);
+        }
+    }
+    if (vOutputs.empty()) {
+        return result;
+    }
+
+    std::vector<SaplingIncomingViewingKey> vIvks;
+    std::vector<int> vBirthHeights;
+    {
+        LOCK(cs_KeyStore);
+        std::vector<std::pair<int, SaplingIncomingViewingKey>> vKeys;
+        vKeys.reserve(mapSaplingFullViewingKeys.size());
+        for (const auto& entry : mapSaplingFullViewingKeys) {
+            int nBirthHeight = 0;
+            if (pBirthHeights) {
+                auto it = pBirthHeights->find(entry.first);
+                if (it != pBirthHeights->end()) {
+                    nBirthHeight = it->second;
+                }
             }
-            auto address = ivk.address(result.value().d);
-            if (address && mapSaplingIncomingViewingKeys.count(address.value()) == 0) {
-                viewingKeysToAdd[address.value()] = ivk;
+            vKeys.emplace_back(nBirthHeight, entry.first);
+        }
+        std::stable_sort(vKeys.begin(), vKeys.end(),
+            [](const auto& a, const auto& b) { return a.first < b.first; });
+        vIvks.reserve(vKeys.size());
+        vBirthHeights.reserve(vKeys.size());
+        for (const auto& [nBirthHeight, ivk] : vKeys) {
+            vBirthHeights.push_back(nBirthHeight);
+            vIvks.push_back(ivk);
+        }
+    }
+    if (vIvks.empty()) {
+        return result;
+    }
+
+    // Protocol Spec: 4.19 Block Chain Scanning (Sapling)
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    const size_t nShards = (vIvks.size() + SAPLING_TRIAL_DECRYPTION_SHARD_KEYS - 1) / SAPLING_TRIAL_DECRYPTION_SHARD_KEYS;
+    std::vector<SaplingTrialDecryptionResult> vShardResults(vOutputs.size() * nShards);
+    {
+        std::vector<CSaplingTrialDecryption> vChecks;
+        vChecks.reserve(vShardResults.size());
+        for (size_t j = 0; j < vOutputs.size(); j++) {
+            const auto& [n, i] = vOutputs[j];
+            // The keys born after the output are left out; the results of
+            // the shards that are not tried stay empty.
+            size_t nKeys = std::upper_bound(vBirthHeights.begin(), vBirthHeights.end(), vHeights[n]) - vBirthHeights.begin();
+            for (size_t nShard = 0; nShard * SAPLING_TRIAL_DECRYPTION_SHARD_KEYS < nKeys; nShard++) {
+                size_t nKeyBegin = nShard * SAPLING_TRIAL_DECRYPTION_SHARD_KEYS;
+                size_t nKeyEnd = std::min(nKeyBegin + SAPLING_TRIAL_DECRYPTION_SHARD_KEYS, nKeys);
+                vChecks.emplace_back(vtx[n]->vShieldedOutput[i], vIvks, nKeyBegin, nKeyEnd,
+                                     consensusParams, vHeights[n], vShardResults[j * nShards + nShard]);
+            }
+        }
+        if (nScriptCheckThreads) {
+            CCheckQueueControl<CSaplingTrialDecryption> control(&saplingdecryptionqueue);
+            control.Add(vChecks);
+            control.Wait();
+        } else {
+            for (CSaplingTrialDecryption& check : vChecks) {
+                check();
             }
-            // We don't cache the nullifier here as computing it requires knowledge of the note position
-            // in the commitment tree, which can only be determined when the transaction has been mined.
-            SaplingOutPoint op {hash, i};
-            SaplingNoteData nd;
-            nd.ivk = ivk;
-            noteData.insert(std::make_pair(op, nd));
-            break;
         }
     }
 
-    return std::make_pair(noteData, viewingKeysToAdd);
+    LOCK(cs_KeyStore);
+    for (size_t j = 0; j < vOutputs.size(); j++) {
+        // The first key that decrypts the output is in the first shard that does.
+        auto itResult = std::find_if(
+            vShardResults.begin() + j * nShards, vShardResults.begin() + (j + 1) * nShards,
+            [](const SaplingTrialDecryptionResult& shardResult) { return shardResult.nKey.has_value(); });
+        if (itResult == vShardResults.begin() + (j + 1) * nShards) {
+            continue;
+        }
+        const auto& [n, i] = vOutputs[j];
+        const SaplingIncomingViewingKey& ivk = vIvks[itResult->nKey.value()];
+        const auto& address = itResult->address;
+        if (address && mapSaplingIncomingViewingKeys.count(address.value()) == 0) {
+            result[n].second[address.value()] = ivk;
+        }
+        // We don't cache the nullifier here as computing it requires knowledge of the note position
+        // in the commitment tree, which can only be determined when the transaction has been mined.
+        SaplingOutPoint op {vtx[n]->GetHash(), i};
+        SaplingNoteData nd;
+        nd.ivk = ivk;
+        result[n].first.insert(std::make_pair(op, nd));
+    }
+
+    return result;
+}
+
+std::map<SaplingIncomingViewingKey, int> CWallet::GetSaplingKeyBirthHeights(const CBlockIndex* pindexStart) const
+{
+    AssertLockHeld(cs_main);
+    AssertLockHeld(cs_wallet); // mapSaplingZKeyMetadata
+
+    std::vector<std::pair<int64_t, SaplingIncomingViewingKey>> vKeyTimes;
+    for (const auto& [ivk, keyMeta] : mapSaplingZKeyMetadata) {
+        if (keyMeta.nCreateTime > 0) {
+            vKeyTimes.emplace_back(keyMeta.nCreateTime, ivk);
+        }
+    }
+    std::sort(vKeyTimes.begin(), vKeyTimes.end());
+
+    // The keys are taken in order of creation, so that the chain is walked
+    // once, with the same allowance for block time variability as the
+    // wallet birthday.
+    std::map<SaplingIncomingViewingKey, int> mapBirthHeights;
+    const CBlockIndex* pindex = pindexStart;
+    for (const auto& [nCreateTime, ivk] : vKeyTimes) {
+        while (pindex != nullptr && pindex->GetBlockTime() < nCreateTime - TIMESTAMP_WINDOW) {
+            pindex = chainActive.Next(pindex);
+        }
+        mapBirthHeights[ivk] = pindex ? pindex->nHeight : chainActive.Height() + 1;
+    }
+    return mapBirthHeights;
 }
 
 bool CWallet::IsSproutNullifierFromMe(const uint256& nullifier) const
 {
     {
         LOCK(cs_wallet);
-        if (mapSproutNullifiersToNotes.count(nullifier) &&
-                mapWallet.count(mapSproutNullifiersToNotes.at(nullifier).hash)) {
+        auto it = mapSproutNullifiersToNotes.find(nullifier);
+        if (it != mapSproutNullifiersToNotes.end() && mapWallet.count(it->second.hash)) {
             return true;
         }
     }
@@ -3531,8 +4399,8 @@ bool CWallet::IsSaplingNullifierFromMe(const uint256& nullifier) const
 {
     {
         LOCK(cs_wallet);
-        if (mapSaplingNullifiersToNotes.count(nullifier) &&
-                mapWallet.count(mapSaplingNullifiersToNotes.at(nullifier).hash)) {
+        auto it = mapSaplingNullifiersToNotes.find(nullifier);
+        if (it != mapSaplingNullifiersToNotes.end() && mapWallet.count(it->second.hash)) {
             return true;
         }
     }
@@ -3552,7 +4420,7 @@ bool CWallet::GetSproutNoteWitnesses(const std::vector<JSOutPoint>& notes,
         if (mapWallet.count(note.hash) &&
                 mapWallet.at(note.hash).mapSproutNoteData.count(note) &&
                 mapWallet.at(note.hash).mapSproutNoteData.at(note).witnesses.size() > 0) {
-            auto noteWitnesses = mapWallet.at(note.hash).mapSproutNoteData.at(note).witnesses;
+            const auto& noteWitnesses = mapWallet.at(note.hash).mapSproutNoteData.at(note).witnesses;
             auto it = noteWitnesses.cbegin(), end = noteWitnesses.cend();
             for (int i = 1; i < confirmations; i++) {
                 if (it == end) return false;
@@ -3582,13 +4450,64 @@ bool CWallet::GetSaplingNoteWitnesses(const std::vector<SaplingOutPoint>& notes,
 {
     LOCK(cs_wallet);
     witnesses.resize(notes.size());
+    if (fLazyWitnesses) {
+        // The witnesses were not incremented since the notes' blocks, so
+        // catch them up to the anchor from the blocks on disk.
+        LOCK(cs_main);
+        int nAnchorHeight = chainActive.Height() + 1 - (int)confirmations;
+        if (nAnchorHeight < 0) {
+            return false;
+        }
+        const CBlockIndex* pindexAnchor = chainActive[nAnchorHeight];
+        if (hashAnchorWitnesses != pindexAnchor->GetBlockHash()) {
+            mapAnchorWitnesses.clear();
+            hashAnchorWitnesses = pindexAnchor->GetBlockHash();
+        }
+        std::vector<std::pair<SaplingWitness*, int>> vCatchUp;
+        std::vector<size_t> vCatchUpIndices;
+        for (size_t i = 0; i < notes.size(); i++) {
+            auto itTx = mapWallet.find(notes[i].hash);
+            if (itTx == mapWallet.end()) continue;
+            auto itNote = itTx->second.mapSaplingNoteData.find(notes[i]);
+            if (itNote == itTx->second.mapSaplingNoteData.end() || itNote->second.witnesses.empty()) continue;
+            const SaplingNoteData& nd = itNote->second;
+            if (nd.witnessHeight < nAnchorHeight) {
+                auto itCached = mapAnchorWitnesses.find(notes[i]);
+                if (itCached != mapAnchorWitnesses.end()) {
+                    witnesses[i] = itCached->second;
+                    continue;
+                }
+                witnesses[i] = nd.witnesses.front();
+                vCatchUp.emplace_back(&witnesses[i].value(), nd.witnessHeight);
+                vCatchUpIndices.push_back(i);
+            } else {
+                // Witnesses cached for the latest blocks are one block apart.
+                size_t nDepth = nd.witnessHeight - nAnchorHeight;
+                if (nDepth >= nd.witnesses.size()) return false;
+                witnesses[i] = *std::next(nd.witnesses.begin(), nDepth);
+            }
+        }
+        if (!CatchUpSaplingWitnesses(vCatchUp, pindexAnchor, Params().GetConsensus())) {
+            return false;
+        }
+        for (const std::optional<SaplingWitness>& witness : witnesses) {
+            if (witness && witness->root() != pindexAnchor->hashFinalSaplingRoot) {
+                return false;
+            }
+        }
+        for (size_t i : vCatchUpIndices) {
+            mapAnchorWitnesses.emplace(notes[i], witnesses[i].value());
+        }
+        final_anchor = pindexAnchor->hashFinalSaplingRoot;
+        return true;
+    }
     std::optional<uint256> rt;
     int i = 0;
     for (SaplingOutPoint note : notes) {
         if (mapWallet.count(note.hash) &&
                 mapWallet.at(note.hash).mapSaplingNoteData.count(note) &&
                 mapWallet.at(note.hash).mapSaplingNoteData.at(note).witnesses.size() > 0) {
-            auto noteWitnesses = mapWallet.at(note.hash).mapSaplingNoteData.at(note).witnesses;
+            const auto& noteWitnesses = mapWallet.at(note.hash).mapSaplingNoteData.at(note).witnesses;
             auto it = noteWitnesses.cbegin(), end = noteWitnesses.cend();
             for (int i = 1; i < confirmations; i++) {
                 if (it == end) return false;
@@ -3957,11 +4876,26 @@ void CWalletTx::SetOrchardTxMeta(OrchardWalletTxMeta txMeta)
     orchardTxMeta = txMeta;
 }
 
+/** Keep a decrypted note in one of the wallet's plaintext caches. */
+template<typename OutPoint, typename Plaintext>
+static void CacheNotePlaintext(std::map<OutPoint, Plaintext>& cache, const OutPoint& op, const Plaintext& plaintext)
+{
+    if (cache.size() >= NOTE_PLAINTEXT_CACHE_SIZE) {
+        cache.clear();
+    }
+    cache.emplace(op, plaintext);
+}
+
 std::pair<SproutNotePlaintext, SproutPaymentAddress> CWalletTx::DecryptSproutNote(
     JSOutPoint jsop) const
 {
     LOCK(pwallet->cs_wallet);
 
+    auto it = pwallet->mapSproutPlaintexts.find(jsop);
+    if (it != pwallet->mapSproutPlaintexts.end()) {
+        return it->second;
+    }
+
     auto nd = this->mapSproutNoteData.at(jsop);
     SproutPaymentAddress pa = nd.address;
 
@@ -3987,7 +4921,9 @@ std::pair<SproutNotePlaintext, SproutPaymentAddress> CWalletTx::DecryptSproutNot
                 hSig,
                 (unsigned char) jsop.n);
 
-        return std::make_pair(plaintext, pa);
+        auto decrypted = std::make_pair(plaintext, pa);
+        CacheNotePlaintext(pwallet->mapSproutPlaintexts, jsop, decrypted);
+        return decrypted;
     } catch (const note_decryption_failed &err) {
         // Couldn't decrypt with this spending key
         throw std::runtime_error(strprintf(
@@ -4039,6 +4975,14 @@ std::optional<std::pair<
         return std::nullopt;
     }
 
+    if (pwallet != nullptr) {
+        LOCK(pwallet->cs_wallet);
+        auto it = pwallet->mapSaplingPlaintexts.find(op);
+        if (it != pwallet->mapSaplingPlaintexts.end()) {
+            return it->second;
+        }
+    }
+
     auto output = this->vShieldedOutput[op.n];
     auto nd = this->mapSaplingNoteData.at(op);
 
@@ -4060,7 +5004,12 @@ std::optional<std::pair<
     assert(static_cast<bool>(maybe_pa));
     auto pa = maybe_pa.value();
 
-    return std::make_pair(notePt, pa);
+    auto decrypted = std::make_pair(notePt, pa);
+    if (pwallet != nullptr) {
+        LOCK(pwallet->cs_wallet);
+        CacheNotePlaintext(pwallet->mapSaplingPlaintexts, op, decrypted);
+    }
+    return decrypted;
 }
 
 std::optional<std::pair<
@@ -4103,6 +5052,16 @@ std::optional<std::pair<
     SaplingNotePlaintext,
     SaplingPaymentAddress>> CWalletTx::RecoverSaplingNoteWithoutLeadByteCheck(SaplingOutPoint op, std::set<uint256>& ovks) const
 {
+    // An output that could not be recovered is tried again, as it may be
+    // recoverable with keys that have been added since.
+    if (pwallet != nullptr) {
+        LOCK(pwallet->cs_wallet);
+        auto it = pwallet->mapSaplingRecoveredPlaintexts.find(op);
+        if (it != pwallet->mapSaplingRecoveredPlaintexts.end()) {
+            return it->second;
+        }
+    }
+
     auto output = this->vShieldedOutput[op.n];
     // ZIP 216: This wallet method is not called from consensus rules.
     bool zip216Enabled = true;
@@ -4136,7 +5095,12 @@ std::optional<std::pair<
         assert(static_cast<bool>(maybe_pt));
         auto notePt = maybe_pt.value();
 
-        return std::make_pair(notePt, SaplingPaymentAddress(notePt.d, outPt->pk_d));
+        auto recovered = std::make_pair(notePt, SaplingPaymentAddress(notePt.d, outPt->pk_d));
+        if (pwallet != nullptr) {
+            LOCK(pwallet->cs_wallet);
+            CacheNotePlaintext(pwallet->mapSaplingRecoveredPlaintexts, op, recovered);
+        }
+        return recovered;
     }
 
     // Couldn't recover with any of the provided OutgoingViewingKeys
@@ -4149,6 +5113,16 @@ OrchardActions CWalletTx::RecoverOrchardActions(const std::vector<uint256>& ovks
 }
 
 
+size_t CWallet::DynamicMemoryUsage() const
+{
+    AssertLockHeld(cs_wallet);
+    size_t nUsage = memusage::DynamicUsage(mapWallet);
+    for (const auto& [txid, wtx] : mapWallet) {
+        nUsage += RecursiveDynamicUsage(wtx);
+    }
+    return nUsage;
+}
+
 int64_t CWalletTx::GetTxTime() const
 {
     int64_t n = nTimeSmart;
@@ -4350,7 +5324,7 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
         uint256 current_anchor = tree.root();
 
         // Consistency check: we should be able to find the current tree
-        // in our CCoins view.
+        // in our coins view.
         SproutMerkleTree dummy_tree;
         assert(pcoinsTip->GetSproutAnchorAt(current_anchor, dummy_tree));
 
@@ -4372,12 +5346,41 @@ void CWallet::WitnessNoteCommitment(std::vector<uint256> commitments,
  * from or to us. If fUpdate is true, found transactions that already
  * exist in the wallet will be updated.
  */
+/**
+ * Reads the given blocks, using up to the number of script check threads.
+ * A block that cannot be read is left null.
+ */
+static void ReadBlocksForRescan(const std::vector<CBlockIndex*>& vIndex, std::vector<CBlock>& vBlocks, const Consensus::Params& consensus)
+{
+    vBlocks.assign(vIndex.size(), CBlock());
+    std::atomic<size_t> nNext{0};
+    auto read = [&]() {
+        for (size_t i = nNext++; i < vIndex.size(); i = nNext++) {
+            if (!ReadBlockFromDisk(vBlocks[i], vIndex[i], consensus)) {
+                LogPrintf("Rescanning... failed to read block %s\n", vIndex[i]->GetBlockHash().ToString());
+                vBlocks[i].SetNull();
+            }
+        }
+    };
+    size_t nThreads = std::min(vIndex.size(), (size_t)std::max(1, nScriptCheckThreads));
+    std::vector<std::thread> vThreads;
+    for (size_t i = 1; i < nThreads; i++) {
+        vThreads.emplace_back(read);
+    }
+    read();
+    for (std::thread& thread : vThreads) {
+        thread.join();
+    }
+}
+
 int CWallet::ScanForWalletTransactions(
         CBlockIndex* pindexStart,
         bool fUpdate,
         bool isInitScan)
 {
     assert(pindexStart != nullptr);
+    auto span = TracingSpan("debug", "profile", "ScanForWalletTransactions");
+    auto spanGuard = span.Enter();
     int ret = 0;
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
@@ -4395,6 +5398,9 @@ int CWallet::ScanForWalletTransactions(
         while (chainActive.Next(pindex) != NULL && nTimeFirstKey && pindex->GetBlockTime() < nTimeFirstKey - TIMESTAMP_WINDOW) {
             pindex = chainActive.Next(pindex);
         }
+        // Likewise, the blocks before a key's own birthday are not tried
+        // with that key.
+        auto mapSaplingBirthHeights = GetSaplingKeyBirthHeights(pindex);
 
         // Attempt to rewind the orchard wallet to the rescan point if the wallet has any
         // checkpoints. Note data will be restored by the calls to AddToWalletIfInvolvingMe,
@@ -4440,37 +5446,96 @@ int CWallet::ScanForWalletTransactions(
         ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
         double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
         double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+        // The blocks are scanned in batches. The next batch is read from disk
+        // while the current one is scanned; the notes of a whole batch are
+        // trial-decrypted at once on the decryption queue, and then each
+        // block's transactions are added in order and its witnesses
+        // incremented.
+        auto nextBatch = [&](CBlockIndex* pindexFirst) {
+            std::vector<CBlockIndex*> vBatch;
+            for (CBlockIndex* p = pindexFirst; p != nullptr && vBatch.size() < RESCAN_BATCH_BLOCKS; p = chainActive.Next(p)) {
+                vBatch.push_back(p);
+            }
+            return vBatch;
+        };
+        std::vector<CBlockIndex*> vBatch = nextBatch(pindex);
+        std::vector<CBlock> vBlocks;
+        ReadBlocksForRescan(vBatch, vBlocks, consensus);
+        while (!vBatch.empty())
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
-
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, consensus);
-            for (CTransaction& tx : block.vtx)
-            {
-                if (AddToWalletIfInvolvingMe(consensus, tx, &block, pindex->nHeight, fUpdate)) {
-                    myTxHashes.push_back(tx.GetHash());
-                    ret++;
-                }
-            }
-
-            MerkleFrontiers frontiers;
-            // This should never fail: we should always be able to get the tree
-            // state on the path to the tip of our chain
-            assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, frontiers.sprout));
-            if (pindex->pprev) {
-                if (consensus.NetworkUpgradeActive(pindex->pprev->nHeight,  Consensus::UPGRADE_SAPLING)) {
-                    assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, frontiers.sapling));
+            std::vector<CBlockIndex*> vNextBatch = nextBatch(chainActive.Next(vBatch.back()));
+            std::vector<CBlock> vNextBlocks;
+            std::thread reader([&]() { ReadBlocksForRescan(vNextBatch, vNextBlocks, consensus); });
+            try {
+                std::vector<const CTransaction*> vtx;
+                std::vector<int> vHeights;
+                std::vector<mapSproutNoteData_t> vSproutNoteData;
+                for (size_t b = 0; b < vBatch.size(); b++) {
+                    for (const CTransaction& tx : vBlocks[b].vtx) {
+                        vtx.push_back(&tx);
+                        vHeights.push_back(vBatch[b]->nHeight);
+                        vSproutNoteData.push_back(FindMySproutNotes(tx));
+                    }
                 }
-                if (consensus.NetworkUpgradeActive(pindex->pprev->nHeight,  Consensus::UPGRADE_NU5)) {
-                    assert(pcoinsTip->GetOrchardAnchorAt(pindex->pprev->hashFinalOrchardRoot, frontiers.orchard));
+                auto vSaplingNoteData = FindMySaplingNotes(vtx, vHeights, &mapSaplingBirthHeights);
+
+                size_t nTx = 0;
+                for (size_t b = 0; b < vBatch.size(); b++) {
+                    pindex = vBatch[b];
+                    CBlock& block = vBlocks[b];
+                    if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
+                        ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+
+                    // The Orchard notes are decrypted a block at a time, as
+                    // the Orchard wallet must see each block's notes before
+                    // its commitments are appended.
+                    auto vOrchardTxMeta = AddOrchardNotesIfInvolvingMe(consensus,
+                        std::vector<const CTransaction*>(vtx.begin() + nTx, vtx.begin() + nTx + block.vtx.size()),
+                        pindex->nHeight, fUpdate);
+
+                    // The block's writes are committed before ChainTipAdded
+                    // starts its own database transaction.
+                    std::optional<CWalletDB> walletdb;
+                    BeginBlockWrites(walletdb);
+                    try {
+                        for (size_t i = 0; i < block.vtx.size(); i++)
+                        {
+                            const CTransaction& tx = block.vtx[i];
+                            if (AddToWalletIfInvolvingMe(consensus, tx, &block, pindex->nHeight, fUpdate,
+                                                         vSproutNoteData[nTx], vSaplingNoteData[nTx], vOrchardTxMeta[i],
+                                                         walletdb ? &walletdb.value() : nullptr)) {
+                                myTxHashes.push_back(tx.GetHash());
+                                ret++;
+                            }
+                            nTx++;
+                        }
+                    } catch (...) {
+                        CommitBlockWrites(walletdb);
+                        throw;
+                    }
+                    CommitBlockWrites(walletdb);
+
+                    MerkleFrontiers frontiers;
+                    // This should never fail: we should always be able to get the tree
+                    // state on the path to the tip of our chain
+                    assert(pcoinsTip->GetSproutAnchorAt(pindex->hashSproutAnchor, frontiers.sprout));
+                    if (pindex->pprev) {
+                        if (consensus.NetworkUpgradeActive(pindex->pprev->nHeight,  Consensus::UPGRADE_SAPLING)) {
+                            assert(pcoinsTip->GetSaplingAnchorAt(pindex->pprev->hashFinalSaplingRoot, frontiers.sapling));
+                        }
+                        if (consensus.NetworkUpgradeActive(pindex->pprev->nHeight,  Consensus::UPGRADE_NU5)) {
+                            assert(pcoinsTip->GetOrchardAnchorAt(pindex->pprev->hashFinalOrchardRoot, frontiers.orchard));
+                        }
+                    }
+                    // Increment note witness caches
+                    ChainTipAdded(pindex, &block, frontiers, performOrchardWalletUpdates);
                 }
+            } catch (...) {
+                reader.join();
+                throw;
             }
-            // Increment note witness caches
-            ChainTipAdded(pindex, &block, frontiers, performOrchardWalletUpdates);
+            reader.join();
 
-            pindex = chainActive.Next(pindex);
             if (GetTime() >= nNow + 60) {
                 nNow = GetTime();
                 LogPrintf(
@@ -4478,13 +5543,15 @@ int CWallet::ScanForWalletTransactions(
                         pindex->nHeight,
                         Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
             }
+            vBatch.swap(vNextBatch);
+            vBlocks.swap(vNextBlocks);
         }
 
         // After rescanning, persist Sapling & Orchard note data that might have changed,
         // e.g. nullifiers. Do not flush the wallet here for performance reasons.
         CWalletDB walletdb(strWalletFile, "r+", false);
         for (auto hash : myTxHashes) {
-            CWalletTx wtx = mapWallet[hash];
+            const CWalletTx& wtx = mapWallet[hash];
             if (!wtx.mapSaplingNoteData.empty() || !wtx.orchardTxMeta.empty()) {
                 if (!walletdb.WriteTx(wtx)) {
                     LogPrintf(
@@ -4809,9 +5876,8 @@ CAmount CWallet::GetBalance(const isminefilter& filter, const int min_depth) con
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        for (const CWalletTx* pcoin : GetUnspentCandidates())
         {
-            const CWalletTx* pcoin = &entry.second;
             if (pcoin->IsTrusted() && pcoin->GetDepthInMainChain() >= min_depth) {
                 nTotal += pcoin->GetAvailableCredit(true, filter);
             }
@@ -4826,9 +5892,8 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        for (const CWalletTx* pcoin : GetUnspentCandidates())
         {
-            const CWalletTx* pcoin = &entry.second;
             if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -4841,9 +5906,8 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        for (const CWalletTx* pcoin : GetUnspentCandidates())
         {
-            const CWalletTx* pcoin = &entry.second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -4855,9 +5919,8 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        for (const CWalletTx* pcoin : GetUnspentCandidates())
         {
-            const CWalletTx* pcoin = &entry.second;
             if (!CheckFinalTx(*pcoin) || (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0))
                 nTotal += pcoin->GetAvailableCredit(true, ISMINE_WATCH_ONLY);
         }
@@ -4870,9 +5933,8 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (const auto& entry : mapWallet)
+        for (const CWalletTx* pcoin : GetUnspentCandidates())
         {
-            const CWalletTx* pcoin = &entry.second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -4934,10 +5996,9 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins,
     vCoins.clear();
 
     {
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        for (const CWalletTx* pcoin : GetUnspentCandidates())
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const uint256& wtxid = pcoin->GetHash();
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -4975,8 +6036,8 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins,
                 }
 
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected((*it).first, i)))
+                    !IsLockedCoin(wtxid, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(wtxid, i)))
                         vCoins.push_back(COutput(pcoin, i, nDepth, isSpendable, isCoinbase));
             }
         }
@@ -5029,6 +6090,116 @@ static void ApproximateBestSubset(vector<pair<CAmount, pair<const CWalletTx*,uns
     }
 }
 
+/**
+ * Depth-first search over vValue, which must be sorted by descending value,
+ * for the subset adding up to between nTargetValue and nTargetValue +
+ * nCostOfChange with the fewest inputs, and of those the least excess. Each
+ * branch first includes the next coin, and is cut off once it overshoots the
+ * window, cannot reach the target with the coins left, or cannot use fewer
+ * inputs than the best subset found so far.
+ */
+static bool SelectBranchAndBound(const vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > >& vValue,
+                                 const CAmount& nTargetValue, const CAmount& nCostOfChange,
+                                 vector<size_t>& vBest, CAmount& nBest)
+{
+    vector<CAmount> vRemaining(vValue.size() + 1, 0);
+    for (size_t i = vValue.size(); i > 0; i--)
+        vRemaining[i - 1] = vRemaining[i] + vValue[i - 1].first;
+
+    vector<size_t> vSelected;
+    CAmount nSelected = 0;
+    size_t nNext = 0;
+    bool fFound = false;
+    for (size_t nTries = 0; nTries < SELECT_COINS_BNB_MAX_TRIES; nTries++)
+    {
+        bool fBacktrack = false;
+        if (nSelected + vRemaining[nNext] < nTargetValue ||
+            nSelected > nTargetValue + nCostOfChange)
+        {
+            fBacktrack = true;
+        }
+        else if (nSelected >= nTargetValue)
+        {
+            if (!fFound || vSelected.size() < vBest.size() ||
+                (vSelected.size() == vBest.size() && nSelected < nBest))
+            {
+                fFound = true;
+                vBest = vSelected;
+                nBest = nSelected;
+            }
+            // More inputs cannot improve on this subset.
+            fBacktrack = true;
+        }
+        else if (fFound && vSelected.size() >= vBest.size())
+        {
+            fBacktrack = true;
+        }
+        else if (fFound && vSelected.size() + 1 == vBest.size() &&
+                 nSelected + vValue[nNext].first < nTargetValue)
+        {
+            // The largest coin left is the only one that could be added.
+            fBacktrack = true;
+        }
+
+        if (fBacktrack)
+        {
+            if (vSelected.empty())
+                break;
+            // Exclude the last coin included, and the coins of the same value
+            // after it, which would only repeat the same branches.
+            size_t nLast = vSelected.back();
+            vSelected.pop_back();
+            nSelected -= vValue[nLast].first;
+            nNext = nLast + 1;
+            while (nNext < vValue.size() && vValue[nNext].first == vValue[nLast].first)
+                nNext++;
+        }
+        else
+        {
+            vSelected.push_back(nNext);
+            nSelected += vValue[nNext].first;
+            nNext++;
+        }
+    }
+    return fFound;
+}
+
+bool CWallet::SelectCoinsBnB(const CAmount& nTargetValue, const CAmount& nCostOfChange, int nConfMine, int nConfTheirs, const vector<COutput>& vCoins,
+                             set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet)
+{
+    setCoinsRet.clear();
+    nValueRet = 0;
+
+    vector<pair<CAmount, pair<const CWalletTx*,unsigned int> > > vValue;
+    vValue.reserve(vCoins.size());
+    for (const COutput &output : vCoins)
+    {
+        if (!output.fSpendable)
+            continue;
+
+        const CWalletTx *pcoin = output.tx;
+
+        if (output.nDepth < (pcoin->IsFromMe(ISMINE_ALL) ? nConfMine : nConfTheirs))
+            continue;
+
+        CAmount n = pcoin->vout[output.i].nValue;
+        if (n > 0)
+            vValue.push_back(make_pair(n, make_pair(pcoin, output.i)));
+    }
+    sort(vValue.rbegin(), vValue.rend(), CompareValueOnly());
+
+    vector<size_t> vBest;
+    CAmount nBest = 0;
+    if (!SelectBranchAndBound(vValue, nTargetValue, nCostOfChange, vBest, nBest))
+        return false;
+
+    for (size_t i : vBest)
+        setCoinsRet.insert(vValue[i].second);
+    nValueRet = nBest;
+    LogPrint("selectcoins", "SelectCoins() found %d inputs without change, total %s\n", vBest.size(), FormatMoney(nBest));
+    return true;
+}
+
 bool CWallet::SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, vector<COutput> vCoins,
                                  set<pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet)
 {
@@ -5134,8 +6305,9 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
 {
     // Output parameter fOnlyCoinbaseCoinsRet is set to true when the only available coins are coinbase utxos.
     vector<COutput> vCoinsNoCoinbase, vCoinsWithCoinbase;
-    AvailableCoins(vCoinsNoCoinbase, true, coinControl, false, false);
     AvailableCoins(vCoinsWithCoinbase, true, coinControl, false, true);
+    std::copy_if(vCoinsWithCoinbase.begin(), vCoinsWithCoinbase.end(), std::back_inserter(vCoinsNoCoinbase),
+        [](const COutput& out) { return !out.fIsCoinbase; });
     fOnlyCoinbaseCoinsRet = vCoinsNoCoinbase.size() == 0 && vCoinsWithCoinbase.size() > 0;
 
     // If coinbase utxos can only be sent to zaddrs, exclude any coinbase utxos from coin selection.
@@ -5207,10 +6379,17 @@ bool CWallet::SelectCoins(const CAmount& nTargetValue, set<pair<const CWalletTx*
             ++it;
     }
 
+    // Prefer the fewest inputs that need no change output; any excess below
+    // the dust threshold of the change output would go to the fee anyway.
+    const CAmount nCostOfChange = CTxOut(0, GetScriptForDestination(CKeyID())).GetDustThreshold(::minRelayTxFee);
+    auto selectMinConf = [&](int nConfMine, int nConfTheirs) {
+        return SelectCoinsBnB(nTargetValue - nValueFromPresetInputs, nCostOfChange, nConfMine, nConfTheirs, vCoins, setCoinsRet, nValueRet) ||
+            SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, nConfMine, nConfTheirs, vCoins, setCoinsRet, nValueRet);
+    };
     bool res = nTargetValue <= nValueFromPresetInputs ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 6, vCoins, setCoinsRet, nValueRet) ||
-        SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 1, 1, vCoins, setCoinsRet, nValueRet) ||
-        (bSpendZeroConfChange && SelectCoinsMinConf(nTargetValue - nValueFromPresetInputs, 0, 1, vCoins, setCoinsRet, nValueRet));
+        selectMinConf(1, 6) ||
+        selectMinConf(1, 1) ||
+        (bSpendZeroConfChange && selectMinConf(0, 1));
 
     // because SelectCoinsMinConf clears the setCoinsRet, we now add the possible inputs to the coinset
     setCoinsRet.insert(setPresetCoins.begin(), setPresetCoins.end());
@@ -5498,32 +6677,29 @@ bool CWallet::CreateTransaction(const vector<CRecipient>& vecSend, CWalletTx& wt
                 auto consensusBranchId = CurrentEpochBranchId(chainActive.Height() + 1, Params().GetConsensus());
 
                 // Sign
-                int nIn = 0;
                 CTransaction txNewConst(txNew);
                 std::vector<CTxOut> allPrevOutputs;
                 for (const std::pair<const CWalletTx*, unsigned int>& coin : setCoins) {
                     allPrevOutputs.push_back(coin.first->vout[coin.second]);
                 }
-                const PrecomputedTransactionData txdata(txNewConst, allPrevOutputs);
-                for (const std::pair<const CWalletTx*, unsigned int>& coin : setCoins)
-                {
-                    bool signSuccess;
-                    const CScript& scriptPubKey = coin.first->vout[coin.second].scriptPubKey;
-                    SignatureData sigdata;
-                    if (sign)
-                        signSuccess = ProduceSignature(TransactionSignatureCreator(this, &txNewConst, txdata, nIn, coin.first->vout[coin.second].nValue, SIGHASH_ALL), scriptPubKey, sigdata, consensusBranchId);
-                    else
-                        signSuccess = ProduceSignature(DummySignatureCreator(this), scriptPubKey, sigdata, consensusBranchId);
-
-                    if (!signSuccess)
-                    {
-                        strFailReason = _("Signing transaction failed");
-                        return false;
-                    } else {
-                        UpdateTransaction(txNew, nIn, sigdata);
+                std::vector<SignatureData> vSigData;
+                bool signSuccess = true;
+                if (sign) {
+                    const PrecomputedTransactionData txdata(txNewConst, allPrevOutputs);
+                    signSuccess = ProduceSignatures(*this, txNewConst, txdata, allPrevOutputs, SIGHASH_ALL, consensusBranchId, vSigData);
+                } else {
+                    vSigData.resize(allPrevOutputs.size());
+                    for (size_t nIn = 0; nIn < allPrevOutputs.size() && signSuccess; nIn++) {
+                        signSuccess = ProduceSignature(DummySignatureCreator(this), allPrevOutputs[nIn].scriptPubKey, vSigData[nIn], consensusBranchId);
                     }
-
-                    nIn++;
+                }
+                if (!signSuccess)
+                {
+                    strFailReason = _("Signing transaction failed");
+                    return false;
+                }
+                for (size_t nIn = 0; nIn < vSigData.size(); nIn++) {
+                    UpdateTransaction(txNew, nIn, vSigData[nIn]);
                 }
 
                 unsigned int nBytes = ::GetSerializeSize(txNew, SER_NETWORK, PROTOCOL_VERSION);
@@ -6339,6 +7515,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     std::string strUsage = HelpMessageGroup(_("Wallet options:"));
     strUsage += HelpMessageOpt("-disablewallet", _("Do not load the wallet and disable wallet RPC calls"));
     strUsage += HelpMessageOpt("-keypool=<n>", strprintf(_("Set key pool size to <n> (default: %u)"), DEFAULT_KEYPOOL_SIZE));
+    strUsage += HelpMessageOpt("-lazywitnesses", strprintf(_("Only compute the witnesses of Sapling notes when they are spent, instead of updating them in every block (default: %u)"), DEFAULT_LAZY_WITNESSES));
     strUsage += HelpMessageOpt("-migration", _("Enable the Sprout to Sapling migration"));
     strUsage += HelpMessageOpt("-migrationdestaddress=<zaddr>", _("Set the Sapling migration address"));
     strUsage += HelpMessageOpt("-mintxfee=<amt>", strprintf(_("Fees (in %s/kB) smaller than this are considered zero fee for transaction creation (default: %s)"),
@@ -6348,6 +7525,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
                                                             CURRENCY_UNIT, FormatMoney(payTxFee.GetFeePerK())));
     strUsage += HelpMessageOpt("-rescan", _("Rescan the block chain for missing wallet transactions on startup"));
     strUsage += HelpMessageOpt("-salvagewallet", _("Attempt to recover private keys from a corrupt wallet on startup (implies -rescan)"));
+    strUsage += HelpMessageOpt("-sendmanybatchwindow=<n>", strprintf(_("Pay z_sendmany requests made within <n> milliseconds of each other, from the same address and with the same options, in one transaction (default: %u)"), DEFAULT_SENDMANY_BATCH_WINDOW));
     strUsage += HelpMessageOpt("-sendfreetransactions", strprintf(_("Send transactions as zero-fee transactions if possible (default: %u)"), DEFAULT_SEND_FREE_TRANSACTIONS));
     strUsage += HelpMessageOpt("-spendzeroconfchange", strprintf(_("Spend unconfirmed change when sending transactions (default: %u)"), DEFAULT_SPEND_ZEROCONF_CHANGE));
     strUsage += HelpMessageOpt("-txconfirmtarget=<n>", strprintf(_("If paytxfee is not set, include enough fee so transactions begin confirmation on average within n blocks (default: %u)"), DEFAULT_TX_CONFIRM_TARGET));
@@ -6356,6 +7534,8 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
     strUsage += HelpMessageOpt("-wallet=<file>", _("Specify wallet file absolute path or a path relative to the data directory") + " " + strprintf(_("(default: %s)"), DEFAULT_WALLET_DAT));
     strUsage += HelpMessageOpt("-walletbroadcast", _("Make the wallet broadcast transactions") + " " + strprintf(_("(default: %u)"), DEFAULT_WALLETBROADCAST));
     strUsage += HelpMessageOpt("-walletnotify=<cmd>", _("Execute command when a wallet transaction changes (%s in cmd is replaced by TxID)"));
+    strUsage += HelpMessageOpt("-walletunlockcheckkeys=<n>", strprintf(_("Decrypt only <n> keys of each type when the wallet is first unlocked, and check the others when they are first used, or 0 to check every key (default: %u)"), DEFAULT_WALLET_UNLOCK_CHECK_KEYS));
+    strUsage += HelpMessageOpt("-witnesswriteinterval=<n>", strprintf(_("Write the wallet's note witnesses and best block at most every <n> seconds while blocks are connected, unless many blocks were connected since (default: %u)"), WITNESS_WRITE_INTERVAL));
     strUsage += HelpMessageOpt("-zapwallettxes=<mode>", _("Delete all wallet transactions and only recover those parts of the blockchain through -rescan on startup") +
                                " " + _("(1 = keep tx meta data e.g. account owner and payment request information, 2 = drop tx meta data)"));
     strUsage += HelpMessageOpt("-walletrequirebackup=<bool>", _("By default, the wallet will not allow generation of new spending keys & addresses from the mnemonic seed until the backup of that seed has been confirmed with the `zcashd-wallet-tool` utility. A user may start zcashd with `-walletrequirebackup=false` to allow generation of spending keys even if the backup has not yet been confirmed."));
@@ -6471,13 +7651,29 @@ bool CWallet::InitLoadWallet(const CChainParams& params, bool clearWitnessCaches
 
     LogPrintf(" wallet      %15dms\n", GetTimeMillis() - nStart);
 
-    RegisterValidationInterface(walletInstance);
+    RegisterQueuedValidationInterface(walletInstance, "wallet");
 
     // chainActive.Genesis() may return null; in this case, we want rescanning
     // to happen automatically as a consequence of the genesis block (and subsequent
     // blocks) being added to the chain.
     CBlockIndex *pindexRescan = chainActive.Genesis();
-    if (clearWitnessCaches || GetBoolArg("-rescan", false)) {
+    if (clearWitnessCaches && !GetBoolArg("-rescan", false)) {
+        walletInstance->ClearNoteWitnessCache();
+        // Only the witnesses are rebuilt, and those of a note start from the
+        // commitment trees stored for the block before its own, so there is
+        // nothing to do in the blocks before the first note of the wallet.
+        // The Orchard wallet is rebuilt from NU5 activation if the rescan
+        // would otherwise start after it.
+        LOCK(cs_main);
+        pindexRescan = walletInstance->GetEarliestNoteBlock();
+        int nu5Height = Params().GetConsensus().GetActivationHeight(Consensus::UPGRADE_NU5).value_or(-1);
+        if (pindexRescan == nullptr || (nu5Height >= 0 && pindexRescan->nHeight > nu5Height)) {
+            pindexRescan = nu5Height >= 0 ? chainActive[nu5Height] : nullptr;
+        }
+        if (pindexRescan == nullptr) {
+            pindexRescan = chainActive.Tip();
+        }
+    } else if (clearWitnessCaches || GetBoolArg("-rescan", false)) {
         walletInstance->ClearNoteWitnessCache();
     } else {
         CWalletDB walletdb(walletFile);
@@ -6597,6 +7793,22 @@ bool CWallet::ParameterInteraction(const CChainParams& params)
     }
     bSpendZeroConfChange = GetBoolArg("-spendzeroconfchange", DEFAULT_SPEND_ZEROCONF_CHANGE);
     fSendFreeTransactions = GetBoolArg("-sendfreetransactions", DEFAULT_SEND_FREE_TRANSACTIONS);
+    fLazyWitnesses = GetBoolArg("-lazywitnesses", DEFAULT_LAZY_WITNESSES);
+    nWitnessWriteInterval = GetArg("-witnesswriteinterval", WITNESS_WRITE_INTERVAL);
+    if (nWitnessWriteInterval < 0) {
+        return UIError(strprintf(_("Invalid value for -witnesswriteinterval='%d' (must not be negative)"), nWitnessWriteInterval));
+    }
+    nSendManyBatchWindow = GetArg("-sendmanybatchwindow", DEFAULT_SENDMANY_BATCH_WINDOW);
+    if (nSendManyBatchWindow < 0) {
+        return UIError(strprintf(_("Invalid value for -sendmanybatchwindow='%d' (must not be negative)"), nSendManyBatchWindow));
+    }
+    nWalletUnlockCheckKeys = GetArg("-walletunlockcheckkeys", DEFAULT_WALLET_UNLOCK_CHECK_KEYS);
+    if (nWalletUnlockCheckKeys < 0) {
+        return UIError(strprintf(_("Invalid value for -walletunlockcheckkeys='%d' (must not be negative)"), nWalletUnlockCheckKeys));
+    }
+    if (fLazyWitnesses && fPruneMode) {
+        return UIError(_("-lazywitnesses needs the blocks since the wallet's notes were received, and is incompatible with -prune."));
+    }
 
     KeyIO keyIO(params);
     // Check Sapling migration address if set and is a valid Sapling address
@@ -6803,8 +8015,22 @@ void CWallet::GetFilteredNotes(
     LOCK2(cs_main, cs_wallet);
 
     KeyIO keyIO(Params());
-    for (auto & p : mapWallet) {
-        CWalletTx wtx = p.second;
+    // Spent notes are only looked for in the whole wallet when asked for,
+    // and the notes to given addresses only in the transactions that have
+    // notes to them.
+    std::vector<const CWalletTx*> vWtx;
+    if (noteFilter.has_value()) {
+        vWtx = GetNoteFilterCandidates(noteFilter.value());
+    } else if (ignoreSpent) {
+        vWtx = GetUnspentCandidates();
+    } else {
+        vWtx.reserve(mapWallet.size());
+        for (const auto& p : mapWallet) {
+            vWtx.push_back(&p.second);
+        }
+    }
+    for (const CWalletTx* pwtx : vWtx) {
+        const CWalletTx& wtx = *pwtx;
 
         // Filter the transactions before checking for notes
         if (!CheckFinalTx(wtx) ||
@@ -6880,7 +8106,11 @@ void CWallet::GetFilteredNotes(
 
         for (auto & pair : wtx.mapSaplingNoteData) {
             SaplingOutPoint op = pair.first;
-            SaplingNoteData nd = pair.second;
+            const SaplingNoteData& nd = pair.second;
+
+            if (ignoreSpent && nd.nullifier.has_value() && IsSaplingSpent(nd.nullifier.value())) {
+                continue;
+            }
 
             auto optDeserialized = SaplingNotePlaintext::attempt_sapling_enc_decryption_deserialization(wtx.vShieldedOutput[op.n].encCiphertext, nd.ivk, wtx.vShieldedOutput[op.n].ephemeralKey);
 
@@ -6898,10 +8128,6 @@ void CWallet::GetFilteredNotes(
                 continue;
             }
 
-            if (ignoreSpent && nd.nullifier.has_value() && IsSaplingSpent(nd.nullifier.value())) {
-                continue;
-            }
-
             // skip notes which cannot be spent
             if (requireSpendingKey && !HaveSaplingSpendingKeyForAddress(pa)) {
                 continue;
@@ -7588,7 +8814,7 @@ bool SpendableInputs::LimitToAmount(
         // Select Sprout notes for spending first - if possible, we want users to
         // spend any notes that they still have in the Sprout pool.
         std::sort(sproutNoteEntries.begin(), sproutNoteEntries.end(),
-            [](SproutNoteEntry i, SproutNoteEntry j) -> bool {
+            [](const SproutNoteEntry& i, const SproutNoteEntry& j) -> bool {
                 return i.note.value() > j.note.value();
             });
         auto sproutIt = sproutNoteEntries.begin();
@@ -7762,7 +8988,7 @@ bool SpendableInputs::LimitToAmount(
             case OutputPool::Transparent:
             {
                 std::sort(utxos.begin(), utxos.end(),
-                    [](COutput i, COutput j) -> bool {
+                    [](const COutput& i, const COutput& j) -> bool {
                         return i.Value() > j.Value();
                     });
                 if (opportunisticShielding) {
@@ -7783,7 +9009,7 @@ bool SpendableInputs::LimitToAmount(
             case OutputPool::Sapling:
             {
                 std::sort(saplingNoteEntries.begin(), saplingNoteEntries.end(),
-                    [](SaplingNoteEntry i, SaplingNoteEntry j) -> bool {
+                    [](const SaplingNoteEntry& i, const SaplingNoteEntry& j) -> bool {
                         return i.note.value() > j.note.value();
                     });
                 auto saplingIt = saplingNoteEntries.begin();
@@ -7798,7 +9024,7 @@ bool SpendableInputs::LimitToAmount(
             case OutputPool::Orchard:
             {
                 std::sort(orchardNoteMetadata.begin(), orchardNoteMetadata.end(),
-                    [](OrchardNoteMetadata i, OrchardNoteMetadata j) -> bool {
+                    [](const OrchardNoteMetadata& i, const OrchardNoteMetadata& j) -> bool {
                         return i.GetNoteValue() > j.GetNoteValue();
                     });
                 auto orchardIt = orchardNoteMetadata.begin();
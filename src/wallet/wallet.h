@@ -43,6 +43,7 @@
 #include <vector>
 
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 
 extern CWallet* pwalletMain;
 
@@ -55,6 +56,9 @@ extern bool bSpendZeroConfChange;
 extern bool fSendFreeTransactions;
 extern bool fPayAtLeastCustomFee;
 extern unsigned int nAnchorConfirmations;
+extern bool fLazyWitnesses;
+extern int64_t nWitnessWriteInterval;
+extern int64_t nSendManyBatchWindow;
 // The maximum number of Orchard actions permitted within a single transaction.
 // This can be overridden with the -orchardactionlimit config option
 extern unsigned int nOrchardActionLimit;
@@ -66,10 +70,14 @@ static const CAmount DEFAULT_TRANSACTION_FEE = 0;
 static const CAmount DEFAULT_TRANSACTION_MINFEE = 1000;
 //! minimum change amount
 static const CAmount MIN_CHANGE = CENT;
+//! Steps after which the branch-and-bound coin selection search gives up
+static const size_t SELECT_COINS_BNB_MAX_TRIES = 100000;
 //! Default for -spendzeroconfchange
 static const bool DEFAULT_SPEND_ZEROCONF_CHANGE = true;
 //! Default for -sendfreetransactions
 static const bool DEFAULT_SEND_FREE_TRANSACTIONS = false;
+//! Default for -lazywitnesses
+static const bool DEFAULT_LAZY_WITNESSES = false;
 //! -txconfirmtarget default
 static const unsigned int DEFAULT_TX_CONFIRM_TARGET = 2;
 //! Largest (in bytes) free transaction we're willing to create
@@ -88,6 +96,14 @@ static const unsigned int DEFAULT_ANCHOR_CONFIRMATIONS = 3;
 static const unsigned int DEFAULT_NOTE_CONFIRMATIONS = 10;
 //! -orchardactionlimit default
 static const unsigned int DEFAULT_ORCHARD_ACTION_LIMIT = 50;
+//! -sendmanybatchwindow default, in milliseconds
+static const int64_t DEFAULT_SENDMANY_BATCH_WINDOW = 0;
+//! Number of note plaintexts kept by each of the wallet's plaintext caches
+static const size_t NOTE_PLAINTEXT_CACHE_SIZE = 10000;
+//! Number of blocks read ahead and trial-decrypted together when rescanning
+static const size_t RESCAN_BATCH_BLOCKS = 16;
+//! Number of viewing keys each Sapling output is tried with in one trial decryption check
+static const size_t SAPLING_TRIAL_DECRYPTION_SHARD_KEYS = 128;
 
 extern const char * DEFAULT_WALLET_DAT;
 
@@ -344,6 +360,56 @@ public:
 typedef std::map<JSOutPoint, SproutNoteData> mapSproutNoteData_t;
 typedef std::map<SaplingOutPoint, SaplingNoteData> mapSaplingNoteData_t;
 
+/** The outcome of trial-decrypting a Sapling output with the wallet's keys. */
+struct SaplingTrialDecryptionResult
+{
+    //! Index of the first key that decrypted the output, if any did.
+    std::optional<size_t> nKey;
+    //! The address the note was sent to.
+    std::optional<libzcash::SaplingPaymentAddress> address;
+};
+
+/**
+ * Closure representing one Sapling output to trial-decrypt with each of a
+ * shard of a snapshot of incoming viewing keys in turn, stopping at the
+ * first that decrypts it. Run on the wallet's trial decryption CCheckQueue.
+ * Note that this stores references to the output, the keys and the result.
+ */
+class CSaplingTrialDecryption
+{
+private:
+    const OutputDescription *poutput;
+    const std::vector<libzcash::SaplingIncomingViewingKey> *pvIvks;
+    size_t nKeyBegin;
+    size_t nKeyEnd;
+    const Consensus::Params *params;
+    int nHeight;
+    SaplingTrialDecryptionResult *presult;
+
+public:
+    CSaplingTrialDecryption(): poutput(0), pvIvks(0), nKeyBegin(0), nKeyEnd(0), params(0), nHeight(0), presult(0) {}
+    CSaplingTrialDecryption(const OutputDescription& outputIn, const std::vector<libzcash::SaplingIncomingViewingKey>& vIvksIn,
+                            size_t nKeyBeginIn, size_t nKeyEndIn,
+                            const Consensus::Params& paramsIn, int nHeightIn, SaplingTrialDecryptionResult& resultIn) :
+        poutput(&outputIn), pvIvks(&vIvksIn), nKeyBegin(nKeyBeginIn), nKeyEnd(nKeyEndIn),
+        params(&paramsIn), nHeight(nHeightIn), presult(&resultIn) { }
+
+    bool operator()();
+
+    void swap(CSaplingTrialDecryption &check) {
+        std::swap(poutput, check.poutput);
+        std::swap(pvIvks, check.pvIvks);
+        std::swap(nKeyBegin, check.nKeyBegin);
+        std::swap(nKeyEnd, check.nKeyEnd);
+        std::swap(params, check.params);
+        std::swap(nHeight, check.nHeight);
+        std::swap(presult, check.presult);
+    }
+};
+
+/** Run a worker thread of the Sapling trial decryption queue. */
+void ThreadSaplingTrialDecryption();
+
 /** Sprout note, its location in a transaction, and number of confirmations. */
 struct SproutNoteEntry
 {
@@ -434,6 +500,11 @@ typedef std::variant<
     libzcash::UnifiedAddressGenerationError,
     WalletUAGenerationError> WalletUAGenerationResult;
 
+typedef std::variant<
+    std::vector<std::pair<libzcash::UnifiedAddress, libzcash::diversifier_index_t>>,
+    libzcash::UnifiedAddressGenerationError,
+    WalletUAGenerationError> WalletUABatchGenerationResult;
+
 /**
  * A transaction with a bunch of additional info that only the owner cares about.
  * It includes any unrecorded transactions needed to link it back to the block chain.
@@ -1044,6 +1115,15 @@ private:
     int nSetChainUpdates;
     bool fBroadcastTransactions;
 
+    /**
+     * With -lazywitnesses, the Sapling witnesses that GetSaplingNoteWitnesses
+     * caught up to the anchor block hashAnchorWitnesses, so that building
+     * another transaction spending the same notes at the same tip does not
+     * read the blocks again. Cleared when the tip changes.
+     */
+    mutable std::map<SaplingOutPoint, SaplingWitness> mapAnchorWitnesses;
+    mutable uint256 hashAnchorWitnesses;
+
     /**
      * A map from a protocol-specific transaction output identifier to
      * a txid.
@@ -1075,6 +1155,56 @@ private:
     void AddToSaplingSpends(const uint256& nullifier, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * The transactions in mapWallet that may have outputs of ours that are
+     * unspent, so that the balance and unspent-output queries need not look
+     * at the whole wallet. A transaction is forgotten once all of those
+     * outputs are spent by transactions at least MAX_REORG_LENGTH blocks
+     * deep, which is checked at most once per chain height; it is added
+     * again whenever it is added to the wallet or updated.
+     *
+     * Maps each txid to the height of the tip when it was last checked.
+     */
+    mutable std::map<uint256, int> mapUnspentCandidates;
+
+    bool MayHaveUnspentOutputs(const CWalletTx& wtx) const;
+
+    /**
+     * The transactions in mapWallet with notes to each Sprout address and
+     * to each Sapling incoming viewing key, so that the note queries for a
+     * few addresses need not look at the whole wallet. Entries are only
+     * added; erased transactions are skipped when they are looked up.
+     */
+    std::map<libzcash::SproutPaymentAddress, std::set<uint256>> mapSproutAddressTxids;
+    std::map<libzcash::SaplingIncomingViewingKey, std::set<uint256>> mapSaplingIvkTxids;
+
+    void IndexNoteOwners(const CWalletTx& wtx);
+    /**
+     * The transactions in mapWallet that may have notes to the Sprout or
+     * Sapling addresses of noteFilter, in txid order. Requires cs_wallet.
+     */
+    std::vector<const CWalletTx*> GetNoteFilterCandidates(const NoteFilter& noteFilter) const;
+    //! Whether the transaction is at least MAX_REORG_LENGTH blocks deep, so
+    //! that its spends are not expected to be reorganized away.
+    bool IsSpendDeep(const uint256& spendingTxid) const;
+
+    /**
+     * The Sapling notes whose witnesses were dropped by
+     * PruneSpentNoteWitnesses. Their nullifiers are kept, although a note
+     * without witnesses otherwise has none.
+     */
+    std::set<SaplingOutPoint> setPrunedSaplingWitnesses;
+
+    //! Start a database transaction for the writes for a block, leaving
+    //! walletdb empty if it cannot be started.
+    void BeginBlockWrites(std::optional<CWalletDB>& walletdb);
+    void CommitBlockWrites(std::optional<CWalletDB>& walletdb);
+    /**
+     * The transactions in mapWallet that may have unspent outputs of ours,
+     * in txid order. Requires cs_main and cs_wallet.
+     */
+    std::vector<const CWalletTx*> GetUnspentCandidates() const;
+
 public:
     /*
      * Size of the incremental witness cache for the notes in our wallet.
@@ -1085,8 +1215,34 @@ public:
     bool fSaplingMigrationEnabled = false;
 
     void ClearNoteWitnessCache();
+    /**
+     * The earliest block in the active chain with a transaction that has
+     * Sprout or Sapling note data, or null if there is none. Requires
+     * cs_main.
+     */
+    CBlockIndex* GetEarliestNoteBlock() const;
+    /**
+     * Drop the cached witnesses of Sprout and Sapling notes that are spent
+     * by transactions at least MAX_REORG_LENGTH blocks deep, as they will
+     * never be needed again. The witnesses of every other note are
+     * incremented with each block and written with its transaction, so
+     * without this the wallet file and its backups keep growing with the
+     * wallet's spent notes. Orchard notes spent as deeply stop being
+     * witnessed in the Orchard note commitment tree, whose next garbage
+     * collection drops the data kept for them. Requires cs_main.
+     */
+    void PruneSpentNoteWitnesses();
 
 protected:
+    /**
+     * Whether the wallet has notes of the Sprout or Sapling pool, or keys
+     * that can decrypt them. The note commitments of a pool are only
+     * appended, and its witnesses only maintained, while this holds; the
+     * frontiers that IncrementNoteWitnesses is given are those of the chain,
+     * so a pool is picked up from the next block once a key for it is added.
+     */
+    bool HasSproutKeysOrNotes() const;
+    bool HasSaplingKeysOrNotes() const;
     /**
      * pindex is the new tip being connected.
      */
@@ -1104,6 +1260,14 @@ protected:
             const Consensus::Params& consensus,
             const CBlockIndex* pindex
             );
+    /**
+     * Catch up the Sapling witnesses that were not incremented under
+     * -lazywitnesses, so that they can be incremented from pindex.
+     */
+    void CatchUpLazySaplingWitnesses(
+            const Consensus::Params& consensus,
+            const CBlockIndex* pindex
+            );
 
     template <typename WalletDB>
     void SetBestChainINTERNAL(WalletDB& walletdb, const CBlockLocator& loc) {
@@ -1115,7 +1279,7 @@ protected:
         try {
             LOCK(cs_wallet);
             for (std::pair<const uint256, CWalletTx>& wtxItem : mapWallet) {
-                auto wtx = wtxItem.second;
+                const CWalletTx& wtx = wtxItem.second;
                 // We skip transactions for which mapSproutNoteData and mapSaplingNoteData
                 // are empty. This covers transactions that have no Sprout or Sapling data
                 // (i.e. are purely transparent), as well as shielding and unshielding
@@ -1300,10 +1464,31 @@ public:
      *
      * - Restarting the node with -reindex (which operates on a locked wallet
      *   but with the now-cached nullifiers).
+     *
+     * The nullifiers themselves are persisted with each transaction's note
+     * data, so the maps are rebuilt on load without any decryption. They are
+     * hashed rather than ordered, as they are only ever looked up: every
+     * shielded spend in every connected block is checked against them.
+     */
+    boost::unordered_map<uint256, JSOutPoint, SaltedTxidHasher> mapSproutNullifiersToNotes;
+
+    boost::unordered_map<uint256, SaplingOutPoint, SaltedTxidHasher> mapSaplingNullifiersToNotes;
+
+    /**
+     * The notes that CWalletTx has decrypted or recovered for showing
+     * transactions, so that showing a transaction again does not repeat the
+     * decryption of each of its outputs. Only notes that were decrypted are
+     * kept, and each cache is cleared once it holds NOTE_PLAINTEXT_CACHE_SIZE
+     * notes. They are kept in memory only, as the wallet file does not
+     * otherwise hold plaintexts. Guarded by cs_wallet.
      */
-    std::map<uint256, JSOutPoint> mapSproutNullifiersToNotes;
+    mutable std::map<JSOutPoint, std::pair<libzcash::SproutNotePlaintext, libzcash::SproutPaymentAddress>> mapSproutPlaintexts;
+    mutable std::map<SaplingOutPoint, std::pair<libzcash::SaplingNotePlaintext, libzcash::SaplingPaymentAddress>> mapSaplingPlaintexts;
+    mutable std::map<SaplingOutPoint, std::pair<libzcash::SaplingNotePlaintext, libzcash::SaplingPaymentAddress>> mapSaplingRecoveredPlaintexts;
 
-    std::map<uint256, SaplingOutPoint> mapSaplingNullifiersToNotes;
+    //! Whether any transaction in mapWallet has Sprout or Sapling note data.
+    bool fHaveSproutNotes = false;
+    bool fHaveSaplingNotes = false;
 
     std::map<uint256, CWalletTx> mapWallet;
 
@@ -1350,6 +1535,15 @@ public:
      */
     static bool SelectCoinsMinConf(const CAmount& nTargetValue, int nConfMine, int nConfTheirs, std::vector<COutput> vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet);
 
+    /**
+     * Search by branch and bound for the coins adding up to between
+     * nTargetValue and nTargetValue + nCostOfChange, so that no change output
+     * is needed, using as few inputs as possible. Returns false if there is
+     * no such selection, or none was found within
+     * SELECT_COINS_BNB_MAX_TRIES steps.
+     */
+    static bool SelectCoinsBnB(const CAmount& nTargetValue, const CAmount& nCostOfChange, int nConfMine, int nConfTheirs, const std::vector<COutput>& vCoins, std::set<std::pair<const CWalletTx*,unsigned int> >& setCoinsRet, CAmount& nValueRet);
+
     /**
      * Returns the ZTXO selector for the specified account ID.
      *
@@ -1539,6 +1733,11 @@ public:
     bool AddSaplingPaymentAddress(
         const libzcash::SaplingIncomingViewingKey &ivk,
         const libzcash::SaplingPaymentAddress &addr);
+    //! As above, writing the address through pwalletdb if it is not null.
+    bool AddSaplingPaymentAddress(
+        const libzcash::SaplingIncomingViewingKey &ivk,
+        const libzcash::SaplingPaymentAddress &addr,
+        CWalletDB* pwalletdb);
     bool AddCryptedSaplingSpendingKey(
         const libzcash::SaplingExtendedFullViewingKey &extfvk,
         const std::vector<unsigned char> &vchCryptedSecret);
@@ -1619,6 +1818,17 @@ public:
         const std::set<libzcash::ReceiverType>& receivers,
         std::optional<libzcash::diversifier_index_t> j = std::nullopt);
 
+    //! Generate the next `count` unified addresses for the specified account
+    //! and set of receiver types, at the next unused diversifier indices.
+    //!
+    //! The candidate diversifier indices are tried in parallel, and the
+    //! addresses are recorded in a single wallet database transaction. Either
+    //! all of the addresses are generated, or none are.
+    WalletUABatchGenerationResult GenerateUnifiedAddresses(
+        const libzcash::AccountId& accountId,
+        const std::set<libzcash::ReceiverType>& receiverTypes,
+        size_t count);
+
     bool AddUnifiedFullViewingKey(const libzcash::UnifiedFullViewingKey &ufvk);
 
     bool LoadUnifiedFullViewingKey(const libzcash::UnifiedFullViewingKey &ufvk);
@@ -1675,6 +1885,7 @@ public:
     void LoadWalletTx(const CWalletTx& wtxIn);
     bool AddToWallet(const CWalletTx& wtxIn, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlock* pblock, const int nHeight);
+    void SyncTransactions(const std::vector<CTransaction>& vtx, const CBlock* pblock, const int nHeight);
     bool AddToWalletIfInvolvingMe(
             const Consensus::Params& consensus,
             const CTransaction& tx,
@@ -1682,6 +1893,35 @@ public:
             const int nHeight,
             bool fUpdate
             );
+    /**
+     * As above, with the Sprout and Sapling notes of tx already found by
+     * FindMySproutNotes and FindMySaplingNotes, and its Orchard notes
+     * already added by AddOrchardNotesIfInvolvingMe. If pwalletdb is not
+     * null, the wallet is written through it, so that the writes for a block
+     * can be grouped into one database transaction.
+     */
+    bool AddToWalletIfInvolvingMe(
+            const Consensus::Params& consensus,
+            const CTransaction& tx,
+            const CBlock* pblock,
+            const int nHeight,
+            bool fUpdate,
+            const mapSproutNoteData_t& sproutNoteData,
+            const std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>& saplingNoteDataAndAddressesToAdd,
+            const std::optional<OrchardWalletTxMeta>& orchardTxMeta,
+            CWalletDB* pwalletdb = nullptr
+            );
+    /**
+     * Add the Orchard notes of the transactions of one block to the Orchard
+     * wallet, decrypting them together, and return the wallet's involvement
+     * with each. Transactions already in the wallet are skipped unless
+     * fUpdate is true.
+     */
+    std::vector<std::optional<OrchardWalletTxMeta>> AddOrchardNotesIfInvolvingMe(
+            const Consensus::Params& consensus,
+            const std::vector<const CTransaction*>& vtx,
+            const int nHeight,
+            bool fUpdate);
     void EraseFromWallet(const uint256 &hash);
     void WitnessNoteCommitment(
          std::vector<uint256> commitments,
@@ -1783,6 +2023,19 @@ public:
         uint8_t n) const;
     mapSproutNoteData_t FindMySproutNotes(const CTransaction& tx) const;
     std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap> FindMySaplingNotes(const CTransaction& tx, int height) const;
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> FindMySaplingNotes(const std::vector<CTransaction>& vtx, int height) const;
+    //! As above, for transactions mined at different heights. If birthday
+    //! heights are given, each output is only tried with the keys whose
+    //! birthday is at or before its height; keys without one are always tried.
+    std::vector<std::pair<mapSaplingNoteData_t, SaplingIncomingViewingKeyMap>> FindMySaplingNotes(
+        const std::vector<const CTransaction*>& vtx, const std::vector<int>& vHeights,
+        const std::map<libzcash::SaplingIncomingViewingKey, int>* pBirthHeights = nullptr) const;
+    /**
+     * The birthday height of each Sapling spending key with a known creation
+     * time: the first block from pindexStart on that may have been mined
+     * after the key was created, or past the tip if there is none.
+     */
+    std::map<libzcash::SaplingIncomingViewingKey, int> GetSaplingKeyBirthHeights(const CBlockIndex* pindexStart) const;
     bool IsSproutNullifierFromMe(const uint256& nullifier) const;
     bool IsSaplingNullifierFromMe(const uint256& nullifier) const;
 
@@ -1878,6 +2131,16 @@ public:
         return setKeyPool.size();
     }
 
+    //! An estimate of the memory used by the wallet's transactions.
+    size_t DynamicMemoryUsage() const;
+
+    //! An estimate of the memory used by the Orchard wallet, which is a lower bound.
+    size_t OrchardDynamicMemoryUsage() const
+    {
+        AssertLockHeld(cs_wallet);
+        return orchardWallet.DynamicMemoryUsage();
+    }
+
     bool SetDefaultKey(const CPubKey &vchPubKey);
 
     //! signify that a particular wallet feature is now used. this may change nWalletVersion and nWalletMaxVersion if those are lower
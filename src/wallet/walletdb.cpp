@@ -24,6 +24,7 @@
 #include <boost/thread.hpp>
 #include <atomic>
 #include <string>
+#include <thread>
 
 using namespace std;
 
@@ -359,6 +360,68 @@ public:
     }
 };
 
+/**
+ * Deserialize and check a "tx" record whose key has been read up to the
+ * record type. This does not touch the wallet, so that the records can be
+ * decoded in parallel; fUpgrade is set if the record is to be rewritten.
+ */
+static bool DecodeWalletTx(CDataStream& ssKey, CDataStream& ssValue, CWalletTx& wtx, bool& fUpgrade, string& strErr)
+{
+    fUpgrade = false;
+    try {
+        uint256 hash;
+        ssKey >> hash;
+        ssValue >> wtx;
+        CValidationState state;
+        // The proofs were verified when the transaction was added to
+        // the wallet; verifying them again would make loading a wallet
+        // with many shielded transactions slow.
+        auto verifier = ProofVerifier::Disabled();
+        if (!(
+            CheckTransaction(wtx, state, verifier) &&
+            (wtx.GetHash() == hash) &&
+            state.IsValid())
+        ) {
+            return false;
+        }
+
+        // Undo serialize changes in 31600
+        if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
+        {
+            if (!ssValue.empty())
+            {
+                char fTmp;
+                char fUnused;
+                std::string unused_string;
+                ssValue >> fTmp >> fUnused >> unused_string;
+                strErr = strprintf("LoadWallet() upgrading tx ver=%d %d %s",
+                                   wtx.fTimeReceivedIsTxTime, fTmp, hash.ToString());
+                wtx.fTimeReceivedIsTxTime = fTmp;
+            }
+            else
+            {
+                strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
+                wtx.fTimeReceivedIsTxTime = 0;
+            }
+            fUpgrade = true;
+        }
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+static void LoadDecodedWalletTx(CWallet* pwallet, const CWalletTx& wtx, bool fUpgrade, CWalletScanState& wss)
+{
+    if (fUpgrade)
+        wss.vWalletUpgrade.push_back(wtx.GetHash());
+
+    if (wtx.nOrderPos == -1)
+        wss.fAnyUnordered = true;
+
+    pwallet->LoadWalletTx(wtx);
+}
+
 bool
 ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
              CWalletScanState &wss, string& strType, string& strErr)
@@ -384,45 +447,12 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
         }
         else if (strType == "tx")
         {
-            uint256 hash;
-            ssKey >> hash;
             CWalletTx wtx;
-            ssValue >> wtx;
-            CValidationState state;
-            auto verifier = ProofVerifier::Strict();
-            if (!(
-                CheckTransaction(wtx, state, verifier) &&
-                (wtx.GetHash() == hash) &&
-                state.IsValid())
-            ) {
+            bool fUpgrade;
+            if (!DecodeWalletTx(ssKey, ssValue, wtx, fUpgrade, strErr)) {
                 return false;
             }
-
-            // Undo serialize changes in 31600
-            if (31404 <= wtx.fTimeReceivedIsTxTime && wtx.fTimeReceivedIsTxTime <= 31703)
-            {
-                if (!ssValue.empty())
-                {
-                    char fTmp;
-                    char fUnused;
-                    std::string unused_string;
-                    ssValue >> fTmp >> fUnused >> unused_string;
-                    strErr = strprintf("LoadWallet() upgrading tx ver=%d %d %s",
-                                       wtx.fTimeReceivedIsTxTime, fTmp, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = fTmp;
-                }
-                else
-                {
-                    strErr = strprintf("LoadWallet() repairing tx ver=%d %s", wtx.fTimeReceivedIsTxTime, hash.ToString());
-                    wtx.fTimeReceivedIsTxTime = 0;
-                }
-                wss.vWalletUpgrade.push_back(hash);
-            }
-
-            if (wtx.nOrderPos == -1)
-                wss.fAnyUnordered = true;
-
-            pwallet->LoadWalletTx(wtx);
+            LoadDecodedWalletTx(pwallet, wtx, fUpgrade, wss);
         }
         else if (strType == "watchs")
         {
@@ -905,6 +935,42 @@ ReadKeyValue(CWallet* pwallet, CDataStream& ssKey, CDataStream& ssValue,
     return true;
 }
 
+/** Number of transaction records decoded together when loading a wallet. */
+static const size_t WALLET_LOAD_TX_BATCH = 1000;
+
+/** A transaction record read while loading a wallet, and what it decoded to. */
+struct PendingWalletTx {
+    CDataStream ssKey;
+    CDataStream ssValue;
+    CWalletTx wtx;
+    bool fDecoded;
+    bool fUpgrade;
+    std::string strErr;
+
+    PendingWalletTx(CDataStream&& ssKeyIn, CDataStream&& ssValueIn) :
+        ssKey(std::move(ssKeyIn)), ssValue(std::move(ssValueIn)), fDecoded(false), fUpgrade(false) {}
+};
+
+static void DecodeWalletTxs(std::vector<PendingWalletTx>& vPending)
+{
+    std::atomic<size_t> nNext{0};
+    auto decode = [&]() {
+        for (size_t i = nNext++; i < vPending.size(); i = nNext++) {
+            PendingWalletTx& pending = vPending[i];
+            pending.fDecoded = DecodeWalletTx(pending.ssKey, pending.ssValue, pending.wtx, pending.fUpgrade, pending.strErr);
+        }
+    };
+    size_t nThreads = std::min(vPending.size(), (size_t)std::max(1, nScriptCheckThreads));
+    std::vector<std::thread> vThreads;
+    for (size_t i = 1; i < nThreads; i++) {
+        vThreads.emplace_back(decode);
+    }
+    decode();
+    for (std::thread& thread : vThreads) {
+        thread.join();
+    }
+}
+
 static bool IsKeyType(string strType)
 {
     return (strType== "key" || strType == "wkey" ||
@@ -942,6 +1008,43 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
             return DB_CORRUPT;
         }
 
+        // Try to be tolerant of single corrupt records:
+        auto recordFailed = [&](const string& strType) {
+            if (strType == "networkinfo") {
+                // example: running mainnet, but this wallet.dat is from testnet
+                result = DB_WRONG_NETWORK;
+            } else if (result != DB_WRONG_NETWORK && IsKeyType(strType)) {
+                // losing keys is considered a catastrophic error
+                LogPrintf("LoadWallet: Unable to read key/value for key type %s (%d)", strType, result);
+                result = DB_CORRUPT;
+            } else {
+                // Leave other errors alone, if we try to fix them we might make things worse.
+                fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
+                if (strType == "tx") {
+                    // Rescan if there is a bad transaction record:
+                    SoftSetBoolArg("-rescan", true);
+                }
+            }
+        };
+
+        // Transaction records are most of a large wallet, and are decoded by
+        // several threads a batch at a time. They are loaded in the order
+        // they were read, before any record that follows them.
+        std::vector<PendingWalletTx> vPendingTx;
+        auto loadPendingTx = [&]() {
+            DecodeWalletTxs(vPendingTx);
+            for (PendingWalletTx& pending : vPendingTx) {
+                if (pending.fDecoded) {
+                    LoadDecodedWalletTx(pwallet, pending.wtx, pending.fUpgrade, wss);
+                } else {
+                    recordFailed("tx");
+                }
+                if (!pending.strErr.empty())
+                    LogPrintf("LoadWallet: %s", pending.strErr);
+            }
+            vPendingTx.clear();
+        };
+
         while (true)
         {
             // Read next record
@@ -956,29 +1059,31 @@ DBErrors CWalletDB::LoadWallet(CWallet* pwallet)
                 return DB_CORRUPT;
             }
 
-            // Try to be tolerant of single corrupt records:
             string strType, strErr;
-            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
             {
-                if (strType == "networkinfo") {
-                    // example: running mainnet, but this wallet.dat is from testnet
-                    result = DB_WRONG_NETWORK;
-                } else if (result != DB_WRONG_NETWORK && IsKeyType(strType)) {
-                    // losing keys is considered a catastrophic error
-                    LogPrintf("LoadWallet: Unable to read key/value for key type %s (%d)", strType, result);
-                    result = DB_CORRUPT;
-                } else {
-                    // Leave other errors alone, if we try to fix them we might make things worse.
-                    fNoncriticalErrors = true; // ... but do warn the user there is something wrong.
-                    if (strType == "tx") {
-                        // Rescan if there is a bad transaction record:
-                        SoftSetBoolArg("-rescan", true);
-                    }
+                CDataStream ssType(ssKey);
+                try {
+                    ssType >> strType;
+                } catch (const std::ios_base::failure&) {
+                    strType.clear();
                 }
+                if (strType == "tx") {
+                    vPendingTx.emplace_back(std::move(ssType), std::move(ssValue));
+                    if (vPendingTx.size() >= WALLET_LOAD_TX_BATCH)
+                        loadPendingTx();
+                    continue;
+                }
+            }
+            loadPendingTx();
+
+            if (!ReadKeyValue(pwallet, ssKey, ssValue, wss, strType, strErr))
+            {
+                recordFailed(strType);
             }
             if (!strErr.empty())
                 LogPrintf("LoadWallet: %s", strErr);
         }
+        loadPendingTx();
         pcursor->close();
 
         // Load unified address/account/key caches based on what was loaded
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <stdexcept>
 
 
@@ -26,6 +27,26 @@ PedersenHash PedersenHash::combine(
     return res;
 }
 
+void PedersenHash::combine_all(
+    const PedersenHash* pairs,
+    size_t count,
+    size_t depth,
+    PedersenHash* out
+)
+{
+    static_assert(sizeof(PedersenHash) == 32, "PedersenHash arrays must be contiguous bytes");
+    if (count == 0) {
+        return;
+    }
+
+    librustzcash_merkle_hash_batch(
+        depth,
+        pairs[0].begin(),
+        count,
+        out[0].begin()
+    );
+}
+
 PedersenHash PedersenHash::uncommitted() {
     PedersenHash res = PedersenHash();
 
@@ -435,6 +456,18 @@ SHA256Compress SHA256Compress::combine(
     return res;
 }
 
+void SHA256Compress::combine_all(
+    const SHA256Compress* pairs,
+    size_t count,
+    size_t depth,
+    SHA256Compress* out
+)
+{
+    for (size_t i = 0; i < count; i++) {
+        out[i] = combine(pairs[2 * i], pairs[2 * i + 1], depth);
+    }
+}
+
 static const std::array<SHA256Compress, 66> sha256_empty_roots = {
     uint256(std::vector<unsigned char>{
         0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -838,21 +871,20 @@ SHA256Compress SHA256Compress::EmptyRoot(size_t depth) {
     return sha256_empty_roots.at(depth);
 }
 
+// Hands out the caller's filler hashes in order without copying them, and
+// then the empty roots.
 template <size_t Depth, typename Hash>
 class PathFiller {
 private:
-    std::deque<Hash> queue;
+    const std::deque<Hash>& queue;
+    size_t nNext;
     static EmptyMerkleRoots<Depth, Hash> emptyroots;
 public:
-    PathFiller() : queue() { }
-    PathFiller(std::deque<Hash> queue) : queue(queue) { }
+    PathFiller(const std::deque<Hash>& queue) : queue(queue), nNext(0) { }
 
     Hash next(size_t depth) {
-        if (queue.size() > 0) {
-            Hash h = queue.front();
-            queue.pop_front();
-
-            return h;
+        if (nNext < queue.size()) {
+            return queue[nNext++];
         } else {
             return emptyroots.empty_root(depth);
         }
@@ -896,6 +928,23 @@ Hash IncrementalMerkleTree<Depth, Hash>::last() const {
     }
 }
 
+template<size_t Depth, typename Hash>
+std::optional<Hash> IncrementalMerkleTree<Depth, Hash>::completed_subtree_root(size_t height) const {
+    assert(height >= 1 && height <= Depth);
+    size_t n = size();
+    if (n == 0 || n % (size_t(1) << height) != 0) {
+        return std::nullopt;
+    }
+
+    // The last object is a right leaf, and every subtree on its path below
+    // the given height is complete, so it is held in the parents.
+    Hash combined = Hash::combine(*left, *right, 0);
+    for (size_t i = 0; i + 1 < height; i++) {
+        combined = Hash::combine(*parents[i], combined, i+1);
+    }
+    return combined;
+}
+
 template<size_t Depth, typename Hash>
 size_t IncrementalMerkleTree<Depth, Hash>::size() const {
     size_t ret = 0;
@@ -921,6 +970,8 @@ void IncrementalMerkleTree<Depth, Hash>::append(Hash obj) {
         throw std::runtime_error("tree is full");
     }
 
+    cached_root = std::nullopt;
+
     if (!left) {
         // Set the left leaf
         left = obj;
@@ -952,6 +1003,79 @@ void IncrementalMerkleTree<Depth, Hash>::append(Hash obj) {
     }
 }
 
+// The leaves below the parents are combined a level at a time: at each level,
+// the nodes completed by the new objects are hashed in pairs, together with
+// the parent to their left if there is one, leaving the last node as the
+// parent if it has no sibling yet.
+template<size_t Depth, typename Hash>
+void IncrementalMerkleTree<Depth, Hash>::append_range(const Hash* first, const Hash* last) {
+    size_t count = last - first;
+    if (count == 0) {
+        return;
+    }
+    uint64_t nSize = size();
+    if (count > (uint64_t(1) << Depth) - nSize) {
+        throw std::runtime_error("tree is full");
+    }
+
+    cached_root = std::nullopt;
+
+    // The leaves not yet in the parents, followed by the new objects.
+    std::vector<Hash> nodes;
+    nodes.reserve(count + 2);
+    if (left) {
+        nodes.push_back(*left);
+    }
+    if (right) {
+        nodes.push_back(*right);
+    }
+    nodes.insert(nodes.end(), first, last);
+
+    // The number of leaves in the parents, before and after. The last one
+    // or two leaves stay in left and right.
+    uint64_t nNewSize = nSize + count;
+    uint64_t nStart = nSize - (left ? 1 : 0) - (right ? 1 : 0);
+    uint64_t nEnd = nNewSize - ((nNewSize - 1) % 2 + 1);
+    size_t nCombine = nEnd - nStart;
+    left = nodes[nCombine];
+    if (nCombine + 1 < nodes.size()) {
+        right = nodes[nCombine + 1];
+    } else {
+        right = std::nullopt;
+    }
+    nodes.resize(nCombine);
+
+    std::vector<Hash> combined;
+    size_t d = 0;
+    while (!nodes.empty()) {
+        combined.resize(nodes.size() / 2);
+        Hash::combine_all(nodes.data(), combined.size(), d, combined.data());
+        d++;
+
+        // The combined nodes are those from nStart >> d to nEnd >> d.
+        uint64_t a = nStart >> d;
+        uint64_t b = nEnd >> d;
+        if (parents.size() < d) {
+            parents.resize(d);
+        }
+        nodes.clear();
+        if (a & 1) {
+            nodes.push_back(*parents[d - 1]);
+        }
+        nodes.insert(nodes.end(), combined.begin(), combined.end());
+        if (b & 1) {
+            parents[d - 1] = nodes.back();
+            nodes.pop_back();
+        } else {
+            parents[d - 1] = std::nullopt;
+        }
+    }
+
+    while (!parents.empty() && !parents.back()) {
+        parents.pop_back();
+    }
+}
+
 // This is for allowing the witness to determine if a subtree has filled
 // to a particular depth, or for append() to ensure we're not appending
 // to a full tree.
@@ -1014,7 +1138,13 @@ size_t IncrementalMerkleTree<Depth, Hash>::next_depth(size_t skip) const {
 // This calculates the root of the tree.
 template<size_t Depth, typename Hash>
 Hash IncrementalMerkleTree<Depth, Hash>::root(size_t depth,
-                                              std::deque<Hash> filler_hashes) const {
+                                              const std::deque<Hash>& filler_hashes) const {
+    // Roots with filler hashes depend on the caller's uncles, so only the
+    // plain roots of the tree (and of witness cursors) are kept.
+    if (filler_hashes.empty() && cached_root && cached_root->first == depth) {
+        return cached_root->second;
+    }
+
     PathFiller<Depth, Hash> filler(filler_hashes);
 
     Hash combine_left =  left  ? *left  : filler.next(0);
@@ -1041,13 +1171,17 @@ Hash IncrementalMerkleTree<Depth, Hash>::root(size_t depth,
         d++;
     }
 
+    if (filler_hashes.empty()) {
+        cached_root = std::make_pair(depth, root);
+    }
+
     return root;
 }
 
 // This constructs an authentication path into the tree in the format that the circuit
 // wants. The caller provides `filler_hashes` to fill in the uncle subtrees.
 template<size_t Depth, typename Hash>
-MerklePath IncrementalMerkleTree<Depth, Hash>::path(std::deque<Hash> filler_hashes) const {
+MerklePath IncrementalMerkleTree<Depth, Hash>::path(const std::deque<Hash>& filler_hashes) const {
     if (!left) {
         throw std::runtime_error("can't create an authentication path for the beginning of the tree");
     }
@@ -1112,6 +1246,8 @@ std::deque<Hash> IncrementalWitness<Depth, Hash>::partial_path() const {
 
 template<size_t Depth, typename Hash>
 void IncrementalWitness<Depth, Hash>::append(Hash obj) {
+    cached_root = std::nullopt;
+
     if (cursor) {
         cursor->append(obj);
 
@@ -1135,6 +1271,101 @@ void IncrementalWitness<Depth, Hash>::append(Hash obj) {
     }
 }
 
+template<size_t Depth, typename Hash>
+void IncrementalWitness<Depth, Hash>::append_all(const std::vector<IncrementalWitness*>& witnesses, const std::vector<Hash>& objs) {
+    // Each group of witnesses has equal cursors; only the first member's
+    // cursor is kept, and it is only appended to, in one batch, when it
+    // fills up and at the end.
+    struct Group {
+        std::vector<IncrementalWitness*> members;
+        // The first object not yet appended to the cursor.
+        size_t nNext;
+        // The number of objects left until the cursor is complete.
+        uint64_t nLeft;
+    };
+    std::vector<Group> groups;
+    // The witnesses without a cursor.
+    std::vector<IncrementalWitness*> idle;
+
+    for (IncrementalWitness* w : witnesses) {
+        if (!objs.empty()) {
+            w->cached_root = std::nullopt;
+        }
+        if (!w->cursor) {
+            idle.push_back(w);
+            continue;
+        }
+        auto it = std::find_if(groups.begin(), groups.end(), [&](const Group& group) {
+            return group.members[0]->cursor_depth == w->cursor_depth && *group.members[0]->cursor == *w->cursor;
+        });
+        if (it == groups.end()) {
+            groups.push_back({{w}, 0, (uint64_t(1) << w->cursor_depth) - w->cursor->size()});
+        } else {
+            it->members.push_back(w);
+        }
+    }
+
+    for (size_t i = 0; i < objs.size(); i++) {
+        const Hash& obj = objs[i];
+        std::vector<IncrementalWitness*> nowIdle;
+
+        for (auto it = groups.begin(); it != groups.end(); ) {
+            if (--it->nLeft == 0) {
+                IncrementalWitness* first = it->members[0];
+                first->cursor->append_range(objs.data() + it->nNext, objs.data() + i + 1);
+                Hash root = first->cursor->root(first->cursor_depth);
+                for (IncrementalWitness* w : it->members) {
+                    w->filled.push_back(root);
+                    w->cursor = std::nullopt;
+                    nowIdle.push_back(w);
+                }
+                it = groups.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        // Witnesses starting a cursor at the same depth with this object
+        // have equal cursors from now on.
+        size_t nOldGroups = groups.size();
+        for (IncrementalWitness* w : idle) {
+            w->cursor_depth = w->tree.next_depth(w->filled.size());
+
+            if (w->cursor_depth >= Depth) {
+                throw std::runtime_error("tree is full");
+            }
+
+            if (w->cursor_depth == 0) {
+                w->filled.push_back(obj);
+                nowIdle.push_back(w);
+                continue;
+            }
+            auto it = std::find_if(groups.begin() + nOldGroups, groups.end(), [&](const Group& group) {
+                return group.members[0]->cursor_depth == w->cursor_depth;
+            });
+            if (it == groups.end()) {
+                // Cursors are at least two objects deep, so this one is not
+                // complete yet.
+                w->cursor = IncrementalMerkleTree<Depth, Hash>();
+                groups.push_back({{w}, i, (uint64_t(1) << w->cursor_depth) - 1});
+            } else {
+                it->members.push_back(w);
+            }
+        }
+
+        idle.swap(nowIdle);
+    }
+
+    for (const Group& group : groups) {
+        IncrementalWitness* first = group.members[0];
+        first->cursor->append_range(objs.data() + group.nNext, objs.data() + objs.size());
+        for (size_t i = 1; i < group.members.size(); i++) {
+            group.members[i]->cursor = first->cursor;
+            group.members[i]->cursor_depth = first->cursor_depth;
+        }
+    }
+}
+
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH, SHA256Compress>;
 template class IncrementalMerkleTree<INCREMENTAL_MERKLE_TREE_DEPTH_TESTING, SHA256Compress>;
 
@@ -4,6 +4,7 @@
 #include <array>
 #include <deque>
 #include <optional>
+#include <utility>
 
 #include "uint256.h"
 #include "serialize.h"
@@ -98,10 +99,20 @@ public:
     size_t size() const;
 
     void append(Hash obj);
+    // Append the objects in order, with the same result as appending them
+    // one at a time. Each level of the tree is hashed in one batch.
+    void append_many(const std::vector<Hash>& objs) {
+        append_range(objs.data(), objs.data() + objs.size());
+    }
     Hash root() const {
-        return root(Depth, std::deque<Hash>());
+        // An empty deque allocates, so one is shared by every call.
+        static const std::deque<Hash> no_filler;
+        return root(Depth, no_filler);
     }
     Hash last() const;
+    // If the last object appended completed a subtree of 2^height objects,
+    // the root of that subtree.
+    std::optional<Hash> completed_subtree_root(size_t height) const;
 
     IncrementalWitness<Depth, Hash> witness() const {
         return IncrementalWitness<Depth, Hash>(*this);
@@ -115,6 +126,10 @@ public:
         READWRITE(right);
         READWRITE(parents);
 
+        if (ser_action.ForRead()) {
+            cached_root = std::nullopt;
+        }
+
         wfcheck();
     }
 
@@ -133,10 +148,14 @@ private:
 
     // Collapsed "left" subtrees ordered toward the root of the tree.
     std::vector<std::optional<Hash>> parents;
-    MerklePath path(std::deque<Hash> filler_hashes = std::deque<Hash>()) const;
-    Hash root(size_t depth, std::deque<Hash> filler_hashes = std::deque<Hash>()) const;
+    // The depth and root last computed without filler hashes, until the
+    // next append. Not compared or serialized.
+    mutable std::optional<std::pair<size_t, Hash>> cached_root;
+    MerklePath path(const std::deque<Hash>& filler_hashes = std::deque<Hash>()) const;
+    Hash root(size_t depth, const std::deque<Hash>& filler_hashes = std::deque<Hash>()) const;
     bool is_complete(size_t depth = Depth) const;
     size_t next_depth(size_t skip) const;
+    void append_range(const Hash* first, const Hash* last);
     void wfcheck() const;
 };
 
@@ -172,11 +191,21 @@ public:
     }
 
     Hash root() const {
-        return tree.root(Depth, partial_path());
+        if (!cached_root) {
+            cached_root = tree.root(Depth, partial_path());
+        }
+        return *cached_root;
     }
 
     void append(Hash obj);
 
+    // Append the same objects to each of the witnesses, with the same result
+    // as appending them to each witness in turn. A witness's cursor only
+    // depends on its depth and the position of the next object, so the
+    // witnesses with equal cursors share one, and the cost is about that of
+    // appending to one witness per distinct cursor depth.
+    static void append_all(const std::vector<IncrementalWitness*>& witnesses, const std::vector<Hash>& objs);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -186,6 +215,9 @@ public:
         READWRITE(cursor);
 
         cursor_depth = tree.next_depth(filled.size());
+        if (ser_action.ForRead()) {
+            cached_root = std::nullopt;
+        }
     }
 
     template <size_t D, typename H>
@@ -197,6 +229,8 @@ private:
     std::vector<Hash> filled;
     std::optional<IncrementalMerkleTree<Depth, Hash>> cursor;
     size_t cursor_depth = 0;
+    // The root, until the next append. Not compared or serialized.
+    mutable std::optional<Hash> cached_root;
     std::deque<Hash> partial_path() const;
     IncrementalWitness(IncrementalMerkleTree<Depth, Hash> tree) : tree(tree) {}
 };
@@ -220,6 +254,14 @@ public:
         const SHA256Compress& b,
         size_t depth
     );
+    // Combine the `count` pairs of nodes at `pairs`, each left then right,
+    // into `out`.
+    static void combine_all(
+        const SHA256Compress* pairs,
+        size_t count,
+        size_t depth,
+        SHA256Compress* out
+    );
 
     static SHA256Compress uncommitted() {
         return SHA256Compress();
@@ -237,6 +279,14 @@ public:
         const PedersenHash& b,
         size_t depth
     );
+    // Combine the `count` pairs of nodes at `pairs`, each left then right,
+    // into `out`.
+    static void combine_all(
+        const PedersenHash* pairs,
+        size_t count,
+        size_t depth,
+        PedersenHash* out
+    );
 
     static PedersenHash uncommitted();
     static PedersenHash EmptyRoot(size_t);
@@ -321,6 +371,20 @@ public:
        return orchard_merkle_frontier_append_bundle(inner.get(), bundle.inner.get());
     }
 
+    // Append the bundle as AppendBundle does, also returning the roots of
+    // the subtrees of 2^height leaves that it completes.
+    bool AppendBundleSubtrees(const OrchardBundle& bundle, uint8_t height, std::vector<uint256>& vRoots) {
+        std::vector<uint256> vCompleted((bundle.GetNumActions() >> height) + 1);
+        size_t nCompleted = 0;
+        if (!orchard_merkle_frontier_append_bundle_subtrees(
+                inner.get(), bundle.inner.get(), height,
+                vCompleted[0].begin(), vCompleted.size(), &nCompleted)) {
+            return false;
+        }
+        vRoots.insert(vRoots.end(), vCompleted.begin(), vCompleted.begin() + nCompleted);
+        return true;
+    }
+
     const uint256 root() const {
         uint256 value;
         orchard_merkle_frontier_root(inner.get(), value.begin());
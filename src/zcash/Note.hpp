@@ -169,6 +169,18 @@ public:
         const uint256 &cmu
     );
 
+    // As above, given the Diffie-Hellman secret of epk and ivk from
+    // SaplingKeyAgreementBatch.
+    static std::optional<SaplingNotePlaintext> decrypt_with_dhsecret(
+        const Consensus::Params& params,
+        int height,
+        const SaplingEncCiphertext &ciphertext,
+        const uint256 &ivk,
+        const uint256 &epk,
+        const uint256 &cmu,
+        const uint256 &dhsecret
+    );
+
     static std::optional<SaplingNotePlaintext> plaintext_checks_without_height(
         const SaplingNotePlaintext &plaintext,
         const uint256 &ivk,
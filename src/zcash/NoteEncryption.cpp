@@ -2,6 +2,7 @@
 
 #include "random.h"
 
+#include <memory>
 #include <stdexcept>
 #include "sodium.h"
 #include "prf.h"
@@ -179,6 +180,75 @@ std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     return plaintext;
 }
 
+bool SaplingKeyAgreementBatch(
+    const uint256 &epk,
+    const std::vector<uint256> &ivks,
+    std::vector<std::optional<uint256>> &dhsecrets
+)
+{
+    dhsecrets.assign(ivks.size(), std::nullopt);
+
+    std::vector<unsigned char> vIvks(ivks.size() * 32);
+    for (size_t i = 0; i < ivks.size(); i++) {
+        memcpy(vIvks.data() + i * 32, ivks[i].begin(), 32);
+    }
+    std::vector<unsigned char> vSecrets(ivks.size() * 32);
+    std::unique_ptr<bool[]> valid(new bool[ivks.size()]);
+
+    // ZIP 216: as in AttemptSaplingEncDecryption.
+    if (!librustzcash_sapling_ka_agree_batch(
+        true, epk.begin(), vIvks.data(), ivks.size(), vSecrets.data(), valid.get()))
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < ivks.size(); i++) {
+        if (valid[i]) {
+            uint256 dhsecret;
+            memcpy(dhsecret.begin(), vSecrets.data() + i * 32, 32);
+            dhsecrets[i] = dhsecret;
+        }
+    }
+    return true;
+}
+
+std::optional<SaplingEncPlaintext> AttemptSaplingNoteDecryption(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &dhsecret,
+    const uint256 &epk
+)
+{
+    // Construct the symmetric key
+    unsigned char K[NOTEENCRYPTION_CIPHER_KEYSIZE];
+    KDF_Sapling(K, dhsecret, epk);
+
+    // The nonce is zero because we never reuse keys
+    unsigned char cipher_nonce[crypto_aead_chacha20poly1305_IETF_NPUBBYTES] = {};
+
+    // The message is encrypted from block 1 of the ChaCha20 stream (block 0
+    // keys Poly1305), so its lead byte can be decrypted on its own.
+    unsigned char leadbyte;
+    crypto_stream_chacha20_ietf_xor_ic(&leadbyte, ciphertext.begin(), 1, cipher_nonce, 1, K);
+    if (leadbyte != 0x01 && leadbyte != 0x02) {
+        return std::nullopt;
+    }
+
+    SaplingEncPlaintext plaintext;
+
+    if (crypto_aead_chacha20poly1305_ietf_decrypt(
+        plaintext.begin(), NULL,
+        NULL,
+        ciphertext.begin(), ZC_SAPLING_ENCCIPHERTEXT_SIZE,
+        NULL,
+        0,
+        cipher_nonce, K) != 0)
+    {
+        return std::nullopt;
+    }
+
+    return plaintext;
+}
+
 std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
     bool zip216Enabled,
     const SaplingEncCiphertext &ciphertext,
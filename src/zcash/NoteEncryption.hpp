@@ -14,6 +14,7 @@ https://github.com/zcash/zips/blob/master/protocol/protocol.pdf
 
 #include <array>
 #include <optional>
+#include <vector>
 
 namespace libzcash {
 
@@ -74,6 +75,27 @@ std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption(
     const uint256 &epk
 );
 
+// Computes the Diffie-Hellman secret of a Sapling ephemeral key with each of
+// the given incoming viewing keys, as AttemptSaplingEncDecryption does for
+// one, decoding epk only once. Returns false if epk is invalid; otherwise
+// sets the secret of each valid key, at the same index.
+bool SaplingKeyAgreementBatch(
+    const uint256 &epk,
+    const std::vector<uint256> &ivks,
+    std::vector<std::optional<uint256>> &dhsecrets
+);
+
+// Attempts to decrypt a Sapling note plaintext, given the Diffie-Hellman
+// secret of the ephemeral key and the incoming viewing key. Ciphertexts whose
+// plaintext does not start with a note plaintext lead byte (0x01 or 0x02) are
+// rejected before the tag is checked, which rules out almost all keys that
+// are not the recipient's.
+std::optional<SaplingEncPlaintext> AttemptSaplingNoteDecryption(
+    const SaplingEncCiphertext &ciphertext,
+    const uint256 &dhsecret,
+    const uint256 &epk
+);
+
 // Attempts to decrypt a Sapling note using outgoing plaintext.
 // This will not check that the contents of the ciphertext are correct.
 std::optional<SaplingEncPlaintext> AttemptSaplingEncDecryption (
@@ -209,6 +209,17 @@ double benchmark_verify_equihash()
     return timer_stop(tv_start);
 }
 
+double benchmark_verify_equihash_batch(size_t nHeaders)
+{
+    CChainParams params = Params(CBaseChainParams::MAIN);
+    CBlock genesis = params.GenesisBlock();
+    std::vector<CBlockHeader> headers(nHeaders, genesis.GetBlockHeader());
+    struct timeval tv_start;
+    timer_start(tv_start);
+    assert(CheckEquihashSolutions(headers, params.GetConsensus()));
+    return timer_stop(tv_start);
+}
+
 double benchmark_large_tx(size_t nInputs)
 {
     // Create priv/pub key
@@ -435,8 +446,9 @@ double benchmark_increment_sapling_note_witnesses(size_t nTxs)
 
 // Fake the input of a given block
 // This class is based on the class CCoinsViewDB, but with limited functionality.
-// The constructor and the functions `GetCoins` and `HaveCoins` come directly from
-// CCoinsViewDB, but the rest are either mocks and/or don't really do anything.
+// The constructor comes directly from CCoinsViewDB, and `GetCoin` and `HaveCoin`
+// read the legacy per-transaction records that the benchmark databases were
+// generated with. The rest are either mocks and/or don't really do anything.
 
 // The following constant is a duplicate of the one found in txdb.cpp
 static const char DB_COINS = 'c';
@@ -521,12 +533,20 @@ public:
         return false;
     }
 
-    bool GetCoins(const uint256 &txid, CCoins &coins) const {
-        return db.Read(std::make_pair(DB_COINS, txid), coins);
+    bool GetCoin(const COutPoint &outpoint, Coin &coin) const {
+        CLegacyCoins coins;
+        if (!db.Read(std::make_pair(DB_COINS, outpoint.hash), coins) ||
+            outpoint.n >= coins.vout.size() ||
+            coins.vout[outpoint.n].IsNull()) {
+            return false;
+        }
+        coin = Coin(std::move(coins.vout[outpoint.n]), coins.nHeight, coins.fCoinBase);
+        return true;
     }
 
-    bool HaveCoins(const uint256 &txid) const {
-        return db.Exists(std::make_pair(DB_COINS, txid));
+    bool HaveCoin(const COutPoint &outpoint) const {
+        Coin coin;
+        return GetCoin(outpoint, coin);
     }
 
     uint256 GetBestBlock() const {
@@ -742,6 +762,34 @@ double benchmark_listunspent()
     return timer_stop(tv_start);
 }
 
+double benchmark_select_coins(size_t nCoins)
+{
+    // Coins of random values below 1 ZEC, spending a third of their total.
+    std::vector<CWalletTx> vWtx;
+    vWtx.reserve(nCoins);
+    CAmount nTotal = 0;
+    for (size_t i = 0; i < nCoins; i++) {
+        CMutableTransaction mtx;
+        mtx.nLockTime = i;
+        mtx.vout.resize(1);
+        mtx.vout[0].nValue = 1000 + GetRand(COIN);
+        nTotal += mtx.vout[0].nValue;
+        vWtx.emplace_back(nullptr, mtx);
+    }
+    std::vector<COutput> vCoins;
+    for (const CWalletTx& wtx : vWtx) {
+        vCoins.emplace_back(&wtx, 0, 100, true);
+    }
+
+    std::set<std::pair<const CWalletTx*, unsigned int>> setCoins;
+    CAmount nValue;
+    struct timeval tv_start;
+    timer_start(tv_start);
+    assert(CWallet::SelectCoinsBnB(nTotal / 3, 1000, 1, 1, vCoins, setCoins, nValue) ||
+           CWallet::SelectCoinsMinConf(nTotal / 3, 1, 1, vCoins, setCoins, nValue));
+    return timer_stop(tv_start);
+}
+
 double benchmark_create_sapling_spend()
 {
     auto sk = libzcash::SaplingSpendingKey::random();
@@ -794,6 +842,19 @@ double benchmark_create_sapling_spend()
     return t;
 }
 
+std::vector<double> benchmark_create_sapling_spend_threaded(int nThreads)
+{
+    std::vector<double> ret;
+    std::vector<std::future<double>> tasks;
+    for (int i = 0; i < nThreads; i++) {
+        tasks.emplace_back(std::async(std::launch::async, &benchmark_create_sapling_spend));
+    }
+    for (auto& task : tasks) {
+        ret.push_back(task.get());
+    }
+    return ret;
+}
+
 double benchmark_create_sapling_output()
 {
     auto sk = libzcash::SaplingSpendingKey::random();
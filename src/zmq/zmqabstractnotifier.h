@@ -33,9 +33,16 @@ public:
     virtual bool Initialize(void *pcontext) = 0;
     virtual void Shutdown() = 0;
 
-    virtual bool NotifyBlock(const CBlockIndex *pindex);
+    // These are called on the publishing thread. pblock is the tip block
+    // if it was in memory, and NULL otherwise.
+    virtual bool NotifyBlock(const CBlockIndex *pindex, const CBlock *pblock);
     virtual bool NotifyBlock(const CBlock& pblock);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    // Every block connected to or disconnected from the active chain, in order.
+    virtual bool NotifyBlockConnected(const CBlock &block, const CBlockIndex *pindex);
+    virtual bool NotifyBlockDisconnected(const CBlock &block, const CBlockIndex *pindex);
+    virtual bool NotifyTransactionAcceptance(const CTransaction &transaction, uint64_t nMempoolSequence);
+    virtual bool NotifyTransactionRemoval(const CTransaction &transaction, uint64_t nMempoolSequence);
 
 protected:
     void *psocket;
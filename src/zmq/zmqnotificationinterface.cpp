@@ -11,12 +11,14 @@
 #include "streams.h"
 #include "util/system.h"
 
+#include <memory>
+
 void zmqError(const char *str)
 {
     LogPrint("zmq", "zmq: Error: %s, errno=%s\n", str, zmq_strerror(errno));
 }
 
-CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL)
+CZMQNotificationInterface::CZMQNotificationInterface() : pcontext(NULL), fChainEvents(false), fMempoolEvents(false), fInterrupt(false)
 {
 }
 
@@ -41,6 +43,10 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
     factories["pubcheckedblock"] = CZMQAbstractNotifier::Create<CZMQPublishCheckedBlockNotifier>;
+    factories["pubcompactblock"] = CZMQAbstractNotifier::Create<CZMQPublishCompactBlockNotifier>;
+    factories["pubnullifiers"] = CZMQAbstractNotifier::Create<CZMQPublishNullifiersNotifier>;
+    factories["pubsequence"] = CZMQAbstractNotifier::Create<CZMQPublishSequenceNotifier>;
+    factories["pubcompactmempooltx"] = CZMQAbstractNotifier::Create<CZMQPublishCompactMempoolTxNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -60,6 +66,8 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     {
         notificationInterface = new CZMQNotificationInterface();
         notificationInterface->notifiers = notifiers;
+        notificationInterface->fChainEvents = args.count("-zmqpubcompactblock") || args.count("-zmqpubnullifiers") || args.count("-zmqpubsequence");
+        notificationInterface->fMempoolEvents = args.count("-zmqpubsequence") || args.count("-zmqpubcompactmempooltx");
 
         if (!notificationInterface->Initialize())
         {
@@ -109,6 +117,7 @@ bool CZMQNotificationInterface::Initialize()
         return false;
     }
 
+    threadPublish = std::thread(&TraceThread<std::function<void()>>, "zmqpub", std::function<void()>([this] { ThreadPublish(); }));
     return true;
 }
 
@@ -116,6 +125,15 @@ bool CZMQNotificationInterface::Initialize()
 void CZMQNotificationInterface::Shutdown()
 {
     LogPrint("zmq", "zmq: Shutdown notification interface\n");
+    {
+        LOCK(cs);
+        fInterrupt = true;
+        condPublish.notify_all();
+    }
+    if (threadPublish.joinable())
+    {
+        threadPublish.join();
+    }
     if (pcontext)
     {
         for (std::list<CZMQAbstractNotifier*>::iterator i=notifiers.begin(); i!=notifiers.end(); ++i)
@@ -130,57 +148,110 @@ void CZMQNotificationInterface::Shutdown()
     }
 }
 
-void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
+void CZMQNotificationInterface::Enqueue(Publication publication)
 {
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
+    LOCK(cs);
+    queue.push_back(std::move(publication));
+    condPublish.notify_one();
+}
+
+void CZMQNotificationInterface::ThreadPublish()
+{
+    while (true)
     {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(pindex))
+        Publication publication;
         {
-            i++;
+            WAIT_LOCK(cs, lock);
+            condPublish.wait(lock, [this] { return fInterrupt || !queue.empty(); });
+            // Notifications still queued at shutdown are dropped.
+            if (fInterrupt)
+                return;
+            publication = std::move(queue.front());
+            queue.pop_front();
         }
-        else
+
+        for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
         {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
+            CZMQAbstractNotifier *notifier = *i;
+            if (publication(notifier))
+            {
+                i++;
+            }
+            else
+            {
+                notifier->Shutdown();
+                i = notifiers.erase(i);
+            }
         }
     }
 }
 
+void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex, const CBlock *pblock)
+{
+    std::shared_ptr<const CBlock> block = pblock ? std::make_shared<const CBlock>(*pblock) : nullptr;
+    Enqueue([pindex, block](CZMQAbstractNotifier *notifier) {
+        return notifier->NotifyBlock(pindex, block.get());
+    });
+}
+
 void CZMQNotificationInterface::BlockChecked(const CBlock& block, const CValidationState& state)
 {
     if (state.IsInvalid()) {
         return;
     }
 
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyBlock(block))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
-    }
+    std::shared_ptr<const CBlock> pblock = std::make_shared<const CBlock>(block);
+    Enqueue([pblock](CZMQAbstractNotifier *notifier) {
+        return notifier->NotifyBlock(*pblock);
+    });
 }
 
 void CZMQNotificationInterface::SyncTransaction(const CTransaction &tx, const CBlock *pblock, const int nHeight)
 {
-    for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
-    {
-        CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx))
-        {
-            i++;
-        }
-        else
-        {
-            notifier->Shutdown();
-            i = notifiers.erase(i);
-        }
+    std::shared_ptr<const CTransaction> ptx = std::make_shared<const CTransaction>(tx);
+    Enqueue([ptx](CZMQAbstractNotifier *notifier) {
+        return notifier->NotifyTransaction(*ptx);
+    });
+}
+
+void CZMQNotificationInterface::ChainTip(const CBlockIndex *pindex, const CBlock *pblock, std::optional<MerkleFrontiers> added)
+{
+    if (!fChainEvents) {
+        return;
+    }
+
+    std::shared_ptr<const CBlock> block = std::make_shared<const CBlock>(*pblock);
+    if (added) {
+        Enqueue([pindex, block](CZMQAbstractNotifier *notifier) {
+            return notifier->NotifyBlockConnected(*block, pindex);
+        });
+    } else {
+        Enqueue([pindex, block](CZMQAbstractNotifier *notifier) {
+            return notifier->NotifyBlockDisconnected(*block, pindex);
+        });
     }
 }
+
+void CZMQNotificationInterface::TransactionAddedToMempool(const CTransaction &tx, uint64_t nMempoolSequence)
+{
+    if (!fMempoolEvents) {
+        return;
+    }
+
+    std::shared_ptr<const CTransaction> ptx = std::make_shared<const CTransaction>(tx);
+    Enqueue([ptx, nMempoolSequence](CZMQAbstractNotifier *notifier) {
+        return notifier->NotifyTransactionAcceptance(*ptx, nMempoolSequence);
+    });
+}
+
+void CZMQNotificationInterface::TransactionRemovedFromMempool(const CTransaction &tx, uint64_t nMempoolSequence)
+{
+    if (!fMempoolEvents) {
+        return;
+    }
+
+    std::shared_ptr<const CTransaction> ptx = std::make_shared<const CTransaction>(tx);
+    Enqueue([ptx, nMempoolSequence](CZMQAbstractNotifier *notifier) {
+        return notifier->NotifyTransactionRemoval(*ptx, nMempoolSequence);
+    });
+}
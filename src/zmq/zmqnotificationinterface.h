@@ -8,8 +8,13 @@
 
 #include "validationinterface.h"
 #include "consensus/validation.h"
+#include "sync.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <string>
 #include <map>
+#include <thread>
 
 class CBlockIndex;
 class CZMQAbstractNotifier;
@@ -27,14 +32,37 @@ protected:
 
     // CValidationInterface
     void SyncTransaction(const CTransaction &tx, const CBlock *pblock, const int nHeight);
-    void UpdatedBlockTip(const CBlockIndex *pindex);
+    void UpdatedBlockTip(const CBlockIndex *pindex, const CBlock *pblock);
     void BlockChecked(const CBlock& block, const CValidationState& state);
+    void ChainTip(const CBlockIndex *pindex, const CBlock *pblock, std::optional<MerkleFrontiers> added);
+    void TransactionAddedToMempool(const CTransaction &tx, uint64_t nMempoolSequence);
+    void TransactionRemovedFromMempool(const CTransaction &tx, uint64_t nMempoolSequence);
 
 private:
     CZMQNotificationInterface();
 
+    //! Publishes a notification with one notifier, returning false if it failed.
+    typedef std::function<bool(CZMQAbstractNotifier*)> Publication;
+
+    //! Queue a notification to be published by every notifier. The callbacks
+    //! only copy what they publish, so that the serialization and sending
+    //! happen on the publishing thread, off the validation threads.
+    void Enqueue(Publication publication);
+    void ThreadPublish();
+
     void *pcontext;
+    //! Only used by the publishing thread once it has started.
     std::list<CZMQAbstractNotifier*> notifiers;
+    //! Whether a notifier publishes each connected and disconnected block,
+    //! and mempool changes; the others are not queued.
+    bool fChainEvents;
+    bool fMempoolEvents;
+
+    Mutex cs;
+    std::condition_variable condPublish;
+    std::deque<Publication> queue;
+    bool fInterrupt;
+    std::thread threadPublish;
 };
 
 #endif // BITCOIN_ZMQ_ZMQNOTIFICATIONINTERFACE_H
@@ -5,6 +5,7 @@
 
 #include "chainparams.h"
 #include "zmqpublishnotifier.h"
+#include "compactblocks.h"
 #include "main.h"
 #include "util/system.h"
 
@@ -15,6 +16,10 @@ static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
 static const char *MSG_CHECKEDBLOCK = "checkedblock";
+static const char *MSG_COMPACTBLOCK = "compactblock";
+static const char *MSG_NULLIFIERS   = "nullifiers";
+static const char *MSG_SEQUENCE     = "sequence";
+static const char *MSG_COMPACTMEMPOOLTX = "compactmempooltx";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -142,7 +147,7 @@ bool CZMQAbstractPublishNotifier::SendMessage(const char *command, const void* d
     return true;
 }
 
-bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishHashBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const CBlock *pblock)
 {
     uint256 hash = pindex->GetBlockHash();
     LogPrint("zmq", "zmq: Publish hashblock %s\n", hash.GetHex());
@@ -162,13 +167,15 @@ bool CZMQPublishHashTransactionNotifier::NotifyTransaction(const CTransaction &t
     return SendMessage(MSG_HASHTX, data, 32);
 }
 
-bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex)
+bool CZMQPublishRawBlockNotifier::NotifyBlock(const CBlockIndex *pindex, const CBlock *pblock)
 {
     LogPrint("zmq", "zmq: Publish rawblock %s\n", pindex->GetBlockHash().GetHex());
 
     const Consensus::Params& consensusParams = Params().GetConsensus();
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
+    if (pblock) {
+        ss << *pblock;
+    } else {
         LOCK(cs_main);
         CBlock block;
         if(!ReadBlockFromDisk(block, pindex, consensusParams))
@@ -188,10 +195,7 @@ bool CZMQPublishCheckedBlockNotifier::NotifyBlock(const CBlock& block)
     LogPrint("zmq", "zmq: Publish checkedblock %s\n", block.GetHash().GetHex());
 
     CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
-    {
-        LOCK(cs_main);
-        ss << block;
-    }
+    ss << block;
 
     return SendMessage(MSG_CHECKEDBLOCK, &(*ss.begin()), ss.size());
 }
@@ -204,3 +208,102 @@ bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     ss << transaction;
     return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
 }
+
+bool CZMQPublishCompactBlockNotifier::NotifyBlockConnected(const CBlock &block, const CBlockIndex *pindex)
+{
+    LogPrint("zmq", "zmq: Publish compactblock %s\n", pindex->GetBlockHash().GetHex());
+    CCompactBlockCache::Entry entry;
+    {
+        // For the sizes of the note commitment trees.
+        LOCK(cs_main);
+        entry = GetCompactBlock(pindex, &block);
+    }
+    return SendMessage(MSG_COMPACTBLOCK, entry->data(), entry->size());
+}
+
+bool CZMQPublishNullifiersNotifier::Publish(const CBlock &block, const CBlockIndex *pindex, bool fConnected)
+{
+    LogPrint("zmq", "zmq: Publish nullifiers %s\n", pindex->GetBlockHash().GetHex());
+    std::vector<uint256> vSprout, vSapling, vOrchard;
+    for (const CTransaction& tx : block.vtx) {
+        for (const JSDescription& joinsplit : tx.vJoinSplit) {
+            vSprout.insert(vSprout.end(), joinsplit.nullifiers.begin(), joinsplit.nullifiers.end());
+        }
+        for (const SpendDescription& spend : tx.vShieldedSpend) {
+            vSapling.push_back(spend.nullifier);
+        }
+        for (const uint256& nullifier : tx.GetOrchardBundle().GetNullifiers()) {
+            vOrchard.push_back(nullifier);
+        }
+    }
+
+    // The block hash and height, whether the block was connected (1) or
+    // disconnected (0), then the Sprout, Sapling and Orchard nullifiers.
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << pindex->GetBlockHash() << (uint32_t)pindex->nHeight << (uint8_t)fConnected;
+    ss << vSprout << vSapling << vOrchard;
+    return SendMessage(MSG_NULLIFIERS, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishNullifiersNotifier::NotifyBlockConnected(const CBlock &block, const CBlockIndex *pindex)
+{
+    return Publish(block, pindex, true);
+}
+
+bool CZMQPublishNullifiersNotifier::NotifyBlockDisconnected(const CBlock &block, const CBlockIndex *pindex)
+{
+    return Publish(block, pindex, false);
+}
+
+bool CZMQPublishSequenceNotifier::Publish(const uint256 &hash, char label, std::optional<uint64_t> nMempoolSequence)
+{
+    LogPrint("zmq", "zmq: Publish sequence %s %c\n", hash.GetHex(), label);
+    // The hash in the same byte order as hashblock and hashtx, the label,
+    // and for mempool changes their LE 8byte mempool sequence number.
+    unsigned char data[sizeof(uint256) + 1 + sizeof(uint64_t)];
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = hash.begin()[i];
+    data[32] = label;
+    size_t size = 33;
+    if (nMempoolSequence) {
+        WriteLE64(&data[33], *nMempoolSequence);
+        size += sizeof(uint64_t);
+    }
+    return SendMessage(MSG_SEQUENCE, data, size);
+}
+
+bool CZMQPublishSequenceNotifier::NotifyBlockConnected(const CBlock &block, const CBlockIndex *pindex)
+{
+    return Publish(pindex->GetBlockHash(), 'C', std::nullopt);
+}
+
+bool CZMQPublishSequenceNotifier::NotifyBlockDisconnected(const CBlock &block, const CBlockIndex *pindex)
+{
+    return Publish(pindex->GetBlockHash(), 'D', std::nullopt);
+}
+
+bool CZMQPublishSequenceNotifier::NotifyTransactionAcceptance(const CTransaction &transaction, uint64_t nMempoolSequence)
+{
+    return Publish(transaction.GetHash(), 'A', nMempoolSequence);
+}
+
+bool CZMQPublishSequenceNotifier::NotifyTransactionRemoval(const CTransaction &transaction, uint64_t nMempoolSequence)
+{
+    return Publish(transaction.GetHash(), 'R', nMempoolSequence);
+}
+
+bool CZMQPublishCompactMempoolTxNotifier::NotifyTransactionAcceptance(const CTransaction &transaction, uint64_t nMempoolSequence)
+{
+    LogPrint("zmq", "zmq: Publish compactmempooltx %s A\n", transaction.GetHash().GetHex());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << nMempoolSequence << (uint8_t)'A' << MakeCompactTx(transaction, 0);
+    return SendMessage(MSG_COMPACTMEMPOOLTX, &(*ss.begin()), ss.size());
+}
+
+bool CZMQPublishCompactMempoolTxNotifier::NotifyTransactionRemoval(const CTransaction &transaction, uint64_t nMempoolSequence)
+{
+    LogPrint("zmq", "zmq: Publish compactmempooltx %s R\n", transaction.GetHash().GetHex());
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << nMempoolSequence << (uint8_t)'R' << transaction.GetHash();
+    return SendMessage(MSG_COMPACTMEMPOOLTX, &(*ss.begin()), ss.size());
+}
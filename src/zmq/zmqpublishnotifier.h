@@ -8,6 +8,8 @@
 
 #include "zmqabstractnotifier.h"
 
+#include <optional>
+
 class CBlockIndex;
 
 class CZMQAbstractPublishNotifier : public CZMQAbstractNotifier
@@ -32,7 +34,7 @@ public:
 class CZMQPublishHashBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex);
+    bool NotifyBlock(const CBlockIndex *pindex, const CBlock *pblock);
 };
 
 class CZMQPublishHashTransactionNotifier : public CZMQAbstractPublishNotifier
@@ -44,7 +46,7 @@ public:
 class CZMQPublishRawBlockNotifier : public CZMQAbstractPublishNotifier
 {
 public:
-    bool NotifyBlock(const CBlockIndex *pindex);
+    bool NotifyBlock(const CBlockIndex *pindex, const CBlock *pblock);
 };
 
 class CZMQPublishRawTransactionNotifier : public CZMQAbstractPublishNotifier
@@ -59,4 +61,58 @@ public:
     bool NotifyBlock(const CBlock &block);
 };
 
+/** Publishes the compact form of each connected block (see compactblocks.h). */
+class CZMQPublishCompactBlockNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyBlockConnected(const CBlock &block, const CBlockIndex *pindex);
+};
+
+/**
+ * Publishes the shielded nullifiers revealed by each connected block, and
+ * those of each disconnected block, which are unspent again.
+ */
+class CZMQPublishNullifiersNotifier : public CZMQAbstractPublishNotifier
+{
+private:
+    bool Publish(const CBlock &block, const CBlockIndex *pindex, bool fConnected);
+
+public:
+    bool NotifyBlockConnected(const CBlock &block, const CBlockIndex *pindex);
+    bool NotifyBlockDisconnected(const CBlock &block, const CBlockIndex *pindex);
+};
+
+/**
+ * Publishes a hash and a label for each change to the active chain and the
+ * mempool: C and D for a block connected and disconnected, and A and R for a
+ * transaction added to and removed from the mempool, followed by the
+ * mempool sequence number of the change.
+ */
+class CZMQPublishSequenceNotifier : public CZMQAbstractPublishNotifier
+{
+private:
+    bool Publish(const uint256 &hash, char label, std::optional<uint64_t> nMempoolSequence);
+
+public:
+    bool NotifyBlockConnected(const CBlock &block, const CBlockIndex *pindex);
+    bool NotifyBlockDisconnected(const CBlock &block, const CBlockIndex *pindex);
+    bool NotifyTransactionAcceptance(const CTransaction &transaction, uint64_t nMempoolSequence);
+    bool NotifyTransactionRemoval(const CTransaction &transaction, uint64_t nMempoolSequence);
+};
+
+/**
+ * Publishes each transaction added to and removed from the mempool, for
+ * light wallet servers to follow the mempool without polling it: the LE
+ * 8byte mempool sequence number of the change, the label A or R, and then
+ * the compact form of an added transaction (see compactblocks.h), or the
+ * txid of a removed one, serialized as in the compact form. Every change is published, so a gap in the
+ * mempool sequence numbers means that messages were dropped.
+ */
+class CZMQPublishCompactMempoolTxNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyTransactionAcceptance(const CTransaction &transaction, uint64_t nMempoolSequence);
+    bool NotifyTransactionRemoval(const CTransaction &transaction, uint64_t nMempoolSequence);
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H